@@ -0,0 +1,26 @@
+# - Try to find libblake3
+# Once done this will define
+#  BLAKE3_FOUND        - System has libblake3
+#  BLAKE3_INCLUDE_DIRS - The libblake3 include directories
+#  BLAKE3_LIBRARIES    - The libraries needed to use libblake3
+
+find_path(BLAKE3_INCLUDE_DIR
+  NAMES blake3.h
+)
+find_library(BLAKE3_LIBRARY
+  NAMES blake3
+)
+
+include(FindPackageHandleStandardArgs)
+# handle the QUIETLY and REQUIRED arguments and set BLAKE3_FOUND to TRUE
+# if all listed variables are TRUE and the requested version matches.
+find_package_handle_standard_args(Blake3 REQUIRED_VARS
+                                  BLAKE3_LIBRARY BLAKE3_INCLUDE_DIR
+                                  VERSION_VAR BLAKE3_VERSION)
+
+if(BLAKE3_FOUND)
+  set(BLAKE3_LIBRARIES     ${BLAKE3_LIBRARY})
+  set(BLAKE3_INCLUDE_DIRS  ${BLAKE3_INCLUDE_DIR})
+endif()
+
+mark_as_advanced(BLAKE3_INCLUDE_DIR BLAKE3_LIBRARY)
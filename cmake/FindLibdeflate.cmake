@@ -0,0 +1,26 @@
+# - Try to find libdeflate
+# Once done this will define
+#  LIBDEFLATE_FOUND        - System has libdeflate
+#  LIBDEFLATE_INCLUDE_DIRS - The libdeflate include directories
+#  LIBDEFLATE_LIBRARIES    - The libraries needed to use libdeflate
+
+find_path(LIBDEFLATE_INCLUDE_DIR
+  NAMES libdeflate.h
+)
+find_library(LIBDEFLATE_LIBRARY
+  NAMES deflate libdeflate
+)
+
+include(FindPackageHandleStandardArgs)
+# handle the QUIETLY and REQUIRED arguments and set LIBDEFLATE_FOUND to TRUE
+# if all listed variables are TRUE and the requested version matches.
+find_package_handle_standard_args(Libdeflate REQUIRED_VARS
+                                  LIBDEFLATE_LIBRARY LIBDEFLATE_INCLUDE_DIR
+                                  VERSION_VAR LIBDEFLATE_VERSION)
+
+if(LIBDEFLATE_FOUND)
+  set(LIBDEFLATE_LIBRARIES     ${LIBDEFLATE_LIBRARY})
+  set(LIBDEFLATE_INCLUDE_DIRS  ${LIBDEFLATE_INCLUDE_DIR})
+endif()
+
+mark_as_advanced(LIBDEFLATE_INCLUDE_DIR LIBDEFLATE_LIBRARY)
@@ -0,0 +1,26 @@
+# - Try to find liburing
+# Once done this will define
+#  LIBURING_FOUND        - System has liburing
+#  LIBURING_INCLUDE_DIRS - The liburing include directories
+#  LIBURING_LIBRARIES    - The libraries needed to use liburing
+
+find_path(LIBURING_INCLUDE_DIR
+  NAMES liburing.h
+)
+find_library(LIBURING_LIBRARY
+  NAMES uring
+)
+
+include(FindPackageHandleStandardArgs)
+# handle the QUIETLY and REQUIRED arguments and set LIBURING_FOUND to TRUE
+# if all listed variables are TRUE and the requested version matches.
+find_package_handle_standard_args(Liburing REQUIRED_VARS
+                                  LIBURING_LIBRARY LIBURING_INCLUDE_DIR
+                                  VERSION_VAR LIBURING_VERSION)
+
+if(LIBURING_FOUND)
+  set(LIBURING_LIBRARIES     ${LIBURING_LIBRARY})
+  set(LIBURING_INCLUDE_DIRS  ${LIBURING_INCLUDE_DIR})
+endif()
+
+mark_as_advanced(LIBURING_INCLUDE_DIR LIBURING_LIBRARY)
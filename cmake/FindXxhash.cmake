@@ -0,0 +1,26 @@
+# - Try to find xxhash
+# Once done this will define
+#  XXHASH_FOUND        - System has xxhash
+#  XXHASH_INCLUDE_DIRS - The xxhash include directories
+#  XXHASH_LIBRARIES    - The libraries needed to use xxhash
+
+find_path(XXHASH_INCLUDE_DIR
+  NAMES xxhash.h
+)
+find_library(XXHASH_LIBRARY
+  NAMES xxhash
+)
+
+include(FindPackageHandleStandardArgs)
+# handle the QUIETLY and REQUIRED arguments and set XXHASH_FOUND to TRUE
+# if all listed variables are TRUE and the requested version matches.
+find_package_handle_standard_args(Xxhash REQUIRED_VARS
+                                  XXHASH_LIBRARY XXHASH_INCLUDE_DIR
+                                  VERSION_VAR XXHASH_VERSION)
+
+if(XXHASH_FOUND)
+  set(XXHASH_LIBRARIES     ${XXHASH_LIBRARY})
+  set(XXHASH_INCLUDE_DIRS  ${XXHASH_INCLUDE_DIR})
+endif()
+
+mark_as_advanced(XXHASH_INCLUDE_DIR XXHASH_LIBRARY)
@@ -10,7 +10,7 @@ pgmoneta_cli_completions()
     if [ "${#COMP_WORDS[@]}" == "2" ]; then
         # main completion: the user has specified nothing at all
         # or a single word, that is a command
-        COMPREPLY=($(compgen -W "backup list-backup restore verify archive delete retain expunge encrypt decrypt info ping shutdown status conf clear" "${COMP_WORDS[1]}"))
+        COMPREPLY=($(compgen -W "backup list-backup restore verify archive delete retain expunge encrypt decrypt info ping profile shutdown status conf clear wal-fetch wal-push" "${COMP_WORDS[1]}"))
     else
         # the user has specified something else
         # subcommand required?
@@ -22,7 +22,7 @@ pgmoneta_cli_completions()
                 COMPREPLY+=($(compgen -W "reload" "${COMP_WORDS[2]}"))
                 ;;
             clear)
-                COMPREPLY+=($(compgen -W "prometheus" "${COMP_WORDS[2]}"))
+                COMPREPLY+=($(compgen -W "prometheus profile" "${COMP_WORDS[2]}"))
                 ;;
         esac
     fi
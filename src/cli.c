@@ -55,6 +55,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 
 #include <openssl/ssl.h>
@@ -76,6 +77,7 @@
 #define COMMAND_COMPRESS "compress"
 #define COMMAND_DECOMPRESS "decompress"
 #define COMMAND_PING "ping"
+#define COMMAND_PROFILE "profile"
 #define COMMAND_SHUTDOWN "shutdown"
 #define COMMAND_STATUS "status"
 #define COMMAND_STATUS_DETAILS "status-details"
@@ -83,6 +85,8 @@
 #define COMMAND_CLEAR "clear"
 #define COMMAND_INFO "info"
 #define COMMAND_ANNOTATE "annotate"
+#define COMMAND_WAL_FETCH "wal-fetch"
+#define COMMAND_WAL_PUSH  "wal-push"
 
 #define OUTPUT_FORMAT_JSON "json"
 #define OUTPUT_FORMAT_TEXT "text"
@@ -104,17 +108,20 @@ static void help_decompress(void);
 static void help_compress(void);
 static void help_shutdown(void);
 static void help_ping(void);
+static void help_profile(void);
 static void help_status_details(void);
 static void help_conf(void);
 static void help_clear(void);
 static void help_info(void);
 static void help_annotate(void);
+static void help_wal_fetch(void);
+static void help_wal_push(void);
 static void display_helper(char* command);
 
 static int backup(SSL* ssl, int socket, char* server, uint8_t compression, uint8_t encryption, char* incremental, int32_t output_format);
 static int list_backup(SSL* ssl, int socket, char* server, char* sort_order, uint8_t compression, uint8_t encryption, int32_t output_format);
 static int restore(SSL* ssl, int socket, char* server, char* backup_id, char* position, char* directory, uint8_t compression, uint8_t encryption, int32_t output_format);
-static int verify(SSL* ssl, int socket, char* server, char* backup_id, char* directory, char* files, uint8_t compression, uint8_t encryption, int32_t output_format);
+static int verify(SSL* ssl, int socket, char* server, char* backup_id, char* directory, char* files, int32_t sample, uint8_t compression, uint8_t encryption, int32_t output_format);
 static int archive(SSL* ssl, int socket, char* server, char* backup_id, char* position, char* directory, uint8_t compression, uint8_t encryption, int32_t output_format);
 static int delete(SSL* ssl, int socket, char* server, char* backup_id, uint8_t compression, uint8_t encryption, int32_t output_format);
 static int pgmoneta_shutdown(SSL* ssl, int socket, uint8_t compression, uint8_t encryption, int32_t output_format);
@@ -122,6 +129,7 @@ static int status(SSL* ssl, int socket, uint8_t compression, uint8_t encryption,
 static int details(SSL* ssl, int socket, uint8_t compression, uint8_t encryption, int32_t output_format);
 static int ping(SSL* ssl, int socket, uint8_t compression, uint8_t encryption, int32_t output_format);
 static int reset(SSL* ssl, int socket, uint8_t compression, uint8_t encryption, int32_t output_format);
+static int profile(SSL* ssl, int socket, bool reset, uint8_t compression, uint8_t encryption, int32_t output_format);
 static int reload(SSL* ssl, int socket, uint8_t compression, uint8_t encryption, int32_t output_format);
 static int retain(SSL* ssl, int socket, char* server, char* backup_id, uint8_t compression, uint8_t encryption, int32_t output_format);
 static int expunge(SSL* ssl, int socket, char* server, char* backup_id, uint8_t compression, uint8_t encryption, int32_t output_format);
@@ -135,6 +143,8 @@ static int decompress_data_server(SSL* ssl, int socket, char* path, uint8_t comp
 static int compress_data_server(SSL* ssl, int socket, char* path, uint8_t compression, uint8_t encryption, int32_t output_format);
 static int info(SSL* ssl, int socket, char* server, char* backup, uint8_t compression, uint8_t encryption, int32_t output_format);
 static int annotate(SSL* ssl, int socket, char* server, char* backup, char* command, char* key, char* comment, uint8_t compression, uint8_t encryption, int32_t output_format);
+static int wal_fetch(SSL* ssl, int socket, char* server, char* file, char* destination, uint8_t compression, uint8_t encryption, int32_t output_format);
+static int wal_push(SSL* ssl, int socket, char* server, char* file, char* source, uint8_t compression, uint8_t encryption, int32_t output_format);
 static int conf_ls(SSL* ssl, int socket, uint8_t compression, uint8_t encryption, int32_t output_format);
 static int conf_get(SSL* ssl, int socket, char* config_key, uint8_t compression, uint8_t encryption, int32_t output_format);
 static int conf_set(SSL* ssl, int socket, char* config_key, char* config_value, uint8_t compression, uint8_t encryption, int32_t output_format);
@@ -195,7 +205,9 @@ usage(void)
    printf("  -F, --format text|json|raw                     Set the output format\n");
    printf("  -C, --compress none|gz|zstd|lz4|bz2            Compress the wire protocol\n");
    printf("  -E, --encrypt none|aes|aes256|aes192|aes128    Encrypt the wire protocol\n");
+   printf("  -B, --binary                                   Use the compact binary encoding for the wire protocol\n");
    printf("  -s, --sort asc|desc                            Sort result (for list-backup)\n");
+   printf("  -a, --all                                      Run the command on all servers (for backup and verify)\n");
    printf("  -?, --help                                     Display help\n");
    printf("\n");
    printf("Commands:\n");
@@ -204,6 +216,7 @@ usage(void)
    printf("  backup                   Backup a server\n");
    printf("  clear <what>             Clear data, with:\n");
    printf("                           - 'prometheus' to reset the Prometheus statistics\n");
+   printf("                           - 'profile' to reset the profiling probes\n");
    printf("  compress                 Compress a file using configured method\n");
    printf("  conf <action>            Manage the configuration, with one of subcommands:\n");
    printf("                           - 'get' to obtain information about a runtime configuration value\n");
@@ -220,11 +233,14 @@ usage(void)
    printf("  info                     Information about a backup\n");
    printf("  list-backup              List the backups for a server\n");
    printf("  ping                     Check if pgmoneta is alive\n");
+   printf("  profile                  Display the profiling probes\n");
    printf("  restore                  Restore a backup from a server\n");
    printf("  retain                   Retain a backup from a server\n");
    printf("  shutdown                 Shutdown pgmoneta\n");
    printf("  status [details]         Status of pgmoneta, with optional details\n");
    printf("  verify                   Verify a backup from a server\n");
+   printf("  wal-fetch                Fetch a WAL file, for restore_command\n");
+   printf("  wal-push                 Push a WAL file, for archive_command\n");
    printf("\n");
    printf("pgmoneta: %s\n", PGMONETA_HOMEPAGE);
    printf("Report bugs: %s\n", PGMONETA_ISSUES);
@@ -258,7 +274,7 @@ struct pgmoneta_command command_table[] = {
    {
       .command = "verify",
       .subcommand = "",
-      .accepted_argument_count = {3, 4},
+      .accepted_argument_count = {3, 4, 5},
       .action = MANAGEMENT_VERIFY,
       .deprecated = false,
       .log_message = "<verify> [%s]",
@@ -399,6 +415,22 @@ struct pgmoneta_command command_table[] = {
       .deprecated = false,
       .log_message = "<clear prometheus>"
    },
+   {
+      .command = "clear",
+      .subcommand = "profile",
+      .accepted_argument_count = {0},
+      .action = MANAGEMENT_PROFILE,
+      .deprecated = false,
+      .log_message = "<clear profile>"
+   },
+   {
+      .command = "profile",
+      .subcommand = "",
+      .accepted_argument_count = {0},
+      .action = MANAGEMENT_PROFILE,
+      .deprecated = false,
+      .log_message = "<profile>"
+   },
    {
       .command = "info",
       .subcommand = "",
@@ -414,6 +446,22 @@ struct pgmoneta_command command_table[] = {
       .action = MANAGEMENT_ANNOTATE,
       .deprecated = false,
       .log_message = "<annotate> [%s]"
+   },
+   {
+      .command = "wal-fetch",
+      .subcommand = "",
+      .accepted_argument_count = {3},
+      .action = MANAGEMENT_WAL_FETCH,
+      .deprecated = false,
+      .log_message = "<wal-fetch> [%s]"
+   },
+   {
+      .command = "wal-push",
+      .subcommand = "",
+      .accepted_argument_count = {3},
+      .action = MANAGEMENT_WAL_PUSH,
+      .deprecated = false,
+      .log_message = "<wal-push> [%s]"
    }
 };
 
@@ -441,6 +489,7 @@ main(int argc, char** argv)
    int32_t output_format = MANAGEMENT_OUTPUT_FORMAT_TEXT;
    int32_t compression = MANAGEMENT_COMPRESSION_NONE;
    int32_t encryption = MANAGEMENT_ENCRYPTION_NONE;
+   bool binary = false;
    size_t command_count = sizeof(command_table) / sizeof(struct pgmoneta_command);
    struct pgmoneta_parsed_command parsed = {.cmd = NULL, .args = {0}};
    char* filepath = NULL;
@@ -448,6 +497,8 @@ main(int argc, char** argv)
    int num_options = 0;
    int num_results = 0;
    char* sort_option = NULL;
+   bool all = false;
+   char** all_argv = NULL;
 
    cli_option options[] = {
       {"c", "config", true},
@@ -461,7 +512,9 @@ main(int argc, char** argv)
       {"F", "format", true},
       {"C", "compress", true},
       {"E", "encrypt", true},
+      {"B", "binary", false},
       {"s", "sort", true},
+      {"a", "all", false},
       {"?", "help", false}
    };
 
@@ -597,6 +650,10 @@ main(int argc, char** argv)
             exit(1);
          }
       }
+      else if (!strcmp(optname, "B") || !strcmp(optname, "binary"))
+      {
+         binary = true;
+      }
       else if (!strcmp(optname, "s") || !strcmp(optname, "sort"))
       {
          if (!strncmp(optarg, "asc", 3) || !strncmp(optarg, "desc", 4))
@@ -609,6 +666,10 @@ main(int argc, char** argv)
             exit(1);
          }
       }
+      else if (!strcmp(optname, "a") || !strcmp(optname, "all"))
+      {
+         all = true;
+      }
       else if (!strcmp(optname, "?") || !strcmp(optname, "help"))
       {
          usage();
@@ -616,6 +677,16 @@ main(int argc, char** argv)
       }
    }
 
+   if (binary)
+   {
+      if (compression != MANAGEMENT_COMPRESSION_NONE)
+      {
+         warnx("pgmoneta-cli: The binary encoding can't be combined with compression");
+         exit(1);
+      }
+      compression |= MANAGEMENT_ENCODING_BINARY;
+   }
+
    if (getuid() == 0)
    {
       warnx("pgmoneta-cli: Running as root is not allowed for security reasons.");
@@ -642,6 +713,29 @@ main(int argc, char** argv)
    }
    pgmoneta_init_main_configuration(shmem);
 
+   /* The server is left out with --all, so a placeholder takes its place for the parser */
+   if (all)
+   {
+      if (optind >= argc || (strcmp(argv[optind], COMMAND_BACKUP) && strcmp(argv[optind], COMMAND_VERIFY)))
+      {
+         warnx("pgmoneta-cli: --all is only supported for backup and verify");
+         exit(1);
+      }
+
+      all_argv = (char**)malloc((argc + 1) * sizeof(char*));
+      if (all_argv == NULL)
+      {
+         exit(1);
+      }
+
+      memcpy(all_argv, argv, (optind + 1) * sizeof(char*));
+      all_argv[optind + 1] = "*";
+      memcpy(all_argv + optind + 2, argv + optind + 1, (argc - optind - 1) * sizeof(char*));
+
+      argv = all_argv;
+      argc++;
+   }
+
    if (!parse_command(argc, argv, optind, &parsed, command_table, command_count))
    {
       if (argc > optind)
@@ -826,11 +920,11 @@ execute:
    {
       if (parsed.args[1])
       {
-         exit_code = backup(s_ssl, socket, parsed.args[0], compression, encryption, parsed.args[1], output_format);
+         exit_code = backup(s_ssl, socket, all ? NULL : parsed.args[0], compression, encryption, parsed.args[1], output_format);
       }
       else
       {
-         exit_code = backup(s_ssl, socket, parsed.args[0], compression, encryption, NULL, output_format);
+         exit_code = backup(s_ssl, socket, all ? NULL : parsed.args[0], compression, encryption, NULL, output_format);
       }
    }
    else if (parsed.cmd->action == MANAGEMENT_LIST_BACKUP)
@@ -850,14 +944,29 @@ execute:
    }
    else if (parsed.cmd->action == MANAGEMENT_VERIFY)
    {
-      if (parsed.args[3])
-      {
-         exit_code = verify(s_ssl, socket, parsed.args[0], parsed.args[1], parsed.args[2], parsed.args[3], compression, encryption, output_format);
-      }
-      else
+      char* files = "failed";
+      int32_t sample = 0;
+
+      for (int i = 3; i < 5 && parsed.args[i] != NULL; i++)
       {
-         exit_code = verify(s_ssl, socket, parsed.args[0], parsed.args[1], parsed.args[2], "failed", compression, encryption, output_format);
+         if (!strncmp(parsed.args[i], "sample=", 7))
+         {
+            sample = atoi(parsed.args[i] + 7);
+
+            if (sample <= 0 || sample > 100)
+            {
+               warnx("pgmoneta-cli: Invalid sample '%s'. Allowed values: sample=1 to sample=100.", parsed.args[i]);
+               exit_code = 1;
+               goto done;
+            }
+         }
+         else
+         {
+            files = parsed.args[i];
+         }
       }
+
+      exit_code = verify(s_ssl, socket, all ? NULL : parsed.args[0], parsed.args[1], parsed.args[2], files, sample, compression, encryption, output_format);
    }
    else if (parsed.cmd->action == MANAGEMENT_ARCHIVE)
    {
@@ -894,6 +1003,10 @@ execute:
    {
       exit_code = reset(s_ssl, socket, compression, encryption, output_format);
    }
+   else if (parsed.cmd->action == MANAGEMENT_PROFILE)
+   {
+      exit_code = profile(s_ssl, socket, !strcmp(parsed.cmd->command, COMMAND_CLEAR), compression, encryption, output_format);
+   }
    else if (parsed.cmd->action == MANAGEMENT_RELOAD)
    {
       exit_code = reload(s_ssl, socket, compression, encryption, output_format);
@@ -959,6 +1072,14 @@ execute:
    {
       exit_code = annotate(s_ssl, socket, parsed.args[0], parsed.args[1], parsed.args[2], parsed.args[3], parsed.args[4], compression, encryption, output_format);
    }
+   else if (parsed.cmd->action == MANAGEMENT_WAL_FETCH)
+   {
+      exit_code = wal_fetch(s_ssl, socket, parsed.args[0], parsed.args[1], parsed.args[2], compression, encryption, output_format);
+   }
+   else if (parsed.cmd->action == MANAGEMENT_WAL_PUSH)
+   {
+      exit_code = wal_push(s_ssl, socket, parsed.args[0], parsed.args[1], parsed.args[2], compression, encryption, output_format);
+   }
    else if (parsed.cmd->action == MANAGEMENT_CONF_LS)
    {
       exit_code = conf_ls(s_ssl, socket, compression, encryption, output_format);
@@ -1003,6 +1124,8 @@ done:
       free(password);
    }
 
+   free(all_argv);
+
    if (verbose)
    {
       if (exit_code == 0)
@@ -1023,6 +1146,7 @@ help_backup(void)
 {
    printf("Backup a server\n");
    printf("  pgmoneta-cli backup <server> [identifier]\n");
+   printf("  pgmoneta-cli backup --all [identifier]\n");
 }
 
 static void
@@ -1036,14 +1160,15 @@ static void
 help_restore(void)
 {
    printf("Restore a backup for a server\n");
-   printf("  pgmoneta-cli restore <server> <timestamp|oldest|newest> [[current|name=X|xid=X|lsn=X|time=X|inclusive=X|timeline=X|action=X|primary|replica],*] <directory>\n");
+   printf("  pgmoneta-cli restore <server> <timestamp|oldest|newest> [[current|name=X|xid=X|lsn=X|time=X|inclusive=X|timeline=X|action=X|primary|replica|database=X|relation=X],*] <directory>\n");
 }
 
 static void
 help_verify(void)
 {
    printf("Verify a backup for a server\n");
-   printf("  pgmoneta-cli verify <server> <timestamp|oldest|newest> <directory> [failed|all]\n");
+   printf("  pgmoneta-cli verify <server> <timestamp|oldest|newest> <directory> [failed|all] [sample=X]\n");
+   printf("  pgmoneta-cli verify --all <timestamp|oldest|newest> <directory> [failed|all] [sample=X]\n");
 }
 
 static void
@@ -1116,6 +1241,13 @@ help_ping(void)
    printf("  pgmoneta-cli ping\n");
 }
 
+static void
+help_profile(void)
+{
+   printf("Display the profiling probes\n");
+   printf("  pgmoneta-cli profile\n");
+}
+
 static void
 help_status_details(void)
 {
@@ -1138,6 +1270,7 @@ help_clear(void)
 {
    printf("Reset data\n");
    printf("  pgmoneta-cli clear [prometheus]\n");
+   printf("  pgmoneta-cli clear [profile]\n");
 }
 
 static void
@@ -1154,6 +1287,20 @@ help_annotate(void)
    printf("  pgmoneta-cli annotate <server> <timestamp|oldest|newest> <add|update|remove> <key> [comment]\n");
 }
 
+static void
+help_wal_fetch(void)
+{
+   printf("Fetch a WAL file for the restore_command of a server\n");
+   printf("  pgmoneta-cli wal-fetch <server> <file> <path>\n");
+}
+
+static void
+help_wal_push(void)
+{
+   printf("Push a WAL file for the archive_command of a server\n");
+   printf("  pgmoneta-cli wal-push <server> <file> <path>\n");
+}
+
 static void
 display_helper(char* command)
 {
@@ -1209,6 +1356,10 @@ display_helper(char* command)
    {
       help_ping();
    }
+   else if (!strcmp(command, COMMAND_PROFILE))
+   {
+      help_profile();
+   }
    else if (!strcmp(command, COMMAND_SHUTDOWN))
    {
       help_shutdown();
@@ -1233,6 +1384,14 @@ display_helper(char* command)
    {
       help_annotate();
    }
+   else if (!strcmp(command, COMMAND_WAL_FETCH))
+   {
+      help_wal_fetch();
+   }
+   else if (!strcmp(command, COMMAND_WAL_PUSH))
+   {
+      help_wal_push();
+   }
    else
    {
       usage();
@@ -1300,9 +1459,9 @@ error:
 }
 
 static int
-verify(SSL* ssl, int socket, char* server, char* backup_id, char* directory, char* files, uint8_t compression, uint8_t encryption, int32_t output_format)
+verify(SSL* ssl, int socket, char* server, char* backup_id, char* directory, char* files, int32_t sample, uint8_t compression, uint8_t encryption, int32_t output_format)
 {
-   if (pgmoneta_management_request_verify(ssl, socket, server, backup_id, directory, files, compression, encryption, output_format))
+   if (pgmoneta_management_request_verify(ssl, socket, server, backup_id, directory, files, sample, compression, encryption, output_format))
    {
       goto error;
    }
@@ -1459,6 +1618,26 @@ error:
    return 1;
 }
 
+static int
+profile(SSL* ssl, int socket, bool reset, uint8_t compression, uint8_t encryption, int32_t output_format)
+{
+   if (pgmoneta_management_request_profile(ssl, socket, reset, compression, encryption, output_format))
+   {
+      goto error;
+   }
+
+   if (process_result(ssl, socket, output_format))
+   {
+      goto error;
+   }
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
 static int
 reload(SSL* ssl, int socket, uint8_t compression, uint8_t encryption, int32_t output_format)
 {
@@ -1519,6 +1698,121 @@ error:
    return 1;
 }
 
+static int
+wal_fetch(SSL* ssl, int socket, char* server, char* file, char* destination, uint8_t compression, uint8_t encryption, int32_t output_format)
+{
+   char* path = NULL;
+   char cwd[MAX_PATH];
+   struct json* read = NULL;
+   struct json* outcome = NULL;
+
+   /* The restore_command gets a path relative to the data directory */
+   if (*destination != '/')
+   {
+      memset(&cwd[0], 0, sizeof(cwd));
+      if (getcwd(&cwd[0], sizeof(cwd)) == NULL)
+      {
+         goto error;
+      }
+
+      path = pgmoneta_append(path, &cwd[0]);
+      path = pgmoneta_append(path, "/");
+   }
+   path = pgmoneta_append(path, destination);
+
+   if (pgmoneta_management_request_wal_fetch(ssl, socket, server, file, path, compression, encryption, output_format))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_management_read_json(ssl, socket, NULL, NULL, &read))
+   {
+      goto error;
+   }
+
+   /* The restore_command only reports through the exit code */
+   outcome = (struct json*)pgmoneta_json_get(read, MANAGEMENT_CATEGORY_OUTCOME);
+   if (!(bool)pgmoneta_json_get(outcome, MANAGEMENT_ARGUMENT_STATUS))
+   {
+      goto error;
+   }
+
+   pgmoneta_json_destroy(read);
+   free(path);
+
+   return 0;
+
+error:
+
+   pgmoneta_json_destroy(read);
+   free(path);
+
+   return 1;
+}
+
+static int
+wal_push(SSL* ssl, int socket, char* server, char* file, char* source, uint8_t compression, uint8_t encryption, int32_t output_format)
+{
+   FILE* f = NULL;
+   char buffer[MANAGEMENT_DATA_BLOCK_SIZE];
+   size_t n;
+   struct stat st;
+   struct json* read = NULL;
+   struct json* outcome = NULL;
+
+   f = fopen(source, "rb");
+   if (f == NULL || fstat(fileno(f), &st))
+   {
+      warnx("wal-push: Could not open %s", source);
+      goto error;
+   }
+
+   if (pgmoneta_management_request_wal_push(ssl, socket, server, file, (uint64_t)st.st_size, compression, encryption, output_format))
+   {
+      goto error;
+   }
+
+   while ((n = fread(&buffer[0], 1, sizeof(buffer), f)) > 0)
+   {
+      if (pgmoneta_management_write_data(ssl, socket, &buffer[0], n))
+      {
+         goto error;
+      }
+   }
+
+   if (ferror(f) || pgmoneta_management_write_data(ssl, socket, NULL, 0))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_management_read_json(ssl, socket, NULL, NULL, &read))
+   {
+      goto error;
+   }
+
+   /* The archive_command only reports through the exit code, the file is durable when it is 0 */
+   outcome = (struct json*)pgmoneta_json_get(read, MANAGEMENT_CATEGORY_OUTCOME);
+   if (!(bool)pgmoneta_json_get(outcome, MANAGEMENT_ARGUMENT_STATUS))
+   {
+      goto error;
+   }
+
+   pgmoneta_json_destroy(read);
+   fclose(f);
+
+   return 0;
+
+error:
+
+   pgmoneta_json_destroy(read);
+   if (f != NULL)
+   {
+      fclose(f);
+   }
+
+   return 1;
+}
+
 static int
 decrypt_data_client(char* from)
 {
@@ -2361,6 +2655,9 @@ translate_command(int32_t cmd_code)
       case MANAGEMENT_RESET:
          command_output = pgmoneta_append(command_output, COMMAND_RESET);
          break;
+      case MANAGEMENT_PROFILE:
+         command_output = pgmoneta_append(command_output, COMMAND_PROFILE);
+         break;
       case MANAGEMENT_RELOAD:
          command_output = pgmoneta_append(command_output, COMMAND_RELOAD);
          break;
@@ -2388,6 +2685,12 @@ translate_command(int32_t cmd_code)
       case MANAGEMENT_ANNOTATE:
          command_output = pgmoneta_append(command_output, COMMAND_ANNOTATE);
          break;
+      case MANAGEMENT_WAL_FETCH:
+         command_output = pgmoneta_append(command_output, COMMAND_WAL_FETCH);
+         break;
+      case MANAGEMENT_WAL_PUSH:
+         command_output = pgmoneta_append(command_output, COMMAND_WAL_PUSH);
+         break;
       case MANAGEMENT_CONF_LS:
          command_output = pgmoneta_append(command_output, COMMAND_CONF);
          command_output = pgmoneta_append_char(command_output, ' ');
@@ -2500,6 +2803,9 @@ translate_encryption(int32_t encryption_code)
       case ENCRYPTION_AES_128_CTR:
          encryption_output = pgmoneta_append(encryption_output, "aes-128-ctr");
          break;
+      case ENCRYPTION_AES_256_GCM:
+         encryption_output = pgmoneta_append(encryption_output, "aes-256-gcm");
+         break;
       default:
          encryption_output = pgmoneta_append(encryption_output, "none");
          break;
@@ -36,7 +36,9 @@ extern "C" {
 #include <pgmoneta.h>
 #include <json.h>
 #include <message.h>
+#include <page.h>
 #include <tablespace.h>
+#include <workers.h>
 
 #include <stdlib.h>
 
@@ -71,20 +73,39 @@ pgmoneta_extract_tar_file(char* file_path, char* destination);
 int
 pgmoneta_tar_directory(char* src, char* dst, char* destination);
 
+/**
+ * Stream a backup into a tar archive without restoring it first. The files
+ * are decrypted and decompressed while they are written, the archive is compressed
+ * with the configured method, and the files of the overlay replace the files
+ * of the source with the same name. With workers the tar stream is compressed
+ * in blocks in parallel
+ * @param source The data directory of the backup
+ * @param overlay The optional directory with the files changed by the restore
+ * @param dst The destination tar file path, or NULL to write to fd
+ * @param fd The descriptor to write to, like a socket or standard output
+ * @param destination The destination name
+ * @param workers The optional workers
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_tar_backup(char* source, char* overlay, char* dst, int fd, char* destination, struct workers* workers);
+
 /**
  * Receive backup tar files from the copy stream and write to disk
  * This functionality is for server version < 15
  * @param ssl The SSL structure
  * @param socket The socket
  * @param buffer The stream buffer
+ * @param server The server
  * @param basedir The base directory for the backup data
  * @param tablespaces The user level tablespaces
  * @param bucket The rate limit bucket
  * @param network_bucket The network rate limit bucket
+ * @param checksums The verification of the page checksums while the files are extracted, or NULL
  * @return 0 upon success, otherwise 1
  */
 int
-pgmoneta_receive_archive_files(SSL* ssl, int socket, struct stream_buffer* buffer, char* basedir, struct tablespace* tablespaces, struct token_bucket* bucket, struct token_bucket* network_bucket);
+pgmoneta_receive_archive_files(SSL* ssl, int socket, struct stream_buffer* buffer, int server, char* basedir, struct tablespace* tablespaces, struct token_bucket* bucket, struct token_bucket* network_bucket, struct page_checksums* checksums);
 
 /**
  * Receive backup tar files from the copy stream and write to disk
@@ -92,14 +113,16 @@ pgmoneta_receive_archive_files(SSL* ssl, int socket, struct stream_buffer* buffe
  * @param ssl The SSL structure
  * @param socket The socket
  * @param buffer The stream buffer
+ * @param server The server
  * @param basedir The base directory for the backup data
  * @param tablespaces The user level tablespaces
  * @param bucket The rate limit bucket
  * @param network_bucket The network rate limit bucket
+ * @param checksums The verification of the page checksums while the files are extracted, or NULL
  * @return 0 upon success, otherwise 1
  */
 int
-pgmoneta_receive_archive_stream(SSL* ssl, int socket, struct stream_buffer* buffer, char* basedir, struct tablespace* tablespaces, struct token_bucket* bucket, struct token_bucket* network_bucket);
+pgmoneta_receive_archive_stream(SSL* ssl, int socket, struct stream_buffer* buffer, int server, char* basedir, struct tablespace* tablespaces, struct token_bucket* bucket, struct token_bucket* network_bucket, struct page_checksums* checksums);
 
 #ifdef __cplusplus
 }
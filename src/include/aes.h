@@ -35,6 +35,7 @@ extern "C" {
 
 #include <pgmoneta.h>
 #include <json.h>
+#include <reader.h>
 #include <workers.h>
 
 #include <openssl/ssl.h>
@@ -63,6 +64,14 @@ pgmoneta_encrypt(char* plaintext, char* password, char** ciphertext, int* cipher
 int
 pgmoneta_decrypt(char* ciphertext, int ciphertext_length, char* password, char** plaintext, int mode);
 
+/**
+ * Is a backup file encrypted by the encryption step of a backup
+ * @param path The file path
+ * @return True if the file should be encrypted, otherwise false
+ */
+bool
+pgmoneta_encryption_applies(char* path);
+
 /**
  * Encrypt the files under the directory in place recursively, also remove unencrypted files.
  * @param d The data directory
@@ -151,6 +160,113 @@ pgmoneta_decrypt_request(SSL* ssl, int client_fd, uint8_t compression, uint8_t e
 int
 pgmoneta_encrypt_buffer(unsigned char* origin_buffer, size_t origin_size, unsigned char** enc_buffer, size_t* enc_size, int mode);
 
+/**
+ *
+ * Encrypt a buffer with the configured encryption, producing the same
+ * output as pgmoneta_encrypt_file
+ * @param path The path of the file, which selects the key of its backup, or NULL for the master key
+ * @param origin_buffer The original buffer
+ * @param origin_size The size of the buffer
+ * @param enc_buffer The result buffer
+ * @param enc_size The result buffer size
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_encrypt_file_buffer(char* path, unsigned char* origin_buffer, size_t origin_size, unsigned char** enc_buffer, size_t* enc_size);
+
+/**
+ * Start using the cache of keys derived from the master key, so the
+ * master key is read and derived once instead of once per file.
+ * Each call must be paired with pgmoneta_encrypt_key_cache_release
+ */
+void
+pgmoneta_encrypt_key_cache_acquire(void);
+
+/**
+ * Stop using the key cache, and wipe it when it has no more users
+ */
+void
+pgmoneta_encrypt_key_cache_release(void);
+
+/**
+ * Use the data key of a backup for the files of a directory outside of
+ * the backup, like the target of a restore, while the key cache is in use
+ * @param directory The directory
+ * @param wrapped The wrapped data key of the backup, or empty for the master key
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_encrypt_key_cache_directory(char* directory, char* wrapped);
+
+/**
+ * Create a data key for a backup, wrapped with the master key.
+ * The files of the backup are encrypted with the data key, which is
+ * found through the DATA_KEY of its backup.info
+ * @param wrapped The wrapped data key in hexadecimal
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_encrypt_data_key(char** wrapped);
+
+/**
+ * Can an encryption mode be used with the streaming encryption functions
+ * @param mode The encryption mode
+ * @return True if supported, otherwise false
+ */
+bool
+pgmoneta_encrypt_stream_supported(int mode);
+
+/**
+ * Create a streaming encryption context using the configured encryption.
+ * Feeding a file through it produces the same output as pgmoneta_encrypt_file
+ * @param path The path of the encrypted file
+ * @param ctx The resulting context
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_encrypt_stream_create(char* path, EVP_CIPHER_CTX** ctx);
+
+/**
+ * Encrypt a chunk of a stream. The output buffer must hold
+ * in_size + EVP_MAX_BLOCK_LENGTH bytes
+ * @param ctx The context
+ * @param in The input buffer
+ * @param in_size The size of the input buffer
+ * @param out The output buffer
+ * @param out_size The number of bytes written to the output buffer
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_encrypt_stream_update(EVP_CIPHER_CTX* ctx, unsigned char* in, size_t in_size, unsigned char* out, size_t* out_size);
+
+/**
+ * Finish a stream. The output buffer must hold EVP_MAX_BLOCK_LENGTH bytes
+ * @param ctx The context
+ * @param out The output buffer
+ * @param out_size The number of bytes written to the output buffer
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_encrypt_stream_final(EVP_CIPHER_CTX* ctx, unsigned char* out, size_t* out_size);
+
+/**
+ * Destroy a streaming encryption context
+ * @param ctx The context
+ */
+void
+pgmoneta_encrypt_stream_destroy(EVP_CIPHER_CTX* ctx);
+
+/**
+ * Create a decryption layer for a streaming reader. AES-GCM files are
+ * recognized by their header, other files use the configured mode
+ * @param path The path of the encrypted file
+ * @param source The layer holding the encrypted data, owned by the new layer upon success
+ * @param reader The resulting reader
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_decrypt_reader(char* path, struct reader* source, struct reader** reader);
+
 /**
  *
  * Decrypt a buffer
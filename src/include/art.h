@@ -44,6 +44,8 @@ typedef int (*art_callback)(void* data, char* key, struct value* value);
 
 typedef void (*value_destroy_callback)(void* value);
 
+struct art_arena;
+
 /** @struct art
  * The ART tree
  */
@@ -51,6 +53,7 @@ struct art
 {
    struct art_node* root;                 /**< The root node of ART */
    uint64_t size;                         /**< The size of the ART */
+   struct art_arena* arena;               /**< The arena of the nodes and leaves, or NULL */
 };
 
 /** @struct art_iterator
@@ -73,6 +76,16 @@ struct art_iterator
 int
 pgmoneta_art_create(struct art** tree);
 
+/**
+ * Initializes an adaptive radix tree whose nodes and leaves are allocated from an arena.
+ * The arena is released in one go when the tree is destroyed or cleared, and memory of
+ * deleted leaves is only reclaimed then
+ * @param tree [out] The tree
+ * @return 0 on success, 1 if otherwise
+ */
+int
+pgmoneta_art_create_with_arena(struct art** tree);
+
 /**
  * inserts a new value into the art tree,note that the key is copied while the value is sometimes not(depending on value type)
  * @param t The tree
@@ -130,6 +143,16 @@ pgmoneta_art_delete(struct art* t, char* key);
 int
 pgmoneta_art_clear(struct art* t);
 
+/**
+ * Visit all the key value pairs in key order
+ * @param t The tree
+ * @param cb The callback, a non-zero return value stops the iteration
+ * @param data The data passed to the callback
+ * @return 0 if all pairs were visited, otherwise the non-zero value of the callback
+ */
+int
+pgmoneta_art_iterate(struct art* t, art_callback cb, void* data);
+
 /**
  * Get the next key value pair into iterator
  * @param iter The iterator
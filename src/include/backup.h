@@ -50,6 +50,40 @@ extern "C" {
 void
 pgmoneta_backup(int client_fd, int server, uint8_t compression, uint8_t encryption, struct json* payload);
 
+/**
+ * Create a backup without leaving the process, so it can run on a thread
+ * @param client_fd The client
+ * @param server The server
+ * @param compression The compress method for wire protocol
+ * @param encryption The encrypt method for wire protocol
+ * @param payload The payload, which is destroyed
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_backup_run(int client_fd, int server, uint8_t compression, uint8_t encryption, struct json* payload);
+
+/**
+ * Run the backups handed over by the main process as threads of one process,
+ * receiving them from an event loop
+ * @param fd The socket the backups are received from
+ * @param argv The argv
+ */
+void
+pgmoneta_backup_multiplex(int fd, char** argv);
+
+/**
+ * Hand a backup over to the multiplexed backup process
+ * @param fd The socket of the multiplexed backup process
+ * @param client_fd The client, which the caller still closes
+ * @param server The server
+ * @param compression The compress method for wire protocol
+ * @param encryption The encrypt method for wire protocol
+ * @param payload The payload
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_backup_multiplex_submit(int fd, int client_fd, int server, uint8_t compression, uint8_t encryption, struct json* payload);
+
 /**
  * List backups for a server
  * @param client_fd The client
@@ -57,8 +91,9 @@ pgmoneta_backup(int client_fd, int server, uint8_t compression, uint8_t encrypti
  * @param compression The compress method for wire protocol
  * @param encryption The encrypt method for wire protocol
  * @param payload The payload
+ * @return 0 upon success, otherwise 1
  */
-void
+int
 pgmoneta_list_backup(int client_fd, int server, uint8_t compression, uint8_t encryption, struct json* payload);
 
 /**
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGMONETA_BANDWIDTH_H
+#define PGMONETA_BANDWIDTH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgmoneta.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#define BANDWIDTH_BACKUP  0
+#define BANDWIDTH_RESTORE 1
+#define BANDWIDTH_UPLOAD  2
+
+/**
+ * Take part in the bandwidth budget. The budget is divided among the processes
+ * taking part by the weight of their kind of work. A process that already takes
+ * part switches to the new kind until the matching stop
+ * @param type The kind of work
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_bandwidth_start(int type);
+
+/**
+ * Stop taking part in the bandwidth budget, or switch back to the previous kind of work
+ */
+void
+pgmoneta_bandwidth_stop(void);
+
+/**
+ * Is this process limited by the bandwidth budget
+ * @return True if limited, otherwise false
+ */
+bool
+pgmoneta_bandwidth_active(void);
+
+/**
+ * Wait until the share of this process allows the bytes
+ * @param bytes The number of bytes
+ */
+void
+pgmoneta_bandwidth_consume(size_t bytes);
+
+/**
+ * Take the bytes from the share of this process without waiting
+ * @param bytes The number of bytes, at most DEFAULT_BURST
+ * @return 0 if the bytes were taken, otherwise 1
+ */
+int
+pgmoneta_bandwidth_once(size_t bytes);
+
+/**
+ * Account WAL received by streaming, which is never limited but
+ * leaves less of the budget to the others
+ * @param bytes The number of bytes
+ */
+void
+pgmoneta_bandwidth_wal(size_t bytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -35,6 +35,7 @@ extern "C" {
 
 #include <pgmoneta.h>
 #include <json.h>
+#include <reader.h>
 #include <workers.h>
 
 #include <stdlib.h>
@@ -112,6 +113,15 @@ pgmoneta_bunzip2_request(SSL* ssl, int client_fd, uint8_t compression, uint8_t e
 int
 pgmoneta_bunzip2_file(char* from, char* to);
 
+/**
+ * Create a BZIP2 decompression layer for a streaming reader
+ * @param source The layer holding the compressed data, owned by the new layer upon success
+ * @param reader The resulting reader
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_bunzip2_reader(struct reader* source, struct reader** reader);
+
 /**
  * BZip compress a string
  * @param s The original string
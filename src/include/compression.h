@@ -31,8 +31,40 @@
 
 #include <pgmoneta.h>
 
+#include <pthread.h>
+#include <stdint.h>
+
+#define COMPRESSION_CONTROLLER_WINDOW (64 * 1024 * 1024)
+
 typedef int (*compression_func)(char*, char*);
 
+/** @struct compression_controller
+ * Defines a controller that adjusts the compression level to keep
+ * the compression throughput at or above a target rate
+ */
+struct compression_controller
+{
+   pthread_mutex_t lock;    /**< The lock */
+   int server;              /**< The server whose level gauge is updated, or -1 */
+   int level;               /**< The current level */
+   int min_level;           /**< The minimum level */
+   int max_level;           /**< The maximum level */
+   int lowest;              /**< The lowest level used */
+   int highest;             /**< The highest level used */
+   int threads;             /**< The number of threads compressing concurrently */
+   double target;           /**< The target rate in bytes per second, 0 when unknown */
+   uint64_t window_bytes;   /**< The bytes compressed in the current window */
+   double window_seconds;   /**< The thread seconds spent in the current window */
+};
+
+/**
+ * Is a backup file compressed by the compression steps of a backup
+ * @param path The file path
+ * @return True if the file should be compressed, otherwise false
+ */
+bool
+pgmoneta_compression_applies(char* path);
+
 /**
  * Decompress a file using the appropriate decompression method.
  *
@@ -49,4 +81,43 @@ typedef int (*compression_func)(char*, char*);
 int
 pgmoneta_decompress(char* from, char* to);
 
+/**
+ * Create a compression level controller
+ * @param server The server whose level gauge is updated, or -1
+ * @param min_level The minimum level
+ * @param max_level The maximum level, and the starting level
+ * @param target The target rate in bytes per second, 0 keeps the level fixed
+ * @param threads The number of threads compressing concurrently
+ * @param controller The resulting controller
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_compression_controller_create(int server, int min_level, int max_level, double target, int threads,
+                                       struct compression_controller** controller);
+
+/**
+ * Get the current compression level
+ * @param controller The controller
+ * @return The level
+ */
+int
+pgmoneta_compression_controller_level(struct compression_controller* controller);
+
+/**
+ * Report a compressed file to the controller, and adjust the level
+ * once a full window has been observed
+ * @param controller The controller
+ * @param bytes The number of uncompressed bytes
+ * @param seconds The time spent compressing
+ */
+void
+pgmoneta_compression_controller_update(struct compression_controller* controller, uint64_t bytes, double seconds);
+
+/**
+ * Destroy a compression level controller
+ * @param controller The controller
+ */
+void
+pgmoneta_compression_controller_destroy(struct compression_controller* controller);
+
 #endif //PGMONETA_COMPRESSION_H
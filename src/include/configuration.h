@@ -52,24 +52,37 @@ extern "C" {
 #define CONFIGURATION_ARGUMENT_MANAGEMENT             "management"
 #define CONFIGURATION_ARGUMENT_COMPRESSION            "compression"
 #define CONFIGURATION_ARGUMENT_COMPRESSION_LEVEL      "compression_level"
+#define CONFIGURATION_ARGUMENT_COMPRESSION_FRAME_SIZE "compression_frame_size"
+#define CONFIGURATION_ARGUMENT_COMPRESSION_ADAPTIVE   "compression_adaptive"
 #define CONFIGURATION_ARGUMENT_WORKERS                "workers"
+#define CONFIGURATION_ARGUMENT_IO_WORKERS             "io_workers"
 #define CONFIGURATION_ARGUMENT_STORAGE_ENGINE         "storage_engine"
+#define CONFIGURATION_ARGUMENT_REFLINK                "reflink"
 #define CONFIGURATION_ARGUMENT_ENCRYPTION             "encryption"
 #define CONFIGURATION_ARGUMENT_CREATE_SLOT            "create_slot"
 #define CONFIGURATION_ARGUMENT_SSH_HOSTNAME           "ssh_hostname"
 #define CONFIGURATION_ARGUMENT_SSH_USERNAME           "ssh_username"
 #define CONFIGURATION_ARGUMENT_SSH_BASE_DIR           "ssh_base_dir"
 #define CONFIGURATION_ARGUMENT_SSH_CIPHERS            "ssh_ciphers"
+#define CONFIGURATION_ARGUMENT_SSH_MAX_INFLIGHT       "ssh_max_inflight"
 #define CONFIGURATION_ARGUMENT_S3_AWS_REGION          "s3_aws_region"
 #define CONFIGURATION_ARGUMENT_S3_ACCESS_KEY_ID       "s3_access_key_id"
 #define CONFIGURATION_ARGUMENT_S3_SECRET_ACCESS_KEY   "s3_secret_access_key"
 #define CONFIGURATION_ARGUMENT_S3_BUCKET              "s3_bucket"
 #define CONFIGURATION_ARGUMENT_S3_BASE_DIR            "s3_base_dir"
+#define CONFIGURATION_ARGUMENT_S3_PART_SIZE           "s3_part_size"
 #define CONFIGURATION_ARGUMENT_AZURE_STORAGE_ACCOUNT  "azure_storage_account"
 #define CONFIGURATION_ARGUMENT_AZURE_CONTAINER        "azure_container"
 #define CONFIGURATION_ARGUMENT_AZURE_SHARED_KEY       "azure_shared_key"
 #define CONFIGURATION_ARGUMENT_AZURE_BASE_DIR         "azure_base_dir"
+#define CONFIGURATION_ARGUMENT_AZURE_BLOCK_SIZE       "azure_block_size"
+#define CONFIGURATION_ARGUMENT_STORAGE_PACK_SIZE      "storage_pack_size"
+#define CONFIGURATION_ARGUMENT_UPLOAD_CONCURRENCY     "upload_concurrency"
+#define CONFIGURATION_ARGUMENT_UPLOAD_MAX_RATE        "upload_max_rate"
+#define CONFIGURATION_ARGUMENT_BANDWIDTH_MAX_RATE     "bandwidth_max_rate"
+#define CONFIGURATION_ARGUMENT_BACKUP_WINDOW          "backup_window"
 #define CONFIGURATION_ARGUMENT_RETENTION              "retention"
+#define CONFIGURATION_ARGUMENT_DELETE_TRASH           "delete_trash"
 #define CONFIGURATION_ARGUMENT_LOG_TYPE               "log_type"
 #define CONFIGURATION_ARGUMENT_LOG_LEVEL              "log_level"
 #define CONFIGURATION_ARGUMENT_LOG_PATH               "log_path"
@@ -89,9 +102,36 @@ extern "C" {
 #define CONFIGURATION_ARGUMENT_BACKUP_MAX_RATE        "backup_max_rate"
 #define CONFIGURATION_ARGUMENT_NETWORK_MAX_RATE       "network_max_rate"
 #define CONFIGURATION_ARGUMENT_MANIFEST               "manifest"
+#define CONFIGURATION_ARGUMENT_WAL_CACHE_SIZE         "wal_cache_size"
+#define CONFIGURATION_ARGUMENT_WAL_FLUSH_SIZE         "wal_flush_size"
+#define CONFIGURATION_ARGUMENT_WAL_FLUSH_INTERVAL     "wal_flush_interval"
+#define CONFIGURATION_ARGUMENT_WAL_STATUS_SIZE        "wal_status_size"
+#define CONFIGURATION_ARGUMENT_WAL_STATUS_INTERVAL    "wal_status_interval"
+#define CONFIGURATION_ARGUMENT_WAL_PREALLOCATE        "wal_preallocate"
+#define CONFIGURATION_ARGUMENT_WAL_INLINE_COMPRESSION "wal_inline_compression"
+#define CONFIGURATION_ARGUMENT_WAL_DICTIONARY         "wal_dictionary"
+#define CONFIGURATION_ARGUMENT_RESTORE_IO_URING       "restore_io_uring"
+#define CONFIGURATION_ARGUMENT_WAL_MULTIPLEX          "wal_multiplex"
+#define CONFIGURATION_ARGUMENT_BACKUP_MULTIPLEX       "backup_multiplex"
+#define CONFIGURATION_ARGUMENT_BACKUP_WRITE_QUEUE     "backup_write_queue"
+#define CONFIGURATION_ARGUMENT_MEMORY_BUDGET          "memory_budget"
+#define CONFIGURATION_ARGUMENT_WAL_PREFETCH           "wal_prefetch"
+#define CONFIGURATION_ARGUMENT_WAL_COMPACTION_AGE     "wal_compaction_age"
+#define CONFIGURATION_ARGUMENT_MANIFEST_TREE          "manifest_tree"
+#define CONFIGURATION_ARGUMENT_INCREMENTAL_DELTA      "incremental_delta"
+#define CONFIGURATION_ARGUMENT_WORKER_CPUS            "worker_cpus"
+#define CONFIGURATION_ARGUMENT_RECEIVER_CPUS          "receiver_cpus"
+#define CONFIGURATION_ARGUMENT_COMPACTION_INTERVAL    "compaction_interval"
+#define CONFIGURATION_ARGUMENT_COMPACTION_CHAIN       "compaction_chain"
+#define CONFIGURATION_ARGUMENT_COMPACTION_MAX_RATE    "compaction_max_rate"
+#define CONFIGURATION_ARGUMENT_SCRUB_INTERVAL         "scrub_interval"
+#define CONFIGURATION_ARGUMENT_SCRUB_MAX_RATE         "scrub_max_rate"
 #define CONFIGURATION_ARGUMENT_KEEP_ALIVE             "keep_alive"
 #define CONFIGURATION_ARGUMENT_NODELAY                "nodelay"
 #define CONFIGURATION_ARGUMENT_NON_BLOCKING           "non_blocking"
+#define CONFIGURATION_ARGUMENT_TCP_BUFFER_SIZE        "tcp_buffer_size"
+#define CONFIGURATION_ARGUMENT_TCP_CONGESTION         "tcp_congestion"
+#define CONFIGURATION_ARGUMENT_DIRECT_IO              "direct_io"
 #define CONFIGURATION_ARGUMENT_BACKLOG                "backlog"
 #define CONFIGURATION_ARGUMENT_HUGEPAGE               "hugepage"
 #define CONFIGURATION_ARGUMENT_PIDFILE                "pidfile"
@@ -105,6 +145,12 @@ extern "C" {
 #define CONFIGURATION_ARGUMENT_HOT_STANDBY             "hot_standby"
 #define CONFIGURATION_ARGUMENT_HOT_STANDBY_OVERRIDES   "hot_standby_overrides"
 #define CONFIGURATION_ARGUMENT_HOT_STANDBY_TABLESPACES "hot_standby_tablespaces"
+#define CONFIGURATION_ARGUMENT_HOT_STANDBY_REPLAY      "hot_standby_replay"
+#define CONFIGURATION_ARGUMENT_TLS_KTLS                "tls_ktls"
+#define CONFIGURATION_ARGUMENT_BACKUP_CONNECTIONS      "backup_connections"
+#define CONFIGURATION_ARGUMENT_BACKUP_STANDBY          "backup_standby"
+#define CONFIGURATION_ARGUMENT_SNAPSHOT_COMMAND        "snapshot_command"
+#define CONFIGURATION_ARGUMENT_SNAPSHOT_RELEASE_COMMAND "snapshot_release_command"
 #define CONFIGURATION_ARGUMENT_EXTRA                   "extra"
 #define CONFIGURATION_ARGUMENT_MAIN_CONF_PATH          "main_configuration_path"
 #define CONFIGURATION_ARGUMENT_USER_CONF_PATH          "users_configuration_path"
@@ -212,8 +258,9 @@ pgmoneta_reload_configuration(bool* restart);
  * @param compression The compress method for wire protocol
  * @param encryption The encrypt method for wire protocol
  * @param payload The payload
+ * @return 0 upon success, otherwise 1
  */
-void
+int
 pgmoneta_conf_get(SSL* ssl, int client_fd, uint8_t compression, uint8_t encryption, struct json* payload);
 
 /**
@@ -40,12 +40,20 @@ extern "C" {
 #include <stdlib.h>
 
 /** @struct csv_reader
- * Defines a CSV reader
+ * Defines a CSV reader.
+ *
+ * The file is memory mapped and scanned with memchr, so rows have no length
+ * limit. The columns of a row point into a buffer owned by the reader
  */
 struct csv_reader
 {
-   FILE* file;     /**< The file */
-   char line[512]; /**< The line */
+   char* data;       /**< The mapped file */
+   size_t size;      /**< The size of the file */
+   size_t offset;    /**< The offset of the next row */
+   char* line;       /**< The buffer of the current row */
+   size_t line_size; /**< The size of the row buffer */
+   char** cols;      /**< The columns of the current row */
+   int cols_size;    /**< The capacity of the columns */
 };
 
 /** @struct csv_writer
@@ -53,7 +61,8 @@ struct csv_reader
  */
 struct csv_writer
 {
-   FILE* file; /**< The file */
+   FILE* file;   /**< The file */
+   char* buffer; /**< The buffer of the file */
 };
 
 /**
@@ -67,7 +76,7 @@ pgmoneta_csv_reader_init(char* path, struct csv_reader** reader);
 
 /**
  * Get the next row in csv file.
- * You need to do free(cols) as the structure is allocated by the function
+ * The columns are owned by the reader and are valid until the next call
  * @param reader The reader
  * @param num_col [out] The number of columns in the row
  * @param cols [out] The columns in the row
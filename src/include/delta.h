@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGMONETA_DELTA_H
+#define PGMONETA_DELTA_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgmoneta.h>
+#include <info.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** @struct delta
+ * Defines the versions of a file in a backup and its parents, newest first,
+ * down to the first full file. A block as of a version is the block of the
+ * first version that has it, XOR'ed with the block as of the next version
+ * while that block is delta encoded
+ */
+struct delta
+{
+   int number_of_sources;     /**< The number of sources */
+   struct rfile** sources;    /**< The sources */
+   bool* owned;               /**< Is the source destroyed with the versions */
+   uint32_t** index;          /**< The position plus one of each block of an incremental source */
+   uint32_t* index_length;    /**< The number of blocks of the index, or of a full source */
+   uint32_t block_size;       /**< The block size */
+   uint8_t* block;            /**< The buffer of a block */
+};
+
+/**
+ * Create empty versions
+ * @param server The server
+ * @param delta [out] The versions
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_delta_create(int server, struct delta** delta);
+
+/**
+ * Add a version that is owned by the caller
+ * @param delta The versions
+ * @param source The source
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_delta_add(struct delta* delta, struct rfile* source);
+
+/**
+ * Add the versions of a file in a backup and its parents, down to the first
+ * full file or the first backup without the file
+ * @param delta The versions
+ * @param server The server
+ * @param label The label of the backup
+ * @param relative_dir The directory of the file relative to the data directory
+ * @param base_file_name The name of the file without the incremental prefix
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_delta_extend(struct delta* delta, int server, char* label, char* relative_dir, char* base_file_name);
+
+/**
+ * Find a version
+ * @param delta The versions
+ * @param source The source
+ * @return The position of the version, or -1
+ */
+int
+pgmoneta_delta_find(struct delta* delta, struct rfile* source);
+
+/**
+ * XOR a block with the same block as of a version. A block which doesn't
+ * exist as of the version is zero, so the block is left as is
+ * @param delta The versions
+ * @param start The position of the version
+ * @param block_number The block number
+ * @param block The block
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_delta_apply(struct delta* delta, int start, uint32_t block_number, uint8_t* block);
+
+/**
+ * Destroy the versions
+ * @param delta The versions
+ */
+void
+pgmoneta_delta_destroy(struct delta* delta);
+
+/**
+ * Delta encode an incremental file of a backup against its parent backup
+ * @param server The server
+ * @param label The label of the backup
+ * @param parent_label The label of the parent backup
+ * @param relative_path The path of the incremental file relative to the data directory
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_delta_encode(int server, char* label, char* parent_label, char* relative_path);
+
+/**
+ * Delta encode the incremental files of a backup against its parent backup.
+ * The blocks of a file are XOR'ed with the same blocks as of the parent, so the
+ * blocks which changed a little compress to almost nothing. The checksums of
+ * the backup manifest are updated
+ * @param server The server
+ * @param label The label of the backup
+ * @param parent_label The label of the parent backup
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_delta_backup(int server, char* label, char* parent_label);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -36,6 +36,7 @@ extern "C" {
 #include <value.h>
 
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -45,13 +46,15 @@ extern "C" {
 struct deque_node
 {
    struct value* data;      /**< The value */
+   struct value value;      /**< The storage of the value */
    char* tag;               /**< The tag */
    struct deque_node* next; /**< The next pointer */
    struct deque_node* prev; /**< The previous pointer */
 };
 
 /** @struct deque
- * Defines a deque
+ * Defines a deque. Nodes added to a thread safe deque are pushed onto the inbox
+ * without taking the lock, and moved into the deque by the next operation that reads it
  */
 struct deque
 {
@@ -60,6 +63,9 @@ struct deque
    pthread_rwlock_t mutex;   /**< The mutex of the deque */
    struct deque_node* start; /**< The start node */
    struct deque_node* end;   /**< The end node */
+   struct deque_node* pool;  /**< The released nodes kept for reuse */
+   uint32_t pool_size;       /**< The number of pooled nodes */
+   _Atomic(struct deque_node*) inbox; /**< The nodes added concurrently, newest first */
 };
 
 /** @struct deque_iterator
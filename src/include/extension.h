@@ -41,6 +41,7 @@ extern "C" {
 
 #define MAX_QUERY_LENGTH 16384
 #define PGMONETA_CHUNK_SIZE 8192
+#define PGMONETA_CHUNKS_IN_FLIGHT 16
 
 /**
  * Check if the server has the extension installed
@@ -114,6 +115,17 @@ pgmoneta_ext_get_file(SSL* ssl, int socket, char* file_path, struct query_respon
 int
 pgmoneta_ext_get_files(SSL* ssl, int socket, char* file_path, struct query_response** qr);
 
+/**
+ * Retrieve the size and the modification time of the specified file
+ * @param ssl The SSL structure
+ * @param socket The socket
+ * @param file_path The path to the file
+ * @param qr The query result
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_ext_stat_file(SSL* ssl, int socket, char* file_path, struct query_response** qr);
+
 /**
  * Send a file chunk to the extension
  * @param ssl The SSL structure
@@ -126,6 +138,33 @@ pgmoneta_ext_get_files(SSL* ssl, int socket, char* file_path, struct query_respo
 int
 pgmoneta_ext_send_file_chunk(SSL* ssl, int socket, char* dest_path, char* base64_data, struct query_response** qr);
 
+/**
+ * Send several file chunks to the extension in one query, which are written in order
+ * @param ssl The SSL structure
+ * @param socket The socket
+ * @param dest_path The path where the file will be written
+ * @param base64_data The encoded file chunks in base64
+ * @param count The number of chunks
+ * @param qr The query result, a row for each chunk
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_ext_send_file_chunks(SSL* ssl, int socket, char* dest_path, char** base64_data, int count, struct query_response** qr);
+
+/**
+ * Retrieve the blocks of the relation files changed since a LSN. Each row has the path
+ * of a relation fork segment relative to the data directory, the number of blocks the
+ * bitmap covers and the bitmap in hex, where bit (i % 8) of byte (i / 8) is set when
+ * block i changed. A relation file without a row isn't tracked
+ * @param ssl The SSL structure
+ * @param socket The socket
+ * @param lsn The LSN, like 0/2000028
+ * @param qr The query result
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_ext_get_changed_blocks(SSL* ssl, int socket, char* lsn, struct query_response** qr);
+
 /**
  * Promote a standby (replica) server to become the primary server
  * @param ssl The SSL structure
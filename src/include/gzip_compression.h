@@ -35,6 +35,7 @@ extern "C" {
 
 #include <pgmoneta.h>
 #include <json.h>
+#include <reader.h>
 #include <workers.h>
 
 #include <stdlib.h>
@@ -102,6 +103,15 @@ pgmoneta_gunzip_request(SSL* ssl, int client_fd, uint8_t compression, uint8_t en
 int
 pgmoneta_gunzip_file(char* from, char* to);
 
+/**
+ * Create a GZIP decompression layer for a streaming reader
+ * @param source The layer holding the compressed data, owned by the new layer upon success
+ * @param reader The resulting reader
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_gunzip_reader(struct reader* source, struct reader** reader);
+
 /**
  * GUNZip a directory
  * @param directory The directory
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGMONETA_HASHCACHE_H
+#define PGMONETA_HASHCACHE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgmoneta.h>
+
+#include <stdlib.h>
+#include <sys/stat.h>
+
+/**
+ * Look up the hash of a file in the hash cache of the repository. The cache
+ * is keyed by the device, inode, size and modification time of the file, so
+ * a file that is linked into several backups is only hashed once. The hash is
+ * of the content after decompression and decryption
+ * @param path The path of the file
+ * @param algorithm The hash algorithm
+ * @param hash [out] The hash, or NULL if the file isn't in the cache
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_hashcache_lookup(char* path, int algorithm, char** hash);
+
+/**
+ * Store the hash of a file in the hash cache of the repository. The hash
+ * isn't stored if the file changed since the stat before it was hashed
+ * @param path The path of the file
+ * @param st The status of the file before it was hashed
+ * @param algorithm The hash algorithm
+ * @param hash The hash
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_hashcache_store(char* path, struct stat* st, int algorithm, char* hash);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
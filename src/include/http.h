@@ -42,8 +42,62 @@ extern "C" {
 #include <sys/stat.h>
 #include <sys/types.h>
 
-#define HTTP_GET 0
-#define HTTP_PUT 1
+#define HTTP_GET    0
+#define HTTP_PUT    1
+#define HTTP_POST   2
+#define HTTP_DELETE 3
+
+#define HTTP_UPLOAD_ATTEMPTS 5
+#define HTTP_BACKOFF_MIN     500
+#define HTTP_BACKOFF_MAX     30000
+
+struct http_upload;
+struct http_scheduler;
+
+/**
+ * Sign an upload. Called before each attempt, so the signature is never stale
+ * @param upload The upload
+ * @param headers The resulting headers
+ * @return 0 upon success, otherwise 1
+ */
+typedef int (*http_sign_func)(struct http_upload* upload, struct curl_slist** headers);
+
+/**
+ * Called when an upload is completed
+ * @param upload The upload
+ * @param data The data given to the scheduler
+ */
+typedef void (*http_done_func)(struct http_upload* upload, void* data);
+
+/** @struct http_upload
+ * Defines an upload of a file, or of a range of a file, with a PUT request.
+ * A download writes a range of an object into the same range of the file with a GET request
+ */
+struct http_upload
+{
+   char* local_path;            /**< The local file, or NULL for an empty body */
+   off_t offset;                /**< The offset of the range in the file */
+   off_t size;                  /**< The size of the range */
+   char* url;                   /**< The URL */
+   char* resource;              /**< The path of the object on the endpoint */
+   char* query;                 /**< The query string, or NULL */
+   char* source;                /**< The source of a server-side copy, or NULL */
+   bool optional;               /**< Is a failure left to the caller instead of failing the run */
+   bool download;               /**< Is the transfer a download */
+   http_sign_func sign;         /**< The sign function */
+   void* data;                  /**< The data of the sign function */
+   struct curl_slist* headers;  /**< The headers of the current attempt */
+   char etag[MISC_LENGTH];      /**< The ETag of the response */
+   long code;                   /**< The HTTP status of the last attempt */
+   int attempts;                /**< The number of attempts */
+   int state;                   /**< The state in the scheduler */
+   int fd;                      /**< The file descriptor during an attempt */
+   off_t sent;                  /**< The number of bytes sent, or received, in the current attempt */
+   CURL* handle;                /**< The easy handle of the current attempt */
+   bool paused;                 /**< Is the transfer paused by the rate limit */
+   uint64_t not_before;         /**< The earliest time of the next attempt, in milliseconds */
+   uint64_t started;            /**< The start of the current attempt, in microseconds */
+};
 
 /**
  * Add a header
@@ -71,7 +125,7 @@ pgmoneta_http_set_header_option(CURL* handle, struct curl_slist* chunk);
  * @return 0 upon success, otherwise 1
  */
 int
-pgmoneta_http_set_request_option(CURL* handle, bool request_type);
+pgmoneta_http_set_request_option(CURL* handle, int request_type);
 
 /**
  * set the URL
@@ -82,6 +136,151 @@ pgmoneta_http_set_request_option(CURL* handle, bool request_type);
 int
 pgmoneta_http_set_url_option(CURL* handle, char* url);
 
+/**
+ * Create an upload scheduler. The uploads run over a pool of keep-alive
+ * connections, so the TLS handshake is paid once per connection instead of
+ * once per file
+ * @param connections The number of concurrent uploads
+ * @param max_rate The maximum number of bytes sent per second, 0 for no limit
+ * @param scheduler The resulting scheduler
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_http_scheduler_create(int connections, long max_rate, struct http_scheduler** scheduler);
+
+/**
+ * Queue an upload. The strings are copied
+ * @param scheduler The scheduler
+ * @param local_path The local file, or NULL for an empty body
+ * @param offset The offset of the range in the file
+ * @param size The size of the range
+ * @param url The URL
+ * @param resource The path of the object on the endpoint
+ * @param query The query string, or NULL
+ * @param sign The sign function
+ * @param data The data of the sign function
+ * @param upload The queued upload, owned by the scheduler
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_http_scheduler_add(struct http_scheduler* scheduler, char* local_path, off_t offset, off_t size,
+                            char* url, char* resource, char* query, http_sign_func sign, void* data,
+                            struct http_upload** upload);
+
+/**
+ * Queue a server-side copy. The copy is an empty PUT, where the sign function
+ * adds the source header of the endpoint. A copy that fails is left in the
+ * failed state, so the caller can upload the file instead
+ * @param scheduler The scheduler
+ * @param url The URL
+ * @param resource The path of the object on the endpoint
+ * @param source The path of the source object
+ * @param sign The sign function
+ * @param data The data of the sign function
+ * @param upload The queued copy, owned by the scheduler
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_http_scheduler_copy(struct http_scheduler* scheduler, char* url, char* resource, char* source,
+                             http_sign_func sign, void* data, struct http_upload** upload);
+
+/**
+ * Queue a download of a range of an object. The range is written at the same
+ * offset in the local file, which is created if needed
+ * @param scheduler The scheduler
+ * @param local_path The local file
+ * @param offset The offset of the range
+ * @param size The size of the range
+ * @param url The URL
+ * @param resource The path of the object on the endpoint
+ * @param sign The sign function, which adds the range header of the endpoint
+ * @param data The data of the sign function
+ * @param upload The queued download, owned by the scheduler
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_http_scheduler_get(struct http_scheduler* scheduler, char* local_path, off_t offset, off_t size,
+                            char* url, char* resource, http_sign_func sign, void* data,
+                            struct http_upload** upload);
+
+/**
+ * Get the byte range of a download, on the form bytes=first-last
+ * @param upload The download
+ * @param range The resulting range
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_http_range(struct http_upload* upload, char** range);
+
+/**
+ * Get the value of the first element with a tag in an XML document
+ * @param xml The document
+ * @param tag The tag
+ * @param value The resulting value
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_http_xml_value(char* xml, char* tag, char** value);
+
+/**
+ * Has an upload failed
+ * @param upload The upload
+ * @return True if the upload failed, otherwise false
+ */
+bool
+pgmoneta_http_upload_failed(struct http_upload* upload);
+
+/**
+ * Run the queued uploads. Failed attempts are retried with an exponential
+ * backoff, up to HTTP_UPLOAD_ATTEMPTS times. Uploads queued after a run are
+ * started by the next run
+ * @param scheduler The scheduler
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_http_scheduler_run(struct http_scheduler* scheduler);
+
+/**
+ * Set the function that is called for each completed upload, for example to
+ * record the progress of a run that can be resumed
+ * @param scheduler The scheduler
+ * @param done The function, or NULL
+ * @param data The data of the function
+ */
+void
+pgmoneta_http_scheduler_on_done(struct http_scheduler* scheduler, http_done_func done, void* data);
+
+/**
+ * Get the number of bytes of the completed uploads
+ * @param scheduler The scheduler
+ * @return The number of bytes
+ */
+uint64_t
+pgmoneta_http_scheduler_bytes(struct http_scheduler* scheduler);
+
+/**
+ * Record the latency of each request of the schedulers of this process.
+ * Enabling the recording drops the earlier latencies. Used by the benchmark
+ * @param enable Is the recording enabled
+ */
+void
+pgmoneta_http_latency_record(bool enable);
+
+/**
+ * Get the recorded request latencies
+ * @param latencies The latencies in microseconds, owned by the recording
+ * @return The number of latencies
+ */
+int
+pgmoneta_http_latencies(uint64_t** latencies);
+
+/**
+ * Destroy an upload scheduler and its uploads
+ * @param scheduler The scheduler
+ */
+void
+pgmoneta_http_scheduler_destroy(struct http_scheduler* scheduler);
+
 #ifdef __cplusplus
 }
 #endif
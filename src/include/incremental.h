@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGMONETA_INCREMENTAL_H
+#define PGMONETA_INCREMENTAL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgmoneta.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+/**
+ * Make a full backup incremental to its parent from the LSN of the pages.
+ * Before PostgreSQL 17 the server has no WAL summaries, so it sends every
+ * file. A relation file is replaced by an INCREMENTAL. file with the blocks
+ * modified since the start of the parent, which are the blocks with a page
+ * LSN at or after it. The backup manifest and backup_label are updated, so
+ * the backup is combined like an incremental backup of PostgreSQL 17.
+ * The INCREMENTAL. files received from the changed blocks are kept
+ * @param server The server
+ * @param label The label of the backup
+ * @param parent_label The label of the parent backup
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_incremental_page_lsn(int server, char* label, char* parent_label);
+
+/**
+ * Is the path a relation file which can be stored as an incremental file
+ * @param path The path relative to the data directory
+ * @return True if it is, otherwise false
+ */
+bool
+pgmoneta_incremental_is_relation_file(char* path);
+
+/**
+ * Get the path of the incremental file of a relation file
+ * @param path The path of the relation file
+ * @return The path with INCREMENTAL. in front of the file name, or NULL
+ */
+char*
+pgmoneta_incremental_path(char* path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
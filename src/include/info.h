@@ -43,8 +43,11 @@ extern "C" {
 #define INFO_PGMONETA_VERSION          "PGMONETA_VERSION"
 #define INFO_BACKUP                    "BACKUP"
 #define INFO_BIGGEST_FILE              "BIGGEST_FILE"
+#define INFO_CHECKSUM_FAILED           "CHECKSUM_FAILED"
+#define INFO_CHECKSUM_PAGES            "CHECKSUM_PAGES"
 #define INFO_CHKPT_WALPOS              "CHKPT_WALPOS"
 #define INFO_COMMENTS                  "COMMENTS"
+#define INFO_DATA_KEY                  "DATA_KEY"
 #define INFO_COMPRESSION               "COMPRESSION"
 #define INFO_ELAPSED                   "ELAPSED"
 #define INFO_BASEBACKUP_ELAPSED        "BASEBACKUP_ELAPSED"
@@ -53,6 +56,8 @@ extern "C" {
 #define INFO_COMPRESSION_GZIP_ELAPSED  "COMPRESSION_GZIP_ELAPSED"
 #define INFO_COMPRESSION_BZIP2_ELAPSED "COMPRESSION_BZIP2_ELAPSED"
 #define INFO_COMPRESSION_LZ4_ELAPSED   "COMPRESSION_LZ4_ELAPSED"
+#define INFO_COMPRESSION_LEVEL_MIN     "COMPRESSION_LEVEL_MIN"
+#define INFO_COMPRESSION_LEVEL_MAX     "COMPRESSION_LEVEL_MAX"
 #define INFO_ENCRYPTION_ELAPSED        "ENCRYPTION_ELAPSED"
 #define INFO_LINKING_ELAPSED           "LINKING_ELAPSED"
 #define INFO_REMOTE_SSH_ELAPSED        "REMOTE_SSH_ELAPSED"
@@ -68,6 +73,8 @@ extern "C" {
 #define INFO_MAJOR_VERSION             "MAJOR_VERSION"
 #define INFO_MINOR_VERSION             "MINOR_VERSION"
 #define INFO_RESTORE                   "RESTORE"
+#define INFO_SCRUB                     "SCRUB"
+#define INFO_SCRUB_FAILED              "SCRUB_FAILED"
 #define INFO_START_TIMELINE            "START_TIMELINE"
 #define INFO_START_WALPOS              "START_WALPOS"
 #define INFO_STATUS                    "STATUS"
@@ -75,6 +82,11 @@ extern "C" {
 #define INFO_WAL                       "WAL"
 #define INFO_TYPE                      "TYPE"
 #define INFO_PARENT                    "PARENT"
+#define INFO_WORKERS_TASKS             "WORKERS_TASKS"
+#define INFO_WORKERS_BYTES             "WORKERS_BYTES"
+#define INFO_WORKERS_WAIT              "WORKERS_WAIT"
+#define INFO_WORKERS_EXECUTE           "WORKERS_EXECUTE"
+#define INFO_WORKERS_BUSY              "WORKERS_BUSY"
 
 #define TYPE_FULL        0
 #define TYPE_INCREMENTAL 1
@@ -84,9 +96,12 @@ extern "C" {
 #define VALID_TRUE     1
 
 #define INCREMENTAL_MAGIC 0xd3ae1f0d
+#define INCREMENTAL_DELTA_MAGIC 0xd3ae1f0e
 #define INCREMENTAL_PREFIX_LENGTH (sizeof(INCREMENTAL_PREFIX) - 1)
 #define MANIFEST_FILES "Files"
 
+struct zstd_seekable;
+
 /**
  * @struct rfile
  * An rfile stores the metadata we need to use a file on disk for reconstruction.
@@ -101,15 +116,19 @@ extern "C" {
  * while truncation_block_length only reflects length until the checkpoint before backup starts.
  * relative_block_numbers are the relative BlockNumber of each block in the file. Relative here means relative to
  * the starting BlockNumber of this file.
+ * delta tells that the blocks are stored as the XOR with the same block of the parent backup.
  */
 struct rfile
 {
    char* filepath;                     /**< The path of the backup file  */
    FILE* fp;                           /**< The file descriptor corresponding to the backup file */
+   struct zstd_seekable* seekable;     /**< The random access reader when the backup file is read in place */
+   uint64_t position;                  /**< The read position of the random access reader */
    size_t header_length;               /**< The header length */
    uint32_t num_blocks;                /**< The number of blocks present inside an incremental file */
    uint32_t* relative_block_numbers;   /**< relative_block_numbers are the relative BlockNumber of each block in the file */
    uint32_t truncation_block_length;   /**< truncation_block_length only reflects length until the checkpoint before backup starts. */
+   bool delta;                         /**< Are the blocks delta encoded against the parent backup */
 };
 
 /** @struct backup
@@ -152,13 +171,34 @@ struct backup
    uint32_t end_timeline;                                         /**< The ending timeline of the backup */
    int hash_algorithm;                                            /**< The hash algorithm for the manifest */
    int compression;                                               /**< The compression type */
+   int compression_level_min;                                     /**< The lowest adaptive compression level, 0 when fixed */
+   int compression_level_max;                                     /**< The highest adaptive compression level, 0 when fixed */
    int encryption;                                                /**< The encryption type */
    char comments[MAX_COMMENT];                                    /**< The comments */
    char extra[MAX_EXTRA_PATH];                                    /**< The extra directory */
    int type;                                                      /**< The backup type */
    char parent_label[MISC_LENGTH];                                /**< The label of backup's parent, only used when backup is incremental */
+   uint64_t scrub_time;                                           /**< The time of the last scrub, 0 if never scrubbed */
+   uint64_t scrub_failed;                                         /**< The number of files that failed the last scrub */
+   uint64_t checksum_pages;                                       /**< The number of pages with a verified checksum */
+   uint64_t checksum_failed;                                      /**< The number of pages that failed checksum verification */
+   char data_key[MAX_COMMENT];                                    /**< The data key wrapped with the master key, empty if none */
 } __attribute__ ((aligned (64)));
 
+/** @struct info_batch
+ * Defines a batch of updates to a backup information file, written at once
+ */
+struct info_batch
+{
+   char directory[MAX_PATH]; /**< The backup directory */
+   bool create;              /**< Whether the file is created instead of updated */
+   bool failed;              /**< Whether an update could not be recorded */
+   int number_of_entries;    /**< The number of keys */
+   int size;                 /**< The capacity of the keys and values */
+   char** keys;              /**< The keys, in the order they were set */
+   char** values;            /**< The values */
+};
+
 /**
  * Create a backup information file
  * @param directory The backup directory
@@ -168,6 +208,78 @@ struct backup
 void
 pgmoneta_create_info(char* directory, char* label, int status);
 
+/**
+ * Begin a batch of updates to a backup information file
+ * @param directory The backup directory
+ * @param batch The resulting batch
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_info_begin(char* directory, struct info_batch** batch);
+
+/**
+ * Begin a batch that creates a backup information file
+ * @param directory The backup directory
+ * @param label The label
+ * @param status The status
+ * @param batch The resulting batch
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_info_create(char* directory, char* label, int status, struct info_batch** batch);
+
+/**
+ * Set a value in a batch: unsigned long
+ * @param batch The batch
+ * @param key The key
+ * @param value The value
+ */
+void
+pgmoneta_info_set_unsigned_long(struct info_batch* batch, char* key, unsigned long value);
+
+/**
+ * Set a value in a batch: float
+ * @param batch The batch
+ * @param key The key
+ * @param value The value
+ */
+void
+pgmoneta_info_set_double(struct info_batch* batch, char* key, double value);
+
+/**
+ * Set a value in a batch: string
+ * @param batch The batch
+ * @param key The key
+ * @param value The value, or NULL for an empty value
+ */
+void
+pgmoneta_info_set_string(struct info_batch* batch, char* key, char* value);
+
+/**
+ * Set a value in a batch: bool
+ * @param batch The batch
+ * @param key The key
+ * @param value The value
+ */
+void
+pgmoneta_info_set_bool(struct info_batch* batch, char* key, bool value);
+
+/**
+ * Write a batch to the backup information file with a single fsync and rename,
+ * and destroy the batch
+ * @param batch The batch
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_info_commit(struct info_batch* batch);
+
+/**
+ * Destroy a batch without writing it
+ * @param batch The batch
+ */
+void
+pgmoneta_info_rollback(struct info_batch* batch);
+
 /**
  * Update backup information: unsigned long
  * @param directory The backup directory
@@ -227,7 +339,10 @@ int
 pgmoneta_get_info_string(struct backup* backup, char* key, char** value);
 
 /**
- * Get the backups
+ * Get the backups.
+ * The backups are served from a binary catalog next to the directory as long
+ * as neither the directory nor any backup information has changed since
+ * the catalog was written
  * @param directory The directory
  * @param number_of_backups The number of backups
  * @param backups The backups
@@ -236,6 +351,12 @@ pgmoneta_get_info_string(struct backup* backup, char* key, char** value);
 int
 pgmoneta_get_backups(char* directory, int* number_of_backups, struct backup*** backups);
 
+/**
+ * Invalidate the backup catalogs
+ */
+void
+pgmoneta_invalidate_backups(void);
+
 /**
  * Get a backup
  * @param directory The directory
@@ -311,8 +432,9 @@ pgmoneta_get_backup_child(int server, struct backup* backup, struct backup** chi
  * @param compression The compress method for wire protocol
  * @param encryption The encrypt method for wire protocol
  * @param payload The payload
+ * @return 0 upon success, otherwise 1
  */
-void
+int
 pgmoneta_info_request(SSL* ssl, int client_fd, int server, uint8_t compression, uint8_t encryption, struct json* payload);
 
 /**
@@ -327,6 +449,29 @@ pgmoneta_info_request(SSL* ssl, int client_fd, int server, uint8_t compression,
 void
 pgmoneta_annotate_request(SSL* ssl, int client_fd, int server, uint8_t compression, uint8_t encryption, struct json* payload);
 
+/**
+ * Get the name of a file as stored in a backup, with the compression
+ * and encryption suffixes
+ * @param file The file
+ * @param encryption The encryption method
+ * @param compression The compression method
+ * @param finalname [out] The name
+ * @return 0 if success, otherwise 1
+ */
+int
+pgmoneta_backup_file_final_name(char* file, int encryption, int compression, char** finalname);
+
+/**
+ * Find a file of a backup manifest, which is stored with the compression
+ * and encryption suffixes of the backup unless it was restored
+ * @param directory The directory
+ * @param name The name of the file in the manifest
+ * @param backup The backup
+ * @return The path, or NULL if the file doesn't exist
+ */
+char*
+pgmoneta_backup_file_find(char* directory, char* name, struct backup* backup);
+
 /**
  * Create an rfile structure of a backup file
  * @param server The server
@@ -348,6 +493,54 @@ pgmoneta_rfile_create(int server, char* label, char* relative_dir, char* base_fi
 void
 pgmoneta_rfile_destroy(struct rfile* rf);
 
+/**
+ * Read from the current position of an rfile
+ * @param rf The rfile
+ * @param buffer The buffer
+ * @param size The number of bytes to read
+ * @return The number of bytes read
+ */
+size_t
+pgmoneta_rfile_read(struct rfile* rf, void* buffer, size_t size);
+
+/**
+ * Get the uncompressed size of the file behind an rfile
+ * @param rf The rfile
+ * @return The size
+ */
+size_t
+pgmoneta_rfile_size(struct rfile* rf);
+
+/**
+ * Set the read position of an rfile
+ * @param rf The rfile
+ * @param offset The offset from the start of the file
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_rfile_seek(struct rfile* rf, off_t offset);
+
+/**
+ * Read from an offset of an rfile without moving its read position
+ * @param rf The rfile
+ * @param offset The offset from the start of the file
+ * @param buffer The buffer
+ * @param size The number of bytes to read
+ * @return The number of bytes read
+ */
+size_t
+pgmoneta_rfile_read_at(struct rfile* rf, off_t offset, void* buffer, size_t size);
+
+/**
+ * Ask the kernel to read a range of an rfile ahead of its use.
+ * Only plain files are read ahead
+ * @param rf The rfile
+ * @param offset The offset from the start of the file
+ * @param size The number of bytes
+ */
+void
+pgmoneta_rfile_prefetch(struct rfile* rf, off_t offset, size_t size);
+
 /**
  * Initialize an rfile structure of an incremental file by reading the incremental file headers
  * @param server The server
@@ -363,7 +556,7 @@ int
 pgmoneta_incremental_rfile_initialize(int server, char* label, char* relative_dir, char* base_file_name, int encryption, int compression, struct rfile** rfile);
 
 /**
- * Extract a file from a backup
+ * Extract a file from a backup, decrypting and decompressing it in one pass
  * @param server The server
  * @param label The label
  * @param relative_file_path The file path relative to the backup data directory
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGMONETA_JOURNAL_H
+#define PGMONETA_JOURNAL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgmoneta.h>
+#include <art.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#define JOURNAL_SUFFIX ".journal"
+
+/** @struct journal
+ * Defines the progress journal of an upload.
+ *
+ * Each entry is a line of a key and a value, which is written and synced
+ * when the step is done, so an upload that is restarted can skip the steps
+ * that are already done. A line that was cut short by a crash is ignored
+ */
+struct journal
+{
+   char path[MAX_PATH];   /**< The path of the journal */
+   FILE* file;            /**< The file the entries are appended to */
+   struct art* entries;   /**< The entries */
+   pthread_mutex_t lock;  /**< The lock of the entries and the file */
+};
+
+/**
+ * Open the journal of an engine in a directory, and read its entries
+ * @param directory The directory
+ * @param name The name of the engine
+ * @param journal The resulting journal
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_journal_open(char* directory, char* name, struct journal** journal);
+
+/**
+ * Get the value of an entry
+ * @param journal The journal, or NULL
+ * @param key The key
+ * @return The value, owned by the journal, or NULL if there is no entry
+ */
+char*
+pgmoneta_journal_get(struct journal* journal, char* key);
+
+/**
+ * Does the journal have an entry
+ * @param journal The journal, or NULL
+ * @param key The key
+ * @return True if there is an entry, otherwise false
+ */
+bool
+pgmoneta_journal_contains(struct journal* journal, char* key);
+
+/**
+ * Add an entry. The key and the value can't contain a tab or a newline
+ * @param journal The journal, or NULL
+ * @param key The key
+ * @param value The value, or NULL for an empty value
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_journal_add(struct journal* journal, char* key, char* value);
+
+/**
+ * Get the number of entries
+ * @param journal The journal, or NULL
+ * @return The number of entries
+ */
+int
+pgmoneta_journal_size(struct journal* journal);
+
+/**
+ * Close a journal
+ * @param journal The journal
+ * @param remove Remove the journal, because the upload is done
+ */
+void
+pgmoneta_journal_close(struct journal* journal, bool remove);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -40,6 +40,9 @@ extern "C" {
 
 /* System */
 #include <stdarg.h>
+#include <stdio.h>
+
+#define JSON_MAX_DEPTH 64
 
 enum json_type {
    JSONUnknown,
@@ -83,6 +86,31 @@ struct json_reader
    enum parse_state state; /**< The current reader state of the JSON reader */
 };
 
+/** @struct json_handler
+ * Defines the callbacks of the streaming JSON parser. The key is the member name inside an
+ * item and NULL inside an array, and like string values it is only valid during the callback.
+ * Any callback can be NULL, and a callback returning non-zero stops the parsing
+ */
+struct json_handler
+{
+   int (*item_start)(void* data, char* key);                                   /**< An item starts */
+   int (*item_end)(void* data);                                                /**< An item ends */
+   int (*array_start)(void* data, char* key);                                  /**< An array starts */
+   int (*array_end)(void* data);                                               /**< An array ends */
+   int (*value)(void* data, char* key, uintptr_t value, enum value_type type); /**< A string, number, boolean or null value */
+};
+
+/** @struct json_writer
+ * Defines an incremental JSON writer, the output has the same layout as pgmoneta_json_to_string
+ */
+struct json_writer
+{
+   FILE* file;                  /**< The file */
+   int depth;                   /**< The number of open items and arrays */
+   bool empty[JSON_MAX_DEPTH];  /**< Is the item or array at a depth still empty */
+   bool error;                  /**< Did a write fail */
+};
+
 /** @struct json_iterator
  * Defines a JSON iterator
  */
@@ -305,6 +333,112 @@ pgmoneta_json_read_file(char* path, struct json** obj);
 int
 pgmoneta_json_write_file(char* path, struct json* obj);
 
+/**
+ * Parse a json file as a stream of events, using constant memory whatever the size of the file.
+ * Numbers are reported as ValueInt64 or ValueDouble, booleans as ValueBool, and strings and
+ * null as ValueString, where null is a NULL string
+ * @param path The path
+ * @param handler The callbacks
+ * @param data The data passed to the callbacks
+ * @return 0 if the whole file was parsed, 1 if otherwise
+ */
+int
+pgmoneta_json_stream(char* path, struct json_handler* handler, void* data);
+
+/**
+ * Create a json writer
+ * @param path The path
+ * @param writer [out] The writer
+ * @return 0 if success, 1 if otherwise
+ */
+int
+pgmoneta_json_writer_init(char* path, struct json_writer** writer);
+
+/**
+ * Start an item
+ * @param writer The writer
+ * @param key The key inside an item, NULL inside an array or at the top level
+ * @return 0 if success, 1 if otherwise
+ */
+int
+pgmoneta_json_writer_item_start(struct json_writer* writer, char* key);
+
+/**
+ * End the current item
+ * @param writer The writer
+ * @return 0 if success, 1 if otherwise
+ */
+int
+pgmoneta_json_writer_item_end(struct json_writer* writer);
+
+/**
+ * Start an array
+ * @param writer The writer
+ * @param key The key inside an item, NULL inside an array or at the top level
+ * @return 0 if success, 1 if otherwise
+ */
+int
+pgmoneta_json_writer_array_start(struct json_writer* writer, char* key);
+
+/**
+ * End the current array
+ * @param writer The writer
+ * @return 0 if success, 1 if otherwise
+ */
+int
+pgmoneta_json_writer_array_end(struct json_writer* writer);
+
+/**
+ * Write a value
+ * @param writer The writer
+ * @param key The key inside an item, NULL inside an array
+ * @param val The value data
+ * @param type The value type
+ * @return 0 if success, 1 if otherwise
+ */
+int
+pgmoneta_json_writer_put(struct json_writer* writer, char* key, uintptr_t val, enum value_type type);
+
+/**
+ * Write a json object without converting it to a string first
+ * @param writer The writer
+ * @param key The key inside an item, NULL inside an array or at the top level
+ * @param obj The json object
+ * @return 0 if success, 1 if otherwise
+ */
+int
+pgmoneta_json_writer_put_json(struct json_writer* writer, char* key, struct json* obj);
+
+/**
+ * Encode a json object in the compact binary encoding. Every value is a tag byte followed
+ * by its payload; integers and lengths are varints, so the encoding is usually smaller
+ * and much cheaper to produce and parse than the json string
+ * @param object The json object
+ * @param buffer [out] The encoded buffer
+ * @param size [out] The size of the buffer
+ * @return 0 if success, 1 if otherwise
+ */
+int
+pgmoneta_json_to_binary(struct json* object, unsigned char** buffer, size_t* size);
+
+/**
+ * Decode a json object from the compact binary encoding
+ * @param buffer The encoded buffer
+ * @param size The size of the buffer
+ * @param object [out] The json object
+ * @return 0 if success, 1 if otherwise
+ */
+int
+pgmoneta_json_from_binary(unsigned char* buffer, size_t size, struct json** object);
+
+/**
+ * Close and free the json writer
+ * @param writer The writer
+ * @return 0 if all the writes succeeded and everything was closed, 1 if otherwise
+ */
+int
+pgmoneta_json_writer_close(struct json_writer* writer);
+
 #ifdef __cplusplus
 }
 #endif
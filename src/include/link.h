@@ -35,6 +35,7 @@ extern "C" {
 
 #include <pgmoneta.h>
 #include <art.h>
+#include <manifest.h>
 #include <workers.h>
 
 #include <stdlib.h>
@@ -44,13 +45,33 @@ extern "C" {
  * @param base_from The base from directory (newer)
  * @param base_to The base to directory
  * @param from The current from directory
- * @param changed The changed files
- * @param added The added files
+ * @param diff The difference of the manifests
  * @param workers The optional workers
  * @return 0 upon success, otherwise 1
  */
 int
-pgmoneta_link_manifest(char* base_from, char* base_to, char* from, struct art* changed, struct art* added, struct workers* workers);
+pgmoneta_link_manifest(char* base_from, char* base_to, char* from, struct manifest_diff* diff, struct workers* workers);
+
+/**
+ * Find the previous valid backup of a backup, and the files of the backup
+ * that differ from it
+ * @param server The server
+ * @param label The label of the backup
+ * @param previous The label of the previous backup, or NULL if there is none
+ * @param diff The difference of the manifests, spilled to the workspace
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_link_delta(int server, char* label, char** previous, struct manifest_diff** diff);
+
+/**
+ * Is a file of a backup unchanged from the previous backup
+ * @param relative_file The path of the file relative to the data directory
+ * @param diff The difference of the manifests
+ * @return True if the file can be shared with the previous backup, otherwise false
+ */
+bool
+pgmoneta_link_is_unchanged(char* relative_file, struct manifest_diff* diff);
 
 /**
  * Relink link two directories
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGMONETA_LOCK_H
+#define PGMONETA_LOCK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgmoneta.h>
+#include <info.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#define LOCK_SHARED    0
+#define LOCK_EXCLUSIVE 1
+
+/** @struct lock
+ * Defines the repository and backup locks held by an operation. The locks
+ * are kept in shared memory, and are only ever tried, so an operation that
+ * can't get one reports the server as active instead of waiting
+ */
+struct lock
+{
+   int server;                               /**< The server */
+   int repository;                           /**< The mode of the repository lock */
+   int backups[NUMBER_OF_BACKUP_LOCKS];      /**< The modes of the backup locks plus one, 0 when not held */
+};
+
+/**
+ * Lock the repository of a server. Operations on single backups take it
+ * shared, operations on the whole repository take it exclusive
+ * @param server The server
+ * @param mode The mode, LOCK_SHARED or LOCK_EXCLUSIVE
+ * @param lock The resulting lock
+ * @return 0 upon success, otherwise 1 when the repository is locked
+ */
+int
+pgmoneta_lock_repository(int server, int mode, struct lock** lock);
+
+/**
+ * Lock a backup. The backups are locked by the hash of their label, so
+ * an unrelated backup may share the lock. A shared lock held by the lock
+ * alone is upgraded to exclusive
+ * @param lock The repository lock, taken shared
+ * @param label The label of the backup
+ * @param mode The mode, LOCK_SHARED or LOCK_EXCLUSIVE
+ * @return 0 upon success, otherwise 1 when the backup is locked
+ */
+int
+pgmoneta_lock_backup(struct lock* lock, char* label, int mode);
+
+/**
+ * Lock a backup and the backups it is incremental to shared, for
+ * operations that read the backup
+ * @param lock The repository lock, taken shared
+ * @param backup The backup
+ * @return 0 upon success, otherwise 1 when a backup is locked
+ */
+int
+pgmoneta_lock_backup_chain(struct lock* lock, struct backup* backup);
+
+/**
+ * Release the backup locks and the repository lock
+ * @param lock The lock, may be NULL
+ */
+void
+pgmoneta_unlock(struct lock* lock);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
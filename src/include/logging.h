@@ -35,8 +35,10 @@ extern "C" {
 
 #include <pgmoneta.h>
 
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <sys/types.h>
 
 #define PGMONETA_LOGGING_TYPE_CONSOLE 0
 #define PGMONETA_LOGGING_TYPE_FILE    1
@@ -59,6 +61,11 @@ extern "C" {
 
 #define PGMONETA_LOGGING_DEFAULT_LOG_LINE_PREFIX "%Y-%m-%d %H:%M:%S"
 
+#define PGMONETA_LOGGING_RING_SLOTS     2048
+#define PGMONETA_LOGGING_RING_LINE_SIZE 1024
+#define PGMONETA_LOGGING_RING_INTERVAL  0.1
+#define PGMONETA_LOGGING_RING_TIMEOUT   5
+
 #define pgmoneta_log_trace(...) pgmoneta_log_line(PGMONETA_LOGGING_LEVEL_DEBUG5, __FILE__, __LINE__, __VA_ARGS__)
 #define pgmoneta_log_debug(...) pgmoneta_log_line(PGMONETA_LOGGING_LEVEL_DEBUG1, __FILE__, __LINE__, __VA_ARGS__)
 #define pgmoneta_log_info(...)  pgmoneta_log_line(PGMONETA_LOGGING_LEVEL_INFO, __FILE__, __LINE__, __VA_ARGS__)
@@ -70,6 +77,32 @@ extern "C" {
  * Initialize the logging system
  * @return 0 upon success, otherwise 1
  */
+/** @struct log_slot
+ * Defines a formatted log line in the log ring
+ */
+struct log_slot
+{
+   atomic_ulong sequence;                        /**< The position the slot is published for, plus one */
+   size_t length;                                /**< The length of the line */
+   char line[PGMONETA_LOGGING_RING_LINE_SIZE];   /**< The line */
+};
+
+/** @struct log_ring
+ * Defines a bounded multi producer, single consumer ring of log lines in shared memory.
+ * A producer reserves a position by moving the head, copies its line into the slot and
+ * publishes it through the sequence of the slot. The main process is the only writer,
+ * and writes the published lines in batches. A slot reserved but not published for
+ * PGMONETA_LOGGING_RING_TIMEOUT seconds, like by a killed process, is skipped
+ */
+struct log_ring
+{
+   pid_t writer;                                          /**< The process writing the lines */
+   atomic_ulong head;                                     /**< The next position to reserve */
+   atomic_ulong tail;                                     /**< The next position to write */
+   atomic_ulong dropped;                                  /**< The lines dropped since the ring was full */
+   struct log_slot slots[PGMONETA_LOGGING_RING_SLOTS];    /**< The slots */
+};
+
 int
 pgmoneta_init_logging(void);
 
@@ -115,6 +148,25 @@ pgmoneta_log_line(int level, char* file, int line, char* fmt, ...);
 void
 pgmoneta_log_mem(void* data, size_t size);
 
+/**
+ * Create the log ring in shared memory, with the calling process as the writer.
+ * Forked processes append their log lines to the ring instead of writing them
+ * @param p_size [out] The size of the shared memory
+ * @param p_shmem [out] The shared memory
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_init_log_ring(size_t* p_size, void** p_shmem);
+
+/**
+ * Write the published lines of the log ring, and report the dropped lines.
+ * Only the writer of the ring writes, in other processes this does nothing.
+ * A slot which stays reserved past PGMONETA_LOGGING_RING_TIMEOUT is skipped
+ * and counted as dropped
+ */
+void
+pgmoneta_log_ring_flush(void);
+
 /**
  * Utility function to understand if log rotation
  * is enabled or not.
@@ -35,6 +35,7 @@ extern "C" {
 
 #include <pgmoneta.h>
 #include <json.h>
+#include <reader.h>
 #include <workers.h>
 
 #include <stdlib.h>
@@ -94,6 +95,15 @@ pgmoneta_lz4d_request(SSL* ssl, int client_fd, uint8_t compression, uint8_t encr
 int
 pgmoneta_lz4d_file(char* from, char* to);
 
+/**
+ * Create a LZ4 decompression layer for a streaming reader
+ * @param source The layer holding the compressed data, owned by the new layer upon success
+ * @param reader The resulting reader
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_lz4d_reader(struct reader* source, struct reader** reader);
+
 /**
  * LZ4 compress a single file, also remove the original file
  * @param ssl The SSL
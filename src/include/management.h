@@ -56,6 +56,10 @@ extern "C" {
 #define MANAGEMENT_ENCRYPTION_AES192    2
 #define MANAGEMENT_ENCRYPTION_AES128    3
 
+/* Set in the compression byte to use the compact binary encoding instead of json text.
+ * The server answers in the encoding of the request. It can't be combined with compression */
+#define MANAGEMENT_ENCODING_BINARY      0x80
+
 /**
  * Management commands
  */
@@ -90,6 +94,19 @@ extern "C" {
 #define MANAGEMENT_REMOVE_USER    27
 #define MANAGEMENT_LIST_USERS     28
 
+#define MANAGEMENT_SUBSCRIBE      29
+
+#define MANAGEMENT_PROFILE        30
+
+#define MANAGEMENT_WAL_FETCH      31
+
+#define MANAGEMENT_WAL_PUSH       32
+
+/**
+ * The size of the data blocks that follow a request, a block fits in a TLS record
+ */
+#define MANAGEMENT_DATA_BLOCK_SIZE 16384
+
 /**
  * Management categories
  */
@@ -103,26 +120,36 @@ extern "C" {
  */
 #define MANAGEMENT_ARGUMENT_ACTION                "Action"
 #define MANAGEMENT_ARGUMENT_ALL                   "All"
+#define MANAGEMENT_ARGUMENT_AVERAGE               "Average"
 #define MANAGEMENT_ARGUMENT_BACKUP                "Backup"
 #define MANAGEMENT_ARGUMENT_BACKUPS               "Backups"
 #define MANAGEMENT_ARGUMENT_BACKUP_SIZE           "BackupSize"
 #define MANAGEMENT_ARGUMENT_BIGGEST_FILE_SIZE     "BiggestFileSize"
+#define MANAGEMENT_ARGUMENT_BYTES                 "Bytes"
+#define MANAGEMENT_ARGUMENT_BYTES_TOTAL           "BytesTotal"
+#define MANAGEMENT_ARGUMENT_CACHED                "Cached"
 #define MANAGEMENT_ARGUMENT_CALCULATED            "Calculated"
+#define MANAGEMENT_ARGUMENT_CALLS                 "Calls"
 #define MANAGEMENT_ARGUMENT_CHECKPOINT_HILSN      "CheckpointHiLSN"
 #define MANAGEMENT_ARGUMENT_CHECKPOINT_LOLSN      "CheckpointLoLSN"
 #define MANAGEMENT_ARGUMENT_CHECKSUMS             "Checksums"
+#define MANAGEMENT_ARGUMENT_CHUNK                 "Chunk"
 #define MANAGEMENT_ARGUMENT_CLIENT_VERSION        "ClientVersion"
 #define MANAGEMENT_ARGUMENT_COMMAND               "Command"
 #define MANAGEMENT_ARGUMENT_COMMENT               "Comment"
 #define MANAGEMENT_ARGUMENT_COMMENTS              "Comments"
 #define MANAGEMENT_ARGUMENT_COMPRESSION           "Compression"
 #define MANAGEMENT_ARGUMENT_COMPRESSION           "Compression"
+#define MANAGEMENT_ARGUMENT_CONFIDENCE            "Confidence"
 #define MANAGEMENT_ARGUMENT_CONFIG_KEY            "ConfigKey"
 #define MANAGEMENT_ARGUMENT_CONFIG_VALUE          "ConfigValue"
+#define MANAGEMENT_ARGUMENT_COVERAGE              "Coverage"
 #define MANAGEMENT_ARGUMENT_DELTA                 "Delta"
 #define MANAGEMENT_ARGUMENT_DESTINATION_FILE      "DestinationFile"
 #define MANAGEMENT_ARGUMENT_DIRECTORY             "Directory"
+#define MANAGEMENT_ARGUMENT_DUPLICATE             "Duplicate"
 #define MANAGEMENT_ARGUMENT_ELAPSED               "Elapsed"
+#define MANAGEMENT_ARGUMENT_ENABLED               "Enabled"
 #define MANAGEMENT_ARGUMENT_ENCRYPTION            "Encryption"
 #define MANAGEMENT_ARGUMENT_ENCRYPTION            "Encryption"
 #define MANAGEMENT_ARGUMENT_END_HILSN             "EndHiLSN"
@@ -130,34 +157,53 @@ extern "C" {
 #define MANAGEMENT_ARGUMENT_END_TIMELINE          "EndTimeline"
 #define MANAGEMENT_ARGUMENT_ERROR                 "Error"
 #define MANAGEMENT_ARGUMENT_FAILED                "Failed"
+#define MANAGEMENT_ARGUMENT_FIELDS                "Fields"
 #define MANAGEMENT_ARGUMENT_FILENAME              "FileName"
 #define MANAGEMENT_ARGUMENT_FILES                 "Files"
+#define MANAGEMENT_ARGUMENT_FILES_TOTAL           "FilesTotal"
 #define MANAGEMENT_ARGUMENT_FREE_SPACE            "FreeSpace"
 #define MANAGEMENT_ARGUMENT_HASH_ALGORITHM        "HashAlgorithm"
 #define MANAGEMENT_ARGUMENT_HOT_STANDBY_SIZE      "HotStandbySize"
 #define MANAGEMENT_ARGUMENT_INCREMENTAL           "Incremental"
 #define MANAGEMENT_ARGUMENT_INCREMENTAL_PARENT    "IncrementalParent"
+#define MANAGEMENT_ARGUMENT_INTERVAL              "Interval"
 #define MANAGEMENT_ARGUMENT_KEEP                  "Keep"
 #define MANAGEMENT_ARGUMENT_KEY                   "Key"
+#define MANAGEMENT_ARGUMENT_LIMIT                 "Limit"
 #define MANAGEMENT_ARGUMENT_MAJOR_VERSION         "MajorVersion"
+#define MANAGEMENT_ARGUMENT_MAX                   "Max"
 #define MANAGEMENT_ARGUMENT_MINOR_VERSION         "MinorVersion"
+#define MANAGEMENT_ARGUMENT_MORE                  "More"
+#define MANAGEMENT_ARGUMENT_NAME                  "Name"
 #define MANAGEMENT_ARGUMENT_NUMBER_OF_BACKUPS     "NumberOfBackups"
 #define MANAGEMENT_ARGUMENT_NUMBER_OF_SERVERS     "NumberOfServers"
 #define MANAGEMENT_ARGUMENT_NUMBER_OF_TABLESPACES "NumberOfTablespaces"
 #define MANAGEMENT_ARGUMENT_OFFLINE               "Offline"
+#define MANAGEMENT_ARGUMENT_OFFSET                "Offset"
 #define MANAGEMENT_ARGUMENT_ORIGINAL              "Original"
 #define MANAGEMENT_ARGUMENT_OUTPUT                "Output"
+#define MANAGEMENT_ARGUMENT_PARTIAL               "Partial"
+#define MANAGEMENT_ARGUMENT_PHASE                 "Phase"
 #define MANAGEMENT_ARGUMENT_POSITION              "Position"
+#define MANAGEMENT_ARGUMENT_PROBES                "Probes"
+#define MANAGEMENT_ARGUMENT_PROGRESS              "Progress"
+#define MANAGEMENT_ARGUMENT_REMAINING             "Remaining"
+#define MANAGEMENT_ARGUMENT_REQUEST_ID            "RequestId"
+#define MANAGEMENT_ARGUMENT_RESET                 "Reset"
 #define MANAGEMENT_ARGUMENT_RESTART               "Restart"
 #define MANAGEMENT_ARGUMENT_RESTORE_SIZE          "RestoreSize"
 #define MANAGEMENT_ARGUMENT_RETENTION_DAYS        "RetentionDays"
 #define MANAGEMENT_ARGUMENT_RETENTION_MONTHS      "RetentionMonths"
 #define MANAGEMENT_ARGUMENT_RETENTION_WEEKS       "RetentionWeeks"
 #define MANAGEMENT_ARGUMENT_RETENTION_YEARS       "RetentionYears"
+#define MANAGEMENT_ARGUMENT_ROTATION              "Rotation"
+#define MANAGEMENT_ARGUMENT_SAMPLE                "Sample"
 #define MANAGEMENT_ARGUMENT_SERVER                "Server"
 #define MANAGEMENT_ARGUMENT_SERVERS               "Servers"
 #define MANAGEMENT_ARGUMENT_SERVER_SIZE           "ServerSize"
 #define MANAGEMENT_ARGUMENT_SERVER_VERSION        "ServerVersion"
+#define MANAGEMENT_ARGUMENT_SESSION               "Session"
+#define MANAGEMENT_ARGUMENT_SINCE                 "Since"
 #define MANAGEMENT_ARGUMENT_SORT                  "Sort"
 #define MANAGEMENT_ARGUMENT_SOURCE_FILE           "SourceFile"
 #define MANAGEMENT_ARGUMENT_START_HILSN           "StartHiLSN"
@@ -167,9 +213,12 @@ extern "C" {
 #define MANAGEMENT_ARGUMENT_TABLESPACE            "Tablespace"
 #define MANAGEMENT_ARGUMENT_TABLESPACES           "Tablespaces"
 #define MANAGEMENT_ARGUMENT_TABLESPACE_NAME       "TablespaceName"
+#define MANAGEMENT_ARGUMENT_THROUGHPUT            "Throughput"
 #define MANAGEMENT_ARGUMENT_TIME                  "Time"
 #define MANAGEMENT_ARGUMENT_TIMESTAMP             "Timestamp"
+#define MANAGEMENT_ARGUMENT_TOTAL                 "Total"
 #define MANAGEMENT_ARGUMENT_TOTAL_SPACE           "TotalSpace"
+#define MANAGEMENT_ARGUMENT_UNTIL                 "Until"
 #define MANAGEMENT_ARGUMENT_USED_SPACE            "UsedSpace"
 #define MANAGEMENT_ARGUMENT_VALID                 "Valid"
 #define MANAGEMENT_ARGUMENT_WAL                   "WAL"
@@ -245,6 +294,7 @@ extern "C" {
 #define MANAGEMENT_ERROR_VERIFY_NOFORK   804
 #define MANAGEMENT_ERROR_VERIFY_NETWORK  805
 #define MANAGEMENT_ERROR_VERIFY_ERROR    806
+#define MANAGEMENT_ERROR_VERIFY_ACTIVE   807
 
 #define MANAGEMENT_ERROR_ARCHIVE_NOBACKUP 900
 #define MANAGEMENT_ERROR_ARCHIVE_NOSERVER 901
@@ -344,6 +394,18 @@ extern "C" {
 #define MANAGEMENT_ERROR_CONF_SET_NETWORK                   2706
 #define MANAGEMENT_ERROR_CONF_SET_ERROR                     2707
 
+#define MANAGEMENT_ERROR_WAL_FETCH_NOSERVER 2800
+#define MANAGEMENT_ERROR_WAL_FETCH_NOFORK   2801
+#define MANAGEMENT_ERROR_WAL_FETCH_NOFILE   2802
+#define MANAGEMENT_ERROR_WAL_FETCH_NETWORK  2803
+#define MANAGEMENT_ERROR_WAL_FETCH_ERROR    2804
+
+#define MANAGEMENT_ERROR_WAL_PUSH_NOSERVER 2900
+#define MANAGEMENT_ERROR_WAL_PUSH_NOFORK   2901
+#define MANAGEMENT_ERROR_WAL_PUSH_EXISTS   2902
+#define MANAGEMENT_ERROR_WAL_PUSH_NETWORK  2903
+#define MANAGEMENT_ERROR_WAL_PUSH_ERROR    2904
+
 /**
  * Output formats
  */
@@ -398,7 +460,7 @@ pgmoneta_management_create_outcome_failure(struct json* json, int32_t error, cha
  * Create a backup request
  * @param ssl The SSL connection
  * @param socket The socket descriptor
- * @param server The server
+ * @param server The server, or NULL for all servers
  * @param compression The compress method for wire protocol
  * @param encryption The encrypt method for wire protocol
  * @param incremental The base of incremental backup
@@ -442,17 +504,18 @@ pgmoneta_management_request_restore(SSL* ssl, int socket, char* server, char* ba
  * Create a verify request
  * @param ssl The SSL connection
  * @param socket The socket descriptor
- * @param server The server
+ * @param server The server, or NULL for all servers
  * @param backup_id The backup
  * @param directory The directory
  * @param files The files filter
+ * @param sample The percentage of the bytes to verify, 0 for all
  * @param compression The compress method for wire protocol
  * @param encryption The encrypt method for wire protocol
  * @param output_format The output format
  * @return 0 upon success, otherwise 1
  */
 int
-pgmoneta_management_request_verify(SSL* ssl, int socket, char* server, char* backup_id, char* directory, char* files, uint8_t compression, uint8_t encryption, int32_t output_format);
+pgmoneta_management_request_verify(SSL* ssl, int socket, char* server, char* backup_id, char* directory, char* files, int32_t sample, uint8_t compression, uint8_t encryption, int32_t output_format);
 
 /**
  * Create an archive request
@@ -544,6 +607,19 @@ pgmoneta_management_request_ping(SSL* ssl, int socket, uint8_t compression, uint
 int
 pgmoneta_management_request_reset(SSL* ssl, int socket, uint8_t compression, uint8_t encryption, int32_t output_format);
 
+/**
+ * Create a profile request
+ * @param ssl The SSL connection
+ * @param socket The socket descriptor
+ * @param reset Reset the probes
+ * @param compression The compress method for wire protocol
+ * @param encryption The encrypt method for wire protocol
+ * @param output_format The output format
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_management_request_profile(SSL* ssl, int socket, bool reset, uint8_t compression, uint8_t encryption, int32_t output_format);
+
 /**
  * Create a reload request
  * @param ssl The SSL connection
@@ -594,6 +670,37 @@ pgmoneta_management_request_conf_get(SSL* ssl, int socket, uint8_t compression,
 int
 pgmoneta_management_request_conf_set(SSL* ssl, int socket, char* config_key, char* config_value, uint8_t compression, uint8_t encryption, int32_t output_format);
 
+/**
+ * Create a WAL fetch request
+ * @param ssl The SSL connection
+ * @param socket The socket descriptor
+ * @param server The server
+ * @param file The WAL file
+ * @param destination The absolute path of the destination
+ * @param compression The compress method for wire protocol
+ * @param encryption The encrypt method for wire protocol
+ * @param output_format The output format
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_management_request_wal_fetch(SSL* ssl, int socket, char* server, char* file, char* destination, uint8_t compression, uint8_t encryption, int32_t output_format);
+
+/**
+ * Create a WAL push request, the file is sent after the request
+ * using pgmoneta_management_write_data
+ * @param ssl The SSL connection
+ * @param socket The socket descriptor
+ * @param server The server
+ * @param file The WAL file
+ * @param size The size of the file
+ * @param compression The compress method for wire protocol
+ * @param encryption The encrypt method for wire protocol
+ * @param output_format The output format
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_management_request_wal_push(SSL* ssl, int socket, char* server, char* file, uint64_t size, uint8_t compression, uint8_t encryption, int32_t output_format);
+
 /**
  * Create a retain request
  * @param ssl The SSL connection
@@ -768,6 +875,28 @@ pgmoneta_management_read_json(SSL* ssl, int socket, uint8_t* compression, uint8_
 int
 pgmoneta_management_write_json(SSL* ssl, int socket, uint8_t compression, uint8_t encryption, struct json* json);
 
+/**
+ * Read a block of data that follows a request
+ * @param ssl The SSL connection
+ * @param socket The socket descriptor
+ * @param data The data, an empty block ends the data
+ * @param size The size of the data
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_management_read_data(SSL* ssl, int socket, unsigned char** data, size_t* size);
+
+/**
+ * Write a block of data that follows a request
+ * @param ssl The SSL connection
+ * @param socket The socket descriptor
+ * @param data The data
+ * @param size The size of the data, 0 ends the data
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_management_write_data(SSL* ssl, int socket, void* data, size_t size);
+
 #ifdef __cplusplus
 }
 #endif
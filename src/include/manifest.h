@@ -35,6 +35,7 @@ extern "C" {
 
 #include <pgmoneta.h>
 #include <art.h>
+#include <csv.h>
 
 #define MANIFEST_CHUNK_SIZE 8192
 
@@ -43,6 +44,11 @@ extern "C" {
 #define MANIFEST_PATH_INDEX 0
 #define MANIFEST_CHECKSUM_INDEX 1
 
+#define MANIFEST_DIFF_DELETED 0
+#define MANIFEST_DIFF_CHANGED 1
+#define MANIFEST_DIFF_ADDED   2
+#define NUMBER_OF_MANIFEST_DIFFS 3
+
 /** @struct manifest_file
  * Defines a manifest file
  */
@@ -61,6 +67,22 @@ struct manifest_chunk
    int size;                                        /**< The size of the chunk */
 };
 
+/** @struct manifest_diff
+ * Defines the difference between two manifests, spilled to disk.
+ *
+ * The deleted, changed and added files are sorted manifests in a directory of the
+ * workspace, which are mapped for lookups and read as streams, so the memory use
+ * doesn't depend on the number of files
+ */
+struct manifest_diff
+{
+   char directory[MAX_PATH];                       /**< The directory of the files */
+   char paths[NUMBER_OF_MANIFEST_DIFFS][MAX_PATH]; /**< The paths of the files */
+   char* data[NUMBER_OF_MANIFEST_DIFFS];           /**< The mapped files */
+   size_t size[NUMBER_OF_MANIFEST_DIFFS];          /**< The sizes of the files */
+   bool manifest_changed;                          /**< Does backup_manifest differ */
+};
+
 /**
  * Verify checksum of the manifest and the checksum
  * @param root The root directory holding the manifest
@@ -70,7 +92,7 @@ int
 pgmoneta_manifest_checksum_verify(char* root);
 
 /**
- * Compare manifests
+ * Compare manifests. Sorted manifests are compared in a single pass
  * @param manifest1 The path to the first manifest
  * @param manifest2 The path to the second manifest
  * @param deleted_files The deleted files
@@ -81,6 +103,63 @@ pgmoneta_manifest_checksum_verify(char* root);
 int
 pgmoneta_compare_manifests(char* old_manifest, char* new_manifest, struct art** deleted_files, struct art** changed_files, struct art** added_files);
 
+/**
+ * Compare manifests with a sort-merge on disk. Manifests that aren't sorted are
+ * sorted in runs first, and the differences are written as sorted files
+ * @param directory The directory to spill to, like the workspace of the server
+ * @param old_manifest The path to the old manifest
+ * @param new_manifest The path to the new manifest
+ * @param diff The difference
+ * @return 0 on success, otherwise 1
+ */
+int
+pgmoneta_manifest_diff(char* directory, char* old_manifest, char* new_manifest, struct manifest_diff** diff);
+
+/**
+ * Is a file in a set of the difference, using a binary search of the sorted file
+ * @param diff The difference
+ * @param kind The set, like MANIFEST_DIFF_CHANGED
+ * @param path The path of the file
+ * @return True if the file is in the set, otherwise false
+ */
+bool
+pgmoneta_manifest_diff_contains(struct manifest_diff* diff, int kind, char* path);
+
+/**
+ * Stream a set of the difference. The rows have the path and the checksum
+ * like a manifest, and backup_manifest isn't part of them
+ * @param diff The difference
+ * @param kind The set, like MANIFEST_DIFF_DELETED
+ * @param reader The reader
+ * @return 0 on success, otherwise 1
+ */
+int
+pgmoneta_manifest_diff_reader(struct manifest_diff* diff, int kind, struct csv_reader** reader);
+
+/**
+ * Destroy a difference, and remove its files
+ * @param diff The difference
+ */
+void
+pgmoneta_manifest_diff_destroy(struct manifest_diff* diff);
+
+/**
+ * Load the checksums of a manifest
+ * @param manifest The path to the manifest
+ * @param files The checksums of the files by path
+ * @return 0 on success, otherwise 1
+ */
+int
+pgmoneta_manifest_load(char* manifest, struct art** files);
+
+/**
+ * Sort a manifest on the path, using runs of a chunk such that the memory use is bounded
+ * @param manifest The path to the manifest
+ * @return 0 on success, otherwise 1
+ */
+int
+pgmoneta_manifest_sort(char* manifest);
+
 #ifdef __cplusplus
 }
 #endif
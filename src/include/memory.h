@@ -35,10 +35,20 @@ extern "C" {
 
 #include <pgmoneta.h>
 
+#include <stdbool.h>
 #include <stdlib.h>
 
+#define MEMORY_BUFFER_SIZE (256 * 1024)
+#define MEMORY_SLAB_SIZE   (2 * 1024 * 1024)
+#define MEMORY_SLABS       64
+
+#define STREAM_BUFFER_LOW_WATER    (DEFAULT_BUFFER_SIZE / 4)
+#define STREAM_BUFFER_SHRINK_READS 64
+
 /** @struct stream_buffer
- * Defines a streaming buffer
+ * Defines a streaming buffer. The data is read at the end and consumed from the
+ * start, and the buffer wraps around to the front once everything is consumed.
+ * The messages are handed out in place, so a message is never split at the wrap
  */
 struct stream_buffer
 {
@@ -47,8 +57,64 @@ struct stream_buffer
    int start;     /**< offset to the first unconsumed data in buffer */
    int end;       /**< offset to the first position after available data */
    int cursor;    /**< next byte to consume */
+   int idle;      /**< reads since the enlarged buffer last held more than the low-water mark */
 } __attribute__ ((aligned (64)));
 
+/**
+ * Set up the buffer pool of the process. The pool hands out buffers of
+ * MEMORY_BUFFER_SIZE from slabs of MEMORY_SLAB_SIZE, which are backed by a huge
+ * page when possible. Forked processes inherit the setting
+ * @param hugepage The huge page setting
+ */
+void
+pgmoneta_memory_pool_init(unsigned char hugepage);
+
+/**
+ * Borrow a buffer for I/O. The buffer is aligned to ALIGNMENT_SIZE, and comes from the
+ * pool when the size is at most MEMORY_BUFFER_SIZE, otherwise it is allocated
+ * @param size The size needed
+ * @return The buffer, or NULL
+ */
+void*
+pgmoneta_memory_buffer_get(size_t size);
+
+/**
+ * Give back a buffer from pgmoneta_memory_buffer_get
+ * @param buffer The buffer, or NULL
+ */
+void
+pgmoneta_memory_buffer_put(void* buffer);
+
+/**
+ * Account memory held by the process. The buffers of pgmoneta_memory_buffer_get
+ * are accounted already, other allocators of large blocks report their blocks
+ * @param delta The number of bytes allocated, negative when released
+ */
+void
+pgmoneta_memory_account(long delta);
+
+/**
+ * Start accounting the memory of the process to a workflow type. A nested
+ * workflow is accounted to the outermost one
+ * @param type The workflow type
+ */
+void
+pgmoneta_memory_workflow_start(int type);
+
+/**
+ * Stop accounting the memory of the process to the workflow type
+ */
+void
+pgmoneta_memory_workflow_finish(void);
+
+/**
+ * Is the memory held by the process above memory_budget. Buffers are then
+ * enlarged no more than needed, and the workers take fewer tasks in flight
+ * @return true if above the budget, otherwise false
+ */
+bool
+pgmoneta_memory_pressure(void);
+
 /**
  * Initialize a memory segment for the process local message structure
  */
@@ -117,6 +183,34 @@ pgmoneta_memory_stream_buffer_init(struct stream_buffer** buffer);
 int
 pgmoneta_memory_stream_buffer_enlarge(struct stream_buffer* buffer, int bytes_needed);
 
+/**
+ * Move the unconsumed data to the front of the buffer, releasing the
+ * space of the messages that have been consumed
+ * @param buffer The stream buffer
+ */
+void
+pgmoneta_memory_stream_buffer_compact(struct stream_buffer* buffer);
+
+/**
+ * Make room for the next read. The space of the consumed messages is reclaimed only
+ * when the rest of the message being received doesn't fit at the end, and the buffer
+ * is enlarged to hold the whole message, so a large message is moved at most once
+ * @param buffer The stream buffer
+ * @param minimum The minimum free space
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_memory_stream_buffer_reserve(struct stream_buffer* buffer, int minimum);
+
+/**
+ * Shrink an enlarged buffer back to DEFAULT_BUFFER_SIZE once it has held no more
+ * than STREAM_BUFFER_LOW_WATER for STREAM_BUFFER_SHRINK_READS reads, or for one
+ * read when the process is above its memory budget
+ * @param buffer The stream buffer
+ */
+void
+pgmoneta_memory_stream_buffer_shrink(struct stream_buffer* buffer);
+
 /**
  * Free a stream buffer
  * @param buffer The stream buffer to be freed
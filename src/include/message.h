@@ -34,6 +34,7 @@ extern "C" {
 #endif
 
 #include <pgmoneta.h>
+#include <art.h>
 #include <memory.h>
 
 #include <stdbool.h>
@@ -488,7 +489,9 @@ pgmoneta_consume_copy_stream(SSL* ssl, int socket, struct stream_buffer* buffer,
 
 /**
  * Consume the data in copy stream buffer similar to pgmoneta_consume_copy_stream.
- * Instead of creating a new message each time, reuse the same message buffer each time
+ * Instead of creating a new message each time, reuse the same message buffer each time.
+ * The message data is a view into the stream buffer, and stays valid until
+ * pgmoneta_consume_copy_stream_end is called
  * Must be used with pgmoneta_consume_copy_stream_end
  * @param ssl The SSL structure
  * @param socket The socket
@@ -501,7 +504,8 @@ int
 pgmoneta_consume_copy_stream_start(SSL* ssl, int socket, struct stream_buffer* buffer, struct message* message, struct token_bucket* network_bucket);
 
 /**
- * Finish consuming the buffer, prepare for the next message to be consumed
+ * Finish consuming the buffer, prepare for the next message to be consumed.
+ * The space of the message is released for reuse
  * @param buffer The stream buffer
  * @param message The message buffer
  */
@@ -539,11 +543,14 @@ pgmoneta_receive_manifest_file(SSL* ssl, int socket, struct stream_buffer* buffe
  * @param username The current server username
  * @param source_dir The directory for the extra files on server side
  * @param target_dir The target directory for writing the extra files
+ * @param previous The extra files of the previous backup by path, or NULL to retrieve all files
+ * @param current The extra files of this backup by path, or NULL
  * @param info_extra The extra infomation for display
  * @return 0 upon success, otherwise 1
  */
 int
-pgmoneta_receive_extra_files(SSL* ssl, int socket, char* username, char* source_dir, char* target_dir, char** info_extra);
+pgmoneta_receive_extra_files(SSL* ssl, int socket, char* username, char* source_dir, char* target_dir,
+                             struct art* previous, struct art* current, char** info_extra);
 
 /**
  * Send a file from the client side to the extension side
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGMONETA_PACK_H
+#define PGMONETA_PACK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgmoneta.h>
+#include <art.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PACK_NAME         "data.pack"
+#define PACK_INDEX_SUFFIX ".index"
+
+/**
+ * Get the path of the pack of the data directory of a backup
+ * @param server The server
+ * @param label The label of the backup
+ * @return The path
+ */
+char*
+pgmoneta_pack_path(int server, char* label);
+
+/**
+ * Pack the small files of a directory into a single file, so a storage
+ * engine sends one object instead of one per file. The index, which is the
+ * pack with PACK_INDEX_SUFFIX, has the path relative to the directory, the
+ * offset and the size of each file. The index is written last, so an
+ * existing index means the pack is complete and it is read instead
+ * @param directory The directory
+ * @param threshold The size under which a file is packed
+ * @param pack The path of the pack
+ * @param packed [out] The paths of the packed files relative to the directory
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_pack_create(char* directory, uint64_t threshold, char* pack, struct art** packed);
+
+/**
+ * Read the paths of the files of a pack
+ * @param pack The path of the pack
+ * @param packed [out] The paths of the packed files relative to the directory
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_pack_read(char* pack, struct art** packed);
+
+/**
+ * Extract the files of a pack into a directory, and delete the pack and its index
+ * @param pack The path of the pack
+ * @param directory The directory
+ * @param filter The filter of the files to extract, or NULL for all
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_pack_extract(char* pack, char* directory, bool (*filter)(char*));
+
+/**
+ * Delete a pack and its index
+ * @param pack The path of the pack
+ */
+void
+pgmoneta_pack_delete(char* pack);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
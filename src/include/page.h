@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGMONETA_PAGE_H
+#define PGMONETA_PAGE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgmoneta.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/** @struct page_checksums
+ * Defines the verification of the page checksums of a backup
+ */
+struct page_checksums
+{
+   uint64_t start_lsn;   /**< The start LSN of the backup, later pages are restored from the WAL */
+   uint32_t block_size;  /**< The block size */
+   uint32_t relseg_size; /**< The number of blocks in a segment */
+   uint64_t pages;       /**< The number of pages verified */
+   uint64_t failed;      /**< The number of pages with a wrong checksum */
+   uint64_t files;       /**< The number of files with a wrong checksum */
+};
+
+/**
+ * Get the LSN of a page
+ * @param page The page
+ * @return The LSN
+ */
+uint64_t
+pgmoneta_page_lsn(unsigned char* page);
+
+/**
+ * Calculate the checksum of a page like PostgreSQL. The page is hashed in
+ * 32 independent FNV-1a lanes, which are computed with AVX2 or NEON when
+ * the CPU has them
+ * @param page The page
+ * @param block_size The block size, a multiple of 128
+ * @param block_number The block number in the relation
+ * @return The checksum
+ */
+uint16_t
+pgmoneta_page_checksum(unsigned char* page, uint32_t block_size, uint32_t block_number);
+
+/**
+ * Verify the checksum of a page. New pages and pages modified since the
+ * start of the backup are not verified. The counters of the verification
+ * are updated
+ * @param checksums The verification
+ * @param page The page
+ * @param block_number The block number in the relation
+ * @return true if the checksum is correct or the page wasn't verified, otherwise false
+ */
+bool
+pgmoneta_page_verify(struct page_checksums* checksums, unsigned char* page, uint32_t block_number);
+
+/**
+ * Is a member of a base backup a segment of a relation with page checksums
+ * @param name The name relative to the data directory or the tablespace
+ * @param segment [out] The segment number
+ * @return true if it is, otherwise false
+ */
+bool
+pgmoneta_page_relation_segment(char* name, uint32_t* segment);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGMONETA_PARALLEL_H
+#define PGMONETA_PARALLEL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgmoneta.h>
+#include <utils.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * Take a backup over several connections. The backup is started with
+ * pg_backup_start(), the files of the data directory are read in parallel with
+ * pg_read_binary_file(), largest first, and the backup_label and backup_manifest
+ * are written from pg_backup_stop(). The server can't have tablespaces.
+ * With a parent and the extension, only the blocks changed since the start of the
+ * parent are read for the relation files the extension tracks, and they are stored
+ * as INCREMENTAL. files. With a snapshot_command the backup is stopped as soon as
+ * the file system snapshot is taken, and the snapshot is copied afterwards
+ * @param server The server index
+ * @param tag The label of the backup on the server
+ * @param backup_base The base directory of the backup
+ * @param hash The hash algorithm of the manifest
+ * @param connections The number of connections copying files
+ * @param parent_label The label of the parent backup, or NULL
+ * @param bucket The token bucket for the backup, or NULL
+ * @param network_bucket The token bucket for the network, or NULL
+ * @param startpos [out] The WAL starting point, 20 bytes
+ * @param endpos [out] The WAL ending point, 20 bytes
+ * @param start_timeline [out] The timeline at the start
+ * @param end_timeline [out] The timeline at the end
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_parallel_backup(int server, char* tag, char* backup_base, int hash, int connections, char* parent_label,
+                         struct token_bucket* bucket, struct token_bucket* network_bucket,
+                         char* startpos, char* endpos, uint32_t* start_timeline, uint32_t* end_timeline);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -60,7 +60,6 @@ extern "C" {
 #define DEFAULT_BUFFER_SIZE  131072
 
 #define DEFAULT_BURST 65536
-#define DEFAULT_EVERY 1
 
 #define MAX_USERNAME_LENGTH  128
 #define MAX_PASSWORD_LENGTH 1024
@@ -75,9 +74,58 @@ extern "C" {
 #define NUMBER_OF_USERS   64
 #define NUMBER_OF_ADMINS   8
 
+#define NUMBER_OF_BACKUP_LOCKS 64
+#define NUMBER_OF_TIMELINE_SWITCHES 64
+
 #define MAX_NUMBER_OF_COLUMNS      8
 #define MAX_NUMBER_OF_TABLESPACES 64
 
+#define NUMBER_OF_WORKFLOW_TYPES  11
+#define WORKERS_HISTOGRAM_BUCKETS  8
+
+#define COPY_METHOD_CLONE           0
+#define COPY_METHOD_COPY_FILE_RANGE 1
+#define COPY_METHOD_SENDFILE        2
+#define COPY_METHOD_READ_WRITE      3
+#define COPY_METHOD_HARDLINK        4
+#define COPY_METHOD_IO_URING        5
+#define NUMBER_OF_COPY_METHODS      6
+
+#define UPLOAD_ENGINE_SSH       0
+#define UPLOAD_ENGINE_S3        1
+#define UPLOAD_ENGINE_AZURE     2
+#define NUMBER_OF_UPLOAD_ENGINES 3
+
+#define PROMETHEUS_HISTOGRAM_BUCKETS 8
+
+#define WAL_PHASE_WRITE       0
+#define WAL_PHASE_SYNC        1
+#define WAL_PHASE_CLOSE       2
+#define NUMBER_OF_WAL_PHASES  3
+
+#define SOCKET_WAL             0
+#define SOCKET_BACKUP          1
+#define NUMBER_OF_SOCKET_TYPES 2
+
+#define FILE_OPERATION_COMPRESS    0
+#define FILE_OPERATION_DECOMPRESS  1
+#define FILE_OPERATION_ENCRYPT     2
+#define FILE_OPERATION_DECRYPT     3
+#define NUMBER_OF_FILE_OPERATIONS  4
+
+#define RESTORE_PHASE_RESTORE      0
+#define RESTORE_PHASE_COMBINE      1
+#define RESTORE_PHASE_COPY_WAL     2
+#define NUMBER_OF_RESTORE_PHASES   3
+
+#define PROFILE_COPY_STREAM        0
+#define PROFILE_TAR_EXTRACT        1
+#define PROFILE_ZSTD_COMPRESS      2
+#define PROFILE_ENCRYPT_FILE       3
+#define PROFILE_FILE_HASH          4
+#define PROFILE_READ_BLOCKS        5
+#define NUMBER_OF_PROFILE_PROBES   6
+
 #define STATE_FREE        0
 #define STATE_IN_USE      1
 
@@ -93,6 +141,7 @@ extern "C" {
 #define ENCRYPTION_AES_256_CTR  4
 #define ENCRYPTION_AES_192_CTR  5
 #define ENCRYPTION_AES_128_CTR  6
+#define ENCRYPTION_AES_256_GCM  7
 
 #define HUGEPAGE_OFF 0
 #define HUGEPAGE_TRY 1
@@ -112,6 +161,15 @@ extern "C" {
 #define STORAGE_ENGINE_S3    1 << 2
 #define STORAGE_ENGINE_AZURE 1 << 3
 
+#define STORAGE_SERVER           0
+#define STORAGE_BACKUP           1
+#define STORAGE_WAL              2
+#define STORAGE_WAL_SHIPPING     3
+#define STORAGE_WAL_SHIPPING_WAL 4
+#define NUMBER_OF_STORAGE        5
+
+#define STORAGE_CACHE_MAX_AGE 60
+
 #define DEFAULT_BLOCKING_TIMEOUT 30
 
 #define UPDATE_PROCESS_TITLE_NEVER   0
@@ -204,46 +262,155 @@ extern void* shmem;
  */
 extern void* prometheus_cache_shmem;
 
+/**
+ * Shared memory used to contain the log ring
+ */
+extern void* log_ring_shmem;
+
+/** @struct storage_size
+ * Defines a cached directory size. The generation is written last, and 0
+ * while the entry is being updated
+ */
+struct storage_size
+{
+   atomic_ulong generation; /**< The storage generation plus one the size was calculated at */
+   atomic_ulong size;       /**< The size in bytes */
+   atomic_llong time;       /**< The time the size was calculated */
+};
+
+/** @struct timeline_cache
+ * Defines the cached history of the newest timeline of a server, and the position
+ * the WAL receiver resumes streaming from. The timelines are written last, and 0
+ * while the entry is being updated
+ */
+struct timeline_cache
+{
+   atomic_uint timeline;                                 /**< The timeline of the history, 0 when there is none */
+   atomic_int number_of_switches;                        /**< The number of switches in the history */
+   atomic_uint parent_tli[NUMBER_OF_TIMELINE_SWITCHES];  /**< The timeline switched off from */
+   atomic_ullong switchpos[NUMBER_OF_TIMELINE_SWITCHES]; /**< The position of the switch */
+   atomic_uint resume_tli;                               /**< The timeline to resume streaming on, 0 to scan the WAL directory */
+   atomic_ullong resume_lsn;                             /**< The segment aligned position to resume streaming from */
+};
+
+#define BANDWIDTH_SLOTS 64
+
+/** @struct bandwidth
+ * Defines the processes that share the bandwidth budget, and the rate of
+ * the WAL streaming that is taken from it. Times are in nanoseconds of the
+ * monotonic clock
+ */
+struct bandwidth
+{
+   atomic_int pids[BANDWIDTH_SLOTS];  /**< The process of each slot, 0 for a free slot */
+   atomic_int types[BANDWIDTH_SLOTS]; /**< The kind of work of each slot */
+   atomic_ulong wal_start;            /**< The start of the WAL window */
+   atomic_ulong wal_bytes;            /**< The WAL bytes received in the window */
+   atomic_ulong wal_rate;             /**< The WAL bytes per second of the last window */
+   atomic_ulong wal_time;             /**< The end of the last WAL window */
+};
+
+/** @struct progress
+ * Defines the progress of the operation running for a server. The counters
+ * of the phase are reset when the next workflow step starts. Times are in
+ * microseconds of the monotonic clock
+ */
+struct progress
+{
+   atomic_int workflow;           /**< The workflow type plus one, 0 when there is no operation */
+   atomic_ulong start;            /**< The start of the operation */
+   atomic_ulong phase_start;      /**< The start of the phase */
+   char phase[MISC_LENGTH];       /**< The name of the phase */
+   atomic_ulong bytes_done;       /**< The bytes processed by the phase */
+   atomic_ulong bytes_total;      /**< The bytes the phase is expected to process, 0 if unknown */
+   atomic_ulong files_done;       /**< The files processed by the phase */
+   atomic_ulong files_total;      /**< The files the phase is expected to process, 0 if unknown */
+};
+
 /** @struct server
- * Defines a server
+ * Defines a server. The fields that are updated while the server is running are
+ * kept in cache line aligned blocks at the start, grouped by the process that
+ * writes them, so the configuration read by every process is not invalidated
+ * by them. The large configuration is kept at the end
  */
 struct server
 {
-   char name[MISC_LENGTH];                  /**< The name of the server */
+   struct
+   {
+      atomic_int repository;                   /**< Repository lock, -1 when exclusive, otherwise the number of holders */
+      atomic_bool active_backup;               /**< Is there an active backup, there is one at a time */
+      bool active_restore;                     /**< Is there an active restore */
+      bool active_archive;                     /**< Is there an active archive */
+      bool active_delete;                      /**< Is there an active delete */
+      bool active_retention;                   /**< Is there an active retention */
+      atomic_ulong operation_count;            /**< Operation count of the server */
+      atomic_ulong failed_operation_count;     /**< Failed operation count of the server */
+      atomic_llong last_operation_time;        /**< Last operation time of the server */
+      atomic_llong last_failed_operation_time; /**< Last failed operation time of the server */
+      atomic_ulong storage_generation;         /**< The storage generation, bumped when the storage changes */
+      atomic_llong retention_after;            /**< The retention waits until then for the backup of a batch (0 = no wait) */
+   } __attribute__ ((aligned (64)));
+   struct
+   {
+      atomic_int backup_locks[NUMBER_OF_BACKUP_LOCKS]; /**< Backup locks by the hash of the label, -1 when exclusive, otherwise the number of readers */
+   } __attribute__ ((aligned (64)));
+   struct
+   {
+      atomic_ulong backup_write_queue;         /**< Queued chunks in the backup writer */
+      atomic_ulong backup_write_queue_waits;   /**< Times the backup receiver waited for the writer */
+      atomic_int compression_level;            /**< The compression level of the running backup (0 = idle) */
+   } __attribute__ ((aligned (64)));
+   struct
+   {
+      bool wal_streaming;                      /**< Is WAL streaming active */
+      atomic_bool wal_restart;                 /**< Reconnect the WAL receiver with the reloaded configuration */
+      uint32_t cur_timeline;                   /**< Current timeline the server is on*/
+      char current_wal_filename[MISC_LENGTH];  /**< The current WAL filename*/
+      char current_wal_lsn[MISC_LENGTH];       /**< The current WAL log sequence number*/
+      struct timeline_cache timelines;         /**< The cached timeline history */
+   } __attribute__ ((aligned (64)));
+   struct
+   {
+      atomic_bool scrub;                       /**< Is the scrubber running for the server */
+      atomic_ulong scrub_bytes;                /**< The bytes read by the scrubber */
+      atomic_ulong scrub_wal_failed;           /**< The WAL files that failed the current scrub pass */
+      struct storage_size storage[NUMBER_OF_STORAGE]; /**< The cached storage sizes */
+   } __attribute__ ((aligned (64)));
+   struct progress progress __attribute__ ((aligned (64))); /**< The progress of the running operation */
+   char name[MISC_LENGTH] __attribute__ ((aligned (64))); /**< The name of the server */
    char host[MISC_LENGTH];                  /**< The host name of the server */
    int port;                                /**< The port of the server */
    char username[MAX_USERNAME_LENGTH];      /**< The user name */
    char wal_slot[MISC_LENGTH];              /**< The WAL slot name */
-   char current_wal_filename[MISC_LENGTH];  /**< The current WAL filename*/
-   char current_wal_lsn[MISC_LENGTH];       /**< The current WAL log sequence number*/
    char follow[MISC_LENGTH];                /**< Follow a server */
-   char workspace[MAX_PATH];                /**< A workspace for combining incremental backups */
    int retention_days;                      /**< The retention days for the server */
    int retention_weeks;                     /**< The retention weeks for the server */
    int retention_months;                    /**< The retention months for the server */
    int retention_years;                     /**< The retention years for the server */
    int create_slot;                         /**< Create a slot */
-   atomic_bool repository;                  /**< Repository lock */
-   bool active_backup;                      /**< Is there an active backup */
-   bool active_restore;                     /**< Is there an active restore */
-   bool active_archive;                     /**< Is there an active archive */
-   bool active_delete;                      /**< Is there an active delete */
-   bool active_retention;                   /**< Is there an active retention */
    int wal_size;                            /**< The size of the WAL files */
    size_t block_size;                       /**< The size of a block in relation files*/
    size_t segment_size;                     /**< The max size of a relation file segment*/
    size_t relseg_size;                      /**< The max number of blocks in a relation file segment */
-   bool wal_streaming;                      /**< Is WAL streaming active */
    bool checksums;                          /**< Are checksums enabled */
    bool summarize_wal;                      /**< Is summarize_wal enabled */
    bool valid;                              /**< Is the server valid */
    int version;                             /**< The major version of the server*/
    int minor_version;                       /**< The minor version of the server*/
-   atomic_ulong operation_count;            /**< Operation count of the server */
-   atomic_ulong failed_operation_count;     /**< Failed operation count of the server */
-   uint32_t cur_timeline;                   /**< Current timeline the server is on*/
-   atomic_llong last_operation_time;        /**< Last operation time of the server */
-   atomic_llong last_failed_operation_time; /**< Last failed operation time of the server */
+   bool hot_standby_replay;                 /**< Feed the completed WAL segments to the hot standby */
+   bool tls_ktls;                           /**< Move the TLS records of the connections to the kernel */
+   int workers;                             /**< The number of workers */
+   int io_workers;                          /**< The number of I/O workers */
+   int backup_connections;                  /**< The number of connections copying a full backup (0 or 1 = BASE_BACKUP) */
+   bool backup_standby;                     /**< Take the backup from the least loaded of the server and its standbys */
+   char snapshot_command[MAX_PATH];         /**< The command taking a file system snapshot of the data directory */
+   char snapshot_release_command[MAX_PATH]; /**< The command releasing the file system snapshot */
+   int backup_max_rate;                     /**< Number of tokens added to the bucket with each replenishment for backup. */
+   int network_max_rate;                    /**< Number of bytes of tokens added every one second to limit the netowrk backup rate */
+   int manifest;                            /**< The manifest hash algorithm */
+   bool ext_valid;                          /**< Is the extension valid */
+   char ext_version[MISC_LENGTH];           /**< The major version of the extension*/
+   char workspace[MAX_PATH];                /**< A workspace for combining incremental backups */
    char wal_shipping[MAX_PATH];             /**< The WAL shipping directory */
    char hot_standby[MAX_PATH];              /**< The hot standby directory */
    char hot_standby_overrides[MAX_PATH];    /**< The hot standby overrides directory */
@@ -251,14 +418,9 @@ struct server
    char tls_cert_file[MAX_PATH];            /**< TLS certificate path */
    char tls_key_file[MAX_PATH];             /**< TLS key path */
    char tls_ca_file[MAX_PATH];              /**< TLS CA certificate path */
-   int workers;                             /**< The number of workers */
-   int backup_max_rate;                     /**< Number of tokens added to the bucket with each replenishment for backup. */
-   int network_max_rate;                    /**< Number of bytes of tokens added every one second to limit the netowrk backup rate */
-   int manifest;                            /**< The manifest hash algorithm */
    int number_of_extra;                     /**< The number of source directory*/
-   char extra[MAX_EXTRA][MAX_EXTRA_PATH];   /**< Source directory*/
-   bool ext_valid;                          /**< Is the extension valid */
-   char ext_version[MISC_LENGTH];           /**< The major version of the extension*/
+   unsigned short extra_offset[MAX_EXTRA];  /**< The offset of each source directory in extra */
+   char extra[MAX_EXTRA_PATH];              /**< The source directories, one after the other */
 } __attribute__ ((aligned (64)));
 
 /** @struct user
@@ -292,17 +454,94 @@ struct prometheus_cache
    char data[];          /**< the payload */
 } __attribute__ ((aligned (64)));
 
+/** @struct workers_statistics
+ * Defines the statistics of a worker pool. Times are in microseconds
+ */
+struct workers_statistics
+{
+   atomic_ulong tasks;                                        /**< The number of tasks */
+   atomic_ulong bytes;                                        /**< The number of bytes processed */
+   atomic_ulong wait;                                         /**< The total time tasks were queued */
+   atomic_ulong execute;                                      /**< The total time tasks were running */
+   atomic_ulong busy;                                         /**< The total time workers were running a task */
+   atomic_ulong available;                                    /**< The total time workers were alive */
+   atomic_ulong wait_histogram[WORKERS_HISTOGRAM_BUCKETS];    /**< The queued time histogram */
+   atomic_ulong execute_histogram[WORKERS_HISTOGRAM_BUCKETS]; /**< The running time histogram */
+};
+
+/** @struct prometheus_histogram
+ * Defines a Prometheus histogram. The unit of the sum depends on the histogram
+ */
+struct prometheus_histogram
+{
+   atomic_ulong buckets[PROMETHEUS_HISTOGRAM_BUCKETS]; /**< The number of observations per bucket */
+   atomic_ulong sum;                                   /**< The sum of the observations */
+};
+
+/** @struct prometheus_wal_ingest
+ * Defines the WAL ingest of a server. Only the WAL receiver of the server updates it
+ */
+struct prometheus_wal_ingest
+{
+   atomic_ulong received_lsn;   /**< The LSN received and written */
+   atomic_ulong flushed_lsn;    /**< The LSN durably flushed */
+   atomic_ulong reported_lsn;   /**< The flush LSN last reported to the server */
+   atomic_ulong received_bytes; /**< The number of WAL bytes received */
+   atomic_ulong throughput;     /**< The received bytes per second over the last window */
+   atomic_ulong window_start;   /**< The start of the throughput window in microseconds */
+   atomic_ulong window_bytes;   /**< The bytes received in the throughput window */
+   atomic_ulong write_lag;      /**< The microseconds between receipt and write of the last message */
+   atomic_ulong flush_lag;      /**< The microseconds between receipt and flush of the last flushed data */
+};
+
+/** @struct prometheus_socket
+ * Defines the TCP state of the last connection of a type to a server, sampled from TCP_INFO
+ */
+struct prometheus_socket
+{
+   atomic_ulong rtt;               /**< The smoothed round trip time in microseconds */
+   atomic_ulong rtt_variance;      /**< The round trip time variance in microseconds */
+   atomic_ulong congestion_window; /**< The congestion window in bytes */
+   atomic_ulong receive_window;    /**< The receive window in bytes */
+   atomic_ulong retransmits;       /**< The number of segments retransmitted on the connection */
+};
+
 /** @struct prometheus
  * Defines the Prometheus metrics
  */
 struct prometheus
 {
-   atomic_ulong logging_info;  /**< Logging: INFO */
-   atomic_ulong logging_warn;  /**< Logging: WARN */
-   atomic_ulong logging_error; /**< Logging: ERROR */
-   atomic_ulong logging_fatal; /**< Logging: FATAL */
+   atomic_ulong logging_info;                                     /**< Logging: INFO */
+   atomic_ulong logging_warn;                                     /**< Logging: WARN */
+   atomic_ulong logging_error;                                    /**< Logging: ERROR */
+   atomic_ulong logging_fatal;                                    /**< Logging: FATAL */
+   struct workers_statistics workers[NUMBER_OF_WORKFLOW_TYPES];   /**< The worker statistics per workflow type */
+   atomic_ulong copy_files[NUMBER_OF_COPY_METHODS];               /**< The number of files copied per copy method */
+   atomic_ulong copy_bytes[NUMBER_OF_COPY_METHODS];               /**< The number of bytes copied per copy method */
+   atomic_ulong upload_bytes[NUMBER_OF_UPLOAD_ENGINES];           /**< The number of bytes uploaded per storage engine */
+   atomic_ulong upload_time[NUMBER_OF_UPLOAD_ENGINES];            /**< The milliseconds spent uploading per storage engine */
+   struct prometheus_histogram wal[NUMBER_OF_SERVERS][NUMBER_OF_WAL_PHASES]; /**< The WAL latency in microseconds per server and phase */
+   struct prometheus_wal_ingest wal_ingest[NUMBER_OF_SERVERS];               /**< The WAL ingest per server */
+   struct prometheus_socket socket[NUMBER_OF_SERVERS][NUMBER_OF_SOCKET_TYPES]; /**< The TCP state per server and connection type */
+   struct prometheus_histogram file[NUMBER_OF_FILE_OPERATIONS];   /**< The per file time in microseconds per operation */
+   struct prometheus_histogram restore[NUMBER_OF_RESTORE_PHASES]; /**< The throughput in bytes per second per restore phase */
+   atomic_ulong wal_cache_hits;                                   /**< The number of WAL segments found in the WAL cache */
+   atomic_ulong wal_cache_misses;                                 /**< The number of WAL segments not found in the WAL cache */
+   atomic_ulong memory_bytes[NUMBER_OF_WORKFLOW_TYPES];           /**< The memory held by the running workflows per workflow type */
+   atomic_ulong memory_peak_bytes[NUMBER_OF_WORKFLOW_TYPES];      /**< The most memory held by a workflow per workflow type */
+   atomic_ulong memory_budget_exceeded[NUMBER_OF_WORKFLOW_TYPES]; /**< The number of times a workflow went above the memory budget */
 } __attribute__ ((aligned (64)));
 
+/** @struct profile_probe
+ * Defines the totals of a profiling probe
+ */
+struct profile_probe
+{
+   atomic_ulong calls; /**< The number of calls */
+   atomic_ulong time;  /**< The time in nanoseconds */
+   atomic_ulong max;   /**< The longest call in nanoseconds */
+};
+
 /** @struct common_configuration
  * Defines configurations that are common between all tools
  */
@@ -334,8 +573,12 @@ struct common_configuration
    bool keep_alive;                                /**< Use keep alive */
    bool nodelay;                                   /**< Use NODELAY */
    bool non_blocking;                              /**< Use non blocking */
+   int tcp_buffer_size;                            /**< The socket buffer size (0 = kernel autotuning) */
+   char tcp_congestion[MISC_LENGTH];               /**< The TCP congestion control algorithm */
+   bool direct_io;                                 /**< Keep the backup files out of the page cache */
 
    struct prometheus prometheus;                   /**< The Prometheus metrics */
+   struct profile_probe profile[NUMBER_OF_PROFILE_PROBES]; /**< The profiling probes, only used with HAVE_PROFILE */
 } __attribute__ ((aligned (64)));
 
 /** @struct main_configuration
@@ -357,10 +600,13 @@ struct main_configuration
 
    int compression_type;                        /**< The compression type */
    int compression_level;                       /**< The compression level */
+   int compression_frame_size;                  /**< The uncompressed size of each seekable Zstandard frame (0 = one frame) */
+   bool compression_adaptive;                   /**< Adapt the compression level to the backup throughput */
 
    int create_slot;                             /**< Create a slot */
 
    int storage_engine;                          /**< The storage engine */
+   bool reflink;                                /**< Share the extents of unchanged files with the previous backup */
 
    int encryption;                              /**< The AES encryption mode */
 
@@ -368,23 +614,39 @@ struct main_configuration
    char ssh_username[MISC_LENGTH];              /**< The SSH username */
    char ssh_base_dir[MAX_PATH];                 /**< The SSH base directory */
    char ssh_ciphers[MISC_LENGTH];               /**< The SSH supported ciphers */
+   int ssh_max_inflight;                        /**< The number of SFTP writes in flight per file */
 
    char s3_aws_region[MISC_LENGTH];             /**< The AWS region */
    char s3_access_key_id[MISC_LENGTH];          /**< The IAM Access Key ID */
    char s3_secret_access_key[MISC_LENGTH];      /**< The IAM Secret Access Key */
    char s3_bucket[MISC_LENGTH];                 /**< The S3 bucket */
    char s3_base_dir[MAX_PATH];                  /**< The S3 base directory */
+   int s3_part_size;                            /**< The size of the parts of an S3 multipart upload */
 
    char azure_storage_account[MISC_LENGTH];     /**< The Azure storage account name */
    char azure_container[MISC_LENGTH];           /**< The Azure container name */
    char azure_shared_key[MISC_LENGTH];          /**< The Azure storage account key */
    char azure_base_dir[MAX_PATH];               /**< The Azure base directory */
+   int azure_block_size;                        /**< The size of the blocks of an Azure block blob upload */
+   int storage_pack_size;                       /**< The size under which files are packed for S3 and Azure, 0 to disable */
+   int upload_concurrency;                      /**< The number of concurrent uploads to S3 or Azure */
+   int upload_max_rate;                         /**< The bytes per second uploaded to S3 or Azure (0 = no limit) */
+   int bandwidth_max_rate;                      /**< The bytes per second shared by all backups, restores and uploads (0 = no limit) */
+   int backup_window;                           /**< The seconds a backup of all servers should finish in (0 = no window) */
 
    int retention_days;                          /**< The retention days for the server */
    int retention_weeks;                         /**< The retention weeks for the server */
    int retention_months;                        /**< The retention months for the server */
    int retention_years;                         /**< The retention years for the server */
    int retention_interval;                      /**< The retention interval */
+   bool delete_trash;                           /**< Move deleted backups to a trash directory that is emptied in the background */
+
+   int compaction_interval;                     /**< The compaction interval in seconds (0 = disabled) */
+   int compaction_chain;                        /**< The longest incremental chain kept by compaction */
+   int compaction_max_rate;                     /**< The bytes per second written by compaction (0 = no limit) */
+
+   int scrub_interval;                          /**< The scrub interval in seconds (0 = disabled) */
+   int scrub_max_rate;                          /**< The bytes per second read by the scrubber (0 = no limit) */
 
    char workspace[MAX_PATH];                    /**< A workspace for combining incremental backups */
 
@@ -402,6 +664,7 @@ struct main_configuration
    char pidfile[MAX_PATH];                      /**< File containing the PID */
 
    int workers;                                 /**< The number of workers */
+   int io_workers;                              /**< The number of I/O workers */
 
    unsigned int update_process_title;           /**< Behaviour for updating the process title */
 
@@ -416,6 +679,30 @@ struct main_configuration
 
    int manifest;                                /**< The manifest hash algorithm */
 
+   int wal_cache_size;                          /**< The size of the cache of decoded WAL segments (0 = disabled) */
+   int wal_flush_size;                          /**< The number of WAL bytes between fsync's (0 = at segment end, 1 = every message) */
+   int wal_flush_interval;                      /**< The number of milliseconds between WAL fsync's (0 = disabled) */
+   int wal_status_size;                         /**< The number of flushed WAL bytes between status reports under load (0 = every fsync) */
+   int wal_status_interval;                     /**< The number of seconds between status reports when idle (0 = disabled) */
+   int wal_preallocate;                         /**< The number of preallocated WAL segments to keep ready */
+   bool wal_inline_compression;                 /**< Compress and encrypt WAL segments while streaming */
+   bool wal_dictionary;                         /**< Compress WAL segments with a trained Zstandard dictionary */
+   bool restore_io_uring;                       /**< Use io_uring for the small files of a restore */
+   bool wal_multiplex;                          /**< Run all WAL receivers in one process */
+   bool backup_multiplex;                       /**< Run all backups in one process */
+   int backup_write_queue;                      /**< The number of chunks queued for the backup writer thread */
+   int memory_budget;                           /**< The memory a workflow process holds before it adapts (0 = unlimited) */
+   int wal_prefetch;                            /**< The number of WAL segments prefetched for the restore_command */
+   int wal_compaction_age;                      /**< The age in seconds of WAL segments recompressed by the compaction (0 = disabled) */
+   bool manifest_tree;                          /**< Record chunked tree hashes of the large files of a backup */
+   bool incremental_delta;                      /**< Delta encode the changed blocks of an incremental backup against its parent */
+   char worker_cpus[MISC_LENGTH];               /**< The CPUs the workers are pinned to */
+   char receiver_cpus[MISC_LENGTH];             /**< The CPUs the backup receiver is pinned to */
+
+   atomic_ulong backup_generation;              /**< The generation of the backup information, bumped on every change */
+   struct storage_size used_space;              /**< The cached size of the base directory */
+   struct bandwidth bandwidth;                  /**< The processes sharing the bandwidth budget */
+
 #ifdef DEBUG
    bool link;                                   /**< Do linking */
 #endif
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGMONETA_PROFILE_H
+#define PGMONETA_PROFILE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgmoneta.h>
+#include <json.h>
+
+#include <stdint.h>
+
+/** @struct profile_scope
+ * Defines a running probe
+ */
+struct profile_scope
+{
+   int probe;      /**< The probe */
+   uint64_t start; /**< The start in nanoseconds */
+};
+
+#ifdef HAVE_PROFILE
+/**
+ * Time the rest of the enclosing scope with a probe. The time is recorded when the
+ * scope is left, whatever the path
+ */
+#define PGMONETA_PROFILE(p) \
+        struct profile_scope __attribute__ ((cleanup(pgmoneta_profile_end))) profile_scope = {.probe = (p), .start = pgmoneta_profile_now()}
+#else
+#define PGMONETA_PROFILE(p) do {} while (0)
+#endif
+
+/**
+ * Get the monotonic clock used by the probes
+ * @return The clock in nanoseconds
+ */
+uint64_t
+pgmoneta_profile_now(void);
+
+/**
+ * Record a probe when its scope is left
+ * @param scope The scope
+ */
+void
+pgmoneta_profile_end(struct profile_scope* scope);
+
+/**
+ * Move the probes recorded by this process to shared memory
+ */
+void
+pgmoneta_profile_flush(void);
+
+/**
+ * Reset the probes in shared memory
+ */
+void
+pgmoneta_profile_reset(void);
+
+/**
+ * Get the name of a probe
+ * @param probe The probe
+ * @return The name
+ */
+char*
+pgmoneta_profile_name(int probe);
+
+/**
+ * Create a json array of the probes
+ * @param probes [out] The probes
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_profile_json(struct json** probes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGMONETA_PROGRESS_H
+#define PGMONETA_PROGRESS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgmoneta.h>
+#include <json.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** @struct progress_snapshot
+ * Defines a consistent view of the progress of a server
+ */
+struct progress_snapshot
+{
+   int workflow;             /**< The workflow type */
+   char phase[MISC_LENGTH];  /**< The name of the phase */
+   double elapsed;           /**< The seconds since the operation started */
+   double phase_elapsed;     /**< The seconds since the phase started */
+   uint64_t bytes_done;      /**< The bytes processed by the phase */
+   uint64_t bytes_total;     /**< The bytes the phase is expected to process, 0 if unknown */
+   uint64_t files_done;      /**< The files processed by the phase */
+   uint64_t files_total;     /**< The files the phase is expected to process, 0 if unknown */
+   double throughput;        /**< The bytes per second of the phase */
+   double remaining;         /**< The seconds until the phase is done, negative if unknown */
+};
+
+/**
+ * Start tracking the progress of an operation of a server in this process.
+ * Nested operations are part of the outermost one
+ * @param server The server
+ * @param workflow The workflow type
+ */
+void
+pgmoneta_progress_start(int server, int workflow);
+
+/**
+ * Start a phase of the operation
+ * @param name The name of the phase
+ */
+void
+pgmoneta_progress_phase(char* name);
+
+/**
+ * Set the expected size of the phase
+ * @param bytes The number of bytes, 0 if unknown
+ * @param files The number of files, 0 if unknown
+ */
+void
+pgmoneta_progress_total(uint64_t bytes, uint64_t files);
+
+/**
+ * Add processed bytes and files to the phase. Safe to call from any thread
+ * @param bytes The number of bytes
+ * @param files The number of files
+ */
+void
+pgmoneta_progress_add(uint64_t bytes, uint64_t files);
+
+/**
+ * Finish the operation
+ */
+void
+pgmoneta_progress_finish(void);
+
+/**
+ * Get the progress of a server
+ * @param server The server
+ * @param snapshot The resulting snapshot
+ * @return true if an operation is running, otherwise false
+ */
+bool
+pgmoneta_progress_snapshot(int server, struct progress_snapshot* snapshot);
+
+/**
+ * Get the name of a workflow type
+ * @param workflow The workflow type
+ * @return The name
+ */
+char*
+pgmoneta_progress_workflow_name(int workflow);
+
+/**
+ * Create the management representation of the progress of a server
+ * @param server The server
+ * @param progress The resulting progress, NULL if no operation is running
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_progress_json(int server, struct json** progress);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
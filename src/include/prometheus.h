@@ -36,6 +36,7 @@ extern "C" {
 #include <pgmoneta.h>
 
 #include <ev.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <openssl/ssl.h>
 
@@ -68,6 +69,29 @@ extern "C" {
 void
 pgmoneta_prometheus(SSL* client_ssl, int fd);
 
+/**
+ * Start the thread serving the metrics connections of the main process.
+ * The connections are kept open between scrapes and the metrics are
+ * gzip compressed when the client accepts it
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_prometheus_start(void);
+
+/**
+ * Hand a metrics connection to the metrics thread
+ * @param client_fd The client descriptor
+ * @return 0 upon success, otherwise 1 and the caller keeps the connection
+ */
+int
+pgmoneta_prometheus_submit(int client_fd);
+
+/**
+ * Stop the metrics thread and close its connections
+ */
+void
+pgmoneta_prometheus_stop(void);
+
 /**
  * Reset the counters and histograms
  */
@@ -105,6 +129,117 @@ pgmoneta_init_prometheus_cache(size_t* p_size, void** p_shmem);
 void
 pgmoneta_prometheus_logging(int logging);
 
+/**
+ * Add a copied file
+ * @param method The copy method
+ * @param bytes The size of the file
+ */
+void
+pgmoneta_prometheus_copy(int method, size_t bytes);
+
+/**
+ * Add an upload to remote storage
+ * @param engine The storage engine
+ * @param bytes The number of bytes uploaded
+ * @param seconds The duration of the upload
+ */
+void
+pgmoneta_prometheus_upload(int engine, uint64_t bytes, double seconds);
+
+/**
+ * Add the statistics of a worker pool
+ * @param type The workflow type
+ * @param statistics The statistics
+ */
+void
+pgmoneta_prometheus_workers(int type, struct workers_statistics* statistics);
+
+/**
+ * Get the monotonic clock used for the histograms
+ * @return The clock in microseconds
+ */
+uint64_t
+pgmoneta_prometheus_now(void);
+
+/**
+ * Add a WAL operation
+ * @param server The server
+ * @param phase The WAL phase
+ * @param start The start of the operation from pgmoneta_prometheus_now()
+ */
+void
+pgmoneta_prometheus_wal(int server, int phase, uint64_t start);
+
+/**
+ * Add WAL received and written by the WAL receiver
+ * @param server The server
+ * @param lsn The LSN written up to
+ * @param bytes The number of bytes
+ * @param received The receipt of the message from pgmoneta_prometheus_now()
+ */
+void
+pgmoneta_prometheus_wal_received(int server, uint64_t lsn, uint64_t bytes, uint64_t received);
+
+/**
+ * Add WAL durably flushed by the WAL receiver
+ * @param server The server
+ * @param lsn The LSN flushed up to
+ * @param received The receipt of the oldest flushed data from pgmoneta_prometheus_now()
+ */
+void
+pgmoneta_prometheus_wal_flushed(int server, uint64_t lsn, uint64_t received);
+
+/**
+ * Set the flush LSN reported to the server in a status report
+ * @param server The server
+ * @param lsn The LSN
+ */
+void
+pgmoneta_prometheus_wal_reported(int server, uint64_t lsn);
+
+/**
+ * Sample the TCP state of a connection to a server. Only supported on Linux
+ * @param server The server
+ * @param type The connection type, SOCKET_WAL or SOCKET_BACKUP
+ * @param fd The descriptor
+ */
+void
+pgmoneta_prometheus_socket(int server, int type, int fd);
+
+/**
+ * Add a file compressed, decompressed, encrypted or decrypted
+ * @param operation The file operation
+ * @param start The start of the operation from pgmoneta_prometheus_now()
+ */
+void
+pgmoneta_prometheus_file(int operation, uint64_t start);
+
+/**
+ * Add a restore phase
+ * @param phase The restore phase
+ * @param bytes The number of bytes restored
+ * @param seconds The duration of the phase
+ */
+void
+pgmoneta_prometheus_restore(int phase, uint64_t bytes, double seconds);
+
+/**
+ * Add a lookup in the WAL cache
+ * @param hit Whether the segment was in the cache
+ */
+void
+pgmoneta_prometheus_wal_cache(bool hit);
+
+/**
+ * Change the memory held by a workflow
+ * @param type The workflow type
+ * @param delta The number of bytes allocated, negative when released
+ * @param used The memory held by the process
+ * @param exceeded Whether the process went above the memory budget
+ */
+void
+pgmoneta_prometheus_memory(int type, long delta, long used, bool exceeded);
+
 #ifdef __cplusplus
 }
 #endif
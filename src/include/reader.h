@@ -0,0 +1,253 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGMONETA_READER_H
+#define PGMONETA_READER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgmoneta.h>
+#include <workers.h>
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#define READER_BUFFER_SIZE 65536
+
+#define READER_PREFETCH_SIZE  (8 * 1024 * 1024)
+#define READER_WRITEBACK_SIZE (8 * 1024 * 1024)
+
+struct copy_batch;
+struct reader;
+
+/** @struct reader_statistics
+ * Defines the statistics of the files extracted by a process. The times are
+ * summed over the threads doing the work, in microseconds
+ */
+struct reader_statistics
+{
+   atomic_ullong files;        /**< The number of files extracted */
+   atomic_ullong read_bytes;   /**< The bytes read from the backup files */
+   atomic_ullong read_time;    /**< The time spent reading the backup files */
+   atomic_ullong decode_time;  /**< The time spent decrypting and decompressing */
+   atomic_ullong write_bytes;  /**< The bytes written to the plain files */
+   atomic_ullong write_time;   /**< The time spent writing the plain files */
+};
+
+/**
+ * Read from a reader layer
+ * @param reader The reader
+ * @param buffer The buffer
+ * @param size The size of the buffer
+ * @param read The number of bytes read, 0 at the end of the stream
+ * @return 0 upon success, otherwise 1
+ */
+typedef int (*reader_read_func)(struct reader* reader, void* buffer, size_t size, size_t* read);
+
+/**
+ * Release the state of a reader layer
+ * @param reader The reader
+ */
+typedef void (*reader_close_func)(struct reader* reader);
+
+/** @struct reader
+ * Defines a layer of a streaming reader. A backup file is read through a
+ * file layer, an optional decryption layer and an optional decompression
+ * layer, so its content is available in one pass without intermediate files
+ */
+struct reader
+{
+   reader_read_func read;   /**< The read function */
+   reader_close_func close; /**< The close function */
+   struct reader* source;   /**< The layer read from, or NULL for the file layer */
+   void* state;             /**< The state of the layer */
+};
+
+/**
+ * Create a reader layer. The layer owns the source from then on
+ * @param source The source layer
+ * @param read The read function
+ * @param close The close function
+ * @param state The state of the layer
+ * @param reader The resulting reader
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_reader_create(struct reader* source, reader_read_func read, reader_close_func close, void* state, struct reader** reader);
+
+/**
+ * Open a backup file. The decryption and decompression layers are
+ * chosen from the .aes and compression suffixes of the path
+ * @param path The file path
+ * @param reader The resulting reader
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_reader_open(char* path, struct reader** reader);
+
+/**
+ * Read from a reader
+ * @param reader The reader
+ * @param buffer The buffer
+ * @param size The size of the buffer
+ * @param read The number of bytes read, 0 at the end of the stream
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_reader_read(struct reader* reader, void* buffer, size_t size, size_t* read);
+
+/**
+ * Read until the buffer is full or the stream ends
+ * @param reader The reader
+ * @param buffer The buffer
+ * @param size The size of the buffer
+ * @param read The number of bytes read, short only at the end of the stream
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_reader_fill(struct reader* reader, void* buffer, size_t size, size_t* read);
+
+/**
+ * Close a reader and all the layers below it
+ * @param reader The reader
+ */
+void
+pgmoneta_reader_close(struct reader* reader);
+
+/**
+ * Calculate the hash of a backup file. Compressed and encrypted files
+ * are hashed as they are decoded
+ * @param path The file path
+ * @param algorithm The hash algorithm
+ * @param throttle Is the read throttled by the reader rate
+ * @param bytes [out] The number of bytes hashed, or NULL
+ * @param hash [out] The hash
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_reader_hash(char* path, int algorithm, bool throttle, uint64_t* bytes, char** hash);
+
+/**
+ * Get the name of a backup file once decrypted and decompressed
+ * @param path The file path
+ * @param name The resulting name
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_reader_plain_name(char* path, char** name);
+
+/**
+ * Decrypt and decompress a backup file to a file in one pass
+ * @param from The backup file
+ * @param to The plain file
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_reader_copy(char* from, char* to);
+
+/**
+ * Extract a backup file. The suffixes of the destination are removed
+ * when the file is decrypted or decompressed, otherwise it is copied
+ * @param from The backup file
+ * @param to The destination as named in the backup
+ * @param workers The optional workers
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_reader_extract_file(char* from, char* to, struct workers* workers);
+
+/**
+ * Extract a backup file into a directory, copying a plain file with the
+ * batch of the directory
+ * @param from The backup file
+ * @param to The destination as named in the backup
+ * @param size The size of the backup file
+ * @param mode The mode of the backup file
+ * @param batch The batch
+ * @param workers The optional workers
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_reader_extract_batch(char* from, char* to, size_t size, mode_t mode, struct copy_batch* batch, struct workers* workers);
+
+/**
+ * Extract a backup directory
+ * @param from The backup directory
+ * @param to The destination directory
+ * @param restore_last_files_names The files to skip
+ * @param workers The optional workers
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_reader_extract_directory(char* from, char* to, char** restore_last_files_names, struct workers* workers);
+
+/**
+ * Limit the rate at which the extractions of the process write
+ * @param max_rate The number of bytes per second, 0 for no limit
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_reader_max_rate(long max_rate);
+
+/**
+ * Wait until a number of bytes can be written within the rate limit of the process
+ * @param bytes The number of bytes
+ */
+void
+pgmoneta_reader_throttle(size_t bytes);
+
+/**
+ * Reset the extraction statistics of the process
+ */
+void
+pgmoneta_reader_statistics_reset(void);
+
+/**
+ * Get the extraction statistics of the process
+ * @param statistics The resulting statistics
+ */
+void
+pgmoneta_reader_statistics(struct reader_statistics* statistics);
+
+/**
+ * Log the throughput of the read, decode and write phases
+ * @param prefix The log prefix
+ */
+void
+pgmoneta_reader_log_statistics(char* prefix);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
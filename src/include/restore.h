@@ -109,18 +109,21 @@ int
 pgmoneta_rollup_backups(int server, char* newest_label, char* oldest_label);
 
 /**
- * Extract and restore the incremental backup into workspace
+ * Extract and restore the incremental backup into workspace, or into a directory
+ * on the file system of its final place, so its files can be moved there
  * @param server The server
  * @param label The label
+ * @param directory The directory to extract into, or NULL for the workspace
  * @param [out] root The root directory backup is extracted to
  * @param [out] base The base data directory backup is extracted to
  * @return 0 on success, 1 if otherwise
  */
 int
-pgmoneta_extract_incremental_backup(int server, char* label, char** root, char** base);
+pgmoneta_extract_incremental_backup(int server, char* label, char* directory, char** root, char** base);
 
 /**
- * Copy a PostgreSQL installation
+ * Copy a PostgreSQL installation from a backup. Files are decrypted and
+ * decompressed while they are copied
  * @param from The from directory
  * @param to The to directory
  * @param base The base directory
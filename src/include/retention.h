@@ -40,8 +40,9 @@ extern "C" {
 /**
  * Retention
  * @param argv The argv
+ * @return 0 upon success, otherwise 1
  */
-void
+int
 pgmoneta_retention(char** argv);
 
 #ifdef __cplusplus
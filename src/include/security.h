@@ -45,6 +45,12 @@ extern "C" {
 #define HASH_ALGORITHM_SHA256  3
 #define HASH_ALGORITHM_SHA384  4
 #define HASH_ALGORITHM_SHA512  5
+#define HASH_ALGORITHM_XXH3    6
+#define HASH_ALGORITHM_BLAKE3  7
+
+#define TREE_HASH_CHUNK_SIZE (16 * 1024 * 1024)
+
+struct hash_context;
 
 /**
  * Authenticate a user
@@ -132,6 +138,17 @@ pgmoneta_create_sha384_file(char* filename, char** sha384);
 int
 pgmoneta_create_sha512_file(char* filename, char** sha512);
 
+/**
+ * Generate the hash that identifies a file in backup.sha256. This is xxh3 or
+ * blake3 when the server manifest setting selects one of them, otherwise SHA256
+ * @param server The server
+ * @param file_path The file path
+ * @param hash [out] The hash value
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_create_backup_file_hash(int server, char* file_path, char** hash);
+
 /**
  * Generate SHA256 for a string.
  * @param filename The string.
@@ -184,6 +201,56 @@ pgmoneta_create_crc32c_file(char* path, char** crc);
 int
 pgmoneta_create_file_hash(int algorithm, char* file_path, char** hash);
 
+/**
+ * Create the tree hash of a file. The chunks of TREE_HASH_CHUNK_SIZE are
+ * hashed in parallel, and the root is the hash of the hashes of the chunks
+ * separated by ':'. A damaged file can be located to a chunk by comparing the
+ * hashes of the chunks
+ * @param algorithm The hash algorithm
+ * @param file_path The file path
+ * @param number_of_workers The number of workers, or 0 to hash the chunks in turn
+ * @param root [out] The root hash
+ * @param chunks [out] The hashes of the chunks separated by ':'
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_create_file_tree_hash(int algorithm, char* file_path, int number_of_workers, char** root, char** chunks);
+
+/**
+ * Create a hash context, to hash data that is not in a file
+ * @param algorithm The hash algorithm
+ * @param context [out] The context
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_hash_create(int algorithm, struct hash_context** context);
+
+/**
+ * Add data to a hash
+ * @param context The context
+ * @param data The data
+ * @param size The size of the data
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_hash_update(struct hash_context* context, void* data, size_t size);
+
+/**
+ * Get the hash of the data added, in the same format as the file hashes
+ * @param context The context
+ * @param hash [out] The hash
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_hash_final(struct hash_context* context, char** hash);
+
+/**
+ * Destroy a hash context
+ * @param context The context
+ */
+void
+pgmoneta_hash_destroy(struct hash_context* context);
+
 /**
  * Close a SSL structure
  * @param ssl The SSL structure
@@ -199,6 +266,15 @@ pgmoneta_close_ssl(SSL* ssl);
 int
 pgmoneta_get_hash_algorithm(char* algorithm);
 
+/**
+ * Can equal checksums of an algorithm be taken as equal content. Only the
+ * SHA family qualifies, a collision of CRC32C is found by chance
+ * @param algorithm The algorithm index
+ * @return true if the checksums identify the content, otherwise false
+ */
+bool
+pgmoneta_hash_algorithm_identifies(int algorithm);
+
 /**
  * Create a SSL context
  * @param client True if client, false if server
@@ -37,6 +37,8 @@ extern "C" {
 
 #include <stdlib.h>
 
+#include <openssl/ssl.h>
+
 /**
  * Get the information for a server
  * @param srv The server index
@@ -44,6 +46,35 @@ extern "C" {
 void
 pgmoneta_server_info(int srv);
 
+/**
+ * Get a non-replication connection to a server as its configured user. The spare
+ * connection of the server is reused when it is still alive, otherwise a new one is
+ * authenticated
+ * @param srv The server index
+ * @param ssl The resulting SSL structure
+ * @param socket The resulting socket
+ * @return AUTH_SUCCESS, AUTH_BAD_PASSWORD or AUTH_ERROR
+ */
+int
+pgmoneta_server_connect(int srv, SSL** ssl, int* socket);
+
+/**
+ * Give back a connection from pgmoneta_server_connect. The connection must be idle.
+ * It is kept as the spare connection of the server when there is none, otherwise it is closed.
+ * The spare connections belong to the calling thread, and are closed when the process exits
+ * @param srv The server index
+ * @param ssl The SSL structure
+ * @param socket The socket
+ */
+void
+pgmoneta_server_disconnect(int srv, SSL* ssl, int socket);
+
+/**
+ * Close the spare connections of the calling thread, and release its server parameters
+ */
+void
+pgmoneta_server_close_connections(void);
+
 /**
  * Is the base settings for the server set
  * @param srv The server index
@@ -51,6 +82,18 @@ pgmoneta_server_info(int srv);
 bool
 pgmoneta_server_valid(int srv);
 
+/**
+ * Select the server a backup of a server is taken from. With backup_standby the
+ * server and the servers that follow it are asked for their number of active
+ * sessions, and the standby replay lag, over their non-replication connections.
+ * The least loaded standby whose replay is within SERVER_STANDBY_MAX_LAG is
+ * selected when it isn't busier than the server, otherwise the server itself
+ * @param srv The server index
+ * @return The server index of the source
+ */
+int
+pgmoneta_server_backup_source(int srv);
+
 #ifdef __cplusplus
 }
 #endif
@@ -46,8 +46,9 @@ extern "C" {
  * @param compression The compress method for wire protocol
  * @param encryption The encrypt method for wire protocol
  * @param payload The payload
+ * @return 0 upon success, otherwise 1
  */
-void
+int
 pgmoneta_status(SSL* ssl, int client_fd, bool offline, uint8_t compression, uint8_t encryption, struct json* payload);
 
 /**
@@ -58,8 +59,9 @@ pgmoneta_status(SSL* ssl, int client_fd, bool offline, uint8_t compression, uint
  * @param compression The compress method for wire protocol
  * @param encryption The encrypt method for wire protocol
  * @param payload The payload
+ * @return 0 upon success, otherwise 1
  */
-void
+int
 pgmoneta_status_details(SSL* ssl, int client_fd, bool offline, uint8_t compression, uint8_t encryption, struct json* payload);
 
 #ifdef __cplusplus
@@ -35,12 +35,16 @@ extern "C" {
 
 /* pgmoneta */
 #include <pgmoneta.h>
+#include <deque.h>
 #include <workflow.h>
 
 /* system */
 #include <libssh/libssh.h>
 #include <libssh/sftp.h>
 
+/* The number of times a remote engine runs a backup upload, each run resumes from the journal */
+#define STORAGE_UPLOAD_ROUNDS 3
+
 /**
  * Create a workflow for the local storage engine
  * @return The workflow
@@ -70,6 +74,50 @@ pgmoneta_storage_create_s3(void);
 struct workflow*
 pgmoneta_storage_create_azure(void);
 
+/**
+ * Upload completed WAL segments to S3
+ * @param server The server index
+ * @param directory The local WAL directory
+ * @param files The file names of the segments in the directory
+ * @return 0 on success, otherwise 1
+ */
+int
+pgmoneta_s3_wal_upload(int server, char* directory, struct deque* files);
+
+/**
+ * Upload completed WAL segments to Azure
+ * @param server The server index
+ * @param directory The local WAL directory
+ * @param files The file names of the segments in the directory
+ * @return 0 on success, otherwise 1
+ */
+int
+pgmoneta_azure_wal_upload(int server, char* directory, struct deque* files);
+
+/**
+ * Fetch the data directory of a backup from S3 into the backup directory.
+ * The files are listed under the backup, and downloaded with ranged GETs of
+ * s3_part_size over upload_concurrency connections
+ * @param server The server index
+ * @param label The backup label
+ * @param filter Is a path, relative to the data directory, fetched, or NULL for all files
+ * @return 0 on success, otherwise 1
+ */
+int
+pgmoneta_s3_fetch(int server, char* label, bool (*filter)(char*));
+
+/**
+ * Fetch the data directory of a backup from Azure into the backup directory.
+ * The files are listed under the backup, and downloaded with ranged GETs of
+ * azure_block_size over upload_concurrency connections
+ * @param server The server index
+ * @param label The backup label
+ * @param filter Is a path, relative to the data directory, fetched, or NULL for all files
+ * @return 0 on success, otherwise 1
+ */
+int
+pgmoneta_azure_fetch(int server, char* label, bool (*filter)(char*));
+
 /**
  * Open WAL shipping file in remote ssh server
  * @param srv The server index
@@ -91,6 +139,26 @@ pgmoneta_sftp_wal_open(int server, char* filename, int segsize, sftp_file* file)
  */
 int
 pgmoneta_sftp_wal_close(int server, char* filename, bool partial, sftp_file* file);
+
+/**
+ * Is the restore directory a remote target on the form [user@]host:/path
+ * @param target The restore directory
+ * @return True if remote, otherwise false
+ */
+bool
+pgmoneta_sftp_is_remote(char* target);
+
+/**
+ * Upload a restored directory to a remote target over SFTP.
+ * The files are shared between one session per worker
+ * @param server The server index
+ * @param target The remote target on the form [user@]host:/path
+ * @param local_root The local directory holding the restore
+ * @return 0 on success, otherwise 1
+ */
+int
+pgmoneta_sftp_restore(int server, char* target, char* local_root);
+
 #ifdef __cplusplus
 }
 #endif
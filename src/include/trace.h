@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGMONETA_TRACE_H
+#define PGMONETA_TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Static tracepoints for bpftrace, perf and SystemTap, like
+ *
+ *   bpftrace -e 'usdt:/usr/lib/libpgmoneta.so:pgmoneta:wal_message { @[arg0] = sum(arg2); }'
+ *
+ * A tracepoint is a single nop in the code until a tracer attaches to it.
+ * They are only compiled in when sys/sdt.h is found, see WITH_SDT
+ */
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+
+#define PGMONETA_TRACE(name)                DTRACE_PROBE(pgmoneta, name)
+#define PGMONETA_TRACE1(name, a)            DTRACE_PROBE1(pgmoneta, name, a)
+#define PGMONETA_TRACE2(name, a, b)         DTRACE_PROBE2(pgmoneta, name, a, b)
+#define PGMONETA_TRACE3(name, a, b, c)      DTRACE_PROBE3(pgmoneta, name, a, b, c)
+#define PGMONETA_TRACE4(name, a, b, c, d)   DTRACE_PROBE4(pgmoneta, name, a, b, c, d)
+#else
+#define PGMONETA_TRACE(name)                do {} while (0)
+#define PGMONETA_TRACE1(name, a)            do {} while (0)
+#define PGMONETA_TRACE2(name, a, b)         do {} while (0)
+#define PGMONETA_TRACE3(name, a, b, c)      do {} while (0)
+#define PGMONETA_TRACE4(name, a, b, c, d)   do {} while (0)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -45,6 +45,8 @@ extern "C" {
 #define LONG_TIME_LENGTH  16 + 1
 #define UTC_TIME_LENGTH   29 + 1
 
+#define BUILDER_INLINE_SIZE 256
+
 /** Define Windows 20 palette colors as constants using ANSI codes **/
 #define COLOR_BLACK         "\033[30m"
 #define COLOR_DARK_RED      "\033[31m"
@@ -68,6 +70,8 @@ extern "C" {
 #define COLOR_WHITE         "\033[97m"
 #define COLOR_RESET         "\033[0m"    /* Reset to default color */
 
+struct copy_batch;
+
 /** @struct signal_info
  * Defines the signal structure
  */
@@ -77,6 +81,19 @@ struct signal_info
    int slot;                /**< The slot */
 };
 
+/** @struct builder
+ * Defines a string builder that keeps the length and the capacity of the string,
+ * so appending is amortized constant time. Strings shorter than the inline buffer
+ * need no allocation, and a zeroed builder is empty
+ */
+struct builder
+{
+   char* heap;                              /**< The allocated string, or NULL while the inline buffer is used */
+   size_t length;                           /**< The length of the string */
+   size_t capacity;                         /**< The capacity of the allocated string */
+   char inline_data[BUILDER_INLINE_SIZE];   /**< The inline buffer */
+};
+
 /** @struct pgmoneta_command
  * Defines pgmoneta commands.
  * The necessary fields are marked with an ">".
@@ -127,15 +144,15 @@ struct pgmoneta_parsed_command
 };
 
 /** @struct token_bucket
- * Defines token bucket structure
+ * Defines token bucket structure. The bucket holds no pointers and uses
+ * the monotonic clock, so it can be shared between processes in shared memory
  */
 struct token_bucket
 {
    unsigned long burst;     /**< Default value is 0, no limit */
    atomic_ulong cur_tokens; /**< The current tokens */
-   long max_rate;           /**< The maximum rate */
-   int every;               /**< The every rate */
-   atomic_ulong last_time;  /**< The last time updated */
+   long max_rate;           /**< The maximum rate in bytes per second */
+   atomic_ulong last_time;  /**< The last time tokens were added in nanoseconds */
 };
 
 /**
@@ -617,6 +634,145 @@ pgmoneta_append_double_precision(char* orig, double d, int precision);
 char*
 pgmoneta_append_bool(char* orig, bool b);
 
+/**
+ * Initialize a string builder
+ * @param builder The builder
+ */
+void
+pgmoneta_builder_init(struct builder* builder);
+
+/**
+ * Append a string to a string builder
+ * @param builder The builder
+ * @param s The string
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_builder_append(struct builder* builder, char* s);
+
+/**
+ * Append a number of bytes to a string builder
+ * @param builder The builder
+ * @param s The bytes
+ * @param length The number of bytes
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_builder_append_length(struct builder* builder, char* s, size_t length);
+
+/**
+ * Append a character to a string builder
+ * @param builder The builder
+ * @param c The character
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_builder_append_char(struct builder* builder, char c);
+
+/**
+ * Append an integer to a string builder
+ * @param builder The builder
+ * @param i The integer
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_builder_append_int(struct builder* builder, int i);
+
+/**
+ * Append an unsigned long to a string builder
+ * @param builder The builder
+ * @param l The unsigned long
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_builder_append_ulong(struct builder* builder, unsigned long l);
+
+/**
+ * Append a double to a string builder
+ * @param builder The builder
+ * @param d The double
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_builder_append_double(struct builder* builder, double d);
+
+/**
+ * Append a double with set precision to a string builder
+ * @param builder The builder
+ * @param d The double
+ * @param precision The number of digits after decimal
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_builder_append_double_precision(struct builder* builder, double d, int precision);
+
+/**
+ * Append a bool to a string builder
+ * @param builder The builder
+ * @param b The bool
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_builder_append_bool(struct builder* builder, bool b);
+
+/**
+ * Format a string and append it to a string builder
+ * @param builder The builder
+ * @param format The format
+ * @param ... The arguments to be formatted
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_builder_format(struct builder* builder, char* format, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * Append an indentation and a tag to a string builder, like pgmoneta_indent
+ * @param builder The builder
+ * @param tag The tag, or NULL
+ * @param indent The number of spaces
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_builder_indent(struct builder* builder, char* tag, int indent);
+
+/**
+ * Get the string of a string builder, valid until the builder is changed
+ * @param builder The builder
+ * @return The string
+ */
+char*
+pgmoneta_builder_string(struct builder* builder);
+
+/**
+ * Get the length of the string of a string builder
+ * @param builder The builder
+ * @return The length
+ */
+size_t
+pgmoneta_builder_length(struct builder* builder);
+
+/**
+ * Empty a string builder, keeping its capacity
+ * @param builder The builder
+ */
+void
+pgmoneta_builder_reset(struct builder* builder);
+
+/**
+ * Take the string of a string builder as an allocated string, and empty the builder
+ * @param builder The builder
+ * @return The string, which the caller must free, or NULL if out of memory
+ */
+char*
+pgmoneta_builder_release(struct builder* builder);
+
+/**
+ * Free the memory of a string builder, and empty it
+ * @param builder The builder
+ */
+void
+pgmoneta_builder_destroy(struct builder* builder);
+
 /**
  * Remove whitespace from a string
  * @param orig The original string
@@ -651,6 +807,24 @@ pgmoneta_remove_suffix(char* orig, char* suffix);
 unsigned long
 pgmoneta_directory_size(char* directory);
 
+/**
+ * Get the size of a storage area of a server.
+ * The size is cached in shared memory until the storage of the server
+ * changes, or for at most STORAGE_CACHE_MAX_AGE seconds
+ * @param server The server, or -1 for the base directory
+ * @param storage The storage area
+ * @return The size in bytes
+ */
+unsigned long
+pgmoneta_storage_size(int server, int storage);
+
+/**
+ * Mark the storage of a server as changed
+ * @param server The server
+ */
+void
+pgmoneta_storage_changed(int server);
+
 /**
  * Get directories
  * @param base The base directory
@@ -669,6 +843,24 @@ pgmoneta_get_directories(char* base, int* number_of_directories, char*** dirs);
 int
 pgmoneta_delete_directory(char* path);
 
+/**
+ * Remove a directory, where the files of each directory are deleted by the workers
+ * @param path The directory
+ * @param workers The optional workers
+ * @return The result
+ */
+int
+pgmoneta_delete_directory_parallel(char* path, struct workers* workers);
+
+/**
+ * Move a directory into a trash directory, which is emptied in the background
+ * @param path The directory
+ * @param trash The trash directory on the same file system
+ * @return The result
+ */
+int
+pgmoneta_trash_directory(char* path, char* trash);
+
 /**
  * Get files
  * @param base The base directory
@@ -727,7 +919,49 @@ int
 pgmoneta_copy_file(char* from, char* to, struct workers* workers);
 
 /**
- * Move a file
+ * Create a batch for the files copied into a directory. With
+ * restore_io_uring the small files are copied together with io_uring,
+ * otherwise each file is copied by pgmoneta_copy_file
+ * @param workers The workers, or NULL
+ * @param batch The resulting batch
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_copy_batch_create(struct workers* workers, struct copy_batch** batch);
+
+/**
+ * Copy a file with a batch. The batch is submitted when it is full, and
+ * large files are copied by pgmoneta_copy_file
+ * @param batch The batch
+ * @param from The from file
+ * @param to The to file, in an existing directory
+ * @param size The size of the from file
+ * @param mode The mode of the from file
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_copy_batch_add(struct copy_batch* batch, char* from, char* to, size_t size, mode_t mode);
+
+/**
+ * Submit the remaining files of a batch and destroy it
+ * @param batch The batch
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_copy_batch_destroy(struct copy_batch* batch);
+
+/**
+ * Link a file, or copy it when the files are on different file systems.
+ * Only use this for files that are never modified in place
+ * @param from The from file
+ * @param to The to file
+ * @return The result
+ */
+int
+pgmoneta_link_or_copy_file(char* from, char* to);
+
+/**
+ * Move a file, or copy and remove it when the files are on different file systems
  * @param from The from file
  * @param to The to file
  * @return The result
@@ -776,6 +1010,31 @@ pgmoneta_is_directory(char* directory);
 bool
 pgmoneta_is_file(char* file);
 
+/**
+ * Defer the fsync of each copied file to a pgmoneta_sync_directory call.
+ * Each call deferring must be matched by one that doesn't
+ * @param defer Should the fsync be deferred
+ */
+void
+pgmoneta_sync_defer(bool defer);
+
+/**
+ * Make all the files of a directory durable. On Linux this is a syncfs of the
+ * file system of the directory, otherwise each file and directory is fsync'ed
+ * @param directory The directory
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_sync_directory(char* directory);
+
+/**
+ * Drop the pages of a file from the page cache when direct_io is on. The dirty
+ * pages are written first, since only clean pages can be dropped
+ * @param file The file
+ */
+void
+pgmoneta_drop_cache(char* file);
+
 /**
  * Compare files
  * @param f1 The first file path
@@ -828,7 +1087,8 @@ bool
 pgmoneta_is_symlink_valid(char* path);
 
 /**
- * Copy WAL files
+ * Copy WAL files. The partial segment is decoded, through the WAL cache
+ * @param server The server
  * @param from The from directory
  * @param to The to directory
  * @param start The start file
@@ -836,7 +1096,7 @@ pgmoneta_is_symlink_valid(char* path);
  * @return The result
  */
 int
-pgmoneta_copy_wal_files(char* from, char* to, char* start, struct workers* workers);
+pgmoneta_copy_wal_files(int server, char* from, char* to, char* start, struct workers* workers);
 
 /**
  * Get the number of WAL files
@@ -983,6 +1243,38 @@ pgmoneta_get_server_backup(int server);
 char*
 pgmoneta_get_server_wal(int server);
 
+/**
+ * Get the directory holding preallocated wal segments for a server
+ * @param server The server
+ * @return The spare directory
+ */
+char*
+pgmoneta_get_server_wal_spare(int server);
+
+/**
+ * Get the directory holding the WAL compression dictionaries for a server
+ * @param server The server
+ * @return The dictionary directory
+ */
+char*
+pgmoneta_get_server_wal_dictionary(int server);
+
+/**
+ * Get the directory holding the WAL segments waiting to be uploaded for a server
+ * @param server The server
+ * @return The upload queue directory
+ */
+char*
+pgmoneta_get_server_wal_upload(int server);
+
+/**
+ * Get the directory holding the summaries of the WAL segments for a server
+ * @param server The server
+ * @return The summary directory
+ */
+char*
+pgmoneta_get_server_wal_summary(int server);
+
 /**
  * Get the wal shipping directory for a server
  * @param server The server
@@ -1216,7 +1508,8 @@ int
 pgmoneta_token_bucket_add(struct token_bucket* tb);
 
 /**
- * Get tokens from token bucket wrapper
+ * Get tokens from token bucket, sleeping exactly until enough tokens
+ * have accrued. More tokens than the burst are taken a burst at a time
  * @param tb The token bucket
  * @param tokens Needed tokens
  * @return 0 upon success, otherwise 1
@@ -1349,6 +1642,34 @@ pgmoneta_backtrace(void);
 int
 pgmoneta_os_kernel_version(char** os, int* kernel_major, int* kernel_minor, int* kernel_patch);
 
+/**
+ * Parse a list of CPUs, like 0-3,8,10-11
+ * @param list The list
+ * @param cpus The resulting CPUs, or NULL to only validate the list
+ * @param size The size of cpus
+ * @param number The resulting number of CPUs
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_parse_cpus(char* list, int* cpus, int size, int* number);
+
+/**
+ * Pin the calling thread to CPUs. Memory the thread touches first
+ * afterwards is allocated on the NUMA node of the CPUs
+ * @param list The list of CPUs, an empty list does nothing
+ * @param index The entry of the list to pin to, modulo its length, or -1 for all of them
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_pin_thread(char* list, int index);
+
+/**
+ * Allow the calling thread to run on all CPUs again
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_unpin_thread(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -78,6 +78,18 @@ struct value
    data_to_string_cb to_string;   /**< The callback to convert data to string */
 };
 
+/**
+ * @struct value_statistics
+ * Defines the allocation statistics of the values of a thread
+ */
+struct value_statistics
+{
+   uint64_t created;   /**< The number of values created */
+   uint64_t allocated; /**< The number of values that needed a malloc */
+   uint64_t inlined;   /**< The number of strings stored inside the value */
+   uint64_t destroyed; /**< The number of values destroyed */
+};
+
 /**
  * @struct value_config
  * Defines configuration for managing a value
@@ -89,7 +101,8 @@ struct value_config
 };
 
 /**
- * Create a value based on the data and value type
+ * Create a value based on the data and value type.
+ * Values are recycled through a per thread cache, and short strings are stored inside the value
  * @param type The value type, use ValueRef if you are only storing pointers without the need to manage memory,
  * use ValueMem if you are storing pointers to a chunk of memory that needs to and can be simply freed
  * (meaning it can't have pointers to other malloced memories)
@@ -111,6 +124,29 @@ pgmoneta_value_create(enum value_type type, uintptr_t data, struct value** value
 int
 pgmoneta_value_create_with_config(uintptr_t data, struct value_config* config, struct value** value);
 
+/**
+ * Initialize a value in place based on the data and value type, for values embedded in another structure.
+ * The data is owned the same way as with pgmoneta_value_create, but the value itself is not freed
+ * by pgmoneta_value_destroy, so call the destroy_data callback instead
+ * @param type The value type
+ * @param data The value data, type cast it to uintptr_t before passing into function
+ * @param value The value
+ * @return 0 on success, 1 if otherwise
+ */
+int
+pgmoneta_value_init(enum value_type type, uintptr_t data, struct value* value);
+
+/**
+ * Initialize a value in place with a config for customized destroy or to_string callback,
+ * the type will default to ValueRef
+ * @param data The value data, type cast it to uintptr_t before passing into function
+ * @param config The configuration
+ * @param value The value
+ * @return 0 on success, 1 if otherwise
+ */
+int
+pgmoneta_value_init_with_config(uintptr_t data, struct value_config* config, struct value* value);
+
 /**
  * Destroy a value along with the data within
  * @param value The value
@@ -173,6 +209,19 @@ pgmoneta_value_to_float(uintptr_t val);
 enum value_type
 pgmoneta_value_to_ref(enum value_type type);
 
+/**
+ * Get the allocation statistics of the values of the calling thread
+ * @param statistics [out] The statistics
+ */
+void
+pgmoneta_value_statistics(struct value_statistics* statistics);
+
+/**
+ * Log the allocation statistics of the values of the calling thread at debug level
+ */
+void
+pgmoneta_value_log_statistics(void);
+
 #ifdef DEBUG
 /**
  * Translate the type to string for debugging purpose
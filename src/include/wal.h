@@ -34,11 +34,14 @@ extern "C" {
 #endif
 
 #include <pgmoneta.h>
+#include <workers.h>
 
 #include <ev.h>
 #include <stdint.h>
 #include <stdlib.h>
 
+#define OID_NAME_LENGTH 16
+
 /** @struct timeline_history
  * Defines a timeline history
  */
@@ -79,7 +82,46 @@ void
 pgmoneta_wal(int srv, char** argv);
 
 /**
- * Find and extract the history info from .history file of given server and timeline
+ * Receive WAL for all servers from a single process, one thread per server
+ * @param argv The argv
+ */
+void
+pgmoneta_wal_multiplex(char** argv);
+
+/**
+ * Should WAL streaming be started for a server, taking followers into account
+ * @param srv The server index
+ * @return True if the server isn't streaming and should be, otherwise false
+ */
+bool
+pgmoneta_wal_should_stream(int srv);
+
+/**
+ * Queue a WAL segment for upload to the remote storage engines, and start an upload
+ * of the queue unless one is already waiting for the server
+ * @param workers The upload workers of the server
+ * @param srv The server index
+ * @param directory The WAL directory
+ * @param queue The upload queue directory
+ * @param filename The WAL segment, or NULL to upload what is already queued
+ */
+void
+pgmoneta_wal_upload(struct workers* workers, int srv, char* directory, char* queue, char* filename);
+
+/**
+ * Copy a completed WAL segment into pg_wal of the hot standby, decompressed
+ * and decrypted, so a PostgreSQL in standby mode there replays it
+ * @param srv The server index
+ * @param directory The WAL directory
+ * @param filename The WAL segment
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_wal_hot_standby(int srv, char* directory, char* filename);
+
+/**
+ * Find and extract the history info from .history file of given server and timeline,
+ * the history of the newest timeline is cached in the shared memory
  * @param srv The server index
  * @param tli The timeline
  * @param history [out] the history info
@@ -136,6 +178,21 @@ pgmoneta_read_mappings_from_server(int server_index);
 int
 pgmoneta_read_mappings_from_json(char* mappings_path);
 
+/**
+ * @brief Get the name of an object by OID without allocating
+ *
+ * The mappings are cached when they are read, so the lookup is constant time
+ * and the returned name is owned by the cache.
+ *
+ * @param type The object type
+ * @param oid The OID to lookup
+ * @param buffer A buffer of at least OID_NAME_LENGTH bytes used when the OID has no name
+ * @param size The size of the buffer
+ * @return The object name, or the OID written into the buffer if not found
+ */
+char*
+pgmoneta_get_object_name(object_type type, int oid, char* buffer, size_t size);
+
 /**
  * @brief Get tablespace name by OID
  * @param oid Tablespace OID to lookup
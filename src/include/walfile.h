@@ -85,6 +85,9 @@ struct xlog_long_page_header_data
  *                   Each page contains metadata about the organization of that page.
  *   - records: A deque that holds the WAL records stored in the WAL file.
  *              Each element has a `struct decoded_xlog_record` data type.
+ *   - arena: The arena the records and their block data are allocated from.
+ *   - map: The content of the WAL file, memory mapped or, for an archived segment, decrypted and
+ *          decompressed into memory. Decoded records point into it when they don't cross a page.
  */
 struct walfile
 {
@@ -92,6 +95,10 @@ struct walfile
    struct xlog_long_page_header_data* long_phd;   /**< Extended XLOG page header. */
    struct deque* page_headers;                    /**< Deque of page headers in the WAL file. */
    struct deque* records;                         /**< Deque of records in the WAL file. */
+   struct wal_arena* arena;                       /**< Arena holding the decoded records. */
+   char* map;                                     /**< The content of the WAL file the records point into. */
+   size_t map_size;                               /**< The size of the content. */
+   bool mapped;                                   /**< Is the content memory mapped, otherwise allocated. */
 };
 
 /**
@@ -141,4 +148,48 @@ pgmoneta_describe_walfile(char* path, enum value_type type, char* output, bool q
                           struct deque* rms, uint64_t start_lsn, uint64_t end_lsn, struct deque* xids,
                           uint32_t limit, char** included_objects);
 
+/**
+ * Describe the WAL segments in a directory. The segments are decoded in
+ * parallel and their output is merged in LSN order. Segments outside of
+ * the LSN range are skipped
+ * @param directory The directory of the WAL segments
+ * @param type The type of output description
+ * @param output The output descriptor
+ * @param quiet Is the WAL file printed
+ * @param color Are colors used
+ * @param rms The resource managers
+ * @param start_lsn The start LSN
+ * @param end_lsn The end LSN
+ * @param xids The XIDs
+ * @param limit The limit
+ * @param included_objects The objects to include the wal records for, if NULL, all objects are included
+ * @param number_of_workers The number of workers
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_describe_walfiles(char* directory, enum value_type type, char* output, bool quiet, bool color,
+                           struct deque* rms, uint64_t start_lsn, uint64_t end_lsn, struct deque* xids,
+                           uint32_t limit, char** included_objects, int number_of_workers);
+
+/**
+ * Summarize a WAL file, or the WAL segments in a directory. The number and
+ * size of the records and full page images are counted per resource manager,
+ * record type, database and relation in a single pass, without describing
+ * the records. The segments of a directory are counted in parallel
+ * @param path The path to the WAL file or directory
+ * @param type The type of output
+ * @param output The output file, or NULL for stdout
+ * @param rms The resource managers
+ * @param start_lsn The start LSN
+ * @param end_lsn The end LSN
+ * @param xids The XIDs
+ * @param limit The number of relations shown, 0 for all
+ * @param number_of_workers The number of workers
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_stats_walfiles(char* path, enum value_type type, char* output,
+                        struct deque* rms, uint64_t start_lsn, uint64_t end_lsn, struct deque* xids,
+                        uint32_t limit, int number_of_workers);
+
 #endif //PGMONETA_WALFILE_H
@@ -40,6 +40,7 @@ typedef uint32_t multi_xact_offset;
 
 // #define variables
 #define INVALID_TRANSACTION_ID              ((transaction_id) 0)
+#define FIRST_NORMAL_TRANSACTION_ID         ((transaction_id) 3)
 
 // #define macros
 #define EPOCH_FROM_FULL_TRANSACTION_ID(x)   ((uint32_t) ((x).value >> 32))
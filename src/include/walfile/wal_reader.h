@@ -290,7 +290,7 @@ struct decoded_bkp_block
  * - main_data: Main data portion of the record.
  * - main_data_len: Length of the main data portion.
  * - max_block_id: Highest block ID in use (-1 if none).
- * - blocks: Array of decoded backup blocks.
+ * - blocks: Array of max_block_id + 1 decoded backup blocks.
  * - partial: Indicates if the record is partial.
  */
 struct decoded_xlog_record
@@ -306,7 +306,7 @@ struct decoded_xlog_record
    char* main_data;                                           /**< Main data portion of the record. */
    uint32_t main_data_len;                                    /**< Length of the main data portion. */
    int max_block_id;                                          /**< Highest block ID in use (-1 if none). */
-   struct decoded_bkp_block blocks[XLR_MAX_BLOCK_ID + 1];     /**< Array of decoded backup blocks. */
+   struct decoded_bkp_block* blocks;                          /**< Array of max_block_id + 1 decoded backup blocks. */
    bool partial;                                              /**< Indicates if the record is partial. */
 };
 
@@ -328,6 +328,57 @@ struct rel_file_node
    oid relNode;      /**< Relation OID. */
 };
 
+struct wal_arena;
+
+/**
+ * @struct wal_record_filter
+ * @brief Selects WAL records from their header.
+ *
+ * The filter is checked before a record is read any further, so a rejected
+ * record is never decoded.
+ */
+struct wal_record_filter
+{
+   bool by_rmgr;                     /**< Are the resource managers filtered. */
+   bool rmgrs[UINT8_MAX + 1];        /**< The included resource managers. */
+   uint64_t start_lsn;               /**< The start LSN, compared to the previous record, or 0. */
+   uint64_t end_lsn;                 /**< The end LSN, or 0. */
+   struct deque* xids;               /**< The included XIDs, or NULL. */
+};
+
+/**
+ * @struct wal_record_iterator
+ * @brief Iterates over the records of a WAL file.
+ *
+ * The WAL file is memory mapped, or decrypted and decompressed into memory
+ * when it is archived, and records are decoded one at a time. Block
+ * images and aligned payloads point into the mapping; only records crossing a
+ * page boundary and unaligned payloads are copied into an arena. Without a
+ * caller supplied arena the iterator resets its own arena on every step, so
+ * only the current record is kept in memory.
+ */
+struct wal_record_iterator
+{
+   char* map;                                                 /**< The content of the WAL file. */
+   size_t size;                                               /**< The size of the WAL file. */
+   bool mapped;                                               /**< Is the file memory mapped, otherwise the content is allocated. */
+   struct xlog_long_page_header_data* long_phd;               /**< The long page header of the file. */
+   xlog_rec_ptr base;                                         /**< The LSN of the start of the file. */
+   uint32_t next_record;                                      /**< The offset of the next record. */
+   int page_number;                                           /**< The page of the next record. */
+   bool partial_first;                                        /**< Does the file start with a continuation record. */
+   bool done;                                                 /**< Is the end of the file reached. */
+   bool failed;                                               /**< Did reading or decoding fail. */
+   bool keep;                                                 /**< Are records kept in a caller supplied arena. */
+   struct wal_arena* arena;                                   /**< The arena of the decoded records. */
+   struct decoded_bkp_block blocks[XLR_MAX_BLOCK_ID + 1];     /**< The blocks of the record being decoded. */
+   struct wal_record_filter* filter;                          /**< The header filter, or NULL. */
+   uint64_t skipped;                                          /**< The number of records rejected by the filter. */
+   bool crc;                                                  /**< Is the CRC of each record checked. */
+   bool corrupt;                                              /**< Did a record fail its CRC check. */
+   struct decoded_xlog_record* record;                        /**< The current record. */
+};
+
 /* External variables */
 extern struct server* server_config;
 
@@ -344,6 +395,94 @@ extern struct server* server_config;
 int
 pgmoneta_wal_parse_wal_file(char* path, int server, struct walfile* wal_file);
 
+/**
+ * Create an arena for decoded WAL records
+ * @param arena The resulting arena
+ * @return 0 on success, otherwise 1
+ */
+int
+pgmoneta_wal_arena_create(struct wal_arena** arena);
+
+/**
+ * Allocate zeroed memory from an arena
+ * @param arena The arena
+ * @param size The size
+ * @return The memory, or NULL
+ */
+void*
+pgmoneta_wal_arena_allocate(struct wal_arena* arena, size_t size);
+
+/**
+ * Release all memory handed out by an arena, keeping one block for reuse
+ * @param arena The arena
+ */
+void
+pgmoneta_wal_arena_reset(struct wal_arena* arena);
+
+/**
+ * Destroy an arena
+ * @param arena The arena
+ */
+void
+pgmoneta_wal_arena_destroy(struct wal_arena* arena);
+
+/**
+ * Create a WAL record filter
+ * @param rms The names of the included resource managers, or NULL
+ * @param start_lsn The start LSN, or 0
+ * @param end_lsn The end LSN, or 0
+ * @param xids The included XIDs, or NULL
+ * @param filter The resulting filter
+ * @return 0 on success, otherwise 1
+ */
+int
+pgmoneta_wal_record_filter_create(struct deque* rms, uint64_t start_lsn, uint64_t end_lsn, struct deque* xids,
+                                  struct wal_record_filter** filter);
+
+/**
+ * Check a record header against a filter
+ * @param filter The filter
+ * @param header The record header
+ * @param lsn The LSN of the record
+ * @return true if the record is selected, otherwise false
+ */
+bool
+pgmoneta_wal_record_filter_accept(struct wal_record_filter* filter, struct xlog_record* header, xlog_rec_ptr lsn);
+
+/**
+ * Destroy a WAL record filter
+ * @param filter The filter
+ */
+void
+pgmoneta_wal_record_filter_destroy(struct wal_record_filter* filter);
+
+/**
+ * Create an iterator over the records of a WAL file
+ * @param path The file path of the WAL file, which may be encrypted and compressed
+ * @param server The index of the server structure, if -1, config.servers[0] will be initialized based on magic value
+ * @param arena The arena to keep the records in, or NULL to keep only the current record.
+ *              Records also point into the mapping, which the iterator unmaps on destroy
+ * @param iterator The resulting iterator
+ * @return 0 on success, otherwise 1
+ */
+int
+pgmoneta_wal_record_iterator_create(char* path, int server, struct wal_arena* arena, struct wal_record_iterator** iterator);
+
+/**
+ * Move to the next record of a WAL file
+ * @param iterator The iterator
+ * @return true if there is a record, otherwise false; check failed for errors
+ */
+bool
+pgmoneta_wal_record_iterator_next(struct wal_record_iterator* iterator);
+
+/**
+ * Destroy a WAL record iterator
+ * @param iterator The iterator
+ */
+void
+pgmoneta_wal_record_iterator_destroy(struct wal_record_iterator* iterator);
+
 /**
  * Retrieves block data from the decoded XLOG record.
  *
@@ -355,6 +494,25 @@ pgmoneta_wal_parse_wal_file(char* path, int server, struct walfile* wal_file);
 char*
 pgmoneta_wal_get_record_block_data(struct decoded_xlog_record* record, uint8_t block_id, size_t* len);
 
+/**
+ * Gets the name of a resource manager.
+ *
+ * @param rmid The resource manager ID.
+ * @return The name, or NULL if the resource manager is unknown.
+ */
+char*
+pgmoneta_wal_rmgr_name(rmgr_id rmid);
+
+/**
+ * Describes a decoded XLOG record with its resource manager.
+ *
+ * @param buf The buffer to append the description to.
+ * @param record The decoded XLOG record.
+ * @return The buffer.
+ */
+char*
+pgmoneta_wal_rmgr_desc(char* buf, struct decoded_xlog_record* record);
+
 /**
  * Checks if the backup image is compressed.
  *
@@ -398,10 +556,12 @@ pgmoneta_wal_array_desc(char* buf, void* array, size_t elem_size, int count);
  * @param xids The XIDs
  * @param limit The limit
  * @param included_objects Objects that will include wal records that reference them
+ * @param count The number of included records so far, updated
  */
 void
 pgmoneta_wal_record_display(struct decoded_xlog_record* record, uint16_t magic_value, enum value_type type, FILE* out, bool quiet, bool color,
-                            struct deque* rms, uint64_t start_lsn, uint64_t end_lsn, struct deque* xids, uint32_t limit, char** included_objects);
+                            struct deque* rms, uint64_t start_lsn, uint64_t end_lsn, struct deque* xids, uint32_t limit, char** included_objects,
+                            uint32_t* count);
 
 /**
  * Encodes a WAL record into a buffer.
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGMONETA_WAL_SUMMARY_H
+#define PGMONETA_WAL_SUMMARY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <walfile/wal_reader.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define WAL_SUMMARY_MAGIC         0x53574D50   /**< The magic of a WAL summary file. */
+#define WAL_SUMMARY_VERSION       2            /**< The version of the WAL summary format. */
+#define WAL_SUMMARY_SUFFIX        ".summary"   /**< The suffix of a WAL summary file. */
+
+/**
+ * @struct wal_summary
+ * @brief Summarizes the content of a WAL segment.
+ *
+ * A summary is built once when a segment is archived and stored next to the
+ * WAL directory, so a lookup by LSN or transaction can skip
+ * a segment without decompressing or decoding it.
+ *
+ * Fields:
+ * - magic: The magic of the file.
+ * - version: The version of the format.
+ * - start_lsn: The LSN of the first record starting in the segment.
+ * - end_lsn: The LSN of the last record starting in the segment.
+ * - min_xid: The lowest transaction ID of a record, or 0 if none.
+ * - max_xid: The highest transaction ID of a record, or 0 if none.
+ * - records: The number of records starting in the segment.
+ */
+struct wal_summary
+{
+   uint32_t magic;                              /**< The magic of the file. */
+   uint32_t version;                            /**< The version of the format. */
+   uint64_t start_lsn;                          /**< The LSN of the first record. */
+   uint64_t end_lsn;                            /**< The LSN of the last record. */
+   uint32_t min_xid;                            /**< The lowest transaction ID, or 0. */
+   uint32_t max_xid;                            /**< The highest transaction ID, or 0. */
+   uint64_t records;                            /**< The number of records. */
+};
+
+/**
+ * Create the summary of a WAL segment
+ * @param path The path of the WAL segment, which may be compressed and/or encrypted
+ * @param server The server index, or -1
+ * @param summary The resulting summary
+ * @return 0 on success, otherwise 1
+ */
+int
+pgmoneta_wal_summary_create(char* path, int server, struct wal_summary** summary);
+
+/**
+ * Write a WAL summary atomically
+ * @param summary The summary
+ * @param path The path of the summary file
+ * @return 0 on success, otherwise 1
+ */
+int
+pgmoneta_wal_summary_write(struct wal_summary* summary, char* path);
+
+/**
+ * Read a WAL summary
+ * @param path The path of the summary file
+ * @param summary The resulting summary
+ * @return 0 on success, otherwise 1
+ */
+int
+pgmoneta_wal_summary_read(char* path, struct wal_summary** summary);
+
+/**
+ * Get the path of the summary of a WAL segment
+ * @param directory The summary directory
+ * @param segment The name of the WAL segment, with or without compression and encryption suffixes
+ * @return The path of the summary file
+ */
+char*
+pgmoneta_wal_summary_path(char* directory, char* segment);
+
+/**
+ * Can a transaction have records in a summarized segment
+ * @param summary The summary
+ * @param xid The transaction ID
+ * @return false if the transaction has no records, true if it may have
+ */
+bool
+pgmoneta_wal_summary_may_contain_xid(struct wal_summary* summary, uint32_t xid);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PGMONETA_WAL_SUMMARY_H
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGMONETA_WALINDEX_H
+#define PGMONETA_WALINDEX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgmoneta.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** @struct wal_segment
+ * Defines a WAL segment of an index
+ */
+struct wal_segment
+{
+   uint32_t timeline; /**< The timeline */
+   uint32_t log;      /**< The log, the high 32 bits of the LSN */
+   uint32_t seg;      /**< The segment within the log */
+   bool partial;      /**< Is the segment partial */
+   char* file;        /**< The name of the file, with its extensions */
+};
+
+/** @struct wal_index
+ * Defines an index of the WAL segments of a directory, ordered by
+ * timeline, log and segment like the names of the segments
+ */
+struct wal_index
+{
+   int number_of_segments;       /**< The number of segments */
+   struct wal_segment* segments; /**< The segments */
+   int number_of_histories;      /**< The number of history files */
+   char** histories;             /**< The names of the history files */
+};
+
+/**
+ * Index the WAL segments of a directory from a single listing. Compressed and
+ * encrypted segments are indexed by their segment, the history files are listed
+ * apart, and other files are left out
+ * @param directory The directory
+ * @param partial Should the partial segments be indexed
+ * @param index [out] The index
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_wal_index_create(char* directory, bool partial, struct wal_index** index);
+
+/**
+ * Parse the timeline, log and segment of a WAL file name
+ * @param name The name, with or without extensions
+ * @param segment [out] The segment
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_wal_index_parse(char* name, struct wal_segment* segment);
+
+/**
+ * Find the first segment of an index that is not before a WAL file
+ * @param index The index
+ * @param name The name of the WAL file
+ * @return The position, which is the number of segments if all are before
+ */
+int
+pgmoneta_wal_index_search(struct wal_index* index, char* name);
+
+/**
+ * Count the segments of an index from a WAL file up to, but not including, another
+ * @param index The index
+ * @param from The first WAL file
+ * @param to The WAL file to stop at, or NULL for the end
+ * @return The number of segments
+ */
+int
+pgmoneta_wal_index_count(struct wal_index* index, char* from, char* to);
+
+/**
+ * Destroy an index
+ * @param index The index
+ */
+void
+pgmoneta_wal_index_destroy(struct wal_index* index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGMONETA_WALK_H
+#define PGMONETA_WALK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgmoneta.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define WALK_STAT       (1 << 0)
+#define WALK_NO_RECURSE (1 << 1)
+
+#define WALK_CONTINUE 0
+#define WALK_SKIP     1
+#define WALK_STOP     2
+
+/** @struct walk_entry
+ * Defines an entry of a directory walk
+ */
+struct walk_entry
+{
+   int dirfd;              /**< The descriptor of the parent directory */
+   char* path;             /**< The path relative to the walked directory */
+   char* name;             /**< The name of the entry */
+   unsigned char type;     /**< The type of the entry (DT_REG, DT_DIR or DT_LNK) */
+   uint64_t size;          /**< The size, with WALK_STAT */
+   uint64_t block_size;    /**< The block size of the file system, with WALK_STAT */
+};
+
+/**
+ * The visitor of a directory walk
+ * @param entry The entry
+ * @param data The data of the walk
+ * @return WALK_CONTINUE, WALK_SKIP to not descend into a directory, or WALK_STOP
+ */
+typedef int (*walk_visitor)(struct walk_entry* entry, void* data);
+
+/**
+ * Walk a directory tree. The directories are opened relative to their parent
+ * with openat, so no full paths are built or resolved, and with WALK_STAT each
+ * entry is stat'ed relative to its directory with only the size requested.
+ * The directories are visited before their content, and symbolic links are
+ * neither followed nor stat'ed through
+ * @param directory The directory
+ * @param flags WALK_STAT to get the size of the entries, WALK_NO_RECURSE to stay in the directory
+ * @param visitor The visitor
+ * @param data The data of the walk
+ * @return 0 upon success, otherwise 1 if the directory can't be opened
+ */
+int
+pgmoneta_walk(char* directory, int flags, walk_visitor visitor, void* data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -36,19 +36,27 @@ extern "C" {
 #include <pgmoneta.h>
 
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#define WORKER_CONTEXT_ZSTD  0
+#define WORKER_CONTEXT_LZ4   1
+#define WORKER_CONTEXT_GZIP  2
+#define WORKER_CONTEXT_AES   3
+#define WORKER_CONTEXT_SIZE  4
+
 struct worker_common;
+struct compression_controller;
 
-/** @struct semaphore
- * Defines a semaphore
+/** @struct worker_context
+ * Defines a thread local compression context
  */
-struct semaphore
+struct worker_context
 {
-   pthread_mutex_t mutex; /**< The mutex of the semaphore */
-   pthread_cond_t cond;   /**< The condition of the semaphore */
-   int value;             /**< The current value */
+   int level;                      /**< The compression level */
+   void* context;                  /**< The context */
+   void (*destroy)(void* context); /**< The destroy function */
 };
 
 /** @struct task
@@ -56,21 +64,23 @@ struct semaphore
  */
 struct task
 {
-   struct task* previous;                  /**< The previous task */
    void (*function)(struct worker_common*); /**< The task */
    struct worker_common* wc;                /**< The common base */
+   struct workers* owner;                   /**< The pool or group the task was added to */
+   uint64_t queued;                         /**< The time the task was added in microseconds */
 };
 
-/** @struct queue
- * Defines a queue
+/** @struct worker_queue
+ * Defines the task queue owned by a worker. The owner pushes and pops
+ * at the bottom, idle workers steal the oldest task from the top
  */
-struct queue
+struct worker_queue
 {
-   pthread_mutex_t rwmutex;     /**< The read/write mutex */
-   struct task* front;          /**< The first task */
-   struct task* rear;           /**< The last task */
-   struct semaphore* has_tasks; /**< Are there any tasks ? */
-   int number_of_tasks;         /**< The number of tasks */
+   pthread_mutex_t lock; /**< The lock */
+   struct task* tasks;   /**< The ring of tasks */
+   size_t capacity;      /**< The capacity of the ring, a power of two */
+   size_t top;           /**< The position of the oldest task */
+   size_t bottom;        /**< The position after the newest task */
 };
 
 /** @struct worker
@@ -78,22 +88,41 @@ struct queue
  */
 struct worker
 {
-   pthread_t pthread;       /**< The worker thread */
-   struct workers* workers; /**< Pointer to the root structure */
+   pthread_t pthread;         /**< The worker thread */
+   struct workers* workers;   /**< Pointer to the root structure */
+   int index;                 /**< The index of the worker */
+   struct worker_queue queue; /**< The tasks of the worker */
+   atomic_ulong busy;         /**< The time spent running tasks in microseconds */
 };
 
 /** @struct workers
- * Defines the workers
+ * Defines the workers. A group shares the threads of its pool but
+ * has its own tasks to wait for and its own outcome
  */
 struct workers
 {
-   struct worker** worker;         /**< The list of workers */
-   volatile int number_of_alive;   /**< The number of alive workers */
-   volatile int number_of_working; /**< The number of workers */
-   pthread_mutex_t worker_lock;    /**< The worker lock */
-   pthread_cond_t worker_all_idle; /**< Are workers idle */
-   bool outcome;                   /**< Outcome of the workers */
-   struct queue queue;             /**< The queue */
+   struct workers* pool;                 /**< The pool of a group, or NULL for a pool */
+   struct worker** worker;               /**< The list of workers */
+   int number_of_workers;                /**< The number of workers */
+   volatile int number_of_alive;         /**< The number of alive workers */
+   atomic_int number_of_pending;         /**< The number of queued tasks */
+   atomic_int number_of_outstanding;     /**< The number of queued or running tasks */
+   atomic_int number_of_sleeping;        /**< The number of sleeping workers */
+   atomic_uint next;                     /**< The next worker for tasks added from outside the pool */
+   atomic_bool keepalive;                /**< Should the workers keep running */
+   pthread_mutex_t worker_lock;          /**< The worker lock */
+   pthread_cond_t has_tasks;             /**< Are there any tasks */
+   pthread_cond_t worker_all_idle;       /**< Are workers idle */
+   pthread_cond_t has_space;             /**< Can blocked submitters add tasks */
+   int max_outstanding;                  /**< The number of outstanding tasks before submitters block */
+   int number_of_blocked;                /**< The number of blocked submitters */
+   bool ordered;                         /**< Are tasks from outside the pool held until the wait, and queued largest first */
+   struct task* held;                    /**< The held tasks */
+   size_t number_of_held;                /**< The number of held tasks */
+   size_t held_capacity;                 /**< The capacity of the held tasks */
+   uint64_t started;                     /**< The time the pool was created in microseconds */
+   struct workers_statistics statistics; /**< The statistics of the pool */
+   bool outcome;                         /**< Outcome of the workers */
 };
 
 /** @struct worker_common
@@ -102,6 +131,7 @@ struct workers
 struct worker_common
 {
    struct workers* workers;  /**< The root structure */
+   size_t size;              /**< The size of the work in bytes, or 0 if unknown */
 };
 
 /** @struct worker_input
@@ -109,14 +139,16 @@ struct worker_common
  */
 struct worker_input
 {
-   struct worker_common common; /**< The common base */
-   char directory[MAX_PATH];    /**< The directory */
-   char from[MAX_PATH];         /**< The from directory */
-   char to[MAX_PATH];           /**< The to directory */
-   int level;                   /**< The compression level */
-   struct json* data;           /**< JSON data */
-   struct deque* failed;        /**< Failed files */
-   struct deque* all;           /**< All files */
+   struct worker_common common;               /**< The common base */
+   char* directory;                           /**< The directory */
+   char* from;                                /**< The from directory */
+   char* to;                                  /**< The to directory */
+   int level;                                 /**< The compression level */
+   struct compression_controller* controller; /**< The compression level controller, or NULL */
+   struct json* data;                         /**< JSON data */
+   struct deque* failed;                      /**< Failed files */
+   struct deque* all;                         /**< All files */
+   char paths[];                              /**< The storage of the paths */
 };
 
 /**
@@ -129,7 +161,22 @@ int
 pgmoneta_workers_initialize(int num, struct workers** workers);
 
 /**
- * Add work to the queue
+ * Create a group that runs its work on a shared pool. Without a pool a
+ * pool of its own is created. The tasks of a group are ordered
+ * @param pool The shared pool, or NULL
+ * @param num The number of workers if a pool has to be created
+ * @param workers The resulting group
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_workers_initialize_group(struct workers* pool, int num, struct workers** workers);
+
+/**
+ * Add work to the queue. Work added from one of the workers is queued
+ * on that worker, otherwise the workers take turns. Ordered workers hold
+ * work added from outside the pool until the wait, and then hand out the
+ * largest work first. Work added from outside the pool blocks while too
+ * much work is outstanding
  * @param workers The workers
  * @param function The function pointer
  * @param wi The argument
@@ -139,19 +186,71 @@ int
 pgmoneta_workers_add(struct workers* workers, void (*function)(struct worker_common*), struct worker_common* wi);
 
 /**
- * Wait for all queued work units to finish
+ * Wait for all queued work units to finish. Held work is queued first
  * @param workers The workers
  */
 void
 pgmoneta_workers_wait(struct workers* workers);
 
 /**
- * Destroy workers
+ * Destroy workers. A group waits for its work and leaves the pool running
  * @param workers The workers
  */
 void
 pgmoneta_workers_destroy(struct workers* workers);
 
+/**
+ * Get the statistics of a pool. The busy and available times are
+ * calculated up to now
+ * @param workers The workers
+ * @param statistics The resulting statistics
+ */
+void
+pgmoneta_workers_statistics(struct workers* workers, struct workers_statistics* statistics);
+
+/**
+ * Get the fraction of its lifetime a worker spent running tasks
+ * @param workers The workers
+ * @param index The index of the worker
+ * @return The busy fraction
+ */
+double
+pgmoneta_workers_busy(struct workers* workers, int index);
+
+/**
+ * Get the upper bound of a histogram bucket
+ * @param bucket The bucket
+ * @return The upper bound in seconds, or a negative value for the last bucket
+ */
+double
+pgmoneta_workers_histogram_bound(int bucket);
+
+/**
+ * Get the compression context cached by the calling thread
+ * @param type The context type
+ * @param level The compression level
+ * @return The context, or NULL if none is cached for the level
+ */
+void*
+pgmoneta_workers_context_get(int type, int level);
+
+/**
+ * Cache a compression context for the calling thread. A context
+ * already cached for the type is destroyed
+ * @param type The context type
+ * @param level The compression level
+ * @param context The context
+ * @param destroy The destroy function
+ */
+void
+pgmoneta_workers_context_put(int type, int level, void* context, void (*destroy)(void* context));
+
+/**
+ * Destroy the compression contexts cached by the calling thread
+ */
+void
+pgmoneta_workers_context_clear(void);
+
 /**
  * Get the number of workers for a server
  * @param server The server identifier
@@ -160,7 +259,15 @@ int
 pgmoneta_get_number_of_workers(int server);
 
 /**
- * Create worker input
+ * Get the number of I/O workers for a server
+ * @param server The server identifier
+ * @return The number of I/O workers, 0 if the workers do the I/O
+ */
+int
+pgmoneta_get_number_of_io_workers(int server);
+
+/**
+ * Create worker input. The paths are stored in the same allocation
  * @param directory The directory path
  * @param from The from file path
  * @param to The to file path
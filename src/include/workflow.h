@@ -36,6 +36,7 @@ extern "C" {
 #include <pgmoneta.h>
 #include <art.h>
 #include <info.h>
+#include <workers.h>
 
 #include <stdlib.h>
 #include <stdbool.h>
@@ -52,13 +53,12 @@ extern "C" {
 #define WORKFLOW_TYPE_COMBINE_AS_IS         9
 #define WORKFLOW_TYPE_POST_ROLLUP          10
 
-#define PERMISSION_TYPE_BACKUP              0
-#define PERMISSION_TYPE_RESTORE             1
 #define PERMISSION_TYPE_ARCHIVE             2
 
 #define CLEANUP_TYPE_RESTORE                0
 
 #define NODE_ALL                 "all"                  /* All the files in a manifest */
+#define NODE_ARCHIVE_SOURCE      "archive_source"       /* The backup an archive is streamed from */
 #define NODE_BACKUP              "backup"               /* The backup structure */
 #define NODE_COMBINE_AS_IS       "combine_as_is"        /* Whether to combine the backups as is*/
 #define NODE_COPY_WAL            "copy_wal"             /* Whether to copy WAL */
@@ -70,27 +70,33 @@ extern "C" {
 #define NODE_INCREMENTAL_LABEL   "incremental_label"    /* The label of the incremental backup */
 #define NODE_LABEL               "label"                /* The backup label */
 #define NODE_LABELS              "labels"               /* A list of backup labels */
+#define NODE_LOCK                "lock"                 /* The repository and backup locks of the operation */
 #define NODE_MANIFEST            "manifest"             /* The manifest */
 #define NODE_PRIMARY             "primary"              /* Is the server a primary */
 #define NODE_RECOVERY_INFO       "recovery_info"        /* The recovery information */
+#define NODE_SAMPLE              "sample_result"        /* The coverage of a sampled verify */
 #define NODE_SERVER_BACKUP       "server_backup"        /* The backup directory of the server */
 #define NODE_SERVER_BASE         "server_base"          /* The base directory of the server */
 #define NODE_SERVER_ID           "server_id"            /* The server number */
 #define NODE_TARGET_BASE         "target_base"          /* The target base directory */
 #define NODE_TARGET_FILE         "target_file"          /* The target file */
 #define NODE_TARGET_ROOT         "target_root"          /* The target root directory */
+#define NODE_IO_WORKERS          "io_workers"           /* The worker pool for the I/O-bound steps */
+#define NODE_WORKERS             "workers"              /* The worker pool shared by the steps */
 
 /* Supplied by the user */
 #define USER_DIRECTORY         "directory"         /* The target root directory */
 #define USER_FILES             "files"             /* The files that should be checked */
 #define USER_IDENTIFIER        "identifier"        /* The backup identifier (oldest, newest, <timestamp>) */
 #define USER_POSITION          "position"          /* The recovery positions */
+#define USER_SAMPLE            "sample"            /* The percentage of the bytes to verify */
 #define USER_SERVER            "server"            /* The server name */
 
 typedef char* (*name)(void);
 typedef int (*setup)(char*, struct art*);
 typedef int (*execute)(char*, struct art*);
 typedef int (*teardown)(char*, struct art*);
+typedef int (*execute_file)(char*, struct art*, char*, char**);
 
 /** @struct workflow
  * Defines a workflow
@@ -103,6 +109,8 @@ struct workflow
    setup setup;      /**< The setup  function pointer */
    execute execute;  /**< The execute function pointer */
    teardown teardown; /**< The teardown function pointer */
+   execute_file execute_file; /**< The optional function pointer that processes a single file */
+   bool independent;          /**< Does not depend on the previous step, so both can run concurrently */
 
    struct workflow* next; /**< The next workflow */
 };
@@ -144,6 +152,35 @@ pgmoneta_workflow_execute(struct workflow* workflow, struct art* nodes,
                           int server, int client_fd, uint8_t compression,
                           uint8_t encryption, struct json* payload);
 
+/**
+ * Create the worker pool shared by the steps of a workflow and add it
+ * to the nodes. When the server has io_workers a second pool is added
+ * as NODE_IO_WORKERS. Nothing is created if the nodes already have a pool
+ * @param nodes The nodes
+ * @param workers The created pool, or NULL
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_workflow_workers_create(struct art* nodes, struct workers** workers);
+
+/**
+ * Report the statistics of a pool created by pgmoneta_workflow_workers_create,
+ * remove it and the I/O pool from the nodes and destroy them
+ * @param type The workflow type
+ * @param nodes The nodes
+ * @param workers The pool, or NULL
+ */
+void
+pgmoneta_workflow_workers_destroy(int type, struct art* nodes, struct workers* workers);
+
+/**
+ * Get the pool for the I/O-bound tasks of the steps
+ * @param nodes The nodes
+ * @return The I/O pool, otherwise the shared pool or NULL
+ */
+struct workers*
+pgmoneta_workflow_io_workers(struct art* nodes);
+
 /**
  * Destroy the workflow
  * @param workflow The workflow
@@ -35,33 +35,97 @@ extern "C" {
 
 #include <pgmoneta.h>
 #include <json.h>
+#include <reader.h>
 #include <workers.h>
 
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 
+/** @struct zstd_seekable
+ * Defines a random access reader for a Zstandard file written with a seek table
+ */
+struct zstd_seekable
+{
+   FILE* fp;                       /**< The compressed file */
+   uint32_t number_of_frames;      /**< The number of frames */
+   uint64_t* compressed_offsets;   /**< The compressed offset of each frame, and the end */
+   uint64_t* decompressed_offsets; /**< The decompressed offset of each frame, and the end */
+   void* dctx;                     /**< The decompression context */
+   int64_t current;                /**< The frame held in the frame buffer, or -1 */
+   void* frame;                    /**< The decompressed frame */
+   size_t frame_capacity;          /**< The capacity of the frame buffer */
+   void* input;                    /**< The compressed frame */
+   size_t input_capacity;          /**< The capacity of the input buffer */
+};
+
 /**
  * Compress a data directory with Zstandard
  * @param directory The directory
+ * @param encrypt Encrypt the compressed stream in the same pass
+ * @param controller The optional compression level controller
  * @param workers The optional workers
  */
 void
-pgmoneta_zstandardc_data(char* directory, struct workers* workers);
+pgmoneta_zstandardc_data(char* directory, bool encrypt, struct compression_controller* controller, struct workers* workers);
 
 /**
  * Compress tablespaces directories with Zstandard
  * @param root The root directory
+ * @param encrypt Encrypt the compressed stream in the same pass
+ * @param controller The optional compression level controller
  * @param workers The optional workers
  */
 void
-pgmoneta_zstandardc_tablespaces(char* root, struct workers* workers);
+pgmoneta_zstandardc_tablespaces(char* root, bool encrypt, struct compression_controller* controller, struct workers* workers);
 
 /**
  * Compress a WAL directory with Zstandard
+ * Files are encrypted in the same pass when encryption is enabled
  * @param directory The directory
  */
 void
 pgmoneta_zstandardc_wal(char* directory);
 
+/**
+ * Open a Zstandard file for random access. Only files written with
+ * compression_frame_size have the seek table this requires
+ * @param path The file path
+ * @param seekable The resulting reader
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_zstandardd_seekable_open(char* path, struct zstd_seekable** seekable);
+
+/**
+ * Read decompressed data at an offset, decompressing only the frames that hold it
+ * @param seekable The reader
+ * @param offset The decompressed offset
+ * @param buffer The buffer
+ * @param size The number of bytes to read
+ * @return The number of bytes read, which is short only at the end of the file or on error
+ */
+size_t
+pgmoneta_zstandardd_seekable_read(struct zstd_seekable* seekable, uint64_t offset, void* buffer, size_t size);
+
+/**
+ * Close a random access reader
+ * @param seekable The reader
+ */
+void
+pgmoneta_zstandardd_seekable_close(struct zstd_seekable* seekable);
+
+/**
+ * Decompress a large Zstandard file with a seek table on the workers, each
+ * decompressing a range of its frames into place. The source is kept
+ * @param from The compressed file
+ * @param to The decompressed file
+ * @param workers The workers
+ * @return 0 if the ranges were queued, otherwise 1 and the file must be decompressed as a stream
+ */
+int
+pgmoneta_zstandardd_parallel(char* from, char* to, struct workers* workers);
+
 /**
  * ZSTD decompress a single file, also remove the original file
  * @param ssl The SSL
@@ -82,6 +146,15 @@ pgmoneta_zstandardd_request(SSL* ssl, int client_fd, uint8_t compression, uint8_
 int
 pgmoneta_zstandardd_file(char* from, char* to);
 
+/**
+ * Create a Zstandard decompression layer for a streaming reader
+ * @param source The layer holding the compressed data, owned by the new layer upon success
+ * @param reader The resulting reader
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_zstandardd_reader(struct reader* source, struct reader** reader);
+
 /**
  * Decompress a Zstandard directory
  * @param directory The directory
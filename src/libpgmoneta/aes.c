@@ -28,20 +28,172 @@
 
 #include <pgmoneta.h>
 #include <aes.h>
+#include <info.h>
 #include <logging.h>
 #include <management.h>
+#include <profile.h>
+#include <prometheus.h>
 #include <security.h>
 #include <utils.h>
 #include <workers.h>
 
 /* System */
 #include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <openssl/crypto.h>
+#include <openssl/rand.h>
 
 #define NAME "aes"
 #define ENC_BUF_SIZE (1024 * 1024)
+#define ENC_BUF_ALIGNMENT 4096
+
+/* AES-GCM files are a header followed by independently authenticated chunks */
+/*   header: magic | chunk size (u32) | nonce prefix */
+/*   chunk:  plaintext length (u32) | ciphertext | tag */
+/* The nonce of a chunk is the random nonce prefix of the file and the chunk */
+/* index, and the chunk index and a last chunk flag are authenticated too, */
+/* so chunks can not be reordered, dropped or truncated */
+#define GCM_MAGIC               "PGMGCM01"
+#define GCM_MAGIC_LENGTH        8
+#define GCM_NONCE_PREFIX_LENGTH 8
+#define GCM_NONCE_LENGTH        12
+#define GCM_TAG_LENGTH          16
+#define GCM_HEADER_LENGTH       (GCM_MAGIC_LENGTH + 4 + GCM_NONCE_PREFIX_LENGTH)
+#define GCM_CHUNK_OVERHEAD      (4 + GCM_TAG_LENGTH)
+
+/* A backup is encrypted with its own random data key, stored in backup.info */
+/* wrapped with the master key, so the master key only unwraps the data keys */
+#define DATA_KEY_LENGTH     32
+#define DATA_KEY_CACHE_SIZE 16
+
+/* Files of this size or more are split into ranges over the workers in CTR and GCM mode */
+#define ENC_PARALLEL_THRESHOLD (64 * 1024 * 1024)
+#define ENC_RANGE_SIZE         (16 * 1024 * 1024)
+
+/** @struct decrypt_reader
+ * Defines the state of a decryption layer
+ */
+struct decrypt_reader
+{
+   EVP_CIPHER_CTX* ctx;                           /**< The cipher context */
+   bool gcm;                                      /**< Is the file in the AES-GCM format */
+   bool done;                                     /**< Has the last block been decrypted */
+   unsigned char key[EVP_MAX_KEY_LENGTH];         /**< The GCM key */
+   unsigned char prefix[GCM_NONCE_PREFIX_LENGTH]; /**< The GCM nonce prefix */
+   uint32_t chunk_size;                           /**< The GCM chunk size */
+   uint32_t index;                                /**< The next GCM chunk */
+   unsigned char length[4];                       /**< The length field of the next GCM chunk */
+   unsigned char* in;                             /**< The encrypted data */
+   size_t in_size;                                /**< The size of the encrypted data buffer */
+   unsigned char* out;                            /**< The decrypted data */
+   size_t out_pos;                                /**< The next decrypted byte to hand out */
+   size_t out_length;                             /**< The number of decrypted bytes */
+};
+
+/** @struct aes_job
+ * Defines a file encrypted or decrypted in ranges
+ */
+struct aes_job
+{
+   char from[MAX_PATH];                    /**< The input file */
+   char to[MAX_PATH];                      /**< The output file */
+   int enc;                                /**< 1 for encrypt, 0 for decrypt */
+   bool gcm;                               /**< Is the file in the AES-GCM format */
+   const EVP_CIPHER* cipher;               /**< The cipher for CTR mode */
+   unsigned char key[EVP_MAX_KEY_LENGTH];  /**< The key */
+   unsigned char iv[EVP_MAX_IV_LENGTH];    /**< The initial counter for CTR mode */
+   unsigned char prefix[GCM_NONCE_PREFIX_LENGTH]; /**< The nonce prefix for GCM mode */
+   uint64_t size;                          /**< The plaintext size */
+   uint32_t chunks;                        /**< The number of GCM chunks */
+   atomic_int remaining;                   /**< The number of ranges not done */
+   atomic_bool failed;                     /**< Did a range fail */
+};
+
+/** @struct aes_range
+ * Defines a range of a file for a worker
+ */
+struct aes_range
+{
+   struct worker_common common; /**< The common base */
+   struct aes_job* job;         /**< The file */
+   uint64_t start;              /**< The first byte (CTR) or chunk (GCM) */
+   uint64_t end;                /**< The end byte (CTR) or chunk (GCM) */
+};
+
+/** @struct aes_context
+ * Defines a cipher context and its buffers, reused by a thread across files
+ */
+struct aes_context
+{
+   EVP_CIPHER_CTX* ctx;   /**< The cipher context */
+   unsigned char* inbuf;  /**< The input buffer */
+   unsigned char* outbuf; /**< The output buffer */
+};
+
+/** @struct aes_key
+ * Defines a key and IV derived from the master key
+ */
+struct aes_key
+{
+   bool valid;                             /**< Is the entry valid */
+   unsigned char key[EVP_MAX_KEY_LENGTH];  /**< The key */
+   unsigned char iv[EVP_MAX_IV_LENGTH];    /**< The IV */
+};
+
+/** @struct data_key
+ * Defines the data key of a backup directory
+ */
+struct data_key
+{
+   bool valid;                                /**< Is the entry valid */
+   bool pinned;                               /**< Is the entry kept until the cache is wiped */
+   char directory[MAX_PATH];                  /**< The backup directory, with a trailing slash */
+   char secret[DATA_KEY_LENGTH * 2 + 1];      /**< The data key, or empty when the master key is used */
+};
+
+static pthread_mutex_t key_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static int key_cache_users = 0;
+static bool key_cache_locked = false;
+static struct aes_key key_cache[ENCRYPTION_AES_256_GCM + 1];
+static int data_key_next = 0;
+static struct data_key data_key_cache[DATA_KEY_CACHE_SIZE];
 
 static int encrypt_file(char* from, char* to, int enc);
 static int derive_key_iv(char* password, unsigned char* key, unsigned char* iv, int mode);
+static int master_key_iv(int mode, unsigned char* key, unsigned char* iv);
+static int file_key_iv(char* path, int mode, unsigned char* key, unsigned char* iv);
+static int data_key_lookup(char* path, char* secret, size_t size);
+static int data_key_unwrap(char* wrapped, char* secret, size_t size);
+static void data_key_hex(unsigned char* raw, size_t length, char* hex);
+static int data_key_unhex(char* hex, unsigned char** raw, size_t* length);
+static struct aes_context* aes_context_get(void);
+static void aes_context_destroy(void* context);
+static void gcm_put_le32(unsigned char* p, uint32_t v);
+static uint32_t gcm_get_le32(unsigned char* p);
+static int gcm_chunk(EVP_CIPHER_CTX* ctx, unsigned char* key, unsigned char* prefix, uint32_t index, bool last, int enc,
+                     unsigned char* in, int in_length, unsigned char* out, unsigned char* tag);
+static bool gcm_is_file(FILE* in);
+static bool gcm_is_last(FILE* in);
+static int gcm_encrypt_stream(FILE* in, FILE* out, unsigned char* key, struct aes_context* actx);
+static int gcm_decrypt_stream(FILE* in, FILE* out, unsigned char* key, struct aes_context* actx);
+static int gcm_encrypt_buffer(unsigned char* origin_buffer, size_t origin_size, unsigned char** res_buffer, size_t* res_size, unsigned char* key);
+static int decrypt_reader_read(struct reader* reader, void* buffer, size_t size, size_t* read);
+static int decrypt_reader_next(struct reader* reader, struct decrypt_reader* dr);
+static void decrypt_reader_close(struct reader* reader);
+static int aes_split(char* from, char* to, int enc, struct workers* workers);
+static void do_aes_range(struct worker_common* wc);
+static int ctr_range(struct aes_job* job, struct aes_context* actx, int in, int out, uint64_t start, uint64_t end);
+static int gcm_range(struct aes_job* job, struct aes_context* actx, int in, int out, uint64_t start, uint64_t end);
+static void ctr_counter(unsigned char* iv, uint64_t blocks, unsigned char* counter);
+static int aes_pread(int fd, void* buffer, size_t size, off_t offset);
+static int aes_pwrite(int fd, void* buffer, size_t size, off_t offset);
 static int aes_encrypt(char* plaintext, unsigned char* key, unsigned char* iv, char** ciphertext, int* ciphertext_length, int mode);
 static int aes_decrypt(char* ciphertext, int ciphertext_length, unsigned char* key, unsigned char* iv, char** plaintext, int mode);
 static const EVP_CIPHER* (*get_cipher(int mode))(void);
@@ -50,7 +202,17 @@ static const EVP_CIPHER* (*get_cipher_buffer(int mode))(void);
 static void do_encrypt_file(struct worker_common* wc);
 static void do_decrypt_file(struct worker_common* wc);
 
-static int encrypt_decrypt_buffer(unsigned char* origin_buffer, size_t origin_size, unsigned char** res_buffer, size_t* res_size, int enc, int mode);
+static int encrypt_decrypt_buffer(char* path, unsigned char* origin_buffer, size_t origin_size, unsigned char** res_buffer, size_t* res_size, int enc, int mode, const EVP_CIPHER* (*cipher_fp)(void));
+
+bool
+pgmoneta_encryption_applies(char* path)
+{
+   return !pgmoneta_ends_with(path, ".aes") &&
+          !pgmoneta_ends_with(path, ".partial") &&
+          !pgmoneta_ends_with(path, ".history") &&
+          !pgmoneta_ends_with(path, "backup_label") &&
+          !pgmoneta_ends_with(path, "backup_manifest");
+}
 
 int
 pgmoneta_encrypt_data(char* d, struct workers* workers)
@@ -82,11 +244,7 @@ pgmoneta_encrypt_data(char* d, struct workers* workers)
       }
       else
       {
-         if (!pgmoneta_ends_with(entry->d_name, ".aes") &&
-             !pgmoneta_ends_with(entry->d_name, ".partial") &&
-             !pgmoneta_ends_with(entry->d_name, ".history") &&
-             !pgmoneta_ends_with(entry->d_name, "backup_label") &&
-             !pgmoneta_ends_with(entry->d_name, "backup_manifest"))
+         if (pgmoneta_encryption_applies(entry->d_name))
          {
             from = pgmoneta_append(from, d);
             from = pgmoneta_append(from, "/");
@@ -97,7 +255,7 @@ pgmoneta_encrypt_data(char* d, struct workers* workers)
             to = pgmoneta_append(to, entry->d_name);
             to = pgmoneta_append(to, ".aes");
 
-            if (pgmoneta_exists(from))
+            if (pgmoneta_exists(from) && aes_split(from, to, 1, workers))
             {
                struct worker_input* wi = NULL;
 
@@ -236,6 +394,9 @@ pgmoneta_encrypt_wal(char* d)
    {
       return 1;
    }
+
+   pgmoneta_encrypt_key_cache_acquire();
+
    while ((entry = readdir(dir)) != NULL)
    {
       if (entry->d_type == DT_REG)
@@ -275,6 +436,9 @@ pgmoneta_encrypt_wal(char* d)
    }
 
    closedir(dir);
+
+   pgmoneta_encrypt_key_cache_release();
+
    return 0;
 }
 
@@ -381,7 +545,21 @@ pgmoneta_encrypt_file(char* from, char* to)
       flag = 1;
    }
 
-   encrypt_file(from, to, 1);
+   if (encrypt_file(from, to, 1))
+   {
+      pgmoneta_log_error("pgmoneta_encrypt_file: could not encrypt %s", from);
+
+      if (pgmoneta_exists(to))
+      {
+         pgmoneta_delete_file(to, NULL);
+      }
+
+      if (flag)
+      {
+         free(to);
+      }
+      return 1;
+   }
 
    if (pgmoneta_exists(from))
    {
@@ -490,7 +668,11 @@ pgmoneta_decrypt_directory(char* d, struct workers* workers)
             to = pgmoneta_append(to, "/");
             to = pgmoneta_append(to, name);
 
-            if (!pgmoneta_create_worker_input(NULL, from, to, 0, workers, &wi))
+            if (!aes_split(from, to, 0, workers))
+            {
+               /* Decrypted in ranges by the workers */
+            }
+            else if (!pgmoneta_create_worker_input(NULL, from, to, 0, workers, &wi))
             {
                if (workers != NULL)
                {
@@ -685,409 +867,620 @@ pgmoneta_decrypt(char* ciphertext, int ciphertext_length, char* password, char**
    return aes_decrypt(ciphertext, ciphertext_length, key, iv, plaintext, mode);
 }
 
-// [private]
-static int
-derive_key_iv(char* password, unsigned char* key, unsigned char* iv, int mode)
+void
+pgmoneta_encrypt_key_cache_acquire(void)
 {
-   if (!EVP_BytesToKey(get_cipher(mode)(), EVP_sha1(), NULL,
-                       (unsigned char*) password, strlen(password), 1,
-                       key, iv))
+   pthread_mutex_lock(&key_cache_lock);
+   if (!key_cache_locked)
    {
-      return 1;
+      /* Keep the keys out of swap, when the limits allow it */
+      mlock(&key_cache[0], sizeof(key_cache));
+      mlock(&data_key_cache[0], sizeof(data_key_cache));
+      key_cache_locked = true;
    }
-
-   return 0;
+   key_cache_users++;
+   pthread_mutex_unlock(&key_cache_lock);
 }
 
-// [private]
-static int
-aes_encrypt(char* plaintext, unsigned char* key, unsigned char* iv, char** ciphertext, int* ciphertext_length, int mode)
+void
+pgmoneta_encrypt_key_cache_release(void)
 {
-   EVP_CIPHER_CTX* ctx = NULL;
-   int length;
-   size_t size;
-   unsigned char* ct = NULL;
-   int ct_length;
-   const EVP_CIPHER* (* cipher_fp)(void) = get_cipher(mode);
-   if (!(ctx = EVP_CIPHER_CTX_new()))
+   pthread_mutex_lock(&key_cache_lock);
+   if (key_cache_users > 0)
    {
-      goto error;
+      key_cache_users--;
    }
-
-   if (EVP_EncryptInit_ex(ctx, cipher_fp(), NULL, key, iv) != 1)
+   if (key_cache_users == 0)
    {
-      goto error;
+      OPENSSL_cleanse(&key_cache[0], sizeof(key_cache));
+      OPENSSL_cleanse(&data_key_cache[0], sizeof(data_key_cache));
+      data_key_next = 0;
    }
+   pthread_mutex_unlock(&key_cache_lock);
+}
 
-   size = strlen(plaintext) + EVP_CIPHER_block_size(cipher_fp());
-   ct = malloc(size);
-
-   if (ct == NULL)
-   {
-      goto error;
-   }
+int
+pgmoneta_encrypt_key_cache_directory(char* directory, char* wrapped)
+{
+   char d[MAX_PATH];
+   char secret[DATA_KEY_LENGTH * 2 + 1];
+   struct data_key* entry = NULL;
 
-   memset(ct, 0, size);
+   memset(&secret[0], 0, sizeof(secret));
+   snprintf(&d[0], sizeof(d), "%s%s", directory, pgmoneta_ends_with(directory, "/") ? "" : "/");
 
-   if (EVP_EncryptUpdate(ctx,
-                         ct, &length,
-                         (unsigned char*)plaintext, strlen((char*)plaintext)) != 1)
+   if (wrapped != NULL && strlen(wrapped) > 0 && data_key_unwrap(wrapped, &secret[0], sizeof(secret)))
    {
-      goto error;
+      return 1;
    }
 
-   ct_length = length;
-
-   if (EVP_EncryptFinal_ex(ctx, ct + length, &length) != 1)
+   pthread_mutex_lock(&key_cache_lock);
+   if (key_cache_users > 0)
    {
-      goto error;
-   }
-
-   ct_length += length;
-
-   EVP_CIPHER_CTX_free(ctx);
-
-   *ciphertext = (char*)ct;
-   *ciphertext_length = ct_length;
+      for (int i = 0; i < DATA_KEY_CACHE_SIZE; i++)
+      {
+         if (data_key_cache[i].valid && !strcmp(data_key_cache[i].directory, &d[0]))
+         {
+            data_key_cache[i].valid = false;
+            data_key_cache[i].pinned = false;
+         }
+      }
 
-   return 0;
+      for (int i = 0; entry == NULL && i < DATA_KEY_CACHE_SIZE; i++)
+      {
+         if (!data_key_cache[i].pinned)
+         {
+            entry = &data_key_cache[i];
+         }
+      }
 
-error:
-   if (ctx)
-   {
-      EVP_CIPHER_CTX_free(ctx);
+      if (entry != NULL)
+      {
+         entry->valid = true;
+         entry->pinned = true;
+         snprintf(&entry->directory[0], sizeof(entry->directory), "%s", &d[0]);
+         snprintf(&entry->secret[0], sizeof(entry->secret), "%s", &secret[0]);
+      }
    }
+   pthread_mutex_unlock(&key_cache_lock);
 
-   free(ct);
+   OPENSSL_cleanse(&secret[0], sizeof(secret));
 
-   return 1;
+   return entry != NULL ? 0 : 1;
 }
 
-// [private]
-static int
-aes_decrypt(char* ciphertext, int ciphertext_length, unsigned char* key, unsigned char* iv, char** plaintext, int mode)
+int
+pgmoneta_encrypt_data_key(char** wrapped)
 {
-   EVP_CIPHER_CTX* ctx = NULL;
-   int plaintext_length;
-   int length;
-   size_t size;
-   char* pt = NULL;
-   const EVP_CIPHER* (* cipher_fp)(void) = get_cipher(mode);
+   unsigned char raw[DATA_KEY_LENGTH];
+   char secret[DATA_KEY_LENGTH * 2 + 1];
+   char* master_key = NULL;
+   char* ciphertext = NULL;
+   int ciphertext_length = 0;
+   char* w = NULL;
 
-   if (!(ctx = EVP_CIPHER_CTX_new()))
-   {
-      goto error;
-   }
+   *wrapped = NULL;
 
-   if (EVP_DecryptInit_ex(ctx, cipher_fp(), NULL, key, iv) != 1)
+   if (RAND_bytes(&raw[0], sizeof(raw)) != 1)
    {
+      pgmoneta_log_error("RAND_bytes: Failed to create a data key");
       goto error;
    }
 
-   size = ciphertext_length + EVP_CIPHER_block_size(cipher_fp());
-   pt = malloc(size);
+   data_key_hex(&raw[0], sizeof(raw), &secret[0]);
 
-   if (pt == NULL)
+   if (pgmoneta_get_master_key(&master_key))
    {
+      pgmoneta_log_error("pgmoneta_get_master_key: Invalid master key");
       goto error;
    }
 
-   memset(pt, 0, size);
-
-   if (EVP_DecryptUpdate(ctx,
-                         (unsigned char*)pt, &length,
-                         (unsigned char*)ciphertext, ciphertext_length) != 1)
+   if (pgmoneta_encrypt(&secret[0], master_key, &ciphertext, &ciphertext_length, ENCRYPTION_AES_256_CBC))
    {
       goto error;
    }
 
-   plaintext_length = length;
-
-   if (EVP_DecryptFinal_ex(ctx, (unsigned char*)pt + length, &length) != 1)
+   /* Hexadecimal, since backup.info can't hold the padding of base64 */
+   w = (char*)malloc((size_t)ciphertext_length * 2 + 1);
+   if (w == NULL)
    {
       goto error;
    }
 
-   plaintext_length += length;
+   data_key_hex((unsigned char*)ciphertext, ciphertext_length, w);
 
-   EVP_CIPHER_CTX_free(ctx);
+   *wrapped = w;
 
-   pt[plaintext_length] = 0;
-   *plaintext = pt;
+   OPENSSL_cleanse(&raw[0], sizeof(raw));
+   OPENSSL_cleanse(&secret[0], sizeof(secret));
+   OPENSSL_cleanse(master_key, strlen(master_key));
+   free(master_key);
+   free(ciphertext);
 
    return 0;
 
 error:
-   if (ctx)
+
+   OPENSSL_cleanse(&raw[0], sizeof(raw));
+   OPENSSL_cleanse(&secret[0], sizeof(secret));
+   if (master_key != NULL)
    {
-      EVP_CIPHER_CTX_free(ctx);
+      OPENSSL_cleanse(master_key, strlen(master_key));
    }
-
-   free(pt);
+   free(master_key);
+   free(ciphertext);
 
    return 1;
 }
 
-static const EVP_CIPHER* (*get_cipher(int mode))(void)
+// [private]
+static int
+derive_key_iv(char* password, unsigned char* key, unsigned char* iv, int mode)
 {
-   if (mode == ENCRYPTION_AES_256_CBC)
-   {
-      return &EVP_aes_256_cbc;
-   }
-   if (mode == ENCRYPTION_AES_192_CBC)
-   {
-      return &EVP_aes_192_cbc;
-   }
-   if (mode == ENCRYPTION_AES_128_CBC)
-   {
-      return &EVP_aes_128_cbc;
-   }
-   if (mode == ENCRYPTION_AES_256_CTR)
-   {
-      return &EVP_aes_256_ctr;
-   }
-   if (mode == ENCRYPTION_AES_192_CTR)
-   {
-      return &EVP_aes_192_ctr;
-   }
-   if (mode == ENCRYPTION_AES_128_CTR)
+   if (!EVP_BytesToKey(get_cipher(mode)(), EVP_sha1(), NULL,
+                       (unsigned char*) password, strlen(password), 1,
+                       key, iv))
    {
-      return &EVP_aes_128_ctr;
+      return 1;
    }
-   return &EVP_aes_256_cbc;
+
+   return 0;
 }
 
-// enc: 1 for encrypt, 0 for decrypt
+// [private]
 static int
-encrypt_file(char* from, char* to, int enc)
+master_key_iv(int mode, unsigned char* key, unsigned char* iv)
 {
-   unsigned char key[EVP_MAX_KEY_LENGTH];
-   unsigned char iv[EVP_MAX_IV_LENGTH];
    char* master_key = NULL;
-   EVP_CIPHER_CTX* ctx = NULL;
-   struct main_configuration* config;
-   const EVP_CIPHER* (* cipher_fp)(void) = NULL;
-   int cipher_block_size = 0;
-   int inbuf_size = 0;
-   int outbuf_size = 0;
-   FILE* in = NULL;
-   FILE* out = NULL;
-   int inl = 0;
-   int outl = 0;
-   int f_len = 0;
+   bool cache;
 
-   config = (struct main_configuration*)shmem;
-   cipher_fp = get_cipher(config->encryption);
-   cipher_block_size = EVP_CIPHER_block_size(cipher_fp());
-   inbuf_size = ENC_BUF_SIZE;
-   outbuf_size = inbuf_size + cipher_block_size - 1;
-   unsigned char inbuf[inbuf_size];
-   unsigned char outbuf[outbuf_size];
+   cache = mode > ENCRYPTION_NONE && mode <= ENCRYPTION_AES_256_GCM;
+
+   if (cache)
+   {
+      pthread_mutex_lock(&key_cache_lock);
+      if (key_cache_users > 0 && key_cache[mode].valid)
+      {
+         memcpy(key, key_cache[mode].key, EVP_MAX_KEY_LENGTH);
+         memcpy(iv, key_cache[mode].iv, EVP_MAX_IV_LENGTH);
+         pthread_mutex_unlock(&key_cache_lock);
+         return 0;
+      }
+      pthread_mutex_unlock(&key_cache_lock);
+   }
 
    if (pgmoneta_get_master_key(&master_key))
    {
       pgmoneta_log_error("pgmoneta_get_master_key: Invalid master key");
       goto error;
    }
-   memset(&key, 0, sizeof(key));
-   memset(&iv, 0, sizeof(iv));
-   if (derive_key_iv(master_key, key, iv, config->encryption) != 0)
+
+   if (derive_key_iv(master_key, key, iv, mode) != 0)
    {
       pgmoneta_log_error("derive_key_iv: Failed to derive key and iv");
       goto error;
    }
 
-   if (!(ctx = EVP_CIPHER_CTX_new()))
+   if (cache)
    {
-      pgmoneta_log_error("EVP_CIPHER_CTX_new: Failed to get context");
-      goto error;
+      pthread_mutex_lock(&key_cache_lock);
+      if (key_cache_users > 0)
+      {
+         memcpy(key_cache[mode].key, key, EVP_MAX_KEY_LENGTH);
+         memcpy(key_cache[mode].iv, iv, EVP_MAX_IV_LENGTH);
+         key_cache[mode].valid = true;
+      }
+      pthread_mutex_unlock(&key_cache_lock);
    }
 
-   in = fopen(from, "rb");
-   if (in == NULL)
+   OPENSSL_cleanse(master_key, strlen(master_key));
+   free(master_key);
+
+   return 0;
+
+error:
+
+   if (master_key != NULL)
    {
-      pgmoneta_log_error("fopen: Could not open %s", from);
-      goto error;
+      OPENSSL_cleanse(master_key, strlen(master_key));
    }
+   free(master_key);
 
-   out = fopen(to, "w");
-   if (out == NULL)
+   return 1;
+}
+
+// [private]
+static int
+file_key_iv(char* path, int mode, unsigned char* key, unsigned char* iv)
+{
+   char secret[DATA_KEY_LENGTH * 2 + 1];
+   int ret;
+
+   memset(&secret[0], 0, sizeof(secret));
+
+   if (path != NULL && data_key_lookup(path, &secret[0], sizeof(secret)))
    {
-      pgmoneta_log_error("fopen: Could not open %s", to);
-      goto error;
+      pgmoneta_log_error("Unable to get the data key of %s", path);
+      return 1;
    }
 
-   if (EVP_CipherInit_ex(ctx, cipher_fp(), NULL, key, iv, enc) == 0)
+   /* A file outside of a backup, or in a backup without a data key */
+   if (strlen(secret) == 0)
    {
-      pgmoneta_log_error("EVP_CipherInit_ex: ailed to initialize context");
-      goto error;
+      return master_key_iv(mode, key, iv);
    }
 
-   while ((inl = fread(inbuf, sizeof(char), inbuf_size, in)) > 0)
+   ret = derive_key_iv(&secret[0], key, iv, mode);
+
+   OPENSSL_cleanse(&secret[0], sizeof(secret));
+
+   return ret;
+}
+
+// [private]
+static int
+data_key_lookup(char* path, char* secret, size_t size)
+{
+   char directory[MAX_PATH];
+   char info[MAX_PATH];
+   char* p = NULL;
+   bool found = false;
+   struct backup* backup = NULL;
+   struct data_key* entry = NULL;
+
+   secret[0] = '\0';
+
+   pthread_mutex_lock(&key_cache_lock);
+   for (int i = 0; key_cache_users > 0 && i < DATA_KEY_CACHE_SIZE; i++)
    {
-      if (EVP_CipherUpdate(ctx, outbuf, &outl, inbuf, inl) == 0)
-      {
-         pgmoneta_log_error("EVP_CipherUpdate: failed to process block");
-         goto error;
-      }
-      if (fwrite(outbuf, sizeof(char), outl, out) != (size_t)outl)
+      if (data_key_cache[i].valid && pgmoneta_starts_with(path, data_key_cache[i].directory))
       {
-         pgmoneta_log_error("fwrite: failed to write cipher");
-         goto error;
+         snprintf(secret, size, "%s", data_key_cache[i].secret);
+         pthread_mutex_unlock(&key_cache_lock);
+         return 0;
       }
    }
+   pthread_mutex_unlock(&key_cache_lock);
+
+   /* The backup directory is the closest one with a backup.info */
+   snprintf(&directory[0], sizeof(directory), "%s", path);
+   while (!found && (p = strrchr(&directory[0], '/')) != NULL && p != &directory[0])
+   {
+      *p = '\0';
+      snprintf(&info[0], sizeof(info), "%s/backup.info", &directory[0]);
+      found = pgmoneta_exists(&info[0]);
+   }
+
+   if (!found)
+   {
+      return 0;
+   }
 
-   if (ferror(in))
+   if (pgmoneta_get_backup_file(&info[0], &backup))
    {
-      pgmoneta_log_error("fread: error reading from file: %s", from);
       goto error;
    }
 
-   if (EVP_CipherFinal_ex(ctx, outbuf, &f_len) == 0)
+   if (strlen(backup->data_key) > 0 && data_key_unwrap(backup->data_key, secret, size))
    {
-      pgmoneta_log_error("EVP_CipherFinal_ex: failed to process final cipher block");
       goto error;
    }
 
-   if (f_len)
+   pthread_mutex_lock(&key_cache_lock);
+   for (int i = 0; key_cache_users > 0 && entry == NULL && i < DATA_KEY_CACHE_SIZE; i++)
    {
-      if (fwrite(outbuf, sizeof(char), f_len, out) != (size_t)f_len)
+      if (!data_key_cache[data_key_next].pinned)
       {
-         pgmoneta_log_error("fwrite: failed to write final block");
-         goto error;
+         entry = &data_key_cache[data_key_next];
       }
+      data_key_next = (data_key_next + 1) % DATA_KEY_CACHE_SIZE;
    }
-
-   if (ctx)
+   if (entry != NULL)
    {
-      EVP_CIPHER_CTX_free(ctx);
+      entry->valid = true;
+      snprintf(&entry->directory[0], sizeof(entry->directory), "%s/", &directory[0]);
+      snprintf(&entry->secret[0], sizeof(entry->secret), "%s", secret);
    }
-   free(master_key);
-   fclose(in);
-   fclose(out);
+   pthread_mutex_unlock(&key_cache_lock);
+
+   free(backup);
+
    return 0;
 
 error:
-   if (ctx)
+
+   free(backup);
+
+   return 1;
+}
+
+// [private]
+static int
+data_key_unwrap(char* wrapped, char* secret, size_t size)
+{
+   char* master_key = NULL;
+   unsigned char* ciphertext = NULL;
+   size_t ciphertext_length = 0;
+   char* plaintext = NULL;
+
+   if (data_key_unhex(wrapped, &ciphertext, &ciphertext_length))
    {
-      EVP_CIPHER_CTX_free(ctx);
+      goto error;
    }
 
-   free(master_key);
+   if (pgmoneta_get_master_key(&master_key))
+   {
+      pgmoneta_log_error("pgmoneta_get_master_key: Invalid master key");
+      goto error;
+   }
 
-   if (in != NULL)
+   if (pgmoneta_decrypt((char*)ciphertext, (int)ciphertext_length, master_key, &plaintext, ENCRYPTION_AES_256_CBC))
    {
-      fclose(in);
+      goto error;
    }
 
-   if (out != NULL)
+   /* A wrong master key seldom passes the padding check, never the format */
+   if (strlen(plaintext) != DATA_KEY_LENGTH * 2 || strspn(plaintext, "0123456789abcdef") != DATA_KEY_LENGTH * 2)
    {
-      fclose(out);
+      pgmoneta_log_error("The data key isn't wrapped with the master key");
+      goto error;
+   }
+
+   snprintf(secret, size, "%s", plaintext);
+
+   OPENSSL_cleanse(master_key, strlen(master_key));
+   OPENSSL_cleanse(plaintext, strlen(plaintext));
+   free(master_key);
+   free(plaintext);
+   free(ciphertext);
+
+   return 0;
+
+error:
+
+   if (master_key != NULL)
+   {
+      OPENSSL_cleanse(master_key, strlen(master_key));
+   }
+   if (plaintext != NULL)
+   {
+      OPENSSL_cleanse(plaintext, strlen(plaintext));
    }
+   free(master_key);
+   free(plaintext);
+   free(ciphertext);
 
    return 1;
 }
 
-int
-pgmoneta_encrypt_buffer(unsigned char* origin_buffer, size_t origin_size, unsigned char** enc_buffer, size_t* enc_size, int mode)
+// [private]
+static void
+data_key_hex(unsigned char* raw, size_t length, char* hex)
 {
-   return encrypt_decrypt_buffer(origin_buffer, origin_size, enc_buffer, enc_size, 1, mode);
+   for (size_t i = 0; i < length; i++)
+   {
+      sprintf(hex + i * 2, "%02x", raw[i]);
+   }
+   hex[length * 2] = '\0';
 }
 
-int
-pgmoneta_decrypt_buffer(unsigned char* origin_buffer, size_t origin_size, unsigned char** dec_buffer, size_t* dec_size, int mode)
+// [private]
+static int
+data_key_unhex(char* hex, unsigned char** raw, size_t* length)
 {
-   return encrypt_decrypt_buffer(origin_buffer, origin_size, dec_buffer, dec_size, 0, mode);
+   size_t n = strlen(hex);
+   unsigned char* r = NULL;
+   unsigned int v;
+
+   *raw = NULL;
+   *length = 0;
+
+   if (n == 0 || n % 2 != 0)
+   {
+      return 1;
+   }
+
+   r = (unsigned char*)malloc(n / 2);
+   if (r == NULL)
+   {
+      return 1;
+   }
+
+   for (size_t i = 0; i < n / 2; i++)
+   {
+      if (sscanf(hex + i * 2, "%2x", &v) != 1)
+      {
+         free(r);
+         return 1;
+      }
+      r[i] = (unsigned char)v;
+   }
+
+   *raw = r;
+   *length = n / 2;
+
+   return 0;
 }
 
-static int
-encrypt_decrypt_buffer(unsigned char* origin_buffer, size_t origin_size, unsigned char** res_buffer, size_t* res_size, int enc, int mode)
+// [private]
+static struct aes_context*
+aes_context_get(void)
 {
-   unsigned char key[EVP_MAX_KEY_LENGTH];
-   unsigned char iv[EVP_MAX_IV_LENGTH];
-   char* master_key = NULL;
-   EVP_CIPHER_CTX* ctx = NULL;
-   const EVP_CIPHER* (*cipher_fp)(void) = NULL;
-   size_t cipher_block_size = 0;
-   size_t outbuf_size = 0;
-   size_t outl = 0;
-   size_t f_len = 0;
+   struct aes_context* actx = NULL;
 
-   cipher_fp = get_cipher_buffer(mode);
-   if (cipher_fp == NULL)
+   actx = (struct aes_context*)pgmoneta_workers_context_get(WORKER_CONTEXT_AES, 0);
+   if (actx != NULL)
+   {
+      return actx;
+   }
+
+   actx = (struct aes_context*)malloc(sizeof(struct aes_context));
+   if (actx == NULL)
    {
-      pgmoneta_log_error("Invalid encryption method specified");
       goto error;
    }
 
-   cipher_block_size = EVP_CIPHER_block_size(cipher_fp());
+   memset(actx, 0, sizeof(struct aes_context));
 
-   if (enc == 1)
+   actx->ctx = EVP_CIPHER_CTX_new();
+   if (actx->ctx == NULL)
    {
-      outbuf_size = origin_size + cipher_block_size;
+      goto error;
    }
-   else
+
+   if (posix_memalign((void**)&actx->inbuf, ENC_BUF_ALIGNMENT, ENC_BUF_SIZE + EVP_MAX_BLOCK_LENGTH) ||
+       posix_memalign((void**)&actx->outbuf, ENC_BUF_ALIGNMENT, ENC_BUF_SIZE + EVP_MAX_BLOCK_LENGTH))
    {
-      outbuf_size = origin_size;
+      goto error;
    }
 
-   *res_buffer = (unsigned char*)malloc(outbuf_size + 1);
-   if (*res_buffer == NULL)
+   pgmoneta_workers_context_put(WORKER_CONTEXT_AES, 0, actx, aes_context_destroy);
+
+   return actx;
+
+error:
+
+   aes_context_destroy(actx);
+
+   return NULL;
+}
+
+// [private]
+static void
+aes_context_destroy(void* context)
+{
+   struct aes_context* actx = (struct aes_context*)context;
+
+   if (actx == NULL)
+   {
+      return;
+   }
+
+   if (actx->ctx != NULL)
+   {
+      EVP_CIPHER_CTX_free(actx->ctx);
+   }
+
+   free(actx->inbuf);
+   free(actx->outbuf);
+   free(actx);
+}
+
+// [private]
+static int
+aes_encrypt(char* plaintext, unsigned char* key, unsigned char* iv, char** ciphertext, int* ciphertext_length, int mode)
+{
+   EVP_CIPHER_CTX* ctx = NULL;
+   int length;
+   size_t size;
+   unsigned char* ct = NULL;
+   int ct_length;
+   const EVP_CIPHER* (* cipher_fp)(void) = get_cipher(mode);
+   if (!(ctx = EVP_CIPHER_CTX_new()))
    {
-      pgmoneta_log_error("pgmoneta_encrypt_decrypt_buffer: Allocation failure");
       goto error;
    }
 
-   if (pgmoneta_get_master_key(&master_key))
+   if (EVP_EncryptInit_ex(ctx, cipher_fp(), NULL, key, iv) != 1)
    {
-      pgmoneta_log_error("pgmoneta_get_master_key: Invalid master key");
       goto error;
    }
 
-   memset(&key, 0, sizeof(key));
-   memset(&iv, 0, sizeof(iv));
+   size = strlen(plaintext) + EVP_CIPHER_block_size(cipher_fp());
+   ct = malloc(size);
 
-   if (derive_key_iv(master_key, key, iv, mode) != 0)
+   if (ct == NULL)
+   {
+      goto error;
+   }
+
+   memset(ct, 0, size);
+
+   if (EVP_EncryptUpdate(ctx,
+                         ct, &length,
+                         (unsigned char*)plaintext, strlen((char*)plaintext)) != 1)
+   {
+      goto error;
+   }
+
+   ct_length = length;
+
+   if (EVP_EncryptFinal_ex(ctx, ct + length, &length) != 1)
    {
-      pgmoneta_log_error("derive_key_iv: Failed to derive key and iv");
       goto error;
    }
 
+   ct_length += length;
+
+   EVP_CIPHER_CTX_free(ctx);
+
+   *ciphertext = (char*)ct;
+   *ciphertext_length = ct_length;
+
+   return 0;
+
+error:
+   if (ctx)
+   {
+      EVP_CIPHER_CTX_free(ctx);
+   }
+
+   free(ct);
+
+   return 1;
+}
+
+// [private]
+static int
+aes_decrypt(char* ciphertext, int ciphertext_length, unsigned char* key, unsigned char* iv, char** plaintext, int mode)
+{
+   EVP_CIPHER_CTX* ctx = NULL;
+   int plaintext_length;
+   int length;
+   size_t size;
+   char* pt = NULL;
+   const EVP_CIPHER* (* cipher_fp)(void) = get_cipher(mode);
+
    if (!(ctx = EVP_CIPHER_CTX_new()))
    {
-      pgmoneta_log_error("EVP_CIPHER_CTX_new: Failed to create context");
       goto error;
    }
 
-   if (EVP_CipherInit_ex(ctx, cipher_fp(), NULL, key, iv, enc) == 0)
+   if (EVP_DecryptInit_ex(ctx, cipher_fp(), NULL, key, iv) != 1)
    {
-      pgmoneta_log_error("EVP_CipherInit_ex: Failed to initialize cipher context");
       goto error;
    }
 
-   if (EVP_CipherUpdate(ctx, *res_buffer, (int*)&outl, origin_buffer, origin_size) == 0)
+   size = ciphertext_length + EVP_CIPHER_block_size(cipher_fp());
+   pt = malloc(size);
+
+   if (pt == NULL)
    {
-      pgmoneta_log_error("EVP_CipherUpdate: Failed to process data");
       goto error;
    }
 
-   *res_size = outl;
+   memset(pt, 0, size);
 
-   if (EVP_CipherFinal_ex(ctx, *res_buffer + outl, (int*)&f_len) == 0)
+   if (EVP_DecryptUpdate(ctx,
+                         (unsigned char*)pt, &length,
+                         (unsigned char*)ciphertext, ciphertext_length) != 1)
    {
-      pgmoneta_log_error("EVP_CipherFinal_ex: Failed to finalize operation");
       goto error;
    }
 
-   *res_size += f_len;
+   plaintext_length = length;
 
-   if (enc == 0)
+   if (EVP_DecryptFinal_ex(ctx, (unsigned char*)pt + length, &length) != 1)
    {
-      (*res_buffer)[*res_size] = '\0';
+      goto error;
    }
 
+   plaintext_length += length;
+
    EVP_CIPHER_CTX_free(ctx);
-   free(master_key);
+
+   pt[plaintext_length] = 0;
+   *plaintext = pt;
 
    return 0;
 
@@ -1097,12 +1490,12 @@ error:
       EVP_CIPHER_CTX_free(ctx);
    }
 
-   free(master_key);
+   free(pt);
 
    return 1;
 }
 
-static const EVP_CIPHER* (*get_cipher_buffer(int mode))(void)
+static const EVP_CIPHER* (*get_cipher(int mode))(void)
 {
    if (mode == ENCRYPTION_AES_256_CBC)
    {
@@ -1116,5 +1509,1446 @@ static const EVP_CIPHER* (*get_cipher_buffer(int mode))(void)
    {
       return &EVP_aes_128_cbc;
    }
+   if (mode == ENCRYPTION_AES_256_CTR)
+   {
+      return &EVP_aes_256_ctr;
+   }
+   if (mode == ENCRYPTION_AES_192_CTR)
+   {
+      return &EVP_aes_192_ctr;
+   }
+   if (mode == ENCRYPTION_AES_128_CTR)
+   {
+      return &EVP_aes_128_ctr;
+   }
+   if (mode == ENCRYPTION_AES_256_GCM)
+   {
+      return &EVP_aes_256_gcm;
+   }
    return &EVP_aes_256_cbc;
 }
+
+// enc: 1 for encrypt, 0 for decrypt
+static int
+encrypt_file(char* from, char* to, int enc)
+{
+   unsigned char key[EVP_MAX_KEY_LENGTH];
+   unsigned char iv[EVP_MAX_IV_LENGTH];
+   struct aes_context* actx = NULL;
+   struct main_configuration* config;
+   const EVP_CIPHER* (* cipher_fp)(void) = NULL;
+   FILE* in = NULL;
+   FILE* out = NULL;
+   bool gcm = false;
+   int mode;
+   int inl = 0;
+   int outl = 0;
+   int f_len = 0;
+   uint64_t start;
+
+   PGMONETA_PROFILE(PROFILE_ENCRYPT_FILE);
+
+   start = pgmoneta_prometheus_now();
+
+   config = (struct main_configuration*)shmem;
+
+   memset(&key, 0, sizeof(key));
+   memset(&iv, 0, sizeof(iv));
+
+   actx = aes_context_get();
+   if (actx == NULL)
+   {
+      pgmoneta_log_error("EVP_CIPHER_CTX_new: Failed to get context");
+      goto error;
+   }
+
+   in = fopen(from, "rb");
+   if (in == NULL)
+   {
+      pgmoneta_log_error("fopen: Could not open %s", from);
+      goto error;
+   }
+
+   /* An AES-GCM file is recognized by its header, whatever the configured mode is */
+   gcm = enc ? config->encryption == ENCRYPTION_AES_256_GCM : gcm_is_file(in);
+   mode = gcm ? ENCRYPTION_AES_256_GCM : config->encryption;
+   cipher_fp = get_cipher(mode);
+
+   if (file_key_iv(enc ? to : from, mode, key, iv))
+   {
+      goto error;
+   }
+
+   out = fopen(to, "w");
+   if (out == NULL)
+   {
+      pgmoneta_log_error("fopen: Could not open %s", to);
+      goto error;
+   }
+
+   if (gcm)
+   {
+      if (enc ? gcm_encrypt_stream(in, out, key, actx) : gcm_decrypt_stream(in, out, key, actx))
+      {
+         pgmoneta_log_error("AES-GCM: Could not %s %s", enc ? "encrypt" : "decrypt", from);
+         goto error;
+      }
+   }
+   else
+   {
+      if (EVP_CipherInit_ex(actx->ctx, cipher_fp(), NULL, key, iv, enc) == 0)
+      {
+         pgmoneta_log_error("EVP_CipherInit_ex: ailed to initialize context");
+         goto error;
+      }
+
+      while ((inl = fread(actx->inbuf, sizeof(char), ENC_BUF_SIZE, in)) > 0)
+      {
+         if (EVP_CipherUpdate(actx->ctx, actx->outbuf, &outl, actx->inbuf, inl) == 0)
+         {
+            pgmoneta_log_error("EVP_CipherUpdate: failed to process block");
+            goto error;
+         }
+         if (fwrite(actx->outbuf, sizeof(char), outl, out) != (size_t)outl)
+         {
+            pgmoneta_log_error("fwrite: failed to write cipher");
+            goto error;
+         }
+      }
+
+      if (ferror(in))
+      {
+         pgmoneta_log_error("fread: error reading from file: %s", from);
+         goto error;
+      }
+
+      if (EVP_CipherFinal_ex(actx->ctx, actx->outbuf, &f_len) == 0)
+      {
+         pgmoneta_log_error("EVP_CipherFinal_ex: failed to process final cipher block");
+         goto error;
+      }
+
+      if (f_len)
+      {
+         if (fwrite(actx->outbuf, sizeof(char), f_len, out) != (size_t)f_len)
+         {
+            pgmoneta_log_error("fwrite: failed to write final block");
+            goto error;
+         }
+      }
+   }
+
+   EVP_CIPHER_CTX_reset(actx->ctx);
+   OPENSSL_cleanse(key, sizeof(key));
+   OPENSSL_cleanse(iv, sizeof(iv));
+   fclose(in);
+   fclose(out);
+
+   pgmoneta_prometheus_file(enc ? FILE_OPERATION_ENCRYPT : FILE_OPERATION_DECRYPT, start);
+
+   return 0;
+
+error:
+   if (actx != NULL)
+   {
+      EVP_CIPHER_CTX_reset(actx->ctx);
+   }
+
+   OPENSSL_cleanse(key, sizeof(key));
+   OPENSSL_cleanse(iv, sizeof(iv));
+
+   if (in != NULL)
+   {
+      fclose(in);
+   }
+
+   if (out != NULL)
+   {
+      fclose(out);
+
+      /* Never leave unauthenticated plaintext behind */
+      if (gcm)
+      {
+         remove(to);
+      }
+   }
+
+   return 1;
+}
+
+int
+pgmoneta_encrypt_buffer(unsigned char* origin_buffer, size_t origin_size, unsigned char** enc_buffer, size_t* enc_size, int mode)
+{
+   return encrypt_decrypt_buffer(NULL, origin_buffer, origin_size, enc_buffer, enc_size, 1, mode, get_cipher_buffer(mode));
+}
+
+int
+pgmoneta_encrypt_file_buffer(char* path, unsigned char* origin_buffer, size_t origin_size, unsigned char** enc_buffer, size_t* enc_size)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (config->encryption == ENCRYPTION_AES_256_GCM)
+   {
+      unsigned char key[EVP_MAX_KEY_LENGTH];
+      unsigned char iv[EVP_MAX_IV_LENGTH];
+      int ret;
+
+      memset(&key, 0, sizeof(key));
+      memset(&iv, 0, sizeof(iv));
+
+      if (file_key_iv(path, ENCRYPTION_AES_256_GCM, key, iv))
+      {
+         return 1;
+      }
+
+      ret = gcm_encrypt_buffer(origin_buffer, origin_size, enc_buffer, enc_size, key);
+
+      OPENSSL_cleanse(key, sizeof(key));
+      OPENSSL_cleanse(iv, sizeof(iv));
+
+      return ret;
+   }
+
+   return encrypt_decrypt_buffer(path, origin_buffer, origin_size, enc_buffer, enc_size, 1, config->encryption, get_cipher(config->encryption));
+}
+
+bool
+pgmoneta_encrypt_stream_supported(int mode)
+{
+   /* AES-GCM output is chunked, and is written by the file functions only */
+   return mode != ENCRYPTION_NONE && mode != ENCRYPTION_AES_256_GCM;
+}
+
+int
+pgmoneta_encrypt_stream_create(char* path, EVP_CIPHER_CTX** ctx)
+{
+   unsigned char key[EVP_MAX_KEY_LENGTH];
+   unsigned char iv[EVP_MAX_IV_LENGTH];
+   EVP_CIPHER_CTX* c = NULL;
+   const EVP_CIPHER* (*cipher_fp)(void) = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   *ctx = NULL;
+
+   if (!pgmoneta_encrypt_stream_supported(config->encryption))
+   {
+      pgmoneta_log_error("Streaming encryption is not supported for encryption mode %d", config->encryption);
+      goto error;
+   }
+
+   cipher_fp = get_cipher(config->encryption);
+   if (cipher_fp == NULL)
+   {
+      pgmoneta_log_error("Invalid encryption method specified");
+      goto error;
+   }
+
+   memset(&key, 0, sizeof(key));
+   memset(&iv, 0, sizeof(iv));
+
+   if (file_key_iv(path, config->encryption, key, iv))
+   {
+      goto error;
+   }
+
+   if (!(c = EVP_CIPHER_CTX_new()))
+   {
+      pgmoneta_log_error("EVP_CIPHER_CTX_new: Failed to create context");
+      goto error;
+   }
+
+   if (EVP_CipherInit_ex(c, cipher_fp(), NULL, key, iv, 1) == 0)
+   {
+      pgmoneta_log_error("EVP_CipherInit_ex: Failed to initialize cipher context");
+      goto error;
+   }
+
+   OPENSSL_cleanse(key, sizeof(key));
+   OPENSSL_cleanse(iv, sizeof(iv));
+
+   *ctx = c;
+
+   return 0;
+
+error:
+
+   if (c != NULL)
+   {
+      EVP_CIPHER_CTX_free(c);
+   }
+
+   OPENSSL_cleanse(key, sizeof(key));
+   OPENSSL_cleanse(iv, sizeof(iv));
+
+   return 1;
+}
+
+int
+pgmoneta_encrypt_stream_update(EVP_CIPHER_CTX* ctx, unsigned char* in, size_t in_size, unsigned char* out, size_t* out_size)
+{
+   int outl = 0;
+
+   *out_size = 0;
+
+   if (EVP_CipherUpdate(ctx, out, &outl, in, (int)in_size) == 0)
+   {
+      pgmoneta_log_error("EVP_CipherUpdate: Failed to process data");
+      return 1;
+   }
+
+   *out_size = (size_t)outl;
+
+   return 0;
+}
+
+int
+pgmoneta_encrypt_stream_final(EVP_CIPHER_CTX* ctx, unsigned char* out, size_t* out_size)
+{
+   int outl = 0;
+
+   *out_size = 0;
+
+   if (EVP_CipherFinal_ex(ctx, out, &outl) == 0)
+   {
+      pgmoneta_log_error("EVP_CipherFinal_ex: Failed to process data");
+      return 1;
+   }
+
+   *out_size = (size_t)outl;
+
+   return 0;
+}
+
+void
+pgmoneta_encrypt_stream_destroy(EVP_CIPHER_CTX* ctx)
+{
+   if (ctx != NULL)
+   {
+      EVP_CIPHER_CTX_free(ctx);
+   }
+}
+
+int
+pgmoneta_decrypt_reader(char* path, struct reader* source, struct reader** reader)
+{
+   unsigned char header[GCM_HEADER_LENGTH];
+   unsigned char iv[EVP_MAX_IV_LENGTH];
+   struct decrypt_reader* dr = NULL;
+   const EVP_CIPHER* (* cipher_fp)(void) = NULL;
+   size_t n = 0;
+   int outl = 0;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   *reader = NULL;
+
+   memset(&header[0], 0, sizeof(header));
+   memset(&iv[0], 0, sizeof(iv));
+
+   dr = (struct decrypt_reader*)malloc(sizeof(struct decrypt_reader));
+   if (dr == NULL)
+   {
+      goto error;
+   }
+
+   memset(dr, 0, sizeof(struct decrypt_reader));
+
+   dr->ctx = EVP_CIPHER_CTX_new();
+   if (dr->ctx == NULL)
+   {
+      goto error;
+   }
+
+   if (pgmoneta_reader_fill(source, &header[0], GCM_MAGIC_LENGTH, &n))
+   {
+      goto error;
+   }
+
+   dr->gcm = n == GCM_MAGIC_LENGTH && memcmp(&header[0], GCM_MAGIC, GCM_MAGIC_LENGTH) == 0;
+
+   if (dr->gcm)
+   {
+      if (pgmoneta_reader_fill(source, &header[GCM_MAGIC_LENGTH], GCM_HEADER_LENGTH - GCM_MAGIC_LENGTH, &n) ||
+          n != GCM_HEADER_LENGTH - GCM_MAGIC_LENGTH)
+      {
+         goto error;
+      }
+
+      dr->chunk_size = gcm_get_le32(&header[GCM_MAGIC_LENGTH]);
+      if (dr->chunk_size == 0 || dr->chunk_size > ENC_BUF_SIZE)
+      {
+         goto error;
+      }
+
+      memcpy(&dr->prefix[0], &header[GCM_MAGIC_LENGTH + 4], GCM_NONCE_PREFIX_LENGTH);
+
+      if (file_key_iv(path, ENCRYPTION_AES_256_GCM, dr->key, &iv[0]))
+      {
+         goto error;
+      }
+
+      /* The length field of the first chunk */
+      if (pgmoneta_reader_fill(source, &dr->length[0], sizeof(dr->length), &n) || n != sizeof(dr->length))
+      {
+         goto error;
+      }
+
+      dr->in_size = dr->chunk_size + GCM_TAG_LENGTH;
+      dr->in = (unsigned char*)malloc(dr->in_size);
+      dr->out = (unsigned char*)malloc(dr->chunk_size);
+   }
+   else
+   {
+      cipher_fp = get_cipher(config->encryption);
+
+      if (file_key_iv(path, config->encryption, dr->key, &iv[0]))
+      {
+         goto error;
+      }
+
+      if (EVP_CipherInit_ex(dr->ctx, cipher_fp(), NULL, dr->key, &iv[0], 0) == 0)
+      {
+         goto error;
+      }
+
+      dr->in_size = READER_BUFFER_SIZE;
+      dr->in = (unsigned char*)malloc(dr->in_size);
+      dr->out = (unsigned char*)malloc(dr->in_size + EVP_MAX_BLOCK_LENGTH);
+
+      /* The bytes read to look for the GCM header are ciphertext */
+      if (dr->out != NULL && n > 0)
+      {
+         if (EVP_CipherUpdate(dr->ctx, dr->out, &outl, &header[0], (int)n) == 0)
+         {
+            goto error;
+         }
+         dr->out_length = (size_t)outl;
+      }
+   }
+
+   if (dr->in == NULL || dr->out == NULL)
+   {
+      goto error;
+   }
+
+   if (pgmoneta_reader_create(source, decrypt_reader_read, decrypt_reader_close, dr, reader))
+   {
+      goto error;
+   }
+
+   OPENSSL_cleanse(&iv[0], sizeof(iv));
+
+   return 0;
+
+error:
+
+   OPENSSL_cleanse(&iv[0], sizeof(iv));
+
+   if (dr != NULL)
+   {
+      struct reader r;
+
+      memset(&r, 0, sizeof(struct reader));
+      r.state = dr;
+      decrypt_reader_close(&r);
+   }
+
+   return 1;
+}
+
+int
+pgmoneta_decrypt_buffer(unsigned char* origin_buffer, size_t origin_size, unsigned char** dec_buffer, size_t* dec_size, int mode)
+{
+   return encrypt_decrypt_buffer(NULL, origin_buffer, origin_size, dec_buffer, dec_size, 0, mode, get_cipher_buffer(mode));
+}
+
+static int
+encrypt_decrypt_buffer(char* path, unsigned char* origin_buffer, size_t origin_size, unsigned char** res_buffer, size_t* res_size, int enc, int mode, const EVP_CIPHER* (*cipher_fp)(void))
+{
+   unsigned char key[EVP_MAX_KEY_LENGTH];
+   unsigned char iv[EVP_MAX_IV_LENGTH];
+   EVP_CIPHER_CTX* ctx = NULL;
+   size_t cipher_block_size = 0;
+   size_t outbuf_size = 0;
+   size_t outl = 0;
+   size_t f_len = 0;
+
+   if (cipher_fp == NULL)
+   {
+      pgmoneta_log_error("Invalid encryption method specified");
+      goto error;
+   }
+
+   cipher_block_size = EVP_CIPHER_block_size(cipher_fp());
+
+   if (enc == 1)
+   {
+      outbuf_size = origin_size + cipher_block_size;
+   }
+   else
+   {
+      outbuf_size = origin_size;
+   }
+
+   *res_buffer = (unsigned char*)malloc(outbuf_size + 1);
+   if (*res_buffer == NULL)
+   {
+      pgmoneta_log_error("pgmoneta_encrypt_decrypt_buffer: Allocation failure");
+      goto error;
+   }
+
+   memset(&key, 0, sizeof(key));
+   memset(&iv, 0, sizeof(iv));
+
+   if (file_key_iv(path, mode, key, iv))
+   {
+      goto error;
+   }
+
+   if (!(ctx = EVP_CIPHER_CTX_new()))
+   {
+      pgmoneta_log_error("EVP_CIPHER_CTX_new: Failed to create context");
+      goto error;
+   }
+
+   if (EVP_CipherInit_ex(ctx, cipher_fp(), NULL, key, iv, enc) == 0)
+   {
+      pgmoneta_log_error("EVP_CipherInit_ex: Failed to initialize cipher context");
+      goto error;
+   }
+
+   if (EVP_CipherUpdate(ctx, *res_buffer, (int*)&outl, origin_buffer, origin_size) == 0)
+   {
+      pgmoneta_log_error("EVP_CipherUpdate: Failed to process data");
+      goto error;
+   }
+
+   *res_size = outl;
+
+   if (EVP_CipherFinal_ex(ctx, *res_buffer + outl, (int*)&f_len) == 0)
+   {
+      pgmoneta_log_error("EVP_CipherFinal_ex: Failed to finalize operation");
+      goto error;
+   }
+
+   *res_size += f_len;
+
+   if (enc == 0)
+   {
+      (*res_buffer)[*res_size] = '\0';
+   }
+
+   EVP_CIPHER_CTX_free(ctx);
+   OPENSSL_cleanse(key, sizeof(key));
+   OPENSSL_cleanse(iv, sizeof(iv));
+
+   return 0;
+
+error:
+   if (ctx)
+   {
+      EVP_CIPHER_CTX_free(ctx);
+   }
+
+   OPENSSL_cleanse(key, sizeof(key));
+   OPENSSL_cleanse(iv, sizeof(iv));
+
+   return 1;
+}
+
+static const EVP_CIPHER* (*get_cipher_buffer(int mode))(void)
+{
+   if (mode == ENCRYPTION_AES_256_CBC)
+   {
+      return &EVP_aes_256_cbc;
+   }
+   if (mode == ENCRYPTION_AES_192_CBC)
+   {
+      return &EVP_aes_192_cbc;
+   }
+   if (mode == ENCRYPTION_AES_128_CBC)
+   {
+      return &EVP_aes_128_cbc;
+   }
+   return &EVP_aes_256_cbc;
+}
+
+static void
+gcm_put_le32(unsigned char* p, uint32_t v)
+{
+   p[0] = v & 0xFF;
+   p[1] = (v >> 8) & 0xFF;
+   p[2] = (v >> 16) & 0xFF;
+   p[3] = (v >> 24) & 0xFF;
+}
+
+static uint32_t
+gcm_get_le32(unsigned char* p)
+{
+   return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static int
+gcm_chunk(EVP_CIPHER_CTX* ctx, unsigned char* key, unsigned char* prefix, uint32_t index, bool last, int enc,
+          unsigned char* in, int in_length, unsigned char* out, unsigned char* tag)
+{
+   unsigned char nonce[GCM_NONCE_LENGTH];
+   unsigned char aad[5];
+   int outl = 0;
+   int f_len = 0;
+
+   memcpy(&nonce[0], prefix, GCM_NONCE_PREFIX_LENGTH);
+   nonce[8] = (index >> 24) & 0xFF;
+   nonce[9] = (index >> 16) & 0xFF;
+   nonce[10] = (index >> 8) & 0xFF;
+   nonce[11] = index & 0xFF;
+
+   gcm_put_le32(&aad[0], index);
+   aad[4] = last ? 1 : 0;
+
+   EVP_CIPHER_CTX_reset(ctx);
+
+   if (EVP_CipherInit_ex(ctx, EVP_aes_256_gcm(), NULL, NULL, NULL, enc) == 0 ||
+       EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, GCM_NONCE_LENGTH, NULL) == 0 ||
+       EVP_CipherInit_ex(ctx, NULL, NULL, key, &nonce[0], enc) == 0)
+   {
+      goto error;
+   }
+
+   if (EVP_CipherUpdate(ctx, NULL, &outl, &aad[0], sizeof(aad)) == 0)
+   {
+      goto error;
+   }
+
+   outl = 0;
+   if (in_length > 0 && EVP_CipherUpdate(ctx, out, &outl, in, in_length) == 0)
+   {
+      goto error;
+   }
+
+   if (!enc && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, GCM_TAG_LENGTH, tag) == 0)
+   {
+      goto error;
+   }
+
+   /* Fails on decryption when the tag does not match */
+   if (EVP_CipherFinal_ex(ctx, out + outl, &f_len) == 0)
+   {
+      goto error;
+   }
+
+   if (enc && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, GCM_TAG_LENGTH, tag) == 0)
+   {
+      goto error;
+   }
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+static bool
+gcm_is_file(FILE* in)
+{
+   char magic[GCM_MAGIC_LENGTH];
+   bool gcm;
+
+   gcm = fread(&magic[0], 1, GCM_MAGIC_LENGTH, in) == GCM_MAGIC_LENGTH &&
+         memcmp(&magic[0], GCM_MAGIC, GCM_MAGIC_LENGTH) == 0;
+
+   rewind(in);
+
+   return gcm;
+}
+
+static bool
+gcm_is_last(FILE* in)
+{
+   int c;
+
+   c = getc(in);
+   if (c == EOF)
+   {
+      return true;
+   }
+
+   ungetc(c, in);
+
+   return false;
+}
+
+static int
+gcm_encrypt_stream(FILE* in, FILE* out, unsigned char* key, struct aes_context* actx)
+{
+   unsigned char header[GCM_HEADER_LENGTH];
+   unsigned char length[4];
+   unsigned char tag[GCM_TAG_LENGTH];
+   unsigned char* prefix = &header[GCM_MAGIC_LENGTH + 4];
+   uint32_t index = 0;
+   size_t inl;
+   bool last;
+
+   memcpy(&header[0], GCM_MAGIC, GCM_MAGIC_LENGTH);
+   gcm_put_le32(&header[GCM_MAGIC_LENGTH], ENC_BUF_SIZE);
+   if (RAND_bytes(prefix, GCM_NONCE_PREFIX_LENGTH) != 1)
+   {
+      goto error;
+   }
+
+   if (fwrite(&header[0], 1, sizeof(header), out) != sizeof(header))
+   {
+      goto error;
+   }
+
+   do
+   {
+      inl = fread(actx->inbuf, 1, ENC_BUF_SIZE, in);
+      if (ferror(in))
+      {
+         goto error;
+      }
+
+      last = inl < ENC_BUF_SIZE || gcm_is_last(in);
+
+      if (gcm_chunk(actx->ctx, key, prefix, index, last, 1, actx->inbuf, (int)inl, actx->outbuf, &tag[0]))
+      {
+         goto error;
+      }
+
+      gcm_put_le32(&length[0], (uint32_t)inl);
+
+      if (fwrite(&length[0], 1, sizeof(length), out) != sizeof(length) ||
+          fwrite(actx->outbuf, 1, inl, out) != inl ||
+          fwrite(&tag[0], 1, sizeof(tag), out) != sizeof(tag))
+      {
+         goto error;
+      }
+
+      index++;
+   }
+   while (!last);
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+static int
+gcm_decrypt_stream(FILE* in, FILE* out, unsigned char* key, struct aes_context* actx)
+{
+   unsigned char header[GCM_HEADER_LENGTH];
+   unsigned char length[4];
+   unsigned char tag[GCM_TAG_LENGTH];
+   unsigned char* prefix = &header[GCM_MAGIC_LENGTH + 4];
+   uint32_t chunk_size;
+   uint32_t inl;
+   uint32_t index = 0;
+   bool last;
+
+   if (fread(&header[0], 1, sizeof(header), in) != sizeof(header) ||
+       memcmp(&header[0], GCM_MAGIC, GCM_MAGIC_LENGTH) != 0)
+   {
+      goto error;
+   }
+
+   chunk_size = gcm_get_le32(&header[GCM_MAGIC_LENGTH]);
+   if (chunk_size == 0 || chunk_size > ENC_BUF_SIZE)
+   {
+      goto error;
+   }
+
+   do
+   {
+      if (fread(&length[0], 1, sizeof(length), in) != sizeof(length))
+      {
+         goto error;
+      }
+
+      inl = gcm_get_le32(&length[0]);
+      if (inl > chunk_size)
+      {
+         goto error;
+      }
+
+      if (fread(actx->inbuf, 1, inl, in) != inl ||
+          fread(&tag[0], 1, sizeof(tag), in) != sizeof(tag))
+      {
+         goto error;
+      }
+
+      last = gcm_is_last(in);
+
+      if (gcm_chunk(actx->ctx, key, prefix, index, last, 0, actx->inbuf, (int)inl, actx->outbuf, &tag[0]))
+      {
+         goto error;
+      }
+
+      if (fwrite(actx->outbuf, 1, inl, out) != inl)
+      {
+         goto error;
+      }
+
+      index++;
+   }
+   while (!last);
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+static int
+gcm_encrypt_buffer(unsigned char* origin_buffer, size_t origin_size, unsigned char** res_buffer, size_t* res_size, unsigned char* key)
+{
+   unsigned char* buffer = NULL;
+   unsigned char* prefix = NULL;
+   struct aes_context* actx = NULL;
+   size_t chunks;
+   size_t position = 0;
+   size_t offset = 0;
+   uint32_t index = 0;
+   bool last;
+
+   *res_buffer = NULL;
+   *res_size = 0;
+
+   actx = aes_context_get();
+   if (actx == NULL)
+   {
+      goto error;
+   }
+
+   chunks = origin_size / ENC_BUF_SIZE + 1;
+
+   buffer = (unsigned char*)malloc(GCM_HEADER_LENGTH + chunks * GCM_CHUNK_OVERHEAD + origin_size);
+   if (buffer == NULL)
+   {
+      goto error;
+   }
+
+   memcpy(buffer, GCM_MAGIC, GCM_MAGIC_LENGTH);
+   gcm_put_le32(buffer + GCM_MAGIC_LENGTH, ENC_BUF_SIZE);
+   prefix = buffer + GCM_MAGIC_LENGTH + 4;
+   if (RAND_bytes(prefix, GCM_NONCE_PREFIX_LENGTH) != 1)
+   {
+      goto error;
+   }
+   position = GCM_HEADER_LENGTH;
+
+   do
+   {
+      size_t inl = MIN(origin_size - offset, (size_t)ENC_BUF_SIZE);
+
+      last = offset + inl == origin_size;
+
+      gcm_put_le32(buffer + position, (uint32_t)inl);
+
+      if (gcm_chunk(actx->ctx, key, prefix, index, last, 1, origin_buffer + offset, (int)inl,
+                    buffer + position + 4, buffer + position + 4 + inl))
+      {
+         goto error;
+      }
+
+      position += GCM_CHUNK_OVERHEAD + inl;
+      offset += inl;
+      index++;
+   }
+   while (!last);
+
+   EVP_CIPHER_CTX_reset(actx->ctx);
+
+   *res_buffer = buffer;
+   *res_size = position;
+
+   return 0;
+
+error:
+
+   if (actx != NULL)
+   {
+      EVP_CIPHER_CTX_reset(actx->ctx);
+   }
+
+   free(buffer);
+
+   return 1;
+}
+
+static int
+aes_split(char* from, char* to, int enc, struct workers* workers)
+{
+   int in = -1;
+   int out = -1;
+   int mode;
+   uint64_t input_size;
+   uint64_t output_size;
+   uint64_t total;
+   uint64_t step;
+   unsigned char header[GCM_HEADER_LENGTH];
+   struct stat st;
+   struct aes_job* job = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (workers == NULL || workers->number_of_alive < 2 || !workers->outcome)
+   {
+      return 1;
+   }
+
+   if (stat(from, &st) || st.st_size < ENC_PARALLEL_THRESHOLD)
+   {
+      return 1;
+   }
+
+   input_size = (uint64_t)st.st_size;
+
+   in = open(from, O_RDONLY);
+   if (in == -1)
+   {
+      return 1;
+   }
+
+   job = (struct aes_job*)malloc(sizeof(struct aes_job));
+   if (job == NULL)
+   {
+      goto fallback;
+   }
+
+   memset(job, 0, sizeof(struct aes_job));
+   snprintf(&job->from[0], sizeof(job->from), "%s", from);
+   snprintf(&job->to[0], sizeof(job->to), "%s", to);
+   job->enc = enc;
+
+   if (enc)
+   {
+      job->gcm = config->encryption == ENCRYPTION_AES_256_GCM;
+   }
+   else
+   {
+      job->gcm = aes_pread(in, &header[0], sizeof(header), 0) == 0 &&
+                 memcmp(&header[0], GCM_MAGIC, GCM_MAGIC_LENGTH) == 0;
+   }
+
+   mode = job->gcm ? ENCRYPTION_AES_256_GCM : config->encryption;
+
+   /* CBC chains the blocks, so only CTR and GCM can be split */
+   if (mode != ENCRYPTION_AES_256_CTR && mode != ENCRYPTION_AES_192_CTR &&
+       mode != ENCRYPTION_AES_128_CTR && mode != ENCRYPTION_AES_256_GCM)
+   {
+      goto fallback;
+   }
+
+   if (file_key_iv(enc ? to : from, mode, job->key, job->iv))
+   {
+      goto fallback;
+   }
+
+   if (job->gcm)
+   {
+      if (enc)
+      {
+         job->size = input_size;
+         job->chunks = input_size == 0 ? 1 : (input_size + ENC_BUF_SIZE - 1) / ENC_BUF_SIZE;
+         output_size = GCM_HEADER_LENGTH + (uint64_t)job->chunks * GCM_CHUNK_OVERHEAD + input_size;
+
+         memcpy(&header[0], GCM_MAGIC, GCM_MAGIC_LENGTH);
+         gcm_put_le32(&header[GCM_MAGIC_LENGTH], ENC_BUF_SIZE);
+         if (RAND_bytes(&header[GCM_MAGIC_LENGTH + 4], GCM_NONCE_PREFIX_LENGTH) != 1)
+         {
+            goto fallback;
+         }
+      }
+      else
+      {
+         uint64_t payload;
+         uint64_t last;
+
+         /* Only files written with this chunk size are split */
+         if (gcm_get_le32(&header[GCM_MAGIC_LENGTH]) != ENC_BUF_SIZE || input_size <= GCM_HEADER_LENGTH)
+         {
+            goto fallback;
+         }
+
+         payload = input_size - GCM_HEADER_LENGTH;
+         job->chunks = (payload + ENC_BUF_SIZE + GCM_CHUNK_OVERHEAD - 1) / (ENC_BUF_SIZE + GCM_CHUNK_OVERHEAD);
+         last = payload - (uint64_t)(job->chunks - 1) * (ENC_BUF_SIZE + GCM_CHUNK_OVERHEAD);
+         if (last < GCM_CHUNK_OVERHEAD)
+         {
+            goto fallback;
+         }
+
+         job->size = payload - (uint64_t)job->chunks * GCM_CHUNK_OVERHEAD;
+         output_size = job->size;
+      }
+
+      memcpy(&job->prefix[0], &header[GCM_MAGIC_LENGTH + 4], GCM_NONCE_PREFIX_LENGTH);
+      total = job->chunks;
+      step = ENC_RANGE_SIZE / ENC_BUF_SIZE;
+   }
+   else
+   {
+      job->cipher = get_cipher(mode)();
+      job->size = input_size;
+      output_size = input_size;
+      total = input_size;
+      step = ENC_RANGE_SIZE;
+   }
+
+   out = open(to, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+   if (out == -1)
+   {
+      goto fallback;
+   }
+
+   if (ftruncate(out, (off_t)output_size) ||
+       (job->gcm && enc && aes_pwrite(out, &header[0], sizeof(header), 0)))
+   {
+      goto fallback;
+   }
+
+   close(in);
+   close(out);
+   in = -1;
+   out = -1;
+
+   atomic_init(&job->remaining, (int)((total + step - 1) / step));
+   atomic_init(&job->failed, false);
+
+   for (uint64_t start = 0; start < total; start += step)
+   {
+      struct aes_range* range = NULL;
+
+      range = (struct aes_range*)malloc(sizeof(struct aes_range));
+      if (range == NULL)
+      {
+         /* Account for the ranges that are never queued */
+         int unqueued = (int)((total - start + step - 1) / step);
+
+         atomic_store(&job->failed, true);
+         if (atomic_fetch_sub(&job->remaining, unqueued) == unqueued)
+         {
+            remove(job->to);
+            OPENSSL_cleanse(job, sizeof(struct aes_job));
+            free(job);
+         }
+         workers->outcome = false;
+         break;
+      }
+
+      memset(range, 0, sizeof(struct aes_range));
+      range->common.workers = workers;
+      range->job = job;
+      range->start = start;
+      range->end = MIN(start + step, total);
+      range->common.size = (size_t)(job->gcm ? (range->end - range->start) * ENC_BUF_SIZE : range->end - range->start);
+
+      pgmoneta_workers_add(workers, do_aes_range, (struct worker_common*)range);
+   }
+
+   return 0;
+
+fallback:
+
+   if (in != -1)
+   {
+      close(in);
+   }
+
+   if (out != -1)
+   {
+      close(out);
+      remove(to);
+   }
+
+   if (job != NULL)
+   {
+      OPENSSL_cleanse(job, sizeof(struct aes_job));
+   }
+   free(job);
+
+   return 1;
+}
+
+static void
+do_aes_range(struct worker_common* wc)
+{
+   struct aes_range* range = (struct aes_range*)wc;
+   struct aes_job* job = range->job;
+   struct aes_context* actx = NULL;
+   int in = -1;
+   int out = -1;
+   int ret = 1;
+
+   if (atomic_load(&job->failed))
+   {
+      goto done;
+   }
+
+   actx = aes_context_get();
+   in = open(job->from, O_RDONLY);
+   out = open(job->to, O_WRONLY);
+
+   if (actx != NULL && in != -1 && out != -1)
+   {
+      if (job->gcm)
+      {
+         ret = gcm_range(job, actx, in, out, range->start, range->end);
+      }
+      else
+      {
+         ret = ctr_range(job, actx, in, out, range->start, range->end);
+      }
+
+      EVP_CIPHER_CTX_reset(actx->ctx);
+   }
+
+   if (ret)
+   {
+      atomic_store(&job->failed, true);
+   }
+
+done:
+
+   if (in != -1)
+   {
+      close(in);
+   }
+
+   if (out != -1)
+   {
+      close(out);
+   }
+
+   /* The last range finishes the file */
+   if (atomic_fetch_sub(&job->remaining, 1) == 1)
+   {
+      if (!atomic_load(&job->failed))
+      {
+         pgmoneta_delete_file(job->from, NULL);
+      }
+      else
+      {
+         pgmoneta_log_warn("%s: %s -> %s", job->enc ? "do_encrypt_file" : "do_decrypt_file", job->from, job->to);
+         remove(job->to);
+      }
+
+      OPENSSL_cleanse(job, sizeof(struct aes_job));
+      free(job);
+   }
+
+   free(range);
+}
+
+static int
+ctr_range(struct aes_job* job, struct aes_context* actx, int in, int out, uint64_t start, uint64_t end)
+{
+   unsigned char counter[EVP_MAX_IV_LENGTH];
+   int outl = 0;
+
+   /* The counter of a block is the IV plus the block number */
+   memset(&counter[0], 0, sizeof(counter));
+   ctr_counter(job->iv, start / 16, &counter[0]);
+
+   if (EVP_CipherInit_ex(actx->ctx, job->cipher, NULL, job->key, &counter[0], job->enc) == 0)
+   {
+      goto error;
+   }
+
+   for (uint64_t offset = start; offset < end; offset += ENC_BUF_SIZE)
+   {
+      size_t length = MIN(end - offset, (uint64_t)ENC_BUF_SIZE);
+
+      if (aes_pread(in, actx->inbuf, length, (off_t)offset))
+      {
+         goto error;
+      }
+
+      if (EVP_CipherUpdate(actx->ctx, actx->outbuf, &outl, actx->inbuf, (int)length) == 0 || (size_t)outl != length)
+      {
+         goto error;
+      }
+
+      if (aes_pwrite(out, actx->outbuf, length, (off_t)offset))
+      {
+         goto error;
+      }
+   }
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+static int
+gcm_range(struct aes_job* job, struct aes_context* actx, int in, int out, uint64_t start, uint64_t end)
+{
+   for (uint64_t chunk = start; chunk < end; chunk++)
+   {
+      bool last = chunk == job->chunks - 1;
+      uint64_t plain_offset = chunk * ENC_BUF_SIZE;
+      uint64_t cipher_offset = GCM_HEADER_LENGTH + chunk * (ENC_BUF_SIZE + GCM_CHUNK_OVERHEAD);
+      uint32_t length = (uint32_t)(last ? job->size - plain_offset : ENC_BUF_SIZE);
+
+      if (job->enc)
+      {
+         /* Build length | ciphertext | tag in the output buffer */
+         if (aes_pread(in, actx->inbuf, length, (off_t)plain_offset))
+         {
+            goto error;
+         }
+
+         gcm_put_le32(actx->outbuf, length);
+
+         if (gcm_chunk(actx->ctx, job->key, job->prefix, (uint32_t)chunk, last, 1, actx->inbuf, (int)length,
+                       actx->outbuf + 4, actx->outbuf + 4 + length))
+         {
+            goto error;
+         }
+
+         if (aes_pwrite(out, actx->outbuf, length + GCM_CHUNK_OVERHEAD, (off_t)cipher_offset))
+         {
+            goto error;
+         }
+      }
+      else
+      {
+         if (aes_pread(in, actx->inbuf, length + GCM_CHUNK_OVERHEAD, (off_t)cipher_offset))
+         {
+            goto error;
+         }
+
+         if (gcm_get_le32(actx->inbuf) != length)
+         {
+            goto error;
+         }
+
+         if (gcm_chunk(actx->ctx, job->key, job->prefix, (uint32_t)chunk, last, 0, actx->inbuf + 4, (int)length,
+                       actx->outbuf, actx->inbuf + 4 + length))
+         {
+            goto error;
+         }
+
+         if (aes_pwrite(out, actx->outbuf, length, (off_t)plain_offset))
+         {
+            goto error;
+         }
+      }
+   }
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+static void
+ctr_counter(unsigned char* iv, uint64_t blocks, unsigned char* counter)
+{
+   unsigned int carry = 0;
+
+   /* 128 bit big endian addition, like the OpenSSL CTR mode increment */
+   for (int i = 15; i >= 0; i--)
+   {
+      unsigned int sum = iv[i] + (unsigned int)(blocks & 0xFF) + carry;
+
+      counter[i] = sum & 0xFF;
+      carry = sum >> 8;
+      blocks >>= 8;
+   }
+}
+
+static int
+aes_pread(int fd, void* buffer, size_t size, off_t offset)
+{
+   size_t done = 0;
+
+   while (done < size)
+   {
+      ssize_t n = pread(fd, (char*)buffer + done, size - done, offset + done);
+
+      if (n <= 0)
+      {
+         return 1;
+      }
+
+      done += n;
+   }
+
+   return 0;
+}
+
+static int
+aes_pwrite(int fd, void* buffer, size_t size, off_t offset)
+{
+   size_t done = 0;
+
+   while (done < size)
+   {
+      ssize_t n = pwrite(fd, (char*)buffer + done, size - done, offset + done);
+
+      if (n <= 0)
+      {
+         return 1;
+      }
+
+      done += n;
+   }
+
+   return 0;
+}
+
+static int
+decrypt_reader_read(struct reader* reader, void* buffer, size_t size, size_t* read)
+{
+   struct decrypt_reader* dr = (struct decrypt_reader*)reader->state;
+   size_t n;
+
+   *read = 0;
+
+   while (dr->out_pos == dr->out_length)
+   {
+      if (dr->done)
+      {
+         return 0;
+      }
+
+      dr->out_pos = 0;
+      dr->out_length = 0;
+
+      if (decrypt_reader_next(reader, dr))
+      {
+         return 1;
+      }
+   }
+
+   n = MIN(size, dr->out_length - dr->out_pos);
+   memcpy(buffer, dr->out + dr->out_pos, n);
+   dr->out_pos += n;
+
+   *read = n;
+
+   return 0;
+}
+
+static int
+decrypt_reader_next(struct reader* reader, struct decrypt_reader* dr)
+{
+   size_t n = 0;
+   int outl = 0;
+
+   if (dr->gcm)
+   {
+      uint32_t inl;
+      bool last;
+
+      inl = gcm_get_le32(&dr->length[0]);
+      if (inl > dr->chunk_size)
+      {
+         goto error;
+      }
+
+      if (pgmoneta_reader_fill(reader->source, dr->in, inl + GCM_TAG_LENGTH, &n) || n != inl + GCM_TAG_LENGTH)
+      {
+         goto error;
+      }
+
+      /* The chunk is the last one when no length field follows it */
+      if (pgmoneta_reader_fill(reader->source, &dr->length[0], sizeof(dr->length), &n))
+      {
+         goto error;
+      }
+
+      if (n != 0 && n != sizeof(dr->length))
+      {
+         goto error;
+      }
+
+      last = n == 0;
+
+      if (gcm_chunk(dr->ctx, dr->key, dr->prefix, dr->index, last, 0, dr->in, (int)inl, dr->out, dr->in + inl))
+      {
+         pgmoneta_log_error("AES-GCM: Authentication failed for chunk %u", dr->index);
+         goto error;
+      }
+
+      dr->out_length = inl;
+      dr->index++;
+      dr->done = last;
+   }
+   else
+   {
+      if (pgmoneta_reader_read(reader->source, dr->in, dr->in_size, &n))
+      {
+         goto error;
+      }
+
+      if (n > 0)
+      {
+         if (EVP_CipherUpdate(dr->ctx, dr->out, &outl, dr->in, (int)n) == 0)
+         {
+            goto error;
+         }
+      }
+      else
+      {
+         if (EVP_CipherFinal_ex(dr->ctx, dr->out, &outl) == 0)
+         {
+            pgmoneta_log_error("EVP_CipherFinal_ex: failed to process final cipher block");
+            goto error;
+         }
+         dr->done = true;
+      }
+
+      dr->out_length = (size_t)outl;
+   }
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+static void
+decrypt_reader_close(struct reader* reader)
+{
+   struct decrypt_reader* dr = (struct decrypt_reader*)reader->state;
+
+   if (dr == NULL)
+   {
+      return;
+   }
+
+   if (dr->ctx != NULL)
+   {
+      EVP_CIPHER_CTX_free(dr->ctx);
+   }
+
+   if (dr->out != NULL)
+   {
+      OPENSSL_cleanse(dr->out, dr->gcm ? dr->chunk_size : dr->in_size + EVP_MAX_BLOCK_LENGTH);
+   }
+
+   free(dr->in);
+   free(dr->out);
+
+   OPENSSL_cleanse(dr, sizeof(struct decrypt_reader));
+   free(dr);
+
+   reader->state = NULL;
+}
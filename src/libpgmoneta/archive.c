@@ -30,39 +30,194 @@
 #include <pgmoneta.h>
 #include <achv.h>
 #include <gzip_compression.h>
+#include <json.h>
+#include <lock.h>
 #include <logging.h>
 #include <lz4_compression.h>
 #include <management.h>
 #include <manifest.h>
+#include <memory.h>
 #include <network.h>
+#include <page.h>
+#include <profile.h>
+#include <progress.h>
+#include <prometheus.h>
+#include <reader.h>
 #include <restore.h>
 #include <security.h>
+#include <trace.h>
 #include <utils.h>
+#include <workers.h>
 #include <workflow.h>
 #include <zstandard_compression.h>
 
 #include <archive.h>
 #include <archive_entry.h>
+#include <bzlib.h>
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <lz4frame.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <zstd.h>
 
 #define NAME "archive"
 
+#define PIPELINE_CHUNK_SIZE (1024 * 1024)
+
+#define PIPELINE_JOB_WRITE  0
+#define PIPELINE_JOB_FINISH 1
+
+#define TAR_BLOCK_SIZE (4 * 1024 * 1024)
+
+#define TAR_HEADER_SIZE     512
+#define TAR_PREALLOCATE_MIN (64 * 1024)
+
+/** @struct tar_block
+ * Defines a block of a tar stream that is compressed on its own
+ */
+struct tar_block
+{
+   struct worker_common common; /**< The common base */
+   int type;                    /**< The compression type */
+   int level;                   /**< The compression level */
+   char* data;                  /**< The plain data */
+   size_t size;                 /**< The size of the plain data */
+   char* compressed;            /**< The compressed data */
+   size_t capacity;             /**< The capacity of the compressed data */
+   size_t compressed_size;      /**< The size of the compressed data */
+};
+
+/** @struct tar_blocks
+ * Defines a tar stream that is compressed in parallel. Each block becomes a
+ * gzip member or a zstd, lz4 or bzip2 frame, and the concatenation is a valid file
+ */
+struct tar_blocks
+{
+   int fd;                   /**< The descriptor */
+   bool owned;               /**< Is the descriptor closed at the end */
+   struct workers* workers;  /**< The workers */
+   int number_of_blocks;     /**< The number of blocks in a batch */
+   int current;              /**< The block being filled */
+   struct tar_block* blocks; /**< The blocks */
+};
+
+/** @struct tar_extract
+ * Defines a tar stream that is extracted while it is received. The members
+ * are written with pwrite straight from the received data
+ */
+struct tar_extract
+{
+   char directory[MAX_PATH];           /**< The directory to extract into */
+   char header[TAR_HEADER_SIZE];       /**< The header being received */
+   size_t header_size;                 /**< The received size of the header */
+   char path[MAX_PATH];                /**< The member being written */
+   int fd;                             /**< The descriptor of the member, or -1 */
+   bool long_name;                     /**< Is the member the name of the next member */
+   char name[MAX_PATH];                /**< The name of the next member */
+   uint64_t remaining;                 /**< The bytes left of the member */
+   uint64_t offset;                    /**< The offset in the member */
+   uint64_t padding;                   /**< The padding left after the member */
+   bool done;                          /**< Has the end of the archive been received */
+   struct page_checksums* checksums;   /**< The verification of the page checksums, or NULL */
+   bool relation;                      /**< Are the pages of the member verified */
+   uint32_t block_number;              /**< The block number of the next page */
+   uint32_t failed;                    /**< The pages of the member with a wrong checksum */
+   unsigned char* page;                /**< The page being received */
+   size_t page_size;                   /**< The received size of the page */
+};
+
+/** @struct pipeline_job
+ * Defines a job for the backup writer thread
+ */
+struct pipeline_job
+{
+   int type;                   /**< The type of job */
+   FILE* file;                 /**< The file */
+   struct tar_extract* extract; /**< The tar stream extracted instead of writing the file, or NULL */
+   char* data;                 /**< The data to write */
+   size_t size;                /**< The size of the data */
+   bool pad;                   /**< Append the tar terminator before closing */
+   char file_path[MAX_PATH];   /**< The tar file to extract */
+   char directory[MAX_PATH];   /**< The directory to extract into */
+};
+
+/** @struct pipeline
+ * Defines the bounded queue between the network thread and the backup writer thread
+ */
+struct pipeline
+{
+   int server;                  /**< The server */
+   pthread_t thread;            /**< The writer thread */
+   pthread_mutex_t lock;        /**< The lock */
+   pthread_cond_t changed;      /**< Signaled when the queue changes */
+   struct pipeline_job* jobs;   /**< The queued jobs */
+   int capacity;                /**< The capacity of the queue */
+   int head;                    /**< The first queued job */
+   int count;                   /**< The number of queued jobs */
+   bool busy;                   /**< Is the writer executing a job */
+   bool done;                   /**< No more jobs will be queued */
+   bool abort;                  /**< Skip the remaining writes */
+   atomic_bool failed;          /**< Has a job failed */
+   FILE* chunk_file;            /**< The file of the chunk being filled */
+   struct tar_extract* chunk_extract; /**< The tar stream of the chunk being filled */
+   char* chunk;                 /**< The chunk being filled */
+   size_t chunk_size;           /**< The used size of the chunk */
+};
+
 static bool is_server_side_compression(void);
+static int server_side_filter(struct archive* a);
+
+static int pipeline_create(int server, struct pipeline** pipeline);
+static int pipeline_write(struct pipeline* pipeline, FILE* file, struct tar_extract* extract, void* data, size_t size);
+static int pipeline_finish(struct pipeline* pipeline, FILE* file, struct tar_extract* extract, bool pad, char* file_path, char* directory);
+static int pipeline_drain(struct pipeline* pipeline);
+static void pipeline_destroy(struct pipeline* pipeline, bool abort);
+static int pipeline_enqueue(struct pipeline* pipeline, struct pipeline_job* job);
+static int pipeline_flush(struct pipeline* pipeline);
+static int pipeline_execute(struct pipeline_job* job);
+static void* pipeline_run(void* arg);
 
 static void write_tar_file(struct archive* a, char* src, char* dst);
 
+static int tar_extract_create(char* directory, struct page_checksums* checksums, struct tar_extract** extract);
+static int tar_extract_write(struct tar_extract* extract, char* data, size_t size);
+static void tar_extract_verify(struct tar_extract* extract, unsigned char* data, size_t size);
+static void tar_extract_verified(struct tar_extract* extract);
+static int tar_extract_header(struct tar_extract* extract);
+static int tar_extract_finish(struct tar_extract* extract);
+static void tar_extract_destroy(struct tar_extract* extract);
+static uint64_t tar_number(char* field, size_t size);
+
+static int tar_filter(struct archive* a);
+static int tar_blocks_create(int fd, bool owned, struct workers* workers, struct tar_blocks** blocks);
+static void tar_blocks_destroy(struct tar_blocks* blocks);
+static la_ssize_t tar_blocks_write(struct archive* a, void* client_data, const void* buffer, size_t length);
+static int tar_blocks_close(struct archive* a, void* client_data);
+static int tar_blocks_flush(struct tar_blocks* blocks);
+static void tar_block_compress(struct worker_common* wc);
+static int tar_sizes(char* source, struct art** sizes);
+static int tar_backup_directory(struct archive* a, char* root, char* relative, char* destination,
+                                struct art* sizes, struct art* written, bool overlay, void* buffer);
+static int tar_backup_file(struct archive* a, char* path, char* name, struct stat* s, int64_t size, void* buffer);
+
 void
 pgmoneta_archive(SSL* ssl __attribute__((unused)), int client_fd, int server, uint8_t compression, uint8_t encryption, struct json* payload)
 {
-   bool active = false;
    char* identifier = NULL;
    char* position = NULL;
    char* directory = NULL;
    char* elapsed = NULL;
    char* real_directory = NULL;
+   char* data = NULL;
    struct timespec start_t;
    struct timespec end_t;
    double total_seconds;
@@ -74,6 +229,7 @@ pgmoneta_archive(SSL* ssl __attribute__((unused)), int client_fd, int server, ui
    struct art* nodes = NULL;
    struct json* req = NULL;
    struct json* response = NULL;
+   struct lock* lock = NULL;
    struct main_configuration* config;
 
    pgmoneta_start_logging();
@@ -86,7 +242,7 @@ pgmoneta_archive(SSL* ssl __attribute__((unused)), int client_fd, int server, ui
    clock_gettime(CLOCK_MONOTONIC_RAW, &start_t);
 #endif
 
-   if (!atomic_compare_exchange_strong(&config->common.servers[server].repository, &active, true))
+   if (pgmoneta_lock_repository(server, LOCK_SHARED, &lock))
    {
       pgmoneta_log_info("Archive: Server %s is active", config->common.servers[server].name);
       pgmoneta_management_response_error(NULL, client_fd, config->common.servers[server].name, MANAGEMENT_ERROR_ARCHIVE_ACTIVE, NAME, compression, encryption, payload);
@@ -131,6 +287,13 @@ pgmoneta_archive(SSL* ssl __attribute__((unused)), int client_fd, int server, ui
       goto error;
    }
 
+   if (pgmoneta_lock_backup_chain(lock, backup))
+   {
+      pgmoneta_log_info("Archive: %s/%s is active", config->common.servers[server].name, backup->label);
+      pgmoneta_management_response_error(NULL, client_fd, config->common.servers[server].name, MANAGEMENT_ERROR_ARCHIVE_ACTIVE, NAME, compression, encryption, payload);
+      goto error;
+   }
+
    real_directory = pgmoneta_append(real_directory, directory);
    if (!pgmoneta_ends_with(real_directory, "/"))
    {
@@ -152,6 +315,17 @@ pgmoneta_archive(SSL* ssl __attribute__((unused)), int client_fd, int server, ui
       goto error;
    }
 
+   /* A full backup is streamed into the archive, the others are restored first */
+   data = pgmoneta_get_server_backup_identifier_data(server, backup->label);
+   if (backup->type == TYPE_FULL && backup->number_of_tablespaces == 0 && pgmoneta_exists(data) &&
+       (position == NULL || (strstr(position, "database=") == NULL && strstr(position, "relation=") == NULL)))
+   {
+      if (pgmoneta_art_insert(nodes, NODE_ARCHIVE_SOURCE, (uintptr_t)data, ValueString))
+      {
+         goto error;
+      }
+   }
+
    if (!pgmoneta_restore_backup(nodes))
    {
       workflow = pgmoneta_workflow_create(WORKFLOW_TYPE_ARCHIVE, server, backup);
@@ -223,7 +397,7 @@ pgmoneta_archive(SSL* ssl __attribute__((unused)), int client_fd, int server, ui
    pgmoneta_disconnect(client_fd);
 
    config->common.servers[server].active_archive = false;
-   atomic_store(&config->common.servers[server].repository, false);
+   pgmoneta_unlock(lock);
 
 done:
 
@@ -232,6 +406,7 @@ done:
    free(label);
    free(output);
    free(real_directory);
+   free(data);
 
    exit(0);
 
@@ -246,13 +421,14 @@ error:
    pgmoneta_disconnect(client_fd);
 
    config->common.servers[server].active_archive = false;
-   atomic_store(&config->common.servers[server].repository, false);
+   pgmoneta_unlock(lock);
 
    pgmoneta_stop_logging();
 
    free(label);
    free(output);
    free(real_directory);
+   free(data);
 
    exit(1);
 }
@@ -265,12 +441,19 @@ pgmoneta_extract_tar_file(char* file_path, char* destination)
    struct archive_entry* entry;
    struct main_configuration* config;
 
+   PGMONETA_PROFILE(PROFILE_TAR_EXTRACT);
+
    config = (struct main_configuration*)shmem;
 
    a = archive_read_new();
    archive_read_support_format_tar(a);
 
-   if (config->compression_type == COMPRESSION_SERVER_GZIP)
+   if (is_server_side_compression() && !server_side_filter(a))
+   {
+      /* Decompress the server side compressed stream while extracting */
+      archive_name = pgmoneta_append(archive_name, file_path);
+   }
+   else if (config->compression_type == COMPRESSION_SERVER_GZIP)
    {
       archive_name = pgmoneta_append(archive_name, file_path);
       archive_name = pgmoneta_append(archive_name, ".gz");
@@ -323,6 +506,12 @@ pgmoneta_extract_tar_file(char* file_path, char* destination)
          pgmoneta_log_error("Failed to extract entry: %s", archive_error_string(a));
          goto error;
       }
+
+      if (archive_entry_filetype(entry) == AE_IFREG)
+      {
+         pgmoneta_progress_add(0, 1);
+         pgmoneta_drop_cache(dst_file_path);
+      }
    }
 
    free(archive_name);
@@ -369,18 +558,142 @@ error:
 }
 
 int
-pgmoneta_receive_archive_files(SSL* ssl, int socket, struct stream_buffer* buffer, char* basedir, struct tablespace* tablespaces, struct token_bucket* bucket, struct token_bucket* network_bucket)
+pgmoneta_tar_backup(char* source, char* overlay, char* dst, int fd, char* destination, struct workers* workers)
+{
+   int status;
+   void* buffer = NULL;
+   struct archive* a = NULL;
+   struct art* sizes = NULL;
+   struct art* written = NULL;
+   struct tar_blocks* blocks = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   buffer = pgmoneta_memory_buffer_get(MEMORY_BUFFER_SIZE);
+   if (buffer == NULL)
+   {
+      goto error;
+   }
+
+   if (tar_sizes(source, &sizes))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_art_create(&written))
+   {
+      goto error;
+   }
+
+   a = archive_write_new();
+   archive_write_set_format_ustar(a);
+
+   if (workers != NULL && config->compression_type != COMPRESSION_NONE)
+   {
+      /* The blocks are compressed by the workers, so libarchive writes a plain tar stream */
+      if (dst != NULL)
+      {
+         fd = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+         if (fd == -1)
+         {
+            pgmoneta_log_error("Could not create tar file %s: %s", dst, strerror(errno));
+            goto error;
+         }
+      }
+
+      if (tar_blocks_create(fd, dst != NULL, workers, &blocks))
+      {
+         if (dst != NULL)
+         {
+            close(fd);
+         }
+         goto error;
+      }
+
+      status = archive_write_open(a, blocks, NULL, tar_blocks_write, tar_blocks_close);
+   }
+   else
+   {
+      if (tar_filter(a))
+      {
+         pgmoneta_log_error("Could not compress tar file: %s", archive_error_string(a));
+         goto error;
+      }
+
+      if (dst != NULL)
+      {
+         status = archive_write_open_filename(a, dst);
+      }
+      else
+      {
+         status = archive_write_open_fd(a, fd);
+      }
+   }
+
+   if (status != ARCHIVE_OK)
+   {
+      pgmoneta_log_error("Could not create tar file %s: %s", dst != NULL ? dst : "stream", archive_error_string(a));
+      goto error;
+   }
+
+   /* The overlay goes first, so its files are skipped in the backup */
+   if (overlay != NULL && tar_backup_directory(a, overlay, "", destination, NULL, written, true, buffer))
+   {
+      goto error;
+   }
+
+   if (tar_backup_directory(a, source, "", destination, sizes, written, false, buffer))
+   {
+      goto error;
+   }
+
+   if (archive_write_close(a) != ARCHIVE_OK)
+   {
+      pgmoneta_log_error("Could not close tar file %s: %s", dst != NULL ? dst : "stream", archive_error_string(a));
+      goto error;
+   }
+
+   archive_write_free(a);
+   tar_blocks_destroy(blocks);
+   pgmoneta_art_destroy(sizes);
+   pgmoneta_art_destroy(written);
+   pgmoneta_memory_buffer_put(buffer);
+
+   return 0;
+
+error:
+
+   if (a != NULL)
+   {
+      archive_write_free(a);
+   }
+   tar_blocks_destroy(blocks);
+   pgmoneta_art_destroy(sizes);
+   pgmoneta_art_destroy(written);
+   pgmoneta_memory_buffer_put(buffer);
+
+   return 1;
+}
+
+int
+pgmoneta_receive_archive_files(SSL* ssl, int socket, struct stream_buffer* buffer, int server, char* basedir, struct tablespace* tablespaces, struct token_bucket* bucket, struct token_bucket* network_bucket, struct page_checksums* checksums)
 {
    char directory[MAX_PATH];
    char link_path[MAX_PATH];
-   char null_buffer[2 * 512]; // 2 tar block size of terminator null bytes
-   FILE* file = NULL;
+   struct tar_extract* extract = NULL;
+   struct pipeline* pipeline = NULL;
    struct query_response* response = NULL;
    struct message* msg = (struct message*)malloc(sizeof (struct message));
    struct tuple* tup = NULL;
 
    memset(msg, 0, sizeof (struct message));
 
+   if (pipeline_create(server, &pipeline))
+   {
+      pgmoneta_log_warn("Unable to start the backup writer, writing from the network thread");
+   }
+
    // Receive the second result set
    if (pgmoneta_consume_data_row_messages(ssl, socket, buffer, &response))
    {
@@ -432,12 +745,13 @@ pgmoneta_receive_archive_files(SSL* ssl, int socket, struct stream_buffer* buffe
          }
       }
       pgmoneta_mkdir(directory);
-      file = fopen(file_path, "wb");
-      if (file == NULL)
+      // the tar stream is extracted while it is received
+      if (tar_extract_create(directory, checksums, &extract))
       {
-         pgmoneta_log_error("Could not create archive tar file");
+         pgmoneta_log_error("Could not extract archive tar file");
          goto error;
       }
+      PGMONETA_TRACE2(backup_file_start, server, file_path);
       // get the copy out response
       while (msg == NULL || msg->kind != 'H')
       {
@@ -446,8 +760,6 @@ pgmoneta_receive_archive_files(SSL* ssl, int socket, struct stream_buffer* buffe
          {
             pgmoneta_log_copyfail_message(msg);
             pgmoneta_log_error_response_message(msg);
-            fflush(file);
-            fclose(file);
             goto error;
          }
          pgmoneta_consume_copy_stream_end(buffer, msg);
@@ -459,8 +771,6 @@ pgmoneta_receive_archive_files(SSL* ssl, int socket, struct stream_buffer* buffe
          {
             pgmoneta_log_copyfail_message(msg);
             pgmoneta_log_error_response_message(msg);
-            fflush(file);
-            fclose(file);
             goto error;
          }
 
@@ -469,45 +779,29 @@ pgmoneta_receive_archive_files(SSL* ssl, int socket, struct stream_buffer* buffe
 
             if (bucket)
             {
-               while (1)
-               {
-                  if (!pgmoneta_token_bucket_consume(bucket, msg->length))
-                  {
-                     break;
-                  }
-                  else
-                  {
-                     SLEEP(500000000L)
-                  }
-               }
+               pgmoneta_token_bucket_consume(bucket, msg->length);
             }
 
             // copy data
-            if (fwrite(msg->data, msg->length, 1, file) != 1)
+            if (pipeline_write(pipeline, NULL, extract, msg->data, msg->length))
             {
                pgmoneta_log_error("could not write to file %s", file_path);
-               fflush(file);
-               fclose(file);
                goto error;
             }
+            pgmoneta_progress_add(msg->length, 0);
          }
          pgmoneta_consume_copy_stream_end(buffer, msg);
       }
-      //append two blocks of null bytes to the end of the tar file
-      memset(null_buffer, 0, 2 * 512);
-      if (fwrite(null_buffer, 2 * 512, 1, file) != 1)
+
+      if (pipeline_finish(pipeline, NULL, extract, false, file_path, directory))
       {
          pgmoneta_log_error("could not write to file %s", file_path);
-         fflush(file);
-         fclose(file);
+         extract = NULL;
          goto error;
       }
-      fflush(file);
-      fclose(file);
-
-      // extract the file
-      pgmoneta_extract_tar_file(file_path, directory);
-      remove(file_path);
+      PGMONETA_TRACE2(backup_file_done, server, file_path);
+      pgmoneta_prometheus_socket(server, SOCKET_BACKUP, socket);
+      extract = NULL;
       pgmoneta_free_message(msg);
 
       msg = NULL;
@@ -519,6 +813,13 @@ pgmoneta_receive_archive_files(SSL* ssl, int socket, struct stream_buffer* buffe
       goto error;
    }
 
+   // the tablespaces must be extracted before they are linked
+   if (pipeline_drain(pipeline))
+   {
+      pgmoneta_log_error("Backup writer failed");
+      goto error;
+   }
+
    // update symbolic link
    struct tablespace* tblspc = tablespaces;
    while (tblspc != NULL)
@@ -559,6 +860,7 @@ pgmoneta_receive_archive_files(SSL* ssl, int socket, struct stream_buffer* buffe
       goto error;
    }
 
+   pipeline_destroy(pipeline, false);
    pgmoneta_free_query_response(response);
    pgmoneta_free_message(msg);
    return 0;
@@ -569,19 +871,21 @@ error:
    {
       pgmoneta_disconnect(socket);
    }
+   pipeline_destroy(pipeline, true);
+   tar_extract_destroy(extract);
    pgmoneta_free_query_response(response);
    pgmoneta_free_message(msg);
    return 1;
 }
 
 int
-pgmoneta_receive_archive_stream(SSL* ssl, int socket, struct stream_buffer* buffer, char* basedir, struct tablespace* tablespaces, struct token_bucket* bucket, struct token_bucket* network_bucket)
+pgmoneta_receive_archive_stream(SSL* ssl, int socket, struct stream_buffer* buffer, int server, char* basedir, struct tablespace* tablespaces, struct token_bucket* bucket, struct token_bucket* network_bucket, struct page_checksums* checksums)
 {
+   struct pipeline* pipeline = NULL;
    struct query_response* response = NULL;
    struct message* msg = (struct message*)malloc(sizeof (struct message));
    struct tuple* tup = NULL;
    struct tablespace* tblspc = NULL;
-   char null_buffer[2 * 512];
    char file_path[MAX_PATH];
    char directory[MAX_PATH];
    char link_path[MAX_PATH];
@@ -592,9 +896,9 @@ pgmoneta_receive_archive_stream(SSL* ssl, int socket, struct stream_buffer* buff
    memset(link_path, 0, sizeof(link_path));
    memset(manifest_file_path, 0, sizeof(manifest_file_path));
    memset(tmp_manifest_file_path, 0, sizeof(tmp_manifest_file_path));
-   memset(null_buffer, 0, 2 * 512);
    char type;
    FILE* file = NULL;
+   struct tar_extract* extract = NULL;
 
    if (msg == NULL)
    {
@@ -603,6 +907,11 @@ pgmoneta_receive_archive_stream(SSL* ssl, int socket, struct stream_buffer* buff
 
    memset(msg, 0, sizeof(struct message));
 
+   if (pipeline_create(server, &pipeline))
+   {
+      pgmoneta_log_warn("Unable to start the backup writer, writing from the network thread");
+   }
+
    // Receive the second result set
    if (pgmoneta_consume_data_row_messages(ssl, socket, buffer, &response))
    {
@@ -637,21 +946,18 @@ pgmoneta_receive_archive_stream(SSL* ssl, int socket, struct stream_buffer* buff
             case 'n':
             {
                // append two blocks of null buffer and extract the tar file
-               if (file != NULL)
+               if (file != NULL || extract != NULL)
                {
-                  if ((!is_server_side_compression()) && fwrite(null_buffer, 2 * 512, 1, file) != 1)
+                  if (pipeline_finish(pipeline, file, extract, !is_server_side_compression(), file_path, directory))
                   {
                      pgmoneta_log_error("could not write to file %s", file_path);
-                     fflush(file);
-                     fclose(file);
                      file = NULL;
+                     extract = NULL;
                      goto error;
                   }
-                  fflush(file);
-                  fclose(file);
+                  PGMONETA_TRACE2(backup_file_done, server, file_path);
                   file = NULL;
-                  pgmoneta_extract_tar_file(file_path, directory);
-                  remove(file_path);
+                  extract = NULL;
                }
                // new tablespace or main directory tar file
                char* archive_name = pgmoneta_read_string(msg->data + 1);
@@ -708,32 +1014,42 @@ pgmoneta_receive_archive_stream(SSL* ssl, int socket, struct stream_buffer* buff
                   }
                }
                pgmoneta_mkdir(directory);
-               file = fopen(file_path, "wb");
-               if (file == NULL)
+               if (!is_server_side_compression())
                {
-                  pgmoneta_log_error("Could not create archive tar file");
-                  goto error;
+                  // a plain tar stream is extracted while it is received
+                  if (tar_extract_create(directory, checksums, &extract))
+                  {
+                     pgmoneta_log_error("Could not extract archive tar file");
+                     goto error;
+                  }
+               }
+               else
+               {
+                  file = fopen(file_path, "wb");
+                  if (file == NULL)
+                  {
+                     pgmoneta_log_error("Could not create archive tar file");
+                     goto error;
+                  }
                }
+               PGMONETA_TRACE2(backup_file_start, server, file_path);
                break;
             }
             case 'm':
             {
                // start of manifest, finish off previous data archive receiving
-               if (file != NULL)
+               if (file != NULL || extract != NULL)
                {
-                  if ((!is_server_side_compression()) && fwrite(null_buffer, 2 * 512, 1, file) != 1)
+                  if (pipeline_finish(pipeline, file, extract, !is_server_side_compression(), file_path, directory))
                   {
                      pgmoneta_log_error("could not write to file %s", file_path);
-                     fflush(file);
-                     fclose(file);
                      file = NULL;
+                     extract = NULL;
                      goto error;
                   }
-                  fflush(file);
-                  fclose(file);
+                  PGMONETA_TRACE2(backup_file_done, server, file_path);
                   file = NULL;
-                  pgmoneta_extract_tar_file(file_path, directory);
-                  remove(file_path);
+                  extract = NULL;
                }
                if (pgmoneta_ends_with(basedir, "/"))
                {
@@ -758,24 +1074,15 @@ pgmoneta_receive_archive_stream(SSL* ssl, int socket, struct stream_buffer* buff
 
                if (bucket)
                {
-                  while (1)
-                  {
-                     if (!pgmoneta_token_bucket_consume(bucket, msg->length))
-                     {
-                        break;
-                     }
-                     else
-                     {
-                        SLEEP(500000000L)
-                     }
-                  }
+                  pgmoneta_token_bucket_consume(bucket, msg->length);
                }
 
-               if (fwrite(msg->data + 1, msg->length - 1, 1, file) != 1)
+               if (pipeline_write(pipeline, file, extract, msg->data + 1, msg->length - 1))
                {
                   pgmoneta_log_error("could not write to file %s", file_path);
                   goto error;
                }
+               pgmoneta_progress_add(msg->length - 1, 0);
                break;
             }
             case 'p':
@@ -794,6 +1101,13 @@ pgmoneta_receive_archive_stream(SSL* ssl, int socket, struct stream_buffer* buff
       pgmoneta_consume_copy_stream_end(buffer, msg);
    }
 
+   // wait for the writer to extract the archives and write the manifest
+   if (pipeline_drain(pipeline))
+   {
+      pgmoneta_log_error("Backup writer failed");
+      goto error;
+   }
+
    if (file != NULL)
    {
       if (rename(tmp_manifest_file_path, manifest_file_path) != 0)
@@ -845,6 +1159,7 @@ pgmoneta_receive_archive_stream(SSL* ssl, int socket, struct stream_buffer* buff
       goto error;
    }
 
+   pipeline_destroy(pipeline, false);
    pgmoneta_free_query_response(response);
    pgmoneta_free_message(msg);
    return 0;
@@ -855,6 +1170,8 @@ error:
    {
       pgmoneta_disconnect(socket);
    }
+   pipeline_destroy(pipeline, true);
+   tar_extract_destroy(extract);
    if (file != NULL)
    {
       fflush(file);
@@ -944,9 +1261,11 @@ write_tar_file(struct archive* a, char* src, char* dst)
             while ((bytes_read = fread(buf, 1, sizeof(buf), file)) > 0)
             {
                archive_write_data(a, buf, bytes_read);
+               pgmoneta_progress_add(bytes_read, 0);
                memset(buf, 0, sizeof(buf));
             }
             fclose(file);
+            pgmoneta_progress_add(0, 1);
          }
       }
 
@@ -956,13 +1275,1560 @@ write_tar_file(struct archive* a, char* src, char* dst)
    closedir(dir);
 }
 
-static bool
-is_server_side_compression(void)
+static int
+tar_filter(struct archive* a)
 {
+   char level[16];
+   int status = ARCHIVE_OK;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
-   return config->compression_type == COMPRESSION_SERVER_GZIP ||
-          config->compression_type == COMPRESSION_SERVER_LZ4 ||
-          config->compression_type == COMPRESSION_SERVER_ZSTD;
+
+   switch (config->compression_type)
+   {
+      case COMPRESSION_CLIENT_GZIP:
+      case COMPRESSION_SERVER_GZIP:
+         status = archive_write_add_filter_gzip(a);
+         break;
+      case COMPRESSION_CLIENT_ZSTD:
+      case COMPRESSION_SERVER_ZSTD:
+         status = archive_write_add_filter_zstd(a);
+         break;
+      case COMPRESSION_CLIENT_LZ4:
+      case COMPRESSION_SERVER_LZ4:
+         status = archive_write_add_filter_lz4(a);
+         break;
+      case COMPRESSION_CLIENT_BZIP2:
+         status = archive_write_add_filter_bzip2(a);
+         break;
+      default:
+         return 0;
+   }
+
+   if (status != ARCHIVE_OK)
+   {
+      return 1;
+   }
+
+   if (config->compression_level > 0)
+   {
+      memset(&level[0], 0, sizeof(level));
+      snprintf(&level[0], sizeof(level), "%d", config->compression_level);
+
+      /* The filter keeps its default when the level is out of its range */
+      archive_write_set_filter_option(a, NULL, "compression-level", &level[0]);
+   }
+
+   return 0;
+}
+
+static int
+tar_blocks_create(int fd, bool owned, struct workers* workers, struct tar_blocks** blocks)
+{
+   int level;
+   int number_of_workers;
+   struct tar_blocks* b = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   *blocks = NULL;
+
+   number_of_workers = workers->pool != NULL ? workers->pool->number_of_workers : workers->number_of_workers;
+
+   level = config->compression_level;
+   if (level < 1)
+   {
+      level = 1;
+   }
+   else if ((config->compression_type == COMPRESSION_CLIENT_ZSTD || config->compression_type == COMPRESSION_SERVER_ZSTD) && level > 19)
+   {
+      level = 19;
+   }
+   else if (config->compression_type != COMPRESSION_CLIENT_ZSTD && config->compression_type != COMPRESSION_SERVER_ZSTD && level > 9)
+   {
+      level = 9;
+   }
+
+   b = (struct tar_blocks*)calloc(1, sizeof(struct tar_blocks));
+   if (b == NULL)
+   {
+      goto error;
+   }
+
+   b->fd = fd;
+   b->owned = owned;
+   b->workers = workers;
+   /* Two blocks per worker keep the workers busy while the batch is written */
+   b->number_of_blocks = 2 * MAX(number_of_workers, 1);
+   b->blocks = (struct tar_block*)calloc(b->number_of_blocks, sizeof(struct tar_block));
+   if (b->blocks == NULL)
+   {
+      goto error;
+   }
+
+   for (int i = 0; i < b->number_of_blocks; i++)
+   {
+      b->blocks[i].common.workers = workers;
+      b->blocks[i].common.size = TAR_BLOCK_SIZE;
+      b->blocks[i].type = config->compression_type;
+      b->blocks[i].level = level;
+      b->blocks[i].data = (char*)malloc(TAR_BLOCK_SIZE);
+      if (b->blocks[i].data == NULL)
+      {
+         goto error;
+      }
+   }
+
+   *blocks = b;
+
+   return 0;
+
+error:
+
+   pgmoneta_log_error("Could not allocate the tar blocks");
+   if (b != NULL)
+   {
+      b->owned = false;
+   }
+   tar_blocks_destroy(b);
+
+   return 1;
+}
+
+static void
+tar_blocks_destroy(struct tar_blocks* blocks)
+{
+   if (blocks == NULL)
+   {
+      return;
+   }
+
+   if (blocks->blocks != NULL)
+   {
+      for (int i = 0; i < blocks->number_of_blocks; i++)
+      {
+         free(blocks->blocks[i].data);
+         free(blocks->blocks[i].compressed);
+      }
+   }
+
+   if (blocks->owned && blocks->fd != -1)
+   {
+      close(blocks->fd);
+   }
+
+   free(blocks->blocks);
+   free(blocks);
+}
+
+static la_ssize_t
+tar_blocks_write(struct archive* a, void* client_data, const void* buffer, size_t length)
+{
+   size_t offset = 0;
+   struct tar_blocks* blocks = (struct tar_blocks*)client_data;
+
+   while (offset < length)
+   {
+      struct tar_block* block = &blocks->blocks[blocks->current];
+      size_t n = MIN(length - offset, TAR_BLOCK_SIZE - block->size);
+
+      memcpy(block->data + block->size, (char*)buffer + offset, n);
+      block->size += n;
+      offset += n;
+
+      if (block->size == TAR_BLOCK_SIZE)
+      {
+         blocks->current++;
+
+         if (blocks->current == blocks->number_of_blocks && tar_blocks_flush(blocks))
+         {
+            archive_set_error(a, EIO, "Could not write the compressed blocks");
+            return -1;
+         }
+      }
+   }
+
+   return (la_ssize_t)length;
+}
+
+static int
+tar_blocks_close(struct archive* a, void* client_data)
+{
+   struct tar_blocks* blocks = (struct tar_blocks*)client_data;
+
+   if (tar_blocks_flush(blocks))
+   {
+      archive_set_error(a, EIO, "Could not write the compressed blocks");
+      return ARCHIVE_FATAL;
+   }
+
+   if (blocks->owned)
+   {
+      if (fsync(blocks->fd) && errno != EINVAL)
+      {
+         archive_set_error(a, errno, "Could not sync the tar file");
+         return ARCHIVE_FATAL;
+      }
+   }
+
+   return ARCHIVE_OK;
+}
+
+static int
+tar_blocks_flush(struct tar_blocks* blocks)
+{
+   for (int i = 0; i < blocks->number_of_blocks; i++)
+   {
+      if (blocks->blocks[i].size > 0 &&
+          pgmoneta_workers_add(blocks->workers, tar_block_compress, &blocks->blocks[i].common))
+      {
+         goto error;
+      }
+   }
+
+   pgmoneta_workers_wait(blocks->workers);
+
+   if (!blocks->workers->outcome)
+   {
+      goto error;
+   }
+
+   /* The blocks are written in order, so the frames follow the tar stream */
+   for (int i = 0; i < blocks->number_of_blocks; i++)
+   {
+      struct tar_block* block = &blocks->blocks[i];
+      size_t offset = 0;
+
+      if (block->size == 0)
+      {
+         continue;
+      }
+
+      while (offset < block->compressed_size)
+      {
+         ssize_t w = write(blocks->fd, block->compressed + offset, block->compressed_size - offset);
+
+         if (w < 0)
+         {
+            if (errno == EINTR)
+            {
+               continue;
+            }
+
+            pgmoneta_log_error("Could not write the tar file: %s", strerror(errno));
+            goto error;
+         }
+
+         offset += w;
+      }
+
+      block->size = 0;
+      block->compressed_size = 0;
+   }
+
+   blocks->current = 0;
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+static void
+tar_block_compress(struct worker_common* wc)
+{
+   size_t bound = 0;
+   struct tar_block* block = (struct tar_block*)wc;
+
+   block->compressed_size = 0;
+
+   switch (block->type)
+   {
+      case COMPRESSION_CLIENT_GZIP:
+      case COMPRESSION_SERVER_GZIP:
+         bound = compressBound(block->size) + 32;
+         break;
+      case COMPRESSION_CLIENT_ZSTD:
+      case COMPRESSION_SERVER_ZSTD:
+         bound = ZSTD_compressBound(block->size);
+         break;
+      case COMPRESSION_CLIENT_LZ4:
+      case COMPRESSION_SERVER_LZ4:
+         bound = LZ4F_compressFrameBound(block->size, NULL);
+         break;
+      case COMPRESSION_CLIENT_BZIP2:
+         bound = block->size + block->size / 100 + 601;
+         break;
+      default:
+         goto error;
+   }
+
+   if (block->capacity < bound)
+   {
+      free(block->compressed);
+      block->compressed = (char*)malloc(bound);
+      if (block->compressed == NULL)
+      {
+         block->capacity = 0;
+         goto error;
+      }
+      block->capacity = bound;
+   }
+
+   switch (block->type)
+   {
+      case COMPRESSION_CLIENT_GZIP:
+      case COMPRESSION_SERVER_GZIP:
+      {
+         z_stream stream;
+
+         memset(&stream, 0, sizeof(stream));
+         if (deflateInit2(&stream, block->level, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+         {
+            goto error;
+         }
+
+         stream.next_in = (Bytef*)block->data;
+         stream.avail_in = block->size;
+         stream.next_out = (Bytef*)block->compressed;
+         stream.avail_out = block->capacity;
+
+         if (deflate(&stream, Z_FINISH) != Z_STREAM_END)
+         {
+            deflateEnd(&stream);
+            goto error;
+         }
+
+         block->compressed_size = stream.total_out;
+         deflateEnd(&stream);
+         break;
+      }
+      case COMPRESSION_CLIENT_ZSTD:
+      case COMPRESSION_SERVER_ZSTD:
+      {
+         size_t r = ZSTD_compress(block->compressed, block->capacity, block->data, block->size, block->level);
+
+         if (ZSTD_isError(r))
+         {
+            goto error;
+         }
+
+         block->compressed_size = r;
+         break;
+      }
+      case COMPRESSION_CLIENT_LZ4:
+      case COMPRESSION_SERVER_LZ4:
+      {
+         size_t r = LZ4F_compressFrame(block->compressed, block->capacity, block->data, block->size, NULL);
+
+         if (LZ4F_isError(r))
+         {
+            goto error;
+         }
+
+         block->compressed_size = r;
+         break;
+      }
+      case COMPRESSION_CLIENT_BZIP2:
+      {
+         unsigned int length = (unsigned int)block->capacity;
+
+         if (BZ2_bzBuffToBuffCompress(block->compressed, &length, block->data, (unsigned int)block->size, block->level, 0, 0) != BZ_OK)
+         {
+            goto error;
+         }
+
+         block->compressed_size = length;
+         break;
+      }
+      default:
+         goto error;
+   }
+
+   return;
+
+error:
+
+   pgmoneta_log_error("Could not compress a block of the tar file");
+   block->common.workers->outcome = false;
+}
+
+static int
+tar_sizes(char* source, struct art** sizes)
+{
+   char manifest[MAX_PATH];
+   char* key_path[1] = {"Files"};
+   struct json_reader* reader = NULL;
+   struct json* file = NULL;
+   struct art* tree = NULL;
+
+   *sizes = NULL;
+
+   if (pgmoneta_art_create(&tree))
+   {
+      goto error;
+   }
+
+   memset(manifest, 0, sizeof(manifest));
+   snprintf(manifest, sizeof(manifest), "%s%sbackup_manifest", source, pgmoneta_ends_with(source, "/") ? "" : "/");
+
+   /* The sizes of the plain files, so a header can be written before the file is decoded */
+   if (pgmoneta_exists(manifest))
+   {
+      if (pgmoneta_json_reader_init(manifest, &reader))
+      {
+         goto error;
+      }
+
+      if (!pgmoneta_json_locate(reader, key_path, 1))
+      {
+         while (pgmoneta_json_next_array_item(reader, &file))
+         {
+            char* path = (char*)pgmoneta_json_get(file, "Path");
+
+            if (path != NULL)
+            {
+               pgmoneta_art_insert(tree, path, (uintptr_t)pgmoneta_json_get(file, "Size"), ValueInt64);
+            }
+
+            pgmoneta_json_destroy(file);
+            file = NULL;
+         }
+      }
+
+      pgmoneta_json_reader_close(reader);
+   }
+
+   *sizes = tree;
+
+   return 0;
+
+error:
+
+   pgmoneta_json_reader_close(reader);
+   pgmoneta_art_destroy(tree);
+
+   return 1;
+}
+
+static int
+tar_backup_directory(struct archive* a, char* root, char* relative, char* destination,
+                     struct art* sizes, struct art* written, bool overlay, void* buffer)
+{
+   DIR* dir = NULL;
+   struct dirent* entry = NULL;
+   char directory[MAX_PATH];
+
+   memset(directory, 0, sizeof(directory));
+   snprintf(directory, sizeof(directory), "%s%s%s", root, pgmoneta_ends_with(root, "/") ? "" : "/", relative);
+
+   dir = opendir(directory);
+   if (dir == NULL)
+   {
+      pgmoneta_log_error("Could not open directory %s", directory);
+      goto error;
+   }
+
+   while ((entry = readdir(dir)) != NULL)
+   {
+      char path[MAX_PATH];
+      char rel[MAX_PATH];
+      char name[MAX_PATH];
+      char* plain = NULL;
+      int64_t size = -1;
+      struct stat s;
+
+      if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+      {
+         continue;
+      }
+
+      memset(path, 0, sizeof(path));
+      snprintf(path, sizeof(path), "%s%s%s", directory, pgmoneta_ends_with(directory, "/") ? "" : "/", entry->d_name);
+
+      if (lstat(path, &s))
+      {
+         pgmoneta_log_error("Could not stat %s", path);
+         goto error;
+      }
+
+      if (S_ISREG(s.st_mode))
+      {
+         if (pgmoneta_reader_plain_name(entry->d_name, &plain))
+         {
+            goto error;
+         }
+      }
+      else
+      {
+         plain = pgmoneta_append(plain, entry->d_name);
+      }
+
+      memset(rel, 0, sizeof(rel));
+      snprintf(rel, sizeof(rel), "%s%s", relative, plain);
+
+      memset(name, 0, sizeof(name));
+      snprintf(name, sizeof(name), "%s/%s", destination, rel);
+
+      if (!overlay && pgmoneta_art_contains_key(written, rel) && !S_ISDIR(s.st_mode))
+      {
+         free(plain);
+         continue;
+      }
+
+      if (S_ISDIR(s.st_mode))
+      {
+         char sub[MAX_PATH];
+
+         if (!pgmoneta_art_contains_key(written, rel))
+         {
+            if (tar_backup_file(a, path, name, &s, 0, buffer))
+            {
+               free(plain);
+               goto error;
+            }
+            pgmoneta_art_insert(written, rel, (uintptr_t)true, ValueBool);
+         }
+
+         memset(sub, 0, sizeof(sub));
+         snprintf(sub, sizeof(sub), "%s/", rel);
+
+         if (tar_backup_directory(a, root, sub, destination, sizes, written, overlay, buffer))
+         {
+            free(plain);
+            goto error;
+         }
+      }
+      else
+      {
+         if (S_ISREG(s.st_mode))
+         {
+            if (!strcmp(plain, entry->d_name))
+            {
+               size = s.st_size;
+            }
+            else if (sizes != NULL && pgmoneta_art_contains_key(sizes, rel))
+            {
+               size = (int64_t)pgmoneta_art_search(sizes, rel);
+            }
+         }
+
+         if (tar_backup_file(a, path, name, &s, size, buffer))
+         {
+            free(plain);
+            goto error;
+         }
+
+         if (overlay)
+         {
+            pgmoneta_art_insert(written, rel, (uintptr_t)true, ValueBool);
+         }
+      }
+
+      free(plain);
+   }
+
+   closedir(dir);
+
+   return 0;
+
+error:
+
+   if (dir != NULL)
+   {
+      closedir(dir);
+   }
+
+   return 1;
+}
+
+static int
+tar_backup_file(struct archive* a, char* path, char* name, struct stat* s, int64_t size, void* buffer)
+{
+   int64_t total = 0;
+   size_t r = 0;
+   struct reader* reader = NULL;
+   struct archive_entry* entry = NULL;
+
+   entry = archive_entry_new();
+   archive_entry_copy_pathname(entry, name);
+   archive_entry_set_perm(entry, s->st_mode);
+   archive_entry_set_mtime(entry, s->st_mtime, 0);
+
+   if (S_ISDIR(s->st_mode))
+   {
+      archive_entry_set_filetype(entry, AE_IFDIR);
+   }
+   else if (S_ISLNK(s->st_mode))
+   {
+      char target[MAX_PATH];
+
+      memset(target, 0, sizeof(target));
+      if (readlink(path, target, sizeof(target) - 1) == -1)
+      {
+         pgmoneta_log_error("Could not read link %s", path);
+         goto error;
+      }
+
+      archive_entry_set_filetype(entry, AE_IFLNK);
+      archive_entry_set_symlink(entry, target);
+   }
+   else if (S_ISREG(s->st_mode))
+   {
+      /* A file that is not in the manifest is decoded twice, once to learn its size */
+      if (size < 0)
+      {
+         size = 0;
+
+         if (pgmoneta_reader_open(path, &reader))
+         {
+            goto error;
+         }
+
+         while (!pgmoneta_reader_read(reader, buffer, MEMORY_BUFFER_SIZE, &r) && r > 0)
+         {
+            size += r;
+         }
+
+         pgmoneta_reader_close(reader);
+         reader = NULL;
+      }
+
+      archive_entry_set_filetype(entry, AE_IFREG);
+      archive_entry_set_size(entry, size);
+   }
+   else
+   {
+      archive_entry_free(entry);
+      return 0;
+   }
+
+   if (archive_write_header(a, entry) != ARCHIVE_OK)
+   {
+      pgmoneta_log_error("Could not write header: %s", archive_error_string(a));
+      goto error;
+   }
+
+   if (S_ISREG(s->st_mode))
+   {
+      if (pgmoneta_reader_open(path, &reader))
+      {
+         goto error;
+      }
+
+      while (true)
+      {
+         if (pgmoneta_reader_read(reader, buffer, MEMORY_BUFFER_SIZE, &r))
+         {
+            pgmoneta_log_error("Could not read %s", path);
+            goto error;
+         }
+
+         if (r == 0)
+         {
+            break;
+         }
+
+         if (archive_write_data(a, buffer, r) < 0)
+         {
+            pgmoneta_log_error("Could not write %s: %s", name, archive_error_string(a));
+            goto error;
+         }
+
+         total += r;
+         pgmoneta_progress_add(r, 0);
+      }
+
+      if (total != size)
+      {
+         pgmoneta_log_error("Size mismatch for %s, read %" PRId64 ", expected %" PRId64, path, total, size);
+         goto error;
+      }
+
+      pgmoneta_progress_add(0, 1);
+   }
+
+   pgmoneta_reader_close(reader);
+   archive_entry_free(entry);
+
+   return 0;
+
+error:
+
+   pgmoneta_reader_close(reader);
+   archive_entry_free(entry);
+
+   return 1;
+}
+
+static int
+tar_extract_create(char* directory, struct page_checksums* checksums, struct tar_extract** extract)
+{
+   struct tar_extract* e = NULL;
+
+   *extract = NULL;
+
+   e = (struct tar_extract*)calloc(1, sizeof(struct tar_extract));
+   if (e == NULL)
+   {
+      return 1;
+   }
+
+   snprintf(e->directory, sizeof(e->directory), "%s", directory);
+   e->fd = -1;
+
+   if (checksums != NULL)
+   {
+      e->page = (unsigned char*)malloc(checksums->block_size);
+      if (e->page == NULL)
+      {
+         free(e);
+         return 1;
+      }
+      e->checksums = checksums;
+   }
+
+   *extract = e;
+
+   return 0;
+}
+
+static int
+tar_extract_write(struct tar_extract* extract, char* data, size_t size)
+{
+   size_t n;
+
+   while (size > 0)
+   {
+      if (extract->remaining > 0)
+      {
+         n = MIN(size, extract->remaining);
+
+         if (extract->fd != -1)
+         {
+            size_t written = 0;
+
+            while (written < n)
+            {
+               ssize_t w = pwrite(extract->fd, data + written, n - written, extract->offset + written);
+
+               if (w < 0)
+               {
+                  if (errno == EINTR)
+                  {
+                     continue;
+                  }
+
+                  pgmoneta_log_error("Could not write %s: %s", extract->path, strerror(errno));
+                  return 1;
+               }
+
+               written += w;
+            }
+
+            if (extract->relation)
+            {
+               tar_extract_verify(extract, (unsigned char*)data, n);
+            }
+         }
+         else if (extract->long_name && extract->offset < sizeof(extract->name) - 1)
+         {
+            memcpy(extract->name + extract->offset, data, MIN(n, sizeof(extract->name) - 1 - extract->offset));
+         }
+
+         extract->offset += n;
+         extract->remaining -= n;
+         data += n;
+         size -= n;
+
+         if (extract->remaining == 0 && extract->fd != -1)
+         {
+            close(extract->fd);
+            extract->fd = -1;
+
+            tar_extract_verified(extract);
+
+            pgmoneta_progress_add(0, 1);
+            pgmoneta_drop_cache(extract->path);
+         }
+
+         continue;
+      }
+
+      if (extract->padding > 0)
+      {
+         n = MIN(size, extract->padding);
+
+         extract->padding -= n;
+         data += n;
+         size -= n;
+
+         continue;
+      }
+
+      if (extract->done)
+      {
+         // the terminator and the padding of the last record
+         break;
+      }
+
+      n = MIN(size, TAR_HEADER_SIZE - extract->header_size);
+
+      memcpy(extract->header + extract->header_size, data, n);
+      extract->header_size += n;
+      data += n;
+      size -= n;
+
+      if (extract->header_size == TAR_HEADER_SIZE)
+      {
+         extract->header_size = 0;
+
+         if (tar_extract_header(extract))
+         {
+            return 1;
+         }
+      }
+   }
+
+   return 0;
+}
+
+static void
+tar_extract_verify(struct tar_extract* extract, unsigned char* data, size_t size)
+{
+   struct page_checksums* checksums = extract->checksums;
+   size_t n;
+
+   while (size > 0)
+   {
+      unsigned char* page = NULL;
+
+      // the pages are verified in the received data, unless they span two messages
+      if (extract->page_size == 0 && size >= checksums->block_size)
+      {
+         page = data;
+         n = checksums->block_size;
+      }
+      else
+      {
+         n = MIN(size, checksums->block_size - extract->page_size);
+
+         memcpy(extract->page + extract->page_size, data, n);
+         extract->page_size += n;
+
+         if (extract->page_size == checksums->block_size)
+         {
+            page = extract->page;
+            extract->page_size = 0;
+         }
+      }
+
+      if (page != NULL)
+      {
+         if (!pgmoneta_page_verify(checksums, page, extract->block_number))
+         {
+            extract->failed++;
+
+            if (extract->failed <= 5)
+            {
+               pgmoneta_log_warn("Checksum verification failed for %s block %u", extract->path, extract->block_number);
+            }
+         }
+
+         extract->block_number++;
+      }
+
+      data += n;
+      size -= n;
+   }
+}
+
+static void
+tar_extract_verified(struct tar_extract* extract)
+{
+   if (!extract->relation)
+   {
+      return;
+   }
+
+   if (extract->failed > 0)
+   {
+      if (extract->failed > 5)
+      {
+         pgmoneta_log_warn("%s has %u pages that failed checksum verification", extract->path, extract->failed);
+      }
+
+      extract->checksums->files++;
+   }
+
+   extract->relation = false;
+}
+
+static int
+tar_extract_header(struct tar_extract* extract)
+{
+   char* h = extract->header;
+   char name[MAX_PATH];
+   char link[101];
+   uint64_t size;
+   uint64_t checksum = 0;
+   mode_t mode;
+   char type;
+   bool empty = true;
+
+   for (int i = 0; i < TAR_HEADER_SIZE; i++)
+   {
+      if (h[i] != 0)
+      {
+         empty = false;
+      }
+
+      // the checksum is calculated with the checksum field as spaces
+      checksum += (i >= 148 && i < 156) ? ' ' : (unsigned char)h[i];
+   }
+
+   if (empty)
+   {
+      extract->done = true;
+      return 0;
+   }
+
+   if (checksum != tar_number(h + 148, 8))
+   {
+      pgmoneta_log_error("Invalid tar header checksum in %s", extract->directory);
+      return 1;
+   }
+
+   size = tar_number(h + 124, 12);
+   mode = (mode_t)(tar_number(h + 100, 8) & 07777);
+   type = h[156];
+
+   memset(name, 0, sizeof(name));
+   if (extract->name[0] != '\0')
+   {
+      snprintf(name, sizeof(name), "%s", extract->name);
+      memset(extract->name, 0, sizeof(extract->name));
+   }
+   else if (!strncmp(h + 257, "ustar", 5) && h[345] != '\0')
+   {
+      snprintf(name, sizeof(name), "%.155s/%.100s", h + 345, h);
+   }
+   else
+   {
+      snprintf(name, sizeof(name), "%.100s", h);
+   }
+
+   if (name[0] == '/' || !strcmp(name, "..") || pgmoneta_starts_with(name, "../") || strstr(name, "/../") != NULL)
+   {
+      pgmoneta_log_error("Invalid tar member %s", name);
+      return 1;
+   }
+
+   memset(extract->path, 0, sizeof(extract->path));
+   snprintf(extract->path, sizeof(extract->path), "%s%s%s", extract->directory,
+            pgmoneta_ends_with(extract->directory, "/") ? "" : "/", name);
+
+   extract->long_name = false;
+   extract->remaining = 0;
+   extract->offset = 0;
+   extract->padding = 0;
+   extract->relation = false;
+
+   switch (type)
+   {
+      case '0':
+      case '\0':
+      case '7':
+         extract->fd = open(extract->path, O_WRONLY | O_CREAT | O_TRUNC, mode != 0 ? mode : 0600);
+         if (extract->fd == -1 && errno == ENOENT)
+         {
+            char* parent = NULL;
+
+            parent = pgmoneta_append(parent, extract->path);
+            *strrchr(parent, '/') = '\0';
+            pgmoneta_mkdir(parent);
+            free(parent);
+
+            extract->fd = open(extract->path, O_WRONLY | O_CREAT | O_TRUNC, mode != 0 ? mode : 0600);
+         }
+
+         if (extract->fd == -1)
+         {
+            pgmoneta_log_error("Could not create %s: %s", extract->path, strerror(errno));
+            return 1;
+         }
+
+         if (extract->checksums != NULL)
+         {
+            uint32_t segment = 0;
+
+            extract->relation = pgmoneta_page_relation_segment(name, &segment);
+            extract->block_number = segment * extract->checksums->relseg_size;
+            extract->failed = 0;
+            extract->page_size = 0;
+         }
+
+         // reserve the blocks of larger members, so a segment is laid out in one piece
+         if (size >= TAR_PREALLOCATE_MIN)
+         {
+            posix_fallocate(extract->fd, 0, (off_t)size);
+         }
+
+         if (size == 0)
+         {
+            close(extract->fd);
+            extract->fd = -1;
+
+            pgmoneta_progress_add(0, 1);
+         }
+
+         extract->remaining = size;
+         break;
+      case '5':
+         if (pgmoneta_mkdir(extract->path))
+         {
+            pgmoneta_log_error("Could not create %s", extract->path);
+            return 1;
+         }
+         chmod(extract->path, mode != 0 ? mode : 0700);
+         break;
+      case '2':
+         memset(link, 0, sizeof(link));
+         memcpy(link, h + 157, 100);
+
+         unlink(extract->path);
+         if (symlink(link, extract->path))
+         {
+            pgmoneta_log_error("Could not create link %s: %s", extract->path, strerror(errno));
+            return 1;
+         }
+         break;
+      case 'L':
+         // GNU long name of the next member
+         extract->long_name = true;
+         extract->remaining = size;
+         break;
+      default:
+         // skip extended headers and other types
+         pgmoneta_log_debug("Skipping tar member %s of type %c", name, type);
+         extract->remaining = size;
+         break;
+   }
+
+   extract->padding = (TAR_HEADER_SIZE - (size % TAR_HEADER_SIZE)) % TAR_HEADER_SIZE;
+   if (type == '5' || type == '2')
+   {
+      extract->padding = 0;
+   }
+
+   return 0;
+}
+
+static int
+tar_extract_finish(struct tar_extract* extract)
+{
+   int ret = 0;
+
+   if (extract == NULL)
+   {
+      return 0;
+   }
+
+   if (extract->remaining > 0 || extract->header_size > 0)
+   {
+      pgmoneta_log_error("Incomplete tar stream for %s", extract->directory);
+      ret = 1;
+   }
+
+   tar_extract_destroy(extract);
+
+   return ret;
+}
+
+static void
+tar_extract_destroy(struct tar_extract* extract)
+{
+   if (extract == NULL)
+   {
+      return;
+   }
+
+   if (extract->fd != -1)
+   {
+      close(extract->fd);
+   }
+
+   free(extract->page);
+   free(extract);
+}
+
+static uint64_t
+tar_number(char* field, size_t size)
+{
+   uint64_t value = 0;
+   size_t i = 0;
+
+   // base-256 for the sizes that do not fit in octal
+   if ((unsigned char)field[0] & 0x80)
+   {
+      value = (unsigned char)field[0] & 0x7F;
+      for (i = 1; i < size; i++)
+      {
+         value = (value << 8) | (unsigned char)field[i];
+      }
+
+      return value;
+   }
+
+   while (i < size && (field[i] == ' ' || field[i] == '\0'))
+   {
+      i++;
+   }
+
+   while (i < size && field[i] >= '0' && field[i] <= '7')
+   {
+      value = (value << 3) + (field[i] - '0');
+      i++;
+   }
+
+   return value;
+}
+
+static bool
+is_server_side_compression(void)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+   return config->compression_type == COMPRESSION_SERVER_GZIP ||
+          config->compression_type == COMPRESSION_SERVER_LZ4 ||
+          config->compression_type == COMPRESSION_SERVER_ZSTD;
+}
+
+static int
+server_side_filter(struct archive* a)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   switch (config->compression_type)
+   {
+      case COMPRESSION_SERVER_GZIP:
+         return archive_read_support_filter_gzip(a) != ARCHIVE_OK;
+      case COMPRESSION_SERVER_ZSTD:
+         return archive_read_support_filter_zstd(a) != ARCHIVE_OK;
+      case COMPRESSION_SERVER_LZ4:
+         return archive_read_support_filter_lz4(a) != ARCHIVE_OK;
+      default:
+         break;
+   }
+
+   return 1;
+}
+
+static int
+pipeline_create(int server, struct pipeline** pipeline)
+{
+   struct pipeline* p = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   *pipeline = NULL;
+
+   if (config->backup_write_queue <= 0)
+   {
+      return 0;
+   }
+
+   p = (struct pipeline*)malloc(sizeof(struct pipeline));
+   if (p == NULL)
+   {
+      goto error;
+   }
+
+   memset(p, 0, sizeof(struct pipeline));
+
+   p->server = server;
+   p->capacity = config->backup_write_queue;
+   p->jobs = (struct pipeline_job*)malloc(p->capacity * sizeof(struct pipeline_job));
+   p->chunk = (char*)malloc(PIPELINE_CHUNK_SIZE);
+   atomic_init(&p->failed, false);
+
+   if (p->jobs == NULL || p->chunk == NULL)
+   {
+      goto error;
+   }
+
+   pthread_mutex_init(&p->lock, NULL);
+   pthread_cond_init(&p->changed, NULL);
+
+   if (pthread_create(&p->thread, NULL, pipeline_run, p))
+   {
+      pthread_cond_destroy(&p->changed);
+      pthread_mutex_destroy(&p->lock);
+      goto error;
+   }
+
+   atomic_store(&config->common.servers[server].backup_write_queue, 0);
+
+   *pipeline = p;
+
+   return 0;
+
+error:
+   if (p != NULL)
+   {
+      free(p->jobs);
+      free(p->chunk);
+      free(p);
+   }
+
+   return 1;
+}
+
+static int
+pipeline_write(struct pipeline* pipeline, FILE* file, struct tar_extract* extract, void* data, size_t size)
+{
+   struct pipeline_job job;
+
+   if (pipeline == NULL)
+   {
+      if (extract != NULL)
+      {
+         return tar_extract_write(extract, data, size);
+      }
+
+      return fwrite(data, size, 1, file) != 1;
+   }
+
+   if (atomic_load(&pipeline->failed))
+   {
+      return 1;
+   }
+
+   if (pipeline->chunk_size > 0 &&
+       (pipeline->chunk_file != file || pipeline->chunk_extract != extract || pipeline->chunk_size + size > PIPELINE_CHUNK_SIZE))
+   {
+      if (pipeline_flush(pipeline))
+      {
+         return 1;
+      }
+   }
+
+   if (size > PIPELINE_CHUNK_SIZE)
+   {
+      // too large to batch, queue it on its own
+      memset(&job, 0, sizeof(struct pipeline_job));
+      job.type = PIPELINE_JOB_WRITE;
+      job.file = file;
+      job.extract = extract;
+      job.data = (char*)malloc(size);
+      job.size = size;
+
+      if (job.data == NULL)
+      {
+         return 1;
+      }
+
+      memcpy(job.data, data, size);
+
+      return pipeline_enqueue(pipeline, &job);
+   }
+
+   if (pipeline->chunk == NULL)
+   {
+      pipeline->chunk = (char*)malloc(PIPELINE_CHUNK_SIZE);
+      if (pipeline->chunk == NULL)
+      {
+         return 1;
+      }
+   }
+
+   memcpy(pipeline->chunk + pipeline->chunk_size, data, size);
+   pipeline->chunk_size += size;
+   pipeline->chunk_file = file;
+   pipeline->chunk_extract = extract;
+
+   return 0;
+}
+
+static int
+pipeline_finish(struct pipeline* pipeline, FILE* file, struct tar_extract* extract, bool pad, char* file_path, char* directory)
+{
+   struct pipeline_job job;
+
+   memset(&job, 0, sizeof(struct pipeline_job));
+   job.type = PIPELINE_JOB_FINISH;
+   job.file = file;
+   job.extract = extract;
+   job.pad = pad;
+   snprintf(job.file_path, sizeof(job.file_path), "%s", file_path);
+   snprintf(job.directory, sizeof(job.directory), "%s", directory);
+
+   if (pipeline == NULL)
+   {
+      return pipeline_execute(&job);
+   }
+
+   if (pipeline_flush(pipeline) || pipeline_enqueue(pipeline, &job))
+   {
+      // the writer may still be using the file
+      atomic_store(&pipeline->failed, true);
+      pipeline_drain(pipeline);
+      if (extract != NULL)
+      {
+         tar_extract_destroy(extract);
+      }
+      else
+      {
+         fclose(file);
+         remove(file_path);
+      }
+      return 1;
+   }
+
+   return 0;
+}
+
+static int
+pipeline_drain(struct pipeline* pipeline)
+{
+   if (pipeline == NULL)
+   {
+      return 0;
+   }
+
+   if (pipeline_flush(pipeline))
+   {
+      return 1;
+   }
+
+   pthread_mutex_lock(&pipeline->lock);
+   while (pipeline->count > 0 || pipeline->busy)
+   {
+      pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+   }
+   pthread_mutex_unlock(&pipeline->lock);
+
+   return atomic_load(&pipeline->failed) ? 1 : 0;
+}
+
+static void
+pipeline_destroy(struct pipeline* pipeline, bool abort)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (pipeline == NULL)
+   {
+      return;
+   }
+
+   if (!abort)
+   {
+      pipeline_flush(pipeline);
+   }
+   else
+   {
+      // the chunk is dropped, its file or tar stream is released by the caller
+      pipeline->chunk_size = 0;
+      pipeline->chunk_file = NULL;
+      pipeline->chunk_extract = NULL;
+   }
+
+   pthread_mutex_lock(&pipeline->lock);
+   pipeline->done = true;
+   pipeline->abort = abort;
+   pthread_cond_broadcast(&pipeline->changed);
+   pthread_mutex_unlock(&pipeline->lock);
+
+   pthread_join(pipeline->thread, NULL);
+
+   pthread_cond_destroy(&pipeline->changed);
+   pthread_mutex_destroy(&pipeline->lock);
+
+   atomic_store(&config->common.servers[pipeline->server].backup_write_queue, 0);
+
+   free(pipeline->jobs);
+   free(pipeline->chunk);
+   free(pipeline);
+}
+
+static int
+pipeline_enqueue(struct pipeline* pipeline, struct pipeline_job* job)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   pthread_mutex_lock(&pipeline->lock);
+
+   if (pipeline->count == pipeline->capacity)
+   {
+      // backpressure, the network waits for the writer
+      atomic_fetch_add(&config->common.servers[pipeline->server].backup_write_queue_waits, 1);
+
+      while (pipeline->count == pipeline->capacity && !atomic_load(&pipeline->failed))
+      {
+         pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+      }
+   }
+
+   if (atomic_load(&pipeline->failed))
+   {
+      pthread_mutex_unlock(&pipeline->lock);
+
+      free(job->data);
+
+      return 1;
+   }
+
+   memcpy(&pipeline->jobs[(pipeline->head + pipeline->count) % pipeline->capacity], job, sizeof(struct pipeline_job));
+   pipeline->count++;
+
+   atomic_store(&config->common.servers[pipeline->server].backup_write_queue, pipeline->count);
+
+   pthread_cond_broadcast(&pipeline->changed);
+   pthread_mutex_unlock(&pipeline->lock);
+
+   return 0;
+}
+
+static int
+pipeline_flush(struct pipeline* pipeline)
+{
+   struct pipeline_job job;
+
+   if (pipeline->chunk_size == 0)
+   {
+      return 0;
+   }
+
+   // the writer takes the chunk as it is, the next write starts a new one
+   memset(&job, 0, sizeof(struct pipeline_job));
+   job.type = PIPELINE_JOB_WRITE;
+   job.file = pipeline->chunk_file;
+   job.extract = pipeline->chunk_extract;
+   job.data = pipeline->chunk;
+   job.size = pipeline->chunk_size;
+
+   pipeline->chunk = NULL;
+   pipeline->chunk_size = 0;
+   pipeline->chunk_file = NULL;
+   pipeline->chunk_extract = NULL;
+
+   return pipeline_enqueue(pipeline, &job);
+}
+
+static int
+pipeline_execute(struct pipeline_job* job)
+{
+   char null_buffer[2 * 512]; // 2 tar block size of terminator null bytes
+
+   if (job->type == PIPELINE_JOB_WRITE)
+   {
+      if (job->extract != NULL)
+      {
+         return tar_extract_write(job->extract, job->data, job->size);
+      }
+
+      return fwrite(job->data, job->size, 1, job->file) != 1;
+   }
+
+   if (job->extract != NULL)
+   {
+      return tar_extract_finish(job->extract);
+   }
+
+   memset(null_buffer, 0, sizeof(null_buffer));
+
+   if (job->pad && fwrite(null_buffer, sizeof(null_buffer), 1, job->file) != 1)
+   {
+      fflush(job->file);
+      fclose(job->file);
+      remove(job->file_path);
+      return 1;
+   }
+
+   fflush(job->file);
+   fclose(job->file);
+
+   pgmoneta_extract_tar_file(job->file_path, job->directory);
+   remove(job->file_path);
+
+   return 0;
+}
+
+static void*
+pipeline_run(void* arg)
+{
+   bool skip;
+   struct pipeline_job job;
+   struct pipeline* pipeline = (struct pipeline*)arg;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   pthread_mutex_lock(&pipeline->lock);
+
+   while (true)
+   {
+      while (pipeline->count == 0 && !pipeline->done)
+      {
+         pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+      }
+
+      if (pipeline->count == 0)
+      {
+         break;
+      }
+
+      memcpy(&job, &pipeline->jobs[pipeline->head], sizeof(struct pipeline_job));
+      pipeline->head = (pipeline->head + 1) % pipeline->capacity;
+      pipeline->count--;
+      pipeline->busy = true;
+      skip = pipeline->abort || atomic_load(&pipeline->failed);
+
+      atomic_store(&config->common.servers[pipeline->server].backup_write_queue, pipeline->count);
+
+      pthread_cond_broadcast(&pipeline->changed);
+      pthread_mutex_unlock(&pipeline->lock);
+
+      if (skip)
+      {
+         // only release the files, and the tar file which is no longer extracted
+         if (job.type == PIPELINE_JOB_FINISH)
+         {
+            if (job.extract != NULL)
+            {
+               tar_extract_destroy(job.extract);
+            }
+            else
+            {
+               fclose(job.file);
+               remove(job.file_path);
+            }
+         }
+      }
+      else if (pipeline_execute(&job))
+      {
+         pgmoneta_log_error("Backup writer: could not write the backup data");
+         atomic_store(&pipeline->failed, true);
+      }
+
+      free(job.data);
+
+      pthread_mutex_lock(&pipeline->lock);
+      pipeline->busy = false;
+      pthread_cond_broadcast(&pipeline->changed);
+   }
+
+   pthread_mutex_unlock(&pipeline->lock);
+
+   return NULL;
 }
@@ -29,8 +29,16 @@
 #include <art.h>
 #include <json.h>
 #include <logging.h>
+#include <memory.h>
 #include <utils.h>
 
+/* system */
+#include <stddef.h>
+#include <stdlib.h>
+
+#define ART_ARENA_BLOCK_SIZE (256 * 1024)
+#define ART_ARENA_ALIGNMENT  64
+
 #define IS_LEAF(x) (((uintptr_t)(x) & 1))
 #define SET_LEAF(x) ((void*)((uintptr_t)(x) | 1))
 #define GET_LEAF(x) ((struct art_leaf*)((void*)((uintptr_t)(x) & ~1)))
@@ -56,6 +64,7 @@ struct art_node
    enum art_node_type type;                 /**< The node type */
    uint8_t num_children;                    /**< The number of children */
    unsigned char prefix[MAX_PREFIX_LEN];    /**< The (potentially partial) prefix, only record up to MAX_PREFIX_LEN characters */
+   struct art_arena* arena;                 /**< The arena the node lives in, or NULL if it was malloc'ed */
 } __attribute__ ((aligned (64)));
 
 /**
@@ -114,9 +123,30 @@ struct art_node256
    struct art_node* children[256];
 } __attribute__ ((aligned (64)));
 
+/**
+ * A block of the arena that nodes and leaves are carved from
+ */
+struct art_arena_block
+{
+   struct art_arena_block* next;                          /**< The next block */
+   size_t size;                                           /**< The size of the data */
+   size_t used;                                           /**< The used part of the data */
+   unsigned char data[] __attribute__ ((aligned (64)));   /**< The data */
+};
+
+/**
+ * The arena owns all nodes and leaves of a tree, so they are released together.
+ * Nodes replaced when a node grows or shrinks are kept per type for reuse
+ */
+struct art_arena
+{
+   struct art_arena_block* blocks;  /**< The blocks, the current one first */
+   struct art_node* free_nodes[4];  /**< The released nodes of each type */
+};
+
 struct to_string_param
 {
-   char* str;
+   struct builder* str;
    int indent;
    uint64_t cnt;
    char* tag;
@@ -130,27 +160,37 @@ node_get_child(struct art_node* node, unsigned char ch);
 static struct art_leaf*
 node_get_minimum(struct art_node* node);
 
+static void*
+art_arena_allocate(struct art_arena* arena, size_t size);
+
+static void
+art_arena_reset(struct art_arena* arena);
+
 static void
-create_art_leaf(struct art_leaf** leaf, unsigned char* key, uint32_t key_len, uintptr_t value, enum value_type type, struct value_config* config);
+create_art_leaf(struct art_arena* arena, struct art_leaf** leaf, unsigned char* key, uint32_t key_len, uintptr_t value, enum value_type type, struct value_config* config);
 
 static void
-create_art_node(struct art_node** node, enum art_node_type type);
+create_art_node(struct art_arena* arena, struct art_node** node, enum art_node_type type);
 
 static void
-create_art_node4(struct art_node4** node);
+create_art_node4(struct art_arena* arena, struct art_node4** node);
 
 static void
-create_art_node16(struct art_node16** node);
+create_art_node16(struct art_arena* arena, struct art_node16** node);
 
 static void
-create_art_node48(struct art_node48** node);
+create_art_node48(struct art_arena* arena, struct art_node48** node);
 
 static void
-create_art_node256(struct art_node256** node);
+create_art_node256(struct art_arena* arena, struct art_node256** node);
 
-// Destroy ART nodes/leaves recursively
+// Release a node that was replaced, without its children
 static void
-destroy_art_node(struct art_node* node);
+release_art_node(struct art_node* node);
+
+// Destroy ART nodes/leaves recursively, with an arena only the values are destroyed
+static void
+destroy_art_node(struct art_arena* arena, struct art_node* node);
 
 static int
 art_iterate(struct art* t, art_callback cb, void* data);
@@ -204,6 +244,7 @@ find_index(unsigned char ch, unsigned char* keys, int length);
 /**
  * Insert a value into a node recursively, adopting lazy expansion and path compression --
  * Expand the leaf, or split inner node should keys diverge within node's prefix range
+ * @param arena The arena, or NULL
  * @param node The node
  * @param node_ref The reference to node pointer
  * @param depth The depth into the node, which is the same as the total prefix length
@@ -216,7 +257,7 @@ find_index(unsigned char ch, unsigned char* keys, int length);
  * @return Old value if the key exists, otherwise NULL
  */
 static struct value*
-art_node_insert(struct art_node* node, struct art_node** node_ref, uint32_t depth, unsigned char* key, uint32_t key_len, uintptr_t value, enum value_type type, struct value_config* config, bool* new);
+art_node_insert(struct art_arena* arena, struct art_node* node, struct art_node** node_ref, uint32_t depth, unsigned char* key, uint32_t key_len, uintptr_t value, enum value_type type, struct value_config* config, bool* new);
 
 /**
  * Delete a value from a node recursively.
@@ -310,10 +351,40 @@ pgmoneta_art_create(struct art** tree)
    t = malloc(sizeof(struct art));
    t->size = 0;
    t->root = NULL;
+   t->arena = NULL;
    *tree = t;
    return 0;
 }
 
+int
+pgmoneta_art_create_with_arena(struct art** tree)
+{
+   struct art* t = NULL;
+
+   *tree = NULL;
+
+   if (pgmoneta_art_create(&t))
+   {
+      goto error;
+   }
+
+   t->arena = (struct art_arena*)calloc(1, sizeof(struct art_arena));
+   if (t->arena == NULL)
+   {
+      goto error;
+   }
+
+   *tree = t;
+
+   return 0;
+
+error:
+
+   free(t);
+
+   return 1;
+}
+
 int
 pgmoneta_art_destroy(struct art* tree)
 {
@@ -321,7 +392,9 @@ pgmoneta_art_destroy(struct art* tree)
    {
       return 0;
    }
-   destroy_art_node(tree->root);
+   destroy_art_node(tree->arena, tree->root);
+   art_arena_reset(tree->arena);
+   free(tree->arena);
    free(tree);
    return 0;
 }
@@ -428,7 +501,7 @@ pgmoneta_art_insert(struct art* t, char* key, uintptr_t value, enum value_type t
       // c'mon, at least create a tree first...
       goto error;
    }
-   old_val = art_node_insert(t->root, &t->root, 0, (unsigned char*)key, strlen(key) + 1, value, type, NULL, &new);
+   old_val = art_node_insert(t->arena, t->root, &t->root, 0, (unsigned char*)key, strlen(key) + 1, value, type, NULL, &new);
    pgmoneta_value_destroy(old_val);
    if (new)
    {
@@ -448,7 +521,7 @@ pgmoneta_art_insert_with_config(struct art* t, char* key, uintptr_t value, struc
    {
       goto error;
    }
-   old_val = art_node_insert(t->root, &t->root, 0, (unsigned char*)key, strlen(key) + 1, value, ValueRef, config, &new);
+   old_val = art_node_insert(t->arena, t->root, &t->root, 0, (unsigned char*)key, strlen(key) + 1, value, ValueRef, config, &new);
    pgmoneta_value_destroy(old_val);
    if (new)
    {
@@ -470,10 +543,24 @@ pgmoneta_art_delete(struct art* t, char* key)
    l = art_node_delete(t->root, &t->root, 0, (unsigned char*)key, strlen(key) + 1);
    t->size--;
    pgmoneta_value_destroy(l->value);
-   free(l);
+   if (t->arena == NULL)
+   {
+      free(l);
+   }
    return 0;
 }
 
+int
+pgmoneta_art_iterate(struct art* t, art_callback cb, void* data)
+{
+   if (t == NULL || cb == NULL)
+   {
+      return 0;
+   }
+
+   return art_iterate(t, cb, data);
+}
+
 int
 pgmoneta_art_clear(struct art* t)
 {
@@ -481,7 +568,8 @@ pgmoneta_art_clear(struct art* t)
    {
       return 0;
    }
-   destroy_art_node(t->root);
+   destroy_art_node(t->arena, t->root);
+   art_arena_reset(t->arena);
    t->root = NULL;
    t->size = 0;
    return 0;
@@ -515,12 +603,81 @@ min(uint32_t a, uint32_t b)
    return a;
 }
 
+static void*
+art_arena_allocate(struct art_arena* arena, size_t size)
+{
+   struct art_arena_block* block = NULL;
+   size_t data_size;
+   void* p = NULL;
+
+   size = (size + ART_ARENA_ALIGNMENT - 1) & ~((size_t)ART_ARENA_ALIGNMENT - 1);
+
+   block = arena->blocks;
+   if (block == NULL || block->size - block->used < size)
+   {
+      data_size = size > ART_ARENA_BLOCK_SIZE ? size : ART_ARENA_BLOCK_SIZE;
+
+      block = (struct art_arena_block*)aligned_alloc(ART_ARENA_ALIGNMENT, sizeof(struct art_arena_block) + data_size);
+      if (block == NULL)
+      {
+         return NULL;
+      }
+
+      block->size = data_size;
+      block->used = 0;
+      block->next = arena->blocks;
+      arena->blocks = block;
+
+      pgmoneta_memory_account((long)(sizeof(struct art_arena_block) + data_size));
+   }
+
+   p = block->data + block->used;
+   block->used += size;
+
+   return p;
+}
+
+static void
+art_arena_reset(struct art_arena* arena)
+{
+   struct art_arena_block* block = NULL;
+   struct art_arena_block* next = NULL;
+
+   if (arena == NULL)
+   {
+      return;
+   }
+
+   block = arena->blocks;
+   while (block != NULL)
+   {
+      next = block->next;
+      pgmoneta_memory_account(-(long)(sizeof(struct art_arena_block) + block->size));
+      free(block);
+      block = next;
+   }
+
+   memset(arena, 0, sizeof(struct art_arena));
+}
+
 static void
-create_art_leaf(struct art_leaf** leaf, unsigned char* key, uint32_t key_len, uintptr_t value, enum value_type type, struct value_config* config)
+create_art_leaf(struct art_arena* arena, struct art_leaf** leaf, unsigned char* key, uint32_t key_len, uintptr_t value, enum value_type type, struct value_config* config)
 {
    struct art_leaf* l = NULL;
-   l = malloc(sizeof(struct art_leaf) + key_len);
-   memset(l, 0, sizeof(struct art_leaf) + key_len);
+   size_t size;
+
+   if (arena != NULL)
+   {
+      // The key follows the header directly, so small keys share the cache line of the leaf
+      size = offsetof(struct art_leaf, key) + key_len;
+      l = art_arena_allocate(arena, size);
+   }
+   else
+   {
+      size = sizeof(struct art_leaf) + key_len;
+      l = malloc(size);
+   }
+   memset(l, 0, size);
    if (config != NULL)
    {
       pgmoneta_value_create_with_config(value, config, &l->value);
@@ -536,81 +693,97 @@ create_art_leaf(struct art_leaf** leaf, unsigned char* key, uint32_t key_len, ui
 }
 
 static void
-create_art_node(struct art_node** node, enum art_node_type type)
+create_art_node(struct art_arena* arena, struct art_node** node, enum art_node_type type)
 {
    struct art_node* n = NULL;
+   size_t size = 0;
    switch (type)
    {
       case Node4:
-      {
-         struct art_node4* n4 = malloc(sizeof(struct art_node4));
-         memset(n4, 0, sizeof(struct art_node4));
-         n4->node.type = Node4;
-         n = (struct art_node*) n4;
+         size = sizeof(struct art_node4);
          break;
-      }
       case Node16:
-      {
-         struct art_node16* n16 = malloc(sizeof(struct art_node16));
-         memset(n16, 0, sizeof(struct art_node16));
-         n16->node.type = Node16;
-         n = (struct art_node*) n16;
+         size = sizeof(struct art_node16);
          break;
-      }
       case Node48:
-      {
-         struct art_node48* n48 = malloc(sizeof(struct art_node48));
-         memset(n48, 0, sizeof(struct art_node48));
-         n48->node.type = Node48;
-         n = (struct art_node*) n48;
+         size = sizeof(struct art_node48);
          break;
-      }
       case Node256:
-      {
-         struct art_node256* n256 = malloc(sizeof(struct art_node256));
-         memset(n256, 0, sizeof(struct art_node256));
-         n256->node.type = Node256;
-         n = (struct art_node*) n256;
+         size = sizeof(struct art_node256);
          break;
+   }
+   if (arena != NULL)
+   {
+      n = arena->free_nodes[type];
+      if (n != NULL)
+      {
+         arena->free_nodes[type] = *(struct art_node**)n;
+      }
+      else
+      {
+         n = art_arena_allocate(arena, size);
       }
    }
+   else
+   {
+      n = malloc(size);
+   }
+   memset(n, 0, size);
+   n->type = type;
+   n->arena = arena;
    *node = n;
 }
 
 static void
-create_art_node4(struct art_node4** node)
+release_art_node(struct art_node* node)
+{
+   struct art_arena* arena = node->arena;
+   enum art_node_type type = node->type;
+
+   if (arena == NULL)
+   {
+      free(node);
+      return;
+   }
+
+   *(struct art_node**)node = arena->free_nodes[type];
+   arena->free_nodes[type] = node;
+}
+
+static void
+create_art_node4(struct art_arena* arena, struct art_node4** node)
 {
    struct art_node* n = NULL;
-   create_art_node(&n, Node4);
+   create_art_node(arena, &n, Node4);
    *node = (struct art_node4*)n;
 }
 
 static void
-create_art_node16(struct art_node16** node)
+create_art_node16(struct art_arena* arena, struct art_node16** node)
 {
    struct art_node* n = NULL;
-   create_art_node(&n, Node16);
+   create_art_node(arena, &n, Node16);
    *node = (struct art_node16*)n;
 }
 
 static void
-create_art_node48(struct art_node48** node)
+create_art_node48(struct art_arena* arena, struct art_node48** node)
 {
    struct art_node* n = NULL;
-   create_art_node(&n, Node48);
+   create_art_node(arena, &n, Node48);
    *node = (struct art_node48*)n;
 }
 
 static void
-create_art_node256(struct art_node256** node)
+create_art_node256(struct art_arena* arena, struct art_node256** node)
 {
    struct art_node* n = NULL;
-   create_art_node(&n, Node256);
+   create_art_node(arena, &n, Node256);
    *node = (struct art_node256*)n;
 }
 
 static void
-destroy_art_node(struct art_node* node)
+destroy_art_node(struct art_arena* arena, struct art_node* node)
 {
    if (node == NULL)
    {
@@ -619,7 +792,10 @@ destroy_art_node(struct art_node* node)
    if (IS_LEAF(node))
    {
       pgmoneta_value_destroy(GET_LEAF(node)->value);
-      free(GET_LEAF(node));
+      if (arena == NULL)
+      {
+         free(GET_LEAF(node));
+      }
       return;
    }
    switch (node->type)
@@ -629,7 +805,7 @@ destroy_art_node(struct art_node* node)
          struct art_node4* n = (struct art_node4*) node;
          for (int i = 0; i < node->num_children; i++)
          {
-            destroy_art_node(n->children[i]);
+            destroy_art_node(arena, n->children[i]);
          }
          break;
       }
@@ -638,7 +814,7 @@ destroy_art_node(struct art_node* node)
          struct art_node16* n = (struct art_node16*) node;
          for (int i = 0; i < node->num_children; i++)
          {
-            destroy_art_node(n->children[i]);
+            destroy_art_node(arena, n->children[i]);
          }
          break;
       }
@@ -652,7 +828,7 @@ destroy_art_node(struct art_node* node)
             {
                continue;
             }
-            destroy_art_node(n->children[idx - 1]);
+            destroy_art_node(arena, n->children[idx - 1]);
          }
          break;
       }
@@ -666,12 +842,15 @@ destroy_art_node(struct art_node* node)
             {
                continue;
             }
-            destroy_art_node(n->children[i]);
+            destroy_art_node(arena, n->children[i]);
          }
          break;
       }
    }
-   free(node);
+   if (arena == NULL)
+   {
+      free(node);
+   }
 }
 
 static struct art_node**
@@ -719,7 +898,7 @@ error:
 }
 
 static struct value*
-art_node_insert(struct art_node* node, struct art_node** node_ref, uint32_t depth, unsigned char* key, uint32_t key_len, uintptr_t value, enum value_type type, struct value_config* config, bool* new)
+art_node_insert(struct art_arena* arena, struct art_node* node, struct art_node** node_ref, uint32_t depth, unsigned char* key, uint32_t key_len, uintptr_t value, enum value_type type, struct value_config* config, bool* new)
 {
    struct art_leaf* leaf = NULL;
    struct art_leaf* min_leaf = NULL;
@@ -733,7 +912,7 @@ art_node_insert(struct art_node* node, struct art_node** node_ref, uint32_t dept
    {
       // Lazy expansion, skip creating an inner node since it currently will have only this one leaf.
       // We will compare keys when reach leaf anyway, the path doesn't need to 100% match the key along the way
-      create_art_leaf(&leaf, key, key_len, value, type, config);
+      create_art_leaf(arena, &leaf, key, key_len, value, type, config);
       *node_ref = SET_LEAF(leaf);
       *new = true;
       return NULL;
@@ -755,8 +934,8 @@ art_node_insert(struct art_node* node, struct art_node** node_ref, uint32_t dept
       // we compare with the existing key in the left most leaf and find an exact diverging point to split the node (see details below).
       // This way we inductively guarantee that all children to a parent share the same prefix even if it's only partially stored
       leaf_key = GET_LEAF(node)->key;
-      create_art_node(&new_node, Node4);
-      create_art_leaf(&leaf, key, key_len, value, type, config);
+      create_art_node(arena, &new_node, Node4);
+      create_art_leaf(arena, &leaf, key, key_len, value, type, config);
       // Get the diverging index after point of depth
       for (idx = depth; idx < min(key_len, GET_LEAF(node)->key_len); idx++)
       {
@@ -797,8 +976,8 @@ art_node_insert(struct art_node* node, struct art_node** node_ref, uint32_t dept
    if (diff_len < node->prefix_len)
    {
       // case 2, split the node
-      create_art_node(&new_node, Node4);
-      create_art_leaf(&leaf, key, key_len, value, type, config);
+      create_art_node(arena, &new_node, Node4);
+      create_art_leaf(arena, &leaf, key, key_len, value, type, config);
       new_node->prefix_len = diff_len;
       memcpy(new_node->prefix, node->prefix, min(MAX_PREFIX_LEN, diff_len));
       // We need to know if new bytes that were once outside the partial prefix range will now come into the range
@@ -844,12 +1023,12 @@ art_node_insert(struct art_node* node, struct art_node** node_ref, uint32_t dept
          {
             node->num_children++;
          }
-         return art_node_insert(*next, next, depth + 1, key, key_len, value, type, config, new);
+         return art_node_insert(arena, *next, next, depth + 1, key, key_len, value, type, config, new);
       }
       else
       {
          // add a child to current node since the spot is available
-         create_art_leaf(&leaf, key, key_len, value, type, config);
+         create_art_leaf(arena, &leaf, key, key_len, value, type, config);
          node_add_child(node, node_ref, key[depth], SET_LEAF(leaf));
          *new = true;
          return NULL;
@@ -1041,13 +1220,13 @@ node4_add_child(struct art_node4* node, struct art_node** node_ref, unsigned cha
    {
       // expand
       struct art_node16* new_node = NULL;
-      create_art_node16(&new_node);
+      create_art_node16(node->node.arena, &new_node);
       copy_header((struct art_node*)new_node, (struct art_node*)node);
       memcpy(new_node->children, node->children, node->node.num_children * sizeof(void*));
       memcpy(new_node->keys, node->keys, node->node.num_children);
       // replace the node through node reference
       *node_ref = (struct art_node*)new_node;
-      free(node);
+      release_art_node((struct art_node*)node);
 
       node16_add_child(new_node, node_ref, ch, child);
    }
@@ -1071,7 +1250,7 @@ node16_add_child(struct art_node16* node, struct art_node** node_ref, unsigned c
    {
       // expand
       struct art_node48* new_node = NULL;
-      create_art_node48(&new_node);
+      create_art_node48(node->node.arena, &new_node);
       copy_header((struct art_node*)new_node, (struct art_node*)node);
       memcpy(new_node->children, node->children, node->node.num_children * sizeof(void*));
       for (int i = 0; i < node->node.num_children; i++)
@@ -1080,7 +1259,7 @@ node16_add_child(struct art_node16* node, struct art_node** node_ref, unsigned c
       }
       // replace the node through node reference
       *node_ref = (struct art_node*)new_node;
-      free(node);
+      release_art_node((struct art_node*)node);
       node48_add_child(new_node, node_ref, ch, child);
    }
 }
@@ -1104,7 +1283,7 @@ node48_add_child(struct art_node48* node, struct art_node** node_ref, unsigned c
    {
       // expand
       struct art_node256* new_node = NULL;
-      create_art_node256(&new_node);
+      create_art_node256(node->node.arena, &new_node);
       copy_header((struct art_node*)new_node, (struct art_node*)node);
       for (int i = 0; i < 256; i++)
       {
@@ -1116,7 +1295,7 @@ node48_add_child(struct art_node48* node, struct art_node** node_ref, unsigned c
       }
       // replace the node through node reference
       *node_ref = (struct art_node*)new_node;
-      free(node);
+      release_art_node((struct art_node*)node);
       node256_add_child(new_node, ch, child);
    }
 }
@@ -1313,6 +1492,7 @@ node4_remove_child(struct art_node4* node, struct art_node** node_ref, unsigned
       {
          // replace directly
          *node_ref = child;
+         release_art_node((struct art_node*)node);
          return;
       }
       // parent prefix bytes + byte index to child + child prefix bytes
@@ -1329,7 +1509,7 @@ node4_remove_child(struct art_node4* node, struct art_node** node_ref, unsigned
       }
       child->prefix_len = node->node.prefix_len + 1 + child->prefix_len;
       memcpy(child->prefix, node->node.prefix, min(child->prefix_len, MAX_PREFIX_LEN));
-      free(node);
+      release_art_node((struct art_node*)node);
       // replace
       *node_ref = child;
    }
@@ -1348,11 +1528,11 @@ node16_remove_child(struct art_node16* node, struct art_node** node_ref, unsigne
    // Trick from libart, do not downgrade immediately to avoid jumping on 4/5 boundary
    if (node->node.num_children <= 3)
    {
-      create_art_node4(&new_node);
+      create_art_node4(node->node.arena, &new_node);
       copy_header((struct art_node*)new_node, (struct art_node*)node);
       memcpy(new_node->keys, node->keys, node->node.num_children);
       memcpy(new_node->children, node->children, node->node.num_children * sizeof(void*));
-      free(node);
+      release_art_node((struct art_node*)node);
       *node_ref = (struct art_node*)new_node;
    }
 }
@@ -1369,7 +1549,7 @@ node48_remove_child(struct art_node48* node, struct art_node** node_ref, unsigne
 
    if (node->node.num_children <= 12)
    {
-      create_art_node16(&new_node);
+      create_art_node16(node->node.arena, &new_node);
       copy_header((struct art_node*)new_node, (struct art_node*)node);
       for (int i = 0; i < 256; i++)
       {
@@ -1380,7 +1560,7 @@ node48_remove_child(struct art_node48* node, struct art_node** node_ref, unsigne
             cnt++;
          }
       }
-      free(node);
+      release_art_node((struct art_node*)node);
       *node_ref = (struct art_node*)new_node;
    }
 }
@@ -1407,7 +1587,7 @@ node256_remove_child(struct art_node256* node, struct art_node** node_ref, unsig
 
    if (node->node.num_children <= 37)
    {
-      create_art_node48(&new_node);
+      create_art_node48(node->node.arena, &new_node);
       copy_header((struct art_node*)new_node, (struct art_node*)node);
       for (int i = 0; i < 256; i++)
       {
@@ -1418,7 +1598,7 @@ node256_remove_child(struct art_node256* node, struct art_node** node_ref, unsig
             cnt++;
          }
       }
-      free(node);
+      release_art_node((struct art_node*)node);
       *node_ref = (struct art_node*)new_node;
    }
 }
@@ -1630,8 +1810,8 @@ art_to_json_string_cb(void* param, char* key, struct value* value)
    tag = pgmoneta_append(tag, ": ");
    str = pgmoneta_value_to_string(value, FORMAT_JSON, tag, p->indent);
    free(tag);
-   p->str = pgmoneta_append(p->str, str);
-   p->str = pgmoneta_append(p->str, has_next ? ",\n" : "\n");
+   pgmoneta_builder_append(p->str, str);
+   pgmoneta_builder_append(p->str, has_next ? ",\n" : "\n");
 
    free(str);
    return 0;
@@ -1654,8 +1834,8 @@ art_to_compact_json_string_cb(void* param, char* key, struct value* value)
    tag = pgmoneta_append(tag, ":");
    str = pgmoneta_value_to_string(value, FORMAT_JSON_COMPACT, tag, p->indent);
    free(tag);
-   p->str = pgmoneta_append(p->str, str);
-   p->str = pgmoneta_append(p->str, has_next ? "," : "");
+   pgmoneta_builder_append(p->str, str);
+   pgmoneta_builder_append(p->str, has_next ? "," : "");
 
    free(str);
    return 0;
@@ -1689,7 +1869,7 @@ art_to_text_string_cb(void* param, char* key, struct value* value)
          }
          else
          {
-            p->str = pgmoneta_indent(p->str, tag, 0);
+            pgmoneta_builder_append(p->str, tag);
             str = pgmoneta_value_to_string(value, FORMAT_TEXT, NULL, p->indent + INDENT_PER_LEVEL);
          }
       }
@@ -1703,8 +1883,8 @@ art_to_text_string_cb(void* param, char* key, struct value* value)
       str = pgmoneta_value_to_string(value, FORMAT_TEXT, tag, p->indent);
    }
    free(tag);
-   p->str = pgmoneta_append(p->str, str);
-   p->str = pgmoneta_append(p->str, has_next ? "\n" : "");
+   pgmoneta_builder_append(p->str, str);
+   pgmoneta_builder_append(p->str, has_next ? "\n" : "");
 
    free(str);
    return 0;
@@ -1713,75 +1893,71 @@ art_to_text_string_cb(void* param, char* key, struct value* value)
 static char*
 to_json_string(struct art* t, char* tag, int indent)
 {
-   char* ret = NULL;
-   ret = pgmoneta_indent(ret, tag, indent);
+   struct builder ret = {0};
+   pgmoneta_builder_indent(&ret, tag, indent);
    if (t == NULL || t->size == 0)
    {
-      ret = pgmoneta_append(ret, "{}");
-      return ret;
+      pgmoneta_builder_append(&ret, "{}");
+      return pgmoneta_builder_release(&ret);
    }
-   ret = pgmoneta_append(ret, "{\n");
+   pgmoneta_builder_append(&ret, "{\n");
    struct to_string_param param = {
       .indent = indent + INDENT_PER_LEVEL,
-      .str = ret,
+      .str = &ret,
       .t = t,
       .cnt = 0,
    };
    art_iterate(t, art_to_json_string_cb, &param);
-   ret = param.str;
-   ret = pgmoneta_indent(ret, NULL, indent);
-   ret = pgmoneta_append(ret, "}");
-   return ret;
+   pgmoneta_builder_indent(&ret, NULL, indent);
+   pgmoneta_builder_append(&ret, "}");
+   return pgmoneta_builder_release(&ret);
 }
 
 static char*
 to_compact_json_string(struct art* t, char* tag, int indent)
 {
-   char* ret = NULL;
-   ret = pgmoneta_indent(ret, tag, indent);
+   struct builder ret = {0};
+   pgmoneta_builder_indent(&ret, tag, indent);
    if (t == NULL || t->size == 0)
    {
-      ret = pgmoneta_append(ret, "{}");
-      return ret;
+      pgmoneta_builder_append(&ret, "{}");
+      return pgmoneta_builder_release(&ret);
    }
-   ret = pgmoneta_append(ret, "{");
+   pgmoneta_builder_append(&ret, "{");
    struct to_string_param param = {
       .indent = indent,
-      .str = ret,
+      .str = &ret,
       .t = t,
       .cnt = 0,
    };
    art_iterate(t, art_to_compact_json_string_cb, &param);
-   ret = param.str;
-   ret = pgmoneta_append(ret, "}");
-   return ret;
+   pgmoneta_builder_append(&ret, "}");
+   return pgmoneta_builder_release(&ret);
 }
 
 static char*
 to_text_string(struct art* t, char* tag, int indent)
 {
-   char* ret = NULL;
+   struct builder ret = {0};
    int next_indent = indent;
    if (tag != NULL && !pgmoneta_compare_string(tag, BULLET_POINT))
    {
-      ret = pgmoneta_indent(ret, tag, indent);
+      pgmoneta_builder_indent(&ret, tag, indent);
       next_indent += INDENT_PER_LEVEL;
    }
    if (t == NULL || t->size == 0)
    {
-      ret = pgmoneta_append(ret, "");
-      return ret;
+      return pgmoneta_builder_release(&ret);
    }
    struct to_string_param param = {
       .indent = next_indent,
-      .str = ret,
+      .str = &ret,
       .t = t,
       .cnt = 0,
       .tag = tag
    };
    art_iterate(t, art_to_text_string_cb, &param);
-   ret = param.str;
-   return ret;
+   return pgmoneta_builder_release(&ret);
 }
 
 static int
@@ -31,18 +31,199 @@
 #include <aes.h>
 #include <backup.h>
 #include <compression.h>
+#include <info.h>
+#include <lock.h>
 #include <logging.h>
 #include <management.h>
+#include <memory.h>
 #include <network.h>
 #include <utils.h>
+#include <walindex.h>
+#include <workers.h>
 #include <workflow.h>
 
+/* system */
+#include <errno.h>
+#include <ev.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
 #define NAME "backup"
 
+#define BACKUP_JOB_SIZE 65536
+
+/** @struct backup_job
+ * The header of a backup handed to the multiplexed backup process,
+ * followed by the payload. The client is passed along as SCM_RIGHTS
+ */
+struct backup_job
+{
+   int server;          /**< The server */
+   uint8_t compression; /**< The compress method for wire protocol */
+   uint8_t encryption;  /**< The encrypt method for wire protocol */
+};
+
+/** @struct backup_thread
+ * A backup running on a thread of the multiplexed backup process
+ */
+struct backup_thread
+{
+   int client_fd;       /**< The client */
+   int server;          /**< The server */
+   uint8_t compression; /**< The compress method for wire protocol */
+   uint8_t encryption;  /**< The encrypt method for wire protocol */
+   struct json* payload; /**< The payload */
+};
+
+static atomic_int number_of_threads = 0;
+
+static void backup_job_cb(struct ev_loop* loop, struct ev_io* watcher, int revents);
+static void* backup_thread_run(void* arg);
+static bool list_backup_field(struct json* fields, char* key);
+static int list_backup_put(struct json* j, struct json* fields, char* key, uintptr_t val, enum value_type type);
+
 void
 pgmoneta_backup(int client_fd, int server, uint8_t compression, uint8_t encryption, struct json* payload)
+{
+   int ret;
+
+   pgmoneta_start_logging();
+
+   ret = pgmoneta_backup_run(client_fd, server, compression, encryption, payload);
+
+   pgmoneta_stop_logging();
+
+   exit(ret);
+}
+
+void
+pgmoneta_backup_multiplex(int fd, char** argv)
+{
+   struct ev_loop* loop = NULL;
+   struct ev_io job;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   pgmoneta_start_logging();
+   pgmoneta_memory_init();
+
+   pgmoneta_set_proc_title(1, argv, "backup", "multiplex");
+
+   /* Each workflow sets and restores this mask, so the threads can't undo it for each other */
+   umask(S_IRWXG | S_IRWXO);
+
+   loop = ev_loop_new(pgmoneta_libev(config->libev));
+   if (loop == NULL)
+   {
+      pgmoneta_log_error("Backup: No loop implementation (%x) (%x)", pgmoneta_libev(config->libev), ev_supported_backends());
+      goto error;
+   }
+
+   ev_io_init(&job, backup_job_cb, fd, EV_READ);
+   ev_io_start(loop, &job);
+
+   /* Runs until the main process closes its end */
+   ev_run(loop, 0);
+
+   ev_io_stop(loop, &job);
+   ev_loop_destroy(loop);
+
+   while (atomic_load(&number_of_threads) > 0)
+   {
+      SLEEP(100000000L);
+   }
+
+   close(fd);
+
+   pgmoneta_memory_destroy();
+   pgmoneta_stop_logging();
+
+   exit(0);
+
+error:
+
+   close(fd);
+
+   pgmoneta_memory_destroy();
+   pgmoneta_stop_logging();
+
+   exit(1);
+}
+
+int
+pgmoneta_backup_multiplex_submit(int fd, int client_fd, int server, uint8_t compression, uint8_t encryption, struct json* payload)
+{
+   char* str = NULL;
+   char control[CMSG_SPACE(sizeof(int))];
+   struct backup_job job;
+   struct iovec iov[2];
+   struct msghdr msg;
+   struct cmsghdr* cmsg = NULL;
+   size_t length;
+
+   str = pgmoneta_json_to_string(payload, FORMAT_JSON_COMPACT, NULL, 0);
+   if (str == NULL)
+   {
+      goto error;
+   }
+
+   length = strlen(str) + 1;
+   if (length > BACKUP_JOB_SIZE)
+   {
+      goto error;
+   }
+
+   memset(&job, 0, sizeof(job));
+   job.server = server;
+   job.compression = compression;
+   job.encryption = encryption;
+
+   iov[0].iov_base = &job;
+   iov[0].iov_len = sizeof(job);
+   iov[1].iov_base = str;
+   iov[1].iov_len = length;
+
+   memset(&msg, 0, sizeof(msg));
+   memset(&control, 0, sizeof(control));
+   msg.msg_iov = iov;
+   msg.msg_iovlen = 2;
+   msg.msg_control = control;
+   msg.msg_controllen = sizeof(control);
+
+   cmsg = CMSG_FIRSTHDR(&msg);
+   cmsg->cmsg_level = SOL_SOCKET;
+   cmsg->cmsg_type = SCM_RIGHTS;
+   cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+   memcpy(CMSG_DATA(cmsg), &client_fd, sizeof(int));
+
+   if (sendmsg(fd, &msg, MSG_NOSIGNAL) != (ssize_t)(sizeof(job) + length))
+   {
+      pgmoneta_log_debug("Backup: Could not hand over the backup due to %s", strerror(errno));
+      errno = 0;
+      goto error;
+   }
+
+   free(str);
+
+   return 0;
+
+error:
+
+   free(str);
+
+   return 1;
+}
+
+int
+pgmoneta_backup_run(int client_fd, int server, uint8_t compression, uint8_t encryption, struct json* payload)
 {
    bool active = false;
+   bool locked = false;
    char date_str[128];
    char* date = NULL;
    char* elapsed = NULL;
@@ -67,10 +248,9 @@ pgmoneta_backup(int client_fd, int server, uint8_t compression, uint8_t encrypti
    struct backup* child = NULL;
    struct json* req = NULL;
    struct json* response = NULL;
+   struct lock* lock = NULL;
    struct main_configuration* config;
 
-   pgmoneta_start_logging();
-
    config = (struct main_configuration*)shmem;
 
    if (!config->common.servers[server].valid)
@@ -89,7 +269,15 @@ pgmoneta_backup(int client_fd, int server, uint8_t compression, uint8_t encrypti
       goto error;
    }
 
-   if (!atomic_compare_exchange_strong(&config->common.servers[server].repository, &active, true))
+   /* One backup at a time, next to the operations on the existing backups */
+   if (atomic_compare_exchange_strong(&config->common.servers[server].active_backup, &active, true) &&
+       pgmoneta_lock_repository(server, LOCK_SHARED, &lock))
+   {
+      atomic_store(&config->common.servers[server].active_backup, false);
+      active = true;
+   }
+
+   if (active)
    {
       pgmoneta_log_info("Backup: Server %s is active", config->common.servers[server].name);
       pgmoneta_management_response_error(NULL, client_fd, config->common.servers[server].name, MANAGEMENT_ERROR_BACKUP_ACTIVE, NAME, compression, encryption, payload);
@@ -97,7 +285,7 @@ pgmoneta_backup(int client_fd, int server, uint8_t compression, uint8_t encrypti
       goto done;
    }
 
-   config->common.servers[server].active_backup = true;
+   locked = true;
 
 #ifdef HAVE_FREEBSD
    clock_gettime(CLOCK_MONOTONIC_FAST, &start_t);
@@ -118,6 +306,14 @@ pgmoneta_backup(int client_fd, int server, uint8_t compression, uint8_t encrypti
    server_backup = pgmoneta_get_server_backup(server);
    root = pgmoneta_get_server_backup_identifier(server, date);
 
+   if (pgmoneta_lock_backup(lock, date, LOCK_EXCLUSIVE))
+   {
+      pgmoneta_log_info("Backup: %s/%s is active", config->common.servers[server].name, date);
+      pgmoneta_management_response_error(NULL, client_fd, config->common.servers[server].name, MANAGEMENT_ERROR_BACKUP_ACTIVE, NAME, compression, encryption, payload);
+
+      goto error;
+   }
+
    if (pgmoneta_art_create(&nodes))
    {
       goto error;
@@ -143,21 +339,15 @@ pgmoneta_backup(int client_fd, int server, uint8_t compression, uint8_t encrypti
       goto error;
    }
 
-   if (incremental != NULL)
+   /* The link step locks the backup it links to with it */
+   if (pgmoneta_art_insert(nodes, NODE_LOCK, (uintptr_t)lock, ValueRef))
    {
-      backup_incremental = false;
-      if (config->common.servers[server].version < 17)
-      {
-         pgmoneta_log_error("Incremental backup not supported for server %s at version %d",
-                            config->common.servers[server].name, config->common.servers[server].version);
-         goto error;
-      }
-      else
-      {
-         backup_incremental = true;
-      }
+      goto error;
    }
 
+   /* Before PostgreSQL 17 the incremental backup is made from the page LSNs */
+   backup_incremental = incremental != NULL;
+
    if (backup_incremental)
    {
       if (pgmoneta_get_backups(server_backup, &number_of_backups, &backups))
@@ -211,6 +401,14 @@ pgmoneta_backup(int client_fd, int server, uint8_t compression, uint8_t encrypti
          goto error;
       }
 
+      /* The parent can't be deleted or rolled up while the backup is made from it */
+      if (pgmoneta_lock_backup(lock, backups[backup_index]->label, LOCK_SHARED))
+      {
+         pgmoneta_log_info("Backup: %s/%s is active", config->common.servers[server].name, backups[backup_index]->label);
+         pgmoneta_management_response_error(NULL, client_fd, config->common.servers[server].name, MANAGEMENT_ERROR_BACKUP_ACTIVE, NAME, compression, encryption, payload);
+         goto error;
+      }
+
       incremental_base = pgmoneta_get_server_backup_identifier(server, backups[backup_index]->label);
 
       pgmoneta_art_insert(nodes, NODE_INCREMENTAL_BASE, (uintptr_t) incremental_base, ValueString);
@@ -280,8 +478,11 @@ pgmoneta_backup(int client_fd, int server, uint8_t compression, uint8_t encrypti
 
    pgmoneta_log_info("Backup: %s/%s (Elapsed: %s)", config->common.servers[server].name, date, elapsed);
 
-   config->common.servers[server].active_backup = false;
-   atomic_store(&config->common.servers[server].repository, false);
+   pgmoneta_unlock(lock);
+   lock = NULL;
+   atomic_store(&config->common.servers[server].active_backup, false);
+
+   pgmoneta_storage_changed(server);
 
 done:
 
@@ -307,9 +508,7 @@ done:
 
    pgmoneta_disconnect(client_fd);
 
-   pgmoneta_stop_logging();
-
-   exit(0);
+   return 0;
 
 error:
 
@@ -317,6 +516,14 @@ error:
    {
       pgmoneta_delete_directory(root);
    }
+   pgmoneta_storage_changed(server);
+
+   /* A process running several backups outlives this one */
+   if (locked)
+   {
+      pgmoneta_unlock(lock);
+      atomic_store(&config->common.servers[server].active_backup, false);
+   }
    for (int i = 0; i < number_of_backups; i++)
    {
       free(backups[i]);
@@ -340,12 +547,10 @@ error:
 
    pgmoneta_disconnect(client_fd);
 
-   pgmoneta_stop_logging();
-
-   exit(1);
+   return 1;
 }
 
-void
+int
 pgmoneta_list_backup(int client_fd, int server, uint8_t compression, uint8_t encryption, struct json* payload)
 {
    char* d = NULL;
@@ -356,13 +561,20 @@ pgmoneta_list_backup(int client_fd, int server, uint8_t compression, uint8_t enc
    double total_seconds;
    int32_t number_of_backups = 0;
    struct backup** backups = NULL;
+   struct wal_index* index = NULL;
    uint64_t wal = 0;
    uint64_t delta = 0;
+   int64_t offset = 0;
+   int64_t limit = 0;
+   int64_t chunk = 0;
+   int64_t matched = 0;
+   bool only_valid = false;
+   char* since = NULL;
+   char* until = NULL;
+   struct json* fields = NULL;
    struct json* response = NULL;
-   struct deque* jl = NULL;
    struct json* j = NULL;
    struct json* bcks = NULL;
-   struct deque_iterator* diter = NULL;
    struct main_configuration* config;
    struct json* request = NULL;
    char* sort_order = NULL;
@@ -377,17 +589,12 @@ pgmoneta_list_backup(int client_fd, int server, uint8_t compression, uint8_t enc
    clock_gettime(CLOCK_MONOTONIC_RAW, &start_t);
 #endif
 
-   if (pgmoneta_deque_create(false, &jl))
-   {
-      pgmoneta_management_response_error(NULL, client_fd, config->common.servers[server].name, MANAGEMENT_ERROR_LIST_BACKUP_DEQUE_CREATE, NAME, compression, encryption, payload);
-      pgmoneta_log_error("List backup: Error creating the deque for %s", config->common.servers[server].name);
-
-      goto error;
-   }
-
    d = pgmoneta_get_server_backup(server);
    wal_dir = pgmoneta_get_server_wal(server);
 
+   /* List the WAL once, the sizes of all backups are counted from it */
+   pgmoneta_wal_index_create(wal_dir, true, &index);
+
    if (pgmoneta_get_backups(d, &number_of_backups, &backups))
    {
       pgmoneta_management_response_error(NULL, client_fd, config->common.servers[server].name, MANAGEMENT_ERROR_LIST_BACKUP_BACKUPS, NAME, compression, encryption, payload);
@@ -438,102 +645,161 @@ pgmoneta_list_backup(int client_fd, int server, uint8_t compression, uint8_t enc
       }
    }
 
+   if (request != NULL)
+   {
+      offset = (int64_t)pgmoneta_json_get(request, MANAGEMENT_ARGUMENT_OFFSET);
+      limit = (int64_t)pgmoneta_json_get(request, MANAGEMENT_ARGUMENT_LIMIT);
+      chunk = (int64_t)pgmoneta_json_get(request, MANAGEMENT_ARGUMENT_CHUNK);
+      only_valid = (bool)pgmoneta_json_get(request, MANAGEMENT_ARGUMENT_VALID);
+      since = (char*)pgmoneta_json_get(request, MANAGEMENT_ARGUMENT_SINCE);
+      until = (char*)pgmoneta_json_get(request, MANAGEMENT_ARGUMENT_UNTIL);
+      fields = (struct json*)pgmoneta_json_get(request, MANAGEMENT_ARGUMENT_FIELDS);
+   }
+
+   if (pgmoneta_json_create(&bcks))
+   {
+      goto error;
+   }
+
    for (int i = 0; i < number_of_backups; i++)
    {
       if (backups[i] != NULL)
       {
-         if (pgmoneta_json_create(&j))
+         /* Labels are timestamps, so a range is a string comparison */
+         if ((only_valid && backups[i]->valid != VALID_TRUE) ||
+             (since != NULL && strcmp(backups[i]->label, since) < 0) ||
+             (until != NULL && strcmp(backups[i]->label, until) > 0))
          {
-            goto json_error;
+            continue;
          }
 
-         if (pgmoneta_json_put(j, MANAGEMENT_ARGUMENT_SERVER, (uintptr_t)config->common.servers[server].name, ValueString))
+         matched++;
+
+         if (matched <= offset || (limit > 0 && matched > offset + limit))
          {
-            goto json_error;
+            continue;
          }
 
-         if (pgmoneta_json_put(j, MANAGEMENT_ARGUMENT_BACKUP, (uintptr_t)backups[i]->label, ValueString))
+         if (pgmoneta_json_create(&j))
          {
             goto json_error;
          }
 
-         if (pgmoneta_json_put(j, MANAGEMENT_ARGUMENT_KEEP, (uintptr_t)backups[i]->keep, ValueBool))
+         if (list_backup_put(j, fields, MANAGEMENT_ARGUMENT_SERVER, (uintptr_t)config->common.servers[server].name, ValueString))
          {
             goto json_error;
          }
 
-         if (pgmoneta_json_put(j, MANAGEMENT_ARGUMENT_VALID, (uintptr_t)backups[i]->valid, ValueInt8))
+         if (pgmoneta_json_put(j, MANAGEMENT_ARGUMENT_BACKUP, (uintptr_t)backups[i]->label, ValueString))
          {
             goto json_error;
          }
 
-         if (pgmoneta_json_put(j, MANAGEMENT_ARGUMENT_BACKUP_SIZE, (uintptr_t)backups[i]->backup_size, ValueUInt64))
+         if (list_backup_put(j, fields, MANAGEMENT_ARGUMENT_KEEP, (uintptr_t)backups[i]->keep, ValueBool))
          {
             goto json_error;
          }
 
-         if (pgmoneta_json_put(j, MANAGEMENT_ARGUMENT_RESTORE_SIZE, (uintptr_t)backups[i]->restore_size, ValueUInt64))
+         if (list_backup_put(j, fields, MANAGEMENT_ARGUMENT_VALID, (uintptr_t)backups[i]->valid, ValueInt8))
          {
             goto json_error;
          }
 
-         if (pgmoneta_json_put(j, MANAGEMENT_ARGUMENT_BIGGEST_FILE_SIZE, (uintptr_t)backups[i]->biggest_file_size, ValueUInt64))
+         if (list_backup_put(j, fields, MANAGEMENT_ARGUMENT_BACKUP_SIZE, (uintptr_t)backups[i]->backup_size, ValueUInt64))
          {
             goto json_error;
          }
 
-         if (pgmoneta_json_put(j, MANAGEMENT_ARGUMENT_COMPRESSION, (uintptr_t)backups[i]->compression, ValueInt32))
+         if (list_backup_put(j, fields, MANAGEMENT_ARGUMENT_RESTORE_SIZE, (uintptr_t)backups[i]->restore_size, ValueUInt64))
          {
             goto json_error;
          }
 
-         if (pgmoneta_json_put(j, MANAGEMENT_ARGUMENT_ENCRYPTION, (uintptr_t)backups[i]->encryption, ValueInt32))
+         if (list_backup_put(j, fields, MANAGEMENT_ARGUMENT_BIGGEST_FILE_SIZE, (uintptr_t)backups[i]->biggest_file_size, ValueUInt64))
          {
             goto json_error;
          }
 
-         if (pgmoneta_json_put(j, MANAGEMENT_ARGUMENT_COMMENTS, (uintptr_t)backups[i]->comments, ValueString))
+         if (list_backup_put(j, fields, MANAGEMENT_ARGUMENT_COMPRESSION, (uintptr_t)backups[i]->compression, ValueInt32))
          {
             goto json_error;
          }
 
-         if (pgmoneta_json_put(j, MANAGEMENT_ARGUMENT_INCREMENTAL, (uintptr_t)backups[i]->type, ValueBool))
+         if (list_backup_put(j, fields, MANAGEMENT_ARGUMENT_ENCRYPTION, (uintptr_t)backups[i]->encryption, ValueInt32))
          {
             goto json_error;
          }
 
-         if (pgmoneta_json_put(j, MANAGEMENT_ARGUMENT_INCREMENTAL_PARENT, (uintptr_t)backups[i]->parent_label, ValueString))
+         if (list_backup_put(j, fields, MANAGEMENT_ARGUMENT_COMMENTS, (uintptr_t)backups[i]->comments, ValueString))
          {
             goto json_error;
          }
 
-         wal = pgmoneta_number_of_wal_files(wal_dir, &backups[i]->wal[0], NULL);
-         wal *= config->common.servers[server].wal_size;
-
-         if (pgmoneta_json_put(j, MANAGEMENT_ARGUMENT_WAL, (uintptr_t)wal, ValueUInt64))
+         if (list_backup_put(j, fields, MANAGEMENT_ARGUMENT_INCREMENTAL, (uintptr_t)backups[i]->type, ValueBool))
          {
             goto json_error;
          }
 
-         delta = 0;
-
-         if (i > 0)
+         if (list_backup_put(j, fields, MANAGEMENT_ARGUMENT_INCREMENTAL_PARENT, (uintptr_t)backups[i]->parent_label, ValueString))
          {
-            delta = pgmoneta_number_of_wal_files(wal_dir, &backups[i - 1]->wal[0], &backups[i]->wal[0]);
-            delta *= config->common.servers[server].wal_size;
+            goto json_error;
          }
 
-         if (pgmoneta_json_put(j, MANAGEMENT_ARGUMENT_WAL, (uintptr_t)delta, ValueUInt64))
+         if (list_backup_field(fields, MANAGEMENT_ARGUMENT_WAL))
          {
-            goto json_error;
+            wal = pgmoneta_wal_index_count(index, &backups[i]->wal[0], NULL);
+            wal *= config->common.servers[server].wal_size;
+
+            if (pgmoneta_json_put(j, MANAGEMENT_ARGUMENT_WAL, (uintptr_t)wal, ValueUInt64))
+            {
+               goto json_error;
+            }
+
+            delta = 0;
+
+            if (i > 0)
+            {
+               delta = pgmoneta_wal_index_count(index, &backups[i - 1]->wal[0], &backups[i]->wal[0]);
+               delta *= config->common.servers[server].wal_size;
+            }
+
+            if (pgmoneta_json_put(j, MANAGEMENT_ARGUMENT_WAL, (uintptr_t)delta, ValueUInt64))
+            {
+               goto json_error;
+            }
          }
 
-         if (pgmoneta_deque_add(jl, NULL, (uintptr_t)j, ValueJSON))
+         if (pgmoneta_json_append(bcks, (uintptr_t)j, ValueJSON))
          {
             goto json_error;
          }
 
          j = NULL;
+
+         /* Send a full chunk right away, the final response carries the rest and the outcome */
+         if (chunk > 0 && pgmoneta_json_array_length(bcks) >= (uint64_t)chunk)
+         {
+            if (pgmoneta_management_create_response(payload, server, &response))
+            {
+               goto json_error;
+            }
+
+            pgmoneta_json_put(response, MANAGEMENT_ARGUMENT_SERVER, (uintptr_t)config->common.servers[server].name, ValueString);
+            pgmoneta_json_put(response, MANAGEMENT_ARGUMENT_BACKUPS, (uintptr_t)bcks, ValueJSON);
+            pgmoneta_json_put(response, MANAGEMENT_ARGUMENT_PARTIAL, (uintptr_t)true, ValueBool);
+            bcks = NULL;
+
+            if (pgmoneta_management_write_json(NULL, client_fd, compression, encryption, payload))
+            {
+               pgmoneta_log_error("List backup: Error sending response for %s", config->common.servers[server].name);
+               goto error;
+            }
+
+            if (pgmoneta_json_create(&bcks))
+            {
+               goto error;
+            }
+         }
       }
    }
 
@@ -549,23 +815,10 @@ pgmoneta_list_backup(int client_fd, int server, uint8_t compression, uint8_t enc
       goto json_error;
    }
 
-   if (pgmoneta_json_create(&bcks))
-   {
-      goto error;
-   }
-
-   if (pgmoneta_deque_iterator_create(jl, &diter))
-   {
-      goto error;
-   }
-
-   while (pgmoneta_deque_iterator_next(diter))
-   {
-      pgmoneta_json_append(bcks, (uintptr_t)pgmoneta_value_data(diter->value), ValueJSON);
-   }
-
+   pgmoneta_json_put(response, MANAGEMENT_ARGUMENT_MORE, (uintptr_t)(limit > 0 && matched > offset + limit), ValueBool);
    pgmoneta_json_put(response, MANAGEMENT_ARGUMENT_SERVER, (uintptr_t)config->common.servers[server].name, ValueString);
    pgmoneta_json_put(response, MANAGEMENT_ARGUMENT_BACKUPS, (uintptr_t)bcks, ValueJSON);
+   bcks = NULL;
 
 #ifdef HAVE_FREEBSD
    clock_gettime(CLOCK_MONOTONIC_FAST, &end_t);
@@ -592,15 +845,15 @@ pgmoneta_list_backup(int client_fd, int server, uint8_t compression, uint8_t enc
    }
    free(backups);
 
+   pgmoneta_wal_index_destroy(index);
+
    free(d);
    free(wal_dir);
    free(elapsed);
 
    pgmoneta_disconnect(client_fd);
 
-   pgmoneta_stop_logging();
-
-   exit(0);
+   return 0;
 
 json_error:
 
@@ -609,6 +862,8 @@ json_error:
 
 error:
 
+   pgmoneta_json_destroy(j);
+   pgmoneta_json_destroy(bcks);
    pgmoneta_json_destroy(payload);
 
    for (int i = 0; i < number_of_backups; i++)
@@ -617,15 +872,15 @@ error:
    }
    free(backups);
 
+   pgmoneta_wal_index_destroy(index);
+
    free(d);
    free(wal_dir);
    free(elapsed);
 
    pgmoneta_disconnect(client_fd);
 
-   pgmoneta_stop_logging();
-
-   exit(1);
+   return 1;
 }
 
 void
@@ -747,3 +1002,194 @@ pgmoneta_get_backup_max_rate(int server)
 
    return config->backup_max_rate;
 }
+
+static bool
+list_backup_field(struct json* fields, char* key)
+{
+   bool found = false;
+   struct json_iterator* iter = NULL;
+
+   /* No projection, all the fields */
+   if (fields == NULL || pgmoneta_json_array_length(fields) == 0)
+   {
+      return true;
+   }
+
+   if (pgmoneta_json_iterator_create(fields, &iter))
+   {
+      return true;
+   }
+
+   while (!found && pgmoneta_json_iterator_next(iter))
+   {
+      if (iter->value->type == ValueString && iter->value->data != 0 && !strcmp((char*)iter->value->data, key))
+      {
+         found = true;
+      }
+   }
+
+   pgmoneta_json_iterator_destroy(iter);
+
+   return found;
+}
+
+static int
+list_backup_put(struct json* j, struct json* fields, char* key, uintptr_t val, enum value_type type)
+{
+   if (!list_backup_field(fields, key))
+   {
+      return 0;
+   }
+
+   return pgmoneta_json_put(j, key, val, type);
+}
+
+static void
+backup_job_cb(struct ev_loop* loop, struct ev_io* watcher, int revents)
+{
+   char* data = NULL;
+   char control[CMSG_SPACE(sizeof(int))];
+   int client_fd = -1;
+   ssize_t n;
+   pthread_t thread;
+   pthread_attr_t attr;
+   struct backup_job job;
+   struct iovec iov[2];
+   struct msghdr msg;
+   struct cmsghdr* cmsg = NULL;
+   struct backup_thread* bt = NULL;
+   struct json* payload = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (EV_ERROR & revents)
+   {
+      pgmoneta_log_trace("backup_job_cb: got invalid event: %s", strerror(errno));
+      errno = 0;
+      return;
+   }
+
+   data = (char*)malloc(BACKUP_JOB_SIZE);
+   if (data == NULL)
+   {
+      goto error;
+   }
+
+   memset(&job, 0, sizeof(job));
+   memset(&control, 0, sizeof(control));
+   memset(data, 0, BACKUP_JOB_SIZE);
+
+   iov[0].iov_base = &job;
+   iov[0].iov_len = sizeof(job);
+   iov[1].iov_base = data;
+   iov[1].iov_len = BACKUP_JOB_SIZE;
+
+   memset(&msg, 0, sizeof(msg));
+   msg.msg_iov = iov;
+   msg.msg_iovlen = 2;
+   msg.msg_control = control;
+   msg.msg_controllen = sizeof(control);
+
+   n = recvmsg(watcher->fd, &msg, 0);
+
+   if (n == -1 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+   {
+      errno = 0;
+      free(data);
+      return;
+   }
+
+   if (n <= 0)
+   {
+      /* The main process is gone, so no more backups arrive */
+      free(data);
+      ev_break(loop, EVBREAK_ALL);
+      return;
+   }
+
+   for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+   {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+      {
+         memcpy(&client_fd, CMSG_DATA(cmsg), sizeof(int));
+      }
+   }
+
+   if (client_fd == -1 || n <= (ssize_t)sizeof(job) ||
+       job.server < 0 || job.server >= config->common.number_of_servers)
+   {
+      pgmoneta_log_error("Backup: Invalid backup handed over");
+      goto error;
+   }
+
+   data[BACKUP_JOB_SIZE - 1] = '\0';
+   if (pgmoneta_json_parse_string(data, &payload))
+   {
+      pgmoneta_log_error("Backup: Invalid payload for %s", config->common.servers[job.server].name);
+      goto error;
+   }
+
+   bt = (struct backup_thread*)malloc(sizeof(struct backup_thread));
+   if (bt == NULL)
+   {
+      goto error;
+   }
+
+   bt->client_fd = client_fd;
+   bt->server = job.server;
+   bt->compression = job.compression;
+   bt->encryption = job.encryption;
+   bt->payload = payload;
+
+   atomic_fetch_add(&number_of_threads, 1);
+
+   pthread_attr_init(&attr);
+   pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+   if (pthread_create(&thread, &attr, backup_thread_run, bt))
+   {
+      pthread_attr_destroy(&attr);
+      atomic_fetch_sub(&number_of_threads, 1);
+      pgmoneta_log_error("Backup: Cannot create thread for %s", config->common.servers[job.server].name);
+      pgmoneta_management_response_error(NULL, client_fd, config->common.servers[job.server].name, MANAGEMENT_ERROR_BACKUP_NOFORK, NAME,
+                                         job.compression, job.encryption, payload);
+      free(bt);
+      goto error;
+   }
+
+   pthread_attr_destroy(&attr);
+
+   free(data);
+
+   return;
+
+error:
+
+   pgmoneta_json_destroy(payload);
+   free(data);
+
+   if (client_fd != -1)
+   {
+      pgmoneta_disconnect(client_fd);
+   }
+}
+
+static void*
+backup_thread_run(void* arg)
+{
+   struct backup_thread* bt = (struct backup_thread*)arg;
+
+   pgmoneta_memory_init();
+
+   pgmoneta_backup_run(bt->client_fd, bt->server, bt->compression, bt->encryption, bt->payload);
+
+   pgmoneta_workers_context_clear();
+   pgmoneta_memory_destroy();
+
+   free(bt);
+
+   atomic_fetch_sub(&number_of_threads, 1);
+
+   return NULL;
+}
@@ -0,0 +1,292 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <bandwidth.h>
+#include <logging.h>
+#include <utils.h>
+
+/* system */
+#include <errno.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+
+/* The share of each process is recalculated this often */
+#define BANDWIDTH_REFRESH 100000000UL
+
+/* The WAL rate is measured over windows of this length, and forgotten after two */
+#define BANDWIDTH_WAL_WINDOW 1000000000UL
+
+/* The others keep at least this fraction of the budget */
+#define BANDWIDTH_MIN_FRACTION 10
+
+#define BANDWIDTH_MAX_DEPTH 4
+
+static int weights[] = {
+   2, /* BANDWIDTH_BACKUP */
+   4, /* BANDWIDTH_RESTORE */
+   1  /* BANDWIDTH_UPLOAD */
+};
+
+static int slot = -1;
+static int types[BANDWIDTH_MAX_DEPTH];
+static int depth = 0;
+static struct token_bucket share;
+static atomic_ulong refreshed;
+
+static unsigned long bandwidth_now(void);
+static void bandwidth_refresh(void);
+
+int
+pgmoneta_bandwidth_start(int type)
+{
+   int pid;
+   int expected;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (config->bandwidth_max_rate <= 0 || depth >= BANDWIDTH_MAX_DEPTH)
+   {
+      return 1;
+   }
+
+   if (slot == -1)
+   {
+      for (int i = 0; slot == -1 && i < BANDWIDTH_SLOTS; i++)
+      {
+         expected = atomic_load(&config->bandwidth.pids[i]);
+
+         // a slot of a process that is gone is taken over
+         if (expected != 0 && (kill(expected, 0) == 0 || errno != ESRCH))
+         {
+            continue;
+         }
+
+         pid = (int)getpid();
+         if (atomic_compare_exchange_strong(&config->bandwidth.pids[i], &expected, pid))
+         {
+            slot = i;
+         }
+      }
+
+      if (slot == -1)
+      {
+         pgmoneta_log_warn("Bandwidth: No free slot, the budget is not applied");
+         return 1;
+      }
+
+      pgmoneta_token_bucket_init(&share, config->bandwidth_max_rate);
+      share.burst = DEFAULT_BURST;
+      atomic_store(&share.cur_tokens, DEFAULT_BURST);
+   }
+
+   types[depth++] = type;
+   atomic_store(&config->bandwidth.types[slot], type);
+   atomic_store(&refreshed, 0);
+
+   return 0;
+}
+
+void
+pgmoneta_bandwidth_stop(void)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (slot == -1 || depth == 0)
+   {
+      return;
+   }
+
+   depth--;
+
+   if (depth > 0)
+   {
+      atomic_store(&config->bandwidth.types[slot], types[depth - 1]);
+   }
+   else
+   {
+      atomic_store(&config->bandwidth.pids[slot], 0);
+      slot = -1;
+   }
+
+   atomic_store(&refreshed, 0);
+}
+
+bool
+pgmoneta_bandwidth_active(void)
+{
+   return slot != -1;
+}
+
+void
+pgmoneta_bandwidth_consume(size_t bytes)
+{
+   if (slot == -1 || bytes == 0)
+   {
+      return;
+   }
+
+   bandwidth_refresh();
+
+   pgmoneta_token_bucket_consume(&share, bytes);
+}
+
+int
+pgmoneta_bandwidth_once(size_t bytes)
+{
+   if (slot == -1 || bytes == 0)
+   {
+      return 0;
+   }
+
+   bandwidth_refresh();
+
+   return pgmoneta_token_bucket_once(&share, bytes);
+}
+
+void
+pgmoneta_bandwidth_wal(size_t bytes)
+{
+   unsigned long now;
+   unsigned long start;
+   unsigned long total;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (config->bandwidth_max_rate <= 0)
+   {
+      return;
+   }
+
+   atomic_fetch_add(&config->bandwidth.wal_bytes, bytes);
+
+   now = bandwidth_now();
+   start = atomic_load(&config->bandwidth.wal_start);
+
+   if (now - start < BANDWIDTH_WAL_WINDOW)
+   {
+      return;
+   }
+
+   // one of the receivers closes the window
+   if (atomic_compare_exchange_strong(&config->bandwidth.wal_start, &start, now))
+   {
+      total = atomic_exchange(&config->bandwidth.wal_bytes, 0);
+
+      atomic_store(&config->bandwidth.wal_rate, start == 0 ? 0 : (unsigned long)((double)total * 1000000000.0 / (now - start)));
+      atomic_store(&config->bandwidth.wal_time, now);
+   }
+}
+
+static unsigned long
+bandwidth_now(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+
+   return (unsigned long)ts.tv_sec * 1000000000UL + (unsigned long)ts.tv_nsec;
+}
+
+/**
+ * Calculate the share of this process from the budget, the rate of the WAL
+ * streaming and the weights of the processes taking part
+ */
+static void
+bandwidth_refresh(void)
+{
+   int pid;
+   int type;
+   long total = 0;
+   long budget;
+   long wal = 0;
+   long rate;
+   unsigned long now;
+   unsigned long last;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   now = bandwidth_now();
+   last = atomic_load(&refreshed);
+
+   if (last != 0 && now - last < BANDWIDTH_REFRESH)
+   {
+      return;
+   }
+
+   if (!atomic_compare_exchange_strong(&refreshed, &last, now))
+   {
+      return;
+   }
+
+   for (int i = 0; i < BANDWIDTH_SLOTS; i++)
+   {
+      pid = atomic_load(&config->bandwidth.pids[i]);
+      type = atomic_load(&config->bandwidth.types[i]);
+
+      if (pid != 0 && type >= 0 && type < (int)(sizeof(weights) / sizeof(weights[0])))
+      {
+         total += weights[type];
+      }
+   }
+
+   type = types[depth > 0 ? depth - 1 : 0];
+   if (total <= 0 || type < 0 || type >= (int)(sizeof(weights) / sizeof(weights[0])))
+   {
+      return;
+   }
+
+   budget = config->bandwidth_max_rate;
+
+   if (now - atomic_load(&config->bandwidth.wal_time) < 2 * BANDWIDTH_WAL_WINDOW)
+   {
+      wal = (long)atomic_load(&config->bandwidth.wal_rate);
+   }
+
+   budget -= wal;
+   if (budget < config->bandwidth_max_rate / BANDWIDTH_MIN_FRACTION)
+   {
+      budget = config->bandwidth_max_rate / BANDWIDTH_MIN_FRACTION;
+   }
+
+   rate = budget * weights[type] / total;
+   if (rate < 1)
+   {
+      rate = 1;
+   }
+
+   share.max_rate = rate;
+}
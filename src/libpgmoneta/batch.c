@@ -0,0 +1,681 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <backup.h>
+#include <batch.h>
+#include <info.h>
+#include <json.h>
+#include <logging.h>
+#include <management.h>
+#include <network.h>
+#include <utils.h>
+#include <verify.h>
+#include <workers.h>
+
+/* system */
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#define NAME "batch"
+
+/* With a bandwidth budget each operation gets at least this rate */
+#define BATCH_MIN_RATE (16 * 1024 * 1024)
+
+/* The I/O workers of the running operations */
+#define BATCH_MAX_IO_WORKERS 64
+
+/* The previous backups a duration is estimated from */
+#define BATCH_HISTORY 5
+
+/** @struct batch_job
+ * Defines an operation of the batch
+ */
+struct batch_job
+{
+   int server;          /**< The server */
+   pid_t pid;           /**< The process */
+   int fd;              /**< The socket the response is read from */
+   int workers;         /**< The workers of the operation */
+   int io_workers;      /**< The I/O workers of the operation */
+   double estimate;     /**< The estimated seconds of a backup */
+   struct json* result; /**< The first response */
+};
+
+static int max_jobs(int number_of_servers);
+static int job_workers(int server);
+static int job_io_workers(int server);
+static double job_estimate(int server);
+static int job_compare(const void* a, const void* b);
+static int window_jobs(struct batch_job* jobs, int number_of_jobs, int max);
+static void job_done(struct batch_job* job, int32_t action);
+static int job_start(struct batch_job* job, int32_t action, struct json* payload, struct batch_job* jobs, int number_of_jobs, int client_fd, char** argv);
+static int job_result(struct batch_job* job, int32_t error, struct json* servers);
+
+void
+pgmoneta_batch(int client_fd, int32_t action, uint8_t compression, uint8_t encryption, struct json* payload, char** argv)
+{
+   int number_of_servers = 0;
+   int next = 0;
+   int running = 0;
+   int failed = 0;
+   int jobs_max;
+   int cpus;
+   int workers = 0;
+   int io_workers = 0;
+   struct timespec start_t;
+   struct timespec end_t;
+   struct batch_job jobs[NUMBER_OF_SERVERS];
+   struct pollfd fds[NUMBER_OF_SERVERS];
+   int slots[NUMBER_OF_SERVERS];
+   struct json* response = NULL;
+   struct json* servers = NULL;
+   struct json* outcome = NULL;
+   struct main_configuration* config;
+
+   pgmoneta_start_logging();
+
+   config = (struct main_configuration*)shmem;
+
+   pgmoneta_set_proc_title(1, argv, "batch", action == MANAGEMENT_BACKUP ? "backup" : "verify");
+
+#ifdef HAVE_FREEBSD
+   clock_gettime(CLOCK_MONOTONIC_FAST, &start_t);
+#else
+   clock_gettime(CLOCK_MONOTONIC_RAW, &start_t);
+#endif
+
+   memset(&jobs, 0, sizeof(jobs));
+
+   for (int i = 0; i < config->common.number_of_servers; i++)
+   {
+      if (config->common.servers[i].valid)
+      {
+         jobs[number_of_servers].server = i;
+         jobs[number_of_servers].pid = -1;
+         jobs[number_of_servers].fd = -1;
+         jobs[number_of_servers].workers = job_workers(i);
+         jobs[number_of_servers].io_workers = job_io_workers(i);
+         number_of_servers++;
+      }
+   }
+
+   if (pgmoneta_json_create(&servers))
+   {
+      goto error;
+   }
+
+   jobs_max = max_jobs(number_of_servers);
+
+   if (action == MANAGEMENT_BACKUP)
+   {
+      for (int i = 0; i < number_of_servers; i++)
+      {
+         jobs[i].estimate = job_estimate(jobs[i].server);
+
+         /* The retention of the server waits for its backup, at most until the window ends */
+         if (config->backup_window > 0)
+         {
+            atomic_store(&config->common.servers[jobs[i].server].retention_after, (long long)time(NULL) + config->backup_window);
+         }
+      }
+
+      /* Longest first, so the short backups fill in behind the long ones */
+      qsort(&jobs[0], number_of_servers, sizeof(struct batch_job), job_compare);
+
+      if (config->backup_window > 0)
+      {
+         jobs_max = window_jobs(&jobs[0], number_of_servers, jobs_max);
+      }
+   }
+
+   cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+   if (cpus <= 0)
+   {
+      cpus = 1;
+   }
+
+   pgmoneta_log_debug("Batch: %d servers, %d at a time on %d CPUs", number_of_servers, jobs_max, cpus);
+
+   while (next < number_of_servers || running > 0)
+   {
+      int n = 0;
+
+      /* Start the operations in order, as long as they fit in the budget */
+      while (next < number_of_servers &&
+             (running == 0 ||
+              (running < jobs_max &&
+               workers + jobs[next].workers <= cpus &&
+               io_workers + jobs[next].io_workers <= BATCH_MAX_IO_WORKERS)))
+      {
+         if (job_start(&jobs[next], action, payload, &jobs[0], next, client_fd, argv))
+         {
+            job_result(&jobs[next], action == MANAGEMENT_BACKUP ? MANAGEMENT_ERROR_BACKUP_NOFORK : MANAGEMENT_ERROR_VERIFY_NOFORK, servers);
+            job_done(&jobs[next], action);
+            failed++;
+         }
+         else
+         {
+            workers += jobs[next].workers;
+            io_workers += jobs[next].io_workers;
+            running++;
+         }
+         next++;
+      }
+
+      for (int i = 0; i < next; i++)
+      {
+         if (jobs[i].fd != -1)
+         {
+            fds[n].fd = jobs[i].fd;
+            fds[n].events = POLLIN;
+            fds[n].revents = 0;
+            slots[n] = i;
+            n++;
+         }
+      }
+
+      if (n == 0)
+      {
+         continue;
+      }
+
+      if (poll(&fds[0], n, -1) == -1)
+      {
+         if (errno == EINTR)
+         {
+            errno = 0;
+            continue;
+         }
+         goto error;
+      }
+
+      for (int i = 0; i < n; i++)
+      {
+         struct batch_job* job = &jobs[slots[i]];
+         struct json* j = NULL;
+
+         if (fds[i].revents == 0)
+         {
+            continue;
+         }
+
+         /* The first response is the outcome, the operation is done when the socket is closed */
+         if (!pgmoneta_management_read_json(NULL, job->fd, NULL, NULL, &j))
+         {
+            if (job->result == NULL)
+            {
+               job->result = j;
+            }
+            else
+            {
+               pgmoneta_json_destroy(j);
+            }
+            continue;
+         }
+
+         pgmoneta_disconnect(job->fd);
+         job->fd = -1;
+
+         waitpid(job->pid, NULL, 0);
+         job->pid = -1;
+
+         job_done(job, action);
+
+         if (job_result(job, action == MANAGEMENT_BACKUP ? MANAGEMENT_ERROR_BACKUP_ERROR : MANAGEMENT_ERROR_VERIFY_ERROR, servers))
+         {
+            failed++;
+         }
+
+         workers -= job->workers;
+         io_workers -= job->io_workers;
+         running--;
+      }
+   }
+
+#ifdef HAVE_FREEBSD
+   clock_gettime(CLOCK_MONOTONIC_FAST, &end_t);
+#else
+   clock_gettime(CLOCK_MONOTONIC_RAW, &end_t);
+#endif
+
+   if (pgmoneta_management_create_response(payload, -1, &response))
+   {
+      goto error;
+   }
+
+   pgmoneta_json_put(response, MANAGEMENT_ARGUMENT_NUMBER_OF_SERVERS, (uintptr_t)number_of_servers, ValueInt32);
+   pgmoneta_json_put(response, MANAGEMENT_ARGUMENT_SERVERS, (uintptr_t)servers, ValueJSON);
+   servers = NULL;
+
+   if (failed == 0)
+   {
+      if (pgmoneta_management_response_ok(NULL, client_fd, start_t, end_t, compression, encryption, payload))
+      {
+         goto error;
+      }
+   }
+   else
+   {
+      /* Keep the outcome of each server in the response */
+      if (pgmoneta_management_create_outcome_failure(payload, action == MANAGEMENT_BACKUP ? MANAGEMENT_ERROR_BACKUP_ERROR : MANAGEMENT_ERROR_VERIFY_ERROR,
+                                                     NAME, &outcome))
+      {
+         goto error;
+      }
+
+      if (pgmoneta_management_write_json(NULL, client_fd, compression, encryption, payload))
+      {
+         goto error;
+      }
+   }
+
+   pgmoneta_log_info("Batch: %d of %d servers succeeded", number_of_servers - failed, number_of_servers);
+
+   pgmoneta_json_destroy(payload);
+
+   pgmoneta_disconnect(client_fd);
+
+   pgmoneta_stop_logging();
+
+   exit(failed == 0 ? 0 : 1);
+
+error:
+
+   for (int i = 0; i < number_of_servers; i++)
+   {
+      if (jobs[i].fd != -1)
+      {
+         pgmoneta_disconnect(jobs[i].fd);
+      }
+      if (jobs[i].pid > 0)
+      {
+         waitpid(jobs[i].pid, NULL, 0);
+      }
+      job_done(&jobs[i], action);
+      pgmoneta_json_destroy(jobs[i].result);
+   }
+
+   pgmoneta_json_destroy(servers);
+
+   pgmoneta_management_response_error(NULL, client_fd, NULL, action == MANAGEMENT_BACKUP ? MANAGEMENT_ERROR_BACKUP_ERROR : MANAGEMENT_ERROR_VERIFY_ERROR,
+                                      NAME, compression, encryption, payload);
+
+   pgmoneta_json_destroy(payload);
+
+   pgmoneta_disconnect(client_fd);
+
+   pgmoneta_stop_logging();
+
+   exit(1);
+}
+
+static int
+max_jobs(int number_of_servers)
+{
+   int max = number_of_servers;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   /* The bandwidth budget is divided among the operations, so it bounds how many are worth running */
+   if (config->bandwidth_max_rate > 0)
+   {
+      max = MIN(max, MAX(1, config->bandwidth_max_rate / BATCH_MIN_RATE));
+   }
+
+   return MAX(1, max);
+}
+
+static int
+job_workers(int server)
+{
+   return MAX(1, pgmoneta_get_number_of_workers(server));
+}
+
+static int
+job_io_workers(int server)
+{
+   return MAX(1, pgmoneta_get_number_of_io_workers(server));
+}
+
+/**
+ * Estimate the duration of the next backup of a server. The seconds per byte come
+ * from the previous full backups, and the size grows with the WAL written since the
+ * last one, by the growth per byte of WAL between the previous backups
+ * @param server The server
+ * @return The estimated seconds, or 0 without previous backups
+ */
+static double
+job_estimate(int server)
+{
+   char* d = NULL;
+   int number_of_backups = 0;
+   int history = 0;
+   double elapsed = 0.0;
+   double size = 0.0;
+   double grown = 0.0;
+   double written = 0.0;
+   double predicted = 0.0;
+   double estimate = 0.0;
+   uint64_t lsn;
+   uint64_t newer_lsn = 0;
+   uint64_t current_lsn;
+   struct backup* newer = NULL;
+   struct backup* latest = NULL;
+   struct backup** backups = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   d = pgmoneta_get_server_backup(server);
+
+   if (d == NULL || pgmoneta_get_backups(d, &number_of_backups, &backups))
+   {
+      goto done;
+   }
+
+   for (int i = number_of_backups - 1; i >= 0 && history < BATCH_HISTORY; i--)
+   {
+      struct backup* b = backups[i];
+
+      if (b->valid != VALID_TRUE || b->type != TYPE_FULL || b->total_elapsed_time <= 0.0 || b->restore_size == 0)
+      {
+         continue;
+      }
+
+      lsn = ((uint64_t)b->start_lsn_hi32 << 32) | b->start_lsn_lo32;
+
+      if (newer == NULL)
+      {
+         latest = b;
+      }
+      else if (newer_lsn > lsn)
+      {
+         grown += newer->restore_size > b->restore_size ? (double)(newer->restore_size - b->restore_size) : 0.0;
+         written += (double)(newer_lsn - lsn);
+      }
+
+      elapsed += b->total_elapsed_time;
+      size += (double)b->restore_size;
+
+      newer = b;
+      newer_lsn = lsn;
+      history++;
+   }
+
+   if (latest == NULL)
+   {
+      goto done;
+   }
+
+   predicted = (double)latest->restore_size;
+
+   /* The WAL streamed since the latest backup tells how much the data grew */
+   current_lsn = atomic_load(&config->common.prometheus.wal_ingest[server].flushed_lsn);
+   lsn = ((uint64_t)latest->start_lsn_hi32 << 32) | latest->start_lsn_lo32;
+
+   if (written > 0.0 && current_lsn > lsn)
+   {
+      predicted += grown / written * (double)(current_lsn - lsn);
+   }
+
+   estimate = elapsed / size * predicted;
+
+   pgmoneta_log_debug("Batch: %s is estimated at %.0fs for %.0f bytes from %d backups",
+                      config->common.servers[server].name, estimate, predicted, history);
+
+done:
+
+   for (int i = 0; i < number_of_backups; i++)
+   {
+      free(backups[i]);
+   }
+   free(backups);
+   free(d);
+
+   return estimate;
+}
+
+static int
+job_compare(const void* a, const void* b)
+{
+   double ea = ((struct batch_job*)a)->estimate;
+   double eb = ((struct batch_job*)b)->estimate;
+
+   if (ea > eb)
+   {
+      return -1;
+   }
+   else if (ea < eb)
+   {
+      return 1;
+   }
+
+   /* Keep the order of the configuration for the same estimate */
+   return ((struct batch_job*)a)->server - ((struct batch_job*)b)->server;
+}
+
+/**
+ * Find the fewest operations at a time whose estimated backups finish in the
+ * backup window, so the backups contend for the disk and the network no more
+ * than they need to
+ * @param jobs The jobs, longest first
+ * @param number_of_jobs The number of jobs
+ * @param max The most operations at a time
+ * @return The operations at a time
+ */
+static int
+window_jobs(struct batch_job* jobs, int number_of_jobs, int max)
+{
+   double lanes[NUMBER_OF_SERVERS];
+   double makespan = 0.0;
+   int lane;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   for (int n = 1; n <= max; n++)
+   {
+      memset(&lanes[0], 0, sizeof(lanes));
+      makespan = 0.0;
+
+      /* Each job starts when the first of the running ones is done */
+      for (int i = 0; i < number_of_jobs; i++)
+      {
+         lane = 0;
+         for (int l = 1; l < n; l++)
+         {
+            if (lanes[l] < lanes[lane])
+            {
+               lane = l;
+            }
+         }
+
+         lanes[lane] += jobs[i].estimate;
+         makespan = MAX(makespan, lanes[lane]);
+      }
+
+      if (makespan <= (double)config->backup_window)
+      {
+         pgmoneta_log_debug("Batch: %d at a time are estimated at %.0fs of the %ds window", n, makespan, config->backup_window);
+         return n;
+      }
+   }
+
+   pgmoneta_log_warn("Batch: The backups are estimated at %.0fs, longer than the %ds window", makespan, config->backup_window);
+
+   return max;
+}
+
+/**
+ * An operation is done, so the retention of its server can run after a backup
+ * @param job The job
+ * @param action The action
+ */
+static void
+job_done(struct batch_job* job, int32_t action)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (action == MANAGEMENT_BACKUP)
+   {
+      atomic_store(&config->common.servers[job->server].retention_after, 0);
+   }
+}
+
+static int
+job_start(struct batch_job* job, int32_t action, struct json* payload, struct batch_job* jobs, int number_of_jobs, int client_fd, char** argv)
+{
+   int sv[2] = {-1, -1};
+   pid_t pid;
+   struct json* pyl = NULL;
+   struct json* request = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv))
+   {
+      pgmoneta_log_error("Batch: Could not create a socket for %s due to %s", config->common.servers[job->server].name, strerror(errno));
+      errno = 0;
+      goto error;
+   }
+
+   pid = fork();
+   if (pid == -1)
+   {
+      pgmoneta_log_error("Batch: No fork for %s", config->common.servers[job->server].name);
+      goto error;
+   }
+   else if (pid == 0)
+   {
+      close(sv[0]);
+      close(client_fd);
+
+      for (int i = 0; i < number_of_jobs; i++)
+      {
+         if (jobs[i].fd != -1)
+         {
+            close(jobs[i].fd);
+         }
+      }
+
+      pgmoneta_json_clone(payload, &pyl);
+
+      request = (struct json*)pgmoneta_json_get(pyl, MANAGEMENT_CATEGORY_REQUEST);
+      pgmoneta_json_remove(request, MANAGEMENT_ARGUMENT_ALL);
+      pgmoneta_json_put(request, MANAGEMENT_ARGUMENT_SERVER, (uintptr_t)config->common.servers[job->server].name, ValueString);
+
+      if (action == MANAGEMENT_BACKUP)
+      {
+         pgmoneta_set_proc_title(1, argv, "backup", config->common.servers[job->server].name);
+         pgmoneta_backup(sv[1], job->server, MANAGEMENT_COMPRESSION_NONE, MANAGEMENT_ENCRYPTION_NONE, pyl);
+      }
+      else
+      {
+         pgmoneta_set_proc_title(1, argv, "verify", config->common.servers[job->server].name);
+         pgmoneta_verify(NULL, sv[1], job->server, MANAGEMENT_COMPRESSION_NONE, MANAGEMENT_ENCRYPTION_NONE, pyl);
+      }
+
+      exit(1);
+   }
+
+   close(sv[1]);
+
+   job->pid = pid;
+   job->fd = sv[0];
+
+   pgmoneta_log_debug("Batch: Started %s for %s", action == MANAGEMENT_BACKUP ? "backup" : "verify", config->common.servers[job->server].name);
+
+   return 0;
+
+error:
+
+   if (sv[0] != -1)
+   {
+      close(sv[0]);
+      close(sv[1]);
+   }
+
+   return 1;
+}
+
+static int
+job_result(struct batch_job* job, int32_t error, struct json* servers)
+{
+   bool status = false;
+   struct json* outcome = NULL;
+   struct json* response = NULL;
+   struct json* entry = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (job->result != NULL)
+   {
+      outcome = (struct json*)pgmoneta_json_get(job->result, MANAGEMENT_CATEGORY_OUTCOME);
+      response = (struct json*)pgmoneta_json_get(job->result, MANAGEMENT_CATEGORY_RESPONSE);
+
+      status = (bool)pgmoneta_json_get(outcome, MANAGEMENT_ARGUMENT_STATUS);
+      error = (int32_t)pgmoneta_json_get(outcome, MANAGEMENT_ARGUMENT_ERROR);
+   }
+
+   if (response == NULL || pgmoneta_json_clone(response, &entry))
+   {
+      pgmoneta_json_create(&entry);
+   }
+
+   pgmoneta_json_put(entry, MANAGEMENT_ARGUMENT_SERVER, (uintptr_t)config->common.servers[job->server].name, ValueString);
+   pgmoneta_json_put(entry, MANAGEMENT_ARGUMENT_STATUS, (uintptr_t)status, ValueBool);
+   if (!status)
+   {
+      pgmoneta_json_put(entry, MANAGEMENT_ARGUMENT_ERROR, (uintptr_t)error, ValueInt32);
+   }
+
+   pgmoneta_json_append(servers, (uintptr_t)entry, ValueJSON);
+
+   pgmoneta_json_destroy(job->result);
+   job->result = NULL;
+
+   if (!status)
+   {
+      pgmoneta_log_warn("Batch: %s failed (%d)", config->common.servers[job->server].name, error);
+   }
+
+   return status ? 0 : 1;
+}
@@ -31,6 +31,8 @@
 #include <bzip2_compression.h>
 #include <logging.h>
 #include <management.h>
+#include <prometheus.h>
+#include <trace.h>
 #include <utils.h>
 
 /* system */
@@ -47,6 +49,19 @@
 #define NAME "bzip2"
 #define BUFFER_LENGTH 8192
 
+/** @struct bzip2_reader
+ * Defines the state of a BZIP2 decompression layer
+ */
+struct bzip2_reader
+{
+   bz_stream stream;         /**< The decompression stream */
+   char in[BUFFER_LENGTH];   /**< The input buffer */
+   bool eof;                 /**< Has the source ended */
+   bool end;                 /**< Has a stream ended */
+};
+
+static int bzip2_reader_read(struct reader* reader, void* buffer, size_t size, size_t* read);
+static void bzip2_reader_close(struct reader* reader);
 static int bzip2_compress(char* from, int level, char* to);
 static int bzip2_decompress(char* from, char* to);
 static int bzip2_decompress_file(char* from, char* to);
@@ -179,6 +194,7 @@ do_bzip2_compress(struct worker_common* wc)
       else
       {
          pgmoneta_delete_file(wi->from, NULL);
+         pgmoneta_drop_cache(wi->to);
       }
    }
 
@@ -651,6 +667,11 @@ bzip2_compress(char* from, int level, char* to)
    size_t buf_len = BUFFER_LENGTH;
    size_t length;
    int bzip2_err = 1;
+   uint64_t start;
+
+   PGMONETA_TRACE2(compress_start, from, COMPRESSION_CLIENT_BZIP2);
+
+   start = pgmoneta_prometheus_now();
 
    from_ptr = fopen(from, "r");
    if (!from_ptr)
@@ -688,6 +709,10 @@ bzip2_compress(char* from, int level, char* to)
    fclose(from_ptr);
    fclose(to_ptr);
 
+   pgmoneta_prometheus_file(FILE_OPERATION_COMPRESS, start);
+
+   PGMONETA_TRACE3(compress_done, from, COMPRESSION_CLIENT_BZIP2, 0);
+
    return 0;
 
 error_zip:
@@ -704,6 +729,8 @@ error:
       fclose(to_ptr);
    }
 
+   PGMONETA_TRACE3(compress_done, from, COMPRESSION_CLIENT_BZIP2, 1);
+
    return 1;
 }
 
@@ -718,6 +745,9 @@ bzip2_decompress(char* from, char* to)
    int length = 0;
    int bzip2_err;
    BZFILE* zip_file = NULL;
+   uint64_t start;
+
+   start = pgmoneta_prometheus_now();
 
    from_ptr = fopen(from, "r");
    if (!from_ptr)
@@ -761,6 +791,8 @@ bzip2_decompress(char* from, char* to)
    fclose(from_ptr);
    fclose(to_ptr);
 
+   pgmoneta_prometheus_file(FILE_OPERATION_DECOMPRESS, start);
+
    return 0;
 
 error_unzip:
@@ -794,6 +826,9 @@ bzip2_decompress_file(char* from, char* to)
    int length = 0;
    int bzip2_err = 1;
    BZFILE* zip_file = NULL;
+   uint64_t start;
+
+   start = pgmoneta_prometheus_now();
 
    from_ptr = fopen(from, "r");
    if (!from_ptr)
@@ -838,6 +873,8 @@ bzip2_decompress_file(char* from, char* to)
    fclose(from_ptr);
    fclose(to_ptr);
 
+   pgmoneta_prometheus_file(FILE_OPERATION_DECOMPRESS, start);
+
    return 0;
 
 error_unzip:
@@ -892,6 +929,46 @@ error:
    return 1;
 }
 
+int
+pgmoneta_bunzip2_reader(struct reader* source, struct reader** reader)
+{
+   struct bzip2_reader* br = NULL;
+
+   *reader = NULL;
+
+   br = (struct bzip2_reader*)malloc(sizeof(struct bzip2_reader));
+   if (br == NULL)
+   {
+      goto error;
+   }
+
+   memset(br, 0, sizeof(struct bzip2_reader));
+
+   if (BZ2_bzDecompressInit(&br->stream, 0, 0) != BZ_OK)
+   {
+      free(br);
+      br = NULL;
+      goto error;
+   }
+
+   if (pgmoneta_reader_create(source, bzip2_reader_read, bzip2_reader_close, br, reader))
+   {
+      goto error;
+   }
+
+   return 0;
+
+error:
+
+   if (br != NULL)
+   {
+      BZ2_bzDecompressEnd(&br->stream);
+      free(br);
+   }
+
+   return 1;
+}
+
 int
 pgmoneta_bzip2_string(char* s, unsigned char** buffer, size_t* buffer_size)
 {
@@ -957,3 +1034,95 @@ error:
 
    return 1;
 }
+
+static int
+bzip2_reader_read(struct reader* reader, void* buffer, size_t size, size_t* read)
+{
+   struct bzip2_reader* br = (struct bzip2_reader*)reader->state;
+   size_t n = 0;
+   int ret;
+
+   *read = 0;
+
+   br->stream.next_out = (char*)buffer;
+   br->stream.avail_out = (unsigned int)size;
+
+   while (br->stream.avail_out == size)
+   {
+      if (br->stream.avail_in == 0 && !br->eof)
+      {
+         if (pgmoneta_reader_read(reader->source, &br->in[0], sizeof(br->in), &n))
+         {
+            goto error;
+         }
+
+         br->eof = n == 0;
+         br->stream.next_in = &br->in[0];
+         br->stream.avail_in = (unsigned int)n;
+      }
+
+      if (br->stream.avail_in == 0 && br->eof)
+      {
+         if (!br->end)
+         {
+            pgmoneta_log_error("BZIP2: Incomplete stream");
+            goto error;
+         }
+         break;
+      }
+
+      /* Another stream follows */
+      if (br->end)
+      {
+         char* next_in = br->stream.next_in;
+         unsigned int avail_in = br->stream.avail_in;
+
+         BZ2_bzDecompressEnd(&br->stream);
+         memset(&br->stream, 0, sizeof(bz_stream));
+         if (BZ2_bzDecompressInit(&br->stream, 0, 0) != BZ_OK)
+         {
+            goto error;
+         }
+         br->stream.next_in = next_in;
+         br->stream.avail_in = avail_in;
+         br->stream.next_out = (char*)buffer;
+         br->stream.avail_out = (unsigned int)size;
+         br->end = false;
+      }
+
+      ret = BZ2_bzDecompress(&br->stream);
+      if (ret == BZ_STREAM_END)
+      {
+         br->end = true;
+      }
+      else if (ret != BZ_OK)
+      {
+         pgmoneta_log_error("BZIP2: Decompression error: %d", ret);
+         goto error;
+      }
+   }
+
+   *read = size - br->stream.avail_out;
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+static void
+bzip2_reader_close(struct reader* reader)
+{
+   struct bzip2_reader* br = (struct bzip2_reader*)reader->state;
+
+   if (br == NULL)
+   {
+      return;
+   }
+
+   BZ2_bzDecompressEnd(&br->stream);
+   free(br);
+
+   reader->state = NULL;
+}
@@ -0,0 +1,627 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <aes.h>
+#include <compaction.h>
+#include <csv.h>
+#include <info.h>
+#include <lock.h>
+#include <logging.h>
+#include <reader.h>
+#include <restore.h>
+#include <utils.h>
+#include <walfile.h>
+#include <walfile/wal_reader.h>
+
+/* system */
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <zstd.h>
+
+/* The share of a WAL segment in uncompressed full page images that makes a recompression worthwhile */
+#define COMPACTION_WAL_FPI_PERCENT 20
+#define COMPACTION_WAL_LEVEL       19
+/* Decoders accept windows up to 2^27 bytes without extra memory settings */
+#define COMPACTION_WAL_WINDOW_MIN  10
+#define COMPACTION_WAL_WINDOW_MAX  27
+
+static int compact_server(int server);
+static int compact_wal(int server);
+static int compact_wal_file(int server, char* directory, char* name, uint64_t* before, uint64_t* after);
+static bool compact_wal_segment(char* name);
+static char* wal_state_path(int server);
+static void wal_state_read(int server, char* last, size_t size);
+static void wal_state_write(int server, char* last);
+
+int
+pgmoneta_compaction(char** argv)
+{
+   int ret = 0;
+   struct main_configuration* config;
+
+   pgmoneta_start_logging();
+
+   config = (struct main_configuration*)shmem;
+
+   pgmoneta_set_proc_title(1, argv, "compaction", NULL);
+
+   if (pgmoneta_reader_max_rate(config->compaction_max_rate))
+   {
+      pgmoneta_log_error("Compaction: Unable to limit the rate to %d", config->compaction_max_rate);
+      goto error;
+   }
+
+   for (int server = 0; server < config->common.number_of_servers; server++)
+   {
+      struct lock* lock = NULL;
+
+      /* Only compact while nothing else works on the backups of the server */
+      if (pgmoneta_lock_repository(server, LOCK_EXCLUSIVE, &lock))
+      {
+         pgmoneta_log_debug("Compaction: Server %s is active", config->common.servers[server].name);
+         continue;
+      }
+
+      if (compact_server(server))
+      {
+         ret = 1;
+      }
+
+      if (config->wal_compaction_age > 0 && compact_wal(server))
+      {
+         ret = 1;
+      }
+
+      pgmoneta_unlock(lock);
+   }
+
+   pgmoneta_reader_max_rate(0);
+
+   return ret;
+
+error:
+
+   pgmoneta_reader_max_rate(0);
+
+   return 1;
+}
+
+static int
+compact_server(int server)
+{
+   char* d = NULL;
+   int number_of_backups = 0;
+   struct backup** backups = NULL;
+   int* depth = NULL;
+   int* root = NULL;
+   int candidate = -1;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   d = pgmoneta_get_server_backup(server);
+
+   if (pgmoneta_get_backups(d, &number_of_backups, &backups))
+   {
+      goto error;
+   }
+
+   if (number_of_backups == 0)
+   {
+      goto done;
+   }
+
+   depth = (int*)calloc(number_of_backups, sizeof(int));
+   root = (int*)calloc(number_of_backups, sizeof(int));
+   if (depth == NULL || root == NULL)
+   {
+      goto error;
+   }
+
+   /* The backups are ordered by label, so a parent is always seen before its children */
+   for (int i = 0; i < number_of_backups; i++)
+   {
+      depth[i] = -1;
+      root[i] = -1;
+
+      if (backups[i]->type == TYPE_FULL)
+      {
+         depth[i] = 0;
+         root[i] = i;
+         continue;
+      }
+
+      for (int j = i - 1; j >= 0; j--)
+      {
+         if (!strcmp(backups[j]->label, backups[i]->parent_label))
+         {
+            if (depth[j] >= 0)
+            {
+               depth[i] = depth[j] + 1;
+               root[i] = root[j];
+            }
+            break;
+         }
+      }
+
+      if (candidate == -1 && depth[i] > config->compaction_chain &&
+          backups[i]->valid == VALID_TRUE && backups[root[i]]->valid == VALID_TRUE)
+      {
+         candidate = i;
+      }
+   }
+
+   /* One rollup per run, so a single pass never holds the server for long */
+   if (candidate != -1)
+   {
+      pgmoneta_log_info("Compaction: Rolling up %s/%s into a full backup (%d incremental backups)",
+                        config->common.servers[server].name, backups[candidate]->label, depth[candidate]);
+
+      if (pgmoneta_rollup_backups(server, backups[candidate]->label, backups[root[candidate]]->label))
+      {
+         pgmoneta_log_error("Compaction: Unable to roll up %s/%s to %s",
+                            config->common.servers[server].name, backups[candidate]->label,
+                            backups[root[candidate]]->label);
+         goto error;
+      }
+
+      pgmoneta_log_info("Compaction: %s/%s is a full backup", config->common.servers[server].name,
+                        backups[candidate]->label);
+   }
+
+done:
+
+   for (int i = 0; i < number_of_backups; i++)
+   {
+      free(backups[i]);
+   }
+   free(backups);
+   free(depth);
+   free(root);
+   free(d);
+
+   return 0;
+
+error:
+
+   for (int i = 0; i < number_of_backups; i++)
+   {
+      free(backups[i]);
+   }
+   free(backups);
+   free(depth);
+   free(root);
+   free(d);
+
+   return 1;
+}
+
+static int
+compact_wal(int server)
+{
+   char* w = NULL;
+   char* path = NULL;
+   int number_of_wal = 0;
+   char** wal = NULL;
+   char last[MISC_LENGTH];
+   int segments = 0;
+   uint64_t before = 0;
+   uint64_t after = 0;
+   struct stat st;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   /* The records can only be decoded with the version of the server */
+   if (config->common.servers[server].version == 0)
+   {
+      return 0;
+   }
+
+   wal_state_read(server, &last[0], sizeof(last));
+
+   w = pgmoneta_get_server_wal(server);
+
+   if (pgmoneta_get_wal_files(w, &number_of_wal, &wal))
+   {
+      goto error;
+   }
+
+   for (int i = 0; i < number_of_wal; i++)
+   {
+      if (!compact_wal_segment(wal[i]))
+      {
+         continue;
+      }
+
+      if (strlen(last) > 0 && strncmp(wal[i], last, 24) <= 0)
+      {
+         continue;
+      }
+
+      path = pgmoneta_append(NULL, w);
+      path = pgmoneta_append(path, wal[i]);
+
+      /* The segments are ordered, so the rest is younger */
+      if (stat(path, &st) || st.st_mtime + config->wal_compaction_age > time(NULL))
+      {
+         free(path);
+         path = NULL;
+         break;
+      }
+
+      free(path);
+      path = NULL;
+
+      if (compact_wal_file(server, w, wal[i], &before, &after))
+      {
+         pgmoneta_log_warn("Compaction: Unable to compact %s%s", w, wal[i]);
+      }
+      else
+      {
+         segments++;
+      }
+
+      memset(&last[0], 0, sizeof(last));
+      memcpy(&last[0], wal[i], 24);
+      wal_state_write(server, &last[0]);
+   }
+
+   if (segments > 0)
+   {
+      pgmoneta_log_info("Compaction: Recompressed %d WAL segments of %s (%" PRIu64 " to %" PRIu64 " bytes)",
+                        segments, config->common.servers[server].name, before, after);
+   }
+
+   for (int i = 0; i < number_of_wal; i++)
+   {
+      free(wal[i]);
+   }
+   free(wal);
+   free(w);
+
+   return 0;
+
+error:
+
+   for (int i = 0; i < number_of_wal; i++)
+   {
+      free(wal[i]);
+   }
+   free(wal);
+   free(w);
+
+   return 1;
+}
+
+/**
+ * Recompress an aged WAL segment whose full page images are stored as they
+ * are. The records, and so the LSNs, can't be moved without breaking replay,
+ * so the segment stays byte identical and only the archived file is rewritten,
+ * as a single Zstandard frame with a window that spans the segment so the
+ * images of the same pages after each checkpoint are matched
+ * @param server The server
+ * @param directory The WAL directory
+ * @param name The archived file
+ * @param before [out] The archived bytes of the recompressed segments
+ * @param after [out] The bytes of the recompressed segments
+ * @return 0 when the segment is recompressed, otherwise 1
+ */
+static int
+compact_wal_file(int server, char* directory, char* name, uint64_t* before, uint64_t* after)
+{
+   char* from = NULL;
+   char* to = NULL;
+   char* tmp = NULL;
+   char base[25];
+   uint64_t fpi = 0;
+   uint64_t fpi_compressed = 0;
+   uint16_t magic;
+   size_t bound;
+   size_t compressed_size = 0;
+   unsigned char* compressed = NULL;
+   unsigned char* encrypted = NULL;
+   size_t encrypted_size = 0;
+   unsigned char* data = NULL;
+   size_t data_size = 0;
+   unsigned int window_log = COMPACTION_WAL_WINDOW_MIN;
+   ZSTD_CCtx* cctx = NULL;
+   FILE* file = NULL;
+   struct stat st;
+   struct wal_record_iterator* iterator = NULL;
+   struct decoded_xlog_record* record = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   memset(&base[0], 0, sizeof(base));
+   memcpy(&base[0], name, 24);
+
+   from = pgmoneta_append(from, directory);
+   from = pgmoneta_append(from, name);
+
+   if (stat(from, &st))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_wal_record_iterator_create(from, server, NULL, &iterator))
+   {
+      goto error;
+   }
+
+   magic = iterator->long_phd->std.xlp_magic;
+
+   while (pgmoneta_wal_record_iterator_next(iterator))
+   {
+      record = iterator->record;
+
+      for (int i = 0; i <= record->max_block_id; i++)
+      {
+         if (record->blocks[i].in_use && record->blocks[i].has_image)
+         {
+            fpi += record->blocks[i].bimg_len;
+
+            if (pgmoneta_wal_is_bkp_image_compressed(magic, record->blocks[i].bimg_info))
+            {
+               fpi_compressed += record->blocks[i].bimg_len;
+            }
+         }
+      }
+   }
+
+   if (iterator->failed)
+   {
+      goto error;
+   }
+
+   pgmoneta_reader_throttle((size_t)st.st_size);
+
+   /* Images compressed by wal_compression don't compress any further */
+   if ((fpi - fpi_compressed) * 100 < (uint64_t)iterator->size * COMPACTION_WAL_FPI_PERCENT)
+   {
+      pgmoneta_log_debug("Compaction: %s has %" PRIu64 " bytes of uncompressed full page images, skipped", from, fpi - fpi_compressed);
+      goto done;
+   }
+
+   while (window_log < COMPACTION_WAL_WINDOW_MAX && ((size_t)1 << window_log) < iterator->size)
+   {
+      window_log++;
+   }
+
+   cctx = ZSTD_createCCtx();
+   if (cctx == NULL)
+   {
+      goto error;
+   }
+
+   ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, COMPACTION_WAL_LEVEL);
+   ZSTD_CCtx_setParameter(cctx, ZSTD_c_windowLog, window_log);
+   ZSTD_CCtx_setParameter(cctx, ZSTD_c_enableLongDistanceMatching, 1);
+   ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
+
+   bound = ZSTD_compressBound(iterator->size);
+   compressed = (unsigned char*)malloc(bound);
+   if (compressed == NULL)
+   {
+      goto error;
+   }
+
+   compressed_size = ZSTD_compress2(cctx, compressed, bound, iterator->map, iterator->size);
+   if (ZSTD_isError(compressed_size))
+   {
+      pgmoneta_log_error("ZSTD: %s", ZSTD_getErrorName(compressed_size));
+      goto error;
+   }
+
+   data = compressed;
+   data_size = compressed_size;
+
+   to = pgmoneta_append(to, directory);
+   to = pgmoneta_append(to, &base[0]);
+   to = pgmoneta_append(to, ".zstd");
+
+   if (config->encryption != ENCRYPTION_NONE)
+   {
+      if (pgmoneta_encrypt_file_buffer(to, compressed, compressed_size, &encrypted, &encrypted_size))
+      {
+         goto error;
+      }
+
+      data = encrypted;
+      data_size = encrypted_size;
+
+      to = pgmoneta_append(to, ".aes");
+   }
+
+   if (data_size >= (size_t)st.st_size)
+   {
+      goto done;
+   }
+
+   tmp = pgmoneta_append(tmp, to);
+   tmp = pgmoneta_append(tmp, ".partial");
+
+   file = fopen(tmp, "wb");
+   if (file == NULL)
+   {
+      goto error;
+   }
+
+   if (fwrite(data, 1, data_size, file) != data_size || fflush(file) || fsync(fileno(file)))
+   {
+      goto error;
+   }
+
+   fclose(file);
+   file = NULL;
+
+   if (rename(tmp, to))
+   {
+      goto error;
+   }
+
+   if (strcmp(from, to))
+   {
+      unlink(from);
+   }
+
+   *before += (uint64_t)st.st_size;
+   *after += (uint64_t)data_size;
+
+done:
+
+   pgmoneta_wal_record_iterator_destroy(iterator);
+   ZSTD_freeCCtx(cctx);
+   free(compressed);
+   free(encrypted);
+   free(from);
+   free(to);
+   free(tmp);
+
+   return 0;
+
+error:
+
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+   if (tmp != NULL)
+   {
+      unlink(tmp);
+   }
+
+   pgmoneta_wal_record_iterator_destroy(iterator);
+   ZSTD_freeCCtx(cctx);
+   free(compressed);
+   free(encrypted);
+   free(from);
+   free(to);
+   free(tmp);
+
+   return 1;
+}
+
+static bool
+compact_wal_segment(char* name)
+{
+   return strlen(name) >= 24 && strspn(name, "0123456789ABCDEF") == 24 &&
+          (name[24] == '\0' || name[24] == '.') && strstr(name, ".backup") == NULL;
+}
+
+static char*
+wal_state_path(int server)
+{
+   char* path = NULL;
+
+   path = pgmoneta_get_server(server);
+   if (path == NULL)
+   {
+      return NULL;
+   }
+
+   path = pgmoneta_append(path, "wal_compaction.state");
+
+   return path;
+}
+
+/**
+ * Read the last WAL segment that was compacted
+ * @param server The server
+ * @param last [out] The segment, empty when there is none
+ * @param size The size of last
+ */
+static void
+wal_state_read(int server, char* last, size_t size)
+{
+   char* path = NULL;
+   int number_of_columns = 0;
+   char** columns = NULL;
+   struct csv_reader* csv = NULL;
+
+   memset(last, 0, size);
+
+   path = wal_state_path(server);
+
+   if (path != NULL && pgmoneta_exists(path) && !pgmoneta_csv_reader_init(path, &csv))
+   {
+      if (pgmoneta_csv_next_row(csv, &number_of_columns, &columns) && number_of_columns == 1)
+      {
+         memcpy(last, columns[0], MIN(strlen(columns[0]), size - 1));
+      }
+
+      pgmoneta_csv_reader_destroy(csv);
+   }
+
+   free(path);
+}
+
+static void
+wal_state_write(int server, char* last)
+{
+   char* path = NULL;
+   char* tmp = NULL;
+   FILE* file = NULL;
+
+   path = wal_state_path(server);
+   if (path == NULL)
+   {
+      return;
+   }
+
+   tmp = pgmoneta_append(tmp, path);
+   tmp = pgmoneta_append(tmp, ".tmp");
+
+   file = fopen(tmp, "w");
+   if (file == NULL)
+   {
+      pgmoneta_log_warn("Compaction: Could not write %s", tmp);
+      goto done;
+   }
+
+   fprintf(file, "%s\n", last);
+   fflush(file);
+   fsync(fileno(file));
+   fclose(file);
+
+   rename(tmp, path);
+
+done:
+
+   free(path);
+   free(tmp);
+}
@@ -34,6 +34,22 @@
 #include <utils.h>
 #include <zstandard_compression.h>
 
+/* system */
+#include <stdlib.h>
+#include <string.h>
+
+bool
+pgmoneta_compression_applies(char* path)
+{
+   if (pgmoneta_ends_with(path, "backup_manifest") ||
+       pgmoneta_ends_with(path, "backup_label"))
+   {
+      return false;
+   }
+
+   return !pgmoneta_is_compressed(path) && !pgmoneta_is_encrypted(path);
+}
+
 static int
 pgmoneta_decompression_file_callback(char* path, compression_func* decompress_cb)
 {
@@ -74,3 +90,120 @@ pgmoneta_decompress(char* from, char* to)
 error:
    return 1;
 }
+
+int
+pgmoneta_compression_controller_create(int server, int min_level, int max_level, double target, int threads,
+                                       struct compression_controller** controller)
+{
+   struct compression_controller* c = NULL;
+
+   *controller = NULL;
+
+   c = (struct compression_controller*)malloc(sizeof(struct compression_controller));
+   if (c == NULL)
+   {
+      goto error;
+   }
+
+   memset(c, 0, sizeof(struct compression_controller));
+
+   if (min_level > max_level)
+   {
+      min_level = max_level;
+   }
+
+   pthread_mutex_init(&c->lock, NULL);
+   c->server = server;
+   c->level = max_level;
+   c->min_level = min_level;
+   c->max_level = max_level;
+   c->lowest = max_level;
+   c->highest = max_level;
+   c->threads = threads > 0 ? threads : 1;
+   c->target = target;
+
+   *controller = c;
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+int
+pgmoneta_compression_controller_level(struct compression_controller* controller)
+{
+   int level;
+
+   pthread_mutex_lock(&controller->lock);
+   level = controller->level;
+   pthread_mutex_unlock(&controller->lock);
+
+   return level;
+}
+
+void
+pgmoneta_compression_controller_update(struct compression_controller* controller, uint64_t bytes, double seconds)
+{
+   double rate;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (controller->target <= 0)
+   {
+      return;
+   }
+
+   pthread_mutex_lock(&controller->lock);
+
+   controller->window_bytes += bytes;
+   controller->window_seconds += seconds;
+
+   if (controller->window_bytes >= COMPRESSION_CONTROLLER_WINDOW && controller->window_seconds > 0)
+   {
+      /* The files of a window are compressed concurrently, so the wall clock */
+      /* time is the thread time divided over the threads */
+      rate = controller->window_bytes / (controller->window_seconds / controller->threads);
+
+      if (rate < controller->target && controller->level > controller->min_level)
+      {
+         controller->level--;
+      }
+      else if (rate > 2 * controller->target && controller->level < controller->max_level)
+      {
+         controller->level++;
+      }
+
+      if (controller->level < controller->lowest)
+      {
+         controller->lowest = controller->level;
+      }
+      if (controller->level > controller->highest)
+      {
+         controller->highest = controller->level;
+      }
+
+      if (controller->server >= 0)
+      {
+         atomic_store(&config->common.servers[controller->server].compression_level, controller->level);
+      }
+
+      controller->window_bytes = 0;
+      controller->window_seconds = 0;
+   }
+
+   pthread_mutex_unlock(&controller->lock);
+}
+
+void
+pgmoneta_compression_controller_destroy(struct compression_controller* controller)
+{
+   if (controller != NULL)
+   {
+      pthread_mutex_destroy(&controller->lock);
+   }
+
+   free(controller);
+}
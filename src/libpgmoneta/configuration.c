@@ -73,6 +73,7 @@ static unsigned int as_update_process_title(char* str, unsigned int default_poli
 static int as_logging_rotation_size(char* str, int* size);
 static int as_seconds(char* str, int* age, int default_age);
 static int as_bytes(char* str, int* bytes, int default_bytes);
+static int as_buffer_size(char* str, int* size);
 static int as_retention(char* str, int* days, int* weeks, int* months, int* years);
 static int as_create_slot(char* str, int* create_slot);
 static char* get_retention_string(int rt_days, int rt_weeks, int rt_months, int rt_year);
@@ -83,6 +84,8 @@ static void copy_user(struct user* dst, struct user* src);
 static int restart_bool(char* name, bool e, bool n);
 static int restart_int(char* name, int e, int n);
 static int restart_string(char* name, char* e, char* n);
+static int reconnect_int(char* name, int* e, int n);
+static int reconnect_string(char* name, char* e, char* n, size_t size);
 
 static void add_configuration_response(struct json* res);
 static void add_servers_configuration_response(struct json* res);
@@ -90,7 +93,7 @@ static void add_servers_configuration_response(struct json* res);
 static bool is_empty_string(char* s);
 static int remove_leading_whitespace_and_comments(char* s, char** trimmed_line);
 
-static void split_extra(char* extra, char res[MAX_EXTRA][MAX_EXTRA_PATH], int* count);
+static void split_extra(char* extra, struct server* srv);
 
 /**
  *
@@ -107,30 +110,55 @@ pgmoneta_init_main_configuration(void* shm)
 
    config->compression_type = COMPRESSION_CLIENT_ZSTD;
    config->compression_level = 3;
+   config->compression_frame_size = 0;
+   config->compression_adaptive = false;
 
    config->encryption = ENCRYPTION_NONE;
 
    config->storage_engine = STORAGE_ENGINE_LOCAL;
+   config->reflink = false;
 
    config->workers = 0;
+   config->io_workers = 0;
 
    config->retention_days = 7;
    config->retention_weeks = -1;
    config->retention_months = -1;
    config->retention_years = -1;
    config->retention_interval = 300;
+   config->delete_trash = false;
+
+   config->compaction_interval = 0;
+   config->compaction_chain = 7;
+   config->compaction_max_rate = 0;
+
+   config->scrub_interval = 0;
+   config->scrub_max_rate = 0;
+
+   config->s3_part_size = 64 * 1024 * 1024;
+   config->ssh_max_inflight = 16;
+   config->azure_block_size = 64 * 1024 * 1024;
+   config->storage_pack_size = 0;
+   config->upload_concurrency = 4;
+   config->upload_max_rate = 0;
+   config->bandwidth_max_rate = 0;
+   config->backup_window = 0;
 
    config->tls = false;
 
    config->blocking_timeout = DEFAULT_BLOCKING_TIMEOUT;
    config->authentication_timeout = 5;
 
+   /* Seeded from the clock so catalogs written by an earlier run never match */
+   atomic_init(&config->backup_generation, (unsigned long)time(NULL) << 20);
+
    home_dir = pgmoneta_get_home_directory();
    memcpy(&config->common.home_dir, home_dir, strlen(home_dir));
 
    config->common.keep_alive = true;
    config->common.nodelay = true;
    config->common.non_blocking = true;
+   config->common.tcp_buffer_size = DEFAULT_BUFFER_SIZE;
    config->backlog = 16;
    config->hugepage = HUGEPAGE_TRY;
 
@@ -146,6 +174,24 @@ pgmoneta_init_main_configuration(void* shm)
 
    config->manifest = HASH_ALGORITHM_SHA256;
 
+   config->wal_cache_size = 0;
+   config->wal_flush_size = 0;
+   config->wal_flush_interval = 0;
+   config->wal_status_size = 1024 * 1024;
+   config->wal_status_interval = 10;
+   config->wal_preallocate = 0;
+   config->wal_inline_compression = false;
+   config->wal_dictionary = false;
+   config->restore_io_uring = false;
+   config->wal_multiplex = false;
+   config->backup_multiplex = false;
+   config->backup_write_queue = 0;
+   config->memory_budget = 0;
+   config->wal_prefetch = 8;
+   config->wal_compaction_age = 0;
+   config->manifest_tree = false;
+   config->incremental_delta = false;
+
 #ifdef DEBUG
    config->link = true;
 #endif
@@ -227,8 +273,12 @@ pgmoneta_read_main_configuration(void* shm, char* filename)
                   memset(&srv, 0, sizeof(struct server));
                   memcpy(&srv.name, &section, strlen(section));
 
-                  atomic_init(&srv.repository, false);
-                  srv.active_backup = false;
+                  atomic_init(&srv.repository, 0);
+                  atomic_init(&srv.active_backup, false);
+                  for (int i = 0; i < NUMBER_OF_BACKUP_LOCKS; i++)
+                  {
+                     atomic_init(&srv.backup_locks[i], 0);
+                  }
                   srv.active_restore = false;
                   srv.active_archive = false;
                   srv.active_delete = false;
@@ -240,8 +290,20 @@ pgmoneta_read_main_configuration(void* shm, char* filename)
                   atomic_init(&srv.failed_operation_count, 0);
                   atomic_init(&srv.last_operation_time, 0);
                   atomic_init(&srv.last_failed_operation_time, 0);
+                  atomic_init(&srv.backup_write_queue, 0);
+                  atomic_init(&srv.backup_write_queue_waits, 0);
+                  atomic_init(&srv.compression_level, 0);
+                  atomic_init(&srv.timelines.timeline, 0);
+                  atomic_init(&srv.timelines.number_of_switches, 0);
+                  atomic_init(&srv.timelines.resume_tli, 0);
+                  atomic_init(&srv.timelines.resume_lsn, 0);
+                  atomic_init(&srv.scrub, false);
+                  atomic_init(&srv.scrub_bytes, 0);
+                  atomic_init(&srv.scrub_wal_failed, 0);
+                  atomic_init(&srv.progress.workflow, 0);
                   memset(srv.wal_shipping, 0, MAX_PATH);
                   srv.workers = -1;
+                  srv.io_workers = -1;
                   srv.backup_max_rate = -1;
                   srv.network_max_rate = -1;
                   srv.manifest = HASH_ALGORITHM_DEFAULT;
@@ -353,9 +415,7 @@ pgmoneta_read_main_configuration(void* shm, char* filename)
                      {
                         max = MAX_PATH - 1;
                      }
-                     int count = 0;
-                     split_extra(value, srv.extra, &count);
-                     srv.number_of_extra = count;
+                     split_extra(value, &srv);
                   }
                   else
                   {
@@ -527,6 +587,130 @@ pgmoneta_read_main_configuration(void* shm, char* filename)
                      memcpy(&srv.hot_standby_tablespaces, value, max);
                   }
                }
+               else if (!strcmp(key, "hot_standby_replay"))
+               {
+                  if (strlen(section) > 0)
+                  {
+                     max = strlen(section);
+                     if (max > MISC_LENGTH - 1)
+                     {
+                        max = MISC_LENGTH - 1;
+                     }
+                     memcpy(&srv.name, section, max);
+                     if (as_bool(value, &srv.hot_standby_replay))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "tls_ktls"))
+               {
+                  if (strlen(section) > 0)
+                  {
+                     max = strlen(section);
+                     if (max > MISC_LENGTH - 1)
+                     {
+                        max = MISC_LENGTH - 1;
+                     }
+                     memcpy(&srv.name, section, max);
+                     if (as_bool(value, &srv.tls_ktls))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "backup_connections"))
+               {
+                  if (strlen(section) > 0)
+                  {
+                     max = strlen(section);
+                     if (max > MISC_LENGTH - 1)
+                     {
+                        max = MISC_LENGTH - 1;
+                     }
+                     memcpy(&srv.name, section, max);
+                     if (as_int(value, &srv.backup_connections))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "backup_standby"))
+               {
+                  if (strlen(section) > 0)
+                  {
+                     max = strlen(section);
+                     if (max > MISC_LENGTH - 1)
+                     {
+                        max = MISC_LENGTH - 1;
+                     }
+                     memcpy(&srv.name, section, max);
+                     if (as_bool(value, &srv.backup_standby))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "snapshot_command"))
+               {
+                  if (strlen(section) > 0)
+                  {
+                     max = strlen(section);
+                     if (max > MISC_LENGTH - 1)
+                     {
+                        max = MISC_LENGTH - 1;
+                     }
+                     memcpy(&srv.name, section, max);
+                     max = strlen(value);
+                     if (max > MAX_PATH - 1)
+                     {
+                        max = MAX_PATH - 1;
+                     }
+                     memcpy(&srv.snapshot_command, value, max);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "snapshot_release_command"))
+               {
+                  if (strlen(section) > 0)
+                  {
+                     max = strlen(section);
+                     if (max > MISC_LENGTH - 1)
+                     {
+                        max = MISC_LENGTH - 1;
+                     }
+                     memcpy(&srv.name, section, max);
+                     max = strlen(value);
+                     if (max > MAX_PATH - 1)
+                     {
+                        max = MAX_PATH - 1;
+                     }
+                     memcpy(&srv.snapshot_release_command, value, max);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
                else if (!strcmp(key, "metrics"))
                {
                   if (!strcmp(section, "pgmoneta"))
@@ -800,6 +984,27 @@ pgmoneta_read_main_configuration(void* shm, char* filename)
                      unknown = true;
                   }
                }
+               else if (!strcmp(key, "io_workers"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_int(value, &config->io_workers))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  if (strlen(section) > 0)
+                  {
+                     if (as_int(value, &srv.io_workers))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
                else if (!strcmp(key, "log_type"))
                {
                   if (!strcmp(section, "pgmoneta"))
@@ -967,6 +1172,50 @@ pgmoneta_read_main_configuration(void* shm, char* filename)
                      unknown = true;
                   }
                }
+               else if (!strcmp(key, "tcp_buffer_size"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_buffer_size(value, &config->common.tcp_buffer_size))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "tcp_congestion"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     max = strlen(value);
+                     if (max > MISC_LENGTH - 1)
+                     {
+                        max = MISC_LENGTH - 1;
+                     }
+                     memcpy(config->common.tcp_congestion, value, max);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "direct_io"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_bool(value, &config->common.direct_io))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
                else if (!strcmp(key, "backlog"))
                {
                   if (!strcmp(section, "pgmoneta"))
@@ -1017,6 +1266,34 @@ pgmoneta_read_main_configuration(void* shm, char* filename)
                      unknown = true;
                   }
                }
+               else if (!strcmp(key, "compression_frame_size"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_bytes(value, &config->compression_frame_size, 0))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "compression_adaptive"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_bool(value, &config->compression_adaptive))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
                else if (!strcmp(key, "storage_engine"))
                {
                   if (!strcmp(section, "pgmoneta"))
@@ -1028,6 +1305,20 @@ pgmoneta_read_main_configuration(void* shm, char* filename)
                      unknown = true;
                   }
                }
+               else if (!strcmp(key, "reflink"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_bool(value, &config->reflink))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
                else if (!strcmp(key, "ssh_hostname"))
                {
                   if (!strcmp(section, "pgmoneta"))
@@ -1096,6 +1387,20 @@ pgmoneta_read_main_configuration(void* shm, char* filename)
                      unknown = true;
                   }
                }
+               else if (!strcmp(key, "ssh_max_inflight"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_int(value, &config->ssh_max_inflight))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
                else if (!strcmp(key, "s3_aws_region"))
                {
                   if (!strcmp(section, "pgmoneta"))
@@ -1176,142 +1481,618 @@ pgmoneta_read_main_configuration(void* shm, char* filename)
                      unknown = true;
                   }
                }
-               else if (!strcmp(key, "azure_storage_account"))
+               else if (!strcmp(key, "s3_part_size"))
                {
                   if (!strcmp(section, "pgmoneta"))
                   {
-                     max = strlen(value);
-                     if (max > MISC_LENGTH - 1)
+                     if (as_bytes(value, &config->s3_part_size, 64 * 1024 * 1024))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "azure_block_size"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_bytes(value, &config->azure_block_size, 64 * 1024 * 1024))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "storage_pack_size"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_bytes(value, &config->storage_pack_size, 0))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "upload_concurrency"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_int(value, &config->upload_concurrency))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "upload_max_rate"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_bytes(value, &config->upload_max_rate, 0))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "bandwidth_max_rate"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_bytes(value, &config->bandwidth_max_rate, 0))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "backup_window"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_seconds(value, &config->backup_window, 0))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "azure_storage_account"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     max = strlen(value);
+                     if (max > MISC_LENGTH - 1)
+                     {
+                        max = MISC_LENGTH - 1;
+                     }
+                     memcpy(config->azure_storage_account, value, max);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "azure_container"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     max = strlen(value);
+                     if (max > MISC_LENGTH - 1)
+                     {
+                        max = MISC_LENGTH - 1;
+                     }
+                     memcpy(config->azure_container, value, max);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "azure_shared_key"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     max = strlen(value);
+                     if (max > MISC_LENGTH - 1)
+                     {
+                        max = MISC_LENGTH - 1;
+                     }
+                     memcpy(config->azure_shared_key, value, max);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "azure_base_dir"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     max = strlen(value);
+                     if (max > MAX_PATH - 1)
+                     {
+                        max = MAX_PATH - 1;
+                     }
+                     memcpy(config->azure_base_dir, value, max);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "workspace"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     max = strlen(value);
+                     if (max > MAX_PATH - 1)
+                     {
+                        max = MAX_PATH - 1;
+                     }
+                     memcpy(config->workspace, value, max);
+                  }
+                  else if (strlen(section) > 0)
+                  {
+                     max = strlen(section);
+                     if (max > MISC_LENGTH - 1)
+                     {
+                        max = MISC_LENGTH - 1;
+                     }
+                     memcpy(&srv.name, section, max);
+                     max = strlen(value);
+                     if (max > MAX_PATH - 1)
+                     {
+                        max = MAX_PATH - 1;
+                     }
+                     memcpy(&srv.workspace, value, max);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+
+               else if (!strcmp(key, "retention"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     config->retention_days = -1;
+                     config->retention_weeks = -1;
+                     config->retention_months = -1;
+                     config->retention_years = -1;
+                     if (as_retention(value, &config->retention_days,
+                                      &config->retention_weeks,
+                                      &config->retention_months,
+                                      &config->retention_years))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else if (strlen(section) > 0)
+                  {
+                     srv.retention_days = -1;
+                     srv.retention_weeks = -1;
+                     srv.retention_months = -1;
+                     srv.retention_years = -1;
+                     if (as_retention(value, &srv.retention_days,
+                                      &srv.retention_weeks,
+                                      &srv.retention_months,
+                                      &srv.retention_years))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "retention_interval"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_int(value, &config->retention_interval))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "delete_trash"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_bool(value, &config->delete_trash))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "encryption"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     config->encryption = as_encryption_mode(value);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "backup_max_rate"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_int(value, &config->backup_max_rate))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else if (strlen(section) > 0)
+                  {
+                     max = strlen(section);
+                     if (max > MISC_LENGTH - 1)
+                     {
+                        max = MISC_LENGTH - 1;
+                     }
+                     memcpy(&srv.name, section, max);
+                     if (as_int(value, &srv.backup_max_rate))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "network_max_rate"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_int(value, &config->network_max_rate))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else if (strlen(section) > 0)
+                  {
+                     max = strlen(section);
+                     if (max > MISC_LENGTH - 1)
+                     {
+                        max = MISC_LENGTH - 1;
+                     }
+                     memcpy(&srv.name, section, max);
+                     if (as_int(value, &srv.network_max_rate))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "manifest"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     config->manifest = pgmoneta_get_hash_algorithm(value);
+                  }
+                  else if (strlen(section) > 0)
+                  {
+                     srv.manifest = pgmoneta_get_hash_algorithm(value);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "wal_cache_size"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_bytes(value, &config->wal_cache_size, 0))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "wal_flush_size"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_bytes(value, &config->wal_flush_size, 0))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "wal_flush_interval"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_int(value, &config->wal_flush_interval))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "wal_status_size"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_bytes(value, &config->wal_status_size, 0))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "wal_status_interval"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_int(value, &config->wal_status_interval))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "wal_preallocate"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_int(value, &config->wal_preallocate))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "wal_inline_compression"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_bool(value, &config->wal_inline_compression))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "wal_dictionary"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_bool(value, &config->wal_dictionary))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "restore_io_uring"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_bool(value, &config->restore_io_uring))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "wal_multiplex"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_bool(value, &config->wal_multiplex))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "backup_multiplex"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_bool(value, &config->backup_multiplex))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "backup_write_queue"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_int(value, &config->backup_write_queue))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "memory_budget"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_bytes(value, &config->memory_budget, 0))
+                     {
+                        unknown = true;
+                     }
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "wal_prefetch"))
+               {
+                  if (!strcmp(section, "pgmoneta"))
+                  {
+                     if (as_int(value, &config->wal_prefetch))
                      {
-                        max = MISC_LENGTH - 1;
+                        unknown = true;
                      }
-                     memcpy(config->azure_storage_account, value, max);
                   }
                   else
                   {
                      unknown = true;
                   }
                }
-               else if (!strcmp(key, "azure_container"))
+               else if (!strcmp(key, "manifest_tree"))
                {
                   if (!strcmp(section, "pgmoneta"))
                   {
-                     max = strlen(value);
-                     if (max > MISC_LENGTH - 1)
+                     if (as_bool(value, &config->manifest_tree))
                      {
-                        max = MISC_LENGTH - 1;
+                        unknown = true;
                      }
-                     memcpy(config->azure_container, value, max);
                   }
                   else
                   {
                      unknown = true;
                   }
                }
-               else if (!strcmp(key, "azure_shared_key"))
+               else if (!strcmp(key, "incremental_delta"))
                {
                   if (!strcmp(section, "pgmoneta"))
                   {
-                     max = strlen(value);
-                     if (max > MISC_LENGTH - 1)
+                     if (as_bool(value, &config->incremental_delta))
                      {
-                        max = MISC_LENGTH - 1;
+                        unknown = true;
                      }
-                     memcpy(config->azure_shared_key, value, max);
                   }
                   else
                   {
                      unknown = true;
                   }
                }
-               else if (!strcmp(key, "azure_base_dir"))
+               else if (!strcmp(key, "wal_compaction_age"))
                {
                   if (!strcmp(section, "pgmoneta"))
                   {
-                     max = strlen(value);
-                     if (max > MAX_PATH - 1)
+                     if (as_seconds(value, &config->wal_compaction_age, 0))
                      {
-                        max = MAX_PATH - 1;
+                        unknown = true;
                      }
-                     memcpy(config->azure_base_dir, value, max);
                   }
                   else
                   {
                      unknown = true;
                   }
                }
-               else if (!strcmp(key, "workspace"))
+               else if (!strcmp(key, "worker_cpus"))
                {
                   if (!strcmp(section, "pgmoneta"))
                   {
                      max = strlen(value);
-                     if (max > MAX_PATH - 1)
-                     {
-                        max = MAX_PATH - 1;
-                     }
-                     memcpy(config->workspace, value, max);
-                  }
-                  else if (strlen(section) > 0)
-                  {
-                     max = strlen(section);
                      if (max > MISC_LENGTH - 1)
                      {
                         max = MISC_LENGTH - 1;
                      }
-                     memcpy(&srv.name, section, max);
-                     max = strlen(value);
-                     if (max > MAX_PATH - 1)
-                     {
-                        max = MAX_PATH - 1;
-                     }
-                     memcpy(&srv.workspace, value, max);
+                     memcpy(config->worker_cpus, value, max);
                   }
                   else
                   {
                      unknown = true;
                   }
                }
-
-               else if (!strcmp(key, "retention"))
+               else if (!strcmp(key, "receiver_cpus"))
                {
                   if (!strcmp(section, "pgmoneta"))
                   {
-                     config->retention_days = -1;
-                     config->retention_weeks = -1;
-                     config->retention_months = -1;
-                     config->retention_years = -1;
-                     if (as_retention(value, &config->retention_days,
-                                      &config->retention_weeks,
-                                      &config->retention_months,
-                                      &config->retention_years))
-                     {
-                        unknown = true;
-                     }
-                  }
-                  else if (strlen(section) > 0)
-                  {
-                     srv.retention_days = -1;
-                     srv.retention_weeks = -1;
-                     srv.retention_months = -1;
-                     srv.retention_years = -1;
-                     if (as_retention(value, &srv.retention_days,
-                                      &srv.retention_weeks,
-                                      &srv.retention_months,
-                                      &srv.retention_years))
+                     max = strlen(value);
+                     if (max > MISC_LENGTH - 1)
                      {
-                        unknown = true;
+                        max = MISC_LENGTH - 1;
                      }
+                     memcpy(config->receiver_cpus, value, max);
                   }
                   else
                   {
                      unknown = true;
                   }
                }
-               else if (!strcmp(key, "retention_interval"))
+               else if (!strcmp(key, "compaction_interval"))
                {
                   if (!strcmp(section, "pgmoneta"))
                   {
-                     if (as_int(value, &config->retention_interval))
+                     if (as_seconds(value, &config->compaction_interval, 0))
                      {
                         unknown = true;
                      }
@@ -1321,35 +2102,25 @@ pgmoneta_read_main_configuration(void* shm, char* filename)
                      unknown = true;
                   }
                }
-               else if (!strcmp(key, "encryption"))
+               else if (!strcmp(key, "compaction_chain"))
                {
                   if (!strcmp(section, "pgmoneta"))
                   {
-                     config->encryption = as_encryption_mode(value);
+                     if (as_int(value, &config->compaction_chain))
+                     {
+                        unknown = true;
+                     }
                   }
                   else
                   {
                      unknown = true;
                   }
                }
-               else if (!strcmp(key, "backup_max_rate"))
+               else if (!strcmp(key, "compaction_max_rate"))
                {
                   if (!strcmp(section, "pgmoneta"))
                   {
-                     if (as_int(value, &config->backup_max_rate))
-                     {
-                        unknown = true;
-                     }
-                  }
-                  else if (strlen(section) > 0)
-                  {
-                     max = strlen(section);
-                     if (max > MISC_LENGTH - 1)
-                     {
-                        max = MISC_LENGTH - 1;
-                     }
-                     memcpy(&srv.name, section, max);
-                     if (as_int(value, &srv.backup_max_rate))
+                     if (as_bytes(value, &config->compaction_max_rate, 0))
                      {
                         unknown = true;
                      }
@@ -1359,24 +2130,11 @@ pgmoneta_read_main_configuration(void* shm, char* filename)
                      unknown = true;
                   }
                }
-               else if (!strcmp(key, "network_max_rate"))
+               else if (!strcmp(key, "scrub_interval"))
                {
                   if (!strcmp(section, "pgmoneta"))
                   {
-                     if (as_int(value, &config->network_max_rate))
-                     {
-                        unknown = true;
-                     }
-                  }
-                  else if (strlen(section) > 0)
-                  {
-                     max = strlen(section);
-                     if (max > MISC_LENGTH - 1)
-                     {
-                        max = MISC_LENGTH - 1;
-                     }
-                     memcpy(&srv.name, section, max);
-                     if (as_int(value, &srv.network_max_rate))
+                     if (as_seconds(value, &config->scrub_interval, 0))
                      {
                         unknown = true;
                      }
@@ -1386,15 +2144,14 @@ pgmoneta_read_main_configuration(void* shm, char* filename)
                      unknown = true;
                   }
                }
-               else if (!strcmp(key, "manifest"))
+               else if (!strcmp(key, "scrub_max_rate"))
                {
                   if (!strcmp(section, "pgmoneta"))
                   {
-                     config->manifest = pgmoneta_get_hash_algorithm(value);
-                  }
-                  else if (strlen(section) > 0)
-                  {
-                     srv.manifest = pgmoneta_get_hash_algorithm(value);
+                     if (as_bytes(value, &config->scrub_max_rate, 0))
+                     {
+                        unknown = true;
+                     }
                   }
                   else
                   {
@@ -1477,6 +2234,7 @@ int
 pgmoneta_validate_main_configuration(void* shm)
 {
    bool found = false;
+   int n = 0;
    struct stat st;
    struct main_configuration* config;
 
@@ -1579,6 +2337,29 @@ pgmoneta_validate_main_configuration(void* shm)
       pgmoneta_log_fatal("retention interval should be at least 1");
       return 1;
    }
+   if (config->compaction_interval > 0 && config->compaction_chain < 1)
+   {
+      pgmoneta_log_fatal("compaction chain should be at least 1");
+      return 1;
+   }
+
+   /* S3 rejects parts below 5MB, except the last one */
+   if (config->s3_part_size < 5 * 1024 * 1024)
+   {
+      config->s3_part_size = 5 * 1024 * 1024;
+   }
+   if (config->ssh_max_inflight < 1)
+   {
+      config->ssh_max_inflight = 1;
+   }
+   if (config->azure_block_size < 1024 * 1024)
+   {
+      config->azure_block_size = 1024 * 1024;
+   }
+   if (config->upload_concurrency < 1)
+   {
+      config->upload_concurrency = 1;
+   }
 
    if (config->backlog < 16)
    {
@@ -1612,6 +2393,19 @@ pgmoneta_validate_main_configuration(void* shm)
       {
          config->compression_level = 22;
       }
+
+      if (config->compression_frame_size < 0)
+      {
+         config->compression_frame_size = 0;
+      }
+      else if (config->compression_frame_size > 0 && config->compression_frame_size < 64 * 1024)
+      {
+         config->compression_frame_size = 64 * 1024;
+      }
+      else if (config->compression_frame_size > 1024 * 1024 * 1024)
+      {
+         config->compression_frame_size = 1024 * 1024 * 1024;
+      }
    }
    else if (config->compression_type == COMPRESSION_CLIENT_LZ4 || config->compression_type == COMPRESSION_SERVER_LZ4)
    {
@@ -1641,6 +2435,23 @@ pgmoneta_validate_main_configuration(void* shm)
       config->workers = 0;
    }
 
+   if (config->io_workers < 0)
+   {
+      config->io_workers = 0;
+   }
+
+   if (strlen(config->worker_cpus) > 0 && pgmoneta_parse_cpus(config->worker_cpus, NULL, 0, &n))
+   {
+      pgmoneta_log_error("worker_cpus: Invalid CPU list %s", config->worker_cpus);
+      memset(config->worker_cpus, 0, sizeof(config->worker_cpus));
+   }
+
+   if (strlen(config->receiver_cpus) > 0 && pgmoneta_parse_cpus(config->receiver_cpus, NULL, 0, &n))
+   {
+      pgmoneta_log_error("receiver_cpus: Invalid CPU list %s", config->receiver_cpus);
+      memset(config->receiver_cpus, 0, sizeof(config->receiver_cpus));
+   }
+
    if (strlen(config->metrics_cert_file) > 0)
    {
       if (!pgmoneta_exists(config->metrics_cert_file))
@@ -1735,6 +2546,16 @@ pgmoneta_validate_main_configuration(void* shm)
          config->common.servers[i].workers = -1;
       }
 
+      if (config->common.servers[i].io_workers < -1)
+      {
+         config->common.servers[i].io_workers = -1;
+      }
+
+      if (config->common.servers[i].backup_connections < 0)
+      {
+         config->common.servers[i].backup_connections = 0;
+      }
+
       if (config->common.servers[i].backup_max_rate < -1)
       {
          config->common.servers[i].backup_max_rate = -1;
@@ -2470,25 +3291,38 @@ add_configuration_response(struct json* res)
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_MANAGEMENT, (uintptr_t)config->management, ValueInt64);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_COMPRESSION, (uintptr_t)config->compression_type, ValueInt32);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_COMPRESSION_LEVEL, (uintptr_t)config->compression_level, ValueInt64);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_COMPRESSION_FRAME_SIZE, (uintptr_t)config->compression_frame_size, ValueInt64);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_COMPRESSION_ADAPTIVE, (uintptr_t)config->compression_adaptive, ValueBool);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_WORKERS, (uintptr_t)config->workers, ValueInt64);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_IO_WORKERS, (uintptr_t)config->io_workers, ValueInt64);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_STORAGE_ENGINE, (uintptr_t)config->storage_engine, ValueInt32);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_REFLINK, (uintptr_t)config->reflink, ValueBool);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_ENCRYPTION, (uintptr_t)config->encryption, ValueInt32);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_CREATE_SLOT, (uintptr_t)config->create_slot, ValueInt32);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_SSH_HOSTNAME, (uintptr_t)config->ssh_hostname, ValueString);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_SSH_USERNAME, (uintptr_t)config->ssh_username, ValueString);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_SSH_BASE_DIR, (uintptr_t)config->ssh_base_dir, ValueString);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_SSH_CIPHERS, (uintptr_t)config->ssh_ciphers, ValueString);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_SSH_MAX_INFLIGHT, (uintptr_t)config->ssh_max_inflight, ValueInt64);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_S3_AWS_REGION, (uintptr_t)config->s3_aws_region, ValueString);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_S3_ACCESS_KEY_ID, (uintptr_t)config->s3_access_key_id, ValueString);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_S3_SECRET_ACCESS_KEY, (uintptr_t)config->s3_secret_access_key, ValueString);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_S3_BUCKET, (uintptr_t)config->s3_bucket, ValueString);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_S3_BASE_DIR, (uintptr_t)config->s3_base_dir, ValueString);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_S3_PART_SIZE, (uintptr_t)config->s3_part_size, ValueInt64);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_AZURE_BASE_DIR, (uintptr_t)config->azure_base_dir, ValueString);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_AZURE_BLOCK_SIZE, (uintptr_t)config->azure_block_size, ValueInt64);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_STORAGE_PACK_SIZE, (uintptr_t)config->storage_pack_size, ValueInt64);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_UPLOAD_CONCURRENCY, (uintptr_t)config->upload_concurrency, ValueInt64);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_UPLOAD_MAX_RATE, (uintptr_t)config->upload_max_rate, ValueInt64);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_BANDWIDTH_MAX_RATE, (uintptr_t)config->bandwidth_max_rate, ValueInt64);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_BACKUP_WINDOW, (uintptr_t)config->backup_window, ValueInt64);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_AZURE_STORAGE_ACCOUNT, (uintptr_t)config->azure_storage_account, ValueString);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_AZURE_CONTAINER, (uintptr_t)config->azure_container, ValueString);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_AZURE_SHARED_KEY, (uintptr_t)config->azure_shared_key, ValueString);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_WORKSPACE, (uintptr_t)config->workspace, ValueString);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_RETENTION, (uintptr_t)ret, ValueString);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_DELETE_TRASH, (uintptr_t)config->delete_trash, ValueBool);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_LOG_TYPE, (uintptr_t)config->common.log_type, ValueInt32);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_LOG_LEVEL, (uintptr_t)config->common.log_level, ValueInt32);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_LOG_PATH, (uintptr_t)config->common.log_path, ValueString);
@@ -2508,9 +3342,36 @@ add_configuration_response(struct json* res)
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_BACKUP_MAX_RATE, (uintptr_t)config->backup_max_rate, ValueInt64);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_NETWORK_MAX_RATE, (uintptr_t)config->network_max_rate, ValueInt64);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_MANIFEST, (uintptr_t)config->manifest, ValueInt64);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_WAL_CACHE_SIZE, (uintptr_t)config->wal_cache_size, ValueInt64);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_WAL_FLUSH_SIZE, (uintptr_t)config->wal_flush_size, ValueInt64);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_WAL_FLUSH_INTERVAL, (uintptr_t)config->wal_flush_interval, ValueInt64);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_WAL_STATUS_SIZE, (uintptr_t)config->wal_status_size, ValueInt64);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_WAL_STATUS_INTERVAL, (uintptr_t)config->wal_status_interval, ValueInt64);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_WAL_PREALLOCATE, (uintptr_t)config->wal_preallocate, ValueInt64);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_WAL_INLINE_COMPRESSION, (uintptr_t)config->wal_inline_compression, ValueBool);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_WAL_DICTIONARY, (uintptr_t)config->wal_dictionary, ValueBool);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_RESTORE_IO_URING, (uintptr_t)config->restore_io_uring, ValueBool);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_WAL_MULTIPLEX, (uintptr_t)config->wal_multiplex, ValueBool);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_BACKUP_MULTIPLEX, (uintptr_t)config->backup_multiplex, ValueBool);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_BACKUP_WRITE_QUEUE, (uintptr_t)config->backup_write_queue, ValueInt64);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_MEMORY_BUDGET, (uintptr_t)config->memory_budget, ValueInt64);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_WAL_PREFETCH, (uintptr_t)config->wal_prefetch, ValueInt64);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_WAL_COMPACTION_AGE, (uintptr_t)config->wal_compaction_age, ValueInt64);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_MANIFEST_TREE, (uintptr_t)config->manifest_tree, ValueBool);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_INCREMENTAL_DELTA, (uintptr_t)config->incremental_delta, ValueBool);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_WORKER_CPUS, (uintptr_t)config->worker_cpus, ValueString);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_RECEIVER_CPUS, (uintptr_t)config->receiver_cpus, ValueString);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_COMPACTION_INTERVAL, (uintptr_t)config->compaction_interval, ValueInt64);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_COMPACTION_CHAIN, (uintptr_t)config->compaction_chain, ValueInt64);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_COMPACTION_MAX_RATE, (uintptr_t)config->compaction_max_rate, ValueInt64);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_SCRUB_INTERVAL, (uintptr_t)config->scrub_interval, ValueInt64);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_SCRUB_MAX_RATE, (uintptr_t)config->scrub_max_rate, ValueInt64);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_KEEP_ALIVE, (uintptr_t)config->common.keep_alive, ValueBool);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_NODELAY, (uintptr_t)config->common.nodelay, ValueBool);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_NON_BLOCKING, (uintptr_t)config->common.non_blocking, ValueBool);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_TCP_BUFFER_SIZE, (uintptr_t)config->common.tcp_buffer_size, ValueInt64);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_TCP_CONGESTION, (uintptr_t)config->common.tcp_congestion, ValueString);
+   pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_DIRECT_IO, (uintptr_t)config->common.direct_io, ValueBool);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_BACKLOG, (uintptr_t)config->backlog, ValueInt64);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_HUGEPAGE, (uintptr_t)config->hugepage, ValueChar);
    pgmoneta_json_put(res, CONFIGURATION_ARGUMENT_PIDFILE, (uintptr_t)config->pidfile, ValueString);
@@ -2552,13 +3413,20 @@ add_servers_configuration_response(struct json* res)
       pgmoneta_json_put(server_conf, CONFIGURATION_ARGUMENT_HOT_STANDBY, (uintptr_t)config->common.servers[i].hot_standby, ValueString);
       pgmoneta_json_put(server_conf, CONFIGURATION_ARGUMENT_HOT_STANDBY_OVERRIDES, (uintptr_t)config->common.servers[i].hot_standby_overrides, ValueString);
       pgmoneta_json_put(server_conf, CONFIGURATION_ARGUMENT_HOT_STANDBY_TABLESPACES, (uintptr_t)config->common.servers[i].hot_standby_tablespaces, ValueString);
+      pgmoneta_json_put(server_conf, CONFIGURATION_ARGUMENT_HOT_STANDBY_REPLAY, (uintptr_t)config->common.servers[i].hot_standby_replay, ValueBool);
       pgmoneta_json_put(server_conf, CONFIGURATION_ARGUMENT_WORKERS, (uintptr_t)config->common.servers[i].workers, ValueInt64);
+      pgmoneta_json_put(server_conf, CONFIGURATION_ARGUMENT_IO_WORKERS, (uintptr_t)config->common.servers[i].io_workers, ValueInt64);
+      pgmoneta_json_put(server_conf, CONFIGURATION_ARGUMENT_BACKUP_CONNECTIONS, (uintptr_t)config->common.servers[i].backup_connections, ValueInt64);
+      pgmoneta_json_put(server_conf, CONFIGURATION_ARGUMENT_BACKUP_STANDBY, (uintptr_t)config->common.servers[i].backup_standby, ValueBool);
+      pgmoneta_json_put(server_conf, CONFIGURATION_ARGUMENT_SNAPSHOT_COMMAND, (uintptr_t)config->common.servers[i].snapshot_command, ValueString);
+      pgmoneta_json_put(server_conf, CONFIGURATION_ARGUMENT_SNAPSHOT_RELEASE_COMMAND, (uintptr_t)config->common.servers[i].snapshot_release_command, ValueString);
       pgmoneta_json_put(server_conf, CONFIGURATION_ARGUMENT_BACKUP_MAX_RATE, (uintptr_t)config->common.servers[i].backup_max_rate, ValueInt64);
       pgmoneta_json_put(server_conf, CONFIGURATION_ARGUMENT_NETWORK_MAX_RATE, (uintptr_t)config->common.servers[i].network_max_rate, ValueInt64);
       pgmoneta_json_put(server_conf, CONFIGURATION_ARGUMENT_MANIFEST, (uintptr_t)config->common.servers[i].manifest, ValueInt64);
       pgmoneta_json_put(server_conf, CONFIGURATION_ARGUMENT_TLS_CERT_FILE, (uintptr_t)config->common.servers[i].tls_cert_file, ValueString);
       pgmoneta_json_put(server_conf, CONFIGURATION_ARGUMENT_TLS_CA_FILE, (uintptr_t)config->common.servers[i].tls_ca_file, ValueString);
       pgmoneta_json_put(server_conf, CONFIGURATION_ARGUMENT_TLS_KEY_FILE, (uintptr_t)config->common.servers[i].tls_key_file, ValueString);
+      pgmoneta_json_put(server_conf, CONFIGURATION_ARGUMENT_TLS_KTLS, (uintptr_t)config->common.servers[i].tls_ktls, ValueBool);
       pgmoneta_json_put(server_conf, CONFIGURATION_ARGUMENT_EXTRA, (uintptr_t)config->common.servers[i].extra, ValueString);
 
       pgmoneta_json_put(res, config->common.servers[i].name, (uintptr_t)server_conf, ValueJSON);
@@ -2567,7 +3435,7 @@ add_servers_configuration_response(struct json* res)
    }
 }
 
-void
+int
 pgmoneta_conf_get(SSL* ssl __attribute__((unused)), int client_fd, uint8_t compression, uint8_t encryption, struct json* payload)
 {
    struct json* response = NULL;
@@ -2616,18 +3484,14 @@ pgmoneta_conf_get(SSL* ssl __attribute__((unused)), int client_fd, uint8_t compr
 
    pgmoneta_disconnect(client_fd);
 
-   pgmoneta_stop_logging();
-
-   exit(0);
+   return 0;
 error:
 
    pgmoneta_json_destroy(payload);
 
    pgmoneta_disconnect(client_fd);
 
-   pgmoneta_stop_logging();
-
-   exit(1);
+   return 1;
 
 }
 
@@ -2814,9 +3678,7 @@ pgmoneta_conf_set(SSL* ssl __attribute__((unused)), int client_fd, uint8_t compr
             {
                max = MAX_PATH - 1;
             }
-            int count = 0;
-            split_extra(config_value, config->common.servers[server_index].extra, &count);
-            config->common.servers[server_index].number_of_extra = count;
+            split_extra(config_value, &config->common.servers[server_index]);
             pgmoneta_json_put(server_j, key, (uintptr_t)config_value, ValueString);
             pgmoneta_json_put(response, config->common.servers[server_index].name, (uintptr_t)server_j, ValueJSON);
          }
@@ -2975,6 +3837,108 @@ pgmoneta_conf_set(SSL* ssl __attribute__((unused)), int client_fd, uint8_t compr
             unknown = true;
          }
       }
+      else if (!strcmp(key, "hot_standby_replay"))
+      {
+         if (strlen(section) > 0)
+         {
+            if (as_bool(config_value, &config->common.servers[server_index].hot_standby_replay))
+            {
+               unknown = true;
+            }
+            pgmoneta_json_put(server_j, key, (uintptr_t)config->common.servers[server_index].hot_standby_replay, ValueBool);
+            pgmoneta_json_put(response, config->common.servers[server_index].name, (uintptr_t)server_j, ValueJSON);
+         }
+         else
+         {
+            unknown = true;
+         }
+      }
+      else if (!strcmp(key, "tls_ktls"))
+      {
+         if (strlen(section) > 0)
+         {
+            if (as_bool(config_value, &config->common.servers[server_index].tls_ktls))
+            {
+               unknown = true;
+            }
+            pgmoneta_json_put(server_j, key, (uintptr_t)config->common.servers[server_index].tls_ktls, ValueBool);
+            pgmoneta_json_put(response, config->common.servers[server_index].name, (uintptr_t)server_j, ValueJSON);
+         }
+         else
+         {
+            unknown = true;
+         }
+      }
+      else if (!strcmp(key, "backup_connections"))
+      {
+         if (strlen(section) > 0)
+         {
+            if (as_int(config_value, &config->common.servers[server_index].backup_connections))
+            {
+               unknown = true;
+            }
+            pgmoneta_json_put(server_j, key, (uintptr_t)config->common.servers[server_index].backup_connections, ValueInt64);
+            pgmoneta_json_put(response, config->common.servers[server_index].name, (uintptr_t)server_j, ValueJSON);
+         }
+         else
+         {
+            unknown = true;
+         }
+      }
+      else if (!strcmp(key, "backup_standby"))
+      {
+         if (strlen(section) > 0)
+         {
+            if (as_bool(config_value, &config->common.servers[server_index].backup_standby))
+            {
+               unknown = true;
+            }
+            pgmoneta_json_put(server_j, key, (uintptr_t)config->common.servers[server_index].backup_standby, ValueBool);
+            pgmoneta_json_put(response, config->common.servers[server_index].name, (uintptr_t)server_j, ValueJSON);
+         }
+         else
+         {
+            unknown = true;
+         }
+      }
+      else if (!strcmp(key, "snapshot_command"))
+      {
+         if (strlen(section) > 0)
+         {
+            max = strlen(config_value);
+            if (max > MAX_PATH - 1)
+            {
+               max = MAX_PATH - 1;
+            }
+            memset(&config->common.servers[server_index].snapshot_command, 0, MAX_PATH);
+            memcpy(&config->common.servers[server_index].snapshot_command, config_value, max);
+            pgmoneta_json_put(server_j, key, (uintptr_t)config->common.servers[server_index].snapshot_command, ValueString);
+            pgmoneta_json_put(response, config->common.servers[server_index].name, (uintptr_t)server_j, ValueJSON);
+         }
+         else
+         {
+            unknown = true;
+         }
+      }
+      else if (!strcmp(key, "snapshot_release_command"))
+      {
+         if (strlen(section) > 0)
+         {
+            max = strlen(config_value);
+            if (max > MAX_PATH - 1)
+            {
+               max = MAX_PATH - 1;
+            }
+            memset(&config->common.servers[server_index].snapshot_release_command, 0, MAX_PATH);
+            memcpy(&config->common.servers[server_index].snapshot_release_command, config_value, max);
+            pgmoneta_json_put(server_j, key, (uintptr_t)config->common.servers[server_index].snapshot_release_command, ValueString);
+            pgmoneta_json_put(response, config->common.servers[server_index].name, (uintptr_t)server_j, ValueJSON);
+         }
+         else
+         {
+            unknown = true;
+         }
+      }
       else if (!strcmp(key, "metrics"))
       {
          if (as_int(config_value, &config->metrics))
@@ -3140,24 +4104,44 @@ pgmoneta_conf_set(SSL* ssl __attribute__((unused)), int client_fd, uint8_t compr
          config->update_process_title = as_update_process_title(config_value, UPDATE_PROCESS_TITLE_VERBOSE);
          pgmoneta_json_put(response, key, (uintptr_t)config->update_process_title, ValueUInt64);
       }
-      else if (!strcmp(key, "workers"))
+      else if (!strcmp(key, "workers"))
+      {
+         if (strlen(section) > 0)
+         {
+            if (as_int(config_value, &config->common.servers[server_index].workers))
+            {
+               unknown = true;
+            }
+            pgmoneta_json_put(server_j, key, (uintptr_t)config->workers, ValueInt64);
+            pgmoneta_json_put(response, config->common.servers[server_index].name, (uintptr_t)server_j, ValueJSON);
+         }
+         else
+         {
+            if (as_int(config_value, &config->workers))
+            {
+               unknown = true;
+            }
+            pgmoneta_json_put(response, key, (uintptr_t)config->workers, ValueInt64);
+         }
+      }
+      else if (!strcmp(key, "io_workers"))
       {
          if (strlen(section) > 0)
          {
-            if (as_int(config_value, &config->common.servers[server_index].workers))
+            if (as_int(config_value, &config->common.servers[server_index].io_workers))
             {
                unknown = true;
             }
-            pgmoneta_json_put(server_j, key, (uintptr_t)config->workers, ValueInt64);
+            pgmoneta_json_put(server_j, key, (uintptr_t)config->common.servers[server_index].io_workers, ValueInt64);
             pgmoneta_json_put(response, config->common.servers[server_index].name, (uintptr_t)server_j, ValueJSON);
          }
          else
          {
-            if (as_int(config_value, &config->workers))
+            if (as_int(config_value, &config->io_workers))
             {
                unknown = true;
             }
-            pgmoneta_json_put(response, key, (uintptr_t)config->workers, ValueInt64);
+            pgmoneta_json_put(response, key, (uintptr_t)config->io_workers, ValueInt64);
          }
       }
       else if (!strcmp(key, "log_type"))
@@ -3255,6 +4239,33 @@ pgmoneta_conf_set(SSL* ssl __attribute__((unused)), int client_fd, uint8_t compr
          }
          pgmoneta_json_put(response, key, (uintptr_t)config->common.non_blocking, ValueBool);
       }
+      else if (!strcmp(key, "tcp_buffer_size"))
+      {
+         if (as_buffer_size(config_value, &config->common.tcp_buffer_size))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->common.tcp_buffer_size, ValueInt64);
+      }
+      else if (!strcmp(key, "tcp_congestion"))
+      {
+         max = strlen(config_value);
+         if (max > MISC_LENGTH - 1)
+         {
+            max = MISC_LENGTH - 1;
+         }
+         memset(config->common.tcp_congestion, 0, MISC_LENGTH);
+         memcpy(config->common.tcp_congestion, config_value, max);
+         pgmoneta_json_put(response, key, (uintptr_t)config->common.tcp_congestion, ValueString);
+      }
+      else if (!strcmp(key, "direct_io"))
+      {
+         if (as_bool(config_value, &config->common.direct_io))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->common.direct_io, ValueBool);
+      }
       else if (!strcmp(key, "backlog"))
       {
          if (as_int(config_value, &config->backlog))
@@ -3281,11 +4292,43 @@ pgmoneta_conf_set(SSL* ssl __attribute__((unused)), int client_fd, uint8_t compr
          }
          pgmoneta_json_put(response, key, (uintptr_t)config->compression_level, ValueInt32);
       }
+      else if (!strcmp(key, "compression_frame_size"))
+      {
+         if (as_bytes(config_value, &config->compression_frame_size, 0))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->compression_frame_size, ValueInt64);
+      }
+      else if (!strcmp(key, "compression_adaptive"))
+      {
+         if (as_bool(config_value, &config->compression_adaptive))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->compression_adaptive, ValueBool);
+      }
       else if (!strcmp(key, "storage_engine"))
       {
          config->storage_engine = as_storage_engine(config_value);
          pgmoneta_json_put(response, key, (uintptr_t)config->storage_engine, ValueInt32);
       }
+      else if (!strcmp(key, "reflink"))
+      {
+         if (as_bool(config_value, &config->reflink))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->reflink, ValueBool);
+      }
+      else if (!strcmp(key, "delete_trash"))
+      {
+         if (as_bool(config_value, &config->delete_trash))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->delete_trash, ValueBool);
+      }
       else if (!strcmp(key, "ssh_hostname"))
       {
          max = strlen(config_value);
@@ -3330,6 +4373,14 @@ pgmoneta_conf_set(SSL* ssl __attribute__((unused)), int client_fd, uint8_t compr
 
          free(ciphers);
       }
+      else if (!strcmp(key, "ssh_max_inflight"))
+      {
+         if (as_int(config_value, &config->ssh_max_inflight))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->ssh_max_inflight, ValueInt64);
+      }
       else if (!strcmp(key, "s3_aws_region"))
       {
          max = strlen(config_value);
@@ -3380,6 +4431,62 @@ pgmoneta_conf_set(SSL* ssl __attribute__((unused)), int client_fd, uint8_t compr
          memcpy(config->s3_base_dir, config_value, max);
          pgmoneta_json_put(response, key, (uintptr_t)config->s3_base_dir, ValueString);
       }
+      else if (!strcmp(key, "s3_part_size"))
+      {
+         if (as_bytes(config_value, &config->s3_part_size, 64 * 1024 * 1024))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->s3_part_size, ValueInt64);
+      }
+      else if (!strcmp(key, "azure_block_size"))
+      {
+         if (as_bytes(config_value, &config->azure_block_size, 64 * 1024 * 1024))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->azure_block_size, ValueInt64);
+      }
+      else if (!strcmp(key, "storage_pack_size"))
+      {
+         if (as_bytes(config_value, &config->storage_pack_size, 0))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->storage_pack_size, ValueInt64);
+      }
+      else if (!strcmp(key, "upload_concurrency"))
+      {
+         if (as_int(config_value, &config->upload_concurrency))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->upload_concurrency, ValueInt64);
+      }
+      else if (!strcmp(key, "upload_max_rate"))
+      {
+         if (as_bytes(config_value, &config->upload_max_rate, 0))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->upload_max_rate, ValueInt64);
+      }
+      else if (!strcmp(key, "bandwidth_max_rate"))
+      {
+         if (as_bytes(config_value, &config->bandwidth_max_rate, 0))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->bandwidth_max_rate, ValueInt64);
+      }
+      else if (!strcmp(key, "backup_window"))
+      {
+         if (as_seconds(config_value, &config->backup_window, 0))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->backup_window, ValueInt64);
+      }
       else if (!strcmp(key, "azure_storage_account"))
       {
          max = strlen(config_value);
@@ -3527,6 +4634,188 @@ pgmoneta_conf_set(SSL* ssl __attribute__((unused)), int client_fd, uint8_t compr
             pgmoneta_json_put(response, key, (uintptr_t)config->manifest, ValueInt32);
          }
       }
+      else if (!strcmp(key, "wal_cache_size"))
+      {
+         if (as_bytes(config_value, &config->wal_cache_size, 0))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->wal_cache_size, ValueInt64);
+      }
+      else if (!strcmp(key, "wal_flush_size"))
+      {
+         if (as_bytes(config_value, &config->wal_flush_size, 0))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->wal_flush_size, ValueInt64);
+      }
+      else if (!strcmp(key, "wal_flush_interval"))
+      {
+         if (as_int(config_value, &config->wal_flush_interval))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->wal_flush_interval, ValueInt64);
+      }
+      else if (!strcmp(key, "wal_status_size"))
+      {
+         if (as_bytes(config_value, &config->wal_status_size, 0))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->wal_status_size, ValueInt64);
+      }
+      else if (!strcmp(key, "wal_status_interval"))
+      {
+         if (as_int(config_value, &config->wal_status_interval))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->wal_status_interval, ValueInt64);
+      }
+      else if (!strcmp(key, "wal_preallocate"))
+      {
+         if (as_int(config_value, &config->wal_preallocate))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->wal_preallocate, ValueInt64);
+      }
+      else if (!strcmp(key, "wal_inline_compression"))
+      {
+         if (as_bool(config_value, &config->wal_inline_compression))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->wal_inline_compression, ValueBool);
+      }
+      else if (!strcmp(key, "wal_dictionary"))
+      {
+         if (as_bool(config_value, &config->wal_dictionary))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->wal_dictionary, ValueBool);
+      }
+      else if (!strcmp(key, "restore_io_uring"))
+      {
+         if (as_bool(config_value, &config->restore_io_uring))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->restore_io_uring, ValueBool);
+      }
+      else if (!strcmp(key, "wal_multiplex"))
+      {
+         if (as_bool(config_value, &config->wal_multiplex))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->wal_multiplex, ValueBool);
+      }
+      else if (!strcmp(key, "backup_multiplex"))
+      {
+         if (as_bool(config_value, &config->backup_multiplex))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->backup_multiplex, ValueBool);
+      }
+      else if (!strcmp(key, "backup_write_queue"))
+      {
+         if (as_int(config_value, &config->backup_write_queue))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->backup_write_queue, ValueInt64);
+      }
+      else if (!strcmp(key, "memory_budget"))
+      {
+         if (as_bytes(config_value, &config->memory_budget, 0))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->memory_budget, ValueInt64);
+      }
+      else if (!strcmp(key, "wal_prefetch"))
+      {
+         if (as_int(config_value, &config->wal_prefetch))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->wal_prefetch, ValueInt64);
+      }
+      else if (!strcmp(key, "manifest_tree"))
+      {
+         if (as_bool(config_value, &config->manifest_tree))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->manifest_tree, ValueBool);
+      }
+      else if (!strcmp(key, "incremental_delta"))
+      {
+         if (as_bool(config_value, &config->incremental_delta))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->incremental_delta, ValueBool);
+      }
+      else if (!strcmp(key, "wal_compaction_age"))
+      {
+         if (as_seconds(config_value, &config->wal_compaction_age, 0))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->wal_compaction_age, ValueInt64);
+      }
+      else if (!strcmp(key, "worker_cpus"))
+      {
+         max = strlen(config_value);
+         if (max > MISC_LENGTH - 1)
+         {
+            max = MISC_LENGTH - 1;
+         }
+         memset(config->worker_cpus, 0, MISC_LENGTH);
+         memcpy(config->worker_cpus, config_value, max);
+         pgmoneta_json_put(response, key, (uintptr_t)config->worker_cpus, ValueString);
+      }
+      else if (!strcmp(key, "receiver_cpus"))
+      {
+         max = strlen(config_value);
+         if (max > MISC_LENGTH - 1)
+         {
+            max = MISC_LENGTH - 1;
+         }
+         memset(config->receiver_cpus, 0, MISC_LENGTH);
+         memcpy(config->receiver_cpus, config_value, max);
+         pgmoneta_json_put(response, key, (uintptr_t)config->receiver_cpus, ValueString);
+      }
+      else if (!strcmp(key, "compaction_chain"))
+      {
+         if (as_int(config_value, &config->compaction_chain))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->compaction_chain, ValueInt64);
+      }
+      else if (!strcmp(key, "compaction_max_rate"))
+      {
+         if (as_bytes(config_value, &config->compaction_max_rate, 0))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->compaction_max_rate, ValueInt64);
+      }
+      else if (!strcmp(key, "scrub_max_rate"))
+      {
+         if (as_bytes(config_value, &config->scrub_max_rate, 0))
+         {
+            unknown = true;
+         }
+         pgmoneta_json_put(response, key, (uintptr_t)config->scrub_max_rate, ValueInt64);
+      }
       else
       {
          unknown = true;
@@ -4620,6 +5909,18 @@ error:
    }
 }
 
+static int
+as_buffer_size(char* str, int* size)
+{
+   if (str != NULL && !strcmp(str, "auto"))
+   {
+      *size = 0;
+      return 0;
+   }
+
+   return as_bytes(str, size, DEFAULT_BUFFER_SIZE);
+}
+
 static int
 as_encryption_mode(char* str)
 {
@@ -4658,6 +5959,11 @@ as_encryption_mode(char* str)
       return ENCRYPTION_AES_128_CTR;
    }
 
+   if (!strcasecmp(str, "aes-256-gcm"))
+   {
+      return ENCRYPTION_AES_256_GCM;
+   }
+
    warnx("Unknown encryption mode: %s", str);
 
    return ENCRYPTION_NONE;
@@ -4828,6 +6134,9 @@ transfer_configuration(struct main_configuration* config, struct main_configurat
    config->common.keep_alive = reload->common.keep_alive;
    config->common.nodelay = reload->common.nodelay;
    config->common.non_blocking = reload->common.non_blocking;
+   config->common.tcp_buffer_size = reload->common.tcp_buffer_size;
+   memcpy(config->common.tcp_congestion, reload->common.tcp_congestion, MISC_LENGTH);
+   config->common.direct_io = reload->common.direct_io;
    config->backlog = reload->backlog;
    if (restart_int("hugepage", config->hugepage, reload->hugepage))
    {
@@ -4867,9 +6176,58 @@ transfer_configuration(struct main_configuration* config, struct main_configurat
    config->common.number_of_admins = reload->common.number_of_admins;
 
    config->workers = reload->workers;
+   config->io_workers = reload->io_workers;
    config->backup_max_rate = reload->backup_max_rate;
    config->network_max_rate = reload->network_max_rate;
    config->manifest = reload->manifest;
+   config->wal_cache_size = reload->wal_cache_size;
+   config->wal_flush_size = reload->wal_flush_size;
+   config->wal_flush_interval = reload->wal_flush_interval;
+   config->wal_status_size = reload->wal_status_size;
+   config->wal_status_interval = reload->wal_status_interval;
+   config->wal_preallocate = reload->wal_preallocate;
+   config->wal_inline_compression = reload->wal_inline_compression;
+   config->restore_io_uring = reload->restore_io_uring;
+   if (restart_bool("wal_multiplex", config->wal_multiplex, reload->wal_multiplex))
+   {
+      changed = true;
+   }
+   if (restart_bool("backup_multiplex", config->backup_multiplex, reload->backup_multiplex))
+   {
+      changed = true;
+   }
+   config->backup_write_queue = reload->backup_write_queue;
+   config->memory_budget = reload->memory_budget;
+   config->wal_prefetch = reload->wal_prefetch;
+   config->wal_compaction_age = reload->wal_compaction_age;
+   config->manifest_tree = reload->manifest_tree;
+   config->incremental_delta = reload->incremental_delta;
+   memcpy(config->worker_cpus, reload->worker_cpus, MISC_LENGTH);
+   memcpy(config->receiver_cpus, reload->receiver_cpus, MISC_LENGTH);
+   if (restart_int("compaction_interval", config->compaction_interval, reload->compaction_interval))
+   {
+      changed = true;
+   }
+   config->compaction_chain = reload->compaction_chain;
+   config->compaction_max_rate = reload->compaction_max_rate;
+   if (restart_int("scrub_interval", config->scrub_interval, reload->scrub_interval))
+   {
+      changed = true;
+   }
+   config->scrub_max_rate = reload->scrub_max_rate;
+   config->ssh_max_inflight = reload->ssh_max_inflight;
+   config->s3_part_size = reload->s3_part_size;
+   config->azure_block_size = reload->azure_block_size;
+   config->storage_pack_size = reload->storage_pack_size;
+   config->upload_concurrency = reload->upload_concurrency;
+   config->upload_max_rate = reload->upload_max_rate;
+   config->bandwidth_max_rate = reload->bandwidth_max_rate;
+   config->backup_window = reload->backup_window;
+   config->compression_frame_size = reload->compression_frame_size;
+   config->wal_dictionary = reload->wal_dictionary;
+   config->compression_adaptive = reload->compression_adaptive;
+   config->reflink = reload->reflink;
+   config->delete_trash = reload->delete_trash;
 
    /* prometheus */
    atomic_init(&config->common.prometheus.logging_info, 0);
@@ -4888,43 +6246,46 @@ static int
 copy_server(struct server* dst, struct server* src)
 {
    bool changed = false;
+   bool reconnect = false;
 
    if (restart_string("name", &dst->name[0], &src->name[0]))
    {
       changed = true;
    }
-   if (restart_string("host", &dst->host[0], &src->host[0]))
+   if (reconnect_string("host", &dst->host[0], &src->host[0], MISC_LENGTH))
    {
-      changed = true;
+      reconnect = true;
    }
-   if (restart_int("port", dst->port, src->port))
+   if (reconnect_int("port", &dst->port, src->port))
    {
-      changed = true;
+      reconnect = true;
    }
-   if (restart_string("username", &dst->username[0], &src->username[0]))
+   if (reconnect_string("username", &dst->username[0], &src->username[0], MAX_USERNAME_LENGTH))
    {
-      changed = true;
+      reconnect = true;
    }
    if (restart_string("workspace", &dst->workspace[0], &src->workspace[0]))
    {
       changed = true;
    }
    dst->create_slot = src->create_slot;
-   if (restart_string("wal_slot", &dst->wal_slot[0], &src->wal_slot[0]))
+   if (reconnect_string("wal_slot", &dst->wal_slot[0], &src->wal_slot[0], MISC_LENGTH))
    {
-      changed = true;
+      reconnect = true;
    }
    if (restart_string("follow", &dst->follow[0], &src->follow[0]))
    {
       changed = true;
    }
-   if (restart_string("wal_shipping", &dst->wal_shipping[0], &src->wal_shipping[0]))
+   if (reconnect_string("wal_shipping", &dst->wal_shipping[0], &src->wal_shipping[0], MAX_PATH))
    {
-      changed = true;
+      reconnect = true;
    }
    memcpy(&dst->hot_standby[0], &src->hot_standby[0], MAX_PATH);
    memcpy(&dst->hot_standby_overrides[0], &src->hot_standby_overrides[0], MAX_PATH);
    memcpy(&dst->hot_standby_tablespaces[0], &src->hot_standby_tablespaces[0], MAX_PATH);
+   dst->hot_standby_replay = src->hot_standby_replay;
+   dst->tls_ktls = src->tls_ktls;
    /* dst->cur_timeline = src->cur_timeline; */
    dst->retention_days = src->retention_days;
    dst->retention_weeks = src->retention_weeks;
@@ -4937,27 +6298,36 @@ copy_server(struct server* dst, struct server* src)
    /* memcpy(&dst->current_wal_filename[0], &src->current_wal_filename[0], MISC_LENGTH); */
    /* memcpy(&dst->current_wal_lsn[0], &src->current_wal_lsn[0], MISC_LENGTH); */
    dst->workers = src->workers;
+   dst->io_workers = src->io_workers;
+   dst->backup_connections = src->backup_connections;
+   dst->backup_standby = src->backup_standby;
+   memcpy(&dst->snapshot_command[0], &src->snapshot_command[0], MAX_PATH);
+   memcpy(&dst->snapshot_release_command[0], &src->snapshot_release_command[0], MAX_PATH);
    dst->backup_max_rate = src->backup_max_rate;
    dst->network_max_rate = src->network_max_rate;
    dst->manifest = src->manifest;
 
-   if (restart_string("tls_cert_file", dst->tls_cert_file, src->tls_cert_file))
+   if (reconnect_string("tls_cert_file", dst->tls_cert_file, src->tls_cert_file, MAX_PATH))
    {
-      changed = true;
+      reconnect = true;
    }
-   if (restart_string("tls_key_file", dst->tls_key_file, src->tls_key_file))
+   if (reconnect_string("tls_key_file", dst->tls_key_file, src->tls_key_file, MAX_PATH))
    {
-      changed = true;
+      reconnect = true;
    }
-   if (restart_string("tls_ca_file", dst->tls_ca_file, src->tls_ca_file))
+   if (reconnect_string("tls_ca_file", dst->tls_ca_file, src->tls_ca_file, MAX_PATH))
    {
-      changed = true;
+      reconnect = true;
    }
 
    dst->number_of_extra = src->number_of_extra;
-   for (int i = 0; i < MAX_EXTRA; i++)
+   memcpy(dst->extra_offset, src->extra_offset, sizeof(dst->extra_offset));
+   memcpy(dst->extra, src->extra, sizeof(dst->extra));
+
+   // only the WAL receiver of the server is restarted for its connection settings
+   if (reconnect && !changed)
    {
-      memcpy(dst->extra[i], src->extra[i], MAX_EXTRA_PATH);
+      atomic_store(&dst->wal_restart, true);
    }
 
    if (changed)
@@ -5011,6 +6381,32 @@ restart_string(char* name, char* e, char* n)
    return 0;
 }
 
+static int
+reconnect_int(char* name, int* e, int n)
+{
+   if (*e != n)
+   {
+      pgmoneta_log_info("Reconnect required for %s - Existing %d New %d", name, *e, n);
+      *e = n;
+      return 1;
+   }
+
+   return 0;
+}
+
+static int
+reconnect_string(char* name, char* e, char* n, size_t size)
+{
+   if (strcmp(e, n))
+   {
+      pgmoneta_log_info("Reconnect required for %s - Existing %s New %s", name, e, n);
+      memcpy(e, n, size);
+      return 1;
+   }
+
+   return 0;
+}
+
 static bool
 is_empty_string(char* s)
 {
@@ -5085,25 +6481,42 @@ error:
 }
 
 static void
-split_extra(char* extra, char res[MAX_EXTRA][MAX_EXTRA_PATH], int* count)
+split_extra(char* extra, struct server* srv)
 {
    int i = 0;
+   size_t offset = 0;
+   size_t length;
    char temp[DEFAULT_BUFFER_SIZE];
    char* token;
    char* trimmed_token;
 
-   strcpy(temp, extra);
+   memset(srv->extra_offset, 0, sizeof(srv->extra_offset));
+   memset(srv->extra, 0, sizeof(srv->extra));
+
+   snprintf(temp, sizeof(temp), "%s", extra);
    token = strtok(temp, ",");
 
-   while (token != NULL)
+   // the directories are stored one after the other, so the server only uses the space of its configuration
+   while (token != NULL && i < MAX_EXTRA)
    {
-      // trim_spaces(token);
       trimmed_token = pgmoneta_remove_whitespace(token);
-      strcpy(res[i], trimmed_token);
+      length = strlen(trimmed_token);
+
+      if (offset + length + 1 > sizeof(srv->extra))
+      {
+         pgmoneta_log_warn("extra: Too many source directories for server %s", srv->name);
+         free(trimmed_token);
+         break;
+      }
+
+      srv->extra_offset[i] = (unsigned short)offset;
+      memcpy(srv->extra + offset, trimmed_token, length + 1);
+      offset += length + 1;
+
       free(trimmed_token);
       token = strtok(NULL, ",");
       i++;
    }
 
-   *count = i;
+   srv->number_of_extra = i;
 }
@@ -28,65 +28,146 @@
 #include <utils.h>
 
 #include <csv.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CSV_WRITER_BUFFER_SIZE 131072
+
+static bool csv_ensure_line(struct csv_reader* reader, size_t size);
+static bool csv_ensure_cols(struct csv_reader* reader, int size);
 
 int
 pgmoneta_csv_reader_init(char* path, struct csv_reader** reader)
 {
-   struct csv_reader* r = malloc(sizeof(struct csv_reader));
-   r->file = fopen(path, "r");
-   memset(r->line, 0, sizeof(r->line));
-   if (r->file == NULL)
+   struct csv_reader* r = NULL;
+   struct stat st;
+   int fd = -1;
+
+   r = (struct csv_reader*)calloc(1, sizeof(struct csv_reader));
+   if (r == NULL)
+   {
+      goto error;
+   }
+
+   fd = open(path, O_RDONLY);
+   if (fd == -1)
+   {
+      goto error;
+   }
+
+   if (fstat(fd, &st))
    {
       goto error;
    }
+
+   r->size = (size_t)st.st_size;
+
+   /* An empty file can't be mapped, it has no rows */
+   if (r->size > 0)
+   {
+      r->data = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (r->data == MAP_FAILED)
+      {
+         r->data = NULL;
+         goto error;
+      }
+
+      madvise(r->data, r->size, MADV_SEQUENTIAL);
+   }
+
+   close(fd);
+
    *reader = r;
+
    return 0;
+
 error:
-   if (r->file != NULL)
+
+   if (fd != -1)
    {
-      fclose(r->file);
+      close(fd);
    }
    free(r);
+
    return 1;
 }
 
 bool
 pgmoneta_csv_next_row(struct csv_reader* reader, int* num_col, char*** cols)
 {
-   char** cs = NULL;
+   char* start = NULL;
+   char* end = NULL;
    char* col = NULL;
-   char* last_tok = NULL;
+   char* sep = NULL;
+   size_t length = 0;
    int num = 0;
-   if (reader == NULL || reader->file == NULL)
+
+   if (reader == NULL || reader->offset >= reader->size)
    {
       goto error;
    }
-   memset(reader->line, 0, sizeof(reader->line));
-   if (fgets(reader->line, sizeof(reader->line), reader->file) == NULL)
+
+   start = reader->data + reader->offset;
+   end = memchr(start, '\n', reader->size - reader->offset);
+
+   if (end != NULL)
    {
-      goto error;
+      length = (size_t)(end - start);
+      reader->offset += length + 1;
    }
-   col = strtok(reader->line, ",");
-   while (col != NULL)
+   else
+   {
+      /* The last row doesn't need a trailing new line */
+      length = reader->size - reader->offset;
+      reader->offset = reader->size;
+   }
+
+   if (length > 0 && start[length - 1] == '\r')
+   {
+      length--;
+   }
+
+   if (!csv_ensure_line(reader, length + 1))
    {
-      cs = realloc(cs, (num + 1) * sizeof(char*));
-      cs[num] = col;
-      num++;
-      col = strtok(NULL, ",");
+      goto error;
    }
-   // trim the new line from the last token
-   if (num > 0)
+
+   memcpy(reader->line, start, length);
+   reader->line[length] = '\0';
+
+   col = reader->line;
+   end = reader->line + length;
+
+   while (true)
    {
-      last_tok = cs[num - 1];
-      last_tok[strlen(last_tok) - 1] = '\0';
+      if (!csv_ensure_cols(reader, num + 1))
+      {
+         goto error;
+      }
+
+      reader->cols[num++] = col;
+
+      sep = memchr(col, ',', (size_t)(end - col));
+      if (sep == NULL)
+      {
+         break;
+      }
+
+      *sep = '\0';
+      col = sep + 1;
    }
-   *cols = cs;
+
+   *cols = reader->cols;
    *num_col = num;
+
    return true;
+
 error:
-   free(cs);
+
    return false;
 }
 
@@ -97,10 +178,12 @@ pgmoneta_csv_reader_destroy(struct csv_reader* reader)
    {
       return 0;
    }
-   if (reader->file != NULL)
+   if (reader->data != NULL)
    {
-      fclose(reader->file);
+      munmap(reader->data, reader->size);
    }
+   free(reader->line);
+   free(reader->cols);
    free(reader);
    return 0;
 }
@@ -108,11 +191,11 @@ pgmoneta_csv_reader_destroy(struct csv_reader* reader)
 int
 pgmoneta_csv_reader_reset(struct csv_reader* reader)
 {
-   if (reader == NULL || reader->file == NULL)
+   if (reader == NULL)
    {
       goto error;
    }
-   rewind(reader->file);
+   reader->offset = 0;
    return 0;
 error:
    return 1;
@@ -121,16 +204,30 @@ error:
 int
 pgmoneta_csv_writer_init(char* path, struct csv_writer** writer)
 {
-   struct csv_writer* w = malloc(sizeof(struct csv_writer));
+   struct csv_writer* w = NULL;
+
+   w = (struct csv_writer*)calloc(1, sizeof(struct csv_writer));
+   if (w == NULL)
+   {
+      goto error;
+   }
+
    w->file = fopen(path, "w+");
    if (w->file == NULL)
    {
       goto error;
    }
+
+   w->buffer = (char*)malloc(CSV_WRITER_BUFFER_SIZE);
+   if (w->buffer != NULL)
+   {
+      setvbuf(w->file, w->buffer, _IOFBF, CSV_WRITER_BUFFER_SIZE);
+   }
+
    *writer = w;
    return 0;
 error:
-   if (w->file != NULL)
+   if (w != NULL && w->file != NULL)
    {
       fclose(w->file);
    }
@@ -141,29 +238,26 @@ error:
 int
 pgmoneta_csv_write(struct csv_writer* writer, int num_col, char** cols)
 {
-   char* row = NULL;
+   size_t length = 0;
+
    if (writer == NULL || writer->file == NULL)
    {
       goto error;
    }
    for (int i = 0; i < num_col; i++)
    {
-      row = pgmoneta_append(row, cols[i]);
-      if (i != num_col - 1)
+      length = strlen(cols[i]);
+      if (fwrite(cols[i], 1, length, writer->file) != length)
       {
-         row = pgmoneta_append(row, ",");
+         goto error;
       }
-      else
+      if (fputc(i != num_col - 1 ? ',' : '\n', writer->file) == EOF)
       {
-         row = pgmoneta_append(row, "\n");
+         goto error;
       }
    }
-   fwrite(row, 1, strlen(row), writer->file);
-   fflush(writer->file);
-   free(row);
    return 0;
 error:
-   free(row);
    return 1;
 }
 
@@ -178,6 +272,65 @@ pgmoneta_csv_writer_destroy(struct csv_writer* writer)
    {
       fclose(writer->file);
    }
+   free(writer->buffer);
    free(writer);
    return 0;
 }
+
+static bool
+csv_ensure_line(struct csv_reader* reader, size_t size)
+{
+   size_t new_size;
+   char* line = NULL;
+
+   if (size <= reader->line_size)
+   {
+      return true;
+   }
+
+   new_size = reader->line_size > 0 ? reader->line_size : 512;
+   while (new_size < size)
+   {
+      new_size *= 2;
+   }
+
+   line = (char*)realloc(reader->line, new_size);
+   if (line == NULL)
+   {
+      return false;
+   }
+
+   reader->line = line;
+   reader->line_size = new_size;
+
+   return true;
+}
+
+static bool
+csv_ensure_cols(struct csv_reader* reader, int size)
+{
+   int new_size;
+   char** cols = NULL;
+
+   if (size <= reader->cols_size)
+   {
+      return true;
+   }
+
+   new_size = reader->cols_size > 0 ? reader->cols_size * 2 : 8;
+   while (new_size < size)
+   {
+      new_size *= 2;
+   }
+
+   cols = (char**)realloc(reader->cols, new_size * sizeof(char*));
+   if (cols == NULL)
+   {
+      return false;
+   }
+
+   reader->cols = cols;
+   reader->cols_size = new_size;
+
+   return true;
+}
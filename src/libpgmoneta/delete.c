@@ -30,6 +30,7 @@
 #include <pgmoneta.h>
 #include <logging.h>
 #include <utils.h>
+#include <walindex.h>
 #include <workflow.h>
 
 /* system */
@@ -98,8 +99,7 @@ pgmoneta_delete_wal(int srv)
    struct backup** backups = NULL;
    char* srv_wal = NULL;
    char* wal_shipping = NULL;
-   int number_of_srv_wal_files = 0;
-   char** srv_wal_files = NULL;
+   struct wal_index* srv_wal_index = NULL;
 
    /* Find the oldest backup */
    d = pgmoneta_get_server_backup(srv);
@@ -125,14 +125,9 @@ pgmoneta_delete_wal(int srv)
    {
       d = pgmoneta_get_server_backup_identifier_data_wal(srv, backups[backup_index]->label);
 
-      number_of_srv_wal_files = 0;
-      srv_wal_files = NULL;
-
-      pgmoneta_get_wal_files(d, &number_of_srv_wal_files, &srv_wal_files);
-
-      if (number_of_srv_wal_files > 0)
+      if (!pgmoneta_wal_index_create(d, false, &srv_wal_index) && srv_wal_index->number_of_segments > 0)
       {
-         srv_wal = srv_wal_files[0];
+         srv_wal = srv_wal_index->segments[0].file;
       }
 
       free(d);
@@ -157,13 +152,18 @@ pgmoneta_delete_wal(int srv)
 
       free(wal_shipping);
       wal_shipping = NULL;
-   }
 
-   for (int i = 0; i < number_of_srv_wal_files; i++)
-   {
-      free(srv_wal_files[i]);
+      /* And the summaries of the deleted WAL */
+      d = pgmoneta_get_server_wal_summary(srv);
+      if (pgmoneta_exists(d))
+      {
+         delete_wal_older_than(srv_wal, d, backup_index);
+      }
+      free(d);
+      d = NULL;
    }
-   free(srv_wal_files);
+
+   pgmoneta_wal_index_destroy(srv_wal_index);
 
    for (int i = 0; i < number_of_backups; i++)
    {
@@ -178,11 +178,7 @@ error:
    free(d);
    free(wal_shipping);
 
-   for (int i = 0; i < number_of_srv_wal_files; i++)
-   {
-      free(srv_wal_files[i]);
-   }
-   free(srv_wal_files);
+   pgmoneta_wal_index_destroy(srv_wal_index);
 
    for (int i = 0; i < number_of_backups; i++)
    {
@@ -196,72 +192,52 @@ error:
 static void
 delete_wal_older_than(char* srv_wal, char* base, int backup_index)
 {
-   int number_of_wal_files = 0;
-   char** wal_files = NULL;
+   struct wal_index* index = NULL;
    char wal_address[MAX_PATH];
-   bool delete;
+   int end;
 
-   if (pgmoneta_get_wal_files(base, &number_of_wal_files, &wal_files))
+   if (pgmoneta_wal_index_create(base, false, &index))
    {
       pgmoneta_log_warn("Unable to get WAL segments under %s", base);
-      goto error;
+      return;
    }
-   for (int i = 0; i < number_of_wal_files; i++)
+
+   /* The segments before the oldest WAL of the backup, or all without a backup */
+   if (backup_index == -1)
    {
-      delete = false;
+      end = index->number_of_segments;
+   }
+   else if (srv_wal != NULL)
+   {
+      end = pgmoneta_wal_index_search(index, srv_wal);
+   }
+   else
+   {
+      end = 0;
+   }
 
-      if (backup_index == -1)
+   for (int i = 0; i < end; i++)
+   {
+      memset(wal_address, 0, MAX_PATH);
+      if (pgmoneta_ends_with(base, "/"))
       {
-         delete = true;
+         snprintf(wal_address, MAX_PATH, "%s%s", base, index->segments[i].file);
       }
-      else if (srv_wal != NULL)
+      else
       {
-         if (strcmp(wal_files[i], srv_wal) < 0)
-         {
-            delete = true;
-         }
+         snprintf(wal_address, MAX_PATH, "%s/%s", base, index->segments[i].file);
       }
 
-      if (delete)
+      pgmoneta_log_trace("WAL: Deleting %s", wal_address);
+      if (pgmoneta_exists(wal_address))
       {
-         memset(wal_address, 0, MAX_PATH);
-         if (pgmoneta_ends_with(base, "/"))
-         {
-            snprintf(wal_address, MAX_PATH, "%s%s", base, wal_files[i]);
-         }
-         else
-         {
-            snprintf(wal_address, MAX_PATH, "%s/%s", base, wal_files[i]);
-         }
-
-         pgmoneta_log_trace("WAL: Deleting %s", wal_address);
-         if (pgmoneta_exists(wal_address))
-         {
-            pgmoneta_delete_file(wal_address, NULL);
-         }
-         else
-         {
-            pgmoneta_log_debug("%s doesn't exists", wal_address);
-         }
+         pgmoneta_delete_file(wal_address, NULL);
       }
       else
       {
-         break;
+         pgmoneta_log_debug("%s doesn't exists", wal_address);
       }
    }
 
-   for (int i = 0; i < number_of_wal_files; i++)
-   {
-      free(wal_files[i]);
-   }
-   free(wal_files);
-
-   return;
-
-error:
-   for (int i = 0; i < number_of_wal_files; i++)
-   {
-      free(wal_files[i]);
-   }
-   free(wal_files);
+   pgmoneta_wal_index_destroy(index);
 }
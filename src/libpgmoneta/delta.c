@@ -0,0 +1,737 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <delta.h>
+#include <info.h>
+#include <json.h>
+#include <logging.h>
+#include <security.h>
+#include <utils.h>
+#include <workers.h>
+
+/* system */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** @struct delta_input
+ * Defines the encoding of an incremental file on a worker
+ */
+struct delta_input
+{
+   struct worker_common common; /**< The common base */
+   int server;                  /**< The server */
+   char* label;                 /**< The label of the backup */
+   char* parent_label;          /**< The label of the parent backup */
+   char* data;                  /**< The data directory of the backup */
+   struct json* entry;          /**< The manifest entry of the file */
+   char* checksum;              /**< The checksum of the encoded file */
+   bool failed;                 /**< Did the encoding fail */
+};
+
+static void encode_file(struct worker_common* wc);
+static int delta_add(struct delta* delta, struct rfile* source, bool owned);
+static bool delta_exists(int server, struct backup* backup, char* relative_path);
+static int delta_xor(struct delta* delta, struct rfile* source, off_t offset, uint8_t* block);
+
+int
+pgmoneta_delta_create(int server, struct delta** delta)
+{
+   struct delta* d = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   *delta = NULL;
+
+   d = (struct delta*)malloc(sizeof(struct delta));
+   if (d == NULL)
+   {
+      goto error;
+   }
+
+   memset(d, 0, sizeof(struct delta));
+   d->block_size = config->common.servers[server].block_size;
+   d->block = (uint8_t*)malloc(d->block_size);
+   if (d->block == NULL)
+   {
+      goto error;
+   }
+
+   *delta = d;
+
+   return 0;
+
+error:
+   pgmoneta_delta_destroy(d);
+
+   return 1;
+}
+
+int
+pgmoneta_delta_add(struct delta* delta, struct rfile* source)
+{
+   return delta_add(delta, source, false);
+}
+
+int
+pgmoneta_delta_extend(struct delta* delta, int server, char* label, char* relative_dir, char* base_file_name)
+{
+   char* server_backup = NULL;
+   char current[MISC_LENGTH];
+   char relative_path[MAX_PATH];
+   char incremental_name[MAX_PATH];
+   char incremental_path[MAX_PATH];
+   char* separator = NULL;
+   struct backup* backup = NULL;
+   struct rfile* rf = NULL;
+
+   separator = (strlen(relative_dir) == 0 || pgmoneta_ends_with(relative_dir, "/")) ? "" : "/";
+
+   memset(current, 0, sizeof(current));
+   memset(relative_path, 0, sizeof(relative_path));
+   memset(incremental_name, 0, sizeof(incremental_name));
+   memset(incremental_path, 0, sizeof(incremental_path));
+   snprintf(current, sizeof(current), "%s", label);
+   snprintf(relative_path, sizeof(relative_path), "%s%s%s", relative_dir, separator, base_file_name);
+   snprintf(incremental_name, sizeof(incremental_name), "%s%s", INCREMENTAL_PREFIX, base_file_name);
+   snprintf(incremental_path, sizeof(incremental_path), "%s%s%s", relative_dir, separator, incremental_name);
+
+   server_backup = pgmoneta_get_server_backup(server);
+
+   while (strlen(current) > 0)
+   {
+      if (pgmoneta_get_backup(server_backup, current, &backup) || backup == NULL)
+      {
+         pgmoneta_log_error("Delta: unable to find backup %s", current);
+         goto error;
+      }
+
+      // the versions end at the first full file, or where the file doesn't exist
+      if (delta_exists(server, backup, relative_path))
+      {
+         if (pgmoneta_rfile_create(server, backup->label, relative_dir, base_file_name, backup->encryption, backup->compression, &rf))
+         {
+            goto error;
+         }
+         if (delta_add(delta, rf, true))
+         {
+            goto error;
+         }
+         rf = NULL;
+         break;
+      }
+
+      if (backup->type == TYPE_FULL || !delta_exists(server, backup, incremental_path))
+      {
+         break;
+      }
+
+      if (pgmoneta_incremental_rfile_initialize(server, backup->label, relative_dir, incremental_name, backup->encryption, backup->compression, &rf))
+      {
+         goto error;
+      }
+      if (delta_add(delta, rf, true))
+      {
+         goto error;
+      }
+      rf = NULL;
+
+      memset(current, 0, sizeof(current));
+      snprintf(current, sizeof(current), "%s", backup->parent_label);
+      free(backup);
+      backup = NULL;
+   }
+
+   free(backup);
+   free(server_backup);
+
+   return 0;
+
+error:
+   pgmoneta_rfile_destroy(rf);
+   free(backup);
+   free(server_backup);
+
+   return 1;
+}
+
+int
+pgmoneta_delta_find(struct delta* delta, struct rfile* source)
+{
+   for (int i = 0; delta != NULL && i < delta->number_of_sources; i++)
+   {
+      if (delta->sources[i] == source)
+      {
+         return i;
+      }
+   }
+
+   return -1;
+}
+
+int
+pgmoneta_delta_apply(struct delta* delta, int start, uint32_t block_number, uint8_t* block)
+{
+   uint32_t position = 0;
+   struct rfile* rf = NULL;
+
+   for (int i = start; i < delta->number_of_sources; i++)
+   {
+      rf = delta->sources[i];
+
+      if (rf->header_length == 0)
+      {
+         // a full file has the blocks up to its size
+         if (block_number < delta->index_length[i])
+         {
+            return delta_xor(delta, rf, (off_t)block_number * delta->block_size, block);
+         }
+         return 0;
+      }
+
+      position = block_number < delta->index_length[i] ? delta->index[i][block_number] : 0;
+      if (position > 0)
+      {
+         if (delta_xor(delta, rf, rf->header_length + (off_t)(position - 1) * delta->block_size, block))
+         {
+            return 1;
+         }
+
+         // a delta encoded block is completed by the block as of the next version
+         if (!rf->delta)
+         {
+            return 0;
+         }
+      }
+      else if (block_number >= rf->truncation_block_length)
+      {
+         // the block was truncated away
+         return 0;
+      }
+   }
+
+   return 0;
+}
+
+void
+pgmoneta_delta_destroy(struct delta* delta)
+{
+   if (delta == NULL)
+   {
+      return;
+   }
+
+   for (int i = 0; i < delta->number_of_sources; i++)
+   {
+      if (delta->owned[i])
+      {
+         pgmoneta_rfile_destroy(delta->sources[i]);
+      }
+      free(delta->index[i]);
+   }
+
+   free(delta->sources);
+   free(delta->owned);
+   free(delta->index);
+   free(delta->index_length);
+   free(delta->block);
+   free(delta);
+}
+
+int
+pgmoneta_delta_encode(int server, char* label, char* parent_label, char* relative_path)
+{
+   char* relative_dir = NULL;
+   char* file_name = NULL;
+   char* path = NULL;
+   char* tmp = NULL;
+   uint8_t* header = NULL;
+   uint8_t* block = NULL;
+   uint32_t magic = INCREMENTAL_DELTA_MAGIC;
+   struct rfile* rf = NULL;
+   struct delta* delta = NULL;
+   FILE* out = NULL;
+
+   file_name = strrchr(relative_path, '/');
+   if (file_name == NULL)
+   {
+      relative_dir = strdup("");
+      file_name = relative_path;
+   }
+   else
+   {
+      relative_dir = strndup(relative_path, file_name - relative_path + 1);
+      file_name++;
+   }
+
+   if (relative_dir == NULL || !pgmoneta_starts_with(file_name, INCREMENTAL_PREFIX))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_incremental_rfile_initialize(server, label, relative_dir, file_name, ENCRYPTION_NONE, COMPRESSION_NONE, &rf))
+   {
+      goto error;
+   }
+
+   if (rf->delta || rf->num_blocks == 0)
+   {
+      goto done;
+   }
+
+   if (pgmoneta_delta_create(server, &delta) ||
+       pgmoneta_delta_extend(delta, server, parent_label, relative_dir, file_name + INCREMENTAL_PREFIX_LENGTH))
+   {
+      goto error;
+   }
+
+   path = pgmoneta_get_server_backup_identifier_data(server, label);
+   if (!pgmoneta_ends_with(path, "/"))
+   {
+      path = pgmoneta_append_char(path, '/');
+   }
+   path = pgmoneta_append(path, relative_path);
+
+   tmp = pgmoneta_append(tmp, path);
+   tmp = pgmoneta_append(tmp, ".delta");
+
+   header = (uint8_t*)malloc(rf->header_length);
+   block = (uint8_t*)malloc(delta->block_size);
+   if (header == NULL || block == NULL)
+   {
+      goto error;
+   }
+
+   // the header is kept as is, only the magic tells the blocks are encoded
+   if (pgmoneta_rfile_read_at(rf, 0, header, rf->header_length) != rf->header_length)
+   {
+      goto error;
+   }
+   memcpy(header, &magic, sizeof(uint32_t));
+
+   out = fopen(tmp, "wb");
+   if (out == NULL)
+   {
+      pgmoneta_log_error("Delta: unable to create %s", tmp);
+      goto error;
+   }
+
+   if (fwrite(header, 1, rf->header_length, out) != rf->header_length)
+   {
+      goto error;
+   }
+
+   for (uint32_t i = 0; i < rf->num_blocks; i++)
+   {
+      if (pgmoneta_rfile_read_at(rf, rf->header_length + (off_t)i * delta->block_size, block, delta->block_size) != delta->block_size)
+      {
+         pgmoneta_log_error("Delta: unable to read block %u of %s", i, path);
+         goto error;
+      }
+
+      if (pgmoneta_delta_apply(delta, 0, rf->relative_block_numbers[i], block))
+      {
+         goto error;
+      }
+
+      if (fwrite(block, 1, delta->block_size, out) != delta->block_size)
+      {
+         goto error;
+      }
+   }
+
+   if (fclose(out))
+   {
+      out = NULL;
+      goto error;
+   }
+   out = NULL;
+
+   if (rename(tmp, path))
+   {
+      pgmoneta_log_error("Delta: unable to replace %s", path);
+      goto error;
+   }
+
+done:
+   pgmoneta_rfile_destroy(rf);
+   pgmoneta_delta_destroy(delta);
+   free(relative_dir);
+   free(path);
+   free(tmp);
+   free(header);
+   free(block);
+
+   return 0;
+
+error:
+   if (out != NULL)
+   {
+      fclose(out);
+   }
+   if (tmp != NULL)
+   {
+      remove(tmp);
+   }
+   pgmoneta_rfile_destroy(rf);
+   pgmoneta_delta_destroy(delta);
+   free(relative_dir);
+   free(path);
+   free(tmp);
+   free(header);
+   free(block);
+
+   return 1;
+}
+
+int
+pgmoneta_delta_backup(int server, char* label, char* parent_label)
+{
+   char* data = NULL;
+   char* manifest_path = NULL;
+   struct json* manifest = NULL;
+   struct json* files = NULL;
+   struct json_iterator* iter = NULL;
+   struct workers* workers = NULL;
+   struct delta_input** inputs = NULL;
+   int number_of_inputs = 0;
+   int number_of_workers = 0;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   data = pgmoneta_get_server_backup_identifier_data(server, label);
+   manifest_path = pgmoneta_append(NULL, data);
+   manifest_path = pgmoneta_append(manifest_path, "backup_manifest");
+
+   if (pgmoneta_json_read_file(manifest_path, &manifest))
+   {
+      pgmoneta_log_error("Delta: Unable to read %s", manifest_path);
+      goto error;
+   }
+
+   files = (struct json*)pgmoneta_json_get(manifest, MANIFEST_FILES);
+   if (files == NULL)
+   {
+      goto error;
+   }
+
+   inputs = (struct delta_input**)calloc(pgmoneta_json_array_length(files) + 1, sizeof(struct delta_input*));
+   if (inputs == NULL)
+   {
+      goto error;
+   }
+
+   number_of_workers = pgmoneta_get_number_of_workers(server);
+   if (number_of_workers > 0)
+   {
+      pgmoneta_workers_initialize(number_of_workers, &workers);
+   }
+
+   if (pgmoneta_json_iterator_create(files, &iter))
+   {
+      goto error;
+   }
+
+   while (pgmoneta_json_iterator_next(iter))
+   {
+      struct json* entry = (struct json*)pgmoneta_value_data(iter->value);
+      struct delta_input* di = NULL;
+      char* path = (char*)pgmoneta_json_get(entry, "Path");
+      char* name = NULL;
+      char file[MAX_PATH];
+
+      if (path == NULL)
+      {
+         continue;
+      }
+
+      name = strrchr(path, '/');
+      name = name != NULL ? name + 1 : path;
+      if (!pgmoneta_starts_with(name, INCREMENTAL_PREFIX))
+      {
+         continue;
+      }
+
+      /* A tablespace stored outside of the data directory is kept as it is */
+      snprintf(file, sizeof(file), "%s%s", data, path);
+      if (!pgmoneta_is_file(file))
+      {
+         continue;
+      }
+
+      di = (struct delta_input*)calloc(1, sizeof(struct delta_input));
+      if (di == NULL)
+      {
+         goto error;
+      }
+      inputs[number_of_inputs++] = di;
+
+      di->server = server;
+      di->label = label;
+      di->parent_label = parent_label;
+      di->data = data;
+      di->entry = entry;
+      di->common.workers = workers;
+      di->common.size = (size_t)pgmoneta_json_get(entry, "Size");
+
+      if (workers != NULL)
+      {
+         if (pgmoneta_workers_add(workers, encode_file, (struct worker_common*)di))
+         {
+            goto error;
+         }
+      }
+      else
+      {
+         encode_file((struct worker_common*)di);
+      }
+   }
+
+   if (workers != NULL)
+   {
+      pgmoneta_workers_wait(workers);
+   }
+
+   for (int i = 0; i < number_of_inputs; i++)
+   {
+      if (inputs[i]->failed)
+      {
+         goto error;
+      }
+
+      pgmoneta_json_put(inputs[i]->entry, "Checksum", (uintptr_t)inputs[i]->checksum, ValueString);
+   }
+
+   if (pgmoneta_json_write_file(manifest_path, manifest))
+   {
+      pgmoneta_log_error("Delta: Unable to write %s", manifest_path);
+      goto error;
+   }
+
+   pgmoneta_log_debug("Delta: %s/%s has %d delta encoded files against %s",
+                      config->common.servers[server].name, label, number_of_inputs, parent_label);
+
+   pgmoneta_json_iterator_destroy(iter);
+   pgmoneta_workers_destroy(workers);
+   for (int i = 0; i < number_of_inputs; i++)
+   {
+      free(inputs[i]->checksum);
+      free(inputs[i]);
+   }
+   free(inputs);
+   pgmoneta_json_destroy(manifest);
+   free(manifest_path);
+   free(data);
+
+   return 0;
+
+error:
+
+   if (workers != NULL)
+   {
+      pgmoneta_workers_wait(workers);
+      pgmoneta_workers_destroy(workers);
+   }
+
+   pgmoneta_json_iterator_destroy(iter);
+   for (int i = 0; inputs != NULL && i < number_of_inputs; i++)
+   {
+      free(inputs[i]->checksum);
+      free(inputs[i]);
+   }
+   free(inputs);
+   pgmoneta_json_destroy(manifest);
+   free(manifest_path);
+   free(data);
+
+   return 1;
+}
+
+static void
+encode_file(struct worker_common* wc)
+{
+   struct delta_input* di = (struct delta_input*)wc;
+   char* relative_path = NULL;
+   char* path = NULL;
+
+   relative_path = (char*)pgmoneta_json_get(di->entry, "Path");
+
+   if (pgmoneta_delta_encode(di->server, di->label, di->parent_label, relative_path))
+   {
+      pgmoneta_log_error("Delta: Unable to encode %s", relative_path);
+      goto error;
+   }
+
+   path = pgmoneta_append(NULL, di->data);
+   path = pgmoneta_append(path, relative_path);
+
+   if (pgmoneta_create_file_hash(pgmoneta_get_hash_algorithm((char*)pgmoneta_json_get(di->entry, "Checksum-Algorithm")), path, &di->checksum))
+   {
+      pgmoneta_log_error("Delta: Unable to hash %s", path);
+      goto error;
+   }
+
+   free(path);
+
+   return;
+
+error:
+
+   free(path);
+
+   di->failed = true;
+   if (di->common.workers != NULL)
+   {
+      di->common.workers->outcome = false;
+   }
+}
+
+static int
+delta_add(struct delta* delta, struct rfile* source, bool owned)
+{
+   int n = delta->number_of_sources;
+   uint32_t length = 0;
+   uint32_t* idx = NULL;
+   void* p = NULL;
+
+   if (source->header_length == 0)
+   {
+      length = (uint32_t)(pgmoneta_rfile_size(source) / delta->block_size);
+   }
+   else
+   {
+      for (uint32_t i = 0; i < source->num_blocks; i++)
+      {
+         if (source->relative_block_numbers[i] >= length)
+         {
+            length = source->relative_block_numbers[i] + 1;
+         }
+      }
+
+      idx = (uint32_t*)calloc(length > 0 ? length : 1, sizeof(uint32_t));
+      if (idx == NULL)
+      {
+         goto error;
+      }
+
+      for (uint32_t i = 0; i < source->num_blocks; i++)
+      {
+         idx[source->relative_block_numbers[i]] = i + 1;
+      }
+   }
+
+   if ((p = realloc(delta->sources, (n + 1) * sizeof(struct rfile*))) == NULL)
+   {
+      goto error;
+   }
+   delta->sources = (struct rfile**)p;
+
+   if ((p = realloc(delta->owned, (n + 1) * sizeof(bool))) == NULL)
+   {
+      goto error;
+   }
+   delta->owned = (bool*)p;
+
+   if ((p = realloc(delta->index, (n + 1) * sizeof(uint32_t*))) == NULL)
+   {
+      goto error;
+   }
+   delta->index = (uint32_t**)p;
+
+   if ((p = realloc(delta->index_length, (n + 1) * sizeof(uint32_t))) == NULL)
+   {
+      goto error;
+   }
+   delta->index_length = (uint32_t*)p;
+
+   delta->sources[n] = source;
+   delta->owned[n] = owned;
+   delta->index[n] = idx;
+   delta->index_length[n] = length;
+   delta->number_of_sources++;
+
+   return 0;
+
+error:
+   free(idx);
+
+   return 1;
+}
+
+static bool
+delta_exists(int server, struct backup* backup, char* relative_path)
+{
+   bool exists = false;
+   char* path = NULL;
+   char* final_path = NULL;
+
+   path = pgmoneta_get_server_backup_identifier_data(server, backup->label);
+   if (!pgmoneta_ends_with(path, "/"))
+   {
+      path = pgmoneta_append_char(path, '/');
+   }
+   path = pgmoneta_append(path, relative_path);
+
+   exists = pgmoneta_exists(path);
+   if (!exists && !pgmoneta_backup_file_final_name(path, backup->encryption, backup->compression, &final_path))
+   {
+      exists = pgmoneta_exists(final_path);
+   }
+
+   free(path);
+   free(final_path);
+
+   return exists;
+}
+
+static int
+delta_xor(struct delta* delta, struct rfile* source, off_t offset, uint8_t* block)
+{
+   uint64_t a;
+   uint64_t b;
+
+   if (pgmoneta_rfile_read_at(source, offset, delta->block, delta->block_size) != delta->block_size)
+   {
+      pgmoneta_log_error("Delta: unable to read the block at offset %llu of %s", (unsigned long long)offset, source->filepath);
+      return 1;
+   }
+
+   for (uint32_t i = 0; i + sizeof(uint64_t) <= delta->block_size; i += sizeof(uint64_t))
+   {
+      memcpy(&a, block + i, sizeof(uint64_t));
+      memcpy(&b, delta->block + i, sizeof(uint64_t));
+      a ^= b;
+      memcpy(block + i, &a, sizeof(uint64_t));
+   }
+
+   return 0;
+}
@@ -34,18 +34,25 @@
 #include <stdlib.h>
 #include <string.h>
 
+/* The maximum number of released nodes a deque keeps for reuse */
+#define DEQUE_POOL_SIZE 256
+
 // tag is copied if not NULL
 static void
 deque_offer(struct deque* deque, char* tag, uintptr_t data, enum value_type type, struct value_config* config);
 
-// tag is copied if not NULL
+// tag is copied if not NULL, the node is taken from the pool of the deque when possible
 static void
-deque_node_create(uintptr_t data, enum value_type type, char* tag, struct value_config* config, struct deque_node** node);
+deque_node_create(struct deque* deque, uintptr_t data, enum value_type type, char* tag, struct value_config* config, struct deque_node** node);
 
 // tag will always be freed
 static void
 deque_node_destroy(struct deque_node* node);
 
+// return a node whose value and tag are already released to the pool of the deque
+static void
+deque_node_recycle(struct deque* deque, struct deque_node* node);
+
 static void
 deque_read_lock(struct deque* deque);
 
@@ -55,6 +62,10 @@ deque_write_lock(struct deque* deque);
 static void
 deque_unlock(struct deque* deque);
 
+// move the nodes added concurrently into a thread safe deque
+static void
+deque_drain(struct deque* deque);
+
 static struct deque_node*
 deque_next(struct deque* deque, struct deque_node* node);
 
@@ -82,6 +93,10 @@ deque_sort(struct deque_node* node);
 static struct deque_node*
 deque_merge(struct deque_node* node1, struct deque_node* node2);
 
+// stable bottom-up merge sort of an array of nodes by tag, tmp must hold size nodes
+static void
+deque_sort_array(struct deque_node** nodes, struct deque_node** tmp, uint32_t size);
+
 static int
 tag_compare(char* tag1, char* tag2);
 
@@ -92,12 +107,15 @@ pgmoneta_deque_create(bool thread_safe, struct deque** deque)
    q = malloc(sizeof(struct deque));
    q->size = 0;
    q->thread_safe = thread_safe;
+   q->pool = NULL;
+   q->pool_size = 0;
+   atomic_init(&q->inbox, NULL);
    if (thread_safe)
    {
       pthread_rwlock_init(&q->mutex, NULL);
    }
-   deque_node_create(0, ValueInt32, NULL, NULL, &q->start);
-   deque_node_create(0, ValueInt32, NULL, NULL, &q->end);
+   deque_node_create(q, 0, ValueInt32, NULL, NULL, &q->start);
+   deque_node_create(q, 0, ValueInt32, NULL, NULL, &q->end);
    q->start->next = q->end;
    q->end->prev = q->start;
    *deque = q;
@@ -184,10 +202,13 @@ pgmoneta_deque_poll(struct deque* deque, char** tag)
    {
       *tag = head->tag;
    }
-   free(head);
+   else
+   {
+      free(head->tag);
+   }
 
    data = pgmoneta_value_data(val);
-   free(val);
+   deque_node_recycle(deque, head);
 
    deque_unlock(deque);
    return data;
@@ -220,10 +241,13 @@ pgmoneta_deque_poll_last(struct deque* deque, char** tag)
    {
       *tag = tail->tag;
    }
-   free(tail);
+   else
+   {
+      free(tail->tag);
+   }
 
    data = pgmoneta_value_data(val);
-   free(val);
+   deque_node_recycle(deque, tail);
 
    deque_unlock(deque);
    return data;
@@ -291,6 +315,7 @@ pgmoneta_deque_get(struct deque* deque, char* tag)
    pgmoneta_log_trace("pgmoneta_deque_get: %s", tag);
 #endif
 
+   deque_drain(deque);
    deque_read_lock(deque);
    n = deque_find(deque, tag);
    if (n == NULL)
@@ -311,6 +336,7 @@ pgmoneta_deque_exists(struct deque* deque, char* tag)
    bool ret = false;
    struct deque_node* n = NULL;
 
+   deque_drain(deque);
    deque_read_lock(deque);
 
    n = deque_find(deque, tag);
@@ -345,12 +371,37 @@ pgmoneta_deque_list(struct deque* deque)
 void
 pgmoneta_deque_sort(struct deque* deque)
 {
+   deque_drain(deque);
    deque_write_lock(deque);
    if (deque == NULL || deque->start == NULL || deque->end == NULL || deque->size <= 1)
    {
       deque_unlock(deque);
       return;
    }
+   // sort an array of the nodes, which is far more cache friendly than chasing the list
+   struct deque_node** nodes = malloc(2 * deque->size * sizeof(struct deque_node*));
+   if (nodes != NULL)
+   {
+      struct deque_node* cur = deque->start->next;
+      struct deque_node* prev = deque->start;
+      for (uint32_t i = 0; i < deque->size; i++)
+      {
+         nodes[i] = cur;
+         cur = cur->next;
+      }
+      deque_sort_array(nodes, nodes + deque->size, deque->size);
+      for (uint32_t i = 0; i < deque->size; i++)
+      {
+         prev->next = nodes[i];
+         nodes[i]->prev = prev;
+         prev = nodes[i];
+      }
+      prev->next = deque->end;
+      deque->end->prev = prev;
+      free(nodes);
+      deque_unlock(deque);
+      return;
+   }
    // break the connection to start and end node since we are going to move nodes around
    struct deque_node* first = deque->start->next;
    struct deque_node* last = deque->end->prev;
@@ -380,6 +431,7 @@ pgmoneta_deque_destroy(struct deque* deque)
    {
       return;
    }
+   deque_drain(deque);
    n = deque->start;
    while (n != NULL)
    {
@@ -387,6 +439,13 @@ pgmoneta_deque_destroy(struct deque* deque)
       deque_node_destroy(n);
       n = next;
    }
+   n = deque->pool;
+   while (n != NULL)
+   {
+      next = n->next;
+      free(n);
+      n = next;
+   }
    if (deque->thread_safe)
    {
       pthread_rwlock_destroy(&deque->mutex);
@@ -431,6 +490,7 @@ pgmoneta_deque_size(struct deque* deque)
    {
       return 0;
    }
+   deque_drain(deque);
    deque_read_lock(deque);
    size = deque->size;
    deque_unlock(deque);
@@ -445,6 +505,7 @@ pgmoneta_deque_iterator_create(struct deque* deque, struct deque_iterator** iter
    {
       return 1;
    }
+   deque_drain(deque);
    i = malloc(sizeof(struct deque_iterator));
    i->deque = deque;
    i->cur = deque->start;
@@ -538,8 +599,19 @@ deque_offer(struct deque* deque, char* tag, uintptr_t data, enum value_type type
    }
 #endif
 
-   deque_node_create(data, type, tag, config, &n);
+   if (deque->thread_safe)
+   {
+      // producers only contend on the inbox, the node is linked in by the next reader
+      deque_node_create(NULL, data, type, tag, config, &n);
+      n->next = atomic_load_explicit(&deque->inbox, memory_order_relaxed);
+      while (!atomic_compare_exchange_weak_explicit(&deque->inbox, &n->next, n, memory_order_release, memory_order_relaxed))
+      {
+      }
+      return;
+   }
+
    deque_write_lock(deque);
+   deque_node_create(deque, data, type, tag, config, &n);
    deque->size++;
    last = deque->end->prev;
    last->next = n;
@@ -550,18 +622,28 @@ deque_offer(struct deque* deque, char* tag, uintptr_t data, enum value_type type
 }
 
 static void
-deque_node_create(uintptr_t data, enum value_type type, char* tag, struct value_config* config, struct deque_node** node)
+deque_node_create(struct deque* deque, uintptr_t data, enum value_type type, char* tag, struct value_config* config, struct deque_node** node)
 {
    struct deque_node* n = NULL;
-   n = malloc(sizeof(struct deque_node));
+   if (deque != NULL && deque->pool != NULL)
+   {
+      n = deque->pool;
+      deque->pool = n->next;
+      deque->pool_size--;
+   }
+   else
+   {
+      n = malloc(sizeof(struct deque_node));
+   }
    memset(n, 0, sizeof(struct deque_node));
+   n->data = &n->value;
    if (config != NULL)
    {
-      pgmoneta_value_create_with_config(data, config, &n->data);
+      pgmoneta_value_init_with_config(data, config, n->data);
    }
    else
    {
-      pgmoneta_value_create(type, data, &n->data);
+      pgmoneta_value_init(type, data, n->data);
    }
    if (tag != NULL)
    {
@@ -581,11 +663,25 @@ deque_node_destroy(struct deque_node* node)
    {
       return;
    }
-   pgmoneta_value_destroy(node->data);
+   node->data->destroy_data(node->data->data);
    free(node->tag);
    free(node);
 }
 
+static void
+deque_node_recycle(struct deque* deque, struct deque_node* node)
+{
+   // thread safe deques create their nodes outside of the lock, so they have no use of a pool
+   if (deque->thread_safe || deque->pool_size >= DEQUE_POOL_SIZE)
+   {
+      free(node);
+      return;
+   }
+   node->next = deque->pool;
+   deque->pool = node;
+   deque->pool_size++;
+}
+
 static void
 deque_read_lock(struct deque* deque)
 {
@@ -616,6 +712,43 @@ deque_unlock(struct deque* deque)
    pthread_rwlock_unlock(&deque->mutex);
 }
 
+static void
+deque_drain(struct deque* deque)
+{
+   struct deque_node* n = NULL;
+   struct deque_node* next = NULL;
+   struct deque_node* first = NULL;
+   struct deque_node* last = NULL;
+
+   if (deque == NULL || !deque->thread_safe || atomic_load_explicit(&deque->inbox, memory_order_relaxed) == NULL)
+   {
+      return;
+   }
+
+   pthread_rwlock_wrlock(&deque->mutex);
+   n = atomic_exchange_explicit(&deque->inbox, NULL, memory_order_acquire);
+   // the inbox is newest first, reverse it to keep the order the nodes were added in
+   while (n != NULL)
+   {
+      next = n->next;
+      n->next = first;
+      first = n;
+      n = next;
+   }
+   while (first != NULL)
+   {
+      next = first->next;
+      last = deque->end->prev;
+      last->next = first;
+      first->prev = last;
+      first->next = deque->end;
+      deque->end->prev = first;
+      deque->size++;
+      first = next;
+   }
+   pthread_rwlock_unlock(&deque->mutex);
+}
+
 static struct deque_node*
 deque_next(struct deque* deque, struct deque_node* node)
 {
@@ -657,16 +790,16 @@ deque_find(struct deque* deque, char* tag)
 static char*
 to_json_string(struct deque* deque, char* tag, int indent)
 {
-   char* ret = NULL;
-   ret = pgmoneta_indent(ret, tag, indent);
+   struct builder ret = {0};
+   pgmoneta_builder_indent(&ret, tag, indent);
    struct deque_node* cur = NULL;
    if (deque == NULL || pgmoneta_deque_empty(deque))
    {
-      ret = pgmoneta_append(ret, "[]");
-      return ret;
+      pgmoneta_builder_append(&ret, "[]");
+      return pgmoneta_builder_release(&ret);
    }
    deque_read_lock(deque);
-   ret = pgmoneta_append(ret, "[\n");
+   pgmoneta_builder_append(&ret, "[\n");
    cur = deque_next(deque, deque->start);
    while (cur != NULL)
    {
@@ -680,30 +813,30 @@ to_json_string(struct deque* deque, char* tag, int indent)
       }
       str = pgmoneta_value_to_string(cur->data, FORMAT_JSON, t, indent + INDENT_PER_LEVEL);
       free(t);
-      ret = pgmoneta_append(ret, str);
-      ret = pgmoneta_append(ret, has_next ? ",\n" : "\n");
+      pgmoneta_builder_append(&ret, str);
+      pgmoneta_builder_append(&ret, has_next ? ",\n" : "\n");
       free(str);
       cur = deque_next(deque, cur);
    }
-   ret = pgmoneta_indent(ret, NULL, indent);
-   ret = pgmoneta_append(ret, "]");
+   pgmoneta_builder_indent(&ret, NULL, indent);
+   pgmoneta_builder_append(&ret, "]");
    deque_unlock(deque);
-   return ret;
+   return pgmoneta_builder_release(&ret);
 }
 
 static char*
 to_compact_json_string(struct deque* deque, char* tag, int indent)
 {
-   char* ret = NULL;
-   ret = pgmoneta_indent(ret, tag, indent);
+   struct builder ret = {0};
+   pgmoneta_builder_indent(&ret, tag, indent);
    struct deque_node* cur = NULL;
    if (deque == NULL || pgmoneta_deque_empty(deque))
    {
-      ret = pgmoneta_append(ret, "[]");
-      return ret;
+      pgmoneta_builder_append(&ret, "[]");
+      return pgmoneta_builder_release(&ret);
    }
    deque_read_lock(deque);
-   ret = pgmoneta_append(ret, "[");
+   pgmoneta_builder_append(&ret, "[");
    cur = deque_next(deque, deque->start);
    while (cur != NULL)
    {
@@ -717,33 +850,33 @@ to_compact_json_string(struct deque* deque, char* tag, int indent)
       }
       str = pgmoneta_value_to_string(cur->data, FORMAT_JSON_COMPACT, t, indent);
       free(t);
-      ret = pgmoneta_append(ret, str);
-      ret = pgmoneta_append(ret, has_next ? "," : "");
+      pgmoneta_builder_append(&ret, str);
+      pgmoneta_builder_append(&ret, has_next ? "," : "");
       free(str);
       cur = deque_next(deque, cur);
    }
-   ret = pgmoneta_append(ret, "]");
+   pgmoneta_builder_append(&ret, "]");
    deque_unlock(deque);
-   return ret;
+   return pgmoneta_builder_release(&ret);
 }
 
 static char*
 to_text_string(struct deque* deque, char* tag, int indent)
 {
-   char* ret = NULL;
+   struct builder ret = {0};
    int cnt = 0;
    int next_indent = pgmoneta_compare_string(tag, BULLET_POINT) ? 0 : indent;
    // we have a tag and it's not the bullet point, so that means another line
    if (tag != NULL && !pgmoneta_compare_string(tag, BULLET_POINT))
    {
-      ret = pgmoneta_indent(ret, tag, indent);
+      pgmoneta_builder_indent(&ret, tag, indent);
       next_indent += INDENT_PER_LEVEL;
    }
    struct deque_node* cur = NULL;
    if (deque == NULL || pgmoneta_deque_empty(deque))
    {
-      ret = pgmoneta_append(ret, "[]");
-      return ret;
+      pgmoneta_builder_append(&ret, "[]");
+      return pgmoneta_builder_release(&ret);
    }
    deque_read_lock(deque);
    cur = deque_next(deque, deque->start);
@@ -762,15 +895,15 @@ to_text_string(struct deque* deque, char* tag, int indent)
       }
       if (cur->data->type == ValueJSON)
       {
-         ret = pgmoneta_indent(ret, BULLET_POINT, next_indent);
+         pgmoneta_builder_indent(&ret, BULLET_POINT, next_indent);
       }
-      ret = pgmoneta_append(ret, str);
-      ret = pgmoneta_append(ret, has_next ? "\n" : "");
+      pgmoneta_builder_append(&ret, str);
+      pgmoneta_builder_append(&ret, has_next ? "\n" : "");
       free(str);
       cur = deque_next(deque, cur);
    }
    deque_unlock(deque);
-   return ret;
+   return pgmoneta_builder_release(&ret);
 }
 
 static struct deque_node*
@@ -784,7 +917,9 @@ deque_remove(struct deque* deque, struct deque_node* node)
    struct deque_node* next = node->next;
    prev->next = next;
    next->prev = prev;
-   deque_node_destroy(node);
+   node->data->destroy_data(node->data->data);
+   free(node->tag);
+   deque_node_recycle(deque, node);
    deque->size--;
    return prev;
 }
@@ -897,6 +1032,54 @@ deque_merge(struct deque_node* node1, struct deque_node* node2)
    }
    return start;
 }
+static void
+deque_sort_array(struct deque_node** nodes, struct deque_node** tmp, uint32_t size)
+{
+   struct deque_node** src = nodes;
+   struct deque_node** dst = tmp;
+   struct deque_node** swap = NULL;
+
+   for (uint32_t width = 1; width < size; width *= 2)
+   {
+      for (uint32_t lo = 0; lo < size; lo += 2 * width)
+      {
+         uint32_t mid = MIN(lo + width, size);
+         uint32_t hi = MIN(lo + 2 * width, size);
+         uint32_t l = lo;
+         uint32_t r = mid;
+         uint32_t k = lo;
+
+         while (l < mid && r < hi)
+         {
+            if (tag_compare(src[l]->tag, src[r]->tag) <= 0)
+            {
+               dst[k++] = src[l++];
+            }
+            else
+            {
+               dst[k++] = src[r++];
+            }
+         }
+         while (l < mid)
+         {
+            dst[k++] = src[l++];
+         }
+         while (r < hi)
+         {
+            dst[k++] = src[r++];
+         }
+      }
+      swap = src;
+      src = dst;
+      dst = swap;
+   }
+
+   if (src != nodes)
+   {
+      memcpy(nodes, src, size * sizeof(struct deque_node*));
+   }
+}
+
 static int
 tag_compare(char* tag1, char* tag2)
 {
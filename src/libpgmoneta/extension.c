@@ -30,6 +30,7 @@
 #include <pgmoneta.h>
 #include <extension.h>
 #include <logging.h>
+#include <utils.h>
 
 /* system */
 #include <stdlib.h>
@@ -82,6 +83,14 @@ pgmoneta_ext_get_files(SSL* ssl, int socket, char* file_path, struct query_respo
    return query_execute(ssl, socket, query, qr);
 }
 
+int
+pgmoneta_ext_stat_file(SSL* ssl, int socket, char* file_path, struct query_response** qr)
+{
+   char query[MAX_QUERY_LENGTH];
+   snprintf(query, MAX_QUERY_LENGTH, "SELECT size, modification FROM pg_stat_file('%s', true);", file_path);
+   return query_execute(ssl, socket, query, qr);
+}
+
 int
 pgmoneta_ext_send_file_chunk(SSL* ssl, int socket, char* dest_path, char* base64_data, struct query_response** qr)
 {
@@ -90,6 +99,41 @@ pgmoneta_ext_send_file_chunk(SSL* ssl, int socket, char* dest_path, char* base64
    return query_execute(ssl, socket, query, qr);
 }
 
+int
+pgmoneta_ext_get_changed_blocks(SSL* ssl, int socket, char* lsn, struct query_response** qr)
+{
+   char query[MAX_QUERY_LENGTH];
+   snprintf(query, MAX_QUERY_LENGTH, "SELECT path, blocks, encode(bitmap, 'hex') FROM pgmoneta_ext_get_changed_blocks('%s');", lsn);
+   return query_execute(ssl, socket, query, qr);
+}
+
+int
+pgmoneta_ext_send_file_chunks(SSL* ssl, int socket, char* dest_path, char** base64_data, int count, struct query_response** qr)
+{
+   int ret;
+   char* query = NULL;
+
+   for (int i = 0; i < count; i++)
+   {
+      query = pgmoneta_append(query, "SELECT pgmoneta_ext_receive_file_chunk('");
+      query = pgmoneta_append(query, base64_data[i]);
+      query = pgmoneta_append(query, "', '");
+      query = pgmoneta_append(query, dest_path);
+      query = pgmoneta_append(query, "');");
+   }
+
+   if (query == NULL)
+   {
+      return 1;
+   }
+
+   ret = query_execute(ssl, socket, query, qr);
+
+   free(query);
+
+   return ret;
+}
+
 int
 pgmoneta_ext_promote(SSL* ssl, int socket, struct query_response** qr)
 {
@@ -31,10 +31,13 @@
 #include <gzip_compression.h>
 #include <logging.h>
 #include <management.h>
+#include <prometheus.h>
+#include <trace.h>
 #include <utils.h>
 
 /* system */
 #include <dirent.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -43,42 +46,102 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#ifdef HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
 #define NAME "gzip"
 #define BUFFER_LENGTH 8192
 
+#define GZIP_PASS_ALL   0
+#define GZIP_PASS_SMALL 1
+#define GZIP_PASS_LARGE 2
+
+#define GZIP_BLOCK_SIZE         (4 * 1024 * 1024)
+#define GZIP_PARALLEL_THRESHOLD (16 * 1024 * 1024)
+
+/** @struct gz_reader
+ * Defines the state of a GZIP decompression layer
+ */
+struct gz_reader
+{
+   z_stream stream;                   /**< The inflate stream */
+   unsigned char in[BUFFER_LENGTH];   /**< The input buffer */
+   bool eof;                          /**< Has the source ended */
+   bool end;                          /**< Has a member ended */
+};
+
+/** @struct gz_block
+ * Defines a block of a file compressed as an independent GZIP member
+ */
+struct gz_block
+{
+   struct worker_common common; /**< The common base */
+   int level;                   /**< The compression level */
+   unsigned char* in;           /**< The uncompressed data */
+   size_t in_size;              /**< The size of the uncompressed data */
+   unsigned char* out;          /**< The GZIP member */
+   size_t out_size;             /**< The size of the GZIP member */
+};
+
+static int gz_reader_read(struct reader* reader, void* buffer, size_t size, size_t* read);
+static void gz_reader_close(struct reader* reader);
+static int gz_data(char* directory, int pass, struct workers* workers);
 static int gz_compress(char* from, int level, char* to);
+static int gz_compress_parallel(char* from, int level, char* to, struct workers* workers);
+static int gz_block_compress(int level, unsigned char* in, size_t in_size, unsigned char** out, size_t* out_size);
 static int gz_decompress(char* from, char* to);
+static int gz_level(void);
 
 static void do_gz_compress(struct worker_common* wc);
+static void do_gz_block(struct worker_common* wc);
 static void do_gz_decompress(struct worker_common* wc);
+#ifdef HAVE_LIBDEFLATE
+static struct libdeflate_compressor* gz_compressor_get(int level);
+static void gz_compressor_destroy(void* context);
+#else
+static z_stream* gz_stream_get(int level);
+static void gz_stream_destroy(void* context);
+#endif
 
 int
 pgmoneta_gzip_data(char* directory, struct workers* workers)
+{
+   int ret;
+
+   if (workers != NULL)
+   {
+      /* Spread the small files over the workers, and let the large files use */
+      /* all the workers for their blocks once the workers are idle */
+      ret = gz_data(directory, GZIP_PASS_SMALL, workers);
+      pgmoneta_workers_wait(workers);
+      ret |= gz_data(directory, GZIP_PASS_LARGE, workers);
+   }
+   else
+   {
+      ret = gz_data(directory, GZIP_PASS_ALL, NULL);
+   }
+
+   return ret;
+}
+
+static int
+gz_data(char* directory, int pass, struct workers* workers)
 {
    char* from = NULL;
    char* to = NULL;
    DIR* dir;
    struct dirent* entry;
    int level;
+   bool large;
    struct worker_input* wi = NULL;
-   struct main_configuration* config;
-
-   config = (struct main_configuration*)shmem;
 
    if (!(dir = opendir(directory)))
    {
       goto error;
    }
 
-   level = config->compression_level;
-   if (level < 1)
-   {
-      level = 1;
-   }
-   else if (level > 9)
-   {
-      level = 9;
-   }
+   level = gz_level();
 
    while ((entry = readdir(dir)) != NULL)
    {
@@ -93,7 +156,7 @@ pgmoneta_gzip_data(char* directory, struct workers* workers)
 
          snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
 
-         pgmoneta_gzip_data(path, workers);
+         gz_data(path, pass, workers);
       }
       else if (entry->d_type == DT_REG)
       {
@@ -114,23 +177,44 @@ pgmoneta_gzip_data(char* directory, struct workers* workers)
             to = pgmoneta_append(to, entry->d_name);
             to = pgmoneta_append(to, ".gz");
 
-            if (!pgmoneta_create_worker_input(directory, from, to, level, workers, &wi))
+            large = pgmoneta_get_file_size(from) >= GZIP_PARALLEL_THRESHOLD;
+
+            if (pass == GZIP_PASS_SMALL && !large)
             {
-               if (workers != NULL)
+               if (workers->outcome)
                {
-                  if (workers->outcome)
+                  if (pgmoneta_create_worker_input(directory, from, to, level, workers, &wi))
                   {
-                     pgmoneta_workers_add(workers, do_gz_compress, (struct worker_common*)wi);
+                     goto error;
                   }
+
+                  pgmoneta_workers_add(workers, do_gz_compress, (struct worker_common*)wi);
                }
-               else
+            }
+            else if (pass == GZIP_PASS_LARGE && large)
+            {
+               if (workers->outcome)
                {
-                  do_gz_compress((struct worker_common*)wi);
+                  if (gz_compress_parallel(from, level, to, workers))
+                  {
+                     pgmoneta_log_error("Gzip: Could not compress %s", from);
+                     workers->outcome = false;
+                  }
+                  else
+                  {
+                     pgmoneta_delete_file(from, NULL);
+                     pgmoneta_drop_cache(to);
+                  }
                }
             }
-            else
+            else if (pass == GZIP_PASS_ALL)
             {
-               goto error;
+               if (pgmoneta_create_worker_input(directory, from, to, level, NULL, &wi))
+               {
+                  goto error;
+               }
+
+               do_gz_compress((struct worker_common*)wi);
             }
 
             free(from);
@@ -176,6 +260,7 @@ do_gz_compress(struct worker_common* wc)
       else
       {
          pgmoneta_delete_file(wi->from, NULL);
+         pgmoneta_drop_cache(wi->to);
       }
    }
 
@@ -221,24 +306,13 @@ pgmoneta_gzip_wal(char* directory)
    DIR* dir;
    struct dirent* entry;
    int level;
-   struct main_configuration* config;
-
-   config = (struct main_configuration*)shmem;
 
    if (!(dir = opendir(directory)))
    {
       return;
    }
 
-   level = config->compression_level;
-   if (level < 1)
-   {
-      level = 1;
-   }
-   else if (level > 9)
-   {
-      level = 9;
-   }
+   level = gz_level();
 
    while ((entry = readdir(dir)) != NULL)
    {
@@ -398,19 +472,8 @@ int
 pgmoneta_gzip_file(char* from, char* to)
 {
    int level;
-   struct main_configuration* config;
 
-   config = (struct main_configuration*)shmem;
-
-   level = config->compression_level;
-   if (level < 1)
-   {
-      level = 1;
-   }
-   else if (level > 9)
-   {
-      level = 9;
-   }
+   level = gz_level();
 
    if (gz_compress(from, level, to))
    {
@@ -562,6 +625,47 @@ error:
    return 1;
 }
 
+int
+pgmoneta_gunzip_reader(struct reader* source, struct reader** reader)
+{
+   struct gz_reader* gr = NULL;
+
+   *reader = NULL;
+
+   gr = (struct gz_reader*)malloc(sizeof(struct gz_reader));
+   if (gr == NULL)
+   {
+      goto error;
+   }
+
+   memset(gr, 0, sizeof(struct gz_reader));
+
+   /* Accept the GZIP header */
+   if (inflateInit2(&gr->stream, 15 + 16) != Z_OK)
+   {
+      free(gr);
+      gr = NULL;
+      goto error;
+   }
+
+   if (pgmoneta_reader_create(source, gz_reader_read, gz_reader_close, gr, reader))
+   {
+      goto error;
+   }
+
+   return 0;
+
+error:
+
+   if (gr != NULL)
+   {
+      inflateEnd(&gr->stream);
+      free(gr);
+   }
+
+   return 1;
+}
+
 int
 pgmoneta_gunzip_data(char* directory, struct workers* workers)
 {
@@ -852,11 +956,25 @@ do_gz_decompress(struct worker_common* wc)
 static int
 gz_compress(char* from, int level, char* to)
 {
-   char buf[BUFFER_LENGTH];
+#ifdef HAVE_LIBDEFLATE
+   unsigned char* in_buf = NULL;
+   unsigned char* out_buf = NULL;
+   size_t out_size;
+#else
+   unsigned char in_buf[BUFFER_LENGTH];
+   unsigned char out_buf[BUFFER_LENGTH];
+   z_stream* stream = NULL;
+   size_t have;
+   int flush;
+#endif
    FILE* in = NULL;
-   char mode[4];
-   gzFile out = NULL;
+   FILE* out = NULL;
    size_t length;
+   uint64_t start;
+
+   PGMONETA_TRACE2(compress_start, from, COMPRESSION_CLIENT_GZIP);
+
+   start = pgmoneta_prometheus_now();
 
    in = fopen(from, "rb");
    if (in == NULL)
@@ -864,49 +982,110 @@ gz_compress(char* from, int level, char* to)
       goto error;
    }
 
-   memset(&mode[0], 0, sizeof(mode));
-   mode[0] = 'w';
-   mode[1] = 'b';
-   mode[2] = '0' + level;
-
-   out = gzopen(to, mode);
+   out = fopen(to, "wb");
    if (out == NULL)
    {
       goto error;
    }
 
+#ifdef HAVE_LIBDEFLATE
+   /* libdeflate has no streaming interface, so each block is a GZIP member */
+   in_buf = (unsigned char*)malloc(GZIP_BLOCK_SIZE);
+   if (in_buf == NULL)
+   {
+      goto error;
+   }
+
    do
    {
-      length = fread(buf, 1, sizeof(buf), in);
+      length = fread(in_buf, 1, GZIP_BLOCK_SIZE, in);
 
       if (ferror(in))
       {
          goto error;
       }
 
-      if (length > 0)
+      if (gz_block_compress(level, in_buf, length, &out_buf, &out_size))
       {
-         if (gzwrite(out, buf, (unsigned)length) != (int)length)
+         goto error;
+      }
+
+      if (fwrite(out_buf, 1, out_size, out) != out_size)
+      {
+         goto error;
+      }
+
+      free(out_buf);
+      out_buf = NULL;
+   }
+   while (!feof(in));
+
+   free(in_buf);
+   in_buf = NULL;
+#else
+   stream = gz_stream_get(level);
+   if (stream == NULL)
+   {
+      goto error;
+   }
+
+   do
+   {
+      length = fread(in_buf, 1, sizeof(in_buf), in);
+
+      if (ferror(in))
+      {
+         goto error;
+      }
+
+      flush = feof(in) ? Z_FINISH : Z_NO_FLUSH;
+
+      stream->next_in = in_buf;
+      stream->avail_in = (uInt)length;
+
+      do
+      {
+         stream->next_out = out_buf;
+         stream->avail_out = sizeof(out_buf);
+
+         if (deflate(stream, flush) == Z_STREAM_ERROR)
+         {
+            goto error;
+         }
+
+         have = sizeof(out_buf) - stream->avail_out;
+         if (have > 0 && fwrite(out_buf, 1, have, out) != have)
          {
             goto error;
          }
       }
+      while (stream->avail_out == 0);
    }
-   while (length > 0);
+   while (flush != Z_FINISH);
+#endif
 
    fclose(in);
    in = NULL;
 
-   if (gzclose(out) != Z_OK)
+   if (fclose(out) != 0)
    {
       out = NULL;
       goto error;
    }
 
+   pgmoneta_prometheus_file(FILE_OPERATION_COMPRESS, start);
+
+   PGMONETA_TRACE3(compress_done, from, COMPRESSION_CLIENT_GZIP, 0);
+
    return 0;
 
 error:
 
+#ifdef HAVE_LIBDEFLATE
+   free(in_buf);
+   free(out_buf);
+#endif
+
    if (in != NULL)
    {
       fclose(in);
@@ -914,12 +1093,365 @@ error:
 
    if (out != NULL)
    {
-      gzclose(out);
+      fclose(out);
    }
 
+   PGMONETA_TRACE3(compress_done, from, COMPRESSION_CLIENT_GZIP, 1);
+
    return 1;
 }
 
+static int
+gz_compress_parallel(char* from, int level, char* to, struct workers* workers)
+{
+   struct gz_block** blocks = NULL;
+   int batch;
+   int number_of_blocks = 0;
+   int fd = -1;
+   FILE* out = NULL;
+   size_t file_size;
+   size_t offset = 0;
+   uint64_t start;
+
+   if (workers == NULL || workers->number_of_alive < 2)
+   {
+      return gz_compress(from, level, to);
+   }
+
+   PGMONETA_TRACE2(compress_start, from, COMPRESSION_CLIENT_GZIP);
+
+   start = pgmoneta_prometheus_now();
+
+   file_size = pgmoneta_get_file_size(from);
+
+   /* A few blocks per worker in memory at a time, written in order */
+   batch = workers->number_of_alive * 2;
+
+   blocks = (struct gz_block**)calloc(batch, sizeof(struct gz_block*));
+   if (blocks == NULL)
+   {
+      goto error;
+   }
+
+   fd = open(from, O_RDONLY);
+   if (fd == -1)
+   {
+      goto error;
+   }
+
+   out = fopen(to, "wb");
+   if (out == NULL)
+   {
+      goto error;
+   }
+
+   while (offset < file_size)
+   {
+      number_of_blocks = 0;
+
+      while (number_of_blocks < batch && offset < file_size)
+      {
+         struct gz_block* block = NULL;
+         size_t length;
+         ssize_t r;
+
+         length = MIN((size_t)GZIP_BLOCK_SIZE, file_size - offset);
+
+         block = (struct gz_block*)malloc(sizeof(struct gz_block));
+         if (block == NULL)
+         {
+            goto error;
+         }
+
+         memset(block, 0, sizeof(struct gz_block));
+         blocks[number_of_blocks++] = block;
+
+         block->common.workers = workers;
+         block->common.size = length;
+         block->level = level;
+         block->in = (unsigned char*)malloc(length);
+         if (block->in == NULL)
+         {
+            goto error;
+         }
+
+         while (block->in_size < length)
+         {
+            r = pread(fd, block->in + block->in_size, length - block->in_size, (off_t)(offset + block->in_size));
+            if (r <= 0)
+            {
+               goto error;
+            }
+            block->in_size += (size_t)r;
+         }
+
+         offset += length;
+      }
+
+      for (int i = 0; i < number_of_blocks; i++)
+      {
+         if (pgmoneta_workers_add(workers, do_gz_block, (struct worker_common*)blocks[i]))
+         {
+            pgmoneta_workers_wait(workers);
+            goto error;
+         }
+      }
+
+      pgmoneta_workers_wait(workers);
+
+      if (!workers->outcome)
+      {
+         goto error;
+      }
+
+      for (int i = 0; i < number_of_blocks; i++)
+      {
+         if (fwrite(blocks[i]->out, 1, blocks[i]->out_size, out) != blocks[i]->out_size)
+         {
+            goto error;
+         }
+
+         free(blocks[i]->in);
+         free(blocks[i]->out);
+         free(blocks[i]);
+         blocks[i] = NULL;
+      }
+   }
+
+   close(fd);
+   fd = -1;
+
+   if (fclose(out) != 0)
+   {
+      out = NULL;
+      goto error;
+   }
+
+   free(blocks);
+
+   pgmoneta_prometheus_file(FILE_OPERATION_COMPRESS, start);
+
+   PGMONETA_TRACE3(compress_done, from, COMPRESSION_CLIENT_GZIP, 0);
+
+   return 0;
+
+error:
+
+   if (blocks != NULL)
+   {
+      for (int i = 0; i < number_of_blocks; i++)
+      {
+         if (blocks[i] != NULL)
+         {
+            free(blocks[i]->in);
+            free(blocks[i]->out);
+            free(blocks[i]);
+         }
+      }
+      free(blocks);
+   }
+
+   if (fd != -1)
+   {
+      close(fd);
+   }
+
+   if (out != NULL)
+   {
+      fclose(out);
+   }
+
+   PGMONETA_TRACE3(compress_done, from, COMPRESSION_CLIENT_GZIP, 1);
+
+   return 1;
+}
+
+static void
+do_gz_block(struct worker_common* wc)
+{
+   struct gz_block* block = (struct gz_block*)wc;
+
+   if (gz_block_compress(block->level, block->in, block->in_size, &block->out, &block->out_size))
+   {
+      block->common.workers->outcome = false;
+   }
+}
+
+static int
+gz_block_compress(int level, unsigned char* in, size_t in_size, unsigned char** out, size_t* out_size)
+{
+   unsigned char* o = NULL;
+   size_t bound;
+#ifdef HAVE_LIBDEFLATE
+   struct libdeflate_compressor* compressor = NULL;
+
+   *out = NULL;
+   *out_size = 0;
+
+   compressor = gz_compressor_get(level);
+   if (compressor == NULL)
+   {
+      goto error;
+   }
+
+   bound = libdeflate_gzip_compress_bound(compressor, in_size);
+
+   o = (unsigned char*)malloc(bound);
+   if (o == NULL)
+   {
+      goto error;
+   }
+
+   *out_size = libdeflate_gzip_compress(compressor, in, in_size, o, bound);
+   if (*out_size == 0)
+   {
+      goto error;
+   }
+#else
+   z_stream* stream = NULL;
+
+   *out = NULL;
+   *out_size = 0;
+
+   stream = gz_stream_get(level);
+   if (stream == NULL)
+   {
+      goto error;
+   }
+
+   bound = deflateBound(stream, (uLong)in_size);
+
+   o = (unsigned char*)malloc(bound);
+   if (o == NULL)
+   {
+      goto error;
+   }
+
+   stream->next_in = in;
+   stream->avail_in = (uInt)in_size;
+   stream->next_out = o;
+   stream->avail_out = (uInt)bound;
+
+   if (deflate(stream, Z_FINISH) != Z_STREAM_END)
+   {
+      goto error;
+   }
+
+   *out_size = bound - stream->avail_out;
+#endif
+
+   *out = o;
+
+   return 0;
+
+error:
+
+   free(o);
+
+   return 1;
+}
+
+static int
+gz_level(void)
+{
+   int level;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   level = config->compression_level;
+   if (level < 1)
+   {
+      level = 1;
+   }
+   else if (level > 9)
+   {
+      level = 9;
+   }
+
+   return level;
+}
+
+#ifdef HAVE_LIBDEFLATE
+static struct libdeflate_compressor*
+gz_compressor_get(int level)
+{
+   struct libdeflate_compressor* compressor = NULL;
+
+   compressor = (struct libdeflate_compressor*)pgmoneta_workers_context_get(WORKER_CONTEXT_GZIP, level);
+   if (compressor != NULL)
+   {
+      return compressor;
+   }
+
+   compressor = libdeflate_alloc_compressor(level);
+   if (compressor == NULL)
+   {
+      return NULL;
+   }
+
+   pgmoneta_workers_context_put(WORKER_CONTEXT_GZIP, level, compressor, gz_compressor_destroy);
+
+   return compressor;
+}
+
+static void
+gz_compressor_destroy(void* context)
+{
+   libdeflate_free_compressor((struct libdeflate_compressor*)context);
+}
+#else
+static z_stream*
+gz_stream_get(int level)
+{
+   z_stream* stream = NULL;
+
+   stream = (z_stream*)pgmoneta_workers_context_get(WORKER_CONTEXT_GZIP, level);
+   if (stream != NULL)
+   {
+      if (deflateReset(stream) == Z_OK)
+      {
+         return stream;
+      }
+
+      pgmoneta_workers_context_put(WORKER_CONTEXT_GZIP, level, NULL, NULL);
+      stream = NULL;
+   }
+
+   stream = (z_stream*)malloc(sizeof(z_stream));
+   if (stream == NULL)
+   {
+      goto error;
+   }
+
+   memset(stream, 0, sizeof(z_stream));
+
+   if (deflateInit2(stream, level, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+   {
+      goto error;
+   }
+
+   pgmoneta_workers_context_put(WORKER_CONTEXT_GZIP, level, stream, gz_stream_destroy);
+
+   return stream;
+
+error:
+
+   free(stream);
+
+   return NULL;
+}
+
+static void
+gz_stream_destroy(void* context)
+{
+   z_stream* stream = (z_stream*)context;
+
+   deflateEnd(stream);
+   free(stream);
+}
+#endif
+
 static int
 gz_decompress(char* from, char* to)
 {
@@ -928,6 +1460,9 @@ gz_decompress(char* from, char* to)
    char mode[3];
    gzFile in = NULL;
    size_t length;
+   uint64_t start;
+
+   start = pgmoneta_prometheus_now();
 
    memset(&mode[0], 0, sizeof(mode));
    mode[0] = 'r';
@@ -967,6 +1502,8 @@ gz_decompress(char* from, char* to)
 
    fclose(out);
 
+   pgmoneta_prometheus_file(FILE_OPERATION_DECOMPRESS, start);
+
    return 0;
 
 error:
@@ -983,3 +1520,86 @@ error:
 
    return 1;
 }
+
+static int
+gz_reader_read(struct reader* reader, void* buffer, size_t size, size_t* read)
+{
+   struct gz_reader* gr = (struct gz_reader*)reader->state;
+   size_t n = 0;
+   int ret;
+
+   *read = 0;
+
+   gr->stream.next_out = (Bytef*)buffer;
+   gr->stream.avail_out = (uInt)size;
+
+   while (gr->stream.avail_out == size)
+   {
+      if (gr->stream.avail_in == 0 && !gr->eof)
+      {
+         if (pgmoneta_reader_read(reader->source, &gr->in[0], sizeof(gr->in), &n))
+         {
+            goto error;
+         }
+
+         gr->eof = n == 0;
+         gr->stream.next_in = &gr->in[0];
+         gr->stream.avail_in = (uInt)n;
+      }
+
+      if (gr->stream.avail_in == 0 && gr->eof)
+      {
+         if (!gr->end)
+         {
+            pgmoneta_log_error("GZIP: Incomplete stream");
+            goto error;
+         }
+         break;
+      }
+
+      /* Concatenated members are read like gzread does */
+      if (gr->end)
+      {
+         if (inflateReset(&gr->stream) != Z_OK)
+         {
+            goto error;
+         }
+         gr->end = false;
+      }
+
+      ret = inflate(&gr->stream, Z_NO_FLUSH);
+      if (ret == Z_STREAM_END)
+      {
+         gr->end = true;
+      }
+      else if (ret != Z_OK && ret != Z_BUF_ERROR)
+      {
+         pgmoneta_log_error("GZIP: Decompression error: %d", ret);
+         goto error;
+      }
+   }
+
+   *read = size - gr->stream.avail_out;
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+static void
+gz_reader_close(struct reader* reader)
+{
+   struct gz_reader* gr = (struct gz_reader*)reader->state;
+
+   if (gr == NULL)
+   {
+      return;
+   }
+
+   inflateEnd(&gr->stream);
+   free(gr);
+
+   reader->state = NULL;
+}
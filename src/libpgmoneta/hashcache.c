@@ -0,0 +1,448 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <art.h>
+#include <hashcache.h>
+#include <logging.h>
+#include <utils.h>
+
+/* system */
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#define HASHCACHE_FILE "hash.cache"
+
+/* The cache is compacted when it has this many times the entries of the last compaction */
+#define HASHCACHE_GROWTH      2
+#define HASHCACHE_MIN_ENTRIES 1024
+
+/*
+ * The cache is a file of lines with the device, inode, size, modification
+ * time in nanoseconds, algorithm, hash and path of a file. The lines are
+ * appended with a single write, so processes share the file, and the
+ * newest line of a key wins. The first line holds the number of entries
+ * after the last compaction. The hash is of the content of the file after
+ * decompression and decryption, like the checksums of the manifest.
+ */
+static pthread_mutex_t hashcache_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool hashcache_loaded = false;
+static struct art* hashcache = NULL;
+static int hashcache_fd = -1;
+
+static char* hashcache_path(void);
+static void hashcache_key(struct stat* st, int algorithm, char* key, size_t size);
+static int hashcache_load(void);
+static int hashcache_compact(char* path);
+static bool hashcache_parse(char* line, struct stat* st, int* algorithm, char** hash, char** path);
+
+int
+pgmoneta_hashcache_lookup(char* path, int algorithm, char** hash)
+{
+   char key[128];
+   char* cached = NULL;
+   struct stat st;
+
+   *hash = NULL;
+
+   if (stat(path, &st))
+   {
+      return 1;
+   }
+
+   hashcache_key(&st, algorithm, key, sizeof(key));
+
+   pthread_mutex_lock(&hashcache_lock);
+
+   if (hashcache_load())
+   {
+      pthread_mutex_unlock(&hashcache_lock);
+      return 1;
+   }
+
+   cached = (char*)pgmoneta_art_search(hashcache, key);
+   if (cached != NULL)
+   {
+      *hash = pgmoneta_append(NULL, cached);
+   }
+
+   pthread_mutex_unlock(&hashcache_lock);
+
+   return 0;
+}
+
+int
+pgmoneta_hashcache_store(char* path, struct stat* st, int algorithm, char* hash)
+{
+   char key[128];
+   char* line = NULL;
+   struct stat now;
+   ssize_t w;
+
+   if (hash == NULL || stat(path, &now))
+   {
+      return 1;
+   }
+
+   /* A file that changed while it was hashed is not cached */
+   if (now.st_dev != st->st_dev || now.st_ino != st->st_ino || now.st_size != st->st_size ||
+       now.st_mtim.tv_sec != st->st_mtim.tv_sec || now.st_mtim.tv_nsec != st->st_mtim.tv_nsec)
+   {
+      return 0;
+   }
+
+   hashcache_key(&now, algorithm, key, sizeof(key));
+
+   line = pgmoneta_append(line, key);
+   line = pgmoneta_append(line, " ");
+   line = pgmoneta_append(line, hash);
+   line = pgmoneta_append(line, " ");
+   line = pgmoneta_append(line, path);
+   line = pgmoneta_append(line, "\n");
+
+   pthread_mutex_lock(&hashcache_lock);
+
+   if (hashcache_load())
+   {
+      goto error;
+   }
+
+   if (pgmoneta_art_insert(hashcache, key, (uintptr_t)hash, ValueString))
+   {
+      goto error;
+   }
+
+   if (hashcache_fd != -1)
+   {
+      w = write(hashcache_fd, line, strlen(line));
+      if (w != (ssize_t)strlen(line))
+      {
+         pgmoneta_log_debug("Hash cache: Could not write %s: %s", path, w < 0 ? strerror(errno) : "short write");
+      }
+   }
+
+   pthread_mutex_unlock(&hashcache_lock);
+
+   free(line);
+
+   return 0;
+
+error:
+   pthread_mutex_unlock(&hashcache_lock);
+
+   free(line);
+
+   return 1;
+}
+
+static char*
+hashcache_path(void)
+{
+   char* path = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   path = pgmoneta_append(path, config->base_dir);
+   if (!pgmoneta_ends_with(path, "/"))
+   {
+      path = pgmoneta_append(path, "/");
+   }
+   path = pgmoneta_append(path, HASHCACHE_FILE);
+
+   return path;
+}
+
+static void
+hashcache_key(struct stat* st, int algorithm, char* key, size_t size)
+{
+   snprintf(key, size, "%ju %ju %jd %jd %d",
+            (uintmax_t)st->st_dev, (uintmax_t)st->st_ino, (intmax_t)st->st_size,
+            (intmax_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec, algorithm);
+}
+
+static bool
+hashcache_parse(char* line, struct stat* st, int* algorithm, char** hash, char** path)
+{
+   uintmax_t dev = 0;
+   uintmax_t ino = 0;
+   intmax_t size = 0;
+   intmax_t mtime = 0;
+   int n = 0;
+   char* p = NULL;
+
+   if (sscanf(line, "%ju %ju %jd %jd %d %n", &dev, &ino, &size, &mtime, algorithm, &n) != 5 || n == 0)
+   {
+      return false;
+   }
+
+   memset(st, 0, sizeof(struct stat));
+   st->st_dev = (dev_t)dev;
+   st->st_ino = (ino_t)ino;
+   st->st_size = (off_t)size;
+   st->st_mtim.tv_sec = (time_t)(mtime / 1000000000);
+   st->st_mtim.tv_nsec = (long)(mtime % 1000000000);
+
+   *hash = line + n;
+   p = strchr(*hash, ' ');
+   if (p == NULL)
+   {
+      return false;
+   }
+   *p = '\0';
+   *path = p + 1;
+
+   p = strchr(*path, '\n');
+   if (p != NULL)
+   {
+      *p = '\0';
+   }
+
+   return strlen(*hash) > 0 && strlen(*path) > 0;
+}
+
+static int
+hashcache_load(void)
+{
+   char* path = NULL;
+   FILE* file = NULL;
+   char* line = NULL;
+   size_t length = 0;
+   uint64_t lines = 0;
+   uint64_t compacted = 0;
+
+   if (hashcache_loaded)
+   {
+      return hashcache == NULL ? 1 : 0;
+   }
+
+   hashcache_loaded = true;
+
+   path = hashcache_path();
+
+   if (pgmoneta_art_create(&hashcache))
+   {
+      goto error;
+   }
+
+   file = fopen(path, "r");
+   if (file != NULL)
+   {
+      while (getline(&line, &length, file) != -1)
+      {
+         struct stat st;
+         int algorithm = 0;
+         char* hash = NULL;
+         char* file_path = NULL;
+         char key[128];
+
+         if (line[0] == '#')
+         {
+            compacted = strtoull(line + 1, NULL, 10);
+            continue;
+         }
+
+         lines++;
+
+         if (!hashcache_parse(line, &st, &algorithm, &hash, &file_path))
+         {
+            continue;
+         }
+
+         hashcache_key(&st, algorithm, key, sizeof(key));
+         pgmoneta_art_insert(hashcache, key, (uintptr_t)hash, ValueString);
+      }
+
+      fclose(file);
+      file = NULL;
+   }
+
+   /* Lines are only appended, so the duplicates and the deleted files are removed now and then */
+   if (lines > HASHCACHE_GROWTH * MAX(compacted, (uint64_t)HASHCACHE_MIN_ENTRIES))
+   {
+      if (hashcache_compact(path))
+      {
+         pgmoneta_log_debug("Hash cache: Could not compact %s", path);
+      }
+   }
+
+   hashcache_fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0600);
+   if (hashcache_fd == -1)
+   {
+      pgmoneta_log_debug("Hash cache: Could not open %s: %s", path, strerror(errno));
+   }
+
+   free(line);
+   free(path);
+
+   return 0;
+
+error:
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+
+   pgmoneta_art_destroy(hashcache);
+   hashcache = NULL;
+
+   free(line);
+   free(path);
+
+   return 1;
+}
+
+static int
+hashcache_compact(char* path)
+{
+   char* tmp = NULL;
+   char* line = NULL;
+   size_t length = 0;
+   uint64_t kept = 0;
+   int lock = -1;
+   FILE* in = NULL;
+   FILE* out = NULL;
+   struct art* written = NULL;
+
+   /* One process compacts at a time, the others keep appending to the old file */
+   lock = open(path, O_RDONLY);
+   if (lock == -1 || flock(lock, LOCK_EX | LOCK_NB))
+   {
+      goto error;
+   }
+
+   tmp = pgmoneta_append(tmp, path);
+   tmp = pgmoneta_append(tmp, ".tmp");
+
+   in = fopen(path, "r");
+   out = fopen(tmp, "w");
+   if (in == NULL || out == NULL || pgmoneta_art_create(&written))
+   {
+      goto error;
+   }
+
+   /* Reserve the first line for the number of entries */
+   fprintf(out, "# %020" PRIu64 "\n", (uint64_t)0);
+
+   while (getline(&line, &length, in) != -1)
+   {
+      struct stat st;
+      struct stat now;
+      int algorithm = 0;
+      char* hash = NULL;
+      char* file_path = NULL;
+      char key[128];
+      char* cached = NULL;
+
+      if (line[0] == '#' || !hashcache_parse(line, &st, &algorithm, &hash, &file_path))
+      {
+         continue;
+      }
+
+      hashcache_key(&st, algorithm, key, sizeof(key));
+
+      /* Only the newest line of a key, for a file that is still there */
+      cached = (char*)pgmoneta_art_search(hashcache, key);
+      if (cached == NULL || strcmp(cached, hash) || pgmoneta_art_contains_key(written, key))
+      {
+         continue;
+      }
+
+      if (stat(file_path, &now) || now.st_dev != st.st_dev || now.st_ino != st.st_ino ||
+          now.st_size != st.st_size || now.st_mtim.tv_sec != st.st_mtim.tv_sec ||
+          now.st_mtim.tv_nsec != st.st_mtim.tv_nsec)
+      {
+         continue;
+      }
+
+      fprintf(out, "%s %s %s\n", key, hash, file_path);
+      pgmoneta_art_insert(written, key, (uintptr_t)1, ValueUInt64);
+      kept++;
+   }
+
+   if (fseek(out, 0, SEEK_SET) == 0)
+   {
+      fprintf(out, "# %020" PRIu64 "\n", kept);
+   }
+
+   if (fflush(out) || fsync(fileno(out)))
+   {
+      goto error;
+   }
+
+   fclose(out);
+   out = NULL;
+
+   if (rename(tmp, path))
+   {
+      goto error;
+   }
+
+   pgmoneta_log_debug("Hash cache: Compacted %s to %" PRIu64 " entries", path, kept);
+
+   fclose(in);
+   close(lock);
+   pgmoneta_art_destroy(written);
+   free(line);
+   free(tmp);
+
+   return 0;
+
+error:
+   if (out != NULL)
+   {
+      fclose(out);
+   }
+   if (tmp != NULL)
+   {
+      unlink(tmp);
+   }
+   if (in != NULL)
+   {
+      fclose(in);
+   }
+   if (lock != -1)
+   {
+      close(lock);
+   }
+   pgmoneta_art_destroy(written);
+   free(line);
+   free(tmp);
+
+   return 1;
+}
@@ -28,9 +28,67 @@
 
 /* pgmoneta */
 #include <pgmoneta.h>
+#include <bandwidth.h>
 #include <http.h>
+#include <logging.h>
 #include <utils.h>
 
+/* system */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#define UPLOAD_PENDING 0
+#define UPLOAD_RUNNING 1
+#define UPLOAD_DONE    2
+#define UPLOAD_FAILED  3
+
+/** @struct http_scheduler
+ * Defines an upload scheduler
+ */
+struct http_scheduler
+{
+   CURLM* multi;                   /**< The multi handle, which owns the connection cache */
+   int number_of_slots;            /**< The number of concurrent uploads */
+   CURL** handles;                 /**< The easy handle of each slot */
+   struct http_upload** slots;     /**< The upload of each slot, or NULL */
+   struct http_upload** uploads;   /**< The uploads */
+   int number_of_uploads;          /**< The number of uploads */
+   int capacity;                   /**< The capacity of the uploads array */
+   int next;                       /**< The next upload never attempted */
+   int retries;                    /**< The number of uploads waiting for a retry */
+   struct token_bucket* bucket;    /**< The rate limit, or NULL */
+   uint64_t bytes;                 /**< The number of bytes uploaded */
+   http_done_func done;            /**< The function called for each completed upload, or NULL */
+   void* done_data;                /**< The data of the done function */
+};
+
+static int upload_start(struct http_scheduler* scheduler, int slot, struct http_upload* upload);
+static void upload_stop(struct http_upload* upload);
+static struct http_upload* upload_next(struct http_scheduler* scheduler, uint64_t now);
+static bool upload_retryable(CURLcode result, long code);
+static size_t upload_read_cb(char* buffer, size_t size, size_t nitems, void* userdata);
+static int upload_seek_cb(void* userdata, curl_off_t offset, int origin);
+static size_t upload_header_cb(char* buffer, size_t size, size_t nitems, void* userdata);
+static size_t upload_write_cb(char* ptr, size_t size, size_t nmemb, void* userdata);
+static size_t download_write_cb(char* ptr, size_t size, size_t nmemb, void* userdata);
+static void latency_add(uint64_t latency);
+static uint64_t now_milliseconds(void);
+static uint64_t now_microseconds(void);
+
+/* The rate limit of the scheduler running in this thread, used by the read callback */
+static _Thread_local struct token_bucket* upload_bucket = NULL;
+
+/* The request latencies of this process, in microseconds, when they are recorded */
+static bool latency_enabled = false;
+static uint64_t* latency_samples = NULL;
+static int latency_count = 0;
+static int latency_capacity = 0;
+
 struct curl_slist*
 pgmoneta_http_add_header(struct curl_slist* chunk, char* header, char* value)
 {
@@ -72,7 +130,7 @@ error:
 }
 
 int
-pgmoneta_http_set_request_option(CURL* handle, bool request_type)
+pgmoneta_http_set_request_option(CURL* handle, int request_type)
 {
    CURLcode res = -1;
 
@@ -89,6 +147,14 @@ pgmoneta_http_set_request_option(CURL* handle, bool request_type)
    {
       res = curl_easy_setopt(handle, CURLOPT_UPLOAD, 1L);
    }
+   else if (request_type == HTTP_POST)
+   {
+      res = curl_easy_setopt(handle, CURLOPT_POST, 1L);
+   }
+   else if (request_type == HTTP_DELETE)
+   {
+      res = curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, "DELETE");
+   }
 
    if (res != CURLE_OK)
    {
@@ -125,3 +191,862 @@ error:
 
    return 1;
 }
+
+int
+pgmoneta_http_scheduler_create(int connections, long max_rate, struct http_scheduler** scheduler)
+{
+   struct http_scheduler* s = NULL;
+
+   *scheduler = NULL;
+
+   if (connections < 1)
+   {
+      connections = 1;
+   }
+
+   s = (struct http_scheduler*)calloc(1, sizeof(struct http_scheduler));
+   if (s == NULL)
+   {
+      goto error;
+   }
+
+   s->number_of_slots = connections;
+   s->handles = (CURL**)calloc(connections, sizeof(CURL*));
+   s->slots = (struct http_upload**)calloc(connections, sizeof(struct http_upload*));
+   s->multi = curl_multi_init();
+   if (s->handles == NULL || s->slots == NULL || s->multi == NULL)
+   {
+      goto error;
+   }
+
+   /* Keep one connection per slot to the endpoint, and no more */
+   curl_multi_setopt(s->multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)connections);
+   curl_multi_setopt(s->multi, CURLMOPT_MAXCONNECTS, (long)connections);
+
+   for (int i = 0; i < connections; i++)
+   {
+      s->handles[i] = curl_easy_init();
+      if (s->handles[i] == NULL)
+      {
+         goto error;
+      }
+   }
+
+   if (max_rate > 0)
+   {
+      s->bucket = (struct token_bucket*)malloc(sizeof(struct token_bucket));
+      if (s->bucket == NULL || pgmoneta_token_bucket_init(s->bucket, max_rate))
+      {
+         pgmoneta_log_error("HTTP: Could not initialize the token bucket");
+         goto error;
+      }
+   }
+
+   *scheduler = s;
+
+   return 0;
+
+error:
+
+   pgmoneta_http_scheduler_destroy(s);
+
+   return 1;
+}
+
+int
+pgmoneta_http_scheduler_add(struct http_scheduler* scheduler, char* local_path, off_t offset, off_t size,
+                            char* url, char* resource, char* query, http_sign_func sign, void* data,
+                            struct http_upload** upload)
+{
+   struct http_upload* u = NULL;
+
+   if (upload != NULL)
+   {
+      *upload = NULL;
+   }
+
+   if (scheduler->number_of_uploads == scheduler->capacity)
+   {
+      int capacity = scheduler->capacity == 0 ? 64 : scheduler->capacity * 2;
+      struct http_upload** uploads = NULL;
+
+      uploads = (struct http_upload**)realloc(scheduler->uploads, capacity * sizeof(struct http_upload*));
+      if (uploads == NULL)
+      {
+         goto error;
+      }
+
+      scheduler->uploads = uploads;
+      scheduler->capacity = capacity;
+   }
+
+   u = (struct http_upload*)calloc(1, sizeof(struct http_upload));
+   if (u == NULL)
+   {
+      goto error;
+   }
+
+   u->fd = -1;
+   u->offset = offset;
+   u->size = size;
+   u->sign = sign;
+   u->data = data;
+   u->state = UPLOAD_PENDING;
+
+   if (local_path != NULL)
+   {
+      u->local_path = pgmoneta_append(u->local_path, local_path);
+   }
+   u->url = pgmoneta_append(u->url, url);
+   u->resource = pgmoneta_append(u->resource, resource);
+   if (query != NULL)
+   {
+      u->query = pgmoneta_append(u->query, query);
+   }
+
+   scheduler->uploads[scheduler->number_of_uploads++] = u;
+
+   if (upload != NULL)
+   {
+      *upload = u;
+   }
+
+   return 0;
+
+error:
+
+   free(u);
+
+   return 1;
+}
+
+int
+pgmoneta_http_scheduler_copy(struct http_scheduler* scheduler, char* url, char* resource, char* source,
+                             http_sign_func sign, void* data, struct http_upload** upload)
+{
+   struct http_upload* u = NULL;
+
+   if (upload != NULL)
+   {
+      *upload = NULL;
+   }
+
+   if (pgmoneta_http_scheduler_add(scheduler, NULL, 0, 0, url, resource, NULL, sign, data, &u))
+   {
+      goto error;
+   }
+
+   u->source = pgmoneta_append(u->source, source);
+   u->optional = true;
+
+   if (upload != NULL)
+   {
+      *upload = u;
+   }
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+int
+pgmoneta_http_scheduler_get(struct http_scheduler* scheduler, char* local_path, off_t offset, off_t size,
+                            char* url, char* resource, http_sign_func sign, void* data,
+                            struct http_upload** upload)
+{
+   struct http_upload* u = NULL;
+
+   if (upload != NULL)
+   {
+      *upload = NULL;
+   }
+
+   if (pgmoneta_http_scheduler_add(scheduler, local_path, offset, size, url, resource, NULL, sign, data, &u))
+   {
+      goto error;
+   }
+
+   u->download = true;
+
+   if (upload != NULL)
+   {
+      *upload = u;
+   }
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+int
+pgmoneta_http_range(struct http_upload* upload, char** range)
+{
+   char r[MISC_LENGTH];
+
+   *range = NULL;
+
+   if (upload->size == 0)
+   {
+      return 1;
+   }
+
+   memset(&r[0], 0, sizeof(r));
+   snprintf(&r[0], sizeof(r), "bytes=%lld-%lld", (long long)upload->offset,
+            (long long)(upload->offset + upload->size - 1));
+
+   *range = pgmoneta_append(*range, &r[0]);
+
+   return *range == NULL;
+}
+
+int
+pgmoneta_http_xml_value(char* xml, char* tag, char** value)
+{
+   char* start = NULL;
+   char* end = NULL;
+   char open_tag[MISC_LENGTH];
+   char close_tag[MISC_LENGTH];
+
+   *value = NULL;
+
+   if (xml == NULL)
+   {
+      goto error;
+   }
+
+   snprintf(open_tag, sizeof(open_tag), "<%s>", tag);
+   snprintf(close_tag, sizeof(close_tag), "</%s>", tag);
+
+   start = strstr(xml, open_tag);
+   if (start == NULL)
+   {
+      goto error;
+   }
+   start += strlen(open_tag);
+
+   end = strstr(start, close_tag);
+   if (end == NULL || end == start)
+   {
+      goto error;
+   }
+
+   *value = strndup(start, end - start);
+   if (*value == NULL)
+   {
+      goto error;
+   }
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+bool
+pgmoneta_http_upload_failed(struct http_upload* upload)
+{
+   return upload != NULL && upload->state == UPLOAD_FAILED;
+}
+
+int
+pgmoneta_http_scheduler_run(struct http_scheduler* scheduler)
+{
+   int completed = 0;
+   int active = 0;
+   int left = 0;
+   CURLMsg* msg = NULL;
+
+   upload_bucket = scheduler->bucket;
+
+   pgmoneta_bandwidth_start(BANDWIDTH_UPLOAD);
+
+   /* The uploads of an earlier run are already done */
+   for (int i = 0; i < scheduler->number_of_uploads; i++)
+   {
+      if (scheduler->uploads[i]->state == UPLOAD_DONE || scheduler->uploads[i]->state == UPLOAD_FAILED)
+      {
+         completed++;
+      }
+   }
+
+   while (completed < scheduler->number_of_uploads)
+   {
+      int running = 0;
+      uint64_t now = now_milliseconds();
+      int timeout = 1000;
+
+      for (int i = 0; i < scheduler->number_of_slots; i++)
+      {
+         struct http_upload* upload = NULL;
+
+         if (scheduler->slots[i] != NULL)
+         {
+            continue;
+         }
+
+         upload = upload_next(scheduler, now);
+         if (upload == NULL)
+         {
+            break;
+         }
+
+         if (upload_start(scheduler, i, upload))
+         {
+            pgmoneta_log_error("HTTP: Could not start the upload of %s", upload->resource);
+            goto error;
+         }
+
+         active++;
+      }
+
+      if (curl_multi_perform(scheduler->multi, &running) != CURLM_OK)
+      {
+         goto error;
+      }
+
+      while ((msg = curl_multi_info_read(scheduler->multi, &left)) != NULL)
+      {
+         struct http_upload* upload = NULL;
+         CURLcode result;
+         int slot = -1;
+
+         if (msg->msg != CURLMSG_DONE)
+         {
+            continue;
+         }
+
+         result = msg->data.result;
+
+         for (int i = 0; slot == -1 && i < scheduler->number_of_slots; i++)
+         {
+            if (scheduler->handles[i] == msg->easy_handle)
+            {
+               slot = i;
+            }
+         }
+
+         upload = scheduler->slots[slot];
+         curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &upload->code);
+         if (latency_enabled)
+         {
+            latency_add(now_microseconds() - upload->started);
+         }
+         curl_multi_remove_handle(scheduler->multi, msg->easy_handle);
+         scheduler->slots[slot] = NULL;
+         active--;
+
+         upload_stop(upload);
+
+         /* A download is complete when the whole range arrived */
+         if (result == CURLE_OK && upload->code >= 200 && upload->code <= 299 &&
+             (!upload->download || upload->sent == upload->size))
+         {
+            upload->state = UPLOAD_DONE;
+            scheduler->bytes += (uint64_t)upload->size;
+            completed++;
+
+            if (scheduler->done != NULL)
+            {
+               scheduler->done(upload, scheduler->done_data);
+            }
+         }
+         else if (upload->attempts < HTTP_UPLOAD_ATTEMPTS && upload_retryable(result, upload->code))
+         {
+            uint64_t backoff = HTTP_BACKOFF_MIN;
+
+            for (int i = 1; i < upload->attempts && backoff < HTTP_BACKOFF_MAX; i++)
+            {
+               backoff *= 2;
+            }
+            if (backoff > HTTP_BACKOFF_MAX)
+            {
+               backoff = HTTP_BACKOFF_MAX;
+            }
+
+            pgmoneta_log_debug("HTTP: Retrying %s in %llu ms (%s, HTTP %ld)", upload->resource,
+                               (unsigned long long)backoff, curl_easy_strerror(result), upload->code);
+
+            upload->state = UPLOAD_PENDING;
+            upload->not_before = now_milliseconds() + backoff;
+            scheduler->retries++;
+         }
+         else if (upload->optional)
+         {
+            pgmoneta_log_debug("HTTP: Could not copy %s (%s, HTTP %ld)", upload->resource,
+                               curl_easy_strerror(result), upload->code);
+            upload->state = UPLOAD_FAILED;
+            completed++;
+         }
+         else
+         {
+            pgmoneta_log_error("HTTP: Could not %s %s (%s, HTTP %ld)", upload->download ? "download" : "upload",
+                               upload->resource, curl_easy_strerror(result), upload->code);
+            upload->state = UPLOAD_FAILED;
+            goto error;
+         }
+      }
+
+      /* Resume the transfers paused by the rate limit, they pause again while the bucket is empty */
+      if (scheduler->bucket != NULL || pgmoneta_bandwidth_active())
+      {
+         for (int i = 0; i < scheduler->number_of_slots; i++)
+         {
+            if (scheduler->slots[i] != NULL && scheduler->slots[i]->paused)
+            {
+               scheduler->slots[i]->paused = false;
+               curl_easy_pause(scheduler->handles[i], CURLPAUSE_CONT);
+            }
+         }
+         timeout = 100;
+      }
+
+      if (active == 0)
+      {
+         /* Only retries are left, so wait for the first of them */
+         if (completed < scheduler->number_of_uploads && scheduler->retries > 0)
+         {
+            SLEEP(100000000L)
+         }
+      }
+      else if (curl_multi_wait(scheduler->multi, NULL, 0, timeout, NULL) != CURLM_OK)
+      {
+         goto error;
+      }
+   }
+
+   upload_bucket = NULL;
+
+   pgmoneta_bandwidth_stop();
+
+   return 0;
+
+error:
+
+   for (int i = 0; i < scheduler->number_of_slots; i++)
+   {
+      if (scheduler->slots[i] != NULL)
+      {
+         curl_multi_remove_handle(scheduler->multi, scheduler->handles[i]);
+         upload_stop(scheduler->slots[i]);
+         scheduler->slots[i] = NULL;
+      }
+   }
+
+   upload_bucket = NULL;
+
+   pgmoneta_bandwidth_stop();
+
+   return 1;
+}
+
+void
+pgmoneta_http_scheduler_on_done(struct http_scheduler* scheduler, http_done_func done, void* data)
+{
+   scheduler->done = done;
+   scheduler->done_data = data;
+}
+
+uint64_t
+pgmoneta_http_scheduler_bytes(struct http_scheduler* scheduler)
+{
+   if (scheduler == NULL)
+   {
+      return 0;
+   }
+
+   return scheduler->bytes;
+}
+
+void
+pgmoneta_http_latency_record(bool enable)
+{
+   latency_enabled = enable;
+
+   if (enable)
+   {
+      latency_count = 0;
+   }
+}
+
+int
+pgmoneta_http_latencies(uint64_t** latencies)
+{
+   *latencies = latency_samples;
+
+   return latency_count;
+}
+
+void
+pgmoneta_http_scheduler_destroy(struct http_scheduler* scheduler)
+{
+   if (scheduler == NULL)
+   {
+      return;
+   }
+
+   if (scheduler->handles != NULL)
+   {
+      for (int i = 0; i < scheduler->number_of_slots; i++)
+      {
+         if (scheduler->handles[i] != NULL)
+         {
+            if (scheduler->multi != NULL && scheduler->slots[i] != NULL)
+            {
+               curl_multi_remove_handle(scheduler->multi, scheduler->handles[i]);
+            }
+            curl_easy_cleanup(scheduler->handles[i]);
+         }
+      }
+   }
+
+   if (scheduler->multi != NULL)
+   {
+      curl_multi_cleanup(scheduler->multi);
+   }
+
+   for (int i = 0; i < scheduler->number_of_uploads; i++)
+   {
+      struct http_upload* upload = scheduler->uploads[i];
+
+      upload_stop(upload);
+      free(upload->local_path);
+      free(upload->url);
+      free(upload->resource);
+      free(upload->query);
+      free(upload->source);
+      free(upload);
+   }
+
+   pgmoneta_token_bucket_destroy(scheduler->bucket);
+   free(scheduler->uploads);
+   free(scheduler->handles);
+   free(scheduler->slots);
+   free(scheduler);
+}
+
+static int
+upload_start(struct http_scheduler* scheduler, int slot, struct http_upload* upload)
+{
+   CURL* handle = scheduler->handles[slot];
+
+   upload->attempts++;
+   upload->started = now_microseconds();
+   upload->sent = 0;
+   upload->paused = false;
+   upload->code = 0;
+   memset(upload->etag, 0, sizeof(upload->etag));
+
+   if (upload->download)
+   {
+      upload->fd = open(upload->local_path, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR);
+      if (upload->fd == -1)
+      {
+         pgmoneta_log_error("HTTP: Could not open %s: %s", upload->local_path, strerror(errno));
+         goto error;
+      }
+   }
+   else if (upload->local_path != NULL)
+   {
+      upload->fd = open(upload->local_path, O_RDONLY);
+      if (upload->fd == -1)
+      {
+         pgmoneta_log_error("HTTP: Could not open %s: %s", upload->local_path, strerror(errno));
+         goto error;
+      }
+   }
+
+   if (upload->sign(upload, &upload->headers))
+   {
+      goto error;
+   }
+
+   curl_easy_reset(handle);
+
+   if (pgmoneta_http_set_header_option(handle, upload->headers))
+   {
+      goto error;
+   }
+
+   pgmoneta_http_set_request_option(handle, upload->download ? HTTP_GET : HTTP_PUT);
+
+   pgmoneta_http_set_url_option(handle, upload->url);
+
+   curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
+   curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION, upload_header_cb);
+   curl_easy_setopt(handle, CURLOPT_HEADERDATA, (void*)upload);
+
+   if (upload->download)
+   {
+      curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, download_write_cb);
+      curl_easy_setopt(handle, CURLOPT_WRITEDATA, (void*)upload);
+   }
+   else
+   {
+      curl_easy_setopt(handle, CURLOPT_READFUNCTION, upload_read_cb);
+      curl_easy_setopt(handle, CURLOPT_READDATA, (void*)upload);
+      curl_easy_setopt(handle, CURLOPT_SEEKFUNCTION, upload_seek_cb);
+      curl_easy_setopt(handle, CURLOPT_SEEKDATA, (void*)upload);
+      curl_easy_setopt(handle, CURLOPT_INFILESIZE_LARGE, (curl_off_t)upload->size);
+      curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, upload_write_cb);
+      curl_easy_setopt(handle, CURLOPT_WRITEDATA, NULL);
+   }
+
+   if (curl_multi_add_handle(scheduler->multi, handle) != CURLM_OK)
+   {
+      goto error;
+   }
+
+   upload->handle = handle;
+   upload->state = UPLOAD_RUNNING;
+   scheduler->slots[slot] = upload;
+
+   return 0;
+
+error:
+
+   upload_stop(upload);
+   upload->state = UPLOAD_FAILED;
+
+   return 1;
+}
+
+static void
+upload_stop(struct http_upload* upload)
+{
+   if (upload->fd != -1)
+   {
+      close(upload->fd);
+      upload->fd = -1;
+   }
+
+   curl_slist_free_all(upload->headers);
+   upload->headers = NULL;
+}
+
+static struct http_upload*
+upload_next(struct http_scheduler* scheduler, uint64_t now)
+{
+   if (scheduler->retries > 0)
+   {
+      for (int i = 0; i < scheduler->next; i++)
+      {
+         struct http_upload* upload = scheduler->uploads[i];
+
+         if (upload->state == UPLOAD_PENDING && upload->not_before <= now)
+         {
+            scheduler->retries--;
+            return upload;
+         }
+      }
+   }
+
+   if (scheduler->next < scheduler->number_of_uploads)
+   {
+      return scheduler->uploads[scheduler->next++];
+   }
+
+   return NULL;
+}
+
+static bool
+upload_retryable(CURLcode result, long code)
+{
+   if (result != CURLE_OK)
+   {
+      return true;
+   }
+
+   return code == 408 || code == 429 || code >= 500;
+}
+
+static size_t
+upload_read_cb(char* buffer, size_t size, size_t nitems, void* userdata)
+{
+   struct http_upload* upload = (struct http_upload*)userdata;
+   size_t max = size * nitems;
+   ssize_t n;
+
+   if (upload->sent >= upload->size)
+   {
+      return 0;
+   }
+
+   if ((off_t)max > upload->size - upload->sent)
+   {
+      max = (size_t)(upload->size - upload->sent);
+   }
+
+   if (upload_bucket != NULL)
+   {
+      if (max > upload_bucket->burst)
+      {
+         max = upload_bucket->burst;
+      }
+
+      if (pgmoneta_token_bucket_once(upload_bucket, max))
+      {
+         upload->paused = true;
+         return CURL_READFUNC_PAUSE;
+      }
+   }
+
+   if (pgmoneta_bandwidth_active())
+   {
+      if (max > DEFAULT_BURST)
+      {
+         max = DEFAULT_BURST;
+      }
+
+      if (pgmoneta_bandwidth_once(max))
+      {
+         upload->paused = true;
+         return CURL_READFUNC_PAUSE;
+      }
+   }
+
+   n = pread(upload->fd, buffer, max, upload->offset + upload->sent);
+   if (n < 0)
+   {
+      return CURL_READFUNC_ABORT;
+   }
+
+   upload->sent += n;
+
+   return (size_t)n;
+}
+
+static int
+upload_seek_cb(void* userdata, curl_off_t offset, int origin)
+{
+   struct http_upload* upload = (struct http_upload*)userdata;
+
+   if (origin != SEEK_SET || offset < 0 || offset > upload->size)
+   {
+      return CURL_SEEKFUNC_CANTSEEK;
+   }
+
+   upload->sent = (off_t)offset;
+
+   return CURL_SEEKFUNC_OK;
+}
+
+static size_t
+upload_header_cb(char* buffer, size_t size, size_t nitems, void* userdata)
+{
+   struct http_upload* upload = (struct http_upload*)userdata;
+   size_t n = size * nitems;
+   size_t start = 5;
+   size_t end = n;
+
+   if (n > 5 && !strncasecmp(buffer, "ETag:", 5))
+   {
+      while (start < end && (buffer[start] == ' ' || buffer[start] == '\t'))
+      {
+         start++;
+      }
+
+      while (end > start && (buffer[end - 1] == '\r' || buffer[end - 1] == '\n' || buffer[end - 1] == ' '))
+      {
+         end--;
+      }
+
+      if (end - start < sizeof(upload->etag))
+      {
+         memset(upload->etag, 0, sizeof(upload->etag));
+         memcpy(upload->etag, buffer + start, end - start);
+      }
+   }
+
+   return n;
+}
+
+static size_t
+upload_write_cb(char* ptr __attribute__((unused)), size_t size, size_t nmemb, void* userdata __attribute__((unused)))
+{
+   return size * nmemb;
+}
+
+static size_t
+download_write_cb(char* ptr, size_t size, size_t nmemb, void* userdata)
+{
+   struct http_upload* upload = (struct http_upload*)userdata;
+   size_t n = size * nmemb;
+   size_t written = 0;
+   ssize_t w;
+
+   /* An error body isn't part of the file */
+   curl_easy_getinfo(upload->handle, CURLINFO_RESPONSE_CODE, &upload->code);
+   if (upload->code < 200 || upload->code > 299)
+   {
+      return n;
+   }
+
+   if (upload->sent + (off_t)n > upload->size)
+   {
+      return 0;
+   }
+
+   while (written < n)
+   {
+      w = pwrite(upload->fd, ptr + written, n - written, upload->offset + upload->sent + written);
+      if (w < 0)
+      {
+         if (errno == EINTR)
+         {
+            continue;
+         }
+         return 0;
+      }
+      written += w;
+   }
+
+   upload->sent += n;
+
+   return n;
+}
+
+static void
+latency_add(uint64_t latency)
+{
+   if (latency_count == latency_capacity)
+   {
+      int capacity = latency_capacity == 0 ? 1024 : latency_capacity * 2;
+      uint64_t* samples = NULL;
+
+      samples = (uint64_t*)realloc(latency_samples, capacity * sizeof(uint64_t));
+      if (samples == NULL)
+      {
+         return;
+      }
+
+      latency_samples = samples;
+      latency_capacity = capacity;
+   }
+
+   latency_samples[latency_count++] = latency;
+}
+
+static uint64_t
+now_microseconds(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+
+   return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static uint64_t
+now_milliseconds(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+
+   return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
@@ -0,0 +1,729 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <art.h>
+#include <incremental.h>
+#include <info.h>
+#include <json.h>
+#include <logging.h>
+#include <manifest.h>
+#include <page.h>
+#include <security.h>
+#include <utils.h>
+#include <workers.h>
+
+/* system */
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define INCREMENTAL_READ_BLOCKS 32
+
+/** @struct incremental_input
+ * Defines the conversion of a relation file on a worker
+ */
+struct incremental_input
+{
+   struct worker_common common; /**< The common base */
+   char path[MAX_PATH];         /**< The path of the relation file */
+   char target[MAX_PATH];       /**< The path of the incremental file */
+   struct json* entry;          /**< The manifest entry of the file */
+   int algorithm;               /**< The checksum algorithm */
+   uint64_t start_lsn;          /**< The start LSN of the parent */
+   uint32_t block_size;         /**< The block size */
+   bool unchanged;              /**< Is the file identical in the parent */
+   bool converted;              /**< Was the file made incremental */
+   uint64_t size;               /**< The size of the incremental file */
+   char* checksum;              /**< The checksum of the incremental file */
+   bool failed;                 /**< Did the conversion fail */
+};
+
+static bool is_digits(char* s, size_t length);
+static int write_incremental(struct incremental_input* ii, int fd, uint32_t* blocks, uint32_t number_of_blocks, uint32_t truncation_block_length);
+static void convert_file(struct worker_common* wc);
+static int update_backup_label(char* data, struct json* entry, uint64_t start_lsn, uint32_t timeline);
+static void input_destroy(struct incremental_input* ii);
+
+int
+pgmoneta_incremental_page_lsn(int server, char* label, char* parent_label)
+{
+   char* server_backup = NULL;
+   char* data = NULL;
+   char* manifest_path = NULL;
+   char* parent_manifest = NULL;
+   char* incr = NULL;
+   struct backup* parent = NULL;
+   struct art* parent_files = NULL;
+   struct json* manifest = NULL;
+   struct json* files = NULL;
+   struct json* label_entry = NULL;
+   struct json_iterator* iter = NULL;
+   struct workers* workers = NULL;
+   struct incremental_input** inputs = NULL;
+   int number_of_inputs = 0;
+   int number_of_workers = 0;
+   uint32_t block_size = 0;
+   uint64_t max_size = 0;
+   uint64_t start_lsn = 0;
+   uint32_t converted = 0;
+   uint32_t unchanged = 0;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   block_size = config->common.servers[server].block_size;
+   max_size = (uint64_t)config->common.servers[server].relseg_size * block_size;
+
+   server_backup = pgmoneta_get_server_backup(server);
+   if (pgmoneta_get_backup(server_backup, parent_label, &parent) || parent == NULL)
+   {
+      pgmoneta_log_error("Incremental: Unable to find backup %s/%s", config->common.servers[server].name, parent_label);
+      goto error;
+   }
+
+   start_lsn = ((uint64_t)parent->start_lsn_hi32 << 32) | parent->start_lsn_lo32;
+
+   /* The checksums of the parent tell which files exist in the chain, and which are identical */
+   parent_manifest = pgmoneta_get_server_backup_identifier(server, parent_label);
+   parent_manifest = pgmoneta_append(parent_manifest, "backup.manifest");
+   if (pgmoneta_manifest_load(parent_manifest, &parent_files))
+   {
+      pgmoneta_log_error("Incremental: Unable to load %s", parent_manifest);
+      goto error;
+   }
+
+   data = pgmoneta_get_server_backup_identifier_data(server, label);
+   manifest_path = pgmoneta_append(NULL, data);
+   manifest_path = pgmoneta_append(manifest_path, "backup_manifest");
+
+   if (pgmoneta_json_read_file(manifest_path, &manifest))
+   {
+      pgmoneta_log_error("Incremental: Unable to read %s", manifest_path);
+      goto error;
+   }
+
+   files = (struct json*)pgmoneta_json_get(manifest, MANIFEST_FILES);
+   if (files == NULL)
+   {
+      goto error;
+   }
+
+   inputs = (struct incremental_input**)calloc(pgmoneta_json_array_length(files) + 1, sizeof(struct incremental_input*));
+   if (inputs == NULL)
+   {
+      goto error;
+   }
+
+   number_of_workers = pgmoneta_get_number_of_workers(server);
+   if (number_of_workers > 0)
+   {
+      pgmoneta_workers_initialize(number_of_workers, &workers);
+   }
+
+   if (pgmoneta_json_iterator_create(files, &iter))
+   {
+      goto error;
+   }
+
+   while (pgmoneta_json_iterator_next(iter))
+   {
+      struct json* entry = (struct json*)pgmoneta_value_data(iter->value);
+      struct incremental_input* ii = NULL;
+      char* path = (char*)pgmoneta_json_get(entry, "Path");
+      char* checksum = (char*)pgmoneta_json_get(entry, "Checksum");
+      char* parent_checksum = NULL;
+      uint64_t size = (uint64_t)pgmoneta_json_get(entry, "Size");
+
+      if (path == NULL)
+      {
+         continue;
+      }
+
+      if (!strcmp(path, "backup_label"))
+      {
+         label_entry = entry;
+         continue;
+      }
+
+      /* Files which can't be described by blocks are kept whole, like PostgreSQL does */
+      if (!pgmoneta_incremental_is_relation_file(path) || size == 0 || size % block_size != 0 || size > max_size)
+      {
+         continue;
+      }
+
+      /* A relation created since the parent has no full file to be combined with */
+      incr = pgmoneta_incremental_path(path);
+      if (incr == NULL)
+      {
+         goto error;
+      }
+      parent_checksum = (char*)pgmoneta_art_search(parent_files, path);
+      if (parent_checksum == NULL && !pgmoneta_art_contains_key(parent_files, incr))
+      {
+         free(incr);
+         incr = NULL;
+         continue;
+      }
+
+      ii = (struct incremental_input*)calloc(1, sizeof(struct incremental_input));
+      if (ii == NULL)
+      {
+         goto error;
+      }
+      inputs[number_of_inputs++] = ii;
+
+      snprintf(ii->path, sizeof(ii->path), "%s%s", data, path);
+      snprintf(ii->target, sizeof(ii->target), "%s%s", data, incr);
+
+      free(incr);
+      incr = NULL;
+
+      /* A tablespace stored outside of the data directory is kept as it is */
+      if (!pgmoneta_is_file(ii->path))
+      {
+         continue;
+      }
+      ii->entry = entry;
+      ii->algorithm = pgmoneta_get_hash_algorithm((char*)pgmoneta_json_get(entry, "Checksum-Algorithm"));
+      ii->start_lsn = start_lsn;
+      ii->block_size = block_size;
+      /* Equal checksums only skip the scan of the pages when they can't collide by chance */
+      ii->unchanged = parent_checksum != NULL && checksum != NULL && pgmoneta_hash_algorithm_identifies(ii->algorithm) &&
+                      !strcmp(parent_checksum, checksum);
+      ii->common.workers = workers;
+      ii->common.size = ii->unchanged ? 0 : size;
+
+      if (workers != NULL)
+      {
+         if (pgmoneta_workers_add(workers, convert_file, (struct worker_common*)ii))
+         {
+            goto error;
+         }
+      }
+      else
+      {
+         convert_file((struct worker_common*)ii);
+      }
+   }
+
+   if (workers != NULL)
+   {
+      pgmoneta_workers_wait(workers);
+   }
+
+   for (int i = 0; i < number_of_inputs; i++)
+   {
+      struct incremental_input* ii = inputs[i];
+      char* path = NULL;
+
+      if (ii->failed)
+      {
+         goto error;
+      }
+
+      if (!ii->converted)
+      {
+         continue;
+      }
+
+      path = pgmoneta_incremental_path((char*)pgmoneta_json_get(ii->entry, "Path"));
+      if (path == NULL)
+      {
+         goto error;
+      }
+      pgmoneta_json_put(ii->entry, "Path", (uintptr_t)path, ValueString);
+      pgmoneta_json_put(ii->entry, "Size", ii->size, ValueUInt64);
+      pgmoneta_json_put(ii->entry, "Checksum", (uintptr_t)ii->checksum, ValueString);
+      free(path);
+
+      converted++;
+      if (ii->unchanged)
+      {
+         unchanged++;
+      }
+   }
+
+   if (label_entry == NULL || update_backup_label(data, label_entry, start_lsn, parent->start_timeline))
+   {
+      pgmoneta_log_error("Incremental: Unable to update the backup_label of %s/%s", config->common.servers[server].name, label);
+      goto error;
+   }
+
+   if (pgmoneta_json_write_file(manifest_path, manifest))
+   {
+      pgmoneta_log_error("Incremental: Unable to write %s", manifest_path);
+      goto error;
+   }
+
+   pgmoneta_log_info("Incremental: %s/%s has %u incremental files (%u unchanged) from %X/%X",
+                     config->common.servers[server].name, label, converted, unchanged,
+                     parent->start_lsn_hi32, parent->start_lsn_lo32);
+
+   pgmoneta_json_iterator_destroy(iter);
+   pgmoneta_workers_destroy(workers);
+   for (int i = 0; i < number_of_inputs; i++)
+   {
+      input_destroy(inputs[i]);
+   }
+   free(inputs);
+   pgmoneta_json_destroy(manifest);
+   pgmoneta_art_destroy(parent_files);
+   free(parent);
+   free(parent_manifest);
+   free(manifest_path);
+   free(data);
+   free(server_backup);
+
+   return 0;
+
+error:
+
+   if (workers != NULL)
+   {
+      pgmoneta_workers_wait(workers);
+      pgmoneta_workers_destroy(workers);
+   }
+
+   pgmoneta_json_iterator_destroy(iter);
+   if (inputs != NULL)
+   {
+      for (int i = 0; i < number_of_inputs; i++)
+      {
+         input_destroy(inputs[i]);
+      }
+   }
+   free(inputs);
+   free(incr);
+   pgmoneta_json_destroy(manifest);
+   pgmoneta_art_destroy(parent_files);
+   free(parent);
+   free(parent_manifest);
+   free(manifest_path);
+   free(data);
+   free(server_backup);
+
+   return 1;
+}
+
+bool
+pgmoneta_incremental_is_relation_file(char* path)
+{
+   char* name = NULL;
+   char* p = NULL;
+   char* dir = NULL;
+   size_t length = 0;
+
+   name = strrchr(path, '/');
+   if (name == NULL)
+   {
+      return false;
+   }
+   name++;
+
+   /* global/<rel>, base/<db>/<rel> or pg_tblspc/<oid>/<version>/<db>/<rel> */
+   if (pgmoneta_starts_with(path, "global/"))
+   {
+      if (name != path + strlen("global/"))
+      {
+         return false;
+      }
+   }
+   else if (pgmoneta_starts_with(path, "base/"))
+   {
+      dir = path + strlen("base/");
+      if (!is_digits(dir, (size_t)(name - 1 - dir)))
+      {
+         return false;
+      }
+   }
+   else if (pgmoneta_starts_with(path, "pg_tblspc/"))
+   {
+      int slashes = 0;
+
+      for (p = path; p < name; p++)
+      {
+         if (*p == '/')
+         {
+            slashes++;
+         }
+      }
+
+      if (slashes != 4)
+      {
+         return false;
+      }
+
+      dir = name - 2;
+      while (dir > path && *dir != '/')
+      {
+         dir--;
+      }
+      dir++;
+
+      if (!is_digits(dir, (size_t)(name - 1 - dir)))
+      {
+         return false;
+      }
+   }
+   else
+   {
+      return false;
+   }
+
+   /* <relfilenode>[_fsm|_vm][.<segment>], the init fork is always sent whole */
+   p = name;
+   while (*p >= '0' && *p <= '9')
+   {
+      p++;
+   }
+
+   if (p == name)
+   {
+      return false;
+   }
+
+   if (pgmoneta_starts_with(p, "_fsm"))
+   {
+      p += strlen("_fsm");
+   }
+   else if (pgmoneta_starts_with(p, "_vm"))
+   {
+      p += strlen("_vm");
+   }
+
+   if (*p == '.')
+   {
+      p++;
+      length = strlen(p);
+      return is_digits(p, length);
+   }
+
+   return *p == '\0';
+}
+
+char*
+pgmoneta_incremental_path(char* path)
+{
+   char* result = NULL;
+   char* name = NULL;
+   size_t length = 0;
+
+   name = strrchr(path, '/');
+   name = name == NULL ? path : name + 1;
+
+   length = strlen(path) + strlen(INCREMENTAL_PREFIX) + 1;
+   result = (char*)malloc(length);
+   if (result == NULL)
+   {
+      return NULL;
+   }
+
+   snprintf(result, length, "%.*s%s%s", (int)(name - path), path, INCREMENTAL_PREFIX, name);
+
+   return result;
+}
+
+static bool
+is_digits(char* s, size_t length)
+{
+   if (length == 0)
+   {
+      return false;
+   }
+
+   for (size_t i = 0; i < length; i++)
+   {
+      if (s[i] < '0' || s[i] > '9')
+      {
+         return false;
+      }
+   }
+
+   return true;
+}
+
+static void
+convert_file(struct worker_common* wc)
+{
+   struct incremental_input* ii = (struct incremental_input*)wc;
+   int fd = -1;
+   struct stat st;
+   unsigned char* buffer = NULL;
+   uint32_t* blocks = NULL;
+   uint32_t number_of_blocks = 0;
+   uint32_t total = 0;
+
+   fd = open(ii->path, O_RDONLY);
+   if (fd == -1 || fstat(fd, &st) != 0)
+   {
+      pgmoneta_log_error("Incremental: Unable to open %s", ii->path);
+      goto error;
+   }
+
+   total = (uint32_t)(st.st_size / ii->block_size);
+
+   /* A file identical to the parent only keeps its length */
+   if (!ii->unchanged)
+   {
+      buffer = (unsigned char*)malloc((size_t)ii->block_size * INCREMENTAL_READ_BLOCKS);
+      blocks = (uint32_t*)malloc(sizeof(uint32_t) * (total + 1));
+      if (buffer == NULL || blocks == NULL)
+      {
+         goto error;
+      }
+
+      for (uint32_t b = 0; b < total; b += INCREMENTAL_READ_BLOCKS)
+      {
+         uint32_t count = MIN(INCREMENTAL_READ_BLOCKS, total - b);
+         size_t length = (size_t)count * ii->block_size;
+
+         if (pread(fd, buffer, length, (off_t)b * ii->block_size) != (ssize_t)length)
+         {
+            pgmoneta_log_error("Incremental: Unable to read %s", ii->path);
+            goto error;
+         }
+
+         /* A page written since the start of the parent carries a later LSN. A page
+          * without an LSN, like a new page which wasn't WAL-logged, is always taken */
+         for (uint32_t i = 0; i < count; i++)
+         {
+            uint64_t lsn = pgmoneta_page_lsn(buffer + (size_t)i * ii->block_size);
+
+            if (lsn == 0 || lsn >= ii->start_lsn)
+            {
+               blocks[number_of_blocks++] = b + i;
+            }
+         }
+      }
+
+      /* Like PostgreSQL, a file which mostly changed is kept whole */
+      if ((uint64_t)number_of_blocks * 10 > (uint64_t)total * 9)
+      {
+         goto done;
+      }
+   }
+
+   if (write_incremental(ii, fd, blocks, number_of_blocks, total))
+   {
+      goto error;
+   }
+
+   close(fd);
+   fd = -1;
+
+   if (pgmoneta_create_file_hash(ii->algorithm, ii->target, &ii->checksum))
+   {
+      pgmoneta_log_error("Incremental: Unable to hash %s", ii->target);
+      goto error;
+   }
+
+   ii->size = pgmoneta_get_file_size(ii->target);
+
+   if (unlink(ii->path) != 0)
+   {
+      pgmoneta_log_error("Incremental: Unable to remove %s", ii->path);
+      goto error;
+   }
+
+   ii->converted = true;
+
+done:
+
+   if (fd != -1)
+   {
+      close(fd);
+   }
+   free(buffer);
+   free(blocks);
+
+   return;
+
+error:
+
+   if (fd != -1)
+   {
+      close(fd);
+   }
+   free(buffer);
+   free(blocks);
+
+   ii->failed = true;
+   if (ii->common.workers != NULL)
+   {
+      ii->common.workers->outcome = false;
+   }
+}
+
+static int
+write_incremental(struct incremental_input* ii, int fd, uint32_t* blocks, uint32_t number_of_blocks, uint32_t truncation_block_length)
+{
+   FILE* out = NULL;
+   unsigned char* header = NULL;
+   unsigned char* block = NULL;
+   size_t header_length = 0;
+   uint32_t magic = INCREMENTAL_MAGIC;
+
+   /* magic, number of blocks, truncation block length and the block numbers,
+    * padded to a block when there are blocks */
+   header_length = sizeof(uint32_t) * (3 + (size_t)number_of_blocks);
+   if (number_of_blocks > 0 && header_length % ii->block_size != 0)
+   {
+      header_length += ii->block_size - (header_length % ii->block_size);
+   }
+
+   header = (unsigned char*)calloc(1, header_length);
+   block = (unsigned char*)malloc(ii->block_size);
+   if (header == NULL || block == NULL)
+   {
+      goto error;
+   }
+
+   memcpy(header, &magic, sizeof(uint32_t));
+   memcpy(header + sizeof(uint32_t), &number_of_blocks, sizeof(uint32_t));
+   memcpy(header + 2 * sizeof(uint32_t), &truncation_block_length, sizeof(uint32_t));
+   if (number_of_blocks > 0)
+   {
+      memcpy(header + 3 * sizeof(uint32_t), blocks, sizeof(uint32_t) * number_of_blocks);
+   }
+
+   out = fopen(ii->target, "wb");
+   if (out == NULL)
+   {
+      pgmoneta_log_error("Incremental: Unable to create %s", ii->target);
+      goto error;
+   }
+
+   if (fwrite(header, 1, header_length, out) != header_length)
+   {
+      goto error;
+   }
+
+   for (uint32_t i = 0; i < number_of_blocks; i++)
+   {
+      if (pread(fd, block, ii->block_size, (off_t)blocks[i] * ii->block_size) != (ssize_t)ii->block_size ||
+          fwrite(block, 1, ii->block_size, out) != ii->block_size)
+      {
+         pgmoneta_log_error("Incremental: Unable to write %s", ii->target);
+         goto error;
+      }
+   }
+
+   if (fclose(out) != 0)
+   {
+      out = NULL;
+      goto error;
+   }
+
+   free(header);
+   free(block);
+
+   return 0;
+
+error:
+
+   if (out != NULL)
+   {
+      fclose(out);
+   }
+   free(header);
+   free(block);
+
+   return 1;
+}
+
+static int
+update_backup_label(char* data, struct json* entry, uint64_t start_lsn, uint32_t timeline)
+{
+   char* path = NULL;
+   char* checksum = NULL;
+   FILE* f = NULL;
+   int algorithm;
+
+   path = pgmoneta_append(NULL, data);
+   path = pgmoneta_append(path, "backup_label");
+
+   /* The same lines as an incremental backup of PostgreSQL 17, used when the chain is combined */
+   f = fopen(path, "a");
+   if (f == NULL)
+   {
+      goto error;
+   }
+
+   fprintf(f, "INCREMENTAL FROM LSN: %X/%X\n", (uint32_t)(start_lsn >> 32), (uint32_t)start_lsn);
+   fprintf(f, "INCREMENTAL FROM TLI: %u\n", timeline);
+
+   if (fclose(f) != 0)
+   {
+      f = NULL;
+      goto error;
+   }
+   f = NULL;
+
+   algorithm = pgmoneta_get_hash_algorithm((char*)pgmoneta_json_get(entry, "Checksum-Algorithm"));
+   if (pgmoneta_create_file_hash(algorithm, path, &checksum))
+   {
+      goto error;
+   }
+
+   pgmoneta_json_put(entry, "Size", pgmoneta_get_file_size(path), ValueUInt64);
+   pgmoneta_json_put(entry, "Checksum", (uintptr_t)checksum, ValueString);
+
+   free(checksum);
+   free(path);
+
+   return 0;
+
+error:
+
+   if (f != NULL)
+   {
+      fclose(f);
+   }
+   free(checksum);
+   free(path);
+
+   return 1;
+}
+
+static void
+input_destroy(struct incremental_input* ii)
+{
+   if (ii == NULL)
+   {
+      return;
+   }
+
+   free(ii->checksum);
+   free(ii);
+}
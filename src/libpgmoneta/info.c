@@ -34,21 +34,125 @@
 #include <logging.h>
 #include <management.h>
 #include <network.h>
+#include <reader.h>
 #include <utils.h>
+#include <zstandard_compression.h>
 
 /* system */
 #include <errno.h>
+#include <fcntl.h>
 #include <libgen.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define NAME "info"
 #define INFO_BUFFER_SIZE 8192
 
+#define CATALOG_MAGIC   0x474C544143474D50ULL /* PGMCATLG */
+#define CATALOG_VERSION 1
+
+/* Steps of a workflow may update backup.info concurrently */
+static pthread_mutex_t info_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** @struct catalog_header
+ * Defines the header of a backup catalog. The header is followed by
+ * number_of_backups records of struct backup. A record is a sequence of
+ * zero runs and literal bytes, since most of a struct backup is unused
+ * tablespace and comment space
+ */
+struct catalog_header
+{
+   uint64_t magic;             /**< The magic */
+   uint32_t version;           /**< The version */
+   uint32_t record_size;       /**< The size of a record */
+   uint64_t generation;        /**< The backup generation the catalog was built at */
+   int64_t mtime_sec;          /**< The modification time of the directory, seconds */
+   int64_t mtime_nsec;         /**< The modification time of the directory, nanoseconds */
+   uint64_t number_of_backups; /**< The number of backups */
+};
+
+/** @struct catalog_token
+ * Defines a token of a catalog record: zeros bytes of zero followed by
+ * literal bytes copied as is
+ */
+struct catalog_token
+{
+   uint16_t zeros;   /**< The number of zero bytes */
+   uint16_t literal; /**< The number of literal bytes that follow */
+};
+
+/**
+ * Find a key in a batch
+ * @param batch The batch
+ * @param key The key
+ * @return The index of the key, otherwise -1
+ */
+static int
+info_find(struct info_batch* batch, char* key);
+
+/**
+ * Set the value of a key in a batch, marking the batch failed when out of memory
+ * @param batch The batch
+ * @param key The key
+ * @param value The value
+ */
+static void
+info_set(struct info_batch* batch, char* key, char* value);
+
+/**
+ * Get the path of the catalog of a backup directory
+ * @param directory The directory
+ * @return The path
+ */
+static char*
+catalog_path(char* directory);
+
+/**
+ * Read the backups from the catalog of a directory
+ * @param directory The directory
+ * @param number_of_backups [out] The number of backups
+ * @param backups [out] The backups
+ * @return 0 on success, 1 if the catalog is missing or stale
+ */
+static int
+catalog_read(char* directory, int* number_of_backups, struct backup*** backups);
+
+/**
+ * Write the catalog of a directory
+ * @param directory The directory
+ * @param generation The backup generation before the backups were read
+ * @param st The status of the directory before the backups were read
+ * @param number_of_backups The number of backups
+ * @param backups The backups
+ * @return 0 on success, 1 if otherwise
+ */
+static int
+catalog_write(char* directory, unsigned long generation, struct stat* st, int number_of_backups, struct backup** backups);
+
+/**
+ * Encode a backup into a catalog record
+ * @param backup The backup
+ * @param file The file
+ * @return 0 on success, 1 if otherwise
+ */
+static int
+catalog_encode(struct backup* backup, FILE* file);
+
+/**
+ * Decode a catalog record into a backup
+ * @param data The record
+ * @param size The number of bytes available
+ * @param backup The backup
+ * @param consumed [out] The size of the record
+ * @return 0 on success, 1 if the record is corrupt
+ */
 static int
-file_final_name(char* file, int encryption, int compression, char** finalname);
+catalog_decode(char* data, size_t size, struct backup* backup, size_t* consumed);
 
 /**
  * Best effort to split a file path into a relative path and a bare file name
@@ -62,103 +166,187 @@ file_final_name(char* file, int encryption, int compression, char** finalname);
 static int
 split_file_path(char* path, char** relative_path, char** bare_file_name);
 
+/**
+ * Open a Zstandard backup file with a seek table for random access
+ * @param server The server
+ * @param label The label
+ * @param relative_file_path The file path relative to the backup data directory
+ * @param seekable [out] The reader
+ * @param file_path [out] The path of the backup file
+ * @return 0 on success, 1 if the file is missing or has no seek table
+ */
+static int
+rfile_open_seekable(int server, char* label, char* relative_file_path, struct zstd_seekable** seekable, char** file_path);
+
+/** @struct backup_size_state
+ * Defines the state of summing up the file sizes of a manifest
+ */
+struct backup_size_state
+{
+   int server;                 /**< The server */
+   char* label;                /**< The label */
+   int depth;                  /**< The nesting depth in the manifest */
+   bool in_files;              /**< Are we inside the Files array */
+   bool found;                 /**< Was the Files array found */
+   char* path;                 /**< The path of the current file */
+   uint64_t file_size;         /**< The size of the current file in the manifest */
+   unsigned long size;         /**< The total size */
+   uint64_t biggest_file_size; /**< The size of the biggest file */
+};
+
+static int
+backup_size_item_start(void* data, char* key);
+
+static int
+backup_size_item_end(void* data);
+
+static int
+backup_size_array_start(void* data, char* key);
+
+static int
+backup_size_array_end(void* data);
+
+static int
+backup_size_value(void* data, char* key, uintptr_t value, enum value_type type);
+
 void
 pgmoneta_create_info(char* directory, char* label, int status)
 {
-   char buffer[INFO_BUFFER_SIZE];
-   char* s = NULL;
-   FILE* sfile = NULL;
-   struct main_configuration* config;
+   struct info_batch* batch = NULL;
 
-   config = (struct main_configuration*)shmem;
+   if (!pgmoneta_info_create(directory, label, status, &batch))
+   {
+      pgmoneta_info_commit(batch);
+   }
+}
 
-   s = pgmoneta_append(s, directory);
-   s = pgmoneta_append(s, "/backup.info");
+int
+pgmoneta_info_begin(char* directory, struct info_batch** batch)
+{
+   struct info_batch* b = NULL;
+
+   *batch = NULL;
 
-   sfile = fopen(s, "w");
-   if (sfile == NULL)
+   b = (struct info_batch*)malloc(sizeof(struct info_batch));
+   if (b == NULL)
    {
-      pgmoneta_log_error("Could not open file %s due to %s", s, strerror(errno));
-      errno = 0;
       goto error;
    }
 
-   memset(&buffer[0], 0, sizeof(buffer));
-   snprintf(&buffer[0], sizeof(buffer), "%s=%d\n", INFO_STATUS, status);
-   fputs(&buffer[0], sfile);
-   pgmoneta_log_trace("%s=%d", INFO_STATUS, status);
-
-   memset(&buffer[0], 0, sizeof(buffer));
-   snprintf(&buffer[0], sizeof(buffer), "%s=%s\n", INFO_LABEL, label);
-   fputs(&buffer[0], sfile);
-   pgmoneta_log_trace("%s=%s", INFO_LABEL, label);
+   memset(b, 0, sizeof(struct info_batch));
+   snprintf(&b->directory[0], sizeof(b->directory), "%s", directory);
 
-   memset(&buffer[0], 0, sizeof(buffer));
-   snprintf(&buffer[0], sizeof(buffer), "%s=0\n", INFO_TABLESPACES);
-   fputs(&buffer[0], sfile);
-   pgmoneta_log_trace("%s=0", INFO_TABLESPACES);
+   *batch = b;
 
-   memset(&buffer[0], 0, sizeof(buffer));
-   snprintf(&buffer[0], sizeof(buffer), "%s=%s\n", INFO_PGMONETA_VERSION, VERSION);
-   fputs(&buffer[0], sfile);
-   pgmoneta_log_trace("%s=%s", INFO_PGMONETA_VERSION, VERSION);
+   return 0;
 
-   memset(&buffer[0], 0, sizeof(buffer));
-   snprintf(&buffer[0], sizeof(buffer), "%s=\n", INFO_COMMENTS);
-   fputs(&buffer[0], sfile);
-   pgmoneta_log_trace("%s=", INFO_COMMENTS);
+error:
 
-   memset(&buffer[0], 0, sizeof(buffer));
-   snprintf(&buffer[0], sizeof(buffer), "%s=%d\n", INFO_COMPRESSION, config->compression_type);
-   fputs(&buffer[0], sfile);
-   pgmoneta_log_trace("%s=%d", INFO_COMPRESSION, config->compression_type);
+   return 1;
+}
 
-   memset(&buffer[0], 0, sizeof(buffer));
-   snprintf(&buffer[0], sizeof(buffer), "%s=%d\n", INFO_ENCRYPTION, config->encryption);
-   fputs(&buffer[0], sfile);
-   pgmoneta_log_trace("%s=%d", INFO_ENCRYPTION, config->encryption);
+int
+pgmoneta_info_create(char* directory, char* label, int status, struct info_batch** batch)
+{
+   struct main_configuration* config;
 
-   pgmoneta_permission(s, 6, 0, 0);
+   config = (struct main_configuration*)shmem;
 
-   if (sfile != NULL)
+   if (pgmoneta_info_begin(directory, batch))
    {
-      fsync(fileno(sfile));
-      fclose(sfile);
+      return 1;
    }
 
-   free(s);
+   (*batch)->create = true;
 
-   return;
+   pgmoneta_info_set_unsigned_long(*batch, INFO_STATUS, status);
+   pgmoneta_info_set_string(*batch, INFO_LABEL, label);
+   pgmoneta_info_set_unsigned_long(*batch, INFO_TABLESPACES, 0);
+   pgmoneta_info_set_string(*batch, INFO_PGMONETA_VERSION, VERSION);
+   pgmoneta_info_set_string(*batch, INFO_COMMENTS, NULL);
+   pgmoneta_info_set_unsigned_long(*batch, INFO_COMPRESSION, config->compression_type);
+   pgmoneta_info_set_unsigned_long(*batch, INFO_ENCRYPTION, config->encryption);
 
-error:
+   return 0;
+}
 
-   free(s);
+void
+pgmoneta_info_set_unsigned_long(struct info_batch* batch, char* key, unsigned long value)
+{
+   char v[MISC_LENGTH];
+
+   snprintf(&v[0], sizeof(v), "%lu", value);
+   info_set(batch, key, &v[0]);
 }
 
 void
-pgmoneta_update_info_unsigned_long(char* directory, char* key, unsigned long value)
+pgmoneta_info_set_double(struct info_batch* batch, char* key, double value)
+{
+   char v[MISC_LENGTH];
+
+   snprintf(&v[0], sizeof(v), "%.4f", value);
+   info_set(batch, key, &v[0]);
+}
+
+void
+pgmoneta_info_set_string(struct info_batch* batch, char* key, char* value)
+{
+   info_set(batch, key, value != NULL ? value : "");
+}
+
+void
+pgmoneta_info_set_bool(struct info_batch* batch, char* key, bool value)
+{
+   info_set(batch, key, value ? "1" : "0");
+}
+
+int
+pgmoneta_info_commit(struct info_batch* batch)
 {
    char buffer[INFO_BUFFER_SIZE];
-   char line[INFO_BUFFER_SIZE];
-   bool found = false;
+   bool* written = NULL;
    char* s = NULL;
    FILE* sfile = NULL;
    char* d = NULL;
    FILE* dfile = NULL;
+   bool locked = false;
+
+   if (batch == NULL)
+   {
+      return 1;
+   }
+
+   if (batch->failed)
+   {
+      goto error;
+   }
 
-   s = pgmoneta_append(s, directory);
+   s = pgmoneta_append(s, batch->directory);
    s = pgmoneta_append(s, "/backup.info");
 
-   d = pgmoneta_append(d, directory);
+   d = pgmoneta_append(d, batch->directory);
    d = pgmoneta_append(d, "/backup.info.tmp");
 
-   sfile = fopen(s, "r");
-   if (sfile == NULL)
+   written = (bool*)calloc(MAX(batch->number_of_entries, 1), sizeof(bool));
+   if (s == NULL || d == NULL || written == NULL)
    {
-      pgmoneta_log_error("Could not open file %s due to %s", s, strerror(errno));
-      errno = 0;
       goto error;
    }
+
+   pthread_mutex_lock(&info_lock);
+   locked = true;
+
+   if (!batch->create)
+   {
+      sfile = fopen(s, "r");
+      if (sfile == NULL)
+      {
+         pgmoneta_log_error("Could not open file %s due to %s", s, strerror(errno));
+         errno = 0;
+         goto error;
+      }
+   }
+
    dfile = fopen(d, "w");
    if (dfile == NULL)
    {
@@ -167,284 +355,163 @@ pgmoneta_update_info_unsigned_long(char* directory, char* key, unsigned long val
       goto error;
    }
 
-   while ((fgets(&buffer[0], sizeof(buffer), sfile)) != NULL)
+   /* The existing keys keep their place, and the keys of the batch replace their values */
+   while (sfile != NULL && fgets(&buffer[0], sizeof(buffer), sfile) != NULL)
    {
-      char k[INFO_BUFFER_SIZE];
-      char v[INFO_BUFFER_SIZE];
-      char* ptr = NULL;
-
-      memset(&k[0], 0, sizeof(k));
-      memset(&v[0], 0, sizeof(v));
+      char* eq = strchr(&buffer[0], '=');
+      int index = -1;
 
-      memset(&line[0], 0, sizeof(line));
-      memcpy(&line[0], &buffer[0], strlen(&buffer[0]));
-
-      ptr = strtok(&buffer[0], "=");
-      memcpy(&k[0], ptr, strlen(ptr));
-
-      ptr = strtok(NULL, "=");
-      memcpy(&v[0], ptr, strlen(ptr) - 1);
+      if (eq != NULL)
+      {
+         *eq = '\0';
+         index = info_find(batch, &buffer[0]);
+         *eq = '=';
+      }
 
-      if (!strcmp(key, &k[0]))
+      if (index >= 0)
       {
-         memset(&line[0], 0, sizeof(line));
-         snprintf(&line[0], sizeof(line), "%s=%lu\n", key, value);
-         fputs(&line[0], dfile);
-         found = true;
+         fprintf(dfile, "%s=%s\n", batch->keys[index], batch->values[index]);
+         written[index] = true;
       }
       else
       {
-         fputs(&line[0], dfile);
+         fputs(&buffer[0], dfile);
       }
    }
 
-   if (!found)
+   for (int i = 0; i < batch->number_of_entries; i++)
    {
-      memset(&line[0], 0, sizeof(line));
-      pgmoneta_log_trace("%s=%lu", key, value);
-      snprintf(&line[0], sizeof(line), "%s=%lu\n", key, value);
-      fputs(&line[0], dfile);
+      if (!written[i])
+      {
+         fprintf(dfile, "%s=%s\n", batch->keys[i], batch->values[i]);
+      }
    }
 
    if (sfile != NULL)
    {
-      fsync(fileno(sfile));
       fclose(sfile);
+      sfile = NULL;
    }
 
-   if (dfile != NULL)
-   {
-      fsync(fileno(dfile));
-      fclose(dfile);
-   }
-
-   pgmoneta_move_file(d, s);
-   pgmoneta_permission(s, 6, 0, 0);
-
-   free(s);
-   free(d);
-
-   return;
-
-error:
-
-   free(s);
-   free(d);
-}
-
-void
-pgmoneta_update_info_double(char* directory, char* key, double value)
-{
-   char buffer[INFO_BUFFER_SIZE];
-   char line[INFO_BUFFER_SIZE];
-   bool found = false;
-   char* s = NULL;
-   FILE* sfile = NULL;
-   char* d = NULL;
-   FILE* dfile = NULL;
-
-   s = pgmoneta_append(s, directory);
-   s = pgmoneta_append(s, "/backup.info");
-
-   d = pgmoneta_append(d, directory);
-   d = pgmoneta_append(d, "/backup.info.tmp");
-
-   sfile = fopen(s, "r");
-   if (sfile == NULL)
+   if (fflush(dfile) || fsync(fileno(dfile)))
    {
-      pgmoneta_log_error("Could not open file %s due to %s", s, strerror(errno));
+      pgmoneta_log_error("Could not write file %s due to %s", d, strerror(errno));
       errno = 0;
       goto error;
    }
-   dfile = fopen(d, "w");
-   if (dfile == NULL)
+
+   fclose(dfile);
+   dfile = NULL;
+
+   if (pgmoneta_move_file(d, s))
    {
-      pgmoneta_log_error("Could not open file %s due to %s", d, strerror(errno));
-      errno = 0;
       goto error;
    }
+   pgmoneta_permission(s, 6, 0, 0);
 
-   while ((fgets(&buffer[0], sizeof(buffer), sfile)) != NULL)
-   {
-      char k[INFO_BUFFER_SIZE];
-      char v[INFO_BUFFER_SIZE];
-      char* ptr = NULL;
-
-      memset(&k[0], 0, sizeof(k));
-      memset(&v[0], 0, sizeof(v));
+   pgmoneta_invalidate_backups();
 
-      memset(&line[0], 0, sizeof(line));
-      memcpy(&line[0], &buffer[0], strlen(&buffer[0]));
+   pthread_mutex_unlock(&info_lock);
 
-      ptr = strtok(&buffer[0], "=");
-      memcpy(&k[0], ptr, strlen(ptr));
+   free(written);
+   free(s);
+   free(d);
 
-      ptr = strtok(NULL, "=");
-      memcpy(&v[0], ptr, strlen(ptr) - 1);
+   pgmoneta_info_rollback(batch);
 
-      if (!strcmp(key, &k[0]))
-      {
-         memset(&line[0], 0, sizeof(line));
-         snprintf(&line[0], sizeof(line), "%s=%.4f\n", key, value);
-         fputs(&line[0], dfile);
-         found = true;
-      }
-      else
-      {
-         fputs(&line[0], dfile);
-      }
-   }
+   return 0;
 
-   if (!found)
-   {
-      memset(&line[0], 0, sizeof(line));
-      pgmoneta_log_trace("%s=%.4f", key, value);
-      snprintf(&line[0], sizeof(line), "%s=%.4f\n", key, value);
-      fputs(&line[0], dfile);
-   }
+error:
 
    if (sfile != NULL)
    {
-      fsync(fileno(sfile));
       fclose(sfile);
    }
 
    if (dfile != NULL)
    {
-      fsync(fileno(dfile));
       fclose(dfile);
+      unlink(d);
    }
 
-   pgmoneta_move_file(d, s);
-   pgmoneta_permission(s, 6, 0, 0);
+   if (locked)
+   {
+      pthread_mutex_unlock(&info_lock);
+   }
 
+   free(written);
    free(s);
    free(d);
 
-   return;
-
-error:
+   pgmoneta_info_rollback(batch);
 
-   free(s);
-   free(d);
+   return 1;
 }
 
 void
-pgmoneta_update_info_string(char* directory, char* key, char* value)
+pgmoneta_info_rollback(struct info_batch* batch)
 {
-   char buffer[INFO_BUFFER_SIZE];
-   char line[INFO_BUFFER_SIZE];
-   bool found = false;
-   char* s = NULL;
-   FILE* sfile = NULL;
-   char* d = NULL;
-   FILE* dfile = NULL;
-
-   s = pgmoneta_append(s, directory);
-   s = pgmoneta_append(s, "/backup.info");
-
-   d = pgmoneta_append(d, directory);
-   d = pgmoneta_append(d, "/backup.info.tmp");
-
-   sfile = fopen(s, "r");
-   if (sfile == NULL)
-   {
-      pgmoneta_log_error("Could not open file %s due to %s", s, strerror(errno));
-      errno = 0;
-      goto error;
-   }
-   dfile = fopen(d, "w");
-   if (dfile == NULL)
+   if (batch == NULL)
    {
-      pgmoneta_log_error("Could not open file %s due to %s", d, strerror(errno));
-      errno = 0;
-      goto error;
+      return;
    }
 
-   while ((fgets(&buffer[0], sizeof(buffer), sfile)) != NULL)
+   for (int i = 0; i < batch->number_of_entries; i++)
    {
-      char k[INFO_BUFFER_SIZE];
-      char v[INFO_BUFFER_SIZE];
-      char* ptr = NULL;
-
-      memset(&k[0], 0, sizeof(k));
-      memset(&v[0], 0, sizeof(v));
-
-      memset(&line[0], 0, sizeof(line));
-      memcpy(&line[0], &buffer[0], strlen(&buffer[0]));
-
-      ptr = strtok(&buffer[0], "=");
-      memcpy(&k[0], ptr, strlen(ptr));
-
-      ptr = strtok(NULL, "=");
-      memcpy(&v[0], ptr, strlen(ptr) - 1);
-
-      if (!strcmp(key, &k[0]))
-      {
-         memset(&line[0], 0, sizeof(line));
-         if (value == NULL)
-         {
-            snprintf(&line[0], sizeof(line), "%s=\n", key);
-         }
-         else
-         {
-            snprintf(&line[0], sizeof(line), "%s=%s\n", key, value);
-         }
-         fputs(&line[0], dfile);
-         found = true;
-      }
-      else
-      {
-         fputs(&line[0], dfile);
-      }
+      free(batch->keys[i]);
+      free(batch->values[i]);
    }
+   free(batch->keys);
+   free(batch->values);
+   free(batch);
+}
 
-   if (!found)
-   {
-      memset(&line[0], 0, sizeof(line));
-      pgmoneta_log_trace("%s=%s", key, value);
-      if (value == NULL)
-      {
-         snprintf(&line[0], sizeof(line), "%s=\n", key);
-      }
-      else
-      {
-         snprintf(&line[0], sizeof(line), "%s=%s\n", key, value);
-      }
-      fputs(&line[0], dfile);
-   }
+void
+pgmoneta_update_info_unsigned_long(char* directory, char* key, unsigned long value)
+{
+   struct info_batch* batch = NULL;
 
-   if (sfile != NULL)
+   if (!pgmoneta_info_begin(directory, &batch))
    {
-      fsync(fileno(sfile));
-      fclose(sfile);
+      pgmoneta_info_set_unsigned_long(batch, key, value);
+      pgmoneta_info_commit(batch);
    }
+}
 
-   if (dfile != NULL)
+void
+pgmoneta_update_info_double(char* directory, char* key, double value)
+{
+   struct info_batch* batch = NULL;
+
+   if (!pgmoneta_info_begin(directory, &batch))
    {
-      fsync(fileno(dfile));
-      fclose(dfile);
+      pgmoneta_info_set_double(batch, key, value);
+      pgmoneta_info_commit(batch);
    }
+}
 
-   pgmoneta_move_file(d, s);
-   pgmoneta_permission(s, 6, 0, 0);
-
-   free(s);
-   free(d);
-
-   return;
-
-error:
+void
+pgmoneta_update_info_string(char* directory, char* key, char* value)
+{
+   struct info_batch* batch = NULL;
 
-   free(s);
-   free(d);
+   if (!pgmoneta_info_begin(directory, &batch))
+   {
+      pgmoneta_info_set_string(batch, key, value);
+      pgmoneta_info_commit(batch);
+   }
 }
 
 void
 pgmoneta_update_info_bool(char* directory, char* key, bool value)
 {
-   pgmoneta_log_trace("%s=%d", key, value ? 1 : 0);
-   pgmoneta_update_info_unsigned_long(directory, key, value ? 1 : 0);
+   struct info_batch* batch = NULL;
+
+   if (!pgmoneta_info_begin(directory, &batch))
+   {
+      pgmoneta_info_set_bool(batch, key, value);
+      pgmoneta_info_commit(batch);
+   }
 }
 
 int
@@ -471,9 +538,10 @@ pgmoneta_update_info_annotate(int server, struct backup* backup, char* action, c
       {
          char* tokens = NULL;
          char* ptr = NULL;
+         char* saveptr = NULL;
 
          tokens = pgmoneta_append(tokens, old_comments);
-         ptr = strtok(tokens, ",");
+         ptr = strtok_r(tokens, ",", &saveptr);
 
          while (ptr != NULL && !fail)
          {
@@ -501,7 +569,7 @@ pgmoneta_update_info_annotate(int server, struct backup* backup, char* action, c
                fail = true;
             }
 
-            ptr = strtok(NULL, ",");
+            ptr = strtok_r(NULL, ",", &saveptr);
             if (ptr != NULL)
             {
                new_comments = pgmoneta_append(new_comments, ",");
@@ -530,11 +598,12 @@ pgmoneta_update_info_annotate(int server, struct backup* backup, char* action, c
       {
          char tokens[INFO_BUFFER_SIZE];
          char* ptr = NULL;
+         char* saveptr = NULL;
 
          memset(&tokens[0], 0, sizeof(tokens));
          memcpy(&tokens[0], old_comments, strlen(old_comments));
 
-         ptr = strtok(&tokens[0], ",");
+         ptr = strtok_r(&tokens[0], ",", &saveptr);
 
          while (ptr != NULL)
          {
@@ -565,7 +634,7 @@ pgmoneta_update_info_annotate(int server, struct backup* backup, char* action, c
                found = true;
             }
 
-            ptr = strtok(NULL, ",");
+            ptr = strtok_r(NULL, ",", &saveptr);
             if (ptr != NULL)
             {
                new_comments = pgmoneta_append(new_comments, ",");
@@ -588,11 +657,12 @@ pgmoneta_update_info_annotate(int server, struct backup* backup, char* action, c
       {
          char tokens[INFO_BUFFER_SIZE];
          char* ptr = NULL;
+         char* saveptr = NULL;
 
          memset(&tokens[0], 0, sizeof(tokens));
          memcpy(&tokens[0], old_comments, strlen(old_comments));
 
-         ptr = strtok(&tokens[0], ",");
+         ptr = strtok_r(&tokens[0], ",", &saveptr);
 
          while (ptr != NULL)
          {
@@ -619,7 +689,7 @@ pgmoneta_update_info_annotate(int server, struct backup* backup, char* action, c
                found = true;
             }
 
-            ptr = strtok(NULL, ",");
+            ptr = strtok_r(NULL, ",", &saveptr);
             if (ptr != NULL)
             {
                new_comments = pgmoneta_append(new_comments, ",");
@@ -752,10 +822,28 @@ pgmoneta_get_backups(char* directory, int* number_of_backups, struct backup*** b
    struct backup** bcks = NULL;
    int number_of_directories;
    char** dirs;
+   unsigned long generation = 0;
+   struct stat st;
+   bool cacheable = false;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
 
    *number_of_backups = 0;
    *backups = NULL;
 
+   if (!catalog_read(directory, number_of_backups, backups))
+   {
+      return 0;
+   }
+
+   /* Take the generation and the directory status before reading, so a concurrent change makes the catalog stale */
+   if (config != NULL)
+   {
+      generation = atomic_load(&config->backup_generation);
+      cacheable = stat(directory, &st) == 0;
+   }
+
    number_of_directories = 0;
    dirs = NULL;
 
@@ -789,6 +877,11 @@ pgmoneta_get_backups(char* directory, int* number_of_backups, struct backup*** b
    }
    free(dirs);
 
+   if (cacheable)
+   {
+      catalog_write(directory, generation, &st, number_of_directories, bcks);
+   }
+
    *number_of_backups = number_of_directories;
    *backups = bcks;
 
@@ -798,6 +891,15 @@ error:
 
    free(d);
 
+   if (bcks != NULL)
+   {
+      for (int i = 0; i < number_of_directories; i++)
+      {
+         free(bcks[i]);
+      }
+      free(bcks);
+   }
+
    if (dirs != NULL)
    {
       for (int i = 0; i < number_of_directories; i++)
@@ -810,6 +912,19 @@ error:
    return 1;
 }
 
+void
+pgmoneta_invalidate_backups(void)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (config != NULL)
+   {
+      atomic_fetch_add(&config->backup_generation, 1);
+   }
+}
+
 int
 pgmoneta_get_backup(char* directory, char* label, struct backup** backup)
 {
@@ -988,11 +1103,12 @@ pgmoneta_get_backup_file(char* fn, struct backup** backup)
          char key[INFO_BUFFER_SIZE];
          char value[INFO_BUFFER_SIZE];
          char* ptr = NULL;
+         char* saveptr = NULL;
 
          memset(&key[0], 0, sizeof(key));
          memset(&value[0], 0, sizeof(value));
 
-         ptr = strtok(&buffer[0], "=");
+         ptr = strtok_r(&buffer[0], "=", &saveptr);
 
          if (ptr == NULL)
          {
@@ -1001,7 +1117,7 @@ pgmoneta_get_backup_file(char* fn, struct backup** backup)
 
          memcpy(&key[0], ptr, strlen(ptr));
 
-         ptr = strtok(NULL, "=");
+         ptr = strtok_r(NULL, "=", &saveptr);
 
          if (ptr == NULL)
          {
@@ -1037,6 +1153,26 @@ pgmoneta_get_backup_file(char* fn, struct backup** backup)
          {
             bck->restore_size = strtoul(&value[0], &ptr, 10);
          }
+         else if (!strcmp(INFO_SCRUB, &key[0]))
+         {
+            bck->scrub_time = strtoul(&value[0], &ptr, 10);
+         }
+         else if (!strcmp(INFO_SCRUB_FAILED, &key[0]))
+         {
+            bck->scrub_failed = strtoul(&value[0], &ptr, 10);
+         }
+         else if (!strcmp(INFO_CHECKSUM_PAGES, &key[0]))
+         {
+            bck->checksum_pages = strtoul(&value[0], &ptr, 10);
+         }
+         else if (!strcmp(INFO_CHECKSUM_FAILED, &key[0]))
+         {
+            bck->checksum_failed = strtoul(&value[0], &ptr, 10);
+         }
+         else if (!strcmp(INFO_DATA_KEY, &key[0]))
+         {
+            memcpy(&bck->data_key[0], &value[0], strlen(&value[0]));
+         }
          else if (!strcmp(INFO_BIGGEST_FILE, &key[0]))
          {
             bck->biggest_file_size = strtoul(&value[0], &ptr, 10);
@@ -1069,6 +1205,14 @@ pgmoneta_get_backup_file(char* fn, struct backup** backup)
          {
             bck->compression_lz4_elapsed_time = atof(&value[0]);
          }
+         else if (!strcmp(INFO_COMPRESSION_LEVEL_MIN, &key[0]))
+         {
+            bck->compression_level_min = atoi(&value[0]);
+         }
+         else if (!strcmp(INFO_COMPRESSION_LEVEL_MAX, &key[0]))
+         {
+            bck->compression_level_max = atoi(&value[0]);
+         }
          else if (!strcmp(INFO_ENCRYPTION_ELAPSED, &key[0]))
          {
             bck->encryption_elapsed_time = atof(&value[0]);
@@ -1387,7 +1531,7 @@ error:
    return 1;
 }
 
-void
+int
 pgmoneta_info_request(SSL* ssl __attribute__((unused)), int client_fd, int server,
                       uint8_t compression, uint8_t encryption,
                       struct json* payload)
@@ -1550,9 +1694,7 @@ pgmoneta_info_request(SSL* ssl __attribute__((unused)), int client_fd, int serve
 
    pgmoneta_disconnect(client_fd);
 
-   pgmoneta_stop_logging();
-
-   exit(0);
+   return 0;
 
 error:
 
@@ -1570,9 +1712,7 @@ error:
 
    pgmoneta_disconnect(client_fd);
 
-   pgmoneta_stop_logging();
-
-   exit(1);
+   return 1;
 }
 
 void
@@ -1776,6 +1916,79 @@ error:
    exit(1);
 }
 
+int
+pgmoneta_backup_file_final_name(char* file, int encryption, int compression, char** finalname)
+{
+   char* final = NULL;
+
+   *finalname = NULL;
+   if (file == NULL)
+   {
+      goto error;
+   }
+
+   final = pgmoneta_append(final, file);
+   if (compression == COMPRESSION_CLIENT_GZIP || compression == COMPRESSION_SERVER_GZIP)
+   {
+      final = pgmoneta_append(final, ".gz");
+   }
+   else if (compression == COMPRESSION_CLIENT_ZSTD || compression == COMPRESSION_SERVER_ZSTD)
+   {
+      final = pgmoneta_append(final, ".zstd");
+   }
+   else if (compression == COMPRESSION_CLIENT_LZ4 || compression == COMPRESSION_SERVER_LZ4)
+   {
+      final = pgmoneta_append(final, ".lz4");
+   }
+   else if (compression == COMPRESSION_CLIENT_BZIP2)
+   {
+      final = pgmoneta_append(final, ".bz2");
+   }
+
+   if (encryption != ENCRYPTION_NONE)
+   {
+      final = pgmoneta_append(final, ".aes");
+   }
+
+   *finalname = final;
+   return 0;
+
+error:
+   free(final);
+   return 1;
+}
+
+char*
+pgmoneta_backup_file_find(char* directory, char* name, struct backup* backup)
+{
+   char* path = NULL;
+   char* final = NULL;
+
+   path = pgmoneta_append(path, directory);
+   if (!pgmoneta_ends_with(path, "/"))
+   {
+      path = pgmoneta_append(path, "/");
+   }
+   path = pgmoneta_append(path, name);
+
+   if (pgmoneta_exists(path))
+   {
+      return path;
+   }
+
+   if (!pgmoneta_backup_file_final_name(path, backup->encryption, backup->compression, &final) &&
+       pgmoneta_exists(final))
+   {
+      free(path);
+      return final;
+   }
+
+   free(path);
+   free(final);
+
+   return NULL;
+}
+
 int
 pgmoneta_rfile_create(int server, char* label, char* relative_dir, char* base_file_name, int encryption, int compression, struct rfile** rfile)
 {
@@ -1784,6 +1997,7 @@ pgmoneta_rfile_create(int server, char* label, char* relative_dir, char* base_fi
    char* final_relative_path = NULL;
    char base_relative_path[MAX_PATH];
    FILE* fp = NULL;
+   struct zstd_seekable* seekable = NULL;
 
    memset(base_relative_path, 0, MAX_PATH);
    if (pgmoneta_ends_with(relative_dir, "/"))
@@ -1800,7 +2014,29 @@ pgmoneta_rfile_create(int server, char* label, char* relative_dir, char* base_fi
    {
       free(extracted_file_path);
       extracted_file_path = NULL;
-      file_final_name(base_relative_path, encryption, compression, &final_relative_path);
+      pgmoneta_backup_file_final_name(base_relative_path, encryption, compression, &final_relative_path);
+
+      // a Zstandard file with a seek table is read in place
+      if (pgmoneta_ends_with(final_relative_path, ".zstd") &&
+          !rfile_open_seekable(server, label, final_relative_path, &seekable, &extracted_file_path))
+      {
+         rf = (struct rfile*) malloc(sizeof(struct rfile));
+         if (rf == NULL)
+         {
+            pgmoneta_zstandardd_seekable_close(seekable);
+            goto error;
+         }
+         memset(rf, 0, sizeof(struct rfile));
+
+         // the file path is the backup file itself, so it is never deleted
+         rf->filepath = extracted_file_path;
+         rf->seekable = seekable;
+         *rfile = rf;
+
+         free(final_relative_path);
+         return 0;
+      }
+
       if (pgmoneta_extract_backup_file(server, label, final_relative_path, NULL, &extracted_file_path))
       {
          goto error;
@@ -1840,7 +2076,11 @@ pgmoneta_rfile_destroy(struct rfile* rf)
    {
       fclose(rf->fp);
    }
-   if (rf->filepath != NULL)
+   if (rf->seekable != NULL)
+   {
+      pgmoneta_zstandardd_seekable_close(rf->seekable);
+   }
+   if (rf->filepath != NULL && rf->seekable == NULL)
    {
       // this is the extracted file, we should delete it
       pgmoneta_delete_file(rf->filepath, NULL);
@@ -1851,6 +2091,88 @@ pgmoneta_rfile_destroy(struct rfile* rf)
    free(rf);
 }
 
+size_t
+pgmoneta_rfile_read(struct rfile* rf, void* buffer, size_t size)
+{
+   size_t nread = 0;
+
+   if (rf->seekable != NULL)
+   {
+      nread = pgmoneta_zstandardd_seekable_read(rf->seekable, rf->position, buffer, size);
+      rf->position += nread;
+      return nread;
+   }
+
+   return fread(buffer, 1, size, rf->fp);
+}
+
+size_t
+pgmoneta_rfile_size(struct rfile* rf)
+{
+   if (rf->seekable != NULL)
+   {
+      return (size_t)rf->seekable->decompressed_offsets[rf->seekable->number_of_frames];
+   }
+
+   return pgmoneta_get_file_size(rf->filepath);
+}
+
+int
+pgmoneta_rfile_seek(struct rfile* rf, off_t offset)
+{
+   if (rf->seekable != NULL)
+   {
+      rf->position = (uint64_t)offset;
+      return 0;
+   }
+
+   return fseek(rf->fp, offset, SEEK_SET) != 0;
+}
+
+size_t
+pgmoneta_rfile_read_at(struct rfile* rf, off_t offset, void* buffer, size_t size)
+{
+   size_t nread = 0;
+   ssize_t n;
+
+   if (rf->seekable != NULL)
+   {
+      return pgmoneta_zstandardd_seekable_read(rf->seekable, (uint64_t)offset, buffer, size);
+   }
+
+   // bypass the stream buffer, pread doesn't move the file position
+   while (nread < size)
+   {
+      n = pread(fileno(rf->fp), (char*)buffer + nread, size - nread, offset + nread);
+      if (n > 0)
+      {
+         nread += n;
+      }
+      else if (n == 0 || errno != EINTR)
+      {
+         break;
+      }
+   }
+
+   return nread;
+}
+
+void
+pgmoneta_rfile_prefetch(struct rfile* rf, off_t offset, size_t size)
+{
+   if (rf == NULL || rf->seekable != NULL || rf->fp == NULL)
+   {
+      return;
+   }
+
+#if defined(HAVE_LINUX) || defined(HAVE_FREEBSD)
+   posix_fadvise(fileno(rf->fp), offset, (off_t)size, POSIX_FADV_WILLNEED);
+#else
+   (void)offset;
+   (void)size;
+#endif
+}
+
 int
 pgmoneta_incremental_rfile_initialize(int server, char* label, char* relative_dir, char* base_file_name, int encryption, int compression, struct rfile** rfile)
 {
@@ -1882,21 +2204,22 @@ pgmoneta_incremental_rfile_initialize(int server, char* label, char* relative_di
    }
 
    // read magic number from header
-   nread = fread(&magic, 1, sizeof(uint32_t), rf->fp);
+   nread = pgmoneta_rfile_read(rf, &magic, sizeof(uint32_t));
    if (nread != sizeof(uint32_t))
    {
       pgmoneta_log_error("rfile initialize: incomplete file header at %s, cannot read magic number", rf->filepath);
       goto error;
    }
 
-   if (magic != INCREMENTAL_MAGIC)
+   if (magic != INCREMENTAL_MAGIC && magic != INCREMENTAL_DELTA_MAGIC)
    {
       pgmoneta_log_error("rfile initialize: incorrect magic number, getting %X, expecting %X", magic, INCREMENTAL_MAGIC);
       goto error;
    }
+   rf->delta = magic == INCREMENTAL_DELTA_MAGIC;
 
    // read number of blocks
-   nread = fread(&rf->num_blocks, 1, sizeof(uint32_t), rf->fp);
+   nread = pgmoneta_rfile_read(rf, &rf->num_blocks, sizeof(uint32_t));
    if (nread != sizeof(uint32_t))
    {
       pgmoneta_log_error("rfile initialize: incomplete file header at %s%s, cannot read block count", relative_dir, base_file_name);
@@ -1909,7 +2232,7 @@ pgmoneta_incremental_rfile_initialize(int server, char* label, char* relative_di
    }
 
    // read truncation block length
-   nread = fread(&rf->truncation_block_length, 1, sizeof(uint32_t), rf->fp);
+   nread = pgmoneta_rfile_read(rf, &rf->truncation_block_length, sizeof(uint32_t));
    if (nread != sizeof(uint32_t))
    {
       pgmoneta_log_error("rfile initialize: incomplete file header at %s%s, cannot read truncation block length", relative_dir, base_file_name);
@@ -1924,7 +2247,7 @@ pgmoneta_incremental_rfile_initialize(int server, char* label, char* relative_di
    if (rf->num_blocks > 0)
    {
       rf->relative_block_numbers = malloc(sizeof(uint32_t) * rf->num_blocks);
-      nread = fread(rf->relative_block_numbers, sizeof(uint32_t), rf->num_blocks, rf->fp);
+      nread = pgmoneta_rfile_read(rf, rf->relative_block_numbers, sizeof(uint32_t) * rf->num_blocks) / sizeof(uint32_t);
       if (nread != rf->num_blocks)
       {
          pgmoneta_log_error("rfile initialize: incomplete file header at %s, cannot read relative block numbers", rf->filepath);
@@ -1954,6 +2277,7 @@ pgmoneta_extract_backup_file(int server, char* label, char* relative_file_path,
 {
    char* from = NULL;
    char* to = NULL;
+   char* plain = NULL;
 
    *target_file = NULL;
 
@@ -1983,51 +2307,19 @@ pgmoneta_extract_backup_file(int server, char* label, char* relative_file_path,
 
    if (!pgmoneta_ends_with(to, "/"))
    {
-      from = pgmoneta_append_char(to, '/');
+      to = pgmoneta_append_char(to, '/');
    }
-   to = pgmoneta_append(to, relative_file_path);
 
-   if (pgmoneta_copy_file(from, to, NULL))
+   /* Decrypt and decompress in one pass, without intermediate files */
+   if (pgmoneta_reader_plain_name(relative_file_path, &plain))
    {
       goto error;
    }
+   to = pgmoneta_append(to, plain);
 
-   if (pgmoneta_is_encrypted(to))
-   {
-      char* new_to = NULL;
-
-      if (pgmoneta_strip_extension(to, &new_to))
-      {
-         goto error;
-      }
-
-      if (pgmoneta_decrypt_file(to, new_to))
-      {
-         free(new_to);
-         goto error;
-      }
-
-      free(to);
-      to = new_to;
-   }
-
-   if (pgmoneta_is_compressed(to))
+   if (pgmoneta_reader_copy(from, to))
    {
-      char* new_to = NULL;
-
-      if (pgmoneta_strip_extension(to, &new_to))
-      {
-         goto error;
-      }
-
-      if (pgmoneta_decompress(to, new_to))
-      {
-         free(new_to);
-         goto error;
-      }
-
-      free(to);
-      to = new_to;
+      goto error;
    }
 
    pgmoneta_log_trace("Extract: %s -> %s", from, to);
@@ -2035,6 +2327,7 @@ pgmoneta_extract_backup_file(int server, char* label, char* relative_file_path,
    *target_file = to;
 
    free(from);
+   free(plain);
 
    return 0;
 
@@ -2042,6 +2335,7 @@ error:
 
    free(from);
    free(to);
+   free(plain);
 
    return 1;
 }
@@ -2049,58 +2343,94 @@ error:
 int
 pgmoneta_backup_size(int server, char* label, unsigned long* size, uint64_t* biggest_file_size)
 {
-   struct json* manifest_read = NULL;
-   struct json* files = NULL;
-   struct main_configuration* config = NULL;
-   struct json_iterator *iter = NULL;
+   struct json_handler handler;
+   struct backup_size_state state;
    char* manifest_path = NULL;
-   unsigned long sz = 0;
-   uint64_t biggest_file_sz = 0;
 
-   config = (struct main_configuration*)shmem;
-
-   // read and traverse the manifest of the incremental backup
+   // stream the manifest of the backup, only one file entry is kept in memory
    manifest_path = pgmoneta_get_server_backup_identifier_data(server, label);
    manifest_path = pgmoneta_append(manifest_path, "backup_manifest");
-   if (pgmoneta_json_read_file(manifest_path, &manifest_read))
+
+   memset(&state, 0, sizeof(struct backup_size_state));
+   state.server = server;
+   state.label = label;
+
+   memset(&handler, 0, sizeof(struct json_handler));
+   handler.item_start = backup_size_item_start;
+   handler.item_end = backup_size_item_end;
+   handler.array_start = backup_size_array_start;
+   handler.array_end = backup_size_array_end;
+   handler.value = backup_size_value;
+
+   if (pgmoneta_json_stream(manifest_path, &handler, &state))
    {
       pgmoneta_log_error("Unable to read manifest %s", manifest_path);
       goto error;
    }
 
-   files = (struct json*)pgmoneta_json_get(manifest_read, MANIFEST_FILES);
-
-   if (files == NULL)
+   if (!state.found)
    {
       goto error;
    }
 
-   pgmoneta_json_iterator_create(files, &iter);
-   while (pgmoneta_json_iterator_next(iter))
+   *size = state.size;
+   *biggest_file_size = state.biggest_file_size;
+
+   free(state.path);
+   free(manifest_path);
+   return 0;
+
+error:
+   free(state.path);
+   free(manifest_path);
+   return 1;
+}
+
+static int
+backup_size_item_start(void* data, char* key __attribute__((unused)))
+{
+   struct backup_size_state* state = (struct backup_size_state*)data;
+
+   state->depth++;
+   if (state->in_files && state->depth == 3)
    {
-      struct json* file = NULL;
-      char* file_path = NULL;
-      uint64_t file_size = 0;
+      free(state->path);
+      state->path = NULL;
+      state->file_size = 0;
+   }
+   return 0;
+}
+
+static int
+backup_size_item_end(void* data)
+{
+   struct backup_size_state* state = (struct backup_size_state*)data;
+   struct main_configuration* config = NULL;
+   uint64_t file_size = 0;
+
+   config = (struct main_configuration*)shmem;
 
-      file = (struct json*)pgmoneta_value_data(iter->value);
-      file_path = (char*)pgmoneta_json_get(file, "Path");
+   if (state->in_files && state->depth == 3)
+   {
       /* for incremental files get the `truncated_block_length` */
-      if (pgmoneta_is_incremental_path(file_path))
-      {  
+      if (pgmoneta_is_incremental_path(state->path))
+      {
          struct rfile* rf = NULL;
          uint32_t block_length = 0;
          char* relative_path = NULL;
          char* bare_file_name = NULL;
 
-         if (split_file_path(file_path, &relative_path, &bare_file_name))
+         if (split_file_path(state->path, &relative_path, &bare_file_name))
          {
-            pgmoneta_log_error("Unable to split file path %s", file_path);
+            pgmoneta_log_error("Unable to split file path %s", state->path);
             goto error;
          }
 
-         if (pgmoneta_incremental_rfile_initialize(server, label, relative_path, bare_file_name, ENCRYPTION_NONE, COMPRESSION_NONE, &rf))
+         if (pgmoneta_incremental_rfile_initialize(state->server, state->label, relative_path, bare_file_name, ENCRYPTION_NONE, COMPRESSION_NONE, &rf))
          {
             pgmoneta_log_error("Unable to create rfile %s", bare_file_name);
+            free(relative_path);
+            free(bare_file_name);
             goto error;
          }
          block_length = rf->truncation_block_length;
@@ -2115,9 +2445,12 @@ pgmoneta_backup_size(int server, char* label, unsigned long* size, uint64_t* big
          if (block_length == 0)
          {
             pgmoneta_log_error("Unable to find block length for %s", bare_file_name);
+            pgmoneta_rfile_destroy(rf);
+            free(relative_path);
+            free(bare_file_name);
             goto error;
          }
-         file_size = block_length * config->common.servers[server].block_size;
+         file_size = block_length * config->common.servers[state->server].block_size;
          pgmoneta_rfile_destroy(rf);
          free(relative_path);
          free(bare_file_name);
@@ -2125,76 +2458,108 @@ pgmoneta_backup_size(int server, char* label, unsigned long* size, uint64_t* big
       /* for non-incremental files get the file size from manifest itself */
       else
       {
-         file_size = (uint64_t)pgmoneta_json_get(file, "Size");
+         file_size = state->file_size;
       }
 
-      if (file_size > biggest_file_sz)
+      if (file_size > state->biggest_file_size)
       {
-         biggest_file_sz = file_size;
+         state->biggest_file_size = file_size;
       }
-      sz += file_size;
+      state->size += file_size;
    }
-   pgmoneta_json_iterator_destroy(iter);
-
-   *size = sz;
-   *biggest_file_size = biggest_file_sz;
 
-   pgmoneta_json_destroy(manifest_read);
-   free(manifest_path);
+   state->depth--;
    return 0;
 
 error:
-   pgmoneta_json_destroy(manifest_read);
-   free(manifest_path);
    return 1;
 }
 
 static int
-file_final_name(char* file, int encryption, int compression, char** finalname)
+backup_size_array_start(void* data, char* key)
 {
-   char* final = NULL;
+   struct backup_size_state* state = (struct backup_size_state*)data;
 
-   *finalname = NULL;
-   if (file == NULL)
+   state->depth++;
+   if (state->depth == 2 && pgmoneta_compare_string(key, MANIFEST_FILES))
    {
-      goto error;
+      state->in_files = true;
+      state->found = true;
    }
+   return 0;
+}
 
-   final = pgmoneta_append(final, file);
-   if (compression == COMPRESSION_CLIENT_GZIP || compression == COMPRESSION_SERVER_GZIP)
-   {
-      final = pgmoneta_append(final, ".gz");
-   }
-   else if (compression == COMPRESSION_CLIENT_ZSTD || compression == COMPRESSION_SERVER_ZSTD)
+static int
+backup_size_array_end(void* data)
+{
+   struct backup_size_state* state = (struct backup_size_state*)data;
+
+   if (state->depth == 2)
    {
-      final = pgmoneta_append(final, ".zstd");
+      state->in_files = false;
    }
-   else if (compression == COMPRESSION_CLIENT_LZ4 || compression == COMPRESSION_SERVER_LZ4)
+   state->depth--;
+   return 0;
+}
+
+static int
+backup_size_value(void* data, char* key, uintptr_t value, enum value_type type)
+{
+   struct backup_size_state* state = (struct backup_size_state*)data;
+
+   if (!state->in_files || state->depth != 3 || key == NULL)
    {
-      final = pgmoneta_append(final, ".lz4");
+      return 0;
    }
-   else if (compression == COMPRESSION_CLIENT_BZIP2)
+
+   if (!strcmp(key, "Path") && type == ValueString && value != 0)
    {
-      final = pgmoneta_append(final, ".bz2");
+      free(state->path);
+      state->path = pgmoneta_append(NULL, (char*)value);
    }
-
-   if (encryption != ENCRYPTION_NONE)
+   else if (!strcmp(key, "Size") && type == ValueInt64)
    {
-      final = pgmoneta_append(final, ".aes");
+      state->file_size = (uint64_t)value;
    }
-
-   *finalname = final;
    return 0;
-
-   error:
-      free(final);
-   return 1;
 }
 
 static int
-split_file_path(char* path, char** relative_path, char** bare_file_name)
+rfile_open_seekable(int server, char* label, char* relative_file_path, struct zstd_seekable** seekable, char** file_path)
 {
-   int relative_path_len = 0;
+   char* path = NULL;
+   int ret = 1;
+
+   *seekable = NULL;
+   *file_path = NULL;
+
+   path = pgmoneta_get_server_backup_identifier_data(server, label);
+   if (!pgmoneta_ends_with(path, "/"))
+   {
+      path = pgmoneta_append_char(path, '/');
+   }
+   path = pgmoneta_append(path, relative_file_path);
+
+   if (pgmoneta_exists(path))
+   {
+      ret = pgmoneta_zstandardd_seekable_open(path, seekable);
+   }
+
+   if (ret)
+   {
+      free(path);
+      path = NULL;
+   }
+
+   *file_path = path;
+
+   return ret;
+}
+
+static int
+split_file_path(char* path, char** relative_path, char** bare_file_name)
+{
+   int relative_path_len = 0;
    
    char* path_copy = NULL;
    char* rel_path = NULL;
@@ -2236,3 +2601,438 @@ error:
    free(path_copy);
    return 1;
 }
+
+static int
+info_find(struct info_batch* batch, char* key)
+{
+   for (int i = 0; i < batch->number_of_entries; i++)
+   {
+      if (!strcmp(batch->keys[i], key))
+      {
+         return i;
+      }
+   }
+
+   return -1;
+}
+
+static void
+info_set(struct info_batch* batch, char* key, char* value)
+{
+   int index;
+   int size;
+   char* v = NULL;
+   char** keys = NULL;
+   char** values = NULL;
+
+   if (batch == NULL || batch->failed)
+   {
+      return;
+   }
+
+   pgmoneta_log_trace("%s=%s", key, value);
+
+   v = strdup(value);
+   if (v == NULL)
+   {
+      goto error;
+   }
+
+   index = info_find(batch, key);
+   if (index >= 0)
+   {
+      free(batch->values[index]);
+      batch->values[index] = v;
+      return;
+   }
+
+   if (batch->number_of_entries == batch->size)
+   {
+      size = batch->size == 0 ? 32 : batch->size * 2;
+
+      keys = (char**)realloc(batch->keys, size * sizeof(char*));
+      if (keys == NULL)
+      {
+         goto error;
+      }
+      batch->keys = keys;
+
+      values = (char**)realloc(batch->values, size * sizeof(char*));
+      if (values == NULL)
+      {
+         goto error;
+      }
+      batch->values = values;
+
+      batch->size = size;
+   }
+
+   batch->keys[batch->number_of_entries] = strdup(key);
+   if (batch->keys[batch->number_of_entries] == NULL)
+   {
+      goto error;
+   }
+   batch->values[batch->number_of_entries] = v;
+   batch->number_of_entries++;
+
+   return;
+
+error:
+
+   free(v);
+   batch->failed = true;
+}
+
+static char*
+catalog_path(char* directory)
+{
+   char* path = NULL;
+   size_t length;
+
+   path = pgmoneta_append(path, directory);
+   if (path == NULL)
+   {
+      return NULL;
+   }
+
+   /* The catalog lives next to the directory, writing it must not touch the directory itself */
+   length = strlen(path);
+   while (length > 1 && path[length - 1] == '/')
+   {
+      path[--length] = '\0';
+   }
+
+   path = pgmoneta_append(path, ".catalog");
+
+   return path;
+}
+
+static int
+catalog_read(char* directory, int* number_of_backups, struct backup*** backups)
+{
+   char* path = NULL;
+   int fd = -1;
+   void* data = MAP_FAILED;
+   size_t size = 0;
+   struct stat st;
+   struct stat cst;
+   struct catalog_header* header = NULL;
+   struct backup** bcks = NULL;
+   size_t offset = 0;
+   size_t consumed = 0;
+   int n = 0;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (config == NULL)
+   {
+      goto error;
+   }
+
+   if (stat(directory, &st))
+   {
+      goto error;
+   }
+
+   path = catalog_path(directory);
+   if (path == NULL)
+   {
+      goto error;
+   }
+
+   fd = open(path, O_RDONLY);
+   if (fd == -1)
+   {
+      goto error;
+   }
+
+   if (fstat(fd, &cst) || (size_t)cst.st_size < sizeof(struct catalog_header))
+   {
+      goto error;
+   }
+
+   size = (size_t)cst.st_size;
+   data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+   if (data == MAP_FAILED)
+   {
+      goto error;
+   }
+
+   header = (struct catalog_header*)data;
+
+   if (header->magic != CATALOG_MAGIC ||
+       header->version != CATALOG_VERSION ||
+       header->record_size != sizeof(struct backup) ||
+       header->generation != atomic_load(&config->backup_generation) ||
+       header->mtime_sec != (int64_t)st.st_mtim.tv_sec ||
+       header->mtime_nsec != (int64_t)st.st_mtim.tv_nsec ||
+       header->number_of_backups > (uint64_t)INT32_MAX)
+   {
+      goto error;
+   }
+
+   n = (int)header->number_of_backups;
+
+   bcks = (struct backup**)calloc(n > 0 ? n : 1, sizeof(struct backup*));
+   if (bcks == NULL)
+   {
+      goto error;
+   }
+
+   offset = sizeof(struct catalog_header);
+
+   for (int i = 0; i < n; i++)
+   {
+      bcks[i] = (struct backup*)malloc(sizeof(struct backup));
+      if (bcks[i] == NULL)
+      {
+         goto error;
+      }
+
+      if (catalog_decode((char*)data + offset, size - offset, bcks[i], &consumed))
+      {
+         goto error;
+      }
+
+      offset += consumed;
+   }
+
+   if (offset != size)
+   {
+      goto error;
+   }
+
+   munmap(data, size);
+   close(fd);
+   free(path);
+
+   *number_of_backups = n;
+   *backups = bcks;
+
+   return 0;
+
+error:
+
+   if (bcks != NULL)
+   {
+      for (int i = 0; i < n; i++)
+      {
+         free(bcks[i]);
+      }
+      free(bcks);
+   }
+
+   if (data != MAP_FAILED)
+   {
+      munmap(data, size);
+   }
+
+   if (fd != -1)
+   {
+      close(fd);
+   }
+
+   free(path);
+
+   return 1;
+}
+
+static int
+catalog_write(char* directory, unsigned long generation, struct stat* st, int number_of_backups, struct backup** backups)
+{
+   char* path = NULL;
+   char* tmp = NULL;
+   int fd = -1;
+   FILE* file = NULL;
+   struct catalog_header header;
+
+   path = catalog_path(directory);
+   if (path == NULL)
+   {
+      goto error;
+   }
+
+   tmp = pgmoneta_append(tmp, path);
+   tmp = pgmoneta_append(tmp, ".XXXXXX");
+   if (tmp == NULL)
+   {
+      goto error;
+   }
+
+   fd = mkstemp(tmp);
+   if (fd == -1)
+   {
+      goto error;
+   }
+
+   file = fdopen(fd, "w");
+   if (file == NULL)
+   {
+      goto error;
+   }
+   fd = -1;
+
+   memset(&header, 0, sizeof(struct catalog_header));
+   header.magic = CATALOG_MAGIC;
+   header.version = CATALOG_VERSION;
+   header.record_size = sizeof(struct backup);
+   header.generation = generation;
+   header.mtime_sec = (int64_t)st->st_mtim.tv_sec;
+   header.mtime_nsec = (int64_t)st->st_mtim.tv_nsec;
+   header.number_of_backups = (uint64_t)number_of_backups;
+
+   if (fwrite(&header, sizeof(struct catalog_header), 1, file) != 1)
+   {
+      goto error;
+   }
+
+   for (int i = 0; i < number_of_backups; i++)
+   {
+      if (catalog_encode(backups[i], file))
+      {
+         goto error;
+      }
+   }
+
+   if (fclose(file))
+   {
+      file = NULL;
+      goto error;
+   }
+   file = NULL;
+
+   /* Readers either see the old catalog or the complete new one */
+   if (rename(tmp, path))
+   {
+      goto error;
+   }
+
+   free(path);
+   free(tmp);
+
+   return 0;
+
+error:
+
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+
+   if (fd != -1)
+   {
+      close(fd);
+   }
+
+   if (tmp != NULL)
+   {
+      unlink(tmp);
+   }
+
+   errno = 0;
+
+   free(path);
+   free(tmp);
+
+   return 1;
+}
+
+static int
+catalog_encode(struct backup* backup, FILE* file)
+{
+   unsigned char* data = (unsigned char*)backup;
+   size_t size = sizeof(struct backup);
+   size_t i = 0;
+   size_t start;
+   size_t zeros;
+   struct catalog_token token;
+
+   while (i < size)
+   {
+      start = i;
+      while (i < size && i - start < UINT16_MAX && data[i] == 0)
+      {
+         i++;
+      }
+      token.zeros = (uint16_t)(i - start);
+
+      /* Literals end at a run of zeros that is worth a token of its own */
+      start = i;
+      zeros = 0;
+      while (i < size && i - start < UINT16_MAX && zeros < sizeof(struct catalog_token))
+      {
+         zeros = data[i] == 0 ? zeros + 1 : 0;
+         i++;
+      }
+      if (zeros > 0)
+      {
+         i -= zeros;
+      }
+      token.literal = (uint16_t)(i - start);
+
+      if (fwrite(&token, sizeof(struct catalog_token), 1, file) != 1)
+      {
+         goto error;
+      }
+
+      if (token.literal > 0 && fwrite(data + start, 1, token.literal, file) != token.literal)
+      {
+         goto error;
+      }
+   }
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+static int
+catalog_decode(char* data, size_t size, struct backup* backup, size_t* consumed)
+{
+   char* b = (char*)backup;
+   size_t position = 0;
+   size_t offset = 0;
+   struct catalog_token token;
+
+   *consumed = 0;
+
+   memset(backup, 0, sizeof(struct backup));
+
+   while (position < sizeof(struct backup))
+   {
+      if (size - offset < sizeof(struct catalog_token))
+      {
+         goto error;
+      }
+
+      memcpy(&token, data + offset, sizeof(struct catalog_token));
+      offset += sizeof(struct catalog_token);
+
+      if (token.zeros == 0 && token.literal == 0)
+      {
+         goto error;
+      }
+
+      if (position + token.zeros + token.literal > sizeof(struct backup) ||
+          size - offset < token.literal)
+      {
+         goto error;
+      }
+
+      position += token.zeros;
+      memcpy(b + position, data + offset, token.literal);
+      position += token.literal;
+      offset += token.literal;
+   }
+
+   *consumed = offset;
+
+   return 0;
+
+error:
+
+   return 1;
+}
@@ -0,0 +1,279 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <pgmoneta.h>
+#include <art.h>
+#include <journal.h>
+#include <logging.h>
+#include <utils.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static int journal_read(struct journal* journal, bool* torn);
+
+int
+pgmoneta_journal_open(char* directory, char* name, struct journal** journal)
+{
+   bool torn = false;
+   struct journal* j = NULL;
+
+   *journal = NULL;
+
+   j = (struct journal*)calloc(1, sizeof(struct journal));
+   if (j == NULL)
+   {
+      goto error;
+   }
+
+   pthread_mutex_init(&j->lock, NULL);
+
+   if (pgmoneta_ends_with(directory, "/"))
+   {
+      snprintf(j->path, sizeof(j->path), "%s%s%s", directory, name, JOURNAL_SUFFIX);
+   }
+   else
+   {
+      snprintf(j->path, sizeof(j->path), "%s/%s%s", directory, name, JOURNAL_SUFFIX);
+   }
+
+   if (pgmoneta_art_create(&j->entries))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_exists(j->path) && journal_read(j, &torn))
+   {
+      pgmoneta_log_warn("Journal: Could not read %s", j->path);
+      goto error;
+   }
+
+   j->file = fopen(j->path, "a");
+   if (j->file == NULL)
+   {
+      pgmoneta_log_error("Journal: Could not open %s: %s", j->path, strerror(errno));
+      goto error;
+   }
+
+   /* Start the next entry on a line of its own */
+   if (torn && fputc('\n', j->file) == EOF)
+   {
+      goto error;
+   }
+
+   if (j->entries->size > 0)
+   {
+      pgmoneta_log_debug("Journal: %s has %" PRIu64 " entries", j->path, j->entries->size);
+   }
+
+   *journal = j;
+
+   return 0;
+
+error:
+
+   pgmoneta_journal_close(j, false);
+
+   return 1;
+}
+
+char*
+pgmoneta_journal_get(struct journal* journal, char* key)
+{
+   char* value = NULL;
+
+   if (journal == NULL)
+   {
+      return NULL;
+   }
+
+   pthread_mutex_lock(&journal->lock);
+   value = (char*)pgmoneta_art_search(journal->entries, key);
+   pthread_mutex_unlock(&journal->lock);
+
+   return value;
+}
+
+bool
+pgmoneta_journal_contains(struct journal* journal, char* key)
+{
+   bool contains = false;
+
+   if (journal == NULL)
+   {
+      return false;
+   }
+
+   pthread_mutex_lock(&journal->lock);
+   contains = pgmoneta_art_contains_key(journal->entries, key);
+   pthread_mutex_unlock(&journal->lock);
+
+   return contains;
+}
+
+int
+pgmoneta_journal_add(struct journal* journal, char* key, char* value)
+{
+   if (journal == NULL)
+   {
+      return 0;
+   }
+
+   if (value == NULL)
+   {
+      value = "";
+   }
+
+   pthread_mutex_lock(&journal->lock);
+
+   if (pgmoneta_art_insert(journal->entries, key, (uintptr_t)value, ValueString))
+   {
+      goto error;
+   }
+
+   /* The step is only skipped by a restart once the entry is on disk */
+   if (fprintf(journal->file, "%s\t%s\n", key, value) < 0 ||
+       fflush(journal->file) != 0 ||
+       fsync(fileno(journal->file)) != 0)
+   {
+      pgmoneta_log_warn("Journal: Could not write %s: %s", journal->path, strerror(errno));
+      goto error;
+   }
+
+   pthread_mutex_unlock(&journal->lock);
+
+   return 0;
+
+error:
+
+   pthread_mutex_unlock(&journal->lock);
+
+   return 1;
+}
+
+int
+pgmoneta_journal_size(struct journal* journal)
+{
+   int size = 0;
+
+   if (journal == NULL)
+   {
+      return 0;
+   }
+
+   pthread_mutex_lock(&journal->lock);
+   size = (int)journal->entries->size;
+   pthread_mutex_unlock(&journal->lock);
+
+   return size;
+}
+
+void
+pgmoneta_journal_close(struct journal* journal, bool remove)
+{
+   if (journal == NULL)
+   {
+      return;
+   }
+
+   if (journal->file != NULL)
+   {
+      fclose(journal->file);
+   }
+
+   if (remove)
+   {
+      unlink(journal->path);
+   }
+
+   pgmoneta_art_destroy(journal->entries);
+   pthread_mutex_destroy(&journal->lock);
+
+   free(journal);
+}
+
+static int
+journal_read(struct journal* journal, bool* torn)
+{
+   FILE* file = NULL;
+   char* line = NULL;
+   size_t capacity = 0;
+   ssize_t length;
+   char* tab = NULL;
+
+   file = fopen(journal->path, "r");
+   if (file == NULL)
+   {
+      goto error;
+   }
+
+   while ((length = getline(&line, &capacity, file)) != -1)
+   {
+      /* The last line is incomplete when the writer stopped in the middle of it */
+      if (line[length - 1] != '\n')
+      {
+         *torn = true;
+         break;
+      }
+
+      line[length - 1] = '\0';
+
+      tab = strchr(line, '\t');
+      if (tab == NULL)
+      {
+         continue;
+      }
+
+      *tab = '\0';
+
+      if (pgmoneta_art_insert(journal->entries, line, (uintptr_t)(tab + 1), ValueString))
+      {
+         goto error;
+      }
+   }
+
+   free(line);
+   fclose(file);
+
+   return 0;
+
+error:
+
+   free(line);
+
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+
+   return 1;
+}
@@ -38,6 +38,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 static int advance_to_first_array_element(struct json_reader* reader);
 static int json_read(struct json_reader* reader);
@@ -48,12 +49,75 @@ static int json_stream_parse_item(struct json_reader* reader, struct json** item
 static bool type_allowed(enum value_type type);
 static char* item_to_string(struct json* item, int32_t format, char* tag, int indent);
 static char* array_to_string(struct json* array, int32_t format, char* tag, int indent);
-static int parse_string(char* str, uint64_t* index, struct json** obj);
+static int parse_string(char* str, uint64_t len, uint64_t* index, struct json** obj);
 static int json_add(struct json* obj, char* key, uintptr_t val, enum value_type type);
-static int fill_value(char* str, char* key, uint64_t* index, struct json* o);
+static int fill_value(char* str, uint64_t len, char* key, uint64_t* index, struct json* o);
 static bool value_start(char ch);
 static int handle_escape_char(char* str, uint64_t* index, uint64_t len, char* ch);
 
+/** @struct json_stream
+ * Defines the state of the streaming parser
+ */
+struct json_stream
+{
+   int fd;                       /**< The file descriptor */
+   char* buffer;                 /**< The read buffer */
+   size_t cursor;                /**< The position of the next character */
+   size_t end;                   /**< The end of the read data */
+   char* token;                  /**< The current string or number */
+   size_t token_length;          /**< The length of the current token */
+   size_t token_size;            /**< The size of the token buffer */
+   struct json_handler* handler; /**< The callbacks */
+   void* data;                   /**< The data of the callbacks */
+};
+
+static bool stream_peek(struct json_stream* s, char* ch);
+static bool stream_next(struct json_stream* s, char* ch);
+static bool stream_next_token(struct json_stream* s, char* ch);
+static void stream_token_append(struct json_stream* s, char ch);
+static int stream_string(struct json_stream* s);
+static int stream_value(struct json_stream* s, char* key, char ch, int depth);
+static int stream_item(struct json_stream* s, char* key, int depth);
+static int stream_array(struct json_stream* s, char* key, int depth);
+static int writer_separator(struct json_writer* writer, char* key, bool indent);
+static int writer_value(struct json_writer* writer, char* key, struct value* value);
+static int writer_json(struct json_writer* writer, char* key, struct json* obj);
+static int writer_item_cb(void* data, char* key, struct value* value);
+
+#define BINARY_ITEM     'I'
+#define BINARY_ARRAY    'A'
+#define BINARY_UNSIGNED 'u'
+#define BINARY_SIGNED   'i'
+#define BINARY_DOUBLE   'd'
+#define BINARY_TRUE     't'
+#define BINARY_FALSE    'f'
+#define BINARY_STRING   's'
+#define BINARY_BASE64   'b'
+#define BINARY_NULL     'n'
+
+/** @struct binary
+ * Defines a buffer for the compact binary encoding
+ */
+struct binary
+{
+   unsigned char* data; /**< The data */
+   size_t size;         /**< The size of the data */
+   size_t capacity;     /**< The capacity of the data */
+   size_t offset;       /**< The read offset */
+};
+
+static int binary_reserve(struct binary* b, size_t size);
+static int binary_byte(struct binary* b, unsigned char byte);
+static int binary_varint(struct binary* b, uint64_t v);
+static int binary_bytes(struct binary* b, char* s, size_t size);
+static int binary_value(struct binary* b, struct value* value, int depth);
+static int binary_json(struct binary* b, struct json* obj, int depth);
+static int binary_read_byte(struct binary* b, unsigned char* byte);
+static int binary_read_varint(struct binary* b, uint64_t* v);
+static int binary_read_bytes(struct binary* b, char** s);
+static int binary_read_value(struct binary* b, struct json* obj, char* key, int depth);
+static int binary_read_json(struct binary* b, struct json** obj, int depth);
+
 int
 pgmoneta_json_reader_init(char* path, struct json_reader** reader)
 {
@@ -603,12 +667,13 @@ int
 pgmoneta_json_parse_string(char* str, struct json** obj)
 {
    uint64_t idx = 0;
-   if (str == NULL || strlen(str) < 2)
+   uint64_t len = 0;
+   if (str == NULL || (len = strlen(str)) < 2)
    {
       return 1;
    }
 
-   return parse_string(str, &idx, obj);
+   return parse_string(str, len, &idx, obj);
 }
 
 int
@@ -630,14 +695,13 @@ error:
 }
 
 static int
-parse_string(char* str, uint64_t* index, struct json** obj)
+parse_string(char* str, uint64_t len, uint64_t* index, struct json** obj)
 {
    enum json_type type;
    struct json* o = NULL;
    uint64_t idx = *index;
    char ch = str[idx];
    char* key = NULL;
-   uint64_t len = strlen(str);
 
    if (ch == '{')
    {
@@ -728,7 +792,7 @@ parse_string(char* str, uint64_t* index, struct json** obj)
             goto error;
          }
          // The value
-         if (fill_value(str, key, &idx, o))
+         if (fill_value(str, len, key, &idx, o))
          {
             goto error;
          }
@@ -771,7 +835,7 @@ parse_string(char* str, uint64_t* index, struct json** obj)
             goto error;
          }
 
-         if (fill_value(str, key, &idx, o))
+         if (fill_value(str, len, key, &idx, o))
          {
             goto error;
          }
@@ -812,10 +876,9 @@ value_start(char ch)
 }
 
 static int
-fill_value(char* str, char* key, uint64_t* index, struct json* o)
+fill_value(char* str, uint64_t len, char* key, uint64_t* index, struct json* o)
 {
    uint64_t idx = *index;
-   uint64_t len = strlen(str);
    if (str[idx] == '"')
    {
       char* val = NULL;
@@ -888,7 +951,7 @@ fill_value(char* str, char* key, uint64_t* index, struct json* o)
    else if (str[idx] == '{')
    {
       struct json* val = NULL;
-      if (parse_string(str, &idx, &val))
+      if (parse_string(str, len, &idx, &val))
       {
          goto error;
       }
@@ -897,7 +960,7 @@ fill_value(char* str, char* key, uint64_t* index, struct json* o)
    else if (str[idx] == '[')
    {
       struct json* val = NULL;
-      if (parse_string(str, &idx, &val))
+      if (parse_string(str, len, &idx, &val))
       {
          goto error;
       }
@@ -1373,7 +1436,8 @@ int
 pgmoneta_json_read_file(char* path, struct json** obj)
 {
    FILE* file = NULL;
-   char buf[DEFAULT_BUFFER_SIZE];
+   struct stat st;
+   size_t n = 0;
    char* str = NULL;
    struct json* j = NULL;
 
@@ -1392,15 +1456,22 @@ pgmoneta_json_read_file(char* path, struct json** obj)
       goto error;
    }
 
-   memset(buf, 0, sizeof(buf));
+   // read the whole file at once, appending chunk by chunk is quadratic for large manifests
+   if (fstat(fileno(file), &st))
+   {
+      pgmoneta_log_error("Failed to stat json file %s", path);
+      goto error;
+   }
 
-   // save the last one for ending so that we get to use append
-   while (fread(buf, 1, DEFAULT_BUFFER_SIZE - 1, file) > 0)
+   str = malloc(st.st_size + 1);
+   if (str == NULL)
    {
-      str = pgmoneta_append(str, buf);
-      memset(buf, 0, sizeof(buf));
+      goto error;
    }
 
+   n = fread(str, 1, st.st_size, file);
+   str[n] = '\0';
+
    if (pgmoneta_json_parse_string(str, &j))
    {
       pgmoneta_log_error("Failed to parse json file %s", path);
@@ -1430,43 +1501,1220 @@ error:
 int
 pgmoneta_json_write_file(char* path, struct json* obj)
 {
-   FILE* file = NULL;
-   char* str = NULL;
+   struct json_writer* writer = NULL;
 
    if (path == NULL || obj == NULL)
    {
       goto error;
    }
 
-   file = fopen(path, "wb");
-   if (file == NULL)
+   // stream the object instead of building the whole document as a string
+   if (pgmoneta_json_writer_init(path, &writer))
+   {
+      goto error;
+   }
+
+   pgmoneta_json_writer_put_json(writer, NULL, obj);
+
+   if (pgmoneta_json_writer_close(writer))
+   {
+      pgmoneta_log_error("Failed to write json file %s", path);
+      goto error;
+   }
+
+   return 0;
+
+error:
+   return 1;
+}
+
+int
+pgmoneta_json_stream(char* path, struct json_handler* handler, void* data)
+{
+   struct json_stream s;
+   char ch = 0;
+
+   memset(&s, 0, sizeof(struct json_stream));
+   s.fd = -1;
+   s.handler = handler;
+   s.data = data;
+
+   if (path == NULL || handler == NULL)
+   {
+      goto error;
+   }
+
+   s.fd = open(path, O_RDONLY);
+   if (s.fd < 0)
+   {
+      pgmoneta_log_error("Failed to open json file %s", path);
+      goto error;
+   }
+
+   s.buffer = malloc(DEFAULT_BUFFER_SIZE);
+   if (s.buffer == NULL)
+   {
+      goto error;
+   }
+
+   if (!stream_next_token(&s, &ch) || stream_value(&s, NULL, ch, 0))
+   {
+      pgmoneta_log_error("Failed to parse json file %s", path);
+      goto error;
+   }
+
+   close(s.fd);
+   free(s.buffer);
+   free(s.token);
+   return 0;
+
+error:
+   if (s.fd >= 0)
+   {
+      close(s.fd);
+   }
+   free(s.buffer);
+   free(s.token);
+   return 1;
+}
+
+int
+pgmoneta_json_writer_init(char* path, struct json_writer** writer)
+{
+   struct json_writer* w = NULL;
+
+   *writer = NULL;
+
+   if (path == NULL)
+   {
+      goto error;
+   }
+
+   w = malloc(sizeof(struct json_writer));
+   if (w == NULL)
+   {
+      goto error;
+   }
+   memset(w, 0, sizeof(struct json_writer));
+
+   w->file = fopen(path, "wb");
+   if (w->file == NULL)
    {
       pgmoneta_log_error("Failed to create json file %s", path);
       goto error;
    }
 
-   str = pgmoneta_json_to_string(obj, FORMAT_JSON, NULL, 0);
-   if (str == NULL)
+   *writer = w;
+   return 0;
+
+error:
+   free(w);
+   return 1;
+}
+
+int
+pgmoneta_json_writer_item_start(struct json_writer* writer, char* key)
+{
+   if (writer == NULL || writer->depth >= JSON_MAX_DEPTH - 1 || writer_separator(writer, key, true))
    {
       goto error;
    }
+   fputc('{', writer->file);
+   writer->depth++;
+   writer->empty[writer->depth] = true;
+   return 0;
 
-   if (fputs(str, file) == EOF)
+error:
+   if (writer != NULL)
+   {
+      writer->error = true;
+   }
+   return 1;
+}
+
+int
+pgmoneta_json_writer_item_end(struct json_writer* writer)
+{
+   if (writer == NULL || writer->depth == 0)
+   {
+      goto error;
+   }
+   if (!writer->empty[writer->depth])
+   {
+      fprintf(writer->file, "\n%*s", (writer->depth - 1) * INDENT_PER_LEVEL, "");
+   }
+   fputc('}', writer->file);
+   writer->depth--;
+   return 0;
+
+error:
+   if (writer != NULL)
+   {
+      writer->error = true;
+   }
+   return 1;
+}
+
+int
+pgmoneta_json_writer_array_start(struct json_writer* writer, char* key)
+{
+   if (writer == NULL || writer->depth >= JSON_MAX_DEPTH - 1 || writer_separator(writer, key, true))
    {
-      pgmoneta_log_error("Failed to write json file %s", path);
       goto error;
    }
+   fputc('[', writer->file);
+   writer->depth++;
+   writer->empty[writer->depth] = true;
+   return 0;
 
-   free(str);
-   fclose(file);
+error:
+   if (writer != NULL)
+   {
+      writer->error = true;
+   }
+   return 1;
+}
+
+int
+pgmoneta_json_writer_array_end(struct json_writer* writer)
+{
+   if (writer == NULL || writer->depth == 0)
+   {
+      goto error;
+   }
+   if (!writer->empty[writer->depth])
+   {
+      fprintf(writer->file, "\n%*s", (writer->depth - 1) * INDENT_PER_LEVEL, "");
+   }
+   fputc(']', writer->file);
+   writer->depth--;
    return 0;
 
 error:
-   free(str);
-   if (file != NULL)
+   if (writer != NULL)
    {
-      fclose(file);
+      writer->error = true;
+   }
+   return 1;
+}
+
+int
+pgmoneta_json_writer_put(struct json_writer* writer, char* key, uintptr_t val, enum value_type type)
+{
+   struct value v;
+
+   if (writer == NULL)
+   {
+      return 1;
+   }
+
+   if (type == ValueJSON || type == ValueJSONRef)
+   {
+      return writer_json(writer, key, (struct json*)val);
+   }
+
+   // a reference type, so that nothing is copied or owned by the temporary value
+   pgmoneta_value_init(pgmoneta_value_to_ref(type), val, &v);
+   return writer_value(writer, key, &v);
+}
+
+int
+pgmoneta_json_writer_put_json(struct json_writer* writer, char* key, struct json* obj)
+{
+   if (writer == NULL)
+   {
+      return 1;
+   }
+   return writer_json(writer, key, obj);
+}
+
+int
+pgmoneta_json_to_binary(struct json* object, unsigned char** buffer, size_t* size)
+{
+   struct binary b;
+
+   memset(&b, 0, sizeof(struct binary));
+
+   *buffer = NULL;
+   *size = 0;
+
+   if (binary_json(&b, object, 0))
+   {
+      goto error;
+   }
+
+   *buffer = b.data;
+   *size = b.size;
+
+   return 0;
+
+error:
+   free(b.data);
+
+   return 1;
+}
+
+int
+pgmoneta_json_from_binary(unsigned char* buffer, size_t size, struct json** object)
+{
+   struct binary b;
+   struct json* o = NULL;
+
+   *object = NULL;
+
+   memset(&b, 0, sizeof(struct binary));
+   b.data = buffer;
+   b.size = size;
+
+   if (binary_read_json(&b, &o, 0))
+   {
+      goto error;
+   }
+
+   if (b.offset != b.size)
+   {
+      goto error;
+   }
+
+   *object = o;
+
+   return 0;
+
+error:
+   pgmoneta_json_destroy(o);
+
+   return 1;
+}
+
+int
+pgmoneta_json_writer_close(struct json_writer* writer)
+{
+   bool error = false;
+
+   if (writer == NULL)
+   {
+      return 1;
+   }
+
+   error = writer->error || writer->depth != 0;
+
+   if (ferror(writer->file))
+   {
+      error = true;
+   }
+   if (fclose(writer->file))
+   {
+      error = true;
+   }
+   free(writer);
+
+   return error ? 1 : 0;
+}
+
+static bool
+stream_peek(struct json_stream* s, char* ch)
+{
+   ssize_t n = 0;
+
+   if (s->cursor == s->end)
+   {
+      n = read(s->fd, s->buffer, DEFAULT_BUFFER_SIZE);
+      if (n <= 0)
+      {
+         return false;
+      }
+      s->cursor = 0;
+      s->end = (size_t)n;
+   }
+   *ch = s->buffer[s->cursor];
+   return true;
+}
+
+static bool
+stream_next(struct json_stream* s, char* ch)
+{
+   if (!stream_peek(s, ch))
+   {
+      return false;
+   }
+   s->cursor++;
+   return true;
+}
+
+static bool
+stream_next_token(struct json_stream* s, char* ch)
+{
+   while (stream_next(s, ch))
+   {
+      if (!isspace((unsigned char)*ch))
+      {
+         return true;
+      }
+   }
+   return false;
+}
+
+static void
+stream_token_append(struct json_stream* s, char ch)
+{
+   if (s->token_length + 1 >= s->token_size)
+   {
+      s->token_size = s->token_size == 0 ? MISC_LENGTH : s->token_size * 2;
+      s->token = realloc(s->token, s->token_size);
    }
+   s->token[s->token_length++] = ch;
+   s->token[s->token_length] = '\0';
+}
+
+static int
+stream_string(struct json_stream* s)
+{
+   char ch = 0;
+   char hex[5];
+   unsigned int code = 0;
+
+   s->token_length = 0;
+   stream_token_append(s, '\0');
+   s->token_length = 0;
+
+   while (stream_next(s, &ch))
+   {
+      if (ch == '"')
+      {
+         return 0;
+      }
+      if (ch != '\\')
+      {
+         stream_token_append(s, ch);
+         continue;
+      }
+      if (!stream_next(s, &ch))
+      {
+         goto error;
+      }
+      switch (ch)
+      {
+         case '"':
+         case '\\':
+         case '/':
+            stream_token_append(s, ch);
+            break;
+         case 'b':
+            stream_token_append(s, '\b');
+            break;
+         case 'f':
+            stream_token_append(s, '\f');
+            break;
+         case 'n':
+            stream_token_append(s, '\n');
+            break;
+         case 'r':
+            stream_token_append(s, '\r');
+            break;
+         case 't':
+            stream_token_append(s, '\t');
+            break;
+         case 'u':
+            for (int i = 0; i < 4; i++)
+            {
+               if (!stream_next(s, &hex[i]) || !isxdigit((unsigned char)hex[i]))
+               {
+                  goto error;
+               }
+            }
+            hex[4] = '\0';
+            code = (unsigned int)strtoul(hex, NULL, 16);
+            // encode as UTF-8, surrogate pairs are not combined
+            if (code < 0x80)
+            {
+               stream_token_append(s, (char)code);
+            }
+            else if (code < 0x800)
+            {
+               stream_token_append(s, (char)(0xC0 | (code >> 6)));
+               stream_token_append(s, (char)(0x80 | (code & 0x3F)));
+            }
+            else
+            {
+               stream_token_append(s, (char)(0xE0 | (code >> 12)));
+               stream_token_append(s, (char)(0x80 | ((code >> 6) & 0x3F)));
+               stream_token_append(s, (char)(0x80 | (code & 0x3F)));
+            }
+            break;
+         default:
+            goto error;
+      }
+   }
+
+error:
+   return 1;
+}
+
+static int
+stream_value(struct json_stream* s, char* key, char ch, int depth)
+{
+   struct json_handler* h = s->handler;
+
+   if (ch == '{')
+   {
+      return stream_item(s, key, depth + 1);
+   }
+   else if (ch == '[')
+   {
+      return stream_array(s, key, depth + 1);
+   }
+   else if (ch == '"')
+   {
+      if (stream_string(s))
+      {
+         goto error;
+      }
+      return h->value != NULL ? h->value(s->data, key, (uintptr_t)s->token, ValueString) : 0;
+   }
+   else if (ch == '-' || ch == '+' || isdigit((unsigned char)ch))
+   {
+      bool is_double = false;
+      char* end = NULL;
+
+      s->token_length = 0;
+      stream_token_append(s, ch);
+      while (stream_peek(s, &ch) && (isdigit((unsigned char)ch) || ch == '.' || ch == '-' || ch == '+' || ch == 'e' || ch == 'E'))
+      {
+         if (ch == '.' || ch == 'e' || ch == 'E')
+         {
+            is_double = true;
+         }
+         stream_token_append(s, ch);
+         s->cursor++;
+      }
+      errno = 0;
+      if (is_double)
+      {
+         double val = strtod(s->token, &end);
+         if (errno != 0 || *end != '\0')
+         {
+            goto error;
+         }
+         return h->value != NULL ? h->value(s->data, key, pgmoneta_value_from_double(val), ValueDouble) : 0;
+      }
+      else
+      {
+         int64_t val = strtoll(s->token, &end, 10);
+         if (errno != 0 || *end != '\0')
+         {
+            goto error;
+         }
+         return h->value != NULL ? h->value(s->data, key, (uintptr_t)val, ValueInt64) : 0;
+      }
+   }
+   else if (ch == 'n' || ch == 't' || ch == 'f')
+   {
+      s->token_length = 0;
+      stream_token_append(s, ch);
+      while (stream_peek(s, &ch) && ch >= 'a' && ch <= 'z')
+      {
+         stream_token_append(s, ch);
+         s->cursor++;
+      }
+      if (!strcmp(s->token, "null"))
+      {
+         return h->value != NULL ? h->value(s->data, key, 0, ValueString) : 0;
+      }
+      else if (!strcmp(s->token, "true"))
+      {
+         return h->value != NULL ? h->value(s->data, key, true, ValueBool) : 0;
+      }
+      else if (!strcmp(s->token, "false"))
+      {
+         return h->value != NULL ? h->value(s->data, key, false, ValueBool) : 0;
+      }
+   }
+
+error:
+   return 1;
+}
+
+static int
+stream_item(struct json_stream* s, char* key, int depth)
+{
+   struct json_handler* h = s->handler;
+   char* k = NULL;
+   size_t k_size = 0;
+   char ch = 0;
+
+   if (depth > JSON_MAX_DEPTH)
+   {
+      goto error;
+   }
+
+   if (h->item_start != NULL && h->item_start(s->data, key))
+   {
+      goto error;
+   }
+
+   if (!stream_next_token(s, &ch))
+   {
+      goto error;
+   }
+
+   while (ch != '}')
+   {
+      if (ch != '"' || stream_string(s))
+      {
+         goto error;
+      }
+      // the token buffer is reused for the value, so keep the key aside
+      if (s->token_length + 1 > k_size)
+      {
+         k_size = s->token_length + 1;
+         k = realloc(k, k_size);
+      }
+      memcpy(k, s->token, s->token_length + 1);
+
+      if (!stream_next_token(s, &ch) || ch != ':' || !stream_next_token(s, &ch))
+      {
+         goto error;
+      }
+      if (stream_value(s, k, ch, depth))
+      {
+         goto error;
+      }
+      if (!stream_next_token(s, &ch))
+      {
+         goto error;
+      }
+      if (ch == ',')
+      {
+         if (!stream_next_token(s, &ch))
+         {
+            goto error;
+         }
+      }
+      else if (ch != '}')
+      {
+         goto error;
+      }
+   }
+
+   free(k);
+
+   if (h->item_end != NULL && h->item_end(s->data))
+   {
+      goto error;
+   }
+
+   return 0;
+
+error:
+   free(k);
+   return 1;
+}
+
+static int
+stream_array(struct json_stream* s, char* key, int depth)
+{
+   struct json_handler* h = s->handler;
+   char ch = 0;
+
+   if (depth > JSON_MAX_DEPTH)
+   {
+      goto error;
+   }
+
+   if (h->array_start != NULL && h->array_start(s->data, key))
+   {
+      goto error;
+   }
+
+   if (!stream_next_token(s, &ch))
+   {
+      goto error;
+   }
+
+   while (ch != ']')
+   {
+      if (stream_value(s, NULL, ch, depth))
+      {
+         goto error;
+      }
+      if (!stream_next_token(s, &ch))
+      {
+         goto error;
+      }
+      if (ch == ',')
+      {
+         if (!stream_next_token(s, &ch))
+         {
+            goto error;
+         }
+      }
+      else if (ch != ']')
+      {
+         goto error;
+      }
+   }
+
+   if (h->array_end != NULL && h->array_end(s->data))
+   {
+      goto error;
+   }
+
+   return 0;
+
+error:
+   return 1;
+}
+
+static int
+writer_separator(struct json_writer* writer, char* key, bool indent)
+{
+   char* escaped = NULL;
+
+   if (writer->depth > 0)
+   {
+      fputs(writer->empty[writer->depth] ? "\n" : ",\n", writer->file);
+      writer->empty[writer->depth] = false;
+      if (indent)
+      {
+         fprintf(writer->file, "%*s", writer->depth * INDENT_PER_LEVEL, "");
+      }
+   }
+   if (key != NULL)
+   {
+      escaped = pgmoneta_escape_string(key);
+      fprintf(writer->file, "\"%s\": ", escaped);
+      free(escaped);
+   }
+   return 0;
+}
+
+static int
+writer_value(struct json_writer* writer, char* key, struct value* value)
+{
+   char* str = NULL;
+   char* tag = NULL;
+   char* escaped = NULL;
+
+   switch (value->type)
+   {
+      case ValueJSON:
+      case ValueJSONRef:
+         return writer_json(writer, key, (struct json*)value->data);
+      case ValueString:
+      case ValueStringRef:
+      case ValueBASE64:
+      case ValueBASE64Ref:
+         writer_separator(writer, key, true);
+         if (value->data == 0)
+         {
+            fputs("null", writer->file);
+         }
+         else
+         {
+            escaped = pgmoneta_escape_string((char*)value->data);
+            fprintf(writer->file, "\"%s\"", escaped != NULL ? escaped : "");
+            free(escaped);
+         }
+         return 0;
+      default:
+         // the value writes its indentation and tag itself
+         writer_separator(writer, NULL, false);
+         if (key != NULL)
+         {
+            escaped = pgmoneta_escape_string(key);
+            tag = pgmoneta_append_char(tag, '"');
+            tag = pgmoneta_append(tag, escaped);
+            tag = pgmoneta_append(tag, "\": ");
+            free(escaped);
+         }
+         str = pgmoneta_value_to_string(value, FORMAT_JSON, tag, writer->depth * INDENT_PER_LEVEL);
+         free(tag);
+         if (str == NULL)
+         {
+            writer->error = true;
+            return 1;
+         }
+         fputs(str, writer->file);
+         free(str);
+         return 0;
+   }
+}
+
+static int
+writer_json(struct json_writer* writer, char* key, struct json* obj)
+{
+   struct deque_iterator* iter = NULL;
+
+   if (obj == NULL || obj->type == JSONUnknown || obj->elements == NULL)
+   {
+      if (pgmoneta_json_writer_item_start(writer, key))
+      {
+         return 1;
+      }
+      return pgmoneta_json_writer_item_end(writer);
+   }
+
+   if (obj->type == JSONItem)
+   {
+      if (pgmoneta_json_writer_item_start(writer, key))
+      {
+         return 1;
+      }
+      // in key order, like pgmoneta_json_to_string
+      if (pgmoneta_art_iterate((struct art*)obj->elements, writer_item_cb, writer))
+      {
+         return 1;
+      }
+      return pgmoneta_json_writer_item_end(writer);
+   }
+
+   if (pgmoneta_json_writer_array_start(writer, key))
+   {
+      return 1;
+   }
+   pgmoneta_deque_iterator_create((struct deque*)obj->elements, &iter);
+   while (pgmoneta_deque_iterator_next(iter))
+   {
+      if (writer_value(writer, NULL, iter->value))
+      {
+         pgmoneta_deque_iterator_destroy(iter);
+         return 1;
+      }
+   }
+   pgmoneta_deque_iterator_destroy(iter);
+   return pgmoneta_json_writer_array_end(writer);
+}
+
+static int
+writer_item_cb(void* data, char* key, struct value* value)
+{
+   return writer_value((struct json_writer*)data, key, value);
+}
+
+static int
+binary_reserve(struct binary* b, size_t size)
+{
+   unsigned char* data = NULL;
+   size_t capacity;
+
+   if (b->size + size <= b->capacity)
+   {
+      return 0;
+   }
+
+   capacity = b->capacity == 0 ? DEFAULT_BUFFER_SIZE : b->capacity;
+   while (capacity < b->size + size)
+   {
+      capacity *= 2;
+   }
+
+   data = realloc(b->data, capacity);
+   if (data == NULL)
+   {
+      return 1;
+   }
+
+   b->data = data;
+   b->capacity = capacity;
+
+   return 0;
+}
+
+static int
+binary_byte(struct binary* b, unsigned char byte)
+{
+   if (binary_reserve(b, 1))
+   {
+      return 1;
+   }
+
+   b->data[b->size++] = byte;
+
+   return 0;
+}
+
+static int
+binary_varint(struct binary* b, uint64_t v)
+{
+   if (binary_reserve(b, 10))
+   {
+      return 1;
+   }
+
+   while (v >= 0x80)
+   {
+      b->data[b->size++] = (unsigned char)(v | 0x80);
+      v >>= 7;
+   }
+   b->data[b->size++] = (unsigned char)v;
+
+   return 0;
+}
+
+static int
+binary_bytes(struct binary* b, char* s, size_t size)
+{
+   if (binary_varint(b, size) || binary_reserve(b, size))
+   {
+      return 1;
+   }
+
+   memcpy(b->data + b->size, s, size);
+   b->size += size;
+
+   return 0;
+}
+
+static int
+binary_value(struct binary* b, struct value* value, int depth)
+{
+   int64_t i = 0;
+   uint64_t u = 0;
+   double d = 0.0;
+
+   switch (value->type)
+   {
+      case ValueInt8:
+         i = (int8_t)value->data;
+         break;
+      case ValueInt16:
+         i = (int16_t)value->data;
+         break;
+      case ValueInt32:
+         i = (int32_t)value->data;
+         break;
+      case ValueInt64:
+         i = (int64_t)value->data;
+         break;
+      case ValueUInt8:
+      case ValueUInt16:
+      case ValueUInt32:
+      case ValueUInt64:
+         u = (uint64_t)value->data;
+         return binary_byte(b, BINARY_UNSIGNED) || binary_varint(b, u);
+      case ValueBool:
+         return binary_byte(b, value->data ? BINARY_TRUE : BINARY_FALSE);
+      case ValueFloat:
+      case ValueDouble:
+         if (value->type == ValueFloat)
+         {
+            d = pgmoneta_value_to_float(value->data);
+         }
+         else
+         {
+            d = pgmoneta_value_to_double(value->data);
+         }
+         memcpy(&u, &d, sizeof(uint64_t));
+         if (binary_byte(b, BINARY_DOUBLE) || binary_reserve(b, 8))
+         {
+            return 1;
+         }
+         pgmoneta_write_uint64(b->data + b->size, u);
+         b->size += 8;
+         return 0;
+      case ValueString:
+      case ValueStringRef:
+      case ValueBASE64:
+      case ValueBASE64Ref:
+         if (value->data == 0)
+         {
+            return binary_byte(b, BINARY_NULL);
+         }
+         if (binary_byte(b, value->type == ValueBASE64 || value->type == ValueBASE64Ref ? BINARY_BASE64 : BINARY_STRING))
+         {
+            return 1;
+         }
+         return binary_bytes(b, (char*)value->data, strlen((char*)value->data));
+      case ValueJSON:
+      case ValueJSONRef:
+         return binary_json(b, (struct json*)value->data, depth + 1);
+      default:
+         return 1;
+   }
+
+   /* Zigzag, so that small negative numbers stay small */
+   u = ((uint64_t)i << 1) ^ (uint64_t)(i >> 63);
+
+   return binary_byte(b, BINARY_SIGNED) || binary_varint(b, u);
+}
+
+static int
+binary_json(struct binary* b, struct json* obj, int depth)
+{
+   struct json_iterator* iter = NULL;
+
+   if (depth >= JSON_MAX_DEPTH)
+   {
+      goto error;
+   }
+
+   if (obj == NULL || obj->type == JSONUnknown)
+   {
+      /* An empty object */
+      return binary_byte(b, BINARY_ITEM) || binary_varint(b, 0);
+   }
+
+   if (obj->type == JSONItem)
+   {
+      if (binary_byte(b, BINARY_ITEM) || binary_varint(b, ((struct art*)obj->elements)->size))
+      {
+         goto error;
+      }
+   }
+   else
+   {
+      if (binary_byte(b, BINARY_ARRAY) || binary_varint(b, pgmoneta_json_array_length(obj)))
+      {
+         goto error;
+      }
+   }
+
+   if (pgmoneta_json_iterator_create(obj, &iter))
+   {
+      goto error;
+   }
+
+   while (pgmoneta_json_iterator_next(iter))
+   {
+      if (obj->type == JSONItem && binary_bytes(b, iter->key, strlen(iter->key)))
+      {
+         goto error;
+      }
+
+      if (binary_value(b, iter->value, depth))
+      {
+         goto error;
+      }
+   }
+
+   pgmoneta_json_iterator_destroy(iter);
+
+   return 0;
+
+error:
+   pgmoneta_json_iterator_destroy(iter);
+
+   return 1;
+}
+
+static int
+binary_read_byte(struct binary* b, unsigned char* byte)
+{
+   if (b->offset >= b->size)
+   {
+      return 1;
+   }
+
+   *byte = b->data[b->offset++];
+
+   return 0;
+}
+
+static int
+binary_read_varint(struct binary* b, uint64_t* v)
+{
+   unsigned char byte = 0;
+
+   *v = 0;
+
+   for (int shift = 0; shift < 64; shift += 7)
+   {
+      if (binary_read_byte(b, &byte))
+      {
+         return 1;
+      }
+
+      *v |= (uint64_t)(byte & 0x7F) << shift;
+
+      if ((byte & 0x80) == 0)
+      {
+         return 0;
+      }
+   }
+
+   return 1;
+}
+
+static int
+binary_read_bytes(struct binary* b, char** s)
+{
+   uint64_t size = 0;
+   char* str = NULL;
+
+   *s = NULL;
+
+   if (binary_read_varint(b, &size) || size > b->size - b->offset)
+   {
+      return 1;
+   }
+
+   str = malloc(size + 1);
+   if (str == NULL)
+   {
+      return 1;
+   }
+
+   memcpy(str, b->data + b->offset, size);
+   str[size] = '\0';
+   b->offset += size;
+
+   *s = str;
+
+   return 0;
+}
+
+static int
+binary_read_value(struct binary* b, struct json* obj, char* key, int depth)
+{
+   unsigned char tag = 0;
+   uint64_t u = 0;
+   double d = 0.0;
+   char* s = NULL;
+   struct json* child = NULL;
+
+   if (b->offset >= b->size)
+   {
+      goto error;
+   }
+
+   tag = b->data[b->offset];
+
+   switch (tag)
+   {
+      case BINARY_ITEM:
+      case BINARY_ARRAY:
+         if (binary_read_json(b, &child, depth + 1) || json_add(obj, key, (uintptr_t)child, ValueJSON))
+         {
+            goto error;
+         }
+         child = NULL;
+         break;
+      case BINARY_UNSIGNED:
+         b->offset++;
+         if (binary_read_varint(b, &u) || json_add(obj, key, (uintptr_t)u, ValueUInt64))
+         {
+            goto error;
+         }
+         break;
+      case BINARY_SIGNED:
+         b->offset++;
+         if (binary_read_varint(b, &u) || json_add(obj, key, (uintptr_t)(int64_t)((u >> 1) ^ -(u & 1)), ValueInt64))
+         {
+            goto error;
+         }
+         break;
+      case BINARY_DOUBLE:
+         b->offset++;
+         if (b->size - b->offset < 8)
+         {
+            goto error;
+         }
+         u = pgmoneta_read_uint64(b->data + b->offset);
+         b->offset += 8;
+         memcpy(&d, &u, sizeof(double));
+         if (json_add(obj, key, pgmoneta_value_from_double(d), ValueDouble))
+         {
+            goto error;
+         }
+         break;
+      case BINARY_TRUE:
+      case BINARY_FALSE:
+         b->offset++;
+         if (json_add(obj, key, tag == BINARY_TRUE, ValueBool))
+         {
+            goto error;
+         }
+         break;
+      case BINARY_NULL:
+         b->offset++;
+         if (json_add(obj, key, 0, ValueString))
+         {
+            goto error;
+         }
+         break;
+      case BINARY_STRING:
+      case BINARY_BASE64:
+         b->offset++;
+         if (binary_read_bytes(b, &s) || json_add(obj, key, (uintptr_t)s, tag == BINARY_STRING ? ValueString : ValueBASE64))
+         {
+            goto error;
+         }
+         free(s);
+         s = NULL;
+         break;
+      default:
+         goto error;
+   }
+
+   return 0;
+
+error:
+   free(s);
+   pgmoneta_json_destroy(child);
+
+   return 1;
+}
+
+static int
+binary_read_json(struct binary* b, struct json** obj, int depth)
+{
+   unsigned char tag = 0;
+   uint64_t count = 0;
+   char* key = NULL;
+   struct json* o = NULL;
+
+   *obj = NULL;
+
+   if (depth >= JSON_MAX_DEPTH)
+   {
+      goto error;
+   }
+
+   if (binary_read_byte(b, &tag) || (tag != BINARY_ITEM && tag != BINARY_ARRAY))
+   {
+      goto error;
+   }
+
+   if (binary_read_varint(b, &count) || count > b->size - b->offset)
+   {
+      goto error;
+   }
+
+   if (pgmoneta_json_create(&o))
+   {
+      goto error;
+   }
+
+   if (tag == BINARY_ARRAY && count == 0)
+   {
+      o->type = JSONArray;
+      pgmoneta_deque_create(false, (struct deque**)&o->elements);
+   }
+
+   for (uint64_t i = 0; i < count; i++)
+   {
+      if (tag == BINARY_ITEM && binary_read_bytes(b, &key))
+      {
+         goto error;
+      }
+
+      if (binary_read_value(b, o, key, depth))
+      {
+         goto error;
+      }
+
+      free(key);
+      key = NULL;
+   }
+
+   *obj = o;
+
+   return 0;
+
+error:
+   free(key);
+   pgmoneta_json_destroy(o);
+
    return 1;
 }
 
@@ -28,39 +28,66 @@
 
 /* pgmoneta */
 #include <pgmoneta.h>
+#include <info.h>
 #include <link.h>
 #include <logging.h>
+#include <manifest.h>
 #include <utils.h>
 
 /* system */
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#ifdef HAVE_LINUX
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+#define DEDUPE_BLOCK_SIZE  8192
+#define DEDUPE_BUFFER_SIZE (1024 * 1024)
+#define DEDUPE_MAX_RANGE   (16 * 1024 * 1024)
 
 static void do_link(struct worker_common* wc);
+static void do_dedupe(struct worker_common* wc);
+static void link_file(char* from, char* to);
+static int reflink_file(char* from, char* to);
+static int dedupe_file(char* from, char* to, size_t* shared);
+#ifdef HAVE_LINUX
+static int dedupe_range(int src, int dest, off_t offset, size_t length, size_t* shared);
+static ssize_t read_at(int fd, char* buffer, size_t size, off_t offset);
+#endif
 static void do_relink(struct worker_common* wc);
 static void do_comparefiles(struct worker_common* wc);
 static char* trim_suffix(char* str);
 
 int
-pgmoneta_link_manifest(char* base_from, char* base_to, char* from, struct art* changed, struct art* added, struct workers* workers)
+pgmoneta_link_manifest(char* base_from, char* base_to, char* from, struct manifest_diff* diff, struct workers* workers)
 {
    DIR* from_dir = opendir(from);
    char* from_entry = NULL;
    char* from_file = NULL;
    char* from_file_trimmed = NULL;
    char* to_entry = NULL;
+   bool dedupe = false;
    struct dirent* entry;
    struct stat statbuf;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
 
    if (from_dir == NULL)
    {
       goto error;
    }
 
+   // the blocks of changed files can only be shared when they are stored as is
+   dedupe = config->reflink && config->compression_type == COMPRESSION_NONE && config->encryption == ENCRYPTION_NONE;
+
    while ((entry = readdir(from_dir)))
    {
       if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
@@ -79,16 +106,19 @@ pgmoneta_link_manifest(char* base_from, char* base_to, char* from, struct art* c
       {
          if (S_ISDIR(statbuf.st_mode))
          {
-            pgmoneta_link_manifest(base_from, base_to, from_entry, changed, added, workers);
+            pgmoneta_link_manifest(base_from, base_to, from_entry, diff, workers);
          }
          else
          {
             struct worker_input* wi = NULL;
+            bool is_changed = false;
             from_file = pgmoneta_remove_prefix(from_entry, base_from);
             from_file_trimmed = trim_suffix(from_file);
-            // file in newer dir is not added nor changed, nor is an incremental file
-            if (!pgmoneta_art_contains_key(added, from_file_trimmed) &&
-                !pgmoneta_art_contains_key(changed, from_file_trimmed) &&
+            is_changed = pgmoneta_manifest_diff_contains(diff, MANIFEST_DIFF_CHANGED, from_file_trimmed);
+            // file in newer dir is not added, nor is an incremental file. A changed
+            // file shares its unchanged blocks, any other file is linked
+            if (!pgmoneta_manifest_diff_contains(diff, MANIFEST_DIFF_ADDED, from_file_trimmed) &&
+                (!is_changed || dedupe) &&
                 !pgmoneta_is_incremental_path(from_file_trimmed))
             {
                to_entry = pgmoneta_append(to_entry, base_to);
@@ -106,9 +136,13 @@ pgmoneta_link_manifest(char* base_from, char* base_to, char* from, struct art* c
                {
                   if (workers->outcome)
                   {
-                     pgmoneta_workers_add(workers, do_link, (struct worker_common*)wi);
+                     pgmoneta_workers_add(workers, is_changed ? do_dedupe : do_link, (struct worker_common*)wi);
                   }
                }
+               else if (is_changed)
+               {
+                  do_dedupe((struct worker_common*)wi);
+               }
                else
                {
                   do_link((struct worker_common*)wi);
@@ -154,22 +188,408 @@ do_link(struct worker_common* wc)
 
    if (pgmoneta_exists(wi->to))
    {
-      if (pgmoneta_exists(wi->from))
+      link_file(wi->from, wi->to);
+   }
+   else
+   {
+      pgmoneta_log_debug("%s doesn't exists", wi->to);
+   }
+
+   free(wi);
+}
+
+static void
+do_dedupe(struct worker_common* wc)
+{
+   struct worker_input* wi = (struct worker_input*)wc;
+   size_t shared = 0;
+
+   // the file is complete either way, so a failure only costs space
+   if (dedupe_file(wi->from, wi->to, &shared))
+   {
+      pgmoneta_log_debug("Unable to share the blocks of %s with %s", wi->from, wi->to);
+   }
+#ifdef DEBUG
+   else
+   {
+      pgmoneta_log_trace("FILETRACKER | Dedupe | %s | %s | %zu |", wi->from, wi->to, shared);
+   }
+#endif
+
+   free(wi);
+}
+
+static void
+link_file(char* from, char* to)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   // a reflink leaves a plain file, so deleting the previous backup has nothing to relink
+   if (config->reflink && !reflink_file(from, to))
+   {
+      return;
+   }
+
+   if (pgmoneta_exists(from))
+   {
+      pgmoneta_delete_file(from, NULL);
+   }
+   else
+   {
+      pgmoneta_log_debug("%s doesn't exists", from);
+   }
+   pgmoneta_symlink_file(from, to);
+}
+
+static int
+reflink_file(char* from, char* to)
+{
+#ifdef HAVE_LINUX
+   char tmp[MAX_PATH];
+   int fd_to = -1;
+   int fd_tmp = -1;
+   struct stat statbuf;
+
+   memset(tmp, 0, sizeof(tmp));
+   if (snprintf(tmp, sizeof(tmp), "%s.reflink", from) >= (int)sizeof(tmp))
+   {
+      goto error;
+   }
+
+   fd_to = open(to, O_RDONLY);
+   if (fd_to < 0 || fstat(fd_to, &statbuf))
+   {
+      goto error;
+   }
+
+   fd_tmp = open(tmp, O_WRONLY | O_CREAT | O_EXCL, statbuf.st_mode & 07777);
+   if (fd_tmp < 0)
+   {
+      goto error;
+   }
+
+   if (ioctl(fd_tmp, FICLONE, fd_to))
+   {
+      goto error;
+   }
+
+   close(fd_to);
+   fd_to = -1;
+
+   if (close(fd_tmp))
+   {
+      fd_tmp = -1;
+      unlink(tmp);
+      goto error;
+   }
+   fd_tmp = -1;
+
+   if (rename(tmp, from))
+   {
+      unlink(tmp);
+      goto error;
+   }
+
+   return 0;
+
+error:
+   if (fd_to >= 0)
+   {
+      close(fd_to);
+   }
+   if (fd_tmp >= 0)
+   {
+      close(fd_tmp);
+      unlink(tmp);
+   }
+#else
+   (void)from;
+   (void)to;
+#endif
+
+   return 1;
+}
+
+static int
+dedupe_file(char* from, char* to, size_t* shared)
+{
+#ifdef HAVE_LINUX
+   int fd_from = -1;
+   int fd_to = -1;
+   char* buffer_from = NULL;
+   char* buffer_to = NULL;
+   ssize_t nfrom;
+   ssize_t nto;
+   size_t length;
+   off_t offset = 0;
+   off_t start = -1;
+
+   *shared = 0;
+
+   fd_from = open(from, O_RDWR);
+   fd_to = open(to, O_RDONLY);
+   buffer_from = (char*)malloc(DEDUPE_BUFFER_SIZE);
+   buffer_to = (char*)malloc(DEDUPE_BUFFER_SIZE);
+
+   if (fd_from < 0 || fd_to < 0 || buffer_from == NULL || buffer_to == NULL)
+   {
+      goto error;
+   }
+
+   // find the runs of equal blocks at the same offsets, and let the file system share them
+   while (true)
+   {
+      nfrom = read_at(fd_from, buffer_from, DEDUPE_BUFFER_SIZE, offset);
+      nto = read_at(fd_to, buffer_to, DEDUPE_BUFFER_SIZE, offset);
+      if (nfrom < 0 || nto < 0)
       {
-         pgmoneta_delete_file(wi->from, NULL);
+         goto error;
       }
-      else
+
+      length = (size_t)MIN(nfrom, nto);
+      length -= length % DEDUPE_BLOCK_SIZE;
+
+      for (size_t i = 0; i < length; i += DEDUPE_BLOCK_SIZE)
+      {
+         if (!memcmp(buffer_from + i, buffer_to + i, DEDUPE_BLOCK_SIZE))
+         {
+            if (start < 0)
+            {
+               start = offset + i;
+            }
+            else if (offset + (off_t)i - start == DEDUPE_MAX_RANGE)
+            {
+               if (dedupe_range(fd_to, fd_from, start, DEDUPE_MAX_RANGE, shared))
+               {
+                  goto error;
+               }
+               start = offset + i;
+            }
+         }
+         else if (start >= 0)
+         {
+            if (dedupe_range(fd_to, fd_from, start, offset + i - start, shared))
+            {
+               goto error;
+            }
+            start = -1;
+         }
+      }
+
+      offset += length;
+
+      if (length < DEDUPE_BUFFER_SIZE)
       {
-         pgmoneta_log_debug("%s doesn't exists", wi->from);
+         break;
       }
-      pgmoneta_symlink_file(wi->from, wi->to);
    }
-   else
+
+   if (start >= 0 && dedupe_range(fd_to, fd_from, start, offset - start, shared))
    {
-      pgmoneta_log_debug("%s doesn't exists", wi->to);
+      goto error;
    }
 
-   free(wi);
+   close(fd_from);
+   close(fd_to);
+   free(buffer_from);
+   free(buffer_to);
+
+   return 0;
+
+error:
+   if (fd_from >= 0)
+   {
+      close(fd_from);
+   }
+   if (fd_to >= 0)
+   {
+      close(fd_to);
+   }
+   free(buffer_from);
+   free(buffer_to);
+#else
+   (void)from;
+   (void)to;
+   *shared = 0;
+#endif
+
+   return 1;
+}
+
+#ifdef HAVE_LINUX
+static int
+dedupe_range(int src, int dest, off_t offset, size_t length, size_t* shared)
+{
+   struct file_dedupe_range* range = NULL;
+
+   range = (struct file_dedupe_range*)calloc(1, sizeof(struct file_dedupe_range) + sizeof(struct file_dedupe_range_info));
+   if (range == NULL)
+   {
+      goto error;
+   }
+
+   range->src_offset = offset;
+   range->src_length = length;
+   range->dest_count = 1;
+   range->info[0].dest_fd = dest;
+   range->info[0].dest_offset = offset;
+
+   // the kernel compares the data again, so a concurrent change is never shared
+   if (ioctl(src, FIDEDUPERANGE, range) || range->info[0].status < 0)
+   {
+      goto error;
+   }
+
+   if (range->info[0].status == FILE_DEDUPE_RANGE_SAME)
+   {
+      *shared += range->info[0].bytes_deduped;
+   }
+
+   free(range);
+   return 0;
+
+error:
+   free(range);
+   return 1;
+}
+
+static ssize_t
+read_at(int fd, char* buffer, size_t size, off_t offset)
+{
+   size_t total = 0;
+   ssize_t n;
+
+   while (total < size)
+   {
+      n = pread(fd, buffer + total, size - total, offset + total);
+      if (n > 0)
+      {
+         total += n;
+      }
+      else if (n == 0)
+      {
+         break;
+      }
+      else if (errno != EINTR)
+      {
+         return -1;
+      }
+   }
+
+   return (ssize_t)total;
+}
+#endif
+
+int
+pgmoneta_link_delta(int server, char* label, char** previous, struct manifest_diff** diff)
+{
+   char* server_path = NULL;
+   char* workspace = NULL;
+   char* old_manifest = NULL;
+   char* new_manifest = NULL;
+   int number_of_backups = 0;
+   int index = -1;
+   int next_newest = -1;
+   struct backup** backups = NULL;
+
+   *previous = NULL;
+   *diff = NULL;
+
+   server_path = pgmoneta_get_server_backup(server);
+
+   if (pgmoneta_get_backups(server_path, &number_of_backups, &backups))
+   {
+      goto error;
+   }
+
+   for (int j = number_of_backups - 1; index == -1 && j >= 0; j--)
+   {
+      if (pgmoneta_compare_string(backups[j]->label, label))
+      {
+         index = j;
+      }
+   }
+
+   for (int j = index - 1; j >= 0 && next_newest == -1; j--)
+   {
+      if (backups[j]->valid == VALID_TRUE && backups[j]->major_version == backups[index]->major_version)
+      {
+         next_newest = j;
+      }
+   }
+
+   if (next_newest != -1)
+   {
+      old_manifest = pgmoneta_get_server_backup_identifier(server, backups[next_newest]->label);
+      old_manifest = pgmoneta_append(old_manifest, "backup.manifest");
+
+      new_manifest = pgmoneta_get_server_backup_identifier(server, label);
+      new_manifest = pgmoneta_append(new_manifest, "backup.manifest");
+
+      workspace = pgmoneta_get_server_workspace(server);
+
+      if (workspace == NULL || pgmoneta_manifest_diff(workspace, old_manifest, new_manifest, diff))
+      {
+         goto error;
+      }
+
+      *previous = pgmoneta_append(*previous, backups[next_newest]->label);
+   }
+
+   for (int i = 0; i < number_of_backups; i++)
+   {
+      free(backups[i]);
+   }
+   free(backups);
+
+   free(server_path);
+   free(workspace);
+   free(old_manifest);
+   free(new_manifest);
+
+   return 0;
+
+error:
+
+   for (int i = 0; i < number_of_backups; i++)
+   {
+      free(backups[i]);
+   }
+   free(backups);
+
+   free(server_path);
+   free(workspace);
+   free(old_manifest);
+   free(new_manifest);
+
+   return 1;
+}
+
+bool
+pgmoneta_link_is_unchanged(char* relative_file, struct manifest_diff* diff)
+{
+   char* trimmed = NULL;
+   bool unchanged = false;
+
+   if (diff == NULL)
+   {
+      return false;
+   }
+
+   trimmed = trim_suffix(relative_file);
+
+   if (trimmed != NULL)
+   {
+      unchanged = !pgmoneta_manifest_diff_contains(diff, MANIFEST_DIFF_ADDED, trimmed) &&
+                  !pgmoneta_manifest_diff_contains(diff, MANIFEST_DIFF_CHANGED, trimmed) &&
+                  !pgmoneta_is_incremental_path(trimmed);
+   }
+
+   free(trimmed);
+
+   return unchanged;
 }
 
 int
@@ -464,15 +884,7 @@ do_comparefiles(struct worker_common* wc)
 
    if (equal)
    {
-      if (pgmoneta_exists(wi->from))
-      {
-         pgmoneta_delete_file(wi->from, NULL);
-      }
-      else
-      {
-         pgmoneta_log_debug("%s doesn't exists", wi->from);
-      }
-      pgmoneta_symlink_file(wi->from, wi->to);
+      link_file(wi->from, wi->to);
    }
 
    free(wi);
@@ -0,0 +1,256 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <info.h>
+#include <lock.h>
+#include <logging.h>
+
+/* system */
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+static int lock_index(char* label);
+static int try_shared(atomic_int* l);
+static int try_exclusive(atomic_int* l, int expected);
+static void release(atomic_int* l, int mode);
+
+int
+pgmoneta_lock_repository(int server, int mode, struct lock** lock)
+{
+   struct lock* l = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   *lock = NULL;
+
+   l = (struct lock*)malloc(sizeof(struct lock));
+   if (l == NULL)
+   {
+      goto error;
+   }
+
+   memset(l, 0, sizeof(struct lock));
+   l->server = server;
+   l->repository = mode;
+
+   if (mode == LOCK_EXCLUSIVE)
+   {
+      if (try_exclusive(&config->common.servers[server].repository, 0))
+      {
+         goto error;
+      }
+   }
+   else if (try_shared(&config->common.servers[server].repository))
+   {
+      goto error;
+   }
+
+   *lock = l;
+
+   return 0;
+
+error:
+
+   free(l);
+
+   return 1;
+}
+
+int
+pgmoneta_lock_backup(struct lock* lock, char* label, int mode)
+{
+   int idx;
+   atomic_int* l = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (lock == NULL || label == NULL)
+   {
+      return 1;
+   }
+
+   /* An exclusive repository lock covers all of the backups */
+   if (lock->repository == LOCK_EXCLUSIVE)
+   {
+      return 0;
+   }
+
+   idx = lock_index(label);
+   l = &config->common.servers[lock->server].backup_locks[idx];
+
+   if (lock->backups[idx] == LOCK_EXCLUSIVE + 1 || (lock->backups[idx] == LOCK_SHARED + 1 && mode == LOCK_SHARED))
+   {
+      return 0;
+   }
+
+   if (mode == LOCK_EXCLUSIVE)
+   {
+      if (try_exclusive(l, lock->backups[idx] == LOCK_SHARED + 1 ? 1 : 0))
+      {
+         pgmoneta_log_debug("Lock: %s/%s is in use", config->common.servers[lock->server].name, label);
+         return 1;
+      }
+   }
+   else if (try_shared(l))
+   {
+      pgmoneta_log_debug("Lock: %s/%s is in use", config->common.servers[lock->server].name, label);
+      return 1;
+   }
+
+   lock->backups[idx] = mode + 1;
+
+   return 0;
+}
+
+int
+pgmoneta_lock_backup_chain(struct lock* lock, struct backup* backup)
+{
+   struct backup* p = NULL;
+   struct backup* parent = NULL;
+
+   if (backup == NULL || pgmoneta_lock_backup(lock, backup->label, LOCK_SHARED))
+   {
+      goto error;
+   }
+
+   p = backup;
+   while (p->type != TYPE_FULL)
+   {
+      if (pgmoneta_get_backup_parent(lock->server, p, &parent))
+      {
+         goto error;
+      }
+
+      if (p != backup)
+      {
+         free(p);
+      }
+      p = parent;
+      parent = NULL;
+
+      if (pgmoneta_lock_backup(lock, p->label, LOCK_SHARED))
+      {
+         goto error;
+      }
+   }
+
+   if (p != backup)
+   {
+      free(p);
+   }
+
+   return 0;
+
+error:
+
+   if (p != backup)
+   {
+      free(p);
+   }
+
+   return 1;
+}
+
+void
+pgmoneta_unlock(struct lock* lock)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (lock == NULL)
+   {
+      return;
+   }
+
+   for (int i = 0; i < NUMBER_OF_BACKUP_LOCKS; i++)
+   {
+      if (lock->backups[i] != 0)
+      {
+         release(&config->common.servers[lock->server].backup_locks[i], lock->backups[i] - 1);
+      }
+   }
+
+   release(&config->common.servers[lock->server].repository, lock->repository);
+
+   free(lock);
+}
+
+static int
+lock_index(char* label)
+{
+   uint32_t hash = 2166136261u;
+
+   for (size_t i = 0; i < strlen(label); i++)
+   {
+      hash ^= (unsigned char)label[i];
+      hash *= 16777619u;
+   }
+
+   return (int)(hash % NUMBER_OF_BACKUP_LOCKS);
+}
+
+static int
+try_shared(atomic_int* l)
+{
+   int current = atomic_load(l);
+
+   while (current >= 0)
+   {
+      if (atomic_compare_exchange_weak(l, &current, current + 1))
+      {
+         return 0;
+      }
+   }
+
+   return 1;
+}
+
+static int
+try_exclusive(atomic_int* l, int expected)
+{
+   return atomic_compare_exchange_strong(l, &expected, -1) ? 0 : 1;
+}
+
+static void
+release(atomic_int* l, int mode)
+{
+   if (mode == LOCK_EXCLUSIVE)
+   {
+      atomic_store(l, 0);
+   }
+   else
+   {
+      atomic_fetch_sub(l, 1);
+   }
+}
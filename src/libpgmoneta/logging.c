@@ -30,9 +30,12 @@
 #include <pgmoneta.h>
 #include <logging.h>
 #include <prometheus.h>
+#include <shmem.h>
 
 /* system */
 #include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -50,6 +53,9 @@ time_t next_log_rotation_age;  /* number of seconds at which the next location w
 
 char current_log_path[MAX_PATH]; /* the current log file */
 
+static unsigned long stalled_position = ULONG_MAX; /* the reserved position the writer waits for */
+static time_t stalled_since = 0;                  /* when the writer started to wait for it */
+
 static char* levels[] =
 {
    "TRACE",
@@ -70,6 +76,12 @@ static char* colors[] =
    "\x1b[35m"
 };
 
+static bool log_ring_append(struct main_configuration* config, int level, char* file, int line, char* fmt, va_list vl);
+static size_t log_ring_format(struct main_configuration* config, int level, char* file, int line, char* buffer, size_t size,
+                              char* fmt, va_list vl);
+static size_t log_ring_format_args(struct main_configuration* config, int level, char* file, int line, char* buffer, size_t size,
+                                   char* fmt, ...);
+
 bool
 log_rotation_enabled(void)
 {
@@ -348,6 +360,22 @@ pgmoneta_log_line(int level, char* file, int line, char* fmt, ...)
             break;
       }
 
+      if (log_ring_shmem != NULL &&
+          (config->common.log_type == PGMONETA_LOGGING_TYPE_CONSOLE || config->common.log_type == PGMONETA_LOGGING_TYPE_FILE))
+      {
+         va_list rl;
+         bool queued;
+
+         va_start(rl, fmt);
+         queued = log_ring_append(config, level, file, line, fmt, rl);
+         va_end(rl);
+
+         if (queued)
+         {
+            return;
+         }
+      }
+
 retry:
       isfree = STATE_FREE;
 
@@ -525,3 +553,298 @@ retry:
         SLEEP_AND_GOTO(1000000L,retry)
    }
 }
+
+int
+pgmoneta_init_log_ring(size_t* p_size, void** p_shmem)
+{
+   struct log_ring* ring = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   *p_size = 0;
+   *p_shmem = NULL;
+
+   if (pgmoneta_create_shared_memory(sizeof(struct log_ring), config->hugepage, (void*)&ring))
+   {
+      return 1;
+   }
+
+   memset(ring, 0, sizeof(struct log_ring));
+   ring->writer = getpid();
+   atomic_init(&ring->head, 0);
+   atomic_init(&ring->tail, 0);
+   atomic_init(&ring->dropped, 0);
+
+   for (unsigned long i = 0; i < PGMONETA_LOGGING_RING_SLOTS; i++)
+   {
+      atomic_init(&ring->slots[i].sequence, i);
+   }
+
+   *p_size = sizeof(struct log_ring);
+   *p_shmem = ring;
+
+   return 0;
+}
+
+void
+pgmoneta_log_ring_flush(void)
+{
+   signed char isfree;
+   unsigned long position;
+   unsigned long dropped;
+   bool written = false;
+   FILE* out = NULL;
+   struct log_ring* ring;
+   struct log_slot* slot;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+   ring = (struct log_ring*)log_ring_shmem;
+
+   if (config == NULL || ring == NULL || ring->writer != getpid())
+   {
+      return;
+   }
+
+   if (config->common.log_type == PGMONETA_LOGGING_TYPE_CONSOLE)
+   {
+      out = stdout;
+   }
+   else if (config->common.log_type == PGMONETA_LOGGING_TYPE_FILE)
+   {
+      out = log_file;
+   }
+
+retry:
+   isfree = STATE_FREE;
+
+   if (atomic_compare_exchange_strong(&config->common.log_lock, &isfree, STATE_IN_USE))
+   {
+      position = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+      for (;;)
+      {
+         slot = &ring->slots[position % PGMONETA_LOGGING_RING_SLOTS];
+
+         if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != position + 1)
+         {
+            unsigned long expected = position;
+
+            /* Nothing reserved past the tail */
+            if (atomic_load_explicit(&ring->head, memory_order_acquire) == position)
+            {
+               break;
+            }
+
+            /* The producer may be gone between the reservation and the publication */
+            if (stalled_position != position)
+            {
+               stalled_position = position;
+               stalled_since = time(NULL);
+               break;
+            }
+
+            if (time(NULL) - stalled_since < PGMONETA_LOGGING_RING_TIMEOUT)
+            {
+               break;
+            }
+
+            /* Hand the slot back, a late producer sees it and writes its line directly */
+            if (atomic_compare_exchange_strong(&slot->sequence, &expected, position + PGMONETA_LOGGING_RING_SLOTS))
+            {
+               atomic_fetch_add(&ring->dropped, 1);
+               position++;
+            }
+            continue;
+         }
+
+         if (out != NULL)
+         {
+            fwrite(slot->line, 1, slot->length, out);
+         }
+
+         /* Hand the slot back to the producers one lap ahead */
+         atomic_store_explicit(&slot->sequence, position + PGMONETA_LOGGING_RING_SLOTS, memory_order_release);
+         position++;
+         written = true;
+      }
+
+      atomic_store_explicit(&ring->tail, position, memory_order_release);
+
+      dropped = atomic_exchange(&ring->dropped, 0);
+      if (dropped > 0 && out != NULL)
+      {
+         char buf[PGMONETA_LOGGING_RING_LINE_SIZE];
+         size_t length;
+
+         length = log_ring_format_args(config, PGMONETA_LOGGING_LEVEL_WARN, __FILE__, __LINE__, &buf[0], sizeof(buf),
+                                       "Logging: Dropped %lu lines", dropped);
+         fwrite(&buf[0], 1, MIN(length, sizeof(buf) - 1), out);
+         written = true;
+      }
+
+      if (written && out != NULL)
+      {
+         fflush(out);
+
+         if (config->common.log_type == PGMONETA_LOGGING_TYPE_FILE && log_rotation_required())
+         {
+            log_file_rotate();
+         }
+      }
+
+      atomic_store(&config->common.log_lock, STATE_FREE);
+   }
+   else
+     SLEEP_AND_GOTO(1000000L,retry)
+}
+
+static bool
+log_ring_append(struct main_configuration* config, int level, char* file, int line, char* fmt, va_list vl)
+{
+   char buf[PGMONETA_LOGGING_RING_LINE_SIZE];
+   size_t length;
+   unsigned long position;
+   unsigned long sequence;
+   long difference;
+   struct log_ring* ring;
+   struct log_slot* slot;
+
+   ring = (struct log_ring*)log_ring_shmem;
+
+   length = log_ring_format(config, level, file, line, &buf[0], sizeof(buf), fmt, vl);
+
+   /* A line longer than a slot is written directly */
+   if (length >= sizeof(buf))
+   {
+      return false;
+   }
+
+   position = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+   for (;;)
+   {
+      slot = &ring->slots[position % PGMONETA_LOGGING_RING_SLOTS];
+      sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+      difference = (long)(sequence - position);
+
+      if (difference == 0)
+      {
+         if (atomic_compare_exchange_weak_explicit(&ring->head, &position, position + 1,
+                                                   memory_order_relaxed, memory_order_relaxed))
+         {
+            break;
+         }
+      }
+      else if (difference < 0)
+      {
+         /* The writer is a lap behind, so the line is dropped instead of waiting, unless it is a warning or worse */
+         if (level >= PGMONETA_LOGGING_LEVEL_WARN)
+         {
+            return false;
+         }
+
+         atomic_fetch_add(&ring->dropped, 1);
+         return true;
+      }
+      else
+      {
+         position = atomic_load_explicit(&ring->head, memory_order_relaxed);
+      }
+   }
+
+   memcpy(&slot->line[0], &buf[0], length);
+   slot->length = length;
+
+   /* The writer hands a slot back when it was reserved too long, then the line is written directly */
+   sequence = position;
+   if (!atomic_compare_exchange_strong_explicit(&slot->sequence, &sequence, position + 1,
+                                                memory_order_release, memory_order_relaxed))
+   {
+      return false;
+   }
+
+   return true;
+}
+
+static size_t
+log_ring_format(struct main_configuration* config, int level, char* file, int line, char* buffer, size_t size,
+                char* fmt, va_list vl)
+{
+   char prefix[256];
+   struct tm* tm;
+   time_t t;
+   char* filename;
+   int n;
+   size_t length = 0;
+
+   t = time(NULL);
+   tm = localtime(&t);
+
+   filename = strrchr(file, '/');
+   if (filename != NULL)
+   {
+      filename = filename + 1;
+   }
+   else
+   {
+      filename = file;
+   }
+
+   if (strlen(config->common.log_line_prefix) == 0)
+   {
+      memcpy(config->common.log_line_prefix, PGMONETA_LOGGING_DEFAULT_LOG_LINE_PREFIX, strlen(PGMONETA_LOGGING_DEFAULT_LOG_LINE_PREFIX));
+   }
+
+   prefix[strftime(prefix, sizeof(prefix), config->common.log_line_prefix, tm)] = '\0';
+
+   if (config->common.log_type == PGMONETA_LOGGING_TYPE_CONSOLE)
+   {
+      n = snprintf(buffer, size, "%s %s%-5s\x1b[0m \x1b[90m%s:%d\x1b[0m ",
+                   prefix, colors[level - 1], levels[level - 1], filename, line);
+   }
+   else
+   {
+      n = snprintf(buffer, size, "%s %-5s %s:%d ", prefix, levels[level - 1], filename, line);
+   }
+
+   if (n < 0)
+   {
+      return size;
+   }
+   length = (size_t)n;
+
+   if (length < size)
+   {
+      n = vsnprintf(buffer + length, size - length, fmt, vl);
+      if (n < 0)
+      {
+         return size;
+      }
+      length += (size_t)n;
+   }
+
+   if (length + 1 < size)
+   {
+      buffer[length] = '\n';
+      buffer[length + 1] = '\0';
+   }
+   length++;
+
+   return length;
+}
+
+static size_t
+log_ring_format_args(struct main_configuration* config, int level, char* file, int line, char* buffer, size_t size,
+                     char* fmt, ...)
+{
+   va_list vl;
+   size_t length;
+
+   va_start(vl, fmt);
+   length = log_ring_format(config, level, file, line, buffer, size, fmt, vl);
+   va_end(vl);
+
+   return length;
+}
@@ -34,6 +34,8 @@
 #include <lz4.h>
 #include <lz4_compression.h>
 #include <management.h>
+#include <prometheus.h>
+#include <trace.h>
 #include <utils.h>
 
 /* system */
@@ -47,11 +49,28 @@
 
 #define NAME "lz4"
 
+/** @struct lz4_reader
+ * Defines the state of a LZ4 decompression layer
+ */
+struct lz4_reader
+{
+   LZ4_streamDecode_t stream;                       /**< The decoding stream */
+   char blocks[2][BLOCK_BYTES];                     /**< The decoded blocks, the previous one is the dictionary */
+   int index;                                       /**< The current block */
+   char compressed[LZ4_COMPRESSBOUND(BLOCK_BYTES)]; /**< The compressed block */
+   size_t pos;                                      /**< The next decoded byte to hand out */
+   size_t length;                                   /**< The number of decoded bytes */
+   bool done;                                       /**< Has the source ended */
+};
+
+static int lz4_reader_read(struct reader* reader, void* buffer, size_t size, size_t* read);
+static void lz4_reader_close(struct reader* reader);
 static int lz4_compress(char* from, char* to);
 static int lz4_decompress(char* from, char* to);
 
 static void do_lz4_compress(struct worker_common* wc);
 static void do_lz4_decompress(struct worker_common* wc);
+static void lz4_stream_destroy(void* context);
 
 int
 pgmoneta_lz4c_data(char* directory, struct workers* workers)
@@ -160,6 +179,7 @@ do_lz4_compress(struct worker_common* wc)
       else
       {
          pgmoneta_delete_file(wi->from, NULL);
+         pgmoneta_drop_cache(wi->to);
       }
    }
 
@@ -509,6 +529,38 @@ error:
    return 1;
 }
 
+int
+pgmoneta_lz4d_reader(struct reader* source, struct reader** reader)
+{
+   struct lz4_reader* lr = NULL;
+
+   *reader = NULL;
+
+   lr = (struct lz4_reader*)malloc(sizeof(struct lz4_reader));
+   if (lr == NULL)
+   {
+      goto error;
+   }
+
+   memset(lr, 0, sizeof(struct lz4_reader));
+
+   LZ4_setStreamDecode(&lr->stream, NULL, 0);
+   lr->index = 1;
+
+   if (pgmoneta_reader_create(source, lz4_reader_read, lz4_reader_close, lr, reader))
+   {
+      goto error;
+   }
+
+   return 0;
+
+error:
+
+   free(lr);
+
+   return 1;
+}
+
 void
 pgmoneta_lz4c_request(SSL* ssl __attribute__((unused)), int client_fd, uint8_t compression, uint8_t encryption, struct json* payload)
 {
@@ -609,6 +661,7 @@ pgmoneta_lz4c_file(char* from, char* to)
       if (lz4_compress(from, to))
       {
          pgmoneta_log_error("LZ4: Could not compress %s", from);
+         return 1;
       }
       else
       {
@@ -628,8 +681,27 @@ lz4_compress(char* from, char* to)
    char buffIn[2][BLOCK_BYTES];
    int buffInIndex = 0;
    char buffOut[LZ4_COMPRESSBOUND(BLOCK_BYTES)];
+   uint64_t start;
+
+   PGMONETA_TRACE2(compress_start, from, COMPRESSION_CLIENT_LZ4);
+
+   start = pgmoneta_prometheus_now();
+
+   lz4Stream = (LZ4_stream_t*)pgmoneta_workers_context_get(WORKER_CONTEXT_LZ4, 0);
+   if (lz4Stream == NULL)
+   {
+      lz4Stream = LZ4_createStream();
+      if (lz4Stream == NULL)
+      {
+         goto error;
+      }
+      pgmoneta_workers_context_put(WORKER_CONTEXT_LZ4, 0, lz4Stream, lz4_stream_destroy);
+   }
+   else
+   {
+      LZ4_resetStream_fast(lz4Stream);
+   }
 
-   lz4Stream = LZ4_createStream();
    fin = fopen(from, "rb");
 
    if (fin == NULL)
@@ -666,7 +738,10 @@ lz4_compress(char* from, char* to)
 
    fclose(fout);
    fclose(fin);
-   LZ4_freeStream(lz4Stream);
+
+   pgmoneta_prometheus_file(FILE_OPERATION_COMPRESS, start);
+
+   PGMONETA_TRACE3(compress_done, from, COMPRESSION_CLIENT_LZ4, 0);
 
    return 0;
 
@@ -682,9 +757,17 @@ error:
       fclose(fout);
    }
 
+   PGMONETA_TRACE3(compress_done, from, COMPRESSION_CLIENT_LZ4, 1);
+
    return 1;
 }
 
+static void
+lz4_stream_destroy(void* context)
+{
+   LZ4_freeStream((LZ4_stream_t*)context);
+}
+
 static int
 lz4_decompress(char* from, char* to)
 {
@@ -696,6 +779,9 @@ lz4_decompress(char* from, char* to)
    int buffInIndex = 0;
    char buffOut[LZ4_COMPRESSBOUND(BLOCK_BYTES)];
    size_t read = 0;
+   uint64_t start;
+
+   start = pgmoneta_prometheus_now();
 
    lz4StreamDecode = &lz4StreamDecodeBody;
    fin = fopen(from, "rb");
@@ -751,6 +837,8 @@ lz4_decompress(char* from, char* to)
    fclose(fout);
    fclose(fin);
 
+   pgmoneta_prometheus_file(FILE_OPERATION_DECOMPRESS, start);
+
    return 0;
 
 error:
@@ -824,3 +912,77 @@ pgmoneta_lz4d_string(unsigned char* compressed_buffer, size_t compressed_size, c
 
    return 0;
 }
+
+static int
+lz4_reader_read(struct reader* reader, void* buffer, size_t size, size_t* read)
+{
+   struct lz4_reader* lr = (struct lz4_reader*)reader->state;
+   int compression = 0;
+   int decompression;
+   size_t n = 0;
+
+   *read = 0;
+
+   while (lr->pos == lr->length)
+   {
+      if (lr->done)
+      {
+         return 0;
+      }
+
+      /* Each block is prefixed with its compressed size */
+      if (pgmoneta_reader_fill(reader->source, &compression, sizeof(compression), &n))
+      {
+         goto error;
+      }
+
+      if (n == 0)
+      {
+         lr->done = true;
+         return 0;
+      }
+
+      if (n < sizeof(compression) || compression <= 0 || compression > (int)sizeof(lr->compressed))
+      {
+         pgmoneta_log_error("LZ4: Invalid block size");
+         goto error;
+      }
+
+      if (pgmoneta_reader_fill(reader->source, &lr->compressed[0], (size_t)compression, &n) || n != (size_t)compression)
+      {
+         pgmoneta_log_error("LZ4: Incomplete block");
+         goto error;
+      }
+
+      lr->index = (lr->index + 1) % 2;
+
+      decompression = LZ4_decompress_safe_continue(&lr->stream, &lr->compressed[0], lr->blocks[lr->index], compression, BLOCK_BYTES);
+      if (decompression < 0)
+      {
+         pgmoneta_log_error("LZ4: Decompression error");
+         goto error;
+      }
+
+      lr->pos = 0;
+      lr->length = (size_t)decompression;
+   }
+
+   n = MIN(size, lr->length - lr->pos);
+   memcpy(buffer, lr->blocks[lr->index] + lr->pos, n);
+   lr->pos += n;
+
+   *read = n;
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+static void
+lz4_reader_close(struct reader* reader)
+{
+   free(reader->state);
+   reader->state = NULL;
+}
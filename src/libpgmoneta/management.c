@@ -47,6 +47,10 @@ static int read_uint8(char* prefix, SSL* ssl, int socket, uint8_t* i);
 static int read_string(char* prefix, SSL* ssl, int socket, char** str);
 static int write_uint8(char* prefix, SSL* ssl, int socket, uint8_t i);
 static int write_string(char* prefix, SSL* ssl, int socket, char* str);
+static int read_buffer(char* prefix, SSL* ssl, int socket, unsigned char** buffer, size_t* size);
+static int write_buffer(char* prefix, SSL* ssl, int socket, unsigned char* buffer, size_t size);
+static int read_binary(SSL* ssl, int socket, uint8_t compression, uint8_t encryption, struct json** json);
+static int write_binary(SSL* ssl, int socket, uint8_t compression, uint8_t encryption, struct json* json);
 static int read_complete(SSL* ssl, int socket, void* buf, size_t size);
 static int write_complete(SSL* ssl, int socket, void* buf, size_t size);
 static int write_socket(int socket, void* buf, size_t size);
@@ -68,7 +72,14 @@ pgmoneta_management_request_backup(SSL* ssl, int socket, char* server, uint8_t c
       goto error;
    }
 
-   pgmoneta_json_put(request, MANAGEMENT_ARGUMENT_SERVER, (uintptr_t)server, ValueString);
+   if (server != NULL)
+   {
+      pgmoneta_json_put(request, MANAGEMENT_ARGUMENT_SERVER, (uintptr_t)server, ValueString);
+   }
+   else
+   {
+      pgmoneta_json_put(request, MANAGEMENT_ARGUMENT_ALL, (uintptr_t)true, ValueBool);
+   }
    pgmoneta_json_put(request, MANAGEMENT_ARGUMENT_BACKUP, (uintptr_t)incremental, ValueString);
 
    if (pgmoneta_management_write_json(ssl, socket, compression, encryption, j))
@@ -161,7 +172,7 @@ error:
 }
 
 int
-pgmoneta_management_request_verify(SSL* ssl, int socket, char* server, char* backup_id, char* directory, char* files, uint8_t compression, uint8_t encryption, int32_t output_format)
+pgmoneta_management_request_verify(SSL* ssl, int socket, char* server, char* backup_id, char* directory, char* files, int32_t sample, uint8_t compression, uint8_t encryption, int32_t output_format)
 {
    struct json* j = NULL;
    struct json* request = NULL;
@@ -176,10 +187,18 @@ pgmoneta_management_request_verify(SSL* ssl, int socket, char* server, char* bac
       goto error;
    }
 
-   pgmoneta_json_put(request, MANAGEMENT_ARGUMENT_SERVER, (uintptr_t)server, ValueString);
+   if (server != NULL)
+   {
+      pgmoneta_json_put(request, MANAGEMENT_ARGUMENT_SERVER, (uintptr_t)server, ValueString);
+   }
+   else
+   {
+      pgmoneta_json_put(request, MANAGEMENT_ARGUMENT_ALL, (uintptr_t)true, ValueBool);
+   }
    pgmoneta_json_put(request, MANAGEMENT_ARGUMENT_BACKUP, (uintptr_t)backup_id, ValueString);
    pgmoneta_json_put(request, MANAGEMENT_ARGUMENT_DIRECTORY, (uintptr_t)directory, ValueString);
    pgmoneta_json_put(request, MANAGEMENT_ARGUMENT_FILES, (uintptr_t)files, ValueString);
+   pgmoneta_json_put(request, MANAGEMENT_ARGUMENT_SAMPLE, (uintptr_t)sample, ValueInt32);
 
    if (pgmoneta_management_write_json(ssl, socket, compression, encryption, j))
    {
@@ -429,6 +448,40 @@ error:
    return 1;
 }
 
+int
+pgmoneta_management_request_profile(SSL* ssl, int socket, bool reset, uint8_t compression, uint8_t encryption, int32_t output_format)
+{
+   struct json* j = NULL;
+   struct json* request = NULL;
+
+   if (pgmoneta_management_create_header(MANAGEMENT_PROFILE, compression, encryption, output_format, &j))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_management_create_request(j, &request))
+   {
+      goto error;
+   }
+
+   pgmoneta_json_put(request, MANAGEMENT_ARGUMENT_RESET, (uintptr_t)reset, ValueBool);
+
+   if (pgmoneta_management_write_json(ssl, socket, compression, encryption, j))
+   {
+      goto error;
+   }
+
+   pgmoneta_json_destroy(j);
+
+   return 0;
+
+error:
+
+   pgmoneta_json_destroy(j);
+
+   return 1;
+}
+
 int
 pgmoneta_management_request_reload(SSL* ssl, int socket, uint8_t compression, uint8_t encryption, int32_t output_format)
 {
@@ -560,6 +613,78 @@ error:
    return 1;
 }
 
+int
+pgmoneta_management_request_wal_fetch(SSL* ssl, int socket, char* server, char* file, char* destination, uint8_t compression, uint8_t encryption, int32_t output_format)
+{
+   struct json* j = NULL;
+   struct json* request = NULL;
+
+   if (pgmoneta_management_create_header(MANAGEMENT_WAL_FETCH, compression, encryption, output_format, &j))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_management_create_request(j, &request))
+   {
+      goto error;
+   }
+
+   pgmoneta_json_put(request, MANAGEMENT_ARGUMENT_SERVER, (uintptr_t)server, ValueString);
+   pgmoneta_json_put(request, MANAGEMENT_ARGUMENT_FILENAME, (uintptr_t)file, ValueString);
+   pgmoneta_json_put(request, MANAGEMENT_ARGUMENT_DESTINATION_FILE, (uintptr_t)destination, ValueString);
+
+   if (pgmoneta_management_write_json(ssl, socket, compression, encryption, j))
+   {
+      goto error;
+   }
+
+   pgmoneta_json_destroy(j);
+
+   return 0;
+
+error:
+
+   pgmoneta_json_destroy(j);
+
+   return 1;
+}
+
+int
+pgmoneta_management_request_wal_push(SSL* ssl, int socket, char* server, char* file, uint64_t size, uint8_t compression, uint8_t encryption, int32_t output_format)
+{
+   struct json* j = NULL;
+   struct json* request = NULL;
+
+   if (pgmoneta_management_create_header(MANAGEMENT_WAL_PUSH, compression, encryption, output_format, &j))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_management_create_request(j, &request))
+   {
+      goto error;
+   }
+
+   pgmoneta_json_put(request, MANAGEMENT_ARGUMENT_SERVER, (uintptr_t)server, ValueString);
+   pgmoneta_json_put(request, MANAGEMENT_ARGUMENT_FILENAME, (uintptr_t)file, ValueString);
+   pgmoneta_json_put(request, MANAGEMENT_ARGUMENT_BYTES, (uintptr_t)size, ValueUInt64);
+
+   if (pgmoneta_management_write_json(ssl, socket, compression, encryption, j))
+   {
+      goto error;
+   }
+
+   pgmoneta_json_destroy(j);
+
+   return 0;
+
+error:
+
+   pgmoneta_json_destroy(j);
+
+   return 1;
+}
+
 int
 pgmoneta_management_request_retain(SSL* ssl, int socket, char* server, char* backup_id, uint8_t compression, uint8_t encryption, int32_t output_format)
 {
@@ -891,6 +1016,11 @@ pgmoneta_management_response_ok(SSL* ssl, int socket, struct timespec start_time
       goto error;
    }
 
+   if (pgmoneta_log_is_enabled(PGMONETA_LOGGING_LEVEL_DEBUG1))
+   {
+      pgmoneta_value_log_statistics();
+   }
+
    return 0;
 
 error:
@@ -991,6 +1121,11 @@ pgmoneta_management_read_json(SSL* ssl, int socket, uint8_t* compression, uint8_
       *encryption = encrypt_method;
    }
 
+   if (compress_method & MANAGEMENT_ENCODING_BINARY)
+   {
+      return read_binary(ssl, socket, compress_method & ~MANAGEMENT_ENCODING_BINARY, encrypt_method, json);
+   }
+
    if (read_string("pgmoneta-cli", ssl, socket, &s))
    {
       goto error;
@@ -1160,6 +1295,11 @@ pgmoneta_management_write_json(SSL* ssl, int socket, uint8_t compression, uint8_
    size_t encrypted_size = 0;
    size_t encoded_size = 0;
 
+   if (compression & MANAGEMENT_ENCODING_BINARY)
+   {
+      return write_binary(ssl, socket, compression, encryption, json);
+   }
+
    s = pgmoneta_json_to_string(json, FORMAT_JSON_COMPACT, NULL, 0);
 
    if (write_uint8("pgmoneta-cli", ssl, socket, compression))
@@ -1325,6 +1465,131 @@ error:
    return 1;
 }
 
+int
+pgmoneta_management_read_data(SSL* ssl, int socket, unsigned char** data, size_t* size)
+{
+   return read_buffer("pgmoneta-cli", ssl, socket, data, size);
+}
+
+int
+pgmoneta_management_write_data(SSL* ssl, int socket, void* data, size_t size)
+{
+   return write_buffer("pgmoneta-cli", ssl, socket, (unsigned char*)data, size);
+}
+
+static int
+read_binary(SSL* ssl, int socket, uint8_t compression, uint8_t encryption, struct json** json)
+{
+   unsigned char* buffer = NULL;
+   unsigned char* decrypted_buffer = NULL;
+   size_t size = 0;
+   size_t decrypted_size = 0;
+   struct json* r = NULL;
+
+   if (read_buffer("pgmoneta-cli", ssl, socket, &buffer, &size))
+   {
+      goto error;
+   }
+
+   if (compression != MANAGEMENT_COMPRESSION_NONE)
+   {
+      pgmoneta_log_error("read_binary: Compression isn't supported with the binary encoding");
+      goto error;
+   }
+
+   if (encryption != MANAGEMENT_ENCRYPTION_NONE)
+   {
+      if (pgmoneta_decrypt_buffer(buffer, size, &decrypted_buffer, &decrypted_size, encryption))
+      {
+         pgmoneta_log_error("read_binary: Failed to decrypt the buffer");
+         goto error;
+      }
+      free(buffer);
+      buffer = decrypted_buffer;
+      size = decrypted_size;
+      decrypted_buffer = NULL;
+   }
+
+   if (pgmoneta_json_from_binary(buffer, size, &r))
+   {
+      pgmoneta_log_error("read_binary: Decoding failed");
+      goto error;
+   }
+
+   *json = r;
+
+   free(buffer);
+
+   return 0;
+
+error:
+
+   free(buffer);
+   free(decrypted_buffer);
+
+   return 1;
+}
+
+static int
+write_binary(SSL* ssl, int socket, uint8_t compression, uint8_t encryption, struct json* json)
+{
+   unsigned char* buffer = NULL;
+   unsigned char* encrypted_buffer = NULL;
+   size_t size = 0;
+   size_t encrypted_size = 0;
+
+   if ((compression & ~MANAGEMENT_ENCODING_BINARY) != MANAGEMENT_COMPRESSION_NONE)
+   {
+      pgmoneta_log_error("write_binary: Compression isn't supported with the binary encoding");
+      goto error;
+   }
+
+   if (pgmoneta_json_to_binary(json, &buffer, &size))
+   {
+      pgmoneta_log_error("write_binary: Encoding failed");
+      goto error;
+   }
+
+   if (encryption != MANAGEMENT_ENCRYPTION_NONE)
+   {
+      if (pgmoneta_encrypt_buffer(buffer, size, &encrypted_buffer, &encrypted_size, encryption))
+      {
+         pgmoneta_log_error("write_binary: Failed to encrypt the buffer");
+         goto error;
+      }
+      free(buffer);
+      buffer = encrypted_buffer;
+      size = encrypted_size;
+      encrypted_buffer = NULL;
+   }
+
+   if (write_uint8("pgmoneta-cli", ssl, socket, compression))
+   {
+      goto error;
+   }
+
+   if (write_uint8("pgmoneta-cli", ssl, socket, encryption))
+   {
+      goto error;
+   }
+
+   if (write_buffer("pgmoneta-cli", ssl, socket, buffer, size))
+   {
+      goto error;
+   }
+
+   free(buffer);
+
+   return 0;
+
+error:
+
+   free(buffer);
+   free(encrypted_buffer);
+
+   return 1;
+}
+
 static int
 read_uint8(char* prefix, SSL* ssl, int socket, uint8_t* i)
 {
@@ -1445,6 +1710,78 @@ error:
    return 1;
 }
 
+static int
+read_buffer(char* prefix, SSL* ssl, int socket, unsigned char** buffer, size_t* size)
+{
+   unsigned char* b = NULL;
+   char buf4[4] = {0};
+   uint32_t s;
+
+   *buffer = NULL;
+   *size = 0;
+
+   if (read_complete(ssl, socket, &buf4[0], sizeof(buf4)))
+   {
+      pgmoneta_log_warn("%s: read_buffer: %p %d %s", prefix, ssl, socket, strerror(errno));
+      errno = 0;
+      goto error;
+   }
+
+   s = pgmoneta_read_uint32(&buf4);
+
+   b = malloc(s > 0 ? s : 1);
+
+   if (b == NULL)
+   {
+      goto error;
+   }
+
+   if (s > 0 && read_complete(ssl, socket, b, s))
+   {
+      pgmoneta_log_warn("%s: read_buffer: %p %d %s", prefix, ssl, socket, strerror(errno));
+      errno = 0;
+      goto error;
+   }
+
+   *buffer = b;
+   *size = s;
+
+   return 0;
+
+error:
+
+   free(b);
+
+   return 1;
+}
+
+static int
+write_buffer(char* prefix, SSL* ssl, int socket, unsigned char* buffer, size_t size)
+{
+   char buf4[4] = {0};
+
+   pgmoneta_write_uint32(&buf4, size);
+   if (write_complete(ssl, socket, &buf4, sizeof(buf4)))
+   {
+      pgmoneta_log_warn("%s: write_buffer: %p %d %s", prefix, ssl, socket, strerror(errno));
+      errno = 0;
+      goto error;
+   }
+
+   if (size > 0 && write_complete(ssl, socket, buffer, size))
+   {
+      pgmoneta_log_warn("%s: write_buffer: %p %d %s", prefix, ssl, socket, strerror(errno));
+      errno = 0;
+      goto error;
+   }
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
 static int
 read_complete(SSL* ssl, int socket, void* buf, size_t size)
 {
@@ -1680,7 +2017,7 @@ pgmoneta_management_create_header(int32_t command, uint8_t compression, uint8_t
    pgmoneta_json_put(header, MANAGEMENT_ARGUMENT_CLIENT_VERSION, (uintptr_t)VERSION, ValueString);
    pgmoneta_json_put(header, MANAGEMENT_ARGUMENT_OUTPUT, (uintptr_t)output_format, ValueUInt8);
    pgmoneta_json_put(header, MANAGEMENT_ARGUMENT_TIMESTAMP, (uintptr_t)timestamp, ValueString);
-   pgmoneta_json_put(header, MANAGEMENT_ARGUMENT_COMPRESSION, (uintptr_t)compression, ValueUInt8);
+   pgmoneta_json_put(header, MANAGEMENT_ARGUMENT_COMPRESSION, (uintptr_t)(compression & ~MANAGEMENT_ENCODING_BINARY), ValueUInt8);
    pgmoneta_json_put(header, MANAGEMENT_ARGUMENT_ENCRYPTION, (uintptr_t)encryption, ValueUInt8);
 
    pgmoneta_json_put(j, MANAGEMENT_CATEGORY_HEADER, (uintptr_t)header, ValueJSON);
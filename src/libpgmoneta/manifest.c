@@ -36,8 +36,134 @@
 #include <utils.h>
 
 /* system */
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/** @struct manifest_run
+ * Defines a sorted run of a manifest being merged
+ */
+struct manifest_run
+{
+   struct csv_reader* reader; /**< The reader of the run */
+   char** row;                /**< The current row */
+};
+
+static char* diff_names[NUMBER_OF_MANIFEST_DIFFS] = {"deleted.manifest", "changed.manifest", "added.manifest"};
+
+static int compare_manifests_chunked(char* old_manifest, char* new_manifest, struct art* deleted, struct art* changed, struct art* added);
+static int compare_manifests_sorted(char* old_manifest, char* new_manifest, struct art** trees, struct csv_writer** writers, bool* manifest_changed, bool* sorted);
+static int diff_emit(struct art** trees, struct csv_writer** writers, int kind, char** row);
+static int diff_write(struct manifest_diff* diff, char* old_manifest, char* new_manifest, bool* sorted);
+static int diff_sorted_copy(char* directory, char* manifest, char* name, char* path, size_t size);
+static int diff_row_compare(char* row, size_t length, char* path);
+static bool next_row(struct csv_reader* reader, char*** row);
+static int manifest_file_compare(const void* a, const void* b);
+static int write_run(char* path, struct manifest_file* files, int number_of_files);
+static bool run_less(struct manifest_run* runs, int a, int b);
+static void run_sift_down(struct manifest_run* runs, int* heap, int size, int i);
+static void run_path(char* manifest, int run, char* path, size_t size);
+
+static int
+diff_emit(struct art** trees, struct csv_writer** writers, int kind, char** row)
+{
+   if (trees != NULL)
+   {
+      return pgmoneta_art_insert(trees[kind], row[MANIFEST_PATH_INDEX], (uintptr_t)row[MANIFEST_CHECKSUM_INDEX], ValueString);
+   }
+
+   return pgmoneta_csv_write(writers[kind], MANIFEST_COLUMN_COUNT, row);
+}
+
+static int
+diff_write(struct manifest_diff* diff, char* old_manifest, char* new_manifest, bool* sorted)
+{
+   struct csv_writer* writers[NUMBER_OF_MANIFEST_DIFFS];
+
+   *sorted = true;
+
+   memset(writers, 0, sizeof(writers));
+
+   for (int i = 0; i < NUMBER_OF_MANIFEST_DIFFS; i++)
+   {
+      if (pgmoneta_csv_writer_init(diff->paths[i], &writers[i]))
+      {
+         pgmoneta_log_error("Could not create csv writer for %s", diff->paths[i]);
+         goto error;
+      }
+   }
+
+   if (compare_manifests_sorted(old_manifest, new_manifest, NULL, writers, &diff->manifest_changed, sorted))
+   {
+      goto error;
+   }
+
+   for (int i = 0; i < NUMBER_OF_MANIFEST_DIFFS; i++)
+   {
+      if (fflush(writers[i]->file))
+      {
+         pgmoneta_log_error("Could not write %s due to %s", diff->paths[i], strerror(errno));
+         errno = 0;
+         goto error;
+      }
+
+      pgmoneta_csv_writer_destroy(writers[i]);
+      writers[i] = NULL;
+   }
+
+   return 0;
+
+error:
+
+   for (int i = 0; i < NUMBER_OF_MANIFEST_DIFFS; i++)
+   {
+      pgmoneta_csv_writer_destroy(writers[i]);
+   }
+
+   return 1;
+}
+
+static int
+diff_sorted_copy(char* directory, char* manifest, char* name, char* path, size_t size)
+{
+   memset(path, 0, size);
+   snprintf(path, size, "%s/%s", directory, name);
+
+   if (pgmoneta_copy_file(manifest, path, NULL))
+   {
+      pgmoneta_log_error("Could not copy %s to %s", manifest, path);
+      return 1;
+   }
+
+   return pgmoneta_manifest_sort(path);
+}
+
+static int
+diff_row_compare(char* row, size_t length, char* path)
+{
+   size_t i = 0;
+
+   /* Like strcmp on the path column of the row */
+   for (; i < length && row[i] != ','; i++)
+   {
+      if (path[i] == '\0')
+      {
+         return 1;
+      }
+
+      if (row[i] != path[i])
+      {
+         return (unsigned char)row[i] < (unsigned char)path[i] ? -1 : 1;
+      }
+   }
+
+   return path[i] == '\0' ? 0 : -1;
+}
 
 static void
 build_deque(struct deque* deque, struct csv_reader* reader, char** f);
@@ -125,14 +251,636 @@ error:
 
 int
 pgmoneta_compare_manifests(char* old_manifest, char* new_manifest, struct art** deleted_files, struct art** changed_files, struct art** added_files)
+{
+   struct art* deleted = NULL;
+   struct art* changed = NULL;
+   struct art* added = NULL;
+   struct art* trees[NUMBER_OF_MANIFEST_DIFFS];
+   bool manifest_changed = false;
+   bool sorted = true;
+
+   *deleted_files = NULL;
+   *changed_files = NULL;
+   *added_files = NULL;
+
+   pgmoneta_art_create_with_arena(&deleted);
+   pgmoneta_art_create_with_arena(&added);
+   pgmoneta_art_create_with_arena(&changed);
+
+   trees[MANIFEST_DIFF_DELETED] = deleted;
+   trees[MANIFEST_DIFF_CHANGED] = changed;
+   trees[MANIFEST_DIFF_ADDED] = added;
+
+   if (compare_manifests_sorted(old_manifest, new_manifest, trees, NULL, &manifest_changed, &sorted))
+   {
+      if (sorted)
+      {
+         goto error;
+      }
+
+      /* Manifests written before they were sorted need the chunked comparison */
+      pgmoneta_log_debug("Manifests %s and %s are not sorted", old_manifest, new_manifest);
+
+      pgmoneta_art_destroy(deleted);
+      pgmoneta_art_destroy(added);
+      pgmoneta_art_destroy(changed);
+
+      deleted = NULL;
+      added = NULL;
+      changed = NULL;
+
+      pgmoneta_art_create_with_arena(&deleted);
+      pgmoneta_art_create_with_arena(&added);
+      pgmoneta_art_create_with_arena(&changed);
+
+      if (compare_manifests_chunked(old_manifest, new_manifest, deleted, changed, added))
+      {
+         goto error;
+      }
+   }
+   else if (manifest_changed)
+   {
+      pgmoneta_art_insert(changed, "backup_manifest", (uintptr_t)"backup manifest", ValueString);
+   }
+
+   *deleted_files = deleted;
+   *changed_files = changed;
+   *added_files = added;
+
+   return 0;
+
+error:
+
+   pgmoneta_art_destroy(deleted);
+   pgmoneta_art_destroy(added);
+   pgmoneta_art_destroy(changed);
+
+   return 1;
+}
+
+int
+pgmoneta_manifest_load(char* manifest, struct art** files)
+{
+   struct csv_reader* reader = NULL;
+   struct art* tree = NULL;
+   char** row = NULL;
+   int cols = 0;
+
+   *files = NULL;
+
+   if (pgmoneta_csv_reader_init(manifest, &reader))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_art_create_with_arena(&tree))
+   {
+      goto error;
+   }
+
+   while (pgmoneta_csv_next_row(reader, &cols, &row))
+   {
+      if (cols != MANIFEST_COLUMN_COUNT)
+      {
+         pgmoneta_log_error("Incorrect number of columns in manifest file");
+         continue;
+      }
+
+      pgmoneta_art_insert(tree, row[MANIFEST_PATH_INDEX], (uintptr_t)row[MANIFEST_CHECKSUM_INDEX], ValueString);
+   }
+
+   pgmoneta_csv_reader_destroy(reader);
+
+   *files = tree;
+
+   return 0;
+
+error:
+
+   pgmoneta_csv_reader_destroy(reader);
+   pgmoneta_art_destroy(tree);
+
+   return 1;
+}
+
+int
+pgmoneta_manifest_sort(char* manifest)
+{
+   struct csv_reader* reader = NULL;
+   struct manifest_file* files = NULL;
+   struct manifest_run* runs = NULL;
+   struct csv_writer* writer = NULL;
+   int* heap = NULL;
+   int number_of_files = 0;
+   int number_of_runs = 0;
+   int size = 0;
+   bool more = true;
+   bool direct = false;
+   char** row = NULL;
+   char path[MAX_PATH];
+   char tmp[MAX_PATH];
+
+   files = (struct manifest_file*)calloc(MANIFEST_CHUNK_SIZE, sizeof(struct manifest_file));
+   if (files == NULL)
+   {
+      goto error;
+   }
+
+   if (pgmoneta_csv_reader_init(manifest, &reader))
+   {
+      goto error;
+   }
+
+   memset(tmp, 0, sizeof(tmp));
+   snprintf(tmp, sizeof(tmp), "%s.tmp", manifest);
+
+   /* Sort the manifest in runs of a chunk, so the memory use is bounded */
+   while (more)
+   {
+      number_of_files = 0;
+
+      while (number_of_files < MANIFEST_CHUNK_SIZE && (more = next_row(reader, &row)))
+      {
+         files[number_of_files].path = strdup(row[MANIFEST_PATH_INDEX]);
+         files[number_of_files].checksum = strdup(row[MANIFEST_CHECKSUM_INDEX]);
+         if (files[number_of_files].path == NULL || files[number_of_files].checksum == NULL)
+         {
+            number_of_files++;
+            goto error;
+         }
+
+         number_of_files++;
+      }
+
+      if (number_of_files == 0 && number_of_runs > 0)
+      {
+         break;
+      }
+
+      qsort(files, number_of_files, sizeof(struct manifest_file), manifest_file_compare);
+
+      /* A manifest that fits in one chunk is written directly */
+      if (number_of_runs == 0 && !more)
+      {
+         direct = true;
+
+         if (write_run(tmp, files, number_of_files))
+         {
+            goto error;
+         }
+      }
+      else
+      {
+         run_path(manifest, number_of_runs, path, sizeof(path));
+
+         if (write_run(path, files, number_of_files))
+         {
+            goto error;
+         }
+      }
+
+      number_of_runs++;
+
+      for (int i = 0; i < number_of_files; i++)
+      {
+         free(files[i].path);
+         free(files[i].checksum);
+      }
+      number_of_files = 0;
+   }
+
+   pgmoneta_csv_reader_destroy(reader);
+   reader = NULL;
+
+   if (!direct)
+   {
+      runs = (struct manifest_run*)calloc(number_of_runs, sizeof(struct manifest_run));
+      heap = (int*)calloc(number_of_runs, sizeof(int));
+      if (runs == NULL || heap == NULL)
+      {
+         goto error;
+      }
+
+      for (int i = 0; i < number_of_runs; i++)
+      {
+         run_path(manifest, i, path, sizeof(path));
+
+         if (pgmoneta_csv_reader_init(path, &runs[i].reader))
+         {
+            goto error;
+         }
+
+         if (next_row(runs[i].reader, &runs[i].row))
+         {
+            heap[size++] = i;
+         }
+      }
+
+      for (int i = size / 2 - 1; i >= 0; i--)
+      {
+         run_sift_down(runs, heap, size, i);
+      }
+
+      if (pgmoneta_csv_writer_init(tmp, &writer))
+      {
+         goto error;
+      }
+
+      /* Merge the runs, always taking the smallest current row */
+      while (size > 0)
+      {
+         struct manifest_run* r = &runs[heap[0]];
+
+         pgmoneta_csv_write(writer, MANIFEST_COLUMN_COUNT, r->row);
+
+         if (!next_row(r->reader, &r->row))
+         {
+            heap[0] = heap[--size];
+         }
+
+         run_sift_down(runs, heap, size, 0);
+      }
+
+      pgmoneta_csv_writer_destroy(writer);
+      writer = NULL;
+   }
+
+   if (rename(tmp, manifest))
+   {
+      pgmoneta_log_error("Could not rename %s due to %s", tmp, strerror(errno));
+      errno = 0;
+      goto error;
+   }
+
+   if (runs != NULL)
+   {
+      for (int i = 0; i < number_of_runs; i++)
+      {
+         pgmoneta_csv_reader_destroy(runs[i].reader);
+
+         run_path(manifest, i, path, sizeof(path));
+         unlink(path);
+      }
+   }
+
+   free(runs);
+   free(heap);
+   free(files);
+
+   return 0;
+
+error:
+
+   pgmoneta_log_error("Could not sort manifest %s", manifest);
+
+   pgmoneta_csv_reader_destroy(reader);
+   pgmoneta_csv_writer_destroy(writer);
+
+   if (files != NULL)
+   {
+      for (int i = 0; i < number_of_files; i++)
+      {
+         free(files[i].path);
+         free(files[i].checksum);
+      }
+   }
+
+   if (runs != NULL)
+   {
+      for (int i = 0; i < number_of_runs; i++)
+      {
+         pgmoneta_csv_reader_destroy(runs[i].reader);
+      }
+   }
+
+   for (int i = 0; i < number_of_runs; i++)
+   {
+      run_path(manifest, i, path, sizeof(path));
+      unlink(path);
+   }
+   unlink(tmp);
+
+   free(runs);
+   free(heap);
+   free(files);
+
+   return 1;
+}
+
+int
+pgmoneta_manifest_diff(char* directory, char* old_manifest, char* new_manifest, struct manifest_diff** diff)
+{
+   struct manifest_diff* d = NULL;
+   struct stat st;
+   char old_sorted[MAX_PATH];
+   char new_sorted[MAX_PATH];
+   bool sorted = true;
+   int fd = -1;
+
+   *diff = NULL;
+
+   d = (struct manifest_diff*)calloc(1, sizeof(struct manifest_diff));
+   if (d == NULL)
+   {
+      goto error;
+   }
+
+   snprintf(d->directory, sizeof(d->directory), "%s%smanifest-diff.XXXXXX",
+            directory, pgmoneta_ends_with(directory, "/") ? "" : "/");
+
+   if (mkdtemp(d->directory) == NULL)
+   {
+      pgmoneta_log_error("Could not create %s due to %s", d->directory, strerror(errno));
+      errno = 0;
+      memset(d->directory, 0, sizeof(d->directory));
+      goto error;
+   }
+
+   for (int i = 0; i < NUMBER_OF_MANIFEST_DIFFS; i++)
+   {
+      snprintf(d->paths[i], sizeof(d->paths[i]), "%s/%s", d->directory, diff_names[i]);
+   }
+
+   if (diff_write(d, old_manifest, new_manifest, &sorted))
+   {
+      if (sorted)
+      {
+         goto error;
+      }
+
+      /* Manifests written before they were sorted are sorted in runs on disk first */
+      pgmoneta_log_debug("Manifests %s and %s are not sorted", old_manifest, new_manifest);
+
+      if (diff_sorted_copy(d->directory, old_manifest, "old.manifest", old_sorted, sizeof(old_sorted)) ||
+          diff_sorted_copy(d->directory, new_manifest, "new.manifest", new_sorted, sizeof(new_sorted)))
+      {
+         goto error;
+      }
+
+      if (diff_write(d, old_sorted, new_sorted, &sorted))
+      {
+         goto error;
+      }
+
+      unlink(old_sorted);
+      unlink(new_sorted);
+   }
+
+   for (int i = 0; i < NUMBER_OF_MANIFEST_DIFFS; i++)
+   {
+      fd = open(d->paths[i], O_RDONLY);
+      if (fd == -1 || fstat(fd, &st))
+      {
+         goto error;
+      }
+
+      /* An empty set can't be mapped, and nothing is in it */
+      if (st.st_size > 0)
+      {
+         d->data[i] = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+         if (d->data[i] == MAP_FAILED)
+         {
+            d->data[i] = NULL;
+            goto error;
+         }
+
+         d->size[i] = (size_t)st.st_size;
+         madvise(d->data[i], d->size[i], MADV_RANDOM);
+      }
+
+      close(fd);
+      fd = -1;
+   }
+
+   *diff = d;
+
+   return 0;
+
+error:
+
+   if (fd != -1)
+   {
+      close(fd);
+   }
+
+   pgmoneta_manifest_diff_destroy(d);
+
+   return 1;
+}
+
+bool
+pgmoneta_manifest_diff_contains(struct manifest_diff* diff, int kind, char* path)
+{
+   char* data = NULL;
+   char* end = NULL;
+   size_t low = 0;
+   size_t high = 0;
+   size_t start = 0;
+   size_t length = 0;
+   int c;
+
+   if (diff == NULL || path == NULL || kind < 0 || kind >= NUMBER_OF_MANIFEST_DIFFS)
+   {
+      return false;
+   }
+
+   /* backup_manifest differs when any file does, and isn't part of the sorted files */
+   if (kind == MANIFEST_DIFF_CHANGED && !strcmp(path, "backup_manifest"))
+   {
+      return diff->manifest_changed;
+   }
+
+   data = diff->data[kind];
+   high = diff->size[kind];
+
+   /* Both bounds are at the start of a row, so a probe goes back to the start of its row */
+   while (low < high)
+   {
+      start = low + (high - low) / 2;
+
+      while (start > low && data[start - 1] != '\n')
+      {
+         start--;
+      }
+
+      end = memchr(data + start, '\n', diff->size[kind] - start);
+      length = end != NULL ? (size_t)(end - (data + start)) : diff->size[kind] - start;
+
+      c = diff_row_compare(data + start, length, path);
+
+      if (c == 0)
+      {
+         return true;
+      }
+      else if (c < 0)
+      {
+         low = start + length + 1;
+      }
+      else
+      {
+         high = start;
+      }
+   }
+
+   return false;
+}
+
+int
+pgmoneta_manifest_diff_reader(struct manifest_diff* diff, int kind, struct csv_reader** reader)
+{
+   *reader = NULL;
+
+   if (diff == NULL || kind < 0 || kind >= NUMBER_OF_MANIFEST_DIFFS)
+   {
+      return 1;
+   }
+
+   return pgmoneta_csv_reader_init(diff->paths[kind], reader);
+}
+
+void
+pgmoneta_manifest_diff_destroy(struct manifest_diff* diff)
+{
+   if (diff == NULL)
+   {
+      return;
+   }
+
+   for (int i = 0; i < NUMBER_OF_MANIFEST_DIFFS; i++)
+   {
+      if (diff->data[i] != NULL)
+      {
+         munmap(diff->data[i], diff->size[i]);
+      }
+   }
+
+   if (strlen(diff->directory) > 0)
+   {
+      pgmoneta_delete_directory(diff->directory);
+   }
+
+   free(diff);
+}
+
+static int
+compare_manifests_sorted(char* old_manifest, char* new_manifest, struct art** trees, struct csv_writer** writers, bool* manifest_changed, bool* sorted)
+{
+   struct csv_reader* r1 = NULL;
+   struct csv_reader* r2 = NULL;
+   char** f1 = NULL;
+   char** f2 = NULL;
+   bool has1 = false;
+   bool has2 = false;
+   char previous1[MAX_PATH];
+   char previous2[MAX_PATH];
+   int c;
+   int kind;
+
+   *manifest_changed = false;
+   *sorted = true;
+
+   memset(previous1, 0, sizeof(previous1));
+   memset(previous2, 0, sizeof(previous2));
+
+   if (pgmoneta_csv_reader_init(old_manifest, &r1))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_csv_reader_init(new_manifest, &r2))
+   {
+      goto error;
+   }
+
+   has1 = next_row(r1, &f1);
+   has2 = next_row(r2, &f2);
+
+   /* Both manifests are sorted on the path, so a single merge pass finds all the differences */
+   while (has1 || has2)
+   {
+      if (has1 && strcmp(f1[MANIFEST_PATH_INDEX], previous1) < 0)
+      {
+         *sorted = false;
+         goto error;
+      }
+
+      if (has2 && strcmp(f2[MANIFEST_PATH_INDEX], previous2) < 0)
+      {
+         *sorted = false;
+         goto error;
+      }
+
+      if (!has1)
+      {
+         c = 1;
+      }
+      else if (!has2)
+      {
+         c = -1;
+      }
+      else
+      {
+         c = strcmp(f1[MANIFEST_PATH_INDEX], f2[MANIFEST_PATH_INDEX]);
+      }
+
+      kind = -1;
+
+      if (c < 0)
+      {
+         kind = MANIFEST_DIFF_DELETED;
+      }
+      else if (c > 0)
+      {
+         kind = MANIFEST_DIFF_ADDED;
+      }
+      else if (strcmp(f1[MANIFEST_CHECKSUM_INDEX], f2[MANIFEST_CHECKSUM_INDEX]))
+      {
+         kind = MANIFEST_DIFF_CHANGED;
+      }
+
+      if (kind != -1)
+      {
+         *manifest_changed = true;
+
+         if (diff_emit(trees, writers, kind, kind == MANIFEST_DIFF_ADDED ? f2 : f1))
+         {
+            goto error;
+         }
+      }
+
+      if (c <= 0)
+      {
+         snprintf(previous1, sizeof(previous1), "%s", f1[MANIFEST_PATH_INDEX]);
+         has1 = next_row(r1, &f1);
+      }
+
+      if (c >= 0)
+      {
+         snprintf(previous2, sizeof(previous2), "%s", f2[MANIFEST_PATH_INDEX]);
+         has2 = next_row(r2, &f2);
+      }
+   }
+
+   pgmoneta_csv_reader_destroy(r1);
+   pgmoneta_csv_reader_destroy(r2);
+
+   return 0;
+
+error:
+
+   pgmoneta_csv_reader_destroy(r1);
+   pgmoneta_csv_reader_destroy(r2);
+
+   return 1;
+}
+
+static int
+compare_manifests_chunked(char* old_manifest, char* new_manifest, struct art* deleted, struct art* changed, struct art* added)
 {
    struct csv_reader* r1 = NULL;
    char** f1 = NULL;
    struct csv_reader* r2 = NULL;
    char** f2 = NULL;
-   struct art* deleted = NULL;
-   struct art* changed = NULL;
-   struct art* added = NULL;
    char* checksum = NULL;
    int cols = 0;
    bool manifest_changed = false;
@@ -140,16 +888,8 @@ pgmoneta_compare_manifests(char* old_manifest, char* new_manifest, struct art**
    struct deque* que = NULL;
    struct deque_iterator* iter = NULL;
 
-   *deleted_files = NULL;
-   *changed_files = NULL;
-   *added_files = NULL;
-
    pgmoneta_deque_create(false, &que);
 
-   pgmoneta_art_create(&deleted);
-   pgmoneta_art_create(&added);
-   pgmoneta_art_create(&changed);
-
    if (pgmoneta_csv_reader_init(old_manifest, &r1))
    {
       goto error;
@@ -165,7 +905,6 @@ pgmoneta_compare_manifests(char* old_manifest, char* new_manifest, struct art**
       if (cols != MANIFEST_COLUMN_COUNT)
       {
          pgmoneta_log_error("Incorrect number of columns in manifest file");
-         free(f1);
          continue;
       }
       // build left chunk into a deque
@@ -175,11 +914,10 @@ pgmoneta_compare_manifests(char* old_manifest, char* new_manifest, struct art**
          if (cols != MANIFEST_COLUMN_COUNT)
          {
             pgmoneta_log_error("Incorrect number of columns in manifest file");
-            free(f2);
             continue;
          }
          // build every right chunk into an ART
-         pgmoneta_art_create(&tree);
+         pgmoneta_art_create_with_arena(&tree);
          build_tree(tree, r2, f2);
          pgmoneta_deque_iterator_create(que, &iter);
          while (pgmoneta_deque_iterator_next(iter))
@@ -202,11 +940,11 @@ pgmoneta_compare_manifests(char* old_manifest, char* new_manifest, struct art**
                }
             }
          }
+         pgmoneta_deque_iterator_destroy(iter);
+         iter = NULL;
          pgmoneta_art_destroy(tree);
          tree = NULL;
       }
-      pgmoneta_deque_iterator_destroy(iter);
-      iter = NULL;
 
       // traverse
       while (!pgmoneta_deque_empty(que))
@@ -235,7 +973,6 @@ pgmoneta_compare_manifests(char* old_manifest, char* new_manifest, struct art**
       if (cols != MANIFEST_COLUMN_COUNT)
       {
          pgmoneta_log_error("Incorrect number of columns in manifest file");
-         free(f2);
          continue;
       }
       build_deque(que, r2, f2);
@@ -244,10 +981,9 @@ pgmoneta_compare_manifests(char* old_manifest, char* new_manifest, struct art**
          if (cols != MANIFEST_COLUMN_COUNT)
          {
             pgmoneta_log_error("Incorrect number of columns in manifest file");
-            free(f1);
             continue;
          }
-         pgmoneta_art_create(&tree);
+         pgmoneta_art_create_with_arena(&tree);
          build_tree(tree, r1, f1);
          pgmoneta_deque_iterator_create(que, &iter);
          while (pgmoneta_deque_iterator_next(iter))
@@ -259,11 +995,11 @@ pgmoneta_compare_manifests(char* old_manifest, char* new_manifest, struct art**
                pgmoneta_deque_iterator_remove(iter);
             }
          }
+         pgmoneta_deque_iterator_destroy(iter);
+         iter = NULL;
          pgmoneta_art_destroy(tree);
          tree = NULL;
       }
-      pgmoneta_deque_iterator_destroy(iter);
-      iter = NULL;
 
       while (!pgmoneta_deque_empty(que))
       {
@@ -286,10 +1022,6 @@ pgmoneta_compare_manifests(char* old_manifest, char* new_manifest, struct art**
       pgmoneta_art_insert(changed, "backup_manifest", (uintptr_t)"backup manifest", ValueString);
    }
 
-   *deleted_files = deleted;
-   *changed_files = changed;
-   *added_files = added;
-
    pgmoneta_csv_reader_destroy(r1);
    pgmoneta_csv_reader_destroy(r2);
    pgmoneta_art_destroy(tree);
@@ -319,20 +1051,16 @@ build_deque(struct deque* deque, struct csv_reader* reader, char** f)
    path = f[MANIFEST_PATH_INDEX];
    checksum = f[MANIFEST_CHECKSUM_INDEX];
    pgmoneta_deque_add(deque, path, (uintptr_t)checksum, ValueString);
-   free(f);
    while (deque->size < MANIFEST_CHUNK_SIZE && pgmoneta_csv_next_row(reader, &cols, &entry))
    {
       if (cols != MANIFEST_COLUMN_COUNT)
       {
          pgmoneta_log_error("Incorrect number of columns in manifest file");
-         free(entry);
          continue;
       }
       path = entry[MANIFEST_PATH_INDEX];
       checksum = entry[MANIFEST_CHECKSUM_INDEX];
       pgmoneta_deque_add(deque, path, (uintptr_t)checksum, ValueString);
-      free(entry);
-      entry = NULL;
    }
 }
 
@@ -348,17 +1076,125 @@ build_tree(struct art* tree, struct csv_reader* reader, char** f)
    }
    path = f[MANIFEST_PATH_INDEX];
    pgmoneta_art_insert(tree, path, (uintptr_t)f[MANIFEST_CHECKSUM_INDEX], ValueString);
-   free(f);
    while (tree->size < MANIFEST_CHUNK_SIZE && pgmoneta_csv_next_row(reader, &cols, &entry))
    {
       if (cols != MANIFEST_COLUMN_COUNT)
       {
          pgmoneta_log_error("Incorrect number of columns in manifest file");
-         free(entry);
          continue;
       }
       path = entry[MANIFEST_PATH_INDEX];
       pgmoneta_art_insert(tree, path, (uintptr_t)entry[MANIFEST_CHECKSUM_INDEX], ValueString);
-      free(entry);
    }
 }
+
+static bool
+next_row(struct csv_reader* reader, char*** row)
+{
+   int cols = 0;
+
+   *row = NULL;
+
+   while (pgmoneta_csv_next_row(reader, &cols, row))
+   {
+      if (cols == MANIFEST_COLUMN_COUNT)
+      {
+         return true;
+      }
+
+      pgmoneta_log_error("Incorrect number of columns in manifest file");
+      *row = NULL;
+   }
+
+   return false;
+}
+
+static int
+manifest_file_compare(const void* a, const void* b)
+{
+   return strcmp(((struct manifest_file*)a)->path, ((struct manifest_file*)b)->path);
+}
+
+static int
+write_run(char* path, struct manifest_file* files, int number_of_files)
+{
+   struct csv_writer* writer = NULL;
+   char* row[MANIFEST_COLUMN_COUNT];
+
+   if (pgmoneta_csv_writer_init(path, &writer))
+   {
+      pgmoneta_log_error("Could not create csv writer for %s", path);
+      goto error;
+   }
+
+   for (int i = 0; i < number_of_files; i++)
+   {
+      row[MANIFEST_PATH_INDEX] = files[i].path;
+      row[MANIFEST_CHECKSUM_INDEX] = files[i].checksum;
+
+      if (pgmoneta_csv_write(writer, MANIFEST_COLUMN_COUNT, row))
+      {
+         goto error;
+      }
+   }
+
+   pgmoneta_csv_writer_destroy(writer);
+
+   return 0;
+
+error:
+
+   pgmoneta_csv_writer_destroy(writer);
+
+   return 1;
+}
+
+static bool
+run_less(struct manifest_run* runs, int a, int b)
+{
+   return strcmp(runs[a].row[MANIFEST_PATH_INDEX], runs[b].row[MANIFEST_PATH_INDEX]) < 0;
+}
+
+static void
+run_sift_down(struct manifest_run* runs, int* heap, int size, int i)
+{
+   int smallest;
+   int l;
+   int r;
+   int t;
+
+   while (true)
+   {
+      smallest = i;
+      l = 2 * i + 1;
+      r = 2 * i + 2;
+
+      if (l < size && run_less(runs, heap[l], heap[smallest]))
+      {
+         smallest = l;
+      }
+
+      if (r < size && run_less(runs, heap[r], heap[smallest]))
+      {
+         smallest = r;
+      }
+
+      if (smallest == i)
+      {
+         break;
+      }
+
+      t = heap[i];
+      heap[i] = heap[smallest];
+      heap[smallest] = t;
+
+      i = smallest;
+   }
+}
+
+static void
+run_path(char* manifest, int run, char* path, size_t size)
+{
+   memset(path, 0, size);
+   snprintf(path, size, "%s.run.%d", manifest, run);
+}
@@ -28,17 +28,162 @@
 
 /* pgmoneta */
 #include <pgmoneta.h>
+#include <memory.h>
+#include <prometheus.h>
 #include <utils.h>
 
 /* system */
 #ifdef DEBUG
 #include <assert.h>
 #endif
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+
+/* per thread, so multiplexed WAL receivers don't share the message */
+static _Thread_local struct message* message = NULL;
+static _Thread_local void* data = NULL;
+
+/* per process, the buffers given back are kept on a free list inside the buffers */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned char pool_hugepage = HUGEPAGE_OFF;
+static void* pool_free = NULL;
+static char* pool_slabs[MEMORY_SLABS];
+static int pool_number_of_slabs = 0;
+
+/* per process, the memory held by the buffers and the arenas */
+static pthread_mutex_t account_lock = PTHREAD_MUTEX_INITIALIZER;
+static long account_used = 0;
+static int account_workflow = -1;
+static int account_depth = 0;
+static atomic_bool account_pressure = false;
+
+static int pool_grow(void);
+static bool pool_owns(void* buffer);
+static void account_update(long delta);
 
-static struct message* message = NULL;
-static void* data = NULL;
+void
+pgmoneta_memory_pool_init(unsigned char hugepage)
+{
+   pool_hugepage = hugepage;
+}
+
+void*
+pgmoneta_memory_buffer_get(size_t size)
+{
+   void* buffer = NULL;
+
+   if (size <= MEMORY_BUFFER_SIZE)
+   {
+      pthread_mutex_lock(&pool_lock);
+
+      if (pool_free == NULL)
+      {
+         pool_grow();
+      }
+
+      if (pool_free != NULL)
+      {
+         buffer = pool_free;
+         pool_free = *(void**)buffer;
+      }
+
+      pthread_mutex_unlock(&pool_lock);
+
+      if (buffer != NULL)
+      {
+         pgmoneta_memory_account(MEMORY_BUFFER_SIZE);
+         return buffer;
+      }
+   }
+
+   /* The size is kept in front of the buffer, so it is accounted when given back */
+   size = pgmoneta_get_aligned_size(size) + ALIGNMENT_SIZE;
+
+   buffer = aligned_alloc((size_t)ALIGNMENT_SIZE, size);
+   if (buffer == NULL)
+   {
+      return NULL;
+   }
+
+   *(size_t*)buffer = size;
+   pgmoneta_memory_account((long)size);
+
+   return (char*)buffer + ALIGNMENT_SIZE;
+}
+
+void
+pgmoneta_memory_buffer_put(void* buffer)
+{
+   if (buffer == NULL)
+   {
+      return;
+   }
+
+   if (!pool_owns(buffer))
+   {
+      buffer = (char*)buffer - ALIGNMENT_SIZE;
+      pgmoneta_memory_account(-(long)*(size_t*)buffer);
+      free(buffer);
+      return;
+   }
+
+   pthread_mutex_lock(&pool_lock);
+   *(void**)buffer = pool_free;
+   pool_free = buffer;
+   pthread_mutex_unlock(&pool_lock);
+
+   pgmoneta_memory_account(-(long)MEMORY_BUFFER_SIZE);
+}
+
+void
+pgmoneta_memory_account(long delta)
+{
+   pthread_mutex_lock(&account_lock);
+   account_update(delta);
+   pthread_mutex_unlock(&account_lock);
+}
+
+void
+pgmoneta_memory_workflow_start(int type)
+{
+   pthread_mutex_lock(&account_lock);
+
+   if (account_depth++ == 0)
+   {
+      account_workflow = type;
+
+      /* The memory the process holds already is the workflow's */
+      pgmoneta_prometheus_memory(type, account_used, account_used, false);
+   }
+
+   pthread_mutex_unlock(&account_lock);
+}
+
+void
+pgmoneta_memory_workflow_finish(void)
+{
+   pthread_mutex_lock(&account_lock);
+
+   if (account_depth > 0 && --account_depth == 0)
+   {
+      /* The memory still held by the process is no longer the workflow's */
+      pgmoneta_prometheus_memory(account_workflow, -account_used, 0, false);
+      account_workflow = -1;
+   }
+
+   pthread_mutex_unlock(&account_lock);
+}
+
+bool
+pgmoneta_memory_pressure(void)
+{
+   return atomic_load(&account_pressure);
+}
 
 void
 pgmoneta_memory_init(void)
@@ -52,7 +197,7 @@ pgmoneta_memory_init(void)
          return;
       }
 
-      data = aligned_alloc((size_t)ALIGNMENT_SIZE, DEFAULT_BUFFER_SIZE);
+      data = pgmoneta_memory_buffer_get(DEFAULT_BUFFER_SIZE);
 
       if (data == NULL)
       {
@@ -93,7 +238,7 @@ pgmoneta_memory_free(void)
 void
 pgmoneta_memory_destroy(void)
 {
-   free(data);
+   pgmoneta_memory_buffer_put(data);
    free(message);
 
    data = NULL;
@@ -150,7 +295,8 @@ pgmoneta_memory_stream_buffer_init(struct stream_buffer** buffer)
 
    b->size = DEFAULT_BUFFER_SIZE;
    b->start = b->end = b->cursor = 0;
-   b->buffer = aligned_alloc((size_t)ALIGNMENT_SIZE, DEFAULT_BUFFER_SIZE);
+   b->idle = 0;
+   b->buffer = pgmoneta_memory_buffer_get(DEFAULT_BUFFER_SIZE);
    *buffer = b;
 }
 
@@ -160,9 +306,11 @@ pgmoneta_memory_stream_buffer_enlarge(struct stream_buffer* buffer, int bytes_ne
    size_t new_size = 0;
    void* new_buffer = NULL;
 
-   if (buffer->size + bytes_needed < buffer->size + DEFAULT_BUFFER_SIZE)
+   // grow geometrically so a burst of large messages doesn't copy the buffer over and over,
+   // unless the process is above its memory budget
+   if (!pgmoneta_memory_pressure() && buffer->size + bytes_needed < buffer->size * 2)
    {
-      new_size = pgmoneta_get_aligned_size(buffer->size + DEFAULT_BUFFER_SIZE);
+      new_size = pgmoneta_get_aligned_size(buffer->size * 2);
    }
    else
    {
@@ -174,17 +322,17 @@ pgmoneta_memory_stream_buffer_enlarge(struct stream_buffer* buffer, int bytes_ne
       return 0;
    }
 
-   new_buffer = aligned_alloc((size_t)ALIGNMENT_SIZE, new_size);
+   new_buffer = pgmoneta_memory_buffer_get(new_size);
 
    if (new_buffer == NULL)
    {
       return 1;
    }
 
-   memset(new_buffer, 0, new_size);
-   memcpy(new_buffer, buffer->buffer, buffer->size);
+   // only the bytes up to the end are live
+   memcpy(new_buffer, buffer->buffer, buffer->end);
 
-   free(buffer->buffer);
+   pgmoneta_memory_buffer_put(buffer->buffer);
 
    buffer->size = new_size;
    buffer->buffer = new_buffer;
@@ -192,6 +340,103 @@ pgmoneta_memory_stream_buffer_enlarge(struct stream_buffer* buffer, int bytes_ne
    return 0;
 }
 
+void
+pgmoneta_memory_stream_buffer_compact(struct stream_buffer* buffer)
+{
+   if (buffer->start == 0)
+   {
+      return;
+   }
+
+   if (buffer->start < buffer->end)
+   {
+      memmove(buffer->buffer, buffer->buffer + buffer->start, buffer->end - buffer->start);
+   }
+
+   buffer->end -= buffer->start;
+   buffer->cursor -= buffer->start;
+   buffer->start = 0;
+}
+
+int
+pgmoneta_memory_stream_buffer_reserve(struct stream_buffer* buffer, int minimum)
+{
+   int needed = minimum;
+   int available = buffer->end - buffer->start;
+   int length = 0;
+
+   // the header of the message being received tells how much is still to come
+   if (available >= 5)
+   {
+      length = pgmoneta_read_int32(buffer->buffer + buffer->start + 1);
+
+      if (length > 0 && 1 + length - available > needed)
+      {
+         needed = 1 + length - available;
+      }
+   }
+
+   if ((int)buffer->size - buffer->end >= needed)
+   {
+      return 0;
+   }
+
+   pgmoneta_memory_stream_buffer_compact(buffer);
+
+   if ((int)buffer->size - buffer->end >= needed)
+   {
+      return 0;
+   }
+
+   return pgmoneta_memory_stream_buffer_enlarge(buffer, needed - ((int)buffer->size - buffer->end));
+}
+
+void
+pgmoneta_memory_stream_buffer_shrink(struct stream_buffer* buffer)
+{
+   int available;
+   char* b = NULL;
+
+   if (buffer->size <= DEFAULT_BUFFER_SIZE)
+   {
+      buffer->idle = 0;
+      return;
+   }
+
+   available = buffer->end - buffer->start;
+
+   if (available > STREAM_BUFFER_LOW_WATER)
+   {
+      buffer->idle = 0;
+      return;
+   }
+
+   if (++buffer->idle < STREAM_BUFFER_SHRINK_READS && !pgmoneta_memory_pressure())
+   {
+      return;
+   }
+
+   b = pgmoneta_memory_buffer_get(DEFAULT_BUFFER_SIZE);
+   if (b == NULL)
+   {
+      return;
+   }
+
+   if (available > 0)
+   {
+      memcpy(b, buffer->buffer + buffer->start, available);
+   }
+
+   pgmoneta_memory_buffer_put(buffer->buffer);
+
+   buffer->buffer = b;
+   buffer->size = DEFAULT_BUFFER_SIZE;
+   buffer->cursor -= buffer->start;
+   buffer->end = available;
+   buffer->start = 0;
+   buffer->idle = 0;
+}
+
 void
 pgmoneta_memory_stream_buffer_free(struct stream_buffer* buffer)
 {
@@ -201,8 +446,99 @@ pgmoneta_memory_stream_buffer_free(struct stream_buffer* buffer)
    }
    if (buffer->buffer != NULL)
    {
-      free(buffer->buffer);
+      pgmoneta_memory_buffer_put(buffer->buffer);
       buffer->buffer = NULL;
    }
    free(buffer);
 }
+
+static void
+account_update(long delta)
+{
+   bool pressure;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   account_used += delta;
+
+   pressure = config != NULL && config->memory_budget > 0 && account_used > config->memory_budget;
+
+   if (account_workflow >= 0)
+   {
+      pgmoneta_prometheus_memory(account_workflow, delta, account_used, pressure && !atomic_load(&account_pressure));
+   }
+
+   atomic_store(&account_pressure, pressure);
+}
+
+static int
+pool_grow(void)
+{
+   char* slab = (void*)-1;
+
+   if (pool_number_of_slabs >= MEMORY_SLABS)
+   {
+      return 1;
+   }
+
+#ifdef HAVE_LINUX
+   if (pool_hugepage == HUGEPAGE_TRY || pool_hugepage == HUGEPAGE_ON)
+   {
+      slab = mmap(NULL, MEMORY_SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
+   }
+#endif
+
+   if (slab == (void*)-1)
+   {
+      errno = 0;
+      slab = mmap(NULL, MEMORY_SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+
+      if (slab == (void*)-1)
+      {
+         errno = 0;
+         return 1;
+      }
+
+#if defined(HAVE_LINUX) && defined(MADV_HUGEPAGE)
+      // without reserved huge pages, ask for a transparent one
+      if (pool_hugepage == HUGEPAGE_TRY || pool_hugepage == HUGEPAGE_ON)
+      {
+         madvise(slab, MEMORY_SLAB_SIZE, MADV_HUGEPAGE);
+      }
+#endif
+   }
+
+   pool_slabs[pool_number_of_slabs++] = slab;
+
+   for (int i = MEMORY_SLAB_SIZE / MEMORY_BUFFER_SIZE - 1; i >= 0; i--)
+   {
+      void* buffer = slab + (size_t)i * MEMORY_BUFFER_SIZE;
+
+      *(void**)buffer = pool_free;
+      pool_free = buffer;
+   }
+
+   return 0;
+}
+
+static bool
+pool_owns(void* buffer)
+{
+   bool owns = false;
+   int slabs;
+
+   pthread_mutex_lock(&pool_lock);
+   slabs = pool_number_of_slabs;
+   pthread_mutex_unlock(&pool_lock);
+
+   for (int i = 0; !owns && i < slabs; i++)
+   {
+      if ((char*)buffer >= pool_slabs[i] && (char*)buffer < pool_slabs[i] + MEMORY_SLAB_SIZE)
+      {
+         owns = true;
+      }
+   }
+
+   return owns;
+}
@@ -29,15 +29,19 @@
 /* pgmoneta */
 #include <pgmoneta.h>
 #include <achv.h>
+#include <bandwidth.h>
 #include <extension.h>
+#include <json.h>
 #include <logging.h>
 #include <manifest.h>
 #include <network.h>
+#include <profile.h>
 #include <security.h>
 #include <utils.h>
 
 #include <assert.h>
 #include <errno.h>
+#include <poll.h>
 #include <string.h>
 #include <unistd.h>
 #include <openssl/err.h>
@@ -61,6 +65,9 @@ static int get_column_name(struct message* msg, int index, char** name);
 static unsigned char* decode_base64(char* base64_data, int* decoded_len);
 static char** get_paths(char* data, int* count);
 static void extract_file_name(char* path, char* file_name, char* file_path);
+static int extra_stat(SSL* ssl, int socket, char* path, int64_t* size, char** modification);
+static void wait_readable(int socket);
+static bool extra_reuse(struct art* previous, char* path, int64_t size, char* modification, char* dest_path);
 
 int
 pgmoneta_read_block_message(SSL* ssl, int socket, struct message** msg)
@@ -853,6 +860,8 @@ pgmoneta_create_base_backup_message(int server_version, bool incremental, char*
             options = pgmoneta_append(options, "SHA256");
             break;
          case HASH_ALGORITHM_CRC32C:
+         case HASH_ALGORITHM_XXH3:
+         case HASH_ALGORITHM_BLAKE3:
             options = pgmoneta_append(options, "CRC32C");
             break;
          case HASH_ALGORITHM_SHA224:
@@ -899,6 +908,8 @@ pgmoneta_create_base_backup_message(int server_version, bool incremental, char*
             options = pgmoneta_append(options, "SHA256");
             break;
          case HASH_ALGORITHM_CRC32C:
+         case HASH_ALGORITHM_XXH3:
+         case HASH_ALGORITHM_BLAKE3:
             options = pgmoneta_append(options, "CRC32C");
             break;
          case HASH_ALGORITHM_SHA224:
@@ -1808,16 +1819,13 @@ pgmoneta_read_copy_stream(SSL* ssl, int socket, struct stream_buffer* buffer)
    config = (struct main_configuration*)shmem;
 
    /*
-    * if buffer is still too full,
-    * try enlarging it to be at least big enough for one TCP packet (I'm using 1500B here)
-    * we don't expect it to absolutely work
+    * give the space of a spike back, then make room for at least one TCP packet (I'm using 1500B here)
+    * and the rest of the message being received, we don't expect it to absolutely work
     */
-   if (buffer->size - buffer->end < 1500)
+   pgmoneta_memory_stream_buffer_shrink(buffer);
+   if (pgmoneta_memory_stream_buffer_reserve(buffer, 1500))
    {
-      if (pgmoneta_memory_stream_buffer_enlarge(buffer, 1500))
-      {
-         pgmoneta_log_error("Fail to enlarge stream buffer");
-      }
+      pgmoneta_log_error("Fail to enlarge stream buffer");
    }
    if (buffer->end >= buffer->size)
    {
@@ -1851,7 +1859,7 @@ pgmoneta_read_copy_stream(SSL* ssl, int socket, struct stream_buffer* buffer)
          {
             keep_read = true;
             errno = 0;
-            SLEEP(1000000L);
+            wait_readable(socket);
          }
          else
          {
@@ -1873,6 +1881,7 @@ ssl_error:
                   break;
                case SSL_ERROR_WANT_READ:
                   keep_read = true;
+                  wait_readable(SSL_get_fd(ssl));
                   break;
                case SSL_ERROR_WANT_WRITE:
                   keep_read = true;
@@ -1913,7 +1922,7 @@ ssl_error:
             {
                keep_read = true;
                errno = 0;
-               SLEEP(1000000L);
+               wait_readable(socket);
             }
             else
             {
@@ -1936,6 +1945,8 @@ pgmoneta_consume_copy_stream(SSL* ssl, int socket, struct stream_buffer* buffer,
    int status;
    int length;
 
+   PGMONETA_PROFILE(PROFILE_COPY_STREAM);
+
    pgmoneta_free_message(*message);
    do
    {
@@ -2066,18 +2077,9 @@ pgmoneta_consume_copy_stream_start(SSL* ssl, int socket, struct stream_buffer* b
 
       if (network_bucket)
       {
-         while (1)
-         {
-            if (!pgmoneta_token_bucket_consume(network_bucket, length))
-            {
-               break;
-            }
-            else
-            {
-               SLEEP(500000000L)
-            }
-         }
+         pgmoneta_token_bucket_consume(network_bucket, length);
       }
+      pgmoneta_bandwidth_consume(length);
       // receive the whole message even if we are going to skip it
       while (buffer->cursor + 1 + length >= buffer->end)
       {
@@ -2134,18 +2136,9 @@ pgmoneta_consume_copy_stream_end(struct stream_buffer* buffer, struct message* m
    int length = pgmoneta_read_int32(buffer->buffer + buffer->cursor + 1);
    buffer->cursor += (1 + length);
    buffer->start = buffer->cursor;
-   // left shift unconsumed data to reuse space
-   if (buffer->start < buffer->end)
-   {
-      if (buffer->start > 0)
-      {
-         memmove(buffer->buffer, buffer->buffer + buffer->start, buffer->end - buffer->start);
-         buffer->end -= buffer->start;
-         buffer->cursor -= buffer->start;
-         buffer->start = 0;
-      }
-   }
-   else
+   // the space is reclaimed lazily by the next read, so the messages
+   // already in the buffer are handed out without moving them
+   if (buffer->start >= buffer->end)
    {
       buffer->start = buffer->end = buffer->cursor = 0;
    }
@@ -2319,17 +2312,7 @@ pgmoneta_receive_manifest_file(SSL* ssl, int socket, struct stream_buffer* buffe
 
          if (bucket)
          {
-            while (1)
-            {
-               if (!pgmoneta_token_bucket_consume(bucket, msg->length))
-               {
-                  break;
-               }
-               else
-               {
-                  SLEEP(500000000L)
-               }
-            }
+            pgmoneta_token_bucket_consume(bucket, msg->length);
          }
 
          // copy data
@@ -2360,7 +2343,8 @@ error:
 }
 
 int
-pgmoneta_receive_extra_files(SSL* ssl, int socket, char* username, char* source_dir, char* target_dir, char** info_extra)
+pgmoneta_receive_extra_files(SSL* ssl, int socket, char* username, char* source_dir, char* target_dir,
+                             struct art* previous, struct art* current, char** info_extra)
 {
    int count = 0;
    char** paths = NULL;
@@ -2399,6 +2383,9 @@ pgmoneta_receive_extra_files(SSL* ssl, int socket, char* username, char* source_
             char* dest_path;
             char file_name[MAX_PATH];
             char file_path[MAX_PATH];
+            int64_t size = -1;
+            char* modification = NULL;
+            bool reused = false;
 
             extract_file_name(paths[j], file_name, file_path);
 
@@ -2419,10 +2406,20 @@ pgmoneta_receive_extra_files(SSL* ssl, int socket, char* username, char* source_
             dest_path = (char*)malloc((strlen(dest_dir) + strlen(file_name) + 1) * sizeof(char));
             snprintf(dest_path, strlen(dest_dir) + strlen(file_name) + 1, "%s%s", dest_dir, file_name);
 
-            pgmoneta_ext_get_file(ssl, socket, paths[j], &qr);
-            if (qr != NULL && qr->tuples != NULL)
+            /* An unchanged file is shared with the previous backup instead of retrieved */
+            if (current != NULL && !extra_stat(ssl, socket, paths[j], &size, &modification))
             {
-               struct tuple* current_tuple = qr->tuples;
+               reused = extra_reuse(previous, paths[j], size, modification, dest_path);
+            }
+
+            if (!reused)
+            {
+               pgmoneta_ext_get_file(ssl, socket, paths[j], &qr);
+            }
+
+            if (reused || (qr != NULL && qr->tuples != NULL))
+            {
+               struct tuple* current_tuple = reused ? NULL : qr->tuples;
                while (current_tuple != NULL)
                {
                   if (current_tuple->data != NULL && current_tuple->data[0] != NULL)
@@ -2444,6 +2441,7 @@ pgmoneta_receive_extra_files(SSL* ssl, int socket, char* username, char* source_
                            pgmoneta_log_error("Retrieving extra files: Could not open file \"%s\" for writing", dest_path);
                            free(dest_dir);
                            free(dest_path);
+                           free(modification);
                            goto error;
                         }
                         free(decoded_data);
@@ -2451,6 +2449,20 @@ pgmoneta_receive_extra_files(SSL* ssl, int socket, char* username, char* source_
                   }
                   current_tuple = current_tuple->next;
                }
+
+               if (current != NULL && modification != NULL)
+               {
+                  struct json* e = NULL;
+
+                  if (!pgmoneta_json_create(&e))
+                  {
+                     pgmoneta_json_put(e, "size", (uintptr_t)size, ValueInt64);
+                     pgmoneta_json_put(e, "modification", (uintptr_t)modification, ValueString);
+                     pgmoneta_json_put(e, "file", (uintptr_t)dest_path, ValueString);
+                     pgmoneta_art_insert(current, paths[j], (uintptr_t)e, ValueJSON);
+                  }
+               }
+
                if (strlen(*info_extra) == 0)
                {
                   *info_extra = pgmoneta_append(*info_extra, paths[j]);
@@ -2464,12 +2476,16 @@ pgmoneta_receive_extra_files(SSL* ssl, int socket, char* username, char* source_
             else
             {
                pgmoneta_log_warn("Retrieving extra files: Query failed");
+               free(dest_dir);
+               free(dest_path);
+               free(modification);
                goto error;
             }
 
             pgmoneta_free_query_response(qr);
             free(dest_dir);
             free(dest_path);
+            free(modification);
             free(paths[j]);
             qr = NULL;
          }
@@ -2508,6 +2524,70 @@ error:
    return 1;
 }
 
+static int
+extra_stat(SSL* ssl, int socket, char* path, int64_t* size, char** modification)
+{
+   struct query_response* qr = NULL;
+
+   *size = -1;
+   *modification = NULL;
+
+   if (pgmoneta_ext_stat_file(ssl, socket, path, &qr) || qr == NULL || qr->tuples == NULL ||
+       qr->tuples->data == NULL || qr->tuples->data[0] == NULL || qr->tuples->data[1] == NULL)
+   {
+      goto error;
+   }
+
+   *size = strtoll(qr->tuples->data[0], NULL, 10);
+   *modification = pgmoneta_append(NULL, qr->tuples->data[1]);
+
+   pgmoneta_free_query_response(qr);
+
+   return 0;
+
+error:
+
+   pgmoneta_free_query_response(qr);
+
+   return 1;
+}
+
+static bool
+extra_reuse(struct art* previous, char* path, int64_t size, char* modification, char* dest_path)
+{
+   struct json* e = NULL;
+   char* file = NULL;
+
+   if (previous == NULL)
+   {
+      return false;
+   }
+
+   e = (struct json*)pgmoneta_art_search(previous, path);
+   if (e == NULL)
+   {
+      return false;
+   }
+
+   file = (char*)pgmoneta_json_get(e, "file");
+
+   if ((int64_t)pgmoneta_json_get(e, "size") != size ||
+       strcmp((char*)pgmoneta_json_get(e, "modification"), modification) ||
+       file == NULL || !pgmoneta_is_file(file))
+   {
+      return false;
+   }
+
+   if (pgmoneta_link_or_copy_file(file, dest_path))
+   {
+      return false;
+   }
+
+   pgmoneta_log_trace("Extra: %s unchanged, shared with %s", path, file);
+
+   return true;
+}
+
 static char**
 get_paths(char* data, int* count)
 {
@@ -2653,10 +2733,14 @@ pgmoneta_send_file(SSL* ssl, int socket, char* username, char* source_path, char
    FILE* file = NULL;
    struct query_response* qr = NULL;
    unsigned char buffer[PGMONETA_CHUNK_SIZE];
-   char* encode_chunk = NULL;
+   char* encode_chunks[PGMONETA_CHUNKS_IN_FLIGHT];
+   int count = 0;
+   bool done = false;
    size_t bytes_read;
    size_t encoded_size;
 
+   memset(encode_chunks, 0, sizeof(encode_chunks));
+
    // Check if the user has sufficient privileges
    pgmoneta_ext_privilege(ssl, socket, &qr);
    if (qr != NULL && qr->tuples != NULL && qr->tuples->data != NULL && qr->tuples->data[0] != NULL && qr->tuples->data[0][0] == 't')
@@ -2672,21 +2756,42 @@ pgmoneta_send_file(SSL* ssl, int socket, char* username, char* source_path, char
          goto error;
       }
 
-      // Send the file content in chunks
-      while ((bytes_read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+      // Send the file content in chunks, several for each round trip
+      while (!done)
       {
-         pgmoneta_base64_encode(buffer, bytes_read, &encode_chunk, &encoded_size);
+         for (count = 0; count < PGMONETA_CHUNKS_IN_FLIGHT; count++)
+         {
+            bytes_read = fread(buffer, 1, sizeof(buffer), file);
+            if (bytes_read == 0)
+            {
+               done = true;
+               break;
+            }
+
+            if (pgmoneta_base64_encode(buffer, bytes_read, &encode_chunks[count], &encoded_size))
+            {
+               goto error;
+            }
+         }
+
+         if (count == 0)
+         {
+            break;
+         }
 
-         pgmoneta_ext_send_file_chunk(ssl, socket, target_path, encode_chunk, &qr);
-         if (!qr)
+         if (pgmoneta_ext_send_file_chunks(ssl, socket, target_path, encode_chunks, count, &qr) || !qr)
          {
             pgmoneta_log_error("Sending file: Send file chunk failed");
             goto error;
          }
          pgmoneta_free_query_response(qr);
-         free(encode_chunk);
-         encode_chunk = NULL;
          qr = NULL;
+
+         for (int i = 0; i < count; i++)
+         {
+            free(encode_chunks[i]);
+            encode_chunks[i] = NULL;
+         }
       }
    }
    else if (qr != NULL && qr->tuples != NULL && qr->tuples->data != NULL && qr->tuples->data[0] != NULL && qr->tuples->data[0][0] == 'f')
@@ -2701,10 +2806,6 @@ pgmoneta_send_file(SSL* ssl, int socket, char* username, char* source_path, char
    }
 
    fclose(file);
-   if (encode_chunk)
-   {
-      free(encode_chunk);
-   }
    pgmoneta_free_query_response(qr);
 
    return 0;
@@ -2714,11 +2815,27 @@ error:
    {
       fclose(file);
    }
-   if (encode_chunk)
+   for (int i = 0; i < PGMONETA_CHUNKS_IN_FLIGHT; i++)
    {
-      free(encode_chunk);
+      free(encode_chunks[i]);
    }
    pgmoneta_free_query_response(qr);
 
    return 1;
 }
+
+static void
+wait_readable(int socket)
+{
+   struct pollfd pfd;
+
+   /* A non-blocking socket waits for data instead of polling the read, the timeout lets the caller check for shutdown */
+   pfd.fd = socket;
+   pfd.events = POLLIN;
+   pfd.revents = 0;
+
+   if (poll(&pfd, 1, 1000) == -1)
+   {
+      errno = 0;
+   }
+}
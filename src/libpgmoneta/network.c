@@ -230,7 +230,7 @@ pgmoneta_connect(char* hostname, int port, int* fd)
    struct addrinfo* servinfo = NULL;
    struct addrinfo* p = NULL;
    int yes = 1;
-   size_t buffer_size = DEFAULT_BUFFER_SIZE;
+   int buffer_size = DEFAULT_BUFFER_SIZE;
    socklen_t optlen = sizeof(int);
    int rv;
    char sport[6];
@@ -294,8 +294,11 @@ pgmoneta_connect(char* hostname, int port, int* fd)
             }
          }
 
-         if (config != NULL)
+         /* A buffer size of 0 leaves the kernel autotuning the buffers to the bandwidth-delay product */
+         if (config != NULL && config->common.tcp_buffer_size > 0)
          {
+            buffer_size = config->common.tcp_buffer_size;
+
             if (setsockopt(*fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, optlen) == -1)
             {
                error = errno;
@@ -315,6 +318,18 @@ pgmoneta_connect(char* hostname, int port, int* fd)
             }
          }
 
+#ifdef HAVE_LINUX
+         if (config != NULL && strlen(config->common.tcp_congestion) > 0)
+         {
+            /* An algorithm that isn't available only costs the choice, not the connection */
+            if (setsockopt(*fd, IPPROTO_TCP, TCP_CONGESTION, config->common.tcp_congestion, strlen(config->common.tcp_congestion)) == -1)
+            {
+               pgmoneta_log_warn("connect: TCP_CONGESTION %s %s", config->common.tcp_congestion, strerror(errno));
+               errno = 0;
+            }
+         }
+#endif
+
          if (connect(*fd, p->ai_addr, p->ai_addrlen) == -1)
          {
             error = errno;
@@ -539,7 +554,20 @@ int
 pgmoneta_socket_buffers(int fd)
 {
    socklen_t optlen = sizeof(int);
-   size_t buffer_size = DEFAULT_BUFFER_SIZE;
+   int buffer_size = DEFAULT_BUFFER_SIZE;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (config != NULL)
+   {
+      if (config->common.tcp_buffer_size == 0)
+      {
+         return 0;
+      }
+
+      buffer_size = config->common.tcp_buffer_size;
+   }
 
    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, optlen) == -1)
    {
@@ -0,0 +1,502 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <art.h>
+#include <csv.h>
+#include <logging.h>
+#include <pack.h>
+#include <utils.h>
+
+/* system */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define PACK_BUFFER_SIZE 65536
+
+#define PACK_PATH_INDEX   0
+#define PACK_OFFSET_INDEX 1
+#define PACK_SIZE_INDEX   2
+#define PACK_COLUMN_COUNT 3
+
+static int pack_directory(char* root, char* relative_path, uint64_t threshold, FILE* pack, uint64_t* offset, struct csv_writer* index, struct art* packed, unsigned char* buffer);
+static int pack_copy(FILE* from, FILE* to, uint64_t size, unsigned char* buffer);
+static char* pack_index(char* pack);
+
+char*
+pgmoneta_pack_path(int server, char* label)
+{
+   char* path = NULL;
+
+   path = pgmoneta_get_server_backup_identifier(server, label);
+   if (path == NULL)
+   {
+      return NULL;
+   }
+
+   if (!pgmoneta_ends_with(path, "/"))
+   {
+      path = pgmoneta_append(path, "/");
+   }
+   path = pgmoneta_append(path, PACK_NAME);
+
+   return path;
+}
+
+int
+pgmoneta_pack_create(char* directory, uint64_t threshold, char* pack, struct art** packed)
+{
+   char* index = NULL;
+   char* index_tmp = NULL;
+   uint64_t offset = 0;
+   unsigned char* buffer = NULL;
+   FILE* file = NULL;
+   struct csv_writer* writer = NULL;
+   struct art* p = NULL;
+
+   *packed = NULL;
+
+   index = pack_index(pack);
+
+   /* A pack of an interrupted upload is complete when it has its index */
+   if (pgmoneta_exists(index))
+   {
+      free(index);
+      return pgmoneta_pack_read(pack, packed);
+   }
+
+   index_tmp = pgmoneta_append(index_tmp, index);
+   index_tmp = pgmoneta_append(index_tmp, ".tmp");
+
+   buffer = (unsigned char*)malloc(PACK_BUFFER_SIZE);
+   if (buffer == NULL)
+   {
+      goto error;
+   }
+
+   if (pgmoneta_art_create(&p))
+   {
+      goto error;
+   }
+
+   file = fopen(pack, "wb");
+   if (file == NULL)
+   {
+      pgmoneta_log_error("Pack: Could not create %s: %s", pack, strerror(errno));
+      goto error;
+   }
+
+   if (pgmoneta_csv_writer_init(index_tmp, &writer))
+   {
+      pgmoneta_log_error("Pack: Could not create %s", index_tmp);
+      goto error;
+   }
+
+   if (pack_directory(directory, "", threshold, file, &offset, writer, p, buffer))
+   {
+      goto error;
+   }
+
+   if (fflush(file) || fsync(fileno(file)))
+   {
+      goto error;
+   }
+
+   fclose(file);
+   file = NULL;
+
+   pgmoneta_csv_writer_destroy(writer);
+   writer = NULL;
+
+   if (rename(index_tmp, index))
+   {
+      pgmoneta_log_error("Pack: Could not create %s: %s", index, strerror(errno));
+      goto error;
+   }
+
+   pgmoneta_log_debug("Pack: %s (Files: %" PRIu64 " Size: %" PRIu64 ")", pack, p->size, offset);
+
+   *packed = p;
+
+   free(index);
+   free(index_tmp);
+   free(buffer);
+
+   return 0;
+
+error:
+
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+
+   pgmoneta_csv_writer_destroy(writer);
+
+   pgmoneta_delete_file(pack, NULL);
+   pgmoneta_delete_file(index_tmp, NULL);
+
+   pgmoneta_art_destroy(p);
+
+   free(index);
+   free(index_tmp);
+   free(buffer);
+
+   return 1;
+}
+
+int
+pgmoneta_pack_read(char* pack, struct art** packed)
+{
+   char* index = NULL;
+   int number_of_columns = 0;
+   char** columns = NULL;
+   struct csv_reader* reader = NULL;
+   struct art* p = NULL;
+
+   *packed = NULL;
+
+   index = pack_index(pack);
+
+   if (pgmoneta_csv_reader_init(index, &reader))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_art_create(&p))
+   {
+      goto error;
+   }
+
+   while (pgmoneta_csv_next_row(reader, &number_of_columns, &columns))
+   {
+      if (number_of_columns < PACK_COLUMN_COUNT)
+      {
+         continue;
+      }
+
+      pgmoneta_art_insert(p, columns[PACK_PATH_INDEX], (uintptr_t)strtoull(columns[PACK_SIZE_INDEX], NULL, 10), ValueUInt64);
+   }
+
+   pgmoneta_csv_reader_destroy(reader);
+
+   *packed = p;
+
+   free(index);
+
+   return 0;
+
+error:
+
+   pgmoneta_csv_reader_destroy(reader);
+   pgmoneta_art_destroy(p);
+
+   free(index);
+
+   return 1;
+}
+
+int
+pgmoneta_pack_extract(char* pack, char* directory, bool (*filter)(char*))
+{
+   char* index = NULL;
+   char* path = NULL;
+   char* dir = NULL;
+   int number_of_columns = 0;
+   int number_of_files = 0;
+   char** columns = NULL;
+   unsigned char* buffer = NULL;
+   FILE* from = NULL;
+   FILE* to = NULL;
+   struct csv_reader* reader = NULL;
+
+   index = pack_index(pack);
+
+   buffer = (unsigned char*)malloc(PACK_BUFFER_SIZE);
+   if (buffer == NULL)
+   {
+      goto error;
+   }
+
+   if (pgmoneta_csv_reader_init(index, &reader))
+   {
+      goto error;
+   }
+
+   from = fopen(pack, "rb");
+   if (from == NULL)
+   {
+      pgmoneta_log_error("Pack: Could not open %s: %s", pack, strerror(errno));
+      goto error;
+   }
+
+   while (pgmoneta_csv_next_row(reader, &number_of_columns, &columns))
+   {
+      if (number_of_columns < PACK_COLUMN_COUNT)
+      {
+         continue;
+      }
+
+      if (filter != NULL && !filter(columns[PACK_PATH_INDEX]))
+      {
+         continue;
+      }
+
+      path = pgmoneta_append(path, directory);
+      if (!pgmoneta_ends_with(path, "/"))
+      {
+         path = pgmoneta_append(path, "/");
+      }
+      path = pgmoneta_append(path, columns[PACK_PATH_INDEX]);
+
+      dir = pgmoneta_append(dir, path);
+      if (pgmoneta_mkdir(dirname(dir)))
+      {
+         pgmoneta_log_error("Pack: Could not create the directory of %s", path);
+         goto error;
+      }
+
+      to = fopen(path, "wb");
+      if (to == NULL)
+      {
+         pgmoneta_log_error("Pack: Could not create %s: %s", path, strerror(errno));
+         goto error;
+      }
+
+      if (fseeko(from, (off_t)strtoull(columns[PACK_OFFSET_INDEX], NULL, 10), SEEK_SET) ||
+          pack_copy(from, to, strtoull(columns[PACK_SIZE_INDEX], NULL, 10), buffer))
+      {
+         pgmoneta_log_error("Pack: Could not extract %s from %s", columns[PACK_PATH_INDEX], pack);
+         goto error;
+      }
+
+      fclose(to);
+      to = NULL;
+
+      free(path);
+      path = NULL;
+      free(dir);
+      dir = NULL;
+
+      number_of_files++;
+   }
+
+   fclose(from);
+   from = NULL;
+
+   pgmoneta_csv_reader_destroy(reader);
+   reader = NULL;
+
+   pgmoneta_log_debug("Pack: Extracted %d files from %s", number_of_files, pack);
+
+   pgmoneta_pack_delete(pack);
+
+   free(index);
+   free(buffer);
+
+   return 0;
+
+error:
+
+   if (from != NULL)
+   {
+      fclose(from);
+   }
+
+   if (to != NULL)
+   {
+      fclose(to);
+   }
+
+   pgmoneta_csv_reader_destroy(reader);
+
+   free(index);
+   free(path);
+   free(dir);
+   free(buffer);
+
+   return 1;
+}
+
+void
+pgmoneta_pack_delete(char* pack)
+{
+   char* index = NULL;
+
+   index = pack_index(pack);
+
+   pgmoneta_delete_file(pack, NULL);
+   pgmoneta_delete_file(index, NULL);
+
+   free(index);
+}
+
+static int
+pack_directory(char* root, char* relative_path, uint64_t threshold, FILE* pack, uint64_t* offset, struct csv_writer* index, struct art* packed, unsigned char* buffer)
+{
+   char* path = NULL;
+   char* relative_file = NULL;
+   char* info[PACK_COLUMN_COUNT];
+   char o[MISC_LENGTH];
+   char s[MISC_LENGTH];
+   DIR* dir = NULL;
+   FILE* file = NULL;
+   struct dirent* entry;
+   struct stat st;
+
+   path = pgmoneta_append(path, root);
+   if (strlen(relative_path) > 0)
+   {
+      path = pgmoneta_append(path, "/");
+      path = pgmoneta_append(path, relative_path);
+   }
+
+   if (!(dir = opendir(path)))
+   {
+      goto error;
+   }
+
+   while ((entry = readdir(dir)) != NULL)
+   {
+      char file_path[MAX_PATH];
+
+      if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+      {
+         continue;
+      }
+
+      relative_file = NULL;
+      if (strlen(relative_path) > 0)
+      {
+         relative_file = pgmoneta_append(relative_file, relative_path);
+         relative_file = pgmoneta_append(relative_file, "/");
+      }
+      relative_file = pgmoneta_append(relative_file, entry->d_name);
+
+      memset(&file_path[0], 0, sizeof(file_path));
+      snprintf(&file_path[0], sizeof(file_path), "%s/%s", path, entry->d_name);
+
+      if (entry->d_type == DT_DIR)
+      {
+         if (pack_directory(root, relative_file, threshold, pack, offset, index, packed, buffer))
+         {
+            goto error;
+         }
+      }
+      else if (entry->d_type == DT_REG && !stat(&file_path[0], &st) && (uint64_t)st.st_size < threshold)
+      {
+         file = fopen(&file_path[0], "rb");
+         if (file == NULL || pack_copy(file, pack, (uint64_t)st.st_size, buffer))
+         {
+            pgmoneta_log_error("Pack: Could not pack %s", &file_path[0]);
+            goto error;
+         }
+
+         fclose(file);
+         file = NULL;
+
+         memset(&o[0], 0, sizeof(o));
+         memset(&s[0], 0, sizeof(s));
+         snprintf(&o[0], sizeof(o), "%" PRIu64, *offset);
+         snprintf(&s[0], sizeof(s), "%" PRIu64, (uint64_t)st.st_size);
+
+         info[PACK_PATH_INDEX] = relative_file;
+         info[PACK_OFFSET_INDEX] = &o[0];
+         info[PACK_SIZE_INDEX] = &s[0];
+         pgmoneta_csv_write(index, PACK_COLUMN_COUNT, info);
+
+         pgmoneta_art_insert(packed, relative_file, (uintptr_t)st.st_size, ValueUInt64);
+
+         *offset += (uint64_t)st.st_size;
+      }
+
+      free(relative_file);
+      relative_file = NULL;
+   }
+
+   closedir(dir);
+
+   free(path);
+
+   return 0;
+
+error:
+
+   if (dir != NULL)
+   {
+      closedir(dir);
+   }
+
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+
+   free(path);
+   free(relative_file);
+
+   return 1;
+}
+
+static int
+pack_copy(FILE* from, FILE* to, uint64_t size, unsigned char* buffer)
+{
+   while (size > 0)
+   {
+      size_t n = fread(buffer, 1, MIN(size, (uint64_t)PACK_BUFFER_SIZE), from);
+
+      if (n == 0 || fwrite(buffer, 1, n, to) != n)
+      {
+         return 1;
+      }
+
+      size -= n;
+   }
+
+   return 0;
+}
+
+static char*
+pack_index(char* pack)
+{
+   char* index = NULL;
+
+   index = pgmoneta_append(index, pack);
+   index = pgmoneta_append(index, PACK_INDEX_SUFFIX);
+
+   return index;
+}
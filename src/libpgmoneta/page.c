@@ -0,0 +1,397 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <page.h>
+
+/* system */
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define PAGE_AVX2
+#include <immintrin.h>
+#endif
+#ifdef __aarch64__
+#define PAGE_NEON
+#include <arm_neon.h>
+#endif
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The page checksum of PostgreSQL (src/include/storage/checksum_impl.h) is
+ * FNV-1a with an extra shift, computed over the page as rows of 32 words
+ * where each column is a lane of its own. The lanes are independent until
+ * they are XORed at the end, so a row is one multiply and two XORs on a
+ * vector register. AVX2 holds 8 lanes in a register and NEON 4.
+ */
+#define N_SUMS    32
+#define FNV_PRIME 16777619
+#define ROW_SIZE  (N_SUMS * sizeof(uint32_t))
+
+#define PAGE_CHECKSUM_OFFSET 8
+#define PAGE_UPPER_OFFSET    14
+
+static const uint32_t checksum_base_offsets[N_SUMS] = {
+   0x5B1F36E9, 0xB8525960, 0x02AB50AA, 0x1DE66D2A,
+   0x79FF467A, 0x9BB9F8A3, 0x217E7CD2, 0x83E13D2C,
+   0xF8D4474F, 0xE39EB970, 0x42C6AE16, 0x993216FA,
+   0x7B093B5D, 0x98DAFF3C, 0xF718902A, 0x0B1C9CDB,
+   0xE58F764B, 0x187636BC, 0x5D7B3BB1, 0xE73DE7DE,
+   0x92BEC979, 0xCCA6C0B2, 0x304A0979, 0x85AA43D4,
+   0x783125BB, 0x6CA8EAA2, 0xE407EAC6, 0x4B5CFC3E,
+   0x9FBF8C76, 0x15CA20BE, 0xF2CA9FFF, 0x3ED7C28F
+};
+
+static uint32_t checksum_block(unsigned char* first, unsigned char* rest, uint32_t rows);
+#ifdef PAGE_AVX2
+static uint32_t checksum_block_avx2(unsigned char* first, unsigned char* rest, uint32_t rows);
+#endif
+#ifdef PAGE_NEON
+static uint32_t checksum_block_neon(unsigned char* first, unsigned char* rest, uint32_t rows);
+#endif
+
+uint64_t
+pgmoneta_page_lsn(unsigned char* page)
+{
+   uint32_t hi = 0;
+   uint32_t lo = 0;
+
+   /* pd_lsn is the first field of the page header */
+   memcpy(&hi, page, sizeof(uint32_t));
+   memcpy(&lo, page + sizeof(uint32_t), sizeof(uint32_t));
+
+   return ((uint64_t)hi << 32) | lo;
+}
+
+uint16_t
+pgmoneta_page_checksum(unsigned char* page, uint32_t block_size, uint32_t block_number)
+{
+   unsigned char first[ROW_SIZE];
+   uint32_t rows = block_size / ROW_SIZE;
+   uint32_t checksum = 0;
+
+   /* The checksum is calculated with pd_checksum as zero */
+   memcpy(first, page, ROW_SIZE);
+   memset(first + PAGE_CHECKSUM_OFFSET, 0, sizeof(uint16_t));
+
+#if defined(PAGE_AVX2)
+   if (__builtin_cpu_supports("avx2"))
+   {
+      checksum = checksum_block_avx2(first, page + ROW_SIZE, rows);
+   }
+   else
+   {
+      checksum = checksum_block(first, page + ROW_SIZE, rows);
+   }
+#elif defined(PAGE_NEON)
+   checksum = checksum_block_neon(first, page + ROW_SIZE, rows);
+#else
+   checksum = checksum_block(first, page + ROW_SIZE, rows);
+#endif
+
+   /* Mix in the block number, so a page written to the wrong place is detected */
+   checksum ^= block_number;
+
+   return (uint16_t)((checksum % 65535) + 1);
+}
+
+bool
+pgmoneta_page_verify(struct page_checksums* checksums, unsigned char* page, uint32_t block_number)
+{
+   uint16_t upper = 0;
+   uint16_t expected = 0;
+
+   /* A new page has no checksum yet */
+   memcpy(&upper, page + PAGE_UPPER_OFFSET, sizeof(uint16_t));
+   if (upper == 0)
+   {
+      return true;
+   }
+
+   /* A page modified during the backup can be torn, and is restored from the WAL */
+   if (pgmoneta_page_lsn(page) >= checksums->start_lsn)
+   {
+      return true;
+   }
+
+   checksums->pages++;
+
+   memcpy(&expected, page + PAGE_CHECKSUM_OFFSET, sizeof(uint16_t));
+   if (pgmoneta_page_checksum(page, checksums->block_size, block_number) != expected)
+   {
+      checksums->failed++;
+      return false;
+   }
+
+   return true;
+}
+
+bool
+pgmoneta_page_relation_segment(char* name, uint32_t* segment)
+{
+   char* file = NULL;
+   char* dir = NULL;
+   char* p = NULL;
+
+   *segment = 0;
+
+   file = strrchr(name, '/');
+   if (file == NULL)
+   {
+      return false;
+   }
+
+   /* The relation is in global or in the directory of a database */
+   dir = file;
+   while (dir > name && *(dir - 1) != '/')
+   {
+      dir--;
+   }
+
+   if (file - dir != 6 || strncmp(dir, "global", 6))
+   {
+      if (dir == file)
+      {
+         return false;
+      }
+
+      for (p = dir; p < file; p++)
+      {
+         if (*p < '0' || *p > '9')
+         {
+            return false;
+         }
+      }
+   }
+
+   /* <relfilenode>[_fsm|_vm|_init][.<segment>] */
+   p = file + 1;
+   if (*p < '0' || *p > '9')
+   {
+      return false;
+   }
+
+   while (*p >= '0' && *p <= '9')
+   {
+      p++;
+   }
+
+   if (*p == '_')
+   {
+      p++;
+
+      if (!strncmp(p, "fsm", 3))
+      {
+         p += 3;
+      }
+      else if (!strncmp(p, "vm", 2))
+      {
+         p += 2;
+      }
+      else if (!strncmp(p, "init", 4))
+      {
+         p += 4;
+      }
+      else
+      {
+         return false;
+      }
+   }
+
+   if (*p == '.')
+   {
+      p++;
+
+      if (*p < '0' || *p > '9')
+      {
+         return false;
+      }
+
+      *segment = (uint32_t)strtoul(p, &p, 10);
+   }
+
+   return *p == '\0';
+}
+
+#define CHECKSUM_COMP(checksum, value)                     \
+        do                                                 \
+        {                                                  \
+           uint32_t __tmp = (checksum) ^ (value);          \
+           (checksum) = __tmp * FNV_PRIME ^ (__tmp >> 17); \
+        }                                                  \
+        while (0)
+
+__attribute__((unused))
+static uint32_t
+checksum_block(unsigned char* first, unsigned char* rest, uint32_t rows)
+{
+   uint32_t sums[N_SUMS];
+   uint32_t row[N_SUMS];
+   uint32_t result = 0;
+
+   memcpy(sums, checksum_base_offsets, sizeof(sums));
+
+   for (uint32_t i = 0; i < rows; i++)
+   {
+      memcpy(row, i == 0 ? first : rest + (size_t)(i - 1) * ROW_SIZE, ROW_SIZE);
+
+      for (int j = 0; j < N_SUMS; j++)
+      {
+         CHECKSUM_COMP(sums[j], row[j]);
+      }
+   }
+
+   /* Two rounds of zeros mix the last row into all the bits */
+   for (int i = 0; i < 2; i++)
+   {
+      for (int j = 0; j < N_SUMS; j++)
+      {
+         CHECKSUM_COMP(sums[j], 0);
+      }
+   }
+
+   for (int j = 0; j < N_SUMS; j++)
+   {
+      result ^= sums[j];
+   }
+
+   return result;
+}
+
+#ifdef PAGE_AVX2
+#define AVX2_COMP(sum, value)                                                                        \
+        do                                                                                           \
+        {                                                                                            \
+           __m256i __tmp = _mm256_xor_si256((sum), (value));                                         \
+           (sum) = _mm256_xor_si256(_mm256_mullo_epi32(__tmp, prime), _mm256_srli_epi32(__tmp, 17)); \
+        }                                                                                            \
+        while (0)
+
+__attribute__((target("avx2")))
+static uint32_t
+checksum_block_avx2(unsigned char* first, unsigned char* rest, uint32_t rows)
+{
+   __m256i sums[N_SUMS / 8];
+   __m256i prime = _mm256_set1_epi32(FNV_PRIME);
+   __m256i zero = _mm256_setzero_si256();
+   uint32_t lanes[N_SUMS];
+   uint32_t result = 0;
+
+   for (int j = 0; j < N_SUMS / 8; j++)
+   {
+      sums[j] = _mm256_loadu_si256((__m256i*)(checksum_base_offsets + j * 8));
+   }
+
+   for (uint32_t i = 0; i < rows; i++)
+   {
+      unsigned char* row = i == 0 ? first : rest + (size_t)(i - 1) * ROW_SIZE;
+
+      for (int j = 0; j < N_SUMS / 8; j++)
+      {
+         AVX2_COMP(sums[j], _mm256_loadu_si256((__m256i*)(row + j * 32)));
+      }
+   }
+
+   for (int i = 0; i < 2; i++)
+   {
+      for (int j = 0; j < N_SUMS / 8; j++)
+      {
+         AVX2_COMP(sums[j], zero);
+      }
+   }
+
+   for (int j = 0; j < N_SUMS / 8; j++)
+   {
+      _mm256_storeu_si256((__m256i*)(lanes + j * 8), sums[j]);
+   }
+
+   for (int j = 0; j < N_SUMS; j++)
+   {
+      result ^= lanes[j];
+   }
+
+   return result;
+}
+#endif
+
+#ifdef PAGE_NEON
+#define NEON_COMP(sum, value)                                                   \
+        do                                                                      \
+        {                                                                       \
+           uint32x4_t __tmp = veorq_u32((sum), (value));                        \
+           (sum) = veorq_u32(vmulq_u32(__tmp, prime), vshrq_n_u32(__tmp, 17));  \
+        }                                                                       \
+        while (0)
+
+static uint32_t
+checksum_block_neon(unsigned char* first, unsigned char* rest, uint32_t rows)
+{
+   uint32x4_t sums[N_SUMS / 4];
+   uint32x4_t prime = vdupq_n_u32(FNV_PRIME);
+   uint32x4_t zero = vdupq_n_u32(0);
+   uint32_t lanes[N_SUMS];
+   uint32_t result = 0;
+
+   for (int j = 0; j < N_SUMS / 4; j++)
+   {
+      sums[j] = vld1q_u32(checksum_base_offsets + j * 4);
+   }
+
+   for (uint32_t i = 0; i < rows; i++)
+   {
+      unsigned char* row = i == 0 ? first : rest + (size_t)(i - 1) * ROW_SIZE;
+
+      for (int j = 0; j < N_SUMS / 4; j++)
+      {
+         NEON_COMP(sums[j], vreinterpretq_u32_u8(vld1q_u8(row + j * 16)));
+      }
+   }
+
+   for (int i = 0; i < 2; i++)
+   {
+      for (int j = 0; j < N_SUMS / 4; j++)
+      {
+         NEON_COMP(sums[j], zero);
+      }
+   }
+
+   for (int j = 0; j < N_SUMS / 4; j++)
+   {
+      vst1q_u32(lanes + j * 4, sums[j]);
+   }
+
+   for (int j = 0; j < N_SUMS; j++)
+   {
+      result ^= lanes[j];
+   }
+
+   return result;
+}
+#endif
@@ -0,0 +1,1837 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <art.h>
+#include <bandwidth.h>
+#include <extension.h>
+#include <incremental.h>
+#include <info.h>
+#include <logging.h>
+#include <manifest.h>
+#include <memory.h>
+#include <message.h>
+#include <network.h>
+#include <parallel.h>
+#include <progress.h>
+#include <security.h>
+#include <server.h>
+#include <utils.h>
+#include <walk.h>
+
+/* system */
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define CHUNK_SIZE (1024 * 1024)
+
+/**
+ * The number of chunks requested by a query, which are sent back to back
+ */
+#define CHUNKS_IN_FLIGHT 4
+
+/**
+ * The files of the data directory, and the directories whose content is left out
+ */
+#define LIST_FILES \
+   "WITH RECURSIVE f(path) AS (" \
+   "SELECT d FROM pg_ls_dir('.', true, false) d " \
+   "UNION ALL " \
+   "SELECT f.path || '/' || c FROM f, " \
+   "LATERAL pg_ls_dir(CASE WHEN (pg_stat_file(f.path, true)).isdir " \
+   "AND f.path NOT IN ('pg_wal', 'pg_stat_tmp', 'pg_replslot', 'pg_dynshmem', 'pg_notify', " \
+   "'pg_serial', 'pg_snapshots', 'pg_subtrans', 'pg_tblspc') " \
+   "AND f.path !~ '(^|/)pgsql_tmp' THEN f.path END, true, false) c) " \
+   "SELECT f.path, s.size, s.isdir, extract(epoch FROM s.modification)::bigint " \
+   "FROM f, LATERAL pg_stat_file(f.path, true) s WHERE s.size IS NOT NULL;"
+
+/**
+ * The directories whose content is left out
+ */
+static char* excluded_directories[] = {
+   "pg_wal",
+   "pg_stat_tmp",
+   "pg_replslot",
+   "pg_dynshmem",
+   "pg_notify",
+   "pg_serial",
+   "pg_snapshots",
+   "pg_subtrans",
+   "pg_tblspc",
+   NULL
+};
+
+/** @struct parallel_file
+ * Defines a file of the backup
+ */
+struct parallel_file
+{
+   char* path;        /**< The path relative to the data directory */
+   uint64_t size;     /**< The size when the backup started */
+   time_t modified;   /**< The modification time */
+   uint64_t copied;   /**< The number of bytes copied */
+   char* checksum;    /**< The checksum */
+   bool missing;      /**< Was the file removed during the backup */
+   uint8_t* changed;  /**< The bitmap of the blocks changed since the parent, or NULL */
+   uint32_t tracked;  /**< The number of blocks covered by the bitmap */
+};
+
+/** @struct parallel_job
+ * Defines the files shared by the connections
+ */
+struct parallel_job
+{
+   char* data;                            /**< The data directory of the backup */
+   char* snapshot;                        /**< The data directory in the file system snapshot, or NULL */
+   int hash;                              /**< The hash algorithm */
+   uint32_t block_size;                   /**< The block size */
+   struct parallel_file* files;           /**< The files, largest first */
+   int number_of_files;                   /**< The number of files */
+   atomic_int next;                       /**< The next file to copy */
+   atomic_bool failed;                    /**< Did a file fail */
+   struct token_bucket* bucket;           /**< The token bucket for the backup */
+   struct token_bucket* network_bucket;   /**< The token bucket for the network */
+};
+
+/** @struct snapshot_list
+ * Defines the listing of the files of a snapshot
+ */
+struct snapshot_list
+{
+   struct parallel_job* job; /**< The job */
+   int capacity;             /**< The capacity of the files */
+   bool failed;              /**< Did the listing fail */
+};
+
+/** @struct parallel_input
+ * Defines the input of a connection
+ */
+struct parallel_input
+{
+   struct parallel_job* job; /**< The job */
+   SSL* ssl;                 /**< The SSL structure */
+   int socket;               /**< The socket */
+};
+
+static char* excluded_files[] = {
+   "postmaster.pid",
+   "postmaster.opts",
+   "backup_label",
+   "tablespace_map",
+   "backup_manifest",
+   "postgresql.auto.conf.tmp",
+   "current_logfiles.tmp",
+   NULL
+};
+
+static int list_files(SSL* ssl, int socket, struct parallel_job* job);
+static int query(SSL* ssl, int socket, char* q, struct query_response** response);
+static bool is_excluded(char* path);
+static int compare_files(const void* a, const void* b);
+static char* sql_literal(char* str);
+static int hex_decode(char* hex, unsigned char* out, size_t* length);
+static int base64_decode(char* base64, unsigned char* out, size_t size, size_t* length);
+static void* copy_files(void* arg);
+static int copy_file(SSL* ssl, int socket, struct parallel_job* job, struct parallel_file* file);
+static int copy_changed_blocks(SSL* ssl, int socket, struct parallel_job* job, struct parallel_file* file);
+static int read_chunks(SSL* ssl, int socket, struct parallel_job* job, char* literal, int count,
+                       uint64_t* offsets, size_t* sizes, unsigned char* chunks, size_t* lengths, bool* missing);
+static int changed_blocks(SSL* ssl, int socket, int server, char* parent_label, struct parallel_job* job);
+static void files_destroy(struct parallel_job* job);
+static int stop_backup(SSL* ssl, int socket, int server, char* endpos, char** label, uint32_t* end_timeline);
+static char* snapshot_format(char* command, int server, char* tag, char* path);
+static int snapshot_take(int server, char* tag, char** path);
+static void snapshot_release(int server, char* tag, char* path);
+static int snapshot_visitor(struct walk_entry* entry, void* data);
+static int copy_snapshot_file(struct parallel_job* job, struct parallel_file* file);
+static char* checksum_algorithm(int hash);
+static int write_file(char* path, char* content);
+static char* manifest_entry(char* manifest, char* path, uint64_t size, time_t modified, char* algorithm, char* checksum, bool first);
+static int write_manifest(struct parallel_job* job, char* label_checksum, size_t label_size,
+                          char* system_identifier, uint32_t timeline, char* startpos, char* endpos);
+
+int
+pgmoneta_parallel_backup(int server, char* tag, char* backup_base, int hash, int connections, char* parent_label,
+                         struct token_bucket* bucket, struct token_bucket* network_bucket,
+                         char* startpos, char* endpos, uint32_t* start_timeline, uint32_t* end_timeline)
+{
+   int usr = -1;
+   int started = 0;
+   bool in_backup = false;
+   SSL* ssl = NULL;
+   int socket = -1;
+   char q[MISC_LENGTH];
+   char path[MAX_PATH];
+   char* system_identifier = NULL;
+   char* label = NULL;
+   char* label_checksum = NULL;
+   struct hash_context* ctx = NULL;
+   struct query_response* response = NULL;
+   struct parallel_job job;
+   struct parallel_input* inputs = NULL;
+   pthread_t* threads = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   memset(&job, 0, sizeof(struct parallel_job));
+   atomic_init(&job.next, 0);
+   atomic_init(&job.failed, false);
+   job.hash = hash;
+   job.block_size = config->common.servers[server].block_size;
+   job.bucket = bucket;
+   job.network_bucket = network_bucket;
+
+   for (int i = 0; usr == -1 && i < config->common.number_of_users; i++)
+   {
+      if (!strcmp(config->common.servers[server].username, config->common.users[i].username))
+      {
+         usr = i;
+      }
+   }
+
+   if (usr == -1)
+   {
+      goto error;
+   }
+
+   job.data = pgmoneta_append(job.data, backup_base);
+   if (!pgmoneta_ends_with(job.data, "/"))
+   {
+      job.data = pgmoneta_append(job.data, "/");
+   }
+   job.data = pgmoneta_append(job.data, "data/");
+
+   if (pgmoneta_server_connect(server, &ssl, &socket) != AUTH_SUCCESS)
+   {
+      pgmoneta_log_error("Parallel backup: Could not connect to %s", config->common.servers[server].name);
+      goto error;
+   }
+
+   // the backup ends if the session ends, so the control connection is never given back before the stop
+   memset(q, 0, sizeof(q));
+   if (config->common.servers[server].version >= 15)
+   {
+      snprintf(q, sizeof(q), "SELECT pg_backup_start('%s', true);", tag);
+   }
+   else
+   {
+      snprintf(q, sizeof(q), "SELECT pg_start_backup('%s', true, false);", tag);
+   }
+
+   if (query(ssl, socket, q, &response) || response->tuples == NULL || response->tuples->data[0] == NULL)
+   {
+      pgmoneta_log_error("Parallel backup: Could not start the backup on %s", config->common.servers[server].name);
+      goto error;
+   }
+   in_backup = true;
+
+   memset(startpos, 0, 20);
+   snprintf(startpos, 20, "%s", response->tuples->data[0]);
+   pgmoneta_free_query_response(response);
+   response = NULL;
+
+   if (query(ssl, socket, "SELECT timeline_id FROM pg_control_checkpoint();", &response) ||
+       response->tuples == NULL || response->tuples->data[0] == NULL)
+   {
+      goto error;
+   }
+   *start_timeline = (uint32_t)strtoul(response->tuples->data[0], NULL, 10);
+   pgmoneta_free_query_response(response);
+   response = NULL;
+
+   if (config->common.servers[server].version >= 17)
+   {
+      if (query(ssl, socket, "SELECT system_identifier FROM pg_control_system();", &response) ||
+          response->tuples == NULL || response->tuples->data[0] == NULL)
+      {
+         goto error;
+      }
+      system_identifier = pgmoneta_append(NULL, response->tuples->data[0]);
+      pgmoneta_free_query_response(response);
+      response = NULL;
+   }
+
+   if (strlen(config->common.servers[server].snapshot_command) > 0)
+   {
+      struct snapshot_list list;
+
+      if (snapshot_take(server, tag, &job.snapshot))
+      {
+         pgmoneta_log_error("Parallel backup: Could not take a snapshot of %s", config->common.servers[server].name);
+         goto error;
+      }
+
+      // the server is only in backup mode for the snapshot, which is copied afterwards
+      if (stop_backup(ssl, socket, server, endpos, &label, end_timeline))
+      {
+         goto error;
+      }
+      in_backup = false;
+
+      pgmoneta_server_disconnect(server, ssl, socket);
+      ssl = NULL;
+      socket = -1;
+
+      pgmoneta_mkdir(job.data);
+
+      memset(&list, 0, sizeof(struct snapshot_list));
+      list.job = &job;
+
+      if (pgmoneta_walk(job.snapshot, WALK_STAT, snapshot_visitor, &list) || list.failed)
+      {
+         pgmoneta_log_error("Parallel backup: Could not list the snapshot %s", job.snapshot);
+         goto error;
+      }
+   }
+   else
+   {
+      if (list_files(ssl, socket, &job))
+      {
+         pgmoneta_log_error("Parallel backup: Could not list the files of %s", config->common.servers[server].name);
+         goto error;
+      }
+
+      // without the changed blocks the files are copied whole, and made incremental afterwards
+      if (parent_label != NULL && config->common.servers[server].ext_valid &&
+          changed_blocks(ssl, socket, server, parent_label, &job))
+      {
+         pgmoneta_log_warn("Parallel backup: No changed blocks from the extension on %s", config->common.servers[server].name);
+      }
+   }
+
+   memset(path, 0, sizeof(path));
+   snprintf(path, sizeof(path), "%spg_wal/archive_status", job.data);
+   pgmoneta_mkdir(path);
+
+   if (config->common.servers[server].version >= 17)
+   {
+      memset(path, 0, sizeof(path));
+      snprintf(path, sizeof(path), "%spg_wal/summaries", job.data);
+      pgmoneta_mkdir(path);
+   }
+
+   qsort(job.files, job.number_of_files, sizeof(struct parallel_file), compare_files);
+
+   if (connections > job.number_of_files)
+   {
+      connections = job.number_of_files > 0 ? job.number_of_files : 1;
+   }
+
+   pgmoneta_log_debug("Parallel backup: %d files from %s using %d %s",
+                      job.number_of_files, config->common.servers[server].name, connections,
+                      job.snapshot != NULL ? "threads" : "connections");
+
+   threads = (pthread_t*)calloc(connections, sizeof(pthread_t));
+   inputs = (struct parallel_input*)calloc(connections, sizeof(struct parallel_input));
+
+   if (threads == NULL || inputs == NULL)
+   {
+      goto error;
+   }
+
+   // authentication isn't thread safe, so the connections are made up front
+   for (int i = 0; i < connections; i++)
+   {
+      inputs[i].job = &job;
+      inputs[i].socket = -1;
+
+      if (job.snapshot == NULL &&
+          pgmoneta_server_authenticate(server, "postgres", config->common.users[usr].username,
+                                       config->common.users[usr].password, false,
+                                       &inputs[i].ssl, &inputs[i].socket) != AUTH_SUCCESS)
+      {
+         pgmoneta_log_error("Parallel backup: Could not open connection %d to %s", i, config->common.servers[server].name);
+         goto error;
+      }
+   }
+
+   for (int i = 0; i < connections; i++)
+   {
+      if (pthread_create(&threads[started], NULL, &copy_files, &inputs[i]))
+      {
+         pgmoneta_log_error("Parallel backup: Could not start connection %d", i);
+         atomic_store(&job.failed, true);
+         break;
+      }
+
+      started++;
+   }
+
+   for (int i = 0; i < started; i++)
+   {
+      pthread_join(threads[i], NULL);
+   }
+
+   if (atomic_load(&job.failed))
+   {
+      goto error;
+   }
+
+   if (in_backup)
+   {
+      if (stop_backup(ssl, socket, server, endpos, &label, end_timeline))
+      {
+         goto error;
+      }
+      in_backup = false;
+   }
+
+   memset(path, 0, sizeof(path));
+   snprintf(path, sizeof(path), "%sbackup_label", job.data);
+   if (write_file(path, label))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_hash_create(job.hash == HASH_ALGORITHM_XXH3 || job.hash == HASH_ALGORITHM_BLAKE3 ? HASH_ALGORITHM_CRC32C : job.hash, &ctx) ||
+       pgmoneta_hash_update(ctx, label, strlen(label)) ||
+       pgmoneta_hash_final(ctx, &label_checksum))
+   {
+      goto error;
+   }
+
+   if (write_manifest(&job, label_checksum, strlen(label), system_identifier, *end_timeline, startpos, endpos))
+   {
+      goto error;
+   }
+
+   for (int i = 0; i < connections; i++)
+   {
+      pgmoneta_close_ssl(inputs[i].ssl);
+      if (inputs[i].socket != -1)
+      {
+         pgmoneta_disconnect(inputs[i].socket);
+      }
+   }
+   pgmoneta_server_disconnect(server, ssl, socket);
+
+   if (job.snapshot != NULL)
+   {
+      snapshot_release(server, tag, job.snapshot);
+   }
+
+   files_destroy(&job);
+   free(job.snapshot);
+   free(job.data);
+   free(threads);
+   free(inputs);
+   free(system_identifier);
+   free(label);
+   free(label_checksum);
+   pgmoneta_hash_destroy(ctx);
+
+   return 0;
+
+error:
+
+   if (in_backup)
+   {
+      pgmoneta_log_debug("Parallel backup: Aborting the backup on %s", config->common.servers[server].name);
+   }
+
+   if (inputs != NULL)
+   {
+      for (int i = 0; i < connections; i++)
+      {
+         pgmoneta_close_ssl(inputs[i].ssl);
+         if (inputs[i].socket > 0)
+         {
+            pgmoneta_disconnect(inputs[i].socket);
+         }
+      }
+   }
+
+   // closing the session aborts a backup that is in progress
+   pgmoneta_close_ssl(ssl);
+   if (socket != -1)
+   {
+      pgmoneta_disconnect(socket);
+   }
+
+   if (job.snapshot != NULL)
+   {
+      snapshot_release(server, tag, job.snapshot);
+   }
+
+   files_destroy(&job);
+   free(job.snapshot);
+   free(job.data);
+   free(threads);
+   free(inputs);
+   free(system_identifier);
+   free(label);
+   free(label_checksum);
+   pgmoneta_hash_destroy(ctx);
+   pgmoneta_free_query_response(response);
+
+   return 1;
+}
+
+static int
+list_files(SSL* ssl, int socket, struct parallel_job* job)
+{
+   char path[MAX_PATH];
+   struct tuple* tup = NULL;
+   struct query_response* response = NULL;
+
+   if (query(ssl, socket, LIST_FILES, &response))
+   {
+      goto error;
+   }
+
+   for (tup = response->tuples; tup != NULL; tup = tup->next)
+   {
+      job->number_of_files++;
+   }
+
+   job->files = (struct parallel_file*)calloc(job->number_of_files > 0 ? job->number_of_files : 1, sizeof(struct parallel_file));
+   if (job->files == NULL)
+   {
+      goto error;
+   }
+   job->number_of_files = 0;
+
+   pgmoneta_mkdir(job->data);
+
+   for (tup = response->tuples; tup != NULL; tup = tup->next)
+   {
+      if (tup->data[0] == NULL || tup->data[1] == NULL || tup->data[2] == NULL || is_excluded(tup->data[0]))
+      {
+         continue;
+      }
+
+      if (!strcmp(tup->data[2], "t"))
+      {
+         memset(path, 0, sizeof(path));
+         snprintf(path, sizeof(path), "%s%s", job->data, tup->data[0]);
+
+         if (pgmoneta_mkdir(path))
+         {
+            pgmoneta_log_error("Parallel backup: Could not create %s", path);
+            goto error;
+         }
+      }
+      else
+      {
+         struct parallel_file* f = &job->files[job->number_of_files++];
+
+         f->path = pgmoneta_append(NULL, tup->data[0]);
+         f->size = strtoull(tup->data[1], NULL, 10);
+         f->modified = tup->data[3] != NULL ? (time_t)strtoll(tup->data[3], NULL, 10) : 0;
+      }
+   }
+   pgmoneta_free_query_response(response);
+
+   return 0;
+
+error:
+
+   pgmoneta_free_query_response(response);
+
+   return 1;
+}
+
+
+static int
+query(SSL* ssl, int socket, char* q, struct query_response** response)
+{
+   struct message* msg = NULL;
+
+   *response = NULL;
+
+   pgmoneta_create_query_message(q, &msg);
+   if (msg == NULL)
+   {
+      goto error;
+   }
+
+   if (pgmoneta_query_execute(ssl, socket, msg, response) || *response == NULL)
+   {
+      goto error;
+   }
+
+   pgmoneta_free_message(msg);
+
+   return 0;
+
+error:
+
+   pgmoneta_free_message(msg);
+
+   return 1;
+}
+
+static bool
+is_excluded(char* path)
+{
+   char* name = NULL;
+   char* p = NULL;
+
+   name = strrchr(path, '/');
+   name = name != NULL ? name + 1 : path;
+
+   for (int i = 0; excluded_files[i] != NULL; i++)
+   {
+      if (!strcmp(name, excluded_files[i]))
+      {
+         return true;
+      }
+   }
+
+   if (pgmoneta_starts_with(name, "pg_internal.init") || pgmoneta_starts_with(name, "pgsql_tmp"))
+   {
+      return true;
+   }
+
+   // temporary relations, t<backend>_<relfilenode>
+   if (name[0] == 't' && isdigit((unsigned char)name[1]))
+   {
+      p = name + 1;
+      while (isdigit((unsigned char)*p))
+      {
+         p++;
+      }
+
+      if (*p == '_' && isdigit((unsigned char)*(p + 1)))
+      {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+static int
+compare_files(const void* a, const void* b)
+{
+   const struct parallel_file* fa = (const struct parallel_file*)a;
+   const struct parallel_file* fb = (const struct parallel_file*)b;
+
+   if (fa->size > fb->size)
+   {
+      return -1;
+   }
+   else if (fa->size < fb->size)
+   {
+      return 1;
+   }
+
+   return strcmp(fa->path, fb->path);
+}
+
+static char*
+sql_literal(char* str)
+{
+   char* result = NULL;
+   size_t length = 0;
+   size_t idx = 0;
+
+   length = strlen(str);
+   result = (char*)malloc(2 * length + 1);
+   if (result == NULL)
+   {
+      return NULL;
+   }
+
+   for (size_t i = 0; i < length; i++)
+   {
+      if (str[i] == '\'')
+      {
+         result[idx++] = '\'';
+      }
+      result[idx++] = str[i];
+   }
+   result[idx] = '\0';
+
+   return result;
+}
+
+static int
+hex_decode(char* hex, unsigned char* out, size_t* length)
+{
+   size_t n = strlen(hex);
+   int hi;
+   int lo;
+
+   if (n % 2 != 0)
+   {
+      return 1;
+   }
+
+   for (size_t i = 0; i < n; i += 2)
+   {
+      hi = isdigit((unsigned char)hex[i]) ? hex[i] - '0' : tolower((unsigned char)hex[i]) - 'a' + 10;
+      lo = isdigit((unsigned char)hex[i + 1]) ? hex[i + 1] - '0' : tolower((unsigned char)hex[i + 1]) - 'a' + 10;
+
+      if (hi < 0 || hi > 15 || lo < 0 || lo > 15)
+      {
+         return 1;
+      }
+
+      out[i / 2] = (unsigned char)((hi << 4) | lo);
+   }
+
+   *length = n / 2;
+
+   return 0;
+}
+
+static int
+base64_decode(char* base64, unsigned char* out, size_t size, size_t* length)
+{
+   uint32_t bits = 0;
+   int count = 0;
+   int v;
+   size_t n = 0;
+
+   // the encoding of PostgreSQL has a line break every 76 characters
+   for (char* p = base64; *p != '\0' && *p != '='; p++)
+   {
+      if (*p >= 'A' && *p <= 'Z')
+      {
+         v = *p - 'A';
+      }
+      else if (*p >= 'a' && *p <= 'z')
+      {
+         v = *p - 'a' + 26;
+      }
+      else if (*p >= '0' && *p <= '9')
+      {
+         v = *p - '0' + 52;
+      }
+      else if (*p == '+')
+      {
+         v = 62;
+      }
+      else if (*p == '/')
+      {
+         v = 63;
+      }
+      else if (*p == '\n' || *p == '\r')
+      {
+         continue;
+      }
+      else
+      {
+         return 1;
+      }
+
+      bits = (bits << 6) | (uint32_t)v;
+      count += 6;
+
+      if (count >= 8)
+      {
+         count -= 8;
+
+         if (n >= size)
+         {
+            return 1;
+         }
+
+         out[n++] = (unsigned char)(bits >> count);
+      }
+   }
+
+   *length = n;
+
+   return 0;
+}
+
+static void*
+copy_files(void* arg)
+{
+   int i;
+   struct parallel_input* input = (struct parallel_input*)arg;
+   struct parallel_job* job = input->job;
+
+   pgmoneta_memory_init();
+
+   while (!atomic_load(&job->failed))
+   {
+      i = atomic_fetch_add(&job->next, 1);
+      if (i >= job->number_of_files)
+      {
+         break;
+      }
+
+      if (job->snapshot != NULL ? copy_snapshot_file(job, &job->files[i]) :
+          job->files[i].changed != NULL ? copy_changed_blocks(input->ssl, input->socket, job, &job->files[i]) :
+          copy_file(input->ssl, input->socket, job, &job->files[i]))
+      {
+         pgmoneta_log_error("Parallel backup: Could not copy %s", job->files[i].path);
+         atomic_store(&job->failed, true);
+      }
+   }
+
+   pgmoneta_memory_destroy();
+
+   return NULL;
+}
+
+static int
+copy_file(SSL* ssl, int socket, struct parallel_job* job, struct parallel_file* file)
+{
+   char path[MAX_PATH];
+   char* literal = NULL;
+   int count = 0;
+   uint64_t offsets[CHUNKS_IN_FLIGHT];
+   size_t sizes[CHUNKS_IN_FLIGHT];
+   size_t lengths[CHUNKS_IN_FLIGHT];
+   uint64_t offset = 0;
+   bool done = false;
+   unsigned char* chunk = NULL;
+   FILE* out = NULL;
+   struct hash_context* ctx = NULL;
+   int algorithm = job->hash;
+
+   if (algorithm == HASH_ALGORITHM_XXH3 || algorithm == HASH_ALGORITHM_BLAKE3)
+   {
+      algorithm = HASH_ALGORITHM_CRC32C;
+   }
+
+   memset(path, 0, sizeof(path));
+   snprintf(path, sizeof(path), "%s%s", job->data, file->path);
+
+   literal = sql_literal(file->path);
+   chunk = (unsigned char*)malloc((size_t)CHUNK_SIZE * CHUNKS_IN_FLIGHT);
+   out = fopen(path, "wb");
+
+   if (literal == NULL || chunk == NULL || out == NULL)
+   {
+      goto error;
+   }
+
+   if (pgmoneta_hash_create(algorithm, &ctx))
+   {
+      goto error;
+   }
+
+   while (!done)
+   {
+      // the chunks expected from the size when the backup started, and the one telling the end
+      count = (int)MIN((uint64_t)CHUNKS_IN_FLIGHT, (file->size > offset ? (file->size - offset) / CHUNK_SIZE : 0) + 1);
+      for (int i = 0; i < count; i++)
+      {
+         offsets[i] = offset + (uint64_t)i * CHUNK_SIZE;
+         sizes[i] = CHUNK_SIZE;
+      }
+
+      if (read_chunks(ssl, socket, job, literal, count, offsets, sizes, chunk, lengths, &file->missing))
+      {
+         goto error;
+      }
+
+      if (file->missing)
+      {
+         // removed during the backup, the WAL replay takes care of it
+         break;
+      }
+
+      for (int i = 0; !done && i < count; i++)
+      {
+         if (lengths[i] > 0)
+         {
+            unsigned char* c = chunk + (size_t)i * CHUNK_SIZE;
+
+            if (fwrite(c, 1, lengths[i], out) != lengths[i] || pgmoneta_hash_update(ctx, c, lengths[i]))
+            {
+               goto error;
+            }
+
+            offset += lengths[i];
+         }
+
+         done = lengths[i] < CHUNK_SIZE;
+      }
+   }
+
+   fclose(out);
+   out = NULL;
+
+   if (file->missing)
+   {
+      unlink(path);
+   }
+   else
+   {
+      file->copied = offset;
+      if (pgmoneta_hash_final(ctx, &file->checksum))
+      {
+         goto error;
+      }
+      pgmoneta_progress_add(0, 1);
+      pgmoneta_drop_cache(path);
+   }
+
+   pgmoneta_hash_destroy(ctx);
+   free(literal);
+   free(chunk);
+
+   return 0;
+
+error:
+
+   if (out != NULL)
+   {
+      fclose(out);
+   }
+   pgmoneta_hash_destroy(ctx);
+   free(literal);
+   free(chunk);
+
+   return 1;
+}
+
+static int
+copy_changed_blocks(SSL* ssl, int socket, struct parallel_job* job, struct parallel_file* file)
+{
+   char path[MAX_PATH];
+   char* incr = NULL;
+   char* literal = NULL;
+   uint32_t* blocks = NULL;
+   uint32_t number_of_blocks = 0;
+   uint32_t total = 0;
+   uint32_t magic = INCREMENTAL_MAGIC;
+   unsigned char* header = NULL;
+   size_t header_length = 0;
+   unsigned char* chunk = NULL;
+   int count = 0;
+   uint64_t offsets[CHUNKS_IN_FLIGHT];
+   size_t sizes[CHUNKS_IN_FLIGHT];
+   size_t lengths[CHUNKS_IN_FLIGHT];
+   uint64_t written = 0;
+   FILE* out = NULL;
+   struct hash_context* ctx = NULL;
+   int algorithm = job->hash;
+
+   if (algorithm == HASH_ALGORITHM_XXH3 || algorithm == HASH_ALGORITHM_BLAKE3)
+   {
+      algorithm = HASH_ALGORITHM_CRC32C;
+   }
+
+   total = (uint32_t)(file->size / job->block_size);
+
+   blocks = (uint32_t*)malloc(sizeof(uint32_t) * (total + 1));
+   if (blocks == NULL)
+   {
+      goto error;
+   }
+
+   // a block past the bitmap was added after the extension looked at the file
+   for (uint32_t b = 0; b < total; b++)
+   {
+      if (b >= file->tracked || (file->changed[b / 8] & (1 << (b % 8))))
+      {
+         blocks[number_of_blocks++] = b;
+      }
+   }
+
+   // like PostgreSQL, a file which mostly changed is kept whole
+   if ((uint64_t)number_of_blocks * 10 > (uint64_t)total * 9)
+   {
+      free(blocks);
+      return copy_file(ssl, socket, job, file);
+   }
+
+   incr = pgmoneta_incremental_path(file->path);
+   literal = sql_literal(file->path);
+   if (incr == NULL || literal == NULL)
+   {
+      goto error;
+   }
+
+   memset(path, 0, sizeof(path));
+   snprintf(path, sizeof(path), "%s%s", job->data, incr);
+
+   // magic, number of blocks, truncation block length and the block numbers, padded to a block when there are blocks
+   header_length = sizeof(uint32_t) * (3 + (size_t)number_of_blocks);
+   if (number_of_blocks > 0 && header_length % job->block_size != 0)
+   {
+      header_length += job->block_size - (header_length % job->block_size);
+   }
+
+   header = (unsigned char*)calloc(1, header_length);
+   chunk = (unsigned char*)malloc((size_t)CHUNK_SIZE * CHUNKS_IN_FLIGHT);
+   out = fopen(path, "wb");
+
+   if (header == NULL || chunk == NULL || out == NULL)
+   {
+      goto error;
+   }
+
+   memcpy(header, &magic, sizeof(uint32_t));
+   memcpy(header + sizeof(uint32_t), &number_of_blocks, sizeof(uint32_t));
+   memcpy(header + 2 * sizeof(uint32_t), &total, sizeof(uint32_t));
+   if (number_of_blocks > 0)
+   {
+      memcpy(header + 3 * sizeof(uint32_t), blocks, sizeof(uint32_t) * number_of_blocks);
+   }
+
+   if (pgmoneta_hash_create(algorithm, &ctx) ||
+       fwrite(header, 1, header_length, out) != header_length ||
+       pgmoneta_hash_update(ctx, header, header_length))
+   {
+      goto error;
+   }
+   written = header_length;
+
+   for (uint32_t i = 0; i < number_of_blocks;)
+   {
+      // consecutive blocks are read together, up to a chunk
+      for (count = 0; count < CHUNKS_IN_FLIGHT && i < number_of_blocks; count++)
+      {
+         uint32_t run = 1;
+
+         while (i + run < number_of_blocks && blocks[i + run] == blocks[i] + run &&
+                (size_t)(run + 1) * job->block_size <= CHUNK_SIZE)
+         {
+            run++;
+         }
+
+         offsets[count] = (uint64_t)blocks[i] * job->block_size;
+         sizes[count] = (size_t)run * job->block_size;
+         i += run;
+      }
+
+      if (read_chunks(ssl, socket, job, literal, count, offsets, sizes, chunk, lengths, &file->missing))
+      {
+         goto error;
+      }
+
+      if (file->missing)
+      {
+         break;
+      }
+
+      for (int j = 0; j < count; j++)
+      {
+         unsigned char* c = chunk + (size_t)j * CHUNK_SIZE;
+
+         // a file truncated during the backup is truncated again by the WAL replay
+         if (lengths[j] < sizes[j])
+         {
+            memset(c + lengths[j], 0, sizes[j] - lengths[j]);
+         }
+
+         if (fwrite(c, 1, sizes[j], out) != sizes[j] || pgmoneta_hash_update(ctx, c, sizes[j]))
+         {
+            goto error;
+         }
+
+         written += sizes[j];
+      }
+   }
+
+   fclose(out);
+   out = NULL;
+
+   if (file->missing)
+   {
+      unlink(path);
+   }
+   else
+   {
+      file->copied = written;
+      if (pgmoneta_hash_final(ctx, &file->checksum))
+      {
+         goto error;
+      }
+
+      free(file->path);
+      file->path = incr;
+      incr = NULL;
+
+      pgmoneta_progress_add(0, 1);
+      pgmoneta_drop_cache(path);
+   }
+
+   pgmoneta_hash_destroy(ctx);
+   free(incr);
+   free(literal);
+   free(blocks);
+   free(header);
+   free(chunk);
+
+   return 0;
+
+error:
+
+   if (out != NULL)
+   {
+      fclose(out);
+   }
+   pgmoneta_hash_destroy(ctx);
+   free(incr);
+   free(literal);
+   free(blocks);
+   free(header);
+   free(chunk);
+
+   return 1;
+}
+
+static int
+read_chunks(SSL* ssl, int socket, struct parallel_job* job, char* literal, int count,
+            uint64_t* offsets, size_t* sizes, unsigned char* chunks, size_t* lengths, bool* missing)
+{
+   int i = 0;
+   char* q = NULL;
+   struct tuple* tup = NULL;
+   struct query_response* response = NULL;
+
+   // the statements of a query are answered back to back, one row each,
+   // and base64 is a third smaller than hex on the wire
+   for (i = 0; i < count; i++)
+   {
+      lengths[i] = 0;
+
+      q = pgmoneta_append(q, "SELECT encode(pg_read_binary_file('");
+      q = pgmoneta_append(q, literal);
+      q = pgmoneta_append(q, "', ");
+      q = pgmoneta_append_ulong(q, offsets[i]);
+      q = pgmoneta_append(q, ", ");
+      q = pgmoneta_append_ulong(q, sizes[i]);
+      q = pgmoneta_append(q, ", true), 'base64');");
+   }
+
+   if (query(ssl, socket, q, &response))
+   {
+      goto error;
+   }
+
+   for (i = 0, tup = response->tuples; i < count && tup != NULL; i++, tup = tup->next)
+   {
+      if (tup->data[0] == NULL)
+      {
+         *missing = true;
+         break;
+      }
+
+      if (base64_decode(tup->data[0], chunks + (size_t)i * CHUNK_SIZE, sizes[i], &lengths[i]))
+      {
+         goto error;
+      }
+
+      if (lengths[i] > 0)
+      {
+         if (job->bucket != NULL)
+         {
+            pgmoneta_token_bucket_consume(job->bucket, lengths[i]);
+         }
+         if (job->network_bucket != NULL)
+         {
+            pgmoneta_token_bucket_consume(job->network_bucket, lengths[i]);
+         }
+         pgmoneta_bandwidth_consume(lengths[i]);
+         pgmoneta_progress_add(lengths[i], 0);
+      }
+   }
+
+   if (i < count && !*missing)
+   {
+      goto error;
+   }
+
+   pgmoneta_free_query_response(response);
+   free(q);
+
+   return 0;
+
+error:
+
+   pgmoneta_free_query_response(response);
+   free(q);
+
+   return 1;
+}
+
+static int
+changed_blocks(SSL* ssl, int socket, int server, char* parent_label, struct parallel_job* job)
+{
+   char lsn[MISC_LENGTH];
+   char* server_backup = NULL;
+   char* manifest = NULL;
+   char* incr = NULL;
+   int tracked = 0;
+   uint64_t max_size = 0;
+   size_t length = 0;
+   struct backup* parent = NULL;
+   struct art* parent_files = NULL;
+   struct art* files = NULL;
+   struct query_response* response = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   max_size = (uint64_t)config->common.servers[server].relseg_size * job->block_size;
+
+   server_backup = pgmoneta_get_server_backup(server);
+   if (pgmoneta_get_backup(server_backup, parent_label, &parent) || parent == NULL)
+   {
+      goto error;
+   }
+
+   memset(lsn, 0, sizeof(lsn));
+   snprintf(lsn, sizeof(lsn), "%X/%X", parent->start_lsn_hi32, parent->start_lsn_lo32);
+
+   manifest = pgmoneta_get_server_backup_identifier(server, parent_label);
+   manifest = pgmoneta_append(manifest, "backup.manifest");
+   if (pgmoneta_manifest_load(manifest, &parent_files) || pgmoneta_art_create(&files))
+   {
+      goto error;
+   }
+
+   // the files which can be described by blocks, like the incremental backups of PostgreSQL
+   for (int i = 0; i < job->number_of_files; i++)
+   {
+      struct parallel_file* f = &job->files[i];
+
+      if (pgmoneta_incremental_is_relation_file(f->path) && f->size > 0 && f->size % job->block_size == 0 &&
+          f->size <= max_size)
+      {
+         pgmoneta_art_insert(files, f->path, (uintptr_t)i, ValueInt32);
+      }
+   }
+
+   if (pgmoneta_ext_get_changed_blocks(ssl, socket, lsn, &response) || response == NULL ||
+       response->number_of_columns < 3)
+   {
+      goto error;
+   }
+
+   for (struct tuple* tup = response->tuples; tup != NULL; tup = tup->next)
+   {
+      struct parallel_file* f = NULL;
+
+      if (tup->data[0] == NULL || tup->data[1] == NULL || tup->data[2] == NULL ||
+          !pgmoneta_art_contains_key(files, tup->data[0]))
+      {
+         continue;
+      }
+
+      // a relation created since the parent has no full file to be combined with
+      incr = pgmoneta_incremental_path(tup->data[0]);
+      if (incr == NULL)
+      {
+         goto error;
+      }
+
+      if (pgmoneta_art_contains_key(parent_files, tup->data[0]) || pgmoneta_art_contains_key(parent_files, incr))
+      {
+         f = &job->files[(int)pgmoneta_art_search(files, tup->data[0])];
+
+         f->changed = (uint8_t*)malloc(strlen(tup->data[2]) / 2 + 1);
+         if (f->changed == NULL || hex_decode(tup->data[2], f->changed, &length))
+         {
+            goto error;
+         }
+
+         f->tracked = (uint32_t)MIN(strtoull(tup->data[1], NULL, 10), (unsigned long long)length * 8);
+         tracked++;
+      }
+
+      free(incr);
+      incr = NULL;
+   }
+
+   pgmoneta_log_debug("Parallel backup: %d relation files changed since %s on %s", tracked, lsn,
+                      config->common.servers[server].name);
+
+   pgmoneta_free_query_response(response);
+   pgmoneta_art_destroy(parent_files);
+   pgmoneta_art_destroy(files);
+   free(parent);
+   free(manifest);
+   free(server_backup);
+
+   return 0;
+
+error:
+
+   // the files are copied whole
+   for (int i = 0; i < job->number_of_files; i++)
+   {
+      free(job->files[i].changed);
+      job->files[i].changed = NULL;
+      job->files[i].tracked = 0;
+   }
+
+   pgmoneta_free_query_response(response);
+   pgmoneta_art_destroy(parent_files);
+   pgmoneta_art_destroy(files);
+   free(incr);
+   free(parent);
+   free(manifest);
+   free(server_backup);
+
+   return 1;
+}
+
+static void
+files_destroy(struct parallel_job* job)
+{
+   if (job->files != NULL)
+   {
+      for (int i = 0; i < job->number_of_files; i++)
+      {
+         free(job->files[i].path);
+         free(job->files[i].checksum);
+         free(job->files[i].changed);
+      }
+   }
+   free(job->files);
+   job->files = NULL;
+}
+
+static int
+stop_backup(SSL* ssl, int socket, int server, char* endpos, char** label, uint32_t* end_timeline)
+{
+   char* q = NULL;
+   struct query_response* response = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (config->common.servers[server].version >= 15)
+   {
+      q = "SELECT lsn, labelfile, spcmapfile FROM pg_backup_stop(false);";
+   }
+   else
+   {
+      q = "SELECT lsn, labelfile, spcmapfile FROM pg_stop_backup(false, false);";
+   }
+
+   if (query(ssl, socket, q, &response) || response->tuples == NULL ||
+       response->tuples->data[0] == NULL || response->tuples->data[1] == NULL)
+   {
+      pgmoneta_log_error("Parallel backup: Could not stop the backup on %s", config->common.servers[server].name);
+      goto error;
+   }
+
+   memset(endpos, 0, 20);
+   snprintf(endpos, 20, "%s", response->tuples->data[0]);
+   *label = pgmoneta_append(NULL, response->tuples->data[1]);
+   pgmoneta_free_query_response(response);
+   response = NULL;
+
+   if (query(ssl, socket, "SELECT timeline_id FROM pg_control_checkpoint();", &response) ||
+       response->tuples == NULL || response->tuples->data[0] == NULL)
+   {
+      goto error;
+   }
+   *end_timeline = (uint32_t)strtoul(response->tuples->data[0], NULL, 10);
+   pgmoneta_free_query_response(response);
+
+   return 0;
+
+error:
+
+   pgmoneta_free_query_response(response);
+
+   return 1;
+}
+
+static char*
+snapshot_format(char* command, int server, char* tag, char* path)
+{
+   char* result = NULL;
+   char c[2];
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   // %s is the server, %l the label of the backup and %p the path of the snapshot
+   for (char* p = command; *p != '\0'; p++)
+   {
+      if (*p == '%' && *(p + 1) == 's')
+      {
+         result = pgmoneta_append(result, config->common.servers[server].name);
+         p++;
+      }
+      else if (*p == '%' && *(p + 1) == 'l')
+      {
+         result = pgmoneta_append(result, tag);
+         p++;
+      }
+      else if (*p == '%' && *(p + 1) == 'p')
+      {
+         result = pgmoneta_append(result, path != NULL ? path : "");
+         p++;
+      }
+      else if (*p == '%' && *(p + 1) == '%')
+      {
+         result = pgmoneta_append(result, "%");
+         p++;
+      }
+      else
+      {
+         c[0] = *p;
+         c[1] = '\0';
+         result = pgmoneta_append(result, c);
+      }
+   }
+
+   return result;
+}
+
+static int
+snapshot_take(int server, char* tag, char** path)
+{
+   char* command = NULL;
+   char line[MAX_PATH];
+   FILE* pipe = NULL;
+   int status;
+   size_t length;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   *path = NULL;
+
+   command = snapshot_format(config->common.servers[server].snapshot_command, server, tag, NULL);
+   if (command == NULL)
+   {
+      goto error;
+   }
+
+   pgmoneta_log_debug("Parallel backup: Snapshot %s", command);
+
+   // the command prints the data directory of the snapshot, mounted on this host
+   memset(line, 0, sizeof(line));
+   pipe = popen(command, "r");
+   if (pipe == NULL)
+   {
+      goto error;
+   }
+
+   if (fgets(line, sizeof(line), pipe) == NULL)
+   {
+      line[0] = '\0';
+   }
+
+   // the rest of the output isn't used
+   while (fgetc(pipe) != EOF)
+   {
+   }
+
+   status = pclose(pipe);
+   pipe = NULL;
+
+   if (status == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+   {
+      pgmoneta_log_error("Parallel backup: %s failed (%d)", command, status);
+      goto error;
+   }
+
+   length = strlen(line);
+   while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+   {
+      line[--length] = '\0';
+   }
+
+   if (length == 0 || !pgmoneta_is_directory(line))
+   {
+      pgmoneta_log_error("Parallel backup: %s didn't print the data directory of the snapshot", command);
+      goto error;
+   }
+
+   *path = pgmoneta_append(NULL, line);
+   if (!pgmoneta_ends_with(*path, "/"))
+   {
+      *path = pgmoneta_append(*path, "/");
+   }
+
+   free(command);
+
+   return 0;
+
+error:
+
+   if (pipe != NULL)
+   {
+      pclose(pipe);
+   }
+   free(command);
+
+   return 1;
+}
+
+static void
+snapshot_release(int server, char* tag, char* path)
+{
+   char* command = NULL;
+   int status;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (strlen(config->common.servers[server].snapshot_release_command) == 0)
+   {
+      return;
+   }
+
+   command = snapshot_format(config->common.servers[server].snapshot_release_command, server, tag, path);
+   if (command == NULL)
+   {
+      return;
+   }
+
+   pgmoneta_log_debug("Parallel backup: Release %s", command);
+
+   status = system(command);
+   if (status == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+   {
+      pgmoneta_log_warn("Parallel backup: %s failed (%d)", command, status);
+   }
+
+   free(command);
+}
+
+static int
+snapshot_visitor(struct walk_entry* entry, void* data)
+{
+   char path[MAX_PATH];
+   struct stat st;
+   struct snapshot_list* list = (struct snapshot_list*)data;
+   struct parallel_job* job = list->job;
+
+   if (is_excluded(entry->path))
+   {
+      return WALK_SKIP;
+   }
+
+   if (entry->type == DT_DIR)
+   {
+      memset(path, 0, sizeof(path));
+      snprintf(path, sizeof(path), "%s%s", job->data, entry->path);
+
+      if (pgmoneta_mkdir(path))
+      {
+         pgmoneta_log_error("Parallel backup: Could not create %s", path);
+         list->failed = true;
+         return WALK_STOP;
+      }
+
+      // like LIST_FILES, the directories are kept without their content
+      for (int i = 0; excluded_directories[i] != NULL; i++)
+      {
+         if (!strcmp(entry->path, excluded_directories[i]))
+         {
+            return WALK_SKIP;
+         }
+      }
+
+      return WALK_CONTINUE;
+   }
+
+   if (entry->type != DT_REG)
+   {
+      return WALK_CONTINUE;
+   }
+
+   if (job->number_of_files == list->capacity)
+   {
+      struct parallel_file* files = NULL;
+      int capacity = list->capacity > 0 ? list->capacity * 2 : 1024;
+
+      files = (struct parallel_file*)realloc(job->files, capacity * sizeof(struct parallel_file));
+      if (files == NULL)
+      {
+         list->failed = true;
+         return WALK_STOP;
+      }
+
+      memset(files + list->capacity, 0, (capacity - list->capacity) * sizeof(struct parallel_file));
+      job->files = files;
+      list->capacity = capacity;
+   }
+
+   memset(&st, 0, sizeof(struct stat));
+   fstatat(entry->dirfd, entry->name, &st, AT_SYMLINK_NOFOLLOW);
+
+   job->files[job->number_of_files].path = pgmoneta_append(NULL, entry->path);
+   job->files[job->number_of_files].size = entry->size;
+   job->files[job->number_of_files].modified = st.st_mtime;
+   job->number_of_files++;
+
+   return WALK_CONTINUE;
+}
+
+static int
+copy_snapshot_file(struct parallel_job* job, struct parallel_file* file)
+{
+   char from[MAX_PATH];
+   char to[MAX_PATH];
+   int in = -1;
+   ssize_t length = 0;
+   uint64_t offset = 0;
+   unsigned char* chunk = NULL;
+   FILE* out = NULL;
+   struct hash_context* ctx = NULL;
+   int algorithm = job->hash;
+
+   if (algorithm == HASH_ALGORITHM_XXH3 || algorithm == HASH_ALGORITHM_BLAKE3)
+   {
+      algorithm = HASH_ALGORITHM_CRC32C;
+   }
+
+   memset(from, 0, sizeof(from));
+   snprintf(from, sizeof(from), "%s%s", job->snapshot, file->path);
+   memset(to, 0, sizeof(to));
+   snprintf(to, sizeof(to), "%s%s", job->data, file->path);
+
+   in = open(from, O_RDONLY);
+   chunk = (unsigned char*)malloc(CHUNK_SIZE);
+   out = fopen(to, "wb");
+
+   if (in == -1 || chunk == NULL || out == NULL || pgmoneta_hash_create(algorithm, &ctx))
+   {
+      goto error;
+   }
+
+   // the snapshot doesn't change, so the copy can be throttled freely
+   while ((length = read(in, chunk, CHUNK_SIZE)) > 0)
+   {
+      if (job->bucket != NULL)
+      {
+         pgmoneta_token_bucket_consume(job->bucket, length);
+      }
+      if (job->network_bucket != NULL)
+      {
+         pgmoneta_token_bucket_consume(job->network_bucket, length);
+      }
+      pgmoneta_bandwidth_consume(length);
+
+      if (fwrite(chunk, 1, length, out) != (size_t)length || pgmoneta_hash_update(ctx, chunk, length))
+      {
+         goto error;
+      }
+
+      offset += length;
+      pgmoneta_progress_add(length, 0);
+   }
+
+   if (length < 0 || fclose(out) != 0)
+   {
+      out = NULL;
+      goto error;
+   }
+   out = NULL;
+
+   file->copied = offset;
+   if (pgmoneta_hash_final(ctx, &file->checksum))
+   {
+      goto error;
+   }
+   pgmoneta_progress_add(0, 1);
+   pgmoneta_drop_cache(to);
+
+   close(in);
+   pgmoneta_hash_destroy(ctx);
+   free(chunk);
+
+   return 0;
+
+error:
+
+   if (in != -1)
+   {
+      close(in);
+   }
+   if (out != NULL)
+   {
+      fclose(out);
+   }
+   pgmoneta_hash_destroy(ctx);
+   free(chunk);
+
+   return 1;
+}
+
+static char*
+checksum_algorithm(int hash)
+{
+   switch (hash)
+   {
+      case HASH_ALGORITHM_CRC32C:
+      case HASH_ALGORITHM_XXH3:
+      case HASH_ALGORITHM_BLAKE3:
+         return "CRC32C";
+      case HASH_ALGORITHM_SHA224:
+         return "SHA224";
+      case HASH_ALGORITHM_SHA384:
+         return "SHA384";
+      case HASH_ALGORITHM_SHA512:
+         return "SHA512";
+      default:
+         break;
+   }
+
+   return "SHA256";
+}
+
+static int
+write_file(char* path, char* content)
+{
+   FILE* f = NULL;
+   size_t length = strlen(content);
+
+   f = fopen(path, "wb");
+   if (f == NULL)
+   {
+      pgmoneta_log_error("Parallel backup: Could not create %s", path);
+      return 1;
+   }
+
+   if (fwrite(content, 1, length, f) != length)
+   {
+      fclose(f);
+      return 1;
+   }
+
+   fclose(f);
+
+   return 0;
+}
+
+static char*
+manifest_entry(char* manifest, char* path, uint64_t size, time_t modified, char* algorithm, char* checksum, bool first)
+{
+   char line[MAX_PATH * 2 + 256];
+   char timestamp[MISC_LENGTH];
+   char* escaped = NULL;
+   struct tm tm;
+
+   memset(timestamp, 0, sizeof(timestamp));
+   gmtime_r(&modified, &tm);
+   strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S GMT", &tm);
+
+   escaped = pgmoneta_escape_string(path);
+
+   memset(line, 0, sizeof(line));
+   snprintf(line, sizeof(line),
+            "%s{ \"Path\": \"%s\", \"Size\": %" PRIu64 ", \"Last-Modified\": \"%s\", \"Checksum-Algorithm\": \"%s\", \"Checksum\": \"%s\" }",
+            first ? "\n" : ",\n", escaped, size, timestamp, algorithm, checksum);
+
+   free(escaped);
+
+   return pgmoneta_append(manifest, line);
+}
+
+static int
+write_manifest(struct parallel_job* job, char* label_checksum, size_t label_size,
+               char* system_identifier, uint32_t timeline, char* startpos, char* endpos)
+{
+   bool first = true;
+   char path[MAX_PATH];
+   char line[MISC_LENGTH];
+   char* manifest = NULL;
+   char* checksum = NULL;
+   char* algorithm = NULL;
+   struct hash_context* ctx = NULL;
+
+   algorithm = checksum_algorithm(job->hash);
+
+   if (system_identifier != NULL)
+   {
+      manifest = pgmoneta_append(manifest, "{ \"PostgreSQL-Backup-Manifest-Version\": 2,\n\"System-Identifier\": ");
+      manifest = pgmoneta_append(manifest, system_identifier);
+      manifest = pgmoneta_append(manifest, ",\n\"Files\": [");
+   }
+   else
+   {
+      manifest = pgmoneta_append(manifest, "{ \"PostgreSQL-Backup-Manifest-Version\": 1,\n\"Files\": [");
+   }
+
+   manifest = manifest_entry(manifest, "backup_label", label_size, time(NULL), algorithm, label_checksum, first);
+   first = false;
+
+   for (int i = 0; i < job->number_of_files; i++)
+   {
+      if (job->files[i].missing || job->files[i].checksum == NULL)
+      {
+         continue;
+      }
+
+      manifest = manifest_entry(manifest, job->files[i].path, job->files[i].copied, job->files[i].modified,
+                                algorithm, job->files[i].checksum, first);
+   }
+
+   memset(line, 0, sizeof(line));
+   snprintf(line, sizeof(line),
+            "\n],\n\"WAL-Ranges\": [\n{ \"Timeline\": %u, \"Start-LSN\": \"%s\", \"End-LSN\": \"%s\" }\n],\n",
+            timeline, startpos, endpos);
+   manifest = pgmoneta_append(manifest, line);
+
+   if (pgmoneta_hash_create(HASH_ALGORITHM_SHA256, &ctx) ||
+       pgmoneta_hash_update(ctx, manifest, strlen(manifest)) ||
+       pgmoneta_hash_final(ctx, &checksum))
+   {
+      goto error;
+   }
+
+   manifest = pgmoneta_append(manifest, "\"Manifest-Checksum\": \"");
+   manifest = pgmoneta_append(manifest, checksum);
+   manifest = pgmoneta_append(manifest, "\"}\n");
+
+   memset(path, 0, sizeof(path));
+   snprintf(path, sizeof(path), "%sbackup_manifest", job->data);
+   if (write_file(path, manifest))
+   {
+      goto error;
+   }
+
+   pgmoneta_hash_destroy(ctx);
+   free(checksum);
+   free(manifest);
+
+   return 0;
+
+error:
+
+   pgmoneta_hash_destroy(ctx);
+   free(checksum);
+   free(manifest);
+
+   return 1;
+}
@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <management.h>
+#include <profile.h>
+
+/* system */
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Flush the local totals of a probe to shared memory every this many calls */
+#define PROFILE_FLUSH_CALLS 256
+
+/** @struct profile_local
+ * Defines the totals of a probe not yet moved to shared memory
+ */
+struct profile_local
+{
+   uint64_t calls; /**< The number of calls */
+   uint64_t total;  /**< The time in nanoseconds */
+   uint64_t max;   /**< The longest call in nanoseconds */
+};
+
+static struct profile_local local[NUMBER_OF_PROFILE_PROBES];
+static bool registered = false;
+
+static char* probe_names[NUMBER_OF_PROFILE_PROBES] = {
+   "copy_stream",
+   "tar_extract",
+   "zstd_compress",
+   "encrypt_file",
+   "file_hash",
+   "read_blocks",
+};
+
+static void profile_flush_probe(int probe);
+static void profile_exit(void);
+
+uint64_t
+pgmoneta_profile_now(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+
+   return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+void
+pgmoneta_profile_end(struct profile_scope* scope)
+{
+   uint64_t duration;
+   struct profile_local* l;
+
+   if (scope == NULL || scope->probe < 0 || scope->probe >= NUMBER_OF_PROFILE_PROBES)
+   {
+      return;
+   }
+
+   duration = pgmoneta_profile_now() - scope->start;
+
+   l = &local[scope->probe];
+   l->calls++;
+   l->time += duration;
+   if (duration > l->max)
+   {
+      l->max = duration;
+   }
+
+   if (!registered)
+   {
+      /* Processes are short lived, so whatever is left is flushed on exit */
+      atexit(profile_exit);
+      registered = true;
+   }
+
+   if (l->calls >= PROFILE_FLUSH_CALLS)
+   {
+      profile_flush_probe(scope->probe);
+   }
+}
+
+void
+pgmoneta_profile_flush(void)
+{
+   for (int i = 0; i < NUMBER_OF_PROFILE_PROBES; i++)
+   {
+      profile_flush_probe(i);
+   }
+}
+
+void
+pgmoneta_profile_reset(void)
+{
+   struct common_configuration* config;
+
+   config = (struct common_configuration*)shmem;
+
+   if (config == NULL)
+   {
+      return;
+   }
+
+   for (int i = 0; i < NUMBER_OF_PROFILE_PROBES; i++)
+   {
+      atomic_store(&config->profile[i].calls, 0);
+      atomic_store(&config->profile[i].time, 0);
+      atomic_store(&config->profile[i].max, 0);
+   }
+}
+
+char*
+pgmoneta_profile_name(int probe)
+{
+   if (probe < 0 || probe >= NUMBER_OF_PROFILE_PROBES)
+   {
+      return "unknown";
+   }
+
+   return probe_names[probe];
+}
+
+int
+pgmoneta_profile_json(struct json** probes)
+{
+   uint64_t calls;
+   uint64_t total;
+   struct json* array = NULL;
+   struct json* p = NULL;
+   struct common_configuration* config;
+
+   config = (struct common_configuration*)shmem;
+
+   *probes = NULL;
+
+   if (pgmoneta_json_create(&array))
+   {
+      goto error;
+   }
+
+   for (int i = 0; i < NUMBER_OF_PROFILE_PROBES; i++)
+   {
+      calls = atomic_load(&config->profile[i].calls);
+      total = atomic_load(&config->profile[i].time);
+
+      if (pgmoneta_json_create(&p))
+      {
+         goto error;
+      }
+
+      pgmoneta_json_put(p, MANAGEMENT_ARGUMENT_NAME, (uintptr_t)probe_names[i], ValueString);
+      pgmoneta_json_put(p, MANAGEMENT_ARGUMENT_CALLS, (uintptr_t)calls, ValueUInt64);
+      pgmoneta_json_put(p, MANAGEMENT_ARGUMENT_TOTAL, pgmoneta_value_from_double(total / 1000000000.0), ValueDouble);
+      pgmoneta_json_put(p, MANAGEMENT_ARGUMENT_AVERAGE, pgmoneta_value_from_double(calls > 0 ? total / 1000000000.0 / calls : 0.0), ValueDouble);
+      pgmoneta_json_put(p, MANAGEMENT_ARGUMENT_MAX, pgmoneta_value_from_double(atomic_load(&config->profile[i].max) / 1000000000.0), ValueDouble);
+
+      if (pgmoneta_json_append(array, (uintptr_t)p, ValueJSON))
+      {
+         goto error;
+      }
+      p = NULL;
+   }
+
+   *probes = array;
+
+   return 0;
+
+error:
+
+   pgmoneta_json_destroy(p);
+   pgmoneta_json_destroy(array);
+
+   return 1;
+}
+
+static void
+profile_flush_probe(int probe)
+{
+   uint64_t max;
+   struct profile_local* l;
+   struct common_configuration* config;
+
+   config = (struct common_configuration*)shmem;
+   l = &local[probe];
+
+   if (config == NULL || l->calls == 0)
+   {
+      return;
+   }
+
+   atomic_fetch_add(&config->profile[probe].calls, l->calls);
+   atomic_fetch_add(&config->profile[probe].time, l->time);
+
+   max = atomic_load(&config->profile[probe].max);
+   while (l->max > max && !atomic_compare_exchange_weak(&config->profile[probe].max, &max, l->max))
+   {
+   }
+
+   memset(l, 0, sizeof(struct profile_local));
+}
+
+static void
+profile_exit(void)
+{
+   pgmoneta_profile_flush();
+}
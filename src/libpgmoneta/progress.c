@@ -0,0 +1,303 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <json.h>
+#include <management.h>
+#include <progress.h>
+#include <prometheus.h>
+#include <value.h>
+#include <workflow.h>
+
+/* system */
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+static char* workflow_names[NUMBER_OF_WORKFLOW_TYPES] = {
+   "backup", "restore", "archive", "delete_backup", "retention", "wal_shipping",
+   "verify", "incremental_backup", "combine", "combine_as_is", "post_rollup"
+};
+
+/* The progress of the operation run by this thread, and how deeply it is nested */
+static _Thread_local struct progress* current = NULL;
+static _Thread_local int depth = 0;
+
+/* The progress for the workers, as long as the process runs a single operation */
+static _Atomic(struct progress*) shared = NULL;
+static atomic_int operations = 0;
+
+static struct progress* progress_get(void);
+
+void
+pgmoneta_progress_start(int server, int workflow)
+{
+   uint64_t now;
+   struct progress* p = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (depth++ > 0)
+   {
+      return;
+   }
+
+   if (config == NULL || server < 0 || server >= config->common.number_of_servers ||
+       workflow < 0 || workflow >= NUMBER_OF_WORKFLOW_TYPES)
+   {
+      return;
+   }
+
+   p = &config->common.servers[server].progress;
+   now = pgmoneta_prometheus_now();
+
+   atomic_store(&p->workflow, 0);
+   memset(p->phase, 0, sizeof(p->phase));
+   atomic_store(&p->bytes_done, 0);
+   atomic_store(&p->bytes_total, 0);
+   atomic_store(&p->files_done, 0);
+   atomic_store(&p->files_total, 0);
+   atomic_store(&p->start, now);
+   atomic_store(&p->phase_start, now);
+   atomic_store(&p->workflow, workflow + 1);
+
+   current = p;
+
+   if (atomic_fetch_add(&operations, 1) == 0)
+   {
+      atomic_store(&shared, p);
+   }
+   else
+   {
+      atomic_store(&shared, NULL);
+   }
+}
+
+void
+pgmoneta_progress_phase(char* name)
+{
+   struct progress* p = progress_get();
+
+   if (p == NULL)
+   {
+      return;
+   }
+
+   atomic_store(&p->bytes_done, 0);
+   atomic_store(&p->bytes_total, 0);
+   atomic_store(&p->files_done, 0);
+   atomic_store(&p->files_total, 0);
+
+   memset(p->phase, 0, sizeof(p->phase));
+   snprintf(p->phase, sizeof(p->phase), "%s", name != NULL ? name : "");
+
+   atomic_store(&p->phase_start, pgmoneta_prometheus_now());
+}
+
+void
+pgmoneta_progress_total(uint64_t bytes, uint64_t files)
+{
+   struct progress* p = progress_get();
+
+   if (p == NULL)
+   {
+      return;
+   }
+
+   atomic_store(&p->bytes_total, bytes);
+   atomic_store(&p->files_total, files);
+}
+
+void
+pgmoneta_progress_add(uint64_t bytes, uint64_t files)
+{
+   struct progress* p = progress_get();
+
+   if (p == NULL)
+   {
+      return;
+   }
+
+   if (bytes > 0)
+   {
+      atomic_fetch_add(&p->bytes_done, bytes);
+   }
+
+   if (files > 0)
+   {
+      atomic_fetch_add(&p->files_done, files);
+   }
+}
+
+void
+pgmoneta_progress_finish(void)
+{
+   if (depth == 0 || --depth > 0)
+   {
+      return;
+   }
+
+   if (current != NULL)
+   {
+      atomic_store(&current->workflow, 0);
+      atomic_store(&shared, NULL);
+      atomic_fetch_sub(&operations, 1);
+      current = NULL;
+   }
+}
+
+bool
+pgmoneta_progress_snapshot(int server, struct progress_snapshot* snapshot)
+{
+   int workflow;
+   uint64_t now;
+   uint64_t start;
+   uint64_t phase_start;
+   struct progress* p = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   memset(snapshot, 0, sizeof(struct progress_snapshot));
+   snapshot->remaining = -1.0;
+
+   if (config == NULL || server < 0 || server >= config->common.number_of_servers)
+   {
+      return false;
+   }
+
+   p = &config->common.servers[server].progress;
+
+   workflow = atomic_load(&p->workflow);
+   if (workflow == 0)
+   {
+      return false;
+   }
+
+   /* The phase start is stored after the name, so the name is complete */
+   phase_start = atomic_load(&p->phase_start);
+   start = atomic_load(&p->start);
+   memcpy(snapshot->phase, p->phase, sizeof(snapshot->phase));
+   snapshot->phase[sizeof(snapshot->phase) - 1] = '\0';
+
+   snapshot->workflow = workflow - 1;
+   snapshot->bytes_done = atomic_load(&p->bytes_done);
+   snapshot->bytes_total = atomic_load(&p->bytes_total);
+   snapshot->files_done = atomic_load(&p->files_done);
+   snapshot->files_total = atomic_load(&p->files_total);
+
+   now = pgmoneta_prometheus_now();
+   snapshot->elapsed = now > start ? (double)(now - start) / 1000000.0 : 0.0;
+   snapshot->phase_elapsed = now > phase_start ? (double)(now - phase_start) / 1000000.0 : 0.0;
+
+   if (snapshot->phase_elapsed > 0.0)
+   {
+      snapshot->throughput = (double)snapshot->bytes_done / snapshot->phase_elapsed;
+   }
+
+   if (snapshot->bytes_total > 0 && snapshot->throughput > 0.0)
+   {
+      if (snapshot->bytes_done < snapshot->bytes_total)
+      {
+         snapshot->remaining = (double)(snapshot->bytes_total - snapshot->bytes_done) / snapshot->throughput;
+      }
+      else
+      {
+         snapshot->remaining = 0.0;
+      }
+   }
+
+   return true;
+}
+
+char*
+pgmoneta_progress_workflow_name(int workflow)
+{
+   if (workflow < 0 || workflow >= NUMBER_OF_WORKFLOW_TYPES)
+   {
+      return "unknown";
+   }
+
+   return workflow_names[workflow];
+}
+
+int
+pgmoneta_progress_json(int server, struct json** progress)
+{
+   struct json* js = NULL;
+   struct progress_snapshot snapshot;
+
+   *progress = NULL;
+
+   if (!pgmoneta_progress_snapshot(server, &snapshot))
+   {
+      return 0;
+   }
+
+   if (pgmoneta_json_create(&js))
+   {
+      goto error;
+   }
+
+   pgmoneta_json_put(js, MANAGEMENT_ARGUMENT_WORKFLOW, (uintptr_t)pgmoneta_progress_workflow_name(snapshot.workflow), ValueString);
+   pgmoneta_json_put(js, MANAGEMENT_ARGUMENT_PHASE, (uintptr_t)snapshot.phase, ValueString);
+   pgmoneta_json_put(js, MANAGEMENT_ARGUMENT_ELAPSED, pgmoneta_value_from_double(snapshot.elapsed), ValueDouble);
+   pgmoneta_json_put(js, MANAGEMENT_ARGUMENT_BYTES, (uintptr_t)snapshot.bytes_done, ValueUInt64);
+   pgmoneta_json_put(js, MANAGEMENT_ARGUMENT_BYTES_TOTAL, (uintptr_t)snapshot.bytes_total, ValueUInt64);
+   pgmoneta_json_put(js, MANAGEMENT_ARGUMENT_FILES, (uintptr_t)snapshot.files_done, ValueUInt64);
+   pgmoneta_json_put(js, MANAGEMENT_ARGUMENT_FILES_TOTAL, (uintptr_t)snapshot.files_total, ValueUInt64);
+   pgmoneta_json_put(js, MANAGEMENT_ARGUMENT_THROUGHPUT, pgmoneta_value_from_double(snapshot.throughput), ValueDouble);
+
+   if (snapshot.remaining >= 0.0)
+   {
+      pgmoneta_json_put(js, MANAGEMENT_ARGUMENT_REMAINING, pgmoneta_value_from_double(snapshot.remaining), ValueDouble);
+   }
+
+   *progress = js;
+
+   return 0;
+
+error:
+
+   pgmoneta_json_destroy(js);
+
+   return 1;
+}
+
+static struct progress*
+progress_get(void)
+{
+   if (current != NULL)
+   {
+      return current;
+   }
+
+   return atomic_load(&shared);
+}
@@ -28,42 +28,163 @@
 
 /* pgmoneta */
 #include <pgmoneta.h>
+#include <gzip_compression.h>
 #include <info.h>
 #include <logging.h>
+#include <memory.h>
 #include <network.h>
+#include <progress.h>
 #include <prometheus.h>
 #include <security.h>
 #include <shmem.h>
 #include <utils.h>
 #include <wal.h>
+#include <workers.h>
 
 /* system */
 #include <ev.h>
+#include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 
 #define CHUNK_SIZE 32768
 
+#define FRAGMENT_MAGIC   0x5452464D4D47504DULL /* MPGMMFRT */
+#define FRAGMENT_VERSION 2
+
 #define PAGE_UNKNOWN 0
 #define PAGE_HOME    1
 #define PAGE_METRICS 2
 #define BAD_REQUEST  3
 
+#define METRICS_KEEP_ALIVE_TIMEOUT 30
+#define METRICS_KEEP_ALIVE_MAX     100
+#define METRICS_GZIP_SIZE          1024
+
+static char* workflow_type_names[NUMBER_OF_WORKFLOW_TYPES] = {
+   "backup", "restore", "archive", "delete_backup", "retention", "wal_shipping",
+   "verify", "incremental_backup", "combine", "combine_as_is", "post_rollup"
+};
+
+static char* copy_method_names[NUMBER_OF_COPY_METHODS] = {
+   "clone", "copy_file_range", "sendfile", "read_write", "hardlink", "io_uring"
+};
+
+static char* upload_engine_names[NUMBER_OF_UPLOAD_ENGINES] = {
+   "ssh", "s3", "azure"
+};
+
+static char* wal_phase_names[NUMBER_OF_WAL_PHASES] = {
+   "write", "sync", "close"
+};
+
+static char* file_operation_names[NUMBER_OF_FILE_OPERATIONS] = {
+   "compress", "decompress", "encrypt", "decrypt"
+};
+
+static char* restore_phase_names[NUMBER_OF_RESTORE_PHASES] = {
+   "restore", "combine", "copy_wal"
+};
+
+/* The upper bounds of the histogram buckets, the last bucket has none */
+static const uint64_t wal_bounds[PROMETHEUS_HISTOGRAM_BUCKETS - 1] = {
+   10, 100, 1000, 10000, 100000, 1000000, 10000000
+};
+
+static const uint64_t file_bounds[PROMETHEUS_HISTOGRAM_BUCKETS - 1] = {
+   1000, 10000, 100000, 1000000, 10000000, 60000000, 600000000
+};
+
+static const uint64_t restore_bounds[PROMETHEUS_HISTOGRAM_BUCKETS - 1] = {
+   1048576, 10485760, 52428800, 104857600, 262144000, 524288000, 1073741824
+};
+
+/** @struct metrics_client
+ * Defines a connection served by the metrics thread
+ */
+struct metrics_client
+{
+   struct ev_io io;             /**< The read watcher */
+   struct ev_timer idle;        /**< The idle timer */
+   SSL_CTX* ctx;                /**< The SSL context, or NULL */
+   SSL* ssl;                    /**< The SSL structure, or NULL */
+   int fd;                      /**< The descriptor */
+   int requests;                /**< The number of requests served */
+   bool accepted;               /**< Is the connection accepted */
+   struct metrics_client* next; /**< The next connection */
+};
+
+/* The metrics thread of the main process, and the connections handed to it */
+static pthread_t metrics_thread;
+static bool metrics_started = false;
+static bool metrics_stopping = false;
+static struct ev_loop* metrics_loop = NULL;
+static struct ev_async metrics_wakeup;
+static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct metrics_client* metrics_pending = NULL;
+static struct metrics_client* metrics_clients = NULL;
+
+/** @struct fragment_header
+ * Defines the header of the backup metrics of a server. The header is
+ * followed by length bytes of exposition text
+ */
+struct fragment_header
+{
+   uint64_t magic;      /**< The magic */
+   uint32_t version;    /**< The version */
+   uint32_t reserved;   /**< Reserved */
+   uint64_t generation; /**< The backup generation the metrics were built at */
+   int64_t mtime_sec;   /**< The modification time of the backup directory, seconds */
+   int64_t mtime_nsec;  /**< The modification time of the backup directory, nanoseconds */
+   uint64_t length;     /**< The length of the text */
+};
+
 static int resolve_page(struct message* msg);
 static int unknown_page(SSL* client_ssl, int client_fd);
 static int home_page(SSL* client_ssl, int client_fd);
-static int metrics_page(SSL* client_ssl, int client_fd);
+static int metrics_page(SSL* client_ssl, int client_fd, bool keep_alive, bool gzip);
+static int metrics_response(SSL* client_ssl, int client_fd, char* body, bool keep_alive, bool gzip);
 static int bad_request(SSL* client_ssl, int client_fd);
 static int redirect_page(SSL* client_ssl, int client_fd, char* path);
-static void general_information(SSL* client_ssl, int client_fd);
-static void backup_information(SSL* client_ssl, int client_fd);
-static void size_information(SSL* client_ssl, int client_fd);
+static void general_information(struct builder* body);
+static void backup_metrics(struct builder* body);
+static int backup_fragment(int server, char** fragment);
+static char* backup_fragment_path(int server);
+static void backup_information(int first, int last, char** fragment);
+static void backup_size_information(int first, int last, char** fragment);
+static void size_information(struct builder* body);
+static void workers_information(struct builder* body);
+static void workers_histogram(struct builder* data, char* name, int type, atomic_ulong* histogram, unsigned long sum);
+static void histogram_information(struct builder* body);
+static void wal_ingest_information(struct builder* body);
+static void socket_information(struct builder* body);
+static void progress_information(struct builder* body);
+static void progress_gauge(struct builder* data, char* name, char* help, struct progress_snapshot* snapshots, bool* active, int field);
+static void histogram_append(struct builder* data, char* name, char* labels, struct prometheus_histogram* histogram, const uint64_t* bounds, double scale, int precision);
+static void histogram_observe(struct prometheus_histogram* histogram, const uint64_t* bounds, uint64_t value);
+static void histogram_reset(struct prometheus_histogram* histogram);
 
 static int send_chunk(SSL* client_ssl, int client_fd, char* data);
 
+static int tls_accept(SSL* client_ssl, int client_fd);
+static void serve_request(SSL* client_ssl, int client_fd, struct message* msg, bool persistent, bool* keep_alive);
+static void request_options(struct message* msg, bool* keep_alive, bool* gzip);
+static void* metrics_run(void* arg);
+static void metrics_wakeup_cb(struct ev_loop* loop, struct ev_async* w, int revents);
+static void metrics_client_cb(struct ev_loop* loop, struct ev_io* w, int revents);
+static void metrics_idle_cb(struct ev_loop* loop, struct ev_timer* w, int revents);
+static void metrics_client_close(struct ev_loop* loop, struct metrics_client* c);
+
 static bool is_metrics_cache_configured(void);
 static bool is_metrics_cache_valid(void);
 static bool metrics_cache_append(char* data);
@@ -75,7 +196,7 @@ void
 pgmoneta_prometheus(SSL* client_ssl, int client_fd)
 {
    int status;
-   int page;
+   bool keep_alive = false;
    struct message* msg = NULL;
    struct main_configuration* config;
 
@@ -84,106 +205,134 @@ pgmoneta_prometheus(SSL* client_ssl, int client_fd)
 
    config = (struct main_configuration*)shmem;
 
-   if (client_ssl)
+   if (client_ssl && tls_accept(client_ssl, client_fd))
    {
-      char buffer[5] = {0};
+      goto error;
+   }
 
-      recv(client_fd, buffer, 5, MSG_PEEK);
+   status = pgmoneta_read_timeout_message(client_ssl, client_fd, config->authentication_timeout, &msg);
 
-      if ((unsigned char)buffer[0] == 0x16 || (unsigned char)buffer[0] == 0x80) // SSL/TLS request
-      {
-         if (SSL_accept(client_ssl) <= 0)
-         {
-            pgmoneta_log_error("Failed to accept SSL connection");
-            goto error;
-         }
-      }
-      else
-      {
-         char* path = "/";
-         char* base_url = NULL;
+   if (status != MESSAGE_STATUS_OK)
+   {
+      goto error;
+   }
 
-         if (pgmoneta_read_timeout_message(NULL, client_fd, config->authentication_timeout, &msg) != MESSAGE_STATUS_OK)
-         {
-            pgmoneta_log_error("Failed to read message");
-            goto error;
-         }
+   /* A forked process serves a single request */
+   serve_request(client_ssl, client_fd, msg, false, &keep_alive);
 
-         char* path_start = strstr(msg->data, " ");
-         if (path_start)
-         {
-            path_start++;
-            char* path_end = strstr(path_start, " ");
-            if (path_end)
-            {
-               *path_end = '\0';
-               path = path_start;
-            }
-         }
+   pgmoneta_close_ssl(client_ssl);
+   pgmoneta_disconnect(client_fd);
 
-         base_url = pgmoneta_format_and_append(base_url, "https://localhost:%d%s", config->metrics, path);
+   pgmoneta_memory_destroy();
+   pgmoneta_stop_logging();
 
-         if (redirect_page(NULL, client_fd, base_url) != MESSAGE_STATUS_OK)
-         {
-            pgmoneta_log_error("Failed to redirect to: %s", base_url);
-            free(base_url);
-            goto error;
-         }
+   exit(0);
+
+error:
 
-         pgmoneta_close_ssl(client_ssl);
-         pgmoneta_disconnect(client_fd);
+   pgmoneta_close_ssl(client_ssl);
+   pgmoneta_disconnect(client_fd);
 
-         pgmoneta_memory_destroy();
-         pgmoneta_stop_logging();
+   pgmoneta_memory_destroy();
+   pgmoneta_stop_logging();
 
-         free(base_url);
+   exit(1);
+}
 
-         exit(0);
-      }
+int
+pgmoneta_prometheus_start(void)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (metrics_started)
+   {
+      return 0;
    }
-   status = pgmoneta_read_timeout_message(client_ssl, client_fd, config->authentication_timeout, &msg);
 
-   if (status != MESSAGE_STATUS_OK)
+   metrics_loop = ev_loop_new(pgmoneta_libev(config->libev));
+   if (metrics_loop == NULL)
    {
+      pgmoneta_log_error("Prometheus: No loop implementation (%x) (%x)", pgmoneta_libev(config->libev), ev_supported_backends());
       goto error;
    }
 
-   page = resolve_page(msg);
+   metrics_stopping = false;
+   ev_async_init(&metrics_wakeup, metrics_wakeup_cb);
+   ev_async_start(metrics_loop, &metrics_wakeup);
 
-   if (page == PAGE_HOME)
+   if (pthread_create(&metrics_thread, NULL, metrics_run, NULL))
    {
-      home_page(client_ssl, client_fd);
+      pgmoneta_log_error("Prometheus: Cannot create the metrics thread");
+      goto error;
    }
-   else if (page == PAGE_METRICS)
+
+   metrics_started = true;
+
+   return 0;
+
+error:
+
+   if (metrics_loop != NULL)
    {
-      metrics_page(client_ssl, client_fd);
+      ev_async_stop(metrics_loop, &metrics_wakeup);
+      ev_loop_destroy(metrics_loop);
+      metrics_loop = NULL;
    }
-   else if (page == PAGE_UNKNOWN)
+
+   return 1;
+}
+
+int
+pgmoneta_prometheus_submit(int client_fd)
+{
+   struct metrics_client* c = NULL;
+
+   if (!metrics_started)
    {
-      unknown_page(client_ssl, client_fd);
+      return 1;
    }
-   else
+
+   c = (struct metrics_client*)calloc(1, sizeof(struct metrics_client));
+   if (c == NULL)
    {
-      bad_request(client_ssl, client_fd);
+      return 1;
    }
 
-   pgmoneta_close_ssl(client_ssl);
-   pgmoneta_disconnect(client_fd);
+   c->fd = client_fd;
 
-   pgmoneta_memory_destroy();
-   pgmoneta_stop_logging();
+   pthread_mutex_lock(&metrics_lock);
+   c->next = metrics_pending;
+   metrics_pending = c;
+   pthread_mutex_unlock(&metrics_lock);
 
-   exit(0);
+   ev_async_send(metrics_loop, &metrics_wakeup);
 
-error:
+   return 0;
+}
 
-   pgmoneta_close_ssl(client_ssl);
-   pgmoneta_disconnect(client_fd);
+void
+pgmoneta_prometheus_stop(void)
+{
+   if (!metrics_started)
+   {
+      return;
+   }
 
-   pgmoneta_memory_destroy();
-   pgmoneta_stop_logging();
+   pthread_mutex_lock(&metrics_lock);
+   metrics_stopping = true;
+   pthread_mutex_unlock(&metrics_lock);
 
-   exit(1);
+   ev_async_send(metrics_loop, &metrics_wakeup);
+
+   pthread_join(metrics_thread, NULL);
+
+   ev_async_stop(metrics_loop, &metrics_wakeup);
+   ev_loop_destroy(metrics_loop);
+   metrics_loop = NULL;
+
+   metrics_started = false;
 }
 
 void
@@ -207,6 +356,65 @@ retry_cache_locking:
       atomic_store(&config->common.prometheus.logging_error, 0);
       atomic_store(&config->common.prometheus.logging_fatal, 0);
 
+      for (int i = 0; i < NUMBER_OF_COPY_METHODS; i++)
+      {
+         atomic_store(&config->common.prometheus.copy_files[i], 0);
+         atomic_store(&config->common.prometheus.copy_bytes[i], 0);
+      }
+
+      for (int i = 0; i < NUMBER_OF_UPLOAD_ENGINES; i++)
+      {
+         atomic_store(&config->common.prometheus.upload_bytes[i], 0);
+         atomic_store(&config->common.prometheus.upload_time[i], 0);
+      }
+
+      atomic_store(&config->common.prometheus.wal_cache_hits, 0);
+      atomic_store(&config->common.prometheus.wal_cache_misses, 0);
+
+      for (int i = 0; i < NUMBER_OF_WORKFLOW_TYPES; i++)
+      {
+         atomic_store(&config->common.prometheus.memory_peak_bytes[i], 0);
+         atomic_store(&config->common.prometheus.memory_budget_exceeded[i], 0);
+      }
+
+      for (int i = 0; i < NUMBER_OF_WORKFLOW_TYPES; i++)
+      {
+         struct workers_statistics* ws = &config->common.prometheus.workers[i];
+
+         atomic_store(&ws->tasks, 0);
+         atomic_store(&ws->bytes, 0);
+         atomic_store(&ws->wait, 0);
+         atomic_store(&ws->execute, 0);
+         atomic_store(&ws->busy, 0);
+         atomic_store(&ws->available, 0);
+
+         for (int j = 0; j < WORKERS_HISTOGRAM_BUCKETS; j++)
+         {
+            atomic_store(&ws->wait_histogram[j], 0);
+            atomic_store(&ws->execute_histogram[j], 0);
+         }
+      }
+
+      for (int i = 0; i < NUMBER_OF_SERVERS; i++)
+      {
+         for (int j = 0; j < NUMBER_OF_WAL_PHASES; j++)
+         {
+            histogram_reset(&config->common.prometheus.wal[i][j]);
+         }
+
+         atomic_store(&config->common.prometheus.wal_ingest[i].received_bytes, 0);
+      }
+
+      for (int i = 0; i < NUMBER_OF_FILE_OPERATIONS; i++)
+      {
+         histogram_reset(&config->common.prometheus.file[i]);
+      }
+
+      for (int i = 0; i < NUMBER_OF_RESTORE_PHASES; i++)
+      {
+         histogram_reset(&config->common.prometheus.restore[i]);
+      }
+
       atomic_store(&cache->lock, STATE_FREE);
    }
    else
@@ -242,127 +450,412 @@ pgmoneta_prometheus_logging(int type)
    }
 }
 
-static int
-resolve_page(struct message* msg)
+void
+pgmoneta_prometheus_copy(int method, size_t bytes)
 {
-   char* from = NULL;
-   int index;
+   struct main_configuration* config;
 
-   if (msg->length < 3 || strncmp((char*)msg->data, "GET", 3) != 0)
+   config = (struct main_configuration*)shmem;
+
+   if (config == NULL || method < 0 || method >= NUMBER_OF_COPY_METHODS)
    {
-      pgmoneta_log_debug("Promethus: Not a GET request");
-      return BAD_REQUEST;
+      return;
    }
 
-   index = 4;
-   from = (char*)msg->data + index;
+   atomic_fetch_add(&config->common.prometheus.copy_files[method], 1);
+   atomic_fetch_add(&config->common.prometheus.copy_bytes[method], bytes);
+}
 
-   while (pgmoneta_read_byte(msg->data + index) != ' ')
-   {
-      index++;
-   }
+void
+pgmoneta_prometheus_upload(int engine, uint64_t bytes, double seconds)
+{
+   struct main_configuration* config;
 
-   pgmoneta_write_byte(msg->data + index, '\0');
+   config = (struct main_configuration*)shmem;
 
-   if (strcmp(from, "/") == 0 || strcmp(from, "/index.html") == 0)
+   if (config == NULL || engine < 0 || engine >= NUMBER_OF_UPLOAD_ENGINES)
    {
-      return PAGE_HOME;
-   }
-   else if (strcmp(from, "/metrics") == 0)
-   {
-      return PAGE_METRICS;
+      return;
    }
 
-   return PAGE_UNKNOWN;
+   atomic_fetch_add(&config->common.prometheus.upload_bytes[engine], bytes);
+   atomic_fetch_add(&config->common.prometheus.upload_time[engine], (unsigned long)(seconds * 1000.0));
 }
 
-static int
-redirect_page(SSL* client_ssl, int client_fd, char* path)
+void
+pgmoneta_prometheus_workers(int type, struct workers_statistics* statistics)
 {
-   char* data = NULL;
-   time_t now;
-   char time_buf[32];
-   int status;
-   struct message msg;
+   struct workers_statistics* ws = NULL;
+   struct main_configuration* config;
 
-   memset(&msg, 0, sizeof(struct message));
-   memset(&data, 0, sizeof(data));
+   config = (struct main_configuration*)shmem;
 
-   now = time(NULL);
+   if (type < 0 || type >= NUMBER_OF_WORKFLOW_TYPES || statistics == NULL)
+   {
+      return;
+   }
 
-   memset(&time_buf, 0, sizeof(time_buf));
-   ctime_r(&now, &time_buf[0]);
-   time_buf[strlen(time_buf) - 1] = 0;
+   ws = &config->common.prometheus.workers[type];
 
-   data = pgmoneta_append(data, "HTTP/1.1 301 Moved Permanently\r\n");
-   data = pgmoneta_append(data, "Location: ");
-   data = pgmoneta_append(data, path);
-   data = pgmoneta_append(data, "\r\n");
-   data = pgmoneta_append(data, "Date: ");
-   data = pgmoneta_append(data, &time_buf[0]);
-   data = pgmoneta_append(data, "\r\n");
-   data = pgmoneta_append(data, "Content-Length: 0\r\n");
-   data = pgmoneta_append(data, "Connection: close\r\n");
-   data = pgmoneta_append(data, "\r\n");
+   atomic_fetch_add(&ws->tasks, atomic_load(&statistics->tasks));
+   atomic_fetch_add(&ws->bytes, atomic_load(&statistics->bytes));
+   atomic_fetch_add(&ws->wait, atomic_load(&statistics->wait));
+   atomic_fetch_add(&ws->execute, atomic_load(&statistics->execute));
+   atomic_fetch_add(&ws->busy, atomic_load(&statistics->busy));
+   atomic_fetch_add(&ws->available, atomic_load(&statistics->available));
 
-   msg.kind = 0;
-   msg.length = strlen(data);
-   msg.data = data;
+   for (int i = 0; i < WORKERS_HISTOGRAM_BUCKETS; i++)
+   {
+      atomic_fetch_add(&ws->wait_histogram[i], atomic_load(&statistics->wait_histogram[i]));
+      atomic_fetch_add(&ws->execute_histogram[i], atomic_load(&statistics->execute_histogram[i]));
+   }
+}
 
-   status = pgmoneta_write_message(client_ssl, client_fd, &msg);
+uint64_t
+pgmoneta_prometheus_now(void)
+{
+   struct timespec ts;
 
-   free(data);
+   clock_gettime(CLOCK_MONOTONIC, &ts);
 
-   return status;
+   return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
 }
 
-static int
-unknown_page(SSL* client_ssl, int client_fd)
+void
+pgmoneta_prometheus_wal(int server, int phase, uint64_t start)
 {
-   char* data = NULL;
-   time_t now;
-   char time_buf[32];
-   int status;
-   struct message msg;
+   struct main_configuration* config;
 
-   memset(&msg, 0, sizeof(struct message));
-   memset(&data, 0, sizeof(data));
+   config = (struct main_configuration*)shmem;
 
-   now = time(NULL);
+   if (config == NULL || server < 0 || server >= NUMBER_OF_SERVERS || phase < 0 || phase >= NUMBER_OF_WAL_PHASES)
+   {
+      return;
+   }
 
-   memset(&time_buf, 0, sizeof(time_buf));
-   ctime_r(&now, &time_buf[0]);
-   time_buf[strlen(time_buf) - 1] = 0;
+   histogram_observe(&config->common.prometheus.wal[server][phase], wal_bounds, pgmoneta_prometheus_now() - start);
+}
 
-   data = pgmoneta_append(data, "HTTP/1.1 403 Forbidden\r\n");
-   data = pgmoneta_append(data, "Date: ");
-   data = pgmoneta_append(data, &time_buf[0]);
-   data = pgmoneta_append(data, "\r\n");
+void
+pgmoneta_prometheus_wal_received(int server, uint64_t lsn, uint64_t bytes, uint64_t received)
+{
+   uint64_t now;
+   uint64_t window;
+   struct prometheus_wal_ingest* ingest;
+   struct main_configuration* config;
 
-   msg.kind = 0;
-   msg.length = strlen(data);
-   msg.data = data;
+   config = (struct main_configuration*)shmem;
 
-   status = pgmoneta_write_message(client_ssl, client_fd, &msg);
+   if (config == NULL || server < 0 || server >= NUMBER_OF_SERVERS)
+   {
+      return;
+   }
 
-   free(data);
+   ingest = &config->common.prometheus.wal_ingest[server];
+   now = pgmoneta_prometheus_now();
 
-   return status;
-}
+   atomic_store(&ingest->received_lsn, lsn);
+   atomic_fetch_add(&ingest->received_bytes, bytes);
+   atomic_store(&ingest->write_lag, now - received);
 
-static int
-home_page(SSL* client_ssl, int client_fd)
-{
-   char* data = NULL;
-   time_t now;
-   char time_buf[32];
-   int status;
-   struct message msg;
+   if (atomic_load(&ingest->window_start) == 0)
+   {
+      atomic_store(&ingest->window_start, now);
+   }
 
-   memset(&msg, 0, sizeof(struct message));
-   memset(&data, 0, sizeof(data));
+   /* Publish the rate once a second, so a single large message doesn't dominate */
+   window = now - atomic_load(&ingest->window_start);
+   atomic_fetch_add(&ingest->window_bytes, bytes);
 
-   now = time(NULL);
+   if (window >= 1000000)
+   {
+      atomic_store(&ingest->throughput, atomic_load(&ingest->window_bytes) * 1000000 / window);
+      atomic_store(&ingest->window_bytes, 0);
+      atomic_store(&ingest->window_start, now);
+   }
+}
+
+void
+pgmoneta_prometheus_wal_flushed(int server, uint64_t lsn, uint64_t received)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (config == NULL || server < 0 || server >= NUMBER_OF_SERVERS)
+   {
+      return;
+   }
+
+   atomic_store(&config->common.prometheus.wal_ingest[server].flushed_lsn, lsn);
+   atomic_store(&config->common.prometheus.wal_ingest[server].flush_lag, pgmoneta_prometheus_now() - received);
+}
+
+void
+pgmoneta_prometheus_wal_reported(int server, uint64_t lsn)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (config == NULL || server < 0 || server >= NUMBER_OF_SERVERS)
+   {
+      return;
+   }
+
+   atomic_store(&config->common.prometheus.wal_ingest[server].reported_lsn, lsn);
+}
+
+void
+pgmoneta_prometheus_socket(int server, int type, int fd)
+{
+#ifdef HAVE_LINUX
+   struct tcp_info info;
+   socklen_t length = sizeof(info);
+   struct prometheus_socket* s;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (config == NULL || server < 0 || server >= NUMBER_OF_SERVERS || type < 0 || type >= NUMBER_OF_SOCKET_TYPES || fd < 0)
+   {
+      return;
+   }
+
+   memset(&info, 0, sizeof(info));
+   if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &length) == -1)
+   {
+      errno = 0;
+      return;
+   }
+
+   s = &config->common.prometheus.socket[server][type];
+
+   atomic_store(&s->rtt, info.tcpi_rtt);
+   atomic_store(&s->rtt_variance, info.tcpi_rttvar);
+   atomic_store(&s->congestion_window, (uint64_t)info.tcpi_snd_cwnd * info.tcpi_snd_mss);
+   atomic_store(&s->receive_window, info.tcpi_rcv_space);
+   atomic_store(&s->retransmits, info.tcpi_total_retrans);
+#else
+   (void)server;
+   (void)type;
+   (void)fd;
+#endif
+}
+
+void
+pgmoneta_prometheus_file(int operation, uint64_t start)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (config == NULL || operation < 0 || operation >= NUMBER_OF_FILE_OPERATIONS)
+   {
+      return;
+   }
+
+   histogram_observe(&config->common.prometheus.file[operation], file_bounds, pgmoneta_prometheus_now() - start);
+}
+
+void
+pgmoneta_prometheus_restore(int phase, uint64_t bytes, double seconds)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (config == NULL || phase < 0 || phase >= NUMBER_OF_RESTORE_PHASES || bytes == 0)
+   {
+      return;
+   }
+
+   /* A phase faster than the clock resolution counts as one millisecond */
+   if (seconds < 0.001)
+   {
+      seconds = 0.001;
+   }
+
+   histogram_observe(&config->common.prometheus.restore[phase], restore_bounds, (uint64_t)((double)bytes / seconds));
+}
+
+void
+pgmoneta_prometheus_wal_cache(bool hit)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (config == NULL)
+   {
+      return;
+   }
+
+   if (hit)
+   {
+      atomic_fetch_add(&config->common.prometheus.wal_cache_hits, 1);
+   }
+   else
+   {
+      atomic_fetch_add(&config->common.prometheus.wal_cache_misses, 1);
+   }
+}
+
+void
+pgmoneta_prometheus_memory(int type, long delta, long used, bool exceeded)
+{
+   unsigned long peak;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (config == NULL || type < 0 || type >= NUMBER_OF_WORKFLOW_TYPES)
+   {
+      return;
+   }
+
+   if (delta >= 0)
+   {
+      atomic_fetch_add(&config->common.prometheus.memory_bytes[type], (unsigned long)delta);
+   }
+   else
+   {
+      atomic_fetch_sub(&config->common.prometheus.memory_bytes[type], (unsigned long)-delta);
+   }
+
+   peak = atomic_load(&config->common.prometheus.memory_peak_bytes[type]);
+   while (used > 0 && (unsigned long)used > peak &&
+          !atomic_compare_exchange_weak(&config->common.prometheus.memory_peak_bytes[type], &peak, (unsigned long)used))
+   {
+   }
+
+   if (exceeded)
+   {
+      atomic_fetch_add(&config->common.prometheus.memory_budget_exceeded[type], 1);
+   }
+}
+
+static int
+resolve_page(struct message* msg)
+{
+   char* from = NULL;
+   int index;
+
+   if (msg->length < 3 || strncmp((char*)msg->data, "GET", 3) != 0)
+   {
+      pgmoneta_log_debug("Promethus: Not a GET request");
+      return BAD_REQUEST;
+   }
+
+   index = 4;
+   from = (char*)msg->data + index;
+
+   while (pgmoneta_read_byte(msg->data + index) != ' ')
+   {
+      index++;
+   }
+
+   pgmoneta_write_byte(msg->data + index, '\0');
+
+   if (strcmp(from, "/") == 0 || strcmp(from, "/index.html") == 0)
+   {
+      return PAGE_HOME;
+   }
+   else if (strcmp(from, "/metrics") == 0)
+   {
+      return PAGE_METRICS;
+   }
+
+   return PAGE_UNKNOWN;
+}
+
+static int
+redirect_page(SSL* client_ssl, int client_fd, char* path)
+{
+   char* data = NULL;
+   time_t now;
+   char time_buf[32];
+   int status;
+   struct message msg;
+
+   memset(&msg, 0, sizeof(struct message));
+   memset(&data, 0, sizeof(data));
+
+   now = time(NULL);
+
+   memset(&time_buf, 0, sizeof(time_buf));
+   ctime_r(&now, &time_buf[0]);
+   time_buf[strlen(time_buf) - 1] = 0;
+
+   data = pgmoneta_append(data, "HTTP/1.1 301 Moved Permanently\r\n");
+   data = pgmoneta_append(data, "Location: ");
+   data = pgmoneta_append(data, path);
+   data = pgmoneta_append(data, "\r\n");
+   data = pgmoneta_append(data, "Date: ");
+   data = pgmoneta_append(data, &time_buf[0]);
+   data = pgmoneta_append(data, "\r\n");
+   data = pgmoneta_append(data, "Content-Length: 0\r\n");
+   data = pgmoneta_append(data, "Connection: close\r\n");
+   data = pgmoneta_append(data, "\r\n");
+
+   msg.kind = 0;
+   msg.length = strlen(data);
+   msg.data = data;
+
+   status = pgmoneta_write_message(client_ssl, client_fd, &msg);
+
+   free(data);
+
+   return status;
+}
+
+static int
+unknown_page(SSL* client_ssl, int client_fd)
+{
+   char* data = NULL;
+   time_t now;
+   char time_buf[32];
+   int status;
+   struct message msg;
+
+   memset(&msg, 0, sizeof(struct message));
+   memset(&data, 0, sizeof(data));
+
+   now = time(NULL);
+
+   memset(&time_buf, 0, sizeof(time_buf));
+   ctime_r(&now, &time_buf[0]);
+   time_buf[strlen(time_buf) - 1] = 0;
+
+   data = pgmoneta_append(data, "HTTP/1.1 403 Forbidden\r\n");
+   data = pgmoneta_append(data, "Date: ");
+   data = pgmoneta_append(data, &time_buf[0]);
+   data = pgmoneta_append(data, "\r\n");
+
+   msg.kind = 0;
+   msg.length = strlen(data);
+   msg.data = data;
+
+   status = pgmoneta_write_message(client_ssl, client_fd, &msg);
+
+   free(data);
+
+   return status;
+}
+
+static int
+home_page(SSL* client_ssl, int client_fd)
+{
+   char* data = NULL;
+   time_t now;
+   char time_buf[32];
+   int status;
+   struct message msg;
+
+   memset(&msg, 0, sizeof(struct message));
+   memset(&data, 0, sizeof(data));
+
+   now = time(NULL);
 
    memset(&time_buf, 0, sizeof(time_buf));
    ctime_r(&now, &time_buf[0]);
@@ -483,6 +976,57 @@ home_page(SSL* client_ssl, int client_fd)
    data = pgmoneta_append(data, "  <h2>pgmoneta_server_last_failed_operation_time</h2>\n");
    data = pgmoneta_append(data, "  The time of the latest failed client operation of a server \n");
    data = pgmoneta_append(data, "  <p>\n");
+   data = pgmoneta_append(data, "  <h2>pgmoneta_server_backup_write_queue</h2>\n");
+   data = pgmoneta_append(data, "  The number of chunks queued for the backup writer of a server\n");
+   data = pgmoneta_append(data, "  <p>\n");
+   data = pgmoneta_append(data, "  <h2>pgmoneta_server_backup_write_queue_waits</h2>\n");
+   data = pgmoneta_append(data, "  The number of times the backup receiver of a server waited for the writer\n");
+   data = pgmoneta_append(data, "  <p>\n");
+   data = pgmoneta_append(data, "  <h2>pgmoneta_server_compression_level</h2>\n");
+   data = pgmoneta_append(data, "  The compression level of the running backup of a server\n");
+   data = pgmoneta_append(data, "  <p>\n");
+   data = pgmoneta_append(data, "  <h2>pgmoneta_workers_tasks</h2>\n");
+   data = pgmoneta_append(data, "  The number of worker tasks of a workflow type\n");
+   data = pgmoneta_append(data, "  <p>\n");
+   data = pgmoneta_append(data, "  <h2>pgmoneta_workers_bytes</h2>\n");
+   data = pgmoneta_append(data, "  The number of bytes processed by the worker tasks of a workflow type\n");
+   data = pgmoneta_append(data, "  <p>\n");
+   data = pgmoneta_append(data, "  <h2>pgmoneta_workers_busy_ratio</h2>\n");
+   data = pgmoneta_append(data, "  The fraction of the time the workers of a workflow type were running a task\n");
+   data = pgmoneta_append(data, "  <p>\n");
+   data = pgmoneta_append(data, "  <h2>pgmoneta_workers_task_wait_seconds</h2>\n");
+   data = pgmoneta_append(data, "  The time worker tasks of a workflow type were queued\n");
+   data = pgmoneta_append(data, "  <p>\n");
+   data = pgmoneta_append(data, "  <h2>pgmoneta_workers_task_execute_seconds</h2>\n");
+   data = pgmoneta_append(data, "  The time worker tasks of a workflow type were running\n");
+   data = pgmoneta_append(data, "  <p>\n");
+   data = pgmoneta_append(data, "  <h2>pgmoneta_copy_files</h2>\n");
+   data = pgmoneta_append(data, "  The number of files copied with a copy method\n");
+   data = pgmoneta_append(data, "  <p>\n");
+   data = pgmoneta_append(data, "  <h2>pgmoneta_copy_bytes</h2>\n");
+   data = pgmoneta_append(data, "  The number of bytes copied with a copy method\n");
+   data = pgmoneta_append(data, "  <p>\n");
+   data = pgmoneta_append(data, "  <h2>pgmoneta_upload_bytes</h2>\n");
+   data = pgmoneta_append(data, "  The number of bytes uploaded by a storage engine\n");
+   data = pgmoneta_append(data, "  <p>\n");
+   data = pgmoneta_append(data, "  <h2>pgmoneta_upload_seconds</h2>\n");
+   data = pgmoneta_append(data, "  The time a storage engine spent uploading\n");
+   data = pgmoneta_append(data, "  <p>\n");
+   data = pgmoneta_append(data, "  <h2>pgmoneta_wal_cache_hits</h2>\n");
+   data = pgmoneta_append(data, "  The number of WAL segments taken from the WAL cache\n");
+   data = pgmoneta_append(data, "  <p>\n");
+   data = pgmoneta_append(data, "  <h2>pgmoneta_wal_cache_misses</h2>\n");
+   data = pgmoneta_append(data, "  The number of WAL segments decoded since they were not in the WAL cache\n");
+   data = pgmoneta_append(data, "  <p>\n");
+   data = pgmoneta_append(data, "  <h2>pgmoneta_memory_bytes</h2>\n");
+   data = pgmoneta_append(data, "  The memory held by the running workflows of a workflow type\n");
+   data = pgmoneta_append(data, "  <p>\n");
+   data = pgmoneta_append(data, "  <h2>pgmoneta_memory_peak_bytes</h2>\n");
+   data = pgmoneta_append(data, "  The most memory held by a workflow of a workflow type\n");
+   data = pgmoneta_append(data, "  <p>\n");
+   data = pgmoneta_append(data, "  <h2>pgmoneta_memory_budget_exceeded</h2>\n");
+   data = pgmoneta_append(data, "  The number of times a workflow of a workflow type went above the memory budget\n");
+   data = pgmoneta_append(data, "  <p>\n");
    data = pgmoneta_append(data, "  <h2>pgmoneta_wal_shipping</h2>\n");
    data = pgmoneta_append(data, "  The disk space used for WAL shipping for a server\n");
    data = pgmoneta_append(data, "  <p>\n");
@@ -591,8 +1135,8 @@ home_page(SSL* client_ssl, int client_fd)
    data = pgmoneta_append(data, "    </tbody>\n");
    data = pgmoneta_append(data, "  </table>\n");
    data = pgmoneta_append(data, "  <p>\n");
-   data = pgmoneta_append(data, "  <h2>pgmoneta_backup_oldest</h2>\n");
-   data = pgmoneta_append(data, "  The oldest backup for a server\n");
+   data = pgmoneta_append(data, "  <h2>pgmoneta_scrub_bytes</h2>\n");
+   data = pgmoneta_append(data, "  The number of bytes read by the scrubber for a server\n");
    data = pgmoneta_append(data, "  <table border=\"1\">\n");
    data = pgmoneta_append(data, "    <tbody>\n");
    data = pgmoneta_append(data, "      <tr>\n");
@@ -602,8 +1146,8 @@ home_page(SSL* client_ssl, int client_fd)
    data = pgmoneta_append(data, "    </tbody>\n");
    data = pgmoneta_append(data, "  </table>\n");
    data = pgmoneta_append(data, "  <p>\n");
-   data = pgmoneta_append(data, "  <h2>pgmoneta_backup_newest</h2>\n");
-   data = pgmoneta_append(data, "  The newest backup for a server\n");
+   data = pgmoneta_append(data, "  <h2>pgmoneta_scrub_wal_failed</h2>\n");
+   data = pgmoneta_append(data, "  The number of WAL files that failed the current scrub pass of a server\n");
    data = pgmoneta_append(data, "  <table border=\"1\">\n");
    data = pgmoneta_append(data, "    <tbody>\n");
    data = pgmoneta_append(data, "      <tr>\n");
@@ -613,8 +1157,8 @@ home_page(SSL* client_ssl, int client_fd)
    data = pgmoneta_append(data, "    </tbody>\n");
    data = pgmoneta_append(data, "  </table>\n");
    data = pgmoneta_append(data, "  <p>\n");
-   data = pgmoneta_append(data, "  <h2>pgmoneta_backup_count</h2>\n");
-   data = pgmoneta_append(data, "  The number of valid backups for a server\n");
+   data = pgmoneta_append(data, "  <h2>pgmoneta_backup_oldest</h2>\n");
+   data = pgmoneta_append(data, "  The oldest backup for a server\n");
    data = pgmoneta_append(data, "  <table border=\"1\">\n");
    data = pgmoneta_append(data, "    <tbody>\n");
    data = pgmoneta_append(data, "      <tr>\n");
@@ -624,22 +1168,44 @@ home_page(SSL* client_ssl, int client_fd)
    data = pgmoneta_append(data, "    </tbody>\n");
    data = pgmoneta_append(data, "  </table>\n");
    data = pgmoneta_append(data, "  <p>\n");
-   data = pgmoneta_append(data, "  <h2>pgmoneta_backup</h2>\n");
-   data = pgmoneta_append(data, "  Is the backup valid for a server\n");
+   data = pgmoneta_append(data, "  <h2>pgmoneta_backup_newest</h2>\n");
+   data = pgmoneta_append(data, "  The newest backup for a server\n");
    data = pgmoneta_append(data, "  <table border=\"1\">\n");
    data = pgmoneta_append(data, "    <tbody>\n");
    data = pgmoneta_append(data, "      <tr>\n");
    data = pgmoneta_append(data, "        <td>name</td>\n");
    data = pgmoneta_append(data, "        <td>The identifier for the server</td>\n");
    data = pgmoneta_append(data, "      </tr>\n");
-   data = pgmoneta_append(data, "      <tr>\n");
-   data = pgmoneta_append(data, "        <td>label</td>\n");
-   data = pgmoneta_append(data, "        <td>The backup label</td>\n");
-   data = pgmoneta_append(data, "      </tr>\n");
    data = pgmoneta_append(data, "    </tbody>\n");
    data = pgmoneta_append(data, "  </table>\n");
    data = pgmoneta_append(data, "  <p>\n");
-   data = pgmoneta_append(data, "  <h2>pgmoneta_backup_version</h2>\n");
+   data = pgmoneta_append(data, "  <h2>pgmoneta_backup_count</h2>\n");
+   data = pgmoneta_append(data, "  The number of valid backups for a server\n");
+   data = pgmoneta_append(data, "  <table border=\"1\">\n");
+   data = pgmoneta_append(data, "    <tbody>\n");
+   data = pgmoneta_append(data, "      <tr>\n");
+   data = pgmoneta_append(data, "        <td>name</td>\n");
+   data = pgmoneta_append(data, "        <td>The identifier for the server</td>\n");
+   data = pgmoneta_append(data, "      </tr>\n");
+   data = pgmoneta_append(data, "    </tbody>\n");
+   data = pgmoneta_append(data, "  </table>\n");
+   data = pgmoneta_append(data, "  <p>\n");
+   data = pgmoneta_append(data, "  <h2>pgmoneta_backup</h2>\n");
+   data = pgmoneta_append(data, "  Is the backup valid for a server\n");
+   data = pgmoneta_append(data, "  <table border=\"1\">\n");
+   data = pgmoneta_append(data, "    <tbody>\n");
+   data = pgmoneta_append(data, "      <tr>\n");
+   data = pgmoneta_append(data, "        <td>name</td>\n");
+   data = pgmoneta_append(data, "        <td>The identifier for the server</td>\n");
+   data = pgmoneta_append(data, "      </tr>\n");
+   data = pgmoneta_append(data, "      <tr>\n");
+   data = pgmoneta_append(data, "        <td>label</td>\n");
+   data = pgmoneta_append(data, "        <td>The backup label</td>\n");
+   data = pgmoneta_append(data, "      </tr>\n");
+   data = pgmoneta_append(data, "    </tbody>\n");
+   data = pgmoneta_append(data, "  </table>\n");
+   data = pgmoneta_append(data, "  <p>\n");
+   data = pgmoneta_append(data, "  <h2>pgmoneta_backup_version</h2>\n");
    data = pgmoneta_append(data, "  The version of PostgreSQL for a backup\n");
    data = pgmoneta_append(data, "  <table border=\"1\">\n");
    data = pgmoneta_append(data, "    <tbody>\n");
@@ -1176,6 +1742,51 @@ home_page(SSL* client_ssl, int client_fd)
    data = pgmoneta_append(data, "    </tbody>\n");
    data = pgmoneta_append(data, "  </table>\n");
    data = pgmoneta_append(data, "  <p>\n");
+   data = pgmoneta_append(data, "  <h2>pgmoneta_backup_scrub_time</h2>\n");
+   data = pgmoneta_append(data, "  The time of the last scrub of a backup for a server\n");
+   data = pgmoneta_append(data, "  <table border=\"1\">\n");
+   data = pgmoneta_append(data, "    <tbody>\n");
+   data = pgmoneta_append(data, "      <tr>\n");
+   data = pgmoneta_append(data, "        <td>name</td>\n");
+   data = pgmoneta_append(data, "        <td>The identifier for the server</td>\n");
+   data = pgmoneta_append(data, "      </tr>\n");
+   data = pgmoneta_append(data, "      <tr>\n");
+   data = pgmoneta_append(data, "        <td>label</td>\n");
+   data = pgmoneta_append(data, "        <td>The backup label</td>\n");
+   data = pgmoneta_append(data, "      </tr>\n");
+   data = pgmoneta_append(data, "    </tbody>\n");
+   data = pgmoneta_append(data, "  </table>\n");
+   data = pgmoneta_append(data, "  <p>\n");
+   data = pgmoneta_append(data, "  <h2>pgmoneta_backup_scrub_failed</h2>\n");
+   data = pgmoneta_append(data, "  The number of files that failed the last scrub of a backup for a server\n");
+   data = pgmoneta_append(data, "  <table border=\"1\">\n");
+   data = pgmoneta_append(data, "    <tbody>\n");
+   data = pgmoneta_append(data, "      <tr>\n");
+   data = pgmoneta_append(data, "        <td>name</td>\n");
+   data = pgmoneta_append(data, "        <td>The identifier for the server</td>\n");
+   data = pgmoneta_append(data, "      </tr>\n");
+   data = pgmoneta_append(data, "      <tr>\n");
+   data = pgmoneta_append(data, "        <td>label</td>\n");
+   data = pgmoneta_append(data, "        <td>The backup label</td>\n");
+   data = pgmoneta_append(data, "      </tr>\n");
+   data = pgmoneta_append(data, "    </tbody>\n");
+   data = pgmoneta_append(data, "  </table>\n");
+   data = pgmoneta_append(data, "  <p>\n");
+   data = pgmoneta_append(data, "  <h2>pgmoneta_backup_checksum_failed</h2>\n");
+   data = pgmoneta_append(data, "  The number of pages that failed checksum verification during a backup for a server\n");
+   data = pgmoneta_append(data, "  <table border=\"1\">\n");
+   data = pgmoneta_append(data, "    <tbody>\n");
+   data = pgmoneta_append(data, "      <tr>\n");
+   data = pgmoneta_append(data, "        <td>name</td>\n");
+   data = pgmoneta_append(data, "        <td>The identifier for the server</td>\n");
+   data = pgmoneta_append(data, "      </tr>\n");
+   data = pgmoneta_append(data, "      <tr>\n");
+   data = pgmoneta_append(data, "        <td>label</td>\n");
+   data = pgmoneta_append(data, "        <td>The backup label</td>\n");
+   data = pgmoneta_append(data, "      </tr>\n");
+   data = pgmoneta_append(data, "    </tbody>\n");
+   data = pgmoneta_append(data, "  </table>\n");
+   data = pgmoneta_append(data, "  <p>\n");
    data = pgmoneta_append(data, "  <h2>pgmoneta_backup_total_size</h2>\n");
    data = pgmoneta_append(data, "  The total size of the backups for a server\n");
    data = pgmoneta_append(data, "  <table border=\"1\">\n");
@@ -1321,20 +1932,16 @@ done:
 }
 
 static int
-metrics_page(SSL* client_ssl, int client_fd)
+metrics_page(SSL* client_ssl, int client_fd, bool keep_alive, bool gzip)
 {
-   char* data = NULL;
-   time_t now;
-   char time_buf[32];
+   char* body = NULL;
    int status;
-   struct message msg;
+   struct builder data = {0};
    struct prometheus_cache* cache;
    signed char cache_is_free;
 
    cache = (struct prometheus_cache*)prometheus_cache_shmem;
 
-   memset(&msg, 0, sizeof(struct message));
-
 retry_cache_locking:
    cache_is_free = STATE_FREE;
    if (atomic_compare_exchange_strong(&cache->lock, &cache_is_free, STATE_IN_USE))
@@ -1348,56 +1955,29 @@ retry_cache_locking:
                             cache->size,
                             cache->valid_until);
 
-         msg.kind = 0;
-         msg.length = strlen(cache->data);
-         msg.data = cache->data;
+         body = pgmoneta_append(body, cache->data);
       }
       else
       {
          // build the message without the cache
          metrics_cache_invalidate();
 
-         now = time(NULL);
+         general_information(&data);
+         backup_metrics(&data);
+         size_information(&data);
+         workers_information(&data);
+         histogram_information(&data);
+         wal_ingest_information(&data);
+         socket_information(&data);
+         progress_information(&data);
 
-         memset(&time_buf, 0, sizeof(time_buf));
-         ctime_r(&now, &time_buf[0]);
-         time_buf[strlen(time_buf) - 1] = 0;
+         body = pgmoneta_append(body, pgmoneta_builder_string(&data));
+         pgmoneta_builder_destroy(&data);
 
-         data = pgmoneta_append(data, "HTTP/1.1 200 OK\r\n");
-         data = pgmoneta_append(data, "Content-Type: text/plain; version=0.0.1; charset=utf-8\r\n");
-         data = pgmoneta_append(data, "Date: ");
-         data = pgmoneta_append(data, &time_buf[0]);
-         data = pgmoneta_append(data, "\r\n");
-         data = pgmoneta_append(data, "Transfer-Encoding: chunked\r\n");
-         data = pgmoneta_append(data, "\r\n");
-         metrics_cache_append(data);
-
-         msg.kind = 0;
-         msg.length = strlen(data);
-         msg.data = data;
-
-         status = pgmoneta_write_message(client_ssl, client_fd, &msg);
-         if (status != MESSAGE_STATUS_OK)
+         if (metrics_cache_append(body))
          {
-            goto error;
+            metrics_cache_finalize();
          }
-
-         free(data);
-         data = NULL;
-
-         general_information(client_ssl, client_fd);
-         backup_information(client_ssl, client_fd);
-         size_information(client_ssl, client_fd);
-
-         /* Footer */
-         data = pgmoneta_append(data, "0\r\n\r\n");
-         metrics_cache_append(data);
-
-         msg.kind = 0;
-         msg.length = strlen(data);
-         msg.data = data;
-
-         metrics_cache_finalize();
       }
 
       // free the cache
@@ -1409,34 +1989,46 @@ retry_cache_locking:
       SLEEP_AND_GOTO(1000000L, retry_cache_locking)
    }
 
-   status = pgmoneta_write_message(client_ssl, client_fd, &msg);
+   if (body == NULL)
+   {
+      goto error;
+   }
+
+   status = metrics_response(client_ssl, client_fd, body, keep_alive, gzip);
    if (status != MESSAGE_STATUS_OK)
    {
       goto error;
    }
 
-   free(data);
+   free(body);
 
    return 0;
 
 error:
 
-   free(data);
+   free(body);
 
    return 1;
 }
 
 static int
-bad_request(SSL* client_ssl, int client_fd)
+metrics_response(SSL* client_ssl, int client_fd, char* body, bool keep_alive, bool gzip)
 {
    char* data = NULL;
+   unsigned char* compressed = NULL;
+   size_t compressed_size = 0;
    time_t now;
    char time_buf[32];
    int status;
    struct message msg;
 
    memset(&msg, 0, sizeof(struct message));
-   memset(&data, 0, sizeof(data));
+
+   /* Small bodies aren't worth the compression */
+   if (gzip && strlen(body) >= METRICS_GZIP_SIZE && pgmoneta_gzip_string(body, &compressed, &compressed_size))
+   {
+      compressed = NULL;
+   }
 
    now = time(NULL);
 
@@ -1444,590 +2036,952 @@ bad_request(SSL* client_ssl, int client_fd)
    ctime_r(&now, &time_buf[0]);
    time_buf[strlen(time_buf) - 1] = 0;
 
-   data = pgmoneta_append(data, "HTTP/1.1 400 Bad Request\r\n");
+   data = pgmoneta_append(data, "HTTP/1.1 200 OK\r\n");
+   data = pgmoneta_append(data, "Content-Type: text/plain; version=0.0.1; charset=utf-8\r\n");
    data = pgmoneta_append(data, "Date: ");
    data = pgmoneta_append(data, &time_buf[0]);
    data = pgmoneta_append(data, "\r\n");
+   if (compressed != NULL)
+   {
+      data = pgmoneta_append(data, "Content-Encoding: gzip\r\n");
+   }
+   data = pgmoneta_append(data, "Content-Length: ");
+   data = pgmoneta_append_ulong(data, compressed != NULL ? compressed_size : strlen(body));
+   data = pgmoneta_append(data, "\r\n");
+   if (keep_alive)
+   {
+      data = pgmoneta_append(data, "Connection: keep-alive\r\n");
+      data = pgmoneta_format_and_append(data, "Keep-Alive: timeout=%d, max=%d\r\n", METRICS_KEEP_ALIVE_TIMEOUT, METRICS_KEEP_ALIVE_MAX);
+   }
+   else
+   {
+      data = pgmoneta_append(data, "Connection: close\r\n");
+   }
+   data = pgmoneta_append(data, "\r\n");
 
    msg.kind = 0;
    msg.length = strlen(data);
    msg.data = data;
 
+   status = pgmoneta_write_message(client_ssl, client_fd, &msg);
+   if (status != MESSAGE_STATUS_OK)
+   {
+      goto error;
+   }
+
+   msg.kind = 0;
+   msg.length = compressed != NULL ? compressed_size : strlen(body);
+   msg.data = compressed != NULL ? (void*)compressed : (void*)body;
+
    status = pgmoneta_write_message(client_ssl, client_fd, &msg);
 
+   free(compressed);
    free(data);
 
    return status;
+
+error:
+
+   free(compressed);
+   free(data);
+
+   return MESSAGE_STATUS_ERROR;
 }
 
-static void
-general_information(SSL* client_ssl, int client_fd)
+static int
+tls_accept(SSL* client_ssl, int client_fd)
 {
-   char* d;
-   unsigned long size;
-   int retention;
-   char* data = NULL;
-   time_t t;
-   char time_str[128];
-   struct tm* time_info;
+   char buffer[5] = {0};
+   char* path = "/";
+   char* path_start = NULL;
+   char* path_end = NULL;
+   char* base_url = NULL;
+   struct message* msg = NULL;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_state The state of pgmoneta\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_state gauge\n");
-   data = pgmoneta_append(data, "pgmoneta_state ");
-   data = pgmoneta_append(data, "1");
-   data = pgmoneta_append(data, "\n\n");
-   data = pgmoneta_append(data, "#HELP pgmoneta_version The version of pgmoneta\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_version gauge\n");
-   data = pgmoneta_append(data, "pgmoneta_version{version=\"");
-   data = pgmoneta_append(data, VERSION);
-   data = pgmoneta_append(data, "\"} 1");
-   data = pgmoneta_append(data, "\n\n");
-   data = pgmoneta_append(data, "#HELP pgmoneta_logging_info The number of INFO logging statements\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_logging_info gauge\n");
-   data = pgmoneta_append(data, "pgmoneta_logging_info ");
-   data = pgmoneta_append_ulong(data, atomic_load(&config->common.prometheus.logging_info));
-   data = pgmoneta_append(data, "\n\n");
-   data = pgmoneta_append(data, "#HELP pgmoneta_logging_warn The number of WARN logging statements\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_logging_warn gauge\n");
-   data = pgmoneta_append(data, "pgmoneta_logging_warn ");
-   data = pgmoneta_append_ulong(data, atomic_load(&config->common.prometheus.logging_warn));
-   data = pgmoneta_append(data, "\n\n");
-   data = pgmoneta_append(data, "#HELP pgmoneta_logging_error The number of ERROR logging statements\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_logging_error gauge\n");
-   data = pgmoneta_append(data, "pgmoneta_logging_error ");
-   data = pgmoneta_append_ulong(data, atomic_load(&config->common.prometheus.logging_error));
-   data = pgmoneta_append(data, "\n\n");
-   data = pgmoneta_append(data, "#HELP pgmoneta_logging_fatal The number of FATAL logging statements\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_logging_fatal gauge\n");
-   data = pgmoneta_append(data, "pgmoneta_logging_fatal ");
-   data = pgmoneta_append_ulong(data, atomic_load(&config->common.prometheus.logging_fatal));
-   data = pgmoneta_append(data, "\n\n");
-   data = pgmoneta_append(data, "#HELP pgmoneta_retention_days The retention days of pgmoneta\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_retention_days gauge\n");
-   data = pgmoneta_append(data, "pgmoneta_retention_days ");
-   data = pgmoneta_append_int(data, config->retention_days <= 0 ? 0 : config->retention_days);
-   data = pgmoneta_append(data, "\n\n");
-
-   data = pgmoneta_append(data, "#HELP pgmoneta_retention_weeks The retention weeks of pgmoneta\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_retention_weeks gauge\n");
-   data = pgmoneta_append(data, "pgmoneta_retention_weeks ");
-   data = pgmoneta_append_int(data, config->retention_weeks <= 0 ? 0 : config->retention_weeks);
-   data = pgmoneta_append(data, "\n\n");
-
-   data = pgmoneta_append(data, "#HELP pgmoneta_retention_months The retention months of pgmoneta\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_retention_months gauge\n");
-   data = pgmoneta_append(data, "pgmoneta_retention_months ");
-   data = pgmoneta_append_int(data, config->retention_months <= 0 ? 0 : config->retention_months);
-   data = pgmoneta_append(data, "\n\n");
-
-   data = pgmoneta_append(data, "#HELP pgmoneta_retention_years The retention years of pgmoneta\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_retention_years gauge\n");
-   data = pgmoneta_append(data, "pgmoneta_retention_years ");
-   data = pgmoneta_append_int(data, config->retention_years <= 0 ? 0 : config->retention_years);
-   data = pgmoneta_append(data, "\n\n");
-
-   data = pgmoneta_append(data, "#HELP pgmoneta_retention_server The retention of a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_retention_server gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
-   {
-      data = pgmoneta_append(data, "pgmoneta_retention_server{");
+   recv(client_fd, buffer, 5, MSG_PEEK);
 
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"");
-      data = pgmoneta_append(data, ", ");
-      data = pgmoneta_append(data, "parameter= \"days\"");
-      data = pgmoneta_append(data, "} ");
-      retention = config->common.servers[i].retention_days;
-      if (retention <= 0)
+   if ((unsigned char)buffer[0] == 0x16 || (unsigned char)buffer[0] == 0x80) // SSL/TLS request
+   {
+      if (SSL_accept(client_ssl) <= 0)
       {
-         retention = config->retention_days;
+         pgmoneta_log_error("Failed to accept SSL connection");
+         goto error;
       }
-      data = pgmoneta_append_int(data, retention <= 0 ? 0 : retention);
-      data = pgmoneta_append(data, "\n");
 
-      data = pgmoneta_append(data, "pgmoneta_retention_server{");
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"");
-      data = pgmoneta_append(data, ", ");
-      data = pgmoneta_append(data, "parameter= \"weeks\"");
-      data = pgmoneta_append(data, "} ");
-      retention = config->common.servers[i].retention_weeks;
-      if (retention <= 0)
-      {
-         retention = config->retention_weeks;
-      }
-      data = pgmoneta_append_int(data, retention <= 0 ? 0 : retention);
-      data = pgmoneta_append(data, "\n");
+      return 0;
+   }
 
-      data = pgmoneta_append(data, "pgmoneta_retention_server{");
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"");
-      data = pgmoneta_append(data, ", ");
-      data = pgmoneta_append(data, "parameter= \"months\"");
-      data = pgmoneta_append(data, "} ");
-      retention = config->common.servers[i].retention_months;
-      if (retention <= 0)
-      {
-         retention = config->retention_months;
-      }
-      data = pgmoneta_append_int(data, retention <= 0 ? 0 : retention);
-      data = pgmoneta_append(data, "\n");
+   /* A plain request on the TLS port is redirected, and the connection ends */
+   if (pgmoneta_read_timeout_message(NULL, client_fd, config->authentication_timeout, &msg) != MESSAGE_STATUS_OK)
+   {
+      pgmoneta_log_error("Failed to read message");
+      goto error;
+   }
 
-      data = pgmoneta_append(data, "pgmoneta_retention_server{");
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"");
-      data = pgmoneta_append(data, ", ");
-      data = pgmoneta_append(data, "parameter= \"years\"");
-      data = pgmoneta_append(data, "} ");
-      retention = config->common.servers[i].retention_years;
-      if (retention <= 0)
+   path_start = strstr(msg->data, " ");
+   if (path_start)
+   {
+      path_start++;
+      path_end = strstr(path_start, " ");
+      if (path_end)
       {
-         retention = config->retention_years;
+         *path_end = '\0';
+         path = path_start;
       }
-      data = pgmoneta_append_int(data, retention <= 0 ? 0 : retention);
-      data = pgmoneta_append(data, "\n");
    }
-   data = pgmoneta_append(data, "\n");
-
-   data = pgmoneta_append(data, "#HELP pgmoneta_compression The compression used\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_compression gauge\n");
-   data = pgmoneta_append(data, "pgmoneta_compression ");
-   data = pgmoneta_append_int(data, config->compression_type);
-   data = pgmoneta_append(data, "\n\n");
 
-   d = NULL;
-
-   d = pgmoneta_append(d, config->base_dir);
-   d = pgmoneta_append(d, "/");
+   base_url = pgmoneta_format_and_append(base_url, "https://localhost:%d%s", config->metrics, path);
 
-   size = pgmoneta_directory_size(d);
-
-   data = pgmoneta_append(data, "#HELP pgmoneta_used_space The disk space used for pgmoneta\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_used_space gauge\n");
-   data = pgmoneta_append(data, "pgmoneta_used_space ");
-   data = pgmoneta_append_ulong(data, size);
-   data = pgmoneta_append(data, "\n\n");
-
-   free(d);
+   if (redirect_page(NULL, client_fd, base_url) != MESSAGE_STATUS_OK)
+   {
+      pgmoneta_log_error("Failed to redirect to: %s", base_url);
+   }
 
-   d = NULL;
+   free(base_url);
 
-   d = pgmoneta_append(d, config->base_dir);
-   d = pgmoneta_append(d, "/");
+error:
 
-   size = pgmoneta_free_space(d);
+   return 1;
+}
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_free_space The free disk space for pgmoneta\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_free_space gauge\n");
-   data = pgmoneta_append(data, "pgmoneta_free_space ");
-   data = pgmoneta_append_ulong(data, size);
-   data = pgmoneta_append(data, "\n\n");
+static void
+serve_request(SSL* client_ssl, int client_fd, struct message* msg, bool persistent, bool* keep_alive)
+{
+   int page;
+   bool gzip = false;
 
-   free(d);
+   request_options(msg, keep_alive, &gzip);
+   *keep_alive = *keep_alive && persistent;
 
-   d = NULL;
+   page = resolve_page(msg);
 
-   d = pgmoneta_append(d, config->base_dir);
-   d = pgmoneta_append(d, "/");
+   if (page == PAGE_METRICS)
+   {
+      metrics_page(client_ssl, client_fd, *keep_alive, gzip);
+      return;
+   }
 
-   size = pgmoneta_total_space(d);
+   /* The other pages end the connection */
+   *keep_alive = false;
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_total_space The total disk space for pgmoneta\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_total_space gauge\n");
-   data = pgmoneta_append(data, "pgmoneta_total_space ");
-   data = pgmoneta_append_ulong(data, size);
-   data = pgmoneta_append(data, "\n\n");
+   if (page == PAGE_HOME)
+   {
+      home_page(client_ssl, client_fd);
+   }
+   else if (page == PAGE_UNKNOWN)
+   {
+      unknown_page(client_ssl, client_fd);
+   }
+   else
+   {
+      bad_request(client_ssl, client_fd);
+   }
+}
 
-   free(d);
+static void
+request_options(struct message* msg, bool* keep_alive, bool* gzip)
+{
+   char* request = NULL;
+   char* line = NULL;
+   char* saveptr = NULL;
 
-   d = NULL;
+   *keep_alive = false;
+   *gzip = false;
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_wal_shipping The disk space used for WAL shipping for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_wal_shipping gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   request = (char*)malloc(msg->length + 1);
+   if (request == NULL)
    {
-      data = pgmoneta_append(data, "pgmoneta_wal_shipping{");
+      return;
+   }
 
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"} ");
+   memcpy(request, msg->data, msg->length);
+   request[msg->length] = '\0';
 
-      d = pgmoneta_get_server_wal_shipping_wal(i);
+   /* HTTP/1.1 keeps the connection unless asked not to, HTTP/1.0 only when asked to */
+   line = strtok_r(request, "\r\n", &saveptr);
+   *keep_alive = line != NULL && strstr(line, "HTTP/1.1") != NULL;
 
-      if (d != NULL)
+   while ((line = strtok_r(NULL, "\r\n", &saveptr)) != NULL)
+   {
+      if (!strncasecmp(line, "Connection:", 11))
       {
-         size = pgmoneta_directory_size(d);
-         data = pgmoneta_append_ulong(data, size);
+         if (strcasestr(line + 11, "close") != NULL)
+         {
+            *keep_alive = false;
+         }
+         else if (strcasestr(line + 11, "keep-alive") != NULL)
+         {
+            *keep_alive = true;
+         }
       }
-      else
+      else if (!strncasecmp(line, "Accept-Encoding:", 16) && strcasestr(line + 16, "gzip") != NULL)
       {
-         data = pgmoneta_append_ulong(data, 0);
+         *gzip = true;
       }
+   }
+
+   free(request);
+}
 
-      data = pgmoneta_append(data, "\n");
+static void*
+metrics_run(void* arg __attribute__((unused)))
+{
+   pgmoneta_memory_init();
 
-      free(d);
-      d = NULL;
-   }
-   data = pgmoneta_append(data, "\n");
+   ev_run(metrics_loop, 0);
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_wal_shipping_used_space The disk space used for WAL shipping of a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_wal_shipping_used_space gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   while (metrics_clients != NULL)
    {
-      data = pgmoneta_append(data, "pgmoneta_wal_shipping_used_space{");
+      metrics_client_close(metrics_loop, metrics_clients);
+   }
 
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"} ");
+   pgmoneta_memory_destroy();
 
-      d = pgmoneta_get_server_wal_shipping(i);
-      if (d != NULL)
-      {
-         size = pgmoneta_directory_size(d);
-         data = pgmoneta_append_ulong(data, size);
-      }
-      else
-      {
-         data = pgmoneta_append_ulong(data, 0);
-      }
+   return NULL;
+}
 
-      data = pgmoneta_append(data, "\n");
+static void
+metrics_wakeup_cb(struct ev_loop* loop, struct ev_async* w __attribute__((unused)), int revents)
+{
+   bool stopping;
+   struct metrics_client* pending = NULL;
+   struct metrics_client* c = NULL;
+   struct main_configuration* config;
 
-      free(d);
-      d = NULL;
-   }
-   data = pgmoneta_append(data, "\n");
+   config = (struct main_configuration*)shmem;
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_wal_shipping_free_space The free disk space for WAL shipping of a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_wal_shipping_free_space gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   if (EV_ERROR & revents)
    {
-      data = pgmoneta_append(data, "pgmoneta_wal_shipping_free_space{");
+      pgmoneta_log_trace("metrics_wakeup_cb: got invalid event: %s", strerror(errno));
+      errno = 0;
+      return;
+   }
 
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"} ");
+   pthread_mutex_lock(&metrics_lock);
+   stopping = metrics_stopping;
+   pending = metrics_pending;
+   metrics_pending = NULL;
+   pthread_mutex_unlock(&metrics_lock);
 
-      d = pgmoneta_get_server_wal_shipping(i);
+   while (pending != NULL)
+   {
+      c = pending;
+      pending = pending->next;
+      c->next = NULL;
 
-      if (d != NULL)
+      if (stopping)
       {
-         size = pgmoneta_free_space(d);
-         data = pgmoneta_append_ulong(data, size);
+         pgmoneta_disconnect(c->fd);
+         free(c);
+         continue;
       }
-      else
+
+      if (strlen(config->metrics_cert_file) > 0 && strlen(config->metrics_key_file) > 0)
       {
-         data = pgmoneta_append_ulong(data, 0);
+         if (pgmoneta_create_ssl_ctx(false, &c->ctx) ||
+             pgmoneta_create_ssl_server(c->ctx, config->metrics_key_file, config->metrics_cert_file, config->metrics_ca_file, c->fd, &c->ssl))
+         {
+            pgmoneta_log_error("Could not create metrics SSL server");
+            if (c->ctx != NULL)
+            {
+               SSL_CTX_free(c->ctx);
+            }
+            pgmoneta_disconnect(c->fd);
+            free(c);
+            continue;
+         }
       }
 
-      data = pgmoneta_append(data, "\n");
+      c->next = metrics_clients;
+      metrics_clients = c;
 
-      free(d);
-      d = NULL;
+      ev_io_init(&c->io, metrics_client_cb, c->fd, EV_READ);
+      ev_io_start(loop, &c->io);
+
+      ev_timer_init(&c->idle, metrics_idle_cb, 0., METRICS_KEEP_ALIVE_TIMEOUT);
+      ev_timer_again(loop, &c->idle);
    }
-   data = pgmoneta_append(data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_wal_shipping_total_space The total disk space for WAL shipping of a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_wal_shipping_total_space gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   if (stopping)
    {
-      data = pgmoneta_append(data, "pgmoneta_wal_shipping_total_space{");
+      ev_break(loop, EVBREAK_ALL);
+   }
+}
 
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"} ");
+static void
+metrics_client_cb(struct ev_loop* loop, struct ev_io* w, int revents)
+{
+   int status;
+   bool keep_alive = false;
+   struct message* msg = NULL;
+   struct metrics_client* c = (struct metrics_client*)w;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (EV_ERROR & revents)
+   {
+      pgmoneta_log_trace("metrics_client_cb: got invalid event: %s", strerror(errno));
+      errno = 0;
+      metrics_client_close(loop, c);
+      return;
+   }
+
+   /* The TLS handshake waits for the first bytes of the client */
+   if (c->ssl != NULL && !c->accepted)
+   {
+      if (tls_accept(c->ssl, c->fd))
+      {
+         metrics_client_close(loop, c);
+         return;
+      }
+
+      c->accepted = true;
+
+      if (SSL_pending(c->ssl) == 0)
+      {
+         return;
+      }
+   }
+
+   status = pgmoneta_read_timeout_message(c->ssl, c->fd, config->authentication_timeout, &msg);
+   if (status != MESSAGE_STATUS_OK)
+   {
+      metrics_client_close(loop, c);
+      return;
+   }
+
+   c->requests++;
+
+   serve_request(c->ssl, c->fd, msg, c->requests < METRICS_KEEP_ALIVE_MAX, &keep_alive);
+
+   if (!keep_alive)
+   {
+      metrics_client_close(loop, c);
+      return;
+   }
+
+   ev_timer_again(loop, &c->idle);
+}
+
+static void
+metrics_idle_cb(struct ev_loop* loop, struct ev_timer* w, int revents __attribute__((unused)))
+{
+   struct metrics_client* c = NULL;
+
+   for (c = metrics_clients; c != NULL; c = c->next)
+   {
+      if (&c->idle == w)
+      {
+         metrics_client_close(loop, c);
+         return;
+      }
+   }
+}
+
+static void
+metrics_client_close(struct ev_loop* loop, struct metrics_client* c)
+{
+   struct metrics_client** p = &metrics_clients;
+
+   while (*p != NULL && *p != c)
+   {
+      p = &(*p)->next;
+   }
+
+   if (*p == c)
+   {
+      *p = c->next;
+   }
+
+   ev_io_stop(loop, &c->io);
+   ev_timer_stop(loop, &c->idle);
+
+   pgmoneta_close_ssl(c->ssl);
+   if (c->ctx != NULL)
+   {
+      SSL_CTX_free(c->ctx);
+   }
+   pgmoneta_disconnect(c->fd);
+
+   free(c);
+}
+
+static int
+bad_request(SSL* client_ssl, int client_fd)
+{
+   char* data = NULL;
+   time_t now;
+   char time_buf[32];
+   int status;
+   struct message msg;
+
+   memset(&msg, 0, sizeof(struct message));
+   memset(&data, 0, sizeof(data));
+
+   now = time(NULL);
+
+   memset(&time_buf, 0, sizeof(time_buf));
+   ctime_r(&now, &time_buf[0]);
+   time_buf[strlen(time_buf) - 1] = 0;
+
+   data = pgmoneta_append(data, "HTTP/1.1 400 Bad Request\r\n");
+   data = pgmoneta_append(data, "Date: ");
+   data = pgmoneta_append(data, &time_buf[0]);
+   data = pgmoneta_append(data, "\r\n");
+
+   msg.kind = 0;
+   msg.length = strlen(data);
+   msg.data = data;
+
+   status = pgmoneta_write_message(client_ssl, client_fd, &msg);
+
+   free(data);
+
+   return status;
+}
+
+static void
+general_information(struct builder* body)
+{
+   char* d;
+   unsigned long size;
+   int retention;
+   struct builder data = {0};
+   time_t t;
+   char time_str[128];
+   struct tm* time_info;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_state The state of pgmoneta\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_state gauge\n");
+   pgmoneta_builder_append(&data, "pgmoneta_state ");
+   pgmoneta_builder_append(&data, "1");
+   pgmoneta_builder_append(&data, "\n\n");
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_version The version of pgmoneta\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_version gauge\n");
+   pgmoneta_builder_append(&data, "pgmoneta_version{version=\"");
+   pgmoneta_builder_append(&data, VERSION);
+   pgmoneta_builder_append(&data, "\"} 1");
+   pgmoneta_builder_append(&data, "\n\n");
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_logging_info The number of INFO logging statements\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_logging_info gauge\n");
+   pgmoneta_builder_append(&data, "pgmoneta_logging_info ");
+   pgmoneta_builder_append_ulong(&data, atomic_load(&config->common.prometheus.logging_info));
+   pgmoneta_builder_append(&data, "\n\n");
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_logging_warn The number of WARN logging statements\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_logging_warn gauge\n");
+   pgmoneta_builder_append(&data, "pgmoneta_logging_warn ");
+   pgmoneta_builder_append_ulong(&data, atomic_load(&config->common.prometheus.logging_warn));
+   pgmoneta_builder_append(&data, "\n\n");
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_logging_error The number of ERROR logging statements\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_logging_error gauge\n");
+   pgmoneta_builder_append(&data, "pgmoneta_logging_error ");
+   pgmoneta_builder_append_ulong(&data, atomic_load(&config->common.prometheus.logging_error));
+   pgmoneta_builder_append(&data, "\n\n");
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_logging_fatal The number of FATAL logging statements\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_logging_fatal gauge\n");
+   pgmoneta_builder_append(&data, "pgmoneta_logging_fatal ");
+   pgmoneta_builder_append_ulong(&data, atomic_load(&config->common.prometheus.logging_fatal));
+   pgmoneta_builder_append(&data, "\n\n");
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_retention_days The retention days of pgmoneta\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_retention_days gauge\n");
+   pgmoneta_builder_append(&data, "pgmoneta_retention_days ");
+   pgmoneta_builder_append_int(&data, config->retention_days <= 0 ? 0 : config->retention_days);
+   pgmoneta_builder_append(&data, "\n\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_retention_weeks The retention weeks of pgmoneta\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_retention_weeks gauge\n");
+   pgmoneta_builder_append(&data, "pgmoneta_retention_weeks ");
+   pgmoneta_builder_append_int(&data, config->retention_weeks <= 0 ? 0 : config->retention_weeks);
+   pgmoneta_builder_append(&data, "\n\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_retention_months The retention months of pgmoneta\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_retention_months gauge\n");
+   pgmoneta_builder_append(&data, "pgmoneta_retention_months ");
+   pgmoneta_builder_append_int(&data, config->retention_months <= 0 ? 0 : config->retention_months);
+   pgmoneta_builder_append(&data, "\n\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_retention_years The retention years of pgmoneta\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_retention_years gauge\n");
+   pgmoneta_builder_append(&data, "pgmoneta_retention_years ");
+   pgmoneta_builder_append_int(&data, config->retention_years <= 0 ? 0 : config->retention_years);
+   pgmoneta_builder_append(&data, "\n\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_retention_server The retention of a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_retention_server gauge\n");
+   for (int i = 0; i < config->common.number_of_servers; i++)
+   {
+      pgmoneta_builder_append(&data, "pgmoneta_retention_server{");
+
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"");
+      pgmoneta_builder_append(&data, ", ");
+      pgmoneta_builder_append(&data, "parameter= \"days\"");
+      pgmoneta_builder_append(&data, "} ");
+      retention = config->common.servers[i].retention_days;
+      if (retention <= 0)
+      {
+         retention = config->retention_days;
+      }
+      pgmoneta_builder_append_int(&data, retention <= 0 ? 0 : retention);
+      pgmoneta_builder_append(&data, "\n");
+
+      pgmoneta_builder_append(&data, "pgmoneta_retention_server{");
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"");
+      pgmoneta_builder_append(&data, ", ");
+      pgmoneta_builder_append(&data, "parameter= \"weeks\"");
+      pgmoneta_builder_append(&data, "} ");
+      retention = config->common.servers[i].retention_weeks;
+      if (retention <= 0)
+      {
+         retention = config->retention_weeks;
+      }
+      pgmoneta_builder_append_int(&data, retention <= 0 ? 0 : retention);
+      pgmoneta_builder_append(&data, "\n");
+
+      pgmoneta_builder_append(&data, "pgmoneta_retention_server{");
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"");
+      pgmoneta_builder_append(&data, ", ");
+      pgmoneta_builder_append(&data, "parameter= \"months\"");
+      pgmoneta_builder_append(&data, "} ");
+      retention = config->common.servers[i].retention_months;
+      if (retention <= 0)
+      {
+         retention = config->retention_months;
+      }
+      pgmoneta_builder_append_int(&data, retention <= 0 ? 0 : retention);
+      pgmoneta_builder_append(&data, "\n");
+
+      pgmoneta_builder_append(&data, "pgmoneta_retention_server{");
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"");
+      pgmoneta_builder_append(&data, ", ");
+      pgmoneta_builder_append(&data, "parameter= \"years\"");
+      pgmoneta_builder_append(&data, "} ");
+      retention = config->common.servers[i].retention_years;
+      if (retention <= 0)
+      {
+         retention = config->retention_years;
+      }
+      pgmoneta_builder_append_int(&data, retention <= 0 ? 0 : retention);
+      pgmoneta_builder_append(&data, "\n");
+   }
+   pgmoneta_builder_append(&data, "\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_compression The compression used\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_compression gauge\n");
+   pgmoneta_builder_append(&data, "pgmoneta_compression ");
+   pgmoneta_builder_append_int(&data, config->compression_type);
+   pgmoneta_builder_append(&data, "\n\n");
+
+   size = pgmoneta_storage_size(-1, STORAGE_SERVER);
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_used_space The disk space used for pgmoneta\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_used_space gauge\n");
+   pgmoneta_builder_append(&data, "pgmoneta_used_space ");
+   pgmoneta_builder_append_ulong(&data, size);
+   pgmoneta_builder_append(&data, "\n\n");
+
+   d = NULL;
+
+   d = pgmoneta_append(d, config->base_dir);
+   d = pgmoneta_append(d, "/");
+
+   size = pgmoneta_free_space(d);
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_free_space The free disk space for pgmoneta\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_free_space gauge\n");
+   pgmoneta_builder_append(&data, "pgmoneta_free_space ");
+   pgmoneta_builder_append_ulong(&data, size);
+   pgmoneta_builder_append(&data, "\n\n");
+
+   free(d);
+
+   d = NULL;
+
+   d = pgmoneta_append(d, config->base_dir);
+   d = pgmoneta_append(d, "/");
+
+   size = pgmoneta_total_space(d);
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_total_space The total disk space for pgmoneta\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_total_space gauge\n");
+   pgmoneta_builder_append(&data, "pgmoneta_total_space ");
+   pgmoneta_builder_append_ulong(&data, size);
+   pgmoneta_builder_append(&data, "\n\n");
+
+   free(d);
+
+   d = NULL;
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_wal_shipping The disk space used for WAL shipping for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_wal_shipping gauge\n");
+   for (int i = 0; i < config->common.number_of_servers; i++)
+   {
+      pgmoneta_builder_append(&data, "pgmoneta_wal_shipping{");
+
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
+
+      size = pgmoneta_storage_size(i, STORAGE_WAL_SHIPPING_WAL);
+      pgmoneta_builder_append_ulong(&data, size);
+
+      pgmoneta_builder_append(&data, "\n");
+   }
+   pgmoneta_builder_append(&data, "\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_wal_shipping_used_space The disk space used for WAL shipping of a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_wal_shipping_used_space gauge\n");
+   for (int i = 0; i < config->common.number_of_servers; i++)
+   {
+      pgmoneta_builder_append(&data, "pgmoneta_wal_shipping_used_space{");
+
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
+
+      size = pgmoneta_storage_size(i, STORAGE_WAL_SHIPPING);
+      pgmoneta_builder_append_ulong(&data, size);
+
+      pgmoneta_builder_append(&data, "\n");
+   }
+   pgmoneta_builder_append(&data, "\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_wal_shipping_free_space The free disk space for WAL shipping of a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_wal_shipping_free_space gauge\n");
+   for (int i = 0; i < config->common.number_of_servers; i++)
+   {
+      pgmoneta_builder_append(&data, "pgmoneta_wal_shipping_free_space{");
+
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
+
+      d = pgmoneta_get_server_wal_shipping(i);
+
+      if (d != NULL)
+      {
+         size = pgmoneta_free_space(d);
+         pgmoneta_builder_append_ulong(&data, size);
+      }
+      else
+      {
+         pgmoneta_builder_append_ulong(&data, 0);
+      }
+
+      pgmoneta_builder_append(&data, "\n");
+
+      free(d);
+      d = NULL;
+   }
+   pgmoneta_builder_append(&data, "\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_wal_shipping_total_space The total disk space for WAL shipping of a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_wal_shipping_total_space gauge\n");
+   for (int i = 0; i < config->common.number_of_servers; i++)
+   {
+      pgmoneta_builder_append(&data, "pgmoneta_wal_shipping_total_space{");
+
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
 
       d = pgmoneta_get_server_wal_shipping(i);
 
       if (d != NULL)
       {
          size = pgmoneta_total_space(d);
-         data = pgmoneta_append_ulong(data, size);
+         pgmoneta_builder_append_ulong(&data, size);
       }
       else
       {
-         data = pgmoneta_append_ulong(data, 0);
+         pgmoneta_builder_append_ulong(&data, 0);
       }
 
-      data = pgmoneta_append(data, "\n");
+      pgmoneta_builder_append(&data, "\n");
 
       free(d);
       d = NULL;
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
    free(d);
 
    d = NULL;
 
    /* workspace */
-   data = pgmoneta_append(data, "#HELP pgmoneta_workspace The disk space used for workspace for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_workspace gauge\n");
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_workspace The disk space used for workspace for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_workspace gauge\n");
    for (int i = 0; i < config->common.number_of_servers; i++)
    {
-      data = pgmoneta_append(data, "pgmoneta_workspace{");
+      pgmoneta_builder_append(&data, "pgmoneta_workspace{");
 
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"} ");
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
 
       d = pgmoneta_get_server_workspace(i);
 
       if (d != NULL)
       {
          size = pgmoneta_directory_size(d);
-         data = pgmoneta_append_ulong(data, size);
+         pgmoneta_builder_append_ulong(&data, size);
       }
       else
       {
-         data = pgmoneta_append_ulong(data, 0);
+         pgmoneta_builder_append_ulong(&data, 0);
       }
 
-      data = pgmoneta_append(data, "\n");
+      pgmoneta_builder_append(&data, "\n");
 
       free(d);
       d = NULL;
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_workspace_free_space The free disk space for workspace of a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_workspace_free_space gauge\n");
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_workspace_free_space The free disk space for workspace of a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_workspace_free_space gauge\n");
    for (int i = 0; i < config->common.number_of_servers; i++)
    {
-      data = pgmoneta_append(data, "pgmoneta_workspace_free_space{");
+      pgmoneta_builder_append(&data, "pgmoneta_workspace_free_space{");
 
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"} ");
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
 
       d = pgmoneta_get_server_workspace(i);
 
       if (d != NULL)
       {
          size = pgmoneta_free_space(d);
-         data = pgmoneta_append_ulong(data, size);
+         pgmoneta_builder_append_ulong(&data, size);
       }
       else
       {
-         data = pgmoneta_append_ulong(data, 0);
+         pgmoneta_builder_append_ulong(&data, 0);
       }
 
-      data = pgmoneta_append(data, "\n");
+      pgmoneta_builder_append(&data, "\n");
 
       free(d);
       d = NULL;
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_workspace_total_space The total disk space for workspace of a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_workspace_total_space gauge\n");
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_workspace_total_space The total disk space for workspace of a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_workspace_total_space gauge\n");
    for (int i = 0; i < config->common.number_of_servers; i++)
    {
-      data = pgmoneta_append(data, "pgmoneta_workspace_total_space{");
+      pgmoneta_builder_append(&data, "pgmoneta_workspace_total_space{");
 
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"} ");
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
 
       d = pgmoneta_get_server_workspace(i);
 
       if (d != NULL)
       {
          size = pgmoneta_total_space(d);
-         data = pgmoneta_append_ulong(data, size);
+         pgmoneta_builder_append_ulong(&data, size);
       }
       else
       {
-         data = pgmoneta_append_ulong(data, 0);
+         pgmoneta_builder_append_ulong(&data, 0);
       }
 
-      data = pgmoneta_append(data, "\n");
+      pgmoneta_builder_append(&data, "\n");
 
       free(d);
       d = NULL;
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
    /* hot_standby */
-   data = pgmoneta_append(data, "#HELP pgmoneta_hot_standby The disk space used for hot standby for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_hot_standby gauge\n");
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_hot_standby The disk space used for hot standby for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_hot_standby gauge\n");
    for (int i = 0; i < config->common.number_of_servers; i++)
    {
-      data = pgmoneta_append(data, "pgmoneta_hot_standby{");
+      pgmoneta_builder_append(&data, "pgmoneta_hot_standby{");
 
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"} ");
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
 
       d = pgmoneta_get_server_hot_standby(i);
 
       if (d != NULL)
       {
          size = pgmoneta_directory_size(d);
-         data = pgmoneta_append_ulong(data, size);
+         pgmoneta_builder_append_ulong(&data, size);
       }
       else
       {
-         data = pgmoneta_append_ulong(data, 0);
+         pgmoneta_builder_append_ulong(&data, 0);
       }
 
-      data = pgmoneta_append(data, "\n");
+      pgmoneta_builder_append(&data, "\n");
 
       free(d);
       d = NULL;
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_hot_standby_free_space The free disk space for hot standby of a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_hot_standby_free_space gauge\n");
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_hot_standby_free_space The free disk space for hot standby of a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_hot_standby_free_space gauge\n");
    for (int i = 0; i < config->common.number_of_servers; i++)
    {
-      data = pgmoneta_append(data, "pgmoneta_hot_standby_free_space{");
+      pgmoneta_builder_append(&data, "pgmoneta_hot_standby_free_space{");
 
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"} ");
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
 
       d = pgmoneta_get_server_hot_standby(i);
 
       if (d != NULL)
       {
          size = pgmoneta_free_space(d);
-         data = pgmoneta_append_ulong(data, size);
+         pgmoneta_builder_append_ulong(&data, size);
       }
       else
       {
-         data = pgmoneta_append_ulong(data, 0);
+         pgmoneta_builder_append_ulong(&data, 0);
       }
 
-      data = pgmoneta_append(data, "\n");
+      pgmoneta_builder_append(&data, "\n");
 
       free(d);
       d = NULL;
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_hot_standby_total_space The total disk space for hot standby of a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_hot_standby_total_space gauge\n");
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_hot_standby_total_space The total disk space for hot standby of a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_hot_standby_total_space gauge\n");
    for (int i = 0; i < config->common.number_of_servers; i++)
    {
-      data = pgmoneta_append(data, "pgmoneta_hot_standby_total_space{");
+      pgmoneta_builder_append(&data, "pgmoneta_hot_standby_total_space{");
 
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"} ");
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
 
       d = pgmoneta_get_server_hot_standby(i);
 
       if (d != NULL)
       {
          size = pgmoneta_total_space(d);
-         data = pgmoneta_append_ulong(data, size);
+         pgmoneta_builder_append_ulong(&data, size);
       }
       else
       {
-         data = pgmoneta_append_ulong(data, 0);
+         pgmoneta_builder_append_ulong(&data, 0);
       }
 
-      data = pgmoneta_append(data, "\n");
+      pgmoneta_builder_append(&data, "\n");
 
       free(d);
       d = NULL;
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_server_timeline The current timeline a server is on\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_server_timeline counter\n");
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_server_timeline The current timeline a server is on\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_server_timeline counter\n");
    for (int i = 0; i < config->common.number_of_servers; i++)
    {
-      data = pgmoneta_append(data, "pgmoneta_server_timeline{");
+      pgmoneta_builder_append(&data, "pgmoneta_server_timeline{");
 
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"} ");
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
 
-      data = pgmoneta_append_int(data, config->common.servers[i].cur_timeline);
+      pgmoneta_builder_append_int(&data, config->common.servers[i].cur_timeline);
 
-      data = pgmoneta_append(data, "\n");
+      pgmoneta_builder_append(&data, "\n");
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_server_parent_tli The parent timeline of a timeline on a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_server_parent_tli gauge\n");
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_server_parent_tli The parent timeline of a timeline on a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_server_parent_tli gauge\n");
    for (int i = 0; i < config->common.number_of_servers; i++)
    {
       struct timeline_history* history = NULL;
       struct timeline_history* curh = NULL;
       int tli = 2;
 
-      data = pgmoneta_append(data, "pgmoneta_server_parent_tli{");
+      pgmoneta_builder_append(&data, "pgmoneta_server_parent_tli{");
 
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\", ");
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\", ");
 
-      data = pgmoneta_append(data, "tli=\"");
-      data = pgmoneta_append_int(data, 1);
-      data = pgmoneta_append(data, "\"} ");
+      pgmoneta_builder_append(&data, "tli=\"");
+      pgmoneta_builder_append_int(&data, 1);
+      pgmoneta_builder_append(&data, "\"} ");
 
-      data = pgmoneta_append_int(data, 0);
+      pgmoneta_builder_append_int(&data, 0);
 
-      data = pgmoneta_append(data, "\n");
+      pgmoneta_builder_append(&data, "\n");
 
       pgmoneta_get_timeline_history(i, config->common.servers[i].cur_timeline, &history);
       curh = history;
       while (curh != NULL)
       {
-         data = pgmoneta_append(data, "pgmoneta_server_parent_tli{");
+         pgmoneta_builder_append(&data, "pgmoneta_server_parent_tli{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\", ");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\", ");
 
-         data = pgmoneta_append(data, "tli=\"");
-         data = pgmoneta_append_int(data, tli);
-         data = pgmoneta_append(data, "\"} ");
+         pgmoneta_builder_append(&data, "tli=\"");
+         pgmoneta_builder_append_int(&data, tli);
+         pgmoneta_builder_append(&data, "\"} ");
 
-         data = pgmoneta_append_int(data, curh->parent_tli);
+         pgmoneta_builder_append_int(&data, curh->parent_tli);
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
 
          curh = curh->next;
          tli++;
       }
       pgmoneta_free_timeline_history(history);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_server_timeline_switchpos The WAL switch position of a timeline on a server (showed in hex as a parameter)\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_server_timeline_switchpos gauge\n");
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_server_timeline_switchpos The WAL switch position of a timeline on a server (showed in hex as a parameter)\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_server_timeline_switchpos gauge\n");
    for (int i = 0; i < config->common.number_of_servers; i++)
    {
       struct timeline_history* history = NULL;
       struct timeline_history* curh = NULL;
       int tli = 2;
 
-      data = pgmoneta_append(data, "pgmoneta_server_timeline_switchpos{");
+      pgmoneta_builder_append(&data, "pgmoneta_server_timeline_switchpos{");
 
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\", ");
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\", ");
 
-      data = pgmoneta_append(data, "tli=\"1\", ");
+      pgmoneta_builder_append(&data, "tli=\"1\", ");
 
-      data = pgmoneta_append(data, "walpos=\"0/0\"} ");
+      pgmoneta_builder_append(&data, "walpos=\"0/0\"} ");
 
-      data = pgmoneta_append(data, "1");
+      pgmoneta_builder_append(&data, "1");
 
-      data = pgmoneta_append(data, "\n");
+      pgmoneta_builder_append(&data, "\n");
 
       pgmoneta_get_timeline_history(i, config->common.servers[i].cur_timeline, &history);
       curh = history;
@@ -2037,122 +2991,122 @@ general_information(SSL* client_ssl, int client_fd)
          memset(xlogpos, 0, MISC_LENGTH);
          snprintf(xlogpos, MISC_LENGTH, "%X/%X", curh->switchpos_hi, curh->switchpos_lo);
 
-         data = pgmoneta_append(data, "pgmoneta_server_timeline_switchpos{");
+         pgmoneta_builder_append(&data, "pgmoneta_server_timeline_switchpos{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\", ");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\", ");
 
-         data = pgmoneta_append(data, "tli=\"");
-         data = pgmoneta_append_int(data, tli);
-         data = pgmoneta_append(data, "\", ");
+         pgmoneta_builder_append(&data, "tli=\"");
+         pgmoneta_builder_append_int(&data, tli);
+         pgmoneta_builder_append(&data, "\", ");
 
-         data = pgmoneta_append(data, "walpos=\"");
-         data = pgmoneta_append(data, xlogpos);
-         data = pgmoneta_append(data, "\"} ");
+         pgmoneta_builder_append(&data, "walpos=\"");
+         pgmoneta_builder_append(&data, xlogpos);
+         pgmoneta_builder_append(&data, "\"} ");
 
-         data = pgmoneta_append_int(data, 1);
+         pgmoneta_builder_append_int(&data, 1);
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
 
          curh = curh->next;
          tli++;
       }
       pgmoneta_free_timeline_history(history);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_server_workers The numbeer of workers for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_server_workers gauge\n");
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_server_workers The numbeer of workers for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_server_workers gauge\n");
    for (int i = 0; i < config->common.number_of_servers; i++)
    {
       int workers = config->common.servers[i].workers != -1 ? config->common.servers[i].workers : config->workers;
 
-      data = pgmoneta_append(data, "pgmoneta_server_workers{");
+      pgmoneta_builder_append(&data, "pgmoneta_server_workers{");
 
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"} ");
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
 
-      data = pgmoneta_append_int(data, workers);
+      pgmoneta_builder_append_int(&data, workers);
 
-      data = pgmoneta_append(data, "\n");
+      pgmoneta_builder_append(&data, "\n");
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_server_valid Is the server in a valid state\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_server_valid gauge\n");
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_server_valid Is the server in a valid state\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_server_valid gauge\n");
    for (int i = 0; i < config->common.number_of_servers; i++)
    {
-      data = pgmoneta_append(data, "pgmoneta_server_valid{");
+      pgmoneta_builder_append(&data, "pgmoneta_server_valid{");
 
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"} ");
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
 
-      data = pgmoneta_append_bool(data, config->common.servers[i].valid);
+      pgmoneta_builder_append_bool(&data, config->common.servers[i].valid);
 
-      data = pgmoneta_append(data, "\n");
+      pgmoneta_builder_append(&data, "\n");
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_wal_streaming The WAL streaming status of a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_wal_streaming gauge\n");
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_wal_streaming The WAL streaming status of a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_wal_streaming gauge\n");
    for (int i = 0; i < config->common.number_of_servers; i++)
    {
-      data = pgmoneta_append(data, "pgmoneta_wal_streaming{");
+      pgmoneta_builder_append(&data, "pgmoneta_wal_streaming{");
 
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"} ");
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
 
-      data = pgmoneta_append_bool(data, config->common.servers[i].wal_streaming);
+      pgmoneta_builder_append_bool(&data, config->common.servers[i].wal_streaming);
 
-      data = pgmoneta_append(data, "\n");
+      pgmoneta_builder_append(&data, "\n");
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_server_operation_count The count of client operations of a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_server_operation_count gauge\n");
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_server_operation_count The count of client operations of a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_server_operation_count gauge\n");
    for (int i = 0; i < config->common.number_of_servers; i++)
    {
-      data = pgmoneta_append(data, "pgmoneta_server_operation_count{");
+      pgmoneta_builder_append(&data, "pgmoneta_server_operation_count{");
 
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"} ");
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
 
-      data = pgmoneta_append_ulong(data, atomic_load(&config->common.servers[i].operation_count));
+      pgmoneta_builder_append_ulong(&data, atomic_load(&config->common.servers[i].operation_count));
 
-      data = pgmoneta_append(data, "\n");
+      pgmoneta_builder_append(&data, "\n");
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_server_failed_operation_count The count of failed client operations of a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_server_failed_operation_count gauge\n");
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_server_failed_operation_count The count of failed client operations of a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_server_failed_operation_count gauge\n");
    for (int i = 0; i < config->common.number_of_servers; i++)
    {
-      data = pgmoneta_append(data, "pgmoneta_server_failed_operation_count{");
+      pgmoneta_builder_append(&data, "pgmoneta_server_failed_operation_count{");
 
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"} ");
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
 
-      data = pgmoneta_append_ulong(data, atomic_load(&config->common.servers[i].failed_operation_count));
+      pgmoneta_builder_append_ulong(&data, atomic_load(&config->common.servers[i].failed_operation_count));
 
-      data = pgmoneta_append(data, "\n");
+      pgmoneta_builder_append(&data, "\n");
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_server_last_operation_time The time of the latest client operation of a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_server_last_operation_time gauge\n");
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_server_last_operation_time The time of the latest client operation of a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_server_last_operation_time gauge\n");
    for (int i = 0; i < config->common.number_of_servers; i++)
    {
-      data = pgmoneta_append(data, "pgmoneta_server_last_operation_time{");
+      pgmoneta_builder_append(&data, "pgmoneta_server_last_operation_time{");
 
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"} ");
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
 
       if (atomic_load(&config->common.servers[i].operation_count) > 0)
       {
@@ -2161,26 +3115,26 @@ general_information(SSL* client_ssl, int client_fd)
          time_info = localtime(&t);
          strftime(&time_str[0], sizeof(time_str), "%Y%m%d%H%M%S", time_info);
 
-         data = pgmoneta_append(data, time_str);
+         pgmoneta_builder_append(&data, time_str);
       }
       else
       {
-         data = pgmoneta_append_int(data, 0);
+         pgmoneta_builder_append_int(&data, 0);
       }
 
-      data = pgmoneta_append(data, "\n");
+      pgmoneta_builder_append(&data, "\n");
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_server_last_failed_operation_time The time of the latest failed client operation of a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_server_last_failed_operation_time gauge\n");
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_server_last_failed_operation_time The time of the latest failed client operation of a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_server_last_failed_operation_time gauge\n");
    for (int i = 0; i < config->common.number_of_servers; i++)
    {
-      data = pgmoneta_append(data, "pgmoneta_server_last_failed_operation_time{");
+      pgmoneta_builder_append(&data, "pgmoneta_server_last_failed_operation_time{");
 
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"} ");
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
 
       if (atomic_load(&config->common.servers[i].failed_operation_count) > 0)
       {
@@ -2189,145 +3143,486 @@ general_information(SSL* client_ssl, int client_fd)
          time_info = localtime(&t);
          strftime(&time_str[0], sizeof(time_str), "%Y%m%d%H%M%S", time_info);
 
-         data = pgmoneta_append(data, time_str);
+         pgmoneta_builder_append(&data, time_str);
       }
       else
       {
-         data = pgmoneta_append_int(data, 0);
+         pgmoneta_builder_append_int(&data, 0);
       }
 
-      data = pgmoneta_append(data, "\n");
+      pgmoneta_builder_append(&data, "\n");
+   }
+   pgmoneta_builder_append(&data, "\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_server_backup_write_queue The number of chunks queued for the backup writer of a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_server_backup_write_queue gauge\n");
+   for (int i = 0; i < config->common.number_of_servers; i++)
+   {
+      pgmoneta_builder_append(&data, "pgmoneta_server_backup_write_queue{");
+
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
+
+      pgmoneta_builder_append_ulong(&data, atomic_load(&config->common.servers[i].backup_write_queue));
+
+      pgmoneta_builder_append(&data, "\n");
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_server_checksums Are checksums enabled\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_server_checksums gauge\n");
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_server_backup_write_queue_waits The number of times the backup receiver of a server waited for the writer\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_server_backup_write_queue_waits counter\n");
    for (int i = 0; i < config->common.number_of_servers; i++)
    {
-      data = pgmoneta_append(data, "pgmoneta_server_checksums{");
+      pgmoneta_builder_append(&data, "pgmoneta_server_backup_write_queue_waits{");
 
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"} ");
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
+
+      pgmoneta_builder_append_ulong(&data, atomic_load(&config->common.servers[i].backup_write_queue_waits));
+
+      pgmoneta_builder_append(&data, "\n");
+   }
+   pgmoneta_builder_append(&data, "\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_server_compression_level The compression level of the running backup of a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_server_compression_level gauge\n");
+   for (int i = 0; i < config->common.number_of_servers; i++)
+   {
+      pgmoneta_builder_append(&data, "pgmoneta_server_compression_level{");
+
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
+
+      pgmoneta_builder_append_int(&data, atomic_load(&config->common.servers[i].compression_level));
+
+      pgmoneta_builder_append(&data, "\n");
+   }
+   pgmoneta_builder_append(&data, "\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_server_checksums Are checksums enabled\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_server_checksums gauge\n");
+   for (int i = 0; i < config->common.number_of_servers; i++)
+   {
+      pgmoneta_builder_append(&data, "pgmoneta_server_checksums{");
+
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
 
       if (config->common.servers[i].checksums)
       {
-         data = pgmoneta_append_int(data, 1);
+         pgmoneta_builder_append_int(&data, 1);
       }
       else
       {
-         data = pgmoneta_append_int(data, 0);
+         pgmoneta_builder_append_int(&data, 0);
       }
 
-      data = pgmoneta_append(data, "\n");
+      pgmoneta_builder_append(&data, "\n");
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_server_summarize_wal Is summarize_wal enabled\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_server_summarize_wal gauge\n");
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_server_summarize_wal Is summarize_wal enabled\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_server_summarize_wal gauge\n");
    for (int i = 0; i < config->common.number_of_servers; i++)
    {
-      data = pgmoneta_append(data, "pgmoneta_server_summarize_wal{");
+      pgmoneta_builder_append(&data, "pgmoneta_server_summarize_wal{");
 
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"} ");
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
 
       if (config->common.servers[i].summarize_wal)
       {
-         data = pgmoneta_append_int(data, 1);
+         pgmoneta_builder_append_int(&data, 1);
       }
       else
       {
-         data = pgmoneta_append_int(data, 0);
+         pgmoneta_builder_append_int(&data, 0);
       }
 
-      data = pgmoneta_append(data, "\n");
+      pgmoneta_builder_append(&data, "\n");
+   }
+   pgmoneta_builder_append(&data, "\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_scrub_bytes The number of bytes read by the scrubber for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_scrub_bytes counter\n");
+   for (int i = 0; i < config->common.number_of_servers; i++)
+   {
+      pgmoneta_builder_append(&data, "pgmoneta_scrub_bytes{");
+
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
+
+      pgmoneta_builder_append_ulong(&data, atomic_load(&config->common.servers[i].scrub_bytes));
+
+      pgmoneta_builder_append(&data, "\n");
+   }
+   pgmoneta_builder_append(&data, "\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_scrub_wal_failed The number of WAL files that failed the current scrub pass of a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_scrub_wal_failed gauge\n");
+   for (int i = 0; i < config->common.number_of_servers; i++)
+   {
+      pgmoneta_builder_append(&data, "pgmoneta_scrub_wal_failed{");
+
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
+
+      pgmoneta_builder_append_ulong(&data, atomic_load(&config->common.servers[i].scrub_wal_failed));
+
+      pgmoneta_builder_append(&data, "\n");
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_extension The version of pgmoneta extension\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_extension gauge\n");
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_extension The version of pgmoneta extension\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_extension gauge\n");
    for (int i = 0; i < config->common.number_of_servers; i++)
    {
-      data = pgmoneta_append(data, "pgmoneta_extension{");
+      pgmoneta_builder_append(&data, "pgmoneta_extension{");
 
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"");
-      data = pgmoneta_append(data, ", ");
-      data = pgmoneta_append(data, "version=\"");
-      data = pgmoneta_append(data, config->common.servers[i].ext_version);
-      data = pgmoneta_append(data, "\"");
-      data = pgmoneta_append(data, "} ");
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"");
+      pgmoneta_builder_append(&data, ", ");
+      pgmoneta_builder_append(&data, "version=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].ext_version);
+      pgmoneta_builder_append(&data, "\"");
+      pgmoneta_builder_append(&data, "} ");
       if (config->common.servers[i].ext_valid)
       {
-         data = pgmoneta_append_int(data, 1);
+         pgmoneta_builder_append_int(&data, 1);
       }
       else
       {
-         data = pgmoneta_append_int(data, 0);
+         pgmoneta_builder_append_int(&data, 0);
       }
 
-      data = pgmoneta_append(data, "\n");
+      pgmoneta_builder_append(&data, "\n");
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   if (data != NULL)
+   if (pgmoneta_builder_length(&data) > 0)
    {
-      send_chunk(client_ssl, client_fd, data);
-      metrics_cache_append(data);
-      free(data);
-      data = NULL;
+      pgmoneta_builder_append(body, pgmoneta_builder_string(&data));
+      pgmoneta_builder_destroy(&data);
    }
 }
 
 static void
-backup_information(SSL* client_ssl, int client_fd)
+backup_metrics(struct builder* body)
 {
-   char* d;
-   int number_of_backups;
-   struct backup** backups;
-   bool valid;
-   int valid_count;
-   char* data = NULL;
+   int number_of_fragments;
+   char** fragments = NULL;
+   char** cursors = NULL;
+   struct builder data = {0};
+   char* line;
+   char* next;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_oldest The oldest backup for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_oldest gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
-   {
-      d = pgmoneta_get_server_backup(i);
-
-      number_of_backups = 0;
-      backups = NULL;
-
-      pgmoneta_get_backups(d, &number_of_backups, &backups);
+   number_of_fragments = MAX(config->common.number_of_servers, 1);
 
-      data = pgmoneta_append(data, "pgmoneta_backup_oldest{");
-
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"} ");
+   fragments = (char**)calloc(number_of_fragments, sizeof(char*));
+   cursors = (char**)calloc(number_of_fragments, sizeof(char*));
+   if (fragments == NULL || cursors == NULL)
+   {
+      goto error;
+   }
 
-      valid = false;
-      for (int j = 0; !valid && j < number_of_backups; j++)
+   if (config->common.number_of_servers == 0)
+   {
+      /* Only the metric headers */
+      backup_information(0, 0, &fragments[0]);
+      backup_size_information(0, 0, &fragments[0]);
+   }
+   else
+   {
+      for (int i = 0; i < config->common.number_of_servers; i++)
       {
-         if (backups[j]->valid == VALID_TRUE)
+         if (backup_fragment(i, &fragments[i]))
          {
-            data = pgmoneta_append(data, backups[j]->label);
-            valid = true;
+            goto error;
          }
       }
+   }
 
-      if (!valid)
+   for (int i = 0; i < number_of_fragments; i++)
+   {
+      cursors[i] = fragments[i];
+   }
+
+   /* Every fragment has the same metrics in the same order, so each metric is
+    * written with the headers of the first fragment and the samples of all of them */
+   while (cursors[0] != NULL && *cursors[0] != '\0')
+   {
+      for (int i = 0; i < number_of_fragments; i++)
       {
-         data = pgmoneta_append(data, "0");
-      }
+         line = cursors[i];
 
-      data = pgmoneta_append(data, "\n");
+         while (line != NULL && *line != '\0')
+         {
+            next = strchr(line, '\n');
+            next = next != NULL ? next + 1 : line + strlen(line);
+
+            /* A metric ends with an empty line */
+            if (*line == '\n')
+            {
+               line = next;
+               break;
+            }
+
+            if (*line != '#' || i == 0)
+            {
+               pgmoneta_builder_append_length(&data, line, next - line);
+            }
+
+            line = next;
+         }
+
+         cursors[i] = line;
+      }
+
+      pgmoneta_builder_append(&data, "\n");
+
+      pgmoneta_builder_append(body, pgmoneta_builder_string(&data));
+      pgmoneta_builder_destroy(&data);
+   }
+
+   for (int i = 0; i < number_of_fragments; i++)
+   {
+      free(fragments[i]);
+   }
+   free(fragments);
+   free(cursors);
+
+   return;
+
+error:
+
+   pgmoneta_log_error("Prometheus: Could not build the backup metrics");
+
+   if (fragments != NULL)
+   {
+      for (int i = 0; i < number_of_fragments; i++)
+      {
+         free(fragments[i]);
+      }
+   }
+   free(fragments);
+   free(cursors);
+   pgmoneta_builder_destroy(&data);
+}
+
+static int
+backup_fragment(int server, char** fragment)
+{
+   char* path = NULL;
+   char* tmp = NULL;
+   char* d = NULL;
+   char* text = NULL;
+   int fd = -1;
+   FILE* file = NULL;
+   unsigned long generation;
+   bool cacheable;
+   struct stat st;
+   struct fragment_header header;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   *fragment = NULL;
+
+   path = backup_fragment_path(server);
+   d = pgmoneta_get_server_backup(server);
+   if (path == NULL || d == NULL)
+   {
+      goto error;
+   }
+
+   /* Take the generation and the directory status before building, so a concurrent change makes the fragment stale */
+   generation = atomic_load(&config->backup_generation);
+   cacheable = stat(d, &st) == 0;
+
+   if (cacheable)
+   {
+      fd = open(path, O_RDONLY);
+      if (fd != -1)
+      {
+         if (read(fd, &header, sizeof(struct fragment_header)) == sizeof(struct fragment_header) &&
+             header.magic == FRAGMENT_MAGIC &&
+             header.version == FRAGMENT_VERSION &&
+             header.generation == generation &&
+             header.mtime_sec == (int64_t)st.st_mtim.tv_sec &&
+             header.mtime_nsec == (int64_t)st.st_mtim.tv_nsec &&
+             header.length < SIZE_MAX)
+         {
+            text = (char*)malloc(header.length + 1);
+            if (text != NULL && read(fd, text, header.length) == (ssize_t)header.length)
+            {
+               text[header.length] = '\0';
+               *fragment = text;
+               text = NULL;
+            }
+            free(text);
+            text = NULL;
+         }
+
+         close(fd);
+         fd = -1;
+      }
+
+      if (*fragment != NULL)
+      {
+         free(path);
+         free(d);
+
+         return 0;
+      }
+   }
+
+   backup_information(server, server + 1, &text);
+   backup_size_information(server, server + 1, &text);
+
+   if (text == NULL)
+   {
+      goto error;
+   }
+
+   if (cacheable)
+   {
+      tmp = pgmoneta_append(tmp, path);
+      tmp = pgmoneta_append(tmp, ".XXXXXX");
+
+      fd = tmp != NULL ? mkstemp(tmp) : -1;
+      if (fd != -1)
+      {
+         file = fdopen(fd, "w");
+         if (file == NULL)
+         {
+            close(fd);
+         }
+         fd = -1;
+      }
+
+      if (file != NULL)
+      {
+         memset(&header, 0, sizeof(struct fragment_header));
+         header.magic = FRAGMENT_MAGIC;
+         header.version = FRAGMENT_VERSION;
+         header.generation = generation;
+         header.mtime_sec = (int64_t)st.st_mtim.tv_sec;
+         header.mtime_nsec = (int64_t)st.st_mtim.tv_nsec;
+         header.length = strlen(text);
+
+         if (fwrite(&header, sizeof(struct fragment_header), 1, file) == 1 &&
+             fwrite(text, 1, header.length, file) == header.length &&
+             fclose(file) == 0)
+         {
+            file = NULL;
+            if (rename(tmp, path))
+            {
+               unlink(tmp);
+            }
+         }
+         else
+         {
+            if (file != NULL)
+            {
+               fclose(file);
+               file = NULL;
+            }
+            unlink(tmp);
+         }
+      }
+   }
+
+   *fragment = text;
+
+   free(tmp);
+   free(path);
+   free(d);
+
+   return 0;
+
+error:
+
+   free(text);
+   free(tmp);
+   free(path);
+   free(d);
+
+   return 1;
+}
+
+static char*
+backup_fragment_path(int server)
+{
+   char* path = NULL;
+
+   path = pgmoneta_get_server(server);
+   if (path == NULL)
+   {
+      return NULL;
+   }
+
+   path = pgmoneta_append(path, "backup.metrics");
+
+   return path;
+}
+
+static void
+backup_information(int first, int last, char** fragment)
+{
+   char* d;
+   int number_of_backups;
+   struct backup** backups;
+   bool valid;
+   int valid_count;
+   struct builder data = {0};
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_oldest The oldest backup for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_oldest gauge\n");
+   for (int i = first; i < last; i++)
+   {
+      d = pgmoneta_get_server_backup(i);
+
+      number_of_backups = 0;
+      backups = NULL;
+
+      pgmoneta_get_backups(d, &number_of_backups, &backups);
+
+      pgmoneta_builder_append(&data, "pgmoneta_backup_oldest{");
+
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
+
+      valid = false;
+      for (int j = 0; !valid && j < number_of_backups; j++)
+      {
+         if (backups[j]->valid == VALID_TRUE)
+         {
+            pgmoneta_builder_append(&data, backups[j]->label);
+            valid = true;
+         }
+      }
+
+      if (!valid)
+      {
+         pgmoneta_builder_append(&data, "0");
+      }
+
+      pgmoneta_builder_append(&data, "\n");
 
       for (int j = 0; j < number_of_backups; j++)
       {
@@ -2337,19 +3632,17 @@ backup_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   if (data != NULL)
+   if (pgmoneta_builder_length(&data) > 0)
    {
-      send_chunk(client_ssl, client_fd, data);
-      metrics_cache_append(data);
-      free(data);
-      data = NULL;
+      *fragment = pgmoneta_append(*fragment, pgmoneta_builder_string(&data));
+      pgmoneta_builder_destroy(&data);
    }
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_newest The newest backup for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_newest gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_newest The newest backup for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_newest gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -2358,28 +3651,28 @@ backup_information(SSL* client_ssl, int client_fd)
 
       pgmoneta_get_backups(d, &number_of_backups, &backups);
 
-      data = pgmoneta_append(data, "pgmoneta_backup_newest{");
+      pgmoneta_builder_append(&data, "pgmoneta_backup_newest{");
 
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"} ");
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
 
       valid = false;
       for (int j = number_of_backups - 1; !valid && j >= 0; j--)
       {
          if (backups[j]->valid == VALID_TRUE)
          {
-            data = pgmoneta_append(data, backups[j]->label);
+            pgmoneta_builder_append(&data, backups[j]->label);
             valid = true;
          }
       }
 
       if (!valid)
       {
-         data = pgmoneta_append(data, "0");
+         pgmoneta_builder_append(&data, "0");
       }
 
-      data = pgmoneta_append(data, "\n");
+      pgmoneta_builder_append(&data, "\n");
 
       for (int j = 0; j < number_of_backups; j++)
       {
@@ -2389,11 +3682,11 @@ backup_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_count The number of valid backups for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_count gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_count The number of valid backups for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_count gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -2402,11 +3695,11 @@ backup_information(SSL* client_ssl, int client_fd)
 
       pgmoneta_get_backups(d, &number_of_backups, &backups);
 
-      data = pgmoneta_append(data, "pgmoneta_backup_count{");
+      pgmoneta_builder_append(&data, "pgmoneta_backup_count{");
 
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"} ");
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
 
       valid_count = 0;
       for (int j = 0; j < number_of_backups; j++)
@@ -2417,9 +3710,9 @@ backup_information(SSL* client_ssl, int client_fd)
          }
       }
 
-      data = pgmoneta_append_int(data, valid_count);
+      pgmoneta_builder_append_int(&data, valid_count);
 
-      data = pgmoneta_append(data, "\n");
+      pgmoneta_builder_append(&data, "\n");
 
       for (int j = 0; j < number_of_backups; j++)
       {
@@ -2429,19 +3722,17 @@ backup_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   if (data != NULL)
+   if (pgmoneta_builder_length(&data) > 0)
    {
-      send_chunk(client_ssl, client_fd, data);
-      metrics_cache_append(data);
-      free(data);
-      data = NULL;
+      *fragment = pgmoneta_append(*fragment, pgmoneta_builder_string(&data));
+      pgmoneta_builder_destroy(&data);
    }
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup Is the backup valid for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup Is the backup valid for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -2456,29 +3747,29 @@ backup_information(SSL* client_ssl, int client_fd)
          {
             if (backups[j] != NULL)
             {
-               data = pgmoneta_append(data, "pgmoneta_backup{");
+               pgmoneta_builder_append(&data, "pgmoneta_backup{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
 
-               data = pgmoneta_append_int(data, backups[j]->valid);
+               pgmoneta_builder_append_int(&data, backups[j]->valid);
 
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_backup{");
+         pgmoneta_builder_append(&data, "pgmoneta_backup{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -2489,19 +3780,17 @@ backup_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   if (data != NULL)
+   if (pgmoneta_builder_length(&data) > 0)
    {
-      send_chunk(client_ssl, client_fd, data);
-      metrics_cache_append(data);
-      free(data);
-      data = NULL;
+      *fragment = pgmoneta_append(*fragment, pgmoneta_builder_string(&data));
+      pgmoneta_builder_destroy(&data);
    }
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_version The version of postgresql for a backup\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_version gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_version The version of postgresql for a backup\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_version gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -2516,31 +3805,31 @@ backup_information(SSL* client_ssl, int client_fd)
          {
             if (backups[j]->valid == VALID_TRUE)
             {
-               data = pgmoneta_append(data, "pgmoneta_backup_version{");
-
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\", major=\"");
-               data = pgmoneta_append_int(data, backups[j]->major_version);
-               data = pgmoneta_append(data, "\", minor=\"");
-               data = pgmoneta_append_int(data, backups[j]->minor_version);
-               data = pgmoneta_append(data, "\"} 1");
-
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "pgmoneta_backup_version{");
+
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\", major=\"");
+               pgmoneta_builder_append_int(&data, backups[j]->major_version);
+               pgmoneta_builder_append(&data, "\", minor=\"");
+               pgmoneta_builder_append_int(&data, backups[j]->minor_version);
+               pgmoneta_builder_append(&data, "\"} 1");
+
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_backup_version{");
+         pgmoneta_builder_append(&data, "pgmoneta_backup_version{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -2551,19 +3840,17 @@ backup_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   if (data != NULL)
+   if (pgmoneta_builder_length(&data) > 0)
    {
-      send_chunk(client_ssl, client_fd, data);
-      metrics_cache_append(data);
-      free(data);
-      data = NULL;
+      *fragment = pgmoneta_append(*fragment, pgmoneta_builder_string(&data));
+      pgmoneta_builder_destroy(&data);
    }
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_total_elapsed_time The backup in seconds for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_total_elapsed_time gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_total_elapsed_time The backup in seconds for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_total_elapsed_time gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -2578,29 +3865,29 @@ backup_information(SSL* client_ssl, int client_fd)
          {
             if (backups[j]->valid == VALID_TRUE)
             {
-               data = pgmoneta_append(data, "pgmoneta_backup_total_elapsed_time{");
+               pgmoneta_builder_append(&data, "pgmoneta_backup_total_elapsed_time{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
 
-               data = pgmoneta_append_double_precision(data, backups[j]->total_elapsed_time, 4);
+               pgmoneta_builder_append_double_precision(&data, backups[j]->total_elapsed_time, 4);
 
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_backup_total_elapsed_time{");
+         pgmoneta_builder_append(&data, "pgmoneta_backup_total_elapsed_time{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -2611,11 +3898,11 @@ backup_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_basebackup_elapsed_time The duration for basebackup in seconds for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_basebackup_elapsed_time gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_basebackup_elapsed_time The duration for basebackup in seconds for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_basebackup_elapsed_time gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -2630,29 +3917,29 @@ backup_information(SSL* client_ssl, int client_fd)
          {
             if (backups[j]->valid == VALID_TRUE)
             {
-               data = pgmoneta_append(data, "pgmoneta_backup_basebackup_elapsed_time{");
+               pgmoneta_builder_append(&data, "pgmoneta_backup_basebackup_elapsed_time{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
 
-               data = pgmoneta_append_double_precision(data, backups[j]->basebackup_elapsed_time, 4);
+               pgmoneta_builder_append_double_precision(&data, backups[j]->basebackup_elapsed_time, 4);
 
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_backup_basebackup_elapsed_time{");
+         pgmoneta_builder_append(&data, "pgmoneta_backup_basebackup_elapsed_time{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -2663,11 +3950,11 @@ backup_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_manifest_elapsed_time The duration for manifest in seconds for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_manifest_elapsed_time gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_manifest_elapsed_time The duration for manifest in seconds for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_manifest_elapsed_time gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -2682,29 +3969,29 @@ backup_information(SSL* client_ssl, int client_fd)
          {
             if (backups[j]->valid == VALID_TRUE)
             {
-               data = pgmoneta_append(data, "pgmoneta_backup_manifest_elapsed_time{");
+               pgmoneta_builder_append(&data, "pgmoneta_backup_manifest_elapsed_time{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
 
-               data = pgmoneta_append_double_precision(data, backups[j]->manifest_elapsed_time, 4);
+               pgmoneta_builder_append_double_precision(&data, backups[j]->manifest_elapsed_time, 4);
 
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_backup_manifest_elapsed_time{");
+         pgmoneta_builder_append(&data, "pgmoneta_backup_manifest_elapsed_time{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -2715,11 +4002,11 @@ backup_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_compression_zstd_elapsed_time The duration for zstd compression in seconds for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_compression_zstd_elapsed_time gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_compression_zstd_elapsed_time The duration for zstd compression in seconds for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_compression_zstd_elapsed_time gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -2734,29 +4021,29 @@ backup_information(SSL* client_ssl, int client_fd)
          {
             if (backups[j]->valid == VALID_TRUE)
             {
-               data = pgmoneta_append(data, "pgmoneta_backup_compression_zstd_elapsed_time{");
+               pgmoneta_builder_append(&data, "pgmoneta_backup_compression_zstd_elapsed_time{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
 
-               data = pgmoneta_append_double_precision(data, backups[j]->compression_zstd_elapsed_time, 4);
+               pgmoneta_builder_append_double_precision(&data, backups[j]->compression_zstd_elapsed_time, 4);
 
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_backup_compression_zstd_elapsed_time{");
+         pgmoneta_builder_append(&data, "pgmoneta_backup_compression_zstd_elapsed_time{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -2767,11 +4054,11 @@ backup_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_compression_gzip_elapsed_time The duration for gzip compression in seconds for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_compression_gzip_elapsed_time gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_compression_gzip_elapsed_time The duration for gzip compression in seconds for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_compression_gzip_elapsed_time gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -2786,29 +4073,29 @@ backup_information(SSL* client_ssl, int client_fd)
          {
             if (backups[j]->valid == VALID_TRUE)
             {
-               data = pgmoneta_append(data, "pgmoneta_backup_compression_gzip_elapsed_time{");
+               pgmoneta_builder_append(&data, "pgmoneta_backup_compression_gzip_elapsed_time{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
 
-               data = pgmoneta_append_double_precision(data, backups[j]->compression_gzip_elapsed_time, 4);
+               pgmoneta_builder_append_double_precision(&data, backups[j]->compression_gzip_elapsed_time, 4);
 
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_backup_compression_gzip_elapsed_time{");
+         pgmoneta_builder_append(&data, "pgmoneta_backup_compression_gzip_elapsed_time{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -2819,11 +4106,11 @@ backup_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_compression_bzip2_elapsed_time The duration for bzip2 compression in seconds for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_compression_bzip2_elapsed_time gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_compression_bzip2_elapsed_time The duration for bzip2 compression in seconds for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_compression_bzip2_elapsed_time gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -2838,29 +4125,29 @@ backup_information(SSL* client_ssl, int client_fd)
          {
             if (backups[j]->valid == VALID_TRUE)
             {
-               data = pgmoneta_append(data, "pgmoneta_backup_compression_bzip2_elapsed_time{");
+               pgmoneta_builder_append(&data, "pgmoneta_backup_compression_bzip2_elapsed_time{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
 
-               data = pgmoneta_append_double_precision(data, backups[j]->compression_bzip2_elapsed_time, 4);
+               pgmoneta_builder_append_double_precision(&data, backups[j]->compression_bzip2_elapsed_time, 4);
 
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_backup_compression_bzip2_elapsed_time{");
+         pgmoneta_builder_append(&data, "pgmoneta_backup_compression_bzip2_elapsed_time{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -2871,11 +4158,11 @@ backup_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_compression_lz4_elapsed_time The duration for lz4 compression in seconds for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_compression_lz4_elapsed_time gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_compression_lz4_elapsed_time The duration for lz4 compression in seconds for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_compression_lz4_elapsed_time gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -2890,29 +4177,29 @@ backup_information(SSL* client_ssl, int client_fd)
          {
             if (backups[j]->valid == VALID_TRUE)
             {
-               data = pgmoneta_append(data, "pgmoneta_backup_compression_lz4_elapsed_time{");
+               pgmoneta_builder_append(&data, "pgmoneta_backup_compression_lz4_elapsed_time{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
 
-               data = pgmoneta_append_double_precision(data, backups[j]->compression_lz4_elapsed_time, 4);
+               pgmoneta_builder_append_double_precision(&data, backups[j]->compression_lz4_elapsed_time, 4);
 
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_backup_compression_lz4_elapsed_time{");
+         pgmoneta_builder_append(&data, "pgmoneta_backup_compression_lz4_elapsed_time{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -2923,11 +4210,11 @@ backup_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_encryption_elapsed_time The duration for encryption in seconds for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_encryption_elapsed_time gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_encryption_elapsed_time The duration for encryption in seconds for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_encryption_elapsed_time gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -2942,29 +4229,29 @@ backup_information(SSL* client_ssl, int client_fd)
          {
             if (backups[j]->valid == VALID_TRUE)
             {
-               data = pgmoneta_append(data, "pgmoneta_backup_encryption_elapsed_time{");
+               pgmoneta_builder_append(&data, "pgmoneta_backup_encryption_elapsed_time{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
 
-               data = pgmoneta_append_double_precision(data, backups[j]->encryption_elapsed_time, 4);
+               pgmoneta_builder_append_double_precision(&data, backups[j]->encryption_elapsed_time, 4);
 
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_backup_encryption_elapsed_time{");
+         pgmoneta_builder_append(&data, "pgmoneta_backup_encryption_elapsed_time{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -2975,11 +4262,11 @@ backup_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_linking_elapsed_time The duration for linking in seconds for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_linking_elapsed_time gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_linking_elapsed_time The duration for linking in seconds for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_linking_elapsed_time gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -2994,29 +4281,29 @@ backup_information(SSL* client_ssl, int client_fd)
          {
             if (backups[j]->valid == VALID_TRUE)
             {
-               data = pgmoneta_append(data, "pgmoneta_backup_linking_elapsed_time{");
+               pgmoneta_builder_append(&data, "pgmoneta_backup_linking_elapsed_time{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
 
-               data = pgmoneta_append_double_precision(data, backups[j]->linking_elapsed_time, 4);
+               pgmoneta_builder_append_double_precision(&data, backups[j]->linking_elapsed_time, 4);
 
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_backup_linking_elapsed_time{");
+         pgmoneta_builder_append(&data, "pgmoneta_backup_linking_elapsed_time{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -3027,11 +4314,11 @@ backup_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_remote_ssh_elapsed_time The duration for remote ssh in seconds for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_remote_ssh_elapsed_time gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_remote_ssh_elapsed_time The duration for remote ssh in seconds for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_remote_ssh_elapsed_time gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -3046,29 +4333,29 @@ backup_information(SSL* client_ssl, int client_fd)
          {
             if (backups[j]->valid == VALID_TRUE)
             {
-               data = pgmoneta_append(data, "pgmoneta_backup_remote_ssh_elapsed_time{");
+               pgmoneta_builder_append(&data, "pgmoneta_backup_remote_ssh_elapsed_time{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
 
-               data = pgmoneta_append_double_precision(data, backups[j]->remote_ssh_elapsed_time, 4);
+               pgmoneta_builder_append_double_precision(&data, backups[j]->remote_ssh_elapsed_time, 4);
 
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_backup_remote_ssh_elapsed_time{");
+         pgmoneta_builder_append(&data, "pgmoneta_backup_remote_ssh_elapsed_time{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -3080,11 +4367,11 @@ backup_information(SSL* client_ssl, int client_fd)
       free(d);
    }
 
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_remote_s3_elapsed_time The duration for remote_s3 in seconds for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_remote_s3_elapsed_time gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_remote_s3_elapsed_time The duration for remote_s3 in seconds for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_remote_s3_elapsed_time gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -3099,29 +4386,29 @@ backup_information(SSL* client_ssl, int client_fd)
          {
             if (backups[j]->valid == VALID_TRUE)
             {
-               data = pgmoneta_append(data, "pgmoneta_backup_remote_s3_elapsed_time{");
+               pgmoneta_builder_append(&data, "pgmoneta_backup_remote_s3_elapsed_time{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
 
-               data = pgmoneta_append_double_precision(data, backups[j]->remote_s3_elapsed_time, 4);
+               pgmoneta_builder_append_double_precision(&data, backups[j]->remote_s3_elapsed_time, 4);
 
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_backup_remote_s3_elapsed_time{");
+         pgmoneta_builder_append(&data, "pgmoneta_backup_remote_s3_elapsed_time{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -3133,11 +4420,11 @@ backup_information(SSL* client_ssl, int client_fd)
       free(d);
    }
 
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_remote_azure_elapsed_time The duration for remote_azure in seconds for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_remote_azure_elapsed_time gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_remote_azure_elapsed_time The duration for remote_azure in seconds for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_remote_azure_elapsed_time gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -3152,29 +4439,29 @@ backup_information(SSL* client_ssl, int client_fd)
          {
             if (backups[j]->valid == VALID_TRUE)
             {
-               data = pgmoneta_append(data, "pgmoneta_backup_remote_azure_elapsed_time{");
+               pgmoneta_builder_append(&data, "pgmoneta_backup_remote_azure_elapsed_time{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
 
-               data = pgmoneta_append_double_precision(data, backups[j]->remote_azure_elapsed_time, 4);
+               pgmoneta_builder_append_double_precision(&data, backups[j]->remote_azure_elapsed_time, 4);
 
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_backup_remote_azure_elapsed_time{");
+         pgmoneta_builder_append(&data, "pgmoneta_backup_remote_azure_elapsed_time{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -3186,11 +4473,11 @@ backup_information(SSL* client_ssl, int client_fd)
       free(d);
    }
 
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_start_timeline The starting timeline of a backup for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_start_timeline gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_start_timeline The starting timeline of a backup for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_start_timeline gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -3205,29 +4492,29 @@ backup_information(SSL* client_ssl, int client_fd)
          {
             if (backups[j]->valid == VALID_TRUE)
             {
-               data = pgmoneta_append(data, "pgmoneta_backup_start_timeline{");
+               pgmoneta_builder_append(&data, "pgmoneta_backup_start_timeline{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
 
-               data = pgmoneta_append_int(data, backups[j]->start_timeline);
+               pgmoneta_builder_append_int(&data, backups[j]->start_timeline);
 
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_backup_start_timeline{");
+         pgmoneta_builder_append(&data, "pgmoneta_backup_start_timeline{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -3238,11 +4525,11 @@ backup_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_end_timeline The ending timeline of a backup for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_end_timeline gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_end_timeline The ending timeline of a backup for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_end_timeline gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -3257,29 +4544,29 @@ backup_information(SSL* client_ssl, int client_fd)
          {
             if (backups[j]->valid == VALID_TRUE)
             {
-               data = pgmoneta_append(data, "pgmoneta_backup_end_timeline{");
+               pgmoneta_builder_append(&data, "pgmoneta_backup_end_timeline{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
 
-               data = pgmoneta_append_int(data, backups[j]->end_timeline);
+               pgmoneta_builder_append_int(&data, backups[j]->end_timeline);
 
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_backup_end_timeline{");
+         pgmoneta_builder_append(&data, "pgmoneta_backup_end_timeline{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -3290,11 +4577,11 @@ backup_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_start_walpos The starting WAL position of a backup for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_start_walpos gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_start_walpos The starting WAL position of a backup for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_start_walpos gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -3311,35 +4598,35 @@ backup_information(SSL* client_ssl, int client_fd)
             {
                char walpos[MISC_LENGTH];
                memset(walpos, 0, MISC_LENGTH);
-               data = pgmoneta_append(data, "pgmoneta_backup_start_walpos{");
+               pgmoneta_builder_append(&data, "pgmoneta_backup_start_walpos{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\", ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\", ");
 
                snprintf(walpos, MISC_LENGTH, "%X/%X", backups[j]->start_lsn_hi32, backups[j]->start_lsn_lo32);
-               data = pgmoneta_append(data, "walpos=\"");
-               data = pgmoneta_append(data, walpos);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "walpos=\"");
+               pgmoneta_builder_append(&data, walpos);
+               pgmoneta_builder_append(&data, "\"} ");
 
-               data = pgmoneta_append_int(data, 1);
+               pgmoneta_builder_append_int(&data, 1);
 
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_backup_start_walpos{");
+         pgmoneta_builder_append(&data, "pgmoneta_backup_start_walpos{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\", ");
-         data = pgmoneta_append(data, "walpos=\"0/0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\", ");
+         pgmoneta_builder_append(&data, "walpos=\"0/0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
       for (int j = 0; j < number_of_backups; j++)
       {
@@ -3349,11 +4636,11 @@ backup_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_checkpoint_walpos The checkpoint WAL position of a backup for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_checkpoint_walpos gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_checkpoint_walpos The checkpoint WAL position of a backup for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_checkpoint_walpos gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -3370,35 +4657,35 @@ backup_information(SSL* client_ssl, int client_fd)
             {
                char walpos[MISC_LENGTH];
                memset(walpos, 0, MISC_LENGTH);
-               data = pgmoneta_append(data, "pgmoneta_backup_checkpoint_walpos{");
+               pgmoneta_builder_append(&data, "pgmoneta_backup_checkpoint_walpos{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\", ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\", ");
 
                snprintf(walpos, MISC_LENGTH, "%X/%X", backups[j]->checkpoint_lsn_hi32, backups[j]->checkpoint_lsn_lo32);
-               data = pgmoneta_append(data, "walpos=\"");
-               data = pgmoneta_append(data, walpos);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "walpos=\"");
+               pgmoneta_builder_append(&data, walpos);
+               pgmoneta_builder_append(&data, "\"} ");
 
-               data = pgmoneta_append_int(data, 1);
+               pgmoneta_builder_append_int(&data, 1);
 
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_backup_checkpoint_walpos{");
+         pgmoneta_builder_append(&data, "pgmoneta_backup_checkpoint_walpos{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\", ");
-         data = pgmoneta_append(data, "walpos=\"0/0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\", ");
+         pgmoneta_builder_append(&data, "walpos=\"0/0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -3409,11 +4696,11 @@ backup_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_end_walpos The ending WAL position of a backup for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_end_walpos gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_end_walpos The ending WAL position of a backup for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_end_walpos gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -3430,35 +4717,35 @@ backup_information(SSL* client_ssl, int client_fd)
             {
                char walpos[MISC_LENGTH];
                memset(walpos, 0, MISC_LENGTH);
-               data = pgmoneta_append(data, "pgmoneta_backup_end_walpos{");
+               pgmoneta_builder_append(&data, "pgmoneta_backup_end_walpos{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\", ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\", ");
 
                snprintf(walpos, MISC_LENGTH, "%X/%X", backups[j]->end_lsn_hi32, backups[j]->end_lsn_lo32);
-               data = pgmoneta_append(data, "walpos=\"");
-               data = pgmoneta_append(data, walpos);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "walpos=\"");
+               pgmoneta_builder_append(&data, walpos);
+               pgmoneta_builder_append(&data, "\"} ");
 
-               data = pgmoneta_append_int(data, 1);
+               pgmoneta_builder_append_int(&data, 1);
 
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_backup_end_walpos{");
+         pgmoneta_builder_append(&data, "pgmoneta_backup_end_walpos{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\", ");
-         data = pgmoneta_append(data, "walpos=\"0/0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\", ");
+         pgmoneta_builder_append(&data, "walpos=\"0/0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -3469,33 +4756,30 @@ backup_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   if (data != NULL)
+   if (pgmoneta_builder_length(&data) > 0)
    {
-      send_chunk(client_ssl, client_fd, data);
-      metrics_cache_append(data);
-      free(data);
-      data = NULL;
+      *fragment = pgmoneta_append(*fragment, pgmoneta_builder_string(&data));
+      pgmoneta_builder_destroy(&data);
    }
 }
 
 static void
-size_information(SSL* client_ssl, int client_fd)
+backup_size_information(int first, int last, char** fragment)
 {
    char* d;
    int number_of_backups;
    struct backup** backups;
-   unsigned long size;
    bool valid;
-   char* data = NULL;
+   struct builder data = {0};
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_restore_newest_size The size of the newest restore for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_restore_newest_size gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_restore_newest_size The size of the newest restore for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_restore_newest_size gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -3504,28 +4788,28 @@ size_information(SSL* client_ssl, int client_fd)
 
       pgmoneta_get_backups(d, &number_of_backups, &backups);
 
-      data = pgmoneta_append(data, "pgmoneta_restore_newest_size{");
+      pgmoneta_builder_append(&data, "pgmoneta_restore_newest_size{");
 
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"} ");
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
 
       valid = false;
       for (int j = number_of_backups - 1; !valid && j >= 0; j--)
       {
          if (backups[j]->valid == VALID_TRUE)
          {
-            data = pgmoneta_append_ulong(data, backups[j]->restore_size);
+            pgmoneta_builder_append_ulong(&data, backups[j]->restore_size);
             valid = true;
          }
       }
 
       if (!valid)
       {
-         data = pgmoneta_append(data, "0");
+         pgmoneta_builder_append(&data, "0");
       }
 
-      data = pgmoneta_append(data, "\n");
+      pgmoneta_builder_append(&data, "\n");
 
       for (int j = 0; j < number_of_backups; j++)
       {
@@ -3535,19 +4819,17 @@ size_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   if (data != NULL)
+   if (pgmoneta_builder_length(&data) > 0)
    {
-      send_chunk(client_ssl, client_fd, data);
-      metrics_cache_append(data);
-      free(data);
-      data = NULL;
+      *fragment = pgmoneta_append(*fragment, pgmoneta_builder_string(&data));
+      pgmoneta_builder_destroy(&data);
    }
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_newest_size The size of the newest backup for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_newest_size gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_newest_size The size of the newest backup for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_newest_size gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -3556,28 +4838,28 @@ size_information(SSL* client_ssl, int client_fd)
 
       pgmoneta_get_backups(d, &number_of_backups, &backups);
 
-      data = pgmoneta_append(data, "pgmoneta_backup_newest_size{");
+      pgmoneta_builder_append(&data, "pgmoneta_backup_newest_size{");
 
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"} ");
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
 
       valid = false;
       for (int j = number_of_backups - 1; !valid && j >= 0; j--)
       {
          if (backups[j]->valid == VALID_TRUE)
          {
-            data = pgmoneta_append_ulong(data, backups[j]->backup_size);
+            pgmoneta_builder_append_ulong(&data, backups[j]->backup_size);
             valid = true;
          }
       }
 
       if (!valid)
       {
-         data = pgmoneta_append(data, "0");
+         pgmoneta_builder_append(&data, "0");
       }
 
-      data = pgmoneta_append(data, "\n");
+      pgmoneta_builder_append(&data, "\n");
 
       for (int j = 0; j < number_of_backups; j++)
       {
@@ -3587,19 +4869,17 @@ size_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   if (data != NULL)
+   if (pgmoneta_builder_length(&data) > 0)
    {
-      send_chunk(client_ssl, client_fd, data);
-      metrics_cache_append(data);
-      free(data);
-      data = NULL;
+      *fragment = pgmoneta_append(*fragment, pgmoneta_builder_string(&data));
+      pgmoneta_builder_destroy(&data);
    }
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_restore_size The size of a restore for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_restore_size gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_restore_size The size of a restore for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_restore_size gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -3614,29 +4894,29 @@ size_information(SSL* client_ssl, int client_fd)
          {
             if (backups[j]->valid == VALID_TRUE)
             {
-               data = pgmoneta_append(data, "pgmoneta_restore_size{");
+               pgmoneta_builder_append(&data, "pgmoneta_restore_size{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
 
-               data = pgmoneta_append_ulong(data, backups[j]->restore_size);
+               pgmoneta_builder_append_ulong(&data, backups[j]->restore_size);
 
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_restore_size{");
+         pgmoneta_builder_append(&data, "pgmoneta_restore_size{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -3647,19 +4927,17 @@ size_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   if (data != NULL)
+   if (pgmoneta_builder_length(&data) > 0)
    {
-      send_chunk(client_ssl, client_fd, data);
-      metrics_cache_append(data);
-      free(data);
-      data = NULL;
+      *fragment = pgmoneta_append(*fragment, pgmoneta_builder_string(&data));
+      pgmoneta_builder_destroy(&data);
    }
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_restore_size_increment The size increment of a restore for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_restore_size_increment gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_restore_size_increment The size increment of a restore for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_restore_size_increment gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -3674,36 +4952,36 @@ size_information(SSL* client_ssl, int client_fd)
          {
             if (backups[j] != NULL)
             {
-               data = pgmoneta_append(data, "pgmoneta_restore_size_increment{");
+               pgmoneta_builder_append(&data, "pgmoneta_restore_size_increment{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
 
                if (j == 0)
                {
-                  data = pgmoneta_append_int(data, backups[0]->restore_size);
+                  pgmoneta_builder_append_int(&data, backups[0]->restore_size);
                }
                else
                {
-                  data = pgmoneta_append_int(data, backups[j]->restore_size - backups[j - 1]->restore_size);
+                  pgmoneta_builder_append_int(&data, backups[j]->restore_size - backups[j - 1]->restore_size);
                }
 
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_restore_size_increment{");
+         pgmoneta_builder_append(&data, "pgmoneta_restore_size_increment{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -3714,19 +4992,17 @@ size_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   if (data != NULL)
+   if (pgmoneta_builder_length(&data) > 0)
    {
-      send_chunk(client_ssl, client_fd, data);
-      metrics_cache_append(data);
-      free(data);
-      data = NULL;
+      *fragment = pgmoneta_append(*fragment, pgmoneta_builder_string(&data));
+      pgmoneta_builder_destroy(&data);
    }
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_size The size of a backup for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_size gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_size The size of a backup for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_size gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -3741,29 +5017,29 @@ size_information(SSL* client_ssl, int client_fd)
          {
             if (backups[j]->valid == VALID_TRUE)
             {
-               data = pgmoneta_append(data, "pgmoneta_backup_size{");
+               pgmoneta_builder_append(&data, "pgmoneta_backup_size{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
 
-               data = pgmoneta_append_ulong(data, backups[j]->backup_size);
+               pgmoneta_builder_append_ulong(&data, backups[j]->backup_size);
 
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_backup_size{");
+         pgmoneta_builder_append(&data, "pgmoneta_backup_size{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -3774,19 +5050,17 @@ size_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   if (data != NULL)
+   if (pgmoneta_builder_length(&data) > 0)
    {
-      send_chunk(client_ssl, client_fd, data);
-      metrics_cache_append(data);
-      free(data);
-      data = NULL;
+      *fragment = pgmoneta_append(*fragment, pgmoneta_builder_string(&data));
+      pgmoneta_builder_destroy(&data);
    }
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_compression_ratio The ratio of backup size to restore size for each backup\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_compression_ratio gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_compression_ratio The ratio of backup size to restore size for each backup\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_compression_ratio gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -3801,36 +5075,36 @@ size_information(SSL* client_ssl, int client_fd)
          {
             if (backups[j] != NULL)
             {
-               data = pgmoneta_append(data, "pgmoneta_backup_compression_ratio{");
+               pgmoneta_builder_append(&data, "pgmoneta_backup_compression_ratio{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
 
                if (backups[j]->restore_size)
                {
-                  data = pgmoneta_append_double(data, 1.0 * backups[j]->backup_size / backups[j]->restore_size);
+                  pgmoneta_builder_append_double(&data, 1.0 * backups[j]->backup_size / backups[j]->restore_size);
                }
                else
                {
-                  data = pgmoneta_append_int(data, 0);
+                  pgmoneta_builder_append_int(&data, 0);
                }
 
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_backup_compression_ratio{");
+         pgmoneta_builder_append(&data, "pgmoneta_backup_compression_ratio{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -3841,19 +5115,17 @@ size_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   if (data != NULL)
+   if (pgmoneta_builder_length(&data) > 0)
    {
-      send_chunk(client_ssl, client_fd, data);
-      metrics_cache_append(data);
-      free(data);
-      data = NULL;
+      *fragment = pgmoneta_append(*fragment, pgmoneta_builder_string(&data));
+      pgmoneta_builder_destroy(&data);
    }
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_throughput The throughput of the backup for a server (MB/s)\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_throughput gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_throughput The throughput of the backup for a server (MB/s)\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_throughput gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -3868,35 +5140,35 @@ size_information(SSL* client_ssl, int client_fd)
          {
             if (backups[j] != NULL)
             {
-               data = pgmoneta_append(data, "pgmoneta_backup_throughput{");
+               pgmoneta_builder_append(&data, "pgmoneta_backup_throughput{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
 
                if (backups[j]->total_elapsed_time)
                {
-                  data = pgmoneta_append_double_precision(data, (1.0 * backups[j]->backup_size / backups[j]->total_elapsed_time) / (1e6), 4);
+                  pgmoneta_builder_append_double_precision(&data, (1.0 * backups[j]->backup_size / backups[j]->total_elapsed_time) / (1e6), 4);
                }
                else
                {
-                  data = pgmoneta_append_int(data, 0);
+                  pgmoneta_builder_append_int(&data, 0);
                }
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_backup_throughput{");
+         pgmoneta_builder_append(&data, "pgmoneta_backup_throughput{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -3907,19 +5179,17 @@ size_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   if (data != NULL)
+   if (pgmoneta_builder_length(&data) > 0)
    {
-      send_chunk(client_ssl, client_fd, data);
-      metrics_cache_append(data);
-      free(data);
-      data = NULL;
+      *fragment = pgmoneta_append(*fragment, pgmoneta_builder_string(&data));
+      pgmoneta_builder_destroy(&data);
    }
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_basebackup_mbs The throughput of the basebackup for a server (MB/s)\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_basebackup_mbs gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_basebackup_mbs The throughput of the basebackup for a server (MB/s)\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_basebackup_mbs gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -3934,35 +5204,35 @@ size_information(SSL* client_ssl, int client_fd)
          {
             if (backups[j] != NULL)
             {
-               data = pgmoneta_append(data, "pgmoneta_backup_basebackup_mbs{");
+               pgmoneta_builder_append(&data, "pgmoneta_backup_basebackup_mbs{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
 
                if (backups[j]->basebackup_elapsed_time)
                {
-                  data = pgmoneta_append_double_precision(data, (1.0 * backups[j]->backup_size / backups[j]->basebackup_elapsed_time) / (1e6), 4);
+                  pgmoneta_builder_append_double_precision(&data, (1.0 * backups[j]->backup_size / backups[j]->basebackup_elapsed_time) / (1e6), 4);
                }
                else
                {
-                  data = pgmoneta_append_int(data, 0);
+                  pgmoneta_builder_append_int(&data, 0);
                }
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_backup_basebackup_mbs{");
+         pgmoneta_builder_append(&data, "pgmoneta_backup_basebackup_mbs{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -3973,19 +5243,17 @@ size_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   if (data != NULL)
+   if (pgmoneta_builder_length(&data) > 0)
    {
-      send_chunk(client_ssl, client_fd, data);
-      metrics_cache_append(data);
-      free(data);
-      data = NULL;
+      *fragment = pgmoneta_append(*fragment, pgmoneta_builder_string(&data));
+      pgmoneta_builder_destroy(&data);
    }
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_manifest_mbs The throughput of the manifest for a server (MB/s)\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_manifest_mbs gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_manifest_mbs The throughput of the manifest for a server (MB/s)\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_manifest_mbs gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -4000,35 +5268,35 @@ size_information(SSL* client_ssl, int client_fd)
          {
             if (backups[j] != NULL)
             {
-               data = pgmoneta_append(data, "pgmoneta_backup_manifest_mbs{");
+               pgmoneta_builder_append(&data, "pgmoneta_backup_manifest_mbs{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
 
                if (backups[j]->manifest_elapsed_time)
                {
-                  data = pgmoneta_append_double_precision(data, (1.0 * backups[j]->backup_size / backups[j]->manifest_elapsed_time) / (1e6), 4);
+                  pgmoneta_builder_append_double_precision(&data, (1.0 * backups[j]->backup_size / backups[j]->manifest_elapsed_time) / (1e6), 4);
                }
                else
                {
-                  data = pgmoneta_append_int(data, 0);
+                  pgmoneta_builder_append_int(&data, 0);
                }
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_backup_manifest_mbs{");
+         pgmoneta_builder_append(&data, "pgmoneta_backup_manifest_mbs{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -4039,19 +5307,17 @@ size_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   if (data != NULL)
+   if (pgmoneta_builder_length(&data) > 0)
    {
-      send_chunk(client_ssl, client_fd, data);
-      metrics_cache_append(data);
-      free(data);
-      data = NULL;
+      *fragment = pgmoneta_append(*fragment, pgmoneta_builder_string(&data));
+      pgmoneta_builder_destroy(&data);
    }
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_compression_zstd_mbs The throughput of the zstd compression for a server (MB/s)\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_compression_zstd_mbs gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_compression_zstd_mbs The throughput of the zstd compression for a server (MB/s)\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_compression_zstd_mbs gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -4066,35 +5332,35 @@ size_information(SSL* client_ssl, int client_fd)
          {
             if (backups[j] != NULL)
             {
-               data = pgmoneta_append(data, "pgmoneta_backup_compression_zstd_mbs{");
+               pgmoneta_builder_append(&data, "pgmoneta_backup_compression_zstd_mbs{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
 
                if (backups[j]->compression_zstd_elapsed_time)
                {
-                  data = pgmoneta_append_double_precision(data, (1.0 * backups[j]->backup_size / backups[j]->compression_zstd_elapsed_time) / (1e6), 4);
+                  pgmoneta_builder_append_double_precision(&data, (1.0 * backups[j]->backup_size / backups[j]->compression_zstd_elapsed_time) / (1e6), 4);
                }
                else
                {
-                  data = pgmoneta_append_int(data, 0);
+                  pgmoneta_builder_append_int(&data, 0);
                }
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_backup_compression_zstd_mbs{");
+         pgmoneta_builder_append(&data, "pgmoneta_backup_compression_zstd_mbs{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -4105,19 +5371,17 @@ size_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   if (data != NULL)
+   if (pgmoneta_builder_length(&data) > 0)
    {
-      send_chunk(client_ssl, client_fd, data);
-      metrics_cache_append(data);
-      free(data);
-      data = NULL;
+      *fragment = pgmoneta_append(*fragment, pgmoneta_builder_string(&data));
+      pgmoneta_builder_destroy(&data);
    }
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_compression_gzip_mbs The throughput of the gzip compression for a server (MB/s)\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_compression_gzip_mbs gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_compression_gzip_mbs The throughput of the gzip compression for a server (MB/s)\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_compression_gzip_mbs gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -4132,35 +5396,35 @@ size_information(SSL* client_ssl, int client_fd)
          {
             if (backups[j] != NULL)
             {
-               data = pgmoneta_append(data, "pgmoneta_backup_compression_gzip_mbs{");
+               pgmoneta_builder_append(&data, "pgmoneta_backup_compression_gzip_mbs{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
 
                if (backups[j]->compression_gzip_elapsed_time)
                {
-                  data = pgmoneta_append_double_precision(data, (1.0 * backups[j]->backup_size / backups[j]->compression_gzip_elapsed_time) / (1e6), 4);
+                  pgmoneta_builder_append_double_precision(&data, (1.0 * backups[j]->backup_size / backups[j]->compression_gzip_elapsed_time) / (1e6), 4);
                }
                else
                {
-                  data = pgmoneta_append_int(data, 0);
+                  pgmoneta_builder_append_int(&data, 0);
                }
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_backup_compression_gzip_mbs{");
+         pgmoneta_builder_append(&data, "pgmoneta_backup_compression_gzip_mbs{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -4171,19 +5435,17 @@ size_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   if (data != NULL)
+   if (pgmoneta_builder_length(&data) > 0)
    {
-      send_chunk(client_ssl, client_fd, data);
-      metrics_cache_append(data);
-      free(data);
-      data = NULL;
+      *fragment = pgmoneta_append(*fragment, pgmoneta_builder_string(&data));
+      pgmoneta_builder_destroy(&data);
    }
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_compression_bzip2_mbs The throughput of the bzip2 compression for a server (MB/s)\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_compression_bzip2_mbs gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_compression_bzip2_mbs The throughput of the bzip2 compression for a server (MB/s)\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_compression_bzip2_mbs gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -4198,35 +5460,35 @@ size_information(SSL* client_ssl, int client_fd)
          {
             if (backups[j] != NULL)
             {
-               data = pgmoneta_append(data, "pgmoneta_backup_compression_bzip2_mbs{");
+               pgmoneta_builder_append(&data, "pgmoneta_backup_compression_bzip2_mbs{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
 
                if (backups[j]->compression_bzip2_elapsed_time)
                {
-                  data = pgmoneta_append_double_precision(data, (1.0 * backups[j]->backup_size / backups[j]->compression_bzip2_elapsed_time) / (1e6), 4);
+                  pgmoneta_builder_append_double_precision(&data, (1.0 * backups[j]->backup_size / backups[j]->compression_bzip2_elapsed_time) / (1e6), 4);
                }
                else
                {
-                  data = pgmoneta_append_int(data, 0);
+                  pgmoneta_builder_append_int(&data, 0);
                }
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_backup_compression_bzip2_mbs{");
+         pgmoneta_builder_append(&data, "pgmoneta_backup_compression_bzip2_mbs{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -4237,19 +5499,17 @@ size_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   if (data != NULL)
+   if (pgmoneta_builder_length(&data) > 0)
    {
-      send_chunk(client_ssl, client_fd, data);
-      metrics_cache_append(data);
-      free(data);
-      data = NULL;
+      *fragment = pgmoneta_append(*fragment, pgmoneta_builder_string(&data));
+      pgmoneta_builder_destroy(&data);
    }
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_compression_lz4_mbs The throughput of the lz4 compression for a server (MB/s)\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_compression_lz4_mbs gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_compression_lz4_mbs The throughput of the lz4 compression for a server (MB/s)\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_compression_lz4_mbs gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -4264,35 +5524,35 @@ size_information(SSL* client_ssl, int client_fd)
          {
             if (backups[j] != NULL)
             {
-               data = pgmoneta_append(data, "pgmoneta_backup_compression_lz4_mbs{");
+               pgmoneta_builder_append(&data, "pgmoneta_backup_compression_lz4_mbs{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
 
                if (backups[j]->compression_lz4_elapsed_time)
                {
-                  data = pgmoneta_append_double_precision(data, (1.0 * backups[j]->backup_size / backups[j]->compression_lz4_elapsed_time) / (1e6), 4);
+                  pgmoneta_builder_append_double_precision(&data, (1.0 * backups[j]->backup_size / backups[j]->compression_lz4_elapsed_time) / (1e6), 4);
                }
                else
                {
-                  data = pgmoneta_append_int(data, 0);
+                  pgmoneta_builder_append_int(&data, 0);
                }
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_backup_compression_lz4_mbs{");
+         pgmoneta_builder_append(&data, "pgmoneta_backup_compression_lz4_mbs{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -4303,19 +5563,17 @@ size_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   if (data != NULL)
+   if (pgmoneta_builder_length(&data) > 0)
    {
-      send_chunk(client_ssl, client_fd, data);
-      metrics_cache_append(data);
-      free(data);
-      data = NULL;
+      *fragment = pgmoneta_append(*fragment, pgmoneta_builder_string(&data));
+      pgmoneta_builder_destroy(&data);
    }
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_encryption_mbs The throughput of the encryption for a server (MB/s)\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_encryption_mbs gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_encryption_mbs The throughput of the encryption for a server (MB/s)\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_encryption_mbs gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -4330,35 +5588,35 @@ size_information(SSL* client_ssl, int client_fd)
          {
             if (backups[j] != NULL)
             {
-               data = pgmoneta_append(data, "pgmoneta_backup_encryption_mbs{");
+               pgmoneta_builder_append(&data, "pgmoneta_backup_encryption_mbs{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
 
                if (backups[j]->encryption_elapsed_time)
                {
-                  data = pgmoneta_append_double_precision(data, (1.0 * backups[j]->backup_size / backups[j]->encryption_elapsed_time) / (1e6), 4);
+                  pgmoneta_builder_append_double_precision(&data, (1.0 * backups[j]->backup_size / backups[j]->encryption_elapsed_time) / (1e6), 4);
                }
                else
                {
-                  data = pgmoneta_append_int(data, 0);
+                  pgmoneta_builder_append_int(&data, 0);
                }
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_backup_encryption_mbs{");
+         pgmoneta_builder_append(&data, "pgmoneta_backup_encryption_mbs{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -4369,19 +5627,17 @@ size_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   if (data != NULL)
+   if (pgmoneta_builder_length(&data) > 0)
    {
-      send_chunk(client_ssl, client_fd, data);
-      metrics_cache_append(data);
-      free(data);
-      data = NULL;
+      *fragment = pgmoneta_append(*fragment, pgmoneta_builder_string(&data));
+      pgmoneta_builder_destroy(&data);
    }
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_linking_mbs The throughput of the linking for a server (MB/s)\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_linking_mbs gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_linking_mbs The throughput of the linking for a server (MB/s)\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_linking_mbs gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -4396,35 +5652,35 @@ size_information(SSL* client_ssl, int client_fd)
          {
             if (backups[j] != NULL)
             {
-               data = pgmoneta_append(data, "pgmoneta_backup_linking_mbs{");
+               pgmoneta_builder_append(&data, "pgmoneta_backup_linking_mbs{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
 
                if (backups[j]->linking_elapsed_time)
                {
-                  data = pgmoneta_append_double_precision(data, (1.0 * backups[j]->backup_size / backups[j]->linking_elapsed_time) / (1e6), 4);
+                  pgmoneta_builder_append_double_precision(&data, (1.0 * backups[j]->backup_size / backups[j]->linking_elapsed_time) / (1e6), 4);
                }
                else
                {
-                  data = pgmoneta_append_int(data, 0);
+                  pgmoneta_builder_append_int(&data, 0);
                }
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_backup_linking_mbs{");
+         pgmoneta_builder_append(&data, "pgmoneta_backup_linking_mbs{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -4435,19 +5691,17 @@ size_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   if (data != NULL)
+   if (pgmoneta_builder_length(&data) > 0)
    {
-      send_chunk(client_ssl, client_fd, data);
-      metrics_cache_append(data);
-      free(data);
-      data = NULL;
+      *fragment = pgmoneta_append(*fragment, pgmoneta_builder_string(&data));
+      pgmoneta_builder_destroy(&data);
    }
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_remote_ssh_mbs The throughput of the remote_ssh for a server (MB/s)\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_remote_ssh_mbs gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_remote_ssh_mbs The throughput of the remote_ssh for a server (MB/s)\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_remote_ssh_mbs gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -4462,35 +5716,35 @@ size_information(SSL* client_ssl, int client_fd)
          {
             if (backups[j] != NULL)
             {
-               data = pgmoneta_append(data, "pgmoneta_backup_remote_ssh_mbs{");
+               pgmoneta_builder_append(&data, "pgmoneta_backup_remote_ssh_mbs{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
 
                if (backups[j]->remote_ssh_elapsed_time)
                {
-                  data = pgmoneta_append_double_precision(data, (1.0 * backups[j]->backup_size / backups[j]->remote_ssh_elapsed_time) / (1e6), 4);
+                  pgmoneta_builder_append_double_precision(&data, (1.0 * backups[j]->backup_size / backups[j]->remote_ssh_elapsed_time) / (1e6), 4);
                }
                else
                {
-                  data = pgmoneta_append_int(data, 0);
+                  pgmoneta_builder_append_int(&data, 0);
                }
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_backup_remote_ssh_mbs{");
+         pgmoneta_builder_append(&data, "pgmoneta_backup_remote_ssh_mbs{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -4501,19 +5755,17 @@ size_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   if (data != NULL)
+   if (pgmoneta_builder_length(&data) > 0)
    {
-      send_chunk(client_ssl, client_fd, data);
-      metrics_cache_append(data);
-      free(data);
-      data = NULL;
+      *fragment = pgmoneta_append(*fragment, pgmoneta_builder_string(&data));
+      pgmoneta_builder_destroy(&data);
    }
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_remote_s3_mbs The throughput of the remote_s3 for a server (MB/s)\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_remote_s3_mbs gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_remote_s3_mbs The throughput of the remote_s3 for a server (MB/s)\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_remote_s3_mbs gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -4528,35 +5780,35 @@ size_information(SSL* client_ssl, int client_fd)
          {
             if (backups[j] != NULL)
             {
-               data = pgmoneta_append(data, "pgmoneta_backup_remote_s3_mbs{");
+               pgmoneta_builder_append(&data, "pgmoneta_backup_remote_s3_mbs{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
 
                if (backups[j]->remote_s3_elapsed_time)
                {
-                  data = pgmoneta_append_double_precision(data, (1.0 * backups[j]->backup_size / backups[j]->remote_s3_elapsed_time) / (1e6), 4);
+                  pgmoneta_builder_append_double_precision(&data, (1.0 * backups[j]->backup_size / backups[j]->remote_s3_elapsed_time) / (1e6), 4);
                }
                else
                {
-                  data = pgmoneta_append_int(data, 0);
+                  pgmoneta_builder_append_int(&data, 0);
                }
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_backup_remote_s3_mbs{");
+         pgmoneta_builder_append(&data, "pgmoneta_backup_remote_s3_mbs{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -4567,19 +5819,17 @@ size_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   if (data != NULL)
+   if (pgmoneta_builder_length(&data) > 0)
    {
-      send_chunk(client_ssl, client_fd, data);
-      metrics_cache_append(data);
-      free(data);
-      data = NULL;
+      *fragment = pgmoneta_append(*fragment, pgmoneta_builder_string(&data));
+      pgmoneta_builder_destroy(&data);
    }
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_remote_azure_mbs The throughput of the remote_azure for a server (MB/s)\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_remote_azure_mbs gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_remote_azure_mbs The throughput of the remote_azure for a server (MB/s)\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_remote_azure_mbs gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -4594,35 +5844,35 @@ size_information(SSL* client_ssl, int client_fd)
          {
             if (backups[j] != NULL)
             {
-               data = pgmoneta_append(data, "pgmoneta_backup_remote_azure_mbs{");
+               pgmoneta_builder_append(&data, "pgmoneta_backup_remote_azure_mbs{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
 
                if (backups[j]->remote_azure_elapsed_time)
                {
-                  data = pgmoneta_append_double_precision(data, (1.0 * backups[j]->backup_size / backups[j]->remote_azure_elapsed_time) / (1e6), 4);
+                  pgmoneta_builder_append_double_precision(&data, (1.0 * backups[j]->backup_size / backups[j]->remote_azure_elapsed_time) / (1e6), 4);
                }
                else
                {
-                  data = pgmoneta_append_int(data, 0);
+                  pgmoneta_builder_append_int(&data, 0);
                }
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_backup_remote_azure_mbs{");
+         pgmoneta_builder_append(&data, "pgmoneta_backup_remote_azure_mbs{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -4633,19 +5883,17 @@ size_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   if (data != NULL)
+   if (pgmoneta_builder_length(&data) > 0)
    {
-      send_chunk(client_ssl, client_fd, data);
-      metrics_cache_append(data);
-      free(data);
-      data = NULL;
+      *fragment = pgmoneta_append(*fragment, pgmoneta_builder_string(&data));
+      pgmoneta_builder_destroy(&data);
    }
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_retain Retain backup for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_retain gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_retain Retain backup for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_retain gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
@@ -4660,29 +5908,29 @@ size_information(SSL* client_ssl, int client_fd)
          {
             if (backups[j] != NULL)
             {
-               data = pgmoneta_append(data, "pgmoneta_backup_retain{");
+               pgmoneta_builder_append(&data, "pgmoneta_backup_retain{");
 
-               data = pgmoneta_append(data, "name=\"");
-               data = pgmoneta_append(data, config->common.servers[i].name);
-               data = pgmoneta_append(data, "\",label=\"");
-               data = pgmoneta_append(data, backups[j]->label);
-               data = pgmoneta_append(data, "\"} ");
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
 
-               data = pgmoneta_append_bool(data, backups[j]->keep);
+               pgmoneta_builder_append_bool(&data, backups[j]->keep);
 
-               data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
             }
          }
       }
       else
       {
-         data = pgmoneta_append(data, "pgmoneta_backup_retain{");
+         pgmoneta_builder_append(&data, "pgmoneta_backup_retain{");
 
-         data = pgmoneta_append(data, "name=\"");
-         data = pgmoneta_append(data, config->common.servers[i].name);
-         data = pgmoneta_append(data, "\",label=\"0\"} 0");
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-         data = pgmoneta_append(data, "\n");
+         pgmoneta_builder_append(&data, "\n");
       }
 
       for (int j = 0; j < number_of_backups; j++)
@@ -4693,287 +5941,1094 @@ size_information(SSL* client_ssl, int client_fd)
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
-
-   if (data != NULL)
-   {
-      send_chunk(client_ssl, client_fd, data);
-      metrics_cache_append(data);
-      free(data);
-      data = NULL;
-   }
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_backup_total_size The total size of the backups for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_backup_total_size gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_scrub_time The time of the last scrub of a backup for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_scrub_time gauge\n");
+   for (int i = first; i < last; i++)
    {
       d = pgmoneta_get_server_backup(i);
 
-      size = pgmoneta_directory_size(d);
+      number_of_backups = 0;
+      backups = NULL;
 
-      data = pgmoneta_append(data, "pgmoneta_backup_total_size{");
+      pgmoneta_get_backups(d, &number_of_backups, &backups);
 
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"} ");
+      if (number_of_backups > 0)
+      {
+         for (int j = 0; j < number_of_backups; j++)
+         {
+            if (backups[j] != NULL)
+            {
+               pgmoneta_builder_append(&data, "pgmoneta_backup_scrub_time{");
 
-      data = pgmoneta_append_ulong(data, size);
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
 
-      data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append_ulong(&data, backups[j]->scrub_time);
 
-      free(d);
-   }
-   data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append(&data, "\n");
+            }
+         }
+      }
+      else
+      {
+         pgmoneta_builder_append(&data, "pgmoneta_backup_scrub_time{");
 
-   if (data != NULL)
-   {
-      send_chunk(client_ssl, client_fd, data);
-      metrics_cache_append(data);
-      free(data);
-      data = NULL;
-   }
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_wal_total_size The total size of the WAL for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_wal_total_size gauge\n");
-   for (int i = 0; i < config->common.number_of_servers; i++)
-   {
-      d = pgmoneta_get_server_wal(i);
+         pgmoneta_builder_append(&data, "\n");
+      }
 
-      size = pgmoneta_directory_size(d);
+      for (int j = 0; j < number_of_backups; j++)
+      {
+         free(backups[j]);
+      }
+      free(backups);
 
       free(d);
+   }
+   pgmoneta_builder_append(&data, "\n");
 
-      d = pgmoneta_get_server_wal_shipping_wal(i);
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_scrub_failed The number of files that failed the last scrub of a backup for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_scrub_failed gauge\n");
+   for (int i = first; i < last; i++)
+   {
+      d = pgmoneta_get_server_backup(i);
 
-      if (d != NULL)
+      number_of_backups = 0;
+      backups = NULL;
+
+      pgmoneta_get_backups(d, &number_of_backups, &backups);
+
+      if (number_of_backups > 0)
+      {
+         for (int j = 0; j < number_of_backups; j++)
+         {
+            if (backups[j] != NULL)
+            {
+               pgmoneta_builder_append(&data, "pgmoneta_backup_scrub_failed{");
+
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
+
+               pgmoneta_builder_append_ulong(&data, backups[j]->scrub_failed);
+
+               pgmoneta_builder_append(&data, "\n");
+            }
+         }
+      }
+      else
       {
+         pgmoneta_builder_append(&data, "pgmoneta_backup_scrub_failed{");
+
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
 
-         size += pgmoneta_directory_size(d);
+         pgmoneta_builder_append(&data, "\n");
       }
 
-      data = pgmoneta_append(data, "pgmoneta_wal_total_size{");
+      for (int j = 0; j < number_of_backups; j++)
+      {
+         free(backups[j]);
+      }
+      free(backups);
+
+      free(d);
+   }
+   pgmoneta_builder_append(&data, "\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_checksum_failed The number of pages that failed checksum verification during a backup for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_checksum_failed gauge\n");
+   for (int i = first; i < last; i++)
+   {
+      d = pgmoneta_get_server_backup(i);
 
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"} ");
+      number_of_backups = 0;
+      backups = NULL;
+
+      pgmoneta_get_backups(d, &number_of_backups, &backups);
+
+      if (number_of_backups > 0)
+      {
+         for (int j = 0; j < number_of_backups; j++)
+         {
+            if (backups[j] != NULL)
+            {
+               pgmoneta_builder_append(&data, "pgmoneta_backup_checksum_failed{");
 
-      data = pgmoneta_append_ulong(data, size);
+               pgmoneta_builder_append(&data, "name=\"");
+               pgmoneta_builder_append(&data, config->common.servers[i].name);
+               pgmoneta_builder_append(&data, "\",label=\"");
+               pgmoneta_builder_append(&data, backups[j]->label);
+               pgmoneta_builder_append(&data, "\"} ");
 
-      data = pgmoneta_append(data, "\n");
+               pgmoneta_builder_append_ulong(&data, backups[j]->checksum_failed);
+
+               pgmoneta_builder_append(&data, "\n");
+            }
+         }
+      }
+      else
+      {
+         pgmoneta_builder_append(&data, "pgmoneta_backup_checksum_failed{");
+
+         pgmoneta_builder_append(&data, "name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",label=\"0\"} 0");
+
+         pgmoneta_builder_append(&data, "\n");
+      }
+
+      for (int j = 0; j < number_of_backups; j++)
+      {
+         free(backups[j]);
+      }
+      free(backups);
 
       free(d);
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   if (data != NULL)
+   if (pgmoneta_builder_length(&data) > 0)
    {
-      send_chunk(client_ssl, client_fd, data);
-      metrics_cache_append(data);
-      free(data);
-      data = NULL;
+      *fragment = pgmoneta_append(*fragment, pgmoneta_builder_string(&data));
+      pgmoneta_builder_destroy(&data);
    }
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_total_size The total size for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_total_size gauge\n");
+}
+
+static void
+size_information(struct builder* body)
+{
+   unsigned long size;
+   struct builder data = {0};
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_backup_total_size The total size of the backups for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_backup_total_size gauge\n");
    for (int i = 0; i < config->common.number_of_servers; i++)
    {
-      d = pgmoneta_get_server(i);
+      size = pgmoneta_storage_size(i, STORAGE_BACKUP);
 
-      size = pgmoneta_directory_size(d);
+      pgmoneta_builder_append(&data, "pgmoneta_backup_total_size{");
 
-      free(d);
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
 
-      d = pgmoneta_get_server_wal_shipping(i);
+      pgmoneta_builder_append_ulong(&data, size);
 
-      if (d != NULL)
-      {
-         size += pgmoneta_directory_size(d);
-      }
+      pgmoneta_builder_append(&data, "\n");
+   }
+   pgmoneta_builder_append(&data, "\n");
 
-      data = pgmoneta_append(data, "pgmoneta_total_size{");
+   if (pgmoneta_builder_length(&data) > 0)
+   {
+      pgmoneta_builder_append(body, pgmoneta_builder_string(&data));
+      pgmoneta_builder_destroy(&data);
+   }
 
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"} ");
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_wal_total_size The total size of the WAL for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_wal_total_size gauge\n");
+   for (int i = 0; i < config->common.number_of_servers; i++)
+   {
+      size = pgmoneta_storage_size(i, STORAGE_WAL);
+      size += pgmoneta_storage_size(i, STORAGE_WAL_SHIPPING_WAL);
 
-      data = pgmoneta_append_ulong(data, size);
+      pgmoneta_builder_append(&data, "pgmoneta_wal_total_size{");
 
-      data = pgmoneta_append(data, "\n");
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
 
-      free(d);
+      pgmoneta_builder_append_ulong(&data, size);
+
+      pgmoneta_builder_append(&data, "\n");
+   }
+   pgmoneta_builder_append(&data, "\n");
+
+   if (pgmoneta_builder_length(&data) > 0)
+   {
+      pgmoneta_builder_append(body, pgmoneta_builder_string(&data));
+      pgmoneta_builder_destroy(&data);
+   }
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_total_size The total size for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_total_size gauge\n");
+   for (int i = 0; i < config->common.number_of_servers; i++)
+   {
+      size = pgmoneta_storage_size(i, STORAGE_SERVER);
+      size += pgmoneta_storage_size(i, STORAGE_WAL_SHIPPING);
+
+      pgmoneta_builder_append(&data, "pgmoneta_total_size{");
+
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
+
+      pgmoneta_builder_append_ulong(&data, size);
+
+      pgmoneta_builder_append(&data, "\n");
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_active_backup Is there an active backup for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_active_backup gauge\n");
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_active_backup Is there an active backup for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_active_backup gauge\n");
 
    for (int i = 0; i < config->common.number_of_servers; i++)
    {
-      data = pgmoneta_append(data, "pgmoneta_active_backup{");
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"} ");
+      pgmoneta_builder_append(&data, "pgmoneta_active_backup{");
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
 
       if (config->common.servers[i].active_backup)
       {
-         data = pgmoneta_append_int(data, 1);
+         pgmoneta_builder_append_int(&data, 1);
       }
       else
       {
-         data = pgmoneta_append_int(data, 0);
+         pgmoneta_builder_append_int(&data, 0);
       }
-      data = pgmoneta_append(data, "\n");
+      pgmoneta_builder_append(&data, "\n");
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_active_restore Is there an active restore for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_active_restore gauge\n");
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_active_restore Is there an active restore for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_active_restore gauge\n");
 
    for (int i = 0; i < config->common.number_of_servers; i++)
    {
-      data = pgmoneta_append(data, "pgmoneta_active_restore{");
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"} ");
+      pgmoneta_builder_append(&data, "pgmoneta_active_restore{");
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
 
       if (config->common.servers[i].active_restore)
       {
-         data = pgmoneta_append_int(data, 1);
+         pgmoneta_builder_append_int(&data, 1);
       }
       else
       {
-         data = pgmoneta_append_int(data, 0);
+         pgmoneta_builder_append_int(&data, 0);
       }
 
-      data = pgmoneta_append(data, "\n");
+      pgmoneta_builder_append(&data, "\n");
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_active_archive Is there an active archiving for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_active_archive gauge\n");
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_active_archive Is there an active archiving for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_active_archive gauge\n");
 
    for (int i = 0; i < config->common.number_of_servers; i++)
    {
-      data = pgmoneta_append(data, "pgmoneta_active_archive{");
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"} ");
+      pgmoneta_builder_append(&data, "pgmoneta_active_archive{");
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
 
       if (config->common.servers[i].active_archive)
       {
-         data = pgmoneta_append_int(data, 1);
+         pgmoneta_builder_append_int(&data, 1);
       }
       else
       {
-         data = pgmoneta_append_int(data, 0);
+         pgmoneta_builder_append_int(&data, 0);
       }
 
-      data = pgmoneta_append(data, "\n");
+      pgmoneta_builder_append(&data, "\n");
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_active_delete Is there an active delete for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_active_delete gauge\n");
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_active_delete Is there an active delete for a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_active_delete gauge\n");
 
    for (int i = 0; i < config->common.number_of_servers; i++)
    {
-      data = pgmoneta_append(data, "pgmoneta_active_delete{");
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"} ");
+      pgmoneta_builder_append(&data, "pgmoneta_active_delete{");
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
 
       if (config->common.servers[i].active_delete)
       {
-         data = pgmoneta_append_int(data, 1);
+         pgmoneta_builder_append_int(&data, 1);
       }
       else
       {
-         data = pgmoneta_append_int(data, 0);
+         pgmoneta_builder_append_int(&data, 0);
       }
 
-      data = pgmoneta_append(data, "\n");
+      pgmoneta_builder_append(&data, "\n");
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_active_retention Is there an "
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_active_retention Is there an "
                           "active archiving for a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_active_retention gauge\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_active_retention gauge\n");
 
    for (int i = 0; i < config->common.number_of_servers; i++)
    {
-      data = pgmoneta_append(data, "pgmoneta_active_retention{");
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\"} ");
+      pgmoneta_builder_append(&data, "pgmoneta_active_retention{");
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
 
       if (config->common.servers[i].active_retention)
       {
-         data = pgmoneta_append_int(data, 1);
+         pgmoneta_builder_append_int(&data, 1);
       }
       else
       {
-         data = pgmoneta_append_int(data, 0);
+         pgmoneta_builder_append_int(&data, 0);
       }
 
-      data = pgmoneta_append(data, "\n");
+      pgmoneta_builder_append(&data, "\n");
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   data = pgmoneta_append(data, "#HELP pgmoneta_current_wal_file The current streaming WAL filename of a server\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_current_wal_file gauge\n");
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_current_wal_file The current streaming WAL filename of a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_current_wal_file gauge\n");
    for (int i = 0; i < config->common.number_of_servers; i++)
    {
-      data = pgmoneta_append(data, "pgmoneta_current_wal_file{");
+      pgmoneta_builder_append(&data, "pgmoneta_current_wal_file{");
 
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\", ");
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\", ");
 
-      data = pgmoneta_append(data, "file=\"");
-      data = pgmoneta_append(data, config->common.servers[i].current_wal_filename);
-      data = pgmoneta_append(data, "\"} ");
+      pgmoneta_builder_append(&data, "file=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].current_wal_filename);
+      pgmoneta_builder_append(&data, "\"} ");
 
-      data = pgmoneta_append_bool(data, config->common.servers[i].wal_streaming);
+      pgmoneta_builder_append_bool(&data, config->common.servers[i].wal_streaming);
 
-      data = pgmoneta_append(data, "\n");
+      pgmoneta_builder_append(&data, "\n");
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
    // Append the WAL LSN of every server
-   data = pgmoneta_append(data, "#HELP pgmoneta_current_wal_lsn The current WAL log sequence number\n");
-   data = pgmoneta_append(data, "#TYPE pgmoneta_current_wal_lsn gauge\n");
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_current_wal_lsn The current WAL log sequence number\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_current_wal_lsn gauge\n");
    for (int i = 0; i < config->common.number_of_servers; i++)
    {
-      data = pgmoneta_append(data, "pgmoneta_current_wal_lsn{");
+      pgmoneta_builder_append(&data, "pgmoneta_current_wal_lsn{");
 
-      data = pgmoneta_append(data, "name=\"");
-      data = pgmoneta_append(data, config->common.servers[i].name);
-      data = pgmoneta_append(data, "\", ");
+      pgmoneta_builder_append(&data, "name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\", ");
 
-      data = pgmoneta_append(data, "lsn=\"");
+      pgmoneta_builder_append(&data, "lsn=\"");
       if (!strcmp(config->common.servers[i].current_wal_lsn, ""))
       {
-         data = pgmoneta_append(data, "0/0");
+         pgmoneta_builder_append(&data, "0/0");
       }
       else
       {
-         data = pgmoneta_append(data, config->common.servers[i].current_wal_lsn);
+         pgmoneta_builder_append(&data, config->common.servers[i].current_wal_lsn);
       }
-      data = pgmoneta_append(data, "\"} ");
+      pgmoneta_builder_append(&data, "\"} ");
 
-      data = pgmoneta_append_bool(data, config->common.servers[i].wal_streaming);
+      pgmoneta_builder_append_bool(&data, config->common.servers[i].wal_streaming);
 
-      data = pgmoneta_append(data, "\n");
+      pgmoneta_builder_append(&data, "\n");
    }
-   data = pgmoneta_append(data, "\n");
+   pgmoneta_builder_append(&data, "\n");
 
-   if (data != NULL)
+   if (pgmoneta_builder_length(&data) > 0)
    {
-      send_chunk(client_ssl, client_fd, data);
-      metrics_cache_append(data);
-      free(data);
-      data = NULL;
+      pgmoneta_builder_append(body, pgmoneta_builder_string(&data));
+      pgmoneta_builder_destroy(&data);
+   }
+}
+
+static void
+workers_information(struct builder* body)
+{
+   struct builder data = {0};
+   struct workers_statistics* ws = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_workers_tasks The number of worker tasks of a workflow type\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_workers_tasks counter\n");
+   for (int i = 0; i < NUMBER_OF_WORKFLOW_TYPES; i++)
+   {
+      ws = &config->common.prometheus.workers[i];
+
+      pgmoneta_builder_append(&data, "pgmoneta_workers_tasks{");
+
+      pgmoneta_builder_append(&data, "type=\"");
+      pgmoneta_builder_append(&data, workflow_type_names[i]);
+      pgmoneta_builder_append(&data, "\"} ");
+
+      pgmoneta_builder_append_ulong(&data, atomic_load(&ws->tasks));
+
+      pgmoneta_builder_append(&data, "\n");
+   }
+   pgmoneta_builder_append(&data, "\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_workers_bytes The number of bytes processed by the worker tasks of a workflow type\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_workers_bytes counter\n");
+   for (int i = 0; i < NUMBER_OF_WORKFLOW_TYPES; i++)
+   {
+      ws = &config->common.prometheus.workers[i];
+
+      pgmoneta_builder_append(&data, "pgmoneta_workers_bytes{");
+
+      pgmoneta_builder_append(&data, "type=\"");
+      pgmoneta_builder_append(&data, workflow_type_names[i]);
+      pgmoneta_builder_append(&data, "\"} ");
+
+      pgmoneta_builder_append_ulong(&data, atomic_load(&ws->bytes));
+
+      pgmoneta_builder_append(&data, "\n");
+   }
+   pgmoneta_builder_append(&data, "\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_workers_busy_ratio The fraction of the time the workers of a workflow type were running a task\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_workers_busy_ratio gauge\n");
+   for (int i = 0; i < NUMBER_OF_WORKFLOW_TYPES; i++)
+   {
+      unsigned long available;
+
+      ws = &config->common.prometheus.workers[i];
+      available = atomic_load(&ws->available);
+
+      pgmoneta_builder_append(&data, "pgmoneta_workers_busy_ratio{");
+
+      pgmoneta_builder_append(&data, "type=\"");
+      pgmoneta_builder_append(&data, workflow_type_names[i]);
+      pgmoneta_builder_append(&data, "\"} ");
+
+      pgmoneta_builder_append_double_precision(&data, available > 0 ? (double)atomic_load(&ws->busy) / (double)available : 0.0, 4);
+
+      pgmoneta_builder_append(&data, "\n");
+   }
+   pgmoneta_builder_append(&data, "\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_workers_task_wait_seconds The time worker tasks of a workflow type were queued\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_workers_task_wait_seconds histogram\n");
+   for (int i = 0; i < NUMBER_OF_WORKFLOW_TYPES; i++)
+   {
+      ws = &config->common.prometheus.workers[i];
+      workers_histogram(&data, "pgmoneta_workers_task_wait_seconds", i, &ws->wait_histogram[0], atomic_load(&ws->wait));
+   }
+   pgmoneta_builder_append(&data, "\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_workers_task_execute_seconds The time worker tasks of a workflow type were running\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_workers_task_execute_seconds histogram\n");
+   for (int i = 0; i < NUMBER_OF_WORKFLOW_TYPES; i++)
+   {
+      ws = &config->common.prometheus.workers[i];
+      workers_histogram(&data, "pgmoneta_workers_task_execute_seconds", i, &ws->execute_histogram[0], atomic_load(&ws->execute));
+   }
+   pgmoneta_builder_append(&data, "\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_copy_files The number of files copied with a copy method\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_copy_files counter\n");
+   for (int i = 0; i < NUMBER_OF_COPY_METHODS; i++)
+   {
+      pgmoneta_builder_append(&data, "pgmoneta_copy_files{");
+
+      pgmoneta_builder_append(&data, "method=\"");
+      pgmoneta_builder_append(&data, copy_method_names[i]);
+      pgmoneta_builder_append(&data, "\"} ");
+
+      pgmoneta_builder_append_ulong(&data, atomic_load(&config->common.prometheus.copy_files[i]));
+
+      pgmoneta_builder_append(&data, "\n");
+   }
+   pgmoneta_builder_append(&data, "\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_copy_bytes The number of bytes copied with a copy method\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_copy_bytes counter\n");
+   for (int i = 0; i < NUMBER_OF_COPY_METHODS; i++)
+   {
+      pgmoneta_builder_append(&data, "pgmoneta_copy_bytes{");
+
+      pgmoneta_builder_append(&data, "method=\"");
+      pgmoneta_builder_append(&data, copy_method_names[i]);
+      pgmoneta_builder_append(&data, "\"} ");
+
+      pgmoneta_builder_append_ulong(&data, atomic_load(&config->common.prometheus.copy_bytes[i]));
+
+      pgmoneta_builder_append(&data, "\n");
+   }
+   pgmoneta_builder_append(&data, "\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_upload_bytes The number of bytes uploaded by a storage engine\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_upload_bytes counter\n");
+   for (int i = 0; i < NUMBER_OF_UPLOAD_ENGINES; i++)
+   {
+      pgmoneta_builder_append(&data, "pgmoneta_upload_bytes{");
+
+      pgmoneta_builder_append(&data, "engine=\"");
+      pgmoneta_builder_append(&data, upload_engine_names[i]);
+      pgmoneta_builder_append(&data, "\"} ");
+
+      pgmoneta_builder_append_ulong(&data, atomic_load(&config->common.prometheus.upload_bytes[i]));
+
+      pgmoneta_builder_append(&data, "\n");
+   }
+   pgmoneta_builder_append(&data, "\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_upload_seconds The time a storage engine spent uploading\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_upload_seconds counter\n");
+   for (int i = 0; i < NUMBER_OF_UPLOAD_ENGINES; i++)
+   {
+      pgmoneta_builder_append(&data, "pgmoneta_upload_seconds{");
+
+      pgmoneta_builder_append(&data, "engine=\"");
+      pgmoneta_builder_append(&data, upload_engine_names[i]);
+      pgmoneta_builder_append(&data, "\"} ");
+
+      pgmoneta_builder_append_double_precision(&data, atomic_load(&config->common.prometheus.upload_time[i]) / 1000.0, 3);
+
+      pgmoneta_builder_append(&data, "\n");
+   }
+   pgmoneta_builder_append(&data, "\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_wal_cache_hits The number of WAL segments taken from the WAL cache\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_wal_cache_hits counter\n");
+   pgmoneta_builder_append(&data, "pgmoneta_wal_cache_hits ");
+   pgmoneta_builder_append_ulong(&data, atomic_load(&config->common.prometheus.wal_cache_hits));
+   pgmoneta_builder_append(&data, "\n\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_wal_cache_misses The number of WAL segments decoded since they were not in the WAL cache\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_wal_cache_misses counter\n");
+   pgmoneta_builder_append(&data, "pgmoneta_wal_cache_misses ");
+   pgmoneta_builder_append_ulong(&data, atomic_load(&config->common.prometheus.wal_cache_misses));
+   pgmoneta_builder_append(&data, "\n\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_memory_bytes The memory held by the running workflows of a workflow type\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_memory_bytes gauge\n");
+   for (int i = 0; i < NUMBER_OF_WORKFLOW_TYPES; i++)
+   {
+      pgmoneta_builder_append(&data, "pgmoneta_memory_bytes{");
+
+      pgmoneta_builder_append(&data, "type=\"");
+      pgmoneta_builder_append(&data, workflow_type_names[i]);
+      pgmoneta_builder_append(&data, "\"} ");
+
+      pgmoneta_builder_append_ulong(&data, atomic_load(&config->common.prometheus.memory_bytes[i]));
+
+      pgmoneta_builder_append(&data, "\n");
+   }
+   pgmoneta_builder_append(&data, "\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_memory_peak_bytes The most memory held by a workflow of a workflow type\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_memory_peak_bytes gauge\n");
+   for (int i = 0; i < NUMBER_OF_WORKFLOW_TYPES; i++)
+   {
+      pgmoneta_builder_append(&data, "pgmoneta_memory_peak_bytes{");
+
+      pgmoneta_builder_append(&data, "type=\"");
+      pgmoneta_builder_append(&data, workflow_type_names[i]);
+      pgmoneta_builder_append(&data, "\"} ");
+
+      pgmoneta_builder_append_ulong(&data, atomic_load(&config->common.prometheus.memory_peak_bytes[i]));
+
+      pgmoneta_builder_append(&data, "\n");
+   }
+   pgmoneta_builder_append(&data, "\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_memory_budget_exceeded The number of times a workflow of a workflow type went above the memory budget\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_memory_budget_exceeded counter\n");
+   for (int i = 0; i < NUMBER_OF_WORKFLOW_TYPES; i++)
+   {
+      pgmoneta_builder_append(&data, "pgmoneta_memory_budget_exceeded{");
+
+      pgmoneta_builder_append(&data, "type=\"");
+      pgmoneta_builder_append(&data, workflow_type_names[i]);
+      pgmoneta_builder_append(&data, "\"} ");
+
+      pgmoneta_builder_append_ulong(&data, atomic_load(&config->common.prometheus.memory_budget_exceeded[i]));
+
+      pgmoneta_builder_append(&data, "\n");
    }
+   pgmoneta_builder_append(&data, "\n");
+
+   if (pgmoneta_builder_length(&data) > 0)
+   {
+      pgmoneta_builder_append(body, pgmoneta_builder_string(&data));
+      pgmoneta_builder_destroy(&data);
+   }
+}
+
+static void
+workers_histogram(struct builder* data, char* name, int type, atomic_ulong* histogram, unsigned long sum)
+{
+   unsigned long count = 0;
+
+   for (int i = 0; i < WORKERS_HISTOGRAM_BUCKETS; i++)
+   {
+      count += atomic_load(&histogram[i]);
+
+      pgmoneta_builder_append(data, name);
+      pgmoneta_builder_append(data, "_bucket{type=\"");
+      pgmoneta_builder_append(data, workflow_type_names[type]);
+      pgmoneta_builder_append(data, "\",le=\"");
+      if (i < WORKERS_HISTOGRAM_BUCKETS - 1)
+      {
+         pgmoneta_builder_append_double_precision(data, pgmoneta_workers_histogram_bound(i), 3);
+      }
+      else
+      {
+         pgmoneta_builder_append(data, "+Inf");
+      }
+      pgmoneta_builder_append(data, "\"} ");
+      pgmoneta_builder_append_ulong(data, count);
+      pgmoneta_builder_append(data, "\n");
+   }
+
+   pgmoneta_builder_append(data, name);
+   pgmoneta_builder_append(data, "_sum{type=\"");
+   pgmoneta_builder_append(data, workflow_type_names[type]);
+   pgmoneta_builder_append(data, "\"} ");
+   pgmoneta_builder_append_double_precision(data, (double)sum / 1000000.0, 6);
+   pgmoneta_builder_append(data, "\n");
+
+   pgmoneta_builder_append(data, name);
+   pgmoneta_builder_append(data, "_count{type=\"");
+   pgmoneta_builder_append(data, workflow_type_names[type]);
+   pgmoneta_builder_append(data, "\"} ");
+   pgmoneta_builder_append_ulong(data, count);
+   pgmoneta_builder_append(data, "\n");
+}
+
+static void
+histogram_information(struct builder* body)
+{
+   struct builder data = {0};
+   char* labels = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_wal_operation_seconds The latency of WAL writes, syncs and segment closes\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_wal_operation_seconds histogram\n");
+   for (int i = 0; i < config->common.number_of_servers; i++)
+   {
+      for (int j = 0; j < NUMBER_OF_WAL_PHASES; j++)
+      {
+         labels = pgmoneta_append(labels, "name=\"");
+         labels = pgmoneta_append(labels, config->common.servers[i].name);
+         labels = pgmoneta_append(labels, "\",phase=\"");
+         labels = pgmoneta_append(labels, wal_phase_names[j]);
+         labels = pgmoneta_append(labels, "\"");
+
+         histogram_append(&data, "pgmoneta_wal_operation_seconds", labels,
+                                 &config->common.prometheus.wal[i][j], wal_bounds, 1000000.0, 6);
+
+         free(labels);
+         labels = NULL;
+      }
+   }
+   pgmoneta_builder_append(&data, "\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_file_operation_seconds The time to compress, decompress, encrypt or decrypt a file\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_file_operation_seconds histogram\n");
+   for (int i = 0; i < NUMBER_OF_FILE_OPERATIONS; i++)
+   {
+      labels = pgmoneta_append(labels, "operation=\"");
+      labels = pgmoneta_append(labels, file_operation_names[i]);
+      labels = pgmoneta_append(labels, "\"");
+
+      histogram_append(&data, "pgmoneta_file_operation_seconds", labels,
+                              &config->common.prometheus.file[i], file_bounds, 1000000.0, 3);
+
+      free(labels);
+      labels = NULL;
+   }
+   pgmoneta_builder_append(&data, "\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_restore_throughput_bytes_per_second The throughput of the restore phases\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_restore_throughput_bytes_per_second histogram\n");
+   for (int i = 0; i < NUMBER_OF_RESTORE_PHASES; i++)
+   {
+      labels = pgmoneta_append(labels, "phase=\"");
+      labels = pgmoneta_append(labels, restore_phase_names[i]);
+      labels = pgmoneta_append(labels, "\"");
+
+      histogram_append(&data, "pgmoneta_restore_throughput_bytes_per_second", labels,
+                              &config->common.prometheus.restore[i], restore_bounds, 1.0, 0);
+
+      free(labels);
+      labels = NULL;
+   }
+   pgmoneta_builder_append(&data, "\n");
+
+   if (pgmoneta_builder_length(&data) > 0)
+   {
+      pgmoneta_builder_append(body, pgmoneta_builder_string(&data));
+      pgmoneta_builder_destroy(&data);
+   }
+}
+
+static void
+wal_ingest_information(struct builder* body)
+{
+   struct builder data = {0};
+   struct prometheus_wal_ingest* ingest;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_wal_lsn The WAL position received, flushed and reported to a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_wal_lsn gauge\n");
+   for (int i = 0; i < config->common.number_of_servers; i++)
+   {
+      ingest = &config->common.prometheus.wal_ingest[i];
+
+      pgmoneta_builder_append(&data, "pgmoneta_wal_lsn{name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\",type=\"received\"} ");
+      pgmoneta_builder_append_ulong(&data, atomic_load(&ingest->received_lsn));
+      pgmoneta_builder_append(&data, "\n");
+
+      pgmoneta_builder_append(&data, "pgmoneta_wal_lsn{name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\",type=\"flushed\"} ");
+      pgmoneta_builder_append_ulong(&data, atomic_load(&ingest->flushed_lsn));
+      pgmoneta_builder_append(&data, "\n");
+
+      pgmoneta_builder_append(&data, "pgmoneta_wal_lsn{name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\",type=\"reported\"} ");
+      pgmoneta_builder_append_ulong(&data, atomic_load(&ingest->reported_lsn));
+      pgmoneta_builder_append(&data, "\n");
+   }
+   pgmoneta_builder_append(&data, "\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_wal_received_bytes The number of WAL bytes received from a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_wal_received_bytes counter\n");
+   for (int i = 0; i < config->common.number_of_servers; i++)
+   {
+      pgmoneta_builder_append(&data, "pgmoneta_wal_received_bytes{name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
+      pgmoneta_builder_append_ulong(&data, atomic_load(&config->common.prometheus.wal_ingest[i].received_bytes));
+      pgmoneta_builder_append(&data, "\n");
+   }
+   pgmoneta_builder_append(&data, "\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_wal_received_bytes_per_second The WAL bytes per second received from a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_wal_received_bytes_per_second gauge\n");
+   for (int i = 0; i < config->common.number_of_servers; i++)
+   {
+      pgmoneta_builder_append(&data, "pgmoneta_wal_received_bytes_per_second{name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
+      pgmoneta_builder_append_ulong(&data, config->common.servers[i].wal_streaming ? atomic_load(&config->common.prometheus.wal_ingest[i].throughput) : 0);
+      pgmoneta_builder_append(&data, "\n");
+   }
+   pgmoneta_builder_append(&data, "\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_wal_write_lag_seconds The time between receipt and write of the last WAL message from a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_wal_write_lag_seconds gauge\n");
+   for (int i = 0; i < config->common.number_of_servers; i++)
+   {
+      pgmoneta_builder_append(&data, "pgmoneta_wal_write_lag_seconds{name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
+      pgmoneta_builder_append_double_precision(&data, atomic_load(&config->common.prometheus.wal_ingest[i].write_lag) / 1000000.0, 6);
+      pgmoneta_builder_append(&data, "\n");
+   }
+   pgmoneta_builder_append(&data, "\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_wal_flush_lag_seconds The time between receipt and durable flush of the last flushed WAL from a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_wal_flush_lag_seconds gauge\n");
+   for (int i = 0; i < config->common.number_of_servers; i++)
+   {
+      pgmoneta_builder_append(&data, "pgmoneta_wal_flush_lag_seconds{name=\"");
+      pgmoneta_builder_append(&data, config->common.servers[i].name);
+      pgmoneta_builder_append(&data, "\"} ");
+      pgmoneta_builder_append_double_precision(&data, atomic_load(&config->common.prometheus.wal_ingest[i].flush_lag) / 1000000.0, 6);
+      pgmoneta_builder_append(&data, "\n");
+   }
+   pgmoneta_builder_append(&data, "\n");
+
+   if (pgmoneta_builder_length(&data) > 0)
+   {
+      pgmoneta_builder_append(body, pgmoneta_builder_string(&data));
+      pgmoneta_builder_destroy(&data);
+   }
+}
+
+static void
+socket_information(struct builder* body)
+{
+   struct builder data = {0};
+   char* types[NUMBER_OF_SOCKET_TYPES] = {"wal", "backup"};
+   struct prometheus_socket* s;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_socket_rtt_seconds The smoothed round trip time of the last connection to a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_socket_rtt_seconds gauge\n");
+   for (int i = 0; i < config->common.number_of_servers; i++)
+   {
+      for (int j = 0; j < NUMBER_OF_SOCKET_TYPES; j++)
+      {
+         s = &config->common.prometheus.socket[i][j];
+
+         pgmoneta_builder_append(&data, "pgmoneta_socket_rtt_seconds{name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",type=\"");
+         pgmoneta_builder_append(&data, types[j]);
+         pgmoneta_builder_append(&data, "\"} ");
+         pgmoneta_builder_append_double_precision(&data, atomic_load(&s->rtt) / 1000000.0, 6);
+         pgmoneta_builder_append(&data, "\n");
+      }
+   }
+   pgmoneta_builder_append(&data, "\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_socket_rtt_variance_seconds The round trip time variance of the last connection to a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_socket_rtt_variance_seconds gauge\n");
+   for (int i = 0; i < config->common.number_of_servers; i++)
+   {
+      for (int j = 0; j < NUMBER_OF_SOCKET_TYPES; j++)
+      {
+         s = &config->common.prometheus.socket[i][j];
+
+         pgmoneta_builder_append(&data, "pgmoneta_socket_rtt_variance_seconds{name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",type=\"");
+         pgmoneta_builder_append(&data, types[j]);
+         pgmoneta_builder_append(&data, "\"} ");
+         pgmoneta_builder_append_double_precision(&data, atomic_load(&s->rtt_variance) / 1000000.0, 6);
+         pgmoneta_builder_append(&data, "\n");
+      }
+   }
+   pgmoneta_builder_append(&data, "\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_socket_window_bytes The congestion and receive window of the last connection to a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_socket_window_bytes gauge\n");
+   for (int i = 0; i < config->common.number_of_servers; i++)
+   {
+      for (int j = 0; j < NUMBER_OF_SOCKET_TYPES; j++)
+      {
+         s = &config->common.prometheus.socket[i][j];
+
+         pgmoneta_builder_append(&data, "pgmoneta_socket_window_bytes{name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",type=\"");
+         pgmoneta_builder_append(&data, types[j]);
+         pgmoneta_builder_append(&data, "\",window=\"congestion\"} ");
+         pgmoneta_builder_append_ulong(&data, atomic_load(&s->congestion_window));
+         pgmoneta_builder_append(&data, "\n");
+
+         pgmoneta_builder_append(&data, "pgmoneta_socket_window_bytes{name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",type=\"");
+         pgmoneta_builder_append(&data, types[j]);
+         pgmoneta_builder_append(&data, "\",window=\"receive\"} ");
+         pgmoneta_builder_append_ulong(&data, atomic_load(&s->receive_window));
+         pgmoneta_builder_append(&data, "\n");
+      }
+   }
+   pgmoneta_builder_append(&data, "\n");
+
+   pgmoneta_builder_append(&data, "#HELP pgmoneta_socket_retransmits The number of segments retransmitted on the last connection to a server\n");
+   pgmoneta_builder_append(&data, "#TYPE pgmoneta_socket_retransmits gauge\n");
+   for (int i = 0; i < config->common.number_of_servers; i++)
+   {
+      for (int j = 0; j < NUMBER_OF_SOCKET_TYPES; j++)
+      {
+         s = &config->common.prometheus.socket[i][j];
+
+         pgmoneta_builder_append(&data, "pgmoneta_socket_retransmits{name=\"");
+         pgmoneta_builder_append(&data, config->common.servers[i].name);
+         pgmoneta_builder_append(&data, "\",type=\"");
+         pgmoneta_builder_append(&data, types[j]);
+         pgmoneta_builder_append(&data, "\"} ");
+         pgmoneta_builder_append_ulong(&data, atomic_load(&s->retransmits));
+         pgmoneta_builder_append(&data, "\n");
+      }
+   }
+   pgmoneta_builder_append(&data, "\n");
+
+   if (pgmoneta_builder_length(&data) > 0)
+   {
+      pgmoneta_builder_append(body, pgmoneta_builder_string(&data));
+      pgmoneta_builder_destroy(&data);
+   }
+}
+
+static void
+progress_information(struct builder* body)
+{
+   struct builder data = {0};
+   bool active[NUMBER_OF_SERVERS];
+   struct progress_snapshot snapshots[NUMBER_OF_SERVERS];
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   /* One snapshot per server, so the families agree with each other */
+   for (int i = 0; i < config->common.number_of_servers; i++)
+   {
+      active[i] = pgmoneta_progress_snapshot(i, &snapshots[i]);
+   }
+
+   progress_gauge(&data, "pgmoneta_progress_elapsed_seconds", "The time the running operation of a server has taken", snapshots, active, 0);
+   progress_gauge(&data, "pgmoneta_progress_bytes", "The bytes processed by the phase of the running operation of a server", snapshots, active, 1);
+   progress_gauge(&data, "pgmoneta_progress_bytes_total", "The bytes the phase of the running operation of a server is expected to process", snapshots, active, 2);
+   progress_gauge(&data, "pgmoneta_progress_files", "The files processed by the phase of the running operation of a server", snapshots, active, 3);
+   progress_gauge(&data, "pgmoneta_progress_files_total", "The files the phase of the running operation of a server is expected to process", snapshots, active, 4);
+   progress_gauge(&data, "pgmoneta_progress_throughput_bytes_per_second", "The throughput of the phase of the running operation of a server", snapshots, active, 5);
+   progress_gauge(&data, "pgmoneta_progress_remaining_seconds", "The estimated time until the phase of the running operation of a server is done", snapshots, active, 6);
+
+   if (pgmoneta_builder_length(&data) > 0)
+   {
+      pgmoneta_builder_append(body, pgmoneta_builder_string(&data));
+      pgmoneta_builder_destroy(&data);
+   }
+}
+
+static void
+progress_gauge(struct builder* data, char* name, char* help, struct progress_snapshot* snapshots, bool* active, int field)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   pgmoneta_builder_append(data, "#HELP ");
+   pgmoneta_builder_append(data, name);
+   pgmoneta_builder_append(data, " ");
+   pgmoneta_builder_append(data, help);
+   pgmoneta_builder_append(data, "\n");
+   pgmoneta_builder_append(data, "#TYPE ");
+   pgmoneta_builder_append(data, name);
+   pgmoneta_builder_append(data, " gauge\n");
+
+   for (int i = 0; i < config->common.number_of_servers; i++)
+   {
+      struct progress_snapshot* s = &snapshots[i];
+
+      if (!active[i] || (field == 6 && s->remaining < 0.0))
+      {
+         continue;
+      }
+
+      pgmoneta_builder_append(data, name);
+      pgmoneta_builder_append(data, "{name=\"");
+      pgmoneta_builder_append(data, config->common.servers[i].name);
+      pgmoneta_builder_append(data, "\",workflow=\"");
+      pgmoneta_builder_append(data, pgmoneta_progress_workflow_name(s->workflow));
+      pgmoneta_builder_append(data, "\",phase=\"");
+      pgmoneta_builder_append(data, s->phase);
+      pgmoneta_builder_append(data, "\"} ");
+
+      switch (field)
+      {
+         case 0:
+            pgmoneta_builder_append_double_precision(data, s->elapsed, 3);
+            break;
+         case 1:
+            pgmoneta_builder_append_ulong(data, s->bytes_done);
+            break;
+         case 2:
+            pgmoneta_builder_append_ulong(data, s->bytes_total);
+            break;
+         case 3:
+            pgmoneta_builder_append_ulong(data, s->files_done);
+            break;
+         case 4:
+            pgmoneta_builder_append_ulong(data, s->files_total);
+            break;
+         case 5:
+            pgmoneta_builder_append_double_precision(data, s->throughput, 0);
+            break;
+         default:
+            pgmoneta_builder_append_double_precision(data, s->remaining, 0);
+            break;
+      }
+
+      pgmoneta_builder_append(data, "\n");
+   }
+   pgmoneta_builder_append(data, "\n");
+}
+
+static void
+histogram_append(struct builder* data, char* name, char* labels, struct prometheus_histogram* histogram, const uint64_t* bounds, double scale, int precision)
+{
+   unsigned long count = 0;
+
+   for (int i = 0; i < PROMETHEUS_HISTOGRAM_BUCKETS; i++)
+   {
+      count += atomic_load(&histogram->buckets[i]);
+
+      pgmoneta_builder_append(data, name);
+      pgmoneta_builder_append(data, "_bucket{");
+      pgmoneta_builder_append(data, labels);
+      pgmoneta_builder_append(data, ",le=\"");
+      if (i < PROMETHEUS_HISTOGRAM_BUCKETS - 1)
+      {
+         pgmoneta_builder_append_double_precision(data, (double)bounds[i] / scale, precision);
+      }
+      else
+      {
+         pgmoneta_builder_append(data, "+Inf");
+      }
+      pgmoneta_builder_append(data, "\"} ");
+      pgmoneta_builder_append_ulong(data, count);
+      pgmoneta_builder_append(data, "\n");
+   }
+
+   pgmoneta_builder_append(data, name);
+   pgmoneta_builder_append(data, "_sum{");
+   pgmoneta_builder_append(data, labels);
+   pgmoneta_builder_append(data, "} ");
+   pgmoneta_builder_append_double_precision(data, (double)atomic_load(&histogram->sum) / scale, 6);
+   pgmoneta_builder_append(data, "\n");
+
+   pgmoneta_builder_append(data, name);
+   pgmoneta_builder_append(data, "_count{");
+   pgmoneta_builder_append(data, labels);
+   pgmoneta_builder_append(data, "} ");
+   pgmoneta_builder_append_ulong(data, count);
+   pgmoneta_builder_append(data, "\n");
+}
+
+static void
+histogram_observe(struct prometheus_histogram* histogram, const uint64_t* bounds, uint64_t value)
+{
+   int bucket = 0;
+
+   while (bucket < PROMETHEUS_HISTOGRAM_BUCKETS - 1 && value > bounds[bucket])
+   {
+      bucket++;
+   }
+
+   atomic_fetch_add(&histogram->buckets[bucket], 1);
+   atomic_fetch_add(&histogram->sum, value);
+}
+
+static void
+histogram_reset(struct prometheus_histogram* histogram)
+{
+   for (int i = 0; i < PROMETHEUS_HISTOGRAM_BUCKETS; i++)
+   {
+      atomic_store(&histogram->buckets[i], 0);
+   }
+
+   atomic_store(&histogram->sum, 0);
 }
 
 static int
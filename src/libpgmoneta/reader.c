@@ -0,0 +1,1032 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <aes.h>
+#include <bandwidth.h>
+#include <bzip2_compression.h>
+#include <gzip_compression.h>
+#include <logging.h>
+#include <lz4_compression.h>
+#include <memory.h>
+#include <progress.h>
+#include <reader.h>
+#include <security.h>
+#include <utils.h>
+#include <workers.h>
+#include <zstandard_compression.h>
+
+/* system */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/** @struct file_state
+ * Defines the state of the file layer
+ */
+struct file_state
+{
+   FILE* fp;         /**< The file, or NULL when it is read with O_DIRECT */
+   int fd;           /**< The O_DIRECT file descriptor */
+   char* staging;    /**< The aligned buffer of the O_DIRECT reads */
+   size_t staged;    /**< The number of bytes in the staging buffer */
+   size_t consumed;  /**< The number of bytes of the staging buffer that are consumed */
+   bool eof;         /**< Has the end of the file been read */
+   off_t position;   /**< The number of bytes read */
+   off_t prefetched; /**< The end of the range the kernel was asked to read ahead */
+   off_t dropped;    /**< The end of the range dropped from the page cache */
+};
+
+static struct reader_statistics reader_stats;
+
+/* The rate limit of the writes of this process, or NULL */
+static struct token_bucket* reader_bucket = NULL;
+
+/* The time spent in the file layer by this thread, to split reading from decoding */
+static _Thread_local uint64_t file_read_time = 0;
+
+static int file_read(struct reader* reader, void* buffer, size_t size, size_t* read);
+static int file_read_direct(struct file_state* fs, void* buffer, size_t size, size_t* read);
+static int file_open(char* path, struct reader** reader);
+static int file_open_direct(char* path, struct file_state* fs);
+static void file_close(struct reader* reader);
+static void file_prefetch(struct file_state* fs);
+static int write_back(FILE* out, off_t from, off_t to);
+static uint64_t now_microseconds(void);
+static void do_extract_file(struct worker_common* wc);
+
+int
+pgmoneta_reader_create(struct reader* source, reader_read_func read, reader_close_func close, void* state, struct reader** reader)
+{
+   struct reader* r = NULL;
+
+   *reader = NULL;
+
+   r = (struct reader*)malloc(sizeof(struct reader));
+   if (r == NULL)
+   {
+      goto error;
+   }
+
+   memset(r, 0, sizeof(struct reader));
+
+   r->read = read;
+   r->close = close;
+   r->source = source;
+   r->state = state;
+
+   *reader = r;
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+int
+pgmoneta_reader_open(char* path, struct reader** reader)
+{
+   char* name = NULL;
+   struct reader* r = NULL;
+   struct reader* layer = NULL;
+   int (*decompress)(struct reader* source, struct reader** reader) = NULL;
+
+   *reader = NULL;
+
+   if (file_open(path, &r))
+   {
+      goto error;
+   }
+
+   name = pgmoneta_append(name, path);
+
+   if (pgmoneta_is_encrypted(name))
+   {
+      char* stripped = NULL;
+
+      if (pgmoneta_decrypt_reader(path, r, &layer))
+      {
+         pgmoneta_log_error("Reader: Could not decrypt %s", path);
+         goto error;
+      }
+      r = layer;
+
+      if (pgmoneta_strip_extension(name, &stripped))
+      {
+         goto error;
+      }
+      free(name);
+      name = stripped;
+   }
+
+   if (pgmoneta_ends_with(name, ".zstd"))
+   {
+      decompress = pgmoneta_zstandardd_reader;
+   }
+   else if (pgmoneta_ends_with(name, ".gz"))
+   {
+      decompress = pgmoneta_gunzip_reader;
+   }
+   else if (pgmoneta_ends_with(name, ".lz4"))
+   {
+      decompress = pgmoneta_lz4d_reader;
+   }
+   else if (pgmoneta_ends_with(name, ".bz2"))
+   {
+      decompress = pgmoneta_bunzip2_reader;
+   }
+
+   if (decompress != NULL)
+   {
+      if (decompress(r, &layer))
+      {
+         pgmoneta_log_error("Reader: Could not decompress %s", path);
+         goto error;
+      }
+      r = layer;
+   }
+
+   *reader = r;
+
+   free(name);
+
+   return 0;
+
+error:
+
+   pgmoneta_reader_close(r);
+   free(name);
+
+   return 1;
+}
+
+int
+pgmoneta_reader_read(struct reader* reader, void* buffer, size_t size, size_t* read)
+{
+   *read = 0;
+
+   if (reader == NULL || reader->read == NULL)
+   {
+      return 1;
+   }
+
+   return reader->read(reader, buffer, size, read);
+}
+
+int
+pgmoneta_reader_fill(struct reader* reader, void* buffer, size_t size, size_t* read)
+{
+   size_t total = 0;
+   size_t n = 0;
+
+   *read = 0;
+
+   while (total < size)
+   {
+      if (pgmoneta_reader_read(reader, (char*)buffer + total, size - total, &n))
+      {
+         goto error;
+      }
+
+      if (n == 0)
+      {
+         break;
+      }
+
+      total += n;
+   }
+
+   *read = total;
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+void
+pgmoneta_reader_close(struct reader* reader)
+{
+   struct reader* next = NULL;
+
+   while (reader != NULL)
+   {
+      next = reader->source;
+
+      if (reader->close != NULL)
+      {
+         reader->close(reader);
+      }
+      free(reader);
+
+      reader = next;
+   }
+}
+
+int
+pgmoneta_reader_hash(char* path, int algorithm, bool throttle, uint64_t* bytes, char** hash)
+{
+   unsigned char buffer[READER_BUFFER_SIZE];
+   size_t n = 0;
+   uint64_t total = 0;
+   struct reader* reader = NULL;
+   struct hash_context* context = NULL;
+
+   *hash = NULL;
+
+   if (pgmoneta_hash_create(algorithm, &context))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_reader_open(path, &reader))
+   {
+      goto error;
+   }
+
+   while (true)
+   {
+      if (pgmoneta_reader_read(reader, buffer, sizeof(buffer), &n))
+      {
+         goto error;
+      }
+
+      if (n == 0)
+      {
+         break;
+      }
+
+      if (pgmoneta_hash_update(context, buffer, n))
+      {
+         goto error;
+      }
+
+      if (throttle)
+      {
+         pgmoneta_reader_throttle(n);
+      }
+      total += n;
+   }
+
+   if (pgmoneta_hash_final(context, hash))
+   {
+      goto error;
+   }
+
+   if (bytes != NULL)
+   {
+      *bytes = total;
+   }
+
+   pgmoneta_reader_close(reader);
+   pgmoneta_hash_destroy(context);
+
+   return 0;
+
+error:
+
+   pgmoneta_reader_close(reader);
+   pgmoneta_hash_destroy(context);
+
+   return 1;
+}
+
+int
+pgmoneta_reader_plain_name(char* path, char** name)
+{
+   char* n = NULL;
+   char* stripped = NULL;
+
+   *name = NULL;
+
+   n = pgmoneta_append(n, path);
+   if (n == NULL)
+   {
+      goto error;
+   }
+
+   if (pgmoneta_is_encrypted(n))
+   {
+      if (pgmoneta_strip_extension(n, &stripped))
+      {
+         goto error;
+      }
+      free(n);
+      n = stripped;
+      stripped = NULL;
+   }
+
+   if (pgmoneta_is_compressed(n))
+   {
+      if (pgmoneta_strip_extension(n, &stripped))
+      {
+         goto error;
+      }
+      free(n);
+      n = stripped;
+      stripped = NULL;
+   }
+
+   *name = n;
+
+   return 0;
+
+error:
+
+   free(n);
+
+   return 1;
+}
+
+int
+pgmoneta_reader_copy(char* from, char* to)
+{
+   struct reader* reader = NULL;
+   FILE* out = NULL;
+   char* copy = NULL;
+   char* dn = NULL;
+   unsigned char* buffer = NULL;
+   size_t n = 0;
+   off_t written = 0;
+   off_t written_back = 0;
+   uint64_t start = 0;
+   uint64_t now = 0;
+   uint64_t file_time = 0;
+   struct stat st;
+
+   if (pgmoneta_reader_open(from, &reader))
+   {
+      goto error;
+   }
+
+   copy = strdup(to);
+   if (copy == NULL)
+   {
+      goto error;
+   }
+   dn = dirname(copy);
+
+   if (pgmoneta_mkdir(dn))
+   {
+      pgmoneta_log_error("Could not create directory: %s", dn);
+      goto error;
+   }
+
+   out = fopen(to, "wb");
+   if (out == NULL)
+   {
+      pgmoneta_log_error("Reader: Could not create %s", to);
+      goto error;
+   }
+
+   buffer = (unsigned char*)pgmoneta_memory_buffer_get(READER_BUFFER_SIZE);
+   if (buffer == NULL)
+   {
+      goto error;
+   }
+
+   do
+   {
+      start = now_microseconds();
+      file_time = file_read_time;
+
+      if (pgmoneta_reader_read(reader, buffer, READER_BUFFER_SIZE, &n))
+      {
+         pgmoneta_log_error("Reader: Could not read %s", from);
+         goto error;
+      }
+
+      now = now_microseconds();
+      file_time = file_read_time - file_time;
+      atomic_fetch_add(&reader_stats.decode_time, now - start > file_time ? now - start - file_time : 0);
+      start = now;
+
+      pgmoneta_reader_throttle(n);
+
+      if (n > 0 && fwrite(buffer, 1, n, out) != n)
+      {
+         pgmoneta_log_error("Reader: Could not write %s", to);
+         goto error;
+      }
+
+      written += n;
+
+      /* Start the write back of each full window, so the disk writes while the next one is decoded */
+      if (written - written_back >= READER_WRITEBACK_SIZE)
+      {
+         if (write_back(out, written_back, written))
+         {
+            pgmoneta_log_error("Reader: Could not write %s", to);
+            goto error;
+         }
+         written_back = written;
+      }
+
+      atomic_fetch_add(&reader_stats.write_time, now_microseconds() - start);
+   }
+   while (n > 0);
+
+   start = now_microseconds();
+
+   if (fclose(out))
+   {
+      out = NULL;
+      goto error;
+   }
+   out = NULL;
+
+   atomic_fetch_add(&reader_stats.write_time, now_microseconds() - start);
+   atomic_fetch_add(&reader_stats.write_bytes, written);
+   atomic_fetch_add(&reader_stats.files, 1);
+   pgmoneta_progress_add(written, 1);
+
+   if (!stat(from, &st))
+   {
+      chmod(to, st.st_mode & (S_IRWXU | S_IRWXG | S_IRWXO));
+   }
+
+#ifdef DEBUG
+   pgmoneta_log_trace("FILETRACKER | Extract | %s | %s |", from, to);
+#endif
+
+   pgmoneta_reader_close(reader);
+   pgmoneta_memory_buffer_put(buffer);
+   free(copy);
+
+   return 0;
+
+error:
+
+   if (out != NULL)
+   {
+      fclose(out);
+   }
+
+   /* Never leave a partial file behind */
+   if (pgmoneta_exists(to))
+   {
+      remove(to);
+   }
+
+   pgmoneta_reader_close(reader);
+   pgmoneta_memory_buffer_put(buffer);
+   free(copy);
+
+   return 1;
+}
+
+int
+pgmoneta_reader_extract_file(char* from, char* to, struct workers* workers)
+{
+   char* name = NULL;
+   struct worker_input* wi = NULL;
+
+   if (!pgmoneta_is_encrypted(from) && !pgmoneta_is_compressed(from))
+   {
+      return pgmoneta_copy_file(from, to, workers);
+   }
+
+   if (pgmoneta_reader_plain_name(to, &name))
+   {
+      goto error;
+   }
+
+   /* A large file with a seek table is spread over the workers, instead of taking one of them */
+   if (workers != NULL && workers->outcome && pgmoneta_ends_with(from, ".zstd") &&
+       !pgmoneta_zstandardd_parallel(from, name, workers))
+   {
+      free(name);
+      return 0;
+   }
+
+   if (pgmoneta_create_worker_input(NULL, from, name, 0, workers, &wi))
+   {
+      goto error;
+   }
+
+   if (workers != NULL)
+   {
+      if (workers->outcome)
+      {
+         pgmoneta_workers_add(workers, do_extract_file, (struct worker_common*)wi);
+      }
+      else
+      {
+         free(wi);
+      }
+   }
+   else
+   {
+      do_extract_file((struct worker_common*)wi);
+   }
+
+   free(name);
+
+   return 0;
+
+error:
+
+   free(name);
+
+   return 1;
+}
+
+int
+pgmoneta_reader_extract_batch(char* from, char* to, size_t size, mode_t mode, struct copy_batch* batch, struct workers* workers)
+{
+   if (!pgmoneta_is_encrypted(from) && !pgmoneta_is_compressed(from))
+   {
+      return pgmoneta_copy_batch_add(batch, from, to, size, mode);
+   }
+
+   return pgmoneta_reader_extract_file(from, to, workers);
+}
+
+int
+pgmoneta_reader_extract_directory(char* from, char* to, char** restore_last_files_names, struct workers* workers)
+{
+   DIR* d = opendir(from);
+   char* from_buffer;
+   char* to_buffer;
+   struct dirent* entry;
+   struct stat statbuf;
+   struct copy_batch* batch = NULL;
+
+   pgmoneta_mkdir(to);
+
+   if (d)
+   {
+      if (pgmoneta_copy_batch_create(workers, &batch))
+      {
+         closedir(d);
+         goto error;
+      }
+
+      while ((entry = readdir(d)))
+      {
+         if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+         {
+            continue;
+         }
+
+         from_buffer = NULL;
+         to_buffer = NULL;
+
+         from_buffer = pgmoneta_append(from_buffer, from);
+         from_buffer = pgmoneta_append(from_buffer, "/");
+         from_buffer = pgmoneta_append(from_buffer, entry->d_name);
+
+         to_buffer = pgmoneta_append(to_buffer, to);
+         to_buffer = pgmoneta_append(to_buffer, "/");
+         to_buffer = pgmoneta_append(to_buffer, entry->d_name);
+
+         if (!stat(from_buffer, &statbuf))
+         {
+            if (S_ISDIR(statbuf.st_mode))
+            {
+               pgmoneta_reader_extract_directory(from_buffer, to_buffer, restore_last_files_names, workers);
+            }
+            else
+            {
+               bool file_is_excluded = false;
+
+               if (restore_last_files_names != NULL)
+               {
+                  for (int i = 0; !file_is_excluded && restore_last_files_names[i] != NULL; i++)
+                  {
+                     file_is_excluded = !strcmp(from_buffer, restore_last_files_names[i]);
+                  }
+               }
+
+               if (!file_is_excluded)
+               {
+                  pgmoneta_reader_extract_batch(from_buffer, to_buffer, statbuf.st_size, statbuf.st_mode, batch, workers);
+               }
+            }
+         }
+
+         free(from_buffer);
+         free(to_buffer);
+      }
+      closedir(d);
+
+      pgmoneta_copy_batch_destroy(batch);
+   }
+   else
+   {
+      goto error;
+   }
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+int
+pgmoneta_reader_max_rate(long max_rate)
+{
+   pgmoneta_token_bucket_destroy(reader_bucket);
+   reader_bucket = NULL;
+
+   if (max_rate > 0)
+   {
+      reader_bucket = (struct token_bucket*)malloc(sizeof(struct token_bucket));
+      if (reader_bucket == NULL)
+      {
+         goto error;
+      }
+
+      if (pgmoneta_token_bucket_init(reader_bucket, max_rate))
+      {
+         goto error;
+      }
+   }
+
+   return 0;
+
+error:
+
+   pgmoneta_token_bucket_destroy(reader_bucket);
+   reader_bucket = NULL;
+
+   return 1;
+}
+
+void
+pgmoneta_reader_throttle(size_t bytes)
+{
+   pgmoneta_bandwidth_consume(bytes);
+
+   if (reader_bucket == NULL || bytes == 0)
+   {
+      return;
+   }
+
+   pgmoneta_token_bucket_consume(reader_bucket, bytes);
+}
+
+void
+pgmoneta_reader_statistics_reset(void)
+{
+   atomic_store(&reader_stats.files, 0);
+   atomic_store(&reader_stats.read_bytes, 0);
+   atomic_store(&reader_stats.read_time, 0);
+   atomic_store(&reader_stats.decode_time, 0);
+   atomic_store(&reader_stats.write_bytes, 0);
+   atomic_store(&reader_stats.write_time, 0);
+}
+
+void
+pgmoneta_reader_statistics(struct reader_statistics* statistics)
+{
+   atomic_store(&statistics->files, atomic_load(&reader_stats.files));
+   atomic_store(&statistics->read_bytes, atomic_load(&reader_stats.read_bytes));
+   atomic_store(&statistics->read_time, atomic_load(&reader_stats.read_time));
+   atomic_store(&statistics->decode_time, atomic_load(&reader_stats.decode_time));
+   atomic_store(&statistics->write_bytes, atomic_load(&reader_stats.write_bytes));
+   atomic_store(&statistics->write_time, atomic_load(&reader_stats.write_time));
+}
+
+void
+pgmoneta_reader_log_statistics(char* prefix)
+{
+   double read_bytes;
+   double write_bytes;
+   double read_time;
+   double decode_time;
+   double write_time;
+
+   if (atomic_load(&reader_stats.files) == 0)
+   {
+      return;
+   }
+
+   read_bytes = (double)atomic_load(&reader_stats.read_bytes) / (1024.0 * 1024.0);
+   write_bytes = (double)atomic_load(&reader_stats.write_bytes) / (1024.0 * 1024.0);
+   read_time = (double)atomic_load(&reader_stats.read_time) / 1000000.0;
+   decode_time = (double)atomic_load(&reader_stats.decode_time) / 1000000.0;
+   write_time = (double)atomic_load(&reader_stats.write_time) / 1000000.0;
+
+   pgmoneta_log_info("%s: %llu files, read %.1f MB in %.3fs (%.1f MB/s), decode %.3fs (%.1f MB/s), write %.1f MB in %.3fs (%.1f MB/s)",
+                     prefix, atomic_load(&reader_stats.files),
+                     read_bytes, read_time, read_time > 0.0 ? read_bytes / read_time : 0.0,
+                     decode_time, decode_time > 0.0 ? write_bytes / decode_time : 0.0,
+                     write_bytes, write_time, write_time > 0.0 ? write_bytes / write_time : 0.0);
+}
+
+static int
+file_read(struct reader* reader, void* buffer, size_t size, size_t* read)
+{
+   struct file_state* fs = (struct file_state*)reader->state;
+   uint64_t start;
+   uint64_t elapsed;
+
+   start = now_microseconds();
+
+   if (fs->fp == NULL)
+   {
+      int ret = file_read_direct(fs, buffer, size, read);
+
+      elapsed = now_microseconds() - start;
+      file_read_time += elapsed;
+      atomic_fetch_add(&reader_stats.read_time, elapsed);
+      atomic_fetch_add(&reader_stats.read_bytes, *read);
+
+      return ret;
+   }
+
+   *read = fread(buffer, 1, size, fs->fp);
+
+   fs->position += *read;
+   file_prefetch(fs);
+
+#if defined(HAVE_LINUX) || defined(HAVE_FREEBSD)
+   /* Without O_DIRECT the pages that are read are dropped behind the reads */
+   if (((struct common_configuration*)shmem)->direct_io && fs->position - fs->dropped >= READER_PREFETCH_SIZE)
+   {
+      posix_fadvise(fileno(fs->fp), fs->dropped, fs->position - fs->dropped, POSIX_FADV_DONTNEED);
+      fs->dropped = fs->position;
+   }
+#endif
+
+   elapsed = now_microseconds() - start;
+   file_read_time += elapsed;
+   atomic_fetch_add(&reader_stats.read_time, elapsed);
+   atomic_fetch_add(&reader_stats.read_bytes, *read);
+
+   if (ferror(fs->fp))
+   {
+      return 1;
+   }
+
+   return 0;
+}
+
+static int
+file_read_direct(struct file_state* fs, void* buffer, size_t size, size_t* read)
+{
+   size_t n;
+   ssize_t r;
+
+   *read = 0;
+
+   while (*read < size)
+   {
+      if (fs->consumed == fs->staged)
+      {
+         if (fs->eof)
+         {
+            break;
+         }
+
+         r = pread(fs->fd, fs->staging, MEMORY_BUFFER_SIZE, fs->position);
+
+#ifdef O_DIRECT
+         if (r == -1 && errno == EINVAL)
+         {
+            /* A short read left the offset unaligned, finish the file buffered */
+            errno = 0;
+            fcntl(fs->fd, F_SETFL, fcntl(fs->fd, F_GETFL) & ~O_DIRECT);
+            r = pread(fs->fd, fs->staging, MEMORY_BUFFER_SIZE, fs->position);
+         }
+#endif
+
+         if (r == -1)
+         {
+            return 1;
+         }
+
+         if (r == 0)
+         {
+            fs->eof = true;
+         }
+
+         fs->staged = (size_t)r;
+         fs->consumed = 0;
+         fs->position += r;
+         continue;
+      }
+
+      n = MIN(size - *read, fs->staged - fs->consumed);
+      memcpy((char*)buffer + *read, fs->staging + fs->consumed, n);
+      fs->consumed += n;
+      *read += n;
+   }
+
+   return 0;
+}
+
+static int
+file_open(char* path, struct reader** reader)
+{
+   struct file_state* fs = NULL;
+
+   *reader = NULL;
+
+   fs = (struct file_state*)calloc(1, sizeof(struct file_state));
+   if (fs == NULL)
+   {
+      goto error;
+   }
+   fs->fd = -1;
+
+   if (shmem != NULL && ((struct common_configuration*)shmem)->direct_io && !file_open_direct(path, fs))
+   {
+      if (pgmoneta_reader_create(NULL, file_read, file_close, fs, reader))
+      {
+         goto error;
+      }
+
+      return 0;
+   }
+
+   fs->fp = fopen(path, "rb");
+   if (fs->fp == NULL)
+   {
+      pgmoneta_log_error("Reader: Could not open %s", path);
+      goto error;
+   }
+
+#if defined(HAVE_LINUX) || defined(HAVE_FREEBSD)
+   posix_fadvise(fileno(fs->fp), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+   file_prefetch(fs);
+
+   if (pgmoneta_reader_create(NULL, file_read, file_close, fs, reader))
+   {
+      goto error;
+   }
+
+   return 0;
+
+error:
+
+   if (fs != NULL)
+   {
+      if (fs->fp != NULL)
+      {
+         fclose(fs->fp);
+      }
+      if (fs->fd != -1)
+      {
+         close(fs->fd);
+      }
+      pgmoneta_memory_buffer_put(fs->staging);
+      free(fs);
+   }
+
+   return 1;
+}
+
+static int
+file_open_direct(char* path, struct file_state* fs)
+{
+#ifdef O_DIRECT
+   fs->fd = open(path, O_RDONLY | O_DIRECT | O_CLOEXEC);
+   if (fs->fd == -1)
+   {
+      /* Not every file system supports O_DIRECT */
+      errno = 0;
+      return 1;
+   }
+
+   fs->staging = pgmoneta_memory_buffer_get(MEMORY_BUFFER_SIZE);
+   if (fs->staging == NULL)
+   {
+      close(fs->fd);
+      fs->fd = -1;
+      return 1;
+   }
+
+   return 0;
+#else
+   (void)path;
+   (void)fs;
+
+   return 1;
+#endif
+}
+
+static void
+file_close(struct reader* reader)
+{
+   struct file_state* fs = (struct file_state*)reader->state;
+
+   if (fs != NULL)
+   {
+      if (fs->fp != NULL)
+      {
+         fclose(fs->fp);
+      }
+      if (fs->fd != -1)
+      {
+         close(fs->fd);
+      }
+      pgmoneta_memory_buffer_put(fs->staging);
+      free(fs);
+      reader->state = NULL;
+   }
+}
+
+static void
+file_prefetch(struct file_state* fs)
+{
+   /* Keep between a half and a full window asked for ahead of the reads */
+   if (fs->prefetched - fs->position > READER_PREFETCH_SIZE / 2)
+   {
+      return;
+   }
+
+#if defined(HAVE_LINUX) || defined(HAVE_FREEBSD)
+   posix_fadvise(fileno(fs->fp), fs->prefetched, READER_PREFETCH_SIZE, POSIX_FADV_WILLNEED);
+#endif
+
+   fs->prefetched += READER_PREFETCH_SIZE;
+}
+
+static int
+write_back(FILE* out, off_t from, off_t to)
+{
+   if (fflush(out))
+   {
+      return 1;
+   }
+
+#if defined(HAVE_LINUX)
+   sync_file_range(fileno(out), from, to - from, SYNC_FILE_RANGE_WRITE);
+#else
+   (void)from;
+   (void)to;
+#endif
+
+   return 0;
+}
+
+static uint64_t
+now_microseconds(void)
+{
+   struct timespec ts;
+
+#ifdef HAVE_FREEBSD
+   clock_gettime(CLOCK_MONOTONIC_FAST, &ts);
+#else
+   clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+#endif
+
+   return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static void
+do_extract_file(struct worker_common* wc)
+{
+   struct worker_input* wi = (struct worker_input*)wc;
+
+   if (pgmoneta_reader_copy(wi->from, wi->to))
+   {
+      pgmoneta_log_error("Extract: %s -> %s", wi->from, wi->to);
+
+      if (wi->common.workers != NULL)
+      {
+         wi->common.workers->outcome = false;
+      }
+   }
+
+   free(wi);
+}
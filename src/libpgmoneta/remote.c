@@ -28,6 +28,7 @@
 
 /* pgmoneta */
 #include <pgmoneta.h>
+#include <json.h>
 #include <logging.h>
 #include <management.h>
 #include <network.h>
@@ -36,21 +37,33 @@
 
 /* system */
 #include <ev.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 
+#define SUBSCRIBE_DEFAULT_INTERVAL 5
+
+static int remote_forward(SSL* client_ssl, int client_fd, uint8_t compression, uint8_t encryption, struct json* payload);
+static int remote_subscribe(SSL* client_ssl, int client_fd, uint8_t compression, uint8_t encryption, struct json* payload);
+static bool remote_closed(SSL* client_ssl, int client_fd);
+static bool remote_wait(SSL* client_ssl, int client_fd, int seconds);
+
 void
 pgmoneta_remote_management(int client_fd, char* address)
 {
-   int server_fd = -1;
    int exit_code;
    int auth_status;
+   int32_t command;
+   bool session = true;
+   bool first = true;
    uint8_t compression;
    uint8_t encryption;
    SSL* client_ssl = NULL;
    struct json* payload = NULL;
+   struct json* header = NULL;
    struct main_configuration* config;
 
    pgmoneta_start_logging();
@@ -65,32 +78,43 @@ pgmoneta_remote_management(int client_fd, char* address)
    auth_status = pgmoneta_remote_management_auth(client_fd, address, &client_ssl);
    if (auth_status == AUTH_SUCCESS)
    {
-      if (pgmoneta_connect_unix_socket(config->unix_socket_dir, MAIN_UDS, &server_fd))
-      {
-         goto done;
-      }
-
-      if (pgmoneta_management_read_json(client_ssl, client_fd, &compression, &encryption, &payload))
+      /* A request with Session set keeps the authenticated connection open for the next one.
+       * Requests are answered in order, so a client can pipeline them and match the responses
+       * by their RequestId */
+      while (session && config->running)
       {
-         goto done;
-      }
+         if (!first && remote_closed(client_ssl, client_fd))
+         {
+            goto done;
+         }
+         first = false;
 
-      if (pgmoneta_management_write_json(NULL, server_fd, compression, encryption, payload))
-      {
-         goto done;
-      }
+         if (pgmoneta_management_read_json(client_ssl, client_fd, &compression, &encryption, &payload))
+         {
+            goto done;
+         }
 
-      pgmoneta_json_destroy(payload);
-      payload = NULL;
+         header = (struct json*)pgmoneta_json_get(payload, MANAGEMENT_CATEGORY_HEADER);
+         command = (int32_t)pgmoneta_json_get(header, MANAGEMENT_ARGUMENT_COMMAND);
+         session = (bool)pgmoneta_json_get(header, MANAGEMENT_ARGUMENT_SESSION);
 
-      if (pgmoneta_management_read_json(NULL, server_fd, &compression, &encryption, &payload))
-      {
-         goto done;
-      }
+         if (command == MANAGEMENT_SUBSCRIBE)
+         {
+            if (remote_subscribe(client_ssl, client_fd, compression, encryption, payload))
+            {
+               goto done;
+            }
+         }
+         else
+         {
+            if (remote_forward(client_ssl, client_fd, compression, encryption, payload))
+            {
+               goto done;
+            }
+         }
 
-      if (pgmoneta_management_write_json(client_ssl, client_fd, compression, encryption, payload))
-      {
-         goto done;
+         pgmoneta_json_destroy(payload);
+         payload = NULL;
       }
    }
    else
@@ -118,7 +142,6 @@ done:
 
    pgmoneta_log_debug("pgmoneta_remote_management: disconnect %d", client_fd);
    pgmoneta_disconnect(client_fd);
-   pgmoneta_disconnect(server_fd);
 
    free(address);
 
@@ -127,3 +150,200 @@ done:
 
    exit(exit_code);
 }
+
+static int
+remote_forward(SSL* client_ssl, int client_fd, uint8_t compression, uint8_t encryption, struct json* payload)
+{
+   int server_fd = -1;
+   bool partial = true;
+   unsigned char* data = NULL;
+   size_t data_size = 0;
+   struct json* header = NULL;
+   struct json* response = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   /* The main process answers one request per connection */
+   if (pgmoneta_connect_unix_socket(config->unix_socket_dir, MAIN_UDS, &server_fd))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_management_write_json(NULL, server_fd, compression, encryption, payload))
+   {
+      goto error;
+   }
+
+   header = (struct json*)pgmoneta_json_get(payload, MANAGEMENT_CATEGORY_HEADER);
+
+   /* A WAL push is followed by the file, which ends with an empty block */
+   if ((int32_t)pgmoneta_json_get(header, MANAGEMENT_ARGUMENT_COMMAND) == MANAGEMENT_WAL_PUSH)
+   {
+      do
+      {
+         if (pgmoneta_management_read_data(client_ssl, client_fd, &data, &data_size))
+         {
+            goto error;
+         }
+
+         if (pgmoneta_management_write_data(NULL, server_fd, data, data_size))
+         {
+            goto error;
+         }
+
+         free(data);
+         data = NULL;
+      }
+      while (data_size > 0);
+   }
+
+   /* A chunked response is a series of partial responses followed by the final one */
+   while (partial)
+   {
+      if (pgmoneta_management_read_json(NULL, server_fd, &compression, &encryption, &response))
+      {
+         goto error;
+      }
+
+      if (pgmoneta_management_write_json(client_ssl, client_fd, compression, encryption, response))
+      {
+         goto error;
+      }
+
+      partial = (bool)pgmoneta_json_get((struct json*)pgmoneta_json_get(response, MANAGEMENT_CATEGORY_RESPONSE), MANAGEMENT_ARGUMENT_PARTIAL);
+
+      pgmoneta_json_destroy(response);
+      response = NULL;
+   }
+
+   pgmoneta_disconnect(server_fd);
+
+   return 0;
+
+error:
+
+   free(data);
+   pgmoneta_json_destroy(response);
+   pgmoneta_disconnect(server_fd);
+
+   return 1;
+}
+
+static int
+remote_subscribe(SSL* client_ssl, int client_fd, uint8_t compression, uint8_t encryption, struct json* payload)
+{
+   int server_fd = -1;
+   int interval;
+   int64_t request_id;
+   char* previous = NULL;
+   char* current = NULL;
+   struct json* header = NULL;
+   struct json* request = NULL;
+   struct json* status = NULL;
+   struct json* status_header = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   header = (struct json*)pgmoneta_json_get(payload, MANAGEMENT_CATEGORY_HEADER);
+   request = (struct json*)pgmoneta_json_get(payload, MANAGEMENT_CATEGORY_REQUEST);
+
+   request_id = (int64_t)pgmoneta_json_get(header, MANAGEMENT_ARGUMENT_REQUEST_ID);
+   interval = (int)(int64_t)pgmoneta_json_get(request, MANAGEMENT_ARGUMENT_INTERVAL);
+   if (interval <= 0)
+   {
+      interval = SUBSCRIBE_DEFAULT_INTERVAL;
+   }
+
+   /* Push the status details whenever they change, until the client sends a new request or leaves */
+   while (config->running)
+   {
+      if (pgmoneta_connect_unix_socket(config->unix_socket_dir, MAIN_UDS, &server_fd))
+      {
+         goto error;
+      }
+
+      if (pgmoneta_management_request_status_details(NULL, server_fd, MANAGEMENT_COMPRESSION_NONE, MANAGEMENT_ENCRYPTION_NONE, MANAGEMENT_OUTPUT_FORMAT_JSON))
+      {
+         goto error;
+      }
+
+      if (pgmoneta_management_read_json(NULL, server_fd, NULL, NULL, &status))
+      {
+         goto error;
+      }
+
+      pgmoneta_disconnect(server_fd);
+      server_fd = -1;
+
+      /* The outcome carries the elapsed time, so only the response tells if something changed */
+      current = pgmoneta_json_to_string((struct json*)pgmoneta_json_get(status, MANAGEMENT_CATEGORY_RESPONSE), FORMAT_JSON_COMPACT, NULL, 0);
+
+      if (previous == NULL || current == NULL || strcmp(previous, current))
+      {
+         status_header = (struct json*)pgmoneta_json_get(status, MANAGEMENT_CATEGORY_HEADER);
+         pgmoneta_json_put(status_header, MANAGEMENT_ARGUMENT_REQUEST_ID, (uintptr_t)request_id, ValueInt64);
+
+         if (pgmoneta_management_write_json(client_ssl, client_fd, compression, encryption, status))
+         {
+            goto error;
+         }
+      }
+
+      pgmoneta_json_destroy(status);
+      status = NULL;
+
+      free(previous);
+      previous = current;
+      current = NULL;
+
+      if (remote_wait(client_ssl, client_fd, interval))
+      {
+         break;
+      }
+   }
+
+   free(previous);
+
+   return 0;
+
+error:
+
+   pgmoneta_json_destroy(status);
+   pgmoneta_disconnect(server_fd);
+   free(previous);
+   free(current);
+
+   return 1;
+}
+
+static bool
+remote_closed(SSL* client_ssl, int client_fd)
+{
+   char c;
+
+   if (client_ssl != NULL)
+   {
+      return SSL_peek(client_ssl, &c, 1) <= 0;
+   }
+
+   return recv(client_fd, &c, 1, MSG_PEEK) <= 0;
+}
+
+static bool
+remote_wait(SSL* client_ssl, int client_fd, int seconds)
+{
+   struct pollfd pfd;
+
+   if (client_ssl != NULL && SSL_pending(client_ssl) > 0)
+   {
+      return true;
+   }
+
+   pfd.fd = client_fd;
+   pfd.events = POLLIN;
+   pfd.revents = 0;
+
+   return poll(&pfd, 1, seconds * 1000) != 0;
+}
@@ -28,18 +28,26 @@
 
 /* pgmoneta */
 #include <pgmoneta.h>
+#include <bandwidth.h>
+#include <delta.h>
+#include <lock.h>
 #include <logging.h>
 #include <management.h>
 #include <network.h>
+#include <profile.h>
+#include <reader.h>
 #include <restore.h>
 #include <security.h>
+#include <storage.h>
 #include <utils.h>
+#include <wal.h>
 #include <workflow.h>
 
 /* system */
 #include <assert.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -56,6 +64,25 @@
 #define RESTORE_ERROR         4
 #define MAX_PATH_CONCAT (MAX_PATH * 2)
 #define TMP_SUFFIX ".tmp"
+#define RECONSTRUCT_BATCH_BLOCKS 128
+#define MAX_SELECTION 64
+#define FIRST_NORMAL_OBJECT_ID 16384
+#define TEMPLATE1_OID 1
+
+/** @struct restore_selection
+ * Defines the databases and relations of a partial restore. Everything
+ * is restored when no database is selected
+ */
+struct restore_selection
+{
+   int number_of_databases;           /**< The number of databases */
+   uint32_t databases[MAX_SELECTION]; /**< The database OIDs */
+   int number_of_relations;           /**< The number of relations */
+   uint32_t relations[MAX_SELECTION]; /**< The relation file nodes */
+};
+
+/* The selection of the restore done by this process */
+static struct restore_selection selection;
 
 struct build_backup_file_input
 {
@@ -75,12 +102,21 @@ struct build_backup_file_input
 
 static char* restore_last_files_names[] = {"/global/pg_control", "/postgresql.conf", "/pg_hba.conf"};
 
+/* The empty directories of a data directory, which object storage doesn't keep */
+static char* empty_directories[] = {"pg_commit_ts", "pg_dynshmem", "pg_logical/mappings", "pg_logical/snapshots",
+                                    "pg_notify", "pg_replslot", "pg_serial", "pg_snapshots", "pg_stat", "pg_stat_tmp",
+                                    "pg_subtrans", "pg_tblspc", "pg_twophase", "pg_wal/archive_status"};
+
 static int restore_backup_full(struct art* nodes);
 
 static int restore_backup_incremental(struct art* nodes);
 
 static int carry_out_workflow(struct workflow* workflow, struct art* nodes);
 
+static int fetch_backup(int server, char* label, struct deque* fetched);
+
+static void remove_fetched_backups(int server, struct deque* fetched);
+
 static void clear_manifest_incremental_entries(struct json* manifest);
 
 static int get_file_manifest(char* path, char* manifest_path, int algorithm, struct json** file);
@@ -213,14 +249,61 @@ static bool
 is_full_file(struct rfile* rf);
 
 static int
-read_block(struct rfile* rf, off_t offset, uint32_t blocksz, uint8_t* buffer);
+read_blocks(struct rfile* rf, off_t offset, uint32_t blocksz, uint32_t count, uint8_t* buffer);
+
+static int
+write_buffer(int fd, void* buffer, size_t size);
+
+static bool
+is_zero_block(uint8_t* block, uint32_t blocksz);
+
+static int
+write_blocks(int fd, uint8_t* buffer, uint32_t count, uint32_t blocksz, off_t* position);
+
+/**
+ * Ask the kernel to read ahead the source blocks of a range of a reconstructed file
+ * @param source_map The source of each block
+ * @param offset_map The offset of each block in its source
+ * @param blocksz The block size
+ * @param from The first block
+ * @param to The block after the last block
+ * @return The block after the last block
+ */
+static uint32_t
+prefetch_blocks(struct rfile** source_map, off_t* offset_map, uint32_t blocksz, uint32_t from, uint32_t to);
+
+/**
+ * Write the blocks of a reconstructed file.
+ * Consecutive blocks sourced from consecutive offsets of the same file are read
+ * with a single call, and the blocks are written in batches. All-zero blocks are
+ * left as holes, so the output file is sparse
+ * @param fd The descriptor of the output file
+ * @param output_file_path The path of the output file
+ * @param block_length The number of blocks
+ * @param source_map The source of each block
+ * @param offset_map The offset of each block in its source
+ * @param blocksz The block size
+ * @param zero_fill Write zero blocks for blocks without a source, otherwise skip them
+ * @param delta The versions to decode delta encoded blocks with, or NULL
+ * @return 0 upon success, otherwise 1
+ */
+static int
+write_reconstructed_blocks(int fd,
+                           char* output_file_path,
+                           uint32_t block_length,
+                           struct rfile** source_map,
+                           off_t* offset_map,
+                           uint32_t blocksz,
+                           bool zero_fill,
+                           struct delta* delta);
 
 static int
 write_reconstructed_file_full(char* output_file_path,
                               uint32_t block_length,
                               struct rfile** source_map,
                               off_t* offset_map,
-                              uint32_t blocksz);
+                              uint32_t blocksz,
+                              struct delta* delta);
 
 static int
 write_reconstructed_file_incremental(char* output_file_path,
@@ -228,7 +311,21 @@ write_reconstructed_file_incremental(char* output_file_path,
                                      struct rfile** source_map,
                                      struct rfile* latest_source,
                                      off_t* offset_map,
-                                     uint32_t blocksz);
+                                     uint32_t blocksz,
+                                     struct delta* delta);
+
+/**
+ * Decode delta encoded blocks read from a source
+ * @param delta The versions of the file
+ * @param source The source
+ * @param block_number The block number of the first block
+ * @param count The number of blocks
+ * @param blocksz The block size
+ * @param buffer The blocks
+ * @return 0 upon success, otherwise 1
+ */
+static int
+decode_blocks(struct delta* delta, struct rfile* source, uint32_t block_number, uint32_t count, uint32_t blocksz, uint8_t* buffer);
 
 static int
 write_backup_label(char* from_dir, char* to_dir, char* lsn_entry, char* tli_entry);
@@ -248,6 +345,37 @@ create_workspace_directory(int server, char* label, char* relative_prefix);
 static void
 create_workspace_directories(int server, struct deque* labels, char* relative_prefix);
 
+/**
+ * Add a database or a relation to the selection of a partial restore.
+ * Names are translated with the OID mappings of the server
+ * @param server The server
+ * @param database Is the object a database, otherwise a relation
+ * @param name The name or the OID
+ * @return 0 on success, 1 if otherwise
+ */
+static int
+select_object(int server, bool database, char* name);
+
+/**
+ * Is a path part of the selection of a partial restore
+ * @param relative_path The path relative to the data directory
+ * @return True if the path should be restored, otherwise false
+ */
+static bool
+is_selected(char* relative_path);
+
+/**
+ * Extract a backup directory, skipping what is not part of the selection
+ * @param from The backup directory
+ * @param to The destination directory
+ * @param relative_path The directory relative to the data directory
+ * @param restore_last_files_names The files to skip
+ * @param workers The optional workers
+ * @return 0 on success, 1 if otherwise
+ */
+static int
+extract_selected_directory(char* from, char* to, char* relative_path, char** restore_last_files_names, struct workers* workers);
+
 /**
  * Construct the backup label chain starting from the newest backup
  * @param server The server
@@ -272,6 +400,22 @@ static int copy_tablespaces_hotstandby(char *from, char *to,
                                        struct backup *backup,
                                        struct workers *workers);
 
+/**
+ * Extract or copy a tablespace. With workers the tablespace is walked by one of
+ * them, so the tablespaces, which usually live on their own devices, are handled
+ * at the same time and each gets at least the worker that walks it
+ * @param from The tablespace in the backup
+ * @param to The tablespace directory
+ * @param relative_path The tablespace relative to the data directory, or NULL to copy it
+ * @param workers The optional workers
+ * @return 0 on success, 1 if otherwise
+ */
+static int
+tablespace_submit(char* from, char* to, char* relative_path, struct workers* workers);
+
+static void
+do_tablespace(struct worker_common* wc);
+
 int
 pgmoneta_get_restore_last_files_names(char*** output)
 {
@@ -316,12 +460,14 @@ pgmoneta_is_restore_last_name(char* file_name)
 void
 pgmoneta_restore(SSL* ssl __attribute__((unused)), int client_fd, int server, uint8_t compression, uint8_t encryption, struct json* payload)
 {
-   bool active = false;
    bool locked = false;
+   bool shared = false;
    int ret = RESTORE_OK;
    char* identifier = NULL;
    char* position = NULL;
    char* directory = NULL;
+   char* remote = NULL;
+   char* local_directory = NULL;
    char* elapsed = NULL;
    struct timespec start_t;
    struct timespec end_t;
@@ -331,6 +477,7 @@ pgmoneta_restore(SSL* ssl __attribute__((unused)), int client_fd, int server, ui
    struct art* nodes = NULL;
    struct json* req = NULL;
    struct json* response = NULL;
+   struct lock* lock = NULL;
    struct main_configuration* config;
 
    pgmoneta_start_logging();
@@ -343,7 +490,7 @@ pgmoneta_restore(SSL* ssl __attribute__((unused)), int client_fd, int server, ui
    clock_gettime(CLOCK_MONOTONIC_RAW, &start_t);
 #endif
 
-   if (!atomic_compare_exchange_strong(&config->common.servers[server].repository, &active, true))
+   if (pgmoneta_lock_repository(server, LOCK_SHARED, &lock))
    {
       pgmoneta_log_info("Restore: Server %s is active", config->common.servers[server].name);
       pgmoneta_management_response_error(NULL, client_fd, config->common.servers[server].name, MANAGEMENT_ERROR_RESTORE_ACTIVE, NAME, compression, encryption, payload);
@@ -378,6 +525,42 @@ pgmoneta_restore(SSL* ssl __attribute__((unused)), int client_fd, int server, ui
       goto error;
    }
 
+   /* The backup and its parents can't be deleted while they are restored */
+   if (pgmoneta_lock_backup_chain(lock, backup))
+   {
+      pgmoneta_log_info("Restore: %s/%s is active", config->common.servers[server].name, identifier);
+      pgmoneta_management_response_error(NULL, client_fd, config->common.servers[server].name,
+                                         MANAGEMENT_ERROR_RESTORE_ACTIVE, NAME, compression, encryption, payload);
+      goto error;
+   }
+
+   if (pgmoneta_sftp_is_remote(directory))
+   {
+      /* Restore into the workspace, and upload the result to the remote target */
+      remote = directory;
+
+      local_directory = pgmoneta_get_server_workspace(server);
+      if (local_directory == NULL)
+      {
+         pgmoneta_management_response_error(NULL, client_fd, config->common.servers[server].name,
+                                            MANAGEMENT_ERROR_RESTORE_NODISK, NAME, compression, encryption, payload);
+         goto error;
+      }
+
+      local_directory = pgmoneta_append(local_directory, "remote-restore");
+
+      pgmoneta_delete_directory(local_directory);
+      if (pgmoneta_mkdir(local_directory))
+      {
+         pgmoneta_log_error("Restore: Could not create directory %s", local_directory);
+         pgmoneta_management_response_error(NULL, client_fd, config->common.servers[server].name,
+                                            MANAGEMENT_ERROR_RESTORE_NODISK, NAME, compression, encryption, payload);
+         goto error;
+      }
+
+      directory = local_directory;
+   }
+
    if (pgmoneta_art_insert(nodes, USER_POSITION, (uintptr_t)position, ValueString))
    {
       goto error;
@@ -388,7 +571,26 @@ pgmoneta_restore(SSL* ssl __attribute__((unused)), int client_fd, int server, ui
       goto error;
    }
 
+   shared = pgmoneta_bandwidth_start(BANDWIDTH_RESTORE) == 0;
+
    ret = pgmoneta_restore_backup(nodes);
+
+   if (shared)
+   {
+      pgmoneta_bandwidth_stop();
+   }
+
+   if (ret == RESTORE_OK && remote != NULL)
+   {
+      if (pgmoneta_sftp_restore(server, remote, local_directory))
+      {
+         pgmoneta_log_error("Restore: Could not upload %s to %s", config->common.servers[server].name, remote);
+         ret = RESTORE_ERROR;
+      }
+
+      pgmoneta_delete_directory(local_directory);
+   }
+
    if (ret == RESTORE_OK)
    {
       if (pgmoneta_management_create_response(payload, server, &response))
@@ -434,6 +636,12 @@ pgmoneta_restore(SSL* ssl __attribute__((unused)), int client_fd, int server, ui
       pgmoneta_log_warn("Restore: No identifier for %s/%s", config->common.servers[server].name, identifier);
       goto error;
    }
+   else if (ret == RESTORE_ERROR && remote != NULL)
+   {
+      pgmoneta_management_response_error(NULL, client_fd, config->common.servers[server].name, MANAGEMENT_ERROR_RESTORE_EXECUTE, NAME,
+                                         compression, encryption, payload);
+      goto error;
+   }
    else
    {
       pgmoneta_management_response_error(NULL, client_fd, config->common.servers[server].name, MANAGEMENT_ERROR_RESTORE_NODISK, NAME,
@@ -442,7 +650,7 @@ pgmoneta_restore(SSL* ssl __attribute__((unused)), int client_fd, int server, ui
    }
 
    config->common.servers[server].active_restore = false;
-   atomic_store(&config->common.servers[server].repository, false);
+   pgmoneta_unlock(lock);
 
    pgmoneta_json_destroy(payload);
 
@@ -453,11 +661,17 @@ pgmoneta_restore(SSL* ssl __attribute__((unused)), int client_fd, int server, ui
    free(backup);
    free(elapsed);
    free(output);
+   free(local_directory);
 
    exit(0);
 
 error:
 
+   if (local_directory != NULL)
+   {
+      pgmoneta_delete_directory(local_directory);
+   }
+
    pgmoneta_json_destroy(payload);
 
    pgmoneta_disconnect(client_fd);
@@ -467,12 +681,13 @@ error:
    if (locked)
    {
       config->common.servers[server].active_restore = false;
-      atomic_store(&config->common.servers[server].repository, false);
+      pgmoneta_unlock(lock);
    }
 
    free(backup);
    free(elapsed);
    free(output);
+   free(local_directory);
 
    exit(1);
 }
@@ -480,9 +695,12 @@ error:
 int
 pgmoneta_restore_backup(struct art* nodes)
 {
+   int ret = RESTORE_OK;
    struct backup* backup = NULL;
    char* position = NULL;
    struct deque* labels = NULL;
+   struct deque* fetched = NULL;
+   struct deque_iterator* iter = NULL;
    int server = 0;
    char* label = NULL;
 
@@ -564,10 +782,23 @@ pgmoneta_restore_backup(struct art* nodes)
          {
             /* Ok */
          }
+         else if (!strcmp(&key[0], "database") || !strcmp(&key[0], "relation"))
+         {
+            if (select_object(server, !strcmp(&key[0], "database"), &value[0]))
+            {
+               return RESTORE_ERROR;
+            }
+         }
 
          ptr = strtok(NULL, ",");
       }
 
+      if (selection.number_of_relations > 0 && selection.number_of_databases == 0)
+      {
+         pgmoneta_log_error("Restore: Relations need a database");
+         return RESTORE_ERROR;
+      }
+
       pgmoneta_art_insert(nodes, NODE_PRIMARY, primary, ValueBool);
 
       pgmoneta_art_insert(nodes, NODE_RECOVERY_INFO, true, ValueBool);
@@ -579,25 +810,54 @@ pgmoneta_restore_backup(struct art* nodes)
       pgmoneta_art_insert(nodes, NODE_RECOVERY_INFO, false, ValueBool);
    }
 
+   if (backup->type != TYPE_FULL && backup->type != TYPE_INCREMENTAL)
+   {
+      return RESTORE_TYPE_UNKNOWN;
+   }
+
+   pgmoneta_deque_create(false, &fetched);
+
+   if (fetch_backup(server, label, fetched))
+   {
+      ret = RESTORE_ERROR;
+      goto done;
+   }
+
    if (backup->type == TYPE_FULL)
    {
-      return restore_backup_full(nodes);
+      ret = restore_backup_full(nodes);
    }
-   else if (backup->type == TYPE_INCREMENTAL)
+   else
    {
       if (construct_backup_label_chain(server, label, NULL, false, &labels))
       {
-         return RESTORE_MISSING_LABEL;
+         ret = RESTORE_MISSING_LABEL;
+         goto done;
       }
       pgmoneta_art_insert(nodes, NODE_LABELS, (uintptr_t)labels, ValueDeque);
       pgmoneta_art_insert(nodes, NODE_INCREMENTAL_COMBINE, (uintptr_t)false, ValueBool);
       pgmoneta_art_insert(nodes, NODE_COMBINE_AS_IS, (uintptr_t)false, ValueBool);
-      return restore_backup_incremental(nodes);
-   }
-   else
-   {
-      return RESTORE_TYPE_UNKNOWN;
+
+      pgmoneta_deque_iterator_create(labels, &iter);
+      while (pgmoneta_deque_iterator_next(iter))
+      {
+         if (fetch_backup(server, (char*)pgmoneta_value_data(iter->value), fetched))
+         {
+            ret = RESTORE_ERROR;
+            goto done;
+         }
+      }
+
+      ret = restore_backup_incremental(nodes);
    }
+
+done:
+
+   pgmoneta_deque_iterator_destroy(iter);
+   remove_fetched_backups(server, fetched);
+   pgmoneta_deque_destroy(fetched);
+
+   return ret;
 }
 
 int
@@ -627,9 +887,9 @@ pgmoneta_combine_backups(int server, char* label, char* base, char* input_dir, c
    config = (struct main_configuration*)shmem;
 
    number_of_workers = pgmoneta_get_number_of_workers(server);
-   if (number_of_workers > 0)
+   if (number_of_workers > 0 && !pgmoneta_workers_initialize(number_of_workers, &workers))
    {
-      pgmoneta_workers_initialize(number_of_workers, &workers);
+      workers->ordered = true;
    }
 
    pgmoneta_deque_iterator_create(prior_labels, &iter);
@@ -660,7 +920,7 @@ pgmoneta_combine_backups(int server, char* label, char* base, char* input_dir, c
       goto error;
    }
 
-   if (number_of_workers > 0)
+   if (workers != NULL)
    {
       pgmoneta_deque_set_thread_safe((struct deque*)files->elements);
    }
@@ -682,7 +942,7 @@ pgmoneta_combine_backups(int server, char* label, char* base, char* input_dir, c
       goto error;
    }
 
-   if (number_of_workers > 0)
+   if (workers != NULL)
    {
       pgmoneta_workers_wait(workers);
       if (!workers->outcome)
@@ -740,7 +1000,7 @@ pgmoneta_combine_backups(int server, char* label, char* base, char* input_dir, c
       }
    }
 
-   if (number_of_workers > 0)
+   if (workers != NULL)
    {
       pgmoneta_workers_wait(workers);
       if (!workers->outcome)
@@ -748,6 +1008,7 @@ pgmoneta_combine_backups(int server, char* label, char* base, char* input_dir, c
          goto error;
       }
       pgmoneta_workers_destroy(workers);
+      workers = NULL;
    }
 
    if (incremental)
@@ -778,7 +1039,7 @@ pgmoneta_combine_backups(int server, char* label, char* base, char* input_dir, c
    return 0;
 
 error:
-   if (number_of_workers > 0)
+   if (workers != NULL)
    {
       pgmoneta_workers_destroy(workers);
    }
@@ -804,6 +1065,7 @@ pgmoneta_rollup_backups(int server, char* newest_label, char* oldest_label)
    char* tmp_old_manifest_path = NULL;
    char* old_manifest_path = NULL;
    struct workflow* workflow = NULL;
+   struct info_batch* info = NULL;
 
    memset(backup_info_path, 0, MAX_PATH);
    memset(tmp_backup_info_path, 0, MAX_PATH);
@@ -818,6 +1080,7 @@ pgmoneta_rollup_backups(int server, char* newest_label, char* oldest_label)
    if (oldest_backup == NULL)
    {
       pgmoneta_log_error("Unable to find the oldest backup %s", oldest_label);
+      goto error;
    }
    incremental = (oldest_backup->type == TYPE_INCREMENTAL);
 
@@ -893,14 +1156,25 @@ pgmoneta_rollup_backups(int server, char* newest_label, char* oldest_label)
       goto error;
    }
 
+   if (pgmoneta_info_begin(tmp_backup_root, &info))
+   {
+      goto error;
+   }
+
    if (!incremental)
    {
-      pgmoneta_update_info_unsigned_long(tmp_backup_root, INFO_TYPE, TYPE_FULL);
-      pgmoneta_update_info_string(tmp_backup_root, INFO_PARENT, NULL);
+      pgmoneta_info_set_unsigned_long(info, INFO_TYPE, TYPE_FULL);
+      pgmoneta_info_set_string(info, INFO_PARENT, NULL);
    }
    else
    {
-      pgmoneta_update_info_string(tmp_backup_root, INFO_PARENT, oldest_backup->parent_label);
+      pgmoneta_info_set_string(info, INFO_PARENT, oldest_backup->parent_label);
+   }
+
+   if (pgmoneta_info_commit(info))
+   {
+      pgmoneta_log_error("Unable to update %s", tmp_backup_info_path);
+      goto error;
    }
 
    pgmoneta_delete_directory(backup_dir);
@@ -909,6 +1183,8 @@ pgmoneta_rollup_backups(int server, char* newest_label, char* oldest_label)
       pgmoneta_log_error("rollup: could not rename directory %s to %s", tmp_backup_root, backup_dir);
       goto error;
    }
+   pgmoneta_invalidate_backups();
+   pgmoneta_storage_changed(server);
 
    workflow = pgmoneta_workflow_create(WORKFLOW_TYPE_POST_ROLLUP, server, newest_backup);
    if (carry_out_workflow(workflow, nodes) != RESTORE_OK)
@@ -945,7 +1221,7 @@ error:
 }
 
 int
-pgmoneta_extract_incremental_backup(int server, char* label, char** root, char** base)
+pgmoneta_extract_incremental_backup(int server, char* label, char* directory, char** root, char** base)
 {
    struct art* nodes = NULL;
    struct backup* backup = NULL;
@@ -978,7 +1254,18 @@ pgmoneta_extract_incremental_backup(int server, char* label, char** root, char**
    pgmoneta_art_insert(nodes, NODE_LABELS, (uintptr_t)labels, ValueDeque);
 
    // USER DIRECTORY
-   backup_root = pgmoneta_get_server_workspace(server);
+   if (directory != NULL)
+   {
+      backup_root = pgmoneta_append(backup_root, directory);
+      if (!pgmoneta_ends_with(backup_root, "/"))
+      {
+         backup_root = pgmoneta_append_char(backup_root, '/');
+      }
+   }
+   else
+   {
+      backup_root = pgmoneta_get_server_workspace(server);
+   }
    backup_root = pgmoneta_append(backup_root, TMP_SUFFIX);
    backup_root = pgmoneta_append(backup_root, "_");
    backup_root = pgmoneta_append(backup_root, label);
@@ -1083,7 +1370,7 @@ pgmoneta_copy_postgresql_restore(char* from, char* to, char* base, char* server,
                }
                else
                {
-                  pgmoneta_copy_directory(from_buffer, to_buffer, restore_last_files_names, workers);
+                  extract_selected_directory(from_buffer, to_buffer, entry->d_name, restore_last_files_names, workers);
                }
             }
             else
@@ -1097,12 +1384,12 @@ pgmoneta_copy_postgresql_restore(char* from, char* to, char* base, char* server,
                   }
                   if (!file_is_excluded)
                   {
-                     pgmoneta_copy_file(from_buffer, to_buffer, workers);
+                     pgmoneta_reader_extract_file(from_buffer, to_buffer, workers);
                   }
                }
                else
                {
-                  pgmoneta_copy_file(from_buffer, to_buffer, workers);
+                  pgmoneta_reader_extract_file(from_buffer, to_buffer, workers);
                }
             }
          }
@@ -1241,6 +1528,7 @@ combine_backups_recursive(uint32_t tsoid,
    bool is_incremental_dir = false;
    char ifulldir[MAX_PATH];
    char ofulldir[MAX_PATH];
+   char ipath[MAX_PATH_CONCAT];
    // Current directory of the file to be reconstructed relative to backup base directory.
    // In normal cases it's the same as relative_dir, except for having an ending backup slash
    // For table spaces the relative_dir is relative to the table space oid directory,
@@ -1339,6 +1627,10 @@ combine_backups_recursive(uint32_t tsoid,
          }
 
          snprintf(new_relative_prefix, MAX_PATH_CONCAT, "%s%s/", relative_prefix, entry->d_name);
+         if (!is_selected(new_relative_prefix))
+         {
+            continue;
+         }
          create_workspace_directory(server, label, new_relative_prefix);
          create_workspace_directories(server, prior_labels, new_relative_prefix);
 
@@ -1364,6 +1656,13 @@ combine_backups_recursive(uint32_t tsoid,
          }
       }
 
+      memset(ipath, 0, sizeof(ipath));
+      snprintf(ipath, sizeof(ipath), "%s%s", relative_prefix, entry->d_name);
+      if (!is_selected(ipath))
+      {
+         continue;
+      }
+
       // skip these, backup_label requires special handling
       if (relative_dir == NULL &&
           (pgmoneta_compare_string(entry->d_name, "backup_label") ||
@@ -1391,6 +1690,8 @@ combine_backups_recursive(uint32_t tsoid,
                                                     files,
                                                     workers,
                                                     &wi);
+               snprintf(ipath, sizeof(ipath), "%s/%s", ifulldir, entry->d_name);
+               wi->common.size = pgmoneta_get_file_size(ipath);
                pgmoneta_workers_add(workers, do_reconstruct_backup_file, (struct worker_common*)wi);
             }
             else
@@ -1425,6 +1726,8 @@ combine_backups_recursive(uint32_t tsoid,
             if (workers->outcome)
             {
                create_copy_backup_file_input(server, label, ofulldir, relative_prefix, entry->d_name, exclude, workers, &wi);
+               snprintf(ipath, sizeof(ipath), "%s/%s", ifulldir, entry->d_name);
+               wi->common.size = pgmoneta_get_file_size(ipath);
                pgmoneta_workers_add(workers, do_copy_backup_file, (struct worker_common*)wi);
             }
             else
@@ -1492,6 +1795,8 @@ reconstruct_backup_file(int server,
    struct value_config rfile_config = {.destroy_data = rfile_destroy_cb, .to_string = NULL};
    struct json* file = NULL;
    bool full_file_found = false;
+   struct delta* delta = NULL;
+   struct deque_iterator* source_iter = NULL;
 
    config = (struct main_configuration*)shmem;
 
@@ -1586,7 +1891,7 @@ reconstruct_backup_file(int server,
       {
          full_file_found = true;
          // would be nice if we could check if stat fails
-         file_size = pgmoneta_get_file_size(rf->filepath);
+         file_size = pgmoneta_rfile_size(rf);
          nblocks = file_size / blocksz;
 
          // no need to check for blocks beyond truncation_block_length
@@ -1604,7 +1909,8 @@ reconstruct_backup_file(int server,
          // full_copy_possible only remains true when there are no modified blocks in later incremental files,
          // which means the file has probably never been modified since last full backup.
          // But it still could've gotten truncated, so check the file size.
-         if (full_copy_possible && file_size == block_length * blocksz)
+         // A file read in place is still compressed, so it is rewritten block by block
+         if (full_copy_possible && file_size == block_length * blocksz && rf->seekable == NULL)
          {
             copy_source = rf;
          }
@@ -1634,6 +1940,42 @@ reconstruct_backup_file(int server,
       goto error;
    }
 
+   // delta encoded blocks are decoded with the versions of the file, newest first
+   pgmoneta_deque_iterator_create(sources, &source_iter);
+   while (!full_copy_possible && pgmoneta_deque_iterator_next(source_iter))
+   {
+      if (((struct rfile*)pgmoneta_value_data(source_iter->value))->delta)
+      {
+         if (pgmoneta_delta_create(server, &delta))
+         {
+            goto error;
+         }
+         break;
+      }
+   }
+   pgmoneta_deque_iterator_destroy(source_iter);
+   source_iter = NULL;
+
+   if (delta != NULL)
+   {
+      pgmoneta_deque_iterator_create(sources, &source_iter);
+      while (pgmoneta_deque_iterator_next(source_iter))
+      {
+         if (pgmoneta_delta_add(delta, (struct rfile*)pgmoneta_value_data(source_iter->value)))
+         {
+            goto error;
+         }
+      }
+
+      // without a full file the versions go on in the parents of the oldest backup
+      bck = (struct backup*)pgmoneta_art_search(backups, prior_label != NULL ? prior_label : label);
+      if (!full_file_found && bck != NULL && bck->type != TYPE_FULL &&
+          pgmoneta_delta_extend(delta, server, bck->parent_label, relative_dir, base_file_name))
+      {
+         goto error;
+      }
+   }
+
    if (full_file_found)
    {
       snprintf(ofullpath, MAX_PATH_CONCAT, "%s/%s", output_dir, base_file_name);
@@ -1647,6 +1989,8 @@ reconstruct_backup_file(int server,
 
    if (copy_source != NULL)
    {
+      pgmoneta_reader_throttle(pgmoneta_get_file_size(copy_source->filepath));
+
       if (pgmoneta_copy_file(copy_source->filepath, ofullpath, NULL))
       {
          pgmoneta_log_error("reconstruct: fail to copy file from %s to %s", copy_source->filepath, ofullpath);
@@ -1657,7 +2001,7 @@ reconstruct_backup_file(int server,
    {
       if (full_file_found)
       {
-         if (write_reconstructed_file_full(ofullpath, block_length, source_map, offset_map, blocksz))
+         if (write_reconstructed_file_full(ofullpath, block_length, source_map, offset_map, blocksz, delta))
          {
             pgmoneta_log_error("reconstruct: fail to write reconstructed full file at %s", ofullpath);
             goto error;
@@ -1665,7 +2009,7 @@ reconstruct_backup_file(int server,
       }
       else
       {
-         if (write_reconstructed_file_incremental(ofullpath, block_length, source_map, latest_source, offset_map, blocksz))
+         if (write_reconstructed_file_incremental(ofullpath, block_length, source_map, latest_source, offset_map, blocksz, delta))
          {
             pgmoneta_log_error("reconstruct: fail to write reconstructed incremental file at %s", ofullpath);
             goto error;
@@ -1684,6 +2028,8 @@ reconstruct_backup_file(int server,
       pgmoneta_json_append(files, (uintptr_t)file, ValueJSON);
    }
 
+   pgmoneta_delta_destroy(delta);
+   pgmoneta_deque_iterator_destroy(source_iter);
    pgmoneta_deque_destroy(sources);
    pgmoneta_deque_iterator_destroy(label_iter);
    free(source_map);
@@ -1691,6 +2037,8 @@ reconstruct_backup_file(int server,
    free(base_file_name);
    return 0;
 error:
+   pgmoneta_delta_destroy(delta);
+   pgmoneta_deque_iterator_destroy(source_iter);
    pgmoneta_deque_destroy(sources);
    pgmoneta_deque_iterator_destroy(label_iter);
    free(source_map);
@@ -1710,7 +2058,8 @@ copy_backup_file(int server,
    bool excluded = false;
    char ofullpath[MAX_PATH_CONCAT];
    char manifest_path[MAX_PATH_CONCAT];
-   char* extracted_file_path = NULL;
+   char* from = NULL;
+   char* plain_path = NULL;
    char* base_file_name = NULL;
    int excluded_files = 0;
 
@@ -1723,17 +2072,23 @@ copy_backup_file(int server,
 
    memset(ofullpath, 0, MAX_PATH_CONCAT);
    memset(manifest_path, 0, MAX_PATH_CONCAT);
-   // copy the full file from input dir to output dir
-   // extract before copy
    snprintf(manifest_path, MAX_PATH_CONCAT, "%s%s", relative_dir, file_name);
-   if (pgmoneta_extract_backup_file(server, label, manifest_path, NULL, &extracted_file_path))
+
+   from = pgmoneta_get_server_backup_identifier_data(server, label);
+   if (!pgmoneta_ends_with(from, "/"))
+   {
+      from = pgmoneta_append_char(from, '/');
+   }
+   from = pgmoneta_append(from, manifest_path);
+
+   if (pgmoneta_reader_plain_name(manifest_path, &plain_path))
    {
       goto error;
    }
 
    for (int i = 0; i < excluded_files; i++)
    {
-      if (pgmoneta_ends_with(extracted_file_path, restore_last_files_names[i]))
+      if (pgmoneta_ends_with(plain_path, restore_last_files_names[i]))
       {
          pgmoneta_log_debug("combine_backup_recursive: exclude %s", manifest_path);
          excluded = true;
@@ -1751,22 +2106,32 @@ copy_backup_file(int server,
       snprintf(ofullpath, MAX_PATH_CONCAT, "%s/%s", output_dir, base_file_name);
    }
 
-   pgmoneta_copy_file(extracted_file_path, ofullpath, NULL);
-
-   pgmoneta_delete_file(extracted_file_path, NULL);
-   free(extracted_file_path);
-   extracted_file_path = NULL;
+   if (!exclude && !strcmp(plain_path, manifest_path))
+   {
+      /* Combining as is keeps the output in the backup directory, where files */
+      /* aren't modified in place, so a plain file can share its data */
+      if (pgmoneta_link_or_copy_file(from, ofullpath))
+      {
+         goto error;
+      }
+   }
+   else
+   {
+      /* Decrypt and decompress straight into the output directory */
+      if (pgmoneta_reader_copy(from, ofullpath))
+      {
+         goto error;
+      }
+   }
 
+   free(from);
+   free(plain_path);
    free(base_file_name);
-   free(extracted_file_path);
    return 0;
 
 error:
-   if (extracted_file_path != NULL)
-   {
-      pgmoneta_delete_file(extracted_file_path, NULL);
-   }
-   free(extracted_file_path);
+   free(from);
+   free(plain_path);
    free(base_file_name);
    return 1;
 }
@@ -1808,19 +2173,15 @@ is_full_file(struct rfile* rf)
 }
 
 static int
-read_block(struct rfile* rf, off_t offset, uint32_t blocksz, uint8_t* buffer)
+read_blocks(struct rfile* rf, off_t offset, uint32_t blocksz, uint32_t count, uint8_t* buffer)
 {
-   int nread = 0;
-   if (fseek(rf->fp, offset, SEEK_SET))
-   {
-      pgmoneta_log_error("unable to locate file pointer to offset %llu in file %s", offset, rf->filepath);
-      goto error;
-   }
+   size_t size = (size_t)blocksz * count;
 
-   nread = fread(buffer, 1, blocksz, rf->fp);
-   if (nread != blocksz)
+   PGMONETA_PROFILE(PROFILE_READ_BLOCKS);
+
+   if (pgmoneta_rfile_read_at(rf, offset, buffer, size) != size)
    {
-      pgmoneta_log_error("unable to read block at offset %llu from file %s", offset, rf->filepath);
+      pgmoneta_log_error("unable to read %u blocks at offset %llu from file %s", count, (unsigned long long)offset, rf->filepath);
       goto error;
    }
 
@@ -1830,102 +2191,269 @@ error:
 }
 
 static int
-write_reconstructed_file_full(char* output_file_path,
-                              uint32_t block_length,
-                              struct rfile** source_map,
-                              off_t* offset_map,
-                              uint32_t blocksz)
+write_buffer(int fd, void* buffer, size_t size)
 {
-   FILE* wfp = NULL;
-   uint8_t buffer[blocksz];
-   struct rfile* s = NULL;
+   size_t nwritten = 0;
+   ssize_t n;
 
-   wfp = fopen(output_file_path, "wb+");
-   if (wfp == NULL)
-   {
-      pgmoneta_log_error("reconstruct: unable to open file for reconstruction at %s", output_file_path);
-      goto error;
-   }
-   for (uint32_t i = 0; i < block_length; i++)
+   pgmoneta_reader_throttle(size);
+
+   while (nwritten < size)
    {
-      memset(buffer, 0, blocksz);
-      s = source_map[i];
-      if (s == NULL)
+      n = write(fd, (char*)buffer + nwritten, size - nwritten);
+      if (n >= 0)
       {
-         // zero fill the block since source doesn't exist
-         memset(buffer, 0, blocksz);
-         if (fwrite(buffer, 1, blocksz, wfp) != blocksz)
-         {
-            pgmoneta_log_error("reconstruct: fail to write to file %s", output_file_path);
-            goto error;
-         }
+         nwritten += n;
       }
-      else
+      else if (errno != EINTR)
       {
-         // we might be able to use copy_file_range to have faster copy,
-         // but for now let's stay in user space
-         if (read_block(s, offset_map[i], blocksz, buffer))
-         {
-            goto error;
-         }
-         if (fwrite(buffer, 1, blocksz, wfp) != blocksz)
-         {
-            pgmoneta_log_error("reconstruct: fail to write to file %s", output_file_path);
-            goto error;
-         }
+         return 1;
       }
    }
-   if (wfp != NULL)
-   {
-      fclose(wfp);
-   }
+
    return 0;
-error:
-   if (wfp != NULL)
-   {
-      fclose(wfp);
-   }
-   return 1;
 }
 
-static int
-write_reconstructed_file_incremental(char* output_file_path,
-                                     uint32_t block_length,
-                                     struct rfile** source_map,
-                                     struct rfile* latest_source,
-                                     off_t* offset_map,
-                                     uint32_t blocksz)
+static bool
+is_zero_block(uint8_t* block, uint32_t blocksz)
 {
-   FILE* wfp = NULL;
-   size_t hdrlen = 0;
-   size_t hdrptr = 0;
-   uint8_t buffer[blocksz];
-   uint32_t num_blocks = 0;
-   uint32_t idx = 0;
-   void* header = NULL;
-   uint32_t magic = INCREMENTAL_MAGIC;
-   struct rfile* s = NULL;
+   return block[0] == 0 && memcmp(block, block + 1, blocksz - 1) == 0;
+}
 
-   pgmoneta_log_debug("reconstruct incremental file %s", output_file_path);
+static int
+write_blocks(int fd, uint8_t* buffer, uint32_t count, uint32_t blocksz, off_t* position)
+{
+   uint32_t i = 0;
+   uint32_t run = 0;
 
-   // build header
-   for (uint32_t i = 0; i < block_length; i++)
+   while (i < count)
    {
-      if (source_map[i] != NULL)
+      if (is_zero_block(buffer + (size_t)i * blocksz, blocksz))
       {
-         num_blocks++;
+         *position += blocksz;
+         i++;
+         continue;
       }
-   }
-   hdrlen = sizeof(uint32_t) * (1 + 1 + 1 + num_blocks);
-   if (num_blocks > 0 && hdrlen % blocksz != 0)
-   {
-      hdrlen += (blocksz - (hdrlen % blocksz));
-   }
 
-   header = malloc(hdrlen);
-   memset(header, 0, hdrlen);
+      run = 1;
+      while (i + run < count && !is_zero_block(buffer + (size_t)(i + run) * blocksz, blocksz))
+      {
+         run++;
+      }
 
-   memcpy(header + hdrptr, &magic, sizeof(uint32_t));
+      if (lseek(fd, *position, SEEK_SET) < 0 || write_buffer(fd, buffer + (size_t)i * blocksz, (size_t)run * blocksz))
+      {
+         return 1;
+      }
+
+      *position += (off_t)run * blocksz;
+      i += run;
+   }
+
+   return 0;
+}
+
+static uint32_t
+prefetch_blocks(struct rfile** source_map, off_t* offset_map, uint32_t blocksz, uint32_t from, uint32_t to)
+{
+   uint32_t run = 0;
+
+   while (from < to)
+   {
+      if (source_map[from] == NULL)
+      {
+         from++;
+         continue;
+      }
+
+      run = 1;
+      while (from + run < to && source_map[from + run] == source_map[from] &&
+             offset_map[from + run] == offset_map[from] + (off_t)run * blocksz)
+      {
+         run++;
+      }
+
+      pgmoneta_rfile_prefetch(source_map[from], offset_map[from], (size_t)run * blocksz);
+
+      from += run;
+   }
+
+   return to;
+}
+
+static int
+write_reconstructed_blocks(int fd,
+                           char* output_file_path,
+                           uint32_t block_length,
+                           struct rfile** source_map,
+                           off_t* offset_map,
+                           uint32_t blocksz,
+                           bool zero_fill,
+                           struct delta* delta)
+{
+   uint8_t* buffer = NULL;
+   uint32_t used = 0;
+   uint32_t run = 0;
+   uint32_t i = 0;
+   uint32_t prefetched = 0;
+   off_t position = 0;
+   struct rfile* s = NULL;
+
+   position = lseek(fd, 0, SEEK_CUR);
+   buffer = malloc((size_t)blocksz * RECONSTRUCT_BATCH_BLOCKS);
+   if (position < 0 || buffer == NULL)
+   {
+      goto error;
+   }
+
+   while (i < block_length)
+   {
+      // keep the next batch of source blocks read ahead while this one is written
+      if (prefetched < i + RECONSTRUCT_BATCH_BLOCKS && prefetched < block_length)
+      {
+         prefetched = prefetch_blocks(source_map, offset_map, blocksz, prefetched > i ? prefetched : i,
+                                      MIN(i + 2 * RECONSTRUCT_BATCH_BLOCKS, block_length));
+      }
+
+      s = source_map[i];
+      if (s == NULL && !zero_fill)
+      {
+         i++;
+         continue;
+      }
+
+      // extend the run while the blocks are next to each other in the same source
+      run = 1;
+      while (i + run < block_length && used + run < RECONSTRUCT_BATCH_BLOCKS && source_map[i + run] == s &&
+             (s == NULL || offset_map[i + run] == offset_map[i] + (off_t)run * blocksz))
+      {
+         run++;
+      }
+
+      if (s == NULL)
+      {
+         // zero fill the blocks since the source doesn't exist
+         memset(buffer + (size_t)used * blocksz, 0, (size_t)run * blocksz);
+      }
+      else if (read_blocks(s, offset_map[i], blocksz, run, buffer + (size_t)used * blocksz))
+      {
+         goto error;
+      }
+      else if (s->delta && decode_blocks(delta, s, i, run, blocksz, buffer + (size_t)used * blocksz))
+      {
+         pgmoneta_log_error("reconstruct: fail to decode blocks of %s", s->filepath);
+         goto error;
+      }
+
+      used += run;
+      i += run;
+
+      if (used == RECONSTRUCT_BATCH_BLOCKS)
+      {
+         if (write_blocks(fd, buffer, used, blocksz, &position))
+         {
+            pgmoneta_log_error("reconstruct: fail to write to file %s", output_file_path);
+            goto error;
+         }
+         used = 0;
+      }
+   }
+
+   if (used > 0 && write_blocks(fd, buffer, used, blocksz, &position))
+   {
+      pgmoneta_log_error("reconstruct: fail to write to file %s", output_file_path);
+      goto error;
+   }
+
+   // holes at the end only exist once the file is extended
+   if (ftruncate(fd, position))
+   {
+      pgmoneta_log_error("reconstruct: fail to set the size of file %s", output_file_path);
+      goto error;
+   }
+
+   free(buffer);
+   return 0;
+
+error:
+   free(buffer);
+   return 1;
+}
+
+static int
+write_reconstructed_file_full(char* output_file_path,
+                              uint32_t block_length,
+                              struct rfile** source_map,
+                              off_t* offset_map,
+                              uint32_t blocksz,
+                              struct delta* delta)
+{
+   int fd = -1;
+
+   fd = open(output_file_path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+   if (fd < 0)
+   {
+      pgmoneta_log_error("reconstruct: unable to open file for reconstruction at %s", output_file_path);
+      goto error;
+   }
+
+   if (write_reconstructed_blocks(fd, output_file_path, block_length, source_map, offset_map, blocksz, true, delta))
+   {
+      goto error;
+   }
+
+   if (close(fd) < 0)
+   {
+      fd = -1;
+      pgmoneta_log_error("reconstruct: fail to close file %s", output_file_path);
+      goto error;
+   }
+   return 0;
+error:
+   if (fd >= 0)
+   {
+      close(fd);
+   }
+   return 1;
+}
+
+static int
+write_reconstructed_file_incremental(char* output_file_path,
+                                     uint32_t block_length,
+                                     struct rfile** source_map,
+                                     struct rfile* latest_source,
+                                     off_t* offset_map,
+                                     uint32_t blocksz,
+                                     struct delta* delta)
+{
+   int fd = -1;
+   size_t hdrlen = 0;
+   size_t hdrptr = 0;
+   uint32_t num_blocks = 0;
+   uint32_t idx = 0;
+   void* header = NULL;
+   uint32_t magic = INCREMENTAL_MAGIC;
+
+   pgmoneta_log_debug("reconstruct incremental file %s", output_file_path);
+
+   // build header
+   for (uint32_t i = 0; i < block_length; i++)
+   {
+      if (source_map[i] != NULL)
+      {
+         num_blocks++;
+      }
+   }
+   hdrlen = sizeof(uint32_t) * (1 + 1 + 1 + num_blocks);
+   if (num_blocks > 0 && hdrlen % blocksz != 0)
+   {
+      hdrlen += (blocksz - (hdrlen % blocksz));
+   }
+
+   header = malloc(hdrlen);
+   memset(header, 0, hdrlen);
+
+   memcpy(header + hdrptr, &magic, sizeof(uint32_t));
    hdrptr += sizeof(uint32_t);
 
    memcpy(header + hdrptr, &num_blocks, sizeof(uint32_t));
@@ -1943,56 +2471,64 @@ write_reconstructed_file_incremental(char* output_file_path,
       }
    }
 
-   wfp = fopen(output_file_path, "wb+");
-   if (wfp == NULL)
+   fd = open(output_file_path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+   if (fd < 0)
    {
       pgmoneta_log_error("reconstruct: unable to open file for reconstruction at %s", output_file_path);
       goto error;
    }
 
-   if (fwrite(header, 1, hdrlen, wfp) != hdrlen)
+   if (write_buffer(fd, header, hdrlen))
    {
       pgmoneta_log_error("reconstruct: fail to write header to file %s", output_file_path);
       goto error;
    }
 
-   for (uint32_t i = 0; i < block_length; i++)
+   if (write_reconstructed_blocks(fd, output_file_path, block_length, source_map, offset_map, blocksz, false, delta))
    {
-      memset(buffer, 0, blocksz);
-      s = source_map[i];
-      if (s != NULL)
-      {
-         // we might be able to use copy_file_range to have faster copy,
-         // but for now let's stay in user space
-         if (read_block(s, offset_map[i], blocksz, buffer))
-         {
-            goto error;
-         }
-         if (fwrite(buffer, 1, blocksz, wfp) != blocksz)
-         {
-            pgmoneta_log_error("reconstruct: fail to write to file %s", output_file_path);
-            goto error;
-         }
-      }
+      goto error;
    }
 
    free(header);
-   if (wfp != NULL)
+   if (close(fd) < 0)
    {
-      fclose(wfp);
+      pgmoneta_log_error("reconstruct: fail to close file %s", output_file_path);
+      return 1;
    }
    return 0;
 
 error:
    free(header);
-   if (wfp != NULL)
+   if (fd >= 0)
    {
-      fclose(wfp);
+      close(fd);
    }
    return 1;
 
 }
 
+static int
+decode_blocks(struct delta* delta, struct rfile* source, uint32_t block_number, uint32_t count, uint32_t blocksz, uint8_t* buffer)
+{
+   int start = pgmoneta_delta_find(delta, source);
+
+   if (start < 0)
+   {
+      return 1;
+   }
+
+   // the blocks are completed by the blocks as of the older versions
+   for (uint32_t k = 0; k < count; k++)
+   {
+      if (pgmoneta_delta_apply(delta, start + 1, block_number + k, buffer + (size_t)k * blocksz))
+      {
+         return 1;
+      }
+   }
+
+   return 0;
+}
+
 static int
 write_backup_label(char* from_dir, char* to_dir, char* lsn_entry, char* tli_entry)
 {
@@ -2153,6 +2689,269 @@ error:
    return 0;
 }
 
+static int
+select_object(int server, bool database, char* name)
+{
+   static bool mappings = false;
+   char* oid = NULL;
+   uint32_t value = 0;
+
+   if (strlen(name) == 0)
+   {
+      pgmoneta_log_error("Restore: No name for the %s", database ? "database" : "relation");
+      goto error;
+   }
+
+   if (strspn(name, "0123456789") != strlen(name))
+   {
+      if (!mappings)
+      {
+         if (pgmoneta_read_mappings_from_server(server))
+         {
+            pgmoneta_log_error("Restore: Could not read the OID mappings from %s", ((struct main_configuration*)shmem)->common.servers[server].name);
+            goto error;
+         }
+         /* The lookup releases the message memory of the process */
+         pgmoneta_memory_init();
+         mappings = true;
+      }
+
+      if (database ? pgmoneta_get_database_oid(name, &oid) : pgmoneta_get_relation_oid(name, &oid))
+      {
+         goto error;
+      }
+
+      if (strspn(oid, "0123456789") != strlen(oid))
+      {
+         pgmoneta_log_error("Restore: Unknown %s %s", database ? "database" : "relation", name);
+         goto error;
+      }
+   }
+   else
+   {
+      oid = pgmoneta_append(oid, name);
+   }
+
+   value = parse_oid(oid);
+   if (value == 0)
+   {
+      goto error;
+   }
+
+   if (database)
+   {
+      if (selection.number_of_databases >= MAX_SELECTION)
+      {
+         goto full;
+      }
+      selection.databases[selection.number_of_databases++] = value;
+   }
+   else
+   {
+      if (selection.number_of_relations >= MAX_SELECTION)
+      {
+         goto full;
+      }
+      selection.relations[selection.number_of_relations++] = value;
+   }
+
+   pgmoneta_log_debug("Restore: Selected %s %s (%u)", database ? "database" : "relation", name, value);
+
+   free(oid);
+
+   return 0;
+
+full:
+
+   pgmoneta_log_error("Restore: At most %d databases and %d relations can be selected", MAX_SELECTION, MAX_SELECTION);
+
+error:
+
+   free(oid);
+
+   return 1;
+}
+
+static bool
+is_selected(char* relative_path)
+{
+   char path[MAX_PATH];
+   char* components[5];
+   char* name = NULL;
+   char* save = NULL;
+   char* ep = NULL;
+   int number_of_components = 0;
+   int database_index = -1;
+   uint32_t oid = 0;
+   uint64_t filenode = 0;
+   bool found = false;
+
+   if (selection.number_of_databases == 0 || relative_path == NULL)
+   {
+      return true;
+   }
+
+   memset(path, 0, sizeof(path));
+   snprintf(path, sizeof(path), "%s", relative_path);
+
+   for (char* c = strtok_r(path, "/", &save); c != NULL && number_of_components < 5; c = strtok_r(NULL, "/", &save))
+   {
+      components[number_of_components++] = c;
+   }
+
+   // base/<database>/<file> and pg_tblspc/<tablespace>/<version>/<database>/<file>
+   if (number_of_components >= 2 && !strcmp(components[0], "base"))
+   {
+      database_index = 1;
+   }
+   else if (number_of_components >= 4 && !strcmp(components[0], "pg_tblspc"))
+   {
+      database_index = 3;
+   }
+   else
+   {
+      return true;
+   }
+
+   oid = (uint32_t)strtoul(components[database_index], &ep, 10);
+   if (*ep != '\0')
+   {
+      return true;
+   }
+
+   found = oid == TEMPLATE1_OID;
+   for (int i = 0; !found && i < selection.number_of_databases; i++)
+   {
+      found = selection.databases[i] == oid;
+   }
+
+   if (!found)
+   {
+      return false;
+   }
+
+   if (number_of_components == database_index + 1 || selection.number_of_relations == 0 || oid == TEMPLATE1_OID)
+   {
+      return true;
+   }
+
+   // <filenode>[_fork][.segment], the system catalogs and the map files are always needed
+   name = components[database_index + 1];
+   if (pgmoneta_starts_with(name, INCREMENTAL_PREFIX))
+   {
+      name += strlen(INCREMENTAL_PREFIX);
+   }
+
+   filenode = strtoul(name, &ep, 10);
+   if (ep == name || (*ep != '\0' && *ep != '.' && *ep != '_') || filenode < FIRST_NORMAL_OBJECT_ID)
+   {
+      return true;
+   }
+
+   for (int i = 0; i < selection.number_of_relations; i++)
+   {
+      if (selection.relations[i] == filenode)
+      {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+static int
+extract_selected_directory(char* from, char* to, char* relative_path, char** restore_last_files_names, struct workers* workers)
+{
+   DIR* d = NULL;
+   char* from_buffer = NULL;
+   char* to_buffer = NULL;
+   char* relative_buffer = NULL;
+   struct dirent* entry;
+   struct stat statbuf;
+   struct copy_batch* batch = NULL;
+
+   if (selection.number_of_databases == 0)
+   {
+      return pgmoneta_reader_extract_directory(from, to, restore_last_files_names, workers);
+   }
+
+   if (!(d = opendir(from)))
+   {
+      goto error;
+   }
+
+   pgmoneta_mkdir(to);
+
+   if (pgmoneta_copy_batch_create(workers, &batch))
+   {
+      closedir(d);
+      goto error;
+   }
+
+   while ((entry = readdir(d)))
+   {
+      if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+      {
+         continue;
+      }
+
+      relative_buffer = pgmoneta_append(relative_buffer, relative_path);
+      relative_buffer = pgmoneta_append(relative_buffer, "/");
+      relative_buffer = pgmoneta_append(relative_buffer, entry->d_name);
+
+      if (is_selected(relative_buffer))
+      {
+         from_buffer = pgmoneta_append(from_buffer, from);
+         from_buffer = pgmoneta_append(from_buffer, "/");
+         from_buffer = pgmoneta_append(from_buffer, entry->d_name);
+
+         to_buffer = pgmoneta_append(to_buffer, to);
+         to_buffer = pgmoneta_append(to_buffer, "/");
+         to_buffer = pgmoneta_append(to_buffer, entry->d_name);
+
+         if (!stat(from_buffer, &statbuf))
+         {
+            if (S_ISDIR(statbuf.st_mode))
+            {
+               extract_selected_directory(from_buffer, to_buffer, relative_buffer, restore_last_files_names, workers);
+            }
+            else
+            {
+               bool file_is_excluded = false;
+
+               for (int i = 0; !file_is_excluded && restore_last_files_names != NULL && restore_last_files_names[i] != NULL; i++)
+               {
+                  file_is_excluded = !strcmp(from_buffer, restore_last_files_names[i]);
+               }
+
+               if (!file_is_excluded)
+               {
+                  pgmoneta_reader_extract_batch(from_buffer, to_buffer, statbuf.st_size, statbuf.st_mode, batch, workers);
+               }
+            }
+         }
+
+         free(from_buffer);
+         free(to_buffer);
+         from_buffer = NULL;
+         to_buffer = NULL;
+      }
+
+      free(relative_buffer);
+      relative_buffer = NULL;
+   }
+
+   closedir(d);
+
+   pgmoneta_copy_batch_destroy(batch);
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
 static void
 clear_manifest_incremental_entries(struct json* manifest)
 {
@@ -2227,6 +3026,12 @@ get_file_manifest(char* path, char* manifest_path, int algorithm, struct json**
       case HASH_ALGORITHM_CRC32C:
          pgmoneta_json_put(f, "Checksum-Algorithm", (uintptr_t)"CRC32C", ValueString);
          break;
+      case HASH_ALGORITHM_XXH3:
+         pgmoneta_json_put(f, "Checksum-Algorithm", (uintptr_t)"XXH3", ValueString);
+         break;
+      case HASH_ALGORITHM_BLAKE3:
+         pgmoneta_json_put(f, "Checksum-Algorithm", (uintptr_t)"BLAKE3", ValueString);
+         break;
       default:
          pgmoneta_json_put(f, "Checksum-Algorithm", (uintptr_t)"NONE", ValueString);
          break;
@@ -2298,6 +3103,12 @@ restore_backup_full(struct art* nodes)
    required_space =
       backup->restore_size + (pgmoneta_get_number_of_workers(server) * backup->biggest_file_size);
 
+   /* A streamed archive only stages the configuration files and the WAL */
+   if (pgmoneta_art_contains_key(nodes, NODE_ARCHIVE_SOURCE))
+   {
+      required_space = 0;
+   }
+
    if (free_space < required_space)
    {
       char* f = NULL;
@@ -2514,7 +3325,15 @@ static int
 carry_out_workflow(struct workflow* workflow, struct art* nodes)
 {
    struct workflow* current = NULL;
+   struct workers* workers = NULL;
    int ret = RESTORE_OK;
+
+   if (pgmoneta_workflow_workers_create(nodes, &workers))
+   {
+      ret = RESTORE_ERROR;
+      goto error;
+   }
+
    current = workflow;
    while (current != NULL)
    {
@@ -2548,11 +3367,105 @@ carry_out_workflow(struct workflow* workflow, struct art* nodes)
       current = current->next;
    }
 
+   pgmoneta_workflow_workers_destroy(workflow != NULL ? workflow->type : -1, nodes, workers);
+
    return ret;
 error:
+   pgmoneta_workflow_workers_destroy(workflow != NULL ? workflow->type : -1, nodes, workers);
+
    return ret;
 }
 
+static int
+fetch_backup(int server, char* label, struct deque* fetched)
+{
+   char* data = NULL;
+   char* dir = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   data = pgmoneta_get_server_backup_identifier_data(server, label);
+
+   if (pgmoneta_exists(data))
+   {
+      free(data);
+      return 0;
+   }
+
+   /* The remote storage engines remove the local data directory, so only the selected files are fetched back */
+   if (config->storage_engine & STORAGE_ENGINE_S3)
+   {
+      pgmoneta_log_info("Restore: Fetching %s/%s from S3", config->common.servers[server].name, label);
+      if (pgmoneta_s3_fetch(server, label, &is_selected))
+      {
+         goto error;
+      }
+   }
+   else if (config->storage_engine & STORAGE_ENGINE_AZURE)
+   {
+      pgmoneta_log_info("Restore: Fetching %s/%s from Azure", config->common.servers[server].name, label);
+      if (pgmoneta_azure_fetch(server, label, &is_selected))
+      {
+         goto error;
+      }
+   }
+   else
+   {
+      pgmoneta_log_error("Restore: No data directory for %s/%s", config->common.servers[server].name, label);
+      goto error;
+   }
+
+   pgmoneta_deque_add(fetched, NULL, (uintptr_t)label, ValueString);
+
+   for (size_t i = 0; i < sizeof(empty_directories) / sizeof(char*); i++)
+   {
+      dir = pgmoneta_append(dir, data);
+      dir = pgmoneta_append(dir, empty_directories[i]);
+
+      if (pgmoneta_mkdir(dir))
+      {
+         pgmoneta_log_error("Restore: Could not create %s", dir);
+         goto error;
+      }
+
+      free(dir);
+      dir = NULL;
+   }
+
+   free(data);
+
+   return 0;
+
+error:
+
+   free(dir);
+   free(data);
+
+   return 1;
+}
+
+static void
+remove_fetched_backups(int server, struct deque* fetched)
+{
+   char* data = NULL;
+   struct deque_iterator* iter = NULL;
+
+   if (fetched == NULL)
+   {
+      return;
+   }
+
+   pgmoneta_deque_iterator_create(fetched, &iter);
+   while (pgmoneta_deque_iterator_next(iter))
+   {
+      data = pgmoneta_get_server_backup_identifier_data(server, (char*)pgmoneta_value_data(iter->value));
+      pgmoneta_delete_directory(data);
+      free(data);
+   }
+   pgmoneta_deque_iterator_destroy(iter);
+}
+
 static void
 cleanup_workspaces(int server, struct deque* labels)
 {
@@ -2708,12 +3621,11 @@ do_reconstruct_backup_file(struct worker_common* wc)
    {
       goto error;
    }
-   input->common.workers->outcome = true;
    free(input);
    return;
 
 error:
-   pgmoneta_log_error("Unable to construct file %s/%s", input->label, input->relative_dir, input->file_name);
+   pgmoneta_log_error("Unable to construct file %s/%s%s", input->label, input->relative_dir, input->file_name);
    input->common.workers->outcome = false;
    free(input);
    return;
@@ -2736,7 +3648,7 @@ do_copy_backup_file(struct worker_common* wc)
    return;
 
 error:
-   pgmoneta_log_error("Unable to construct file %s/%s", input->label, input->relative_dir, input->file_name);
+   pgmoneta_log_error("Unable to construct file %s/%s%s", input->label, input->relative_dir, input->file_name);
    input->common.workers->outcome = false;
    free(input);
    return;
@@ -2848,7 +3760,7 @@ copy_tablespaces_restore(char* from, char* to, char* base, char* server, char* i
 {
    char* from_tblspc = NULL;
    char* to_tblspc = NULL;
-   int idx = -1;
+   int idx;
    DIR* d = NULL;
    ssize_t size;
    struct dirent* entry;
@@ -2891,6 +3803,8 @@ copy_tablespaces_restore(char* from, char* to, char* base, char* server, char* i
             continue;
          }
 
+         idx = -1;
+
          link = pgmoneta_append(link, from_tblspc);
          link = pgmoneta_append(link, entry->d_name);
 
@@ -2953,7 +3867,10 @@ copy_tablespaces_restore(char* from, char* to, char* base, char* server, char* i
             pgmoneta_mkdir(to_directory);
             pgmoneta_symlink_at_file(to_oid, relative_directory);
 
-            pgmoneta_copy_directory(link, to_directory, NULL, workers);
+            memset(&path[0], 0, sizeof(path));
+            snprintf(&path[0], sizeof(path), "pg_tblspc/%s", entry->d_name);
+
+            tablespace_submit(link, to_directory, &path[0], workers);
 
             free(to_oid);
             free(to_directory);
@@ -3092,7 +4009,7 @@ copy_tablespaces_hotstandby(char* from, char* to, char* tblspc_mappings, struct
             }
          }
 
-         pgmoneta_copy_directory(src, dst, NULL, workers);
+         tablespace_submit(src, dst, NULL, workers);
 
          free(src);
          free(dst);
@@ -3112,3 +4029,61 @@ error:
 
    return 1;
 }
+
+static int
+tablespace_submit(char* from, char* to, char* relative_path, struct workers* workers)
+{
+   struct worker_input* wi = NULL;
+
+   if (pgmoneta_create_worker_input(relative_path, from, to, 0, workers, &wi))
+   {
+      return 1;
+   }
+
+   if (workers != NULL)
+   {
+      if (workers->outcome)
+      {
+         pgmoneta_workers_add(workers, do_tablespace, (struct worker_common*)wi);
+      }
+      else
+      {
+         free(wi);
+      }
+   }
+   else
+   {
+      do_tablespace((struct worker_common*)wi);
+   }
+
+   return 0;
+}
+
+static void
+do_tablespace(struct worker_common* wc)
+{
+   struct worker_input* wi = (struct worker_input*)wc;
+   int ret;
+
+   /* The files of the tablespace are queued on this worker, the idle workers steal them */
+   if (strlen(wi->directory) > 0)
+   {
+      ret = extract_selected_directory(wi->from, wi->to, wi->directory, NULL, wi->common.workers);
+   }
+   else
+   {
+      ret = pgmoneta_copy_directory(wi->from, wi->to, NULL, wi->common.workers);
+   }
+
+   if (ret)
+   {
+      pgmoneta_log_error("Tablespace: %s -> %s", wi->from, wi->to);
+
+      if (wi->common.workers != NULL)
+      {
+         wi->common.workers->outcome = false;
+      }
+   }
+
+   free(wi);
+}
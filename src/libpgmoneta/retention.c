@@ -28,16 +28,21 @@
 
 /* pgmoneta */
 #include <pgmoneta.h>
+#include <lock.h>
 #include <logging.h>
 #include <utils.h>
 #include <workflow.h>
 
-void
+/* system */
+#include <time.h>
+
+int
 pgmoneta_retention(char** argv)
 {
    int server = 0;
    struct workflow* workflow = NULL;
    struct art* nodes = NULL;
+   struct lock* lock = NULL;
    struct main_configuration* config;
 
    pgmoneta_start_logging();
@@ -48,9 +53,15 @@ pgmoneta_retention(char** argv)
 
    for (server = 0; server < config->common.number_of_servers; server++)
    {
-      bool active = false;
+      /* The retention follows the backup of the server in a batch, so they don't contend for the disk */
+      if (atomic_load(&config->common.servers[server].retention_after) > (long long)time(NULL))
+      {
+         pgmoneta_log_debug("Retention: Server %s waits for its backup", config->common.servers[server].name);
+         continue;
+      }
 
-      if (!atomic_compare_exchange_strong(&config->common.servers[server].repository, &active, true))
+      /* Each expired backup is locked by the delete, so only those block the retention */
+      if (pgmoneta_lock_repository(server, LOCK_SHARED, &lock))
       {
          pgmoneta_log_info("Retention: Server %s is active", config->common.servers[server].name);
          continue;
@@ -77,12 +88,11 @@ pgmoneta_retention(char** argv)
       workflow = NULL;
 
       config->common.servers[server].active_retention = false;
-      atomic_store(&config->common.servers[server].repository, false);
+      pgmoneta_unlock(lock);
+      lock = NULL;
    }
 
-   pgmoneta_stop_logging();
-
-   exit(0);
+   return 0;
 
 error:
 
@@ -90,9 +100,7 @@ error:
    pgmoneta_workflow_destroy(workflow);
 
    config->common.servers[server].active_retention = false;
-   atomic_store(&config->common.servers[server].repository, false);
-
-   pgmoneta_stop_logging();
+   pgmoneta_unlock(lock);
 
-   exit(1);
+   return 1;
 }
@@ -0,0 +1,531 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <csv.h>
+#include <info.h>
+#include <logging.h>
+#include <manifest.h>
+#include <reader.h>
+#include <scrub.h>
+#include <security.h>
+#include <utils.h>
+#include <walfile/wal_reader.h>
+
+/* system */
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* A WAL file changed more recently may still be compressed or encrypted */
+#define SCRUB_WAL_SETTLE 300
+
+/** @struct scrub_state
+ * Defines where the scrub pass of a server stopped
+ */
+struct scrub_state
+{
+   char label[MISC_LENGTH];   /**< The last backup scrubbed, empty at the start of a pass */
+   char wal[MISC_LENGTH];     /**< The last WAL file scrubbed, empty until the backups are done */
+   unsigned long wal_failed;  /**< The WAL files that failed so far in the pass */
+};
+
+static int scrub_server(int server, uint64_t budget);
+static int scrub_backup(int server, struct backup* backup, uint64_t* bytes);
+static int scrub_wal(int server, char* path, uint64_t* bytes);
+static int scrub_file(int server, char* path, int algorithm, char* checksum, uint64_t* bytes);
+
+static char* state_path(int server);
+static void state_read(int server, struct scrub_state* state);
+static int state_write(int server, struct scrub_state* state);
+
+int
+pgmoneta_scrub(char** argv)
+{
+   int ret = 0;
+   uint64_t budget = 0;
+   struct main_configuration* config;
+
+   pgmoneta_start_logging();
+
+   config = (struct main_configuration*)shmem;
+
+   pgmoneta_set_proc_title(1, argv, "scrub", NULL);
+
+   if (pgmoneta_reader_max_rate(config->scrub_max_rate))
+   {
+      pgmoneta_log_error("Scrub: Unable to limit the rate to %d", config->scrub_max_rate);
+      goto error;
+   }
+
+   /* With a rate limit a run reads what the rate allows until the next run */
+   if (config->scrub_max_rate > 0)
+   {
+      budget = (uint64_t)config->scrub_max_rate * (uint64_t)config->scrub_interval;
+   }
+
+   for (int server = 0; server < config->common.number_of_servers; server++)
+   {
+      bool active = false;
+
+      if (!atomic_compare_exchange_strong(&config->common.servers[server].scrub, &active, true))
+      {
+         pgmoneta_log_debug("Scrub: Server %s is being scrubbed", config->common.servers[server].name);
+         continue;
+      }
+
+      if (scrub_server(server, budget))
+      {
+         ret = 1;
+      }
+
+      atomic_store(&config->common.servers[server].scrub, false);
+   }
+
+   pgmoneta_reader_max_rate(0);
+
+   return ret;
+
+error:
+
+   pgmoneta_reader_max_rate(0);
+
+   return 1;
+}
+
+static int
+scrub_server(int server, uint64_t budget)
+{
+   char* d = NULL;
+   char* w = NULL;
+   char* path = NULL;
+   int number_of_backups = 0;
+   struct backup** backups = NULL;
+   int number_of_wal = 0;
+   char** wal = NULL;
+   uint64_t bytes = 0;
+   struct stat st;
+   struct scrub_state state;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   state_read(server, &state);
+   atomic_store(&config->common.servers[server].scrub_wal_failed, state.wal_failed);
+
+   d = pgmoneta_get_server_backup(server);
+
+   if (pgmoneta_get_backups(d, &number_of_backups, &backups))
+   {
+      goto error;
+   }
+
+   /* The backups come first, so a pass is only in the WAL once they are done */
+   if (strlen(state.wal) == 0)
+   {
+      for (int i = 0; i < number_of_backups; i++)
+      {
+         if (backups[i]->valid != VALID_TRUE)
+         {
+            continue;
+         }
+
+         if (strlen(state.label) > 0 && strcmp(backups[i]->label, state.label) <= 0)
+         {
+            continue;
+         }
+
+         if (scrub_backup(server, backups[i], &bytes))
+         {
+            goto error;
+         }
+
+         memset(state.label, 0, sizeof(state.label));
+         memcpy(state.label, backups[i]->label, strlen(backups[i]->label));
+         state_write(server, &state);
+
+         if (budget > 0 && bytes >= budget)
+         {
+            goto done;
+         }
+      }
+   }
+
+   /* The records can only be decoded with the version of the server */
+   if (config->common.servers[server].version == 0)
+   {
+      pgmoneta_log_debug("Scrub: The version of %s is unknown, the WAL is scrubbed later",
+                         config->common.servers[server].name);
+      goto done;
+   }
+
+   w = pgmoneta_get_server_wal(server);
+
+   if (pgmoneta_get_wal_files(w, &number_of_wal, &wal))
+   {
+      goto error;
+   }
+
+   for (int i = 0; i < number_of_wal; i++)
+   {
+      if (strlen(state.wal) > 0 && strcmp(wal[i], state.wal) <= 0)
+      {
+         continue;
+      }
+
+      path = pgmoneta_append(NULL, w);
+      path = pgmoneta_append(path, wal[i]);
+
+      if (stat(path, &st) || st.st_mtime + SCRUB_WAL_SETTLE > time(NULL))
+      {
+         free(path);
+         path = NULL;
+         break;
+      }
+
+      if (scrub_wal(server, path, &bytes))
+      {
+         state.wal_failed++;
+         atomic_store(&config->common.servers[server].scrub_wal_failed, state.wal_failed);
+      }
+
+      free(path);
+      path = NULL;
+
+      memset(state.wal, 0, sizeof(state.wal));
+      memcpy(state.wal, wal[i], strlen(wal[i]));
+      state_write(server, &state);
+
+      if (budget > 0 && bytes >= budget)
+      {
+         goto done;
+      }
+   }
+
+   pgmoneta_log_info("Scrub: Completed a pass of %s (%lu WAL files failed)",
+                     config->common.servers[server].name, state.wal_failed);
+
+   memset(&state, 0, sizeof(struct scrub_state));
+   state_write(server, &state);
+
+done:
+
+   for (int i = 0; i < number_of_backups; i++)
+   {
+      free(backups[i]);
+   }
+   free(backups);
+   for (int i = 0; i < number_of_wal; i++)
+   {
+      free(wal[i]);
+   }
+   free(wal);
+   free(d);
+   free(w);
+
+   return 0;
+
+error:
+
+   for (int i = 0; i < number_of_backups; i++)
+   {
+      free(backups[i]);
+   }
+   free(backups);
+   for (int i = 0; i < number_of_wal; i++)
+   {
+      free(wal[i]);
+   }
+   free(wal);
+   free(d);
+   free(w);
+
+   return 1;
+}
+
+static int
+scrub_backup(int server, struct backup* backup, uint64_t* bytes)
+{
+   char* base = NULL;
+   char* data = NULL;
+   char* manifest = NULL;
+   char* path = NULL;
+   int number_of_columns = 0;
+   char** columns = NULL;
+   unsigned long failed = 0;
+   struct csv_reader* csv = NULL;
+   struct info_batch* info = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   base = pgmoneta_get_server_backup_identifier(server, backup->label);
+   data = pgmoneta_get_server_backup_identifier_data(server, backup->label);
+
+   manifest = pgmoneta_append(manifest, base);
+   if (!pgmoneta_ends_with(manifest, "/"))
+   {
+      manifest = pgmoneta_append(manifest, "/");
+   }
+   manifest = pgmoneta_append(manifest, "backup.manifest");
+
+   pgmoneta_log_debug("Scrub: %s/%s", config->common.servers[server].name, backup->label);
+
+   if (pgmoneta_csv_reader_init(manifest, &csv))
+   {
+      pgmoneta_log_error("Scrub: Unable to read %s", manifest);
+      failed++;
+   }
+
+   while (csv != NULL && pgmoneta_csv_next_row(csv, &number_of_columns, &columns))
+   {
+      if (number_of_columns < MANIFEST_COLUMN_COUNT)
+      {
+         continue;
+      }
+
+      path = pgmoneta_backup_file_find(data, columns[MANIFEST_PATH_INDEX], backup);
+
+      if (path == NULL)
+      {
+         pgmoneta_log_error("Scrub: %s/%s is missing %s", config->common.servers[server].name,
+                            backup->label, columns[MANIFEST_PATH_INDEX]);
+         failed++;
+      }
+      else if (scrub_file(server, path, backup->hash_algorithm, columns[MANIFEST_CHECKSUM_INDEX], bytes))
+      {
+         pgmoneta_log_error("Scrub: %s/%s has an incorrect checksum for %s", config->common.servers[server].name,
+                            backup->label, columns[MANIFEST_PATH_INDEX]);
+         failed++;
+      }
+
+      free(path);
+      path = NULL;
+   }
+
+   pgmoneta_csv_reader_destroy(csv);
+
+   /* A backup deleted while it was scrubbed isn't damaged */
+   if (!pgmoneta_exists(base))
+   {
+      goto done;
+   }
+
+   if (!pgmoneta_info_begin(base, &info))
+   {
+      pgmoneta_info_set_unsigned_long(info, INFO_SCRUB, (unsigned long)time(NULL));
+      pgmoneta_info_set_unsigned_long(info, INFO_SCRUB_FAILED, failed);
+      pgmoneta_info_commit(info);
+   }
+
+   if (failed > 0)
+   {
+      pgmoneta_log_error("Scrub: %s/%s has %lu damaged files", config->common.servers[server].name,
+                         backup->label, failed);
+   }
+
+done:
+
+   free(base);
+   free(data);
+   free(manifest);
+
+   return 0;
+}
+
+static int
+scrub_wal(int server, char* path, uint64_t* bytes)
+{
+   bool failed = false;
+   struct stat st;
+   struct wal_record_iterator* iterator = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (pgmoneta_wal_record_iterator_create(path, server, NULL, &iterator))
+   {
+      failed = true;
+   }
+   else
+   {
+      iterator->crc = true;
+
+      while (pgmoneta_wal_record_iterator_next(iterator))
+      {
+      }
+
+      failed = iterator->corrupt;
+   }
+
+   pgmoneta_wal_record_iterator_destroy(iterator);
+
+   if (!stat(path, &st))
+   {
+      pgmoneta_reader_throttle((size_t)st.st_size);
+      *bytes += (uint64_t)st.st_size;
+      atomic_fetch_add(&config->common.servers[server].scrub_bytes, (unsigned long)st.st_size);
+   }
+   else
+   {
+      /* Removed by retention while it was scrubbed */
+      failed = false;
+   }
+
+   if (failed)
+   {
+      pgmoneta_log_error("Scrub: %s is damaged", path);
+      return 1;
+   }
+
+   return 0;
+}
+
+static int
+scrub_file(int server, char* path, int algorithm, char* checksum, uint64_t* bytes)
+{
+   uint64_t n = 0;
+   char* hash = NULL;
+   int ret = 1;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (!pgmoneta_reader_hash(path, algorithm, true, &n, &hash) && !strcmp(hash, checksum))
+   {
+      ret = 0;
+   }
+
+   *bytes += n;
+   atomic_fetch_add(&config->common.servers[server].scrub_bytes, (unsigned long)n);
+
+   free(hash);
+
+   return ret;
+}
+
+static char*
+state_path(int server)
+{
+   char* path = NULL;
+
+   path = pgmoneta_get_server(server);
+   if (path == NULL)
+   {
+      return NULL;
+   }
+
+   path = pgmoneta_append(path, "scrub.state");
+
+   return path;
+}
+
+/**
+ * Read where the scrub pass of a server stopped. The state is a single
+ * line with the last backup, the last WAL file and the failed WAL files
+ * @param server The server
+ * @param state [out] The state, empty when there is none
+ */
+static void
+state_read(int server, struct scrub_state* state)
+{
+   char* path = NULL;
+   int number_of_columns = 0;
+   char** columns = NULL;
+   struct csv_reader* csv = NULL;
+
+   memset(state, 0, sizeof(struct scrub_state));
+
+   path = state_path(server);
+
+   if (path != NULL && pgmoneta_exists(path) && !pgmoneta_csv_reader_init(path, &csv))
+   {
+      if (pgmoneta_csv_next_row(csv, &number_of_columns, &columns) && number_of_columns == 3)
+      {
+         memcpy(state->label, columns[0], MIN(strlen(columns[0]), sizeof(state->label) - 1));
+         memcpy(state->wal, columns[1], MIN(strlen(columns[1]), sizeof(state->wal) - 1));
+         state->wal_failed = strtoul(columns[2], NULL, 10);
+      }
+
+      pgmoneta_csv_reader_destroy(csv);
+   }
+
+   free(path);
+}
+
+static int
+state_write(int server, struct scrub_state* state)
+{
+   char* path = NULL;
+   char* tmp = NULL;
+   FILE* file = NULL;
+
+   path = state_path(server);
+   if (path == NULL)
+   {
+      goto error;
+   }
+
+   tmp = pgmoneta_append(tmp, path);
+   tmp = pgmoneta_append(tmp, ".tmp");
+
+   file = fopen(tmp, "w");
+   if (file == NULL)
+   {
+      pgmoneta_log_warn("Scrub: Could not write %s, the scrub restarts from the beginning", tmp);
+      goto error;
+   }
+
+   fprintf(file, "%s,%s,%lu\n", state->label, state->wal, state->wal_failed);
+   fflush(file);
+   fsync(fileno(file));
+   fclose(file);
+
+   if (rename(tmp, path))
+   {
+      goto error;
+   }
+
+   free(path);
+   free(tmp);
+
+   return 0;
+
+error:
+
+   free(path);
+   free(tmp);
+
+   return 1;
+}
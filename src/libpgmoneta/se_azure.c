@@ -28,31 +28,113 @@
 
 /* pgmoneta */
 #include <pgmoneta.h>
+#include <deque.h>
 #include <http.h>
+#include <journal.h>
+#include <link.h>
 #include <logging.h>
+#include <pack.h>
+#include <prometheus.h>
 #include <security.h>
+#include <storage.h>
 #include <utils.h>
 #include <workflow.h>
 
 /* system */
 #include <assert.h>
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define AZURE_VERSION         "2021-08-06"
+#define AZURE_MAX_BLOCKS      50000
+#define AZURE_BLOCK_ID_LENGTH 6
+#define AZURE_BLOCK_LIST_TYPE "application/xml"
+
+/** @struct azure_delta
+ * Defines the files shared with the previous backup on Azure
+ */
+struct azure_delta
+{
+   char* previous_root;          /**< The Azure root of the previous backup */
+   struct manifest_diff* diff;   /**< The difference of the manifests */
+   struct http_upload** copies;  /**< The server-side copies, owned by the scheduler */
+   int number_of_copies;         /**< The number of copies */
+   int capacity;                 /**< The capacity of the copies array */
+};
+
+/** @struct azure_blob
+ * Defines a blob uploaded as a list of blocks
+ */
+struct azure_blob
+{
+   char* azure_path;             /**< The path of the blob */
+   int number_of_blocks;         /**< The number of blocks */
+   struct http_upload** blocks;  /**< The block uploads, owned by the scheduler */
+   struct azure_blob* next;      /**< The next blob */
+};
+
+/** @struct azure_object
+ * Defines a blob of a listing
+ */
+struct azure_object
+{
+   char* relative_path;  /**< The path relative to the listed prefix */
+   off_t size;           /**< The size */
+};
+
+/** @struct azure_response
+ * Defines the body of a response
+ */
+struct azure_response
+{
+   char* data;   /**< The data, zero terminated */
+   size_t size;  /**< The size of the data */
+};
 
 static char* azure_storage_name(void);
 static int azure_storage_setup(char* name, struct art*);
 static int azure_storage_execute(char* name, struct art*);
 static int azure_storage_teardown(char* name, struct art*);
 
-static int azure_upload_files(char* local_root, char* azure_root, char* relative_path);
-static int azure_send_upload_request(char* local_root, char* azure_root, char* relative_path);
-
+static int azure_upload_backup(int server, char* label, char* local_root, char* azure_root, uint64_t* bytes);
+static void azure_upload_done(struct http_upload* upload, void* data);
+static int azure_block_key(char* azure_path, char* query, off_t offset, off_t size, char** key);
+static int azure_upload_files(struct http_scheduler* scheduler, struct azure_blob** blobs, struct azure_delta* delta, char* local_root, char* azure_root, char* relative_path);
+static int azure_queue_upload(struct http_scheduler* scheduler, struct azure_blob** blobs, struct azure_delta* delta, char* local_root, char* azure_root, char* relative_path, bool empty);
+static int azure_queue_copy(struct http_scheduler* scheduler, struct azure_delta* delta, char* azure_path, char* relative_path);
+static int azure_upload_failed_copies(struct http_scheduler* scheduler, struct azure_blob** blobs, struct azure_delta* delta, char* local_root, char* azure_root);
+static int azure_queue_blocks(struct http_scheduler* scheduler, struct azure_blob** blobs, char* local_path, char* azure_path, off_t file_size);
+static int azure_commit_blocks(struct azure_blob* blob);
+static void azure_blob_destroy(struct azure_blob* blob);
+static int azure_block_id(int number, char** block_id);
+static int azure_sign_upload(struct http_upload* upload, struct curl_slist** headers);
+static int azure_sign_download(struct http_upload* upload, struct curl_slist** headers);
+static int azure_sign_request(char* method, char* azure_path, char* query, size_t content_length, char* content_type, char* copy_source, char* range, bool blob_type, struct curl_slist** headers);
+static int azure_list_blobs(char* prefix, struct azure_object** objects, int* number_of_objects);
+static int azure_queue_download(struct http_scheduler* scheduler, char* local_root, char* azure_prefix, struct azure_object* object);
+static int azure_compare_objects(const void* a, const void* b);
+static size_t azure_response_cb(char* ptr, size_t size, size_t nmemb, void* userdata);
+static size_t azure_discard_cb(char* ptr, size_t size, size_t nmemb, void* userdata);
+
+static char* azure_get_url(char* azure_path, char* query);
 static char* azure_get_host(void);
 static char* azure_get_basepath(int server, char* identifier);
+static char* azure_get_walpath(int server, char* filename);
 
 static CURL* curl = NULL;
 
+/* The progress of the backup upload, NULL for other uploads */
+static struct journal* journal = NULL;
+
+/* The files of the data directory that are uploaded in the pack */
+static struct art* packed = NULL;
+
 struct workflow*
 pgmoneta_storage_create_azure(void)
 {
@@ -64,11 +146,267 @@ pgmoneta_storage_create_azure(void)
    wf->setup = &azure_storage_setup;
    wf->execute = &azure_storage_execute;
    wf->teardown = &azure_storage_teardown;
+   wf->execute_file = NULL;
+   wf->independent = false;
    wf->next = NULL;
 
    return wf;
 }
 
+int
+pgmoneta_azure_wal_upload(int server, char* directory, struct deque* files)
+{
+   struct timespec start_t;
+   struct timespec end_t;
+   char* local_path = NULL;
+   char* azure_path = NULL;
+   char* azure_url = NULL;
+   struct stat file_info;
+   struct http_scheduler* scheduler = NULL;
+   struct deque_iterator* iter = NULL;
+   struct main_configuration* config;
+
+#ifdef HAVE_FREEBSD
+   clock_gettime(CLOCK_MONOTONIC_FAST, &start_t);
+#else
+   clock_gettime(CLOCK_MONOTONIC_RAW, &start_t);
+#endif
+
+   config = (struct main_configuration*)shmem;
+
+   if (pgmoneta_http_scheduler_create(config->upload_concurrency, config->upload_max_rate, &scheduler))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_deque_iterator_create(files, &iter))
+   {
+      goto error;
+   }
+
+   /* A segment is at most 1GB, so it is always a single Put Blob */
+   while (pgmoneta_deque_iterator_next(iter))
+   {
+      char* filename = (char*)pgmoneta_value_data(iter->value);
+
+      local_path = pgmoneta_append(local_path, directory);
+      local_path = pgmoneta_append(local_path, filename);
+
+      if (stat(local_path, &file_info) != 0)
+      {
+         pgmoneta_log_error("Azure: Could not stat %s: %s", local_path, strerror(errno));
+         goto error;
+      }
+
+      azure_path = azure_get_walpath(server, filename);
+      azure_url = azure_get_url(azure_path, NULL);
+
+      if (pgmoneta_http_scheduler_add(scheduler, local_path, 0, file_info.st_size, azure_url, azure_path, NULL,
+                                      &azure_sign_upload, NULL, NULL))
+      {
+         goto error;
+      }
+
+      free(local_path);
+      local_path = NULL;
+
+      free(azure_path);
+      azure_path = NULL;
+
+      free(azure_url);
+      azure_url = NULL;
+   }
+
+   if (pgmoneta_http_scheduler_run(scheduler))
+   {
+      goto error;
+   }
+
+#ifdef HAVE_FREEBSD
+   clock_gettime(CLOCK_MONOTONIC_FAST, &end_t);
+#else
+   clock_gettime(CLOCK_MONOTONIC_RAW, &end_t);
+#endif
+
+   pgmoneta_prometheus_upload(UPLOAD_ENGINE_AZURE, pgmoneta_http_scheduler_bytes(scheduler), pgmoneta_compute_duration(start_t, end_t));
+
+   pgmoneta_deque_iterator_destroy(iter);
+   pgmoneta_http_scheduler_destroy(scheduler);
+
+   return 0;
+
+error:
+
+   pgmoneta_deque_iterator_destroy(iter);
+   pgmoneta_http_scheduler_destroy(scheduler);
+
+   free(local_path);
+   free(azure_path);
+   free(azure_url);
+
+   return 1;
+}
+
+int
+pgmoneta_azure_fetch(int server, char* label, bool (*filter)(char*))
+{
+   char* local_root = NULL;
+   char* azure_prefix = NULL;
+   char* pack = NULL;
+   char* pack_prefix = NULL;
+   struct azure_object* objects = NULL;
+   struct azure_object* pack_objects = NULL;
+   int number_of_objects = 0;
+   int number_of_pack_objects = 0;
+   int number_of_files = 0;
+   bool own_curl = false;
+   struct http_scheduler* scheduler = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   local_root = pgmoneta_get_server_backup_identifier_data(server, label);
+   azure_prefix = azure_get_basepath(server, label);
+   azure_prefix = pgmoneta_append(azure_prefix, "/data/");
+
+   if (curl == NULL)
+   {
+      curl = curl_easy_init();
+      if (curl == NULL)
+      {
+         goto error;
+      }
+      own_curl = true;
+   }
+
+   if (azure_list_blobs(azure_prefix, &objects, &number_of_objects))
+   {
+      goto error;
+   }
+
+   /* The small files are in the pack, next to the data directory */
+   pack = pgmoneta_pack_path(server, label);
+   pack_prefix = azure_get_basepath(server, label);
+   pack_prefix = pgmoneta_append(pack_prefix, "/");
+   pack_prefix = pgmoneta_append(pack_prefix, PACK_NAME);
+
+   if (azure_list_blobs(pack_prefix, &pack_objects, &number_of_pack_objects))
+   {
+      goto error;
+   }
+
+   if (number_of_objects == 0 && number_of_pack_objects == 0)
+   {
+      pgmoneta_log_error("Azure: No files for %s/%s", config->common.servers[server].name, label);
+      goto error;
+   }
+
+   /* The biggest files go first, so their ranges keep all connections busy until the end */
+   qsort(objects, number_of_objects, sizeof(struct azure_object), azure_compare_objects);
+
+   if (pgmoneta_http_scheduler_create(config->upload_concurrency, 0, &scheduler))
+   {
+      goto error;
+   }
+
+   for (int i = 0; i < number_of_objects; i++)
+   {
+      if (filter != NULL && !filter(objects[i].relative_path))
+      {
+         continue;
+      }
+
+      if (azure_queue_download(scheduler, local_root, azure_prefix, &objects[i]))
+      {
+         goto error;
+      }
+
+      number_of_files++;
+   }
+
+   for (int i = 0; i < number_of_pack_objects; i++)
+   {
+      if (azure_queue_download(scheduler, pack, pack_prefix, &pack_objects[i]))
+      {
+         goto error;
+      }
+   }
+
+   if (pgmoneta_http_scheduler_run(scheduler))
+   {
+      goto error;
+   }
+
+   if (number_of_pack_objects > 0)
+   {
+      if (pgmoneta_pack_extract(pack, local_root, filter))
+      {
+         goto error;
+      }
+   }
+
+   pgmoneta_log_info("Azure: Fetched %d files (%s/%s)", number_of_files, config->common.servers[server].name, label);
+
+   pgmoneta_http_scheduler_destroy(scheduler);
+
+   if (own_curl)
+   {
+      curl_easy_cleanup(curl);
+      curl = NULL;
+   }
+
+   for (int i = 0; i < number_of_objects; i++)
+   {
+      free(objects[i].relative_path);
+   }
+   free(objects);
+   for (int i = 0; i < number_of_pack_objects; i++)
+   {
+      free(pack_objects[i].relative_path);
+   }
+   free(pack_objects);
+   free(local_root);
+   free(azure_prefix);
+   free(pack);
+   free(pack_prefix);
+
+   return 0;
+
+error:
+
+   pgmoneta_http_scheduler_destroy(scheduler);
+
+   if (own_curl)
+   {
+      curl_easy_cleanup(curl);
+      curl = NULL;
+   }
+
+   /* A partial backup must not be mistaken for a complete one */
+   pgmoneta_delete_directory(local_root);
+   if (pack != NULL)
+   {
+      pgmoneta_pack_delete(pack);
+   }
+
+   for (int i = 0; i < number_of_objects; i++)
+   {
+      free(objects[i].relative_path);
+   }
+   free(objects);
+   for (int i = 0; i < number_of_pack_objects; i++)
+   {
+      free(pack_objects[i].relative_path);
+   }
+   free(pack_objects);
+   free(local_root);
+   free(azure_prefix);
+   free(pack);
+   free(pack_prefix);
+
+   return 1;
+}
+
 static char*
 azure_storage_name(void)
 {
@@ -123,6 +461,8 @@ azure_storage_execute(char* name __attribute__((unused)), struct art* nodes)
    double remote_azure_elapsed_time;
    char* local_root = NULL;
    char* azure_root = NULL;
+   char* pack = NULL;
+   uint64_t bytes = 0;
    struct main_configuration* config;
 
 #ifdef HAVE_FREEBSD
@@ -154,11 +494,49 @@ azure_storage_execute(char* name __attribute__((unused)), struct art* nodes)
    local_root = pgmoneta_get_server_backup_identifier(server, label);
    azure_root = azure_get_basepath(server, label);
 
-   if (azure_upload_files(local_root, azure_root, ""))
+   /* The journal keeps the completed files and blocks, so a failed run resumes where it stopped */
+   if (pgmoneta_journal_open(local_root, "azure", &journal))
    {
       goto error;
    }
 
+   /* The small files are uploaded as one blob, instead of one request each */
+   if (config->storage_pack_size > 0)
+   {
+      char* data = pgmoneta_get_server_backup_identifier_data(server, label);
+
+      pack = pgmoneta_pack_path(server, label);
+
+      if (pgmoneta_pack_create(data, (uint64_t)config->storage_pack_size, pack, &packed))
+      {
+         free(data);
+         goto error;
+      }
+
+      free(data);
+   }
+
+   for (int round = 1; azure_upload_backup(server, label, local_root, azure_root, &bytes); round++)
+   {
+      if (round == STORAGE_UPLOAD_ROUNDS)
+      {
+         goto error;
+      }
+
+      pgmoneta_log_warn("Azure: Resuming the upload of %s/%s (%d files and blocks done)",
+                        config->common.servers[server].name, label, pgmoneta_journal_size(journal));
+   }
+
+   pgmoneta_journal_close(journal, true);
+   journal = NULL;
+
+   if (pack != NULL)
+   {
+      pgmoneta_pack_delete(pack);
+   }
+   pgmoneta_art_destroy(packed);
+   packed = NULL;
+
 #ifdef HAVE_FREEBSD
    clock_gettime(CLOCK_MONOTONIC_FAST, &end_t);
 #else
@@ -169,15 +547,26 @@ azure_storage_execute(char* name __attribute__((unused)), struct art* nodes)
 
    pgmoneta_update_info_double(local_root, INFO_REMOTE_AZURE_ELAPSED, remote_azure_elapsed_time);
 
+   pgmoneta_prometheus_upload(UPLOAD_ENGINE_AZURE, bytes, remote_azure_elapsed_time);
+
    free(local_root);
    free(azure_root);
+   free(pack);
 
    return 0;
 
 error:
 
+   pgmoneta_journal_close(journal, false);
+   journal = NULL;
+
+   /* The pack is kept with the journal, so the next upload resumes with it */
+   pgmoneta_art_destroy(packed);
+   packed = NULL;
+
    free(local_root);
    free(azure_root);
+   free(pack);
 
    return 1;
 }
@@ -213,6 +602,7 @@ azure_storage_teardown(char* name __attribute__((unused)), struct art* nodes)
    pgmoneta_delete_directory(root);
 
    curl_easy_cleanup(curl);
+   curl = NULL;
 
    pgmoneta_log_debug("Azure storage engine (teardown): %s/%s", config->common.servers[server].name, label);
 
@@ -222,132 +612,689 @@ azure_storage_teardown(char* name __attribute__((unused)), struct art* nodes)
 }
 
 static int
-azure_upload_files(char* local_root, char* azure_root, char* relative_path)
+azure_upload_backup(int server, char* label, char* local_root, char* azure_root, uint64_t* bytes)
 {
-   char* local_path = NULL;
-   char* relative_file;
-   char* new_file;
-   bool copied_files = false;
-   DIR* dir;
-   struct dirent* entry;
+   struct http_scheduler* scheduler = NULL;
+   struct azure_blob* blobs = NULL;
+   struct azure_blob* b = NULL;
+   char* previous = NULL;
+   struct azure_delta delta;
+   struct main_configuration* config;
 
-   local_path = pgmoneta_append(local_path, local_root);
-   local_path = pgmoneta_append(local_path, relative_path);
+   config = (struct main_configuration*)shmem;
 
-   if (!(dir = opendir(local_path)))
+   memset(&delta, 0, sizeof(struct azure_delta));
+
+   if (pgmoneta_http_scheduler_create(config->upload_concurrency, config->upload_max_rate, &scheduler))
    {
       goto error;
    }
 
-   while ((entry = readdir(dir)) != NULL)
-   {
-      if (entry->d_type == DT_DIR)
-      {
-         char relative_dir[1024];
-
-         if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
-         {
-            continue;
-         }
+   pgmoneta_http_scheduler_on_done(scheduler, &azure_upload_done, NULL);
 
-         snprintf(relative_dir, sizeof(relative_dir), "%s/%s", relative_path, entry->d_name);
+   if (pgmoneta_link_delta(server, label, &previous, &delta.diff))
+   {
+      goto error;
+   }
 
-         azure_upload_files(local_root, azure_root, relative_dir);
-      }
-      else
-      {
-         copied_files = true;
+   if (previous != NULL)
+   {
+      delta.previous_root = azure_get_basepath(server, previous);
+      pgmoneta_log_debug("Azure: Copying unchanged files from %s", delta.previous_root);
+   }
 
-         relative_file = NULL;
+   if (azure_upload_files(scheduler, &blobs, &delta, local_root, azure_root, ""))
+   {
+      goto error;
+   }
 
-         relative_file = pgmoneta_append(relative_file, relative_path);
-         relative_file = pgmoneta_append(relative_file, "/");
-         relative_file = pgmoneta_append(relative_file, entry->d_name);
+   if (pgmoneta_http_scheduler_run(scheduler))
+   {
+      goto error;
+   }
 
-         if (azure_send_upload_request(local_root, azure_root, relative_file))
-         {
-            free(relative_file);
-            goto error;
-         }
+   if (azure_upload_failed_copies(scheduler, &blobs, &delta, local_root, azure_root))
+   {
+      goto error;
+   }
 
-         free(relative_file);
+   for (b = blobs; b != NULL; b = b->next)
+   {
+      if (azure_commit_blocks(b))
+      {
+         goto error;
       }
    }
 
-   // In case no files are copied, then the directory is empty.
-   // Create a .pgmoneta file for uploading.
-   if (!copied_files)
+   *bytes += pgmoneta_http_scheduler_bytes(scheduler);
+
+   while (blobs != NULL)
    {
-      relative_file = NULL;
+      b = blobs->next;
+      azure_blob_destroy(blobs);
+      blobs = b;
+   }
 
-      relative_file = pgmoneta_append(relative_file, relative_path);
-      relative_file = pgmoneta_append(relative_file, "/.pgmoneta");
+   pgmoneta_http_scheduler_destroy(scheduler);
 
-      new_file = NULL;
+   pgmoneta_manifest_diff_destroy(delta.diff);
+   free(delta.copies);
+   free(delta.previous_root);
+   free(previous);
 
-      new_file = pgmoneta_append(new_file, local_root);
-      new_file = pgmoneta_append(new_file, relative_file);
+   return 0;
 
-      FILE* file = fopen(new_file, "w");
+error:
 
-      pgmoneta_permission(new_file, 6, 4, 4);
+   if (scheduler != NULL)
+   {
+      *bytes += pgmoneta_http_scheduler_bytes(scheduler);
+   }
 
-      azure_send_upload_request(local_root, azure_root, relative_file);
+   /* Uncommitted blocks are kept by Azure for a week, so the next run commits them */
+   while (blobs != NULL)
+   {
+      b = blobs->next;
+      azure_blob_destroy(blobs);
+      blobs = b;
+   }
 
-      fclose(file);
+   pgmoneta_http_scheduler_destroy(scheduler);
 
-      remove(new_file);
+   pgmoneta_manifest_diff_destroy(delta.diff);
+   free(delta.copies);
+   free(delta.previous_root);
+   free(previous);
 
-      free(new_file);
-      free(relative_file);
-   }
+   return 1;
+}
 
-   closedir(dir);
+static void
+azure_upload_done(struct http_upload* upload, void* data __attribute__((unused)))
+{
+   char* key = NULL;
 
-   free(local_path);
+   if (upload->query != NULL && pgmoneta_starts_with(upload->query, "blockid="))
+   {
+      if (azure_block_key(upload->resource, upload->query, upload->offset, upload->size, &key))
+      {
+         return;
+      }
+   }
+   else
+   {
+      key = pgmoneta_append(key, "file ");
+      key = pgmoneta_append(key, upload->resource);
+   }
+
+   pgmoneta_journal_add(journal, key, NULL);
+
+   free(key);
+}
+
+static int
+azure_block_key(char* azure_path, char* query, off_t offset, off_t size, char** key)
+{
+   char* k = NULL;
+
+   /* The range is part of the key, so a block of another block size is never used */
+   k = pgmoneta_append(k, "block ");
+   k = pgmoneta_append(k, azure_path);
+   k = pgmoneta_append(k, " ");
+   k = pgmoneta_append(k, query);
+   k = pgmoneta_append(k, " ");
+   k = pgmoneta_append_ulong(k, (unsigned long)offset);
+   k = pgmoneta_append(k, " ");
+   k = pgmoneta_append_ulong(k, (unsigned long)size);
+
+   *key = k;
+
+   return k == NULL ? 1 : 0;
+}
+
+static int
+azure_upload_files(struct http_scheduler* scheduler, struct azure_blob** blobs, struct azure_delta* delta, char* local_root, char* azure_root, char* relative_path)
+{
+   char* local_path = NULL;
+   char* relative_file;
+   bool copied_files = false;
+   DIR* dir = NULL;
+   struct dirent* entry;
+
+   local_path = pgmoneta_append(local_path, local_root);
+   local_path = pgmoneta_append(local_path, relative_path);
+
+   if (!(dir = opendir(local_path)))
+   {
+      goto error;
+   }
+
+   while ((entry = readdir(dir)) != NULL)
+   {
+      if (entry->d_type == DT_DIR)
+      {
+         char relative_dir[1024];
+
+         if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+         {
+            continue;
+         }
+
+         snprintf(relative_dir, sizeof(relative_dir), "%s/%s", relative_path, entry->d_name);
+
+         if (azure_upload_files(scheduler, blobs, delta, local_root, azure_root, relative_dir))
+         {
+            goto error;
+         }
+      }
+      else if (strlen(relative_path) == 0 && pgmoneta_ends_with(entry->d_name, JOURNAL_SUFFIX))
+      {
+         continue;
+      }
+      else
+      {
+         copied_files = true;
+
+         relative_file = NULL;
+
+         relative_file = pgmoneta_append(relative_file, relative_path);
+         relative_file = pgmoneta_append(relative_file, "/");
+         relative_file = pgmoneta_append(relative_file, entry->d_name);
+
+         /* The directory of a packed file is created when the pack is extracted */
+         if (packed != NULL && pgmoneta_starts_with(relative_file, "/data/") &&
+             pgmoneta_art_contains_key(packed, relative_file + strlen("/data/")))
+         {
+            free(relative_file);
+            continue;
+         }
+
+         if (azure_queue_upload(scheduler, blobs, delta, local_root, azure_root, relative_file, false))
+         {
+            free(relative_file);
+            goto error;
+         }
+
+         free(relative_file);
+      }
+   }
+
+   // In case no files are copied, then the directory is empty.
+   // Upload an empty .pgmoneta file, so the directory exists.
+   if (!copied_files)
+   {
+      relative_file = NULL;
+
+      relative_file = pgmoneta_append(relative_file, relative_path);
+      relative_file = pgmoneta_append(relative_file, "/.pgmoneta");
+
+      if (azure_queue_upload(scheduler, blobs, delta, local_root, azure_root, relative_file, true))
+      {
+         free(relative_file);
+         goto error;
+      }
+
+      free(relative_file);
+   }
+
+   closedir(dir);
+
+   free(local_path);
+
+   return 0;
+
+error:
+
+   if (dir != NULL)
+   {
+      closedir(dir);
+   }
+
+   free(local_path);
+
+   return 1;
+}
+
+static int
+azure_queue_upload(struct http_scheduler* scheduler, struct azure_blob** blobs, struct azure_delta* delta, char* local_root, char* azure_root, char* relative_path, bool empty)
+{
+   char* local_path = NULL;
+   char* azure_path = NULL;
+   char* azure_url = NULL;
+   char* key = NULL;
+   struct stat file_info;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   memset(&file_info, 0, sizeof(struct stat));
+
+   azure_path = pgmoneta_append(azure_path, azure_root);
+   azure_path = pgmoneta_append(azure_path, relative_path);
+
+   key = pgmoneta_append(key, "file ");
+   key = pgmoneta_append(key, azure_path);
+
+   if (pgmoneta_journal_contains(journal, key))
+   {
+      goto done;
+   }
+
+   if (!empty)
+   {
+      local_path = pgmoneta_append(local_path, local_root);
+      local_path = pgmoneta_append(local_path, relative_path);
+
+      if (stat(local_path, &file_info) != 0)
+      {
+         pgmoneta_log_error("Azure: Could not stat %s: %s", local_path, strerror(errno));
+         goto error;
+      }
+   }
+
+   if (!empty && delta != NULL && delta->previous_root != NULL &&
+       pgmoneta_starts_with(relative_path, "/data/") &&
+       pgmoneta_link_is_unchanged(relative_path + strlen("/data/"), delta->diff))
+   {
+      if (azure_queue_copy(scheduler, delta, azure_path, relative_path))
+      {
+         goto error;
+      }
+   }
+   else if (file_info.st_size > config->azure_block_size)
+   {
+      if (azure_queue_blocks(scheduler, blobs, local_path, azure_path, file_info.st_size))
+      {
+         goto error;
+      }
+   }
+   else
+   {
+      azure_url = azure_get_url(azure_path, NULL);
+
+      if (pgmoneta_http_scheduler_add(scheduler, local_path, 0, file_info.st_size, azure_url, azure_path, NULL,
+                                      &azure_sign_upload, NULL, NULL))
+      {
+         goto error;
+      }
+   }
+
+done:
+
+   free(local_path);
+   free(azure_path);
+   free(azure_url);
+   free(key);
+
+   return 0;
+
+error:
+
+   free(local_path);
+   free(azure_path);
+   free(azure_url);
+   free(key);
+
+   return 1;
+}
+
+static int
+azure_queue_copy(struct http_scheduler* scheduler, struct azure_delta* delta, char* azure_path, char* relative_path)
+{
+   char* azure_url = NULL;
+   char* source_path = NULL;
+   char* source = NULL;
+   struct http_upload* upload = NULL;
+
+   if (delta->number_of_copies == delta->capacity)
+   {
+      int capacity = delta->capacity == 0 ? 64 : delta->capacity * 2;
+      struct http_upload** copies = NULL;
+
+      copies = (struct http_upload**)realloc(delta->copies, capacity * sizeof(struct http_upload*));
+      if (copies == NULL)
+      {
+         goto error;
+      }
+
+      delta->copies = copies;
+      delta->capacity = capacity;
+   }
+
+   source_path = pgmoneta_append(source_path, delta->previous_root);
+   source_path = pgmoneta_append(source_path, relative_path);
+
+   source = azure_get_url(source_path, NULL);
+   azure_url = azure_get_url(azure_path, NULL);
+
+   if (pgmoneta_http_scheduler_copy(scheduler, azure_url, azure_path, source, &azure_sign_upload, NULL, &upload))
+   {
+      goto error;
+   }
+
+   delta->copies[delta->number_of_copies++] = upload;
+
+   free(azure_url);
+   free(source_path);
+   free(source);
+
+   return 0;
+
+error:
+
+   free(azure_url);
+   free(source_path);
+   free(source);
+
+   return 1;
+}
+
+static int
+azure_upload_failed_copies(struct http_scheduler* scheduler, struct azure_blob** blobs, struct azure_delta* delta, char* local_root, char* azure_root)
+{
+   int failed = 0;
+
+   for (int i = 0; i < delta->number_of_copies; i++)
+   {
+      if (pgmoneta_http_upload_failed(delta->copies[i]))
+      {
+         char* relative_path = delta->copies[i]->resource + strlen(azure_root);
+
+         pgmoneta_log_debug("Azure: Uploading %s instead of copying it", delta->copies[i]->resource);
+
+         if (azure_queue_upload(scheduler, blobs, NULL, local_root, azure_root, relative_path, false))
+         {
+            goto error;
+         }
+
+         failed++;
+      }
+   }
+
+   pgmoneta_log_debug("Azure: Copied %d of %d unchanged files", delta->number_of_copies - failed, delta->number_of_copies);
+
+   if (failed > 0 && pgmoneta_http_scheduler_run(scheduler))
+   {
+      goto error;
+   }
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+static int
+azure_queue_blocks(struct http_scheduler* scheduler, struct azure_blob** blobs, char* local_path, char* azure_path, off_t file_size)
+{
+   off_t block_size;
+   char* block_id = NULL;
+   char* query = NULL;
+   char* azure_url = NULL;
+   char* key = NULL;
+   struct azure_blob* blob = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   block_size = config->azure_block_size;
+   if ((file_size + block_size - 1) / block_size > AZURE_MAX_BLOCKS)
+   {
+      block_size = (file_size + AZURE_MAX_BLOCKS - 1) / AZURE_MAX_BLOCKS;
+   }
+
+   blob = (struct azure_blob*)calloc(1, sizeof(struct azure_blob));
+   if (blob == NULL)
+   {
+      goto error;
+   }
+
+   blob->azure_path = pgmoneta_append(blob->azure_path, azure_path);
+   blob->number_of_blocks = (int)((file_size + block_size - 1) / block_size);
+   blob->blocks = (struct http_upload**)calloc(blob->number_of_blocks, sizeof(struct http_upload*));
+   if (blob->blocks == NULL)
+   {
+      goto error;
+   }
+
+   blob->next = *blobs;
+   *blobs = blob;
+
+   pgmoneta_log_debug("Azure: Uploading %s in %d blocks of %lld bytes",
+                      azure_path, blob->number_of_blocks, (long long)block_size);
+
+   for (int i = 0; i < blob->number_of_blocks; i++)
+   {
+      off_t offset = (off_t)i * block_size;
+      off_t size = file_size - offset < block_size ? file_size - offset : block_size;
+
+      if (azure_block_id(i, &block_id))
+      {
+         goto error;
+      }
+
+      query = pgmoneta_append(query, "blockid=");
+      query = pgmoneta_append(query, block_id);
+      query = pgmoneta_append(query, "&comp=block");
+
+      if (azure_block_key(azure_path, query, offset, size, &key))
+      {
+         goto error;
+      }
+
+      /* A block of an earlier run is still uncommitted on Azure */
+      if (pgmoneta_journal_contains(journal, key))
+      {
+         free(key);
+         key = NULL;
+         free(block_id);
+         block_id = NULL;
+         free(query);
+         query = NULL;
+         continue;
+      }
+
+      free(key);
+      key = NULL;
+
+      azure_url = azure_get_url(azure_path, query);
+
+      if (pgmoneta_http_scheduler_add(scheduler, local_path, offset, size, azure_url, azure_path, query,
+                                      &azure_sign_upload, NULL, &blob->blocks[i]))
+      {
+         goto error;
+      }
+
+      free(block_id);
+      block_id = NULL;
+      free(query);
+      query = NULL;
+      free(azure_url);
+      azure_url = NULL;
+   }
+
+   return 0;
+
+error:
+
+   if (blob != NULL && *blobs != blob)
+   {
+      azure_blob_destroy(blob);
+   }
+
+   free(block_id);
+   free(query);
+   free(azure_url);
+   free(key);
+
+   return 1;
+}
+
+static int
+azure_commit_blocks(struct azure_blob* blob)
+{
+   char* block_id = NULL;
+   char* body = NULL;
+   char* azure_url = NULL;
+   char* key = NULL;
+   struct curl_slist* chunk = NULL;
+   CURLcode res;
+   long code = 0;
+
+   body = pgmoneta_append(body, "<?xml version=\"1.0\" encoding=\"utf-8\"?><BlockList>");
+   for (int i = 0; i < blob->number_of_blocks; i++)
+   {
+      if (azure_block_id(i, &block_id))
+      {
+         goto error;
+      }
+
+      body = pgmoneta_append(body, "<Latest>");
+      body = pgmoneta_append(body, block_id);
+      body = pgmoneta_append(body, "</Latest>");
+
+      free(block_id);
+      block_id = NULL;
+   }
+   body = pgmoneta_append(body, "</BlockList>");
+
+   if (azure_sign_request("PUT", blob->azure_path, "comp=blocklist", strlen(body), AZURE_BLOCK_LIST_TYPE, NULL, NULL, false, &chunk))
+   {
+      goto error;
+   }
+
+   azure_url = azure_get_url(blob->azure_path, "comp=blocklist");
+
+   curl_easy_reset(curl);
+
+   if (pgmoneta_http_set_header_option(curl, chunk))
+   {
+      goto error;
+   }
+
+   pgmoneta_http_set_url_option(curl, azure_url);
+
+   curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "PUT");
+   curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body);
+   curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)strlen(body));
+   curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, azure_discard_cb);
+
+   res = curl_easy_perform(curl);
+   if (res != CURLE_OK)
+   {
+      pgmoneta_log_error("Azure: Put Block List %s failed: %s", blob->azure_path, curl_easy_strerror(res));
+      goto error;
+   }
+
+   curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+   if (code < 200 || code > 299)
+   {
+      pgmoneta_log_error("Azure: Put Block List %s failed: HTTP %ld", blob->azure_path, code);
+      goto error;
+   }
+
+   key = pgmoneta_append(key, "file ");
+   key = pgmoneta_append(key, blob->azure_path);
+
+   pgmoneta_journal_add(journal, key, NULL);
+
+   free(key);
+   free(body);
+   free(azure_url);
+   curl_slist_free_all(chunk);
 
    return 0;
 
 error:
 
-   closedir(dir);
-
-   free(local_path);
+   free(block_id);
+   free(body);
+   free(azure_url);
+   curl_slist_free_all(chunk);
 
    return 1;
 }
 
+static void
+azure_blob_destroy(struct azure_blob* blob)
+{
+   if (blob == NULL)
+   {
+      return;
+   }
+
+   /* The blocks themselves are owned by the scheduler */
+   free(blob->azure_path);
+   free(blob->blocks);
+   free(blob);
+}
+
+static int
+azure_block_id(int number, char** block_id)
+{
+   char id[AZURE_BLOCK_ID_LENGTH + 1];
+   size_t length = 0;
+
+   *block_id = NULL;
+
+   /* All the ids of a blob must have the same length. Base64 of decimal digits
+    * has no '+', '/' or '=', so the id can go into the query as is */
+   snprintf(&id[0], sizeof(id), "%0*d", AZURE_BLOCK_ID_LENGTH, number);
+
+   if (pgmoneta_base64_encode(&id[0], AZURE_BLOCK_ID_LENGTH, block_id, &length))
+   {
+      return 1;
+   }
+
+   return 0;
+}
+
+static int
+azure_sign_upload(struct http_upload* upload, struct curl_slist** headers)
+{
+   /* Put Blob carries the blob type, Put Block and Copy Blob don't */
+   return azure_sign_request("PUT", upload->resource, upload->query, (size_t)upload->size, NULL, upload->source,
+                             NULL, upload->query == NULL && upload->source == NULL, headers);
+}
+
+static int
+azure_sign_download(struct http_upload* upload, struct curl_slist** headers)
+{
+   char* range = NULL;
+   int ret;
+
+   if (pgmoneta_http_range(upload, &range))
+   {
+      return 1;
+   }
+
+   ret = azure_sign_request("GET", upload->resource, NULL, 0, NULL, NULL, range, false, headers);
+
+   free(range);
+
+   return ret;
+}
+
 static int
-azure_send_upload_request(char* local_root, char* azure_root, char* relative_path)
+azure_sign_request(char* method, char* azure_path, char* query, size_t content_length, char* content_type, char* copy_source, char* range, bool blob_type, struct curl_slist** headers)
 {
+   bool value = false;
    char utc_date[UTC_TIME_LENGTH];
    char* string_to_sign = NULL;
    char* signing_key = NULL;
-   char* signature = NULL;
    char* base64_signature = NULL;
    size_t base64_signature_length;
-   char* local_path = NULL;
-   char* azure_path = NULL;
-   char* azure_host = NULL;
-   char* azure_url = NULL;
    char* auth_value = NULL;
    unsigned char* signature_hmac = NULL;
-   unsigned char* signature_hex = NULL;
    int hmac_length = 0;
    size_t signing_key_length = 0;
-   FILE* file = NULL;
-   struct stat file_info;
-   CURLcode res = -1;
    struct curl_slist* chunk = NULL;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
 
-   local_path = pgmoneta_append(local_path, local_root);
-   local_path = pgmoneta_append(local_path, relative_path);
-
-   azure_path = pgmoneta_append(azure_path, azure_root);
-   azure_path = pgmoneta_append(azure_path, relative_path);
+   *headers = NULL;
 
    memset(&utc_date[0], 0, sizeof(utc_date));
 
@@ -356,36 +1303,71 @@ azure_send_upload_request(char* local_root, char* azure_root, char* relative_pat
       goto error;
    }
 
-   file = fopen(local_path, "rb");
-   if (file == NULL)
+   // Construct string to sign. Content-Length is empty when zero.
+   string_to_sign = pgmoneta_append(string_to_sign, method);
+   string_to_sign = pgmoneta_append(string_to_sign, "\n\n\n");
+   if (content_length > 0)
    {
-      goto error;
+      string_to_sign = pgmoneta_append_ulong(string_to_sign, (unsigned long)content_length);
    }
-
-   if (fstat(fileno(file), &file_info) != 0)
+   string_to_sign = pgmoneta_append(string_to_sign, "\n\n");
+   if (content_type != NULL)
    {
-      goto error;
+      string_to_sign = pgmoneta_append(string_to_sign, content_type);
    }
-
-   // Construct string to sign.
-   if (file_info.st_size == 0)
+   string_to_sign = pgmoneta_append(string_to_sign, "\n\n\n\n\n\n\n");
+   if (blob_type)
    {
-      string_to_sign = pgmoneta_append(string_to_sign, "PUT\n\n\n\n\n\n\n\n\n\n\n\nx-ms-blob-type:BlockBlob\nx-ms-date:");
+      string_to_sign = pgmoneta_append(string_to_sign, "x-ms-blob-type:BlockBlob\n");
    }
-   else
+   if (copy_source != NULL)
    {
-      string_to_sign = pgmoneta_append(string_to_sign, "PUT\n\n\n");
-      string_to_sign = pgmoneta_append(string_to_sign, (char*)file_info.st_size);
-      string_to_sign = pgmoneta_append(string_to_sign, "\n\n\n\n\n\n\n\n\nx-ms-blob-type:BlockBlob\nx-ms-date:");
+      string_to_sign = pgmoneta_append(string_to_sign, "x-ms-copy-source:");
+      string_to_sign = pgmoneta_append(string_to_sign, copy_source);
+      string_to_sign = pgmoneta_append(string_to_sign, "\n");
    }
-
+   string_to_sign = pgmoneta_append(string_to_sign, "x-ms-date:");
    string_to_sign = pgmoneta_append(string_to_sign, utc_date);
-   string_to_sign = pgmoneta_append(string_to_sign, "\nx-ms-version:2021-08-06\n/");
+   if (range != NULL)
+   {
+      string_to_sign = pgmoneta_append(string_to_sign, "\nx-ms-range:");
+      string_to_sign = pgmoneta_append(string_to_sign, range);
+   }
+   string_to_sign = pgmoneta_append(string_to_sign, "\nx-ms-version:");
+   string_to_sign = pgmoneta_append(string_to_sign, AZURE_VERSION);
+   string_to_sign = pgmoneta_append(string_to_sign, "\n/");
    string_to_sign = pgmoneta_append(string_to_sign, config->azure_storage_account);
    string_to_sign = pgmoneta_append(string_to_sign, "/");
    string_to_sign = pgmoneta_append(string_to_sign, config->azure_container);
-   string_to_sign = pgmoneta_append(string_to_sign, "/");
-   string_to_sign = pgmoneta_append(string_to_sign, azure_path);
+   if (azure_path != NULL)
+   {
+      string_to_sign = pgmoneta_append(string_to_sign, "/");
+      string_to_sign = pgmoneta_append(string_to_sign, azure_path);
+   }
+
+   // The query parameters are already sorted and unescaped, one per line as name:value.
+   // Only the first '=' separates the name, a value may hold more of them
+   if (query != NULL)
+   {
+      string_to_sign = pgmoneta_append(string_to_sign, "\n");
+      for (char* q = query; *q != '\0'; q++)
+      {
+         char c[2] = {*q, '\0'};
+
+         if (*q == '&')
+         {
+            c[0] = '\n';
+            value = false;
+         }
+         else if (*q == '=' && !value)
+         {
+            c[0] = ':';
+            value = true;
+         }
+
+         string_to_sign = pgmoneta_append(string_to_sign, &c[0]);
+      }
+   }
 
    // Decode the Azure storage account shared key.
    pgmoneta_base64_decode(config->azure_shared_key, strlen(config->azure_shared_key), (void**)&signing_key, &signing_key_length);
@@ -407,118 +1389,342 @@ azure_send_upload_request(char* local_root, char* azure_root, char* relative_pat
 
    chunk = pgmoneta_http_add_header(chunk, "Authorization", auth_value);
 
-   chunk = pgmoneta_http_add_header(chunk, "x-ms-blob-type", "BlockBlob");
-
-   chunk = pgmoneta_http_add_header(chunk, "x-ms-date", utc_date);
+   if (blob_type)
+   {
+      chunk = pgmoneta_http_add_header(chunk, "x-ms-blob-type", "BlockBlob");
+   }
 
-   chunk = pgmoneta_http_add_header(chunk, "x-ms-version", "2021-08-06");
+   if (copy_source != NULL)
+   {
+      chunk = pgmoneta_http_add_header(chunk, "x-ms-copy-source", copy_source);
+   }
 
-   if (pgmoneta_http_set_header_option(curl, chunk))
+   if (content_type != NULL)
    {
-      goto error;
+      chunk = pgmoneta_http_add_header(chunk, "Content-Type", content_type);
    }
 
-   azure_host = azure_get_host();
+   chunk = pgmoneta_http_add_header(chunk, "x-ms-date", utc_date);
 
-   azure_url = pgmoneta_append(azure_url, "https://");
-   azure_url = pgmoneta_append(azure_url, azure_host);
-   azure_url = pgmoneta_append(azure_url, "/");
-   azure_url = pgmoneta_append(azure_url, azure_path);
+   if (range != NULL)
+   {
+      chunk = pgmoneta_http_add_header(chunk, "x-ms-range", range);
+   }
 
-   pgmoneta_http_set_request_option(curl, HTTP_PUT);
+   chunk = pgmoneta_http_add_header(chunk, "x-ms-version", AZURE_VERSION);
 
-   pgmoneta_http_set_url_option(curl, azure_url);
+   *headers = chunk;
 
-   curl_easy_setopt(curl, CURLOPT_READDATA, (void*) file);
+   free(signing_key);
+   free(base64_signature);
+   free(signature_hmac);
+   free(string_to_sign);
+   free(auth_value);
 
-   curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, (curl_off_t)file_info.st_size);
+   return 0;
 
-   res = curl_easy_perform(curl);
-   if (res != CURLE_OK)
-   {
-      fprintf(stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
-      goto error;
-   }
+error:
 
-   free(local_path);
-   free(azure_path);
-   free(azure_url);
-   free(azure_host);
-   free(signature);
+   curl_slist_free_all(chunk);
+   free(signing_key);
    free(base64_signature);
    free(signature_hmac);
-   free(signature_hex);
    free(string_to_sign);
    free(auth_value);
 
-   curl_slist_free_all(chunk);
+   return 1;
+}
 
-   fclose(file);
-   return 0;
+static int
+azure_list_blobs(char* prefix, struct azure_object** objects, int* number_of_objects)
+{
+   char* marker = NULL;
+   char* escaped_marker = NULL;
+   char* query = NULL;
+   char* url_query = NULL;
+   char* azure_url = NULL;
+   char* name = NULL;
+   char* size = NULL;
+   int capacity = 0;
+   struct azure_object* o = NULL;
+   struct curl_slist* chunk = NULL;
+   struct azure_response response;
+   CURLcode res;
+   long code = 0;
 
-error:
+   *objects = NULL;
+   *number_of_objects = 0;
 
-   if (local_path != NULL)
-   {
-      free(local_path);
-   }
+   memset(&response, 0, sizeof(struct azure_response));
 
-   if (azure_path != NULL)
+   do
    {
-      free(azure_path);
-   }
+      /* The signed query is unescaped, the prefix has no characters to escape */
+      if (marker != NULL)
+      {
+         escaped_marker = curl_easy_escape(curl, marker, 0);
+         if (escaped_marker == NULL)
+         {
+            goto error;
+         }
 
-   if (azure_url != NULL)
-   {
+         query = pgmoneta_append(query, "comp=list&marker=");
+         query = pgmoneta_append(query, marker);
+         url_query = pgmoneta_append(url_query, "comp=list&marker=");
+         url_query = pgmoneta_append(url_query, escaped_marker);
+
+         curl_free(escaped_marker);
+         escaped_marker = NULL;
+      }
+      else
+      {
+         query = pgmoneta_append(query, "comp=list");
+         url_query = pgmoneta_append(url_query, "comp=list");
+      }
+      query = pgmoneta_append(query, "&prefix=");
+      query = pgmoneta_append(query, prefix);
+      query = pgmoneta_append(query, "&restype=container");
+      url_query = pgmoneta_append(url_query, "&prefix=");
+      url_query = pgmoneta_append(url_query, prefix);
+      url_query = pgmoneta_append(url_query, "&restype=container");
+
+      if (azure_sign_request("GET", NULL, query, 0, NULL, NULL, NULL, false, &chunk))
+      {
+         goto error;
+      }
+
+      azure_url = azure_get_url(NULL, url_query);
+
+      curl_easy_reset(curl);
+
+      if (pgmoneta_http_set_header_option(curl, chunk))
+      {
+         goto error;
+      }
+
+      pgmoneta_http_set_request_option(curl, HTTP_GET);
+
+      pgmoneta_http_set_url_option(curl, azure_url);
+
+      curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, azure_response_cb);
+      curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)&response);
+
+      res = curl_easy_perform(curl);
+      if (res != CURLE_OK)
+      {
+         pgmoneta_log_error("Azure: List Blobs %s failed: %s", prefix, curl_easy_strerror(res));
+         goto error;
+      }
+
+      curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+      if (code < 200 || code > 299)
+      {
+         pgmoneta_log_error("Azure: List Blobs %s failed: HTTP %ld", prefix, code);
+         goto error;
+      }
+
+      for (char* b = strstr(response.data, "<Blob>"); b != NULL; b = strstr(b + 1, "<Blob>"))
+      {
+         if (pgmoneta_http_xml_value(b, "Name", &name) || pgmoneta_http_xml_value(b, "Content-Length", &size) ||
+             !pgmoneta_starts_with(name, prefix))
+         {
+            pgmoneta_log_error("Azure: Invalid listing of %s", prefix);
+            goto error;
+         }
+
+         if (*number_of_objects == capacity)
+         {
+            capacity = capacity == 0 ? 1024 : capacity * 2;
+            o = (struct azure_object*)realloc(*objects, capacity * sizeof(struct azure_object));
+            if (o == NULL)
+            {
+               goto error;
+            }
+            *objects = o;
+         }
+
+         (*objects)[*number_of_objects].relative_path = pgmoneta_append(NULL, name + strlen(prefix));
+         (*objects)[*number_of_objects].size = (off_t)strtoll(size, NULL, 10);
+         (*number_of_objects)++;
+
+         free(name);
+         name = NULL;
+         free(size);
+         size = NULL;
+      }
+
+      /* The last page has an empty marker */
+      free(marker);
+      marker = NULL;
+      pgmoneta_http_xml_value(response.data, "NextMarker", &marker);
+
+      free(query);
+      query = NULL;
+      free(url_query);
+      url_query = NULL;
       free(azure_url);
+      azure_url = NULL;
+      curl_slist_free_all(chunk);
+      chunk = NULL;
+      free(response.data);
+      memset(&response, 0, sizeof(struct azure_response));
    }
+   while (marker != NULL);
 
-   if (azure_host != NULL)
-   {
-      free(azure_host);
-   }
+   return 0;
 
-   if (signature != NULL)
+error:
+
+   for (int i = 0; i < *number_of_objects; i++)
    {
-      free(signature);
+      free((*objects)[i].relative_path);
    }
+   free(*objects);
+   *objects = NULL;
+   *number_of_objects = 0;
+
+   curl_free(escaped_marker);
+   free(marker);
+   free(query);
+   free(url_query);
+   free(azure_url);
+   free(name);
+   free(size);
+   curl_slist_free_all(chunk);
+   free(response.data);
 
-   if (base64_signature != NULL)
+   return 1;
+}
+
+static int
+azure_queue_download(struct http_scheduler* scheduler, char* local_root, char* azure_prefix, struct azure_object* object)
+{
+   char* local_path = NULL;
+   char* local_dir = NULL;
+   char* azure_path = NULL;
+   char* azure_url = NULL;
+   int fd = -1;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   local_path = pgmoneta_append(local_path, local_root);
+   local_path = pgmoneta_append(local_path, object->relative_path);
+
+   local_dir = pgmoneta_append(local_dir, local_path);
+   if (pgmoneta_mkdir(dirname(local_dir)))
    {
-      free(base64_signature);
+      pgmoneta_log_error("Azure: Could not create the directory of %s", local_path);
+      goto error;
    }
 
-   if (signature_hmac != NULL)
+   /* The ranges are written in place, in any order */
+   fd = open(local_path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+   if (fd == -1 || ftruncate(fd, object->size) != 0)
    {
-      free(signature_hmac);
+      pgmoneta_log_error("Azure: Could not create %s: %s", local_path, strerror(errno));
+      goto error;
    }
+   close(fd);
+   fd = -1;
 
-   if (signature_hex != NULL)
+   azure_path = pgmoneta_append(azure_path, azure_prefix);
+   azure_path = pgmoneta_append(azure_path, object->relative_path);
+   azure_url = azure_get_url(azure_path, NULL);
+
+   for (off_t offset = 0; offset < object->size; offset += config->azure_block_size)
    {
-      free(signature_hex);
+      off_t size = object->size - offset < config->azure_block_size ? object->size - offset : config->azure_block_size;
+
+      if (pgmoneta_http_scheduler_get(scheduler, local_path, offset, size, azure_url, azure_path,
+                                      &azure_sign_download, NULL, NULL))
+      {
+         goto error;
+      }
    }
 
-   if (string_to_sign != NULL)
+   free(local_path);
+   free(local_dir);
+   free(azure_path);
+   free(azure_url);
+
+   return 0;
+
+error:
+
+   if (fd != -1)
    {
-      free(string_to_sign);
+      close(fd);
    }
 
-   if (auth_value != NULL)
+   free(local_path);
+   free(local_dir);
+   free(azure_path);
+   free(azure_url);
+
+   return 1;
+}
+
+static int
+azure_compare_objects(const void* a, const void* b)
+{
+   off_t size_a = ((struct azure_object*)a)->size;
+   off_t size_b = ((struct azure_object*)b)->size;
+
+   return size_a < size_b ? 1 : size_a > size_b ? -1 : 0;
+}
+
+static size_t
+azure_response_cb(char* ptr, size_t size, size_t nmemb, void* userdata)
+{
+   struct azure_response* response = (struct azure_response*)userdata;
+   size_t n = size * nmemb;
+   char* data = NULL;
+
+   data = (char*)realloc(response->data, response->size + n + 1);
+   if (data == NULL)
    {
-      free(auth_value);
+      return 0;
    }
 
-   if (chunk != NULL)
+   memcpy(data + response->size, ptr, n);
+   response->size += n;
+   data[response->size] = '\0';
+   response->data = data;
+
+   return n;
+}
+
+static size_t
+azure_discard_cb(char* ptr __attribute__((unused)), size_t size, size_t nmemb, void* userdata __attribute__((unused)))
+{
+   return size * nmemb;
+}
+
+static char*
+azure_get_url(char* azure_path, char* query)
+{
+   char* azure_host = NULL;
+   char* azure_url = NULL;
+
+   azure_host = azure_get_host();
+
+   azure_url = pgmoneta_append(azure_url, "https://");
+   azure_url = pgmoneta_append(azure_url, azure_host);
+   if (azure_path != NULL)
    {
-      curl_slist_free_all(chunk);
+      azure_url = pgmoneta_append(azure_url, "/");
+      azure_url = pgmoneta_append(azure_url, azure_path);
    }
-
-   if (file != NULL)
+   if (query != NULL)
    {
-      fclose(file);
+      azure_url = pgmoneta_append(azure_url, "?");
+      azure_url = pgmoneta_append(azure_url, query);
    }
 
-   return 1;
+   free(azure_host);
+
+   return azure_url;
 }
 
 static char*
@@ -555,3 +1761,23 @@ azure_get_basepath(int server, char* identifier)
 
    return d;
 }
+
+static char*
+azure_get_walpath(int server, char* filename)
+{
+   char* d = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   d = pgmoneta_append(d, config->azure_base_dir);
+   if (!pgmoneta_ends_with(config->azure_base_dir, "/"))
+   {
+      d = pgmoneta_append(d, "/");
+   }
+   d = pgmoneta_append(d, config->common.servers[server].name);
+   d = pgmoneta_append(d, "/wal/");
+   d = pgmoneta_append(d, filename);
+
+   return d;
+}
@@ -55,6 +55,8 @@ pgmoneta_storage_create_local(void)
    wf->setup = &pgmoneta_common_setup;
    wf->execute = &local_storage_execute;
    wf->teardown = &pgmoneta_common_teardown;
+   wf->execute_file = NULL;
+   wf->independent = false;
    wf->next = NULL;
 
    return wf;
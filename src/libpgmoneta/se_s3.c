@@ -28,32 +28,116 @@
 
 /* pgmoneta */
 #include <pgmoneta.h>
+#include <deque.h>
 #include <http.h>
+#include <journal.h>
+#include <link.h>
 #include <logging.h>
+#include <pack.h>
+#include <prometheus.h>
 #include <security.h>
+#include <storage.h>
 #include <utils.h>
 #include <workflow.h>
 
 /* system */
 #include <assert.h>
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+#define S3_MAX_PARTS 10000
+#define S3_MAX_COPY  (5LL * 1024 * 1024 * 1024)
+
+#define S3_UNSIGNED_PAYLOAD "UNSIGNED-PAYLOAD"
+#define S3_EMPTY_PAYLOAD    "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"
+
+/** @struct s3_multipart
+ * Defines a multipart upload
+ */
+struct s3_multipart
+{
+   char* s3_path;               /**< The object */
+   char* upload_id;             /**< The upload id */
+   char* escaped_id;            /**< The upload id, escaped for a query string */
+   int number_of_parts;         /**< The number of parts */
+   struct http_upload** parts;  /**< The parts, owned by the scheduler */
+   bool completed;              /**< Is the upload completed */
+   struct s3_multipart* next;   /**< The next multipart upload */
+};
+
+/** @struct s3_delta
+ * Defines the files shared with the previous backup on S3
+ */
+struct s3_delta
+{
+   char* previous_root;          /**< The S3 root of the previous backup */
+   struct manifest_diff* diff;   /**< The difference of the manifests */
+   struct http_upload** copies;  /**< The server-side copies, owned by the scheduler */
+   int number_of_copies;         /**< The number of copies */
+   int capacity;                 /**< The capacity of the copies array */
+};
+
+/** @struct s3_object
+ * Defines an object of a listing
+ */
+struct s3_object
+{
+   char* relative_path;  /**< The path relative to the listed prefix */
+   off_t size;           /**< The size */
+};
+
+/** @struct s3_response
+ * Defines the body of a response
+ */
+struct s3_response
+{
+   char* data;   /**< The data, zero terminated */
+   size_t size;  /**< The size of the data */
+};
 
 static char* s3_storage_name(void);
 static int s3_storage_setup(char*, struct art*);
 static int s3_storage_execute(char*, struct art*);
 static int s3_storage_teardown(char*, struct art*);
 
-static int s3_upload_files(char* local_root, char* s3_root, char* relative_path);
-static int s3_send_upload_request(char* local_root, char* s3_root, char* relative_path);
-
+static int s3_upload_backup(int server, char* label, char* local_root, char* s3_root, bool last, uint64_t* bytes);
+static void s3_upload_done(struct http_upload* upload, void* data);
+static int s3_upload_files(struct http_scheduler* scheduler, struct s3_multipart** multiparts, struct s3_delta* delta, char* local_root, char* s3_root, char* relative_path);
+static int s3_queue_upload(struct http_scheduler* scheduler, struct s3_multipart** multiparts, struct s3_delta* delta, char* local_root, char* s3_root, char* relative_path);
+static int s3_queue_copy(struct http_scheduler* scheduler, struct s3_delta* delta, char* s3_path, char* relative_path);
+static int s3_upload_failed_copies(struct http_scheduler* scheduler, struct s3_multipart** multiparts, struct s3_delta* delta, char* local_root, char* s3_root);
+static int s3_queue_multipart(struct http_scheduler* scheduler, struct s3_multipart** multiparts, char* local_path, char* s3_path, off_t file_size);
+static int s3_complete_multipart(struct s3_multipart* multipart);
+static void s3_abort_multipart(struct s3_multipart* multipart);
+static void s3_multipart_destroy(struct s3_multipart* multipart);
+static int s3_sign_upload(struct http_upload* upload, struct curl_slist** headers);
+static int s3_sign_download(struct http_upload* upload, struct curl_slist** headers);
+static int s3_list_objects(char* prefix, struct s3_object** objects, int* number_of_objects);
+static int s3_queue_download(struct http_scheduler* scheduler, char* local_root, char* s3_prefix, struct s3_object* object);
+static int s3_compare_objects(const void* a, const void* b);
+static int s3_send_request(int method, char* s3_path, char* query, char* body, bool storage_class, struct s3_response* response);
+static int s3_sign_request(char* method, char* s3_path, char* query, char* payload_sha256, char* copy_source, bool storage_class, struct curl_slist** headers);
+static size_t s3_write_cb(char* ptr, size_t size, size_t nmemb, void* userdata);
+
+static char* s3_get_url(char* s3_path, char* query);
 static char* s3_get_host(void);
 static char* s3_get_basepath(int server, char* identifier);
+static char* s3_get_walpath(int server, char* filename);
 
 static CURL* curl = NULL;
 
+/* The progress of the backup upload, NULL for other uploads */
+static struct journal* journal = NULL;
+
+/* The files of the data directory that are uploaded in the pack */
+static struct art* packed = NULL;
+
 struct workflow*
 pgmoneta_storage_create_s3(void)
 {
@@ -65,11 +149,267 @@ pgmoneta_storage_create_s3(void)
    wf->setup = &s3_storage_setup;
    wf->execute = &s3_storage_execute;
    wf->teardown = &s3_storage_teardown;
+   wf->execute_file = NULL;
+   wf->independent = false;
    wf->next = NULL;
 
    return wf;
 }
 
+int
+pgmoneta_s3_wal_upload(int server, char* directory, struct deque* files)
+{
+   struct timespec start_t;
+   struct timespec end_t;
+   char* local_path = NULL;
+   char* s3_path = NULL;
+   char* s3_url = NULL;
+   struct stat file_info;
+   struct http_scheduler* scheduler = NULL;
+   struct deque_iterator* iter = NULL;
+   struct main_configuration* config;
+
+#ifdef HAVE_FREEBSD
+   clock_gettime(CLOCK_MONOTONIC_FAST, &start_t);
+#else
+   clock_gettime(CLOCK_MONOTONIC_RAW, &start_t);
+#endif
+
+   config = (struct main_configuration*)shmem;
+
+   if (pgmoneta_http_scheduler_create(config->upload_concurrency, config->upload_max_rate, &scheduler))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_deque_iterator_create(files, &iter))
+   {
+      goto error;
+   }
+
+   /* A segment is at most 1GB, so it is always a single PUT */
+   while (pgmoneta_deque_iterator_next(iter))
+   {
+      char* filename = (char*)pgmoneta_value_data(iter->value);
+
+      local_path = pgmoneta_append(local_path, directory);
+      local_path = pgmoneta_append(local_path, filename);
+
+      if (stat(local_path, &file_info) != 0)
+      {
+         pgmoneta_log_error("S3: Could not stat %s: %s", local_path, strerror(errno));
+         goto error;
+      }
+
+      s3_path = s3_get_walpath(server, filename);
+      s3_url = s3_get_url(s3_path, NULL);
+
+      if (pgmoneta_http_scheduler_add(scheduler, local_path, 0, file_info.st_size, s3_url, s3_path, NULL,
+                                      &s3_sign_upload, NULL, NULL))
+      {
+         goto error;
+      }
+
+      free(local_path);
+      local_path = NULL;
+
+      free(s3_path);
+      s3_path = NULL;
+
+      free(s3_url);
+      s3_url = NULL;
+   }
+
+   if (pgmoneta_http_scheduler_run(scheduler))
+   {
+      goto error;
+   }
+
+#ifdef HAVE_FREEBSD
+   clock_gettime(CLOCK_MONOTONIC_FAST, &end_t);
+#else
+   clock_gettime(CLOCK_MONOTONIC_RAW, &end_t);
+#endif
+
+   pgmoneta_prometheus_upload(UPLOAD_ENGINE_S3, pgmoneta_http_scheduler_bytes(scheduler), pgmoneta_compute_duration(start_t, end_t));
+
+   pgmoneta_deque_iterator_destroy(iter);
+   pgmoneta_http_scheduler_destroy(scheduler);
+
+   return 0;
+
+error:
+
+   pgmoneta_deque_iterator_destroy(iter);
+   pgmoneta_http_scheduler_destroy(scheduler);
+
+   free(local_path);
+   free(s3_path);
+   free(s3_url);
+
+   return 1;
+}
+
+int
+pgmoneta_s3_fetch(int server, char* label, bool (*filter)(char*))
+{
+   char* local_root = NULL;
+   char* s3_prefix = NULL;
+   char* pack = NULL;
+   char* pack_prefix = NULL;
+   struct s3_object* objects = NULL;
+   struct s3_object* pack_objects = NULL;
+   int number_of_objects = 0;
+   int number_of_pack_objects = 0;
+   int number_of_files = 0;
+   bool own_curl = false;
+   struct http_scheduler* scheduler = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   local_root = pgmoneta_get_server_backup_identifier_data(server, label);
+   s3_prefix = s3_get_basepath(server, label);
+   s3_prefix = pgmoneta_append(s3_prefix, "/data/");
+
+   if (curl == NULL)
+   {
+      curl = curl_easy_init();
+      if (curl == NULL)
+      {
+         goto error;
+      }
+      own_curl = true;
+   }
+
+   if (s3_list_objects(s3_prefix, &objects, &number_of_objects))
+   {
+      goto error;
+   }
+
+   /* The small files are in the pack, next to the data directory */
+   pack = pgmoneta_pack_path(server, label);
+   pack_prefix = s3_get_basepath(server, label);
+   pack_prefix = pgmoneta_append(pack_prefix, "/");
+   pack_prefix = pgmoneta_append(pack_prefix, PACK_NAME);
+
+   if (s3_list_objects(pack_prefix, &pack_objects, &number_of_pack_objects))
+   {
+      goto error;
+   }
+
+   if (number_of_objects == 0 && number_of_pack_objects == 0)
+   {
+      pgmoneta_log_error("S3: No files for %s/%s", config->common.servers[server].name, label);
+      goto error;
+   }
+
+   /* The biggest files go first, so their ranges keep all connections busy until the end */
+   qsort(objects, number_of_objects, sizeof(struct s3_object), s3_compare_objects);
+
+   if (pgmoneta_http_scheduler_create(config->upload_concurrency, 0, &scheduler))
+   {
+      goto error;
+   }
+
+   for (int i = 0; i < number_of_objects; i++)
+   {
+      if (filter != NULL && !filter(objects[i].relative_path))
+      {
+         continue;
+      }
+
+      if (s3_queue_download(scheduler, local_root, s3_prefix, &objects[i]))
+      {
+         goto error;
+      }
+
+      number_of_files++;
+   }
+
+   for (int i = 0; i < number_of_pack_objects; i++)
+   {
+      if (s3_queue_download(scheduler, pack, pack_prefix, &pack_objects[i]))
+      {
+         goto error;
+      }
+   }
+
+   if (pgmoneta_http_scheduler_run(scheduler))
+   {
+      goto error;
+   }
+
+   if (number_of_pack_objects > 0)
+   {
+      if (pgmoneta_pack_extract(pack, local_root, filter))
+      {
+         goto error;
+      }
+   }
+
+   pgmoneta_log_info("S3: Fetched %d files (%s/%s)", number_of_files, config->common.servers[server].name, label);
+
+   pgmoneta_http_scheduler_destroy(scheduler);
+
+   if (own_curl)
+   {
+      curl_easy_cleanup(curl);
+      curl = NULL;
+   }
+
+   for (int i = 0; i < number_of_objects; i++)
+   {
+      free(objects[i].relative_path);
+   }
+   free(objects);
+   for (int i = 0; i < number_of_pack_objects; i++)
+   {
+      free(pack_objects[i].relative_path);
+   }
+   free(pack_objects);
+   free(local_root);
+   free(s3_prefix);
+   free(pack);
+   free(pack_prefix);
+
+   return 0;
+
+error:
+
+   pgmoneta_http_scheduler_destroy(scheduler);
+
+   if (own_curl)
+   {
+      curl_easy_cleanup(curl);
+      curl = NULL;
+   }
+
+   /* A partial backup must not be mistaken for a complete one */
+   pgmoneta_delete_directory(local_root);
+   if (pack != NULL)
+   {
+      pgmoneta_pack_delete(pack);
+   }
+
+   for (int i = 0; i < number_of_objects; i++)
+   {
+      free(objects[i].relative_path);
+   }
+   free(objects);
+   for (int i = 0; i < number_of_pack_objects; i++)
+   {
+      free(pack_objects[i].relative_path);
+   }
+   free(pack_objects);
+   free(local_root);
+   free(s3_prefix);
+   free(pack);
+   free(pack_prefix);
+
+   return 1;
+}
+
 static char*
 s3_storage_name(void)
 {
@@ -125,6 +465,8 @@ s3_storage_execute(char* name __attribute__((unused)), struct art* nodes)
    double remote_s3_elapsed_time;
    char* local_root = NULL;
    char* s3_root = NULL;
+   char* pack = NULL;
+   uint64_t bytes = 0;
    struct main_configuration* config;
 
 #ifdef HAVE_FREEBSD
@@ -156,11 +498,49 @@ s3_storage_execute(char* name __attribute__((unused)), struct art* nodes)
    local_root = pgmoneta_get_server_backup_identifier(server, label);
    s3_root = s3_get_basepath(server, label);
 
-   if (s3_upload_files(local_root, s3_root, ""))
+   /* The journal keeps the completed files and parts, so a failed run resumes where it stopped */
+   if (pgmoneta_journal_open(local_root, "s3", &journal))
    {
       goto error;
    }
 
+   /* The small files are uploaded as one object, instead of one request each */
+   if (config->storage_pack_size > 0)
+   {
+      char* data = pgmoneta_get_server_backup_identifier_data(server, label);
+
+      pack = pgmoneta_pack_path(server, label);
+
+      if (pgmoneta_pack_create(data, (uint64_t)config->storage_pack_size, pack, &packed))
+      {
+         free(data);
+         goto error;
+      }
+
+      free(data);
+   }
+
+   for (int round = 1; s3_upload_backup(server, label, local_root, s3_root, round == STORAGE_UPLOAD_ROUNDS, &bytes); round++)
+   {
+      if (round == STORAGE_UPLOAD_ROUNDS)
+      {
+         goto error;
+      }
+
+      pgmoneta_log_warn("S3: Resuming the upload of %s/%s (%d files and parts done)",
+                        config->common.servers[server].name, label, pgmoneta_journal_size(journal));
+   }
+
+   pgmoneta_journal_close(journal, true);
+   journal = NULL;
+
+   if (pack != NULL)
+   {
+      pgmoneta_pack_delete(pack);
+   }
+   pgmoneta_art_destroy(packed);
+   packed = NULL;
+
 #ifdef HAVE_FREEBSD
    clock_gettime(CLOCK_MONOTONIC_FAST, &end_t);
 #else
@@ -169,126 +549,1058 @@ s3_storage_execute(char* name __attribute__((unused)), struct art* nodes)
 
    remote_s3_elapsed_time = pgmoneta_compute_duration(start_t, end_t);
 
-   pgmoneta_update_info_double(local_root, INFO_REMOTE_S3_ELAPSED, remote_s3_elapsed_time);
+   pgmoneta_update_info_double(local_root, INFO_REMOTE_S3_ELAPSED, remote_s3_elapsed_time);
+
+   pgmoneta_prometheus_upload(UPLOAD_ENGINE_S3, bytes, remote_s3_elapsed_time);
+
+   free(local_root);
+   free(s3_root);
+   free(pack);
+
+   return 0;
+
+error:
+
+   pgmoneta_journal_close(journal, false);
+   journal = NULL;
+
+   /* The pack is kept with the journal, so the next upload resumes with it */
+   pgmoneta_art_destroy(packed);
+   packed = NULL;
+
+   free(local_root);
+   free(s3_root);
+   free(pack);
+
+   return 1;
+}
+
+static int
+s3_storage_teardown(char* name __attribute__((unused)), struct art* nodes)
+{
+   int server = -1;
+   char* label = NULL;
+   char* root = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+#ifdef DEBUG
+   if (pgmoneta_log_is_enabled(PGMONETA_LOGGING_LEVEL_DEBUG1))
+   {
+      char* a = NULL;
+      a = pgmoneta_art_to_string(nodes, FORMAT_TEXT, NULL, 0);
+      pgmoneta_log_debug("(Tree)\n%s", a);
+      free(a);
+   }
+   assert(nodes != NULL);
+   assert(pgmoneta_art_contains_key(nodes, NODE_SERVER_ID));
+   assert(pgmoneta_art_contains_key(nodes, NODE_LABEL));
+#endif
+
+   server = (int)pgmoneta_art_search(nodes, NODE_SERVER_ID);
+   label = (char*)pgmoneta_art_search(nodes, NODE_LABEL);
+
+   pgmoneta_log_debug("S3 storage engine (teardown): %s/%s", config->common.servers[server].name, label);
+
+   root = pgmoneta_get_server_backup_identifier_data(server, label);
+
+   pgmoneta_delete_directory(root);
+
+   curl_easy_cleanup(curl);
+
+   free(root);
+
+   return 0;
+}
+
+static int
+s3_upload_backup(int server, char* label, char* local_root, char* s3_root, bool last, uint64_t* bytes)
+{
+   struct http_scheduler* scheduler = NULL;
+   struct s3_multipart* multiparts = NULL;
+   struct s3_multipart* m = NULL;
+   char* previous = NULL;
+   struct s3_delta delta;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   memset(&delta, 0, sizeof(struct s3_delta));
+
+   if (pgmoneta_http_scheduler_create(config->upload_concurrency, config->upload_max_rate, &scheduler))
+   {
+      goto error;
+   }
+
+   pgmoneta_http_scheduler_on_done(scheduler, &s3_upload_done, NULL);
+
+   if (pgmoneta_link_delta(server, label, &previous, &delta.diff))
+   {
+      goto error;
+   }
+
+   if (previous != NULL)
+   {
+      delta.previous_root = s3_get_basepath(server, previous);
+      pgmoneta_log_debug("S3: Copying unchanged files from %s", delta.previous_root);
+   }
+
+   if (s3_upload_files(scheduler, &multiparts, &delta, local_root, s3_root, ""))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_http_scheduler_run(scheduler))
+   {
+      goto error;
+   }
+
+   if (s3_upload_failed_copies(scheduler, &multiparts, &delta, local_root, s3_root))
+   {
+      goto error;
+   }
+
+   for (m = multiparts; m != NULL; m = m->next)
+   {
+      if (s3_complete_multipart(m))
+      {
+         goto error;
+      }
+   }
+
+   *bytes += pgmoneta_http_scheduler_bytes(scheduler);
+
+   while (multiparts != NULL)
+   {
+      m = multiparts->next;
+      s3_multipart_destroy(multiparts);
+      multiparts = m;
+   }
+
+   pgmoneta_http_scheduler_destroy(scheduler);
+
+   pgmoneta_manifest_diff_destroy(delta.diff);
+   free(delta.copies);
+   free(delta.previous_root);
+   free(previous);
+
+   return 0;
+
+error:
+
+   if (scheduler != NULL)
+   {
+      *bytes += pgmoneta_http_scheduler_bytes(scheduler);
+   }
+
+   /* The parts of an upload are kept for the next run, which finds the upload in the journal */
+   while (multiparts != NULL)
+   {
+      m = multiparts->next;
+      if (!multiparts->completed && last)
+      {
+         s3_abort_multipart(multiparts);
+      }
+      s3_multipart_destroy(multiparts);
+      multiparts = m;
+   }
+
+   pgmoneta_http_scheduler_destroy(scheduler);
+
+   pgmoneta_manifest_diff_destroy(delta.diff);
+   free(delta.copies);
+   free(delta.previous_root);
+   free(previous);
+
+   return 1;
+}
+
+static void
+s3_upload_done(struct http_upload* upload, void* data __attribute__((unused)))
+{
+   char* key = NULL;
+
+   /* A part is known by its upload, so the parts of an abandoned upload are never used */
+   if (upload->query != NULL && pgmoneta_starts_with(upload->query, "partNumber=") &&
+       strstr(upload->query, "&uploadId=") != NULL)
+   {
+      key = pgmoneta_append(key, "part ");
+      key = pgmoneta_append(key, strstr(upload->query, "&uploadId=") + strlen("&uploadId="));
+      key = pgmoneta_append(key, " ");
+      key = pgmoneta_append_int(key, atoi(upload->query + strlen("partNumber=")));
+
+      pgmoneta_journal_add(journal, key, upload->etag);
+   }
+   else
+   {
+      key = pgmoneta_append(key, "file ");
+      key = pgmoneta_append(key, upload->resource);
+
+      pgmoneta_journal_add(journal, key, NULL);
+   }
+
+   free(key);
+}
+
+static int
+s3_upload_files(struct http_scheduler* scheduler, struct s3_multipart** multiparts, struct s3_delta* delta, char* local_root, char* s3_root, char* relative_path)
+{
+   char* local_path = NULL;
+   char* relative_file;
+   DIR* dir = NULL;
+   struct dirent* entry;
+
+   local_path = pgmoneta_append(local_path, local_root);
+   local_path = pgmoneta_append(local_path, relative_path);
+
+   if (!(dir = opendir(local_path)))
+   {
+      goto error;
+   }
+
+   while ((entry = readdir(dir)) != NULL)
+   {
+      if (entry->d_type == DT_DIR)
+      {
+         char relative_dir[1024];
+
+         if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+         {
+            continue;
+         }
+
+         snprintf(relative_dir, sizeof(relative_dir), "%s/%s", relative_path, entry->d_name);
+
+         if (s3_upload_files(scheduler, multiparts, delta, local_root, s3_root, relative_dir))
+         {
+            goto error;
+         }
+      }
+      else if (strlen(relative_path) == 0 && pgmoneta_ends_with(entry->d_name, JOURNAL_SUFFIX))
+      {
+         continue;
+      }
+      else
+      {
+         relative_file = NULL;
+
+         relative_file = pgmoneta_append(relative_file, relative_path);
+         relative_file = pgmoneta_append(relative_file, "/");
+         relative_file = pgmoneta_append(relative_file, entry->d_name);
+
+         if (packed != NULL && pgmoneta_starts_with(relative_file, "/data/") &&
+             pgmoneta_art_contains_key(packed, relative_file + strlen("/data/")))
+         {
+            free(relative_file);
+            continue;
+         }
+
+         if (s3_queue_upload(scheduler, multiparts, delta, local_root, s3_root, relative_file))
+         {
+            free(relative_file);
+            goto error;
+         }
+
+         free(relative_file);
+      }
+   }
+
+   closedir(dir);
+
+   free(local_path);
+
+   return 0;
+
+error:
+
+   if (dir != NULL)
+   {
+      closedir(dir);
+   }
+
+   free(local_path);
+
+   return 1;
+}
+
+static int
+s3_queue_upload(struct http_scheduler* scheduler, struct s3_multipart** multiparts, struct s3_delta* delta, char* local_root, char* s3_root, char* relative_path)
+{
+   char* s3_url = NULL;
+   char* local_path = NULL;
+   char* s3_path = NULL;
+   char* key = NULL;
+   struct stat file_info;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   local_path = pgmoneta_append(local_path, local_root);
+   local_path = pgmoneta_append(local_path, relative_path);
+
+   s3_path = pgmoneta_append(s3_path, s3_root);
+   s3_path = pgmoneta_append(s3_path, relative_path);
+
+   key = pgmoneta_append(key, "file ");
+   key = pgmoneta_append(key, s3_path);
+
+   if (pgmoneta_journal_contains(journal, key))
+   {
+      goto done;
+   }
+
+   if (stat(local_path, &file_info) != 0)
+   {
+      pgmoneta_log_error("S3: Could not stat %s: %s", local_path, strerror(errno));
+      goto error;
+   }
+
+   if (delta != NULL && delta->previous_root != NULL && file_info.st_size <= S3_MAX_COPY &&
+       pgmoneta_starts_with(relative_path, "/data/") &&
+       pgmoneta_link_is_unchanged(relative_path + strlen("/data/"), delta->diff))
+   {
+      if (s3_queue_copy(scheduler, delta, s3_path, relative_path))
+      {
+         goto error;
+      }
+   }
+   else if (file_info.st_size > config->s3_part_size)
+   {
+      if (s3_queue_multipart(scheduler, multiparts, local_path, s3_path, file_info.st_size))
+      {
+         goto error;
+      }
+   }
+   else
+   {
+      s3_url = s3_get_url(s3_path, NULL);
+
+      if (pgmoneta_http_scheduler_add(scheduler, local_path, 0, file_info.st_size, s3_url, s3_path, NULL,
+                                      &s3_sign_upload, NULL, NULL))
+      {
+         goto error;
+      }
+   }
+
+done:
+
+   free(s3_url);
+   free(local_path);
+   free(s3_path);
+   free(key);
+
+   return 0;
+
+error:
+
+   free(s3_url);
+   free(local_path);
+   free(s3_path);
+   free(key);
+
+   return 1;
+}
+
+static int
+s3_queue_copy(struct http_scheduler* scheduler, struct s3_delta* delta, char* s3_path, char* relative_path)
+{
+   char* s3_url = NULL;
+   char* source = NULL;
+   struct http_upload* upload = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (delta->number_of_copies == delta->capacity)
+   {
+      int capacity = delta->capacity == 0 ? 64 : delta->capacity * 2;
+      struct http_upload** copies = NULL;
+
+      copies = (struct http_upload**)realloc(delta->copies, capacity * sizeof(struct http_upload*));
+      if (copies == NULL)
+      {
+         goto error;
+      }
+
+      delta->copies = copies;
+      delta->capacity = capacity;
+   }
+
+   source = pgmoneta_append(source, "/");
+   source = pgmoneta_append(source, config->s3_bucket);
+   source = pgmoneta_append(source, "/");
+   source = pgmoneta_append(source, delta->previous_root);
+   source = pgmoneta_append(source, relative_path);
+
+   s3_url = s3_get_url(s3_path, NULL);
+
+   if (pgmoneta_http_scheduler_copy(scheduler, s3_url, s3_path, source, &s3_sign_upload, NULL, &upload))
+   {
+      goto error;
+   }
+
+   delta->copies[delta->number_of_copies++] = upload;
+
+   free(s3_url);
+   free(source);
+
+   return 0;
+
+error:
+
+   free(s3_url);
+   free(source);
+
+   return 1;
+}
+
+static int
+s3_upload_failed_copies(struct http_scheduler* scheduler, struct s3_multipart** multiparts, struct s3_delta* delta, char* local_root, char* s3_root)
+{
+   int failed = 0;
+
+   for (int i = 0; i < delta->number_of_copies; i++)
+   {
+      if (pgmoneta_http_upload_failed(delta->copies[i]))
+      {
+         char* relative_path = delta->copies[i]->resource + strlen(s3_root);
+
+         pgmoneta_log_debug("S3: Uploading %s instead of copying it", delta->copies[i]->resource);
+
+         if (s3_queue_upload(scheduler, multiparts, NULL, local_root, s3_root, relative_path))
+         {
+            goto error;
+         }
+
+         failed++;
+      }
+   }
+
+   pgmoneta_log_debug("S3: Copied %d of %d unchanged files", delta->number_of_copies - failed, delta->number_of_copies);
+
+   if (failed > 0 && pgmoneta_http_scheduler_run(scheduler))
+   {
+      goto error;
+   }
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+static int
+s3_queue_multipart(struct http_scheduler* scheduler, struct s3_multipart** multiparts, char* local_path, char* s3_path, off_t file_size)
+{
+   off_t part_size;
+   char* query = NULL;
+   char* s3_url = NULL;
+   char* key = NULL;
+   char* part_key = NULL;
+   char* started = NULL;
+   struct s3_response response;
+   struct s3_multipart* multipart = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   memset(&response, 0, sizeof(struct s3_response));
+
+   part_size = config->s3_part_size;
+   if ((file_size + part_size - 1) / part_size > S3_MAX_PARTS)
+   {
+      part_size = (file_size + S3_MAX_PARTS - 1) / S3_MAX_PARTS;
+   }
+
+   multipart = (struct s3_multipart*)calloc(1, sizeof(struct s3_multipart));
+   if (multipart == NULL)
+   {
+      goto error;
+   }
+
+   multipart->s3_path = pgmoneta_append(multipart->s3_path, s3_path);
+   multipart->number_of_parts = (int)((file_size + part_size - 1) / part_size);
+   multipart->parts = (struct http_upload**)calloc(multipart->number_of_parts, sizeof(struct http_upload*));
+   if (multipart->parts == NULL)
+   {
+      goto error;
+   }
+
+   /* An upload of an earlier run is continued when its parts have the same size */
+   key = pgmoneta_append(key, "upload ");
+   key = pgmoneta_append(key, s3_path);
+
+   started = pgmoneta_journal_get(journal, key);
+   if (started != NULL && strchr(started, ' ') != NULL &&
+       strtoll(started, NULL, 10) == (long long)part_size)
+   {
+      multipart->upload_id = pgmoneta_append(multipart->upload_id, strchr(started, ' ') + 1);
+   }
+   else
+   {
+      if (started != NULL && strchr(started, ' ') != NULL)
+      {
+         struct s3_multipart abandoned;
+
+         memset(&abandoned, 0, sizeof(struct s3_multipart));
+         abandoned.s3_path = s3_path;
+         abandoned.escaped_id = curl_easy_escape(curl, strchr(started, ' ') + 1, 0);
+
+         if (abandoned.escaped_id != NULL)
+         {
+            s3_abort_multipart(&abandoned);
+            curl_free(abandoned.escaped_id);
+         }
+      }
+
+      if (s3_send_request(HTTP_POST, s3_path, "uploads=", NULL, true, &response))
+      {
+         goto error;
+      }
+
+      if (pgmoneta_http_xml_value(response.data, "UploadId", &multipart->upload_id))
+      {
+         pgmoneta_log_error("S3: No upload id for %s", s3_path);
+         goto error;
+      }
+
+      started = NULL;
+      started = pgmoneta_append_int(started, (int)part_size);
+      started = pgmoneta_append(started, " ");
+      started = pgmoneta_append(started, multipart->upload_id);
+
+      pgmoneta_journal_add(journal, key, started);
+
+      free(started);
+      started = NULL;
+   }
+
+   multipart->escaped_id = curl_easy_escape(curl, multipart->upload_id, 0);
+   if (multipart->escaped_id == NULL)
+   {
+      goto error;
+   }
+
+   /* The upload exists from here on, so it must be completed or aborted */
+   multipart->next = *multiparts;
+   *multiparts = multipart;
+
+   pgmoneta_log_debug("S3: Uploading %s in %d parts of %lld bytes",
+                      s3_path, multipart->number_of_parts, (long long)part_size);
+
+   for (int i = 0; i < multipart->number_of_parts; i++)
+   {
+      off_t offset = (off_t)i * part_size;
+      off_t size = file_size - offset < part_size ? file_size - offset : part_size;
+
+      part_key = pgmoneta_append(part_key, "part ");
+      part_key = pgmoneta_append(part_key, multipart->escaped_id);
+      part_key = pgmoneta_append(part_key, " ");
+      part_key = pgmoneta_append_int(part_key, i + 1);
+
+      /* The ETag of a part of an earlier run is taken from the journal */
+      if (pgmoneta_journal_contains(journal, part_key))
+      {
+         free(part_key);
+         part_key = NULL;
+         continue;
+      }
+
+      free(part_key);
+      part_key = NULL;
+
+      query = pgmoneta_append(query, "partNumber=");
+      query = pgmoneta_append_int(query, i + 1);
+      query = pgmoneta_append(query, "&uploadId=");
+      query = pgmoneta_append(query, multipart->escaped_id);
+
+      s3_url = s3_get_url(s3_path, query);
+
+      if (pgmoneta_http_scheduler_add(scheduler, local_path, offset, size, s3_url, s3_path, query,
+                                      &s3_sign_upload, NULL, &multipart->parts[i]))
+      {
+         goto error;
+      }
+
+      free(query);
+      query = NULL;
+      free(s3_url);
+      s3_url = NULL;
+   }
+
+   free(key);
+   free(response.data);
+
+   return 0;
+
+error:
+
+   if (multipart != NULL && *multiparts != multipart)
+   {
+      s3_multipart_destroy(multipart);
+   }
+
+   free(query);
+   free(s3_url);
+   free(key);
+   free(part_key);
+   free(response.data);
+
+   return 1;
+}
+
+static int
+s3_complete_multipart(struct s3_multipart* multipart)
+{
+   char* query = NULL;
+   char* body = NULL;
+   char* key = NULL;
+   char* etag = NULL;
+   struct s3_response response;
+
+   memset(&response, 0, sizeof(struct s3_response));
+
+   body = pgmoneta_append(body, "<CompleteMultipartUpload>");
+   for (int i = 0; i < multipart->number_of_parts; i++)
+   {
+      if (multipart->parts[i] != NULL)
+      {
+         etag = multipart->parts[i]->etag;
+      }
+      else
+      {
+         key = pgmoneta_append(key, "part ");
+         key = pgmoneta_append(key, multipart->escaped_id);
+         key = pgmoneta_append(key, " ");
+         key = pgmoneta_append_int(key, i + 1);
+
+         etag = pgmoneta_journal_get(journal, key);
+
+         free(key);
+         key = NULL;
+      }
+
+      if (etag == NULL || strlen(etag) == 0)
+      {
+         pgmoneta_log_error("S3: No ETag for part %d of %s", i + 1, multipart->s3_path);
+         goto error;
+      }
+
+      body = pgmoneta_append(body, "<Part><PartNumber>");
+      body = pgmoneta_append_int(body, i + 1);
+      body = pgmoneta_append(body, "</PartNumber><ETag>");
+      body = pgmoneta_append(body, etag);
+      body = pgmoneta_append(body, "</ETag></Part>");
+   }
+   body = pgmoneta_append(body, "</CompleteMultipartUpload>");
+
+   query = pgmoneta_append(query, "uploadId=");
+   query = pgmoneta_append(query, multipart->escaped_id);
+
+   /* The completion can fail after the status line is sent, so the body is checked too */
+   if (s3_send_request(HTTP_POST, multipart->s3_path, query, body, false, &response) ||
+       (response.data != NULL && strstr(response.data, "<Error>") != NULL))
+   {
+      pgmoneta_log_error("S3: Could not complete the upload of %s", multipart->s3_path);
+      goto error;
+   }
+
+   multipart->completed = true;
+
+   key = pgmoneta_append(key, "file ");
+   key = pgmoneta_append(key, multipart->s3_path);
+
+   pgmoneta_journal_add(journal, key, NULL);
+
+   free(key);
+   free(query);
+   free(body);
+   free(response.data);
+
+   return 0;
+
+error:
+
+   free(query);
+   free(body);
+   free(response.data);
+
+   return 1;
+}
+
+static void
+s3_abort_multipart(struct s3_multipart* multipart)
+{
+   char* query = NULL;
+   struct s3_response response;
+
+   memset(&response, 0, sizeof(struct s3_response));
+
+   query = pgmoneta_append(query, "uploadId=");
+   query = pgmoneta_append(query, multipart->escaped_id);
+
+   /* S3 keeps the uploaded parts until the upload is aborted */
+   if (s3_send_request(HTTP_DELETE, multipart->s3_path, query, NULL, false, &response))
+   {
+      pgmoneta_log_warn("S3: Could not abort the upload of %s", multipart->s3_path);
+   }
+
+   free(query);
+   free(response.data);
+}
+
+static void
+s3_multipart_destroy(struct s3_multipart* multipart)
+{
+   if (multipart == NULL)
+   {
+      return;
+   }
+
+   curl_free(multipart->escaped_id);
+   free(multipart->upload_id);
+   free(multipart->s3_path);
+   free(multipart->parts);
+   free(multipart);
+}
+
+static int
+s3_sign_upload(struct http_upload* upload, struct curl_slist** headers)
+{
+   /* The storage class is set when the object is created, so parts don't send it */
+   return s3_sign_request("PUT", upload->resource, upload->query, S3_UNSIGNED_PAYLOAD, upload->source, upload->query == NULL, headers);
+}
+
+static int
+s3_sign_download(struct http_upload* upload, struct curl_slist** headers)
+{
+   char* range = NULL;
+
+   if (s3_sign_request("GET", upload->resource, NULL, S3_EMPTY_PAYLOAD, NULL, false, headers))
+   {
+      goto error;
+   }
+
+   /* The range isn't a signed header */
+   if (pgmoneta_http_range(upload, &range))
+   {
+      goto error;
+   }
+
+   *headers = pgmoneta_http_add_header(*headers, "Range", range);
+
+   free(range);
+
+   return 0;
+
+error:
+
+   curl_slist_free_all(*headers);
+   *headers = NULL;
+
+   return 1;
+}
+
+static int
+s3_list_objects(char* prefix, struct s3_object** objects, int* number_of_objects)
+{
+   char* escaped_prefix = NULL;
+   char* escaped_token = NULL;
+   char* token = NULL;
+   char* truncated = NULL;
+   char* query = NULL;
+   char* key = NULL;
+   char* size = NULL;
+   int capacity = 0;
+   struct s3_object* o = NULL;
+   struct s3_response response;
+
+   *objects = NULL;
+   *number_of_objects = 0;
+
+   memset(&response, 0, sizeof(struct s3_response));
+
+   escaped_prefix = curl_easy_escape(curl, prefix, 0);
+   if (escaped_prefix == NULL)
+   {
+      goto error;
+   }
+
+   do
+   {
+      /* The parameters are sorted, as the canonical request needs them */
+      if (token != NULL)
+      {
+         escaped_token = curl_easy_escape(curl, token, 0);
+         if (escaped_token == NULL)
+         {
+            goto error;
+         }
+
+         query = pgmoneta_append(query, "continuation-token=");
+         query = pgmoneta_append(query, escaped_token);
+         query = pgmoneta_append(query, "&");
+
+         curl_free(escaped_token);
+         escaped_token = NULL;
+      }
+      query = pgmoneta_append(query, "list-type=2&prefix=");
+      query = pgmoneta_append(query, escaped_prefix);
+
+      if (s3_send_request(HTTP_GET, "", query, NULL, false, &response))
+      {
+         goto error;
+      }
+
+      for (char* c = strstr(response.data, "<Contents>"); c != NULL; c = strstr(c + 1, "<Contents>"))
+      {
+         if (pgmoneta_http_xml_value(c, "Key", &key) || pgmoneta_http_xml_value(c, "Size", &size) ||
+             !pgmoneta_starts_with(key, prefix))
+         {
+            pgmoneta_log_error("S3: Invalid listing of %s", prefix);
+            goto error;
+         }
+
+         if (*number_of_objects == capacity)
+         {
+            capacity = capacity == 0 ? 1024 : capacity * 2;
+            o = (struct s3_object*)realloc(*objects, capacity * sizeof(struct s3_object));
+            if (o == NULL)
+            {
+               goto error;
+            }
+            *objects = o;
+         }
+
+         (*objects)[*number_of_objects].relative_path = pgmoneta_append(NULL, key + strlen(prefix));
+         (*objects)[*number_of_objects].size = (off_t)strtoll(size, NULL, 10);
+         (*number_of_objects)++;
+
+         free(key);
+         key = NULL;
+         free(size);
+         size = NULL;
+      }
+
+      free(token);
+      token = NULL;
+      free(truncated);
+      truncated = NULL;
+
+      if (!pgmoneta_http_xml_value(response.data, "IsTruncated", &truncated) && !strcmp(truncated, "true") &&
+          pgmoneta_http_xml_value(response.data, "NextContinuationToken", &token))
+      {
+         pgmoneta_log_error("S3: No continuation token for %s", prefix);
+         goto error;
+      }
+
+      free(query);
+      query = NULL;
+      free(response.data);
+      memset(&response, 0, sizeof(struct s3_response));
+   }
+   while (token != NULL);
+
+   curl_free(escaped_prefix);
+   free(truncated);
+
+   return 0;
+
+error:
+
+   for (int i = 0; i < *number_of_objects; i++)
+   {
+      free((*objects)[i].relative_path);
+   }
+   free(*objects);
+   *objects = NULL;
+   *number_of_objects = 0;
+
+   curl_free(escaped_prefix);
+   curl_free(escaped_token);
+   free(token);
+   free(truncated);
+   free(query);
+   free(key);
+   free(size);
+   free(response.data);
+
+   return 1;
+}
+
+static int
+s3_queue_download(struct http_scheduler* scheduler, char* local_root, char* s3_prefix, struct s3_object* object)
+{
+   char* local_path = NULL;
+   char* local_dir = NULL;
+   char* s3_path = NULL;
+   char* s3_url = NULL;
+   int fd = -1;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   local_path = pgmoneta_append(local_path, local_root);
+   local_path = pgmoneta_append(local_path, object->relative_path);
+
+   local_dir = pgmoneta_append(local_dir, local_path);
+   if (pgmoneta_mkdir(dirname(local_dir)))
+   {
+      pgmoneta_log_error("S3: Could not create the directory of %s", local_path);
+      goto error;
+   }
+
+   /* The ranges are written in place, in any order */
+   fd = open(local_path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+   if (fd == -1 || ftruncate(fd, object->size) != 0)
+   {
+      pgmoneta_log_error("S3: Could not create %s: %s", local_path, strerror(errno));
+      goto error;
+   }
+   close(fd);
+   fd = -1;
+
+   s3_path = pgmoneta_append(s3_path, s3_prefix);
+   s3_path = pgmoneta_append(s3_path, object->relative_path);
+   s3_url = s3_get_url(s3_path, NULL);
+
+   for (off_t offset = 0; offset < object->size; offset += config->s3_part_size)
+   {
+      off_t size = object->size - offset < config->s3_part_size ? object->size - offset : config->s3_part_size;
+
+      if (pgmoneta_http_scheduler_get(scheduler, local_path, offset, size, s3_url, s3_path,
+                                      &s3_sign_download, NULL, NULL))
+      {
+         goto error;
+      }
+   }
 
-   free(local_root);
-   free(s3_root);
+   free(local_path);
+   free(local_dir);
+   free(s3_path);
+   free(s3_url);
 
    return 0;
 
 error:
 
-   free(local_root);
-   free(s3_root);
+   if (fd != -1)
+   {
+      close(fd);
+   }
+
+   free(local_path);
+   free(local_dir);
+   free(s3_path);
+   free(s3_url);
 
    return 1;
 }
 
 static int
-s3_storage_teardown(char* name __attribute__((unused)), struct art* nodes)
+s3_compare_objects(const void* a, const void* b)
 {
-   int server = -1;
-   char* label = NULL;
-   char* root = NULL;
-   struct main_configuration* config;
+   off_t size_a = ((struct s3_object*)a)->size;
+   off_t size_b = ((struct s3_object*)b)->size;
 
-   config = (struct main_configuration*)shmem;
+   return size_a < size_b ? 1 : size_a > size_b ? -1 : 0;
+}
 
-#ifdef DEBUG
-   if (pgmoneta_log_is_enabled(PGMONETA_LOGGING_LEVEL_DEBUG1))
+static int
+s3_send_request(int method, char* s3_path, char* query, char* body, bool storage_class, struct s3_response* response)
+{
+   char* payload_sha256 = NULL;
+   char* s3_url = NULL;
+   char* name = NULL;
+   struct curl_slist* chunk = NULL;
+   CURLcode res = -1;
+   long code = 0;
+
+   if (body != NULL)
    {
-      char* a = NULL;
-      a = pgmoneta_art_to_string(nodes, FORMAT_TEXT, NULL, 0);
-      pgmoneta_log_debug("(Tree)\n%s", a);
-      free(a);
+      if (pgmoneta_generate_string_sha256_hash(body, &payload_sha256))
+      {
+         goto error;
+      }
+   }
+   else
+   {
+      payload_sha256 = pgmoneta_append(payload_sha256, S3_EMPTY_PAYLOAD);
    }
-   assert(nodes != NULL);
-   assert(pgmoneta_art_contains_key(nodes, NODE_SERVER_ID));
-   assert(pgmoneta_art_contains_key(nodes, NODE_LABEL));
-#endif
 
-   server = (int)pgmoneta_art_search(nodes, NODE_SERVER_ID);
-   label = (char*)pgmoneta_art_search(nodes, NODE_LABEL);
+   if (method == HTTP_GET)
+   {
+      name = "GET";
+   }
+   else if (method == HTTP_DELETE)
+   {
+      name = "DELETE";
+   }
+   else
+   {
+      name = "POST";
+   }
 
-   pgmoneta_log_debug("S3 storage engine (teardown): %s/%s", config->common.servers[server].name, label);
+   if (s3_sign_request(name, s3_path, query, payload_sha256, NULL, storage_class, &chunk))
+   {
+      goto error;
+   }
 
-   root = pgmoneta_get_server_backup_identifier_data(server, label);
+   s3_url = s3_get_url(s3_path, query);
 
-   pgmoneta_delete_directory(root);
+   curl_easy_reset(curl);
 
-   curl_easy_cleanup(curl);
+   if (pgmoneta_http_set_header_option(curl, chunk))
+   {
+      goto error;
+   }
 
-   free(root);
+   pgmoneta_http_set_request_option(curl, method);
 
-   return 0;
-}
+   pgmoneta_http_set_url_option(curl, s3_url);
 
-static int
-s3_upload_files(char* local_root, char* s3_root, char* relative_path)
-{
-   char* local_path = NULL;
-   char* relative_file;
-   DIR* dir;
-   struct dirent* entry;
+   if (method == HTTP_POST)
+   {
+      curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body != NULL ? body : "");
+      curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, body != NULL ? (long)strlen(body) : 0L);
+   }
 
-   local_path = pgmoneta_append(local_path, local_root);
-   local_path = pgmoneta_append(local_path, relative_path);
+   curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, s3_write_cb);
+   curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)response);
 
-   if (!(dir = opendir(local_path)))
+   res = curl_easy_perform(curl);
+   if (res != CURLE_OK)
    {
+      pgmoneta_log_error("S3: %s %s failed: %s", name, s3_path, curl_easy_strerror(res));
       goto error;
    }
 
-   while ((entry = readdir(dir)) != NULL)
+   curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+   if (code < 200 || code > 299)
    {
-      if (entry->d_type == DT_DIR)
-      {
-         char relative_dir[1024];
-
-         if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
-         {
-            continue;
-         }
-
-         snprintf(relative_dir, sizeof(relative_dir), "%s/%s", relative_path, entry->d_name);
-
-         s3_upload_files(local_root, s3_root, relative_dir);
-      }
-      else
-      {
-         relative_file = NULL;
-
-         relative_file = pgmoneta_append(relative_file, relative_path);
-         relative_file = pgmoneta_append(relative_file, "/");
-         relative_file = pgmoneta_append(relative_file, entry->d_name);
-
-         if (s3_send_upload_request(local_root, s3_root, relative_file))
-         {
-            free(relative_file);
-            goto error;
-         }
-
-         free(relative_file);
-      }
+      pgmoneta_log_error("S3: %s %s failed: HTTP %ld", name, s3_path, code);
+      goto error;
    }
 
-   closedir(dir);
-
-   free(local_path);
+   free(payload_sha256);
+   free(s3_url);
+   curl_slist_free_all(chunk);
 
    return 0;
 
 error:
 
-   closedir(dir);
-
-   free(local_path);
+   free(payload_sha256);
+   free(s3_url);
+   curl_slist_free_all(chunk);
 
    return 1;
 }
 
 static int
-s3_send_upload_request(char* local_root, char* s3_root, char* relative_path)
+s3_sign_request(char* method, char* s3_path, char* query, char* payload_sha256, char* copy_source, bool storage_class, struct curl_slist** headers)
 {
    char short_date[SHORT_TIME_LENGTH];
    char long_date[LONG_TIME_LENGTH];
@@ -296,12 +1608,9 @@ s3_send_upload_request(char* local_root, char* s3_root, char* relative_path)
    char* auth_value = NULL;
    char* string_to_sign = NULL;
    char* s3_host = NULL;
-   char* s3_url = NULL;
-   char* file_sha256 = NULL;
+   char* signed_headers = NULL;
    char* canonical_request_sha256 = NULL;
    char* key = NULL;
-   char* local_path = NULL;
-   char* s3_path = NULL;
    unsigned char* date_key_hmac = NULL;
    unsigned char* date_region_key_hmac = NULL;
    unsigned char* date_region_service_key_hmac = NULL;
@@ -309,19 +1618,12 @@ s3_send_upload_request(char* local_root, char* s3_root, char* relative_path)
    unsigned char* signature_hmac = NULL;
    unsigned char* signature_hex = NULL;
    int hmac_length = 0;
-   FILE* file = NULL;
-   struct stat file_info;
-   CURLcode res = -1;
    struct curl_slist* chunk = NULL;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
 
-   local_path = pgmoneta_append(local_path, local_root);
-   local_path = pgmoneta_append(local_path, relative_path);
-
-   s3_path = pgmoneta_append(s3_path, s3_root);
-   s3_path = pgmoneta_append(s3_path, relative_path);
+   *headers = NULL;
 
    memset(&short_date[0], 0, sizeof(short_date));
    memset(&long_date[0], 0, sizeof(long_date));
@@ -331,21 +1633,48 @@ s3_send_upload_request(char* local_root, char* s3_root, char* relative_path)
       goto error;
    }
 
-   pgmoneta_create_sha256_file(local_path, &file_sha256);
-
    s3_host = s3_get_host();
 
+   signed_headers = pgmoneta_append(signed_headers, "host;x-amz-content-sha256");
+   if (copy_source != NULL)
+   {
+      signed_headers = pgmoneta_append(signed_headers, ";x-amz-copy-source");
+   }
+   signed_headers = pgmoneta_append(signed_headers, ";x-amz-date");
+   if (storage_class)
+   {
+      signed_headers = pgmoneta_append(signed_headers, ";x-amz-storage-class");
+   }
+
    // Construct canonical request.
-   canonical_request = pgmoneta_append(canonical_request, "PUT\n/");
+   canonical_request = pgmoneta_append(canonical_request, method);
+   canonical_request = pgmoneta_append(canonical_request, "\n/");
    canonical_request = pgmoneta_append(canonical_request, s3_path);
-   canonical_request = pgmoneta_append(canonical_request, "\n\nhost:");
+   canonical_request = pgmoneta_append(canonical_request, "\n");
+   if (query != NULL)
+   {
+      canonical_request = pgmoneta_append(canonical_request, query);
+   }
+   canonical_request = pgmoneta_append(canonical_request, "\nhost:");
    canonical_request = pgmoneta_append(canonical_request, s3_host);
    canonical_request = pgmoneta_append(canonical_request, "\nx-amz-content-sha256:");
-   canonical_request = pgmoneta_append(canonical_request, file_sha256);
+   canonical_request = pgmoneta_append(canonical_request, payload_sha256);
+   if (copy_source != NULL)
+   {
+      canonical_request = pgmoneta_append(canonical_request, "\nx-amz-copy-source:");
+      canonical_request = pgmoneta_append(canonical_request, copy_source);
+   }
    canonical_request = pgmoneta_append(canonical_request, "\nx-amz-date:");
    canonical_request = pgmoneta_append(canonical_request, long_date);
-   canonical_request = pgmoneta_append(canonical_request, "\nx-amz-storage-class:REDUCED_REDUNDANCY\n\nhost;x-amz-content-sha256;x-amz-date;x-amz-storage-class\n");
-   canonical_request = pgmoneta_append(canonical_request, file_sha256);
+   canonical_request = pgmoneta_append(canonical_request, "\n");
+   if (storage_class)
+   {
+      canonical_request = pgmoneta_append(canonical_request, "x-amz-storage-class:REDUCED_REDUNDANCY\n");
+   }
+   canonical_request = pgmoneta_append(canonical_request, "\n");
+   canonical_request = pgmoneta_append(canonical_request, signed_headers);
+   canonical_request = pgmoneta_append(canonical_request, "\n");
+   canonical_request = pgmoneta_append(canonical_request, payload_sha256);
 
    pgmoneta_generate_string_sha256_hash(canonical_request, &canonical_request_sha256);
 
@@ -395,60 +1724,33 @@ s3_send_upload_request(char* local_root, char* s3_root, char* relative_path)
    auth_value = pgmoneta_append(auth_value, short_date);
    auth_value = pgmoneta_append(auth_value, "/");
    auth_value = pgmoneta_append(auth_value, config->s3_aws_region);
-   auth_value = pgmoneta_append(auth_value, "/s3/aws4_request,SignedHeaders=host;x-amz-content-sha256;x-amz-date;x-amz-storage-class,Signature=");
+   auth_value = pgmoneta_append(auth_value, "/s3/aws4_request,SignedHeaders=");
+   auth_value = pgmoneta_append(auth_value, signed_headers);
+   auth_value = pgmoneta_append(auth_value, ",Signature=");
    auth_value = pgmoneta_append(auth_value, (char*)signature_hex);
 
    chunk = pgmoneta_http_add_header(chunk, "Authorization", auth_value);
 
    chunk = pgmoneta_http_add_header(chunk, "Host", s3_host);
 
-   chunk = pgmoneta_http_add_header(chunk, "x-amz-content-sha256", file_sha256);
-
-   chunk = pgmoneta_http_add_header(chunk, "x-amz-date", long_date);
-
-   chunk = pgmoneta_http_add_header(chunk, "x-amz-storage-class", "REDUCED_REDUNDANCY");
+   chunk = pgmoneta_http_add_header(chunk, "x-amz-content-sha256", payload_sha256);
 
-   if (pgmoneta_http_set_header_option(curl, chunk))
+   if (copy_source != NULL)
    {
-      goto error;
+      chunk = pgmoneta_http_add_header(chunk, "x-amz-copy-source", copy_source);
    }
 
-   s3_url = pgmoneta_append(s3_url, "https://");
-   s3_url = pgmoneta_append(s3_url, s3_host);
-   s3_url = pgmoneta_append(s3_url, "/");
-   s3_url = pgmoneta_append(s3_url, s3_path);
-
-   file = fopen(local_path, "rb");
-   if (file == NULL)
-   {
-      goto error;
-   }
+   chunk = pgmoneta_http_add_header(chunk, "x-amz-date", long_date);
 
-   if (fstat(fileno(file), &file_info) != 0)
+   if (storage_class)
    {
-      goto error;
+      chunk = pgmoneta_http_add_header(chunk, "x-amz-storage-class", "REDUCED_REDUNDANCY");
    }
 
-   pgmoneta_http_set_request_option(curl, HTTP_PUT);
-
-   pgmoneta_http_set_url_option(curl, s3_url);
-
-   curl_easy_setopt(curl, CURLOPT_READDATA, (void*) file);
-
-   curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, (curl_off_t)file_info.st_size);
+   *headers = chunk;
 
-   curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
-
-   res = curl_easy_perform(curl);
-   if (res != CURLE_OK)
-   {
-      fprintf(stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
-      goto error;
-   }
-
-   free(s3_url);
    free(s3_host);
-   free(file_sha256);
+   free(signed_headers);
    free(signature_hex);
    free(signature_hmac);
    free(signing_key_hmac);
@@ -456,111 +1758,80 @@ s3_send_upload_request(char* local_root, char* s3_root, char* relative_path)
    free(date_region_key_hmac);
    free(date_key_hmac);
    free(key);
-   free(local_path);
-   free(s3_path);
    free(canonical_request_sha256);
    free(canonical_request);
    free(string_to_sign);
    free(auth_value);
 
-   curl_slist_free_all(chunk);
-
-   fclose(file);
    return 0;
 
 error:
 
-   if (s3_url != NULL)
-   {
-      free(s3_url);
-   }
-
-   if (s3_host != NULL)
-   {
-      free(s3_host);
-   }
-
-   if (signature_hex != NULL)
-   {
-      free(signature_hex);
-   }
-
-   if (signature_hmac != NULL)
-   {
-      free(signature_hmac);
-   }
-
-   if (signing_key_hmac != NULL)
-   {
-      free(signing_key_hmac);
-   }
-
-   if (date_region_service_key_hmac != NULL)
-   {
-      free(date_region_service_key_hmac);
-   }
-
-   if (date_region_key_hmac != NULL)
-   {
-      free(date_region_key_hmac);
-   }
-
-   if (date_key_hmac != NULL)
-   {
-      free(date_region_key_hmac);
-   }
+   free(s3_host);
+   free(signed_headers);
+   free(signature_hex);
+   free(signature_hmac);
+   free(signing_key_hmac);
+   free(date_region_service_key_hmac);
+   free(date_region_key_hmac);
+   free(date_key_hmac);
+   free(key);
+   free(canonical_request_sha256);
+   free(canonical_request);
+   free(string_to_sign);
+   free(auth_value);
 
-   if (key != NULL)
-   {
-      free(key);
-   }
+   return 1;
+}
 
-   if (local_path != NULL)
-   {
-      free(local_path);
-   }
+static size_t
+s3_write_cb(char* ptr, size_t size, size_t nmemb, void* userdata)
+{
+   struct s3_response* response = (struct s3_response*)userdata;
+   size_t n = size * nmemb;
+   char* data = NULL;
 
-   if (s3_path != NULL)
+   // Without a response the body is discarded
+   if (response == NULL)
    {
-      free(s3_path);
+      return n;
    }
 
-   if (canonical_request_sha256 != NULL)
+   data = (char*)realloc(response->data, response->size + n + 1);
+   if (data == NULL)
    {
-      free(canonical_request_sha256);
+      return 0;
    }
 
-   if (file_sha256 != NULL)
-   {
-      free(file_sha256);
-   }
+   memcpy(data + response->size, ptr, n);
+   response->size += n;
+   data[response->size] = '\0';
+   response->data = data;
 
-   if (canonical_request != NULL)
-   {
-      free(canonical_request);
-   }
+   return n;
+}
 
-   if (string_to_sign != NULL)
-   {
-      free(string_to_sign);
-   }
+static char*
+s3_get_url(char* s3_path, char* query)
+{
+   char* s3_host = NULL;
+   char* s3_url = NULL;
 
-   if (auth_value != NULL)
-   {
-      free(auth_value);
-   }
+   s3_host = s3_get_host();
 
-   if (chunk != NULL)
+   s3_url = pgmoneta_append(s3_url, "https://");
+   s3_url = pgmoneta_append(s3_url, s3_host);
+   s3_url = pgmoneta_append(s3_url, "/");
+   s3_url = pgmoneta_append(s3_url, s3_path);
+   if (query != NULL)
    {
-      curl_slist_free_all(chunk);
+      s3_url = pgmoneta_append(s3_url, "?");
+      s3_url = pgmoneta_append(s3_url, query);
    }
 
-   if (file != NULL)
-   {
-      fclose(file);
-   }
+   free(s3_host);
 
-   return 1;
+   return s3_url;
 }
 
 static char*
@@ -598,3 +1869,23 @@ s3_get_basepath(int server, char* identifier)
 
    return d;
 }
+
+static char*
+s3_get_walpath(int server, char* filename)
+{
+   char* d = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   d = pgmoneta_append(d, config->s3_base_dir);
+   if (!pgmoneta_ends_with(config->s3_base_dir, "/"))
+   {
+      d = pgmoneta_append(d, "/");
+   }
+   d = pgmoneta_append(d, config->common.servers[server].name);
+   d = pgmoneta_append(d, "/wal/");
+   d = pgmoneta_append(d, filename);
+
+   return d;
+}
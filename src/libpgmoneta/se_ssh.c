@@ -30,9 +30,15 @@
 
 /* pgmoneta */
 #include <pgmoneta.h>
+#include <deque.h>
+#include <journal.h>
+#include <link.h>
 #include <logging.h>
+#include <prometheus.h>
 #include <security.h>
+#include <storage.h>
 #include <utils.h>
+#include <workers.h>
 #include <workflow.h>
 
 /* system */
@@ -42,6 +48,13 @@
 #include <fcntl.h>
 #include <libssh/libssh.h>
 #include <libssh/sftp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define SFTP_CHUNK_SIZE 16384
 
 static char* ssh_storage_name(void);
 static int ssh_storage_setup(char*, struct art*);
@@ -55,25 +68,50 @@ static char* get_remote_server_backup(int server);
 static char* get_remote_server_backup_identifier(int server, char* identifier);
 static char* get_remote_server_wal(int server);
 
-static int read_latest_backup_sha256(char* path);
-
 static int sftp_make_directory(char* local_dir, char* remote_dir);
-static int sftp_copy_directory(char* local_root, char* remote_root, char* relative_path);
 static int sftp_copy_file(char* local_root, char* remote_root, char* relative_path);
+static int sftp_write_file(FILE* sfile, sftp_file dfile, char* d);
+static int sftp_link_file(char* source, char* d);
 static int sftp_wal_prepare(sftp_file* file, int segsize);
 static bool sftp_exists(char* path);
 static int sftp_get_file_size(char* file_path, size_t* file_size);
 static int sftp_permission(char* path, int user, int group, int all);
 
-static ssh_session session = NULL;
-static sftp_session sftp = NULL;
+static int ssh_open_session(char* hostname, char* username);
+static void ssh_close_session(void);
+static int sftp_parse_target(char* target, char** hostname, char** username, char** path);
+static int sftp_copy_prepare(char* local_root, char* remote_root, char* relative_path, struct deque* files);
+static int sftp_copy_files(char* hostname, char* username, char* local_root, char* remote_root, struct deque* files, int number_of_threads);
+static void* do_sftp_copy(void* arg);
+
+/** @struct sftp_copy_input
+ * Defines the input for one upload thread
+ */
+struct sftp_copy_input
+{
+   char* hostname;     /**< The remote host */
+   char* username;     /**< The remote user */
+   char* local_root;   /**< The local root directory */
+   char* remote_root;  /**< The remote root directory */
+   struct deque* files; /**< The files left to upload */
+   int result;         /**< The result of the thread */
+};
+
+/* Each upload thread opens its own session */
+static _Thread_local ssh_session session = NULL;
+static _Thread_local sftp_session sftp = NULL;
 
-static struct art* tree_map = NULL;
+static struct manifest_diff* diff = NULL;
 
 static bool is_error = false;
 
 static char* latest_remote_root = NULL;
 
+static atomic_ulong uploaded_bytes = 0;
+
+/* The progress of the backup upload, NULL for other uploads */
+static struct journal* journal = NULL;
+
 struct workflow*
 pgmoneta_storage_create_ssh(int workflow_type)
 {
@@ -102,201 +140,152 @@ pgmoneta_storage_create_ssh(int workflow_type)
       default:
          break;
    }
+   wf->execute_file = NULL;
+   wf->independent = false;
    wf->next = NULL;
 
    return wf;
 }
 
-static char*
-ssh_storage_name(void)
-{
-   return "SSH";
-}
-
-static int
-ssh_storage_setup(char* name __attribute__((unused)), struct art* nodes)
+bool
+pgmoneta_sftp_is_remote(char* target)
 {
-   int server = -1;
-   char* label = NULL;
-   ssh_key srv_pubkey = NULL;
-   ssh_key client_pubkey = NULL;
-   ssh_key client_privkey = NULL;
-   char* pubkey_path = NULL;
-   char* privkey_path = NULL;
-   char* pubkey_full_path = NULL;
-   char* privkey_full_path = NULL;
-   char* homedir = NULL;
-   char* hexa = NULL;
-   unsigned char* srv_pubkey_hash = NULL;
-   size_t hash_length;
-   int rc;
-   enum ssh_known_hosts_e state;
-   struct main_configuration* config;
+   char* colon = NULL;
+   char* slash = NULL;
 
-   config = (struct main_configuration*)shmem;
-
-#ifdef DEBUG
-   if (pgmoneta_log_is_enabled(PGMONETA_LOGGING_LEVEL_DEBUG1))
+   if (target == NULL || strlen(target) == 0 || target[0] == '/')
    {
-      char* a = NULL;
-      a = pgmoneta_art_to_string(nodes, FORMAT_TEXT, NULL, 0);
-      pgmoneta_log_debug("(Tree)\n%s", a);
-      free(a);
+      return false;
    }
-   assert(nodes != NULL);
-   assert(pgmoneta_art_contains_key(nodes, NODE_SERVER_ID));
-   assert(pgmoneta_art_contains_key(nodes, NODE_LABEL));
-#endif
 
-   server = (int)pgmoneta_art_search(nodes, NODE_SERVER_ID);
-   label = (char*)pgmoneta_art_search(nodes, NODE_LABEL);
+   colon = strchr(target, ':');
+   slash = strchr(target, '/');
 
-   pgmoneta_log_debug("SSH storage engine (setup): %s/%s", config->common.servers[server].name, label);
+   return colon != NULL && colon != target && (slash == NULL || colon < slash);
+}
 
-   homedir = getenv("HOME");
-   pubkey_path = "/.ssh/id_rsa.pub";
-   privkey_path = "/.ssh/id_rsa";
+int
+pgmoneta_sftp_restore(int server, char* target, char* local_root)
+{
+   char* hostname = NULL;
+   char* username = NULL;
+   char* remote_root = NULL;
+   char* remote_dir = NULL;
+   int number_of_threads = 0;
+   struct deque* files = NULL;
+   struct main_configuration* config;
 
-   session = ssh_new();
+   config = (struct main_configuration*)shmem;
 
-   if (session == NULL)
+   if (sftp_parse_target(target, &hostname, &username, &remote_root))
    {
+      pgmoneta_log_error("SSH: Invalid target %s", target);
       goto error;
    }
 
-   ssh_options_set(session, SSH_OPTIONS_USER, config->ssh_username);
-   ssh_options_set(session, SSH_OPTIONS_HOST, config->ssh_hostname);
-
-   if (strlen(config->ssh_ciphers) == 0)
-   {
-      ssh_options_set(session, SSH_OPTIONS_CIPHERS_C_S, "aes256-ctr,aes192-ctr,aes128-ctr");
-   }
-   else
+   if (username == NULL && strlen(config->ssh_username) > 0)
    {
-      ssh_options_set(session, SSH_OPTIONS_CIPHERS_C_S, config->ssh_ciphers);
+      username = pgmoneta_append(username, config->ssh_username);
    }
 
-   rc = ssh_connect(session);
-   if (rc != SSH_OK)
+   if (pgmoneta_deque_create(true, &files))
    {
-      pgmoneta_log_error("Remote Backup: Error connecting to %s: %s",
-                         config->ssh_hostname, ssh_get_error(session));
       goto error;
    }
 
-   rc = ssh_get_server_publickey(session, &srv_pubkey);
-   if (rc < 0)
+   /* The directories and links are made by one session, the files are shared between the threads */
+   if (ssh_open_session(hostname, username))
    {
       goto error;
    }
 
-   rc = ssh_get_publickey_hash(srv_pubkey, SSH_PUBLICKEY_HASH_SHA1,
-                               &srv_pubkey_hash, &hash_length);
-   if (rc < 0)
+   remote_dir = pgmoneta_append(remote_dir, remote_root);
+   if (sftp_make_directory(local_root, remote_dir) ||
+       sftp_copy_prepare(local_root, remote_root, "", files))
    {
+      ssh_close_session();
       goto error;
    }
 
-   state = ssh_session_is_known_server(session);
-   switch (state)
-   {
-      case SSH_KNOWN_HOSTS_OK:
-         break;
-      case SSH_KNOWN_HOSTS_CHANGED:
-         pgmoneta_log_error("the server key has changed: %s", strerror(errno));
-         goto error;
-      case SSH_KNOWN_HOSTS_OTHER:
-         pgmoneta_log_error("the host key for this server was not found: %s", strerror(errno));
-         goto error;
-      case SSH_KNOWN_HOSTS_NOT_FOUND:
-         pgmoneta_log_error("could not find known host file: %s", strerror(errno));
-         goto error;
-      case SSH_KNOWN_HOSTS_UNKNOWN:
-         rc = ssh_session_update_known_hosts(session);
-         if (rc < 0)
-         {
-            pgmoneta_log_error("could not update known_hosts file: %s", strerror(errno));
-            goto error;
-         }
-         break;
-      case SSH_KNOWN_HOSTS_ERROR:
-         pgmoneta_log_error("error checking the host: %s", strerror(errno));
-         goto error;
-   }
+   ssh_close_session();
 
-   pubkey_full_path = pgmoneta_append(pubkey_full_path, homedir);
-   pubkey_full_path = pgmoneta_append(pubkey_full_path, pubkey_path);
+   number_of_threads = pgmoneta_get_number_of_workers(server);
 
-   rc = ssh_pki_import_pubkey_file(pubkey_full_path, &client_pubkey);
-   if (rc != SSH_OK)
+   pgmoneta_log_debug("SSH: %d files to %s@%s:%s",
+                      (int)pgmoneta_deque_size(files), username != NULL ? username : "", hostname, remote_root);
+
+   if (sftp_copy_files(hostname, username, local_root, remote_root, files, number_of_threads))
    {
-      pgmoneta_log_error("could not import host's public key: %s", strerror(errno));
       goto error;
    }
 
-   privkey_full_path = pgmoneta_append(privkey_full_path, homedir);
-   privkey_full_path = pgmoneta_append(privkey_full_path, privkey_path);
+   pgmoneta_log_info("SSH: %s uploaded to %s", local_root, target);
 
-   rc = ssh_pki_import_privkey_file(privkey_full_path, NULL, NULL, NULL,
-                                    &client_privkey);
-   if (rc != SSH_OK)
-   {
-      pgmoneta_log_error("could not import host's private key: %s", strerror(errno));
-      goto error;
-   }
+   pgmoneta_deque_destroy(files);
+   free(hostname);
+   free(username);
+   free(remote_root);
+   free(remote_dir);
 
-   rc = ssh_userauth_publickey(session, NULL, client_privkey);
-   if (rc != SSH_AUTH_SUCCESS)
-   {
-      pgmoneta_log_error("could not authenticate with public/private key: %s", strerror(errno));
-      goto error;
-   }
+   return 0;
 
-   sftp = sftp_new(session);
+error:
 
-   if (sftp == NULL)
+   pgmoneta_deque_destroy(files);
+   free(hostname);
+   free(username);
+   free(remote_root);
+   free(remote_dir);
+
+   return 1;
+}
+
+static char*
+ssh_storage_name(void)
+{
+   return "SSH";
+}
+
+static int
+ssh_storage_setup(char* name __attribute__((unused)), struct art* nodes)
+{
+   int server = -1;
+   char* label = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+#ifdef DEBUG
+   if (pgmoneta_log_is_enabled(PGMONETA_LOGGING_LEVEL_DEBUG1))
    {
-      pgmoneta_log_error("Error: %s", ssh_get_error(session));
-      goto error;
+      char* a = NULL;
+      a = pgmoneta_art_to_string(nodes, FORMAT_TEXT, NULL, 0);
+      pgmoneta_log_debug("(Tree)\n%s", a);
+      free(a);
    }
+   assert(nodes != NULL);
+   assert(pgmoneta_art_contains_key(nodes, NODE_SERVER_ID));
+   assert(pgmoneta_art_contains_key(nodes, NODE_LABEL));
+#endif
 
-   rc = sftp_init(sftp);
-   if (rc != SSH_OK)
+   server = (int)pgmoneta_art_search(nodes, NODE_SERVER_ID);
+   label = (char*)pgmoneta_art_search(nodes, NODE_LABEL);
+
+   pgmoneta_log_debug("SSH storage engine (setup): %s/%s", config->common.servers[server].name, label);
+
+   if (ssh_open_session(config->ssh_hostname, config->ssh_username))
    {
-      pgmoneta_log_error("Error: %s", sftp_get_error(sftp));
       goto error;
    }
 
    is_error = false;
 
-   ssh_string_free_char(hexa);
-   ssh_clean_pubkey_hash(&srv_pubkey_hash);
-   ssh_key_free(srv_pubkey);
-   ssh_key_free(client_pubkey);
-   ssh_key_free(client_privkey);
-
-   free(pubkey_full_path);
-   free(privkey_full_path);
-
    return 0;
 
 error:
 
    is_error = true;
 
-   ssh_string_free_char(hexa);
-   ssh_clean_pubkey_hash(&srv_pubkey_hash);
-   ssh_key_free(srv_pubkey);
-   ssh_key_free(client_pubkey);
-   ssh_key_free(client_privkey);
-
-   free(pubkey_full_path);
-   free(privkey_full_path);
-
-   sftp_free(sftp);
-
-   ssh_disconnect(session);
-   ssh_free(session);
    return 1;
 }
 
@@ -308,13 +297,10 @@ ssh_storage_backup_execute(char* name __attribute__((unused)), struct art* nodes
    struct timespec start_t;
    struct timespec end_t;
    double remote_ssh_elapsed_time;
-   char* server_path = NULL;
    char* local_root = NULL;
    char* remote_root = NULL;
-   char* latest_backup_sha256 = NULL;
-   int next_newest = -1;
-   int number_of_backups = 0;
-   struct backup** backups = NULL;
+   char* previous = NULL;
+   struct deque* files = NULL;
    struct main_configuration* config;
 
 #ifdef HAVE_FREEBSD
@@ -323,6 +309,8 @@ ssh_storage_backup_execute(char* name __attribute__((unused)), struct art* nodes
    clock_gettime(CLOCK_MONOTONIC_RAW, &start_t);
 #endif
 
+   atomic_store(&uploaded_bytes, 0);
+
    config = (struct main_configuration*)shmem;
 
 #ifdef DEBUG
@@ -353,66 +341,74 @@ ssh_storage_backup_execute(char* name __attribute__((unused)), struct art* nodes
       goto error;
    }
 
-   server_path = pgmoneta_get_server_backup(server);
+   sftp_copy_file(local_root, remote_root, "/backup.info");
+   sftp_copy_file(local_root, remote_root, "/backup.sha256");
 
-   pgmoneta_get_backups(server_path, &number_of_backups, &backups);
+   /* The files that are unchanged since the previous backup are linked on the remote server */
+   if (pgmoneta_link_delta(server, label, &previous, &diff))
+   {
+      goto error;
+   }
 
-   if (number_of_backups >= 2)
+   if (previous != NULL)
    {
-      for (int j = number_of_backups - 2; j >= 0 && next_newest == -1; j--)
-      {
-         if (backups[j]->valid == VALID_TRUE)
-         {
-            if (next_newest == -1)
-            {
-               next_newest = j;
-            }
-         }
-      }
+      latest_remote_root = get_remote_server_backup_identifier(server, previous);
+      latest_remote_root = pgmoneta_append(latest_remote_root, "/data");
    }
 
-   if (pgmoneta_art_create(&tree_map))
+   /* The journal keeps the uploaded files, so a failed run resumes where it stopped */
+   if (pgmoneta_journal_open(local_root, "ssh", &journal))
    {
       goto error;
    }
 
-   if (next_newest != -1)
+   local_root = pgmoneta_append(local_root, "/data");
+   remote_root = pgmoneta_append(remote_root, "/data");
+
+   for (int round = 1; ; round++)
    {
-      latest_remote_root = get_remote_server_backup_identifier(server, backups[next_newest]->label);
+      if (pgmoneta_deque_create(true, &files))
+      {
+         goto error;
+      }
 
-      latest_backup_sha256 = pgmoneta_get_server_backup_identifier(server, backups[next_newest]->label);
-      latest_backup_sha256 = pgmoneta_append(latest_backup_sha256, "backup.sha256");
+      /* The directories are made by this session, the files are shared between the sessions of the workers */
+      if (!sftp_copy_prepare(local_root, remote_root, "", files) &&
+          !sftp_copy_files(config->ssh_hostname, config->ssh_username, local_root, remote_root, files,
+                           pgmoneta_get_number_of_workers(server)))
+      {
+         break;
+      }
 
-      if (read_latest_backup_sha256(latest_backup_sha256))
+      if (round == STORAGE_UPLOAD_ROUNDS)
       {
+         pgmoneta_log_error("failed to transfer the backup directory from the local host to the remote server");
          goto error;
       }
-   }
 
-   sftp_copy_file(local_root, remote_root, "/backup.info");
-   sftp_copy_file(local_root, remote_root, "/backup.sha256");
+      pgmoneta_log_warn("SSH: Resuming the upload of %s/%s (%d files done)",
+                        config->common.servers[server].name, label, pgmoneta_journal_size(journal));
 
-   local_root = pgmoneta_append(local_root, "/data");
-   remote_root = pgmoneta_append(remote_root, "/data");
+      pgmoneta_deque_destroy(files);
+      files = NULL;
 
-   if (sftp_copy_directory(local_root, remote_root, "") != 0)
-   {
-      pgmoneta_log_error("failed to transfer the backup directory from the local host to the remote server: %s", strerror(errno));
-      goto error;
+      /* The failure can be the connection of this session too */
+      ssh_close_session();
+      if (ssh_open_session(config->ssh_hostname, config->ssh_username))
+      {
+         goto error;
+      }
    }
 
-   is_error = false;
+   pgmoneta_deque_destroy(files);
+   files = NULL;
 
-   for (int i = 0; i < number_of_backups; i++)
-   {
-      free(backups[i]);
-   }
-   free(backups);
+   pgmoneta_journal_close(journal, true);
+   journal = NULL;
 
-   if (latest_backup_sha256 != NULL)
-   {
-      free(latest_backup_sha256);
-   }
+   is_error = false;
+
+   free(previous);
 
 #ifdef HAVE_FREEBSD
    clock_gettime(CLOCK_MONOTONIC_FAST, &end_t);
@@ -424,7 +420,8 @@ ssh_storage_backup_execute(char* name __attribute__((unused)), struct art* nodes
 
    pgmoneta_update_info_double(local_root, INFO_REMOTE_SSH_ELAPSED, remote_ssh_elapsed_time);
 
-   free(server_path);
+   pgmoneta_prometheus_upload(UPLOAD_ENGINE_SSH, atomic_load(&uploaded_bytes), remote_ssh_elapsed_time);
+
    free(remote_root);
    free(local_root);
 
@@ -434,18 +431,12 @@ error:
 
    is_error = true;
 
-   for (int i = 0; i < number_of_backups; i++)
-   {
-      free(backups[i]);
-   }
-   free(backups);
+   pgmoneta_deque_destroy(files);
 
-   if (latest_backup_sha256 != NULL)
-   {
-      free(latest_backup_sha256);
-   }
+   pgmoneta_journal_close(journal, false);
+   journal = NULL;
 
-   free(server_path);
+   free(previous);
    free(remote_root);
    free(local_root);
 
@@ -543,11 +534,13 @@ ssh_storage_backup_teardown(char* name __attribute__((unused)), struct art* node
 
    pgmoneta_delete_directory(root);
 
-   pgmoneta_art_destroy(tree_map);
+   pgmoneta_manifest_diff_destroy(diff);
+   diff = NULL;
 
    free(root);
 
    free(latest_remote_root);
+   latest_remote_root = NULL;
 
    sftp_free(sftp);
 
@@ -591,59 +584,255 @@ ssh_storage_wal_shipping_teardown(char* name __attribute__((unused)), struct art
 }
 
 static int
-sftp_make_directory(char* local_dir, char* remote_dir)
+ssh_open_session(char* hostname, char* username)
 {
+   ssh_key srv_pubkey = NULL;
+   ssh_key client_pubkey = NULL;
+   ssh_key client_privkey = NULL;
+   char* pubkey_path = NULL;
+   char* privkey_path = NULL;
+   char* pubkey_full_path = NULL;
+   char* privkey_full_path = NULL;
+   char* homedir = NULL;
+   char* hexa = NULL;
+   unsigned char* srv_pubkey_hash = NULL;
+   size_t hash_length;
    int rc;
-   char* p;
-   mode_t mode = 0;
+   enum ssh_known_hosts_e state;
+   struct main_configuration* config;
 
-   mode = pgmoneta_get_permission(local_dir);
+   config = (struct main_configuration*)shmem;
 
-   for (p = remote_dir + 1; *p; p++)
-   {
-      if (*p == '/')
-      {
-         *p = '\0';
+   homedir = getenv("HOME");
+   pubkey_path = "/.ssh/id_rsa.pub";
+   privkey_path = "/.ssh/id_rsa";
 
-         rc = sftp_mkdir(sftp, remote_dir, mode);
-         if (rc != SSH_OK)
+   session = ssh_new();
+
+   if (session == NULL)
+   {
+      goto error;
+   }
+
+   ssh_options_set(session, SSH_OPTIONS_USER, username);
+   ssh_options_set(session, SSH_OPTIONS_HOST, hostname);
+
+   if (strlen(config->ssh_ciphers) == 0)
+   {
+      ssh_options_set(session, SSH_OPTIONS_CIPHERS_C_S, "aes256-ctr,aes192-ctr,aes128-ctr");
+   }
+   else
+   {
+      ssh_options_set(session, SSH_OPTIONS_CIPHERS_C_S, config->ssh_ciphers);
+   }
+
+   rc = ssh_connect(session);
+   if (rc != SSH_OK)
+   {
+      pgmoneta_log_error("SSH: Error connecting to %s: %s",
+                         hostname, ssh_get_error(session));
+      goto error;
+   }
+
+   rc = ssh_get_server_publickey(session, &srv_pubkey);
+   if (rc < 0)
+   {
+      goto error;
+   }
+
+   rc = ssh_get_publickey_hash(srv_pubkey, SSH_PUBLICKEY_HASH_SHA1,
+                               &srv_pubkey_hash, &hash_length);
+   if (rc < 0)
+   {
+      goto error;
+   }
+
+   state = ssh_session_is_known_server(session);
+   switch (state)
+   {
+      case SSH_KNOWN_HOSTS_OK:
+         break;
+      case SSH_KNOWN_HOSTS_CHANGED:
+         pgmoneta_log_error("the server key has changed: %s", strerror(errno));
+         goto error;
+      case SSH_KNOWN_HOSTS_OTHER:
+         pgmoneta_log_error("the host key for this server was not found: %s", strerror(errno));
+         goto error;
+      case SSH_KNOWN_HOSTS_NOT_FOUND:
+         pgmoneta_log_error("could not find known host file: %s", strerror(errno));
+         goto error;
+      case SSH_KNOWN_HOSTS_UNKNOWN:
+         rc = ssh_session_update_known_hosts(session);
+         if (rc < 0)
          {
-            if (sftp_get_error(sftp) != SSH_FX_FILE_ALREADY_EXISTS)
-            {
-               pgmoneta_log_error("could not create the directory: %s in the remote server: %s", remote_dir, strerror(errno));
-               goto error;
-            }
+            pgmoneta_log_error("could not update known_hosts file: %s", strerror(errno));
+            goto error;
          }
+         break;
+      case SSH_KNOWN_HOSTS_ERROR:
+         pgmoneta_log_error("error checking the host: %s", strerror(errno));
+         goto error;
+   }
 
-         *p = '/';
-      }
+   pubkey_full_path = pgmoneta_append(pubkey_full_path, homedir);
+   pubkey_full_path = pgmoneta_append(pubkey_full_path, pubkey_path);
+
+   rc = ssh_pki_import_pubkey_file(pubkey_full_path, &client_pubkey);
+   if (rc != SSH_OK)
+   {
+      pgmoneta_log_error("could not import host's public key: %s", strerror(errno));
+      goto error;
    }
 
-   rc = sftp_mkdir(sftp, remote_dir, mode);
+   privkey_full_path = pgmoneta_append(privkey_full_path, homedir);
+   privkey_full_path = pgmoneta_append(privkey_full_path, privkey_path);
+
+   rc = ssh_pki_import_privkey_file(privkey_full_path, NULL, NULL, NULL,
+                                    &client_privkey);
    if (rc != SSH_OK)
    {
-      if (sftp_get_error(sftp) != SSH_FX_FILE_ALREADY_EXISTS)
-      {
-         pgmoneta_log_error("could not create the directory: %s in the remote server: %s", remote_dir, strerror(errno));
-         goto error;
-      }
+      pgmoneta_log_error("could not import host's private key: %s", strerror(errno));
+      goto error;
+   }
+
+   rc = ssh_userauth_publickey(session, NULL, client_privkey);
+   if (rc != SSH_AUTH_SUCCESS)
+   {
+      pgmoneta_log_error("could not authenticate with public/private key: %s", strerror(errno));
+      goto error;
+   }
+
+   sftp = sftp_new(session);
+
+   if (sftp == NULL)
+   {
+      pgmoneta_log_error("Error: %s", ssh_get_error(session));
+      goto error;
    }
 
+   rc = sftp_init(sftp);
+   if (rc != SSH_OK)
+   {
+      pgmoneta_log_error("Error: %s", sftp_get_error(sftp));
+      goto error;
+   }
+
+   ssh_string_free_char(hexa);
+   ssh_clean_pubkey_hash(&srv_pubkey_hash);
+   ssh_key_free(srv_pubkey);
+   ssh_key_free(client_pubkey);
+   ssh_key_free(client_privkey);
+
+   free(pubkey_full_path);
+   free(privkey_full_path);
+
    return 0;
 
 error:
+
+   ssh_string_free_char(hexa);
+   ssh_clean_pubkey_hash(&srv_pubkey_hash);
+   ssh_key_free(srv_pubkey);
+   ssh_key_free(client_pubkey);
+   ssh_key_free(client_privkey);
+
+   free(pubkey_full_path);
+   free(privkey_full_path);
+
+   ssh_close_session();
+
    return 1;
 }
 
+static void
+ssh_close_session(void)
+{
+   if (sftp != NULL)
+   {
+      sftp_free(sftp);
+      sftp = NULL;
+   }
+
+   if (session != NULL)
+   {
+      ssh_disconnect(session);
+      ssh_free(session);
+      session = NULL;
+   }
+}
+
 static int
-sftp_copy_directory(char* local_root, char* remote_root, char* relative_path)
+sftp_parse_target(char* target, char** hostname, char** username, char** path)
+{
+   char* at = NULL;
+   char* colon = NULL;
+   char* host = NULL;
+
+   *hostname = NULL;
+   *username = NULL;
+   *path = NULL;
+
+   if (!pgmoneta_sftp_is_remote(target))
+   {
+      goto error;
+   }
+
+   colon = strchr(target, ':');
+   at = strchr(target, '@');
+
+   if (at != NULL && at < colon)
+   {
+      *username = strndup(target, at - target);
+      host = at + 1;
+   }
+   else
+   {
+      host = target;
+   }
+
+   if (colon == host || strlen(colon + 1) == 0)
+   {
+      goto error;
+   }
+
+   *hostname = strndup(host, colon - host);
+   *path = pgmoneta_append(*path, colon + 1);
+
+   /* The relative paths of the files start with a slash */
+   if (strlen(*path) > 1 && pgmoneta_ends_with(*path, "/"))
+   {
+      (*path)[strlen(*path) - 1] = '\0';
+   }
+
+   return 0;
+
+error:
+
+   free(*hostname);
+   free(*username);
+   free(*path);
+
+   *hostname = NULL;
+   *username = NULL;
+   *path = NULL;
+
+   return 1;
+}
+
+static int
+sftp_copy_prepare(char* local_root, char* remote_root, char* relative_path, struct deque* files)
 {
    char* from = NULL;
    char* to = NULL;
-   char* relative_file;
+   char* relative_entry = NULL;
+   char* local_entry = NULL;
+   char* remote_entry = NULL;
+   char link_target[MAX_PATH];
+   ssize_t length;
    int rc;
-   DIR* dir;
+   DIR* dir = NULL;
    struct dirent* entry;
+   struct stat statbuf;
    mode_t mode = 0;
 
    from = pgmoneta_append(from, local_root);
@@ -654,6 +843,7 @@ sftp_copy_directory(char* local_root, char* remote_root, char* relative_path)
 
    if (!(dir = opendir(from)))
    {
+      pgmoneta_log_error("SSH: Could not open %s", from);
       goto error;
    }
 
@@ -664,41 +854,69 @@ sftp_copy_directory(char* local_root, char* remote_root, char* relative_path)
    {
       if (sftp_get_error(sftp) != SSH_FX_FILE_ALREADY_EXISTS)
       {
+         pgmoneta_log_error("SSH: Could not create %s: %s", to, ssh_get_error(session));
          goto error;
       }
    }
 
    while ((entry = readdir(dir)) != NULL)
    {
-      if (entry->d_type == DT_DIR)
+      if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
       {
-         char relative_dir[1024];
+         continue;
+      }
 
-         if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
-         {
-            continue;
-         }
+      relative_entry = pgmoneta_append(relative_entry, relative_path);
+      relative_entry = pgmoneta_append(relative_entry, "/");
+      relative_entry = pgmoneta_append(relative_entry, entry->d_name);
 
-         snprintf(relative_dir, sizeof(relative_dir), "%s/%s", relative_path, entry->d_name);
+      local_entry = pgmoneta_append(local_entry, local_root);
+      local_entry = pgmoneta_append(local_entry, relative_entry);
 
-         sftp_copy_directory(local_root, remote_root, relative_dir);
+      if (entry->d_type == DT_DIR)
+      {
+         if (sftp_copy_prepare(local_root, remote_root, relative_entry, files))
+         {
+            goto error;
+         }
       }
-      else
+      else if (entry->d_type == DT_LNK && !stat(local_entry, &statbuf) && S_ISDIR(statbuf.st_mode))
       {
-         relative_file = NULL;
+         /* Tablespace links are relative to the restore, so they are made as they are */
+         length = readlink(local_entry, link_target, sizeof(link_target) - 1);
+         if (length < 0)
+         {
+            pgmoneta_log_error("SSH: Could not read link %s: %s", local_entry, strerror(errno));
+            goto error;
+         }
+         link_target[length] = '\0';
 
-         relative_file = pgmoneta_append(relative_file, relative_path);
-         relative_file = pgmoneta_append(relative_file, "/");
-         relative_file = pgmoneta_append(relative_file, entry->d_name);
+         remote_entry = pgmoneta_append(remote_entry, remote_root);
+         remote_entry = pgmoneta_append(remote_entry, relative_entry);
 
-         if (sftp_copy_file(local_root, remote_root, relative_file))
+         sftp_unlink(sftp, remote_entry);
+         if (sftp_symlink(sftp, link_target, remote_entry) < 0)
          {
-            free(relative_file);
+            pgmoneta_log_error("SSH: Could not link %s: %s", remote_entry, ssh_get_error(session));
             goto error;
          }
 
-         free(relative_file);
+         free(remote_entry);
+         remote_entry = NULL;
       }
+      else
+      {
+         if (pgmoneta_deque_add(files, NULL, (uintptr_t)relative_entry, ValueString))
+         {
+            goto error;
+         }
+      }
+
+      free(relative_entry);
+      relative_entry = NULL;
+
+      free(local_entry);
+      local_entry = NULL;
    }
 
    closedir(dir);
@@ -710,26 +928,192 @@ sftp_copy_directory(char* local_root, char* remote_root, char* relative_path)
 
 error:
 
-   closedir(dir);
+   if (dir != NULL)
+   {
+      closedir(dir);
+   }
 
    free(from);
    free(to);
+   free(relative_entry);
+   free(local_entry);
+   free(remote_entry);
+
+   return 1;
+}
+
+static int
+sftp_copy_files(char* hostname, char* username, char* local_root, char* remote_root, struct deque* files, int number_of_threads)
+{
+   int started = 0;
+   bool failed = false;
+   pthread_t* threads = NULL;
+   struct sftp_copy_input* inputs = NULL;
+
+   if (number_of_threads < 1)
+   {
+      number_of_threads = 1;
+   }
+   if (number_of_threads > (int)pgmoneta_deque_size(files))
+   {
+      number_of_threads = (int)pgmoneta_deque_size(files);
+   }
+
+   if (number_of_threads == 0)
+   {
+      return 0;
+   }
+
+   pgmoneta_log_debug("SSH: %d files to %s using %d sessions",
+                      (int)pgmoneta_deque_size(files), hostname, number_of_threads);
+
+   threads = (pthread_t*)calloc(number_of_threads, sizeof(pthread_t));
+   inputs = (struct sftp_copy_input*)calloc(number_of_threads, sizeof(struct sftp_copy_input));
+
+   if (threads == NULL || inputs == NULL)
+   {
+      goto error;
+   }
+
+   for (int i = 0; i < number_of_threads; i++)
+   {
+      inputs[i].hostname = hostname;
+      inputs[i].username = username;
+      inputs[i].local_root = local_root;
+      inputs[i].remote_root = remote_root;
+      inputs[i].files = files;
+      inputs[i].result = 1;
+
+      if (pthread_create(&threads[started], NULL, &do_sftp_copy, &inputs[i]))
+      {
+         pgmoneta_log_error("SSH: Could not start session %d", i);
+         failed = true;
+         break;
+      }
+
+      started++;
+   }
+
+   for (int i = 0; i < started; i++)
+   {
+      pthread_join(threads[i], NULL);
+
+      if (inputs[i].result)
+      {
+         failed = true;
+      }
+   }
+
+   if (failed)
+   {
+      goto error;
+   }
+
+   free(threads);
+   free(inputs);
+
+   return 0;
+
+error:
+
+   free(threads);
+   free(inputs);
 
    return 1;
 }
 
+static void*
+do_sftp_copy(void* arg)
+{
+   char* relative_file = NULL;
+   struct sftp_copy_input* input = (struct sftp_copy_input*)arg;
+
+   input->result = 1;
+
+   if (ssh_open_session(input->hostname, input->username))
+   {
+      goto error;
+   }
+
+   while ((relative_file = (char*)pgmoneta_deque_poll(input->files, NULL)) != NULL)
+   {
+      if (sftp_copy_file(input->local_root, input->remote_root, relative_file))
+      {
+         pgmoneta_log_error("SSH: Could not upload %s", relative_file);
+         free(relative_file);
+         goto error;
+      }
+
+      free(relative_file);
+   }
+
+   input->result = 0;
+
+   ssh_close_session();
+
+   return NULL;
+
+error:
+
+   ssh_close_session();
+
+   return NULL;
+}
+
+static int
+sftp_make_directory(char* local_dir, char* remote_dir)
+{
+   int rc;
+   char* p;
+   mode_t mode = 0;
+
+   mode = pgmoneta_get_permission(local_dir);
+
+   for (p = remote_dir + 1; *p; p++)
+   {
+      if (*p == '/')
+      {
+         *p = '\0';
+
+         rc = sftp_mkdir(sftp, remote_dir, mode);
+         if (rc != SSH_OK)
+         {
+            if (sftp_get_error(sftp) != SSH_FX_FILE_ALREADY_EXISTS)
+            {
+               pgmoneta_log_error("could not create the directory: %s in the remote server: %s", remote_dir, strerror(errno));
+               goto error;
+            }
+         }
+
+         *p = '/';
+      }
+   }
+
+   rc = sftp_mkdir(sftp, remote_dir, mode);
+   if (rc != SSH_OK)
+   {
+      if (sftp_get_error(sftp) != SSH_FX_FILE_ALREADY_EXISTS)
+      {
+         pgmoneta_log_error("could not create the directory: %s in the remote server: %s", remote_dir, strerror(errno));
+         goto error;
+      }
+   }
+
+   return 0;
+
+error:
+   return 1;
+}
+
 static int
 sftp_copy_file(char* local_root, char* remote_root, char* relative_path)
 {
    char* s = NULL;
    char* d = NULL;
-   char* sha256 = NULL;
-   char* latest_sha256 = NULL;
    char* latest_backup_path = NULL;
-   char buffer[16384];
+   char* key = NULL;
    FILE* sfile = NULL;
    sftp_file dfile = NULL;
-   unsigned long read_bytes = 0;
    mode_t mode = 0;
    bool is_link = false;
 
@@ -739,31 +1123,24 @@ sftp_copy_file(char* local_root, char* remote_root, char* relative_path)
    d = pgmoneta_append(d, remote_root);
    d = pgmoneta_append(d, relative_path);
 
-   pgmoneta_create_sha256_file(s, &sha256);
+   key = pgmoneta_append(key, "file ");
+   key = pgmoneta_append(key, d);
+
+   if (pgmoneta_journal_contains(journal, key))
+   {
+      goto done;
+   }
 
-   if (latest_remote_root != NULL)
+   if (latest_remote_root != NULL && relative_path[0] == '/' &&
+       pgmoneta_link_is_unchanged(relative_path + 1, diff))
    {
       latest_backup_path = pgmoneta_append(latest_backup_path, latest_remote_root);
       latest_backup_path = pgmoneta_append(latest_backup_path, relative_path);
 
-      if ((latest_sha256 = (char*)pgmoneta_art_search(tree_map, relative_path)) != NULL)
-      {
-         if (!strcmp(latest_sha256, sha256))
-         {
-            is_link = true;
-         }
-      }
+      is_link = sftp_link_file(latest_backup_path, d) == 0;
    }
 
-   if (is_link)
-   {
-      if (sftp_symlink(sftp, latest_backup_path, d) < 0)
-      {
-         pgmoneta_log_error("Failed to link remotely: %s", ssh_get_error(session));
-         goto error;
-      }
-   }
-   else
+   if (!is_link)
    {
       mode = pgmoneta_get_permission(s);
 
@@ -781,32 +1158,32 @@ sftp_copy_file(char* local_root, char* remote_root, char* relative_path)
          goto error;
       }
 
-      memset(buffer, 0, sizeof(buffer));
-
-      while ((read_bytes = fread(buffer, 1, sizeof(buffer), sfile)) > 0)
+      if (sftp_write_file(sfile, dfile, d))
       {
-         sftp_write(dfile, buffer, read_bytes);
+         goto error;
       }
    }
 
    if (sfile != NULL)
    {
       fclose(sfile);
+      sfile = NULL;
    }
 
    if (dfile != NULL)
    {
       sftp_close(dfile);
+      dfile = NULL;
    }
 
+   pgmoneta_journal_add(journal, key, NULL);
+
+done:
+
    free(s);
    free(d);
-   free(sha256);
-
-   if (latest_backup_path != NULL)
-   {
-      free(latest_backup_path);
-   }
+   free(latest_backup_path);
+   free(key);
 
    return 0;
 
@@ -824,100 +1201,171 @@ error:
 
    free(s);
    free(d);
-   free(sha256);
-
-   if (latest_backup_path != NULL)
-   {
-      free(latest_backup_path);
-   }
+   free(latest_backup_path);
+   free(key);
 
    return 1;
 }
 
 static int
-sftp_wal_prepare(sftp_file* file, int segsize)
+sftp_link_file(char* source, char* d)
 {
-   char buffer[8192] = {0};
-   size_t written = 0;
-
-   if (file == NULL || *file == NULL)
-   {
-      return 1;
-   }
+   sftp_unlink(sftp, d);
 
-   while (written < (size_t)segsize)
+#if LIBSSH_VERSION_INT >= SSH_VERSION_INT(0, 11, 0)
+   /* A hard link keeps the file when the previous backup is deleted */
+   if (sftp_hardlink(sftp, source, d) < 0)
+#else
+   if (sftp_symlink(sftp, source, d) < 0)
+#endif
    {
-      written += sftp_write(*file, buffer, sizeof(buffer));
+      pgmoneta_log_debug("SSH: Could not link %s to %s: %s", d, source, ssh_get_error(session));
+      goto error;
    }
 
-   if (sftp_seek(*file, 0) < 0)
-   {
-      pgmoneta_log_error("WAL error: %s", ssh_get_error(session));
-      return 1;
-   }
    return 0;
+
+error:
+
+   return 1;
 }
 
 static int
-read_latest_backup_sha256(char* path)
+sftp_write_file(FILE* sfile, sftp_file dfile, char* d)
 {
-   char buffer[4096];
-   FILE* file = NULL;
+   char buffer[SFTP_CHUNK_SIZE];
+   size_t read_bytes = 0;
+#if LIBSSH_VERSION_INT >= SSH_VERSION_INT(0, 11, 0)
+   int depth;
+   int head = 0;
+   int count = 0;
+   bool eof = false;
+   sftp_aio* aios = NULL;
+   size_t* lengths = NULL;
+   struct main_configuration* config;
 
-   file = fopen(path, "r");
-   if (file == NULL)
+   config = (struct main_configuration*)shmem;
+
+   /* A write is acknowledged one round trip after it is sent, so keep
+    * ssh_max_inflight writes on the wire instead of waiting for each one */
+   depth = config->ssh_max_inflight;
+
+   aios = (sftp_aio*)calloc(depth, sizeof(sftp_aio));
+   lengths = (size_t*)calloc(depth, sizeof(size_t));
+
+   if (aios == NULL || lengths == NULL)
    {
       goto error;
    }
 
-   fclose(file);
+   while (true)
+   {
+      while (!eof && count < depth)
+      {
+         int slot = (head + count) % depth;
 
-   file = fopen(path, "r");
+         read_bytes = fread(buffer, 1, sizeof(buffer), sfile);
+         if (read_bytes == 0)
+         {
+            if (ferror(sfile))
+            {
+               pgmoneta_log_error("Failed to read the source of %s", d);
+               goto error;
+            }
 
-   memset(&buffer[0], 0, sizeof(buffer));
+            eof = true;
+            break;
+         }
 
-   while ((fgets(&buffer[0], sizeof(buffer), file)) != NULL)
-   {
-      char* ptr = NULL;
-      char* file_path = NULL;
-      char* hash = NULL;
+         /* The data is copied into the request, so the buffer can be reused */
+         if (sftp_aio_begin_write(dfile, buffer, read_bytes, &aios[slot]) != (ssize_t)read_bytes)
+         {
+            pgmoneta_log_error("Failed to write %s remotely: %s", d, ssh_get_error(session));
+            goto error;
+         }
 
-      ptr = strtok(&buffer[0], ":");
+         lengths[slot] = read_bytes;
+         count++;
+      }
 
-      if (ptr == NULL)
+      if (count == 0)
       {
-         goto error;
+         break;
       }
-      file_path = pgmoneta_append(NULL, ptr);
-
-      ptr = strtok(NULL, ":");
-
-      hash = (char*)malloc(strlen(ptr));
 
-      if (hash == NULL)
+      /* The wait frees the request, also when it fails */
+      if (sftp_aio_wait_write(&aios[head]) != (ssize_t)lengths[head])
       {
+         aios[head] = NULL;
+         pgmoneta_log_error("Failed to write %s remotely: %s", d, ssh_get_error(session));
          goto error;
       }
 
-      memset(hash, 0, strlen(ptr));
-      memcpy(hash, ptr, strlen(ptr) - 1);
+      aios[head] = NULL;
 
-      pgmoneta_art_insert(tree_map, file_path, (uintptr_t)hash, ValueString);
-      free(file_path);
+      atomic_fetch_add(&uploaded_bytes, lengths[head]);
+
+      head = (head + 1) % depth;
+      count--;
    }
 
-   fclose(file);
+   free(aios);
+   free(lengths);
 
    return 0;
 
 error:
 
-   if (file != NULL)
+   if (aios != NULL)
    {
-      fclose(file);
+      for (int i = 0; i < depth; i++)
+      {
+         sftp_aio_free(aios[i]);
+      }
    }
 
+   free(aios);
+   free(lengths);
+
    return 1;
+#else
+   while ((read_bytes = fread(buffer, 1, sizeof(buffer), sfile)) > 0)
+   {
+      if (sftp_write(dfile, buffer, read_bytes) != (ssize_t)read_bytes)
+      {
+         pgmoneta_log_error("Failed to write %s remotely: %s", d, ssh_get_error(session));
+         return 1;
+      }
+
+      atomic_fetch_add(&uploaded_bytes, read_bytes);
+   }
+
+   return 0;
+#endif
+}
+
+static int
+sftp_wal_prepare(sftp_file* file, int segsize)
+{
+   char buffer[8192] = {0};
+   size_t written = 0;
+
+   if (file == NULL || *file == NULL)
+   {
+      return 1;
+   }
+
+   while (written < (size_t)segsize)
+   {
+      written += sftp_write(*file, buffer, sizeof(buffer));
+   }
+
+   if (sftp_seek(*file, 0) < 0)
+   {
+      pgmoneta_log_error("WAL error: %s", ssh_get_error(session));
+      return 1;
+   }
+   return 0;
 }
 
 static char*
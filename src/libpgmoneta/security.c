@@ -30,13 +30,17 @@
 #include <pgmoneta.h>
 #include <logging.h>
 #include <network.h>
+#include <profile.h>
 #include <security.h>
 #include <utils.h>
+#include <workers.h>
 
 /* system */
-#ifdef HAVE_PCLMUL
+#if defined(HAVE_CRC32C) && !defined(__aarch64__)
 #include <nmmintrin.h>
 #endif
+#include <pthread.h>
+#include <fcntl.h>
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -45,9 +49,6 @@
 #include <string.h>
 #include <strings.h>
 #include <unistd.h>
-#ifdef HAVE_PCLMUL
-#include <wmmintrin.h>
-#endif
 #include <arpa/inet.h>
 #include <openssl/err.h>
 #include <openssl/evp.h>
@@ -56,12 +57,48 @@
 #include <openssl/rand.h>
 #include <openssl/sha.h>
 #include <openssl/ssl.h>
+#ifdef HAVE_XXHASH
+#include <xxhash.h>
+#endif
+#ifdef HAVE_BLAKE3
+#include <blake3.h>
+#endif
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 
 typedef uint32_t pg_crc32c;
 
+/** @struct tree_chunk
+ * Defines a chunk of a file that is hashed on a worker
+ */
+struct tree_chunk
+{
+   struct worker_common common; /**< The common base */
+   char* path;                  /**< The path of the file */
+   int algorithm;               /**< The hash algorithm */
+   off_t offset;                /**< The offset of the chunk */
+   size_t size;                 /**< The size of the chunk */
+   char* hash;                  /**< The hash of the chunk */
+};
+
+/** @struct hash_context
+ * Defines a running hash
+ */
+struct hash_context
+{
+   int algorithm;            /**< The hash algorithm */
+   EVP_MD_CTX* md;           /**< The message digest for the SHA algorithms */
+   uint32_t crc;             /**< The CRC32C */
+#ifdef HAVE_XXHASH
+   XXH3_state_t* xxh3;       /**< The XXH3 state */
+#endif
+#ifdef HAVE_BLAKE3
+   blake3_hasher blake3;     /**< The BLAKE3 hasher */
+#endif
+};
+
 #ifdef HAVE_CRC32C
 #ifdef __aarch64__
 __attribute__((unused))
@@ -95,10 +132,12 @@ _mm_crc32_u8(uint32_t crc, uint8_t value)
 
 #define NUMBER_OF_SECURITY_MESSAGES    5
 #define SECURITY_BUFFER_SIZE        1024
+#define HASH_BUFFER_SIZE            65536
 
-static signed char has_security;
-static ssize_t security_lengths[NUMBER_OF_SECURITY_MESSAGES];
-static char security_messages[NUMBER_OF_SECURITY_MESSAGES][SECURITY_BUFFER_SIZE];
+/* Per thread, as the backups of one process may authenticate at the same time */
+static _Thread_local signed char has_security;
+static _Thread_local ssize_t security_lengths[NUMBER_OF_SECURITY_MESSAGES];
+static _Thread_local char security_messages[NUMBER_OF_SECURITY_MESSAGES][SECURITY_BUFFER_SIZE];
 
 static int get_auth_type(struct message* msg, int* auth_type);
 static int get_salt(void* data, char** salt);
@@ -136,6 +175,10 @@ static int  server_signature(char* password, char* salt, int salt_length, int it
 static int  create_ssl_client(SSL_CTX* ctx, char* key, char* cert, char* root, int socket, SSL** ssl);
 
 static int create_hash_file(char* filename, char* algorithm, char** hash);
+static int create_xxh3_file(char* filename, char** xxh3);
+static int create_blake3_file(char* filename, char** blake3);
+static char* hash_to_hex(unsigned char* digest, size_t length);
+static void tree_hash_chunk(struct worker_common* wc);
 
 int
 pgmoneta_remote_management_auth(int client_fd, char* address, SSL** client_ssl)
@@ -1136,6 +1179,16 @@ pgmoneta_server_authenticate(int server, char* database, char* username, char* p
          goto error;
       }
 
+      if (config->common.servers[server].tls_ktls)
+      {
+#ifdef SSL_OP_ENABLE_KTLS
+         /* The records are moved to the kernel after the handshake, if the kernel supports the cipher */
+         SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#else
+         pgmoneta_log_warn("%s: kTLS is not supported by this OpenSSL", config->common.servers[server].name);
+#endif
+      }
+
       pgmoneta_log_trace("%s: Key file @ %s", config->common.servers[server].name, config->common.servers[server].tls_key_file);
       pgmoneta_log_trace("%s: Certificate file @ %s", config->common.servers[server].name, config->common.servers[server].tls_cert_file);
       pgmoneta_log_trace("%s: CA file @ %s", config->common.servers[server].name, config->common.servers[server].tls_ca_file);
@@ -1184,6 +1237,16 @@ pgmoneta_server_authenticate(int server, char* database, char* username, char* p
          }
       }
       while (connect != 1);
+
+#ifdef SSL_OP_ENABLE_KTLS
+      if (config->common.servers[server].tls_ktls)
+      {
+         pgmoneta_log_debug("%s: kTLS send %s, receive %s (%s)", config->common.servers[server].name,
+                            BIO_get_ktls_send(SSL_get_wbio(c_ssl)) ? "on" : "off",
+                            BIO_get_ktls_recv(SSL_get_rbio(c_ssl)) ? "on" : "off",
+                            SSL_get_cipher(c_ssl));
+      }
+#endif
    }
 
    ret = pgmoneta_create_startup_message(username, database, replication, &startup_msg);
@@ -2871,6 +2934,26 @@ create_hash_file(char* filename, char* algorithm, char** hash)
    return 0;
 }
 
+static char*
+hash_to_hex(unsigned char* digest, size_t length)
+{
+   char* hex = NULL;
+
+   hex = malloc(length * 2 + 1);
+   if (hex == NULL)
+   {
+      return NULL;
+   }
+
+   for (size_t i = 0; i < length; i++)
+   {
+      sprintf(&hex[i * 2], "%02x", digest[i]);
+   }
+   hex[length * 2] = '\0';
+
+   return hex;
+}
+
 int
 pgmoneta_create_sha224_file(char* filename, char** sha224)
 {
@@ -2895,6 +2978,163 @@ pgmoneta_create_sha512_file(char* filename, char** sha512)
    return create_hash_file(filename, "SHA512", sha512);
 }
 
+static int
+create_xxh3_file(char* filename, char** xxh3)
+{
+#ifdef HAVE_XXHASH
+   XXH3_state_t* state = NULL;
+   XXH128_hash_t h;
+   XXH128_canonical_t canonical;
+   FILE* file = NULL;
+   char read_buf[65536];
+   size_t read_bytes = 0;
+
+   *xxh3 = NULL;
+
+   state = XXH3_createState();
+   if (state == NULL || XXH3_128bits_reset(state) == XXH_ERROR)
+   {
+      goto error;
+   }
+
+   file = fopen(filename, "rb");
+   if (file == NULL)
+   {
+      goto error;
+   }
+
+   while ((read_bytes = fread(read_buf, 1, sizeof(read_buf), file)) > 0)
+   {
+      if (XXH3_128bits_update(state, read_buf, read_bytes) == XXH_ERROR)
+      {
+         goto error;
+      }
+   }
+
+   if (ferror(file))
+   {
+      goto error;
+   }
+
+   h = XXH3_128bits_digest(state);
+   XXH128_canonicalFromHash(&canonical, h);
+
+   *xxh3 = hash_to_hex(canonical.digest, sizeof(canonical.digest));
+   if (*xxh3 == NULL)
+   {
+      goto error;
+   }
+
+   XXH3_freeState(state);
+   fclose(file);
+
+   return 0;
+
+error:
+
+   if (state != NULL)
+   {
+      XXH3_freeState(state);
+   }
+
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+
+   return 1;
+#else
+   (void)filename;
+   *xxh3 = NULL;
+
+   pgmoneta_log_error("xxh3 is not supported by this build");
+
+   return 1;
+#endif
+}
+
+static int
+create_blake3_file(char* filename, char** blake3)
+{
+#ifdef HAVE_BLAKE3
+   blake3_hasher hasher;
+   uint8_t digest[BLAKE3_OUT_LEN];
+   FILE* file = NULL;
+   char read_buf[65536];
+   size_t read_bytes = 0;
+
+   *blake3 = NULL;
+
+   file = fopen(filename, "rb");
+   if (file == NULL)
+   {
+      goto error;
+   }
+
+   blake3_hasher_init(&hasher);
+
+   while ((read_bytes = fread(read_buf, 1, sizeof(read_buf), file)) > 0)
+   {
+      blake3_hasher_update(&hasher, read_buf, read_bytes);
+   }
+
+   if (ferror(file))
+   {
+      goto error;
+   }
+
+   blake3_hasher_finalize(&hasher, digest, BLAKE3_OUT_LEN);
+
+   *blake3 = hash_to_hex(digest, BLAKE3_OUT_LEN);
+   if (*blake3 == NULL)
+   {
+      goto error;
+   }
+
+   fclose(file);
+
+   return 0;
+
+error:
+
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+
+   return 1;
+#else
+   (void)filename;
+   *blake3 = NULL;
+
+   pgmoneta_log_error("blake3 is not supported by this build");
+
+   return 1;
+#endif
+}
+
+int
+pgmoneta_create_backup_file_hash(int server, char* file_path, char** hash)
+{
+   int algorithm;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   algorithm = config->common.servers[server].manifest;
+   if (algorithm == HASH_ALGORITHM_DEFAULT)
+   {
+      algorithm = config->manifest;
+   }
+
+   if (algorithm == HASH_ALGORITHM_XXH3 || algorithm == HASH_ALGORITHM_BLAKE3)
+   {
+      return pgmoneta_create_file_hash(algorithm, file_path, hash);
+   }
+
+   return pgmoneta_create_sha256_file(file_path, hash);
+}
+
 int
 pgmoneta_generate_string_sha256_hash(char* string, char** sha256)
 {
@@ -2983,131 +3223,190 @@ error:
    return 1;
 }
 
-#if HAVE_PCLMUL
-__attribute__((target("pclmul,sse4.2")))
-static int
-pgmoneta_crc32c_pclmul(const void* buffer, size_t size, uint32_t* crc)
+#ifdef HAVE_CRC32C
+/*
+ * The hardware CRC32C instruction has a latency of three cycles but a
+ * throughput of one per cycle, so a single dependency chain leaves two
+ * thirds of the unit idle. Large buffers are therefore split into three
+ * lanes that are computed independently and then combined by shifting the
+ * earlier lanes over the length of the later ones (M. Adler).
+ */
+#define CRC32C_POLY  0x82f63b78
+#define CRC32C_LONG  8192
+#define CRC32C_SHORT 256
+
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+static uint32_t crc32c_long[4][256];
+static uint32_t crc32c_short[4][256];
+
+static uint32_t
+gf2_matrix_times(uint32_t* mat, uint32_t vec)
 {
-   pg_crc32c initial_crc = ~(*crc);
-   ssize_t len = (ssize_t)size;
-   const unsigned char* p = buffer;
-
-   static const uint64_t k1k2[2] = { 0x740eef02, 0x9e4addf8 };
-   static const uint64_t k3k4[2] = { 0xf20c0dfe, 0x14cd00bd6 };
-   static const uint64_t k5k0[2] = { 0xdd45aab8, 0 };
-   static const uint64_t poly[2] = { 0x105ec76f1, 0xdea713f1 };
-
-   if (len >= 64)
-   {
-      __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
-      x1 = _mm_loadu_si128((__m128i*)(p));
-      x2 = _mm_loadu_si128((__m128i*)(p + 0x10));
-      x3 = _mm_loadu_si128((__m128i*)(p + 0x20));
-      x4 = _mm_loadu_si128((__m128i*)(p + 0x30));
-      x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(initial_crc));
-      x0 = _mm_load_si128((__m128i*)k1k2);
-      p += 64;
-      len -= 64;
-
-      while (len >= 64)
-      {
-         x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
-         x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
-         x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
-         x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
-         x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
-         x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
-         x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
-         x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
-         y5 = _mm_loadu_si128((__m128i*)(p + 0x00));
-         y6 = _mm_loadu_si128((__m128i*)(p + 0x10));
-         y7 = _mm_loadu_si128((__m128i*)(p + 0x20));
-         y8 = _mm_loadu_si128((__m128i*)(p + 0x30));
-         x1 = _mm_xor_si128(x1, x5); x1 = _mm_xor_si128(x1, y5);
-         x2 = _mm_xor_si128(x2, x6); x2 = _mm_xor_si128(x2, y6);
-         x3 = _mm_xor_si128(x3, x7); x3 = _mm_xor_si128(x3, y7);
-         x4 = _mm_xor_si128(x4, x8); x4 = _mm_xor_si128(x4, y8);
-         p += 64;
-         len -= 64;
-      }
-
-      x0 = _mm_load_si128((__m128i*)k3k4);
-      x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
-      x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
-      x1 = _mm_xor_si128(x1, x2); x1 = _mm_xor_si128(x1, x5);
-      x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
-      x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
-      x1 = _mm_xor_si128(x1, x3); x1 = _mm_xor_si128(x1, x5);
-      x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
-      x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
-      x1 = _mm_xor_si128(x1, x4); x1 = _mm_xor_si128(x1, x5);
-
-      while (len >= 16)
-      {
-         x2 = _mm_loadu_si128((__m128i*)p);
-         x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
-         x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
-         x1 = _mm_xor_si128(x1, x2); x1 = _mm_xor_si128(x1, x5);
-         p += 16;
-         len -= 16;
-      }
-
-      x0 = _mm_load_si128((__m128i*)k3k4);
-      x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
-      x3 = _mm_setr_epi32(~0, 0, ~0, 0);
-      x1 = _mm_srli_si128(x1, 8);
-      x1 = _mm_xor_si128(x1, x2);
-      x0 = _mm_loadl_epi64((__m128i*)k5k0);
-      x2 = _mm_srli_si128(x1, 4);
-      x1 = _mm_and_si128(x1, x3);
-      x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
-      x1 = _mm_xor_si128(x1, x2);
-
-      x0 = _mm_load_si128((__m128i*)poly);
-      x2 = _mm_and_si128(x1, x3);
-      x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
-      x2 = _mm_and_si128(x2, x3);
-      x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
-      x1 = _mm_xor_si128(x1, x2);
-      initial_crc = _mm_extract_epi32(x1, 1);
-   }
-
-   uint64_t crc64 = (uint64_t)initial_crc;
-   for (; p < (const unsigned char*)buffer + size; p += 8)
-   {
-      crc64 = _mm_crc32_u64(crc64, *(uint64_t*)p);
-   }
-
-   initial_crc = (pg_crc32c)crc64;
-   *crc = ~initial_crc;
+   uint32_t sum = 0;
 
-   return 0;
+   while (vec)
+   {
+      if (vec & 1)
+      {
+         sum ^= *mat;
+      }
+      vec >>= 1;
+      mat++;
+   }
+
+   return sum;
+}
+
+static void
+gf2_matrix_square(uint32_t* square, uint32_t* mat)
+{
+   for (int n = 0; n < 32; n++)
+   {
+      square[n] = gf2_matrix_times(mat, mat[n]);
+   }
+}
+
+static void
+crc32c_zeros_op(uint32_t* even, size_t len)
+{
+   uint32_t odd[32];
+   uint32_t row = 1;
+
+   /* Operator for one zero bit */
+   odd[0] = CRC32C_POLY;
+   for (int n = 1; n < 32; n++)
+   {
+      odd[n] = row;
+      row <<= 1;
+   }
+
+   /* Two and four zero bits */
+   gf2_matrix_square(even, odd);
+   gf2_matrix_square(odd, even);
+
+   /* Square until len (a power of two) bytes of zeros are covered */
+   do
+   {
+      gf2_matrix_square(even, odd);
+      len >>= 1;
+      if (len == 0)
+      {
+         return;
+      }
+      gf2_matrix_square(odd, even);
+      len >>= 1;
+   }
+   while (len);
+
+   memcpy(even, odd, sizeof(odd));
+}
+
+static void
+crc32c_zeros(uint32_t zeros[][256], size_t len)
+{
+   uint32_t op[32];
+
+   crc32c_zeros_op(op, len);
+
+   for (uint32_t n = 0; n < 256; n++)
+   {
+      zeros[0][n] = gf2_matrix_times(op, n);
+      zeros[1][n] = gf2_matrix_times(op, n << 8);
+      zeros[2][n] = gf2_matrix_times(op, n << 16);
+      zeros[3][n] = gf2_matrix_times(op, n << 24);
+   }
+}
+
+static void
+crc32c_init(void)
+{
+   crc32c_zeros(crc32c_long, CRC32C_LONG);
+   crc32c_zeros(crc32c_short, CRC32C_SHORT);
+}
+
+static inline uint32_t
+crc32c_shift(uint32_t zeros[][256], uint32_t crc)
+{
+   return zeros[0][crc & 0xff] ^ zeros[1][(crc >> 8) & 0xff] ^
+          zeros[2][(crc >> 16) & 0xff] ^ zeros[3][crc >> 24];
 }
-#endif
 
-#if HAVE_CRC32
-__attribute__((target("sse4.2")))
 static int
-pgmoneta_crc32c_sse42(const void* buffer, size_t size, uint32_t* crc)
+pgmoneta_crc32c_hardware(const void* buffer, size_t size, uint32_t* crc)
 {
-   uint64_t crc64 = (uint64_t) ~(*crc);
-   const unsigned char* p = (const unsigned char*)buffer;
-   size_t remaining = size;
+   const unsigned char* next = (const unsigned char*)buffer;
+   const unsigned char* end = NULL;
+   uint64_t crc0;
+   uint64_t crc1;
+   uint64_t crc2;
+   uint64_t word;
+   size_t len = size;
+
+   pthread_once(&crc32c_once, crc32c_init);
+
+   crc0 = (uint32_t) ~(*crc);
 
-   while (remaining >= 8)
+   while (len > 0 && ((uintptr_t)next & 7) != 0)
    {
-      crc64 = _mm_crc32_u64(crc64, *(const uint64_t*)p);
-      p += 8;
-      remaining -= 8;
+      crc0 = _mm_crc32_u8(crc0, *next);
+      next++;
+      len--;
    }
 
-   while (remaining > 0)
+   while (len >= CRC32C_LONG * 3)
    {
-      crc64 = _mm_crc32_u8(crc64, *p++);
-      remaining--;
+      crc1 = 0;
+      crc2 = 0;
+      end = next + CRC32C_LONG;
+      do
+      {
+         crc0 = _mm_crc32_u64(crc0, *(const uint64_t*)next);
+         crc1 = _mm_crc32_u64(crc1, *(const uint64_t*)(next + CRC32C_LONG));
+         crc2 = _mm_crc32_u64(crc2, *(const uint64_t*)(next + CRC32C_LONG * 2));
+         next += 8;
+      }
+      while (next < end);
+      crc0 = crc32c_shift(crc32c_long, crc0) ^ crc1;
+      crc0 = crc32c_shift(crc32c_long, crc0) ^ crc2;
+      next += CRC32C_LONG * 2;
+      len -= CRC32C_LONG * 3;
+   }
+
+   while (len >= CRC32C_SHORT * 3)
+   {
+      crc1 = 0;
+      crc2 = 0;
+      end = next + CRC32C_SHORT;
+      do
+      {
+         crc0 = _mm_crc32_u64(crc0, *(const uint64_t*)next);
+         crc1 = _mm_crc32_u64(crc1, *(const uint64_t*)(next + CRC32C_SHORT));
+         crc2 = _mm_crc32_u64(crc2, *(const uint64_t*)(next + CRC32C_SHORT * 2));
+         next += 8;
+      }
+      while (next < end);
+      crc0 = crc32c_shift(crc32c_short, crc0) ^ crc1;
+      crc0 = crc32c_shift(crc32c_short, crc0) ^ crc2;
+      next += CRC32C_SHORT * 2;
+      len -= CRC32C_SHORT * 3;
    }
 
-   *crc = ~crc64;
+   while (len >= 8)
+   {
+      memcpy(&word, next, sizeof(word));
+      crc0 = _mm_crc32_u64(crc0, word);
+      next += 8;
+      len -= 8;
+   }
+
+   while (len > 0)
+   {
+      crc0 = _mm_crc32_u8(crc0, *next);
+      next++;
+      len--;
+   }
+
+   *crc = ~(uint32_t)crc0;
 
    return 0;
 }
@@ -3201,13 +3500,11 @@ pgmoneta_create_crc32c_buffer(void* buffer, size_t size, uint32_t* crc)
       return 1;
    }
 
-#ifdef HAVE_PCLMUL
-   return pgmoneta_crc32c_pclmul(buffer, size, crc);
-#elif HAVE_CRC32
-   return pgmoneta_crc32c_sse42(buffer, size, crc);
-#endif
-
+#ifdef HAVE_CRC32C
+   return pgmoneta_crc32c_hardware(buffer, size, crc);
+#else
    return pgmoneta_crc32c_software(buffer, size, crc);
+#endif
 }
 
 int
@@ -3267,6 +3564,8 @@ int
 pgmoneta_create_file_hash(int algorithm, char* file_path, char** hash)
 {
    int stat = 0;
+   PGMONETA_PROFILE(PROFILE_FILE_HASH);
+
    switch (algorithm)
    {
       case HASH_ALGORITHM_CRC32C:
@@ -3285,14 +3584,421 @@ pgmoneta_create_file_hash(int algorithm, char* file_path, char** hash)
       case HASH_ALGORITHM_SHA512:
          stat = pgmoneta_create_sha512_file(file_path, hash);
          break;
+      case HASH_ALGORITHM_XXH3:
+         stat = create_xxh3_file(file_path, hash);
+         break;
+      case HASH_ALGORITHM_BLAKE3:
+         stat = create_blake3_file(file_path, hash);
+         break;
       default:
-         pgmoneta_log_error("Unrecognized hash algorithm: %s", algorithm);
+         pgmoneta_log_error("Unrecognized hash algorithm: %d", algorithm);
          stat = 1;
          break;
    }
    return stat;
 }
 
+static void
+tree_hash_chunk(struct worker_common* wc)
+{
+   struct tree_chunk* tc = (struct tree_chunk*)wc;
+   struct hash_context* ctx = NULL;
+   unsigned char* buffer = NULL;
+   size_t done = 0;
+   int fd = -1;
+
+   buffer = (unsigned char*)malloc(HASH_BUFFER_SIZE);
+   fd = open(tc->path, O_RDONLY);
+
+   if (buffer == NULL || fd == -1 || pgmoneta_hash_create(tc->algorithm, &ctx))
+   {
+      goto error;
+   }
+
+   while (done < tc->size)
+   {
+      ssize_t n = pread(fd, buffer, MIN((size_t)HASH_BUFFER_SIZE, tc->size - done), tc->offset + (off_t)done);
+
+      if (n < 0 && errno == EINTR)
+      {
+         continue;
+      }
+
+      if (n <= 0 || pgmoneta_hash_update(ctx, buffer, (size_t)n))
+      {
+         goto error;
+      }
+
+      done += (size_t)n;
+   }
+
+   if (pgmoneta_hash_final(ctx, &tc->hash))
+   {
+      goto error;
+   }
+
+   pgmoneta_hash_destroy(ctx);
+   close(fd);
+   free(buffer);
+
+   return;
+
+error:
+   if (tc->common.workers != NULL)
+   {
+      tc->common.workers->outcome = false;
+   }
+
+   free(tc->hash);
+   tc->hash = NULL;
+
+   pgmoneta_hash_destroy(ctx);
+   if (fd != -1)
+   {
+      close(fd);
+   }
+   free(buffer);
+}
+
+int
+pgmoneta_create_file_tree_hash(int algorithm, char* file_path, int number_of_workers, char** root, char** chunks)
+{
+   struct stat st;
+   struct workers* workers = NULL;
+   struct tree_chunk* tc = NULL;
+   struct hash_context* ctx = NULL;
+   char* list = NULL;
+   uint64_t number_of_chunks = 0;
+
+   *root = NULL;
+   *chunks = NULL;
+
+   if (stat(file_path, &st))
+   {
+      goto error;
+   }
+
+   /* An empty file has one empty chunk */
+   number_of_chunks = MAX((uint64_t)1, ((uint64_t)st.st_size + TREE_HASH_CHUNK_SIZE - 1) / TREE_HASH_CHUNK_SIZE);
+
+   tc = (struct tree_chunk*)calloc(number_of_chunks, sizeof(struct tree_chunk));
+   if (tc == NULL)
+   {
+      goto error;
+   }
+
+   if (number_of_workers > 1 && number_of_chunks > 1)
+   {
+      if (pgmoneta_workers_initialize(MIN((uint64_t)number_of_workers, number_of_chunks), &workers))
+      {
+         workers = NULL;
+      }
+   }
+
+   for (uint64_t i = 0; i < number_of_chunks; i++)
+   {
+      tc[i].path = file_path;
+      tc[i].algorithm = algorithm;
+      tc[i].offset = (off_t)(i * TREE_HASH_CHUNK_SIZE);
+      tc[i].size = (size_t)MIN((uint64_t)TREE_HASH_CHUNK_SIZE, (uint64_t)st.st_size - i * TREE_HASH_CHUNK_SIZE);
+      if ((uint64_t)st.st_size == 0)
+      {
+         tc[i].size = 0;
+      }
+      tc[i].common.workers = workers;
+      tc[i].common.size = tc[i].size;
+
+      if (workers != NULL)
+      {
+         if (pgmoneta_workers_add(workers, tree_hash_chunk, (struct worker_common*)&tc[i]))
+         {
+            goto error;
+         }
+      }
+      else
+      {
+         tree_hash_chunk((struct worker_common*)&tc[i]);
+      }
+   }
+
+   if (workers != NULL)
+   {
+      pgmoneta_workers_wait(workers);
+   }
+
+   for (uint64_t i = 0; i < number_of_chunks; i++)
+   {
+      if (tc[i].hash == NULL)
+      {
+         goto error;
+      }
+
+      if (i > 0)
+      {
+         list = pgmoneta_append_char(list, ':');
+      }
+      list = pgmoneta_append(list, tc[i].hash);
+   }
+
+   if (pgmoneta_hash_create(algorithm, &ctx) ||
+       pgmoneta_hash_update(ctx, list, strlen(list)) ||
+       pgmoneta_hash_final(ctx, root))
+   {
+      goto error;
+   }
+
+   *chunks = list;
+
+   pgmoneta_hash_destroy(ctx);
+   pgmoneta_workers_destroy(workers);
+   for (uint64_t i = 0; i < number_of_chunks; i++)
+   {
+      free(tc[i].hash);
+   }
+   free(tc);
+
+   return 0;
+
+error:
+   pgmoneta_hash_destroy(ctx);
+   pgmoneta_workers_destroy(workers);
+   if (tc != NULL)
+   {
+      for (uint64_t i = 0; i < number_of_chunks; i++)
+      {
+         free(tc[i].hash);
+      }
+   }
+   free(tc);
+   free(list);
+   free(*root);
+   *root = NULL;
+
+   return 1;
+}
+
+int
+pgmoneta_hash_create(int algorithm, struct hash_context** context)
+{
+   const EVP_MD* md = NULL;
+   struct hash_context* c = NULL;
+
+   *context = NULL;
+
+   c = (struct hash_context*)malloc(sizeof(struct hash_context));
+   if (c == NULL)
+   {
+      goto error;
+   }
+
+   memset(c, 0, sizeof(struct hash_context));
+
+   c->algorithm = algorithm == HASH_ALGORITHM_DEFAULT ? HASH_ALGORITHM_SHA256 : algorithm;
+
+   switch (c->algorithm)
+   {
+      case HASH_ALGORITHM_CRC32C:
+         break;
+      case HASH_ALGORITHM_SHA224:
+      case HASH_ALGORITHM_SHA256:
+      case HASH_ALGORITHM_SHA384:
+      case HASH_ALGORITHM_SHA512:
+         if (c->algorithm == HASH_ALGORITHM_SHA224)
+         {
+            md = EVP_sha224();
+         }
+         else if (c->algorithm == HASH_ALGORITHM_SHA256)
+         {
+            md = EVP_sha256();
+         }
+         else if (c->algorithm == HASH_ALGORITHM_SHA384)
+         {
+            md = EVP_sha384();
+         }
+         else
+         {
+            md = EVP_sha512();
+         }
+
+         c->md = EVP_MD_CTX_new();
+         if (c->md == NULL)
+         {
+            goto error;
+         }
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+         if (!EVP_DigestInit_ex2(c->md, md, NULL))
+#else
+         if (!EVP_DigestInit_ex(c->md, md, NULL))
+#endif
+         {
+            pgmoneta_log_error("Message digest initialization failed");
+            goto error;
+         }
+         break;
+#ifdef HAVE_XXHASH
+      case HASH_ALGORITHM_XXH3:
+         c->xxh3 = XXH3_createState();
+         if (c->xxh3 == NULL || XXH3_128bits_reset(c->xxh3) == XXH_ERROR)
+         {
+            goto error;
+         }
+         break;
+#endif
+#ifdef HAVE_BLAKE3
+      case HASH_ALGORITHM_BLAKE3:
+         blake3_hasher_init(&c->blake3);
+         break;
+#endif
+      default:
+         pgmoneta_log_error("Unsupported hash algorithm: %d", algorithm);
+         goto error;
+   }
+
+   *context = c;
+
+   return 0;
+
+error:
+
+   pgmoneta_hash_destroy(c);
+
+   return 1;
+}
+
+int
+pgmoneta_hash_update(struct hash_context* context, void* data, size_t size)
+{
+   if (context == NULL || (data == NULL && size > 0))
+   {
+      return 1;
+   }
+
+   if (size == 0)
+   {
+      return 0;
+   }
+
+   switch (context->algorithm)
+   {
+      case HASH_ALGORITHM_CRC32C:
+         return pgmoneta_create_crc32c_buffer(data, size, &context->crc);
+      case HASH_ALGORITHM_SHA224:
+      case HASH_ALGORITHM_SHA256:
+      case HASH_ALGORITHM_SHA384:
+      case HASH_ALGORITHM_SHA512:
+         if (!EVP_DigestUpdate(context->md, data, size))
+         {
+            pgmoneta_log_error("Message digest update failed");
+            return 1;
+         }
+         return 0;
+#ifdef HAVE_XXHASH
+      case HASH_ALGORITHM_XXH3:
+         return XXH3_128bits_update(context->xxh3, data, size) == XXH_ERROR ? 1 : 0;
+#endif
+#ifdef HAVE_BLAKE3
+      case HASH_ALGORITHM_BLAKE3:
+         blake3_hasher_update(&context->blake3, data, size);
+         return 0;
+#endif
+      default:
+         break;
+   }
+
+   return 1;
+}
+
+int
+pgmoneta_hash_final(struct hash_context* context, char** hash)
+{
+   unsigned char md_value[EVP_MAX_MD_SIZE];
+   unsigned int md_len = 0;
+   char* h = NULL;
+
+   *hash = NULL;
+
+   if (context == NULL)
+   {
+      return 1;
+   }
+
+   switch (context->algorithm)
+   {
+      case HASH_ALGORITHM_CRC32C:
+         h = malloc(9);
+         if (h != NULL)
+         {
+            snprintf(h, 9, "%08x", context->crc);
+         }
+         break;
+      case HASH_ALGORITHM_SHA224:
+      case HASH_ALGORITHM_SHA256:
+      case HASH_ALGORITHM_SHA384:
+      case HASH_ALGORITHM_SHA512:
+         if (!EVP_DigestFinal_ex(context->md, md_value, &md_len))
+         {
+            pgmoneta_log_error("Message digest finalization failed");
+            return 1;
+         }
+         h = hash_to_hex(md_value, md_len);
+         break;
+#ifdef HAVE_XXHASH
+      case HASH_ALGORITHM_XXH3:
+      {
+         XXH128_canonical_t canonical;
+
+         XXH128_canonicalFromHash(&canonical, XXH3_128bits_digest(context->xxh3));
+         h = hash_to_hex(canonical.digest, sizeof(canonical.digest));
+         break;
+      }
+#endif
+#ifdef HAVE_BLAKE3
+      case HASH_ALGORITHM_BLAKE3:
+      {
+         uint8_t digest[BLAKE3_OUT_LEN];
+
+         blake3_hasher_finalize(&context->blake3, digest, BLAKE3_OUT_LEN);
+         h = hash_to_hex(digest, BLAKE3_OUT_LEN);
+         break;
+      }
+#endif
+      default:
+         break;
+   }
+
+   if (h == NULL)
+   {
+      return 1;
+   }
+
+   *hash = h;
+
+   return 0;
+}
+
+void
+pgmoneta_hash_destroy(struct hash_context* context)
+{
+   if (context == NULL)
+   {
+      return;
+   }
+
+   if (context->md != NULL)
+   {
+      EVP_MD_CTX_free(context->md);
+   }
+#ifdef HAVE_XXHASH
+   if (context->xxh3 != NULL)
+   {
+      XXH3_freeState(context->xxh3);
+   }
+#endif
+
+   free(context);
+}
+
 void
 pgmoneta_close_ssl(SSL* ssl)
 {
@@ -3335,10 +4041,33 @@ pgmoneta_get_hash_algorithm(char* algorithm)
    {
       return HASH_ALGORITHM_SHA512;
    }
+   else if (!strcasecmp(algorithm, "xxh3"))
+   {
+#ifdef HAVE_XXHASH
+      return HASH_ALGORITHM_XXH3;
+#else
+      pgmoneta_log_warn("xxh3 is not supported by this build, using sha256");
+#endif
+   }
+   else if (!strcasecmp(algorithm, "blake3"))
+   {
+#ifdef HAVE_BLAKE3
+      return HASH_ALGORITHM_BLAKE3;
+#else
+      pgmoneta_log_warn("blake3 is not supported by this build, using sha256");
+#endif
+   }
 
    return HASH_ALGORITHM_SHA256;
 }
 
+bool
+pgmoneta_hash_algorithm_identifies(int algorithm)
+{
+   return algorithm == HASH_ALGORITHM_SHA224 || algorithm == HASH_ALGORITHM_SHA256 ||
+          algorithm == HASH_ALGORITHM_SHA384 || algorithm == HASH_ALGORITHM_SHA512;
+}
+
 int
 pgmoneta_extract_server_parameters(struct deque** server_parameters)
 {
@@ -28,19 +28,51 @@
 
 /* pgmoneta */
 #include <pgmoneta.h>
+#include <deque.h>
 #include <extension.h>
 #include <logging.h>
+#include <message.h>
 #include <network.h>
 #include <security.h>
+#include <server.h>
 #include <utils.h>
 
 /* system */
+#include <errno.h>
 #include <ev.h>
+#include <stdatomic.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#define CONNECTION_IDLE 300
+
+#define SERVER_STANDBY_MAX_LAG (64 * 1024 * 1024)
+
+/** @struct connection
+ * A spare connection to a server. It belongs to the thread that opened it, so the
+ * WAL receivers of a multiplexed process each have their own, and a forked
+ * process leaves the connections of its parent alone
+ */
+struct connection
+{
+   pid_t pid;    /**< The process owning the connection, 0 if none */
+   SSL* ssl;     /**< The SSL structure */
+   int socket;   /**< The socket */
+   time_t since; /**< When the connection became idle */
+};
+
+static _Thread_local struct connection connections[NUMBER_OF_SERVERS];
+static _Thread_local struct deque* parameters[NUMBER_OF_SERVERS];
+static atomic_bool registered = false;
+
+static bool connection_alive(struct connection* c);
+static void connection_close(SSL* ssl, int socket);
+
 static int get_wal_level(SSL* ssl, int socket, int server, bool* replica);
 static int get_wal_size(SSL* ssl, int socket, int server, int* ws);
 static int get_checksums(SSL* ssl, int socket, int server, bool* checksums);
@@ -51,11 +83,118 @@ static int get_summarize_wal(SSL* ssl, int socket, int server, bool* sw);
 static int process_server_parameters(int server, struct deque* server_parameters);
 
 static bool is_valid_response(struct query_response* response);
+static int get_load(int srv, bool* standby, long* active, long* lag);
+
+int
+pgmoneta_server_connect(int srv, SSL** ssl, int* socket)
+{
+   int usr = -1;
+   int auth;
+   struct connection* c;
+   struct common_configuration* config;
+
+   config = (struct common_configuration*)shmem;
+
+   *ssl = NULL;
+   *socket = -1;
+
+   c = &connections[srv];
+
+   if (c->pid == getpid())
+   {
+      if (time(NULL) - c->since < CONNECTION_IDLE && connection_alive(c))
+      {
+         pgmoneta_log_trace("Reusing connection to %s", config->servers[srv].name);
+
+         *ssl = c->ssl;
+         *socket = c->socket;
+
+         memset(c, 0, sizeof(struct connection));
+
+         return AUTH_SUCCESS;
+      }
+
+      connection_close(c->ssl, c->socket);
+   }
+
+   memset(c, 0, sizeof(struct connection));
+
+   for (int i = 0; usr == -1 && i < config->number_of_users; i++)
+   {
+      if (!strcmp(config->servers[srv].username, config->users[i].username))
+      {
+         usr = i;
+      }
+   }
+
+   if (usr == -1)
+   {
+      return AUTH_ERROR;
+   }
+
+   auth = pgmoneta_server_authenticate(srv, "postgres", config->users[usr].username, config->users[usr].password, false, ssl, socket);
+
+   if (auth == AUTH_SUCCESS)
+   {
+      pgmoneta_deque_destroy(parameters[srv]);
+      parameters[srv] = NULL;
+
+      pgmoneta_extract_server_parameters(&parameters[srv]);
+   }
+
+   return auth;
+}
+
+void
+pgmoneta_server_disconnect(int srv, SSL* ssl, int socket)
+{
+   struct connection* c;
+
+   if (socket == -1)
+   {
+      return;
+   }
+
+   c = &connections[srv];
+
+   if (c->pid != getpid())
+   {
+      if (!atomic_exchange(&registered, true))
+      {
+         atexit(pgmoneta_server_close_connections);
+      }
+
+      c->pid = getpid();
+      c->ssl = ssl;
+      c->socket = socket;
+      c->since = time(NULL);
+
+      return;
+   }
+
+   connection_close(ssl, socket);
+}
+
+void
+pgmoneta_server_close_connections(void)
+{
+   for (int i = 0; i < NUMBER_OF_SERVERS; i++)
+   {
+      if (connections[i].pid == getpid())
+      {
+         connection_close(connections[i].ssl, connections[i].socket);
+      }
+
+      memset(&connections[i], 0, sizeof(struct connection));
+
+      pgmoneta_deque_destroy(parameters[i]);
+      parameters[i] = NULL;
+   }
+}
 
 void
 pgmoneta_server_info(int srv)
 {
-   int usr;
    int auth;
    SSL* ssl = NULL;
    int socket = -1;
@@ -74,29 +213,16 @@ pgmoneta_server_info(int srv)
    config->common.servers[srv].valid = false;
    config->common.servers[srv].checksums = false;
 
-   usr = -1;
-   for (int i = 0; usr == -1 && i < config->common.number_of_users; i++)
-   {
-      if (!strcmp(config->common.servers[srv].username, config->common.users[i].username))
-      {
-         usr = i;
-      }
-   }
-
-   if (usr == -1)
-   {
-      goto done;
-   }
-
-   auth = pgmoneta_server_authenticate(srv, "postgres", config->common.users[usr].username, config->common.users[usr].password, false, &ssl, &socket);
+   auth = pgmoneta_server_connect(srv, &ssl, &socket);
 
    if (auth != AUTH_SUCCESS)
    {
-      pgmoneta_log_error("Authentication failed for user %s on %s", config->common.users[usr].username, config->common.servers[srv].name);
+      pgmoneta_log_error("Authentication failed for user %s on %s", config->common.servers[srv].username, config->common.servers[srv].name);
       goto done;
    }
 
-   if (pgmoneta_extract_server_parameters(&server_parameters))
+   server_parameters = parameters[srv];
+   if (server_parameters == NULL)
    {
       pgmoneta_log_error("Unable to extract server parameters for %s", config->common.servers[srv].name);
       goto done;
@@ -209,11 +335,13 @@ pgmoneta_server_info(int srv)
    }
    pgmoneta_log_debug("%s/summarize_wal %d", config->common.servers[srv].name, config->common.servers[srv].summarize_wal);
 
-   pgmoneta_write_terminate(ssl, socket);
+   /* The connection is idle, so the next operation on the server can use it */
+   pgmoneta_server_disconnect(srv, ssl, socket);
+   ssl = NULL;
+   socket = -1;
 
 done:
 
-   pgmoneta_deque_destroy(server_parameters);
    pgmoneta_close_ssl(ssl);
    if (socket != -1)
    {
@@ -706,6 +834,119 @@ error:
    return 1;
 }
 
+int
+pgmoneta_server_backup_source(int srv)
+{
+   int source = srv;
+   bool standby = false;
+   long active = 0;
+   long lag = 0;
+   long least = 0;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (!config->common.servers[srv].backup_standby)
+   {
+      return srv;
+   }
+
+   /* The server is the source when it can't be asked either */
+   if (get_load(srv, &standby, &least, &lag))
+   {
+      least = 0;
+   }
+
+   for (int i = 0; i < config->common.number_of_servers; i++)
+   {
+      if (i == srv || strcmp(config->common.servers[i].follow, config->common.servers[srv].name))
+      {
+         continue;
+      }
+
+      if (get_load(i, &standby, &active, &lag))
+      {
+         pgmoneta_log_debug("Backup source: %s is not available", config->common.servers[i].name);
+         continue;
+      }
+
+      if (!standby || lag > SERVER_STANDBY_MAX_LAG)
+      {
+         pgmoneta_log_debug("Backup source: %s is not a standby within the replay lag (%ld)",
+                            config->common.servers[i].name, lag);
+         continue;
+      }
+
+      /* A standby is preferred over an equally loaded server */
+      if (active <= least)
+      {
+         source = i;
+         least = active;
+      }
+   }
+
+   if (source != srv)
+   {
+      pgmoneta_log_info("Backup source: %s for %s", config->common.servers[source].name, config->common.servers[srv].name);
+   }
+
+   return source;
+}
+
+static int
+get_load(int srv, bool* standby, long* active, long* lag)
+{
+   SSL* ssl = NULL;
+   int socket = -1;
+   struct message* query_msg = NULL;
+   struct query_response* response = NULL;
+
+   *standby = false;
+   *active = 0;
+   *lag = 0;
+
+   if (pgmoneta_server_connect(srv, &ssl, &socket) != AUTH_SUCCESS)
+   {
+      goto error;
+   }
+
+   if (pgmoneta_create_query_message("SELECT pg_is_in_recovery(), "
+                                     "(SELECT count(*) FROM pg_stat_activity WHERE state = 'active' AND backend_type = 'client backend' AND pid <> pg_backend_pid()), "
+                                     "COALESCE(pg_wal_lsn_diff(pg_last_wal_receive_lsn(), pg_last_wal_replay_lsn()), 0)::bigint;",
+                                     &query_msg) != MESSAGE_STATUS_OK)
+   {
+      goto error;
+   }
+
+   if (pgmoneta_query_execute(ssl, socket, query_msg, &response) || !is_valid_response(response) ||
+       response->number_of_columns < 3)
+   {
+      goto error;
+   }
+
+   *standby = !strcmp(response->tuples->data[0], "t");
+   *active = response->tuples->data[1] != NULL ? strtol(response->tuples->data[1], NULL, 10) : 0;
+   *lag = response->tuples->data[2] != NULL ? strtol(response->tuples->data[2], NULL, 10) : 0;
+
+   pgmoneta_free_query_response(response);
+   pgmoneta_free_message(query_msg);
+   pgmoneta_server_disconnect(srv, ssl, socket);
+
+   return 0;
+
+error:
+
+   pgmoneta_free_query_response(response);
+   pgmoneta_free_message(query_msg);
+
+   if (socket != -1)
+   {
+      connection_close(ssl, socket);
+   }
+
+   return 1;
+}
+
 static bool
 is_valid_response(struct query_response* response)
 {
@@ -783,3 +1024,35 @@ process_server_parameters(int server, struct deque* server_parameters)
    pgmoneta_deque_iterator_destroy(iter);
    return status;
 }
+
+static bool
+connection_alive(struct connection* c)
+{
+   char b;
+   ssize_t r;
+
+   /* Anything buffered on an idle connection is an error or the end of it */
+   if (c->ssl != NULL && SSL_pending(c->ssl) > 0)
+   {
+      return false;
+   }
+
+   r = recv(c->socket, &b, 1, MSG_PEEK | MSG_DONTWAIT);
+
+   if (r == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+   {
+      errno = 0;
+      return true;
+   }
+
+   errno = 0;
+   return false;
+}
+
+static void
+connection_close(SSL* ssl, int socket)
+{
+   pgmoneta_write_terminate(ssl, socket);
+   pgmoneta_close_ssl(ssl);
+   pgmoneta_disconnect(socket);
+}
@@ -32,11 +32,13 @@
 #include <logging.h>
 #include <management.h>
 #include <network.h>
+#include <progress.h>
 #include <utils.h>
+#include <walindex.h>
 
 #define NAME "status"
 
-void
+int
 pgmoneta_status(SSL* ssl __attribute__((unused)), int client_fd, bool offline, uint8_t compression, uint8_t encryption, struct json* payload)
 {
    char* d = NULL;
@@ -77,17 +79,10 @@ pgmoneta_status(SSL* ssl __attribute__((unused)), int client_fd, bool offline, u
       goto error;
    }
 
-   d = NULL;
-   d = pgmoneta_append(d, config->base_dir);
-   d = pgmoneta_append(d, "/");
-
-   used_size = pgmoneta_directory_size(d);
+   used_size = pgmoneta_storage_size(-1, STORAGE_SERVER);
 
    pgmoneta_json_put(response, MANAGEMENT_ARGUMENT_USED_SPACE, (uintptr_t)used_size, ValueUInt64);
 
-   free(d);
-   d = NULL;
-
    free_size = pgmoneta_free_space(config->base_dir);
    total_size = pgmoneta_total_space(config->base_dir);
 
@@ -143,15 +138,10 @@ pgmoneta_status(SSL* ssl __attribute__((unused)), int client_fd, bool offline, u
       free(d);
       d = NULL;
 
-      d = pgmoneta_get_server(i);
-
-      server_size = pgmoneta_directory_size(d);
+      server_size = pgmoneta_storage_size(i, STORAGE_SERVER);
 
       pgmoneta_json_put(js, MANAGEMENT_ARGUMENT_SERVER_SIZE, (uintptr_t)server_size, ValueUInt64);
 
-      free(d);
-      d = NULL;
-
       if (strlen(config->common.servers[i].workspace) > 0)
       {
          workspace_size = pgmoneta_directory_size(config->common.servers[i].workspace);
@@ -224,9 +214,7 @@ pgmoneta_status(SSL* ssl __attribute__((unused)), int client_fd, bool offline, u
 
    pgmoneta_disconnect(client_fd);
 
-   pgmoneta_stop_logging();
-
-   exit(0);
+   return 0;
 
 error:
 
@@ -242,12 +230,10 @@ error:
 
    pgmoneta_disconnect(client_fd);
 
-   pgmoneta_stop_logging();
-
-   exit(1);
+   return 1;
 }
 
-void
+int
 pgmoneta_status_details(SSL* ssl __attribute__((unused)), int client_fd, bool offline, uint8_t compression, uint8_t encryption, struct json* payload)
 {
    char* d = NULL;
@@ -271,9 +257,11 @@ pgmoneta_status_details(SSL* ssl __attribute__((unused)), int client_fd, bool of
    uint64_t delta;
    int32_t number_of_backups = 0;
    struct backup** backups = NULL;
+   struct wal_index* index = NULL;
    struct json* response = NULL;
    struct json* servers = NULL;
    struct json* bcks = NULL;
+   struct json* progress = NULL;
    struct main_configuration* config;
 
    pgmoneta_start_logging();
@@ -291,17 +279,10 @@ pgmoneta_status_details(SSL* ssl __attribute__((unused)), int client_fd, bool of
       goto error;
    }
 
-   d = NULL;
-   d = pgmoneta_append(d, config->base_dir);
-   d = pgmoneta_append(d, "/");
-
-   used_size = pgmoneta_directory_size(d);
+   used_size = pgmoneta_storage_size(-1, STORAGE_SERVER);
 
    pgmoneta_json_put(response, MANAGEMENT_ARGUMENT_USED_SPACE, (uintptr_t)used_size, ValueUInt64);
 
-   free(d);
-   d = NULL;
-
    free_size = pgmoneta_free_space(config->base_dir);
    total_size = pgmoneta_total_space(config->base_dir);
 
@@ -321,6 +302,9 @@ pgmoneta_status_details(SSL* ssl __attribute__((unused)), int client_fd, bool of
 
       wal_dir = pgmoneta_get_server_wal(i);
 
+      /* List the WAL once, the sizes of all backups are counted from it */
+      pgmoneta_wal_index_create(wal_dir, true, &index);
+
       pgmoneta_json_create(&js);
 
       retention_days = config->common.servers[i].retention_days;
@@ -352,15 +336,10 @@ pgmoneta_status_details(SSL* ssl __attribute__((unused)), int client_fd, bool of
       pgmoneta_json_put(js, MANAGEMENT_ARGUMENT_RETENTION_MONTHS, (uintptr_t)retention_months, ValueInt32);
       pgmoneta_json_put(js, MANAGEMENT_ARGUMENT_RETENTION_YEARS, (uintptr_t)retention_years, ValueInt32);
 
-      d = pgmoneta_get_server(i);
-
-      server_size = pgmoneta_directory_size(d);
+      server_size = pgmoneta_storage_size(i, STORAGE_SERVER);
 
       pgmoneta_json_put(js, MANAGEMENT_ARGUMENT_SERVER_SIZE, (uintptr_t)server_size, ValueUInt64);
 
-      free(d);
-      d = NULL;
-
       if (strlen(config->common.servers[i].workspace) > 0)
       {
          d = pgmoneta_get_server_workspace(i);
@@ -427,7 +406,7 @@ pgmoneta_status_details(SSL* ssl __attribute__((unused)), int client_fd, bool of
             pgmoneta_json_put(bck, MANAGEMENT_ARGUMENT_COMPRESSION, (uintptr_t)backups[j]->compression, ValueInt32);
             pgmoneta_json_put(bck, MANAGEMENT_ARGUMENT_ENCRYPTION, (uintptr_t)backups[j]->encryption, ValueInt32);
 
-            wal = pgmoneta_number_of_wal_files(wal_dir, &backups[j]->wal[0], NULL);
+            wal = pgmoneta_wal_index_count(index, &backups[j]->wal[0], NULL);
             wal *= config->common.servers[i].wal_size;
 
             pgmoneta_json_put(bck, MANAGEMENT_ARGUMENT_WAL, (uintptr_t)wal, ValueUInt64);
@@ -435,7 +414,7 @@ pgmoneta_status_details(SSL* ssl __attribute__((unused)), int client_fd, bool of
             delta = 0;
             if (j > 0)
             {
-               delta = pgmoneta_number_of_wal_files(wal_dir, &backups[j - 1]->wal[0], &backups[j]->wal[0]);
+               delta = pgmoneta_wal_index_count(index, &backups[j - 1]->wal[0], &backups[j]->wal[0]);
                delta *= config->common.servers[i].wal_size;
             }
 
@@ -447,6 +426,17 @@ pgmoneta_status_details(SSL* ssl __attribute__((unused)), int client_fd, bool of
 
       pgmoneta_json_put(js, MANAGEMENT_ARGUMENT_BACKUPS, (uintptr_t)bcks, ValueJSON);
 
+      if (pgmoneta_progress_json(i, &progress))
+      {
+         goto error;
+      }
+
+      if (progress != NULL)
+      {
+         pgmoneta_json_put(js, MANAGEMENT_ARGUMENT_PROGRESS, (uintptr_t)progress, ValueJSON);
+         progress = NULL;
+      }
+
       pgmoneta_json_append(servers, (uintptr_t)js, ValueJSON);
 
       for (int j = 0; j < number_of_directories; j++)
@@ -463,6 +453,9 @@ pgmoneta_status_details(SSL* ssl __attribute__((unused)), int client_fd, bool of
       free(backups);
       backups = NULL;
 
+      pgmoneta_wal_index_destroy(index);
+      index = NULL;
+
       free(wal_dir);
       wal_dir = NULL;
 
@@ -494,9 +487,7 @@ pgmoneta_status_details(SSL* ssl __attribute__((unused)), int client_fd, bool of
 
    pgmoneta_disconnect(client_fd);
 
-   pgmoneta_stop_logging();
-
-   exit(0);
+   return 0;
 
 error:
 
@@ -512,13 +503,13 @@ error:
    }
    free(array);
 
+   pgmoneta_wal_index_destroy(index);
+
    free(d);
 
    pgmoneta_json_destroy(payload);
 
    pgmoneta_disconnect(client_fd);
 
-   pgmoneta_stop_logging();
-
-   exit(1);
+   return 1;
 }
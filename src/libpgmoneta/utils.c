@@ -29,7 +29,12 @@
 /* pgmoneta */
 #include <pgmoneta.h>
 #include <logging.h>
+#include <progress.h>
+#include <prometheus.h>
 #include <utils.h>
+#include <walcache.h>
+#include <walindex.h>
+#include <walk.h>
 
 /* system */
 #include <dirent.h>
@@ -39,7 +44,9 @@
 #include <fcntl.h>
 #include <inttypes.h>
 #include <libgen.h>
+#include <pthread.h>
 #include <pwd.h>
+#include <sched.h>
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -55,6 +62,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/utsname.h>
+#include <sys/wait.h>
 
 #ifndef EVBACKEND_LINUXAIO
 #define EVBACKEND_LINUXAIO 0x00000040U
@@ -68,13 +76,84 @@
 #include <execinfo.h>
 #endif
 
+#ifdef HAVE_LINUX
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/sysinfo.h>
+#endif
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#define MAX_NUMBER_OF_CPUS 1024
+#define COPY_CHUNK_SIZE (1024 * 1024 * 1024)
+
+#define COPY_BATCH_FILES     64
+#define COPY_BATCH_FILE_SIZE (128 * 1024)
+#define COPY_BATCH_OPS       5
+
+#define COPY_BATCH_READ       0
+#define COPY_BATCH_CLOSE_FROM 1
+#define COPY_BATCH_WRITE      2
+#define COPY_BATCH_SYNC       3
+#define COPY_BATCH_CLOSE_TO   4
+
+/** @struct copy_batch_file
+ * Defines a file of a copy batch
+ */
+struct copy_batch_file
+{
+   char* from;  /**< The from file */
+   char* to;    /**< The to file */
+   size_t size; /**< The size */
+   mode_t mode; /**< The permissions */
+};
+
+/** @struct copy_batch_input
+ * Defines the input for copying a batch of small files
+ */
+struct copy_batch_input
+{
+   struct worker_common common;                    /**< The common base */
+   int number_of_files;                            /**< The number of files */
+   struct copy_batch_file files[COPY_BATCH_FILES]; /**< The files */
+};
+
+/** @struct copy_batch
+ * Defines a batch of the files copied into a directory
+ */
+struct copy_batch
+{
+   struct workers* workers;        /**< The workers, or NULL */
+   bool io_uring;                  /**< Are the small files copied with io_uring */
+   struct copy_batch_input* input; /**< The files not submitted yet, or NULL */
+};
+
+/** @struct wal_restore_input
+ * Defines the input for restoring a compressed or encrypted WAL segment
+ */
+struct wal_restore_input
+{
+   struct worker_common common; /**< The common base */
+   int server;                  /**< The server */
+   char directory[MAX_PATH];    /**< The WAL directory */
+   char source[MAX_PATH];       /**< The archived file */
+   char target[MAX_PATH];       /**< The path of the restored segment */
+};
+
 extern char** environ;
 #ifdef HAVE_LINUX
 static bool env_changed = false;
 static int max_process_title_size = 0;
 #endif
+static atomic_int sync_deferred = 0;
 
 static int string_compare(const void* a, const void* b);
+static unsigned long allocated_size(struct walk_entry* entry);
+static int directory_size_visitor(struct walk_entry* entry, void* data);
+static int biggest_file_visitor(struct walk_entry* entry, void* data);
 
 static bool is_wal_file(char* file);
 
@@ -83,7 +162,29 @@ static char* get_server_basepath(int server);
 static int get_permissions(char* from, int* permissions);
 
 static void do_copy_file(struct worker_common* wc);
+static int copy_batch_submit(struct copy_batch* batch);
+static void copy_batch_fallback(struct copy_batch_input* bi, int index);
+static void copy_batch_free(struct copy_batch_input* bi);
+#ifdef HAVE_LIBURING
+static void do_copy_batch(struct worker_common* wc);
+#endif
+static int copy_wal_file(char* from, char* to, char* source, char* target, struct workers* workers);
+static int restore_wal_file(int server, char* from, char* to, char* source, char* target, struct workers* workers);
+static void do_restore_wal_file(struct worker_common* wc);
+#if !defined(HAVE_LINUX)
+static int sync_tree(char* directory);
+#endif
+static int copy_file_data(int fd_from, int fd_to, int* method);
+#ifdef HAVE_LINUX
+static bool copy_fallback(int error);
+#endif
 static void do_delete_file(struct worker_common* wc);
+static int delete_at(int parent, char* name);
+static int delete_entries(int fd, bool directories);
+static int delete_submit(char* path, struct workers* workers);
+static void do_delete_entries(struct worker_common* wc);
+static unsigned long token_bucket_now(void);
+static void token_bucket_wait(struct token_bucket* tb, unsigned long tokens);
 
 int32_t
 pgmoneta_get_request(struct message* msg)
@@ -1261,6 +1362,251 @@ pgmoneta_append_bool(char* orig, bool b)
    return orig;
 }
 
+void
+pgmoneta_builder_init(struct builder* builder)
+{
+   memset(builder, 0, sizeof(struct builder));
+}
+
+int
+pgmoneta_builder_append(struct builder* builder, char* s)
+{
+   if (s == NULL)
+   {
+      return 0;
+   }
+
+   return pgmoneta_builder_append_length(builder, s, strlen(s));
+}
+
+int
+pgmoneta_builder_append_length(struct builder* builder, char* s, size_t length)
+{
+   size_t needed;
+   size_t capacity;
+   char* n = NULL;
+
+   needed = builder->length + length + 1;
+
+   if (builder->heap == NULL && needed > BUILDER_INLINE_SIZE)
+   {
+      capacity = BUILDER_INLINE_SIZE * 4;
+      while (capacity < needed)
+      {
+         capacity *= 2;
+      }
+
+      n = (char*)malloc(capacity);
+      if (n == NULL)
+      {
+         return 1;
+      }
+
+      memcpy(n, &builder->inline_data[0], builder->length);
+      builder->heap = n;
+      builder->capacity = capacity;
+   }
+   else if (builder->heap != NULL && needed > builder->capacity)
+   {
+      capacity = builder->capacity;
+      while (capacity < needed)
+      {
+         capacity *= 2;
+      }
+
+      n = (char*)realloc(builder->heap, capacity);
+      if (n == NULL)
+      {
+         return 1;
+      }
+
+      builder->heap = n;
+      builder->capacity = capacity;
+   }
+
+   n = builder->heap != NULL ? builder->heap : &builder->inline_data[0];
+
+   memcpy(n + builder->length, s, length);
+   builder->length += length;
+   n[builder->length] = '\0';
+
+   return 0;
+}
+
+int
+pgmoneta_builder_append_char(struct builder* builder, char c)
+{
+   return pgmoneta_builder_append_length(builder, &c, 1);
+}
+
+int
+pgmoneta_builder_append_int(struct builder* builder, int i)
+{
+   char number[12];
+   int length;
+
+   length = snprintf(&number[0], sizeof(number), "%d", i);
+
+   return pgmoneta_builder_append_length(builder, &number[0], length);
+}
+
+int
+pgmoneta_builder_append_ulong(struct builder* builder, unsigned long l)
+{
+   char number[21];
+   int length;
+
+   length = snprintf(&number[0], sizeof(number), "%lu", l);
+
+   return pgmoneta_builder_append_length(builder, &number[0], length);
+}
+
+int
+pgmoneta_builder_append_double(struct builder* builder, double d)
+{
+   return pgmoneta_builder_format(builder, "%lf", d);
+}
+
+int
+pgmoneta_builder_append_double_precision(struct builder* builder, double d, int precision)
+{
+   return pgmoneta_builder_format(builder, "%.*f", precision, d);
+}
+
+int
+pgmoneta_builder_append_bool(struct builder* builder, bool b)
+{
+   return pgmoneta_builder_append_length(builder, b ? "1" : "0", 1);
+}
+
+int
+pgmoneta_builder_format(struct builder* builder, char* format, ...)
+{
+   char buffer[BUILDER_INLINE_SIZE];
+   char* formatted = NULL;
+   int length;
+   int ret;
+   va_list args;
+
+   va_start(args, format);
+   length = vsnprintf(&buffer[0], sizeof(buffer), format, args);
+   va_end(args);
+
+   if (length < 0)
+   {
+      return 1;
+   }
+
+   if ((size_t)length < sizeof(buffer))
+   {
+      return pgmoneta_builder_append_length(builder, &buffer[0], length);
+   }
+
+   /* Longer than the stack buffer, so format it again */
+   formatted = (char*)malloc(length + 1);
+   if (formatted == NULL)
+   {
+      return 1;
+   }
+
+   va_start(args, format);
+   vsnprintf(formatted, length + 1, format, args);
+   va_end(args);
+
+   ret = pgmoneta_builder_append_length(builder, formatted, length);
+
+   free(formatted);
+
+   return ret;
+}
+
+int
+pgmoneta_builder_indent(struct builder* builder, char* tag, int indent)
+{
+   static char spaces[] = "                                                                ";
+
+   while (indent > 0)
+   {
+      int n = MIN(indent, (int)sizeof(spaces) - 1);
+
+      if (pgmoneta_builder_append_length(builder, &spaces[0], n))
+      {
+         return 1;
+      }
+
+      indent -= n;
+   }
+
+   return pgmoneta_builder_append(builder, tag);
+}
+
+char*
+pgmoneta_builder_string(struct builder* builder)
+{
+   if (builder->heap != NULL)
+   {
+      return builder->heap;
+   }
+
+   builder->inline_data[builder->length] = '\0';
+
+   return &builder->inline_data[0];
+}
+
+size_t
+pgmoneta_builder_length(struct builder* builder)
+{
+   return builder->length;
+}
+
+void
+pgmoneta_builder_reset(struct builder* builder)
+{
+   builder->length = 0;
+
+   if (builder->heap != NULL)
+   {
+      builder->heap[0] = '\0';
+   }
+   else
+   {
+      builder->inline_data[0] = '\0';
+   }
+}
+
+char*
+pgmoneta_builder_release(struct builder* builder)
+{
+   char* s = NULL;
+
+   if (builder->heap != NULL)
+   {
+      s = builder->heap;
+   }
+   else
+   {
+      s = (char*)malloc(builder->length + 1);
+      if (s == NULL)
+      {
+         return NULL;
+      }
+
+      memcpy(s, &builder->inline_data[0], builder->length);
+      s[builder->length] = '\0';
+   }
+
+   memset(builder, 0, sizeof(struct builder));
+
+   return s;
+}
+
+void
+pgmoneta_builder_destroy(struct builder* builder)
+{
+   free(builder->heap);
+   memset(builder, 0, sizeof(struct builder));
+}
+
 char*
 pgmoneta_remove_whitespace(char* orig)
 {
@@ -1357,76 +1703,108 @@ unsigned long
 pgmoneta_directory_size(char* directory)
 {
    unsigned long total_size = 0;
-   DIR* dir;
-   struct dirent* entry;
-   char* p;
-   struct stat st;
-   unsigned long l;
 
-   if (!(dir = opendir(directory)))
-   {
-      return total_size;
-   }
+   pgmoneta_walk(directory, WALK_STAT, directory_size_visitor, &total_size);
 
-   while ((entry = readdir(dir)) != NULL)
-   {
-      if (entry->d_type == DT_DIR)
-      {
-         char path[1024];
+   return total_size;
+}
 
-         if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
-         {
-            continue;
-         }
+unsigned long
+pgmoneta_storage_size(int server, int storage)
+{
+   char* d = NULL;
+   unsigned long generation = 0;
+   unsigned long g1;
+   unsigned long g2;
+   unsigned long size = 0;
+   time_t now;
+   struct storage_size* entry = NULL;
+   struct main_configuration* config;
 
-         snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+   config = (struct main_configuration*)shmem;
 
-         total_size += pgmoneta_directory_size(path);
+   if (server == -1)
+   {
+      /* The base directory changes whenever the storage of any server does */
+      for (int i = 0; i < config->common.number_of_servers; i++)
+      {
+         generation += atomic_load(&config->common.servers[i].storage_generation);
       }
-      else if (entry->d_type == DT_REG)
+      entry = &config->used_space;
+   }
+   else
+   {
+      if (storage < 0 || storage >= NUMBER_OF_STORAGE)
       {
-         p = NULL;
-
-         p = pgmoneta_append(p, directory);
-         p = pgmoneta_append(p, "/");
-         p = pgmoneta_append(p, entry->d_name);
-
-         memset(&st, 0, sizeof(struct stat));
+         return 0;
+      }
+      generation = atomic_load(&config->common.servers[server].storage_generation);
+      entry = &config->common.servers[server].storage[storage];
+   }
 
-         stat(p, &st);
+   now = time(NULL);
 
-         l = st.st_size / st.st_blksize;
+   g1 = atomic_load(&entry->generation);
+   size = atomic_load(&entry->size);
+   if (now - (time_t)atomic_load(&entry->time) < STORAGE_CACHE_MAX_AGE)
+   {
+      g2 = atomic_load(&entry->generation);
+      if (g1 == generation + 1 && g2 == g1)
+      {
+         return size;
+      }
+   }
 
-         if (st.st_size % st.st_blksize != 0)
-         {
-            l += 1;
-         }
+   if (server == -1)
+   {
+      d = pgmoneta_append(d, config->base_dir);
+      d = pgmoneta_append(d, "/");
+   }
+   else if (storage == STORAGE_SERVER)
+   {
+      d = pgmoneta_get_server(server);
+   }
+   else if (storage == STORAGE_BACKUP)
+   {
+      d = pgmoneta_get_server_backup(server);
+   }
+   else if (storage == STORAGE_WAL)
+   {
+      d = pgmoneta_get_server_wal(server);
+   }
+   else if (storage == STORAGE_WAL_SHIPPING)
+   {
+      d = pgmoneta_get_server_wal_shipping(server);
+   }
+   else if (storage == STORAGE_WAL_SHIPPING_WAL)
+   {
+      d = pgmoneta_get_server_wal_shipping_wal(server);
+   }
 
-         total_size += (l * st.st_blksize);
+   size = d != NULL ? pgmoneta_directory_size(d) : 0;
 
-         free(p);
-      }
-      else if (entry->d_type == DT_LNK)
-      {
-         p = NULL;
+   /* Readers take the entry only when they see the same generation before and after */
+   atomic_store(&entry->generation, 0);
+   atomic_store(&entry->size, size);
+   atomic_store(&entry->time, (long long)now);
+   atomic_store(&entry->generation, generation + 1);
 
-         p = pgmoneta_append(p, directory);
-         p = pgmoneta_append(p, "/");
-         p = pgmoneta_append(p, entry->d_name);
+   free(d);
 
-         memset(&st, 0, sizeof(struct stat));
+   return size;
+}
 
-         stat(p, &st);
+void
+pgmoneta_storage_changed(int server)
+{
+   struct main_configuration* config;
 
-         total_size += st.st_blksize;
+   config = (struct main_configuration*)shmem;
 
-         free(p);
-      }
+   if (config != NULL && server >= 0 && server < config->common.number_of_servers)
+   {
+      atomic_fetch_add(&config->common.servers[server].storage_generation, 1);
    }
-
-   closedir(dir);
-
-   return total_size;
 }
 
 int
@@ -1528,56 +1906,298 @@ error:
 int
 pgmoneta_delete_directory(char* path)
 {
-   DIR* d = opendir(path);
-   size_t path_len = strlen(path);
-   int r = -1;
-   int r2 = -1;
-   char* buf;
-   size_t len;
-   struct dirent* entry;
+   return delete_at(AT_FDCWD, path);
+}
 
-   if (d)
+int
+pgmoneta_delete_directory_parallel(char* path, struct workers* workers)
+{
+   if (workers == NULL)
    {
-      r = 0;
-      while (!r && (entry = readdir(d)))
-      {
-         if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
-         {
-            continue;
-         }
-
-         len = path_len + strlen(entry->d_name) + 2;
-         buf = malloc(len);
+      return pgmoneta_delete_directory(path);
+   }
 
-         if (buf)
-         {
-            struct stat statbuf;
+   /* The files are unlinked by the workers, and the empty directories afterwards */
+   if (delete_submit(path, workers))
+   {
+      goto error;
+   }
 
-            snprintf(buf, len, "%s/%s", path, entry->d_name);
-            if (!lstat(buf, &statbuf))
-            {
-               if (S_ISDIR(statbuf.st_mode))
-               {
-                  r2 = pgmoneta_delete_directory(buf);
-               }
-               else
-               {
-                  r2 = unlink(buf);
-               }
-            }
-            free(buf);
+   pgmoneta_workers_wait(workers);
+
+   return pgmoneta_delete_directory(path);
+
+error:
+
+   pgmoneta_workers_wait(workers);
+
+   return 1;
+}
+
+int
+pgmoneta_trash_directory(char* path, char* trash)
+{
+   char* name = NULL;
+   char* target = NULL;
+   pid_t pid;
+
+   if (pgmoneta_mkdir(trash))
+   {
+      goto fallback;
+   }
+
+   name = pgmoneta_append(name, path);
+   while (strlen(name) > 1 && pgmoneta_ends_with(name, "/"))
+   {
+      name[strlen(name) - 1] = '\0';
+   }
+
+   target = pgmoneta_append(target, trash);
+   if (!pgmoneta_ends_with(target, "/"))
+   {
+      target = pgmoneta_append(target, "/");
+   }
+   target = pgmoneta_append(target, basename(name));
+
+   free(name);
+   name = NULL;
+
+   /* The trash is on the same file system, so the rename is instant */
+   if (rename(path, target))
+   {
+      pgmoneta_log_debug("pgmoneta_trash_directory: %s (%s)", path, strerror(errno));
+      errno = 0;
+      goto fallback;
+   }
+
+   free(target);
+   target = NULL;
+
+   /* The grandchild is adopted by init, so nobody has to wait for it */
+   pid = fork();
+   if (pid == 0)
+   {
+      if (fork() == 0)
+      {
+         int fd = open(trash, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+
+         if (fd != -1)
+         {
+            delete_entries(fd, true);
+            close(fd);
+         }
+
+         _exit(0);
+      }
+
+      _exit(0);
+   }
+   else if (pid > 0)
+   {
+      waitpid(pid, NULL, 0);
+   }
+
+   return 0;
+
+fallback:
+
+   free(name);
+   free(target);
+
+   return pgmoneta_delete_directory(path);
+}
+
+/**
+ * Delete an entry relative to a directory file descriptor, so the
+ * path is only resolved once no matter how deep the tree is
+ * @param parent The file descriptor of the parent, or AT_FDCWD
+ * @param name The name of the entry
+ * @return 0 upon success, otherwise 1
+ */
+static int
+delete_at(int parent, char* name)
+{
+   int fd = -1;
+   int ret = 0;
+
+   fd = openat(parent, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+   if (fd == -1)
+   {
+      if (errno == ENOTDIR || errno == ELOOP)
+      {
+         errno = 0;
+         return unlinkat(parent, name, 0) && errno != ENOENT;
+      }
+
+      ret = errno != ENOENT;
+      errno = 0;
+
+      return ret;
+   }
+
+   ret = delete_entries(fd, true);
+   close(fd);
+
+   if (!ret && unlinkat(parent, name, AT_REMOVEDIR) && errno != ENOENT)
+   {
+      ret = 1;
+   }
+   errno = 0;
+
+   return ret;
+}
+
+/**
+ * Delete the entries of a directory
+ * @param fd The file descriptor of the directory, which is kept open
+ * @param directories Delete the directories too
+ * @return 0 upon success, otherwise 1
+ */
+static int
+delete_entries(int fd, bool directories)
+{
+   int dfd = -1;
+   int ret = 0;
+   DIR* d = NULL;
+   struct dirent* entry;
+
+   /* closedir() closes the descriptor, so the walk gets its own */
+   dfd = dup(fd);
+   if (dfd == -1)
+   {
+      return 1;
+   }
+
+   d = fdopendir(dfd);
+   if (d == NULL)
+   {
+      close(dfd);
+      return 1;
+   }
+
+   while ((entry = readdir(d)) != NULL)
+   {
+      bool directory = false;
+
+      if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+      {
+         continue;
+      }
+
+      if (entry->d_type == DT_DIR)
+      {
+         directory = true;
+      }
+      else if (entry->d_type == DT_UNKNOWN)
+      {
+         struct stat statbuf;
+
+         directory = !fstatat(fd, entry->d_name, &statbuf, AT_SYMLINK_NOFOLLOW) && S_ISDIR(statbuf.st_mode);
+      }
+
+      if (directory)
+      {
+         if (directories && delete_at(fd, entry->d_name))
+         {
+            ret = 1;
          }
-         r = r2;
       }
+      else if (unlinkat(fd, entry->d_name, 0) && errno != ENOENT)
+      {
+         ret = 1;
+      }
+      errno = 0;
+   }
+
+   closedir(d);
+
+   return ret;
+}
+
+static int
+delete_submit(char* path, struct workers* workers)
+{
+   DIR* d = NULL;
+   struct dirent* entry;
+   struct worker_input* wi = NULL;
+
+   if (pgmoneta_create_worker_input(NULL, path, NULL, 0, workers, &wi))
+   {
+      goto error;
+   }
+
+   if (workers->outcome)
+   {
+      pgmoneta_workers_add(workers, do_delete_entries, (struct worker_common*)wi);
+   }
+   else
+   {
+      free(wi);
+   }
+
+   d = opendir(path);
+   if (d == NULL)
+   {
+      return 0;
+   }
+
+   while ((entry = readdir(d)) != NULL)
+   {
+      char* sub = NULL;
+
+      if (entry->d_type != DT_DIR || !strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+      {
+         continue;
+      }
+
+      sub = pgmoneta_append(sub, path);
+      if (!pgmoneta_ends_with(sub, "/"))
+      {
+         sub = pgmoneta_append(sub, "/");
+      }
+      sub = pgmoneta_append(sub, entry->d_name);
+
+      if (delete_submit(sub, workers))
+      {
+         free(sub);
+         goto error;
+      }
+
+      free(sub);
+   }
+
+   closedir(d);
+
+   return 0;
+
+error:
+
+   if (d != NULL)
+   {
       closedir(d);
    }
 
-   if (!r)
+   return 1;
+}
+
+static void
+do_delete_entries(struct worker_common* wc)
+{
+   struct worker_input* wi = (struct worker_input*)wc;
+   int fd = -1;
+
+   fd = open(wi->from, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+   if (fd != -1)
    {
-      r = rmdir(path);
+      if (delete_entries(fd, false))
+      {
+         pgmoneta_log_warn("pgmoneta_delete_directory_parallel: %s", wi->from);
+      }
+
+      close(fd);
    }
 
-   return r;
+   free(wi);
 }
 
 int
@@ -1833,11 +2453,18 @@ pgmoneta_copy_directory(char* from, char* to, char** restore_last_files_names, s
    char* to_buffer;
    struct dirent* entry;
    struct stat statbuf;
+   struct copy_batch* batch = NULL;
 
    pgmoneta_mkdir(to);
 
    if (d)
    {
+      if (pgmoneta_copy_batch_create(workers, &batch))
+      {
+         closedir(d);
+         goto error;
+      }
+
       while ((entry = readdir(d)))
       {
          if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
@@ -1873,12 +2500,12 @@ pgmoneta_copy_directory(char* from, char* to, char** restore_last_files_names, s
                   }
                   if (!file_is_excluded)
                   {
-                     pgmoneta_copy_file(from_buffer, to_buffer, workers);
+                     pgmoneta_copy_batch_add(batch, from_buffer, to_buffer, statbuf.st_size, statbuf.st_mode);
                   }
                }
                else
                {
-                  pgmoneta_copy_file(from_buffer, to_buffer, workers);
+                  pgmoneta_copy_batch_add(batch, from_buffer, to_buffer, statbuf.st_size, statbuf.st_mode);
                }
             }
          }
@@ -1887,6 +2514,8 @@ pgmoneta_copy_directory(char* from, char* to, char** restore_last_files_names, s
          free(to_buffer);
       }
       closedir(d);
+
+      pgmoneta_copy_batch_destroy(batch);
    }
    else
    {
@@ -1997,9 +2626,9 @@ do_copy_file(struct worker_common* wc)
    struct worker_input* fi = (struct worker_input*)wc;
    int fd_from = -1;
    int fd_to = -1;
-   char buffer[8192];
-   ssize_t nread = -1;
+   int method = COPY_METHOD_READ_WRITE;
    int permissions = -1;
+   size_t size;
    char* dn = NULL;
    char* to = NULL;
 
@@ -2034,39 +2663,27 @@ do_copy_file(struct worker_common* wc)
       goto error;
    }
 
-   while ((nread = read(fd_from, buffer, sizeof(buffer))) > 0)
+   if (copy_file_data(fd_from, fd_to, &method))
    {
-      char* out = &buffer[0];
-      ssize_t nwritten;
-
-      do
-      {
-         nwritten = write(fd_to, out, nread);
-
-         if (nwritten >= 0)
-         {
-            nread -= nwritten;
-            out += nwritten;
-         }
-         else if (errno != EINTR)
-         {
-            goto error;
-         }
-      }
-      while (nread > 0);
+      pgmoneta_log_error("Unable to copy file: %s", fi->from);
+      goto error;
    }
 
-   if (nread == 0)
+   if (atomic_load(&sync_deferred) == 0)
    {
       fsync(fd_to);
+   }
 
-      if (close(fd_to) < 0)
-      {
-         fd_to = -1;
-         goto error;
-      }
-      close(fd_from);
+   if (close(fd_to) < 0)
+   {
+      fd_to = -1;
+      goto error;
    }
+   close(fd_from);
+
+   size = pgmoneta_get_file_size(to);
+   pgmoneta_prometheus_copy(method, size);
+   pgmoneta_progress_add(size, 1);
 
 #ifdef DEBUG
    pgmoneta_log_trace("FILETRACKER | Copy | %s | %s |", fi->from, fi->to);
@@ -2111,70 +2728,640 @@ error:
 }
 
 int
-pgmoneta_move_file(char* from, char* to)
+pgmoneta_copy_batch_create(struct workers* workers, struct copy_batch** batch)
 {
-   int ret;
+   struct copy_batch* b = NULL;
+#ifdef HAVE_LIBURING
+   struct main_configuration* config;
 
-   ret = rename(from, to);
-   if (ret != 0)
+   config = (struct main_configuration*)shmem;
+#endif
+
+   *batch = NULL;
+
+   b = (struct copy_batch*)malloc(sizeof(struct copy_batch));
+   if (b == NULL)
    {
-      pgmoneta_log_warn("pgmoneta_move_file: %s -> %s (%s)", from, to, strerror(errno));
-      errno = 0;
-      ret = 1;
+      goto error;
    }
 
-   return ret;
+   memset(b, 0, sizeof(struct copy_batch));
+   b->workers = workers;
+#ifdef HAVE_LIBURING
+   b->io_uring = config != NULL && config->restore_io_uring;
+#endif
+
+   *batch = b;
+
+   return 0;
+
+error:
+
+   return 1;
 }
 
 int
-pgmoneta_strip_extension(char* s, char** name)
+pgmoneta_copy_batch_add(struct copy_batch* batch, char* from, char* to, size_t size, mode_t mode)
 {
-   size_t size;
-   char* ext = NULL;
-   char* r = NULL;
+   char* from_copy = NULL;
+   char* to_copy = NULL;
+   struct copy_batch_file* f = NULL;
 
-   *name = NULL;
+   if (!batch->io_uring || size > COPY_BATCH_FILE_SIZE)
+   {
+      return pgmoneta_copy_file(from, to, batch->workers);
+   }
 
-   ext = strrchr(s, '.');
-   if (ext != NULL)
+   if (batch->input == NULL)
    {
-      size = ext - s + 1;
-      r = (char*)malloc(size);
-      if (r == NULL)
+      batch->input = (struct copy_batch_input*)malloc(sizeof(struct copy_batch_input));
+      if (batch->input == NULL)
       {
          goto error;
       }
 
-      memset(r, 0, size);
-      memcpy(r, s, size - 1);
+      memset(batch->input, 0, sizeof(struct copy_batch_input));
+      batch->input->common.workers = batch->workers;
    }
-   else
+
+   from_copy = strdup(from);
+   to_copy = strdup(to);
+
+   if (from_copy == NULL || to_copy == NULL)
    {
-      r = pgmoneta_append(r, s);
-      if (r == NULL)
-      {
-         goto error;
-      }
+      goto error;
    }
 
-   *name = r;
+   f = &batch->input->files[batch->input->number_of_files++];
+   f->from = from_copy;
+   f->to = to_copy;
+   f->size = size;
+   f->mode = mode & (S_IRWXU | S_IRWXG | S_IRWXO);
+
+   batch->input->common.size += size;
+
+   if (batch->input->number_of_files == COPY_BATCH_FILES)
+   {
+      return copy_batch_submit(batch);
+   }
 
    return 0;
 
 error:
 
+   free(from_copy);
+   free(to_copy);
+
    return 1;
 }
 
-char*
-pgmoneta_translate_file_size(uint64_t size)
+int
+pgmoneta_copy_batch_destroy(struct copy_batch* batch)
 {
-   char* translated_size = NULL;
-   double sz = (double)size;
-   char* units[] = {"B", "kB", "MB", "GB", "TB", "PB"};
-   int i = 0;
+   int ret;
 
-   while (sz >= 1024 && i < 6)
+   if (batch == NULL)
+   {
+      return 0;
+   }
+
+   ret = copy_batch_submit(batch);
+
+   free(batch);
+
+   return ret;
+}
+
+static int
+copy_batch_submit(struct copy_batch* batch)
+{
+   struct copy_batch_input* bi = batch->input;
+
+   batch->input = NULL;
+
+   if (bi == NULL)
+   {
+      return 0;
+   }
+
+#ifdef HAVE_LIBURING
+   if (batch->workers != NULL)
+   {
+      if (batch->workers->outcome)
+      {
+         pgmoneta_workers_add(batch->workers, do_copy_batch, (struct worker_common*)bi);
+      }
+      else
+      {
+         copy_batch_free(bi);
+      }
+   }
+   else
+   {
+      do_copy_batch((struct worker_common*)bi);
+   }
+#else
+   for (int i = 0; i < bi->number_of_files; i++)
+   {
+      copy_batch_fallback(bi, i);
+   }
+   copy_batch_free(bi);
+#endif
+
+   return 0;
+}
+
+#ifdef HAVE_LIBURING
+static void
+do_copy_batch(struct worker_common* wc)
+{
+   struct copy_batch_input* bi = (struct copy_batch_input*)wc;
+   struct io_uring ring;
+   struct io_uring_sqe* sqe = NULL;
+   struct io_uring_cqe* cqe = NULL;
+   bool ring_created = false;
+   bool sync;
+   bool done[COPY_BATCH_FILES];
+   int fd_from[COPY_BATCH_FILES];
+   int fd_to[COPY_BATCH_FILES];
+   int res[COPY_BATCH_FILES][COPY_BATCH_OPS];
+   int count = 0;
+   size_t offset = 0;
+   uintptr_t data;
+   char* buffer = NULL;
+
+   for (int i = 0; i < COPY_BATCH_FILES; i++)
+   {
+      done[i] = false;
+      fd_from[i] = -1;
+      fd_to[i] = -1;
+   }
+
+   sync = atomic_load(&sync_deferred) == 0;
+
+   buffer = (char*)malloc(bi->common.size > 0 ? bi->common.size : 1);
+   if (buffer == NULL)
+   {
+      goto fallback;
+   }
+
+   if (io_uring_queue_init(COPY_BATCH_FILES * COPY_BATCH_OPS, &ring, 0) < 0)
+   {
+      pgmoneta_log_debug("io_uring is not available, copying the files one by one");
+      goto fallback;
+   }
+   ring_created = true;
+
+   /* Open all the files with one submission */
+   for (int i = 0; i < bi->number_of_files; i++)
+   {
+      sqe = io_uring_get_sqe(&ring);
+      io_uring_prep_openat(sqe, AT_FDCWD, bi->files[i].from, O_RDONLY, 0);
+      io_uring_sqe_set_data(sqe, (void*)(uintptr_t)(i * 2));
+
+      sqe = io_uring_get_sqe(&ring);
+      io_uring_prep_openat(sqe, AT_FDCWD, bi->files[i].to, O_WRONLY | O_CREAT | O_TRUNC, bi->files[i].mode);
+      io_uring_sqe_set_data(sqe, (void*)(uintptr_t)(i * 2 + 1));
+   }
+
+   count = bi->number_of_files * 2;
+
+   if (io_uring_submit_and_wait(&ring, count) < 0)
+   {
+      goto fallback;
+   }
+
+   for (int i = 0; i < count; i++)
+   {
+      if (io_uring_wait_cqe(&ring, &cqe) < 0)
+      {
+         goto fallback;
+      }
+
+      data = (uintptr_t)io_uring_cqe_get_data(cqe);
+      if (data % 2 == 0)
+      {
+         fd_from[data / 2] = cqe->res;
+      }
+      else
+      {
+         fd_to[data / 2] = cqe->res;
+      }
+
+      io_uring_cqe_seen(&ring, cqe);
+   }
+
+   /* Each file is a chain of read, close, write, sync and close, a short read or a
+    * failure cancels the rest of its chain. All the chains are one submission */
+   count = 0;
+   for (int i = 0; i < bi->number_of_files; i++)
+   {
+      char* data_buffer = buffer + offset;
+
+      if (fd_from[i] < 0 || fd_to[i] < 0)
+      {
+         continue;
+      }
+
+      offset += bi->files[i].size;
+
+      for (int j = 0; j < COPY_BATCH_OPS; j++)
+      {
+         res[i][j] = -ECANCELED;
+      }
+
+      sqe = io_uring_get_sqe(&ring);
+      io_uring_prep_read(sqe, fd_from[i], data_buffer, bi->files[i].size, 0);
+      io_uring_sqe_set_flags(sqe, IOSQE_IO_LINK);
+      io_uring_sqe_set_data(sqe, (void*)(uintptr_t)(i * COPY_BATCH_OPS + COPY_BATCH_READ));
+
+      sqe = io_uring_get_sqe(&ring);
+      io_uring_prep_close(sqe, fd_from[i]);
+      io_uring_sqe_set_flags(sqe, IOSQE_IO_LINK);
+      io_uring_sqe_set_data(sqe, (void*)(uintptr_t)(i * COPY_BATCH_OPS + COPY_BATCH_CLOSE_FROM));
+
+      sqe = io_uring_get_sqe(&ring);
+      io_uring_prep_write(sqe, fd_to[i], data_buffer, bi->files[i].size, 0);
+      io_uring_sqe_set_flags(sqe, IOSQE_IO_LINK);
+      io_uring_sqe_set_data(sqe, (void*)(uintptr_t)(i * COPY_BATCH_OPS + COPY_BATCH_WRITE));
+
+      if (sync)
+      {
+         sqe = io_uring_get_sqe(&ring);
+         io_uring_prep_fsync(sqe, fd_to[i], 0);
+         io_uring_sqe_set_flags(sqe, IOSQE_IO_LINK);
+         io_uring_sqe_set_data(sqe, (void*)(uintptr_t)(i * COPY_BATCH_OPS + COPY_BATCH_SYNC));
+         count++;
+      }
+
+      sqe = io_uring_get_sqe(&ring);
+      io_uring_prep_close(sqe, fd_to[i]);
+      io_uring_sqe_set_data(sqe, (void*)(uintptr_t)(i * COPY_BATCH_OPS + COPY_BATCH_CLOSE_TO));
+
+      count += COPY_BATCH_OPS - 1;
+   }
+
+   if (count > 0 && io_uring_submit_and_wait(&ring, count) < 0)
+   {
+      goto fallback;
+   }
+
+   for (int i = 0; i < count; i++)
+   {
+      if (io_uring_wait_cqe(&ring, &cqe) < 0)
+      {
+         /* The closes may still run, so the descriptors are left alone */
+         for (int j = 0; j < bi->number_of_files; j++)
+         {
+            fd_from[j] = -1;
+            fd_to[j] = -1;
+         }
+         goto fallback;
+      }
+
+      data = (uintptr_t)io_uring_cqe_get_data(cqe);
+      res[data / COPY_BATCH_OPS][data % COPY_BATCH_OPS] = cqe->res;
+
+      io_uring_cqe_seen(&ring, cqe);
+   }
+
+   for (int i = 0; i < bi->number_of_files; i++)
+   {
+      if (fd_from[i] < 0 || fd_to[i] < 0)
+      {
+         continue;
+      }
+
+      if (res[i][COPY_BATCH_CLOSE_FROM] != -ECANCELED)
+      {
+         fd_from[i] = -1;
+      }
+      if (res[i][COPY_BATCH_CLOSE_TO] != -ECANCELED)
+      {
+         fd_to[i] = -1;
+      }
+
+      done[i] = res[i][COPY_BATCH_READ] >= 0 && (size_t)res[i][COPY_BATCH_READ] == bi->files[i].size &&
+                res[i][COPY_BATCH_WRITE] >= 0 && (size_t)res[i][COPY_BATCH_WRITE] == bi->files[i].size &&
+                (!sync || res[i][COPY_BATCH_SYNC] == 0) && res[i][COPY_BATCH_CLOSE_TO] == 0;
+
+      if (done[i])
+      {
+         pgmoneta_prometheus_copy(COPY_METHOD_IO_URING, bi->files[i].size);
+         pgmoneta_progress_add(bi->files[i].size, 1);
+
+#ifdef DEBUG
+         pgmoneta_log_trace("FILETRACKER | Copy | %s | %s |", bi->files[i].from, bi->files[i].to);
+#endif
+      }
+   }
+
+fallback:
+
+   /* The files that failed are copied again one by one, which reports the error */
+   for (int i = 0; i < bi->number_of_files; i++)
+   {
+      if (!done[i])
+      {
+         if (fd_from[i] >= 0)
+         {
+            close(fd_from[i]);
+         }
+         if (fd_to[i] >= 0)
+         {
+            close(fd_to[i]);
+         }
+
+         copy_batch_fallback(bi, i);
+      }
+   }
+
+   if (ring_created)
+   {
+      io_uring_queue_exit(&ring);
+   }
+
+   free(buffer);
+   copy_batch_free(bi);
+}
+#endif
+
+static void
+copy_batch_fallback(struct copy_batch_input* bi, int index)
+{
+   struct worker_input* fi = NULL;
+
+   if (pgmoneta_create_worker_input(NULL, bi->files[index].from, bi->files[index].to, 0, bi->common.workers, &fi))
+   {
+      if (bi->common.workers != NULL)
+      {
+         bi->common.workers->outcome = false;
+      }
+      return;
+   }
+
+   do_copy_file((struct worker_common*)fi);
+}
+
+static void
+copy_batch_free(struct copy_batch_input* bi)
+{
+   for (int i = 0; i < bi->number_of_files; i++)
+   {
+      free(bi->files[i].from);
+      free(bi->files[i].to);
+   }
+
+   free(bi);
+}
+
+static int
+copy_file_data(int fd_from, int fd_to, int* method)
+{
+   char buffer[8192];
+   ssize_t nread = -1;
+#ifdef HAVE_LINUX
+   bool started = false;
+
+   // a reflink shares the extents of the file, so no data is copied at all
+   if (ioctl(fd_to, FICLONE, fd_from) == 0)
+   {
+      *method = COPY_METHOD_CLONE;
+      return 0;
+   }
+
+   // the kernel copies the data, it can fail before anything is copied
+   // when the files are on different file systems
+   *method = COPY_METHOD_COPY_FILE_RANGE;
+   while ((nread = copy_file_range(fd_from, NULL, fd_to, NULL, COPY_CHUNK_SIZE, 0)) != 0)
+   {
+      if (nread > 0)
+      {
+         started = true;
+      }
+      else if (errno == EINTR)
+      {
+         continue;
+      }
+      else if (!started && copy_fallback(errno))
+      {
+         break;
+      }
+      else
+      {
+         return 1;
+      }
+   }
+
+   if (nread == 0)
+   {
+      return 0;
+   }
+
+   *method = COPY_METHOD_SENDFILE;
+   while ((nread = sendfile(fd_to, fd_from, NULL, COPY_CHUNK_SIZE)) != 0)
+   {
+      if (nread > 0)
+      {
+         started = true;
+      }
+      else if (errno == EINTR)
+      {
+         continue;
+      }
+      else if (!started && copy_fallback(errno))
+      {
+         break;
+      }
+      else
+      {
+         return 1;
+      }
+   }
+
+   if (nread == 0)
+   {
+      return 0;
+   }
+#endif
+
+   *method = COPY_METHOD_READ_WRITE;
+   while ((nread = read(fd_from, buffer, sizeof(buffer))) != 0)
+   {
+      char* out = &buffer[0];
+      ssize_t nwritten;
+
+      if (nread < 0)
+      {
+         if (errno == EINTR)
+         {
+            continue;
+         }
+         return 1;
+      }
+
+      do
+      {
+         nwritten = write(fd_to, out, nread);
+
+         if (nwritten >= 0)
+         {
+            nread -= nwritten;
+            out += nwritten;
+         }
+         else if (errno != EINTR)
+         {
+            return 1;
+         }
+      }
+      while (nread > 0);
+   }
+
+   return 0;
+}
+
+#ifdef HAVE_LINUX
+static bool
+copy_fallback(int error)
+{
+   return error == ENOSYS || error == EXDEV || error == EINVAL || error == EOPNOTSUPP || error == EBADF;
+}
+#endif
+
+int
+pgmoneta_link_or_copy_file(char* from, char* to)
+{
+   size_t size;
+   char* copy = NULL;
+   char* dn = NULL;
+
+   copy = strdup(to);
+   if (copy == NULL)
+   {
+      goto error;
+   }
+   dn = dirname(copy);
+
+   if (pgmoneta_mkdir(dn))
+   {
+      pgmoneta_log_error("Could not create directory: %s", dn);
+      goto error;
+   }
+
+   if (pgmoneta_exists(to))
+   {
+      unlink(to);
+   }
+
+   // a hardlink needs the same file system, and a file system may limit the
+   // number of links of a file, so copy the data when that isn't possible
+   if (link(from, to) == 0)
+   {
+      size = pgmoneta_get_file_size(to);
+      pgmoneta_prometheus_copy(COPY_METHOD_HARDLINK, size);
+      pgmoneta_progress_add(size, 1);
+   }
+   else
+   {
+      if (errno != EXDEV && errno != EMLINK && errno != EPERM && errno != ENOTSUP)
+      {
+         pgmoneta_log_warn("pgmoneta_link_or_copy_file: %s -> %s (%s)", from, to, strerror(errno));
+      }
+      errno = 0;
+
+      if (pgmoneta_copy_file(from, to, NULL))
+      {
+         goto error;
+      }
+   }
+
+   free(copy);
+
+   return 0;
+
+error:
+
+   free(copy);
+
+   return 1;
+}
+
+int
+pgmoneta_move_file(char* from, char* to)
+{
+   int ret;
+
+   ret = rename(from, to);
+   if (ret != 0 && errno == EXDEV)
+   {
+      // rename can't cross file systems, so copy the file and remove the original
+      errno = 0;
+      ret = pgmoneta_copy_file(from, to, NULL);
+      if (ret == 0)
+      {
+         ret = unlink(from);
+      }
+   }
+
+   if (ret != 0)
+   {
+      pgmoneta_log_warn("pgmoneta_move_file: %s -> %s (%s)", from, to, strerror(errno));
+      errno = 0;
+      ret = 1;
+   }
+
+   return ret;
+}
+
+int
+pgmoneta_strip_extension(char* s, char** name)
+{
+   size_t size;
+   char* ext = NULL;
+   char* r = NULL;
+
+   *name = NULL;
+
+   ext = strrchr(s, '.');
+   if (ext != NULL)
+   {
+      size = ext - s + 1;
+      r = (char*)malloc(size);
+      if (r == NULL)
+      {
+         goto error;
+      }
+
+      memset(r, 0, size);
+      memcpy(r, s, size - 1);
+   }
+   else
+   {
+      r = pgmoneta_append(r, s);
+      if (r == NULL)
+      {
+         goto error;
+      }
+   }
+
+   *name = r;
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+char*
+pgmoneta_translate_file_size(uint64_t size)
+{
+   char* translated_size = NULL;
+   double sz = (double)size;
+   char* units[] = {"B", "kB", "MB", "GB", "TB", "PB"};
+   int i = 0;
+
+   while (sz >= 1024 && i < 6)
    {
       sz /= 1024.0;
       i++;
@@ -2183,57 +3370,216 @@ pgmoneta_translate_file_size(uint64_t size)
    translated_size = pgmoneta_append_double_precision(translated_size, sz, 2);
    translated_size = pgmoneta_append(translated_size, units[i]);
 
-   return translated_size;
+   return translated_size;
+}
+
+bool
+pgmoneta_exists(char* f)
+{
+   if (f != NULL)
+   {
+      if (access(f, F_OK) == 0)
+      {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+bool
+pgmoneta_is_directory(char* directory)
+{
+   struct stat statbuf;
+
+   memset(&statbuf, 0, sizeof(struct stat));
+
+   if (!lstat(directory, &statbuf))
+   {
+      if (S_ISDIR(statbuf.st_mode))
+      {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+bool
+pgmoneta_is_file(char* file)
+{
+   struct stat statbuf;
+
+   memset(&statbuf, 0, sizeof(struct stat));
+
+   if (!lstat(file, &statbuf))
+   {
+      if (S_ISREG(statbuf.st_mode))
+      {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+void
+pgmoneta_sync_defer(bool defer)
+{
+   /* Counted, so the workflows running on the threads of one process don't undo each other */
+   if (defer)
+   {
+      atomic_fetch_add(&sync_deferred, 1);
+   }
+   else
+   {
+      atomic_fetch_sub(&sync_deferred, 1);
+   }
+}
+
+int
+pgmoneta_sync_directory(char* directory)
+{
+#if defined(HAVE_LINUX)
+   int fd = -1;
+
+   fd = open(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+   if (fd == -1)
+   {
+      goto error;
+   }
+
+   if (syncfs(fd))
+   {
+      goto error;
+   }
+
+   close(fd);
+
+   return 0;
+
+error:
+
+   pgmoneta_log_error("Could not sync %s: %s", directory, strerror(errno));
+
+   if (fd != -1)
+   {
+      close(fd);
+   }
+
+   errno = 0;
+
+   return 1;
+#else
+   return sync_tree(directory);
+#endif
 }
 
-bool
-pgmoneta_exists(char* f)
+#if !defined(HAVE_LINUX)
+static int
+sync_tree(char* directory)
 {
-   if (f != NULL)
+   DIR* dir = NULL;
+   struct dirent* entry;
+   char path[MAX_PATH];
+   int fd = -1;
+
+   dir = opendir(directory);
+   if (dir == NULL)
    {
-      if (access(f, F_OK) == 0)
+      goto error;
+   }
+
+   while ((entry = readdir(dir)) != NULL)
+   {
+      if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
       {
-         return true;
+         continue;
+      }
+
+      snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+
+      if (entry->d_type == DT_DIR)
+      {
+         if (sync_tree(path))
+         {
+            goto error;
+         }
+      }
+      else if (entry->d_type == DT_REG)
+      {
+         fd = open(path, O_RDONLY | O_CLOEXEC);
+         if (fd == -1 || fsync(fd))
+         {
+            goto error;
+         }
+
+         close(fd);
+         fd = -1;
       }
    }
 
-   return false;
-}
+   /* The directory entries of the new files */
+   fd = dirfd(dir);
+   if (fsync(fd) && errno != EINVAL)
+   {
+      fd = -1;
+      goto error;
+   }
+   fd = -1;
 
-bool
-pgmoneta_is_directory(char* directory)
-{
-   struct stat statbuf;
+   closedir(dir);
 
-   memset(&statbuf, 0, sizeof(struct stat));
+   return 0;
 
-   if (!lstat(directory, &statbuf))
+error:
+
+   pgmoneta_log_error("Could not sync %s: %s", directory, strerror(errno));
+
+   if (fd != -1)
    {
-      if (S_ISDIR(statbuf.st_mode))
-      {
-         return true;
-      }
+      close(fd);
    }
 
-   return false;
+   if (dir != NULL)
+   {
+      closedir(dir);
+   }
+
+   errno = 0;
+
+   return 1;
 }
+#endif
 
-bool
-pgmoneta_is_file(char* file)
+void
+pgmoneta_drop_cache(char* file)
 {
-   struct stat statbuf;
+   int fd = -1;
 
-   memset(&statbuf, 0, sizeof(struct stat));
+   if (shmem == NULL || !((struct common_configuration*)shmem)->direct_io)
+   {
+      return;
+   }
 
-   if (!lstat(file, &statbuf))
+   fd = open(file, O_RDONLY | O_CLOEXEC);
+   if (fd == -1)
    {
-      if (S_ISREG(statbuf.st_mode))
-      {
-         return true;
-      }
+      errno = 0;
+      return;
    }
 
-   return false;
+#if defined(HAVE_LINUX)
+   sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+#else
+   fdatasync(fd);
+#endif
+
+#if defined(HAVE_LINUX) || defined(HAVE_FREEBSD)
+   posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+
+   close(fd);
 }
 
 bool
@@ -2490,303 +3836,223 @@ error:
 }
 
 int
-pgmoneta_copy_wal_files(char* from, char* to, char* start, struct workers* workers)
+pgmoneta_copy_wal_files(int server, char* from, char* to, char* start, struct workers* workers)
 {
-   int number_of_wal_files = 0;
-   char** wal_files = NULL;
+   struct wal_index* index = NULL;
+   struct wal_segment first;
+   char* file = NULL;
    char* basename = NULL;
-   char* ff = NULL;
-   char* tf = NULL;
 
-   pgmoneta_get_files(from, &number_of_wal_files, &wal_files);
+   if (pgmoneta_wal_index_create(from, true, &index) || pgmoneta_wal_index_parse(start, &first))
+   {
+      goto error;
+   }
 
-   for (int i = 0; i < number_of_wal_files; i++)
+   /* The history files of the later timelines */
+   for (int i = 0; i < index->number_of_histories; i++)
    {
-      if (pgmoneta_is_encrypted(wal_files[i]))
+      if ((uint32_t)strtoul(index->histories[i], NULL, 16) > first.timeline)
       {
-         if (pgmoneta_strip_extension(wal_files[i], &basename))
+         if (copy_wal_file(from, to, index->histories[i], index->histories[i], workers))
          {
             goto error;
          }
       }
-      else
-      {
-         basename = pgmoneta_append(basename, wal_files[i]);
-      }
+   }
 
-      if (pgmoneta_is_compressed(basename))
-      {
-         char* bn = basename;
-         basename = NULL;
-         if (pgmoneta_strip_extension(bn, &basename))
-         {
-            goto error;
-         }
-         free(bn);
-      }
+   for (int i = pgmoneta_wal_index_search(index, start); i < index->number_of_segments; i++)
+   {
+      file = index->segments[i].file;
 
-      if (strcmp(basename, start) >= 0)
+      /* The segments are restored uncompressed and unencrypted for the recovery */
+      if (pgmoneta_is_encrypted(file) || pgmoneta_is_compressed(file))
       {
-         if (pgmoneta_ends_with(basename, ".partial"))
-         {
-            ff = pgmoneta_append(ff, from);
-            if (!pgmoneta_ends_with(ff, "/"))
-            {
-               ff = pgmoneta_append(ff, "/");
-            }
-            ff = pgmoneta_append(ff, wal_files[i]);
+         basename = pgmoneta_append(NULL, file);
 
-            tf = pgmoneta_append(tf, to);
-            if (!pgmoneta_ends_with(tf, "/"))
-            {
-               tf = pgmoneta_append(tf, "/");
-            }
-            tf = pgmoneta_append(tf, basename);
-         }
-         else
+         while (basename != NULL && (pgmoneta_is_encrypted(basename) || pgmoneta_is_compressed(basename)))
          {
-            ff = pgmoneta_append(ff, from);
-            if (!pgmoneta_ends_with(ff, "/"))
+            char* bn = basename;
+            basename = NULL;
+            if (pgmoneta_strip_extension(bn, &basename))
             {
-               ff = pgmoneta_append(ff, "/");
+               free(bn);
+               goto error;
             }
-            ff = pgmoneta_append(ff, wal_files[i]);
+            free(bn);
+         }
 
-            tf = pgmoneta_append(tf, to);
-            if (!pgmoneta_ends_with(tf, "/"))
-            {
-               tf = pgmoneta_append(tf, "/");
-            }
-            tf = pgmoneta_append(tf, wal_files[i]);
+         if (basename == NULL || restore_wal_file(server, from, to, file, basename, workers))
+         {
+            goto error;
          }
 
-         pgmoneta_copy_file(ff, tf, workers);
+         free(basename);
+         basename = NULL;
+      }
+      else if (copy_wal_file(from, to, file, file, workers))
+      {
+         goto error;
       }
-
-      free(basename);
-      free(ff);
-      free(tf);
-
-      basename = NULL;
-      ff = NULL;
-      tf = NULL;
    }
 
-   for (int i = 0; i < number_of_wal_files; i++)
-   {
-      free(wal_files[i]);
-   }
-   free(wal_files);
+   pgmoneta_wal_index_destroy(index);
 
    return 0;
 
 error:
 
-   for (int i = 0; i < number_of_wal_files; i++)
-   {
-      free(wal_files[i]);
-   }
-   free(wal_files);
+   free(basename);
+
+   pgmoneta_wal_index_destroy(index);
 
    return 1;
 }
 
-int
-pgmoneta_number_of_wal_files(char* directory, char* from, char* to)
+static int
+restore_wal_file(int server, char* from, char* to, char* source, char* target, struct workers* workers)
 {
-   int result;
-   int number_of_wal_files = 0;
-   char** wal_files = NULL;
-   char* basename = NULL;
-
-   result = 0;
+   struct wal_restore_input* wri = NULL;
+   int ret = 0;
 
-   pgmoneta_get_files(directory, &number_of_wal_files, &wal_files);
-
-   for (int i = 0; i < number_of_wal_files; i++)
+   if (pgmoneta_mkdir(to))
    {
-      if (pgmoneta_is_encrypted(wal_files[i]))
-      {
-         if (pgmoneta_strip_extension(wal_files[i], &basename))
-         {
-            goto error;
-         }
-      }
-      else
-      {
-         basename = pgmoneta_append(basename, wal_files[i]);
-      }
-
-      if (pgmoneta_is_compressed(basename))
-      {
-         char* bn = basename;
-         basename = NULL;
-         if (pgmoneta_strip_extension(bn, &basename))
-         {
-            goto error;
-         }
-         free(bn);
-      }
-
-      if (strcmp(basename, from) >= 0)
-      {
-         if (to == NULL || strcmp(basename, to) < 0)
-         {
-            result++;
-         }
-      }
-
-      free(basename);
-      basename = NULL;
+      return 1;
    }
 
-   for (int i = 0; i < number_of_wal_files; i++)
+   wri = (struct wal_restore_input*)calloc(1, sizeof(struct wal_restore_input));
+   if (wri == NULL)
    {
-      free(wal_files[i]);
+      return 1;
    }
-   free(wal_files);
 
-   return result;
+   wri->server = server;
+   snprintf(wri->directory, sizeof(wri->directory), "%s", from);
+   snprintf(wri->source, sizeof(wri->source), "%s", source);
+   snprintf(wri->target, sizeof(wri->target), "%s%s%s", to, pgmoneta_ends_with(to, "/") ? "" : "/", target);
+   wri->common.workers = workers;
 
-error:
+   if (workers == NULL)
+   {
+      ret = pgmoneta_wal_cache_restore(server, wri->directory, wri->source, wri->target);
+      free(wri);
+      return ret;
+   }
 
-   for (int i = 0; i < number_of_wal_files; i++)
+   if (!workers->outcome || pgmoneta_workers_add(workers, do_restore_wal_file, (struct worker_common*)wri))
    {
-      free(wal_files[i]);
+      free(wri);
+      return workers->outcome ? 1 : 0;
    }
-   free(wal_files);
 
    return 0;
 }
 
-unsigned long
-pgmoneta_free_space(char* path)
+static void
+do_restore_wal_file(struct worker_common* wc)
 {
-   struct statvfs buf;
+   struct wal_restore_input* wri = (struct wal_restore_input*)wc;
 
-   if (statvfs(path, &buf))
+   if (pgmoneta_wal_cache_restore(wri->server, wri->directory, wri->source, wri->target))
    {
-      errno = 0;
-      return 0;
+      pgmoneta_log_error("Unable to restore WAL segment %s", wri->source);
+      wc->workers->outcome = false;
    }
 
-   return buf.f_bsize * buf.f_bavail;
+   free(wri);
 }
 
-unsigned long
-pgmoneta_total_space(char* path)
+static int
+copy_wal_file(char* from, char* to, char* source, char* target, struct workers* workers)
 {
-   struct statvfs buf;
+   char* ff = NULL;
+   char* tf = NULL;
 
-   if (statvfs(path, &buf))
+   ff = pgmoneta_append(ff, from);
+   if (!pgmoneta_ends_with(ff, "/"))
    {
-      errno = 0;
-      return 0;
+      ff = pgmoneta_append(ff, "/");
    }
+   ff = pgmoneta_append(ff, source);
 
-   return buf.f_frsize * buf.f_blocks;
-}
-
-unsigned long
-pgmoneta_biggest_file(char* directory)
-{
-   unsigned long biggest_size = 0;
-   DIR* dir;
-   char* p;
-   unsigned long l;
-   unsigned long size = 0;
-   struct dirent* entry;
-   struct stat st;
-
-   if (!(dir = opendir(directory)))
+   tf = pgmoneta_append(tf, to);
+   if (!pgmoneta_ends_with(tf, "/"))
    {
-      goto error;
+      tf = pgmoneta_append(tf, "/");
    }
+   tf = pgmoneta_append(tf, target);
 
-   while ((entry = readdir(dir)) != NULL)
+   if (ff == NULL || tf == NULL)
    {
-      if (entry->d_type == DT_DIR)
-      {
-         char path[MAX_PATH];
-
-         if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
-         {
-            continue;
-         }
-
-         memset(&path[0], 0, sizeof(path));
-         snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
-
-         size = pgmoneta_biggest_file(path);
-
-         if (size > biggest_size)
-         {
-            biggest_size = size;
-         }
-      }
-      else if (entry->d_type == DT_REG)
-      {
-         p = NULL;
-
-         p = pgmoneta_append(p, directory);
-         p = pgmoneta_append(p, "/");
-         p = pgmoneta_append(p, entry->d_name);
+      free(ff);
+      free(tf);
+      return 1;
+   }
 
-         memset(&st, 0, sizeof(struct stat));
+   pgmoneta_copy_file(ff, tf, workers);
 
-         stat(p, &st);
+   free(ff);
+   free(tf);
 
-         l = st.st_size / st.st_blksize;
+   return 0;
+}
 
-         if (st.st_size % st.st_blksize != 0)
-         {
-            l += 1;
-         }
+int
+pgmoneta_number_of_wal_files(char* directory, char* from, char* to)
+{
+   int result = 0;
+   struct wal_index* index = NULL;
 
-         size = (l * st.st_blksize);
+   if (pgmoneta_wal_index_create(directory, true, &index))
+   {
+      return 0;
+   }
 
-         if (size > biggest_size)
-         {
-            biggest_size = size;
-         }
+   result = pgmoneta_wal_index_count(index, from, to);
 
-         free(p);
-      }
-      else if (entry->d_type == DT_LNK)
-      {
-         p = NULL;
+   pgmoneta_wal_index_destroy(index);
 
-         p = pgmoneta_append(p, directory);
-         p = pgmoneta_append(p, "/");
-         p = pgmoneta_append(p, entry->d_name);
+   return result;
+}
 
-         memset(&st, 0, sizeof(struct stat));
+unsigned long
+pgmoneta_free_space(char* path)
+{
+   struct statvfs buf;
 
-         stat(p, &st);
+   if (statvfs(path, &buf))
+   {
+      errno = 0;
+      return 0;
+   }
 
-         size = st.st_blksize;
+   return buf.f_bsize * buf.f_bavail;
+}
 
-         if (size > biggest_size)
-         {
-            biggest_size = size;
-         }
+unsigned long
+pgmoneta_total_space(char* path)
+{
+   struct statvfs buf;
 
-         free(p);
-      }
+   if (statvfs(path, &buf))
+   {
+      errno = 0;
+      return 0;
    }
 
-   closedir(dir);
-
-   return biggest_size;
+   return buf.f_frsize * buf.f_blocks;
+}
 
-error:
+unsigned long
+pgmoneta_biggest_file(char* directory)
+{
+   unsigned long biggest_size = 0;
 
-   if (dir != NULL)
+   if (pgmoneta_walk(directory, WALK_STAT, biggest_file_visitor, &biggest_size))
    {
-      closedir(dir);
+      return 1024 * 1024 * 1024;
    }
 
-   return 1024 * 1024 * 1024;
+   return biggest_size;
 }
 
 bool
@@ -3092,6 +4358,55 @@ error:
    return 1;
 }
 
+static unsigned long
+allocated_size(struct walk_entry* entry)
+{
+   unsigned long l;
+
+   if (entry->type == DT_LNK || entry->block_size == 0)
+   {
+      return entry->block_size;
+   }
+
+   l = entry->size / entry->block_size;
+
+   if (entry->size % entry->block_size != 0)
+   {
+      l += 1;
+   }
+
+   return l * entry->block_size;
+}
+
+static int
+directory_size_visitor(struct walk_entry* entry, void* data)
+{
+   if (entry->type != DT_DIR)
+   {
+      *(unsigned long*)data += allocated_size(entry);
+   }
+
+   return WALK_CONTINUE;
+}
+
+static int
+biggest_file_visitor(struct walk_entry* entry, void* data)
+{
+   unsigned long size;
+
+   if (entry->type != DT_DIR)
+   {
+      size = allocated_size(entry);
+
+      if (size > *(unsigned long*)data)
+      {
+         *(unsigned long*)data = size;
+      }
+   }
+
+   return WALK_CONTINUE;
+}
+
 static int
 string_compare(const void* a, const void* b)
 {
@@ -3142,6 +4457,50 @@ pgmoneta_get_server_wal(int server)
    return d;
 }
 
+char*
+pgmoneta_get_server_wal_spare(int server)
+{
+   char* d = NULL;
+
+   d = get_server_basepath(server);
+   d = pgmoneta_append(d, "spare/");
+
+   return d;
+}
+
+char*
+pgmoneta_get_server_wal_dictionary(int server)
+{
+   char* d = NULL;
+
+   d = get_server_basepath(server);
+   d = pgmoneta_append(d, "wal_dictionary/");
+
+   return d;
+}
+
+char*
+pgmoneta_get_server_wal_upload(int server)
+{
+   char* d = NULL;
+
+   d = get_server_basepath(server);
+   d = pgmoneta_append(d, "wal_upload/");
+
+   return d;
+}
+
+char*
+pgmoneta_get_server_wal_summary(int server)
+{
+   char* d = NULL;
+
+   d = get_server_basepath(server);
+   d = pgmoneta_append(d, "wal_summary/");
+
+   return d;
+}
+
 char*
 pgmoneta_get_server_wal_shipping(int server)
 {
@@ -3845,8 +5204,7 @@ pgmoneta_token_bucket_init(struct token_bucket* tb, long max_rate)
       }
       atomic_init(&tb->cur_tokens, tb->burst);
       tb->max_rate = max_rate;
-      tb->every = DEFAULT_EVERY;
-      atomic_init(&tb->last_time, (unsigned long)time(NULL));
+      atomic_init(&tb->last_time, token_bucket_now());
       return 0;
    }
 
@@ -3866,51 +5224,55 @@ int
 pgmoneta_token_bucket_add(struct token_bucket* tb)
 {
    unsigned long diff;
+   unsigned long tokens;
    unsigned long expected_tokens;
    unsigned long new_tokens;
    unsigned long expected_time;
    unsigned long cur_time;
 
    expected_time = atomic_load(&tb->last_time);
-   cur_time = (unsigned long) time(NULL);
-   diff = cur_time - expected_time;
+   cur_time = token_bucket_now();
 
-   if (diff < (unsigned long)tb->every)
+   if (cur_time <= expected_time)
    {
       return 0;
    }
 
-   // update time
-   while (!atomic_compare_exchange_weak(&tb->last_time, &expected_time, cur_time))
+   diff = cur_time - expected_time;
+
+   // a full bucket needs no more time than that
+   if ((double)diff > (double)tb->burst * 1000000000.0 / tb->max_rate)
    {
-      expected_time = atomic_load(&tb->last_time);
-      cur_time = (unsigned long) time(NULL);
-      diff = cur_time - expected_time;
-      if (diff < (unsigned long)tb->every)
-      {
-         return 0;
-      }
+      tokens = tb->burst;
+   }
+   else
+   {
+      tokens = (unsigned long)((double)tb->max_rate * diff / 1000000000.0);
    }
 
-   // update token
-   expected_tokens = atomic_load(&tb->cur_tokens);
-   new_tokens = expected_tokens + tb->max_rate * (diff / tb->every);
+   // the time keeps accruing until it is worth a token
+   if (tokens == 0)
+   {
+      return 0;
+   }
 
-   if (new_tokens > tb->burst)
+   // somebody else added the tokens for this time
+   if (!atomic_compare_exchange_strong(&tb->last_time, &expected_time, cur_time))
    {
-      new_tokens = tb->burst;
+      return 0;
    }
 
-   while (!atomic_compare_exchange_weak(&tb->cur_tokens, &expected_tokens, new_tokens))
+   expected_tokens = atomic_load(&tb->cur_tokens);
+   do
    {
-      expected_tokens = atomic_load(&tb->cur_tokens);
-      new_tokens = expected_tokens + tb->max_rate * (diff / tb->every);
+      new_tokens = expected_tokens + tokens;
 
       if (new_tokens > tb->burst)
       {
          new_tokens = tb->burst;
       }
    }
+   while (!atomic_compare_exchange_weak(&tb->cur_tokens, &expected_tokens, new_tokens));
 
    return 0;
 }
@@ -3918,30 +5280,21 @@ pgmoneta_token_bucket_add(struct token_bucket* tb)
 int
 pgmoneta_token_bucket_consume(struct token_bucket* tb, unsigned long tokens)
 {
-   if (tokens < tb->burst)
-   {
-      return pgmoneta_token_bucket_once(tb, tokens);
-   }
-   else
+   unsigned long chunk;
+
+   while (tokens > 0)
    {
-      unsigned long accum = 0;
-      unsigned long cur_tokens;
-      while (accum < tokens)
-      {
+      chunk = MIN(tokens, tb->burst);
 
-         cur_tokens = atomic_load(&tb->cur_tokens);
-         if (!pgmoneta_token_bucket_once(tb, cur_tokens))
-         {
-            accum += cur_tokens;
-         }
-         else
-         {
-            SLEEP(500000000L);
-         }
+      while (pgmoneta_token_bucket_once(tb, chunk))
+      {
+         token_bucket_wait(tb, chunk);
       }
-      return 0;
 
+      tokens -= chunk;
    }
+
+   return 0;
 }
 
 int
@@ -3968,15 +5321,31 @@ pgmoneta_token_bucket_once(struct token_bucket* tb, unsigned long tokens)
 char*
 pgmoneta_format_and_append(char* buf, char* format, ...)
 {
+   char buffer[BUILDER_INLINE_SIZE];
+   char* formatted_str = NULL;
+   int size_needed;
    va_list args;
-   va_start(args, format);
 
-   // Determine the required buffer size
-   int size_needed = vsnprintf(NULL, 0, format, args) + 1;
+   // Most descriptions fit the stack buffer, so they are formatted once without an allocation
+   va_start(args, format);
+   size_needed = vsnprintf(&buffer[0], sizeof(buffer), format, args) + 1;
    va_end(args);
 
-   // Allocate buffer to hold the formatted string
-   char* formatted_str = malloc(size_needed);
+   if (size_needed <= 0)
+   {
+      return buf;
+   }
+
+   if ((size_t)size_needed <= sizeof(buffer))
+   {
+      return pgmoneta_append(buf, &buffer[0]);
+   }
+
+   formatted_str = malloc(size_needed);
+   if (formatted_str == NULL)
+   {
+      return buf;
+   }
 
    va_start(args, format);
    vsnprintf(formatted_str, size_needed, format, args);
@@ -3987,7 +5356,6 @@ pgmoneta_format_and_append(char* buf, char* format, ...)
    free(formatted_str);
 
    return buf;
-
 }
 
 int
@@ -4122,6 +5490,7 @@ pgmoneta_split(const char* string, char*** results, int* count, char delimiter)
    char** temp_results = NULL;
    int num_objects = 0;
    char* token = NULL;
+   char* saveptr = NULL;
 
    *results = NULL;
    *count = 0;
@@ -4144,11 +5513,11 @@ pgmoneta_split(const char* string, char*** results, int* count, char delimiter)
       return 0;
    }
 
-   token = strtok(temp, delim_str);
+   token = strtok_r(temp, delim_str, &saveptr);
    while (token)
    {
       num_objects++;
-      token = strtok(NULL, delim_str);
+      token = strtok_r(NULL, delim_str, &saveptr);
    }
 
    temp_results = calloc(num_objects + 1, sizeof(char*));
@@ -4164,7 +5533,7 @@ pgmoneta_split(const char* string, char*** results, int* count, char delimiter)
       goto error;
    }
 
-   token = strtok(temp, delim_str);
+   token = strtok_r(temp, delim_str, &saveptr);
    for (int i = 0; i < num_objects; i++)
    {
       temp_results[i] = strdup(token);
@@ -4172,7 +5541,7 @@ pgmoneta_split(const char* string, char*** results, int* count, char delimiter)
       {
          goto error;
       }
-      token = strtok(NULL, delim_str);
+      token = strtok_r(NULL, delim_str, &saveptr);
    }
 
    temp_results[num_objects] = NULL;
@@ -4631,3 +6000,203 @@ error:
    return 1;
 #endif
 }
+
+int
+pgmoneta_parse_cpus(char* list, int* cpus, int size, int* number)
+{
+   char* copy = NULL;
+   char* token = NULL;
+   char* saveptr = NULL;
+   char* end = NULL;
+   long first;
+   long last;
+
+   *number = 0;
+
+   if (list == NULL || strlen(list) == 0)
+   {
+      goto error;
+   }
+
+   copy = strdup(list);
+   if (copy == NULL)
+   {
+      goto error;
+   }
+
+   for (token = strtok_r(copy, ",", &saveptr); token != NULL; token = strtok_r(NULL, ",", &saveptr))
+   {
+      while (*token == ' ')
+      {
+         token++;
+      }
+
+      first = strtol(token, &end, 10);
+      if (end == token || first < 0)
+      {
+         goto error;
+      }
+
+      last = first;
+      if (*end == '-')
+      {
+         token = end + 1;
+         last = strtol(token, &end, 10);
+         if (end == token || last < first)
+         {
+            goto error;
+         }
+      }
+
+      while (*end == ' ')
+      {
+         end++;
+      }
+
+      if (*end != '\0' || last >= MAX_NUMBER_OF_CPUS)
+      {
+         goto error;
+      }
+
+      for (long cpu = first; cpu <= last; cpu++)
+      {
+         if (cpus != NULL)
+         {
+            if (*number >= size)
+            {
+               goto error;
+            }
+            cpus[*number] = (int)cpu;
+         }
+         (*number)++;
+      }
+   }
+
+   free(copy);
+
+   return *number > 0 ? 0 : 1;
+
+error:
+
+   free(copy);
+
+   return 1;
+}
+
+int
+pgmoneta_pin_thread(char* list, int index)
+{
+#ifdef HAVE_LINUX
+   int cpus[MAX_NUMBER_OF_CPUS];
+   int number = 0;
+   cpu_set_t set;
+
+   if (list == NULL || strlen(list) == 0)
+   {
+      return 0;
+   }
+
+   if (pgmoneta_parse_cpus(list, &cpus[0], MAX_NUMBER_OF_CPUS, &number))
+   {
+      goto error;
+   }
+
+   CPU_ZERO(&set);
+
+   if (index >= 0)
+   {
+      CPU_SET(cpus[index % number], &set);
+   }
+   else
+   {
+      for (int i = 0; i < number; i++)
+      {
+         CPU_SET(cpus[i], &set);
+      }
+   }
+
+   if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set))
+   {
+      goto error;
+   }
+
+   return 0;
+
+error:
+
+   pgmoneta_log_warn("Could not pin thread to CPUs %s", list);
+
+   return 1;
+#else
+   (void)index;
+
+   if (list != NULL && strlen(list) > 0)
+   {
+      pgmoneta_log_debug("Pinning threads to CPUs is only supported on Linux");
+   }
+
+   return 0;
+#endif
+}
+
+int
+pgmoneta_unpin_thread(void)
+{
+#ifdef HAVE_LINUX
+   cpu_set_t set;
+
+   CPU_ZERO(&set);
+
+   for (int i = 0; i < MIN(get_nprocs_conf(), CPU_SETSIZE); i++)
+   {
+      CPU_SET(i, &set);
+   }
+
+   if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set))
+   {
+      return 1;
+   }
+#endif
+
+   return 0;
+}
+
+static unsigned long
+token_bucket_now(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+
+   return (unsigned long)ts.tv_sec * 1000000000UL + (unsigned long)ts.tv_nsec;
+}
+
+/**
+ * Sleep until the tokens missing from the bucket have accrued
+ * @param tb The token bucket
+ * @param tokens The needed tokens
+ */
+static void
+token_bucket_wait(struct token_bucket* tb, unsigned long tokens)
+{
+   unsigned long available;
+   unsigned long missing;
+   unsigned long wait;
+   struct timespec ts;
+
+   available = atomic_load(&tb->cur_tokens);
+   missing = tokens > available ? tokens - available : 1;
+
+   wait = (unsigned long)((double)missing * 1000000000.0 / tb->max_rate);
+   if (wait == 0)
+   {
+      wait = 1;
+   }
+
+   ts.tv_sec = wait / 1000000000UL;
+   ts.tv_nsec = wait % 1000000000UL;
+
+   while (clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, &ts) == EINTR)
+   {
+   }
+}
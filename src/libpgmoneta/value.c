@@ -28,14 +28,42 @@
 /* pgmoneta */
 #include <art.h>
 #include <json.h>
+#include <logging.h>
 #include <utils.h>
 
 /* System */
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#define VALUE_CACHE_SIZE  256
+#define VALUE_INLINE_SIZE 32
+
+/**
+ * @struct value_box
+ * Defines the allocation behind a created value, with room for a short string
+ */
+struct value_box
+{
+   struct value value;                  /**< The value, must be first */
+   char inline_data[VALUE_INLINE_SIZE]; /**< The storage of a short string */
+};
+
+/* Values freed by a thread are reused by the same thread, linked through value.data */
+static _Thread_local struct value_box* value_cache = NULL;
+static _Thread_local int value_cache_size = 0;
+static _Thread_local struct value_statistics value_stats;
+
+static pthread_key_t value_cache_key;
+static pthread_once_t value_cache_once = PTHREAD_ONCE_INIT;
+
+static struct value_box* value_box_alloc(void);
+static void value_box_release(struct value_box* box);
+static void value_cache_create_key(void);
+static void value_cache_destroy(void* data);
+
 static void noop_destroy_cb(uintptr_t data);
 static void free_destroy_cb(uintptr_t data);
 static void art_destroy_cb(uintptr_t data);
@@ -63,12 +91,66 @@ static char* mem_to_string_cb(uintptr_t data, int32_t format, char* tag, int ind
 int
 pgmoneta_value_create(enum value_type type, uintptr_t data, struct value** value)
 {
-   struct value* val = NULL;
-   val = (struct value*) malloc(sizeof(struct value));
-   if (val == NULL)
+   struct value_box* box = NULL;
+   size_t length;
+
+   box = value_box_alloc();
+   if (box == NULL)
    {
       goto error;
    }
+
+   if ((type == ValueString || type == ValueBASE64) && data != 0 &&
+       (length = strlen((char*)data)) < VALUE_INLINE_SIZE)
+   {
+      /* The string lives in the box, so there is nothing to free with it */
+      memcpy(box->inline_data, (char*)data, length + 1);
+      pgmoneta_value_init(pgmoneta_value_to_ref(type), (uintptr_t)box->inline_data, &box->value);
+      box->value.type = type;
+      value_stats.inlined++;
+   }
+   else
+   {
+      pgmoneta_value_init(type, data, &box->value);
+   }
+
+   value_stats.created++;
+
+   *value = &box->value;
+   return 0;
+
+error:
+   return 1;
+}
+
+int
+pgmoneta_value_create_with_config(uintptr_t data, struct value_config* config, struct value** value)
+{
+   if (pgmoneta_value_create(ValueRef, data, value))
+   {
+      return 1;
+   }
+   if (config != NULL)
+   {
+      if (config->destroy_data != NULL)
+      {
+         (*value)->destroy_data = config->destroy_data;
+      }
+      if (config->to_string != NULL)
+      {
+         (*value)->to_string = config->to_string;
+      }
+   }
+   return 0;
+}
+
+int
+pgmoneta_value_init(enum value_type type, uintptr_t data, struct value* val)
+{
+   if (val == NULL)
+   {
+      return 1;
+   }
    val->data = 0;
    val->type = type;
    switch (type)
@@ -170,17 +252,13 @@ pgmoneta_value_create(enum value_type type, uintptr_t data, struct value** value
          val->destroy_data = noop_destroy_cb;
          break;
    }
-   *value = val;
    return 0;
-
-error:
-   return 1;
 }
 
 int
-pgmoneta_value_create_with_config(uintptr_t data, struct value_config* config, struct value** value)
+pgmoneta_value_init_with_config(uintptr_t data, struct value_config* config, struct value* value)
 {
-   if (pgmoneta_value_create(ValueRef, data, value))
+   if (pgmoneta_value_init(ValueRef, data, value))
    {
       return 1;
    }
@@ -188,11 +266,11 @@ pgmoneta_value_create_with_config(uintptr_t data, struct value_config* config, s
    {
       if (config->destroy_data != NULL)
       {
-         (*value)->destroy_data = config->destroy_data;
+         value->destroy_data = config->destroy_data;
       }
       if (config->to_string != NULL)
       {
-         (*value)->to_string = config->to_string;
+         value->to_string = config->to_string;
       }
    }
    return 0;
@@ -206,7 +284,8 @@ pgmoneta_value_destroy(struct value* value)
       return 0;
    }
    value->destroy_data(value->data);
-   free(value);
+   value_box_release((struct value_box*)value);
+   value_stats.destroyed++;
    return 0;
 }
 
@@ -278,6 +357,22 @@ pgmoneta_value_to_float(uintptr_t val)
    return uni.val;
 }
 
+void
+pgmoneta_value_statistics(struct value_statistics* statistics)
+{
+   if (statistics != NULL)
+   {
+      *statistics = value_stats;
+   }
+}
+
+void
+pgmoneta_value_log_statistics(void)
+{
+   pgmoneta_log_debug("Values: %" PRIu64 " created, %" PRIu64 " allocated, %" PRIu64 " inline strings, %" PRIu64 " destroyed, %d cached",
+                      value_stats.created, value_stats.allocated, value_stats.inlined, value_stats.destroyed, value_cache_size);
+}
+
 enum value_type
 pgmoneta_value_to_ref(enum value_type type)
 {
@@ -562,13 +657,16 @@ string_to_string_cb(uintptr_t data, int32_t format, char* tag, int indent)
    {
       if (format == FORMAT_JSON || format == FORMAT_JSON_COMPACT)
       {
+         // appended directly, long strings such as SHA512 checksums don't fit the buffer
          translated_string = pgmoneta_escape_string(str);
-         snprintf(buf, MISC_LENGTH, "\"%s\"", translated_string);
+         ret = pgmoneta_append_char(ret, '"');
+         ret = pgmoneta_append(ret, translated_string);
+         ret = pgmoneta_append_char(ret, '"');
          free(translated_string);
       }
       else if (format == FORMAT_TEXT)
       {
-         snprintf(buf, MISC_LENGTH, "%s", str);
+         ret = pgmoneta_append(ret, str);
       }
    }
    ret = pgmoneta_append(ret, buf);
@@ -630,3 +728,66 @@ mem_to_string_cb(uintptr_t data, int32_t format __attribute__((unused)), char* t
 
    return ret;
 }
+
+static struct value_box*
+value_box_alloc(void)
+{
+   struct value_box* box = NULL;
+
+   if (value_cache != NULL)
+   {
+      box = value_cache;
+      value_cache = (struct value_box*)box->value.data;
+      value_cache_size--;
+      return box;
+   }
+
+   box = (struct value_box*)malloc(sizeof(struct value_box));
+   if (box != NULL)
+   {
+      value_stats.allocated++;
+   }
+
+   return box;
+}
+
+static void
+value_box_release(struct value_box* box)
+{
+   if (value_cache_size >= VALUE_CACHE_SIZE)
+   {
+      free(box);
+      return;
+   }
+
+   if (value_cache_size == 0)
+   {
+      /* Give the cache back when the thread exits */
+      pthread_once(&value_cache_once, value_cache_create_key);
+      pthread_setspecific(value_cache_key, &value_cache);
+   }
+
+   box->value.data = (uintptr_t)value_cache;
+   value_cache = box;
+   value_cache_size++;
+}
+
+static void
+value_cache_create_key(void)
+{
+   pthread_key_create(&value_cache_key, value_cache_destroy);
+}
+
+static void
+value_cache_destroy(void* data __attribute__((unused)))
+{
+   struct value_box* box = NULL;
+
+   while (value_cache != NULL)
+   {
+      box = value_cache;
+      value_cache = (struct value_box*)box->value.data;
+      free(box);
+   }
+   value_cache_size = 0;
+}
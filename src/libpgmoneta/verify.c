@@ -28,6 +28,7 @@
 
 /* pgmoneta */
 #include <pgmoneta.h>
+#include <lock.h>
 #include <logging.h>
 #include <management.h>
 #include <network.h>
@@ -46,6 +47,7 @@ pgmoneta_verify(SSL* ssl __attribute__((unused)), int client_fd, int server, uin
    char* identifier = NULL;
    char* directory = NULL;
    char* files = NULL;
+   int32_t sample = 0;
    char* elapsed = NULL;
    struct timespec start_t;
    struct timespec end_t;
@@ -54,6 +56,7 @@ pgmoneta_verify(SSL* ssl __attribute__((unused)), int client_fd, int server, uin
    struct backup* backup = NULL;
    struct workflow* workflow = NULL;
    struct workflow* current = NULL;
+   struct workers* workers = NULL;
    struct art* nodes = NULL;
    struct deque* f = NULL;
    struct deque* a = NULL;
@@ -64,6 +67,8 @@ pgmoneta_verify(SSL* ssl __attribute__((unused)), int client_fd, int server, uin
    struct json* req = NULL;
    struct json* response = NULL;
    struct json* filesj = NULL;
+   struct json* result = NULL;
+   struct lock* lock = NULL;
    struct main_configuration* config;
 
    pgmoneta_start_logging();
@@ -80,6 +85,7 @@ pgmoneta_verify(SSL* ssl __attribute__((unused)), int client_fd, int server, uin
    identifier = (char*)pgmoneta_json_get(req, MANAGEMENT_ARGUMENT_BACKUP);
    directory = (char*)pgmoneta_json_get(req, MANAGEMENT_ARGUMENT_DIRECTORY);
    files = (char*)pgmoneta_json_get(req, MANAGEMENT_ARGUMENT_FILES);
+   sample = (int32_t)pgmoneta_json_get(req, MANAGEMENT_ARGUMENT_SAMPLE);
 
    if (pgmoneta_art_create(&nodes))
    {
@@ -101,13 +107,31 @@ pgmoneta_verify(SSL* ssl __attribute__((unused)), int client_fd, int server, uin
       goto error;
    }
 
+   if (pgmoneta_art_insert(nodes, USER_SAMPLE, (uintptr_t)sample, ValueInt32))
+   {
+      goto error;
+   }
+
    if (pgmoneta_workflow_nodes(server, identifier, nodes, &backup))
    {
       goto error;
    }
 
+   /* Verify runs next to a new backup, but not while the backup is deleted */
+   if (pgmoneta_lock_repository(server, LOCK_SHARED, &lock) || pgmoneta_lock_backup_chain(lock, backup))
+   {
+      pgmoneta_log_info("Verify: %s/%s is active", config->common.servers[server].name, identifier);
+      pgmoneta_management_response_error(NULL, client_fd, config->common.servers[server].name, MANAGEMENT_ERROR_VERIFY_ACTIVE, NAME, compression, encryption, payload);
+      goto error;
+   }
+
    workflow = pgmoneta_workflow_create(WORKFLOW_TYPE_VERIFY, server, backup);
 
+   if (pgmoneta_workflow_workers_create(nodes, &workers))
+   {
+      goto error;
+   }
+
    current = workflow;
    while (current != NULL)
    {
@@ -138,6 +162,9 @@ pgmoneta_verify(SSL* ssl __attribute__((unused)), int client_fd, int server, uin
       current = current->next;
    }
 
+   pgmoneta_workflow_workers_destroy(WORKFLOW_TYPE_VERIFY, nodes, workers);
+   workers = NULL;
+
    label = (char*)pgmoneta_art_search(nodes, NODE_LABEL);
 
    f = (struct deque*)pgmoneta_art_search(nodes, NODE_FAILED);
@@ -208,7 +235,19 @@ pgmoneta_verify(SSL* ssl __attribute__((unused)), int client_fd, int server, uin
    pgmoneta_json_put(response, MANAGEMENT_ARGUMENT_SERVER, (uintptr_t)config->common.servers[server].name, ValueString);
    pgmoneta_json_put(response, MANAGEMENT_ARGUMENT_FILES, (uintptr_t)filesj, ValueJSON);
 
-   pgmoneta_delete_directory((char*)pgmoneta_art_search(nodes, NODE_TARGET_BASE));
+   result = (struct json*)pgmoneta_art_search(nodes, NODE_SAMPLE);
+   if (result != NULL)
+   {
+      pgmoneta_json_put(response, MANAGEMENT_ARGUMENT_SAMPLE, (uintptr_t)sample, ValueInt32);
+      pgmoneta_json_put(response, MANAGEMENT_ARGUMENT_COVERAGE, (uintptr_t)pgmoneta_json_get(result, MANAGEMENT_ARGUMENT_COVERAGE), ValueDouble);
+      pgmoneta_json_put(response, MANAGEMENT_ARGUMENT_ROTATION, (uintptr_t)pgmoneta_json_get(result, MANAGEMENT_ARGUMENT_ROTATION), ValueInt32);
+      pgmoneta_json_put(response, MANAGEMENT_ARGUMENT_CONFIDENCE, (uintptr_t)pgmoneta_json_get(result, MANAGEMENT_ARGUMENT_CONFIDENCE), ValueDouble);
+   }
+
+   if (pgmoneta_art_contains_key(nodes, NODE_TARGET_BASE))
+   {
+      pgmoneta_delete_directory((char*)pgmoneta_art_search(nodes, NODE_TARGET_BASE));
+   }
 
 #ifdef HAVE_FREEBSD
    clock_gettime(CLOCK_MONOTONIC_FAST, &end_t);
@@ -239,6 +278,8 @@ pgmoneta_verify(SSL* ssl __attribute__((unused)), int client_fd, int server, uin
 
    pgmoneta_disconnect(client_fd);
 
+   pgmoneta_unlock(lock);
+
    pgmoneta_stop_logging();
 
    free(elapsed);
@@ -247,7 +288,12 @@ pgmoneta_verify(SSL* ssl __attribute__((unused)), int client_fd, int server, uin
 
 error:
 
-   pgmoneta_delete_directory((char*)pgmoneta_art_search(nodes, NODE_TARGET_BASE));
+   pgmoneta_workflow_workers_destroy(WORKFLOW_TYPE_VERIFY, nodes, workers);
+
+   if (pgmoneta_art_contains_key(nodes, NODE_TARGET_BASE))
+   {
+      pgmoneta_delete_directory((char*)pgmoneta_art_search(nodes, NODE_TARGET_BASE));
+   }
 
    pgmoneta_deque_iterator_destroy(fiter);
    pgmoneta_deque_iterator_destroy(aiter);
@@ -260,6 +306,8 @@ error:
 
    pgmoneta_disconnect(client_fd);
 
+   pgmoneta_unlock(lock);
+
    pgmoneta_stop_logging();
 
    free(elapsed);
@@ -28,13 +28,23 @@
 
 /* pgmoneta */
 #include <pgmoneta.h>
+#include <aes.h>
+#include <art.h>
+#include <bandwidth.h>
+#include <deque.h>
 #include <logging.h>
 #include <network.h>
+#include <prometheus.h>
+#include <reader.h>
 #include <security.h>
 #include <server.h>
 #include <storage.h>
+#include <trace.h>
 #include <utils.h>
 #include <wal.h>
+#include <walcache.h>
+#include <workers.h>
+#include <walfile/wal_summary.h>
 
 /* system */
 #include <ctype.h>
@@ -42,36 +52,301 @@
 #include <err.h>
 #include <errno.h>
 #include <ev.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 #include <libssh/libssh.h>
 #include <libssh/sftp.h>
 #include <openssl/ssl.h>
+#include <zstd.h>
+
+#define WAL_SPARE_PREFIX "spare."
+
+#define WAL_RECEIVER_RESTART 60
+
+/** @struct wal_spare_input
+ * Defines the input for refilling the preallocated segment pool
+ */
+struct wal_spare_input
+{
+   struct worker_common common; /**< The common base */
+   char directory[MAX_PATH];    /**< The spare directory */
+   int segsize;                 /**< The segment size */
+   int count;                   /**< The number of segments to keep */
+};
+
+/** @struct wal_upload_input
+ * Defines the input for uploading the queued WAL segments
+ */
+struct wal_upload_input
+{
+   struct worker_common common; /**< The common base */
+   int server;                  /**< The server */
+   char directory[MAX_PATH];    /**< The WAL directory */
+   char queue[MAX_PATH];        /**< The upload queue directory */
+};
+
+/** @struct wal_summary_input
+ * Defines the input for summarizing a completed WAL segment
+ */
+struct wal_summary_input
+{
+   struct worker_common common; /**< The common base */
+   int server;                  /**< The server */
+   char directory[MAX_PATH];    /**< The WAL directory */
+   char summaries[MAX_PATH];    /**< The summary directory */
+   char filename[MAX_PATH];     /**< The WAL segment */
+};
+
+/** @struct wal_standby_input
+ * Defines the input for feeding a completed WAL segment to the hot standby
+ */
+struct wal_standby_input
+{
+   struct worker_common common; /**< The common base */
+   int server;                  /**< The server */
+   char directory[MAX_PATH];    /**< The WAL directory */
+   char filename[MAX_PATH];     /**< The WAL segment */
+};
+
+/** @struct wal_inline
+ * Defines the state of a WAL segment compressed while it is streamed
+ */
+struct wal_inline
+{
+   ZSTD_CCtx* cctx;       /**< The compression context */
+   unsigned char* buffer; /**< The compressed segment */
+   size_t size;           /**< The used size of the buffer */
+   size_t capacity;       /**< The capacity of the buffer */
+   size_t consumed;       /**< The number of WAL bytes compressed */
+};
+
+/** @struct wal_receiver
+ * Defines a WAL receiver thread of the multiplexed WAL process
+ */
+struct wal_receiver
+{
+   int server;         /**< The server */
+   pthread_t thread;   /**< The thread */
+   bool started;       /**< Has the thread been started */
+   atomic_bool active; /**< Is the thread streaming */
+};
 
 int mappings_size = 0;
 oid_mapping* oidMappings = NULL;
 bool enable_translation = false;
 
+static int wal_stream(int srv);
+static void* wal_receiver_run(void* arg);
 static char* wal_file_name(uint32_t timeline, size_t segno, int segsize);
 static int wal_fetch_history(char* basedir, int timeline, SSL* ssl, int socket);
-static FILE* wal_open(char* root, char* filename, int segsize);
+static FILE* wal_open(char* root, char* spare, char* filename, int segsize);
 static int wal_close(char* root, char* filename, bool partial, FILE* file);
 static int wal_prepare(FILE* file, int segsize);
-static int wal_send_status_report(SSL* ssl, int socket, int64_t received, int64_t flushed, int64_t applied);
+static bool wal_spare_take(char* spare, char* path, int segsize);
+static void wal_spare_fill(struct workers* workers, char* spare, int segsize);
+static void do_wal_spare_fill(struct worker_common* wc);
+static int wal_sync(FILE* file);
+static void do_wal_upload(struct worker_common* wc);
+static char* wal_upload_resolve(char* directory, char* filename);
+static void wal_summarize(struct workers* workers, int srv, char* directory, char* summaries, char* filename);
+static void do_wal_summarize(struct worker_common* wc);
+static void wal_standby(struct workers* workers, int srv, char* directory, char* filename);
+static void do_wal_standby(struct worker_common* wc);
+static int wal_write(int srv, FILE* file, FILE* shipping, void* data, size_t size);
+static int wal_commit(int srv, FILE* file, FILE* shipping);
+static int wal_complete(int srv, struct wal_inline* wi, char* root, char* filename, int segsize, FILE* file, FILE* shipping);
+static int wal_inline_create(int segsize, struct wal_inline** wi);
+static void wal_inline_reset(struct wal_inline* wi);
+static int wal_inline_write(struct wal_inline* wi, void* data, size_t size);
+static int wal_inline_close(struct wal_inline* wi, char* root, char* filename, int segsize, FILE* file);
+static void wal_inline_destroy(struct wal_inline* wi);
+static bool wal_running(int srv);
+static int wal_cached_history(int srv, uint32_t tli, struct timeline_history** history);
+static void wal_cache_history(int srv, uint32_t tli, struct timeline_history* history);
+static bool wal_resume_load(int srv, int segsize, uint32_t* timeline, uint32_t* high32, uint32_t* low32);
+static void wal_resume_store(int srv, uint32_t timeline, uint64_t lsn);
+static bool wal_group_commit(void);
+static bool wal_commit_due(size_t pending, struct timespec* last_commit);
+static int64_t wal_elapsed(struct timespec* since);
+static int wal_idle_timeout(size_t pending, struct timespec* last_commit, struct timespec* last_report);
+static bool wal_readable(SSL* ssl, int socket, int timeout);
+static int wal_send_status_report(int srv, SSL* ssl, int socket, int64_t received, int64_t flushed, int64_t applied);
 static int wal_xlog_offset(size_t xlogptr, int segsize);
 static int wal_convert_xlogpos(char* xlogpos, int segsize, uint32_t* high32, uint32_t* low32);
 static int wal_find_streaming_start(char* basedir, int segsize, uint32_t* timeline, uint32_t* high32, uint32_t* low32);
 static int wal_read_replication_slot(SSL* ssl, int socket, char* slot, char* name, int segsize, uint32_t* high32, uint32_t* low32, uint32_t* timeline);
 static int wal_shipping_setup(int srv, char** wal_shipping);
 static void update_wal_lsn(int srv, size_t xlogptr);
+static int build_oid_cache(void);
+static void oid_name_key(object_type type, int oid, char* key, size_t size);
+static void oid_value_key(object_type type, char* name, char* key, size_t size);
+static int get_oid(object_type type, char* name, char** oid);
+
+static atomic_bool wal_upload_pending[NUMBER_OF_SERVERS];
+static pthread_mutex_t wal_summary_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct art* oid_names = NULL;
+static struct art* oid_values = NULL;
 
 void
 pgmoneta_wal(int srv, char** argv)
+{
+   int ret;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*) shmem;
+
+   pgmoneta_start_logging();
+   pgmoneta_memory_init();
+
+   pgmoneta_set_proc_title(1, argv, "wal", config->common.servers[srv].name);
+
+   ret = wal_stream(srv);
+
+   pgmoneta_memory_destroy();
+   pgmoneta_stop_logging();
+
+   exit(ret);
+}
+
+void
+pgmoneta_wal_multiplex(char** argv)
+{
+   time_t last_start = 0;
+   struct wal_receiver receivers[NUMBER_OF_SERVERS];
+   struct main_configuration* config;
+
+   config = (struct main_configuration*) shmem;
+
+   pgmoneta_start_logging();
+
+   pgmoneta_set_proc_title(1, argv, "wal", "multiplex");
+
+   memset(&receivers, 0, sizeof(receivers));
+
+   while (config->running)
+   {
+      if (last_start == 0 || difftime(time(NULL), last_start) >= WAL_RECEIVER_RESTART)
+      {
+         for (int i = 0; i < config->common.number_of_servers; i++)
+         {
+            struct wal_receiver* r = &receivers[i];
+
+            if (r->started && !atomic_load(&r->active))
+            {
+               pthread_join(r->thread, NULL);
+               r->started = false;
+            }
+
+            if (r->started)
+            {
+               continue;
+            }
+
+            // the first round only starts primaries, like the per-server receivers
+            if ((last_start == 0 && strlen(config->common.servers[i].follow) == 0) ||
+                (last_start != 0 && pgmoneta_wal_should_stream(i)))
+            {
+               r->server = i;
+               atomic_store(&r->active, true);
+
+               if (pthread_create(&r->thread, NULL, wal_receiver_run, r))
+               {
+                  pgmoneta_log_error("WAL - Cannot create thread for %s", config->common.servers[i].name);
+                  atomic_store(&r->active, false);
+               }
+               else
+               {
+                  r->started = true;
+               }
+            }
+         }
+
+         last_start = time(NULL);
+      }
+
+      sleep(1);
+   }
+
+   for (int i = 0; i < config->common.number_of_servers; i++)
+   {
+      if (receivers[i].started)
+      {
+         pthread_join(receivers[i].thread, NULL);
+      }
+   }
+
+   pgmoneta_stop_logging();
+
+   exit(0);
+}
+
+bool
+pgmoneta_wal_should_stream(int srv)
+{
+   int follow;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*) shmem;
+
+   if (config->common.servers[srv].wal_streaming)
+   {
+      return false;
+   }
+
+   if (strlen(config->common.servers[srv].follow) == 0)
+   {
+      follow = -1;
+
+      for (int j = 0; follow == -1 && j < config->common.number_of_servers; j++)
+      {
+         if (!strcmp(config->common.servers[j].follow, config->common.servers[srv].name))
+         {
+            follow = j;
+         }
+      }
+
+      return follow == -1 || !config->common.servers[follow].wal_streaming;
+   }
+
+   for (int j = 0; j < config->common.number_of_servers; j++)
+   {
+      if (!strcmp(config->common.servers[srv].follow, config->common.servers[j].name) && !config->common.servers[j].wal_streaming)
+      {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+static void*
+wal_receiver_run(void* arg)
+{
+   struct wal_receiver* r = (struct wal_receiver*)arg;
+
+   pgmoneta_memory_init();
+
+   wal_stream(r->server);
+
+   pgmoneta_memory_destroy();
+
+   atomic_store(&r->active, false);
+
+   return NULL;
+}
+
+static int
+wal_stream(int srv)
 {
    int usr;
    int auth;
@@ -80,6 +355,14 @@ pgmoneta_wal(int srv, char** argv)
    uint32_t high32 = 0;
    uint32_t low32 = 0;
    char* d = NULL;
+   char* spare = NULL;
+   struct workers* spare_workers = NULL;
+   char* upload_queue = NULL;
+   struct workers* upload_workers = NULL;
+   char* summaries = NULL;
+   struct workers* summary_workers = NULL;
+   struct workers* standby_workers = NULL;
+   struct wal_inline* inline_compression = NULL;
    char* wal_shipping = NULL;
    uint32_t timeline = 0;
    uint32_t cur_timeline = 0;
@@ -89,6 +372,14 @@ pgmoneta_wal(int srv, char** argv)
    char cmd[MISC_LENGTH];
    size_t xlogpos_size = 0;
    size_t xlogptr = 0;
+   size_t flushptr = 0;
+   size_t pending = 0;
+   uint64_t close_start = 0;
+   uint64_t received = 0;
+   uint64_t pending_since = 0;
+   struct timespec last_commit;
+   struct timespec last_report;
+   size_t reportptr = 0;
    size_t segno;
    size_t xlogoff;
    size_t curr_xlogoff = 0;
@@ -103,6 +394,7 @@ pgmoneta_wal(int srv, char** argv)
    struct message* identify_system_msg = NULL;
    struct query_response* identify_system_response = NULL;
    struct query_response* end_of_timeline_response = NULL;
+   struct timeline_history* history = NULL;
    struct message* start_replication_msg = NULL;
    struct message* msg = (struct message*)malloc(sizeof (struct message));
    struct main_configuration* config;
@@ -113,11 +405,6 @@ pgmoneta_wal(int srv, char** argv)
 
    config = (struct main_configuration*) shmem;
 
-   pgmoneta_start_logging();
-   pgmoneta_memory_init();
-
-   pgmoneta_set_proc_title(1, argv, "wal", config->common.servers[srv].name);
-
    if (msg == NULL)
    {
       goto error;
@@ -145,6 +432,8 @@ pgmoneta_wal(int srv, char** argv)
       goto error;
    }
    pgmoneta_server_info(srv);
+   /* The WAL receiver runs for long, so it doesn't keep a spare connection */
+   pgmoneta_server_close_connections();
 
    if (config->common.servers[srv].checksums)
    {
@@ -159,6 +448,65 @@ pgmoneta_wal(int srv, char** argv)
    d = pgmoneta_get_server_wal(srv);
    pgmoneta_mkdir(d);
 
+   if (config->wal_preallocate > 0)
+   {
+      spare = pgmoneta_get_server_wal_spare(srv);
+      if (pgmoneta_mkdir(spare) || pgmoneta_workers_initialize(1, &spare_workers))
+      {
+         pgmoneta_log_warn("Unable to preallocate WAL segments for %s", config->common.servers[srv].name);
+         free(spare);
+         spare = NULL;
+      }
+      else
+      {
+         wal_spare_fill(spare_workers, spare, segsize);
+      }
+   }
+
+   if (config->storage_engine & (STORAGE_ENGINE_S3 | STORAGE_ENGINE_AZURE))
+   {
+      upload_queue = pgmoneta_get_server_wal_upload(srv);
+      if (pgmoneta_mkdir(upload_queue) || pgmoneta_workers_initialize(1, &upload_workers))
+      {
+         pgmoneta_log_warn("Unable to upload WAL segments for %s", config->common.servers[srv].name);
+         free(upload_queue);
+         upload_queue = NULL;
+      }
+      else
+      {
+         // upload what was left in the queue by an earlier run
+         pgmoneta_wal_upload(upload_workers, srv, d, upload_queue, NULL);
+      }
+   }
+
+   summaries = pgmoneta_get_server_wal_summary(srv);
+   if (pgmoneta_mkdir(summaries) || pgmoneta_workers_initialize(1, &summary_workers))
+   {
+      pgmoneta_log_warn("Unable to summarize WAL segments for %s", config->common.servers[srv].name);
+      free(summaries);
+      summaries = NULL;
+   }
+
+   if (config->common.servers[srv].hot_standby_replay && strlen(config->common.servers[srv].hot_standby) > 0)
+   {
+      if (pgmoneta_workers_initialize(1, &standby_workers))
+      {
+         pgmoneta_log_warn("Unable to feed WAL segments to the hot standby for %s", config->common.servers[srv].name);
+      }
+   }
+
+   if (config->wal_inline_compression)
+   {
+      if (config->compression_type != COMPRESSION_CLIENT_ZSTD && config->compression_type != COMPRESSION_SERVER_ZSTD)
+      {
+         pgmoneta_log_warn("Inline WAL compression requires zstd compression for %s", config->common.servers[srv].name);
+      }
+      else if (wal_inline_create(segsize, &inline_compression))
+      {
+         pgmoneta_log_warn("Unable to compress WAL inline for %s", config->common.servers[srv].name);
+      }
+   }
+
    if (pgmoneta_art_create(&nodes))
    {
       goto error;
@@ -201,6 +549,8 @@ pgmoneta_wal(int srv, char** argv)
       pgmoneta_log_warn("Unable to create WAL shipping directory");
    }
 
+   atomic_store(&config->common.servers[srv].wal_restart, false);
+
    auth = pgmoneta_server_authenticate(srv, "postgres", config->common.users[usr].username, config->common.users[usr].password, true, &ssl, &socket);
 
    if (auth != AUTH_SUCCESS)
@@ -232,7 +582,12 @@ pgmoneta_wal(int srv, char** argv)
    }
    config->common.servers[srv].cur_timeline = cur_timeline;
 
-   wal_find_streaming_start(d, segsize, &timeline, &high32, &low32);
+   // a restarted receiver resumes where the previous one stopped, the directory
+   // is only scanned when the position isn't known
+   if (!wal_resume_load(srv, segsize, &timeline, &high32, &low32))
+   {
+      wal_find_streaming_start(d, segsize, &timeline, &high32, &low32);
+   }
    if (timeline == 0)
    {
       read_replication = (config->common.servers[srv].version >= 15) ? 1 : 0;
@@ -271,7 +626,10 @@ pgmoneta_wal(int srv, char** argv)
    pgmoneta_free_query_response(identify_system_response);
    identify_system_response = NULL;
 
-   while (config->running)
+   clock_gettime(CLOCK_MONOTONIC, &last_commit);
+   clock_gettime(CLOCK_MONOTONIC, &last_report);
+
+   while (wal_running(srv))
    {
       if (wal_fetch_history(d, timeline, ssl, socket))
       {
@@ -279,6 +637,11 @@ pgmoneta_wal(int srv, char** argv)
          goto error;
       }
 
+      // parse the history once into the cache for the readers of the lineage
+      pgmoneta_get_timeline_history(srv, timeline, &history);
+      pgmoneta_free_timeline_history(history);
+      history = NULL;
+
       snprintf(cmd, sizeof(cmd), "%X/%X", high32, low32);
 
       pgmoneta_create_start_replication_message(cmd, timeline, config->common.servers[srv].wal_slot, &start_replication_msg);
@@ -291,6 +654,8 @@ pgmoneta_wal(int srv, char** argv)
          goto error;
       }
 
+      wal_resume_store(srv, timeline, ((uint64_t)high32 << 32) | low32);
+
       // assign xlogpos at the beginning of the streaming to LSN
       memset(config->common.servers[srv].current_wal_lsn, 0, MISC_LENGTH);
       snprintf(config->common.servers[srv].current_wal_lsn, MISC_LENGTH, "%s", cmd);
@@ -299,7 +664,7 @@ pgmoneta_wal(int srv, char** argv)
 
       // wait for the CopyBothResponse message
 
-      while (config->running && (msg == NULL || type != 'W'))
+      while (wal_running(srv) && (msg == NULL || type != 'W'))
       {
          ret = pgmoneta_consume_copy_stream_start(ssl, socket, buffer, msg, NULL);
          if (ret != 1)
@@ -320,8 +685,42 @@ pgmoneta_wal(int srv, char** argv)
       type = 0;
 
       // start streaming current timeline's WAL segments
-      while (config->running)
+      while (wal_running(srv))
       {
+         // the received data is drained, so commit what is pending and report the
+         // flush position before waiting, or reply from the timer when idle
+         while (wal_running(srv) && buffer->cursor >= buffer->end)
+         {
+            if (wal_readable(ssl, socket, wal_idle_timeout(pending, &last_commit, &last_report)))
+            {
+               break;
+            }
+
+            if (pending > 0 && (config->wal_flush_interval <= 0 || wal_commit_due(pending, &last_commit)))
+            {
+               if (wal_commit(srv, wal_file, wal_shipping_file))
+               {
+                  pgmoneta_log_error("Could not sync WAL file %s", filename);
+                  goto error;
+               }
+               flushptr = xlogptr;
+               pending = 0;
+               clock_gettime(CLOCK_MONOTONIC, &last_commit);
+               pgmoneta_prometheus_wal_flushed(srv, flushptr, pending_since);
+            }
+
+            if (flushptr != reportptr ||
+                (config->wal_status_interval > 0 && wal_elapsed(&last_report) >= (int64_t)config->wal_status_interval * 1000))
+            {
+               if (wal_send_status_report(srv, ssl, socket, xlogptr, flushptr, 0))
+               {
+                  goto error;
+               }
+               reportptr = flushptr;
+               clock_gettime(CLOCK_MONOTONIC, &last_report);
+            }
+         }
+
          ret = pgmoneta_consume_copy_stream_start(ssl, socket, buffer, msg, NULL);
          if (ret == 0)
          {
@@ -357,8 +756,15 @@ pgmoneta_wal(int srv, char** argv)
                      pgmoneta_log_error("Incomplete CopyData payload");
                      goto error;
                   }
+                  received = pgmoneta_prometheus_now();
+                  pgmoneta_bandwidth_wal(msg->length);
+                  if (pending == 0 && (inline_compression == NULL || wal_file == NULL))
+                  {
+                     pending_since = received;
+                  }
                   xlogptr = pgmoneta_read_int64(msg->data + 1);
                   xlogoff = wal_xlog_offset(xlogptr, segsize);
+                  PGMONETA_TRACE3(wal_message, srv, xlogptr, msg->length);
 
                   if (wal_file == NULL)
                   {
@@ -371,14 +777,16 @@ pgmoneta_wal(int srv, char** argv)
                      segno = xlogptr / segsize;
                      curr_xlogoff = 0;
                      filename = wal_file_name(timeline, segno, segsize);
-                     if ((wal_file = wal_open(d, filename, segsize)) == NULL)
+                     if ((wal_file = wal_open(d, spare, filename, segsize)) == NULL)
                      {
                         pgmoneta_log_error("Could not create or open WAL segment file at %s", d);
                         goto error;
                      }
+                     wal_spare_fill(spare_workers, spare, segsize);
+                     wal_inline_reset(inline_compression);
                      memset(config->common.servers[srv].current_wal_filename, 0, MISC_LENGTH);
                      snprintf(config->common.servers[srv].current_wal_filename, MISC_LENGTH, "%s.partial", filename);
-                     if ((wal_shipping_file = wal_open(wal_shipping, filename, segsize)) == NULL)
+                     if ((wal_shipping_file = wal_open(wal_shipping, NULL, filename, segsize)) == NULL)
                      {
                         if (wal_shipping != NULL)
                         {
@@ -414,32 +822,43 @@ pgmoneta_wal(int srv, char** argv)
                      {
                         bytes_to_write = bytes_left;
                      }
-                     if (bytes_to_write != fwrite(msg->data + hdrlen + bytes_written, 1, bytes_to_write, wal_file))
+                     // with inline compression the raw segment is not written
+                     if (wal_write(srv, inline_compression == NULL ? wal_file : NULL, wal_shipping_file, msg->data + hdrlen + bytes_written, bytes_to_write))
                      {
                         pgmoneta_log_error("Could not write %d bytes to WAL file %s", bytes_to_write, filename);
                         goto error;
                      }
-                     if (sftp_wal_file != NULL)
+                     if (wal_inline_write(inline_compression, msg->data + hdrlen + bytes_written, bytes_to_write))
                      {
-                        sftp_write(sftp_wal_file, msg->data + hdrlen + bytes_written, bytes_to_write);
+                        pgmoneta_log_error("Inline WAL compression failed for %s", filename);
+                        goto error;
                      }
-
-                     if (wal_shipping_file != NULL)
+                     if (sftp_wal_file != NULL)
                      {
-                        fwrite(msg->data + hdrlen + bytes_written, 1, bytes_to_write, wal_shipping_file);
+                        sftp_write(sftp_wal_file, msg->data + hdrlen + bytes_written, bytes_to_write);
                      }
 
                      bytes_written += bytes_to_write;
                      bytes_left -= bytes_to_write;
+                     pending += bytes_to_write;
                      xlogptr += bytes_written;
                      xlogoff += bytes_written;
                      curr_xlogoff += bytes_written;
 
                      if (wal_xlog_offset(xlogptr, segsize) == 0)
                      {
-                        // the end of WAL segment
-                        fflush(wal_file);
-                        wal_close(d, filename, false, wal_file);
+                        // the end of WAL segment, always a commit point
+                        close_start = pgmoneta_prometheus_now();
+                        if (wal_complete(srv, inline_compression, d, filename, segsize, wal_file, wal_shipping_file))
+                        {
+                           goto error;
+                        }
+                        pgmoneta_prometheus_wal(srv, WAL_PHASE_CLOSE, close_start);
+                        flushptr = xlogptr;
+                        pending = 0;
+                        wal_resume_store(srv, timeline, xlogptr);
+                        pgmoneta_prometheus_wal_flushed(srv, flushptr, pending_since);
+                        pending_since = received;
                         if (sftp_wal_file != NULL)
                         {
                            pgmoneta_sftp_wal_close(srv, filename, false, &sftp_wal_file);
@@ -449,10 +868,13 @@ pgmoneta_wal(int srv, char** argv)
                         wal_file = NULL;
                         if (wal_shipping_file != NULL)
                         {
-                           fflush(wal_shipping_file);
                            wal_close(wal_shipping, filename, false, wal_shipping_file);
                            wal_shipping_file = NULL;
                         }
+                        pgmoneta_storage_changed(srv);
+                        pgmoneta_wal_upload(upload_workers, srv, d, upload_queue, filename);
+                        wal_summarize(summary_workers, srv, d, summaries, filename);
+                        wal_standby(standby_workers, srv, d, filename);
                         free(filename);
                         filename = NULL;
 
@@ -465,14 +887,16 @@ pgmoneta_wal(int srv, char** argv)
                            segno = xlogptr / segsize;
                            curr_xlogoff = 0;
                            filename = wal_file_name(timeline, segno, segsize);
-                           if ((wal_file = wal_open(d, filename, segsize)) == NULL)
+                           if ((wal_file = wal_open(d, spare, filename, segsize)) == NULL)
                            {
                               pgmoneta_log_error("Could not create or open WAL segment file at %s", d);
                               goto error;
                            }
+                           wal_spare_fill(spare_workers, spare, segsize);
+                           wal_inline_reset(inline_compression);
                            memset(config->common.servers[srv].current_wal_filename, 0, MISC_LENGTH);
                            snprintf(config->common.servers[srv].current_wal_filename, MISC_LENGTH, "%s.partial", filename);
-                           if ((wal_shipping_file = wal_open(wal_shipping, filename, segsize)) == NULL)
+                           if ((wal_shipping_file = wal_open(wal_shipping, NULL, filename, segsize)) == NULL)
                            {
                               if (wal_shipping != NULL)
                               {
@@ -487,15 +911,21 @@ pgmoneta_wal(int srv, char** argv)
                                  goto error;
                               }
                            }
+                           if (wal_write(srv, inline_compression == NULL ? wal_file : NULL, wal_shipping_file, msg->data + hdrlen + bytes_written, bytes_left))
+                           {
+                              pgmoneta_log_error("Could not write %d bytes to WAL file %s", bytes_left, filename);
+                              goto error;
+                           }
                            curr_xlogoff += bytes_left;
-                           fwrite(msg->data + hdrlen + bytes_written, 1, bytes_left, wal_file);
-                           if (sftp_wal_file != NULL)
+                           pending += bytes_left;
+                           if (wal_inline_write(inline_compression, msg->data + hdrlen + bytes_written, bytes_left))
                            {
-                              sftp_write(sftp_wal_file, msg->data + hdrlen + bytes_written, bytes_left);
+                              pgmoneta_log_error("Inline WAL compression failed for %s", filename);
+                              goto error;
                            }
-                           if (wal_shipping_file != NULL)
+                           if (sftp_wal_file != NULL)
                            {
-                              fwrite(msg->data + hdrlen + bytes_written, 1, bytes_left, wal_shipping_file);
+                              sftp_write(sftp_wal_file, msg->data + hdrlen + bytes_written, bytes_left);
                            }
                            bytes_left = 0;
                         }
@@ -504,14 +934,69 @@ pgmoneta_wal(int srv, char** argv)
                   }
                   // update LSN after a message data is written to the segment
                   update_wal_lsn(srv, xlogptr);
+                  pgmoneta_prometheus_wal_received(srv, xlogptr, msg->length - hdrlen, received);
+
+                  if (inline_compression != NULL)
+                  {
+                     // the compressed segment is the durable artifact, so the flush
+                     // position only advances when the segment is complete
+                     pending = 0;
+                  }
+                  else if (wal_commit_due(pending, &last_commit))
+                  {
+                     if (wal_commit(srv, wal_file, wal_shipping_file))
+                     {
+                        pgmoneta_log_error("Could not sync WAL file %s", filename);
+                        goto error;
+                     }
+                     flushptr = xlogptr;
+                     pending = 0;
+                     clock_gettime(CLOCK_MONOTONIC, &last_commit);
+                     pgmoneta_prometheus_wal_flushed(srv, flushptr, pending_since);
+                  }
+                  else if (!wal_group_commit())
+                  {
+                     // without group commit the flush position follows the received WAL,
+                     // and the segment is synced when it is complete
+                     flushptr = xlogptr;
+                     pending = 0;
+                     pgmoneta_prometheus_wal_flushed(srv, flushptr, pending_since);
+                  }
 
-                  wal_send_status_report(ssl, socket, xlogptr, xlogptr, 0);
+                  // under load the reports are coalesced until enough WAL is flushed,
+                  // the rest is reported once the received data is drained
+                  if (flushptr != reportptr && flushptr - reportptr >= (size_t)config->wal_status_size)
+                  {
+                     wal_send_status_report(srv, ssl, socket, xlogptr, flushptr, 0);
+                     reportptr = flushptr;
+                     clock_gettime(CLOCK_MONOTONIC, &last_report);
+                  }
                   break;
                }
                case 'k':
                {
-                  // keep alive request
-                  wal_send_status_report(ssl, socket, xlogptr, xlogptr, 0);
+                  // keep alive, the server only waits for a reply when it is requested,
+                  // otherwise the timer and the flush progress drive the reports
+                  if (msg->length < 18 || *((char*)msg->data + 17) == 0)
+                  {
+                     break;
+                  }
+                  // flush whatever is pending so the reported flush position is as recent as possible
+                  if (pending > 0)
+                  {
+                     if (wal_commit(srv, wal_file, wal_shipping_file))
+                     {
+                        pgmoneta_log_error("Could not sync WAL file %s", filename);
+                        goto error;
+                     }
+                     flushptr = xlogptr;
+                     pending = 0;
+                     clock_gettime(CLOCK_MONOTONIC, &last_commit);
+                     pgmoneta_prometheus_wal_flushed(srv, flushptr, pending_since);
+                  }
+                  wal_send_status_report(srv, ssl, socket, xlogptr, flushptr, 0);
+                  reportptr = flushptr;
+                  clock_gettime(CLOCK_MONOTONIC, &last_report);
                   break;
                }
                default:
@@ -526,8 +1011,20 @@ pgmoneta_wal(int srv, char** argv)
             pgmoneta_send_copy_done_message(ssl, socket);
             if (wal_file != NULL)
             {
+               if (pending == 0)
+               {
+                  pending_since = pgmoneta_prometheus_now();
+               }
                // Next file would be at a new timeline, so we treat the current wal file completed
-               wal_close(d, filename, false, wal_file);
+               close_start = pgmoneta_prometheus_now();
+               if (wal_complete(srv, inline_compression, d, filename, segsize, wal_file, wal_shipping_file))
+               {
+                  goto error;
+               }
+               pgmoneta_prometheus_wal(srv, WAL_PHASE_CLOSE, close_start);
+               flushptr = xlogptr;
+               pending = 0;
+               pgmoneta_prometheus_wal_flushed(srv, flushptr, pending_since);
                wal_file = NULL;
                wal_close(wal_shipping, filename, false, wal_shipping_file);
                wal_shipping_file = NULL;
@@ -536,6 +1033,10 @@ pgmoneta_wal(int srv, char** argv)
                   pgmoneta_sftp_wal_close(srv, filename, false, &sftp_wal_file);
                   sftp_wal_file = NULL;
                }
+               pgmoneta_storage_changed(srv);
+               pgmoneta_wal_upload(upload_workers, srv, d, upload_queue, filename);
+               wal_summarize(summary_workers, srv, d, summaries, filename);
+               wal_standby(standby_workers, srv, d, filename);
             }
             pgmoneta_consume_copy_stream_end(buffer, msg);
             break;
@@ -544,7 +1045,7 @@ pgmoneta_wal(int srv, char** argv)
       }
       // there should be a DataRow message followed by a CommandComplete messages,
       // receive them and parse the next timeline and xlogpos from it
-      if (!config->running)
+      if (!wal_running(srv))
       {
          break;
       }
@@ -560,9 +1061,10 @@ pgmoneta_wal(int srv, char** argv)
          goto error;
       }
       xlogpos = NULL;
+      config->common.servers[srv].cur_timeline = timeline;
       // receive the last command complete message
       msg->kind = '\0';
-      while (config->running && msg->kind != 'C')
+      while (wal_running(srv) && msg->kind != 'C')
       {
          pgmoneta_consume_copy_stream_start(ssl, socket, buffer, msg, NULL);
          pgmoneta_consume_copy_stream_end(buffer, msg);
@@ -583,6 +1085,8 @@ pgmoneta_wal(int srv, char** argv)
    if (wal_file != NULL)
    {
       bool partial = (wal_xlog_offset(xlogptr, segsize) != 0);
+      // a partially compressed segment is streamed again after a restart
+      wal_commit(srv, inline_compression == NULL ? wal_file : NULL, wal_shipping_file);
       wal_close(d, filename, partial, wal_file);
       wal_close(wal_shipping, filename, partial, wal_shipping_file);
       if (sftp_wal_file != NULL)
@@ -590,6 +1094,13 @@ pgmoneta_wal(int srv, char** argv)
          pgmoneta_sftp_wal_close(srv, filename, partial, &sftp_wal_file);
          sftp_wal_file = NULL;
       }
+      pgmoneta_storage_changed(srv);
+      if (!partial)
+      {
+         pgmoneta_wal_upload(upload_workers, srv, d, upload_queue, filename);
+         wal_summarize(summary_workers, srv, d, summaries, filename);
+         wal_standby(standby_workers, srv, d, filename);
+      }
    }
 
    current = head;
@@ -600,8 +1111,17 @@ pgmoneta_wal(int srv, char** argv)
       current = current->next;
    }
 
-   pgmoneta_memory_destroy();
-   pgmoneta_stop_logging();
+   pgmoneta_workers_wait(spare_workers);
+   pgmoneta_workers_destroy(spare_workers);
+
+   pgmoneta_workers_wait(upload_workers);
+   pgmoneta_workers_destroy(upload_workers);
+
+   pgmoneta_workers_wait(summary_workers);
+   pgmoneta_workers_destroy(summary_workers);
+
+   pgmoneta_workers_wait(standby_workers);
+   pgmoneta_workers_destroy(standby_workers);
 
    pgmoneta_free_message(identify_system_msg);
    pgmoneta_free_message(start_replication_msg);
@@ -612,15 +1132,21 @@ pgmoneta_wal(int srv, char** argv)
    pgmoneta_free_message(msg);
    pgmoneta_free_query_response(identify_system_response);
    pgmoneta_free_query_response(end_of_timeline_response);
+   pgmoneta_free_timeline_history(history);
    pgmoneta_memory_stream_buffer_free(buffer);
 
    pgmoneta_art_destroy(nodes);
 
    free(d);
+   free(spare);
+   free(upload_queue);
+   free(summaries);
+   wal_inline_destroy(inline_compression);
    free(wal_shipping);
    free(filename);
    free(xlogpos);
-   exit(0);
+
+   return 0;
 
 error:
    config->common.servers[srv].wal_streaming = false;
@@ -632,6 +1158,7 @@ error:
 
    if (wal_file != NULL)
    {
+      wal_commit(srv, inline_compression == NULL ? wal_file : NULL, wal_shipping_file);
       wal_close(d, filename, true, wal_file);
       wal_close(wal_shipping, filename, true, wal_shipping_file);
    }
@@ -649,6 +1176,7 @@ error:
    pgmoneta_free_message(msg);
    pgmoneta_free_query_response(identify_system_response);
    pgmoneta_free_query_response(end_of_timeline_response);
+   pgmoneta_free_timeline_history(history);
    pgmoneta_memory_stream_buffer_free(buffer);
 
    current = head;
@@ -659,16 +1187,30 @@ error:
       current = current->next;
    }
 
-   pgmoneta_memory_destroy();
-   pgmoneta_stop_logging();
+   pgmoneta_workers_wait(spare_workers);
+   pgmoneta_workers_destroy(spare_workers);
+
+   pgmoneta_workers_wait(upload_workers);
+   pgmoneta_workers_destroy(upload_workers);
+
+   pgmoneta_workers_wait(summary_workers);
+   pgmoneta_workers_destroy(summary_workers);
+
+   pgmoneta_workers_wait(standby_workers);
+   pgmoneta_workers_destroy(standby_workers);
 
    pgmoneta_art_destroy(nodes);
 
    free(d);
+   free(spare);
+   free(upload_queue);
+   free(summaries);
+   wal_inline_destroy(inline_compression);
    free(wal_shipping);
    free(filename);
    free(xlogpos);
-   exit(1);
+
+   return 1;
 }
 
 static int
@@ -753,6 +1295,11 @@ pgmoneta_get_timeline_history(int srv, uint32_t tli, struct timeline_history** h
       return 0;
    }
 
+   if (!wal_cached_history(srv, tli, history))
+   {
+      return 0;
+   }
+
    snprintf(filename, sizeof(filename), "%08X.history", tli);
    path = pgmoneta_get_server_wal(srv);
    path = pgmoneta_append(path, filename);
@@ -803,6 +1350,8 @@ pgmoneta_get_timeline_history(int srv, uint32_t tli, struct timeline_history** h
       memset(buffer, 0, sizeof(buffer));
    }
 
+   wal_cache_history(srv, tli, h);
+
    *history = h;
 
    free(path);
@@ -868,7 +1417,11 @@ wal_fetch_history(char* basedir, int timeline, SSL* ssl, int socket)
    memset(path, 0, sizeof(path));
    if (pgmoneta_ends_with(basedir, "/"))
    {
-      snprintf(path, sizeof(path), "%s%08x.history", basedir, timeline);
+      snprintf(path, sizeof(path), "%s%08X.history", basedir, timeline);
+   }
+   else
+   {
+      snprintf(path, sizeof(path), "%s/%08X.history", basedir, timeline);
    }
 
    // do nothing if the corresponding .history already exists, or current timeline is 1
@@ -913,7 +1466,7 @@ error:
 }
 
 static FILE*
-wal_open(char* root, char* filename, int segsize)
+wal_open(char* root, char* spare, char* filename, int segsize)
 {
    if (root == NULL || strlen(root) == 0 || !pgmoneta_exists(root))
    {
@@ -921,6 +1474,9 @@ wal_open(char* root, char* filename, int segsize)
    }
    char* path = NULL;
    FILE* file = NULL;
+
+   PGMONETA_TRACE2(wal_segment_open, root, filename);
+
    path = pgmoneta_append(path, root);
    if (!pgmoneta_ends_with(path, "/"))
    {
@@ -956,6 +1512,21 @@ wal_open(char* root, char* filename, int segsize)
       }
    }
 
+   if (wal_spare_take(spare, path, segsize))
+   {
+      file = fopen(path, "r+b");
+      if (file == NULL)
+      {
+         pgmoneta_log_error("WAL error: %s", strerror(errno));
+         errno = 0;
+         goto error;
+      }
+      pgmoneta_permission(path, 6, 0, 0);
+
+      free(path);
+      return file;
+   }
+
    file = fopen(path, "wb");
 
    if (file == NULL)
@@ -994,6 +1565,8 @@ wal_close(char* root, char* filename, bool partial, FILE* file)
    char tmp_file_path[MAX_PATH] = {0};
    char file_path[MAX_PATH] = {0};
 
+   PGMONETA_TRACE3(wal_segment_close, root, filename, partial);
+
    if (partial)
    {
       pgmoneta_log_info("Not renaming %s.partial, this segment is incomplete", filename);
@@ -1037,6 +1610,14 @@ wal_prepare(FILE* file, int segsize)
       return 1;
    }
 
+#if defined(HAVE_LINUX) || defined(HAVE_FREEBSD)
+   // allocated but unwritten extents read back as zeros
+   if (posix_fallocate(fileno(file), 0, segsize) == 0)
+   {
+      written = segsize;
+   }
+#endif
+
    while (written < (size_t)segsize)
    {
       written += fwrite(buffer, 1, sizeof(buffer), file);
@@ -1052,8 +1633,1110 @@ wal_prepare(FILE* file, int segsize)
    return 0;
 }
 
-static int
-wal_send_status_report(SSL* ssl, int socket, int64_t received, int64_t flushed, int64_t applied)
+static bool
+wal_spare_take(char* spare, char* path, int segsize)
+{
+   struct main_configuration* config = (struct main_configuration*) shmem;
+   char from[MAX_PATH];
+
+   if (spare == NULL)
+   {
+      return false;
+   }
+
+   for (int i = 0; i < config->wal_preallocate; i++)
+   {
+      memset(from, 0, sizeof(from));
+      snprintf(from, sizeof(from), "%s%s%d", spare, WAL_SPARE_PREFIX, i);
+
+      if (!pgmoneta_exists(from))
+      {
+         continue;
+      }
+
+      if (pgmoneta_get_file_size(from) != (size_t)segsize)
+      {
+         // left over from a different segment size
+         unlink(from);
+         continue;
+      }
+
+      if (rename(from, path) == 0)
+      {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+static void
+wal_spare_fill(struct workers* workers, char* spare, int segsize)
+{
+   struct main_configuration* config = (struct main_configuration*) shmem;
+   struct wal_spare_input* wsi = NULL;
+
+   if (workers == NULL || spare == NULL)
+   {
+      return;
+   }
+
+   wsi = (struct wal_spare_input*)malloc(sizeof(struct wal_spare_input));
+   if (wsi == NULL)
+   {
+      return;
+   }
+
+   memset(wsi, 0, sizeof(struct wal_spare_input));
+   memcpy(wsi->directory, spare, MIN(strlen(spare), (size_t)MAX_PATH - 1));
+   wsi->segsize = segsize;
+   wsi->count = config->wal_preallocate;
+   wsi->common.workers = workers;
+
+   if (pgmoneta_workers_add(workers, do_wal_spare_fill, (struct worker_common*)wsi))
+   {
+      free(wsi);
+   }
+}
+
+static void
+do_wal_spare_fill(struct worker_common* wc)
+{
+   struct wal_spare_input* wsi = (struct wal_spare_input*)wc;
+   char tmp[MAX_PATH];
+   char to[MAX_PATH];
+   FILE* file = NULL;
+
+   for (int i = 0; i < wsi->count; i++)
+   {
+      memset(to, 0, sizeof(to));
+      snprintf(to, sizeof(to), "%s%s%d", wsi->directory, WAL_SPARE_PREFIX, i);
+
+      if (pgmoneta_exists(to))
+      {
+         continue;
+      }
+
+      memset(tmp, 0, sizeof(tmp));
+      snprintf(tmp, sizeof(tmp), "%s.tmp", to);
+
+      file = fopen(tmp, "wb");
+      if (file == NULL)
+      {
+         pgmoneta_log_debug("Unable to create spare WAL segment %s: %s", tmp, strerror(errno));
+         errno = 0;
+         break;
+      }
+
+      if (wal_prepare(file, wsi->segsize) || wal_sync(file))
+      {
+         fclose(file);
+         unlink(tmp);
+         break;
+      }
+
+      fclose(file);
+      file = NULL;
+
+      if (rename(tmp, to) != 0)
+      {
+         unlink(tmp);
+         break;
+      }
+   }
+
+   free(wsi);
+}
+
+void
+pgmoneta_wal_upload(struct workers* workers, int srv, char* directory, char* queue, char* filename)
+{
+   char path[MAX_PATH];
+   int fd = -1;
+   struct wal_upload_input* wui = NULL;
+
+   if (workers == NULL || queue == NULL)
+   {
+      return;
+   }
+
+   // the queue entry is the record of the upload, so it is made durable first
+   if (filename != NULL)
+   {
+      memset(path, 0, sizeof(path));
+      snprintf(path, sizeof(path), "%s%s", queue, filename);
+
+      fd = open(path, O_WRONLY | O_CREAT, 0600);
+      if (fd == -1)
+      {
+         pgmoneta_log_warn("Unable to queue %s for upload: %s", filename, strerror(errno));
+         errno = 0;
+         return;
+      }
+      close(fd);
+
+      fd = open(queue, O_RDONLY);
+      if (fd != -1)
+      {
+         fsync(fd);
+         close(fd);
+      }
+   }
+
+   // a task that hasn't started yet picks up the new entry, so the receiver never waits
+   if (atomic_exchange(&wal_upload_pending[srv], true))
+   {
+      return;
+   }
+
+   wui = (struct wal_upload_input*)malloc(sizeof(struct wal_upload_input));
+   if (wui == NULL)
+   {
+      atomic_store(&wal_upload_pending[srv], false);
+      return;
+   }
+
+   memset(wui, 0, sizeof(struct wal_upload_input));
+   wui->server = srv;
+   memcpy(wui->directory, directory, MIN(strlen(directory), (size_t)MAX_PATH - 1));
+   memcpy(wui->queue, queue, MIN(strlen(queue), (size_t)MAX_PATH - 1));
+   wui->common.workers = workers;
+
+   if (pgmoneta_workers_add(workers, do_wal_upload, (struct worker_common*)wui))
+   {
+      atomic_store(&wal_upload_pending[srv], false);
+      free(wui);
+   }
+}
+
+static void
+do_wal_upload(struct worker_common* wc)
+{
+   struct wal_upload_input* wui = (struct wal_upload_input*)wc;
+   char path[MAX_PATH];
+   char* name = NULL;
+   bool failed = false;
+   DIR* dir = NULL;
+   struct dirent* entry;
+   struct deque* queued = NULL;
+   struct deque* files = NULL;
+   struct deque_iterator* iter = NULL;
+   struct main_configuration* config = (struct main_configuration*) shmem;
+
+   atomic_store(&wal_upload_pending[wui->server], false);
+
+   // every task uploads all of the queue, so a failed upload is retried by the next segment
+   if (pgmoneta_deque_create(false, &queued) || pgmoneta_deque_create(false, &files))
+   {
+      goto done;
+   }
+
+   if (!(dir = opendir(wui->queue)))
+   {
+      goto done;
+   }
+
+   while ((entry = readdir(dir)) != NULL)
+   {
+      if (entry->d_type != DT_REG)
+      {
+         continue;
+      }
+
+      // the segment may have been compressed or encrypted since it was queued
+      name = wal_upload_resolve(wui->directory, entry->d_name);
+      if (name == NULL)
+      {
+         pgmoneta_log_warn("WAL segment %s is gone, skipping its upload", entry->d_name);
+         memset(path, 0, sizeof(path));
+         snprintf(path, sizeof(path), "%s%s", wui->queue, entry->d_name);
+         unlink(path);
+         continue;
+      }
+
+      pgmoneta_deque_add(queued, NULL, (uintptr_t)entry->d_name, ValueString);
+      pgmoneta_deque_add(files, NULL, (uintptr_t)name, ValueString);
+      free(name);
+      name = NULL;
+   }
+
+   closedir(dir);
+   dir = NULL;
+
+   if (pgmoneta_deque_empty(files))
+   {
+      goto done;
+   }
+
+   if ((config->storage_engine & STORAGE_ENGINE_S3) && pgmoneta_s3_wal_upload(wui->server, wui->directory, files))
+   {
+      failed = true;
+   }
+
+   if ((config->storage_engine & STORAGE_ENGINE_AZURE) && pgmoneta_azure_wal_upload(wui->server, wui->directory, files))
+   {
+      failed = true;
+   }
+
+   if (failed)
+   {
+      pgmoneta_log_warn("Unable to upload %u WAL segments for %s, retrying with the next segment",
+                        pgmoneta_deque_size(files), config->common.servers[wui->server].name);
+      goto done;
+   }
+
+   if (pgmoneta_deque_iterator_create(queued, &iter))
+   {
+      goto done;
+   }
+
+   while (pgmoneta_deque_iterator_next(iter))
+   {
+      memset(path, 0, sizeof(path));
+      snprintf(path, sizeof(path), "%s%s", wui->queue, (char*)pgmoneta_value_data(iter->value));
+      unlink(path);
+   }
+
+done:
+
+   if (dir != NULL)
+   {
+      closedir(dir);
+   }
+
+   pgmoneta_deque_iterator_destroy(iter);
+   pgmoneta_deque_destroy(queued);
+   pgmoneta_deque_destroy(files);
+
+   free(wui);
+}
+
+static void
+wal_summarize(struct workers* workers, int srv, char* directory, char* summaries, char* filename)
+{
+   struct wal_summary_input* wsi = NULL;
+
+   if (workers == NULL || summaries == NULL || filename == NULL)
+   {
+      return;
+   }
+
+   wsi = (struct wal_summary_input*)calloc(1, sizeof(struct wal_summary_input));
+   if (wsi == NULL)
+   {
+      return;
+   }
+
+   wsi->server = srv;
+   memcpy(wsi->directory, directory, MIN(strlen(directory), (size_t)MAX_PATH - 1));
+   memcpy(wsi->summaries, summaries, MIN(strlen(summaries), (size_t)MAX_PATH - 1));
+   memcpy(wsi->filename, filename, MIN(strlen(filename), (size_t)MAX_PATH - 1));
+   wsi->common.workers = workers;
+
+   if (pgmoneta_workers_add(workers, do_wal_summarize, (struct worker_common*)wsi))
+   {
+      free(wsi);
+   }
+}
+
+static void
+do_wal_summarize(struct worker_common* wc)
+{
+   struct wal_summary_input* wsi = (struct wal_summary_input*)wc;
+   char path[MAX_PATH];
+   char* name = NULL;
+   char* target = NULL;
+   struct wal_summary* summary = NULL;
+   int ret = 1;
+
+   // the segment may have been compressed or encrypted since it was completed
+   name = wal_upload_resolve(wsi->directory, wsi->filename);
+   if (name == NULL)
+   {
+      goto done;
+   }
+
+   memset(path, 0, sizeof(path));
+   snprintf(path, sizeof(path), "%s%s", wsi->directory, name);
+
+   // the WAL reader keeps the server of the segment being decoded in a global
+   pthread_mutex_lock(&wal_summary_lock);
+   ret = pgmoneta_wal_summary_create(path, wsi->server, &summary);
+   pthread_mutex_unlock(&wal_summary_lock);
+
+   if (ret)
+   {
+      goto done;
+   }
+
+   target = pgmoneta_wal_summary_path(wsi->summaries, wsi->filename);
+   ret = pgmoneta_wal_summary_write(summary, target);
+
+done:
+
+   // a missing summary only means that lookups read the segment
+   if (ret)
+   {
+      pgmoneta_log_debug("Unable to summarize WAL segment %s", wsi->filename);
+   }
+
+   free(summary);
+   free(target);
+   free(name);
+   free(wsi);
+}
+
+int
+pgmoneta_wal_hot_standby(int srv, char* directory, char* filename)
+{
+   char path[MAX_PATH];
+   char target[MAX_PATH];
+   char tmp[MAX_PATH];
+   char* name = NULL;
+   FILE* file = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   memset(path, 0, sizeof(path));
+   snprintf(path, sizeof(path), "%s%s%s/pg_wal", config->common.servers[srv].hot_standby,
+            pgmoneta_ends_with(config->common.servers[srv].hot_standby, "/") ? "" : "/",
+            config->common.servers[srv].name);
+
+   // nothing to feed until the hot standby has been created by a backup
+   if (!pgmoneta_is_directory(path))
+   {
+      return 0;
+   }
+
+   memset(target, 0, sizeof(target));
+   snprintf(target, sizeof(target), "%s/%s", path, filename);
+
+   memset(tmp, 0, sizeof(tmp));
+   snprintf(tmp, sizeof(tmp), "%s.pgmoneta", target);
+
+   // the segment may have been compressed or encrypted since it was completed
+   name = wal_upload_resolve(directory, filename);
+   if (name == NULL)
+   {
+      goto error;
+   }
+
+   // each refresh replays the same recent segments
+   if (pgmoneta_wal_cache_restore(srv, directory, name, tmp))
+   {
+      goto error;
+   }
+
+   file = fopen(tmp, "ab");
+   if (file == NULL)
+   {
+      goto error;
+   }
+
+   if (wal_sync(file) || fsync(fileno(file)))
+   {
+      goto error;
+   }
+
+   fclose(file);
+   file = NULL;
+
+   // PostgreSQL only sees the segment once it is complete
+   if (rename(tmp, target))
+   {
+      goto error;
+   }
+
+   free(name);
+
+   return 0;
+
+error:
+
+   pgmoneta_log_warn("Unable to feed WAL segment %s to the hot standby of %s", filename, config->common.servers[srv].name);
+
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+   unlink(tmp);
+
+   free(name);
+
+   return 1;
+}
+
+static void
+wal_standby(struct workers* workers, int srv, char* directory, char* filename)
+{
+   struct wal_standby_input* wsi = NULL;
+
+   if (workers == NULL || filename == NULL)
+   {
+      return;
+   }
+
+   wsi = (struct wal_standby_input*)calloc(1, sizeof(struct wal_standby_input));
+   if (wsi == NULL)
+   {
+      return;
+   }
+
+   wsi->server = srv;
+   memcpy(wsi->directory, directory, MIN(strlen(directory), (size_t)MAX_PATH - 1));
+   memcpy(wsi->filename, filename, MIN(strlen(filename), (size_t)MAX_PATH - 1));
+   wsi->common.workers = workers;
+
+   if (pgmoneta_workers_add(workers, do_wal_standby, (struct worker_common*)wsi))
+   {
+      free(wsi);
+   }
+}
+
+static void
+do_wal_standby(struct worker_common* wc)
+{
+   struct wal_standby_input* wsi = (struct wal_standby_input*)wc;
+
+   pgmoneta_wal_hot_standby(wsi->server, wsi->directory, wsi->filename);
+
+   free(wsi);
+}
+
+static char*
+wal_upload_resolve(char* directory, char* filename)
+{
+   char path[MAX_PATH];
+   char* name = NULL;
+   char* compression[] = {"", ".zstd", ".lz4", ".bz2", ".gz"};
+   char* encryption[] = {"", ".aes"};
+
+   for (int i = 0; i < (int)(sizeof(compression) / sizeof(compression[0])); i++)
+   {
+      for (int j = 0; j < (int)(sizeof(encryption) / sizeof(encryption[0])); j++)
+      {
+         memset(path, 0, sizeof(path));
+         snprintf(path, sizeof(path), "%s%s%s%s", directory, filename, compression[i], encryption[j]);
+
+         if (pgmoneta_exists(path))
+         {
+            name = pgmoneta_append(name, filename);
+            name = pgmoneta_append(name, compression[i]);
+            name = pgmoneta_append(name, encryption[j]);
+
+            return name;
+         }
+      }
+   }
+
+   return NULL;
+}
+
+static int
+wal_sync(FILE* file)
+{
+   if (file == NULL)
+   {
+      return 0;
+   }
+
+   if (fflush(file) != 0)
+   {
+      pgmoneta_log_error("WAL error: %s", strerror(errno));
+      errno = 0;
+      return 1;
+   }
+
+#if defined(HAVE_LINUX)
+   if (fdatasync(fileno(file)) != 0)
+#else
+   if (fsync(fileno(file)) != 0)
+#endif
+   {
+      pgmoneta_log_error("WAL error: %s", strerror(errno));
+      errno = 0;
+      return 1;
+   }
+
+   return 0;
+}
+
+static int
+wal_write(int srv, FILE* file, FILE* shipping, void* data, size_t size)
+{
+   uint64_t start;
+
+   start = pgmoneta_prometheus_now();
+
+   if (file != NULL && size != fwrite(data, 1, size, file))
+   {
+      return 1;
+   }
+
+   if (shipping != NULL)
+   {
+      fwrite(data, 1, size, shipping);
+   }
+
+   pgmoneta_prometheus_wal(srv, WAL_PHASE_WRITE, start);
+
+   return 0;
+}
+
+static int
+wal_commit(int srv, FILE* file, FILE* shipping)
+{
+   int ret;
+   uint64_t start;
+
+   PGMONETA_TRACE1(wal_sync_start, srv);
+
+   start = pgmoneta_prometheus_now();
+   ret = wal_sync(file);
+   wal_sync(shipping);
+
+   PGMONETA_TRACE2(wal_sync_done, srv, ret);
+
+   if (file != NULL)
+   {
+      pgmoneta_prometheus_wal(srv, WAL_PHASE_SYNC, start);
+   }
+
+   return ret;
+}
+
+static int
+wal_complete(int srv, struct wal_inline* wi, char* root, char* filename, int segsize, FILE* file, FILE* shipping)
+{
+   if (wi != NULL)
+   {
+      // the raw segment only holds the place of the compressed one, so it is neither synced nor kept
+      if (wal_inline_close(wi, root, filename, segsize, file))
+      {
+         pgmoneta_log_error("Could not compress WAL file %s", filename);
+         return 1;
+      }
+      wal_commit(srv, NULL, shipping);
+
+      return 0;
+   }
+
+   if (wal_commit(srv, file, shipping))
+   {
+      pgmoneta_log_error("Could not sync WAL file %s", filename);
+      return 1;
+   }
+   wal_close(root, filename, false, file);
+
+   return 0;
+}
+
+static int
+wal_inline_create(int segsize, struct wal_inline** wi)
+{
+   int level;
+   struct wal_inline* w = NULL;
+   struct main_configuration* config = (struct main_configuration*) shmem;
+
+   *wi = NULL;
+
+   w = (struct wal_inline*)malloc(sizeof(struct wal_inline));
+   if (w == NULL)
+   {
+      goto error;
+   }
+
+   memset(w, 0, sizeof(struct wal_inline));
+
+   // the whole segment is kept in memory until it is complete
+   w->capacity = ZSTD_compressBound(segsize) + ZSTD_CStreamOutSize();
+   w->buffer = (unsigned char*)malloc(w->capacity);
+   if (w->buffer == NULL)
+   {
+      goto error;
+   }
+
+   w->cctx = ZSTD_createCCtx();
+   if (w->cctx == NULL)
+   {
+      goto error;
+   }
+
+   level = config->compression_level;
+   if (level < 1)
+   {
+      level = 1;
+   }
+   else if (level > 19)
+   {
+      level = 19;
+   }
+
+   ZSTD_CCtx_setParameter(w->cctx, ZSTD_c_compressionLevel, level);
+   ZSTD_CCtx_setParameter(w->cctx, ZSTD_c_checksumFlag, 1);
+
+   *wi = w;
+
+   return 0;
+
+error:
+
+   wal_inline_destroy(w);
+
+   return 1;
+}
+
+static void
+wal_inline_reset(struct wal_inline* wi)
+{
+   if (wi == NULL)
+   {
+      return;
+   }
+
+   ZSTD_CCtx_reset(wi->cctx, ZSTD_reset_session_only);
+   wi->size = 0;
+   wi->consumed = 0;
+}
+
+static int
+wal_inline_write(struct wal_inline* wi, void* data, size_t size)
+{
+   size_t ret;
+   ZSTD_inBuffer input = {data, size, 0};
+
+   if (wi == NULL)
+   {
+      return 0;
+   }
+
+   while (input.pos < input.size)
+   {
+      ZSTD_outBuffer output = {wi->buffer + wi->size, wi->capacity - wi->size, 0};
+
+      ret = ZSTD_compressStream2(wi->cctx, &output, &input, ZSTD_e_continue);
+      if (ZSTD_isError(ret))
+      {
+         pgmoneta_log_error("ZSTD: %s", ZSTD_getErrorName(ret));
+         return 1;
+      }
+
+      wi->size += output.pos;
+
+      if (wi->size == wi->capacity && input.pos < input.size)
+      {
+         return 1;
+      }
+   }
+
+   wi->consumed += size;
+
+   return 0;
+}
+
+static int
+wal_inline_close(struct wal_inline* wi, char* root, char* filename, int segsize, FILE* file)
+{
+   size_t ret;
+   char zeros[8192];
+   unsigned char* data = NULL;
+   size_t data_size = 0;
+   unsigned char* enc = NULL;
+   size_t enc_size = 0;
+   char tmp_file_path[MAX_PATH];
+   char file_path[MAX_PATH];
+   char partial_path[MAX_PATH];
+   FILE* out = NULL;
+   struct main_configuration* config = (struct main_configuration*) shmem;
+
+   // a segment ended by a timeline switch is still a full size segment on disk
+   memset(zeros, 0, sizeof(zeros));
+   while (wi->consumed < (size_t)segsize)
+   {
+      size_t n = MIN(sizeof(zeros), (size_t)segsize - wi->consumed);
+
+      if (wal_inline_write(wi, zeros, n))
+      {
+         goto error;
+      }
+   }
+
+   do
+   {
+      ZSTD_inBuffer input = {NULL, 0, 0};
+      ZSTD_outBuffer output = {wi->buffer + wi->size, wi->capacity - wi->size, 0};
+
+      ret = ZSTD_compressStream2(wi->cctx, &output, &input, ZSTD_e_end);
+      if (ZSTD_isError(ret))
+      {
+         pgmoneta_log_error("ZSTD: %s", ZSTD_getErrorName(ret));
+         goto error;
+      }
+
+      wi->size += output.pos;
+
+      if (ret != 0 && wi->size == wi->capacity)
+      {
+         goto error;
+      }
+   }
+   while (ret != 0);
+
+   data = wi->buffer;
+   data_size = wi->size;
+
+   memset(tmp_file_path, 0, sizeof(tmp_file_path));
+   memset(file_path, 0, sizeof(file_path));
+   memset(partial_path, 0, sizeof(partial_path));
+
+   if (config->encryption != ENCRYPTION_NONE)
+   {
+      if (pgmoneta_encrypt_file_buffer(NULL, wi->buffer, wi->size, &enc, &enc_size))
+      {
+         goto error;
+      }
+
+      data = enc;
+      data_size = enc_size;
+
+      snprintf(file_path, sizeof(file_path), "%s/%s.zstd.aes", root, filename);
+   }
+   else
+   {
+      snprintf(file_path, sizeof(file_path), "%s/%s.zstd", root, filename);
+   }
+
+   // .partial keeps the file away from the archiving and retention logic
+   snprintf(tmp_file_path, sizeof(tmp_file_path), "%s.partial", file_path);
+   snprintf(partial_path, sizeof(partial_path), "%s/%s.partial", root, filename);
+
+   out = fopen(tmp_file_path, "wb");
+   if (out == NULL)
+   {
+      pgmoneta_log_error("WAL error: %s", strerror(errno));
+      errno = 0;
+      goto error;
+   }
+
+   if (fwrite(data, 1, data_size, out) != data_size)
+   {
+      pgmoneta_log_error("Could not write %s", tmp_file_path);
+      goto error;
+   }
+
+   if (wal_sync(out))
+   {
+      goto error;
+   }
+
+   fclose(out);
+   out = NULL;
+
+   if (rename(tmp_file_path, file_path) != 0)
+   {
+      pgmoneta_log_error("could not rename file %s to %s", tmp_file_path, file_path);
+      goto error;
+   }
+
+   // the raw segment is no longer needed
+   fclose(file);
+   unlink(partial_path);
+
+   free(enc);
+   wal_inline_reset(wi);
+
+   return 0;
+
+error:
+
+   if (out != NULL)
+   {
+      fclose(out);
+      unlink(tmp_file_path);
+   }
+
+   free(enc);
+   wal_inline_reset(wi);
+
+   return 1;
+}
+
+static void
+wal_inline_destroy(struct wal_inline* wi)
+{
+   if (wi == NULL)
+   {
+      return;
+   }
+
+   ZSTD_freeCCtx(wi->cctx);
+   free(wi->buffer);
+   free(wi);
+}
+
+static bool
+wal_running(int srv)
+{
+   struct main_configuration* config = (struct main_configuration*) shmem;
+
+   // a reload with new connection settings for the server restarts the receiver
+   return config->running && !atomic_load(&config->common.servers[srv].wal_restart);
+}
+
+static int
+wal_cached_history(int srv, uint32_t tli, struct timeline_history** history)
+{
+   uint32_t t1;
+   uint32_t t2;
+   int n;
+   bool found = false;
+   struct timeline_history* h = NULL;
+   struct timeline_history* curh = NULL;
+   struct timeline_history* nexth = NULL;
+   struct timeline_cache* cache;
+   struct main_configuration* config = (struct main_configuration*) shmem;
+
+   cache = &config->common.servers[srv].timelines;
+
+   t1 = atomic_load(&cache->timeline);
+   if (t1 == 0 || tli > t1)
+   {
+      return 1;
+   }
+
+   n = atomic_load(&cache->number_of_switches);
+   if (tli < t1)
+   {
+      // the history of an ancestor is the part before the switch off from it
+      for (int i = 0; !found && i < n; i++)
+      {
+         if (atomic_load(&cache->parent_tli[i]) == tli)
+         {
+            n = i;
+            found = true;
+         }
+      }
+
+      if (!found)
+      {
+         return 1;
+      }
+   }
+
+   for (int i = 0; i < n; i++)
+   {
+      nexth = (struct timeline_history*) malloc(sizeof(struct timeline_history));
+
+      if (nexth == NULL)
+      {
+         goto error;
+      }
+
+      memset(nexth, 0, sizeof(struct timeline_history));
+      nexth->parent_tli = atomic_load(&cache->parent_tli[i]);
+      nexth->switchpos_hi = (uint32_t)(atomic_load(&cache->switchpos[i]) >> 32);
+      nexth->switchpos_lo = (uint32_t)(atomic_load(&cache->switchpos[i]) & 0xffffffff);
+
+      if (h == NULL)
+      {
+         h = nexth;
+      }
+      else
+      {
+         curh->next = nexth;
+      }
+      curh = nexth;
+   }
+
+   // readers take the entry only when they see the same timeline before and after
+   t2 = atomic_load(&cache->timeline);
+   if (t2 != t1)
+   {
+      goto error;
+   }
+
+   *history = h;
+
+   return 0;
+
+error:
+   pgmoneta_free_timeline_history(h);
+
+   return 1;
+}
+
+static void
+wal_cache_history(int srv, uint32_t tli, struct timeline_history* history)
+{
+   uint32_t old;
+   int n = 0;
+   struct timeline_cache* cache;
+   struct main_configuration* config = (struct main_configuration*) shmem;
+
+   cache = &config->common.servers[srv].timelines;
+
+   for (struct timeline_history* h = history; h != NULL; h = h->next)
+   {
+      n++;
+   }
+
+   // only a newer timeline replaces the entry, its history contains the older ones
+   old = atomic_load(&cache->timeline);
+   if (n > NUMBER_OF_TIMELINE_SWITCHES || (old != 0 && old >= tli))
+   {
+      return;
+   }
+
+   // only the writer that takes the entry updates it
+   if (!atomic_compare_exchange_strong(&cache->timeline, &old, 0))
+   {
+      return;
+   }
+
+   n = 0;
+   for (struct timeline_history* h = history; h != NULL; h = h->next)
+   {
+      atomic_store(&cache->parent_tli[n], h->parent_tli);
+      atomic_store(&cache->switchpos[n], ((uint64_t)h->switchpos_hi << 32) | h->switchpos_lo);
+      n++;
+   }
+   atomic_store(&cache->number_of_switches, n);
+   atomic_store(&cache->timeline, tli);
+}
+
+static bool
+wal_resume_load(int srv, int segsize, uint32_t* timeline, uint32_t* high32, uint32_t* low32)
+{
+   uint32_t tli;
+   uint64_t lsn;
+   struct timeline_cache* cache;
+   struct main_configuration* config = (struct main_configuration*) shmem;
+
+   cache = &config->common.servers[srv].timelines;
+
+   tli = atomic_load(&cache->resume_tli);
+   lsn = atomic_load(&cache->resume_lsn);
+   if (tli == 0 || tli != atomic_load(&cache->resume_tli))
+   {
+      return false;
+   }
+
+   *timeline = tli;
+   *high32 = (uint32_t)(lsn >> 32);
+   *low32 = (uint32_t)(lsn & 0xffffffff) & ~(uint32_t)(segsize - 1);
+
+   return true;
+}
+
+static void
+wal_resume_store(int srv, uint32_t timeline, uint64_t lsn)
+{
+   struct timeline_cache* cache;
+   struct main_configuration* config = (struct main_configuration*) shmem;
+
+   cache = &config->common.servers[srv].timelines;
+
+   atomic_store(&cache->resume_tli, 0);
+   atomic_store(&cache->resume_lsn, lsn);
+   atomic_store(&cache->resume_tli, timeline);
+}
+
+static bool
+wal_group_commit(void)
+{
+   struct main_configuration* config = (struct main_configuration*) shmem;
+
+   return config->wal_flush_size > 0 || config->wal_flush_interval > 0;
+}
+
+static bool
+wal_commit_due(size_t pending, struct timespec* last_commit)
+{
+   struct main_configuration* config = (struct main_configuration*) shmem;
+
+   if (pending == 0)
+   {
+      return false;
+   }
+
+   if (!wal_group_commit())
+   {
+      return false;
+   }
+
+   if (config->wal_flush_size > 0 && pending >= (size_t)config->wal_flush_size)
+   {
+      return true;
+   }
+
+   if (config->wal_flush_interval > 0 && wal_elapsed(last_commit) >= config->wal_flush_interval)
+   {
+      return true;
+   }
+
+   return false;
+}
+
+static int64_t
+wal_elapsed(struct timespec* since)
+{
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+
+   return (int64_t)(now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+static int
+wal_idle_timeout(size_t pending, struct timespec* last_commit, struct timespec* last_report)
+{
+   int64_t timeout = 1000;
+   int64_t remaining;
+   struct main_configuration* config = (struct main_configuration*) shmem;
+
+   // wake up at least every second to check if the receiver is still running
+   if (pending > 0)
+   {
+      remaining = config->wal_flush_interval > 0 ? config->wal_flush_interval - wal_elapsed(last_commit) : 0;
+      if (remaining < timeout)
+      {
+         timeout = remaining;
+      }
+   }
+
+   if (config->wal_status_interval > 0)
+   {
+      remaining = (int64_t)config->wal_status_interval * 1000 - wal_elapsed(last_report);
+      if (remaining < timeout)
+      {
+         timeout = remaining;
+      }
+   }
+
+   return timeout > 0 ? (int)timeout : 0;
+}
+
+static bool
+wal_readable(SSL* ssl, int socket, int timeout)
+{
+   struct pollfd pfd;
+
+   if (ssl != NULL && SSL_pending(ssl) > 0)
+   {
+      return true;
+   }
+
+   pfd.fd = socket;
+   pfd.events = POLLIN;
+   pfd.revents = 0;
+
+   // an error is left to the read to report
+   return poll(&pfd, 1, timeout) != 0;
+}
+
+static int
+wal_send_status_report(int srv, SSL* ssl, int socket, int64_t received, int64_t flushed, int64_t applied)
 {
    struct message* status_report_msg = NULL;
    pgmoneta_create_standby_status_update_message(received, flushed, applied, &status_report_msg);
@@ -1062,6 +2745,8 @@ wal_send_status_report(SSL* ssl, int socket, int64_t received, int64_t flushed,
    {
       goto error;
    }
+   pgmoneta_prometheus_wal_reported(srv, flushed);
+   pgmoneta_prometheus_socket(srv, SOCKET_WAL, socket);
    pgmoneta_free_message(status_report_msg);
    return 0;
 
@@ -1262,6 +2947,13 @@ pgmoneta_read_mappings_from_json(char* mappings_path)
 
    mappings_size = total_entries;
    pgmoneta_json_destroy(root);
+
+   if (build_oid_cache())
+   {
+      pgmoneta_log_error("Failed to build the OID cache");
+      return 1;
+   }
+
    enable_translation = true;
 
    return 0;
@@ -1313,7 +3005,7 @@ pgmoneta_read_mappings_from_server(int server_index)
       goto error;
    }
 
-   auth = pgmoneta_server_authenticate(server_index, "postgres", config->common.users[user_index].username, config->common.users[user_index].password, false, &ssl, &socket);
+   auth = pgmoneta_server_connect(server_index, &ssl, &socket);
 
    if (auth != AUTH_SUCCESS)
    {
@@ -1387,9 +3079,15 @@ pgmoneta_read_mappings_from_server(int server_index)
       qr = NULL;
    }
 
-   pgmoneta_close_ssl(ssl);
-   pgmoneta_disconnect(socket);
+   pgmoneta_server_disconnect(server_index, ssl, socket);
    pgmoneta_memory_destroy();
+
+   if (build_oid_cache())
+   {
+      pgmoneta_log_error("Failed to build the OID cache");
+      return 1;
+   }
+
    enable_translation = true;
 
    return 0;
@@ -1403,270 +3101,181 @@ error:
    return 1;
 }
 
-int
-pgmoneta_get_database_name(int oid, char** name)
+char*
+pgmoneta_get_object_name(object_type type, int oid, char* buffer, size_t size)
 {
-   char* temp_name = NULL;
-   int max_digits = 0;
+   char key[OID_NAME_LENGTH];
+   char* name = NULL;
 
-   if (enable_translation)
+   if (enable_translation && oid_names != NULL)
    {
-      for (int i = 0; i < mappings_size; i++)
+      oid_name_key(type, oid, key, sizeof(key));
+      name = (char*)pgmoneta_art_search(oid_names, key);
+      if (name != NULL)
       {
-         if (oidMappings[i].oid == oid && oidMappings[i].type == OBJ_DATABASE)
-         {
-            temp_name = strdup(oidMappings[i].name);
-            if (temp_name == NULL)
-            {
-               goto error;
-            }
-            break;
-         }
+         return name;
       }
    }
 
-   if (temp_name == NULL)
-   {
-      max_digits = snprintf(NULL, 0, "%d", oid) + 1;
-      temp_name = malloc(max_digits);
+   snprintf(buffer, size, "%d", oid);
 
-      if (temp_name == NULL)
-      {
-         goto error;
-      }
+   return buffer;
+}
+
+int
+pgmoneta_get_database_name(int oid, char** name)
+{
+   char buffer[OID_NAME_LENGTH];
+   char* temp_name = NULL;
 
-      snprintf(temp_name, max_digits, "%d", oid);
+   temp_name = strdup(pgmoneta_get_object_name(OBJ_DATABASE, oid, buffer, sizeof(buffer)));
+   if (temp_name == NULL)
+   {
+      return 1;
    }
 
    *name = temp_name;
-   temp_name = NULL;
 
    return 0;
-
-error:
-   free(temp_name);
-   temp_name = NULL;
-   return 1;
 }
 
 int
 pgmoneta_get_tablespace_name(int oid, char** name)
 {
+   char buffer[OID_NAME_LENGTH];
    char* temp_name = NULL;
-   int max_digits = 0;
-
-   if (enable_translation)
-   {
-      for (int i = 0; i < mappings_size; i++)
-      {
-         if (oidMappings[i].oid == oid && oidMappings[i].type == OBJ_TABLESPACE)
-         {
-            temp_name = strdup(oidMappings[i].name);
-            if (temp_name == NULL)
-            {
-               goto error;
-            }
-            break;
-         }
-      }
-   }
 
+   temp_name = strdup(pgmoneta_get_object_name(OBJ_TABLESPACE, oid, buffer, sizeof(buffer)));
    if (temp_name == NULL)
    {
-      max_digits = snprintf(NULL, 0, "%d", oid) + 1;
-      temp_name = malloc(max_digits);
-      if (temp_name == NULL)
-      {
-         goto error;
-      }
-
-      snprintf(temp_name, max_digits, "%d", oid);
+      return 1;
    }
 
    *name = temp_name;
-   temp_name = NULL;
 
    return 0;
-
-error:
-   free(temp_name);
-   temp_name = NULL;
-   return 1;
 }
 
 int
 pgmoneta_get_relation_name(int oid, char** name)
 {
+   char buffer[OID_NAME_LENGTH];
    char* temp_name = NULL;
-   int max_digits = 0;
-
-   if (enable_translation)
-   {
-      for (int i = 0; i < mappings_size; i++)
-      {
-         if (oidMappings[i].oid == oid && oidMappings[i].type == OBJ_RELATION)
-         {
-            temp_name = strdup(oidMappings[i].name);
-            if (temp_name == NULL)
-            {
-               goto error;
-            }
-            break;
-         }
-      }
-   }
 
+   temp_name = strdup(pgmoneta_get_object_name(OBJ_RELATION, oid, buffer, sizeof(buffer)));
    if (temp_name == NULL)
    {
-      max_digits = snprintf(NULL, 0, "%d", oid) + 1;
-      temp_name = malloc(max_digits);
-      if (temp_name == NULL)
-      {
-         goto error;
-      }
-
-      snprintf(temp_name, max_digits, "%d", oid);
+      return 1;
    }
 
    *name = temp_name;
-   temp_name = NULL;
 
    return 0;
-
-error:
-   free(temp_name);
-   temp_name = NULL;
-   return 1;
 }
 
 int
 pgmoneta_get_tablespace_oid(char* name, char** oid)
 {
-   char* temp_oid = NULL;
-   int max_digits = 0;
-
-   if (enable_translation)
-   {
-      for (int i = 0; i < mappings_size; i++)
-      {
-         if (oidMappings[i].type == OBJ_TABLESPACE && !strcmp(oidMappings[i].name, name))
-         {
-            max_digits = snprintf(NULL, 0, "%d", oidMappings[i].oid) + 1;
-            temp_oid = malloc(max_digits);
-            if (temp_oid == NULL)
-            {
-               goto error;
-            }
-            snprintf(temp_oid, max_digits, "%d", oidMappings[i].oid);
-            break;
-         }
-      }
-   }
-
-   if (temp_oid == NULL)
-   {
-      temp_oid = strdup(name);
-      if (temp_oid == NULL)
-      {
-         goto error;
-      }
-   }
-
-   *oid = temp_oid;
-   temp_oid = NULL;
-
-   return 0;
-
-error:
-   free(temp_oid);
-   temp_oid = NULL;
-   return 1;
+   return get_oid(OBJ_TABLESPACE, name, oid);
 }
 
 int
 pgmoneta_get_database_oid(char* name, char** oid)
 {
-   char* temp_oid = NULL;
-   int max_digits = 0;
+   return get_oid(OBJ_DATABASE, name, oid);
+}
+
+int
+pgmoneta_get_relation_oid(char* name, char** oid)
+{
+   return get_oid(OBJ_RELATION, name, oid);
+}
+
+static int
+build_oid_cache(void)
+{
+   char key[MAX_PATH];
 
-   if (enable_translation)
+   pgmoneta_art_destroy(oid_names);
+   pgmoneta_art_destroy(oid_values);
+   oid_names = NULL;
+   oid_values = NULL;
+
+   if (pgmoneta_art_create_with_arena(&oid_names) || pgmoneta_art_create_with_arena(&oid_values))
    {
-      for (int i = 0; i < mappings_size; i++)
-      {
-         if (oidMappings[i].type == OBJ_DATABASE && !strcmp(oidMappings[i].name, name))
-         {
-            max_digits = snprintf(NULL, 0, "%d", oidMappings[i].oid) + 1;
-            temp_oid = malloc(max_digits);
-            if (temp_oid == NULL)
-            {
-               goto error;
-            }
-            snprintf(temp_oid, max_digits, "%d", oidMappings[i].oid);
-            break;
-         }
-      }
+      goto error;
    }
 
-   if (temp_oid == NULL)
+   for (int i = 0; i < mappings_size; i++)
    {
-      temp_oid = strdup(name);
-      if (temp_oid == NULL)
+      oid_name_key(oidMappings[i].type, oidMappings[i].oid, key, sizeof(key));
+      if (pgmoneta_art_insert(oid_names, key, (uintptr_t)oidMappings[i].name, ValueRef))
       {
          goto error;
       }
-   }
 
-   *oid = temp_oid;
-   temp_oid = NULL;
+      oid_value_key(oidMappings[i].type, oidMappings[i].name, key, sizeof(key));
+      if (pgmoneta_art_insert(oid_values, key, (uintptr_t)oidMappings[i].oid, ValueInt32))
+      {
+         goto error;
+      }
+   }
 
    return 0;
 
 error:
-   free(temp_oid);
-   temp_oid = NULL;
+   pgmoneta_art_destroy(oid_names);
+   pgmoneta_art_destroy(oid_values);
+   oid_names = NULL;
+   oid_values = NULL;
+
    return 1;
 }
 
-int
-pgmoneta_get_relation_oid(char* name, char** oid)
+static void
+oid_name_key(object_type type, int oid, char* key, size_t size)
+{
+   snprintf(key, size, "%d/%d", type, oid);
+}
+
+static void
+oid_value_key(object_type type, char* name, char* key, size_t size)
+{
+   snprintf(key, size, "%d/%s", type, name);
+}
+
+static int
+get_oid(object_type type, char* name, char** oid)
 {
+   char key[MAX_PATH];
+   char buffer[OID_NAME_LENGTH];
    char* temp_oid = NULL;
-   int max_digits = 0;
+   int value = 0;
 
-   if (enable_translation)
+   if (enable_translation && oid_values != NULL)
    {
-      for (int i = 0; i < mappings_size; i++)
-      {
-         if (oidMappings[i].type == OBJ_RELATION && !strcmp(oidMappings[i].name, name))
-         {
-            max_digits = snprintf(NULL, 0, "%d", oidMappings[i].oid) + 1;
-            temp_oid = malloc(max_digits);
-            if (temp_oid == NULL)
-            {
-               goto error;
-            }
-            snprintf(temp_oid, max_digits, "%d", oidMappings[i].oid);
-            break;
-         }
-      }
+      oid_value_key(type, name, key, sizeof(key));
+
+      /* InvalidOid is never part of the catalogs, so 0 means not found */
+      value = (int)pgmoneta_art_search(oid_values, key);
    }
 
-   if (temp_oid == NULL)
+   if (value != 0)
+   {
+      snprintf(buffer, sizeof(buffer), "%d", value);
+      temp_oid = strdup(buffer);
+   }
+   else
    {
       temp_oid = strdup(name);
-      if (temp_oid == NULL)
-      {
-         goto error;
-      }
+   }
+
+   if (temp_oid == NULL)
+   {
+      return 1;
    }
 
    *oid = temp_oid;
-   temp_oid = NULL;
 
    return 0;
-
-error:
-   free(temp_oid);
-   temp_oid = NULL;
-   return 1;
 }
@@ -0,0 +1,371 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <logging.h>
+#include <prometheus.h>
+#include <reader.h>
+#include <security.h>
+#include <utils.h>
+#include <walcache.h>
+
+/* system */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define WALCACHE_DIRECTORY "wal_cache/"
+
+/*
+ * The cache is a directory per server in the workspace, with a file per decoded
+ * segment named after the segment and a checksum of the identity of the archived
+ * file. An entry is written under a temporary name and renamed, so processes
+ * share the directory. The modification time of an entry is its last use
+ */
+
+static char* walcache_directory(int server);
+static int walcache_entry(char* path, char* file, char* entry, size_t size);
+static int walcache_decode(char* from, char* to);
+static int walcache_copy(char* from, char* to);
+static void walcache_evict(char* directory, int64_t limit);
+
+int
+pgmoneta_wal_cache_restore(int server, char* directory, char* file, char* target)
+{
+   char source[MAX_PATH];
+   char entry[MAX_PATH];
+   char tmp[MAX_PATH];
+   char* cache = NULL;
+   int fd = -1;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   memset(source, 0, sizeof(source));
+   snprintf(source, sizeof(source), "%s%s%s", directory, pgmoneta_ends_with(directory, "/") ? "" : "/", file);
+
+   // the partial segment is still growing
+   if (config->wal_cache_size <= 0 || strstr(file, ".partial") != NULL)
+   {
+      return walcache_decode(source, target);
+   }
+
+   cache = walcache_directory(server);
+   if (cache == NULL || walcache_entry(source, file, entry, sizeof(entry)))
+   {
+      free(cache);
+      return walcache_decode(source, target);
+   }
+
+   memset(tmp, 0, sizeof(tmp));
+   snprintf(tmp, sizeof(tmp), "%s%s", cache, entry);
+
+   // the entry may be evicted by another process in between, then it is a miss
+   if (pgmoneta_exists(tmp) && !walcache_copy(tmp, target))
+   {
+      utimensat(AT_FDCWD, tmp, NULL, 0);
+      pgmoneta_prometheus_wal_cache(true);
+      free(cache);
+      return 0;
+   }
+
+   pgmoneta_prometheus_wal_cache(false);
+
+   if (walcache_decode(source, target))
+   {
+      free(cache);
+      return 1;
+   }
+
+   memset(tmp, 0, sizeof(tmp));
+   snprintf(tmp, sizeof(tmp), "%s%s.XXXXXX", cache, entry);
+
+   memset(source, 0, sizeof(source));
+   snprintf(source, sizeof(source), "%s%s", cache, entry);
+
+   fd = mkstemp(tmp);
+   if (fd >= 0)
+   {
+      close(fd);
+   }
+
+   // the segment is restored even if it couldn't be cached
+   if (fd < 0 || walcache_copy(target, tmp) || rename(tmp, source))
+   {
+      pgmoneta_log_debug("WAL cache: Could not add %s", entry);
+      unlink(tmp);
+   }
+   else
+   {
+      walcache_evict(cache, config->wal_cache_size);
+   }
+
+   free(cache);
+
+   return 0;
+}
+
+static char*
+walcache_directory(int server)
+{
+   char* d = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   d = pgmoneta_get_server_workspace(server);
+   if (d == NULL)
+   {
+      return NULL;
+   }
+
+   d = pgmoneta_append(d, WALCACHE_DIRECTORY);
+   d = pgmoneta_append(d, config->common.servers[server].name);
+   d = pgmoneta_append(d, "/");
+
+   if (!pgmoneta_exists(d) && pgmoneta_mkdir(d))
+   {
+      pgmoneta_log_debug("WAL cache: Could not create %s", d);
+      free(d);
+      return NULL;
+   }
+
+   return d;
+}
+
+static int
+walcache_entry(char* path, char* file, char* entry, size_t size)
+{
+   char key[MAX_PATH];
+   uint32_t crc = 0;
+   struct stat st;
+
+   if (stat(path, &st))
+   {
+      return 1;
+   }
+
+   // the archived file is replaced, never changed, when it is compressed or encrypted
+   memset(key, 0, sizeof(key));
+   snprintf(key, sizeof(key), "%s %ju %ju %jd %jd", file,
+            (uintmax_t)st.st_dev, (uintmax_t)st.st_ino, (intmax_t)st.st_size,
+            (intmax_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec);
+
+   if (pgmoneta_create_crc32c_buffer(key, strlen(key), &crc))
+   {
+      return 1;
+   }
+
+   memset(entry, 0, size);
+   snprintf(entry, size, "%.24s-%08" PRIx32, file, crc);
+
+   return 0;
+}
+
+static int
+walcache_decode(char* from, char* to)
+{
+   unsigned char buffer[READER_BUFFER_SIZE];
+   size_t n = 0;
+   FILE* file = NULL;
+   struct reader* reader = NULL;
+
+   if (pgmoneta_reader_open(from, &reader))
+   {
+      goto error;
+   }
+
+   file = fopen(to, "wb");
+   if (file == NULL)
+   {
+      goto error;
+   }
+
+   do
+   {
+      if (pgmoneta_reader_read(reader, buffer, sizeof(buffer), &n) || fwrite(buffer, 1, n, file) != n)
+      {
+         goto error;
+      }
+   }
+   while (n > 0);
+
+   if (fclose(file))
+   {
+      file = NULL;
+      goto error;
+   }
+
+   pgmoneta_reader_close(reader);
+
+   return 0;
+
+error:
+
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+   unlink(to);
+
+   pgmoneta_reader_close(reader);
+
+   return 1;
+}
+
+static int
+walcache_copy(char* from, char* to)
+{
+   unsigned char buffer[READER_BUFFER_SIZE];
+   ssize_t n;
+   int in = -1;
+   int out = -1;
+
+   in = open(from, O_RDONLY);
+   if (in < 0)
+   {
+      goto error;
+   }
+
+   out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+   if (out < 0)
+   {
+      goto error;
+   }
+
+   while ((n = read(in, buffer, sizeof(buffer))) > 0)
+   {
+      for (ssize_t written = 0, w; written < n; written += w)
+      {
+         w = write(out, buffer + written, (size_t)(n - written));
+         if (w < 0)
+         {
+            goto error;
+         }
+      }
+   }
+
+   if (n < 0 || close(out))
+   {
+      out = -1;
+      goto error;
+   }
+
+   close(in);
+
+   return 0;
+
+error:
+
+   if (in >= 0)
+   {
+      close(in);
+   }
+   if (out >= 0)
+   {
+      close(out);
+   }
+   unlink(to);
+
+   return 1;
+}
+
+static void
+walcache_evict(char* directory, int64_t limit)
+{
+   DIR* dir = NULL;
+   struct dirent* e = NULL;
+   struct stat st;
+   char path[MAX_PATH];
+   char oldest[MAX_PATH];
+   int64_t total;
+   int64_t oldest_size;
+   int64_t oldest_time;
+   int64_t t;
+
+   // a pass per eviction, the cache only holds a few hundred segments
+   for (;;)
+   {
+      total = 0;
+      oldest_size = 0;
+      oldest_time = INT64_MAX;
+      memset(oldest, 0, sizeof(oldest));
+
+      dir = opendir(directory);
+      if (dir == NULL)
+      {
+         return;
+      }
+
+      while ((e = readdir(dir)) != NULL)
+      {
+         if (e->d_name[0] == '.')
+         {
+            continue;
+         }
+
+         snprintf(path, sizeof(path), "%s%s", directory, e->d_name);
+         if (stat(path, &st) || !S_ISREG(st.st_mode))
+         {
+            continue;
+         }
+
+         total += st.st_size;
+
+         t = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+         if (t < oldest_time)
+         {
+            oldest_time = t;
+            oldest_size = st.st_size;
+            memcpy(oldest, path, sizeof(oldest));
+         }
+      }
+
+      closedir(dir);
+
+      if (total <= limit || strlen(oldest) == 0)
+      {
+         return;
+      }
+
+      if (unlink(oldest) && errno != ENOENT)
+      {
+         return;
+      }
+
+      pgmoneta_log_trace("WAL cache: Evicted %s (%" PRId64 " bytes)", oldest, oldest_size);
+   }
+}
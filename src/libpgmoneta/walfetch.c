@@ -0,0 +1,508 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <logging.h>
+#include <management.h>
+#include <network.h>
+#include <reader.h>
+#include <utils.h>
+#include <walfetch.h>
+#include <workers.h>
+
+/* system */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define NAME "walfetch"
+
+#define WAL_FETCH_PREFETCH ".prefetch"
+#define WAL_FETCH_STALE    10
+
+static char* cache_directory(int server);
+static bool is_segment(char* file);
+static bool next_segment(char* file, uint64_t segment_size, char* next);
+static void wait_prefetch(char* cache, char* file);
+static int take_cached(char* cache, char* file, char* destination, bool* hit);
+static void evict(char* cache, char* file);
+static void prefetch(int server, char* cache, char* file, uint64_t segment_size);
+static void do_prefetch(struct worker_common* wc);
+
+void
+pgmoneta_wal_fetch(SSL* ssl __attribute__((unused)), int client_fd, int server, uint8_t compression, uint8_t encryption, struct json* payload)
+{
+   char* elapsed = NULL;
+   struct timespec start_t;
+   struct timespec end_t;
+   double total_seconds;
+   char* file = NULL;
+   char* destination = NULL;
+   char* cache = NULL;
+   char* from = NULL;
+   bool hit = false;
+   uint64_t segment_size = 0;
+   struct json* req = NULL;
+   struct json* response = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+#ifdef HAVE_FREEBSD
+   clock_gettime(CLOCK_MONOTONIC_FAST, &start_t);
+#else
+   clock_gettime(CLOCK_MONOTONIC_RAW, &start_t);
+#endif
+
+   req = (struct json*)pgmoneta_json_get(payload, MANAGEMENT_CATEGORY_REQUEST);
+   file = (char*)pgmoneta_json_get(req, MANAGEMENT_ARGUMENT_FILENAME);
+   destination = (char*)pgmoneta_json_get(req, MANAGEMENT_ARGUMENT_DESTINATION_FILE);
+
+   if (file == NULL || strlen(file) == 0 || strchr(file, '/') != NULL ||
+       destination == NULL || *destination != '/')
+   {
+      pgmoneta_management_response_error(NULL, client_fd, config->common.servers[server].name, MANAGEMENT_ERROR_BAD_PAYLOAD, NAME, compression, encryption, payload);
+      pgmoneta_log_error("WAL fetch: Invalid request for %s", config->common.servers[server].name);
+      goto error;
+   }
+
+   cache = cache_directory(server);
+   if (cache == NULL)
+   {
+      pgmoneta_management_response_error(NULL, client_fd, config->common.servers[server].name, MANAGEMENT_ERROR_WAL_FETCH_ERROR, NAME, compression, encryption, payload);
+      goto error;
+   }
+
+   if (is_segment(file))
+   {
+      evict(cache, file);
+      wait_prefetch(cache, file);
+   }
+
+   if (take_cached(cache, file, destination, &hit))
+   {
+      pgmoneta_management_response_error(NULL, client_fd, config->common.servers[server].name, MANAGEMENT_ERROR_WAL_FETCH_ERROR, NAME, compression, encryption, payload);
+      pgmoneta_log_error("WAL fetch: Could not move %s to %s", file, destination);
+      goto error;
+   }
+
+   if (!hit)
+   {
+      from = pgmoneta_wal_archived_file(server, file);
+
+      if (from == NULL)
+      {
+         /* Recovery asks for files past the end of the archive, so this is not an error */
+         pgmoneta_management_response_error(NULL, client_fd, config->common.servers[server].name, MANAGEMENT_ERROR_WAL_FETCH_NOFILE, NAME, compression, encryption, payload);
+         pgmoneta_log_debug("WAL fetch: No %s for %s", file, config->common.servers[server].name);
+         goto error;
+      }
+
+      if (pgmoneta_reader_copy(from, destination))
+      {
+         unlink(destination);
+
+         pgmoneta_management_response_error(NULL, client_fd, config->common.servers[server].name, MANAGEMENT_ERROR_WAL_FETCH_ERROR, NAME, compression, encryption, payload);
+         pgmoneta_log_error("WAL fetch: Could not restore %s to %s", from, destination);
+         goto error;
+      }
+   }
+
+   if (pgmoneta_management_create_response(payload, server, &response))
+   {
+      pgmoneta_management_response_error(NULL, client_fd, config->common.servers[server].name, MANAGEMENT_ERROR_ALLOCATION, NAME, compression, encryption, payload);
+      goto error;
+   }
+
+   pgmoneta_json_put(response, MANAGEMENT_ARGUMENT_SERVER, (uintptr_t)config->common.servers[server].name, ValueString);
+   pgmoneta_json_put(response, MANAGEMENT_ARGUMENT_FILENAME, (uintptr_t)file, ValueString);
+   pgmoneta_json_put(response, MANAGEMENT_ARGUMENT_CACHED, (uintptr_t)hit, ValueBool);
+
+#ifdef HAVE_FREEBSD
+   clock_gettime(CLOCK_MONOTONIC_FAST, &end_t);
+#else
+   clock_gettime(CLOCK_MONOTONIC_RAW, &end_t);
+#endif
+
+   if (pgmoneta_management_response_ok(NULL, client_fd, start_t, end_t, compression, encryption, payload))
+   {
+      pgmoneta_management_response_error(NULL, client_fd, config->common.servers[server].name, MANAGEMENT_ERROR_WAL_FETCH_NETWORK, NAME, compression, encryption, payload);
+      pgmoneta_log_error("WAL fetch: Error sending response");
+      goto error;
+   }
+
+   elapsed = pgmoneta_get_timestamp_string(start_t, end_t, &total_seconds);
+
+   pgmoneta_log_debug("WAL fetch: %s/%s%s (Elapsed: %s)", config->common.servers[server].name, file, hit ? " (Cached)" : "", elapsed);
+
+   /* The recovery continues with this segment while the next ones are prefetched */
+   pgmoneta_disconnect(client_fd);
+
+   if (is_segment(file) && config->wal_prefetch > 0)
+   {
+      segment_size = config->common.servers[server].wal_size > 0 ?
+                     (uint64_t)config->common.servers[server].wal_size : (uint64_t)pgmoneta_get_file_size(destination);
+
+      prefetch(server, cache, file, segment_size);
+   }
+
+   free(cache);
+   free(from);
+   free(elapsed);
+
+   exit(0);
+
+error:
+
+   free(cache);
+   free(from);
+   free(elapsed);
+
+   exit(1);
+}
+
+char*
+pgmoneta_wal_archived_file(int server, char* file)
+{
+   static char* compression_suffixes[] = {"", ".gz", ".zstd", ".lz4", ".bz2"};
+   static char* encryption_suffixes[] = {"", ".aes"};
+   char* wal = NULL;
+   char* path = NULL;
+
+   wal = pgmoneta_get_server_wal(server);
+
+   for (size_t i = 0; i < sizeof(compression_suffixes) / sizeof(char*); i++)
+   {
+      for (size_t j = 0; j < sizeof(encryption_suffixes) / sizeof(char*); j++)
+      {
+         path = pgmoneta_append(path, wal);
+         path = pgmoneta_append(path, file);
+         path = pgmoneta_append(path, compression_suffixes[i]);
+         path = pgmoneta_append(path, encryption_suffixes[j]);
+
+         if (pgmoneta_exists(path))
+         {
+            free(wal);
+            return path;
+         }
+
+         free(path);
+         path = NULL;
+      }
+   }
+
+   free(wal);
+
+   return NULL;
+}
+
+static char*
+cache_directory(int server)
+{
+   char* d = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   d = pgmoneta_get_server_workspace(server);
+   if (d == NULL)
+   {
+      return NULL;
+   }
+
+   /* The workspace can be shared by the servers */
+   d = pgmoneta_append(d, "wal_cache_");
+   d = pgmoneta_append(d, config->common.servers[server].name);
+   d = pgmoneta_append(d, "/");
+
+   if (pgmoneta_mkdir(d))
+   {
+      pgmoneta_log_error("WAL fetch: Could not create directory: %s", d);
+      free(d);
+      return NULL;
+   }
+
+   return d;
+}
+
+static bool
+is_segment(char* file)
+{
+   return strlen(file) == 24 && strspn(file, "0123456789ABCDEF") == 24;
+}
+
+static bool
+next_segment(char* file, uint64_t segment_size, char* next)
+{
+   unsigned int tli;
+   unsigned int log;
+   unsigned int seg;
+   uint64_t segments_per_id;
+
+   if (segment_size == 0 || 0x100000000ULL % segment_size != 0)
+   {
+      return false;
+   }
+
+   if (sscanf(file, "%08X%08X%08X", &tli, &log, &seg) != 3)
+   {
+      return false;
+   }
+
+   segments_per_id = 0x100000000ULL / segment_size;
+
+   seg++;
+   if (seg >= segments_per_id)
+   {
+      seg = 0;
+      log++;
+   }
+
+   snprintf(next, 25, "%08X%08X%08X", tli, log, seg);
+
+   return true;
+}
+
+static void
+wait_prefetch(char* cache, char* file)
+{
+   char* path = NULL;
+   struct stat st;
+   off_t size = -1;
+   time_t progress;
+
+   path = pgmoneta_append(path, cache);
+   path = pgmoneta_append(path, file);
+   path = pgmoneta_append(path, WAL_FETCH_PREFETCH);
+
+   progress = time(NULL);
+
+   /* A prefetch that stops growing was left behind by a failed process */
+   while (stat(path, &st) == 0)
+   {
+      if (st.st_size != size)
+      {
+         size = st.st_size;
+         progress = time(NULL);
+      }
+      else if (time(NULL) - progress > WAL_FETCH_STALE)
+      {
+         pgmoneta_log_warn("WAL fetch: Removing stale %s", path);
+         unlink(path);
+         break;
+      }
+
+      SLEEP(10000000L);
+   }
+
+   free(path);
+}
+
+static int
+take_cached(char* cache, char* file, char* destination, bool* hit)
+{
+   char* path = NULL;
+
+   *hit = false;
+
+   path = pgmoneta_append(path, cache);
+   path = pgmoneta_append(path, file);
+
+   if (!pgmoneta_exists(path))
+   {
+      free(path);
+      return 0;
+   }
+
+   if (rename(path, destination))
+   {
+      if (errno != EXDEV || pgmoneta_copy_file(path, destination, NULL))
+      {
+         goto error;
+      }
+
+      unlink(path);
+   }
+
+   *hit = true;
+
+   free(path);
+
+   return 0;
+
+error:
+
+   free(path);
+
+   return 1;
+}
+
+static void
+evict(char* cache, char* file)
+{
+   DIR* dir = NULL;
+   struct dirent* entry = NULL;
+   char* path = NULL;
+
+   dir = opendir(cache);
+   if (dir == NULL)
+   {
+      return;
+   }
+
+   /* Recovery only moves forward, so the segments before the requested one are done */
+   while ((entry = readdir(dir)) != NULL)
+   {
+      if (is_segment(entry->d_name) && strcmp(entry->d_name, file) < 0)
+      {
+         path = pgmoneta_append(path, cache);
+         path = pgmoneta_append(path, entry->d_name);
+
+         unlink(path);
+
+         free(path);
+         path = NULL;
+      }
+   }
+
+   closedir(dir);
+}
+
+static void
+prefetch(int server, char* cache, char* file, uint64_t segment_size)
+{
+   char current[25];
+   char next[25];
+   char* from = NULL;
+   char* to = NULL;
+   char* final = NULL;
+   int fd = -1;
+   int number_of_workers = 0;
+   struct workers* workers = NULL;
+   struct worker_input* wi = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   number_of_workers = pgmoneta_get_number_of_workers(server);
+   if (number_of_workers > 0)
+   {
+      pgmoneta_workers_initialize(number_of_workers, &workers);
+   }
+
+   memset(&current[0], 0, sizeof(current));
+   memcpy(&current[0], file, strlen(file));
+
+   for (int i = 0; i < config->wal_prefetch; i++)
+   {
+      if (!next_segment(&current[0], segment_size, &next[0]))
+      {
+         break;
+      }
+
+      memcpy(&current[0], &next[0], sizeof(current));
+
+      from = pgmoneta_wal_archived_file(server, &next[0]);
+      if (from == NULL)
+      {
+         /* The end of the archive */
+         break;
+      }
+
+      final = pgmoneta_append(final, cache);
+      final = pgmoneta_append(final, &next[0]);
+
+      to = pgmoneta_append(to, final);
+      to = pgmoneta_append(to, WAL_FETCH_PREFETCH);
+
+      /* The segment may be cached or claimed by the prefetch of an earlier request */
+      if (!pgmoneta_exists(final))
+      {
+         fd = open(to, O_CREAT | O_EXCL | O_WRONLY, 0600);
+         if (fd != -1)
+         {
+            close(fd);
+
+            if (pgmoneta_create_worker_input(NULL, from, to, 0, workers, &wi) == 0)
+            {
+               if (workers != NULL)
+               {
+                  pgmoneta_workers_add(workers, do_prefetch, (struct worker_common*)wi);
+               }
+               else
+               {
+                  do_prefetch((struct worker_common*)wi);
+               }
+            }
+            else
+            {
+               unlink(to);
+            }
+         }
+      }
+
+      free(from);
+      free(to);
+      free(final);
+
+      from = NULL;
+      to = NULL;
+      final = NULL;
+   }
+
+   if (workers != NULL)
+   {
+      pgmoneta_workers_wait(workers);
+      pgmoneta_workers_destroy(workers);
+   }
+}
+
+static void
+do_prefetch(struct worker_common* wc)
+{
+   struct worker_input* wi = (struct worker_input*)wc;
+   char* final = NULL;
+
+   final = pgmoneta_remove_suffix(wi->to, WAL_FETCH_PREFETCH);
+
+   if (final == NULL || pgmoneta_reader_copy(wi->from, wi->to) || rename(wi->to, final))
+   {
+      pgmoneta_log_warn("WAL fetch: Could not prefetch %s", wi->from);
+      unlink(wi->to);
+   }
+
+   free(final);
+   free(wi);
+}
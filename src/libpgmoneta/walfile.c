@@ -26,13 +26,22 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include <aes.h>
-#include <compression.h>
 #include <logging.h>
 #include <utils.h>
 #include <walfile.h>
+#include <workers.h>
+#include <walfile/rm.h>
+#include <walfile/wal_summary.h>
 
-#include <libgen.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define DESCRIBE_OUTPUT_BUFFER_SIZE (1024 * 1024)
+
+#define STATS_RECORD_TYPES 16
+#define STATS_RELATIONS    1024
 
 /**
  * Validate if a WAL file exists and is accessible before processing.
@@ -89,7 +98,7 @@ pgmoneta_read_walfile(int server, char* path, struct walfile** wf)
       goto error;
    }
 
-   new_wf = malloc(sizeof(struct walfile));
+   new_wf = calloc(1, sizeof(struct walfile));
    if (!new_wf)
    {
       pgmoneta_log_error("Memory allocation failed for WAL file structure");
@@ -97,7 +106,8 @@ pgmoneta_read_walfile(int server, char* path, struct walfile** wf)
       goto error;
    }
 
-   if (pgmoneta_deque_create(false, &new_wf->records) || pgmoneta_deque_create(false, &new_wf->page_headers))
+   if (pgmoneta_deque_create(false, &new_wf->records) || pgmoneta_deque_create(false, &new_wf->page_headers) ||
+       pgmoneta_wal_arena_create(&new_wf->arena))
    {
       pgmoneta_log_error("Failed to initialize WAL deque structures");
       error_code = PGMONETA_WAL_ERR_MEMORY;
@@ -244,7 +254,6 @@ error:
 void
 pgmoneta_destroy_walfile(struct walfile* wf)
 {
-   struct deque_iterator* record_iterator = NULL;
    struct deque_iterator* page_header_iterator = NULL;
 
    if (wf == NULL)
@@ -252,38 +261,24 @@ pgmoneta_destroy_walfile(struct walfile* wf)
       return;
    }
 
-   if (pgmoneta_deque_iterator_create(wf->records, &record_iterator) || pgmoneta_deque_iterator_create(wf->page_headers, &page_header_iterator))
+   /* The records live in the arena and the mapping */
+   pgmoneta_deque_destroy(wf->records);
+   pgmoneta_wal_arena_destroy(wf->arena);
+   if (wf->mapped)
    {
-      return;
+      munmap(wf->map, wf->map_size);
+   }
+   else
+   {
+      free(wf->map);
    }
 
-   while (pgmoneta_deque_iterator_next(record_iterator))
+   if (pgmoneta_deque_iterator_create(wf->page_headers, &page_header_iterator))
    {
-      struct decoded_xlog_record* record = (struct decoded_xlog_record*) record_iterator->value->data;
-      if (record->partial)
-      {
-         free(record);
-         continue;
-      }
-      if (record->main_data != NULL)
-      {
-         free(record->main_data);
-      }
-      for (int i = 0; i <= record->max_block_id; i++)
-      {
-         if (record->blocks[i].has_data)
-         {
-            free(record->blocks[i].data);
-         }
-         if (record->blocks[i].has_image)
-         {
-            free(record->blocks[i].bkp_image);
-         }
-      }
-      free(record);
+      free(wf->long_phd);
+      free(wf);
+      return;
    }
-   pgmoneta_deque_iterator_destroy(record_iterator);
-   pgmoneta_deque_destroy(wf->records);
 
    while (pgmoneta_deque_iterator_next(page_header_iterator))
    {
@@ -297,96 +292,200 @@ pgmoneta_destroy_walfile(struct walfile* wf)
    free(wf);
 }
 
-int
-pgmoneta_describe_walfile(char* path, enum value_type type, char* output, bool quiet, bool color,
-                          struct deque* rms, uint64_t start_lsn, uint64_t end_lsn, struct deque* xids,
-                          uint32_t limit, char** included_objects)
+/** @struct describe_options
+ * Defines how WAL records are described
+ */
+struct describe_options
 {
-   FILE* out = NULL;
-   char* tmp_wal = NULL;
-   struct walfile* wf = NULL;
-   struct deque_iterator* record_iterator = NULL;
-   struct decoded_xlog_record* record = NULL;
-   char* decompressed_file_name = NULL;
-   char* decrypted_file_name = NULL;
-   char* wal_path = NULL;
-   bool copy = true;
-
-   if (!pgmoneta_is_file(path))
+   enum value_type type;     /**< The type of output description */
+   bool quiet;               /**< Is the WAL file printed */
+   bool color;               /**< Are colors used */
+   struct deque* rms;        /**< The resource managers */
+   uint64_t start_lsn;       /**< The start LSN */
+   uint64_t end_lsn;         /**< The end LSN */
+   struct deque* xids;       /**< The XIDs */
+   uint32_t limit;           /**< The limit */
+   char** included_objects;  /**< The objects to include the wal records for */
+   struct wal_record_filter* filter; /**< The filter checked before records are decoded */
+};
+
+/** @struct describe_input
+ * Defines the input for describing a WAL segment on a worker
+ */
+struct describe_input
+{
+   struct worker_common common;      /**< The common base */
+   char path[MAX_PATH];              /**< The path to the WAL segment */
+   bool continuation;                /**< Is a leading continuation record shown */
+   struct describe_options* options; /**< The options */
+   char* buffer;                     /**< The output */
+   size_t size;                      /**< The size of the output */
+   size_t* ends;                     /**< The end of each shown record in the output */
+   uint32_t number_of_ends;          /**< The number of shown records in the output */
+   uint32_t count;                   /**< The number of included records */
+   bool failed;                      /**< Did the description fail */
+};
+
+static void
+describe_options_init(struct describe_options* options, enum value_type type, bool quiet, bool color,
+                      struct deque* rms, uint64_t start_lsn, uint64_t end_lsn, struct deque* xids,
+                      uint32_t limit, char** included_objects)
+{
+   options->type = type;
+   options->quiet = quiet;
+   options->color = color;
+   options->rms = rms;
+   options->start_lsn = start_lsn;
+   options->end_lsn = end_lsn;
+   options->xids = xids;
+   options->limit = limit;
+   options->included_objects = included_objects;
+   options->filter = NULL;
+
+   if (rms != NULL || start_lsn > 0 || end_lsn > 0 || xids != NULL)
    {
-      pgmoneta_log_fatal("WAL file at %s does not exist", path);
-      goto error;
+      if (pgmoneta_wal_record_filter_create(rms, start_lsn, end_lsn, xids, &options->filter))
+      {
+         pgmoneta_log_warn("Failed to create the WAL record filter");
+      }
    }
+}
+
+static void
+describe_output_buffer(FILE* out, char** buffer)
+{
+   static char stdout_buffer[DESCRIBE_OUTPUT_BUFFER_SIZE];
+   static bool stdout_buffered = false;
+
+   *buffer = NULL;
 
-   wal_path = pgmoneta_append(wal_path, path);
+   if (out == NULL)
+   {
+      return;
+   }
 
-   // Based on the file extension, if it's an encrypted file, decrypt it in /tmp
-   if (pgmoneta_is_encrypted(wal_path))
+   /* Records are written in small pieces, so they are collected in a large buffer */
+   if (out == stdout)
    {
-      tmp_wal = pgmoneta_format_and_append(tmp_wal, "/tmp/%s", basename(wal_path));
+      if (!stdout_buffered && !isatty(fileno(stdout)))
+      {
+         setvbuf(stdout, stdout_buffer, _IOFBF, sizeof(stdout_buffer));
+         stdout_buffered = true;
+      }
+      return;
+   }
 
-      // Temporarily copying the encrypted WAL file, because the decrypt
-      // functions delete the source file
-      pgmoneta_copy_file(wal_path, tmp_wal, NULL);
-      copy = false;
+   *buffer = (char*)malloc(DESCRIBE_OUTPUT_BUFFER_SIZE);
+   if (*buffer != NULL)
+   {
+      setvbuf(out, *buffer, _IOFBF, DESCRIBE_OUTPUT_BUFFER_SIZE);
+   }
+}
 
-      pgmoneta_strip_extension(basename(wal_path), &decrypted_file_name);
+static void
+describe_input_destroy(struct describe_input* di)
+{
+   if (di == NULL)
+   {
+      return;
+   }
 
-      free(wal_path);
-      wal_path = NULL;
+   free(di->buffer);
+   free(di->ends);
+   free(di);
+}
 
-      wal_path = pgmoneta_format_and_append(wal_path, "/tmp/%s", decrypted_file_name);
-      free(decrypted_file_name);
+static int
+describe_segment(char* path, struct describe_options* options, bool continuation, FILE* out,
+                 uint32_t* count, size_t** ends, uint32_t* number_of_ends)
+{
+   struct wal_record_iterator* record_iterator = NULL;
+   uint16_t magic = 0;
+   uint32_t capacity = 0;
 
-      if (pgmoneta_decrypt_file(tmp_wal, wal_path))
-      {
-         pgmoneta_log_fatal("Failed to decrypt WAL file at %s", path);
-         goto error;
-      }
+   if (!pgmoneta_is_file(path))
+   {
+      pgmoneta_log_fatal("WAL file at %s does not exist", path);
+      goto error;
    }
 
-   // Based on the file extension, if it's a compressed file, decompress it
-   // in /tmp
-   if (pgmoneta_is_compressed(wal_path))
+   if (validate_wal_file(path) != PGMONETA_WAL_SUCCESS)
    {
-      free(tmp_wal);
-      tmp_wal = NULL;
+      pgmoneta_log_fatal("Failed to read WAL file at %s", path);
+      goto error;
+   }
 
-      tmp_wal = pgmoneta_format_and_append(tmp_wal, "/tmp/%s", basename(wal_path));
+   /* Stream the records so only one decoded record is held at a time. Archived
+    * segments are decrypted and decompressed in memory by the iterator */
+   if (pgmoneta_wal_record_iterator_create(path, -1, NULL, &record_iterator))
+   {
+      pgmoneta_log_fatal("Failed to read WAL file at %s", path);
+      goto error;
+   }
+   magic = record_iterator->long_phd->std.xlp_magic;
 
-      if (copy)
-      {
-         // Temporarily copying the compressed WAL file, because the decompress
-         // functions delete the source file
-         pgmoneta_copy_file(wal_path, tmp_wal, NULL);
-      }
+   record_iterator->filter = options->filter;
 
-      pgmoneta_strip_extension(basename(wal_path), &decompressed_file_name);
+   /* The previous segment already reported the record continued here */
+   if (!continuation)
+   {
+      record_iterator->partial_first = false;
+   }
 
-      free(wal_path);
-      wal_path = NULL;
+   while (pgmoneta_wal_record_iterator_next(record_iterator))
+   {
+      uint32_t before = *count;
 
-      wal_path = pgmoneta_format_and_append(wal_path, "/tmp/%s", decompressed_file_name);
-      free(decompressed_file_name);
+      pgmoneta_wal_record_display(record_iterator->record, magic, options->type, out, options->quiet, options->color,
+                                  options->rms, options->start_lsn, options->end_lsn, options->xids,
+                                  options->limit, options->included_objects, count);
 
-      if (pgmoneta_decompress(tmp_wal, wal_path))
+      /* Remember where each shown record ends, so the output can be cut at the limit */
+      if (ends != NULL && *count != before && (options->limit == 0 || *count <= options->limit))
       {
-         pgmoneta_log_fatal("Failed to decompress WAL file at %s", path);
-         goto error;
+         if (*number_of_ends == capacity)
+         {
+            size_t* e = NULL;
+
+            capacity = capacity == 0 ? 1024 : capacity * 2;
+            e = (size_t*)realloc(*ends, capacity * sizeof(size_t));
+            if (e == NULL)
+            {
+               goto error;
+            }
+            *ends = e;
+         }
+
+         (*ends)[(*number_of_ends)++] = (size_t)ftell(out);
       }
    }
 
-   if (pgmoneta_read_walfile(-1, wal_path, &wf))
+   if (record_iterator->failed)
    {
       pgmoneta_log_fatal("Failed to read WAL file at %s", path);
       goto error;
    }
 
-   if (pgmoneta_deque_iterator_create(wf->records, &record_iterator))
-   {
-      pgmoneta_log_fatal("Failed to create deque iterator");
-      goto error;
-   }
+   pgmoneta_wal_record_iterator_destroy(record_iterator);
+
+   return 0;
+
+error:
+
+   pgmoneta_wal_record_iterator_destroy(record_iterator);
+
+   return 1;
+}
+
+int
+pgmoneta_describe_walfile(char* path, enum value_type type, char* output, bool quiet, bool color,
+                          struct deque* rms, uint64_t start_lsn, uint64_t end_lsn, struct deque* xids,
+                          uint32_t limit, char** included_objects)
+{
+   FILE* out = NULL;
+   char* buffer = NULL;
+   struct describe_options options;
+   uint32_t count = 0;
 
    if (output == NULL)
    {
@@ -398,33 +497,23 @@ pgmoneta_describe_walfile(char* path, enum value_type type, char* output, bool q
       color = false;
    }
 
-   if (type == ValueJSON)
-   {
-      if (!quiet)
-      {
-         fprintf(out, "{ \"WAL\": [\n");
-      }
+   describe_output_buffer(out, &buffer);
 
-      while (pgmoneta_deque_iterator_next(record_iterator))
-      {
-         record = (struct decoded_xlog_record*) record_iterator->value->data;
-         pgmoneta_wal_record_display(record, wf->long_phd->std.xlp_magic, type, out, quiet, color,
-                                     rms, start_lsn, end_lsn, xids, limit, included_objects);
-      }
+   describe_options_init(&options, type, quiet, color, rms, start_lsn, end_lsn, xids, limit, included_objects);
 
-      if (!quiet)
-      {
-         fprintf(out, "\n]}");
-      }
+   if (type == ValueJSON && !quiet)
+   {
+      fprintf(out, "{ \"WAL\": [\n");
    }
-   else
+
+   if (describe_segment(path, &options, true, out, &count, NULL, NULL))
    {
-      while (pgmoneta_deque_iterator_next(record_iterator))
-      {
-         record = (struct decoded_xlog_record*) record_iterator->value->data;
-         pgmoneta_wal_record_display(record, wf->long_phd->std.xlp_magic, type, out, quiet, color,
-                                     rms, start_lsn, end_lsn, xids, limit, included_objects);
-      }
+      goto error;
+   }
+
+   if (type == ValueJSON && !quiet)
+   {
+      fprintf(out, "\n]}");
    }
 
    if (output != NULL)
@@ -436,10 +525,10 @@ pgmoneta_describe_walfile(char* path, enum value_type type, char* output, bool q
       }
    }
 
-   free(tmp_wal);
-   free(wal_path);
-   pgmoneta_deque_iterator_destroy(record_iterator);
-   pgmoneta_destroy_walfile(wf);
+   free(buffer);
+
+   pgmoneta_wal_record_filter_destroy(options.filter);
+
    return 0;
 
 error:
@@ -453,9 +542,1197 @@ error:
       }
    }
 
-   free(tmp_wal);
-   free(wal_path);
-   pgmoneta_destroy_walfile(wf);
-   pgmoneta_deque_iterator_destroy(record_iterator);
+   free(buffer);
+
+   pgmoneta_wal_record_filter_destroy(options.filter);
+
+   return 1;
+}
+
+static bool
+is_wal_segment(char* name)
+{
+   return strlen(name) >= 24 && strspn(name, "0123456789ABCDEF") >= 24;
+}
+
+static bool
+segment_in_range(char* directory, char* name, uint64_t start_lsn, uint64_t end_lsn)
+{
+   char* path = NULL;
+   uint32_t tli = 0;
+   uint32_t log = 0;
+   uint32_t seg = 0;
+   size_t segsize = 0;
+   uint64_t base = 0;
+
+   if (start_lsn == 0 && end_lsn == 0)
+   {
+      return true;
+   }
+
+   /* The segment size is only known for plain segments */
+   if (pgmoneta_is_encrypted(name) || pgmoneta_is_compressed(name))
+   {
+      return true;
+   }
+
+   if (sscanf(name, "%08X%08X%08X", &tli, &log, &seg) != 3)
+   {
+      return true;
+   }
+
+   path = pgmoneta_append(path, directory);
+   if (!pgmoneta_ends_with(path, "/"))
+   {
+      path = pgmoneta_append(path, "/");
+   }
+   path = pgmoneta_append(path, name);
+   segsize = pgmoneta_get_file_size(path);
+   free(path);
+
+   if (segsize == 0)
+   {
+      return true;
+   }
+
+   base = ((uint64_t)log << 32) + (uint64_t)seg * segsize;
+
+   /* Records are selected by xl_prev >= start and lsn <= end */
+   if (start_lsn > 0 && base + segsize <= start_lsn)
+   {
+      return false;
+   }
+
+   if (end_lsn > 0 && base > end_lsn)
+   {
+      return false;
+   }
+
+   return true;
+}
+
+static bool
+segment_in_summary(char* directory, char* name, uint64_t start_lsn, uint64_t end_lsn, struct deque* xids)
+{
+   char* summaries = NULL;
+   char* path = NULL;
+   char* slash = NULL;
+   struct wal_summary* summary = NULL;
+   struct deque_iterator* iter = NULL;
+   bool found = true;
+
+   if (start_lsn == 0 && end_lsn == 0 && (xids == NULL || pgmoneta_deque_empty(xids)))
+   {
+      return true;
+   }
+
+   /* The summaries of <server>/wal/ are kept in <server>/wal_summary/ */
+   summaries = pgmoneta_append(summaries, directory);
+   while (pgmoneta_ends_with(summaries, "/") && strlen(summaries) > 1)
+   {
+      summaries[strlen(summaries) - 1] = '\0';
+   }
+   slash = strrchr(summaries, '/');
+   if (slash == NULL)
+   {
+      goto done;
+   }
+   *(slash + 1) = '\0';
+   summaries = pgmoneta_append(summaries, "wal_summary/");
+
+   path = pgmoneta_wal_summary_path(summaries, name);
+
+   /* Without a summary the segment is read */
+   if (!pgmoneta_exists(path) || pgmoneta_wal_summary_read(path, &summary))
+   {
+      goto done;
+   }
+
+   if (summary->records == 0)
+   {
+      goto done;
+   }
+
+   if (start_lsn > 0 && summary->end_lsn < start_lsn)
+   {
+      found = false;
+      goto done;
+   }
+
+   if (end_lsn > 0 && summary->start_lsn > end_lsn)
+   {
+      found = false;
+      goto done;
+   }
+
+   if (xids != NULL && !pgmoneta_deque_empty(xids))
+   {
+      found = false;
+
+      if (pgmoneta_deque_iterator_create(xids, &iter))
+      {
+         found = true;
+         goto done;
+      }
+
+      while (!found && pgmoneta_deque_iterator_next(iter))
+      {
+         found = pgmoneta_wal_summary_may_contain_xid(summary, (uint32_t)pgmoneta_value_data(iter->value));
+      }
+   }
+
+done:
+
+   pgmoneta_deque_iterator_destroy(iter);
+   free(summary);
+   free(path);
+   free(summaries);
+
+   return found;
+}
+
+static void
+describe_segment_worker(struct worker_common* wc)
+{
+   struct describe_input* di = (struct describe_input*)wc;
+   FILE* out = NULL;
+
+   out = open_memstream(&di->buffer, &di->size);
+   if (out == NULL)
+   {
+      di->failed = true;
+      goto done;
+   }
+
+   if (describe_segment(di->path, di->options, di->continuation, out,
+                        &di->count, &di->ends, &di->number_of_ends))
+   {
+      di->failed = true;
+   }
+
+   fclose(out);
+
+done:
+
+   if (di->failed && di->common.workers != NULL)
+   {
+      di->common.workers->outcome = false;
+   }
+}
+
+int
+pgmoneta_describe_walfiles(char* directory, enum value_type type, char* output, bool quiet, bool color,
+                           struct deque* rms, uint64_t start_lsn, uint64_t end_lsn, struct deque* xids,
+                           uint32_t limit, char** included_objects, int number_of_workers)
+{
+   FILE* out = NULL;
+   char* buffer = NULL;
+   struct workers* workers = NULL;
+   struct describe_options options;
+   struct describe_input** inputs = NULL;
+   char** files = NULL;
+   int number_of_files = 0;
+   int batch = 0;
+   int next = 0;
+   uint32_t total = 0;
+   bool first = true;
+   bool done = false;
+
+   memset(&options, 0, sizeof(struct describe_options));
+
+   if (!pgmoneta_is_directory(directory))
+   {
+      pgmoneta_log_fatal("WAL directory at %s does not exist", directory);
+      goto error;
+   }
+
+   if (pgmoneta_get_wal_files(directory, &number_of_files, &files))
+   {
+      pgmoneta_log_fatal("Failed to list WAL files in %s", directory);
+      goto error;
+   }
+
+   if (output == NULL)
+   {
+      out = stdout;
+   }
+   else
+   {
+      out = fopen(output, "w");
+      color = false;
+   }
+
+   describe_output_buffer(out, &buffer);
+
+   describe_options_init(&options, type, quiet, color, rms, start_lsn, end_lsn, xids, limit, included_objects);
+
+   if (number_of_workers > 1)
+   {
+      if (pgmoneta_workers_initialize(number_of_workers, &workers))
+      {
+         goto error;
+      }
+   }
+
+   /* Hold a few segments per worker, so the memory of the output stays bounded */
+   batch = MAX(number_of_workers, 1) * 2;
+   inputs = (struct describe_input**)calloc(batch, sizeof(struct describe_input*));
+   if (inputs == NULL)
+   {
+      goto error;
+   }
+
+   if (type == ValueJSON && !quiet)
+   {
+      fprintf(out, "{ \"WAL\": [\n");
+   }
+
+   while (!done && next < number_of_files)
+   {
+      int n = 0;
+
+      while (n < batch && next < number_of_files)
+      {
+         char* name = files[next++];
+         struct describe_input* di = NULL;
+
+         if (!is_wal_segment(name) || !segment_in_range(directory, name, start_lsn, end_lsn) ||
+             !segment_in_summary(directory, name, start_lsn, end_lsn, xids))
+         {
+            continue;
+         }
+
+         di = (struct describe_input*)calloc(1, sizeof(struct describe_input));
+         if (di == NULL)
+         {
+            goto error;
+         }
+
+         snprintf(di->path, sizeof(di->path), "%s%s%s", directory,
+                  pgmoneta_ends_with(directory, "/") ? "" : "/", name);
+         di->options = &options;
+         di->continuation = first;
+         di->common.workers = workers;
+         di->common.size = pgmoneta_get_file_size(di->path);
+         first = false;
+
+         inputs[n++] = di;
+
+         if (workers != NULL)
+         {
+            if (pgmoneta_workers_add(workers, describe_segment_worker, (struct worker_common*)di))
+            {
+               goto error;
+            }
+         }
+         else
+         {
+            describe_segment_worker((struct worker_common*)di);
+         }
+      }
+
+      if (workers != NULL)
+      {
+         pgmoneta_workers_wait(workers);
+      }
+
+      /* The segments are in LSN order, so their outputs are merged as they are */
+      for (int i = 0; i < n; i++)
+      {
+         struct describe_input* di = inputs[i];
+         uint32_t shown = di->number_of_ends;
+
+         if (di->failed)
+         {
+            goto error;
+         }
+
+         if (limit > 0)
+         {
+            shown = done ? 0 : MIN(shown, limit - total);
+         }
+
+         if (shown > 0)
+         {
+            if (type == ValueJSON && !quiet && total > 0)
+            {
+               fprintf(out, ",\n");
+            }
+
+            fwrite(di->buffer, 1, di->ends[shown - 1], out);
+            total += shown;
+         }
+
+         if (limit > 0 && total >= limit)
+         {
+            done = true;
+         }
+
+         describe_input_destroy(di);
+         inputs[i] = NULL;
+      }
+   }
+
+   if (type == ValueJSON && !quiet)
+   {
+      fprintf(out, "\n]}");
+   }
+
+   if (output != NULL)
+   {
+      if (out != NULL)
+      {
+         fflush(out);
+         fclose(out);
+      }
+   }
+
+   free(buffer);
+
+   pgmoneta_workers_destroy(workers);
+   pgmoneta_wal_record_filter_destroy(options.filter);
+
+   for (int i = 0; i < number_of_files; i++)
+   {
+      free(files[i]);
+   }
+   free(files);
+   free(inputs);
+
+   return 0;
+
+error:
+
+   if (workers != NULL)
+   {
+      pgmoneta_workers_wait(workers);
+      pgmoneta_workers_destroy(workers);
+   }
+
+   if (inputs != NULL)
+   {
+      for (int i = 0; i < batch; i++)
+      {
+         describe_input_destroy(inputs[i]);
+      }
+   }
+   free(inputs);
+   pgmoneta_wal_record_filter_destroy(options.filter);
+
+   if (output != NULL)
+   {
+      if (out != NULL)
+      {
+         fflush(out);
+         fclose(out);
+      }
+   }
+
+   free(buffer);
+
+   for (int i = 0; i < number_of_files; i++)
+   {
+      free(files[i]);
+   }
+   free(files);
+
+   return 1;
+}
+
+/** @struct stats_counter
+ * Defines the counters of a group of WAL records
+ */
+struct stats_counter
+{
+   uint64_t records;      /**< The number of records */
+   uint64_t record_bytes; /**< The size of the records */
+   uint64_t fpis;         /**< The number of full page images */
+   uint64_t fpi_bytes;    /**< The size of the full page images */
+};
+
+/** @struct stats_relation
+ * Defines the counters of a relation
+ */
+struct stats_relation
+{
+   bool in_use;                     /**< Is the slot in use */
+   struct rel_file_locator locator; /**< The relation */
+   struct stats_counter counter;    /**< The counters */
+};
+
+/** @struct wal_stats
+ * Defines the statistics of WAL segments
+ */
+struct wal_stats
+{
+   uint64_t segments;                                                 /**< The number of segments */
+   uint64_t incomplete;                                               /**< The number of records split over segments */
+   struct stats_counter types[UINT8_MAX + 1][STATS_RECORD_TYPES];     /**< The counters per resource manager and record type */
+   struct stats_relation* relations;                                  /**< The relations, an open addressing hash table */
+   uint32_t number_of_relations;                                      /**< The number of relations */
+   uint32_t capacity;                                                 /**< The capacity of the relations */
+};
+
+/** @struct stats_input
+ * Defines the input for the statistics of a WAL segment on a worker
+ */
+struct stats_input
+{
+   struct worker_common common;      /**< The common base */
+   char path[MAX_PATH];              /**< The path to the WAL segment */
+   bool continuation;                /**< Is a leading continuation record counted */
+   struct wal_record_filter* filter; /**< The filter */
+   struct wal_stats* stats;          /**< The statistics */
+   bool failed;                      /**< Did the statistics fail */
+};
+
+static struct wal_stats*
+stats_create(void)
+{
+   struct wal_stats* stats = NULL;
+
+   stats = (struct wal_stats*)calloc(1, sizeof(struct wal_stats));
+   if (stats == NULL)
+   {
+      return NULL;
+   }
+
+   stats->relations = (struct stats_relation*)calloc(STATS_RELATIONS, sizeof(struct stats_relation));
+   if (stats->relations == NULL)
+   {
+      free(stats);
+      return NULL;
+   }
+   stats->capacity = STATS_RELATIONS;
+
+   return stats;
+}
+
+static void
+stats_destroy(struct wal_stats* stats)
+{
+   if (stats == NULL)
+   {
+      return;
+   }
+
+   free(stats->relations);
+   free(stats);
+}
+
+static void
+stats_counter_add(struct stats_counter* to, struct stats_counter* from)
+{
+   to->records += from->records;
+   to->record_bytes += from->record_bytes;
+   to->fpis += from->fpis;
+   to->fpi_bytes += from->fpi_bytes;
+}
+
+static uint32_t
+stats_relation_hash(struct rel_file_locator* locator)
+{
+   uint64_t h = ((uint64_t)locator->spcOid * 0x9E3779B1u) ^ ((uint64_t)locator->dbOid * 0x85EBCA77u) ^
+                ((uint64_t)locator->relNumber * 0xC2B2AE3Du);
+
+   return (uint32_t)(h ^ (h >> 29));
+}
+
+static struct stats_relation*
+stats_relation_find(struct wal_stats* stats, struct rel_file_locator* locator)
+{
+   uint32_t i;
+
+   /* Grow at 75% full, so the probes stay short */
+   if ((stats->number_of_relations + 1) * 4 > stats->capacity * 3)
+   {
+      struct stats_relation* old = stats->relations;
+      uint32_t old_capacity = stats->capacity;
+      struct stats_relation* relations = NULL;
+
+      relations = (struct stats_relation*)calloc(old_capacity * 2, sizeof(struct stats_relation));
+      if (relations == NULL)
+      {
+         return NULL;
+      }
+
+      stats->relations = relations;
+      stats->capacity = old_capacity * 2;
+
+      for (uint32_t j = 0; j < old_capacity; j++)
+      {
+         if (old[j].in_use)
+         {
+            i = stats_relation_hash(&old[j].locator) & (stats->capacity - 1);
+            while (stats->relations[i].in_use)
+            {
+               i = (i + 1) & (stats->capacity - 1);
+            }
+            stats->relations[i] = old[j];
+         }
+      }
+
+      free(old);
+   }
+
+   i = stats_relation_hash(locator) & (stats->capacity - 1);
+   while (stats->relations[i].in_use)
+   {
+      struct rel_file_locator* l = &stats->relations[i].locator;
+
+      if (l->relNumber == locator->relNumber && l->dbOid == locator->dbOid && l->spcOid == locator->spcOid)
+      {
+         return &stats->relations[i];
+      }
+
+      i = (i + 1) & (stats->capacity - 1);
+   }
+
+   stats->relations[i].in_use = true;
+   stats->relations[i].locator = *locator;
+   stats->number_of_relations++;
+
+   return &stats->relations[i];
+}
+
+static int
+stats_record(struct wal_stats* stats, struct decoded_xlog_record* record)
+{
+   struct stats_counter* type = NULL;
+   struct stats_relation* relation = NULL;
+   uint64_t fpi_bytes = 0;
+   bool first = true;
+
+   if (record->partial)
+   {
+      stats->incomplete++;
+      return 0;
+   }
+
+   type = &stats->types[record->header.xl_rmid][(record->header.xl_info & XLR_RMGR_INFO_MASK) >> 4];
+   type->records++;
+   type->record_bytes += record->header.xl_tot_len;
+
+   for (int i = 0; i <= record->max_block_id; i++)
+   {
+      if (record->blocks[i].in_use && record->blocks[i].has_image)
+      {
+         type->fpis++;
+         type->fpi_bytes += record->blocks[i].bimg_len;
+         fpi_bytes += record->blocks[i].bimg_len;
+      }
+   }
+
+   /* The record is counted for the relation of its first block, and each
+    * image for the relation of its own block, so the bytes of the relations
+    * add up to the bytes of the records */
+   for (int i = 0; i <= record->max_block_id; i++)
+   {
+      struct decoded_bkp_block* block = &record->blocks[i];
+
+      if (!block->in_use || (!first && !block->has_image))
+      {
+         continue;
+      }
+
+      relation = stats_relation_find(stats, &block->rlocator);
+      if (relation == NULL)
+      {
+         return 1;
+      }
+
+      if (first)
+      {
+         relation->counter.records++;
+         relation->counter.record_bytes += record->header.xl_tot_len - MIN(fpi_bytes, record->header.xl_tot_len);
+         first = false;
+      }
+
+      if (block->has_image)
+      {
+         relation->counter.record_bytes += block->bimg_len;
+         relation->counter.fpis++;
+         relation->counter.fpi_bytes += block->bimg_len;
+      }
+   }
+
+   return 0;
+}
+
+static int
+stats_merge(struct wal_stats* to, struct wal_stats* from)
+{
+   to->segments += from->segments;
+   to->incomplete += from->incomplete;
+
+   for (int i = 0; i <= UINT8_MAX; i++)
+   {
+      for (int j = 0; j < STATS_RECORD_TYPES; j++)
+      {
+         stats_counter_add(&to->types[i][j], &from->types[i][j]);
+      }
+   }
+
+   for (uint32_t i = 0; i < from->capacity; i++)
+   {
+      struct stats_relation* relation = NULL;
+
+      if (!from->relations[i].in_use)
+      {
+         continue;
+      }
+
+      relation = stats_relation_find(to, &from->relations[i].locator);
+      if (relation == NULL)
+      {
+         return 1;
+      }
+
+      stats_counter_add(&relation->counter, &from->relations[i].counter);
+   }
+
+   return 0;
+}
+
+static int
+stats_segment(char* path, struct wal_record_filter* filter, bool continuation, struct wal_stats* stats)
+{
+   struct wal_record_iterator* record_iterator = NULL;
+
+   if (!pgmoneta_is_file(path))
+   {
+      pgmoneta_log_fatal("WAL file at %s does not exist", path);
+      goto error;
+   }
+
+   if (validate_wal_file(path) != PGMONETA_WAL_SUCCESS)
+   {
+      pgmoneta_log_fatal("Failed to read WAL file at %s", path);
+      goto error;
+   }
+
+   if (pgmoneta_wal_record_iterator_create(path, -1, NULL, &record_iterator))
+   {
+      pgmoneta_log_fatal("Failed to read WAL file at %s", path);
+      goto error;
+   }
+
+   record_iterator->filter = filter;
+
+   /* The previous segment already counted the record continued here */
+   if (!continuation)
+   {
+      record_iterator->partial_first = false;
+   }
+
+   while (pgmoneta_wal_record_iterator_next(record_iterator))
+   {
+      if (stats_record(stats, record_iterator->record))
+      {
+         goto error;
+      }
+   }
+
+   if (record_iterator->failed)
+   {
+      pgmoneta_log_fatal("Failed to read WAL file at %s", path);
+      goto error;
+   }
+
+   stats->segments++;
+
+   pgmoneta_wal_record_iterator_destroy(record_iterator);
+
+   return 0;
+
+error:
+
+   pgmoneta_wal_record_iterator_destroy(record_iterator);
+
+   return 1;
+}
+
+static void
+stats_segment_worker(struct worker_common* wc)
+{
+   struct stats_input* si = (struct stats_input*)wc;
+
+   if (stats_segment(si->path, si->filter, si->continuation, si->stats))
+   {
+      si->failed = true;
+   }
+
+   if (si->failed && si->common.workers != NULL)
+   {
+      si->common.workers->outcome = false;
+   }
+}
+
+static void
+stats_input_destroy(struct stats_input* si)
+{
+   if (si == NULL)
+   {
+      return;
+   }
+
+   stats_destroy(si->stats);
+   free(si);
+}
+
+static int
+stats_relation_compare(const void* a, const void* b)
+{
+   const struct stats_relation* ra = (const struct stats_relation*)a;
+   const struct stats_relation* rb = (const struct stats_relation*)b;
+
+   if (ra->counter.record_bytes != rb->counter.record_bytes)
+   {
+      return ra->counter.record_bytes < rb->counter.record_bytes ? 1 : -1;
+   }
+
+   if (ra->locator.dbOid != rb->locator.dbOid)
+   {
+      return ra->locator.dbOid < rb->locator.dbOid ? -1 : 1;
+   }
+
+   if (ra->locator.relNumber != rb->locator.relNumber)
+   {
+      return ra->locator.relNumber < rb->locator.relNumber ? -1 : 1;
+   }
+
+   return 0;
+}
+
+static double
+stats_percent(uint64_t part, uint64_t total)
+{
+   return total > 0 ? 100.0 * (double)part / (double)total : 0.0;
+}
+
+static void
+stats_output_row(FILE* out, enum value_type type, bool first, char* key, char* name,
+                 struct stats_counter* counter, struct stats_counter* total)
+{
+   if (type == ValueJSON)
+   {
+      fprintf(out, "%s\n    { \"%s\": \"%s\", \"Records\": %" PRIu64 ", \"RecordBytes\": %" PRIu64
+              ", \"FPI\": %" PRIu64 ", \"FPIBytes\": %" PRIu64 " }",
+              first ? "" : ",", key, name, counter->records, counter->record_bytes,
+              counter->fpis, counter->fpi_bytes);
+   }
+   else
+   {
+      fprintf(out, "%-32s %12" PRIu64 " %6.2f%% %14" PRIu64 " %6.2f%% %10" PRIu64 " %14" PRIu64 " %6.2f%%\n",
+              name, counter->records, stats_percent(counter->records, total->records),
+              counter->record_bytes, stats_percent(counter->record_bytes, total->record_bytes),
+              counter->fpis, counter->fpi_bytes, stats_percent(counter->fpi_bytes, total->fpi_bytes));
+   }
+}
+
+static void
+stats_output_section(FILE* out, enum value_type type, char* title, char* key)
+{
+   if (type == ValueJSON)
+   {
+      fprintf(out, ",\n  \"%s\": [", title);
+   }
+   else
+   {
+      fprintf(out, "\n%-32s %12s %7s %14s %7s %10s %14s %7s\n", key,
+              "Records", "%", "Bytes", "%", "FPI", "FPI bytes", "%");
+   }
+}
+
+static void
+stats_output_section_end(FILE* out, enum value_type type)
+{
+   if (type == ValueJSON)
+   {
+      fprintf(out, "\n  ]");
+   }
+}
+
+static int
+stats_output(FILE* out, enum value_type type, struct wal_stats* stats, uint32_t limit)
+{
+   struct stats_counter total;
+   struct stats_relation* relations = NULL;
+   struct stats_relation* databases = NULL;
+   uint32_t number_of_relations = 0;
+   uint32_t number_of_databases = 0;
+   uint32_t shown = 0;
+   char name[MISC_LENGTH];
+   bool first = true;
+
+   memset(&total, 0, sizeof(struct stats_counter));
+
+   for (int i = 0; i <= UINT8_MAX; i++)
+   {
+      for (int j = 0; j < STATS_RECORD_TYPES; j++)
+      {
+         stats_counter_add(&total, &stats->types[i][j]);
+      }
+   }
+
+   /* The relations are sorted by size, and summed per database */
+   relations = (struct stats_relation*)calloc(stats->number_of_relations + 1, sizeof(struct stats_relation));
+   databases = (struct stats_relation*)calloc(stats->number_of_relations + 1, sizeof(struct stats_relation));
+   if (relations == NULL || databases == NULL)
+   {
+      goto error;
+   }
+
+   for (uint32_t i = 0; i < stats->capacity; i++)
+   {
+      if (stats->relations[i].in_use)
+      {
+         relations[number_of_relations++] = stats->relations[i];
+      }
+   }
+
+   qsort(relations, number_of_relations, sizeof(struct stats_relation), stats_relation_compare);
+
+   for (uint32_t i = 0; i < number_of_relations; i++)
+   {
+      uint32_t d = 0;
+
+      while (d < number_of_databases && databases[d].locator.dbOid != relations[i].locator.dbOid)
+      {
+         d++;
+      }
+
+      if (d == number_of_databases)
+      {
+         databases[d].locator.dbOid = relations[i].locator.dbOid;
+         number_of_databases++;
+      }
+
+      stats_counter_add(&databases[d].counter, &relations[i].counter);
+   }
+
+   qsort(databases, number_of_databases, sizeof(struct stats_relation), stats_relation_compare);
+
+   if (type == ValueJSON)
+   {
+      fprintf(out, "{\n  \"Segments\": %" PRIu64 ", \"Records\": %" PRIu64 ", \"RecordBytes\": %" PRIu64
+              ", \"FPI\": %" PRIu64 ", \"FPIBytes\": %" PRIu64 ", \"Incomplete\": %" PRIu64,
+              stats->segments, total.records, total.record_bytes, total.fpis, total.fpi_bytes,
+              stats->incomplete);
+   }
+   else
+   {
+      fprintf(out, "Segments:    %" PRIu64 "\n", stats->segments);
+      fprintf(out, "Records:     %" PRIu64 "\n", total.records);
+      fprintf(out, "Bytes:       %" PRIu64 "\n", total.record_bytes);
+      fprintf(out, "FPI:         %" PRIu64 "\n", total.fpis);
+      fprintf(out, "FPI bytes:   %" PRIu64 " (%.2f%%)\n", total.fpi_bytes,
+              stats_percent(total.fpi_bytes, total.record_bytes));
+      fprintf(out, "Incomplete:  %" PRIu64 "\n", stats->incomplete);
+   }
+
+   stats_output_section(out, type, "ResourceManagers", "Resource manager");
+   first = true;
+   for (int i = 0; i <= UINT8_MAX; i++)
+   {
+      struct stats_counter rm;
+      char* rm_name = pgmoneta_wal_rmgr_name((rmgr_id)i);
+
+      memset(&rm, 0, sizeof(struct stats_counter));
+      for (int j = 0; j < STATS_RECORD_TYPES; j++)
+      {
+         stats_counter_add(&rm, &stats->types[i][j]);
+      }
+
+      if (rm.records == 0)
+      {
+         continue;
+      }
+
+      if (rm_name != NULL)
+      {
+         snprintf(name, sizeof(name), "%s", rm_name);
+      }
+      else
+      {
+         snprintf(name, sizeof(name), "%d", i);
+      }
+
+      stats_output_row(out, type, first, "ResourceManager", name, &rm, &total);
+      first = false;
+   }
+   stats_output_section_end(out, type);
+
+   stats_output_section(out, type, "RecordTypes", "Record type");
+   first = true;
+   for (int i = 0; i <= UINT8_MAX; i++)
+   {
+      char* rm_name = pgmoneta_wal_rmgr_name((rmgr_id)i);
+
+      for (int j = 0; j < STATS_RECORD_TYPES; j++)
+      {
+         if (stats->types[i][j].records == 0)
+         {
+            continue;
+         }
+
+         if (rm_name != NULL)
+         {
+            snprintf(name, sizeof(name), "%s/0x%02X", rm_name, j << 4);
+         }
+         else
+         {
+            snprintf(name, sizeof(name), "%d/0x%02X", i, j << 4);
+         }
+
+         stats_output_row(out, type, first, "RecordType", name, &stats->types[i][j], &total);
+         first = false;
+      }
+   }
+   stats_output_section_end(out, type);
+
+   stats_output_section(out, type, "Databases", "Database");
+   for (uint32_t i = 0; i < number_of_databases; i++)
+   {
+      snprintf(name, sizeof(name), "%u", databases[i].locator.dbOid);
+      stats_output_row(out, type, i == 0, "Database", name, &databases[i].counter, &total);
+   }
+   stats_output_section_end(out, type);
+
+   stats_output_section(out, type, "Relations", "Relation");
+   shown = limit > 0 ? MIN(limit, number_of_relations) : number_of_relations;
+   for (uint32_t i = 0; i < shown; i++)
+   {
+      snprintf(name, sizeof(name), "%u/%u/%u", relations[i].locator.spcOid,
+               relations[i].locator.dbOid, relations[i].locator.relNumber);
+      stats_output_row(out, type, i == 0, "Relation", name, &relations[i].counter, &total);
+   }
+   stats_output_section_end(out, type);
+
+   if (type == ValueJSON)
+   {
+      fprintf(out, "\n}\n");
+   }
+
+   free(relations);
+   free(databases);
+
+   return 0;
+
+error:
+
+   free(relations);
+   free(databases);
+
+   return 1;
+}
+
+int
+pgmoneta_stats_walfiles(char* path, enum value_type type, char* output,
+                        struct deque* rms, uint64_t start_lsn, uint64_t end_lsn, struct deque* xids,
+                        uint32_t limit, int number_of_workers)
+{
+   FILE* out = NULL;
+   struct workers* workers = NULL;
+   struct describe_options options;
+   struct stats_input** inputs = NULL;
+   struct wal_stats* stats = NULL;
+   char** files = NULL;
+   int number_of_files = 0;
+   int batch = 0;
+   int next = 0;
+   bool first = true;
+   bool directory = false;
+
+   memset(&options, 0, sizeof(struct describe_options));
+
+   directory = pgmoneta_is_directory(path);
+
+   if (directory)
+   {
+      if (pgmoneta_get_wal_files(path, &number_of_files, &files))
+      {
+         pgmoneta_log_fatal("Failed to list WAL files in %s", path);
+         goto error;
+      }
+   }
+   else
+   {
+      number_of_files = 1;
+      files = (char**)calloc(1, sizeof(char*));
+      if (files == NULL)
+      {
+         goto error;
+      }
+      files[0] = pgmoneta_append(NULL, path);
+      number_of_workers = 1;
+   }
+
+   describe_options_init(&options, type, true, false, rms, start_lsn, end_lsn, xids, limit, NULL);
+
+   stats = stats_create();
+   if (stats == NULL)
+   {
+      goto error;
+   }
+
+   if (number_of_workers > 1)
+   {
+      if (pgmoneta_workers_initialize(number_of_workers, &workers))
+      {
+         goto error;
+      }
+   }
+
+   /* Each segment is counted on its own and merged, so the workers share nothing */
+   batch = MAX(number_of_workers, 1) * 2;
+   inputs = (struct stats_input**)calloc(batch, sizeof(struct stats_input*));
+   if (inputs == NULL)
+   {
+      goto error;
+   }
+
+   while (next < number_of_files)
+   {
+      int n = 0;
+
+      while (n < batch && next < number_of_files)
+      {
+         char* name = files[next++];
+         struct stats_input* si = NULL;
+
+         if (directory && (!is_wal_segment(name) || !segment_in_range(path, name, start_lsn, end_lsn) ||
+                           !segment_in_summary(path, name, start_lsn, end_lsn, xids)))
+         {
+            continue;
+         }
+
+         si = (struct stats_input*)calloc(1, sizeof(struct stats_input));
+         if (si == NULL)
+         {
+            goto error;
+         }
+         inputs[n++] = si;
+
+         si->stats = stats_create();
+         if (si->stats == NULL)
+         {
+            goto error;
+         }
+
+         if (directory)
+         {
+            snprintf(si->path, sizeof(si->path), "%s%s%s", path,
+                     pgmoneta_ends_with(path, "/") ? "" : "/", name);
+         }
+         else
+         {
+            snprintf(si->path, sizeof(si->path), "%s", name);
+         }
+         si->filter = options.filter;
+         si->continuation = first;
+         si->common.workers = workers;
+         si->common.size = pgmoneta_get_file_size(si->path);
+         first = false;
+
+         if (workers != NULL)
+         {
+            if (pgmoneta_workers_add(workers, stats_segment_worker, (struct worker_common*)si))
+            {
+               goto error;
+            }
+         }
+         else
+         {
+            stats_segment_worker((struct worker_common*)si);
+         }
+      }
+
+      if (workers != NULL)
+      {
+         pgmoneta_workers_wait(workers);
+      }
+
+      for (int i = 0; i < n; i++)
+      {
+         if (inputs[i]->failed || stats_merge(stats, inputs[i]->stats))
+         {
+            goto error;
+         }
+
+         stats_input_destroy(inputs[i]);
+         inputs[i] = NULL;
+      }
+   }
+
+   if (output == NULL)
+   {
+      out = stdout;
+   }
+   else
+   {
+      out = fopen(output, "w");
+      if (out == NULL)
+      {
+         pgmoneta_log_fatal("Failed to open %s", output);
+         goto error;
+      }
+   }
+
+   if (stats_output(out, type, stats, limit))
+   {
+      goto error;
+   }
+
+   if (output != NULL)
+   {
+      fflush(out);
+      fclose(out);
+   }
+
+   pgmoneta_workers_destroy(workers);
+   pgmoneta_wal_record_filter_destroy(options.filter);
+   stats_destroy(stats);
+
+   for (int i = 0; i < number_of_files; i++)
+   {
+      free(files[i]);
+   }
+   free(files);
+   free(inputs);
+
+   return 0;
+
+error:
+
+   if (workers != NULL)
+   {
+      pgmoneta_workers_wait(workers);
+      pgmoneta_workers_destroy(workers);
+   }
+
+   if (inputs != NULL)
+   {
+      for (int i = 0; i < batch; i++)
+      {
+         stats_input_destroy(inputs[i]);
+      }
+   }
+   free(inputs);
+   pgmoneta_wal_record_filter_destroy(options.filter);
+   stats_destroy(stats);
+
+   if (output != NULL && out != NULL)
+   {
+      fflush(out);
+      fclose(out);
+   }
+
+   for (int i = 0; i < number_of_files; i++)
+   {
+      free(files[i]);
+   }
+   free(files);
+
    return 1;
 }
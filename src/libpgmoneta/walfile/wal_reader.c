@@ -28,8 +28,10 @@
 
 /* pgmoneta */
 #include <pgmoneta.h>
-#include <json.h>
 #include <logging.h>
+#include <memory.h>
+#include <reader.h>
+#include <security.h>
 #include <utils.h>
 #include <wal.h>
 #include <walfile.h>
@@ -38,14 +40,50 @@
 
 /* system */
 #include <assert.h>
+#include <stddef.h>
+#include <fcntl.h>
 #include <libgen.h>
 #include <stdint.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define WAL_ARENA_BLOCK_SIZE ((size_t)(64 * 1024))
+
+/**
+ * @struct wal_arena_block
+ * A block of memory in a WAL arena
+ */
+struct wal_arena_block
+{
+   struct wal_arena_block* next; /**< The next block */
+   size_t size;                  /**< The size of the data */
+   size_t used;                  /**< The used part of the data */
+   char data[];                  /**< The data */
+};
+
+/**
+ * @struct wal_arena
+ * A bump allocator for decoded WAL records
+ */
+struct wal_arena
+{
+   struct wal_arena_block* head; /**< The current block */
+   size_t allocated;             /**< The number of bytes handed out */
+};
 
 struct server* server_config;
 
-static int decode_xlog_record(char* buffer, struct decoded_xlog_record* decoded, struct xlog_record* record, uint32_t block_size, uint16_t magic_value, xlog_rec_ptr lsn);
-static void record_json(struct decoded_xlog_record* record, uint8_t magic_value, struct value** value);
+static struct decoded_xlog_record* partial_record(struct wal_record_iterator* iterator);
+static char* record_payload(struct wal_arena* arena, char* ptr, size_t length);
+static uint32_t record_crc(struct xlog_record* record, char* data, uint32_t length);
+static int decode_xlog_record(char* buffer, struct decoded_xlog_record* decoded, struct xlog_record* record, struct decoded_bkp_block* blocks, struct wal_arena* arena, uint32_t block_size, uint16_t magic_value, xlog_rec_ptr lsn);
+static void out_str(FILE* out, char* str);
+static void out_uint(FILE* out, uint64_t value);
+static void out_hex(FILE* out, uint32_t value);
+static void out_lsn(FILE* out, uint64_t lsn);
+static void out_json_string(FILE* out, char* str);
 static bool get_record_block_tag_extended(struct decoded_xlog_record* pRecord, int id, struct rel_file_locator* pLocator, enum fork_number* pNumber, block_number* pInt, buffer* pVoid);
 static char* get_record_block_ref_info(char* buf, struct decoded_xlog_record* record, bool pretty, bool detailed_format, uint32_t* fpi_len, uint8_t magic_value);
 static int magic_value_to_postgres_version(uint16_t magic_value);
@@ -140,344 +178,786 @@ pgmoneta_wal_array_desc(char* buf, void* array, size_t elem_size, int count)
 }
 
 static void
-read_all_page_headers(FILE* file, struct xlog_long_page_header_data* long_header, struct walfile* wal_file)
+read_all_page_headers(char* map, size_t size, struct xlog_long_page_header_data* long_header, struct walfile* wal_file)
 {
-   int page_number = 1;
-   while (true)
+   struct xlog_page_header_data* page_header = NULL;
+   size_t offset = 0;
+
+   for (int page_number = 1;; page_number++)
    {
-      fseek(file, page_number * long_header->xlp_xlog_blcksz, SEEK_SET);
-      struct xlog_page_header_data* page_header = NULL;
-      page_header = malloc(SIZE_OF_XLOG_SHORT_PHD);
-      size_t bytes_read = fread(page_header, SIZE_OF_XLOG_SHORT_PHD, 1, file);
-      if (feof(file))
+      offset = (size_t)page_number * long_header->xlp_xlog_blcksz;
+      if (offset + SIZE_OF_XLOG_SHORT_PHD > size)
       {
-         free(page_header);
-         goto finish;
+         break;
       }
-      if (bytes_read != 1)
+
+      page_header = malloc(SIZE_OF_XLOG_SHORT_PHD);
+      if (page_header == NULL)
       {
-         pgmoneta_log_error("Error: Failed to read the complete data");
-         goto error;
+         pgmoneta_log_fatal("Error: Could not read all page headers");
+         break;
       }
+      memcpy(page_header, map + offset, SIZE_OF_XLOG_SHORT_PHD);
+
       pgmoneta_deque_add(wal_file->page_headers, NULL, (uintptr_t) page_header, ValueRef);
-      page_number++;
    }
-finish:
-   return;
+}
+
+int
+pgmoneta_wal_arena_create(struct wal_arena** arena)
+{
+   struct wal_arena* a = NULL;
+
+   *arena = NULL;
+
+   a = (struct wal_arena*)calloc(1, sizeof(struct wal_arena));
+   if (a == NULL)
+   {
+      goto error;
+   }
+
+   *arena = a;
+
+   return 0;
+
 error:
-   pgmoneta_log_fatal("Error: Could not read all page headers");
-   return;
+
+   return 1;
+}
+
+void*
+pgmoneta_wal_arena_allocate(struct wal_arena* arena, size_t size)
+{
+   struct wal_arena_block* block = NULL;
+   size_t block_size = 0;
+   void* p = NULL;
+
+   if (arena == NULL || size == 0)
+   {
+      return NULL;
+   }
+
+   size = MAXALIGN(size);
+   block = arena->head;
+
+   if (block == NULL || block->size - block->used < size)
+   {
+      block_size = MAX(size, WAL_ARENA_BLOCK_SIZE);
+
+      block = (struct wal_arena_block*)malloc(sizeof(struct wal_arena_block) + block_size);
+      if (block == NULL)
+      {
+         return NULL;
+      }
+
+      block->size = block_size;
+      block->used = 0;
+      block->next = arena->head;
+      arena->head = block;
+
+      pgmoneta_memory_account((long)(sizeof(struct wal_arena_block) + block_size));
+   }
+
+   p = block->data + block->used;
+   block->used += size;
+   arena->allocated += size;
+
+   memset(p, 0, size);
+
+   return p;
+}
+
+void
+pgmoneta_wal_arena_reset(struct wal_arena* arena)
+{
+   struct wal_arena_block* block = NULL;
+   struct wal_arena_block* next = NULL;
+   struct wal_arena_block* keep = NULL;
+
+   if (arena == NULL)
+   {
+      return;
+   }
+
+   block = arena->head;
+   while (block != NULL)
+   {
+      next = block->next;
+
+      if (keep == NULL && block->size == WAL_ARENA_BLOCK_SIZE)
+      {
+         keep = block;
+         keep->used = 0;
+         keep->next = NULL;
+      }
+      else
+      {
+         pgmoneta_memory_account(-(long)(sizeof(struct wal_arena_block) + block->size));
+         free(block);
+      }
+
+      block = next;
+   }
+
+   arena->head = keep;
+   arena->allocated = 0;
+}
+
+void
+pgmoneta_wal_arena_destroy(struct wal_arena* arena)
+{
+   if (arena == NULL)
+   {
+      return;
+   }
+
+   pgmoneta_wal_arena_reset(arena);
+   if (arena->head != NULL)
+   {
+      pgmoneta_memory_account(-(long)(sizeof(struct wal_arena_block) + arena->head->size));
+   }
+   free(arena->head);
+   free(arena);
+}
+
+static struct decoded_xlog_record*
+partial_record(struct wal_record_iterator* iterator)
+{
+   struct decoded_xlog_record* decoded = NULL;
+
+   decoded = (struct decoded_xlog_record*)pgmoneta_wal_arena_allocate(iterator->arena, sizeof(struct decoded_xlog_record));
+   if (decoded == NULL)
+   {
+      pgmoneta_log_fatal("Error: Could not allocate memory for decoded");
+      return NULL;
+   }
+
+   decoded->partial = true;
+   decoded->max_block_id = -1;
+
+   return decoded;
+}
+
+static char*
+record_payload(struct wal_arena* arena, char* ptr, size_t length)
+{
+   char* copy = NULL;
+
+   /* Payloads are read through struct casts, so only aligned data is used in place */
+   if (((uintptr_t)ptr % MAXIMUM_ALIGNOF) == 0)
+   {
+      return ptr;
+   }
+
+   copy = (char*)pgmoneta_wal_arena_allocate(arena, length);
+   if (copy != NULL)
+   {
+      memcpy(copy, ptr, length);
+   }
+
+   return copy;
 }
 
 int
-pgmoneta_wal_parse_wal_file(char* path, int server, struct walfile* wal_file)
+pgmoneta_wal_record_filter_create(struct deque* rms, uint64_t start_lsn, uint64_t end_lsn, struct deque* xids,
+                                  struct wal_record_filter** filter)
 {
-#define MALLOC(pointer, size) \
-        pointer = malloc(size); \
-        if (pointer == NULL) \
-        { \
-           pgmoneta_log_fatal("Error: Could not allocate memory for %s", #pointer); \
-           goto error; \
-        }
-
-   struct xlog_record* record = NULL;
-   struct xlog_long_page_header_data* long_header = NULL;
+   struct wal_record_filter* f = NULL;
+   struct deque_iterator* rms_iter = NULL;
+
+   *filter = NULL;
+
+   f = (struct wal_record_filter*)calloc(1, sizeof(struct wal_record_filter));
+   if (f == NULL)
+   {
+      goto error;
+   }
+
+   f->start_lsn = start_lsn;
+   f->end_lsn = end_lsn;
+   f->xids = xids;
+
+   if (rms != NULL)
+   {
+      f->by_rmgr = true;
+
+      if (pgmoneta_deque_iterator_create(rms, &rms_iter))
+      {
+         goto error;
+      }
+
+      while (pgmoneta_deque_iterator_next(rms_iter))
+      {
+         char* name = (char*)pgmoneta_value_data(rms_iter->value);
+
+         for (int i = 0; i <= RM_MAX_ID; i++)
+         {
+            if (RmgrTable[i].name != NULL && !strcmp(RmgrTable[i].name, name))
+            {
+               f->rmgrs[i] = true;
+            }
+         }
+      }
+
+      /* Records of unknown resource managers are not filtered */
+      for (int i = 0; i <= RM_MAX_ID; i++)
+      {
+         if (RmgrTable[i].name == NULL)
+         {
+            f->rmgrs[i] = true;
+         }
+      }
+
+      pgmoneta_deque_iterator_destroy(rms_iter);
+   }
+
+   *filter = f;
+
+   return 0;
+
+error:
+
+   pgmoneta_deque_iterator_destroy(rms_iter);
+   free(f);
+
+   return 1;
+}
+
+bool
+pgmoneta_wal_record_filter_accept(struct wal_record_filter* filter, struct xlog_record* header, xlog_rec_ptr lsn)
+{
+   struct deque_iterator* xids_iter = NULL;
+   bool found = false;
+
+   if (filter == NULL)
+   {
+      return true;
+   }
+
+   if (filter->start_lsn > 0 && header->xl_prev < filter->start_lsn)
+   {
+      return false;
+   }
+
+   if (filter->end_lsn > 0 && lsn > filter->end_lsn)
+   {
+      return false;
+   }
+
+   if (filter->by_rmgr && !filter->rmgrs[header->xl_rmid])
+   {
+      return false;
+   }
+
+   if (filter->xids != NULL)
+   {
+      if (pgmoneta_deque_iterator_create(filter->xids, &xids_iter))
+      {
+         return true;
+      }
+
+      while (!found && pgmoneta_deque_iterator_next(xids_iter))
+      {
+         if (header->xl_xid == (uint32_t)pgmoneta_value_data(xids_iter->value))
+         {
+            found = true;
+         }
+      }
+
+      pgmoneta_deque_iterator_destroy(xids_iter);
+
+      if (!found)
+      {
+         return false;
+      }
+   }
+
+   return true;
+}
+
+void
+pgmoneta_wal_record_filter_destroy(struct wal_record_filter* filter)
+{
+   free(filter);
+}
+
+static int
+read_segment(char* path, char** data, size_t* size)
+{
+   struct reader* reader = NULL;
    char* buffer = NULL;
-   struct decoded_xlog_record* decoded = NULL;
-   struct xlog_page_header_data* page_header = NULL;
+   size_t capacity = DEFAULT_WAL_SEGZ_BYTES;
+   size_t length = 0;
+   size_t n = 0;
+
+   *data = NULL;
+   *size = 0;
+
+   if (pgmoneta_reader_open(path, &reader))
+   {
+      goto error;
+   }
+
+   buffer = (char*)malloc(capacity);
+   if (buffer == NULL)
+   {
+      goto error;
+   }
+
+   while (true)
+   {
+      if (length == capacity)
+      {
+         char* b = NULL;
+
+         capacity *= 2;
+         b = (char*)realloc(buffer, capacity);
+         if (b == NULL)
+         {
+            goto error;
+         }
+         buffer = b;
+      }
+
+      if (pgmoneta_reader_read(reader, buffer + length, capacity - length, &n))
+      {
+         goto error;
+      }
+
+      if (n == 0)
+      {
+         break;
+      }
+
+      length += n;
+   }
+
+   pgmoneta_reader_close(reader);
+
+   *data = buffer;
+   *size = length;
+
+   return 0;
+
+error:
+
+   pgmoneta_reader_close(reader);
+   free(buffer);
+
+   return 1;
+}
+
+/* The CRC covers the data of the record followed by its header up to the CRC itself */
+static uint32_t
+record_crc(struct xlog_record* record, char* data, uint32_t length)
+{
+   uint32_t crc = 0;
+
+   pgmoneta_create_crc32c_buffer(data, length, &crc);
+   pgmoneta_create_crc32c_buffer(record, offsetof(struct xlog_record, xl_crc), &crc);
+
+   return crc;
+}
+
+int
+pgmoneta_wal_record_iterator_create(char* path, int server, struct wal_arena* arena, struct wal_record_iterator** iterator)
+{
+   struct wal_record_iterator* it = NULL;
    struct walinfo_configuration* config = NULL;
+   struct stat st;
    timeline_id tli = 0;
    xlog_seg_no logSegNo = 0;
-   xlog_rec_ptr base;
    int wal_segz_bytes = DEFAULT_WAL_SEGZ_BYTES;
-   char* temp_buffer = NULL;
+   int fd = -1;
+
+   *iterator = NULL;
+
+   config = (struct walinfo_configuration*) shmem;
+
+   it = (struct wal_record_iterator*)calloc(1, sizeof(struct wal_record_iterator));
+   if (it == NULL)
+   {
+      pgmoneta_log_fatal("Error: Could not allocate memory for the iterator");
+      goto error;
+   }
+
+   if (arena != NULL)
+   {
+      it->arena = arena;
+      it->keep = true;
+   }
+   else if (pgmoneta_wal_arena_create(&it->arena))
+   {
+      pgmoneta_log_fatal("Error: Could not allocate memory for the arena");
+      goto error;
+   }
+
+   if (pgmoneta_is_encrypted(path) || pgmoneta_is_compressed(path))
+   {
+      /* Archived segments are decrypted and decompressed into memory */
+      if (read_segment(path, &it->map, &it->size))
+      {
+         pgmoneta_log_fatal("Error: Could not read file %s", path);
+         goto error;
+      }
+   }
+   else
+   {
+      fd = open(path, O_RDONLY);
+      if (fd == -1 || fstat(fd, &st))
+      {
+         pgmoneta_log_fatal("Error: Could not open file %s", path);
+         goto error;
+      }
+
+      it->size = (size_t)st.st_size;
+
+      if (it->size < SIZE_OF_XLOG_LONG_PHD)
+      {
+         pgmoneta_log_error("Error: Failed to read the complete data");
+         goto error;
+      }
+
+      it->map = mmap(NULL, it->size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (it->map == MAP_FAILED)
+      {
+         it->map = NULL;
+         pgmoneta_log_fatal("Error: Could not map file %s", path);
+         goto error;
+      }
+      it->mapped = true;
+
+      madvise(it->map, it->size, MADV_SEQUENTIAL);
+
+      close(fd);
+      fd = -1;
+   }
+
+   wal_segz_bytes = (int)it->size;
+
+   if (it->size < SIZE_OF_XLOG_LONG_PHD)
+   {
+      pgmoneta_log_error("Error: Failed to read the complete data");
+      goto error;
+   }
+
+   it->long_phd = (struct xlog_long_page_header_data*)malloc(SIZE_OF_XLOG_LONG_PHD);
+   if (it->long_phd == NULL)
+   {
+      pgmoneta_log_fatal("Error: Could not allocate memory for long_header");
+      goto error;
+   }
+   memcpy(it->long_phd, it->map, SIZE_OF_XLOG_LONG_PHD);
+
+   assert(magic_value_to_postgres_version(it->long_phd->std.xlp_magic) != -1);
+
+   if (server == -1)
+   {
+      config->common.servers[0].version = magic_value_to_postgres_version(it->long_phd->std.xlp_magic);
+      server_config = &config->common.servers[0];
+   }
+   else
+   {
+      assert(config->common.servers[server].version == magic_value_to_postgres_version(it->long_phd->std.xlp_magic));
+      server_config = &config->common.servers[server];
+   }
+
+   it->partial_first = it->long_phd->std.xlp_rem_len > 0;
+   it->next_record = MAXALIGN(
+      SIZE_OF_XLOG_LONG_PHD +
+      ((it->long_phd->std.xlp_rem_len / it->long_phd->xlp_xlog_blcksz) * SIZE_OF_XLOG_SHORT_PHD) +
+      it->long_phd->std.xlp_rem_len % it->long_phd->xlp_xlog_blcksz
+      );
+   it->page_number = 0;
+
+   if (xlog_from_file_name(basename(path), &tli, &logSegNo, wal_segz_bytes))
+   {
+      pgmoneta_log_fatal("Failed to extract LSN from the filename");
+      goto error;
+   }
+   XLOG_SEG_NO_OFFEST_TO_REC_PTR(logSegNo, 0, wal_segz_bytes, it->base);
+
+   *iterator = it;
+
+   return 0;
+
+error:
+
+   if (fd != -1)
+   {
+      close(fd);
+   }
+
+   pgmoneta_wal_record_iterator_destroy(it);
+
+   return 1;
+}
+
+bool
+pgmoneta_wal_record_iterator_next(struct wal_record_iterator* iterator)
+{
+   char header[MAX(sizeof(struct xlog_record), SIZE_OF_XLOG_RECORD)];
+   struct xlog_page_header_data* page_header = NULL;
+   struct xlog_record* record = (struct xlog_record*)header;
+   struct decoded_xlog_record* decoded = NULL;
+   char* data = NULL;
+   uint32_t block_size = 0;
+   size_t position = 0;
+   size_t length = 0;
+
+   if (iterator == NULL || iterator->done || iterator->failed)
+   {
+      return false;
+   }
+
+   if (!iterator->keep)
+   {
+      pgmoneta_wal_arena_reset(iterator->arena);
+   }
+   iterator->record = NULL;
+
+   if (iterator->partial_first)
+   {
+      iterator->partial_first = false;
+      goto partial;
+   }
+
+   block_size = iterator->long_phd->xlp_xlog_blcksz;
+
+next:
+
+   memset(header, 0, sizeof(header));
+
+   // Skip page headers until the next record starts on the current page
+   while (iterator->next_record >= (block_size * (iterator->page_number + 1)))
+   {
+      iterator->page_number++;
+      position = (size_t)iterator->page_number * block_size;
+      if (position + SIZE_OF_XLOG_SHORT_PHD > iterator->size)
+      {
+         iterator->done = true;
+         goto partial;
+      }
+      page_header = (struct xlog_page_header_data*)(iterator->map + position);
+      iterator->next_record = MAXALIGN(position + SIZE_OF_XLOG_SHORT_PHD + page_header->xlp_rem_len);
+   }
+   position = iterator->next_record;
+
+   // Check if record crosses the page boundary
+   if (position + SIZE_OF_XLOG_RECORD > block_size * (iterator->page_number + 1))
+   {
+      uint32_t end_of_page = (iterator->page_number + 1) * block_size;
+
+      length = MIN(end_of_page - position, iterator->size - MIN(position, iterator->size));
+      memcpy(header, iterator->map + position, length);
+      position = end_of_page + SIZE_OF_XLOG_SHORT_PHD;
+
+      if (position + (SIZE_OF_XLOG_RECORD - length) > iterator->size)
+      {
+         iterator->done = true;
+         goto partial;
+      }
+
+      memcpy(header + length, iterator->map + position, SIZE_OF_XLOG_RECORD - length);
+      position += SIZE_OF_XLOG_RECORD - length;
+      iterator->page_number++;
+   }
+   else
+   {
+      if (position + SIZE_OF_XLOG_RECORD > iterator->size)
+      {
+         pgmoneta_log_error("Error: Failed to read the complete data");
+         goto error;
+      }
+      memcpy(header, iterator->map + position, SIZE_OF_XLOG_RECORD);
+      position += SIZE_OF_XLOG_RECORD;
+   }
+
+   if (record->xl_tot_len == 0)
+   {
+      iterator->done = true;
+      return false;
+   }
+
+   uint32_t data_length = record->xl_tot_len - SIZE_OF_XLOG_RECORD;
+   xlog_rec_ptr lsn = position + iterator->base - SIZE_OF_XLOG_RECORD;
+   iterator->next_record = position + MAXALIGN(record->xl_tot_len - SIZE_OF_XLOG_RECORD);
+   uint32_t end_of_page = (iterator->page_number + 1) * block_size;
+
+   /* A rejected record is skipped before its data is touched */
+   if (iterator->filter != NULL && !pgmoneta_wal_record_filter_accept(iterator->filter, record, lsn))
+   {
+      iterator->skipped++;
+      goto next;
+   }
+
+   if (data_length + position > end_of_page)
+   {
+      // A continuation record is assembled from its page fragments
+      size_t total_bytes_read = 0;
+      uint32_t remaining_data_length = data_length;
+
+      data = (char*)pgmoneta_wal_arena_allocate(iterator->arena, data_length);
+      if (data == NULL)
+      {
+         pgmoneta_log_fatal("Error: Could not allocate memory for buffer");
+         goto error;
+      }
+
+      length = MIN(end_of_page - position, iterator->size - MIN(position, iterator->size));
+      memcpy(data, iterator->map + position, length);
+      position += length;
+      total_bytes_read += length;
+      remaining_data_length -= length;
+      while (remaining_data_length != 0)
+      {
+         if (position + SIZE_OF_XLOG_SHORT_PHD >= iterator->size)
+         {
+            iterator->done = true;
+            goto partial;
+         }
+         position += SIZE_OF_XLOG_SHORT_PHD;
+         length = MIN(MIN(remaining_data_length, block_size - SIZE_OF_XLOG_SHORT_PHD), iterator->size - position);
+         memcpy(data + total_bytes_read, iterator->map + position, length);
+         position += length;
+         remaining_data_length -= length;
+         total_bytes_read += length;
+      }
+      assert(total_bytes_read == data_length);
+   }
+   else
+   {
+      if (position + data_length > iterator->size)
+      {
+         pgmoneta_log_error("Error: Actual bytes read do not match the expected length");
+         goto error;
+      }
 
-   config = (struct walinfo_configuration*) shmem;
+      // The record is decoded in place
+      data = iterator->map + position;
+   }
+
+   if (iterator->crc && record_crc(record, data, data_length) != record->xl_crc)
+   {
+      pgmoneta_log_error("Error: Incorrect CRC of the record at %X/%X", (uint32_t)(lsn >> 32), (uint32_t)lsn);
+      iterator->corrupt = true;
+      goto error;
+   }
+
+   decoded = (struct decoded_xlog_record*)pgmoneta_wal_arena_allocate(iterator->arena, sizeof(struct decoded_xlog_record));
+   if (decoded == NULL)
+   {
+      pgmoneta_log_fatal("Error: Could not allocate memory for decoded");
+      goto error;
+   }
 
-   FILE* file = fopen(path, "rb");
-   if (file == NULL)
+   if (decode_xlog_record(data, decoded, record, iterator->blocks, iterator->arena,
+                          block_size, iterator->long_phd->std.xlp_magic, lsn))
    {
-      pgmoneta_log_fatal("Error: Could not open file %s", path);
       goto error;
    }
 
-   // calculate the size of the file
-   fseek(file, 0, SEEK_END);
-   wal_segz_bytes = ftell(file);
-   fseek(file, 0, SEEK_SET);
+   iterator->record = decoded;
+
+   return true;
 
-   MALLOC(long_header, SIZE_OF_XLOG_LONG_PHD);
-   size_t bytes_read = fread(long_header, SIZE_OF_XLOG_LONG_PHD, 1, file);
+partial:
 
-   if (bytes_read < 1)
+   iterator->record = partial_record(iterator);
+   if (iterator->record == NULL)
    {
-      pgmoneta_log_error("Error: Failed to read the complete data");
       goto error;
    }
 
-   assert(magic_value_to_postgres_version(long_header->std.xlp_magic) != -1);
+   return true;
 
-   if (server == -1)
+error:
+
+   iterator->failed = true;
+   iterator->record = NULL;
+
+   return false;
+}
+
+void
+pgmoneta_wal_record_iterator_destroy(struct wal_record_iterator* iterator)
+{
+   if (iterator == NULL)
    {
-      config->common.servers[0].version = magic_value_to_postgres_version(long_header->std.xlp_magic);
-      server_config = &config->common.servers[0];
+      return;
+   }
+
+   if (iterator->mapped)
+   {
+      munmap(iterator->map, iterator->size);
    }
    else
    {
-      assert(config->common.servers[server].version == magic_value_to_postgres_version(long_header->std.xlp_magic));
-      server_config = &config->common.servers[server];
+      free(iterator->map);
    }
 
-   if (long_header->std.xlp_rem_len > 0)
+   if (!iterator->keep)
    {
-      decoded = malloc(sizeof(struct decoded_xlog_record));
-      if (decoded == NULL)
-      {
-         pgmoneta_log_fatal("Error: Could not allocate memory for decoded");
-         goto error;
-      }
-      decoded->partial = true;
-      if (pgmoneta_deque_add(wal_file->records, NULL, (uintptr_t) decoded, ValueRef))
-      {
-         free(decoded);
-         decoded = NULL;
-         goto error;
-      }
-      decoded = NULL;
+      pgmoneta_wal_arena_destroy(iterator->arena);
    }
 
-   uint32_t next_record = MAXALIGN(
-      ftell(file) +
-      ((long_header->std.xlp_rem_len / long_header->xlp_xlog_blcksz) * SIZE_OF_XLOG_SHORT_PHD) +
-      long_header->std.xlp_rem_len % long_header->xlp_xlog_blcksz
-      );
-   int page_number = 0;
-   wal_file->long_phd = long_header;
-   long_header = NULL;
+   free(iterator->long_phd);
+   free(iterator);
+}
 
-   read_all_page_headers(file, wal_file->long_phd, wal_file);
-   fseek(file, next_record, SEEK_SET);
+int
+pgmoneta_wal_parse_wal_file(char* path, int server, struct walfile* wal_file)
+{
+   struct wal_record_iterator* iterator = NULL;
 
-   if (xlog_from_file_name(basename(path), &tli, &logSegNo, wal_segz_bytes))
+   if (wal_file->arena == NULL && pgmoneta_wal_arena_create(&wal_file->arena))
    {
-      pgmoneta_log_fatal("Failed to extract LSN from the filename");
+      pgmoneta_log_fatal("Error: Could not allocate memory for the arena");
       goto error;
    }
-   XLOG_SEG_NO_OFFEST_TO_REC_PTR(logSegNo, 0, wal_segz_bytes, base);
 
-   while (true)
+   if (pgmoneta_wal_record_iterator_create(path, server, wal_file->arena, &iterator))
    {
-      // Check if next record is beyond the current page
-      if (next_record >= (wal_file->long_phd->xlp_xlog_blcksz * (page_number + 1)))
-      {
-         page_number++;
-         fseek(file, page_number * wal_file->long_phd->xlp_xlog_blcksz, SEEK_SET);
-         MALLOC(page_header, SIZE_OF_XLOG_SHORT_PHD);
-         bytes_read = fread(page_header, SIZE_OF_XLOG_SHORT_PHD, 1, file);
-         if (feof(file))
-         {
-            decoded = calloc(1, sizeof(struct decoded_xlog_record));
-            if (decoded == NULL)
-            {
-               pgmoneta_log_fatal("Error: Could not allocate memory for decoded");
-               free(page_header);
-               page_header = NULL;
-               goto error;
-            }
-            decoded->partial = true;
-            if (pgmoneta_deque_add(wal_file->records, NULL, (uintptr_t) decoded, ValueRef))
-            {
-               free(decoded);
-               decoded = NULL;
-               free(page_header);
-               page_header = NULL;
-               goto error;
-            }
-            decoded = NULL;
-            free(page_header);
-            page_header = NULL;
-            goto finish;
-         }
-         if (bytes_read < 1)
-         {
-            pgmoneta_log_error("Error: Failed to read the complete data");
-            free(page_header);
-            page_header = NULL;
-            goto error;
-         }
-         next_record = MAXALIGN(ftell(file) + page_header->xlp_rem_len);
-         free(page_header);
-         page_header = NULL;
-         continue;
-      }
-      fseek(file, next_record, SEEK_SET);
-
-      // Check if record crosses the page boundary
-      if (ftell(file) + SIZE_OF_XLOG_RECORD > wal_file->long_phd->xlp_xlog_blcksz * (page_number + 1))
-      {
-         MALLOC(temp_buffer, SIZE_OF_XLOG_RECORD);
-         uint32_t end_of_page = (page_number + 1) * wal_file->long_phd->xlp_xlog_blcksz;
-         bytes_read = fread(temp_buffer, 1, end_of_page - ftell(file), file);
-
-         fseek(file, SIZE_OF_XLOG_SHORT_PHD, SEEK_CUR);
-         bytes_read += fread(temp_buffer + bytes_read, 1, SIZE_OF_XLOG_RECORD - bytes_read, file);
-
-         if (feof(file) && bytes_read != SIZE_OF_XLOG_RECORD)
-         {
-            free(temp_buffer);
-            temp_buffer = NULL;
-            decoded = calloc(1, sizeof(struct decoded_xlog_record));
-            if (decoded == NULL)
-            {
-               pgmoneta_log_fatal("Error: Could not allocate memory for decoded");
-               goto error;
-            }
-            decoded->partial = true;
-            if (pgmoneta_deque_add(wal_file->records, NULL, (uintptr_t) decoded, ValueRef))
-            {
-               free(decoded);
-               decoded = NULL;
-               goto error;
-            }
-            decoded = NULL;
-            goto finish;
-         }
+      goto error;
+   }
 
-         assert(bytes_read == SIZE_OF_XLOG_RECORD);
-         record = (struct xlog_record*) temp_buffer;
-         temp_buffer = NULL;
-         page_number++;
-      }
-      else
-      {
-         MALLOC(record, SIZE_OF_XLOG_RECORD);
-         bytes_read = fread(record, SIZE_OF_XLOG_RECORD, 1, file);
-         if (bytes_read < 1)
-         {
-            pgmoneta_log_error("Error: Failed to read the complete data");
-            goto error;
-         }
-      }
+   read_all_page_headers(iterator->map, iterator->size, iterator->long_phd, wal_file);
 
-      if (record->xl_tot_len == 0)
+   while (pgmoneta_wal_record_iterator_next(iterator))
+   {
+      if (pgmoneta_deque_add(wal_file->records, NULL, (uintptr_t) iterator->record, ValueRef))
       {
-         free(record);
-         record = NULL;
-         break;
+         goto error;
       }
-      uint32_t data_length = record->xl_tot_len - SIZE_OF_XLOG_RECORD;
-      xlog_rec_ptr lsn = ftell(file) + base - SIZE_OF_XLOG_RECORD;
-      next_record = ftell(file) + MAXALIGN(record->xl_tot_len - SIZE_OF_XLOG_RECORD);
-      uint32_t end_of_page = (page_number + 1) * wal_file->long_phd->xlp_xlog_blcksz;
-
-      MALLOC(buffer, data_length);
+   }
 
-      // Read record data, possibly across page boundaries
-      if (data_length + ftell(file) >= end_of_page)
-      {
-         size_t bytes_read = 0;
-         size_t total_bytes_read = 0;
-         uint32_t remaining_data_length = data_length;
-         bytes_read = fread(buffer, 1, end_of_page - ftell(file), file);
-         total_bytes_read += bytes_read;
-         remaining_data_length -= bytes_read;
-         while (remaining_data_length != 0)
-         {
-            if (feof(file))
-            {
-               free(record);
-               record = NULL;
-               decoded = calloc(1, sizeof(struct decoded_xlog_record));
-               if (decoded == NULL)
-               {
-                  pgmoneta_log_fatal("Error: Could not allocate memory for decoded");
-                  free(buffer);
-                  buffer = NULL;
-                  goto error;
-               }
-               decoded->partial = true;
-               if (pgmoneta_deque_add(wal_file->records, NULL, (uintptr_t) decoded, ValueRef))
-               {
-                  free(decoded);
-                  decoded = NULL;
-                  free(buffer);
-                  buffer = NULL;
-                  goto error;
-               }
-               decoded = NULL;
-               free(buffer);
-               buffer = NULL;
-               goto finish;
-            }
-            fseek(file, SIZE_OF_XLOG_SHORT_PHD, SEEK_CUR);
-            bytes_read = fread(buffer + total_bytes_read, 1,
-                               MIN(remaining_data_length, wal_file->long_phd->xlp_xlog_blcksz - SIZE_OF_XLOG_SHORT_PHD), file);
-            remaining_data_length -= bytes_read;
-            total_bytes_read += bytes_read;
-         }
-         assert(total_bytes_read == data_length);
-      }
-      else
-      {
-         bytes_read = fread(buffer, 1, data_length, file);
+   if (iterator->failed)
+   {
+      goto error;
+   }
 
-         if (bytes_read != data_length)
-         {
-            pgmoneta_log_error("Error: Actual bytes read do not match the expected length");
-            goto error;
-         }
-      }
+   /* The records point into the mapping, so the walfile keeps it */
+   wal_file->long_phd = iterator->long_phd;
+   wal_file->map = iterator->map;
+   wal_file->map_size = iterator->size;
+   wal_file->mapped = iterator->mapped;
+   iterator->long_phd = NULL;
+   iterator->map = NULL;
 
-      decoded = calloc(1, sizeof(struct decoded_xlog_record));
-      if (decoded == NULL)
-      {
-         pgmoneta_log_fatal("Error: Could not allocate memory for decoded");
-         goto error;
-      }
+   pgmoneta_wal_record_iterator_destroy(iterator);
 
-      if (decode_xlog_record(buffer, decoded, record, wal_file->long_phd->xlp_xlog_blcksz, wal_file->long_phd->std.xlp_magic, lsn))
-      {
-         free(decoded);
-         decoded = NULL;
-         goto error;
-      }
-      else
-      {
-         if (pgmoneta_deque_add(wal_file->records, NULL, (uintptr_t) decoded, ValueRef))
-         {
-            free(decoded);
-            decoded = NULL;
-            goto error;
-         }
-         decoded = NULL;
-      }
-      free(buffer);
-      buffer = NULL;
-      free(record);
-      record = NULL;
-   }
-finish:
-   fclose(file);
    return 0;
 
 error:
-   // Cleanup all allocated resources
-   free(long_header);
-   free(page_header);
-   free(temp_buffer);
-   free(buffer);
-   free(record);
-   free(decoded);
-   if (file != NULL)
-   {
-      fclose(file);
-   }
+
+   pgmoneta_wal_record_iterator_destroy(iterator);
    pgmoneta_log_fatal("Error: Could not parse WAL file");
+
    return 1;
 }
 
 static int
-decode_xlog_record(char* buffer, struct decoded_xlog_record* decoded, struct xlog_record* record, uint32_t block_size, uint16_t magic_value, xlog_rec_ptr lsn)
+decode_xlog_record(char* buffer, struct decoded_xlog_record* decoded, struct xlog_record* record, struct decoded_bkp_block* blocks, struct wal_arena* arena, uint32_t block_size, uint16_t magic_value, xlog_rec_ptr lsn)
 {
 #define COPY_HEADER_FIELD(_dst, _size)          \
         do {                                        \
@@ -544,7 +1024,7 @@ decode_xlog_record(char* buffer, struct decoded_xlog_record* decoded, struct xlo
          /* mark any intervening block IDs as not in use */
          for (int i = decoded->max_block_id + 1; i < block_id; ++i)
          {
-            decoded->blocks[i].in_use = false;
+            memset(&blocks[i], 0, sizeof(struct decoded_bkp_block));
          }
 
          if (block_id <= decoded->max_block_id)
@@ -553,7 +1033,8 @@ decode_xlog_record(char* buffer, struct decoded_xlog_record* decoded, struct xlo
          }
          decoded->max_block_id = block_id;
 
-         blk = &decoded->blocks[block_id];
+         blk = &blocks[block_id];
+         memset(blk, 0, sizeof(struct decoded_bkp_block));
          blk->in_use = true;
          blk->apply_image = false;
 
@@ -676,6 +1157,16 @@ decode_xlog_record(char* buffer, struct decoded_xlog_record* decoded, struct xlo
    }
    assert(remaining == datatotal);
 
+   if (decoded->max_block_id >= 0)
+   {
+      decoded->blocks = (struct decoded_bkp_block*)pgmoneta_wal_arena_allocate(arena, (decoded->max_block_id + 1) * sizeof(struct decoded_bkp_block));
+      if (decoded->blocks == NULL)
+      {
+         goto err;
+      }
+      memcpy(decoded->blocks, blocks, (decoded->max_block_id + 1) * sizeof(struct decoded_bkp_block));
+   }
+
    for (block_id = 0; block_id <= decoded->max_block_id; block_id++)
    {
       struct decoded_bkp_block* blk = &decoded->blocks[block_id];
@@ -690,27 +1181,28 @@ decode_xlog_record(char* buffer, struct decoded_xlog_record* decoded, struct xlo
       if (blk->has_image)
       {
          /* no need to align image */
-         blk->bkp_image = malloc(blk->bimg_len);
-         memcpy(blk->bkp_image, ptr, blk->bimg_len);
+         blk->bkp_image = ptr;
          ptr += blk->bimg_len;
       }
       if (blk->has_data)
       {
-         blk->data = malloc(blk->data_len);
-         memcpy(blk->data, ptr, blk->data_len);
+         blk->data = record_payload(arena, ptr, blk->data_len);
+         if (blk->data == NULL)
+         {
+            goto err;
+         }
          ptr += blk->data_len;
       }
    }
 
    if (decoded->main_data_len > 0)
    {
-      decoded->main_data = malloc(decoded->main_data_len);
+      decoded->main_data = record_payload(arena, ptr, decoded->main_data_len);
       if (decoded->main_data == NULL)
       {
          goto
          shortdata_err;
       }
-      memcpy(decoded->main_data, ptr, decoded->main_data_len);
       ptr += decoded->main_data_len;
    }
    decoded->partial = false;
@@ -725,6 +1217,23 @@ err:
    return 1;
 }
 
+char*
+pgmoneta_wal_rmgr_name(rmgr_id rmid)
+{
+   return RmgrTable[rmid].name;
+}
+
+char*
+pgmoneta_wal_rmgr_desc(char* buf, struct decoded_xlog_record* record)
+{
+   if (RmgrTable[record->header.xl_rmid].rm_desc == NULL)
+   {
+      return buf;
+   }
+
+   return RmgrTable[record->header.xl_rmid].rm_desc(buf, record);
+}
+
 char*
 pgmoneta_wal_get_record_block_data(struct decoded_xlog_record* record, uint8_t block_id, size_t* len)
 {
@@ -795,15 +1304,17 @@ get_record_block_ref_info(char* buf, struct decoded_xlog_record* record, bool pr
       buf = pgmoneta_format_and_append(buf, "\n");
    }
 
-   char* dbname = NULL;
-   char* relname = NULL;
-   char* spcname = NULL;
-
    for (block_id = 0; block_id <= record->max_block_id; block_id++)
    {
       struct rel_file_locator rlocator;
       enum fork_number forknum;
       block_number blk;
+      char dbbuf[OID_NAME_LENGTH];
+      char relbuf[OID_NAME_LENGTH];
+      char spcbuf[OID_NAME_LENGTH];
+      char* dbname = NULL;
+      char* relname = NULL;
+      char* spcname = NULL;
 
       if (!get_record_block_tag_extended(record, block_id, &rlocator, &forknum, &blk, NULL))
       {
@@ -823,20 +1334,10 @@ get_record_block_ref_info(char* buf, struct decoded_xlog_record* record, bool pr
             buf = pgmoneta_format_and_append(buf, " ");
          }
 
-         if (pgmoneta_get_database_name(rlocator.dbOid, &dbname))
-         {
-            goto error;
-         }
-
-         if (pgmoneta_get_relation_name(rlocator.relNumber, &relname))
-         {
-            goto error;
-         }
-
-         if (pgmoneta_get_tablespace_name(rlocator.spcOid, &spcname))
-         {
-            goto error;
-         }
+         /* The names are borrowed from the mapping cache, so nothing is allocated per block */
+         dbname = pgmoneta_get_object_name(OBJ_DATABASE, rlocator.dbOid, dbbuf, sizeof(dbbuf));
+         relname = pgmoneta_get_object_name(OBJ_RELATION, rlocator.relNumber, relbuf, sizeof(relbuf));
+         spcname = pgmoneta_get_object_name(OBJ_TABLESPACE, rlocator.spcOid, spcbuf, sizeof(spcbuf));
 
          buf = pgmoneta_format_and_append(buf, "blkref #%d: rel %s/%s/%s forknum %d blk %u",
                                           block_id,
@@ -907,25 +1408,14 @@ get_record_block_ref_info(char* buf, struct decoded_xlog_record* record, bool pr
       {
          /* Get block references in short format. */
 
-         if (pgmoneta_get_database_name(rlocator.dbOid, &dbname))
-         {
-            goto error;
-         }
-
-         if (pgmoneta_get_relation_name(rlocator.relNumber, &relname))
-         {
-            goto error;
-         }
-
-         if (pgmoneta_get_tablespace_name(rlocator.spcOid, &spcname))
-         {
-            goto error;
-         }
+         dbname = pgmoneta_get_object_name(OBJ_DATABASE, rlocator.dbOid, dbbuf, sizeof(dbbuf));
+         relname = pgmoneta_get_object_name(OBJ_RELATION, rlocator.relNumber, relbuf, sizeof(relbuf));
+         spcname = pgmoneta_get_object_name(OBJ_TABLESPACE, rlocator.spcOid, spcbuf, sizeof(spcbuf));
 
          if (forknum != MAIN_FORKNUM)
          {
             buf = pgmoneta_format_and_append(buf,
-                                             ", blkref #%d: rel %u/%u/%u fork %d blk %u",
+                                             ", blkref #%d: rel %s/%s/%s fork %d blk %u",
                                              block_id,
                                              spcname, dbname, relname,
                                              forknum,
@@ -934,7 +1424,7 @@ get_record_block_ref_info(char* buf, struct decoded_xlog_record* record, bool pr
          else
          {
             buf = pgmoneta_format_and_append(buf,
-                                             ", blkref #%d: rel %u/%u/%u blk %u",
+                                             ", blkref #%d: rel %s/%s/%s blk %u",
                                              block_id,
                                              spcname, dbname, relname,
                                              blk);
@@ -963,20 +1453,9 @@ get_record_block_ref_info(char* buf, struct decoded_xlog_record* record, bool pr
       {
          buf = pgmoneta_format_and_append(buf, "\n");
       }
-
-      free(dbname);
-      free(spcname);
-      free(relname);
    }
 
    return buf;
-
-error:
-   free(dbname);
-   free(spcname);
-   free(relname);
-   free(buf);
-   return NULL;
 }
 
 static bool
@@ -1012,123 +1491,138 @@ get_record_block_tag_extended(struct decoded_xlog_record* pRecord, int id, struc
 
 void
 pgmoneta_wal_record_display(struct decoded_xlog_record* record, uint16_t magic_value, enum value_type type, FILE* out, bool quiet, bool color,
-                            struct deque* rms, uint64_t start_lsn, uint64_t end_lsn, struct deque* xids, uint32_t limit, char** included_objects)
+                            struct deque* rms, uint64_t start_lsn, uint64_t end_lsn, struct deque* xids, uint32_t limit, char** included_objects,
+                            uint32_t* count)
 {
-   static uint32_t current_limit = 0;
-   char* header_str = NULL;
    char* rm_desc = NULL;
    char* backup_str = NULL;
-   char* start_lsn_string = NULL;
-   char* end_lsn_string = NULL;
-   struct value* record_serialized = NULL;
-   char* value_str = NULL;
    uint32_t rec_len = 0;
    uint32_t fpi_len = 0;
 
    if (!record->partial)
    {
-      rm_desc = RmgrTable[record->header.xl_rmid].rm_desc(rm_desc, record);
-      backup_str = get_record_block_ref_info(backup_str, record, false, true, &fpi_len, magic_value);
-
-      char* record_desc = pgmoneta_format_and_append(NULL, "%s %s", rm_desc, backup_str);
-
+      /* The header filters are checked before the record is described */
       if (!is_included(RmgrTable[record->header.xl_rmid].name, rms,
                        record->header.xl_prev, start_lsn,
                        record->lsn, end_lsn,
-                       record->header.xl_xid, xids, included_objects, record_desc))
+                       record->header.xl_xid, xids, NULL, NULL))
       {
-         free(record_desc);
          return;
       }
-      free(record_desc);
+
+      /* The description is only built when it is filtered on or shown */
+      if (included_objects != NULL || !quiet)
+      {
+         rm_desc = RmgrTable[record->header.xl_rmid].rm_desc(rm_desc, record);
+         backup_str = get_record_block_ref_info(backup_str, record, false, true, &fpi_len, magic_value);
+      }
+
+      if (included_objects != NULL)
+      {
+         char* record_desc = pgmoneta_format_and_append(NULL, "%s %s", rm_desc, backup_str);
+
+         if (!is_included(NULL, NULL, 0, 0, 0, 0, record->header.xl_xid, NULL, included_objects, record_desc))
+         {
+            free(record_desc);
+            free(rm_desc);
+            free(backup_str);
+            return;
+         }
+         free(record_desc);
+      }
    }
 
-   current_limit++;
-   if (limit > 0 && current_limit > limit)
+   (*count)++;
+   if ((limit > 0 && *count > limit) || quiet)
    {
+      free(rm_desc);
+      free(backup_str);
       return;
    }
 
+   /* The record is written in pieces under one lock, so the stream buffer is the output buffer */
+   flockfile(out);
+
    if (type == ValueJSON)
    {
-      if (!quiet)
+      out_str(out, *count == 1 ? "{\"Record\": " : ",\n{\"Record\": ");
+
+      /* The keys are in the order of the JSON serializer */
+      if (record->partial)
       {
-         if (current_limit == 1)
-         {
-            fprintf(out, "{\"Record\": ");
-         }
-         else
-         {
-            fprintf(out, ",\n{\"Record\": ");
-         }
-         record_json(record, magic_value, &record_serialized);
-         value_str = pgmoneta_value_to_string(record_serialized, FORMAT_JSON_COMPACT, NULL, 0);
-         fprintf(out, "%s}", value_str);
-         pgmoneta_value_destroy(record_serialized);
-         free(value_str);
+         out_str(out, "{\"Partial\":true}");
+      }
+      else
+      {
+         get_record_length(record, &rec_len, &fpi_len);
+
+         out_str(out, "{\"Crc\":");
+         out_uint(out, record->header.xl_crc);
+         out_str(out, ",\"Data\":");
+         out_json_string(out, rm_desc);
+         out_str(out, ",\"Description\":");
+         out_json_string(out, backup_str);
+         out_str(out, ",\"EndLSN\":");
+         out_uint(out, record->lsn);
+         out_str(out, ",\"Info\":");
+         out_uint(out, record->header.xl_info);
+         out_str(out, ",\"RecordLength\":");
+         out_uint(out, rec_len);
+         out_str(out, ",\"ResourceManager\":");
+         out_json_string(out, RmgrTable[record->header.xl_rmid].name);
+         out_str(out, ",\"ResourceManagerId\":");
+         out_uint(out, record->header.xl_rmid);
+         out_str(out, ",\"StartLSN\":");
+         out_uint(out, record->header.xl_prev);
+         out_str(out, ",\"TotalLength\":");
+         out_uint(out, record->header.xl_tot_len);
+         out_str(out, ",\"Xid\":");
+         out_uint(out, record->header.xl_xid);
+         out_str(out, "}");
       }
+      out_str(out, "}");
    }
    else if (type == ValueString)
    {
-      if (!quiet)
+      if (record->partial)
       {
-         if (record->partial)
-         {
-            if (color)
-            {
-               fprintf(out, "%sIncomplete%s | | | | | %sSkipped%s\n",
-                       COLOR_RED, COLOR_WHITE, COLOR_GREEN, COLOR_RESET);
-            }
-            else
-            {
-               fprintf(out, "Incomplete | | | | | Skipped\n");
-            }
-            return;
-         }
-         get_record_length(record, &rec_len, &fpi_len);
-         start_lsn_string = pgmoneta_lsn_to_string(record->header.xl_prev);
-         end_lsn_string = pgmoneta_lsn_to_string(record->lsn);
-
-         if (color)
-         {
-            header_str = pgmoneta_format_and_append(header_str, "%s%s%s | %s%s%s | %s%s%s | %s%d%s | %s%d%s | %s%d%s",
-                                                    COLOR_RED, RmgrTable[record->header.xl_rmid].name, COLOR_RESET,
-                                                    COLOR_MAGENTA, start_lsn_string, COLOR_RESET,
-                                                    COLOR_MAGENTA, end_lsn_string, COLOR_RESET,
-                                                    COLOR_BLUE, rec_len, COLOR_RESET,
-                                                    COLOR_YELLOW, record->header.xl_tot_len, COLOR_RESET,
-                                                    COLOR_CYAN, record->header.xl_xid, COLOR_RESET);
-         }
-         else
-         {
-            header_str = pgmoneta_format_and_append(header_str, "%s | %s | %s | %d | %d | %d",
-                                                    RmgrTable[record->header.xl_rmid].name,
-                                                    start_lsn_string,
-                                                    end_lsn_string,
-                                                    rec_len,
-                                                    record->header.xl_tot_len,
-                                                    record->header.xl_xid);
-         }
-
          if (color)
          {
-            fprintf(out, "%s%s%s | %s%s %s%s\n",
-                    COLOR_RED, header_str, COLOR_WHITE,
-                    COLOR_GREEN, rm_desc,
-                    backup_str, COLOR_RESET);
+            out_str(out, COLOR_RED "Incomplete" COLOR_WHITE " | | | | | " COLOR_GREEN "Skipped" COLOR_RESET "\n");
          }
          else
          {
-            fprintf(out, "%s | %s %s\n", header_str, rm_desc, backup_str);
+            out_str(out, "Incomplete | | | | | Skipped\n");
          }
+      }
+      else
+      {
+         get_record_length(record, &rec_len, &fpi_len);
 
-         free(header_str);
-         free(rm_desc);
-         free(backup_str);
-         free(start_lsn_string);
-         free(end_lsn_string);
+         out_str(out, color ? COLOR_RED COLOR_RED : "");
+         out_str(out, RmgrTable[record->header.xl_rmid].name);
+         out_str(out, color ? COLOR_RESET " | " COLOR_MAGENTA : " | ");
+         out_lsn(out, record->header.xl_prev);
+         out_str(out, color ? COLOR_RESET " | " COLOR_MAGENTA : " | ");
+         out_lsn(out, record->lsn);
+         out_str(out, color ? COLOR_RESET " | " COLOR_BLUE : " | ");
+         out_uint(out, rec_len);
+         out_str(out, color ? COLOR_RESET " | " COLOR_YELLOW : " | ");
+         out_uint(out, record->header.xl_tot_len);
+         out_str(out, color ? COLOR_RESET " | " COLOR_CYAN : " | ");
+         out_uint(out, record->header.xl_xid);
+         out_str(out, color ? COLOR_RESET COLOR_WHITE " | " COLOR_GREEN : " | ");
+         out_str(out, rm_desc);
+         out_str(out, " ");
+         out_str(out, backup_str);
+         out_str(out, color ? COLOR_RESET "\n" : "\n");
       }
    }
+
+   funlockfile(out);
+
+   free(rm_desc);
+   free(backup_str);
 }
 
 static bool
@@ -1284,49 +1778,100 @@ no:
 }
 
 static void
-record_json(struct decoded_xlog_record* record, uint8_t magic_value, struct value** value)
+out_str(FILE* out, char* str)
 {
-   char* rm_desc = NULL;
-   char* backup_str = NULL;
-   struct json* record_json = NULL;
-   uint32_t rec_len;
-   uint32_t fpi_len;
+   if (str != NULL)
+   {
+      fputs(str, out);
+   }
+}
+
+static void
+out_uint(FILE* out, uint64_t value)
+{
+   char buf[24];
+   int i = sizeof(buf);
+
+   do
+   {
+      buf[--i] = (char)('0' + value % 10);
+      value /= 10;
+   }
+   while (value > 0);
+
+   fwrite(&buf[i], 1, sizeof(buf) - i, out);
+}
 
-   pgmoneta_json_create(&record_json);
+static void
+out_hex(FILE* out, uint32_t value)
+{
+   char buf[8];
+   int i = sizeof(buf);
 
-   if (record->partial)
+   do
    {
-      pgmoneta_json_put(record_json, "Partial", true, ValueBool);
-      goto finish;
+      buf[--i] = "0123456789ABCDEF"[value & 0xF];
+      value >>= 4;
    }
+   while (value > 0);
+
+   fwrite(&buf[i], 1, sizeof(buf) - i, out);
+}
 
-   get_record_length(record, &rec_len, &fpi_len);
+static void
+out_lsn(FILE* out, uint64_t lsn)
+{
+   out_hex(out, (uint32_t)(lsn >> 32));
+   putc_unlocked('/', out);
+   out_hex(out, (uint32_t)lsn);
+}
 
-   rm_desc = RmgrTable[record->header.xl_rmid].rm_desc(rm_desc, record);
-   backup_str = get_record_block_ref_info(backup_str, record, false, true, &fpi_len, magic_value);
+static void
+out_json_string(FILE* out, char* str)
+{
+   char* start = str;
 
-   // Header serialization
-   pgmoneta_json_put(record_json, "ResourceManager", (uintptr_t) RmgrTable[record->header.xl_rmid].name, ValueString);
-   pgmoneta_json_put(record_json, "RecordLength", rec_len, ValueUInt32);
-   pgmoneta_json_put(record_json, "TotalLength", record->header.xl_tot_len, ValueUInt32);
-   pgmoneta_json_put(record_json, "Xid", record->header.xl_xid, ValueUInt32);
-   pgmoneta_json_put(record_json, "Info", record->header.xl_info, ValueUInt8);
-   pgmoneta_json_put(record_json, "StartLSN", record->header.xl_prev, ValueUInt64);
-   pgmoneta_json_put(record_json, "EndLSN", record->lsn, ValueUInt64);
-   pgmoneta_json_put(record_json, "ResourceManagerId", record->header.xl_rmid, ValueUInt8);
-   pgmoneta_json_put(record_json, "Crc", record->header.xl_crc, ValueUInt32);
+   if (str == NULL)
+   {
+      out_str(out, "null");
+      return;
+   }
 
-   // Data serialization
-   pgmoneta_json_put(record_json, "Data", (uintptr_t) rm_desc, ValueString);
+   /* Escaped in the same way as pgmoneta_escape_string, without copying */
+   putc_unlocked('"', out);
+   for (char* p = str; *p != '\0'; p++)
+   {
+      char escaped = 0;
 
-   // Backup serialization
-   get_record_length(record, &rec_len, &fpi_len);
-   pgmoneta_json_put(record_json, "Description", (uintptr_t) backup_str, ValueString);
+      switch (*p)
+      {
+         case '\\':
+         case '"':
+            escaped = *p;
+            break;
+         case '\n':
+            escaped = 'n';
+            break;
+         case '\t':
+            escaped = 't';
+            break;
+         case '\r':
+            escaped = 'r';
+            break;
+         default:
+            break;
+      }
 
-finish:
-   pgmoneta_value_create(ValueJSON, (uintptr_t) record_json, value);
-   free(rm_desc);
-   free(backup_str);
+      if (escaped != 0)
+      {
+         fwrite(start, 1, p - start, out);
+         putc_unlocked('\\', out);
+         putc_unlocked(escaped, out);
+         start = p + 1;
+      }
+   }
+   fwrite(start, 1, strlen(start), out);
+   putc_unlocked('"', out);
 }
 
 char*
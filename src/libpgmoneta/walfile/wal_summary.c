@@ -0,0 +1,290 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <logging.h>
+#include <utils.h>
+#include <walfile/rm.h>
+#include <walfile/wal_reader.h>
+#include <walfile/wal_summary.h>
+
+/* system */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define WAL_SEGMENT_NAME  24
+
+static void add_xid(struct wal_summary* summary, transaction_id xid);
+
+int
+pgmoneta_wal_summary_create(char* path, int server, struct wal_summary** summary)
+{
+   struct wal_summary* s = NULL;
+   struct wal_record_iterator* iter = NULL;
+   struct decoded_xlog_record* record = NULL;
+
+   *summary = NULL;
+
+   s = (struct wal_summary*)calloc(1, sizeof(struct wal_summary));
+   if (s == NULL)
+   {
+      goto error;
+   }
+
+   s->magic = WAL_SUMMARY_MAGIC;
+   s->version = WAL_SUMMARY_VERSION;
+
+   if (pgmoneta_wal_record_iterator_create(path, server, NULL, &iter))
+   {
+      goto error;
+   }
+
+   while (pgmoneta_wal_record_iterator_next(iter))
+   {
+      record = iter->record;
+
+      /* The continuation of a record from the previous segment is summarized there */
+      if (record->partial)
+      {
+         continue;
+      }
+
+      if (s->records == 0)
+      {
+         s->start_lsn = record->lsn;
+      }
+      s->end_lsn = record->lsn;
+      s->records++;
+
+      add_xid(s, record->header.xl_xid);
+      add_xid(s, record->toplevel_xid);
+   }
+
+   if (iter->failed)
+   {
+      pgmoneta_log_error("WAL summary: Unable to decode %s", path);
+      goto error;
+   }
+
+   pgmoneta_wal_record_iterator_destroy(iter);
+
+   *summary = s;
+
+   return 0;
+
+error:
+
+   pgmoneta_wal_record_iterator_destroy(iter);
+   free(s);
+
+   return 1;
+}
+
+int
+pgmoneta_wal_summary_write(struct wal_summary* summary, char* path)
+{
+   char* tmp = NULL;
+   int fd = -1;
+   size_t written = 0;
+   ssize_t n = 0;
+
+   if (summary == NULL || path == NULL)
+   {
+      goto error;
+   }
+
+   tmp = pgmoneta_append(tmp, path);
+   tmp = pgmoneta_append(tmp, ".tmp");
+
+   fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+   if (fd == -1)
+   {
+      pgmoneta_log_warn("WAL summary: Unable to create %s: %s", tmp, strerror(errno));
+      errno = 0;
+      goto error;
+   }
+
+   while (written < sizeof(struct wal_summary))
+   {
+      n = write(fd, (char*)summary + written, sizeof(struct wal_summary) - written);
+      if (n <= 0)
+      {
+         pgmoneta_log_warn("WAL summary: Unable to write %s: %s", tmp, strerror(errno));
+         errno = 0;
+         goto error;
+      }
+      written += (size_t)n;
+   }
+
+   if (fsync(fd))
+   {
+      goto error;
+   }
+
+   close(fd);
+   fd = -1;
+
+   /* A reader sees either no summary or a complete one */
+   if (rename(tmp, path))
+   {
+      pgmoneta_log_warn("WAL summary: Unable to rename %s: %s", tmp, strerror(errno));
+      errno = 0;
+      goto error;
+   }
+
+   free(tmp);
+
+   return 0;
+
+error:
+
+   if (fd != -1)
+   {
+      close(fd);
+   }
+
+   if (tmp != NULL)
+   {
+      unlink(tmp);
+   }
+
+   free(tmp);
+
+   return 1;
+}
+
+int
+pgmoneta_wal_summary_read(char* path, struct wal_summary** summary)
+{
+   struct wal_summary* s = NULL;
+   FILE* file = NULL;
+
+   *summary = NULL;
+
+   file = fopen(path, "r");
+   if (file == NULL)
+   {
+      goto error;
+   }
+
+   s = (struct wal_summary*)malloc(sizeof(struct wal_summary));
+   if (s == NULL)
+   {
+      goto error;
+   }
+
+   if (fread(s, 1, sizeof(struct wal_summary), file) != sizeof(struct wal_summary))
+   {
+      goto error;
+   }
+
+   /* A summary of another format is ignored, so the segment is read instead */
+   if (s->magic != WAL_SUMMARY_MAGIC || s->version != WAL_SUMMARY_VERSION)
+   {
+      pgmoneta_log_debug("WAL summary: Ignoring %s with an unknown format", path);
+      goto error;
+   }
+
+   fclose(file);
+
+   *summary = s;
+
+   return 0;
+
+error:
+
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+
+   free(s);
+
+   return 1;
+}
+
+char*
+pgmoneta_wal_summary_path(char* directory, char* segment)
+{
+   char* path = NULL;
+   char name[WAL_SEGMENT_NAME + 1];
+
+   memset(name, 0, sizeof(name));
+   memcpy(name, segment, MIN(strlen(segment), (size_t)WAL_SEGMENT_NAME));
+
+   path = pgmoneta_append(path, directory);
+   if (!pgmoneta_ends_with(path, "/"))
+   {
+      path = pgmoneta_append(path, "/");
+   }
+   path = pgmoneta_append(path, name);
+   path = pgmoneta_append(path, WAL_SUMMARY_SUFFIX);
+
+   return path;
+}
+
+bool
+pgmoneta_wal_summary_may_contain_xid(struct wal_summary* summary, uint32_t xid)
+{
+   if (summary == NULL)
+   {
+      return true;
+   }
+
+   if (summary->max_xid == 0)
+   {
+      return false;
+   }
+
+   return xid >= summary->min_xid && xid <= summary->max_xid;
+}
+
+static void
+add_xid(struct wal_summary* summary, transaction_id xid)
+{
+   /* Records without a transaction carry the invalid, bootstrap or frozen ID */
+   if (xid < FIRST_NORMAL_TRANSACTION_ID)
+   {
+      return;
+   }
+
+   if (summary->max_xid == 0 || xid < summary->min_xid)
+   {
+      summary->min_xid = xid;
+   }
+
+   if (summary->max_xid == 0 || xid > summary->max_xid)
+   {
+      summary->max_xid = xid;
+   }
+}
@@ -0,0 +1,311 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <walindex.h>
+#include <walk.h>
+
+/* system */
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WAL_NAME_LENGTH 24
+
+/** @struct wal_index_build
+ * Defines the state of the listing of an index
+ */
+struct wal_index_build
+{
+   struct wal_index* index; /**< The index */
+   int capacity;            /**< The capacity of the segments */
+   int history_capacity;    /**< The capacity of the history files */
+   bool partial;            /**< Should the partial segments be indexed */
+   bool failed;             /**< Has the listing failed */
+};
+
+static int wal_index_visitor(struct walk_entry* entry, void* data);
+static int wal_segment_compare(const void* a, const void* b);
+static int wal_segment_order(struct wal_segment* a, struct wal_segment* b);
+
+int
+pgmoneta_wal_index_create(char* directory, bool partial, struct wal_index** index)
+{
+   struct wal_index_build build;
+
+   *index = NULL;
+
+   memset(&build, 0, sizeof(struct wal_index_build));
+   build.partial = partial;
+
+   build.index = (struct wal_index*)malloc(sizeof(struct wal_index));
+   if (build.index == NULL)
+   {
+      goto error;
+   }
+
+   memset(build.index, 0, sizeof(struct wal_index));
+
+   if (pgmoneta_walk(directory, WALK_NO_RECURSE, wal_index_visitor, &build) || build.failed)
+   {
+      goto error;
+   }
+
+   if (build.index->number_of_segments > 1)
+   {
+      qsort(build.index->segments, build.index->number_of_segments, sizeof(struct wal_segment), wal_segment_compare);
+   }
+
+   *index = build.index;
+
+   return 0;
+
+error:
+
+   pgmoneta_wal_index_destroy(build.index);
+
+   return 1;
+}
+
+int
+pgmoneta_wal_index_parse(char* name, struct wal_segment* segment)
+{
+   char part[9];
+   uint32_t values[3];
+
+   if (name == NULL || strlen(name) < WAL_NAME_LENGTH ||
+       (name[WAL_NAME_LENGTH] != '\0' && name[WAL_NAME_LENGTH] != '.'))
+   {
+      return 1;
+   }
+
+   for (int i = 0; i < WAL_NAME_LENGTH; i++)
+   {
+      if (!((name[i] >= '0' && name[i] <= '9') || (name[i] >= 'A' && name[i] <= 'F')))
+      {
+         return 1;
+      }
+   }
+
+   for (int i = 0; i < 3; i++)
+   {
+      memcpy(&part[0], name + (i * 8), 8);
+      part[8] = '\0';
+      values[i] = (uint32_t)strtoul(&part[0], NULL, 16);
+   }
+
+   segment->timeline = values[0];
+   segment->log = values[1];
+   segment->seg = values[2];
+   segment->partial = strstr(name + WAL_NAME_LENGTH, ".partial") != NULL;
+
+   return 0;
+}
+
+int
+pgmoneta_wal_index_search(struct wal_index* index, char* name)
+{
+   struct wal_segment segment;
+   int lo;
+   int hi;
+   int mid;
+
+   if (index == NULL)
+   {
+      return 0;
+   }
+
+   if (pgmoneta_wal_index_parse(name, &segment))
+   {
+      return index->number_of_segments;
+   }
+
+   lo = 0;
+   hi = index->number_of_segments;
+   while (lo < hi)
+   {
+      mid = lo + (hi - lo) / 2;
+      if (wal_segment_order(&index->segments[mid], &segment) < 0)
+      {
+         lo = mid + 1;
+      }
+      else
+      {
+         hi = mid;
+      }
+   }
+
+   return lo;
+}
+
+int
+pgmoneta_wal_index_count(struct wal_index* index, char* from, char* to)
+{
+   int lower;
+   int upper;
+
+   if (index == NULL)
+   {
+      return 0;
+   }
+
+   lower = pgmoneta_wal_index_search(index, from);
+   upper = to != NULL ? pgmoneta_wal_index_search(index, to) : index->number_of_segments;
+
+   return upper > lower ? upper - lower : 0;
+}
+
+void
+pgmoneta_wal_index_destroy(struct wal_index* index)
+{
+   if (index == NULL)
+   {
+      return;
+   }
+
+   for (int i = 0; i < index->number_of_segments; i++)
+   {
+      free(index->segments[i].file);
+   }
+   free(index->segments);
+
+   for (int i = 0; i < index->number_of_histories; i++)
+   {
+      free(index->histories[i]);
+   }
+   free(index->histories);
+
+   free(index);
+}
+
+static int
+wal_index_visitor(struct walk_entry* entry, void* data)
+{
+   struct wal_index_build* build = (struct wal_index_build*)data;
+   struct wal_index* index = build->index;
+   struct wal_segment segment;
+
+   if (entry->type != DT_REG)
+   {
+      return WALK_CONTINUE;
+   }
+
+   if (pgmoneta_wal_index_parse(entry->name, &segment))
+   {
+      if (strlen(entry->name) > 8 && !strncmp(entry->name + 8, ".history", 8) &&
+          strspn(entry->name, "0123456789ABCDEF") == 8)
+      {
+         if (index->number_of_histories == build->history_capacity)
+         {
+            char** histories = NULL;
+            int capacity = build->history_capacity > 0 ? build->history_capacity * 2 : 16;
+
+            histories = (char**)realloc(index->histories, capacity * sizeof(char*));
+            if (histories == NULL)
+            {
+               build->failed = true;
+               return WALK_STOP;
+            }
+
+            index->histories = histories;
+            build->history_capacity = capacity;
+         }
+
+         index->histories[index->number_of_histories] = strdup(entry->name);
+         if (index->histories[index->number_of_histories] == NULL)
+         {
+            build->failed = true;
+            return WALK_STOP;
+         }
+         index->number_of_histories++;
+      }
+
+      return WALK_CONTINUE;
+   }
+
+   if (segment.partial && !build->partial)
+   {
+      return WALK_CONTINUE;
+   }
+
+   if (index->number_of_segments == build->capacity)
+   {
+      struct wal_segment* segments = NULL;
+      int capacity = build->capacity > 0 ? build->capacity * 2 : 1024;
+
+      segments = (struct wal_segment*)realloc(index->segments, capacity * sizeof(struct wal_segment));
+      if (segments == NULL)
+      {
+         build->failed = true;
+         return WALK_STOP;
+      }
+
+      index->segments = segments;
+      build->capacity = capacity;
+   }
+
+   segment.file = strdup(entry->name);
+   if (segment.file == NULL)
+   {
+      build->failed = true;
+      return WALK_STOP;
+   }
+
+   index->segments[index->number_of_segments++] = segment;
+
+   return WALK_CONTINUE;
+}
+
+static int
+wal_segment_compare(const void* a, const void* b)
+{
+   return wal_segment_order((struct wal_segment*)a, (struct wal_segment*)b);
+}
+
+static int
+wal_segment_order(struct wal_segment* a, struct wal_segment* b)
+{
+   if (a->timeline != b->timeline)
+   {
+      return a->timeline < b->timeline ? -1 : 1;
+   }
+
+   if (a->log != b->log)
+   {
+      return a->log < b->log ? -1 : 1;
+   }
+
+   if (a->seg != b->seg)
+   {
+      return a->seg < b->seg ? -1 : 1;
+   }
+
+   /* A partial segment is after the complete one, like its name */
+   return (int)a->partial - (int)b->partial;
+}
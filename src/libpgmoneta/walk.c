@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <walk.h>
+
+/* system */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+static int walk_directory(int fd, char* path, int flags, walk_visitor visitor, void* data);
+static int walk_stat(int dirfd, char* name, unsigned char* type, uint64_t* size, uint64_t* block_size);
+
+int
+pgmoneta_walk(char* directory, int flags, walk_visitor visitor, void* data)
+{
+   int fd = -1;
+
+   if (directory == NULL || visitor == NULL)
+   {
+      goto error;
+   }
+
+   fd = open(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+   if (fd == -1)
+   {
+      goto error;
+   }
+
+   /* The descriptor is closed by the walk */
+   walk_directory(fd, "", flags, visitor, data);
+
+   return 0;
+
+error:
+
+   errno = 0;
+
+   return 1;
+}
+
+static int
+walk_directory(int fd, char* path, int flags, walk_visitor visitor, void* data)
+{
+   DIR* dir = NULL;
+   struct dirent* d = NULL;
+   struct walk_entry entry;
+   char relative[MAX_PATH];
+   int child = -1;
+   int ret = WALK_CONTINUE;
+
+   dir = fdopendir(fd);
+   if (dir == NULL)
+   {
+      close(fd);
+      errno = 0;
+      return WALK_CONTINUE;
+   }
+
+   while ((d = readdir(dir)) != NULL)
+   {
+      if (!strcmp(d->d_name, ".") || !strcmp(d->d_name, ".."))
+      {
+         continue;
+      }
+
+      memset(&entry, 0, sizeof(struct walk_entry));
+      entry.dirfd = dirfd(dir);
+      entry.name = d->d_name;
+      entry.type = d->d_type;
+
+      snprintf(relative, sizeof(relative), "%s%s%s", path, *path != '\0' ? "/" : "", d->d_name);
+      entry.path = relative;
+
+      /* Only a stat'ed entry, or one the file system doesn't type, costs a system call */
+      if ((flags & WALK_STAT) || entry.type == DT_UNKNOWN)
+      {
+         if (walk_stat(entry.dirfd, d->d_name, &entry.type, &entry.size, &entry.block_size))
+         {
+            continue;
+         }
+      }
+
+      if (entry.type != DT_REG && entry.type != DT_DIR && entry.type != DT_LNK)
+      {
+         continue;
+      }
+
+      ret = visitor(&entry, data);
+
+      if (ret == WALK_STOP)
+      {
+         break;
+      }
+
+      if (entry.type == DT_DIR && ret != WALK_SKIP && !(flags & WALK_NO_RECURSE))
+      {
+         child = openat(entry.dirfd, d->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+         if (child == -1)
+         {
+            errno = 0;
+            ret = WALK_CONTINUE;
+            continue;
+         }
+
+         ret = walk_directory(child, relative, flags, visitor, data);
+         if (ret == WALK_STOP)
+         {
+            break;
+         }
+      }
+
+      ret = WALK_CONTINUE;
+   }
+
+   closedir(dir);
+
+   return ret;
+}
+
+static int
+walk_stat(int dirfd, char* name, unsigned char* type, uint64_t* size, uint64_t* block_size)
+{
+#if defined(HAVE_LINUX)
+   struct statx stx;
+
+   /* The type and the block size are always returned, so only ask for the size */
+   if (statx(dirfd, name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, STATX_TYPE | STATX_SIZE, &stx))
+   {
+      errno = 0;
+      return 1;
+   }
+
+   if (*type == DT_UNKNOWN)
+   {
+      *type = S_ISREG(stx.stx_mode) ? DT_REG : S_ISDIR(stx.stx_mode) ? DT_DIR : S_ISLNK(stx.stx_mode) ? DT_LNK : DT_UNKNOWN;
+   }
+
+   *size = stx.stx_size;
+   *block_size = stx.stx_blksize;
+#else
+   struct stat st;
+
+   if (fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW))
+   {
+      errno = 0;
+      return 1;
+   }
+
+   if (*type == DT_UNKNOWN)
+   {
+      *type = S_ISREG(st.st_mode) ? DT_REG : S_ISDIR(st.st_mode) ? DT_DIR : S_ISLNK(st.st_mode) ? DT_LNK : DT_UNKNOWN;
+   }
+
+   *size = st.st_size;
+   *block_size = st.st_blksize;
+#endif
+
+   errno = 0;
+
+   return 0;
+}
@@ -0,0 +1,493 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <aes.h>
+#include <bzip2_compression.h>
+#include <gzip_compression.h>
+#include <logging.h>
+#include <lz4_compression.h>
+#include <management.h>
+#include <network.h>
+#include <reader.h>
+#include <utils.h>
+#include <walfetch.h>
+#include <walpush.h>
+#include <zstandard_compression.h>
+
+/* system */
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NAME "walpush"
+
+#define WAL_PUSH_COMPARE_SIZE 65536
+
+static char* staging_file(char* wal, char* file, char* suffix);
+static int receive(SSL* ssl, int client_fd, char* path, uint64_t* received);
+static int identical(char* archived, char* path, bool* same);
+static int store(char* wal, char* file, char* raw, char** stored);
+static int sync_path(char* path);
+
+void
+pgmoneta_wal_push(SSL* ssl __attribute__((unused)), int client_fd, int server, uint8_t compression, uint8_t encryption, struct json* payload)
+{
+   char* elapsed = NULL;
+   struct timespec start_t;
+   struct timespec end_t;
+   double total_seconds;
+   char* file = NULL;
+   uint64_t size = 0;
+   uint64_t received = 0;
+   char* wal = NULL;
+   char* raw = NULL;
+   char* archived = NULL;
+   char* stored = NULL;
+   bool duplicate = false;
+   struct json* req = NULL;
+   struct json* response = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+#ifdef HAVE_FREEBSD
+   clock_gettime(CLOCK_MONOTONIC_FAST, &start_t);
+#else
+   clock_gettime(CLOCK_MONOTONIC_RAW, &start_t);
+#endif
+
+   req = (struct json*)pgmoneta_json_get(payload, MANAGEMENT_CATEGORY_REQUEST);
+   file = (char*)pgmoneta_json_get(req, MANAGEMENT_ARGUMENT_FILENAME);
+   size = (uint64_t)pgmoneta_json_get(req, MANAGEMENT_ARGUMENT_BYTES);
+
+   if (file == NULL || strlen(file) == 0 || strchr(file, '/') != NULL || file[0] == '.')
+   {
+      pgmoneta_management_response_error(NULL, client_fd, config->common.servers[server].name, MANAGEMENT_ERROR_BAD_PAYLOAD, NAME, compression, encryption, payload);
+      pgmoneta_log_error("WAL push: Invalid request for %s", config->common.servers[server].name);
+      goto error;
+   }
+
+   wal = pgmoneta_get_server_wal(server);
+   if (wal == NULL || pgmoneta_mkdir(wal))
+   {
+      pgmoneta_management_response_error(NULL, client_fd, config->common.servers[server].name, MANAGEMENT_ERROR_WAL_PUSH_ERROR, NAME, compression, encryption, payload);
+      goto error;
+   }
+
+   raw = staging_file(wal, file, "");
+
+   if (receive(NULL, client_fd, raw, &received) || received != size)
+   {
+      pgmoneta_management_response_error(NULL, client_fd, config->common.servers[server].name, MANAGEMENT_ERROR_WAL_PUSH_NETWORK, NAME, compression, encryption, payload);
+      pgmoneta_log_error("WAL push: Could not receive %s for %s (%" PRIu64 " of %" PRIu64 " bytes)",
+                         file, config->common.servers[server].name, received, size);
+      goto error;
+   }
+
+   archived = pgmoneta_wal_archived_file(server, file);
+
+   if (archived != NULL)
+   {
+      /* archive_command is retried after a crash, so an identical file is a success */
+      if (identical(archived, raw, &duplicate) || !duplicate)
+      {
+         pgmoneta_management_response_error(NULL, client_fd, config->common.servers[server].name, MANAGEMENT_ERROR_WAL_PUSH_EXISTS, NAME, compression, encryption, payload);
+         pgmoneta_log_error("WAL push: %s already exists with different content", archived);
+         goto error;
+      }
+
+      unlink(raw);
+   }
+   else if (store(wal, file, raw, &stored))
+   {
+      pgmoneta_management_response_error(NULL, client_fd, config->common.servers[server].name, MANAGEMENT_ERROR_WAL_PUSH_ERROR, NAME, compression, encryption, payload);
+      pgmoneta_log_error("WAL push: Could not store %s for %s", file, config->common.servers[server].name);
+      goto error;
+   }
+
+   if (pgmoneta_management_create_response(payload, server, &response))
+   {
+      pgmoneta_management_response_error(NULL, client_fd, config->common.servers[server].name, MANAGEMENT_ERROR_ALLOCATION, NAME, compression, encryption, payload);
+      goto error;
+   }
+
+   pgmoneta_json_put(response, MANAGEMENT_ARGUMENT_SERVER, (uintptr_t)config->common.servers[server].name, ValueString);
+   pgmoneta_json_put(response, MANAGEMENT_ARGUMENT_FILENAME, (uintptr_t)file, ValueString);
+   pgmoneta_json_put(response, MANAGEMENT_ARGUMENT_BYTES, (uintptr_t)received, ValueUInt64);
+   pgmoneta_json_put(response, MANAGEMENT_ARGUMENT_DUPLICATE, (uintptr_t)duplicate, ValueBool);
+
+#ifdef HAVE_FREEBSD
+   clock_gettime(CLOCK_MONOTONIC_FAST, &end_t);
+#else
+   clock_gettime(CLOCK_MONOTONIC_RAW, &end_t);
+#endif
+
+   if (pgmoneta_management_response_ok(NULL, client_fd, start_t, end_t, compression, encryption, payload))
+   {
+      pgmoneta_management_response_error(NULL, client_fd, config->common.servers[server].name, MANAGEMENT_ERROR_WAL_PUSH_NETWORK, NAME, compression, encryption, payload);
+      pgmoneta_log_error("WAL push: Error sending response");
+      goto error;
+   }
+
+   elapsed = pgmoneta_get_timestamp_string(start_t, end_t, &total_seconds);
+
+   pgmoneta_log_debug("WAL push: %s/%s%s (Elapsed: %s)", config->common.servers[server].name, file, duplicate ? " (Duplicate)" : "", elapsed);
+
+   free(wal);
+   free(raw);
+   free(archived);
+   free(stored);
+   free(elapsed);
+
+   exit(0);
+
+error:
+
+   if (raw != NULL)
+   {
+      unlink(raw);
+   }
+
+   free(wal);
+   free(raw);
+   free(archived);
+   free(stored);
+   free(elapsed);
+
+   exit(1);
+}
+
+static char*
+staging_file(char* wal, char* file, char* suffix)
+{
+   char pid[32];
+   char* path = NULL;
+
+   /* .partial keeps the file away from the WAL compression and the retention */
+   snprintf(&pid[0], sizeof(pid), ".push%d", (int)getpid());
+
+   path = pgmoneta_append(path, wal);
+   path = pgmoneta_append(path, file);
+   path = pgmoneta_append(path, suffix);
+   path = pgmoneta_append(path, &pid[0]);
+   path = pgmoneta_append(path, ".partial");
+
+   return path;
+}
+
+static int
+receive(SSL* ssl, int client_fd, char* path, uint64_t* received)
+{
+   int fd = -1;
+   unsigned char* data = NULL;
+   size_t data_size = 0;
+   size_t offset;
+   ssize_t w;
+
+   *received = 0;
+
+   fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0600);
+   if (fd == -1)
+   {
+      pgmoneta_log_error("WAL push: Could not create %s: %s", path, strerror(errno));
+      errno = 0;
+      goto error;
+   }
+
+   do
+   {
+      if (pgmoneta_management_read_data(ssl, client_fd, &data, &data_size))
+      {
+         goto error;
+      }
+
+      offset = 0;
+      while (offset < data_size)
+      {
+         w = write(fd, data + offset, data_size - offset);
+         if (w == -1)
+         {
+            if (errno == EINTR)
+            {
+               continue;
+            }
+
+            pgmoneta_log_error("WAL push: Could not write %s: %s", path, strerror(errno));
+            errno = 0;
+            goto error;
+         }
+
+         offset += w;
+      }
+
+      *received += data_size;
+
+      free(data);
+      data = NULL;
+   }
+   while (data_size > 0);
+
+   close(fd);
+
+   return 0;
+
+error:
+
+   free(data);
+
+   if (fd != -1)
+   {
+      close(fd);
+   }
+
+   return 1;
+}
+
+static int
+identical(char* archived, char* path, bool* same)
+{
+   struct reader* reader = NULL;
+   FILE* file = NULL;
+   unsigned char* a = NULL;
+   unsigned char* b = NULL;
+   size_t a_read = 0;
+   size_t b_read = 0;
+
+   *same = false;
+
+   a = (unsigned char*)malloc(WAL_PUSH_COMPARE_SIZE);
+   b = (unsigned char*)malloc(WAL_PUSH_COMPARE_SIZE);
+
+   if (a == NULL || b == NULL)
+   {
+      goto error;
+   }
+
+   if (pgmoneta_reader_open(archived, &reader))
+   {
+      goto error;
+   }
+
+   file = fopen(path, "rb");
+   if (file == NULL)
+   {
+      goto error;
+   }
+
+   do
+   {
+      if (pgmoneta_reader_fill(reader, a, WAL_PUSH_COMPARE_SIZE, &a_read))
+      {
+         goto error;
+      }
+
+      b_read = fread(b, 1, WAL_PUSH_COMPARE_SIZE, file);
+
+      if (a_read != b_read || memcmp(a, b, a_read))
+      {
+         goto done;
+      }
+   }
+   while (a_read == WAL_PUSH_COMPARE_SIZE);
+
+   *same = true;
+
+done:
+
+   pgmoneta_reader_close(reader);
+   fclose(file);
+   free(a);
+   free(b);
+
+   return 0;
+
+error:
+
+   pgmoneta_reader_close(reader);
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+   free(a);
+   free(b);
+
+   return 1;
+}
+
+static int
+store(char* wal, char* file, char* raw, char** stored)
+{
+   char* suffix = NULL;
+   char* current = NULL;
+   char* next = NULL;
+   char* final = NULL;
+   int ret = 0;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   *stored = NULL;
+
+   current = pgmoneta_append(current, raw);
+
+   /* The same layout as the streamed WAL after its compression and encryption */
+   if (pgmoneta_ends_with(file, ".history"))
+   {
+      /* History files are kept as they are */
+   }
+   else if (config->compression_type == COMPRESSION_CLIENT_GZIP || config->compression_type == COMPRESSION_SERVER_GZIP)
+   {
+      suffix = pgmoneta_append(suffix, ".gz");
+      next = staging_file(wal, file, suffix);
+      ret = pgmoneta_gzip_file(current, next);
+   }
+   else if (config->compression_type == COMPRESSION_CLIENT_ZSTD || config->compression_type == COMPRESSION_SERVER_ZSTD)
+   {
+      suffix = pgmoneta_append(suffix, ".zstd");
+      next = staging_file(wal, file, suffix);
+      ret = pgmoneta_zstandardc_file(current, next);
+   }
+   else if (config->compression_type == COMPRESSION_CLIENT_LZ4 || config->compression_type == COMPRESSION_SERVER_LZ4)
+   {
+      suffix = pgmoneta_append(suffix, ".lz4");
+      next = staging_file(wal, file, suffix);
+      ret = pgmoneta_lz4c_file(current, next);
+   }
+   else if (config->compression_type == COMPRESSION_CLIENT_BZIP2)
+   {
+      suffix = pgmoneta_append(suffix, ".bz2");
+      next = staging_file(wal, file, suffix);
+      ret = pgmoneta_bzip2_file(current, next);
+   }
+
+   if (next != NULL)
+   {
+      if (ret)
+      {
+         goto error;
+      }
+
+      free(current);
+      current = next;
+      next = NULL;
+   }
+
+   if (config->encryption != ENCRYPTION_NONE && !pgmoneta_ends_with(file, ".history"))
+   {
+      suffix = pgmoneta_append(suffix, ".aes");
+      next = staging_file(wal, file, suffix);
+
+      if (pgmoneta_encrypt_file(current, next))
+      {
+         goto error;
+      }
+
+      free(current);
+      current = next;
+      next = NULL;
+   }
+
+   final = pgmoneta_append(final, wal);
+   final = pgmoneta_append(final, file);
+   final = pgmoneta_append(final, suffix);
+
+   if (sync_path(current))
+   {
+      goto error;
+   }
+
+   if (rename(current, final))
+   {
+      pgmoneta_log_error("WAL push: Could not rename %s to %s: %s", current, final, strerror(errno));
+      errno = 0;
+      goto error;
+   }
+
+   if (sync_path(wal))
+   {
+      goto error;
+   }
+
+   *stored = final;
+
+   free(suffix);
+   free(current);
+
+   return 0;
+
+error:
+
+   if (current != NULL)
+   {
+      unlink(current);
+   }
+
+   if (next != NULL)
+   {
+      unlink(next);
+   }
+
+   free(suffix);
+   free(current);
+   free(next);
+   free(final);
+
+   return 1;
+}
+
+static int
+sync_path(char* path)
+{
+   int fd = -1;
+
+   fd = open(path, O_RDONLY);
+   if (fd == -1)
+   {
+      pgmoneta_log_error("WAL push: Could not open %s: %s", path, strerror(errno));
+      errno = 0;
+      return 1;
+   }
+
+   if (fsync(fd))
+   {
+      pgmoneta_log_error("WAL push: Could not sync %s: %s", path, strerror(errno));
+      errno = 0;
+      close(fd);
+      return 1;
+   }
+
+   close(fd);
+
+   return 0;
+}
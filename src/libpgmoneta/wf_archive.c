@@ -30,7 +30,9 @@
 #include <pgmoneta.h>
 #include <achv.h>
 #include <logging.h>
+#include <progress.h>
 #include <utils.h>
+#include <workers.h>
 #include <workflow.h>
 
 /* system */
@@ -68,6 +70,8 @@ pgmoneta_create_archive(void)
    wf->setup = &pgmoneta_common_setup;
    wf->execute = &archive_execute;
    wf->teardown = &archive_teardown;
+   wf->execute_file = NULL;
+   wf->independent = false;
    wf->next = NULL;
 
    return wf;
@@ -83,12 +87,17 @@ static int
 archive_execute(char* name __attribute__((unused)), struct art* nodes)
 {
    int server = -1;
+   int number_of_workers = 0;
    char* label = NULL;
    char* root = NULL;
    char* base = NULL;
-   char* src = NULL;
+   char* source = NULL;
+   char* overlay = NULL;
+   char* tarfile = NULL;
    char* dst = NULL;
    char* d_name = NULL;
+   struct backup* backup = NULL;
+   struct workers* workers = NULL;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
@@ -115,18 +124,45 @@ archive_execute(char* name __attribute__((unused)), struct art* nodes)
 
    pgmoneta_log_debug("Archive (execute): %s/%s", config->common.servers[server].name, label);
 
-   src = pgmoneta_append(src, base);
+   /* A streamed archive reads the backup itself, and the base only holds the files changed by the restore */
+   source = (char*)pgmoneta_art_search(nodes, NODE_ARCHIVE_SOURCE);
+   if (source != NULL)
+   {
+      overlay = base;
+   }
+   else
+   {
+      source = base;
+   }
 
-   dst = pgmoneta_append(dst, root);
-   if (!pgmoneta_ends_with(dst, "/"))
+   tarfile = pgmoneta_append(tarfile, root);
+   if (!pgmoneta_ends_with(tarfile, "/"))
+   {
+      tarfile = pgmoneta_append(tarfile, "/");
+   }
+   tarfile = pgmoneta_append(tarfile, "archive-");
+   tarfile = pgmoneta_append(tarfile, config->common.servers[server].name);
+   tarfile = pgmoneta_append(tarfile, "-");
+   tarfile = pgmoneta_append(tarfile, label);
+   tarfile = pgmoneta_append(tarfile, ".tar");
+
+   dst = pgmoneta_append(dst, tarfile);
+   if (config->compression_type == COMPRESSION_CLIENT_GZIP || config->compression_type == COMPRESSION_SERVER_GZIP)
+   {
+      dst = pgmoneta_append(dst, ".gz");
+   }
+   else if (config->compression_type == COMPRESSION_CLIENT_ZSTD || config->compression_type == COMPRESSION_SERVER_ZSTD)
+   {
+      dst = pgmoneta_append(dst, ".zstd");
+   }
+   else if (config->compression_type == COMPRESSION_CLIENT_LZ4 || config->compression_type == COMPRESSION_SERVER_LZ4)
    {
-      dst = pgmoneta_append(dst, "/");
+      dst = pgmoneta_append(dst, ".lz4");
+   }
+   else if (config->compression_type == COMPRESSION_CLIENT_BZIP2)
+   {
+      dst = pgmoneta_append(dst, ".bz2");
    }
-   dst = pgmoneta_append(dst, "archive-");
-   dst = pgmoneta_append(dst, config->common.servers[server].name);
-   dst = pgmoneta_append(dst, "-");
-   dst = pgmoneta_append(dst, label);
-   dst = pgmoneta_append(dst, ".tar");
 
    d_name = pgmoneta_append(d_name, config->common.servers[server].name);
    d_name = pgmoneta_append(d_name, "-");
@@ -137,17 +173,33 @@ archive_execute(char* name __attribute__((unused)), struct art* nodes)
       pgmoneta_delete_file(dst, NULL);
    }
 
-   if (pgmoneta_tar_directory(src, dst, d_name))
+   backup = (struct backup*)pgmoneta_art_search(nodes, NODE_BACKUP);
+   if (backup != NULL)
+   {
+      pgmoneta_progress_total(backup->restore_size, 0);
+   }
+
+   number_of_workers = pgmoneta_get_number_of_workers(server);
+   if (number_of_workers > 0)
+   {
+      pgmoneta_workers_initialize_group(pgmoneta_workflow_io_workers(nodes), number_of_workers, &workers);
+   }
+
+   if (pgmoneta_tar_backup(source, overlay, dst, -1, d_name, workers))
    {
       goto error;
    }
 
-   if (pgmoneta_art_insert(nodes, NODE_TARGET_FILE, (uintptr_t)dst, ValueString))
+   pgmoneta_workers_destroy(workers);
+   workers = NULL;
+
+   /* The target file is the plain tar file, the following steps add their suffixes */
+   if (pgmoneta_art_insert(nodes, NODE_TARGET_FILE, (uintptr_t)tarfile, ValueString))
    {
       goto error;
    }
 
-   free(src);
+   free(tarfile);
    free(dst);
    free(d_name);
 
@@ -155,7 +207,9 @@ archive_execute(char* name __attribute__((unused)), struct art* nodes)
 
 error:
 
-   free(src);
+   pgmoneta_workers_destroy(workers);
+
+   free(tarfile);
    free(dst);
    free(d_name);
 
@@ -29,9 +29,18 @@
 /* pgmoneta */
 #include <pgmoneta.h>
 #include <achv.h>
+#include <aes.h>
+#include <bandwidth.h>
 #include <backup.h>
+#include <delta.h>
+#include <incremental.h>
+#include <info.h>
 #include <logging.h>
 #include <network.h>
+#include <page.h>
+#include <parallel.h>
+#include <progress.h>
+#include <prometheus.h>
 #include <security.h>
 #include <server.h>
 #include <tablespace.h>
@@ -40,12 +49,14 @@
 
 /* system */
 #include <assert.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 static char* basebackup_name(void);
 static int basebackup_execute(char*, struct art*);
+static int basebackup_execute_source(struct art* nodes, int source);
 
 static int send_upload_manifest(SSL* ssl, int socket);
 static int upload_manifest(SSL* ssl, int socket, char* path);
@@ -66,6 +77,8 @@ pgmoneta_create_basebackup(void)
    wf->setup = &pgmoneta_common_setup;
    wf->execute = &basebackup_execute;
    wf->teardown = &pgmoneta_common_teardown;
+   wf->execute_file = NULL;
+   wf->independent = false;
    wf->next = NULL;
 
    return wf;
@@ -79,6 +92,38 @@ basebackup_name(void)
 
 static int
 basebackup_execute(char* name __attribute__((unused)), struct art* nodes)
+{
+   int server = -1;
+   int source = -1;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   server = (int)pgmoneta_art_search(nodes, NODE_SERVER_ID);
+   source = server;
+
+   // a server side incremental backup needs the WAL summaries of the server
+   if (!pgmoneta_art_contains_key(nodes, NODE_INCREMENTAL_BASE) || config->common.servers[server].version < 17)
+   {
+      source = pgmoneta_server_backup_source(server);
+   }
+
+   if (source != server)
+   {
+      if (!basebackup_execute_source(nodes, source))
+      {
+         return 0;
+      }
+
+      pgmoneta_log_warn("Backup: Could not backup %s from %s, using %s", config->common.servers[server].name,
+                        config->common.servers[source].name, config->common.servers[server].name);
+   }
+
+   return basebackup_execute_source(nodes, server);
+}
+
+static int
+basebackup_execute_source(struct art* nodes, int source)
 {
    int server = -1;
    char* label = NULL;
@@ -110,6 +155,8 @@ basebackup_execute(char* name __attribute__((unused)), struct art* nodes)
    char* chkptpos = NULL;
    uint32_t start_timeline = 0;
    uint32_t end_timeline = 0;
+   uint32_t hi = 0;
+   uint32_t lo = 0;
    char old_label_path[MAX_PATH];
    int backup_max_rate;
    int network_max_rate;
@@ -122,9 +169,20 @@ basebackup_execute(char* name __attribute__((unused)), struct art* nodes)
    struct query_response* response = NULL;
    struct tablespace* tablespaces = NULL;
    struct tablespace* current_tablespace = NULL;
+   struct info_batch* info = NULL;
    struct tuple* tup = NULL;
    struct token_bucket* bucket = NULL;
    struct token_bucket* network_bucket = NULL;
+   bool shared = false;
+   bool parallel = false;
+   bool tracked = false;
+   bool server_incremental = false;
+   bool verify_checksums = false;
+   struct page_checksums checksums;
+   char* d = NULL;
+   char* data_key = NULL;
+   int number_of_backups = 0;
+   struct backup** backups = NULL;
 
    config = (struct main_configuration*)shmem;
 
@@ -144,7 +202,11 @@ basebackup_execute(char* name __attribute__((unused)), struct art* nodes)
    server = (int)pgmoneta_art_search(nodes, NODE_SERVER_ID);
    label = (char*)pgmoneta_art_search(nodes, NODE_LABEL);
 
-   pgmoneta_log_debug("Basebackup (execute): %s", config->common.servers[server].name, label);
+   pgmoneta_log_debug("Basebackup (execute): %s/%s from %s", config->common.servers[server].name, label,
+                      config->common.servers[source].name);
+
+   /* Keep the receiver, and the writer thread it starts, on the node of the network card */
+   pgmoneta_pin_thread(config->receiver_cpus, -1);
 
 #ifdef HAVE_FREEBSD
    clock_gettime(CLOCK_MONOTONIC_FAST, &start_t);
@@ -185,31 +247,34 @@ basebackup_execute(char* name __attribute__((unused)), struct art* nodes)
          goto error;
       }
    }
+
+   shared = pgmoneta_bandwidth_start(BANDWIDTH_BACKUP) == 0;
+
    usr = -1;
    // find the corresponding user's index of the given server
    for (int i = 0; usr == -1 && i < config->common.number_of_users; i++)
    {
-      if (!strcmp(config->common.servers[server].username, config->common.users[i].username))
+      if (!strcmp(config->common.servers[source].username, config->common.users[i].username))
       {
          usr = i;
       }
    }
-   // establish a connection, with replication flag set
-   if (pgmoneta_server_authenticate(server, "postgres", config->common.users[usr].username, config->common.users[usr].password, false, &ssl, &socket) != AUTH_SUCCESS)
-   {
-      pgmoneta_log_info("Invalid credentials for %s", config->common.users[usr].username);
-      goto error;
-   }
-
-   if (!pgmoneta_server_valid(server))
+   if (!pgmoneta_server_valid(source))
    {
-      pgmoneta_server_info(server);
+      pgmoneta_server_info(source);
 
-      if (!pgmoneta_server_valid(server))
+      if (!pgmoneta_server_valid(source))
       {
          goto error;
       }
    }
+
+   // establish a connection, reusing the one of the server information when possible
+   if (pgmoneta_server_connect(source, &ssl, &socket) != AUTH_SUCCESS)
+   {
+      pgmoneta_log_info("Invalid credentials for %s", config->common.users[usr].username);
+      goto error;
+   }
    memset(version, 0, sizeof(version));
    snprintf(version, sizeof(version), "%d", config->common.servers[server].version);
    memset(minor_version, 0, sizeof(minor_version));
@@ -248,95 +313,155 @@ basebackup_execute(char* name __attribute__((unused)), struct art* nodes)
    }
    pgmoneta_free_query_response(response);
    response = NULL;
-   pgmoneta_close_ssl(ssl);
-   pgmoneta_disconnect(socket);
+   pgmoneta_server_disconnect(source, ssl, socket);
+   ssl = NULL;
+   socket = -1;
+
+   tag = pgmoneta_append(tag, "pgmoneta_");
+   tag = pgmoneta_append(tag, label);
 
-   if (pgmoneta_server_authenticate(server, "postgres", config->common.users[usr].username, config->common.users[usr].password, true, &ssl, &socket) != AUTH_SUCCESS)
+   hash = config->common.servers[server].manifest;
+   if (hash == HASH_ALGORITHM_DEFAULT)
    {
-      pgmoneta_log_info("Invalid credentials for %s", config->common.users[usr].username);
-      goto error;
+      hash = config->manifest;
    }
 
-   pgmoneta_memory_stream_buffer_init(&buffer);
+   // before PostgreSQL 17 the server sends every file, and the backup is made incremental afterwards
+   server_incremental = incremental != NULL && config->common.servers[server].version >= 17;
 
-   if (incremental != NULL)
+   // the extension tells the blocks changed since the parent, so the other blocks aren't read
+   tracked = incremental != NULL && !server_incremental && config->common.servers[server].ext_valid;
+
+   // a backup of a cluster without tablespaces can be copied over several connections of the server,
+   // or from a file system snapshot
+   parallel = !server_incremental && tablespaces == NULL && source == server &&
+              (config->common.servers[server].backup_connections > 1 || tracked ||
+               strlen(config->common.servers[server].snapshot_command) > 0);
+
+   // the page checksums are verified while a plain tar stream is extracted
+   verify_checksums = config->common.servers[server].checksums && !parallel &&
+                      config->compression_type != COMPRESSION_SERVER_GZIP &&
+                      config->compression_type != COMPRESSION_SERVER_LZ4 &&
+                      config->compression_type != COMPRESSION_SERVER_ZSTD;
+   memset(&checksums, 0, sizeof(struct page_checksums));
+   checksums.block_size = config->common.servers[server].block_size;
+   checksums.relseg_size = config->common.servers[server].relseg_size;
+
+   if (!parallel)
    {
-      // send UPLOAD_MANIFEST
-      if (send_upload_manifest(ssl, socket))
+      if (pgmoneta_server_authenticate(source, "postgres", config->common.users[usr].username, config->common.users[usr].password, true, &ssl, &socket) != AUTH_SUCCESS)
       {
-         pgmoneta_log_error("Fail to send UPLOAD_MANIFEST to server %s", config->common.servers[server].name);
+         pgmoneta_log_info("Invalid credentials for %s", config->common.users[usr].username);
          goto error;
       }
-      manifest_path = pgmoneta_append(NULL, incremental);
-      manifest_path = pgmoneta_append(manifest_path, "data/backup_manifest");
-      old_manifest_path = pgmoneta_append(NULL, incremental);
-      old_manifest_path = pgmoneta_append(old_manifest_path, "backup_manifest.old");
-
-      // use the old manifest because postgres doesn't recognize our own manifest,
-      // we can remove this when we have a format converter
-      if (pgmoneta_exists(old_manifest_path))
+
+      pgmoneta_memory_stream_buffer_init(&buffer);
+
+      if (server_incremental)
       {
-         if (upload_manifest(ssl, socket, old_manifest_path))
+         // send UPLOAD_MANIFEST
+         if (send_upload_manifest(ssl, socket))
          {
-            pgmoneta_log_error("Fail to upload manifest to server %s", config->common.servers[server].name);
+            pgmoneta_log_error("Fail to send UPLOAD_MANIFEST to server %s", config->common.servers[server].name);
             goto error;
          }
-      }
-      else
-      {
-         if (upload_manifest(ssl, socket, manifest_path))
+         manifest_path = pgmoneta_append(NULL, incremental);
+         manifest_path = pgmoneta_append(manifest_path, "data/backup_manifest");
+         old_manifest_path = pgmoneta_append(NULL, incremental);
+         old_manifest_path = pgmoneta_append(old_manifest_path, "backup_manifest.old");
+
+         // use the old manifest because postgres doesn't recognize our own manifest,
+         // we can remove this when we have a format converter
+         if (pgmoneta_exists(old_manifest_path))
+         {
+            if (upload_manifest(ssl, socket, old_manifest_path))
+            {
+               pgmoneta_log_error("Fail to upload manifest to server %s", config->common.servers[server].name);
+               goto error;
+            }
+         }
+         else
+         {
+            if (upload_manifest(ssl, socket, manifest_path))
+            {
+               pgmoneta_log_error("Fail to upload manifest to server %s", config->common.servers[server].name);
+               goto error;
+            }
+         }
+
+         // receive and ignore the result set for UPLOAD_MANIFEST
+         if (pgmoneta_consume_data_row_messages(ssl, socket, buffer, &response))
          {
-            pgmoneta_log_error("Fail to upload manifest to server %s", config->common.servers[server].name);
             goto error;
          }
+         pgmoneta_free_query_response(response);
+         response = NULL;
       }
 
-      // receive and ignore the result set for UPLOAD_MANIFEST
+      pgmoneta_create_base_backup_message(config->common.servers[server].version, server_incremental, tag, true, hash,
+                                          config->compression_type, config->compression_level,
+                                          &basebackup_msg);
+
+      status = pgmoneta_write_message(ssl, socket, basebackup_msg);
+      if (status != MESSAGE_STATUS_OK)
+      {
+         goto error;
+      }
+
+      // Receive the first result set, which contains the WAL starting point
       if (pgmoneta_consume_data_row_messages(ssl, socket, buffer, &response))
       {
          goto error;
       }
+      memset(startpos, 0, sizeof(startpos));
+      memcpy(startpos, response->tuples[0].data[0], strlen(response->tuples[0].data[0]));
+      start_timeline = atoi(response->tuples[0].data[1]);
       pgmoneta_free_query_response(response);
       response = NULL;
-   }
-
-   tag = pgmoneta_append(tag, "pgmoneta_");
-   tag = pgmoneta_append(tag, label);
 
-   hash = config->common.servers[server].manifest;
-   if (hash == HASH_ALGORITHM_DEFAULT)
-   {
-      hash = config->manifest;
+      sscanf(startpos, "%X/%X", &hi, &lo);
+      checksums.start_lsn = ((uint64_t)hi << 32) | lo;
    }
 
-   pgmoneta_create_base_backup_message(config->common.servers[server].version, incremental != NULL, tag, true, hash,
-                                       config->compression_type, config->compression_level,
-                                       &basebackup_msg);
-
-   status = pgmoneta_write_message(ssl, socket, basebackup_msg);
-   if (status != MESSAGE_STATUS_OK)
+   // the newest valid backup is the estimate of the size of this one
+   d = pgmoneta_get_server_backup(server);
+   if (!pgmoneta_get_backups(d, &number_of_backups, &backups))
    {
-      goto error;
-   }
+      for (int i = number_of_backups - 1; i >= 0; i--)
+      {
+         if (backups[i] != NULL && backups[i]->valid == VALID_TRUE)
+         {
+            pgmoneta_progress_total(backups[i]->restore_size, 0);
+            break;
+         }
+      }
 
-   // Receive the first result set, which contains the WAL starting point
-   if (pgmoneta_consume_data_row_messages(ssl, socket, buffer, &response))
+      /* The data key is shared, so the files can be linked between the backups */
+      for (int i = number_of_backups - 1; i >= 0 && data_key == NULL; i--)
+      {
+         if (backups[i] != NULL && strlen(backups[i]->data_key) > 0)
+         {
+            data_key = pgmoneta_append(NULL, backups[i]->data_key);
+         }
+      }
+   }
+   for (int i = 0; i < number_of_backups; i++)
    {
-      goto error;
+      free(backups[i]);
    }
-   memset(startpos, 0, sizeof(startpos));
-   memcpy(startpos, response->tuples[0].data[0], strlen(response->tuples[0].data[0]));
-   start_timeline = atoi(response->tuples[0].data[1]);
-   pgmoneta_free_query_response(response);
-   response = NULL;
+   free(backups);
+   backups = NULL;
+   free(d);
+   d = NULL;
 
    // create the root dir
    backup_base = pgmoneta_get_server_backup_identifier(server, label);
 
    pgmoneta_mkdir(backup_base);
-   if (config->common.servers[server].version < 15)
+   if (parallel)
    {
-      if (pgmoneta_receive_archive_files(ssl, socket, buffer, backup_base, tablespaces, bucket, network_bucket))
+      if (pgmoneta_parallel_backup(server, tag, backup_base, hash, MAX(config->common.servers[server].backup_connections, 1),
+                                   tracked ? incremental_label : NULL, bucket, network_bucket, startpos, endpos, &start_timeline, &end_timeline))
       {
          pgmoneta_log_error("Backup: Could not backup %s", config->common.servers[server].name);
 
@@ -347,52 +472,76 @@ basebackup_execute(char* name __attribute__((unused)), struct art* nodes)
    }
    else
    {
-      if (pgmoneta_receive_archive_stream(ssl, socket, buffer, backup_base, tablespaces, bucket, network_bucket))
+      if (config->common.servers[server].version < 15)
       {
-         pgmoneta_log_error("Backup: Could not backup %s", config->common.servers[server].name);
+         if (pgmoneta_receive_archive_files(ssl, socket, buffer, server, backup_base, tablespaces, bucket, network_bucket,
+                                            verify_checksums ? &checksums : NULL))
+         {
+            pgmoneta_log_error("Backup: Could not backup %s", config->common.servers[server].name);
 
-         pgmoneta_create_info(backup_base, label, 0);
+            pgmoneta_create_info(backup_base, label, 0);
 
-         goto error;
+            goto error;
+         }
       }
-   }
+      else
+      {
+         if (pgmoneta_receive_archive_stream(ssl, socket, buffer, server, backup_base, tablespaces, bucket, network_bucket,
+                                             verify_checksums ? &checksums : NULL))
+         {
+            pgmoneta_log_error("Backup: Could not backup %s", config->common.servers[server].name);
 
-   // Receive the final result set, which contains the WAL ending point
-   if (pgmoneta_consume_data_row_messages(ssl, socket, buffer, &response))
-   {
-      goto error;
-   }
-   memset(endpos, 0, sizeof(endpos));
-   memcpy(endpos, response->tuples[0].data[0], strlen(response->tuples[0].data[0]));
-   end_timeline = atoi(response->tuples[0].data[1]);
-   pgmoneta_free_query_response(response);
-   response = NULL;
+            pgmoneta_create_info(backup_base, label, 0);
 
-   // remove backup_label.old if it exists
-   memset(old_label_path, 0, MAX_PATH);
-   if (pgmoneta_ends_with(backup_base, "/"))
-   {
-      snprintf(old_label_path, MAX_PATH, "%sdata/%s", backup_base, "backup_label.old");
-   }
-   else
-   {
-      snprintf(old_label_path, MAX_PATH, "%s/data/%s", backup_base, "backup_label.old");
-   }
+            goto error;
+         }
+      }
 
-   if (pgmoneta_exists(old_label_path))
-   {
-      if (pgmoneta_exists(old_label_path))
+      if (checksums.failed > 0)
+      {
+         pgmoneta_log_warn("Backup: %" PRIu64 " pages in %" PRIu64 " files of %s failed checksum verification",
+                           checksums.failed, checksums.files, config->common.servers[server].name);
+      }
+
+      pgmoneta_prometheus_socket(server, SOCKET_BACKUP, socket);
+
+      // Receive the final result set, which contains the WAL ending point
+      if (pgmoneta_consume_data_row_messages(ssl, socket, buffer, &response))
+      {
+         goto error;
+      }
+      memset(endpos, 0, sizeof(endpos));
+      memcpy(endpos, response->tuples[0].data[0], strlen(response->tuples[0].data[0]));
+      end_timeline = atoi(response->tuples[0].data[1]);
+      pgmoneta_free_query_response(response);
+      response = NULL;
+
+      // remove backup_label.old if it exists
+      memset(old_label_path, 0, MAX_PATH);
+      if (pgmoneta_ends_with(backup_base, "/"))
       {
-         pgmoneta_delete_file(old_label_path, NULL);
+         snprintf(old_label_path, MAX_PATH, "%sdata/%s", backup_base, "backup_label.old");
       }
       else
       {
-         pgmoneta_log_debug("%s doesn't exists", old_label_path);
+         snprintf(old_label_path, MAX_PATH, "%s/data/%s", backup_base, "backup_label.old");
       }
-   }
 
-   // receive and ignore the last result set, it's just a summary
-   pgmoneta_consume_data_row_messages(ssl, socket, buffer, &response);
+      if (pgmoneta_exists(old_label_path))
+      {
+         if (pgmoneta_exists(old_label_path))
+         {
+            pgmoneta_delete_file(old_label_path, NULL);
+         }
+         else
+         {
+            pgmoneta_log_debug("%s doesn't exists", old_label_path);
+         }
+      }
+
+      // receive and ignore the last result set, it's just a summary
+      pgmoneta_consume_data_row_messages(ssl, socket, buffer, &response);
+   }
 
 #ifdef HAVE_FREEBSD
    clock_gettime(CLOCK_MONOTONIC_FAST, &end_t);
@@ -412,6 +561,25 @@ basebackup_execute(char* name __attribute__((unused)), struct art* nodes)
 
    backup_data = pgmoneta_get_server_backup_identifier_data(server, label);
 
+   if (incremental != NULL && !server_incremental)
+   {
+      if (pgmoneta_incremental_page_lsn(server, label, incremental_label))
+      {
+         pgmoneta_log_error("Backup: Could not make the backup of %s incremental", config->common.servers[server].name);
+         goto error;
+      }
+   }
+
+   /* The manifest is built from the encoded files */
+   if (incremental != NULL && config->incremental_delta)
+   {
+      if (pgmoneta_delta_backup(server, label, incremental_label))
+      {
+         pgmoneta_log_error("Backup: Could not delta encode the backup of %s", config->common.servers[server].name);
+         goto error;
+      }
+   }
+
    if (!incremental)
    {
       size = pgmoneta_directory_size(backup_data);
@@ -438,33 +606,50 @@ basebackup_execute(char* name __attribute__((unused)), struct art* nodes)
       goto error;
    }
 
-   pgmoneta_create_info(backup_base, label, 1);
-   pgmoneta_update_info_string(backup_base, INFO_WAL, wal);
-   pgmoneta_update_info_unsigned_long(backup_base, INFO_RESTORE, size);
-   pgmoneta_update_info_unsigned_long(backup_base, INFO_BIGGEST_FILE, biggest_file_size);
-   pgmoneta_update_info_string(backup_base, INFO_MAJOR_VERSION, version);
-   pgmoneta_update_info_string(backup_base, INFO_MINOR_VERSION, minor_version);
-   pgmoneta_update_info_bool(backup_base, INFO_KEEP, false);
-   pgmoneta_update_info_string(backup_base, INFO_START_WALPOS, startpos);
-   pgmoneta_update_info_string(backup_base, INFO_END_WALPOS, endpos);
-   pgmoneta_update_info_unsigned_long(backup_base, INFO_START_TIMELINE, start_timeline);
-   pgmoneta_update_info_unsigned_long(backup_base, INFO_END_TIMELINE, end_timeline);
-   pgmoneta_update_info_unsigned_long(backup_base, INFO_HASH_ALGORITHM, hash);
-   pgmoneta_update_info_double(backup_base, INFO_BASEBACKUP_ELAPSED, basebackup_elapsed_time);
+   /* The backup information is written once, with all its keys */
+   pgmoneta_info_create(backup_base, label, 1, &info);
+   pgmoneta_info_set_string(info, INFO_WAL, wal);
+   pgmoneta_info_set_unsigned_long(info, INFO_RESTORE, size);
+   pgmoneta_info_set_unsigned_long(info, INFO_BIGGEST_FILE, biggest_file_size);
+   pgmoneta_info_set_string(info, INFO_MAJOR_VERSION, version);
+   pgmoneta_info_set_string(info, INFO_MINOR_VERSION, minor_version);
+   pgmoneta_info_set_bool(info, INFO_KEEP, false);
+   pgmoneta_info_set_string(info, INFO_START_WALPOS, startpos);
+   pgmoneta_info_set_string(info, INFO_END_WALPOS, endpos);
+   pgmoneta_info_set_unsigned_long(info, INFO_START_TIMELINE, start_timeline);
+   pgmoneta_info_set_unsigned_long(info, INFO_END_TIMELINE, end_timeline);
+   pgmoneta_info_set_unsigned_long(info, INFO_HASH_ALGORITHM, hash);
+   pgmoneta_info_set_double(info, INFO_BASEBACKUP_ELAPSED, basebackup_elapsed_time);
+
+   if (verify_checksums)
+   {
+      pgmoneta_info_set_unsigned_long(info, INFO_CHECKSUM_PAGES, checksums.pages);
+      pgmoneta_info_set_unsigned_long(info, INFO_CHECKSUM_FAILED, checksums.failed);
+   }
 
    if (incremental != NULL)
    {
-      pgmoneta_update_info_unsigned_long(backup_base, INFO_TYPE, TYPE_INCREMENTAL);
-      pgmoneta_update_info_string(backup_base, INFO_PARENT, incremental_label);
+      pgmoneta_info_set_unsigned_long(info, INFO_TYPE, TYPE_INCREMENTAL);
+      pgmoneta_info_set_string(info, INFO_PARENT, incremental_label);
    }
    else
    {
-      pgmoneta_update_info_unsigned_long(backup_base, INFO_TYPE, TYPE_FULL);
+      pgmoneta_info_set_unsigned_long(info, INFO_TYPE, TYPE_FULL);
    }
    // in case of parsing error
    if (chkptpos != NULL)
    {
-      pgmoneta_update_info_string(backup_base, INFO_CHKPT_WALPOS, chkptpos);
+      pgmoneta_info_set_string(info, INFO_CHKPT_WALPOS, chkptpos);
+   }
+
+   if (config->encryption != ENCRYPTION_NONE)
+   {
+      if (data_key == NULL && pgmoneta_encrypt_data_key(&data_key))
+      {
+         pgmoneta_log_error("Backup: Could not create a data key for %s", config->common.servers[server].name);
+         goto error;
+      }
+      pgmoneta_info_set_string(info, INFO_DATA_KEY, data_key);
    }
 
    current_tablespace = tablespaces;
@@ -476,19 +661,35 @@ basebackup_execute(char* name __attribute__((unused)), struct art* nodes)
       snprintf(&tblname[0], MAX_PATH, "tblspc_%s", current_tablespace->name);
 
       number_of_tablespaces++;
-      pgmoneta_update_info_unsigned_long(backup_base, INFO_TABLESPACES, number_of_tablespaces);
+      pgmoneta_info_set_unsigned_long(info, INFO_TABLESPACES, number_of_tablespaces);
 
       snprintf(key, sizeof(key) - 1, "TABLESPACE%d", number_of_tablespaces);
-      pgmoneta_update_info_string(backup_base, key, tblname);
+      pgmoneta_info_set_string(info, key, tblname);
 
       snprintf(key, sizeof(key) - 1, "TABLESPACE_OID%d", number_of_tablespaces);
-      pgmoneta_update_info_unsigned_long(backup_base, key, current_tablespace->oid);
+      pgmoneta_info_set_unsigned_long(info, key, current_tablespace->oid);
 
       snprintf(key, sizeof(key) - 1, "TABLESPACE_PATH%d", number_of_tablespaces);
-      pgmoneta_update_info_string(backup_base, key, current_tablespace->path);
+      pgmoneta_info_set_string(info, key, current_tablespace->path);
 
       current_tablespace = current_tablespace->next;
    }
+
+   /* The data is durable before the backup is marked as valid */
+   if (pgmoneta_sync_directory(backup_base))
+   {
+      goto error;
+   }
+
+   /* The batch is released by the commit, whatever its outcome */
+   if (pgmoneta_info_commit(info))
+   {
+      info = NULL;
+      pgmoneta_log_error("Backup: Could not write the backup information for %s", config->common.servers[server].name);
+      goto error;
+   }
+   info = NULL;
+
    pgmoneta_close_ssl(ssl);
    if (socket != -1)
    {
@@ -502,6 +703,10 @@ basebackup_execute(char* name __attribute__((unused)), struct art* nodes)
    pgmoneta_free_query_response(response);
    pgmoneta_token_bucket_destroy(bucket);
    pgmoneta_token_bucket_destroy(network_bucket);
+   if (shared)
+   {
+      pgmoneta_bandwidth_stop();
+   }
    free(backup_base);
    free(backup_data);
    free(manifest_path);
@@ -509,11 +714,19 @@ basebackup_execute(char* name __attribute__((unused)), struct art* nodes)
    free(chkptpos);
    free(tag);
    free(wal);
+   free(data_key);
+
+   if (strlen(config->receiver_cpus) > 0)
+   {
+      pgmoneta_unpin_thread();
+   }
 
    return 0;
 
 error:
 
+   pgmoneta_info_rollback(info);
+
    if (backup_base == NULL)
    {
       backup_base = pgmoneta_get_server_backup_identifier(server, label);
@@ -538,6 +751,10 @@ error:
    pgmoneta_free_query_response(response);
    pgmoneta_token_bucket_destroy(bucket);
    pgmoneta_token_bucket_destroy(network_bucket);
+   if (shared)
+   {
+      pgmoneta_bandwidth_stop();
+   }
    free(backup_base);
    free(backup_data);
    free(manifest_path);
@@ -545,6 +762,12 @@ error:
    free(chkptpos);
    free(tag);
    free(wal);
+   free(data_key);
+
+   if (strlen(config->receiver_cpus) > 0)
+   {
+      pgmoneta_unpin_thread();
+   }
 
    return 1;
 }
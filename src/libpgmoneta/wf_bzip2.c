@@ -29,6 +29,7 @@
 /* pgmoneta */
 #include <pgmoneta.h>
 #include <bzip2_compression.h>
+#include <compression.h>
 #include <logging.h>
 #include <utils.h>
 #include <workflow.h>
@@ -40,6 +41,7 @@
 
 static char* bzip2_name(void);
 static int bzip2_execute_compress(char*, struct art*);
+static int bzip2_execute_file(char*, struct art*, char*, char**);
 static int bzip2_execute_uncompress(char*, struct art*);
 
 struct workflow*
@@ -67,6 +69,8 @@ pgmoneta_create_bzip2(bool compress)
    }
 
    wf->teardown = &pgmoneta_common_teardown;
+   wf->execute_file = compress ? &bzip2_execute_file : NULL;
+   wf->independent = false;
    wf->next = NULL;
 
    return wf;
@@ -132,7 +136,7 @@ bzip2_execute_compress(char* name __attribute__((unused)), struct art* nodes)
       number_of_workers = pgmoneta_get_number_of_workers(server);
       if (number_of_workers > 0)
       {
-         pgmoneta_workers_initialize(number_of_workers, &workers);
+         pgmoneta_workers_initialize_group((struct workers*)pgmoneta_art_search(nodes, NODE_WORKERS), number_of_workers, &workers);
       }
 
       backup_base = (char*)pgmoneta_art_search(nodes, NODE_BACKUP_BASE);
@@ -195,6 +199,33 @@ bzip2_execute_compress(char* name __attribute__((unused)), struct art* nodes)
    return ret;
 }
 
+static int
+bzip2_execute_file(char* name __attribute__((unused)), struct art* nodes __attribute__((unused)), char* path, char** result)
+{
+   char* to = NULL;
+
+   *result = NULL;
+
+   if (!pgmoneta_compression_applies(path))
+   {
+      *result = pgmoneta_append(NULL, path);
+      return 0;
+   }
+
+   to = pgmoneta_append(to, path);
+   to = pgmoneta_append(to, ".bz2");
+
+   if (pgmoneta_bzip2_file(path, to))
+   {
+      free(to);
+      return 1;
+   }
+
+   *result = to;
+
+   return 0;
+}
+
 static int
 bzip2_execute_uncompress(char* name __attribute__((unused)), struct art* nodes)
 {
@@ -252,7 +283,7 @@ bzip2_execute_uncompress(char* name __attribute__((unused)), struct art* nodes)
    number_of_workers = pgmoneta_get_number_of_workers(server);
    if (number_of_workers > 0)
    {
-      pgmoneta_workers_initialize(number_of_workers, &workers);
+      pgmoneta_workers_initialize_group((struct workers*)pgmoneta_art_search(nodes, NODE_WORKERS), number_of_workers, &workers);
    }
 
    ret = pgmoneta_bunzip2_data(base, workers);
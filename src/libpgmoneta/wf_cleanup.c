@@ -62,6 +62,8 @@ pgmoneta_create_cleanup(int type)
          pgmoneta_log_error("Invalid cleanup type");
    }
    wf->teardown = &pgmoneta_common_teardown;
+   wf->execute_file = NULL;
+   wf->independent = false;
    wf->next = NULL;
 
    return wf;
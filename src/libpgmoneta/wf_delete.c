@@ -29,6 +29,7 @@
 /* pgmoneta */
 #include <pgmoneta.h>
 #include <link.h>
+#include <lock.h>
 #include <logging.h>
 #include <restore.h>
 #include <utils.h>
@@ -43,7 +44,9 @@
 static char* delete_name(void);
 static int delete_backup_execute(char*, struct art*);
 
-static int delete_backup(int server, int index, struct backup* backup, int number_of_backups, struct backup** backups);
+static int lock_delete(struct lock* lock, int index, struct backup* child, int number_of_backups, struct backup** backups);
+static int delete_backup(struct art* nodes, int server, int index, struct backup* backup, int number_of_backups, struct backup** backups);
+static int remove_backup(int server, char* d, struct workers* workers);
 
 struct workflow*
 pgmoneta_create_delete_backup(void)
@@ -61,6 +64,8 @@ pgmoneta_create_delete_backup(void)
    wf->setup = &pgmoneta_common_setup;
    wf->execute = &delete_backup_execute;
    wf->teardown = &pgmoneta_common_teardown;
+   wf->execute_file = NULL;
+   wf->independent = false;
    wf->next = NULL;
 
    return wf;
@@ -76,7 +81,6 @@ static int
 delete_backup_execute(char* name __attribute__((unused)), struct art* nodes)
 {
    int server = -1;
-   bool active = false;
    int backup_index = -1;
    char* label = NULL;
    char* d = NULL;
@@ -84,6 +88,7 @@ delete_backup_execute(char* name __attribute__((unused)), struct art* nodes)
    struct backup** backups = NULL;
    struct backup* backup = NULL;
    struct backup* child = NULL;
+   struct lock* lock = NULL;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
@@ -106,9 +111,7 @@ delete_backup_execute(char* name __attribute__((unused)), struct art* nodes)
 
    pgmoneta_log_debug("Delete (execute): %s/%s", config->common.servers[server].name, label);
 
-   active = false;
-
-   if (!atomic_compare_exchange_strong(&config->common.servers[server].repository, &active, true))
+   if (pgmoneta_lock_repository(server, LOCK_SHARED, &lock))
    {
       pgmoneta_log_info("Delete: Server %s is active", config->common.servers[server].name);
 
@@ -149,6 +152,14 @@ delete_backup_execute(char* name __attribute__((unused)), struct art* nodes)
    }
 
    pgmoneta_get_backup_child(server, backups[backup_index], &child);
+
+   if (lock_delete(lock, backup_index, child, number_of_backups, backups))
+   {
+      pgmoneta_log_info("Delete: %s/%s is active", config->common.servers[server].name, label);
+
+      goto done;
+   }
+
    if (child != NULL)
    {
       if (pgmoneta_rollup_backups(server, child->label, label))
@@ -158,7 +169,7 @@ delete_backup_execute(char* name __attribute__((unused)), struct art* nodes)
       }
    }
 
-   if (delete_backup(server, backup_index, backups[backup_index], number_of_backups, backups))
+   if (delete_backup(nodes, server, backup_index, backups[backup_index], number_of_backups, backups))
    {
       pgmoneta_log_error("Delete: Full backup error for %s/%s", config->common.servers[server].name, label);
       goto error;
@@ -166,7 +177,7 @@ delete_backup_execute(char* name __attribute__((unused)), struct art* nodes)
 
 done:
 
-   pgmoneta_log_debug("Delete: %s/%s", config->common.servers[server].name, backups[backup_index]->label);
+   pgmoneta_log_debug("Delete: %s/%s", config->common.servers[server].name, label);
 
    for (int i = 0; i < number_of_backups; i++)
    {
@@ -218,7 +229,7 @@ done:
    free(child);
 
    config->common.servers[server].active_delete = false;
-   atomic_store(&config->common.servers[server].repository, false);
+   pgmoneta_unlock(lock);
    pgmoneta_log_trace("Delete is ready for %s", config->common.servers[server].name);
 
    return 0;
@@ -236,14 +247,51 @@ error:
    free(child);
 
    config->common.servers[server].active_delete = false;
-   atomic_store(&config->common.servers[server].repository, false);
+   pgmoneta_unlock(lock);
    pgmoneta_log_trace("Delete is ready for %s", config->common.servers[server].name);
 
    return 1;
 }
 
+/**
+ * Lock the backups written by a delete. The backup is removed, its child is
+ * rolled up and the next valid backup takes over its files
+ * @param lock The repository lock
+ * @param index The index of the backup
+ * @param child The child of the backup, or NULL
+ * @param number_of_backups The number of backups
+ * @param backups The backups
+ * @return 0 upon success, otherwise 1 when a backup is in use
+ */
+static int
+lock_delete(struct lock* lock, int index, struct backup* child, int number_of_backups, struct backup** backups)
+{
+   if (pgmoneta_lock_backup(lock, backups[index]->label, LOCK_EXCLUSIVE))
+   {
+      return 1;
+   }
+
+   if (child != NULL && pgmoneta_lock_backup(lock, child->label, LOCK_EXCLUSIVE))
+   {
+      return 1;
+   }
+
+   if (backups[index]->valid == VALID_TRUE)
+   {
+      for (int i = index + 1; i < number_of_backups; i++)
+      {
+         if (backups[i]->valid == VALID_TRUE)
+         {
+            return pgmoneta_lock_backup(lock, backups[i]->label, LOCK_EXCLUSIVE);
+         }
+      }
+   }
+
+   return 0;
+}
+
 static int
-delete_backup(int server, int index, struct backup* backup __attribute__((unused)), int number_of_backups, struct backup** backups)
+delete_backup(struct art* nodes, int server, int index, struct backup* backup __attribute__((unused)), int number_of_backups, struct backup** backups)
 {
    int prev_index = -1;
    int next_index = -1;
@@ -292,7 +340,7 @@ delete_backup(int server, int index, struct backup* backup __attribute__((unused
    number_of_workers = pgmoneta_get_number_of_workers(server);
    if (number_of_workers > 0)
    {
-      pgmoneta_workers_initialize(number_of_workers, &workers);
+      pgmoneta_workers_initialize_group(pgmoneta_workflow_io_workers(nodes), number_of_workers, &workers);
    }
 
    if (backups[index]->valid == VALID_TRUE)
@@ -312,11 +360,10 @@ delete_backup(int server, int index, struct backup* backup __attribute__((unused
             {
                goto error;
             }
-            pgmoneta_workers_destroy(workers);
          }
 
          /* Delete from */
-         pgmoneta_delete_directory(d);
+         remove_backup(server, d, workers);
          free(d);
          d = NULL;
 
@@ -334,7 +381,7 @@ delete_backup(int server, int index, struct backup* backup __attribute__((unused
       else if (prev_index != -1)
       {
          /* Latest valid backup */
-         pgmoneta_delete_directory(d);
+         remove_backup(server, d, workers);
       }
       else if (next_index != -1)
       {
@@ -351,11 +398,10 @@ delete_backup(int server, int index, struct backup* backup __attribute__((unused
             {
                goto error;
             }
-            pgmoneta_workers_destroy(workers);
          }
 
          /* Delete from */
-         pgmoneta_delete_directory(d);
+         remove_backup(server, d, workers);
          free(d);
          d = NULL;
 
@@ -373,15 +419,23 @@ delete_backup(int server, int index, struct backup* backup __attribute__((unused
       else
       {
          /* Only valid backup */
-         pgmoneta_delete_directory(d);
+         remove_backup(server, d, workers);
       }
    }
    else
    {
       /* Just delete */
-      pgmoneta_delete_directory(d);
+      remove_backup(server, d, workers);
    }
 
+   if (number_of_workers > 0)
+   {
+      pgmoneta_workers_destroy(workers);
+   }
+
+   pgmoneta_invalidate_backups();
+   pgmoneta_storage_changed(server);
+
    free(d);
    free(from);
    free(to);
@@ -399,3 +453,41 @@ error:
    free(to);
    return 1;
 }
+
+/**
+ * Remove the directory of a backup, either through the trash or by the workers
+ * @param server The server
+ * @param d The directory of the backup
+ * @param workers The optional workers
+ * @return 0 upon success, otherwise 1
+ */
+static int
+remove_backup(int server, char* d, struct workers* workers)
+{
+   char* trash = NULL;
+   int ret;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (config->delete_trash)
+   {
+      trash = pgmoneta_get_server(server);
+      trash = pgmoneta_append(trash, "trash/");
+
+      ret = pgmoneta_trash_directory(d, trash);
+
+      free(trash);
+   }
+   else
+   {
+      ret = pgmoneta_delete_directory_parallel(d, workers);
+   }
+
+   if (ret)
+   {
+      pgmoneta_log_warn("Delete: Could not remove %s", d);
+   }
+
+   return ret;
+}
@@ -29,6 +29,7 @@
 /* pgmoneta */
 #include <pgmoneta.h>
 #include <aes.h>
+#include <info.h>
 #include <logging.h>
 #include <utils.h>
 #include <workflow.h>
@@ -40,6 +41,9 @@
 static char* encryption_name(void);
 static int encryption_execute(char*, struct art*);
 static int decryption_execute(char*, struct art*);
+static int encryption_setup(char*, struct art*);
+static int encryption_teardown(char*, struct art*);
+static int encryption_execute_file(char*, struct art*, char*, char**);
 
 struct workflow*
 pgmoneta_encryption(bool encrypt)
@@ -55,17 +59,23 @@ pgmoneta_encryption(bool encrypt)
 
    wf->name = &encryption_name;
    wf->setup = &pgmoneta_common_setup;
+   wf->teardown = &pgmoneta_common_teardown;
+   wf->execute_file = NULL;
 
    if (encrypt)
    {
+      /* The key stays derived while the workflow runs, also when the files are pipelined */
+      wf->setup = &encryption_setup;
       wf->execute = &encryption_execute;
+      wf->teardown = &encryption_teardown;
+      wf->execute_file = &encryption_execute_file;
    }
    else
    {
       wf->execute = &decryption_execute;
    }
 
-   wf->teardown = &pgmoneta_common_teardown;
+   wf->independent = false;
    wf->next = NULL;
 
    return wf;
@@ -77,6 +87,54 @@ encryption_name(void)
    return "Encryption";
 }
 
+static int
+encryption_setup(char* name, struct art* nodes)
+{
+   if (pgmoneta_common_setup(name, nodes))
+   {
+      return 1;
+   }
+
+   pgmoneta_encrypt_key_cache_acquire();
+
+   return 0;
+}
+
+static int
+encryption_teardown(char* name, struct art* nodes)
+{
+   pgmoneta_encrypt_key_cache_release();
+
+   return pgmoneta_common_teardown(name, nodes);
+}
+
+static int
+encryption_execute_file(char* name __attribute__((unused)), struct art* nodes __attribute__((unused)), char* path, char** result)
+{
+   char* to = NULL;
+
+   *result = NULL;
+
+   if (!pgmoneta_encryption_applies(path))
+   {
+      *result = pgmoneta_append(NULL, path);
+      return 0;
+   }
+
+   to = pgmoneta_append(to, path);
+   to = pgmoneta_append(to, ".aes");
+
+   if (pgmoneta_encrypt_file(path, to))
+   {
+      free(to);
+      return 1;
+   }
+
+   *result = to;
+
+   return 0;
+}
+
 static int
 encryption_execute(char* name __attribute__((unused)), struct art* nodes)
 {
@@ -125,6 +183,8 @@ encryption_execute(char* name __attribute__((unused)), struct art* nodes)
 
    pgmoneta_log_debug("Encryption (execute): %s/%s", config->common.servers[server].name, label);
 
+   pgmoneta_encrypt_key_cache_acquire();
+
    tarfile = (char*)pgmoneta_art_search(nodes, NODE_TARGET_FILE);
 
    if (tarfile == NULL)
@@ -132,7 +192,7 @@ encryption_execute(char* name __attribute__((unused)), struct art* nodes)
       number_of_workers = pgmoneta_get_number_of_workers(server);
       if (number_of_workers > 0)
       {
-         pgmoneta_workers_initialize(number_of_workers, &workers);
+         pgmoneta_workers_initialize_group((struct workers*)pgmoneta_art_search(nodes, NODE_WORKERS), number_of_workers, &workers);
       }
 
       backup_base = (char*)pgmoneta_art_search(nodes, NODE_BACKUP_BASE);
@@ -223,6 +283,8 @@ encryption_execute(char* name __attribute__((unused)), struct art* nodes)
 
    pgmoneta_update_info_double(backup_base, INFO_ENCRYPTION_ELAPSED, encryption_elapsed_time);
 
+   pgmoneta_encrypt_key_cache_release();
+
    free(d);
    free(enc_file);
 
@@ -235,6 +297,8 @@ error:
       pgmoneta_workers_destroy(workers);
    }
 
+   pgmoneta_encrypt_key_cache_release();
+
    free(d);
    free(enc_file);
 
@@ -255,6 +319,7 @@ decryption_execute(char* name __attribute__((unused)), struct art* nodes)
    char elapsed[128];
    int number_of_workers = 0;
    struct workers* workers = NULL;
+   struct backup* backup = NULL;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
@@ -277,7 +342,19 @@ decryption_execute(char* name __attribute__((unused)), struct art* nodes)
 
    pgmoneta_log_debug("Decryption (execute): %s/%s", config->common.servers[server].name, label);
 
+   pgmoneta_encrypt_key_cache_acquire();
+
    base = (char*)pgmoneta_art_search(nodes, NODE_TARGET_BASE);
+   backup = (struct backup*)pgmoneta_art_search(nodes, NODE_BACKUP);
+
+   /* The files copied to the target use the data key of their backup */
+   if (base != NULL && backup != NULL && pgmoneta_encrypt_key_cache_directory(base, backup->data_key))
+   {
+      pgmoneta_log_error("Decryption: No data key for %s/%s", config->common.servers[server].name, label);
+      pgmoneta_encrypt_key_cache_release();
+      return 1;
+   }
+
    if (base == NULL)
    {
       base = (char*)pgmoneta_art_search(nodes, NODE_BACKUP_BASE);
@@ -292,7 +369,7 @@ decryption_execute(char* name __attribute__((unused)), struct art* nodes)
    number_of_workers = pgmoneta_get_number_of_workers(server);
    if (number_of_workers > 0)
    {
-      pgmoneta_workers_initialize(number_of_workers, &workers);
+      pgmoneta_workers_initialize_group((struct workers*)pgmoneta_art_search(nodes, NODE_WORKERS), number_of_workers, &workers);
    }
 
    pgmoneta_decrypt_directory(base, workers);
@@ -303,6 +380,8 @@ decryption_execute(char* name __attribute__((unused)), struct art* nodes)
       pgmoneta_workers_destroy(workers);
    }
 
+   pgmoneta_encrypt_key_cache_release();
+
    total_seconds = (int)difftime(time(NULL), decrypt_time);
    hours = total_seconds / 3600;
    minutes = (total_seconds % 3600) / 60;
@@ -27,14 +27,18 @@
  */
 
 #include <pgmoneta.h>
+#include <csv.h>
 #include <extension.h>
+#include <json.h>
 #include <logging.h>
 #include <network.h>
 #include <security.h>
+#include <server.h>
 #include <utils.h>
 #include <workflow.h>
 
 #include <assert.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -42,6 +46,10 @@
 static char* extra_name(void);
 static int extra_execute(char*, struct art*);
 
+static char* index_path(int server);
+static int index_read(int server, struct art** index);
+static int index_write(int server, struct art* index);
+
 struct workflow*
 pgmoneta_create_extra(void)
 {
@@ -58,6 +66,8 @@ pgmoneta_create_extra(void)
    wf->setup = &pgmoneta_common_setup;
    wf->execute = &extra_execute;
    wf->teardown = &pgmoneta_common_teardown;
+   wf->execute_file = NULL;
+   wf->independent = false;
    wf->next = NULL;
 
    return wf;
@@ -89,6 +99,8 @@ extra_execute(char* name __attribute__((unused)), struct art* nodes)
    SSL* ssl = NULL;
    struct main_configuration* config;
    struct query_response* qr = NULL;
+   struct art* previous = NULL;
+   struct art* current = NULL;
 
    config = (struct main_configuration*)shmem;
 
@@ -143,8 +155,8 @@ extra_execute(char* name __attribute__((unused)), struct art* nodes)
       goto error;
    }
 
-   // establish a connection, with replication flag set
-   if (pgmoneta_server_authenticate(server, "postgres", config->common.users[usr].username, config->common.users[usr].password, false, &ssl, &socket) != AUTH_SUCCESS)
+   // establish a connection, reusing the one of the backup when possible
+   if (pgmoneta_server_connect(server, &ssl, &socket) != AUTH_SUCCESS)
    {
       pgmoneta_log_error("Authentication failed for user %s on %s", config->common.users[usr].username, config->common.servers[server].name);
       goto error;
@@ -159,14 +171,26 @@ extra_execute(char* name __attribute__((unused)), struct art* nodes)
    pgmoneta_free_query_response(qr);
    qr = NULL;
 
+   // the files of the previous backup are shared when their size and modification time are unchanged
+   index_read(server, &previous);
+   pgmoneta_art_create(&current);
+
    for (int i = 0; i < config->common.servers[server].number_of_extra; i++)
    {
-      if (pgmoneta_receive_extra_files(ssl, socket, config->common.servers[server].name, config->common.servers[server].extra[i], root, &info_extra) != 0)
+      char* extra = config->common.servers[server].extra + config->common.servers[server].extra_offset[i];
+
+      if (pgmoneta_receive_extra_files(ssl, socket, config->common.servers[server].name, extra, root,
+                                       previous, current, &info_extra) != 0)
       {
-         pgmoneta_log_warn("extra failed: Server %s failed to retrieve extra files %s", config->common.servers[server].name, config->common.servers[server].extra[i]);
+         pgmoneta_log_warn("extra failed: Server %s failed to retrieve extra files %s", config->common.servers[server].name, extra);
       }
    }
 
+   if (current != NULL && index_write(server, current))
+   {
+      pgmoneta_log_warn("extra: Could not write the index of server %s, the next backup retrieves all extra files", config->common.servers[server].name);
+   }
+
 #ifdef HAVE_FREEBSD
    clock_gettime(CLOCK_MONOTONIC_FAST, &end_t);
 #else
@@ -200,6 +224,8 @@ extra_execute(char* name __attribute__((unused)), struct art* nodes)
    {
       free(info_extra);
    }
+   pgmoneta_art_destroy(previous);
+   pgmoneta_art_destroy(current);
    pgmoneta_close_ssl(ssl);
    pgmoneta_disconnect(socket);
    pgmoneta_memory_destroy();
@@ -219,6 +245,8 @@ error:
    {
       free(info_extra);
    }
+   pgmoneta_art_destroy(previous);
+   pgmoneta_art_destroy(current);
    if (ssl != NULL)
    {
       pgmoneta_close_ssl(ssl);
@@ -231,3 +259,153 @@ error:
 
    return 1;
 }
+
+static char*
+index_path(int server)
+{
+   char* path = NULL;
+
+   path = pgmoneta_get_server(server);
+   if (path == NULL)
+   {
+      return NULL;
+   }
+
+   path = pgmoneta_append(path, "extra.index");
+
+   return path;
+}
+
+/**
+ * Read the index of the extra files held by the backups of a server
+ * @param server The server
+ * @param index The extra files by path, or NULL if there is no index
+ * @return 0 upon success, otherwise 1
+ */
+static int
+index_read(int server, struct art** index)
+{
+   char* path = NULL;
+   struct csv_reader* reader = NULL;
+   struct art* tree = NULL;
+   struct json* e = NULL;
+   char** row = NULL;
+   int cols = 0;
+
+   *index = NULL;
+
+   path = index_path(server);
+   if (path == NULL || !pgmoneta_exists(path))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_csv_reader_init(path, &reader) || pgmoneta_art_create(&tree))
+   {
+      goto error;
+   }
+
+   while (pgmoneta_csv_next_row(reader, &cols, &row))
+   {
+      if (cols != 4 || pgmoneta_json_create(&e))
+      {
+         continue;
+      }
+
+      pgmoneta_json_put(e, "size", (uintptr_t)strtoll(row[1], NULL, 10), ValueInt64);
+      pgmoneta_json_put(e, "modification", (uintptr_t)row[2], ValueString);
+      pgmoneta_json_put(e, "file", (uintptr_t)row[3], ValueString);
+      pgmoneta_art_insert(tree, row[0], (uintptr_t)e, ValueJSON);
+      e = NULL;
+   }
+
+   pgmoneta_csv_reader_destroy(reader);
+   free(path);
+
+   *index = tree;
+
+   return 0;
+
+error:
+
+   pgmoneta_csv_reader_destroy(reader);
+   pgmoneta_art_destroy(tree);
+   free(path);
+
+   return 1;
+}
+
+static int
+index_write(int server, struct art* index)
+{
+   char* path = NULL;
+   char* tmp = NULL;
+   char size[MISC_LENGTH];
+   char* row[4];
+   struct csv_writer* writer = NULL;
+   struct art_iterator* iter = NULL;
+   struct json* e = NULL;
+
+   path = index_path(server);
+   if (path == NULL)
+   {
+      goto error;
+   }
+
+   tmp = pgmoneta_append(tmp, path);
+   tmp = pgmoneta_append(tmp, ".tmp");
+
+   if (pgmoneta_csv_writer_init(tmp, &writer) || pgmoneta_art_iterator_create(index, &iter))
+   {
+      goto error;
+   }
+
+   while (pgmoneta_art_iterator_next(iter))
+   {
+      e = (struct json*)pgmoneta_value_data(iter->value);
+
+      memset(&size[0], 0, sizeof(size));
+      snprintf(&size[0], sizeof(size), "%" PRId64, (int64_t)pgmoneta_json_get(e, "size"));
+
+      row[0] = iter->key;
+      row[1] = &size[0];
+      row[2] = (char*)pgmoneta_json_get(e, "modification");
+      row[3] = (char*)pgmoneta_json_get(e, "file");
+
+      if (pgmoneta_csv_write(writer, 4, row))
+      {
+         goto error;
+      }
+   }
+
+   pgmoneta_art_iterator_destroy(iter);
+   iter = NULL;
+
+   pgmoneta_csv_writer_destroy(writer);
+   writer = NULL;
+
+   if (rename(tmp, path))
+   {
+      goto error;
+   }
+
+   free(tmp);
+   free(path);
+
+   return 0;
+
+error:
+
+   pgmoneta_art_iterator_destroy(iter);
+   pgmoneta_csv_writer_destroy(writer);
+
+   if (tmp != NULL)
+   {
+      remove(tmp);
+   }
+
+   free(tmp);
+   free(path);
+
+   return 1;
+}
@@ -28,6 +28,7 @@
 
 /* pgmoneta */
 #include <pgmoneta.h>
+#include <compression.h>
 #include <gzip_compression.h>
 #include <logging.h>
 #include <utils.h>
@@ -40,6 +41,7 @@
 
 static char* gzip_name(void);
 static int gzip_execute_compress(char*, struct art*);
+static int gzip_execute_file(char*, struct art*, char*, char**);
 static int gzip_execute_uncompress(char*, struct art*);
 
 struct workflow*
@@ -67,6 +69,8 @@ pgmoneta_create_gzip(bool compress)
    }
 
    wf->teardown = &pgmoneta_common_teardown;
+   wf->execute_file = compress ? &gzip_execute_file : NULL;
+   wf->independent = false;
    wf->next = NULL;
 
    return wf;
@@ -131,7 +135,7 @@ gzip_execute_compress(char* name __attribute__((unused)), struct art* nodes)
       number_of_workers = pgmoneta_get_number_of_workers(server);
       if (number_of_workers > 0)
       {
-         pgmoneta_workers_initialize(number_of_workers, &workers);
+         pgmoneta_workers_initialize_group((struct workers*)pgmoneta_art_search(nodes, NODE_WORKERS), number_of_workers, &workers);
       }
 
       backup_base = (char*)pgmoneta_art_search(nodes, NODE_BACKUP_BASE);
@@ -206,6 +210,33 @@ error:
    return 1;
 }
 
+static int
+gzip_execute_file(char* name __attribute__((unused)), struct art* nodes __attribute__((unused)), char* path, char** result)
+{
+   char* to = NULL;
+
+   *result = NULL;
+
+   if (!pgmoneta_compression_applies(path))
+   {
+      *result = pgmoneta_append(NULL, path);
+      return 0;
+   }
+
+   to = pgmoneta_append(to, path);
+   to = pgmoneta_append(to, ".gz");
+
+   if (pgmoneta_gzip_file(path, to))
+   {
+      free(to);
+      return 1;
+   }
+
+   *result = to;
+
+   return 0;
+}
+
 static int
 gzip_execute_uncompress(char* name __attribute__((unused)), struct art* nodes)
 {
@@ -257,7 +288,7 @@ gzip_execute_uncompress(char* name __attribute__((unused)), struct art* nodes)
    number_of_workers = pgmoneta_get_number_of_workers(server);
    if (number_of_workers > 0)
    {
-      pgmoneta_workers_initialize(number_of_workers, &workers);
+      pgmoneta_workers_initialize_group((struct workers*)pgmoneta_art_search(nodes, NODE_WORKERS), number_of_workers, &workers);
    }
 
    pgmoneta_gunzip_data(base, workers);
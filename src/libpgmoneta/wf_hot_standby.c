@@ -28,20 +28,31 @@
 
 /* pgmoneta */
 #include <pgmoneta.h>
+#include <csv.h>
 #include <logging.h>
 #include <manifest.h>
 #include <restore.h>
 #include <utils.h>
+#include <wal.h>
 #include <workflow.h>
 
 /* system */
 #include <assert.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 static char* hot_standby_name(void);
 static int hot_standby_execute(char*, struct art*);
 
+static char* standby_file(char* key);
+static bool standby_copied(struct manifest_diff* diff, char* name);
+static void standby_copy(char* source, char* destination, char* name, bool move, struct workers* workers);
+static char* state_path(int server);
+static char* state_read(int server);
+static void state_write(int server, char* label);
+static int standby_replay(int server, char* destination, struct backup* backup);
+
 struct workflow*
 pgmoneta_create_hot_standby(void)
 {
@@ -58,6 +69,8 @@ pgmoneta_create_hot_standby(void)
    wf->setup = &pgmoneta_common_setup;
    wf->execute = &hot_standby_execute;
    wf->teardown = &pgmoneta_common_teardown;
+   wf->execute_file = NULL;
+   wf->independent = false;
    wf->next = NULL;
 
    return wf;
@@ -81,7 +94,12 @@ hot_standby_execute(char* name __attribute__((unused)), struct art* nodes)
    char* destination = NULL;
    char* old_manifest = NULL;
    char* new_manifest = NULL;
+   char* previous = NULL;
    bool incremental = false;
+   bool found = false;
+   bool replaying = false;
+   int number_of_copied = 0;
+   int number_of_deleted = 0;
    struct timespec start_t;
    struct timespec end_t;
    double hot_standby_elapsed_time;
@@ -91,14 +109,12 @@ hot_standby_execute(char* name __attribute__((unused)), struct art* nodes)
    char elapsed[128];
    int number_of_workers = 0;
    char* f = NULL;
-   char* from = NULL;
    char* to = NULL;
-   struct art* deleted_files = NULL;
-   struct art_iterator* deleted_iter = NULL;
-   struct art* changed_files = NULL;
-   struct art_iterator* changed_iter = NULL;
-   struct art* added_files = NULL;
-   struct art_iterator* added_iter = NULL;
+   char* workspace = NULL;
+   char** row = NULL;
+   int cols = 0;
+   struct manifest_diff* diff = NULL;
+   struct csv_reader* reader = NULL;
    int number_of_backups = 0;
    struct backup** backups = NULL;
    struct workers* workers = NULL;
@@ -147,157 +163,175 @@ hot_standby_execute(char* name __attribute__((unused)), struct art* nodes)
       destination = pgmoneta_append(destination, root);
       destination = pgmoneta_append(destination, config->common.servers[server].name);
 
-      if (!incremental && pgmoneta_exists(destination) && number_of_backups >= 2)
+      previous = state_read(server);
+
+      for (int i = 0; !found && previous != NULL && i < number_of_backups; i++)
       {
-         if (number_of_workers > 0)
-         {
-            pgmoneta_workers_initialize(number_of_workers, &workers);
-         }
+         found = !strcmp(backups[i]->label, previous);
+      }
 
-         source = pgmoneta_append(source, base);
-         if (!pgmoneta_ends_with(source, "/"))
-         {
-            source = pgmoneta_append_char(source, '/');
-         }
-         source = pgmoneta_append(source, backups[number_of_backups - 1]->label);
-         if (!pgmoneta_ends_with(source, "/"))
+      /* A running standby replays the WAL itself, so its files are left alone */
+      replaying = config->common.servers[server].hot_standby_replay && found && pgmoneta_exists(destination);
+
+      if (replaying)
+      {
+         pgmoneta_log_debug("Hot standby: %s replays WAL from %s", config->common.servers[server].name, previous);
+      }
+      else if (incremental)
+      {
+         /* The backup is combined next to the hot standby, so its files are moved in place */
+         pgmoneta_mkdir(root);
+         if (pgmoneta_extract_incremental_backup(server, label, root, &source_root, &source))
          {
-            source = pgmoneta_append_char(source, '/');
+            pgmoneta_log_error("Hotstandby: Unable to extract backup %s", label);
+            goto error;
          }
+      }
+      else
+      {
+         source = pgmoneta_append(source, base);
+         source = pgmoneta_append(source, label);
+         source = pgmoneta_append_char(source, '/');
+         source = pgmoneta_append(source, "data");
+      }
 
+      if (number_of_workers > 0)
+      {
+         pgmoneta_workers_initialize_group(pgmoneta_workflow_io_workers(nodes), number_of_workers, &workers);
+      }
+
+      /* Only the difference to the backup the hot standby holds is applied */
+      if (replaying)
+      {
+         /* Nothing to apply */
+      }
+      else if (found && strcmp(previous, label) && pgmoneta_exists(destination))
+      {
          old_manifest = pgmoneta_append(old_manifest, base);
-         if (!pgmoneta_ends_with(old_manifest, "/"))
-         {
-            old_manifest = pgmoneta_append_char(old_manifest, '/');
-         }
-         old_manifest = pgmoneta_append(old_manifest, backups[number_of_backups - 2]->label);
-         if (!pgmoneta_ends_with(old_manifest, "/"))
-         {
-            old_manifest = pgmoneta_append_char(old_manifest, '/');
-         }
-         old_manifest = pgmoneta_append(old_manifest, "backup.manifest");
+         old_manifest = pgmoneta_append(old_manifest, previous);
+         old_manifest = pgmoneta_append(old_manifest, "/backup.manifest");
 
-         new_manifest = pgmoneta_append(new_manifest, source);
-         new_manifest = pgmoneta_append(new_manifest, "backup.manifest");
+         new_manifest = pgmoneta_append(new_manifest, base);
+         new_manifest = pgmoneta_append(new_manifest, label);
+         new_manifest = pgmoneta_append(new_manifest, "/backup.manifest");
 
          pgmoneta_log_trace("old_manifest: %s", old_manifest);
          pgmoneta_log_trace("new_manifest: %s", new_manifest);
 
-         pgmoneta_compare_manifests(old_manifest, new_manifest, &deleted_files, &changed_files, &added_files);
-
-         pgmoneta_art_iterator_create(deleted_files, &deleted_iter);
-         pgmoneta_art_iterator_create(changed_files, &changed_iter);
-         pgmoneta_art_iterator_create(added_files, &added_iter);
+         /* The difference is spilled to the workspace and streamed, so the memory use doesn't grow with the cluster */
+         workspace = pgmoneta_get_server_workspace(server);
 
-         while (pgmoneta_art_iterator_next(deleted_iter))
+         if (workspace == NULL || pgmoneta_manifest_diff(workspace, old_manifest, new_manifest, &diff))
          {
-            f = pgmoneta_append(f, destination);
-            if (!pgmoneta_ends_with(f, "/"))
-            {
-               f = pgmoneta_append_char(f, '/');
-            }
-            f = pgmoneta_append(f, deleted_iter->key);
-
-            if (pgmoneta_exists(f))
-            {
-               pgmoneta_delete_file(f, workers);
-            }
-            else
-            {
-               pgmoneta_log_debug("%s doesn't exists", f);
-            }
+            pgmoneta_log_error("Hot standby: Unable to compare %s and %s", previous, label);
+            goto error;
+         }
 
-            free(f);
-            f = NULL;
+         if (pgmoneta_manifest_diff_reader(diff, MANIFEST_DIFF_DELETED, &reader))
+         {
+            goto error;
          }
 
-         while (pgmoneta_art_iterator_next(changed_iter))
+         while (pgmoneta_csv_next_row(reader, &cols, &row))
          {
-            from = pgmoneta_append(from, source);
-            if (!pgmoneta_ends_with(from, "/"))
+            if (cols != MANIFEST_COLUMN_COUNT)
             {
-               from = pgmoneta_append_char(from, '/');
+               continue;
             }
-            from = pgmoneta_append(from, "data/");
-            from = pgmoneta_append(from, changed_iter->key);
 
-            to = pgmoneta_append(to, destination);
-            if (!pgmoneta_ends_with(to, "/"))
+            f = standby_file(row[MANIFEST_PATH_INDEX]);
+
+            /* A relation that turned into an incremental file, or back, is still there */
+            if (!standby_copied(diff, f))
             {
+               to = pgmoneta_append(to, destination);
                to = pgmoneta_append_char(to, '/');
-            }
-            to = pgmoneta_append(to, changed_iter->key);
-
-            pgmoneta_log_trace("hot_standby changed: %s -> %s", from, to);
+               to = pgmoneta_append(to, f);
 
-            pgmoneta_copy_file(from, to, workers);
+               if (pgmoneta_exists(to))
+               {
+                  pgmoneta_log_trace("hot_standby deleted: %s", to);
+                  pgmoneta_delete_file(to, workers);
+                  number_of_deleted++;
+               }
 
-            free(from);
-            from = NULL;
+               free(to);
+               to = NULL;
+            }
 
-            free(to);
-            to = NULL;
+            free(f);
+            f = NULL;
          }
 
-         while (pgmoneta_art_iterator_next(added_iter))
+         pgmoneta_csv_reader_destroy(reader);
+         reader = NULL;
+
+         for (int kind = MANIFEST_DIFF_CHANGED; kind <= MANIFEST_DIFF_ADDED; kind++)
          {
-            from = pgmoneta_append(from, source);
-            if (!pgmoneta_ends_with(from, "/"))
+            if (pgmoneta_manifest_diff_reader(diff, kind, &reader))
             {
-               from = pgmoneta_append_char(from, '/');
+               goto error;
             }
-            from = pgmoneta_append(from, "data/");
-            from = pgmoneta_append(from, added_iter->key);
 
-            to = pgmoneta_append(to, destination);
-            if (!pgmoneta_ends_with(to, "/"))
+            while (pgmoneta_csv_next_row(reader, &cols, &row))
             {
-               to = pgmoneta_append_char(to, '/');
+               if (cols != MANIFEST_COLUMN_COUNT)
+               {
+                  continue;
+               }
+
+               f = standby_file(row[MANIFEST_PATH_INDEX]);
+               standby_copy(source, destination, f, source_root != NULL, workers);
+               number_of_copied++;
+               free(f);
+               f = NULL;
             }
-            to = pgmoneta_append(to, added_iter->key);
-
-            pgmoneta_log_trace("hot_standby new: %s -> %s", from, to);
-
-            pgmoneta_copy_file(from, to, workers);
 
-            free(from);
-            from = NULL;
+            pgmoneta_csv_reader_destroy(reader);
+            reader = NULL;
+         }
 
-            free(to);
-            to = NULL;
+         if (diff->manifest_changed)
+         {
+            standby_copy(source, destination, "backup_manifest", source_root != NULL, workers);
+            number_of_copied++;
          }
+
+         pgmoneta_log_debug("Hot standby: %s/%s from %s (Copied: %d, Deleted: %d)", config->common.servers[server].name, label, previous, number_of_copied, number_of_deleted);
       }
       else
       {
-         if (incremental)
+         if (pgmoneta_exists(destination))
          {
-            if (pgmoneta_extract_incremental_backup(server, label, &source_root, &source))
-            {
-               pgmoneta_log_error("Hotstandby: Unable to extract backup %s", label);
-               goto error;
-            }
+            pgmoneta_delete_directory_parallel(destination, workers);
          }
-         else
+
+         pgmoneta_mkdir(root);
+
+         if (workers != NULL)
          {
-            source = pgmoneta_append(source, base);
-            source = pgmoneta_append(source, label);
-            source = pgmoneta_append_char(source, '/');
-            source = pgmoneta_append(source, "data");
+            pgmoneta_workers_wait(workers);
          }
-         if (number_of_workers > 0)
+
+         /* A combined backup without tablespaces becomes the hot standby as it is */
+         if (source_root == NULL || backups[number_of_backups - 1]->number_of_tablespaces > 0 || rename(source, destination))
          {
-            pgmoneta_workers_initialize(number_of_workers, &workers);
+            pgmoneta_mkdir(destination);
+
+            pgmoneta_copy_postgresql_hotstandby(source, destination, config->common.servers[server].hot_standby_tablespaces, backups[number_of_backups - 1], workers);
          }
 
-         if (pgmoneta_exists(destination))
+         if (config->common.servers[server].hot_standby_replay)
          {
-            pgmoneta_delete_directory(destination);
+            for (int i = 0; i < number_of_backups; i++)
+            {
+               if (!strcmp(backups[i]->label, label) && standby_replay(server, destination, backups[i]))
+               {
+                  pgmoneta_log_error("Hot standby: Unable to prepare WAL replay for %s", config->common.servers[server].name);
+                  goto error;
+               }
+            }
          }
-
-         pgmoneta_mkdir(root);
-         pgmoneta_mkdir(destination);
-
-         pgmoneta_copy_postgresql_hotstandby(source, destination, config->common.servers[server].hot_standby_tablespaces, backups[number_of_backups - 1], workers);
       }
 
       pgmoneta_log_debug("hot_standby source:      %s", source);
@@ -312,7 +346,8 @@ hot_standby_execute(char* name __attribute__((unused)), struct art* nodes)
          }
       }
 
-      if (strlen(config->common.servers[server].hot_standby_overrides) > 0 &&
+      if (!replaying &&
+          strlen(config->common.servers[server].hot_standby_overrides) > 0 &&
           pgmoneta_exists(config->common.servers[server].hot_standby_overrides) &&
           pgmoneta_is_directory(config->common.servers[server].hot_standby_overrides))
       {
@@ -333,8 +368,11 @@ hot_standby_execute(char* name __attribute__((unused)), struct art* nodes)
             goto error;
          }
          pgmoneta_workers_destroy(workers);
+         workers = NULL;
       }
 
+      state_write(server, replaying ? previous : label);
+
 #ifdef HAVE_FREEBSD
       clock_gettime(CLOCK_MONOTONIC_FAST, &end_t);
 #else
@@ -367,14 +405,11 @@ hot_standby_execute(char* name __attribute__((unused)), struct art* nodes)
    }
    free(backups);
 
-   pgmoneta_art_iterator_destroy(deleted_iter);
-   pgmoneta_art_iterator_destroy(changed_iter);
-   pgmoneta_art_iterator_destroy(added_iter);
-
-   pgmoneta_art_destroy(deleted_files);
-   pgmoneta_art_destroy(changed_files);
-   pgmoneta_art_destroy(added_files);
+   pgmoneta_csv_reader_destroy(reader);
+   pgmoneta_manifest_diff_destroy(diff);
+   free(workspace);
 
+   free(previous);
    free(root);
    free(base);
    free(source);
@@ -384,6 +419,11 @@ hot_standby_execute(char* name __attribute__((unused)), struct art* nodes)
 
 error:
 
+   if (workers != NULL)
+   {
+      pgmoneta_workers_destroy(workers);
+   }
+
    free(old_manifest);
    free(new_manifest);
 
@@ -399,14 +439,11 @@ error:
    }
    free(backups);
 
-   pgmoneta_art_iterator_destroy(deleted_iter);
-   pgmoneta_art_iterator_destroy(changed_iter);
-   pgmoneta_art_iterator_destroy(added_iter);
-
-   pgmoneta_art_destroy(deleted_files);
-   pgmoneta_art_destroy(changed_files);
-   pgmoneta_art_destroy(added_files);
+   pgmoneta_csv_reader_destroy(reader);
+   pgmoneta_manifest_diff_destroy(diff);
+   free(workspace);
 
+   free(previous);
    free(root);
    free(base);
    free(source);
@@ -414,3 +451,286 @@ error:
 
    return 1;
 }
+
+/**
+ * Get the name of a manifest entry in the data directory, as an
+ * incremental backup stores a changed relation as INCREMENTAL.<relation>
+ * @param key The name in the manifest
+ * @return The name
+ */
+static char*
+standby_file(char* key)
+{
+   char* name = NULL;
+   char* b = NULL;
+   char* f = NULL;
+
+   b = strrchr(key, '/');
+   b = b != NULL ? b + 1 : key;
+
+   if (!pgmoneta_starts_with(b, INCREMENTAL_PREFIX))
+   {
+      return pgmoneta_append(NULL, key);
+   }
+
+   f = pgmoneta_append(f, key);
+   f[b - key] = '\0';
+
+   name = pgmoneta_append(name, f);
+   name = pgmoneta_append(name, b + INCREMENTAL_PREFIX_LENGTH);
+
+   free(f);
+
+   return name;
+}
+
+/**
+ * Is a file of the data directory copied, as a changed or added file of the
+ * manifest, or as its incremental file
+ * @param diff The difference of the manifests
+ * @param name The name in the data directory
+ * @return True if the file is copied, otherwise false
+ */
+static bool
+standby_copied(struct manifest_diff* diff, char* name)
+{
+   char* incremental = NULL;
+   char* b = NULL;
+   bool copied = false;
+
+   copied = pgmoneta_manifest_diff_contains(diff, MANIFEST_DIFF_CHANGED, name) ||
+            pgmoneta_manifest_diff_contains(diff, MANIFEST_DIFF_ADDED, name);
+
+   if (!copied)
+   {
+      b = strrchr(name, '/');
+      b = b != NULL ? b + 1 : name;
+
+      incremental = pgmoneta_append(incremental, name);
+      incremental[b - name] = '\0';
+      incremental = pgmoneta_append(incremental, INCREMENTAL_PREFIX);
+      incremental = pgmoneta_append(incremental, b);
+
+      copied = pgmoneta_manifest_diff_contains(diff, MANIFEST_DIFF_CHANGED, incremental) ||
+               pgmoneta_manifest_diff_contains(diff, MANIFEST_DIFF_ADDED, incremental);
+
+      free(incremental);
+   }
+
+   return copied;
+}
+
+/**
+ * Copy a file of the backup to the hot standby
+ * @param source The data directory of the backup
+ * @param destination The hot standby
+ * @param name The name in the data directory
+ * @param move Can the file be moved, as the backup was combined for the hot standby
+ * @param workers The optional workers
+ */
+static void
+standby_copy(char* source, char* destination, char* name, bool move, struct workers* workers)
+{
+   char* from = NULL;
+   char* to = NULL;
+
+   from = pgmoneta_append(from, source);
+   from = pgmoneta_append_char(from, '/');
+   from = pgmoneta_append(from, name);
+
+   to = pgmoneta_append(to, destination);
+   to = pgmoneta_append_char(to, '/');
+   to = pgmoneta_append(to, name);
+
+   pgmoneta_log_trace("hot_standby copied: %s -> %s", from, to);
+
+   if (!move || pgmoneta_move_file(from, to))
+   {
+      pgmoneta_copy_file(from, to, workers);
+   }
+
+   free(from);
+   free(to);
+}
+
+static char*
+state_path(int server)
+{
+   char* path = NULL;
+
+   path = pgmoneta_get_server(server);
+   if (path == NULL)
+   {
+      return NULL;
+   }
+
+   path = pgmoneta_append(path, "hot_standby.label");
+
+   return path;
+}
+
+/**
+ * Read the label of the backup the hot standby holds
+ * @param server The server
+ * @return The label, or NULL if unknown
+ */
+static char*
+state_read(int server)
+{
+   char* path = NULL;
+   char* label = NULL;
+   char buffer[MISC_LENGTH];
+   FILE* file = NULL;
+
+   path = state_path(server);
+   if (path == NULL)
+   {
+      return NULL;
+   }
+
+   file = fopen(path, "r");
+   if (file != NULL)
+   {
+      memset(&buffer[0], 0, sizeof(buffer));
+
+      if (fgets(&buffer[0], sizeof(buffer), file) != NULL)
+      {
+         buffer[strcspn(&buffer[0], "\n")] = '\0';
+
+         if (strlen(&buffer[0]) > 0)
+         {
+            label = pgmoneta_append(label, &buffer[0]);
+         }
+      }
+
+      fclose(file);
+   }
+
+   free(path);
+
+   return label;
+}
+
+static void
+state_write(int server, char* label)
+{
+   char* path = NULL;
+   FILE* file = NULL;
+
+   path = state_path(server);
+   if (path == NULL)
+   {
+      return;
+   }
+
+   file = fopen(path, "w");
+   if (file != NULL)
+   {
+      fprintf(file, "%s\n", label);
+      fclose(file);
+   }
+   else
+   {
+      pgmoneta_log_warn("Hot standby: Could not write %s, the next refresh copies everything", path);
+   }
+
+   free(path);
+}
+
+/**
+ * Prepare a hot standby for WAL replay by a PostgreSQL in standby mode,
+ * seeding pg_wal with the segments since the start of the backup
+ * @param server The server
+ * @param destination The hot standby directory
+ * @param backup The backup
+ * @return 0 upon success, otherwise 1
+ */
+static int
+standby_replay(int server, char* destination, struct backup* backup)
+{
+   char* wal_dir = NULL;
+   char* path = NULL;
+   char name[MISC_LENGTH];
+   int number_of_files = 0;
+   char** files = NULL;
+   size_t length;
+   FILE* file = NULL;
+
+   path = pgmoneta_append(path, destination);
+   path = pgmoneta_append(path, "/standby.signal");
+
+   file = fopen(path, "w");
+   if (file == NULL)
+   {
+      goto error;
+   }
+   fclose(file);
+
+   free(path);
+   path = NULL;
+
+   path = pgmoneta_append(path, destination);
+   path = pgmoneta_append(path, "/pg_wal");
+
+   if (!pgmoneta_exists(path) && pgmoneta_mkdir(path))
+   {
+      goto error;
+   }
+
+   wal_dir = pgmoneta_get_server_wal(server);
+
+   if (pgmoneta_get_files(wal_dir, &number_of_files, &files))
+   {
+      goto error;
+   }
+
+   for (int i = 0; i < number_of_files; i++)
+   {
+      length = strspn(files[i], "0123456789ABCDEF");
+
+      memset(&name[0], 0, sizeof(name));
+
+      if (length == 8 && pgmoneta_starts_with(files[i] + 8, ".history"))
+      {
+         snprintf(&name[0], sizeof(name), "%.16s", files[i]);
+      }
+      else if (length >= 24 && !pgmoneta_ends_with(files[i], ".partial") &&
+               strncmp(files[i] + 8, backup->wal + 8, 16) >= 0)
+      {
+         snprintf(&name[0], sizeof(name), "%.24s", files[i]);
+      }
+      else
+      {
+         continue;
+      }
+
+      if (pgmoneta_wal_hot_standby(server, wal_dir, &name[0]))
+      {
+         goto error;
+      }
+   }
+
+   for (int i = 0; i < number_of_files; i++)
+   {
+      free(files[i]);
+   }
+   free(files);
+
+   free(wal_dir);
+   free(path);
+
+   return 0;
+
+error:
+
+   for (int i = 0; i < number_of_files; i++)
+   {
+      free(files[i]);
+   }
+   free(files);
+
+   free(wal_dir);
+   free(path);
+
+   return 1;
+}
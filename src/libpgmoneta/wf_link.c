@@ -29,6 +29,7 @@
 /* pgmoneta */
 #include <pgmoneta.h>
 #include <link.h>
+#include <lock.h>
 #include <logging.h>
 #include <manifest.h>
 #include <utils.h>
@@ -58,6 +59,8 @@ pgmoneta_create_link(void)
    wf->setup = &pgmoneta_common_setup;
    wf->execute = &link_execute;
    wf->teardown = &pgmoneta_common_teardown;
+   wf->execute_file = NULL;
+   wf->independent = false;
    wf->next = NULL;
 
    return wf;
@@ -88,6 +91,7 @@ link_execute(char* name __attribute__((unused)), struct art* nodes)
    int next_newest = -1;
    int number_of_backups = 0;
    struct backup** backups = NULL;
+   char* workspace = NULL;
    int hours;
    int minutes;
    double seconds;
@@ -96,9 +100,8 @@ link_execute(char* name __attribute__((unused)), struct art* nodes)
    int index = 0;
    struct workers* workers = NULL;
    struct main_configuration* config;
-   struct art* deleted_files = NULL;
-   struct art* changed_files = NULL;
-   struct art* added_files = NULL;
+   struct manifest_diff* diff = NULL;
+   struct lock* lock = NULL;
 
    config = (struct main_configuration*)shmem;
 
@@ -117,6 +120,7 @@ link_execute(char* name __attribute__((unused)), struct art* nodes)
 
    server = (int)pgmoneta_art_search(nodes, NODE_SERVER_ID);
    label = (char*)pgmoneta_art_search(nodes, NODE_LABEL);
+   lock = (struct lock*)pgmoneta_art_search(nodes, NODE_LOCK);
 
    pgmoneta_log_debug("Link (execute): %s/%s", config->common.servers[server].name, label);
 
@@ -142,12 +146,18 @@ link_execute(char* name __attribute__((unused)), struct art* nodes)
       }
       for (int j = index - 1; j >= 0 && next_newest == -1; j--)
       {
-         if (backups[j]->valid == VALID_TRUE && backups[j]->major_version == backups[number_of_backups - 1]->major_version)
+         /* Files encrypted with another data key can't be shared */
+         if (backups[j]->valid == VALID_TRUE && backups[j]->major_version == backups[number_of_backups - 1]->major_version &&
+             !strcmp(backups[j]->data_key, backups[index]->data_key))
          {
-            if (next_newest == -1)
+            /* The backup linked to is held until the backup is done, so a delete can't remove the files under it */
+            if (lock != NULL && pgmoneta_lock_backup(lock, backups[j]->label, LOCK_SHARED))
             {
-               next_newest = j;
+               pgmoneta_log_debug("Link: %s/%s is active", config->common.servers[server].name, backups[j]->label);
+               continue;
             }
+
+            next_newest = j;
          }
       }
 
@@ -157,7 +167,7 @@ link_execute(char* name __attribute__((unused)), struct art* nodes)
 
          if (number_of_workers > 0)
          {
-            pgmoneta_workers_initialize(number_of_workers, &workers);
+            pgmoneta_workers_initialize_group(pgmoneta_workflow_io_workers(nodes), number_of_workers, &workers);
          }
 
          from = pgmoneta_get_server_backup_identifier(server, label);
@@ -173,8 +183,16 @@ link_execute(char* name __attribute__((unused)), struct art* nodes)
          from = pgmoneta_append(from, "data/");
          to = pgmoneta_append(to, "data/");
 
-         pgmoneta_compare_manifests(to_manifest, from_manifest, &deleted_files, &changed_files, &added_files);
-         pgmoneta_link_manifest(from, to, from, changed_files, added_files, workers);
+         /* The difference is spilled to the workspace, so the memory use doesn't grow with the cluster */
+         workspace = pgmoneta_get_server_workspace(server);
+
+         if (workspace == NULL || pgmoneta_manifest_diff(workspace, to_manifest, from_manifest, &diff))
+         {
+            pgmoneta_log_error("Link: Unable to compare %s and %s", backups[next_newest]->label, label);
+            goto error;
+         }
+
+         pgmoneta_link_manifest(from, to, from, diff, workers);
 
          if (number_of_workers > 0)
          {
@@ -221,9 +239,8 @@ link_execute(char* name __attribute__((unused)), struct art* nodes)
    free(to_manifest);
    free(from_tablespaces);
    free(to_tablespaces);
-   pgmoneta_art_destroy(changed_files);
-   pgmoneta_art_destroy(added_files);
-   pgmoneta_art_destroy(deleted_files);
+   free(workspace);
+   pgmoneta_manifest_diff_destroy(diff);
 
    return 0;
 
@@ -247,9 +264,8 @@ error:
    free(to_manifest);
    free(from_tablespaces);
    free(to_tablespaces);
-   pgmoneta_art_destroy(changed_files);
-   pgmoneta_art_destroy(added_files);
-   pgmoneta_art_destroy(deleted_files);
+   free(workspace);
+   pgmoneta_manifest_diff_destroy(diff);
 
    return 1;
 }
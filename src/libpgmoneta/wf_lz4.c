@@ -30,6 +30,7 @@
 #include <pgmoneta.h>
 #include <logging.h>
 #include <utils.h>
+#include <compression.h>
 #include <lz4_compression.h>
 #include <workflow.h>
 
@@ -39,6 +40,7 @@
 
 static char* lz4_name(void);
 static int lz4_execute_compress(char*, struct art*);
+static int lz4_execute_file(char*, struct art*, char*, char**);
 static int lz4_execute_uncompress(char*, struct art*);
 
 struct workflow*
@@ -66,6 +68,8 @@ pgmoneta_create_lz4(bool compress)
    }
 
    wf->teardown = &pgmoneta_common_teardown;
+   wf->execute_file = compress ? &lz4_execute_file : NULL;
+   wf->independent = false;
    wf->next = NULL;
 
    return wf;
@@ -130,7 +134,7 @@ lz4_execute_compress(char* name __attribute__((unused)), struct art* nodes)
       number_of_workers = pgmoneta_get_number_of_workers(server);
       if (number_of_workers > 0)
       {
-         pgmoneta_workers_initialize(number_of_workers, &workers);
+         pgmoneta_workers_initialize_group((struct workers*)pgmoneta_art_search(nodes, NODE_WORKERS), number_of_workers, &workers);
       }
 
       backup_base = (char*)pgmoneta_art_search(nodes, NODE_BACKUP_BASE);
@@ -204,6 +208,33 @@ error:
    return 1;
 }
 
+static int
+lz4_execute_file(char* name __attribute__((unused)), struct art* nodes __attribute__((unused)), char* path, char** result)
+{
+   char* to = NULL;
+
+   *result = NULL;
+
+   if (!pgmoneta_compression_applies(path))
+   {
+      *result = pgmoneta_append(NULL, path);
+      return 0;
+   }
+
+   to = pgmoneta_append(to, path);
+   to = pgmoneta_append(to, ".lz4");
+
+   if (pgmoneta_lz4c_file(path, to))
+   {
+      free(to);
+      return 1;
+   }
+
+   *result = to;
+
+   return 0;
+}
+
 static int
 lz4_execute_uncompress(char* name __attribute__((unused)), struct art* nodes)
 {
@@ -255,7 +286,7 @@ lz4_execute_uncompress(char* name __attribute__((unused)), struct art* nodes)
    number_of_workers = pgmoneta_get_number_of_workers(server);
    if (number_of_workers > 0)
    {
-      pgmoneta_workers_initialize(number_of_workers, &workers);
+      pgmoneta_workers_initialize_group((struct workers*)pgmoneta_art_search(nodes, NODE_WORKERS), number_of_workers, &workers);
    }
 
    pgmoneta_lz4d_data(base, workers);
@@ -29,6 +29,7 @@
 #include <csv.h>
 #include <logging.h>
 #include <manifest.h>
+#include <security.h>
 #include <utils.h>
 #include <workflow.h>
 
@@ -36,9 +37,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 static char* manifest_name(void);
 static int manifest_execute(char*, struct art*);
+static int manifest_tree(int server, char* manifest, char* backup_base, char* backup_data, int algorithm);
 
 struct workflow*
 pgmoneta_create_manifest(void)
@@ -56,6 +59,8 @@ pgmoneta_create_manifest(void)
    wf->setup = &pgmoneta_common_setup;
    wf->execute = &manifest_execute;
    wf->teardown = &pgmoneta_common_teardown;
+   wf->execute_file = NULL;
+   wf->independent = false;
    wf->next = NULL;
 
    return wf;
@@ -165,8 +170,26 @@ manifest_execute(char* name __attribute__((unused)), struct art* nodes)
    }
 
    pgmoneta_json_reader_close(reader);
+   reader = NULL;
    pgmoneta_csv_writer_destroy(writer);
+   writer = NULL;
    pgmoneta_json_destroy(entry);
+   entry = NULL;
+
+   /* Sorted manifests can be compared in a single pass */
+   if (pgmoneta_manifest_sort(manifest))
+   {
+      goto error;
+   }
+
+   if (config->manifest_tree)
+   {
+      if (manifest_tree(server, manifest, backup_base, backup_data, backup->hash_algorithm))
+      {
+         goto error;
+      }
+   }
+
    free(backup);
    free(manifest);
    free(manifest_orig);
@@ -192,3 +215,110 @@ error:
 
    return 1;
 }
+
+/**
+ * Write backup.tree with the chunk hashes of the files of the manifest
+ * that span several chunks, so verify can tell which chunks are damaged
+ * @param server The server
+ * @param manifest The path of backup.manifest
+ * @param backup_base The base directory of the backup
+ * @param backup_data The data directory of the backup
+ * @param algorithm The hash algorithm
+ * @return 0 on success, otherwise 1
+ */
+static int
+manifest_tree(int server, char* manifest, char* backup_base, char* backup_data, int algorithm)
+{
+   char* tree = NULL;
+   char* path = NULL;
+   char* root = NULL;
+   char* chunks = NULL;
+   char alg[MISC_LENGTH];
+   char size[MISC_LENGTH];
+   char* info[5];
+   int number_of_columns = 0;
+   char** columns = NULL;
+   struct stat st;
+   struct csv_reader* reader = NULL;
+   struct csv_writer* writer = NULL;
+
+   tree = pgmoneta_append(tree, backup_base);
+   if (!pgmoneta_ends_with(tree, "/"))
+   {
+      tree = pgmoneta_append(tree, "/");
+   }
+   tree = pgmoneta_append(tree, "backup.tree");
+
+   if (pgmoneta_csv_reader_init(manifest, &reader))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_csv_writer_init(tree, &writer))
+   {
+      pgmoneta_log_error("Could not create csv writer for %s", tree);
+      goto error;
+   }
+
+   memset(&alg[0], 0, sizeof(alg));
+   memset(&size[0], 0, sizeof(size));
+   snprintf(&alg[0], sizeof(alg), "%d", algorithm);
+   snprintf(&size[0], sizeof(size), "%d", TREE_HASH_CHUNK_SIZE);
+
+   while (pgmoneta_csv_next_row(reader, &number_of_columns, &columns))
+   {
+      if (number_of_columns < MANIFEST_COLUMN_COUNT)
+      {
+         continue;
+      }
+
+      path = pgmoneta_append(path, backup_data);
+      if (!pgmoneta_ends_with(path, "/"))
+      {
+         path = pgmoneta_append(path, "/");
+      }
+      path = pgmoneta_append(path, columns[MANIFEST_PATH_INDEX]);
+
+      /* A file of a single chunk gains nothing over its manifest checksum */
+      if (!stat(path, &st) && S_ISREG(st.st_mode) && st.st_size > TREE_HASH_CHUNK_SIZE)
+      {
+         if (pgmoneta_create_file_tree_hash(algorithm, path, pgmoneta_get_number_of_workers(server), &root, &chunks))
+         {
+            pgmoneta_log_error("Could not create the tree hash of %s", path);
+            goto error;
+         }
+
+         info[0] = columns[MANIFEST_PATH_INDEX];
+         info[1] = &alg[0];
+         info[2] = &size[0];
+         info[3] = root;
+         info[4] = chunks;
+         pgmoneta_csv_write(writer, 5, info);
+
+         free(root);
+         root = NULL;
+         free(chunks);
+         chunks = NULL;
+      }
+
+      free(path);
+      path = NULL;
+   }
+
+   pgmoneta_csv_reader_destroy(reader);
+   pgmoneta_csv_writer_destroy(writer);
+   free(tree);
+
+   return 0;
+
+error:
+
+   pgmoneta_csv_reader_destroy(reader);
+   pgmoneta_csv_writer_destroy(writer);
+   free(tree);
+   free(path);
+   free(root);
+   free(chunks);
+
+   return 1;
+}
@@ -37,8 +37,6 @@
 #include <stdlib.h>
 
 static char* permissions_name(void);
-static int permissions_execute_backup(char*, struct art*);
-static int permissions_execute_restore(char*, struct art*);
 static int permissions_execute_archive(char*, struct art*);
 
 struct workflow*
@@ -57,12 +55,6 @@ pgmoneta_create_permissions(int type)
    wf->setup = &pgmoneta_common_setup;
    switch (type)
    {
-      case PERMISSION_TYPE_BACKUP:
-         wf->execute = &permissions_execute_backup;
-         break;
-      case PERMISSION_TYPE_RESTORE:
-         wf->execute = &permissions_execute_restore;
-         break;
       case PERMISSION_TYPE_ARCHIVE:
          wf->execute = &permissions_execute_archive;
          break;
@@ -70,6 +62,8 @@ pgmoneta_create_permissions(int type)
          pgmoneta_log_error("Invalid permission type");
    }
    wf->teardown = &pgmoneta_common_teardown;
+   wf->execute_file = NULL;
+   wf->independent = false;
    wf->next = NULL;
 
    return wf;
@@ -81,88 +75,6 @@ permissions_name(void)
    return "Permissions";
 }
 
-static int
-permissions_execute_backup(char* name __attribute__((unused)), struct art* nodes)
-{
-   int server = -1;
-   char* label = NULL;
-   char* path = NULL;
-   struct main_configuration* config;
-
-   config = (struct main_configuration*)shmem;
-
-#ifdef DEBUG
-   if (pgmoneta_log_is_enabled(PGMONETA_LOGGING_LEVEL_DEBUG1))
-   {
-      char* a = NULL;
-      a = pgmoneta_art_to_string(nodes, FORMAT_TEXT, NULL, 0);
-      pgmoneta_log_debug("(Tree)\n%s", a);
-      free(a);
-   }
-   assert(nodes != NULL);
-   assert(pgmoneta_art_contains_key(nodes, NODE_SERVER_ID));
-   assert(pgmoneta_art_contains_key(nodes, NODE_LABEL));
-#endif
-
-   server = (int)pgmoneta_art_search(nodes, NODE_SERVER_ID);
-   label = (char*)pgmoneta_art_search(nodes, NODE_LABEL);
-
-   pgmoneta_log_debug("Permissions (backup): %s/%s", config->common.servers[server].name, label);
-
-   path = pgmoneta_get_server_backup_identifier_data(server, label);
-
-   pgmoneta_permission_recursive(path);
-
-   free(path);
-
-   return 0;
-}
-
-static int
-permissions_execute_restore(char* name __attribute__((unused)), struct art* nodes)
-{
-   int server = -1;
-   char* label = NULL;
-   char* path = NULL;
-   struct main_configuration* config;
-
-   config = (struct main_configuration*)shmem;
-
-#ifdef DEBUG
-   if (pgmoneta_log_is_enabled(PGMONETA_LOGGING_LEVEL_DEBUG1))
-   {
-      char* a = NULL;
-      a = pgmoneta_art_to_string(nodes, FORMAT_TEXT, NULL, 0);
-      pgmoneta_log_debug("(Tree)\n%s", a);
-      free(a);
-   }
-   assert(nodes != NULL);
-   assert(pgmoneta_art_contains_key(nodes, NODE_SERVER_ID));
-   assert(pgmoneta_art_contains_key(nodes, NODE_LABEL));
-#endif
-
-   server = (int)pgmoneta_art_search(nodes, NODE_SERVER_ID);
-   label = (char*)pgmoneta_art_search(nodes, NODE_LABEL);
-   path = pgmoneta_append(path, (char*)pgmoneta_art_search(nodes, NODE_TARGET_ROOT));
-
-   if (!pgmoneta_ends_with(path, "/"))
-   {
-      path = pgmoneta_append(path, "/");
-   }
-   path = pgmoneta_append(path, config->common.servers[server].name);
-   path = pgmoneta_append(path, "-");
-   path = pgmoneta_append(path, label);
-   path = pgmoneta_append(path, "/");
-
-   pgmoneta_log_debug("Permissions (restore): %s/%s at %s", config->common.servers[server].name, label, path);
-
-   pgmoneta_permission_recursive(path);
-
-   free(path);
-
-   return 0;
-}
-
 static int
 permissions_execute_archive(char* name __attribute__((unused)), struct art* nodes)
 {
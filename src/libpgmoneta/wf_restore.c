@@ -28,13 +28,18 @@
 
 /* pgmoneta */
 #include <pgmoneta.h>
+#include <aes.h>
 #include <logging.h>
+#include <progress.h>
+#include <prometheus.h>
+#include <reader.h>
 #include <restore.h>
 #include <utils.h>
 #include <workflow.h>
 
 /* system */
 #include <assert.h>
+#include <dirent.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -57,6 +62,7 @@ static int restore_excluded_files_teardown(char*, struct art*);
 
 static char* get_user_password(char* username);
 static void create_standby_signal(char* basedir);
+static int stage_configuration(char* from, char* to);
 
 struct workflow*
 pgmoneta_create_restore(void)
@@ -74,6 +80,8 @@ pgmoneta_create_restore(void)
    wf->setup = &pgmoneta_common_setup;
    wf->execute = &restore_execute;
    wf->teardown = &pgmoneta_common_teardown;
+   wf->execute_file = NULL;
+   wf->independent = false;
    wf->next = NULL;
 
    return wf;
@@ -95,6 +103,8 @@ pgmoneta_create_combine_incremental(void)
    wf->setup = &pgmoneta_common_setup;
    wf->execute = &combine_incremental_execute;
    wf->teardown = &pgmoneta_common_teardown;
+   wf->execute_file = NULL;
+   wf->independent = false;
    wf->next = NULL;
 
    return wf;
@@ -116,6 +126,8 @@ pgmoneta_create_copy_wal(void)
    wf->setup = &pgmoneta_common_setup;
    wf->execute = &copy_wal_execute;
    wf->teardown = &pgmoneta_common_teardown;
+   wf->execute_file = NULL;
+   wf->independent = false;
    wf->next = NULL;
 
    return wf;
@@ -137,6 +149,8 @@ pgmoneta_create_recovery_info(void)
    wf->setup = &pgmoneta_common_setup;
    wf->execute = &recovery_info_execute;
    wf->teardown = &pgmoneta_common_teardown;
+   wf->execute_file = NULL;
+   wf->independent = false;
    wf->next = NULL;
 
    return wf;
@@ -158,6 +172,8 @@ pgmoneta_restore_excluded_files(void)
    wf->setup = &pgmoneta_common_setup;
    wf->execute = &restore_excluded_files_execute;
    wf->teardown = &restore_excluded_files_teardown;
+   wf->execute_file = NULL;
+   wf->independent = false;
    wf->next = NULL;
 
    return wf;
@@ -183,9 +199,11 @@ restore_execute(char* name __attribute__((unused)), struct art* nodes)
    char* waltarget = NULL;
    int number_of_workers = 0;
    struct workers* workers = NULL;
+   uint64_t start;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
+   start = pgmoneta_prometheus_now();
 
 #ifdef DEBUG
    if (pgmoneta_log_is_enabled(PGMONETA_LOGGING_LEVEL_DEBUG1))
@@ -219,12 +237,27 @@ restore_execute(char* name __attribute__((unused)), struct art* nodes)
    number_of_workers = pgmoneta_get_number_of_workers(server);
    if (number_of_workers > 0)
    {
-      pgmoneta_workers_initialize(number_of_workers, &workers);
+      pgmoneta_workers_initialize_group(pgmoneta_workflow_io_workers(nodes), number_of_workers, &workers);
    }
 
-   if (pgmoneta_copy_postgresql_restore(from, to, directory, config->common.servers[server].name, label, backup, workers))
+   pgmoneta_encrypt_key_cache_acquire();
+   pgmoneta_reader_statistics_reset();
+   pgmoneta_progress_total(backup->restore_size, 0);
+
+   if (pgmoneta_art_contains_key(nodes, NODE_ARCHIVE_SOURCE))
+   {
+      /* The archive streams the backup, so only the files the restore changes are staged */
+      if (stage_configuration(from, to))
+      {
+         pgmoneta_log_error("Restore: Could not stage %s/%s", config->common.servers[server].name, label);
+         pgmoneta_encrypt_key_cache_release();
+         goto error;
+      }
+   }
+   else if (pgmoneta_copy_postgresql_restore(from, to, directory, config->common.servers[server].name, label, backup, workers))
    {
       pgmoneta_log_error("Restore: Could not restore %s/%s", config->common.servers[server].name, label);
+      pgmoneta_encrypt_key_cache_release();
       goto error;
    }
 
@@ -233,11 +266,19 @@ restore_execute(char* name __attribute__((unused)), struct art* nodes)
       pgmoneta_workers_wait(workers);
       if (!workers->outcome)
       {
+         pgmoneta_encrypt_key_cache_release();
          goto error;
       }
       pgmoneta_workers_destroy(workers);
    }
 
+   pgmoneta_encrypt_key_cache_release();
+
+   pgmoneta_reader_log_statistics("Restore");
+
+   pgmoneta_prometheus_restore(RESTORE_PHASE_RESTORE, pgmoneta_directory_size(to),
+                               (double)(pgmoneta_prometheus_now() - start) / 1000000.0);
+
    free(from);
    free(origwal);
    free(waldir);
@@ -280,9 +321,11 @@ combine_incremental_execute(char* name __attribute__((unused)), struct art* node
    char* base = NULL;
    struct backup* bck = NULL;
    struct json* manifest = NULL;
+   uint64_t start;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
+   start = pgmoneta_prometheus_now();
 
 #ifdef DEBUG
    if (pgmoneta_log_is_enabled(PGMONETA_LOGGING_LEVEL_DEBUG1))
@@ -352,11 +395,18 @@ combine_incremental_execute(char* name __attribute__((unused)), struct art* node
       }
    }
 
+   pgmoneta_reader_statistics_reset();
+
    if (pgmoneta_combine_backups(server, label, base, input_dir, output_dir, prior_labels, bck, manifest, incremental, combine_as_is))
    {
       goto error;
    }
 
+   pgmoneta_reader_log_statistics("Combine incremental");
+
+   pgmoneta_prometheus_restore(RESTORE_PHASE_COMBINE, pgmoneta_directory_size(output_dir),
+                               (double)(pgmoneta_prometheus_now() - start) / 1000000.0);
+
    free(input_dir);
    return 0;
 
@@ -584,7 +634,8 @@ recovery_info_execute(char* name __attribute__((unused)), struct art* nodes)
                   mode = true;
                }
             }
-            else if (!strcmp(&key[0], "primary") || !strcmp(&key[0], "replica"))
+            else if (!strcmp(&key[0], "primary") || !strcmp(&key[0], "replica") ||
+                     !strcmp(&key[0], "database") || !strcmp(&key[0], "relation"))
             {
                /* Ok */
             }
@@ -750,9 +801,11 @@ copy_wal_execute(char* name __attribute__((unused)), struct art* nodes)
    struct backup* backup = NULL;
    int number_of_workers = 0;
    struct workers* workers = NULL;
+   uint64_t start;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
+   start = pgmoneta_prometheus_now();
 
 #ifdef DEBUG
    assert(nodes != NULL);
@@ -771,7 +824,7 @@ copy_wal_execute(char* name __attribute__((unused)), struct art* nodes)
    number_of_workers = pgmoneta_get_number_of_workers(server);
    if (number_of_workers > 0)
    {
-      pgmoneta_workers_initialize(number_of_workers, &workers);
+      pgmoneta_workers_initialize_group(pgmoneta_workflow_io_workers(nodes), number_of_workers, &workers);
    }
 
    server = (int)pgmoneta_art_search(nodes, NODE_SERVER_ID);
@@ -789,7 +842,7 @@ copy_wal_execute(char* name __attribute__((unused)), struct art* nodes)
    waltarget = pgmoneta_append(waltarget, label);
    waltarget = pgmoneta_append(waltarget, "/pg_wal/");
 
-   pgmoneta_copy_wal_files(waldir, waltarget, &backup->wal[0], workers);
+   pgmoneta_copy_wal_files(server, waldir, waltarget, &backup->wal[0], workers);
 
    if (number_of_workers > 0)
    {
@@ -801,6 +854,9 @@ copy_wal_execute(char* name __attribute__((unused)), struct art* nodes)
       pgmoneta_workers_destroy(workers);
    }
 
+   pgmoneta_prometheus_restore(RESTORE_PHASE_COPY_WAL, pgmoneta_directory_size(waltarget),
+                               (double)(pgmoneta_prometheus_now() - start) / 1000000.0);
+
    free(origwal);
    free(waldir);
    free(waltarget);
@@ -905,6 +961,9 @@ restore_excluded_files_execute(char* name __attribute__((unused)), struct art* n
       case ENCRYPTION_AES_128_CTR:
          suffix = pgmoneta_append(suffix, ".aes");
          break;
+      case ENCRYPTION_AES_256_GCM:
+         suffix = pgmoneta_append(suffix, ".aes");
+         break;
       case ENCRYPTION_NONE:
          break;
       default:
@@ -917,7 +976,7 @@ restore_excluded_files_execute(char* name __attribute__((unused)), struct art* n
    number_of_workers = pgmoneta_get_number_of_workers(server);
    if (number_of_workers > 0)
    {
-      pgmoneta_workers_initialize(number_of_workers, &workers);
+      pgmoneta_workers_initialize_group(pgmoneta_workflow_io_workers(nodes), number_of_workers, &workers);
    }
 
    for (int i = 0; restore_last_files_names[i] != NULL; i++)
@@ -1066,6 +1125,9 @@ restore_excluded_files_teardown(char* name __attribute__((unused)), struct art*
       case ENCRYPTION_AES_128_CTR:
          suffix = pgmoneta_append(suffix, ".aes");
          break;
+      case ENCRYPTION_AES_256_GCM:
+         suffix = pgmoneta_append(suffix, ".aes");
+         break;
       case ENCRYPTION_NONE:
          break;
       default:
@@ -1163,3 +1225,78 @@ create_standby_signal(char* basedir)
 
    free(f);
 }
+
+static int
+stage_configuration(char* from, char* to)
+{
+   DIR* dir = NULL;
+   struct dirent* entry = NULL;
+
+   if (pgmoneta_mkdir(to))
+   {
+      goto error;
+   }
+
+   dir = opendir(from);
+   if (dir == NULL)
+   {
+      pgmoneta_log_error("Unable to open: %s", from);
+      goto error;
+   }
+
+   /* The recovery information is added to the configuration files */
+   while ((entry = readdir(dir)) != NULL)
+   {
+      char* plain = NULL;
+      char* f = NULL;
+      char* t = NULL;
+
+      if (pgmoneta_reader_plain_name(entry->d_name, &plain))
+      {
+         goto error;
+      }
+
+      if (!strcmp(plain, "postgresql.conf") || !strcmp(plain, "postgresql.auto.conf"))
+      {
+         f = pgmoneta_append(f, from);
+         if (!pgmoneta_ends_with(f, "/"))
+         {
+            f = pgmoneta_append(f, "/");
+         }
+         f = pgmoneta_append(f, entry->d_name);
+
+         t = pgmoneta_append(t, to);
+         if (!pgmoneta_ends_with(t, "/"))
+         {
+            t = pgmoneta_append(t, "/");
+         }
+         t = pgmoneta_append(t, entry->d_name);
+
+         if (pgmoneta_reader_extract_file(f, t, NULL))
+         {
+            pgmoneta_log_error("Unable to extract: %s", f);
+            free(plain);
+            free(f);
+            free(t);
+            goto error;
+         }
+      }
+
+      free(plain);
+      free(f);
+      free(t);
+   }
+
+   closedir(dir);
+
+   return 0;
+
+error:
+
+   if (dir != NULL)
+   {
+      closedir(dir);
+   }
+
+   return 1;
+}
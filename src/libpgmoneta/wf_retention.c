@@ -28,6 +28,7 @@
 
 /* pgmoneta */
 #include <pgmoneta.h>
+#include <art.h>
 #include <delete.h>
 #include <logging.h>
 #include <utils.h>
@@ -46,6 +47,8 @@ static int retention_execute(char*, struct art*);
 static int retention_teardown(char*, struct art*);
 static void mark_retention(int server, int retention_days, int retention_weeks, int retention_months,
                            int retention_years, int number_of_backups, struct backup** backups, bool** retention_flags);
+static int plan_retention(int server, int number_of_backups, struct backup** backups, bool* retention_keep,
+                          int* number_of_expired, int** expired);
 
 struct workflow*
 pgmoneta_create_retention(void)
@@ -63,6 +66,8 @@ pgmoneta_create_retention(void)
    wf->setup = &retention_setup;
    wf->execute = &retention_execute;
    wf->teardown = &retention_teardown;
+   wf->execute_file = NULL;
+   wf->independent = false;
    wf->next = NULL;
 
    return wf;
@@ -106,8 +111,9 @@ retention_execute(char* name __attribute__((unused)), struct art* nodes)
    char* d;
    int number_of_backups = 0;
    struct backup** backups = NULL;
-   struct backup* child = NULL;
    bool* retention_keep = NULL;
+   int number_of_expired = 0;
+   int* expired = NULL;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
@@ -164,27 +170,27 @@ retention_execute(char* name __attribute__((unused)), struct art* nodes)
       {
          mark_retention(i, retention_days, retention_weeks, retention_months,
                         retention_years, number_of_backups, backups, &retention_keep);
-         for (int j = 0; j < number_of_backups; j++)
+
+         if (retention_keep != NULL && !plan_retention(i, number_of_backups, backups, retention_keep, &number_of_expired, &expired))
          {
-            if (!retention_keep[j])
+            pgmoneta_log_trace("Retention: %s has %d of %d backups expired", config->common.servers[i].name, number_of_expired, number_of_backups);
+
+            /* The plan is newest first, so every file is relinked at most once into the backup that is kept.
+               A backup in use is skipped by the delete, and expires again on the next run */
+            for (int j = 0; j < number_of_expired; j++)
             {
-               pgmoneta_get_backup_child(i, backups[j], &child);
-               // a backup can only be deleted if it has no child
-               if (!backups[j]->keep && child == NULL)
+               pgmoneta_log_info("Retention: %s/%s", config->common.servers[i].name, backups[expired[j]]->label);
+
+               if (pgmoneta_delete(i, backups[expired[j]]->label))
                {
-                  pgmoneta_log_trace("Retention: %s/%s (%s)", config->common.servers[i].name, backups[j]->label, atomic_load(&config->common.servers[i].repository) ? "Active" : "Inactive");
-
-                  if (!atomic_load(&config->common.servers[i].repository))
-                  {
-                     pgmoneta_log_info("Retention: %s/%s", config->common.servers[i].name, backups[j]->label);
-                     pgmoneta_delete(i, backups[j]->label);
-                     break;
-                  }
+                  break;
                }
-               free(child);
-               child = NULL;
             }
          }
+
+         free(expired);
+         expired = NULL;
+         number_of_expired = 0;
       }
 
       pgmoneta_delete_wal(i);
@@ -231,7 +237,10 @@ retention_execute(char* name __attribute__((unused)), struct art* nodes)
          free(hs);
       }
 
+      pgmoneta_storage_changed(i);
+
       free(retention_keep);
+      retention_keep = NULL;
       free(d);
    }
 
@@ -437,3 +446,91 @@ mark_retention(int server, int retention_days, int retention_weeks, int retentio
    }
    *retention_keep = keep;
 }
+
+/**
+ * Plan the deletions of a server from the backups loaded once. A backup is
+ * expired when it isn't retained and has no child left after the newer
+ * expired backups are deleted, so a whole incremental chain goes in one run
+ * @param server The server
+ * @param number_of_backups The number of backups
+ * @param backups The backups, oldest first
+ * @param retention_keep The backups kept by the retention policy
+ * @param number_of_expired [out] The number of expired backups
+ * @param expired [out] The indexes of the expired backups, newest first
+ * @return 0 upon success, otherwise 1
+ */
+static int
+plan_retention(int server, int number_of_backups, struct backup** backups, bool* retention_keep,
+               int* number_of_expired, int** expired)
+{
+   int n = 0;
+   int* children = NULL;
+   int* e = NULL;
+   struct art* labels = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   *number_of_expired = 0;
+   *expired = NULL;
+
+   children = (int*)calloc(number_of_backups, sizeof(int));
+   e = (int*)malloc(number_of_backups * sizeof(int));
+
+   if (children == NULL || e == NULL)
+   {
+      goto error;
+   }
+
+   if (pgmoneta_art_create(&labels))
+   {
+      goto error;
+   }
+
+   for (int j = 0; j < number_of_backups; j++)
+   {
+      pgmoneta_art_insert(labels, backups[j]->label, (uintptr_t)j, ValueInt32);
+   }
+
+   for (int j = 0; j < number_of_backups; j++)
+   {
+      if (strlen(backups[j]->parent_label) > 0 && pgmoneta_art_contains_key(labels, backups[j]->parent_label))
+      {
+         children[(int)pgmoneta_art_search(labels, backups[j]->parent_label)]++;
+      }
+   }
+
+   /* A child is always newer than its parent, so it is planned first */
+   for (int j = number_of_backups - 1; j >= 0; j--)
+   {
+      if (retention_keep[j] || backups[j]->keep || children[j] > 0)
+      {
+         continue;
+      }
+
+      pgmoneta_log_debug("Retention: Plan %s/%s", config->common.servers[server].name, backups[j]->label);
+
+      e[n++] = j;
+
+      if (strlen(backups[j]->parent_label) > 0 && pgmoneta_art_contains_key(labels, backups[j]->parent_label))
+      {
+         children[(int)pgmoneta_art_search(labels, backups[j]->parent_label)]--;
+      }
+   }
+
+   pgmoneta_art_destroy(labels);
+   free(children);
+
+   *number_of_expired = n;
+   *expired = e;
+
+   return 0;
+
+error:
+
+   pgmoneta_art_destroy(labels);
+   free(children);
+   free(e);
+
+   return 1;
+}
@@ -28,6 +28,8 @@
 
 /* pgmoneta */
 #include <pgmoneta.h>
+#include <art.h>
+#include <json.h>
 #include <logging.h>
 #include <security.h>
 #include <utils.h>
@@ -36,13 +38,21 @@
 /* system */
 #include <assert.h>
 #include <dirent.h>
+#include <strings.h>
+
+/* One of this many checksums taken from the backup manifest is verified */
+#define SHA256_SAMPLE 100
 
 static char* sha256_name(void);
 static int sha256_execute(char*, struct art*);
 
-static int write_backup_sha256(char* root, char* relative_path);
+static int load_manifest_checksums(int server, char* data);
+static int write_backup_sha256(int server, char* root, char* relative_path);
 
 static FILE* sha256_file = NULL;
+static struct art* manifest_checksums = NULL;
+static uint64_t imported = 0;
+static bool mismatch = false;
 
 struct workflow*
 pgmoneta_create_sha256(void)
@@ -55,6 +65,8 @@ pgmoneta_create_sha256(void)
    wf->setup = &pgmoneta_common_setup;
    wf->execute = &sha256_execute;
    wf->teardown = &pgmoneta_common_teardown;
+   wf->execute_file = NULL;
+   wf->independent = false;
    wf->next = NULL;
 
    return wf;
@@ -101,22 +113,52 @@ sha256_execute(char* name __attribute__((unused)), struct art* nodes)
    sha256_path = pgmoneta_append(sha256_path, root);
    sha256_path = pgmoneta_append(sha256_path, "backup.sha256");
 
+   d = pgmoneta_get_server_backup_identifier_data(server, label);
+
+   if (load_manifest_checksums(server, d))
+   {
+      goto error;
+   }
+
    sha256_file = fopen(sha256_path, "w");
    if (sha256_file == NULL)
    {
       goto error;
    }
 
-   d = pgmoneta_get_server_backup_identifier_data(server, label);
-
-   if (write_backup_sha256(d, ""))
+   if (write_backup_sha256(server, d, ""))
    {
       goto error;
    }
 
+   if (mismatch)
+   {
+      /* The files don't match the manifest, so every file is hashed */
+      pgmoneta_log_warn("SHA256: %s/%s doesn't match its backup manifest", config->common.servers[server].name, label);
+
+      pgmoneta_art_destroy(manifest_checksums);
+      manifest_checksums = NULL;
+
+      fclose(sha256_file);
+      sha256_file = fopen(sha256_path, "w");
+      if (sha256_file == NULL)
+      {
+         goto error;
+      }
+
+      if (write_backup_sha256(server, d, ""))
+      {
+         goto error;
+      }
+   }
+
    pgmoneta_permission(sha256_path, 6, 0, 0);
 
    fclose(sha256_file);
+   sha256_file = NULL;
+
+   pgmoneta_art_destroy(manifest_checksums);
+   manifest_checksums = NULL;
 
    free(sha256_path);
    free(root);
@@ -129,8 +171,12 @@ error:
    if (sha256_file != NULL)
    {
       fclose(sha256_file);
+      sha256_file = NULL;
    }
 
+   pgmoneta_art_destroy(manifest_checksums);
+   manifest_checksums = NULL;
+
    free(sha256_path);
    free(root);
    free(d);
@@ -139,7 +185,7 @@ error:
 }
 
 static int
-write_backup_sha256(char* root, char* relative_path)
+write_backup_sha256(int server, char* root, char* relative_path)
 {
    char* dir_path = NULL;
    char* relative_file_path;
@@ -170,7 +216,7 @@ write_backup_sha256(char* root, char* relative_path)
 
          snprintf(relative_dir, sizeof(relative_dir), "%s/%s", relative_path, entry->d_name);
 
-         write_backup_sha256(root, relative_dir);
+         write_backup_sha256(server, root, relative_dir);
       }
       else
       {
@@ -187,7 +233,35 @@ write_backup_sha256(char* root, char* relative_path)
          absolute_file_path = pgmoneta_append(absolute_file_path, "/");
          absolute_file_path = pgmoneta_append(absolute_file_path, relative_file_path);
 
-         pgmoneta_create_sha256_file(absolute_file_path, &sha256);
+         if (manifest_checksums != NULL)
+         {
+            char* checksum = (char*)pgmoneta_art_search(manifest_checksums, relative_file_path + 1);
+
+            if (checksum != NULL)
+            {
+               imported++;
+
+               if (imported % SHA256_SAMPLE == 0)
+               {
+                  pgmoneta_create_backup_file_hash(server, absolute_file_path, &sha256);
+
+                  if (sha256 == NULL || strcasecmp(sha256, checksum))
+                  {
+                     pgmoneta_log_debug("SHA256: %s doesn't match the backup manifest", relative_file_path);
+                     mismatch = true;
+                  }
+               }
+               else
+               {
+                  sha256 = pgmoneta_append(NULL, checksum);
+               }
+            }
+         }
+
+         if (sha256 == NULL)
+         {
+            pgmoneta_create_backup_file_hash(server, absolute_file_path, &sha256);
+         }
 
          buffer = pgmoneta_append(buffer, relative_file_path);
          buffer = pgmoneta_append(buffer, ":");
@@ -220,3 +294,97 @@ error:
 
    return 1;
 }
+
+static int
+load_manifest_checksums(int server, char* data)
+{
+   char* manifest = NULL;
+   char* key_path[1] = {"Files"};
+   struct json_reader* reader = NULL;
+   struct json* entry = NULL;
+   int algorithm;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   manifest_checksums = NULL;
+   imported = 0;
+   mismatch = false;
+
+   algorithm = config->common.servers[server].manifest;
+   if (algorithm == HASH_ALGORITHM_DEFAULT)
+   {
+      algorithm = config->manifest;
+   }
+
+   /*
+    * PostgreSQL already calculated the SHA256 of the files it sent, which are
+    * stored as they are without compression and encryption
+    */
+   if (config->compression_type != COMPRESSION_NONE || config->encryption != ENCRYPTION_NONE ||
+       algorithm == HASH_ALGORITHM_XXH3 || algorithm == HASH_ALGORITHM_BLAKE3)
+   {
+      return 0;
+   }
+
+   manifest = pgmoneta_append(manifest, data);
+   if (!pgmoneta_ends_with(manifest, "/"))
+   {
+      manifest = pgmoneta_append(manifest, "/");
+   }
+   manifest = pgmoneta_append(manifest, "backup_manifest");
+
+   if (!pgmoneta_exists(manifest))
+   {
+      free(manifest);
+      return 0;
+   }
+
+   if (pgmoneta_art_create(&manifest_checksums))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_json_reader_init(manifest, &reader))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_json_locate(reader, key_path, 1))
+   {
+      pgmoneta_log_error("Could not locate files array in manifest %s", manifest);
+      goto error;
+   }
+
+   while (pgmoneta_json_next_array_item(reader, &entry))
+   {
+      char* path = (char*)pgmoneta_json_get(entry, "Path");
+      char* checksum_algorithm = (char*)pgmoneta_json_get(entry, "Checksum-Algorithm");
+      char* checksum = (char*)pgmoneta_json_get(entry, "Checksum");
+
+      if (path != NULL && checksum != NULL && checksum_algorithm != NULL && !strcasecmp(checksum_algorithm, "SHA256"))
+      {
+         if (pgmoneta_art_insert(manifest_checksums, path, (uintptr_t)checksum, ValueString))
+         {
+            goto error;
+         }
+      }
+
+      pgmoneta_json_destroy(entry);
+      entry = NULL;
+   }
+
+   pgmoneta_json_reader_close(reader);
+   free(manifest);
+
+   return 0;
+
+error:
+   pgmoneta_json_reader_close(reader);
+   pgmoneta_json_destroy(entry);
+   pgmoneta_art_destroy(manifest_checksums);
+   manifest_checksums = NULL;
+   free(manifest);
+
+   return 1;
+}
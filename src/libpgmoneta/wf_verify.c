@@ -28,9 +28,14 @@
 
 /* pgmoneta */
 #include <pgmoneta.h>
+#include <art.h>
 #include <csv.h>
+#include <hashcache.h>
+#include <info.h>
 #include <logging.h>
 #include <management.h>
+#include <manifest.h>
+#include <reader.h>
 #include <security.h>
 #include <utils.h>
 #include <workflow.h>
@@ -38,13 +43,57 @@
 /* system */
 #include <assert.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
+#include <openssl/rand.h>
+#include <sys/stat.h>
+
+/* The number of random draws of a sample, per file of the manifest */
+#define SAMPLE_DRAWS 4
+
+/** @struct sample_file
+ * Defines a file of the manifest for a sampled verify
+ */
+struct sample_file
+{
+   char* name;        /**< The name of the file in the manifest */
+   uint64_t size;     /**< The size of the file in the backup */
+   int64_t verified;  /**< When the file was verified the last time, 0 for never */
+   bool selected;     /**< Is the file verified by this verify */
+};
+
+/* The files verified so far, so an interrupted verify can resume */
+static FILE* checkpoint = NULL;
+static pthread_mutex_t checkpoint_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* A sampled verify reads the files, since it is looking for damage that doesn't change the file */
+static bool hash_cache = false;
+
+/* The chunk hashes of backup.tree, by the name of the file in the manifest */
+static struct art* tree = NULL;
 
 static char* verify_name(void);
 static int verify_execute(char*, struct art*);
 
 static void do_verify(struct worker_common* wc);
+static void verify_result(struct worker_input* wi, char* f, bool failed, char* calculated);
+
+static char* checkpoint_path(int server, char* label);
+static int checkpoint_read(char* path, struct art** verified);
+static void checkpoint_write(char* file, char* calculated);
+
+static int tree_read(char* path, int algorithm, struct art** chunks);
+static void tree_locate(char* f, int algorithm, char* chunks);
+
+static int sample_select(struct csv_reader* csv, char* directory, struct backup* backup, char* coverage_file, struct art* verified, int sample, struct sample_file** files, int* number_of_files, int* draws, struct art** selected);
+static int sample_report(struct art* nodes, char* coverage_file, struct sample_file* files, int number_of_files, int draws, struct deque* failed);
+static int sample_coverage_read(char* path, struct art** coverage);
+static int sample_compare(const void* a, const void* b);
+static void sample_destroy(struct sample_file* files, int number_of_files);
 
 struct workflow*
 pgmoneta_create_verify(void)
@@ -62,6 +111,8 @@ pgmoneta_create_verify(void)
    wf->setup = &pgmoneta_common_setup;
    wf->execute = &verify_execute;
    wf->teardown = &pgmoneta_common_teardown;
+   wf->execute_file = NULL;
+   wf->independent = false;
    wf->next = NULL;
 
    return wf;
@@ -79,14 +130,24 @@ verify_execute(char* name __attribute__((unused)), struct art* nodes)
    int server = -1;
    char* label = NULL;
    char* base = NULL;
+   char* directory = NULL;
    char* info_file = NULL;
    char* manifest_file = NULL;
+   char* checkpoint_file = NULL;
+   char* coverage_file = NULL;
+   char* tree_file = NULL;
+   int sample = 0;
+   int draws = 0;
+   int number_of_sampled = 0;
    int number_of_columns = 0;
    char** columns = NULL;
    int number_of_workers = 0;
    struct backup* backup = NULL;
    struct deque* failed_deque = NULL;
    struct deque* all_deque = NULL;
+   struct art* verified = NULL;
+   struct art* selected = NULL;
+   struct sample_file* sampled = NULL;
    struct csv_reader* csv = NULL;
    struct workers* workers = NULL;
    struct main_configuration* config;
@@ -110,6 +171,12 @@ verify_execute(char* name __attribute__((unused)), struct art* nodes)
    server = (int)pgmoneta_art_search(nodes, NODE_SERVER_ID);
    label = (char*)pgmoneta_art_search(nodes, NODE_LABEL);
 
+   if (pgmoneta_art_contains_key(nodes, USER_SAMPLE))
+   {
+      sample = (int)pgmoneta_art_search(nodes, USER_SAMPLE);
+   }
+   hash_cache = sample == 0;
+
    pgmoneta_log_debug("Verify (execute): %s/%s", config->common.servers[server].name, label);
 
    base = pgmoneta_get_server_backup_identifier(server, (char*)pgmoneta_art_search(nodes, NODE_LABEL));
@@ -128,8 +195,37 @@ verify_execute(char* name __attribute__((unused)), struct art* nodes)
    }
    manifest_file = pgmoneta_append(manifest_file, "backup.manifest");
 
+   coverage_file = pgmoneta_append(coverage_file, base);
+   if (!pgmoneta_ends_with(coverage_file, "/"))
+   {
+      coverage_file = pgmoneta_append(coverage_file, "/");
+   }
+   coverage_file = pgmoneta_append(coverage_file, "verify.coverage");
+
+   tree_file = pgmoneta_append(tree_file, base);
+   if (!pgmoneta_ends_with(tree_file, "/"))
+   {
+      tree_file = pgmoneta_append(tree_file, "/");
+   }
+   tree_file = pgmoneta_append(tree_file, "backup.tree");
+
    pgmoneta_get_backup_file(info_file, &backup);
 
+   if (backup == NULL)
+   {
+      goto error;
+   }
+
+   /* A restored backup has plain files, otherwise the files are read in place */
+   if (pgmoneta_art_contains_key(nodes, NODE_TARGET_BASE))
+   {
+      directory = (char*)pgmoneta_art_search(nodes, NODE_TARGET_BASE);
+   }
+   else
+   {
+      directory = (char*)pgmoneta_art_search(nodes, NODE_BACKUP_DATA);
+   }
+
    if (pgmoneta_deque_create(true, &failed_deque))
    {
       goto error;
@@ -143,10 +239,32 @@ verify_execute(char* name __attribute__((unused)), struct art* nodes)
       }
    }
 
+   checkpoint_file = checkpoint_path(server, label);
+   if (checkpoint_file == NULL)
+   {
+      goto error;
+   }
+
+   if (checkpoint_read(checkpoint_file, &verified))
+   {
+      goto error;
+   }
+
+   if (tree_read(tree_file, backup->hash_algorithm, &tree))
+   {
+      goto error;
+   }
+
+   checkpoint = fopen(checkpoint_file, "a");
+   if (checkpoint == NULL)
+   {
+      pgmoneta_log_warn("Verify: Could not open %s, an interrupted verify will start over", checkpoint_file);
+   }
+
    number_of_workers = pgmoneta_get_number_of_workers(server);
    if (number_of_workers > 0)
    {
-      pgmoneta_workers_initialize(number_of_workers, &workers);
+      pgmoneta_workers_initialize_group((struct workers*)pgmoneta_art_search(nodes, NODE_WORKERS), number_of_workers, &workers);
    }
 
    if (pgmoneta_csv_reader_init(manifest_file, &csv))
@@ -154,14 +272,33 @@ verify_execute(char* name __attribute__((unused)), struct art* nodes)
       goto error;
    }
 
+   if (sample > 0)
+   {
+      if (sample_select(csv, directory, backup, coverage_file, verified, sample, &sampled, &number_of_sampled, &draws, &selected))
+      {
+         goto error;
+      }
+
+      if (pgmoneta_csv_reader_reset(csv))
+      {
+         goto error;
+      }
+   }
+
    while (pgmoneta_csv_next_row(csv, &number_of_columns, &columns))
    {
       struct worker_input* payload = NULL;
       struct json* j = NULL;
+      char* f = NULL;
 
-      if (pgmoneta_create_worker_input(NULL, NULL, NULL, -1, workers, &payload))
+      if (number_of_columns < MANIFEST_COLUMN_COUNT)
       {
-         goto error;
+         continue;
+      }
+
+      if (selected != NULL && !pgmoneta_art_contains_key(selected, columns[MANIFEST_PATH_INDEX]))
+      {
+         continue;
       }
 
       if (pgmoneta_json_create(&j))
@@ -169,11 +306,46 @@ verify_execute(char* name __attribute__((unused)), struct art* nodes)
          goto error;
       }
 
-      pgmoneta_json_put(j, MANAGEMENT_ARGUMENT_DIRECTORY, (uintptr_t)pgmoneta_art_search(nodes, NODE_TARGET_BASE), ValueString);
-      pgmoneta_json_put(j, MANAGEMENT_ARGUMENT_FILENAME, (uintptr_t)columns[0], ValueString);
-      pgmoneta_json_put(j, MANAGEMENT_ARGUMENT_ORIGINAL, (uintptr_t)columns[1], ValueString);
+      pgmoneta_json_put(j, MANAGEMENT_ARGUMENT_DIRECTORY, (uintptr_t)directory, ValueString);
+      pgmoneta_json_put(j, MANAGEMENT_ARGUMENT_FILENAME, (uintptr_t)columns[MANIFEST_PATH_INDEX], ValueString);
+      pgmoneta_json_put(j, MANAGEMENT_ARGUMENT_ORIGINAL, (uintptr_t)columns[MANIFEST_CHECKSUM_INDEX], ValueString);
       pgmoneta_json_put(j, MANAGEMENT_ARGUMENT_HASH_ALGORITHM, (uintptr_t)backup->hash_algorithm, ValueInt32);
 
+      if (pgmoneta_art_contains_key(verified, columns[MANIFEST_PATH_INDEX]))
+      {
+         char* calculated = (char*)pgmoneta_art_search(verified, columns[MANIFEST_PATH_INDEX]);
+         struct worker_input wi;
+
+         memset(&wi, 0, sizeof(struct worker_input));
+         wi.data = j;
+         wi.failed = failed_deque;
+         wi.all = all_deque;
+
+         f = pgmoneta_append(f, directory);
+         if (!pgmoneta_ends_with(f, "/"))
+         {
+            f = pgmoneta_append(f, "/");
+         }
+         f = pgmoneta_append(f, columns[MANIFEST_PATH_INDEX]);
+
+         verify_result(&wi, f, strlen(calculated) > 0, calculated);
+
+         free(f);
+         continue;
+      }
+
+      /* The size of the file orders the work, largest first */
+      f = pgmoneta_backup_file_find(directory, columns[MANIFEST_PATH_INDEX], backup);
+
+      if (pgmoneta_create_worker_input(NULL, f, NULL, -1, workers, &payload))
+      {
+         free(f);
+         pgmoneta_json_destroy(j);
+         goto error;
+      }
+
+      free(f);
+
       payload->data = j;
       payload->failed = failed_deque;
       payload->all = all_deque;
@@ -189,9 +361,6 @@ verify_execute(char* name __attribute__((unused)), struct art* nodes)
       {
          do_verify((struct worker_common*)payload);
       }
-
-      free(columns);
-      columns = NULL;
    }
 
    if (number_of_workers > 0)
@@ -204,6 +373,22 @@ verify_execute(char* name __attribute__((unused)), struct art* nodes)
       pgmoneta_workers_destroy(workers);
    }
 
+   /* Every file has been verified, so the next verify starts over */
+   if (checkpoint != NULL)
+   {
+      fclose(checkpoint);
+      checkpoint = NULL;
+   }
+   pgmoneta_delete_file(checkpoint_file, NULL);
+
+   if (sampled != NULL)
+   {
+      if (sample_report(nodes, coverage_file, sampled, number_of_sampled, draws, failed_deque))
+      {
+         goto error;
+      }
+   }
+
    pgmoneta_deque_list(failed_deque);
    pgmoneta_deque_list(all_deque);
 
@@ -211,12 +396,20 @@ verify_execute(char* name __attribute__((unused)), struct art* nodes)
    pgmoneta_art_insert(nodes, NODE_ALL, (uintptr_t)all_deque, ValueDeque);
 
    pgmoneta_csv_reader_destroy(csv);
+   pgmoneta_art_destroy(verified);
+   pgmoneta_art_destroy(selected);
+   pgmoneta_art_destroy(tree);
+   tree = NULL;
+   sample_destroy(sampled, number_of_sampled);
 
    free(backup);
 
    free(base);
    free(info_file);
    free(manifest_file);
+   free(checkpoint_file);
+   free(coverage_file);
+   free(tree_file);
 
    return 0;
 
@@ -227,6 +420,12 @@ error:
       pgmoneta_workers_destroy(workers);
    }
 
+   if (checkpoint != NULL)
+   {
+      fclose(checkpoint);
+      checkpoint = NULL;
+   }
+
    pgmoneta_art_insert(nodes, NODE_FAILED, (uintptr_t)NULL, ValueDeque);
    pgmoneta_art_insert(nodes, NODE_ALL, (uintptr_t)NULL, ValueDeque);
 
@@ -234,12 +433,20 @@ error:
    pgmoneta_deque_destroy(all_deque);
 
    pgmoneta_csv_reader_destroy(csv);
+   pgmoneta_art_destroy(verified);
+   pgmoneta_art_destroy(selected);
+   pgmoneta_art_destroy(tree);
+   tree = NULL;
+   sample_destroy(sampled, number_of_sampled);
 
    free(backup);
 
    free(base);
    free(info_file);
    free(manifest_file);
+   free(checkpoint_file);
+   free(coverage_file);
+   free(tree_file);
 
    return 1;
 }
@@ -251,10 +458,12 @@ do_verify(struct worker_common* wc)
    char* f = NULL;
    char* hash_cal = NULL;
    bool failed = false;
-   int ha = 0;
    struct json* j = NULL;
+   struct stat st;
+   int algorithm;
 
    j = wi->data;
+   algorithm = (int)pgmoneta_json_get(j, MANAGEMENT_ARGUMENT_HASH_ALGORITHM);
 
    f = pgmoneta_append(f, (char*)pgmoneta_json_get(j, MANAGEMENT_ARGUMENT_DIRECTORY));
    if (!pgmoneta_ends_with(f, "/"))
@@ -263,130 +472,689 @@ do_verify(struct worker_common* wc)
    }
    f = pgmoneta_append(f, (char*)pgmoneta_json_get(j, MANAGEMENT_ARGUMENT_FILENAME));
 
-   if (!pgmoneta_exists(f))
+   /* A file that is unchanged since it was hashed, like a file linked from another backup, isn't read again */
+   if (hash_cache && strlen(wi->from) > 0)
+   {
+      pgmoneta_hashcache_lookup(wi->from, algorithm, &hash_cal);
+   }
+
+   if (hash_cal == NULL)
+   {
+      if (strlen(wi->from) == 0 || stat(wi->from, &st) || pgmoneta_reader_hash(wi->from, algorithm, false, NULL, &hash_cal))
+      {
+         failed = true;
+      }
+      else if (hash_cache)
+      {
+         pgmoneta_hashcache_store(wi->from, &st, algorithm, hash_cal);
+      }
+   }
+
+   if (!failed && strcmp(hash_cal, (char*)pgmoneta_json_get(j, MANAGEMENT_ARGUMENT_ORIGINAL)))
+   {
+      failed = true;
+   }
+
+   /* The chunk hashes of a plain file tell where it is damaged */
+   if (failed && tree != NULL && strlen(wi->from) > 0 && !strcmp(wi->from, f) &&
+       pgmoneta_art_contains_key(tree, (char*)pgmoneta_json_get(j, MANAGEMENT_ARGUMENT_FILENAME)))
+   {
+      tree_locate(f, algorithm, (char*)pgmoneta_art_search(tree, (char*)pgmoneta_json_get(j, MANAGEMENT_ARGUMENT_FILENAME)));
+   }
+
+   verify_result(wi, f, failed, failed ? (hash_cal != NULL && strlen(hash_cal) > 0 ? hash_cal : "Unknown") : "");
+
+   wi->data = NULL;
+   wi->failed = NULL;
+   wi->all = NULL;
+
+   free(hash_cal);
+   free(f);
+   free(wi);
+}
+
+/**
+ * Record the result of a file
+ * @param wi The worker input, whose data is taken over
+ * @param f The path of the file
+ * @param failed Did the verification fail
+ * @param calculated The calculated hash of a failed file
+ */
+static void
+verify_result(struct worker_input* wi, char* f, bool failed, char* calculated)
+{
+   struct json* j = wi->data;
+
+   checkpoint_write((char*)pgmoneta_json_get(j, MANAGEMENT_ARGUMENT_FILENAME), failed ? calculated : "");
+
+   if (failed)
+   {
+      pgmoneta_json_put(j, MANAGEMENT_ARGUMENT_CALCULATED, (uintptr_t)calculated, ValueString);
+      pgmoneta_deque_add(wi->failed, f, (uintptr_t)j, ValueJSON);
+   }
+   else if (wi->all != NULL)
+   {
+      pgmoneta_deque_add(wi->all, f, (uintptr_t)j, ValueJSON);
+   }
+   else
+   {
+      pgmoneta_json_destroy(j);
+   }
+
+   wi->data = NULL;
+}
+
+/**
+ * Read the chunk hashes of backup.tree
+ * @param path The path of backup.tree
+ * @param algorithm The hash algorithm of the backup
+ * @param chunks [out] The chunk hashes by the name of the file, or NULL if there is no backup.tree
+ * @return 0 on success, otherwise 1
+ */
+static int
+tree_read(char* path, int algorithm, struct art** chunks)
+{
+   int number_of_columns = 0;
+   char** columns = NULL;
+   struct csv_reader* reader = NULL;
+   struct art* c = NULL;
+
+   *chunks = NULL;
+
+   if (!pgmoneta_exists(path))
+   {
+      return 0;
+   }
+
+   if (pgmoneta_csv_reader_init(path, &reader))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_art_create(&c))
    {
       goto error;
    }
 
-   ha = (int)pgmoneta_json_get(j, MANAGEMENT_ARGUMENT_HASH_ALGORITHM);
-   if (ha == HASH_ALGORITHM_SHA256)
+   while (pgmoneta_csv_next_row(reader, &number_of_columns, &columns))
    {
-      if (!pgmoneta_create_sha256_file(f, &hash_cal))
+      if (number_of_columns < 5)
       {
-         if (strcmp(hash_cal, (char*)pgmoneta_json_get(j, MANAGEMENT_ARGUMENT_ORIGINAL)))
-         {
-            failed = true;
-         }
+         continue;
       }
-      else
+
+      /* Chunks of another algorithm or size can't be compared */
+      if (atoi(columns[1]) != algorithm || atoi(columns[2]) != TREE_HASH_CHUNK_SIZE)
       {
-         failed = true;
+         continue;
       }
+
+      pgmoneta_art_insert(c, columns[0], (uintptr_t)columns[4], ValueString);
    }
-   else if (ha == HASH_ALGORITHM_SHA384)
+
+   pgmoneta_csv_reader_destroy(reader);
+
+   *chunks = c;
+
+   return 0;
+
+error:
+
+   pgmoneta_csv_reader_destroy(reader);
+   pgmoneta_art_destroy(c);
+
+   return 1;
+}
+
+/**
+ * Log the chunks of a failed file that don't match backup.tree
+ * @param f The path of the file
+ * @param algorithm The hash algorithm
+ * @param chunks The chunk hashes of backup.tree
+ */
+static void
+tree_locate(char* f, int algorithm, char* chunks)
+{
+   char* root = NULL;
+   char* calculated = NULL;
+   char* expected_save = NULL;
+   char* calculated_save = NULL;
+   char* expected = NULL;
+   char* e = NULL;
+   char* c = NULL;
+   uint64_t chunk = 0;
+   int damaged = 0;
+
+   /* The file is hashed on this worker, since it already runs on the pool */
+   if (pgmoneta_create_file_tree_hash(algorithm, f, 1, &root, &calculated))
+   {
+      goto done;
+   }
+
+   expected = strdup(chunks);
+   if (expected == NULL)
    {
-      if (!pgmoneta_create_sha384_file(f, &hash_cal))
+      goto done;
+   }
+
+   e = strtok_r(expected, ":", &expected_save);
+   c = strtok_r(calculated, ":", &calculated_save);
+
+   while (e != NULL || c != NULL)
+   {
+      if (e == NULL || c == NULL || strcmp(e, c))
       {
-         if (strcmp(hash_cal, (char*)pgmoneta_json_get(j, MANAGEMENT_ARGUMENT_ORIGINAL)))
-         {
-            failed = true;
-         }
+         pgmoneta_log_warn("Verify: %s is damaged at bytes %" PRIu64 " - %" PRIu64,
+                           f, chunk * TREE_HASH_CHUNK_SIZE, (chunk + 1) * TREE_HASH_CHUNK_SIZE - 1);
+         damaged++;
       }
-      else
+
+      e = e != NULL ? strtok_r(NULL, ":", &expected_save) : NULL;
+      c = c != NULL ? strtok_r(NULL, ":", &calculated_save) : NULL;
+      chunk++;
+   }
+
+   if (damaged == 0)
+   {
+      pgmoneta_log_warn("Verify: %s has the chunks of backup.tree", f);
+   }
+
+done:
+
+   free(root);
+   free(calculated);
+   free(expected);
+}
+
+static char*
+checkpoint_path(int server, char* label)
+{
+   char* path = NULL;
+
+   path = pgmoneta_get_server_workspace(server);
+   if (path == NULL)
+   {
+      return NULL;
+   }
+
+   path = pgmoneta_append(path, label);
+   path = pgmoneta_append(path, ".verify");
+
+   return path;
+}
+
+/**
+ * Read the files verified by an interrupted verify. Each line holds the
+ * file and, if it failed, its calculated hash
+ * @param path The path of the checkpoint
+ * @param verified [out] The verified files
+ * @return 0 upon success, otherwise 1
+ */
+static int
+checkpoint_read(char* path, struct art** verified)
+{
+   int number_of_columns = 0;
+   char** columns = NULL;
+   struct art* v = NULL;
+   struct csv_reader* csv = NULL;
+
+   *verified = NULL;
+
+   if (pgmoneta_art_create(&v))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_exists(path) && !pgmoneta_csv_reader_init(path, &csv))
+   {
+      while (pgmoneta_csv_next_row(csv, &number_of_columns, &columns))
       {
-         failed = true;
+         /* A line cut short by the interruption has no separator */
+         if (number_of_columns == 2 && strlen(columns[0]) > 0)
+         {
+            pgmoneta_art_insert(v, columns[0], (uintptr_t)columns[1], ValueString);
+         }
       }
+
+      pgmoneta_log_info("Verify: Resuming from %s", path);
+   }
+
+   pgmoneta_csv_reader_destroy(csv);
+
+   *verified = v;
+
+   return 0;
+
+error:
+
+   pgmoneta_art_destroy(v);
+
+   return 1;
+}
+
+static void
+checkpoint_write(char* file, char* calculated)
+{
+   pthread_mutex_lock(&checkpoint_lock);
+
+   if (checkpoint != NULL)
+   {
+      fprintf(checkpoint, "%s,%s\n", file, calculated);
+      fflush(checkpoint);
+   }
+
+   pthread_mutex_unlock(&checkpoint_lock);
+}
+
+/**
+ * Select the files of a sampled verify. Half of the bytes rotate through the
+ * files that were verified the longest ago, so every file is verified in turn,
+ * and the other half is drawn at random weighted by size
+ * @param csv The manifest
+ * @param directory The directory of the files
+ * @param backup The backup
+ * @param coverage_file The path of the coverage
+ * @param verified The files verified by an interrupted verify
+ * @param sample The percentage of the bytes to verify
+ * @param files [out] The files of the manifest
+ * @param number_of_files [out] The number of files
+ * @param draws [out] The number of random draws
+ * @param selected [out] The files to verify
+ * @return 0 upon success, otherwise 1
+ */
+static int
+sample_select(struct csv_reader* csv, char* directory, struct backup* backup, char* coverage_file, struct art* verified, int sample, struct sample_file** files, int* number_of_files, int* draws, struct art** selected)
+{
+   int number_of_columns = 0;
+   char** columns = NULL;
+   int n = 0;
+   int capacity = 0;
+   int m = 0;
+   uint64_t total = 0;
+   uint64_t budget = 0;
+   uint64_t used = 0;
+   uint64_t* offsets = NULL;
+   struct sample_file* sf = NULL;
+   struct sample_file** order = NULL;
+   struct art* coverage = NULL;
+   struct art* s = NULL;
+
+   *files = NULL;
+   *number_of_files = 0;
+   *draws = 0;
+   *selected = NULL;
+
+   if (sample_coverage_read(coverage_file, &coverage))
+   {
+      goto error;
    }
-   else if (ha == HASH_ALGORITHM_SHA512)
+
+   while (pgmoneta_csv_next_row(csv, &number_of_columns, &columns))
    {
-      if (!pgmoneta_create_sha512_file(f, &hash_cal))
+      char* f = NULL;
+
+      if (number_of_columns < MANIFEST_COLUMN_COUNT)
       {
-         if (strcmp(hash_cal, (char*)pgmoneta_json_get(j, MANAGEMENT_ARGUMENT_ORIGINAL)))
+         continue;
+      }
+
+      if (n == capacity)
+      {
+         struct sample_file* tmp = NULL;
+
+         capacity = capacity == 0 ? 1024 : capacity * 2;
+         tmp = (struct sample_file*)realloc(sf, capacity * sizeof(struct sample_file));
+         if (tmp == NULL)
          {
-            failed = true;
+            goto error;
          }
+         sf = tmp;
+      }
+
+      memset(&sf[n], 0, sizeof(struct sample_file));
+
+      sf[n].name = strdup(columns[MANIFEST_PATH_INDEX]);
+      if (sf[n].name == NULL)
+      {
+         goto error;
+      }
+
+      f = pgmoneta_backup_file_find(directory, sf[n].name, backup);
+      if (f != NULL)
+      {
+         sf[n].size = pgmoneta_get_file_size(f);
       }
       else
       {
-         failed = true;
+         /* A missing file is always reported */
+         sf[n].selected = true;
       }
+      free(f);
+
+      if (pgmoneta_art_contains_key(coverage, sf[n].name))
+      {
+         sf[n].verified = strtoll((char*)pgmoneta_art_search(coverage, sf[n].name), NULL, 10);
+      }
+
+      if (pgmoneta_art_contains_key(verified, sf[n].name))
+      {
+         sf[n].selected = true;
+      }
+
+      if (sf[n].selected)
+      {
+         used += sf[n].size;
+      }
+
+      total += sf[n].size;
+      n++;
    }
-   else if (ha == HASH_ALGORITHM_SHA224)
+
+   budget = total / 100 * sample + total % 100 * sample / 100;
+
+   if (n > 0)
    {
-      if (!pgmoneta_create_sha224_file(f, &hash_cal))
+      order = (struct sample_file**)malloc(n * sizeof(struct sample_file*));
+      offsets = (uint64_t*)malloc(n * sizeof(uint64_t));
+
+      if (order == NULL || offsets == NULL)
+      {
+         goto error;
+      }
+
+      for (int i = 0; i < n; i++)
+      {
+         order[i] = &sf[i];
+         offsets[i] = (i > 0 ? offsets[i - 1] : 0) + sf[i].size;
+      }
+
+      qsort(order, n, sizeof(struct sample_file*), sample_compare);
+
+      for (int i = 0; i < n && used < budget / 2; i++)
       {
-         if (strcmp(hash_cal, (char*)pgmoneta_json_get(j, MANAGEMENT_ARGUMENT_ORIGINAL)))
+         if (!order[i]->selected)
          {
-            failed = true;
+            order[i]->selected = true;
+            used += order[i]->size;
          }
       }
-      else
+
+      /* A draw picks a byte, so the draws are an unbiased sample of the bytes */
+      while (total > 0 && used < budget && m < n * SAMPLE_DRAWS)
       {
-         failed = true;
+         uint64_t r = 0;
+         int low = 0;
+         int high = n - 1;
+
+         if (RAND_bytes((unsigned char*)&r, sizeof(r)) != 1)
+         {
+            goto error;
+         }
+
+         r %= total;
+
+         while (low < high)
+         {
+            int middle = low + (high - low) / 2;
+
+            if (offsets[middle] > r)
+            {
+               high = middle;
+            }
+            else
+            {
+               low = middle + 1;
+            }
+         }
+
+         m++;
+
+         if (!sf[low].selected)
+         {
+            sf[low].selected = true;
+            used += sf[low].size;
+         }
       }
-   }
-   else if (ha == HASH_ALGORITHM_CRC32C)
-   {
-      if (!pgmoneta_create_crc32c_file(f, &hash_cal))
+
+      /* The rotation fills up what the draws didn't reach */
+      for (int i = 0; i < n && used < budget; i++)
       {
-         if (strcmp(hash_cal, (char*)pgmoneta_json_get(j, MANAGEMENT_ARGUMENT_ORIGINAL)))
+         if (!order[i]->selected)
          {
-            failed = true;
+            order[i]->selected = true;
+            used += order[i]->size;
          }
       }
-      else
+   }
+
+   if (pgmoneta_art_create(&s))
+   {
+      goto error;
+   }
+
+   for (int i = 0; i < n; i++)
+   {
+      if (sf[i].selected)
       {
-         failed = true;
+         pgmoneta_art_insert(s, sf[i].name, (uintptr_t)i, ValueInt32);
       }
    }
-   else
+
+   pgmoneta_log_debug("Verify: Sampled %" PRIu64 " of %" PRIu64 " bytes with %d draws", used, total, m);
+
+   pgmoneta_art_destroy(coverage);
+
+   free(order);
+   free(offsets);
+
+   *files = sf;
+   *number_of_files = n;
+   *draws = m;
+   *selected = s;
+
+   return 0;
+
+error:
+
+   pgmoneta_art_destroy(coverage);
+   pgmoneta_art_destroy(s);
+
+   sample_destroy(sf, n);
+
+   free(order);
+   free(offsets);
+
+   return 1;
+}
+
+/**
+ * Store when the files were verified, and report the coverage of the sample,
+ * the number of days it takes to rotate through all files, and the confidence
+ * that less than 1% of the bytes are damaged
+ * @param nodes The nodes
+ * @param coverage_file The path of the coverage
+ * @param files The files of the manifest
+ * @param number_of_files The number of files
+ * @param draws The number of random draws
+ * @param failed The failed files
+ * @return 0 upon success, otherwise 1
+ */
+static int
+sample_report(struct art* nodes, char* coverage_file, struct sample_file* files, int number_of_files, int draws, struct deque* failed)
+{
+   int64_t now = (int64_t)time(NULL);
+   int64_t oldest = now;
+   uint64_t total = 0;
+   uint64_t bytes = 0;
+   double missed = 1.0;
+   char* tmp = NULL;
+   char verified[MISC_LENGTH];
+   char* row[2];
+   struct art* failures = NULL;
+   struct deque_iterator* iter = NULL;
+   struct csv_writer* writer = NULL;
+   struct json* result = NULL;
+
+   if (pgmoneta_art_create(&failures))
    {
       goto error;
    }
 
-   if (failed)
+   if (pgmoneta_deque_iterator_create(failed, &iter))
    {
-      if (hash_cal != NULL && strlen(hash_cal) > 0)
+      goto error;
+   }
+
+   while (pgmoneta_deque_iterator_next(iter))
+   {
+      struct json* j = (struct json*)pgmoneta_value_data(iter->value);
+
+      pgmoneta_art_insert(failures, (char*)pgmoneta_json_get(j, MANAGEMENT_ARGUMENT_FILENAME), (uintptr_t)1, ValueInt32);
+   }
+
+   tmp = pgmoneta_append(tmp, coverage_file);
+   tmp = pgmoneta_append(tmp, ".tmp");
+
+   if (pgmoneta_csv_writer_init(tmp, &writer))
+   {
+      pgmoneta_log_warn("Verify: Could not write %s", tmp);
+      goto error;
+   }
+
+   for (int i = 0; i < number_of_files; i++)
+   {
+      total += files[i].size;
+
+      if (files[i].selected)
       {
-         pgmoneta_json_put(j, MANAGEMENT_ARGUMENT_CALCULATED, (uintptr_t)hash_cal, ValueString);
+         bytes += files[i].size;
+
+         /* A failed file is verified again by the next sample */
+         if (!pgmoneta_art_contains_key(failures, files[i].name))
+         {
+            files[i].verified = now;
+         }
       }
-      else
+
+      if (files[i].verified < oldest)
       {
-         failed = true;
-         pgmoneta_json_put(j, MANAGEMENT_ARGUMENT_CALCULATED, (uintptr_t)"Unknown", ValueString);
+         oldest = files[i].verified;
       }
 
-      pgmoneta_deque_add(wi->failed, f, (uintptr_t)j, ValueJSON);
+      if (files[i].verified > 0)
+      {
+         memset(&verified[0], 0, sizeof(verified));
+         snprintf(&verified[0], sizeof(verified), "%" PRId64, files[i].verified);
+
+         row[0] = files[i].name;
+         row[1] = &verified[0];
+
+         pgmoneta_csv_write(writer, 2, row);
+      }
    }
-   else if (wi->all != NULL)
+
+   pgmoneta_csv_writer_destroy(writer);
+   writer = NULL;
+
+   if (rename(tmp, coverage_file))
    {
-      pgmoneta_deque_add(wi->all, f, (uintptr_t)j, ValueJSON);
+      goto error;
    }
-   else
+
+   for (int i = 0; i < draws; i++)
    {
-      pgmoneta_json_destroy(j);
+      missed *= 0.99;
    }
 
-   wi->data = NULL;
-   wi->failed = NULL;
-   wi->all = NULL;
+   if (pgmoneta_json_create(&result))
+   {
+      goto error;
+   }
 
-   free(hash_cal);
-   free(f);
-   free(wi);
+   pgmoneta_json_put(result, MANAGEMENT_ARGUMENT_COVERAGE, (uintptr_t)pgmoneta_value_from_double(total > 0 ? 100.0 * bytes / total : 100.0), ValueDouble);
+   pgmoneta_json_put(result, MANAGEMENT_ARGUMENT_ROTATION, (uintptr_t)(oldest > 0 ? (int32_t)((now - oldest) / 86400) : -1), ValueInt32);
+   pgmoneta_json_put(result, MANAGEMENT_ARGUMENT_CONFIDENCE, (uintptr_t)pgmoneta_value_from_double(pgmoneta_deque_size(failed) == 0 ? 100.0 * (1.0 - missed) : 0.0), ValueDouble);
+
+   pgmoneta_art_insert(nodes, NODE_SAMPLE, (uintptr_t)result, ValueJSON);
+
+   pgmoneta_deque_iterator_destroy(iter);
+   pgmoneta_art_destroy(failures);
 
-   return;
+   free(tmp);
+
+   return 0;
 
 error:
-   pgmoneta_log_error("Unable to calculate hash for %s", f);
 
-   pgmoneta_json_destroy(wi->data);
+   pgmoneta_csv_writer_destroy(writer);
+   pgmoneta_deque_iterator_destroy(iter);
+   pgmoneta_art_destroy(failures);
 
-   wi->data = NULL;
-   wi->failed = NULL;
-   wi->all = NULL;
+   free(tmp);
 
-   free(hash_cal);
-   free(f);
-   free(wi);
+   return 1;
+}
+
+static int
+sample_coverage_read(char* path, struct art** coverage)
+{
+   int number_of_columns = 0;
+   char** columns = NULL;
+   struct art* c = NULL;
+   struct csv_reader* csv = NULL;
+
+   *coverage = NULL;
+
+   if (pgmoneta_art_create(&c))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_exists(path) && !pgmoneta_csv_reader_init(path, &csv))
+   {
+      while (pgmoneta_csv_next_row(csv, &number_of_columns, &columns))
+      {
+         if (number_of_columns == 2)
+         {
+            pgmoneta_art_insert(c, columns[0], (uintptr_t)columns[1], ValueString);
+         }
+      }
+   }
+
+   pgmoneta_csv_reader_destroy(csv);
+
+   *coverage = c;
+
+   return 0;
+
+error:
+
+   pgmoneta_art_destroy(c);
+
+   return 1;
+}
+
+static int
+sample_compare(const void* a, const void* b)
+{
+   struct sample_file* fa = *(struct sample_file**)a;
+   struct sample_file* fb = *(struct sample_file**)b;
+
+   if (fa->verified != fb->verified)
+   {
+      return fa->verified < fb->verified ? -1 : 1;
+   }
+
+   return strcmp(fa->name, fb->name);
+}
+
+static void
+sample_destroy(struct sample_file* files, int number_of_files)
+{
+   for (int i = 0; i < number_of_files; i++)
+   {
+      free(files[i].name);
+   }
+
+   free(files);
 }
@@ -28,6 +28,9 @@
 
 /* pgmoneta */
 #include <pgmoneta.h>
+#include <aes.h>
+#include <compression.h>
+#include <info.h>
 #include <logging.h>
 #include <utils.h>
 #include <zstandard_compression.h>
@@ -41,6 +44,7 @@
 static char* zstd_name(void);
 static int zstd_execute_compress(char*, struct art*);
 static int zstd_execute_uncompress(char*, struct art*);
+static int zstd_controller(int server, char* label, int threads, struct compression_controller** controller);
 
 struct workflow*
 pgmoneta_create_zstd(bool compress)
@@ -67,6 +71,8 @@ pgmoneta_create_zstd(bool compress)
    }
 
    wf->teardown = &pgmoneta_common_teardown;
+   wf->execute_file = NULL;
+   wf->independent = false;
    wf->next = NULL;
 
    return wf;
@@ -95,6 +101,9 @@ zstd_execute_compress(char* name __attribute__((unused)), struct art* nodes)
    double seconds;
    char elapsed[128];
    int number_of_workers = 0;
+   bool encrypt = false;
+   struct compression_controller* controller = NULL;
+   struct info_batch* info = NULL;
    struct workers* workers = NULL;
    struct main_configuration* config;
 
@@ -131,14 +140,34 @@ zstd_execute_compress(char* name __attribute__((unused)), struct art* nodes)
       number_of_workers = pgmoneta_get_number_of_workers(server);
       if (number_of_workers > 0)
       {
-         pgmoneta_workers_initialize(number_of_workers, &workers);
+         pgmoneta_workers_initialize_group((struct workers*)pgmoneta_art_search(nodes, NODE_WORKERS), number_of_workers, &workers);
       }
 
       backup_base = (char*)pgmoneta_art_search(nodes, NODE_BACKUP_BASE);
       backup_data = (char*)pgmoneta_art_search(nodes, NODE_BACKUP_DATA);
 
-      pgmoneta_zstandardc_data(backup_data, workers);
-      pgmoneta_zstandardc_tablespaces(backup_base, workers);
+      /* An encryption step follows, so encrypt the compressed stream directly */
+      if (pgmoneta_art_contains_key(nodes, NODE_BACKUP))
+      {
+         encrypt = pgmoneta_encrypt_stream_supported(((struct backup*)pgmoneta_art_search(nodes, NODE_BACKUP))->encryption);
+      }
+      else
+      {
+         encrypt = pgmoneta_encrypt_stream_supported(config->encryption);
+      }
+
+      if (encrypt)
+      {
+         pgmoneta_encrypt_key_cache_acquire();
+      }
+
+      if (config->compression_adaptive)
+      {
+         zstd_controller(server, label, number_of_workers, &controller);
+      }
+
+      pgmoneta_zstandardc_data(backup_data, encrypt, controller, workers);
+      pgmoneta_zstandardc_tablespaces(backup_base, encrypt, controller, workers);
 
       if (number_of_workers > 0)
       {
@@ -149,6 +178,26 @@ zstd_execute_compress(char* name __attribute__((unused)), struct art* nodes)
          }
          pgmoneta_workers_destroy(workers);
       }
+
+      if (encrypt)
+      {
+         pgmoneta_encrypt_key_cache_release();
+      }
+
+      if (controller != NULL)
+      {
+         pgmoneta_log_debug("Compression: %s/%s (Level: %d - %d)", config->common.servers[server].name, label,
+                            controller->lowest, controller->highest);
+         if (!pgmoneta_info_begin(backup_base, &info))
+         {
+            pgmoneta_info_set_unsigned_long(info, INFO_COMPRESSION_LEVEL_MIN, controller->lowest);
+            pgmoneta_info_set_unsigned_long(info, INFO_COMPRESSION_LEVEL_MAX, controller->highest);
+            pgmoneta_info_commit(info);
+         }
+         atomic_store(&config->common.servers[server].compression_level, 0);
+         pgmoneta_compression_controller_destroy(controller);
+         controller = NULL;
+      }
    }
    else
    {
@@ -196,6 +245,17 @@ error:
       pgmoneta_workers_destroy(workers);
    }
 
+   if (controller != NULL)
+   {
+      atomic_store(&config->common.servers[server].compression_level, 0);
+      pgmoneta_compression_controller_destroy(controller);
+   }
+
+   if (encrypt)
+   {
+      pgmoneta_encrypt_key_cache_release();
+   }
+
    free(d);
 
    return 1;
@@ -252,7 +312,7 @@ zstd_execute_uncompress(char* name __attribute__((unused)), struct art* nodes)
    number_of_workers = pgmoneta_get_number_of_workers(server);
    if (number_of_workers > 0)
    {
-      pgmoneta_workers_initialize(number_of_workers, &workers);
+      pgmoneta_workers_initialize_group((struct workers*)pgmoneta_art_search(nodes, NODE_WORKERS), number_of_workers, &workers);
    }
 
    pgmoneta_zstandardd_directory(base, workers);
@@ -288,3 +348,62 @@ error:
 
    return 1;
 }
+
+static int
+zstd_controller(int server, char* label, int threads, struct compression_controller** controller)
+{
+   char* server_backup = NULL;
+   int level;
+   double target = 0;
+   struct backup* backup = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   *controller = NULL;
+
+   level = config->compression_level;
+   if (level < 1)
+   {
+      level = 1;
+   }
+   else if (level > 19)
+   {
+      level = 19;
+   }
+
+   /* Keep up with the rate the base backup was received at */
+   server_backup = pgmoneta_get_server_backup(server);
+   if (server_backup != NULL && pgmoneta_get_backup(server_backup, label, &backup) == 0 && backup != NULL)
+   {
+      if (backup->basebackup_elapsed_time > 0)
+      {
+         target = backup->restore_size / backup->basebackup_elapsed_time;
+      }
+   }
+
+   if (target <= 0)
+   {
+      pgmoneta_log_debug("Compression: %s/%s has no ingest rate, using level %d",
+                         config->common.servers[server].name, label, level);
+   }
+
+   if (pgmoneta_compression_controller_create(server, 1, level, target, threads, controller))
+   {
+      goto error;
+   }
+
+   atomic_store(&config->common.servers[server].compression_level, level);
+
+   free(backup);
+   free(server_backup);
+
+   return 0;
+
+error:
+
+   free(backup);
+   free(server_backup);
+
+   return 1;
+}
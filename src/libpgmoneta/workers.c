@@ -28,33 +28,54 @@
 
 #include <pgmoneta.h>
 #include <logging.h>
+#include <memory.h>
+#include <trace.h>
+#include <utils.h>
 #include <workers.h>
 
 #include <errno.h>
 #include <signal.h>
+#include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 #ifdef HAVE_LINUX
 #include <sys/sysinfo.h>
 #endif
 
-static volatile int worker_keepalive;
+#define WORKER_QUEUE_CAPACITY 64
+#define WORKER_MAX_OUTSTANDING 256
 
-static int worker_init(struct workers* workers, struct worker** worker);
-static void* worker_do(struct worker* worker);
-static void worker_destroy(struct worker* worker);
+/* The upper bounds of the histogram buckets in microseconds, the last bucket has none */
+static const uint64_t histogram_bounds[WORKERS_HISTOGRAM_BUCKETS - 1] = {
+   1000, 10000, 100000, 1000000, 10000000, 60000000, 600000000
+};
 
-static int queue_init(struct queue* queue);
-static void queue_clear(struct queue* queue);
-static void queue_push(struct queue* queue, struct task* task);
-static struct task* queue_pull(struct queue* queue);
-static void queue_destroy(struct queue* queue);
+static _Thread_local struct worker_context worker_contexts[WORKER_CONTEXT_SIZE];
+static _Thread_local struct worker* current_worker = NULL;
 
-static int semaphore_init(struct semaphore* semaphore, int value);
-static void semaphore_reset(struct semaphore* semaphore);
-static void semaphore_post(struct semaphore* semaphore);
-static void semaphore_post_all(struct semaphore* semaphore);
-static void semaphore_wait(struct semaphore* semaphore);
+static int worker_init(struct workers* workers, int index, struct worker** worker);
+static void* worker_do(struct worker* worker);
+static bool worker_take(struct worker* worker, struct task* task);
+static void worker_sleep(struct workers* workers);
+static void worker_destroy(struct worker* worker);
+static void task_execute(struct workers* pool, struct worker* worker, struct task* task);
+static void task_reserve(struct workers* workers);
+static int task_limit(struct workers* workers);
+static void task_done(struct workers* owner);
+static size_t task_size(const struct task* task);
+static void statistics_record(struct workers_statistics* statistics, uint64_t wait, uint64_t execute, size_t bytes);
+static int histogram_bucket(uint64_t time);
+static uint64_t now_microseconds(void);
+static int task_hold(struct workers* workers, struct task* task);
+static void task_release(struct workers* workers);
+static int task_compare(const void* a, const void* b);
+
+static int queue_init(struct worker_queue* queue);
+static int queue_push(struct worker_queue* queue, struct task* task);
+static int queue_push_batch(struct worker_queue* queue, struct task* tasks, size_t number);
+static bool queue_pop(struct worker_queue* queue, struct task* task);
+static bool queue_steal(struct worker_queue* queue, struct task* task);
+static void queue_destroy(struct worker_queue* queue);
 
 int
 pgmoneta_workers_initialize(int num, struct workers** workers)
@@ -63,8 +84,6 @@ pgmoneta_workers_initialize(int num, struct workers** workers)
 
    *workers = NULL;
 
-   worker_keepalive = 1;
-
    if (num < 1)
    {
       goto error;
@@ -77,17 +96,18 @@ pgmoneta_workers_initialize(int num, struct workers** workers)
       goto error;
    }
 
+   memset(w, 0, sizeof(struct workers));
+
    w->number_of_alive = 0;
-   w->number_of_working = 0;
+   atomic_init(&w->number_of_pending, 0);
+   atomic_init(&w->number_of_outstanding, 0);
+   atomic_init(&w->number_of_sleeping, 0);
+   atomic_init(&w->next, 0);
+   atomic_init(&w->keepalive, true);
+   w->started = now_microseconds();
    w->outcome = true;
 
-   if (queue_init(&w->queue))
-   {
-      pgmoneta_log_error("Could not allocate memory for queue");
-      goto error;
-   }
-
-   w->worker = (struct worker**)malloc(num * sizeof(struct worker*));
+   w->worker = (struct worker**)calloc(num, sizeof(struct worker*));
    if (w->worker == NULL)
    {
       pgmoneta_log_error("Could not allocate memory for workers");
@@ -95,17 +115,34 @@ pgmoneta_workers_initialize(int num, struct workers** workers)
    }
 
    pthread_mutex_init(&(w->worker_lock), NULL);
+   pthread_cond_init(&w->has_tasks, NULL);
    pthread_cond_init(&w->worker_all_idle, NULL);
+   pthread_cond_init(&w->has_space, NULL);
+   w->max_outstanding = num * WORKER_MAX_OUTSTANDING;
 
+   /* All queues must exist before any worker starts to steal */
    for (int n = 0; n < num; n++)
    {
-      worker_init(w, &w->worker[n]);
+      if (worker_init(w, n, &w->worker[n]))
+      {
+         goto error;
+      }
+      w->number_of_workers++;
    }
 
+   for (int n = 0; n < num; n++)
+   {
+      pthread_create(&w->worker[n]->pthread, NULL, (void* (*)(void*)) worker_do, w->worker[n]);
+   }
+
+   pthread_mutex_lock(&w->worker_lock);
    while (w->number_of_alive != num)
    {
+      pthread_mutex_unlock(&w->worker_lock);
       SLEEP(10);
+      pthread_mutex_lock(&w->worker_lock);
    }
+   pthread_mutex_unlock(&w->worker_lock);
 
    *workers = w;
 
@@ -115,31 +152,110 @@ error:
 
    if (w != NULL)
    {
-      queue_destroy(&w->queue);
+      for (int n = 0; n < w->number_of_workers; n++)
+      {
+         worker_destroy(w->worker[n]);
+      }
+      free(w->worker);
       free(w);
    }
 
    return 1;
 }
 
+int
+pgmoneta_workers_initialize_group(struct workers* pool, int num, struct workers** workers)
+{
+   struct workers* w = NULL;
+
+   *workers = NULL;
+
+   if (pool == NULL)
+   {
+      return pgmoneta_workers_initialize(num, workers);
+   }
+
+   w = (struct workers*)malloc(sizeof(struct workers));
+   if (w == NULL)
+   {
+      pgmoneta_log_error("Could not allocate memory for worker group");
+      goto error;
+   }
+
+   memset(w, 0, sizeof(struct workers));
+
+   w->pool = pool;
+   w->number_of_workers = pool->number_of_workers;
+   w->number_of_alive = pool->number_of_alive;
+   atomic_init(&w->number_of_outstanding, 0);
+   atomic_init(&w->keepalive, true);
+   w->ordered = true;
+   w->outcome = true;
+
+   pthread_mutex_init(&w->worker_lock, NULL);
+   pthread_cond_init(&w->worker_all_idle, NULL);
+   pthread_cond_init(&w->has_space, NULL);
+   w->max_outstanding = pool->number_of_workers * WORKER_MAX_OUTSTANDING;
+
+   *workers = w;
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
 int
 pgmoneta_workers_add(struct workers* workers, void (*function)(struct worker_common*), struct worker_common* wc)
 {
-   struct task* t = NULL;
+   struct task t;
+   struct worker* w = NULL;
+   struct workers* pool = NULL;
 
    if (workers != NULL)
    {
-      t = (struct task*)malloc(sizeof(struct task));
-      if (t == NULL)
+      pool = workers->pool != NULL ? workers->pool : workers;
+
+      t.function = function;
+      t.wc = wc;
+      t.owner = workers;
+      t.queued = now_microseconds();
+
+      /* Work added from inside the pool never blocks, as the workers may be the ones to make space */
+      if (current_worker != NULL && current_worker->workers == pool)
+      {
+         w = current_worker;
+      }
+      else
+      {
+         task_reserve(workers);
+
+         if (workers->ordered && !task_hold(workers, &t))
+         {
+            return 0;
+         }
+
+         w = pool->worker[atomic_fetch_add(&pool->next, 1) % (unsigned int)pool->number_of_workers];
+      }
+
+      atomic_fetch_add(&workers->number_of_outstanding, 1);
+
+      if (queue_push(&w->queue, &t))
       {
          pgmoneta_log_error("Could not allocate memory for task");
+         task_done(workers);
          goto error;
       }
 
-      t->function = function;
-      t->wc = wc;
+      atomic_fetch_add(&pool->number_of_pending, 1);
 
-      queue_push(&workers->queue, t);
+      if (atomic_load(&pool->number_of_sleeping) > 0)
+      {
+         pthread_mutex_lock(&pool->worker_lock);
+         pthread_cond_signal(&pool->has_tasks);
+         pthread_mutex_unlock(&pool->worker_lock);
+      }
 
       return 0;
    }
@@ -154,9 +270,11 @@ pgmoneta_workers_wait(struct workers* workers)
 {
    if (workers != NULL)
    {
+      task_release(workers);
+
       pthread_mutex_lock(&workers->worker_lock);
 
-      while (workers->queue.number_of_tasks || workers->number_of_working)
+      while (atomic_load(&workers->number_of_outstanding) > 0)
       {
          pthread_cond_wait(&workers->worker_all_idle, &workers->worker_lock);
       }
@@ -168,40 +286,170 @@ pgmoneta_workers_wait(struct workers* workers)
 void
 pgmoneta_workers_destroy(struct workers* workers)
 {
-   volatile int worker_total;
-   double timeout = 1.0;
-   time_t start;
-   time_t end;
-   double tpassed = 0.0;
+   if (workers != NULL && workers->pool != NULL)
+   {
+      pgmoneta_workers_wait(workers);
 
-   if (workers != NULL)
+      pthread_mutex_destroy(&workers->worker_lock);
+      pthread_cond_destroy(&workers->worker_all_idle);
+      pthread_cond_destroy(&workers->has_space);
+
+      free(workers->held);
+      free(workers);
+   }
+   else if (workers != NULL)
    {
-      worker_total = workers->number_of_alive;
-      worker_keepalive = 0;
+      pthread_mutex_lock(&workers->worker_lock);
+      atomic_store(&workers->keepalive, false);
+      pthread_cond_broadcast(&workers->has_tasks);
+      pthread_mutex_unlock(&workers->worker_lock);
 
-      time (&start);
-      while (tpassed < timeout && workers->number_of_alive)
+      /* Idle workers steal from every queue, so all must be gone first */
+      for (int n = 0; n < workers->number_of_workers; n++)
       {
-         semaphore_post_all(workers->queue.has_tasks);
-         time(&end);
-         tpassed = difftime(end, start);
+         pthread_join(workers->worker[n]->pthread, NULL);
       }
 
-      while (workers->number_of_alive)
+      for (int n = 0; n < workers->number_of_workers; n++)
+      {
+         worker_destroy(workers->worker[n]);
+      }
+
+      pthread_mutex_destroy(&workers->worker_lock);
+      pthread_cond_destroy(&workers->has_tasks);
+      pthread_cond_destroy(&workers->worker_all_idle);
+      pthread_cond_destroy(&workers->has_space);
+
+      free(workers->held);
+      free(workers->worker);
+      free(workers);
+   }
+}
+
+void
+pgmoneta_workers_statistics(struct workers* workers, struct workers_statistics* statistics)
+{
+   struct workers* pool = NULL;
+   uint64_t busy = 0;
+
+   memset(statistics, 0, sizeof(struct workers_statistics));
+
+   if (workers == NULL)
+   {
+      return;
+   }
+
+   pool = workers->pool != NULL ? workers->pool : workers;
+
+   for (int i = 0; i < pool->number_of_workers; i++)
+   {
+      busy += atomic_load(&pool->worker[i]->busy);
+   }
+
+   atomic_store(&statistics->tasks, atomic_load(&pool->statistics.tasks));
+   atomic_store(&statistics->bytes, atomic_load(&pool->statistics.bytes));
+   atomic_store(&statistics->wait, atomic_load(&pool->statistics.wait));
+   atomic_store(&statistics->execute, atomic_load(&pool->statistics.execute));
+   atomic_store(&statistics->busy, busy);
+   atomic_store(&statistics->available, (now_microseconds() - pool->started) * (uint64_t)pool->number_of_workers);
+
+   for (int i = 0; i < WORKERS_HISTOGRAM_BUCKETS; i++)
+   {
+      atomic_store(&statistics->wait_histogram[i], atomic_load(&pool->statistics.wait_histogram[i]));
+      atomic_store(&statistics->execute_histogram[i], atomic_load(&pool->statistics.execute_histogram[i]));
+   }
+}
+
+double
+pgmoneta_workers_busy(struct workers* workers, int index)
+{
+   struct workers* pool = NULL;
+   uint64_t elapsed;
+
+   if (workers == NULL)
+   {
+      return 0.0;
+   }
+
+   pool = workers->pool != NULL ? workers->pool : workers;
+
+   if (index < 0 || index >= pool->number_of_workers)
+   {
+      return 0.0;
+   }
+
+   elapsed = now_microseconds() - pool->started;
+   if (elapsed == 0)
+   {
+      return 0.0;
+   }
+
+   return MIN(1.0, (double)atomic_load(&pool->worker[index]->busy) / (double)elapsed);
+}
+
+double
+pgmoneta_workers_histogram_bound(int bucket)
+{
+   if (bucket < 0 || bucket >= WORKERS_HISTOGRAM_BUCKETS - 1)
+   {
+      return -1.0;
+   }
+
+   return (double)histogram_bounds[bucket] / 1000000.0;
+}
+
+void*
+pgmoneta_workers_context_get(int type, int level)
+{
+   if (type < 0 || type >= WORKER_CONTEXT_SIZE)
+   {
+      return NULL;
+   }
+
+   if (worker_contexts[type].context != NULL && worker_contexts[type].level == level)
+   {
+      return worker_contexts[type].context;
+   }
+
+   return NULL;
+}
+
+void
+pgmoneta_workers_context_put(int type, int level, void* context, void (*destroy)(void* context))
+{
+   if (type < 0 || type >= WORKER_CONTEXT_SIZE)
+   {
+      if (context != NULL && destroy != NULL)
       {
-         semaphore_post_all(workers->queue.has_tasks);
-         SLEEP(1000000000L);
+         destroy(context);
       }
+      return;
+   }
+
+   if (worker_contexts[type].context != NULL && worker_contexts[type].context != context &&
+       worker_contexts[type].destroy != NULL)
+   {
+      worker_contexts[type].destroy(worker_contexts[type].context);
+   }
 
-      queue_destroy(&workers->queue);
+   worker_contexts[type].level = level;
+   worker_contexts[type].context = context;
+   worker_contexts[type].destroy = destroy;
+}
 
-      for (int n = 0; n < worker_total; n++)
+void
+pgmoneta_workers_context_clear(void)
+{
+   for (int i = 0; i < WORKER_CONTEXT_SIZE; i++)
+   {
+      if (worker_contexts[i].context != NULL && worker_contexts[i].destroy != NULL)
       {
-         worker_destroy(workers->worker[n]);
+         worker_contexts[i].destroy(worker_contexts[i].context);
       }
 
-      free(workers->worker);
-      free(workers);
+      worker_contexts[i].level = 0;
+      worker_contexts[i].context = NULL;
+      worker_contexts[i].destroy = NULL;
    }
 }
 
@@ -231,15 +479,43 @@ pgmoneta_get_number_of_workers(int server)
    return nw;
 }
 
+int
+pgmoneta_get_number_of_io_workers(int server)
+{
+   int nw = 0;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (config->common.servers[server].io_workers != -1)
+   {
+      nw = config->common.servers[server].io_workers;
+   }
+   else
+   {
+      nw = config->io_workers;
+   }
+
+   /* I/O workers mostly wait on the disk, so they aren't bound by the CPUs */
+   nw = MIN(nw, 64);
+
+   return nw;
+}
+
 int
 pgmoneta_create_worker_input(char* directory, char* from, char* to, int level,
                              struct workers* workers, struct worker_input** wi)
 {
    struct worker_input* w = NULL;
+   struct stat st;
+   size_t directory_length = directory != NULL ? strlen(directory) : 0;
+   size_t from_length = from != NULL ? strlen(from) : 0;
+   size_t to_length = to != NULL ? strlen(to) : 0;
+   char* p = NULL;
 
    *wi = NULL;
 
-   w = (struct worker_input*)malloc(sizeof(struct worker_input));
+   w = (struct worker_input*)malloc(sizeof(struct worker_input) + directory_length + from_length + to_length + 3);
 
    if (w == NULL)
    {
@@ -248,19 +524,25 @@ pgmoneta_create_worker_input(char* directory, char* from, char* to, int level,
 
    memset(w, 0, sizeof(struct worker_input));
 
-   if (directory != NULL && strlen(directory) > 0)
-   {
-      memcpy(w->directory, directory, strlen(directory));
-   }
+   p = &w->paths[0];
 
-   if (from != NULL && strlen(from) > 0)
-   {
-      memcpy(w->from, from, strlen(from));
-   }
+   w->directory = p;
+   memcpy(p, directory_length > 0 ? directory : "", directory_length);
+   p[directory_length] = '\0';
+   p += directory_length + 1;
+
+   w->from = p;
+   memcpy(p, from_length > 0 ? from : "", from_length);
+   p[from_length] = '\0';
+   p += from_length + 1;
+
+   w->to = p;
+   memcpy(p, to_length > 0 ? to : "", to_length);
+   p[to_length] = '\0';
 
-   if (to != NULL && strlen(to) > 0)
+   if (from_length > 0 && !stat(from, &st) && S_ISREG(st.st_mode))
    {
-      memcpy(w->to, to, strlen(to));
+      w->common.size = (size_t)st.st_size;
    }
 
    w->level = level;
@@ -279,7 +561,7 @@ error:
 }
 
 static int
-worker_init(struct workers* workers, struct worker** worker)
+worker_init(struct workers* workers, int index, struct worker** worker)
 {
    struct worker* w = NULL;
 
@@ -293,9 +575,14 @@ worker_init(struct workers* workers, struct worker** worker)
    }
 
    w->workers = workers;
+   w->index = index;
+   atomic_init(&w->busy, 0);
 
-   pthread_create(&w->pthread, NULL, (void* (*)(void*)) worker_do, w);
-   pthread_detach(w->pthread);
+   if (queue_init(&w->queue))
+   {
+      pgmoneta_log_error("Could not allocate memory for queue");
+      goto error;
+   }
 
    *worker = w;
 
@@ -303,49 +590,46 @@ worker_init(struct workers* workers, struct worker** worker)
 
 error:
 
+   free(w);
+
    return 1;
 }
 
 static void*
 worker_do(struct worker* worker)
 {
-   void (*func_ref)(struct worker_common*);
-   struct task* t;
+   struct task t;
    struct workers* workers = worker->workers;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   current_worker = worker;
+
+   /* Pin before the worker allocates its buffers and contexts, so they are node local */
+   pgmoneta_pin_thread(config->worker_cpus, worker->index);
 
    pthread_mutex_lock(&workers->worker_lock);
    workers->number_of_alive += 1;
    pthread_mutex_unlock(&workers->worker_lock);
 
-   while (worker_keepalive)
+   while (atomic_load(&workers->keepalive))
    {
-      semaphore_wait(workers->queue.has_tasks);
-
-      if (worker_keepalive)
+      if (!worker_take(worker, &t))
       {
-         pthread_mutex_lock(&workers->worker_lock);
-         workers->number_of_working++;
-         pthread_mutex_unlock(&workers->worker_lock);
+         worker_sleep(workers);
+         continue;
+      }
 
-         t = queue_pull(&workers->queue);
-         if (t)
-         {
-            func_ref = t->function;
-            func_ref(t->wc);
+      atomic_fetch_sub(&workers->number_of_pending, 1);
 
-            free(t);
-         }
+      task_execute(workers, worker, &t);
+   }
 
-         pthread_mutex_lock(&workers->worker_lock);
-         workers->number_of_working--;
-         if (!workers->number_of_working)
-         {
-            pthread_cond_signal(&workers->worker_all_idle);
-         }
-         pthread_mutex_unlock(&workers->worker_lock);
+   pgmoneta_workers_context_clear();
+
+   current_worker = NULL;
 
-      }
-   }
    pthread_mutex_lock(&workers->worker_lock);
    workers->number_of_alive--;
    pthread_mutex_unlock(&workers->worker_lock);
@@ -353,168 +637,416 @@ worker_do(struct worker* worker)
    return NULL;
 }
 
-static void
-worker_destroy(struct worker* w)
+static bool
+worker_take(struct worker* worker, struct task* task)
 {
-   free(w);
+   struct workers* workers = worker->workers;
+   int n = workers->number_of_workers;
+
+   if (queue_pop(&worker->queue, task))
+   {
+      return true;
+   }
+
+   for (int i = 1; i < n; i++)
+   {
+      if (queue_steal(&workers->worker[(worker->index + i) % n]->queue, task))
+      {
+         return true;
+      }
+   }
+
+   return false;
 }
 
-static int
-queue_init(struct queue* queue)
+static void
+worker_sleep(struct workers* workers)
 {
-   queue->number_of_tasks = 0;
-   queue->front = NULL;
-   queue->rear = NULL;
+   pthread_mutex_lock(&workers->worker_lock);
 
-   queue->has_tasks = (struct semaphore*)malloc(sizeof(struct semaphore));
-   if (queue->has_tasks == NULL)
+   atomic_fetch_add(&workers->number_of_sleeping, 1);
+
+   while (atomic_load(&workers->keepalive) && atomic_load(&workers->number_of_pending) <= 0)
    {
-      return 1;
+      pthread_cond_wait(&workers->has_tasks, &workers->worker_lock);
    }
 
-   pthread_mutex_init(&(queue->rwmutex), NULL);
-   if (semaphore_init(queue->has_tasks, 0))
+   atomic_fetch_sub(&workers->number_of_sleeping, 1);
+
+   pthread_mutex_unlock(&workers->worker_lock);
+}
+
+static void
+task_execute(struct workers* pool, struct worker* worker, struct task* task)
+{
+   uint64_t start;
+   uint64_t execute;
+   size_t size;
+
+   /* The task frees its input */
+   size = task_size(task);
+
+   PGMONETA_TRACE1(worker_task_start, size);
+
+   start = now_microseconds();
+   task->function(task->wc);
+   execute = now_microseconds() - start;
+
+   PGMONETA_TRACE2(worker_task_done, size, execute);
+
+   if (worker != NULL)
    {
-      goto error;
+      atomic_fetch_add(&worker->busy, execute);
    }
 
-   return 0;
-
-error:
+   statistics_record(&pool->statistics, start > task->queued ? start - task->queued : 0, execute, size);
 
-   return 1;
+   task_done(task->owner);
 }
 
 static void
-queue_clear(struct queue* queue)
+task_reserve(struct workers* workers)
 {
-   while (queue->number_of_tasks)
+   pthread_mutex_lock(&workers->worker_lock);
+
+   while (atomic_load(&workers->number_of_outstanding) >= task_limit(workers))
    {
-      free(queue_pull(queue));
+      /* Held tasks only run once released, so hand out this batch first */
+      if (workers->number_of_held > 0)
+      {
+         pthread_mutex_unlock(&workers->worker_lock);
+         task_release(workers);
+         pthread_mutex_lock(&workers->worker_lock);
+         continue;
+      }
+
+      workers->number_of_blocked++;
+      pthread_cond_wait(&workers->has_space, &workers->worker_lock);
+      workers->number_of_blocked--;
    }
 
-   queue->front = NULL;
-   queue->rear = NULL;
-   semaphore_reset(queue->has_tasks);
-   queue->number_of_tasks = 0;
+   pthread_mutex_unlock(&workers->worker_lock);
+}
 
+static int
+task_limit(struct workers* workers)
+{
+   /* Above the memory budget each worker has one task in flight */
+   if (pgmoneta_memory_pressure())
+   {
+      return workers->max_outstanding / WORKER_MAX_OUTSTANDING;
+   }
+
+   return workers->max_outstanding;
 }
 
 static void
-queue_push(struct queue* queue, struct task* task)
+task_done(struct workers* owner)
 {
+   int outstanding;
 
-   pthread_mutex_lock(&queue->rwmutex);
-   task->previous = NULL;
+   /* The waiter may free a group as soon as it sees zero, so the count
+    * only drops while the lock is held */
+   pthread_mutex_lock(&owner->worker_lock);
+   outstanding = atomic_fetch_sub(&owner->number_of_outstanding, 1);
+   if (outstanding == 1)
+   {
+      pthread_cond_broadcast(&owner->worker_all_idle);
+   }
+   if (owner->number_of_blocked > 0 && outstanding <= owner->max_outstanding)
+   {
+      pthread_cond_signal(&owner->has_space);
+   }
+   pthread_mutex_unlock(&owner->worker_lock);
+}
 
-   switch (queue->number_of_tasks)
+static int
+task_hold(struct workers* workers, struct task* task)
+{
+   struct task* held = NULL;
+   size_t capacity;
+
+   pthread_mutex_lock(&workers->worker_lock);
+
+   if (workers->number_of_held == workers->held_capacity)
    {
-      case 0:
-         queue->front = task;
-         queue->rear = task;
-         break;
+      capacity = workers->held_capacity == 0 ? WORKER_QUEUE_CAPACITY : workers->held_capacity * 2;
 
-      default:
-         queue->rear->previous = task;
-         queue->rear = task;
+      held = (struct task*)realloc(workers->held, capacity * sizeof(struct task));
+      if (held == NULL)
+      {
+         pthread_mutex_unlock(&workers->worker_lock);
+         return 1;
+      }
 
+      workers->held = held;
+      workers->held_capacity = capacity;
    }
-   queue->number_of_tasks++;
 
-   semaphore_post(queue->has_tasks);
-   pthread_mutex_unlock(&queue->rwmutex);
+   workers->held[workers->number_of_held++] = *task;
+   atomic_fetch_add(&workers->number_of_outstanding, 1);
+
+   pthread_mutex_unlock(&workers->worker_lock);
+
+   return 0;
 }
 
-static struct task*
-queue_pull(struct queue* queue)
+static void
+task_release(struct workers* workers)
 {
-   struct task* task = NULL;
+   struct task* held = NULL;
+   struct task* batch = NULL;
+   struct workers* pool = NULL;
+   size_t number_of_held = 0;
+   size_t number_of_workers;
+   size_t number;
+   unsigned int start;
+
+   pthread_mutex_lock(&workers->worker_lock);
+   held = workers->held;
+   number_of_held = workers->number_of_held;
+   workers->held = NULL;
+   workers->number_of_held = 0;
+   workers->held_capacity = 0;
+   pthread_mutex_unlock(&workers->worker_lock);
+
+   if (number_of_held == 0)
+   {
+      free(held);
+      return;
+   }
+
+   pool = workers->pool != NULL ? workers->pool : workers;
+   number_of_workers = (size_t)pool->number_of_workers;
+
+   /* Longest processing time first: worker k gets the tasks k, k + n, ... of the
+    * sorted tasks. A worker pops its newest task first, so its share is queued
+    * smallest first, while idle workers steal the small tasks at the end */
+   qsort(held, number_of_held, sizeof(struct task), task_compare);
+
+   batch = (struct task*)malloc(((number_of_held + number_of_workers - 1) / number_of_workers) * sizeof(struct task));
+   start = atomic_fetch_add(&pool->next, (unsigned int)number_of_workers);
+
+   for (size_t k = 0; k < number_of_workers && k < number_of_held; k++)
+   {
+      struct worker* w = pool->worker[(start + k) % number_of_workers];
 
-   pthread_mutex_lock(&queue->rwmutex);
-   task = queue->front;
+      number = (number_of_held - 1 - k) / number_of_workers + 1;
 
-   switch (queue->number_of_tasks)
+      if (batch != NULL)
+      {
+         for (size_t j = 0; j < number; j++)
+         {
+            batch[j] = held[k + (number - 1 - j) * number_of_workers];
+         }
+      }
+
+      if (batch == NULL || queue_push_batch(&w->queue, batch, number))
+      {
+         /* Run the share on the waiting thread rather than losing it */
+         for (size_t j = 0; j < number; j++)
+         {
+            task_execute(pool, NULL, &held[k + j * number_of_workers]);
+         }
+         continue;
+      }
+
+      atomic_fetch_add(&pool->number_of_pending, (int)number);
+   }
+
+   free(batch);
+   free(held);
+
+   if (atomic_load(&pool->number_of_sleeping) > 0)
    {
-      case 0:
-         break;
+      pthread_mutex_lock(&pool->worker_lock);
+      pthread_cond_broadcast(&pool->has_tasks);
+      pthread_mutex_unlock(&pool->worker_lock);
+   }
+}
 
-      case 1:
-         queue->front = NULL;
-         queue->rear = NULL;
-         queue->number_of_tasks = 0;
-         break;
+static int
+task_compare(const void* a, const void* b)
+{
+   size_t sa = task_size((const struct task*)a);
+   size_t sb = task_size((const struct task*)b);
 
-      default:
-         queue->front = task->previous;
-         queue->number_of_tasks--;
-         semaphore_post(queue->has_tasks);
+   if (sa == sb)
+   {
+      return 0;
    }
 
-   pthread_mutex_unlock(&queue->rwmutex);
-   return task;
+   return sa > sb ? -1 : 1;
+}
+
+static size_t
+task_size(const struct task* task)
+{
+   return task->wc != NULL ? task->wc->size : 0;
 }
 
 static void
-queue_destroy(struct queue* queue)
+statistics_record(struct workers_statistics* statistics, uint64_t wait, uint64_t execute, size_t bytes)
 {
-   queue_clear(queue);
-   free(queue->has_tasks);
+   atomic_fetch_add(&statistics->tasks, 1);
+   atomic_fetch_add(&statistics->bytes, bytes);
+   atomic_fetch_add(&statistics->wait, wait);
+   atomic_fetch_add(&statistics->execute, execute);
+   atomic_fetch_add(&statistics->wait_histogram[histogram_bucket(wait)], 1);
+   atomic_fetch_add(&statistics->execute_histogram[histogram_bucket(execute)], 1);
 }
 
 static int
-semaphore_init(struct semaphore* semaphore, int value)
+histogram_bucket(uint64_t time)
 {
-   if (value < 0 || value > 1 || semaphore == NULL)
+   int bucket = 0;
+
+   while (bucket < WORKERS_HISTOGRAM_BUCKETS - 1 && time > histogram_bounds[bucket])
    {
-      pgmoneta_log_error("Invalid semaphore value: %d", value);
-      goto error;
+      bucket++;
    }
 
-   pthread_mutex_init(&(semaphore->mutex), NULL);
-   pthread_cond_init(&(semaphore->cond), NULL);
-   semaphore->value = value;
+   return bucket;
+}
 
-   return 0;
+static uint64_t
+now_microseconds(void)
+{
+   struct timespec ts;
 
-error:
+   clock_gettime(CLOCK_MONOTONIC, &ts);
 
-   return 1;
+   return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
 }
 
 static void
-semaphore_reset(struct semaphore* semaphore)
+worker_destroy(struct worker* w)
 {
-   pthread_mutex_destroy(&(semaphore->mutex));
-   pthread_cond_destroy(&(semaphore->cond));
-   semaphore_init(semaphore, 0);
+   if (w != NULL)
+   {
+      queue_destroy(&w->queue);
+      free(w);
+   }
 }
 
-static void
-semaphore_post(struct semaphore* semaphore)
+static int
+queue_init(struct worker_queue* queue)
 {
-   pthread_mutex_lock(&semaphore->mutex);
-   semaphore->value = 1;
-   pthread_cond_signal(&semaphore->cond);
-   pthread_mutex_unlock(&semaphore->mutex);
+   queue->top = 0;
+   queue->bottom = 0;
+   queue->capacity = WORKER_QUEUE_CAPACITY;
+
+   queue->tasks = (struct task*)malloc(queue->capacity * sizeof(struct task));
+   if (queue->tasks == NULL)
+   {
+      return 1;
+   }
+
+   pthread_mutex_init(&queue->lock, NULL);
+
+   return 0;
 }
 
-static void
-semaphore_post_all(struct semaphore* semaphore)
+static int
+queue_push(struct worker_queue* queue, struct task* task)
 {
-   pthread_mutex_lock(&semaphore->mutex);
-   semaphore->value = 1;
-   pthread_cond_broadcast(&semaphore->cond);
-   pthread_mutex_unlock(&semaphore->mutex);
+   return queue_push_batch(queue, task, 1);
 }
 
-static void
-semaphore_wait(struct semaphore* semaphore)
+static int
+queue_push_batch(struct worker_queue* queue, struct task* tasks, size_t number)
 {
-   pthread_mutex_lock(&semaphore->mutex);
-   while (semaphore->value != 1)
+   struct task* grown = NULL;
+   size_t capacity;
+   size_t size;
+
+   pthread_mutex_lock(&queue->lock);
+
+   size = queue->bottom - queue->top;
+
+   if (size + number > queue->capacity)
    {
-      pthread_cond_wait(&semaphore->cond, &semaphore->mutex);
+      capacity = queue->capacity;
+      while (size + number > capacity)
+      {
+         capacity *= 2;
+      }
+
+      grown = (struct task*)malloc(capacity * sizeof(struct task));
+      if (grown == NULL)
+      {
+         pthread_mutex_unlock(&queue->lock);
+         return 1;
+      }
+
+      for (size_t i = 0; i < size; i++)
+      {
+         grown[i] = queue->tasks[(queue->top + i) & (queue->capacity - 1)];
+      }
+
+      free(queue->tasks);
+      queue->tasks = grown;
+      queue->capacity = capacity;
+      queue->top = 0;
+      queue->bottom = size;
+   }
+
+   for (size_t i = 0; i < number; i++)
+   {
+      queue->tasks[queue->bottom & (queue->capacity - 1)] = tasks[i];
+      queue->bottom++;
    }
-   semaphore->value = 0;
-   pthread_mutex_unlock(&semaphore->mutex);
+
+   pthread_mutex_unlock(&queue->lock);
+
+   return 0;
+}
+
+static bool
+queue_pop(struct worker_queue* queue, struct task* task)
+{
+   bool found = false;
+
+   pthread_mutex_lock(&queue->lock);
+
+   if (queue->bottom != queue->top)
+   {
+      queue->bottom--;
+      *task = queue->tasks[queue->bottom & (queue->capacity - 1)];
+      found = true;
+   }
+
+   pthread_mutex_unlock(&queue->lock);
+
+   return found;
+}
+
+static bool
+queue_steal(struct worker_queue* queue, struct task* task)
+{
+   bool found = false;
+
+   if (pthread_mutex_trylock(&queue->lock))
+   {
+      return false;
+   }
+
+   if (queue->bottom != queue->top)
+   {
+      *task = queue->tasks[queue->top & (queue->capacity - 1)];
+      queue->top++;
+      found = true;
+   }
+
+   pthread_mutex_unlock(&queue->lock);
+
+   return found;
+}
+
+static void
+queue_destroy(struct worker_queue* queue)
+{
+   free(queue->tasks);
+   queue->tasks = NULL;
+   pthread_mutex_destroy(&queue->lock);
 }
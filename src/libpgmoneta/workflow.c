@@ -29,24 +29,38 @@
 /* pgmoneta */
 #include <pgmoneta.h>
 #include <hot_standby.h>
+#include <info.h>
 #include <logging.h>
 #include <management.h>
+#include <memory.h>
+#include <progress.h>
+#include <prometheus.h>
 #include <storage.h>
 #include <utils.h>
+#include <workers.h>
 #include <workflow_funcs.h>
 
 /* system */
 #include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #define SETUP    0
 #define EXECUTE  1
 #define TEARDOWN 2
 
+#define PIPELINE_READ_AHEAD (16 * 1024 * 1024)
+
 static struct workflow* wf_backup(struct backup* backup);
 static struct workflow* wf_incremental_backup(void);
-static struct workflow* wf_restore(struct backup* backup);
+static struct workflow* wf_restore(struct backup* backup __attribute__((unused)));
 static struct workflow* wf_combine(int server, struct backup* backup, bool combine_as_is);
 static struct workflow* wf_verify(struct backup* backup);
 static struct workflow* wf_archive(struct backup* backup);
@@ -54,7 +68,44 @@ static struct workflow* wf_delete_backup(struct backup* backup);
 static struct workflow* wf_retention(struct backup* backup);
 static struct workflow* wf_post_rollup(int server, struct backup* backup);
 
+static int workflow_sync(struct art* nodes);
 static int get_error_code(int type, int flow);
+static void workers_report(int type, struct art* nodes, struct workers* workers);
+
+/** @struct pipeline_input
+ * Defines the input for streaming one file through a run of steps
+ */
+struct pipeline_input
+{
+   struct worker_common common; /**< The common base */
+   struct workflow* first;      /**< The first step */
+   struct workflow* last;       /**< The step after the last step */
+   struct art* nodes;           /**< The nodes */
+   struct workers* cpu;         /**< The group running the steps once the I/O group has read the file */
+   char path[MAX_PATH];         /**< The file */
+};
+
+static bool pipeline_possible(struct workflow* current, struct art* nodes);
+static int pipeline_execute(struct workflow* first, struct workflow* last, struct art* nodes);
+static int pipeline_directory(char* directory, struct workflow* first, struct workflow* last,
+                              struct art* nodes, struct workers* io, struct workers* workers);
+static int pipeline_file(struct pipeline_input* pi);
+static void do_pipeline(struct worker_common* wc);
+static void do_pipeline_read(struct worker_common* wc);
+
+/** @struct level_input
+ * Defines the input for running one step of a level on its own thread
+ */
+struct level_input
+{
+   struct workflow* workflow; /**< The step */
+   struct art* nodes;         /**< The nodes */
+   int result;                /**< The result of the step */
+};
+
+static int level_execute(struct workflow* first, struct workflow* last, struct art* nodes,
+                         struct workflow** failed);
+static void* do_level(void* arg);
 
 struct workflow*
 pgmoneta_workflow_create(int workflow_type, int server, struct backup* backup)
@@ -255,10 +306,31 @@ pgmoneta_workflow_execute(struct workflow* workflow, struct art* nodes,
                           uint8_t encryption, struct json* payload)
 {
    struct workflow* current = NULL;
+   struct workflow* last = NULL;
+   struct workers* workers = NULL;
+   mode_t mask;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
 
+   /* Files are created as 0600 and directories as 0700, so the backup and */
+   /* the restore don't need a pass over the tree to set the permissions */
+   mask = umask(S_IRWXG | S_IRWXO);
+
+   /* The files are made durable together once the workflow is done */
+   pgmoneta_sync_defer(true);
+
+   if (pgmoneta_workflow_workers_create(nodes, &workers))
+   {
+      goto error;
+   }
+
+   if (workflow != NULL)
+   {
+      pgmoneta_progress_start(server, workflow->type);
+      pgmoneta_memory_workflow_start(workflow->type);
+   }
+
    current = workflow;
    while (current != NULL)
    {
@@ -279,6 +351,58 @@ pgmoneta_workflow_execute(struct workflow* workflow, struct art* nodes,
    current = workflow;
    while (current != NULL)
    {
+      pgmoneta_progress_phase(current->name());
+
+      if (pipeline_possible(current, nodes))
+      {
+         last = current->next;
+         while (last != NULL && last->execute_file != NULL)
+         {
+            last = last->next;
+         }
+
+         if (pipeline_execute(current, last, nodes))
+         {
+            if (client_fd > 0)
+            {
+               pgmoneta_management_response_error(NULL, client_fd, config->common.servers[server].name,
+                                                  get_error_code(current->type, EXECUTE), current->name(),
+                                                  compression, encryption, payload);
+            }
+
+            goto error;
+         }
+
+         current = last;
+         continue;
+      }
+
+      if (current->next != NULL && current->next->independent)
+      {
+         struct workflow* failed = NULL;
+
+         last = current->next;
+         while (last != NULL && last->independent)
+         {
+            last = last->next;
+         }
+
+         if (level_execute(current, last, nodes, &failed))
+         {
+            if (client_fd > 0)
+            {
+               pgmoneta_management_response_error(NULL, client_fd, config->common.servers[server].name,
+                                                  get_error_code(failed->type, EXECUTE), failed->name(),
+                                                  compression, encryption, payload);
+            }
+
+            goto error;
+         }
+
+         current = last;
+         continue;
+      }
+
       if (current->execute(current->name(), nodes))
       {
          if (client_fd > 0)
@@ -293,6 +417,24 @@ pgmoneta_workflow_execute(struct workflow* workflow, struct art* nodes,
       current = current->next;
    }
 
+   if (workflow_sync(nodes))
+   {
+      last = workflow;
+      while (last != NULL && last->next != NULL)
+      {
+         last = last->next;
+      }
+
+      if (client_fd > 0 && last != NULL)
+      {
+         pgmoneta_management_response_error(NULL, client_fd, config->common.servers[server].name,
+                                            get_error_code(last->type, EXECUTE), last->name(),
+                                            compression, encryption, payload);
+      }
+
+      goto error;
+   }
+
    current = workflow;
    while (current != NULL)
    {
@@ -310,13 +452,137 @@ pgmoneta_workflow_execute(struct workflow* workflow, struct art* nodes,
       current = current->next;
    }
 
+   pgmoneta_workflow_workers_destroy(workflow != NULL ? workflow->type : -1, nodes, workers);
+
+   if (workflow != NULL)
+   {
+      pgmoneta_memory_workflow_finish();
+      pgmoneta_progress_finish();
+   }
+
+   pgmoneta_sync_defer(false);
+   umask(mask);
+
+   return 0;
+
+error:
+
+   pgmoneta_workflow_workers_destroy(workflow != NULL ? workflow->type : -1, nodes, workers);
+
+   if (workflow != NULL)
+   {
+      pgmoneta_memory_workflow_finish();
+      pgmoneta_progress_finish();
+   }
+
+   pgmoneta_sync_defer(false);
+   umask(mask);
+
+   return 1;
+}
+
+int
+pgmoneta_workflow_workers_create(struct art* nodes, struct workers** workers)
+{
+   int server = -1;
+   int number_of_workers = 0;
+   int number_of_io_workers = 0;
+   struct workers* w = NULL;
+   struct workers* io = NULL;
+
+   *workers = NULL;
+
+   if (nodes == NULL || pgmoneta_art_contains_key(nodes, NODE_WORKERS) ||
+       !pgmoneta_art_contains_key(nodes, NODE_SERVER_ID))
+   {
+      return 0;
+   }
+
+   server = (int)pgmoneta_art_search(nodes, NODE_SERVER_ID);
+
+   number_of_workers = pgmoneta_get_number_of_workers(server);
+   if (number_of_workers <= 0)
+   {
+      return 0;
+   }
+
+   if (pgmoneta_workers_initialize(number_of_workers, &w))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_art_insert(nodes, NODE_WORKERS, (uintptr_t)w, ValueRef))
+   {
+      goto error;
+   }
+
+   number_of_io_workers = pgmoneta_get_number_of_io_workers(server);
+   if (number_of_io_workers > 0)
+   {
+      if (pgmoneta_workers_initialize(number_of_io_workers, &io))
+      {
+         goto error;
+      }
+
+      if (pgmoneta_art_insert(nodes, NODE_IO_WORKERS, (uintptr_t)io, ValueRef))
+      {
+         goto error;
+      }
+   }
+
+   *workers = w;
+
    return 0;
 
 error:
 
+   pgmoneta_art_delete(nodes, NODE_WORKERS);
+   pgmoneta_workers_destroy(io);
+   pgmoneta_workers_destroy(w);
+
    return 1;
 }
 
+void
+pgmoneta_workflow_workers_destroy(int type, struct art* nodes, struct workers* workers)
+{
+   struct workers* io = NULL;
+   struct workers_statistics statistics;
+
+   if (workers != NULL)
+   {
+      io = (struct workers*)pgmoneta_art_search(nodes, NODE_IO_WORKERS);
+      if (io != NULL)
+      {
+         pgmoneta_workers_statistics(io, &statistics);
+         pgmoneta_log_debug("I/O workers: %lu tasks, %lu bytes",
+                            atomic_load(&statistics.tasks), atomic_load(&statistics.bytes));
+
+         pgmoneta_art_delete(nodes, NODE_IO_WORKERS);
+         pgmoneta_workers_destroy(io);
+      }
+
+      workers_report(type, nodes, workers);
+
+      pgmoneta_art_delete(nodes, NODE_WORKERS);
+      pgmoneta_workers_destroy(workers);
+   }
+}
+
+struct workers*
+pgmoneta_workflow_io_workers(struct art* nodes)
+{
+   struct workers* io = NULL;
+
+   io = (struct workers*)pgmoneta_art_search(nodes, NODE_IO_WORKERS);
+   if (io == NULL)
+   {
+      io = (struct workers*)pgmoneta_art_search(nodes, NODE_WORKERS);
+   }
+
+   return io;
+}
+
 int
 pgmoneta_workflow_destroy(struct workflow* workflow)
 {
@@ -419,6 +685,7 @@ wf_backup(struct backup* backup __attribute__((unused)))
 
    current->next = pgmoneta_create_extra();
    current = current->next;
+   current->independent = true;
 
    current->next = pgmoneta_storage_create_local();
    current = current->next;
@@ -464,9 +731,6 @@ wf_backup(struct backup* backup __attribute__((unused)))
    current = current->next;
 #endif
 
-   current->next = pgmoneta_create_permissions(PERMISSION_TYPE_BACKUP);
-   current = current->next;
-
    if (config->storage_engine & STORAGE_ENGINE_SSH)
    {
       current->next = pgmoneta_create_sha256();
@@ -504,41 +768,15 @@ wf_backup(struct backup* backup __attribute__((unused)))
 }
 
 static struct workflow*
-wf_restore(struct backup* backup)
+wf_restore(struct backup* backup __attribute__((unused)))
 {
    struct workflow* head = NULL;
    struct workflow* current = NULL;
 
+   /* The restore step decrypts and decompresses the files while copying them */
    head = pgmoneta_create_restore();
    current = head;
 
-   if (backup->encryption != ENCRYPTION_NONE)
-   {
-      current->next = pgmoneta_encryption(false);
-      current = current->next;
-   }
-
-   if (backup->compression == COMPRESSION_CLIENT_GZIP || backup->compression == COMPRESSION_SERVER_GZIP)
-   {
-      current->next = pgmoneta_create_gzip(false);
-      current = current->next;
-   }
-   else if (backup->compression == COMPRESSION_CLIENT_ZSTD || backup->compression == COMPRESSION_SERVER_ZSTD)
-   {
-      current->next = pgmoneta_create_zstd(false);
-      current = current->next;
-   }
-   else if (backup->compression == COMPRESSION_CLIENT_LZ4 || backup->compression == COMPRESSION_SERVER_LZ4)
-   {
-      current->next = pgmoneta_create_lz4(false);
-      current = current->next;
-   }
-   else if (backup->compression == COMPRESSION_CLIENT_BZIP2)
-   {
-      current->next = pgmoneta_create_bzip2(false);
-      current = current->next;
-   }
-
    current->next = pgmoneta_create_copy_wal();
    current = current->next;
 
@@ -548,9 +786,6 @@ wf_restore(struct backup* backup)
    current->next = pgmoneta_restore_excluded_files();
    current = current->next;
 
-   current->next = pgmoneta_create_permissions(PERMISSION_TYPE_RESTORE);
-   current = current->next;
-
    current->next = pgmoneta_create_cleanup(CLEANUP_TYPE_RESTORE);
    current = current->next;
 
@@ -586,9 +821,6 @@ wf_combine(int server __attribute__((unused)), struct backup* backup __attribute
       current->next = pgmoneta_create_recovery_info();
       current = current->next;
 
-      current->next = pgmoneta_create_permissions(PERMISSION_TYPE_RESTORE);
-      current = current->next;
-
       current->next = pgmoneta_create_cleanup(CLEANUP_TYPE_RESTORE);
       current = current->next;
    }
@@ -622,6 +854,7 @@ wf_post_rollup(int server __attribute__((unused)), struct backup* backup)
 
    current->next = pgmoneta_create_extra();
    current = current->next;
+   current->independent = true;
 
    current->next = pgmoneta_storage_create_local();
    current = current->next;
@@ -664,9 +897,6 @@ wf_post_rollup(int server __attribute__((unused)), struct backup* backup)
    current = current->next;
 #endif
 
-   current->next = pgmoneta_create_permissions(PERMISSION_TYPE_BACKUP);
-   current = current->next;
-
    if (config->storage_engine & STORAGE_ENGINE_SSH)
    {
       current->next = pgmoneta_create_sha256();
@@ -719,6 +949,7 @@ wf_incremental_backup(void)
 
    current->next = pgmoneta_create_extra();
    current = current->next;
+   current->independent = true;
 
    current->next = pgmoneta_storage_create_local();
    current = current->next;
@@ -756,9 +987,6 @@ wf_incremental_backup(void)
    current->next = pgmoneta_create_link();
    current = current->next;
 
-   current->next = pgmoneta_create_permissions(PERMISSION_TYPE_BACKUP);
-   current = current->next;
-
    if (config->storage_engine & STORAGE_ENGINE_SSH)
    {
       current->next = pgmoneta_create_sha256();
@@ -801,45 +1029,25 @@ wf_verify(struct backup* backup)
    struct workflow* head = NULL;
    struct workflow* current = NULL;
 
-   head = pgmoneta_create_restore();
-   current = head;
-
-   if (backup->encryption != ENCRYPTION_NONE)
-   {
-      current->next = pgmoneta_encryption(false);
-      current = current->next;
-   }
-
-   if (backup->compression == COMPRESSION_CLIENT_GZIP || backup->compression == COMPRESSION_SERVER_GZIP)
+   /* A full backup is verified in place, an incremental backup has to be combined first */
+   if (backup != NULL && backup->type == TYPE_FULL)
    {
-      current->next = pgmoneta_create_gzip(false);
-      current = current->next;
+      head = pgmoneta_create_verify();
+      current = head;
    }
-   else if (backup->compression == COMPRESSION_CLIENT_ZSTD || backup->compression == COMPRESSION_SERVER_ZSTD)
-   {
-      current->next = pgmoneta_create_zstd(false);
-      current = current->next;
-   }
-   else if (backup->compression == COMPRESSION_CLIENT_LZ4 || backup->compression == COMPRESSION_SERVER_LZ4)
+   else
    {
-      current->next = pgmoneta_create_lz4(false);
+      /* The restore step decrypts and decompresses the files while copying them */
+      head = pgmoneta_create_restore();
+      current = head;
+
+      current->next = pgmoneta_restore_excluded_files();
       current = current->next;
-   }
-   else if (backup->compression == COMPRESSION_CLIENT_BZIP2)
-   {
-      current->next = pgmoneta_create_bzip2(false);
+
+      current->next = pgmoneta_create_verify();
       current = current->next;
    }
 
-   current->next = pgmoneta_restore_excluded_files();
-   current = current->next;
-
-   current->next = pgmoneta_create_permissions(PERMISSION_TYPE_RESTORE);
-   current = current->next;
-
-   current->next = pgmoneta_create_verify();
-   current = current->next;
-
 #ifdef DEBUG
    current = head;
    while (current != NULL)
@@ -861,32 +1069,10 @@ wf_archive(struct backup* backup)
    struct workflow* head = NULL;
    struct workflow* current = NULL;
 
+   /* The archive step compresses the tar file while it is written */
    head = pgmoneta_create_archive();
    current = head;
 
-   if (backup->compression == COMPRESSION_CLIENT_GZIP || backup->compression == COMPRESSION_SERVER_GZIP)
-   {
-      current->next = pgmoneta_create_gzip(true);
-      current = current->next;
-   }
-   else if (backup->compression == COMPRESSION_CLIENT_ZSTD || backup->compression == COMPRESSION_SERVER_ZSTD)
-   {
-      current->next = pgmoneta_create_zstd(true);
-      current = current->next;
-   }
-   else if (backup->compression == COMPRESSION_CLIENT_LZ4 || backup->compression == COMPRESSION_SERVER_LZ4)
-   {
-      current->next = pgmoneta_create_lz4(true);
-
-      current = current->next;
-   }
-   else if (backup->compression == COMPRESSION_CLIENT_BZIP2)
-   {
-      current->next = pgmoneta_create_bzip2(true);
-
-      current = current->next;
-   }
-
    if (backup->encryption != ENCRYPTION_NONE)
    {
       current->next = pgmoneta_encryption(true);
@@ -957,6 +1143,516 @@ wf_delete_backup(struct backup* backup __attribute__((unused)))
    return head;
 }
 
+static bool
+pipeline_possible(struct workflow* current, struct art* nodes)
+{
+   /* A tar file is one file, so there is nothing to stream */
+   if (pgmoneta_art_contains_key(nodes, NODE_TARGET_FILE) ||
+       !pgmoneta_art_contains_key(nodes, NODE_BACKUP_BASE) ||
+       !pgmoneta_art_contains_key(nodes, NODE_BACKUP_DATA))
+   {
+      return false;
+   }
+
+   return current->execute_file != NULL && current->next != NULL && current->next->execute_file != NULL;
+}
+
+static int
+pipeline_execute(struct workflow* first, struct workflow* last, struct art* nodes)
+{
+   int server = -1;
+   int number_of_workers = 0;
+   char* backup_base = NULL;
+   char* backup_data = NULL;
+   char path[MAX_PATH];
+   DIR* dir = NULL;
+   struct dirent* entry;
+   struct workers* workers = NULL;
+   struct workers* io = NULL;
+   struct timespec start_t;
+   struct timespec end_t;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+#ifdef HAVE_FREEBSD
+   clock_gettime(CLOCK_MONOTONIC_FAST, &start_t);
+#else
+   clock_gettime(CLOCK_MONOTONIC_RAW, &start_t);
+#endif
+
+   server = (int)pgmoneta_art_search(nodes, NODE_SERVER_ID);
+   backup_base = (char*)pgmoneta_art_search(nodes, NODE_BACKUP_BASE);
+   backup_data = (char*)pgmoneta_art_search(nodes, NODE_BACKUP_DATA);
+
+   for (struct workflow* wf = first; wf != last; wf = wf->next)
+   {
+      pgmoneta_log_debug("%s (pipeline): %s/%s", wf->name(), config->common.servers[server].name,
+                         (char*)pgmoneta_art_search(nodes, NODE_LABEL));
+   }
+
+   number_of_workers = pgmoneta_get_number_of_workers(server);
+   if (number_of_workers > 0)
+   {
+      pgmoneta_workers_initialize_group((struct workers*)pgmoneta_art_search(nodes, NODE_WORKERS), number_of_workers, &workers);
+   }
+
+   /* The I/O workers read the files ahead and hand them to the workers, which run the steps as they arrive */
+   if (workers != NULL && pgmoneta_art_contains_key(nodes, NODE_IO_WORKERS))
+   {
+      pgmoneta_workers_initialize_group((struct workers*)pgmoneta_art_search(nodes, NODE_IO_WORKERS),
+                                        pgmoneta_get_number_of_io_workers(server), &io);
+      workers->ordered = false;
+   }
+
+   if (pipeline_directory(backup_data, first, last, nodes, io, workers))
+   {
+      goto error;
+   }
+
+   if (!(dir = opendir(backup_base)))
+   {
+      goto error;
+   }
+
+   while ((entry = readdir(dir)) != NULL)
+   {
+      if (entry->d_type == DT_DIR &&
+          strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0 && strcmp(entry->d_name, "data") != 0)
+      {
+         snprintf(path, sizeof(path), "%s/%s", backup_base, entry->d_name);
+
+         if (pipeline_directory(path, first, last, nodes, io, workers))
+         {
+            goto error;
+         }
+      }
+   }
+
+   closedir(dir);
+   dir = NULL;
+
+   if (io != NULL)
+   {
+      pgmoneta_workers_wait(io);
+      if (!io->outcome)
+      {
+         workers->outcome = false;
+      }
+      pgmoneta_workers_destroy(io);
+      io = NULL;
+   }
+
+   if (workers != NULL)
+   {
+      pgmoneta_workers_wait(workers);
+      if (!workers->outcome)
+      {
+         goto error;
+      }
+      pgmoneta_workers_destroy(workers);
+   }
+
+#ifdef HAVE_FREEBSD
+   clock_gettime(CLOCK_MONOTONIC_FAST, &end_t);
+#else
+   clock_gettime(CLOCK_MONOTONIC_RAW, &end_t);
+#endif
+
+   pgmoneta_log_debug("Pipeline: %s/%s (Elapsed: %.4f)", config->common.servers[server].name,
+                      (char*)pgmoneta_art_search(nodes, NODE_LABEL), pgmoneta_compute_duration(start_t, end_t));
+
+   return 0;
+
+error:
+
+   if (dir != NULL)
+   {
+      closedir(dir);
+   }
+
+   if (io != NULL)
+   {
+      pgmoneta_workers_wait(io);
+      pgmoneta_workers_destroy(io);
+   }
+
+   if (workers != NULL)
+   {
+      pgmoneta_workers_wait(workers);
+   }
+   pgmoneta_workers_destroy(workers);
+
+   return 1;
+}
+
+static int
+pipeline_directory(char* directory, struct workflow* first, struct workflow* last,
+                   struct art* nodes, struct workers* io, struct workers* workers)
+{
+   char path[MAX_PATH];
+   DIR* dir = NULL;
+   struct dirent* entry;
+   struct pipeline_input* pi = NULL;
+
+   if (!(dir = opendir(directory)))
+   {
+      goto error;
+   }
+
+   while ((entry = readdir(dir)) != NULL)
+   {
+      if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+      {
+         continue;
+      }
+
+      snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+
+      if (entry->d_type == DT_DIR)
+      {
+         /* Tablespaces are linked from pg_tblspc and processed from the backup base */
+         if (strcmp(entry->d_name, "pg_tblspc") == 0)
+         {
+            continue;
+         }
+
+         if (pipeline_directory(path, first, last, nodes, io, workers))
+         {
+            goto error;
+         }
+      }
+      else if (entry->d_type == DT_REG)
+      {
+         pi = (struct pipeline_input*)malloc(sizeof(struct pipeline_input));
+         if (pi == NULL)
+         {
+            goto error;
+         }
+
+         memset(pi, 0, sizeof(struct pipeline_input));
+         pi->common.workers = workers;
+         pi->first = first;
+         pi->last = last;
+         pi->nodes = nodes;
+         memcpy(pi->path, path, strlen(path));
+         pi->common.size = pgmoneta_get_file_size(path);
+
+         if (io != NULL)
+         {
+            pi->common.workers = io;
+            pi->cpu = workers;
+
+            if (!io->outcome || !workers->outcome || pgmoneta_workers_add(io, do_pipeline_read, (struct worker_common*)pi))
+            {
+               free(pi);
+            }
+         }
+         else if (workers != NULL)
+         {
+            if (!workers->outcome || pgmoneta_workers_add(workers, do_pipeline, (struct worker_common*)pi))
+            {
+               free(pi);
+            }
+         }
+         else
+         {
+            if (pipeline_file(pi))
+            {
+               free(pi);
+               goto error;
+            }
+            free(pi);
+         }
+         pi = NULL;
+      }
+   }
+
+   closedir(dir);
+
+   return 0;
+
+error:
+
+   if (dir != NULL)
+   {
+      closedir(dir);
+   }
+
+   return 1;
+}
+
+static int
+pipeline_file(struct pipeline_input* pi)
+{
+   char* current = NULL;
+   char* next = NULL;
+
+   current = pgmoneta_append(current, pi->path);
+
+   for (struct workflow* wf = pi->first; wf != pi->last; wf = wf->next)
+   {
+      if (wf->execute_file(wf->name(), pi->nodes, current, &next))
+      {
+         pgmoneta_log_error("%s: Could not process %s", wf->name(), current);
+         goto error;
+      }
+
+      free(current);
+      current = next;
+      next = NULL;
+   }
+
+   free(current);
+
+   return 0;
+
+error:
+
+   free(current);
+
+   return 1;
+}
+
+static void
+do_pipeline(struct worker_common* wc)
+{
+   struct pipeline_input* pi = (struct pipeline_input*)wc;
+
+   if (pipeline_file(pi))
+   {
+      wc->workers->outcome = false;
+   }
+
+   free(pi);
+}
+
+static void
+do_pipeline_read(struct worker_common* wc)
+{
+   int fd = -1;
+   ssize_t r = 0;
+   size_t total = 0;
+   char buffer[65536];
+   struct pipeline_input* pi = (struct pipeline_input*)wc;
+   struct workers* io = wc->workers;
+
+   /* Pull the start of the file into the page cache, so the steps find it there */
+   fd = open(pi->path, O_RDONLY);
+   if (fd != -1)
+   {
+#if defined(HAVE_LINUX) || defined(HAVE_FREEBSD)
+      posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+      while (total < PIPELINE_READ_AHEAD && (r = read(fd, buffer, sizeof(buffer))) > 0)
+      {
+         total += (size_t)r;
+      }
+
+#if defined(HAVE_LINUX) || defined(HAVE_FREEBSD)
+      if (r > 0)
+      {
+         posix_fadvise(fd, (off_t)total, 0, POSIX_FADV_WILLNEED);
+      }
+#endif
+
+      close(fd);
+   }
+
+   /* Blocks while the workers are behind, which holds the I/O workers back */
+   pi->common.workers = pi->cpu;
+   if (!pi->cpu->outcome || pgmoneta_workers_add(pi->cpu, do_pipeline, (struct worker_common*)pi))
+   {
+      io->outcome = false;
+      free(pi);
+   }
+}
+
+static int
+level_execute(struct workflow* first, struct workflow* last, struct art* nodes,
+              struct workflow** failed)
+{
+   int number_of_steps = 0;
+   int i = 0;
+   struct workflow* current = NULL;
+   struct level_input* inputs = NULL;
+   pthread_t* threads = NULL;
+   bool* started = NULL;
+
+   *failed = NULL;
+
+   for (current = first; current != last; current = current->next)
+   {
+      number_of_steps++;
+   }
+
+   inputs = (struct level_input*)calloc(number_of_steps, sizeof(struct level_input));
+   threads = (pthread_t*)calloc(number_of_steps, sizeof(pthread_t));
+   started = (bool*)calloc(number_of_steps, sizeof(bool));
+
+   if (inputs == NULL || threads == NULL || started == NULL)
+   {
+      goto error;
+   }
+
+   pgmoneta_log_debug("Executing %d steps concurrently, starting with %s", number_of_steps, first->name());
+
+   /* The file level work of each step still goes to the shared worker pool, so the
+      step bodies get their own threads in order to never wait from inside the pool */
+   for (current = first, i = 0; current != last; current = current->next, i++)
+   {
+      inputs[i].workflow = current;
+      inputs[i].nodes = nodes;
+
+      if (pthread_create(&threads[i], NULL, &do_level, &inputs[i]) == 0)
+      {
+         started[i] = true;
+      }
+      else
+      {
+         do_level(&inputs[i]);
+      }
+   }
+
+   for (i = 0; i < number_of_steps; i++)
+   {
+      if (started[i])
+      {
+         pthread_join(threads[i], NULL);
+      }
+
+      if (inputs[i].result != 0 && *failed == NULL)
+      {
+         *failed = inputs[i].workflow;
+      }
+   }
+
+   free(inputs);
+   free(threads);
+   free(started);
+
+   return *failed != NULL ? 1 : 0;
+
+error:
+
+   *failed = first;
+
+   free(inputs);
+   free(threads);
+   free(started);
+
+   return 1;
+}
+
+static void*
+do_level(void* arg)
+{
+   struct level_input* li = (struct level_input*)arg;
+
+   li->result = li->workflow->execute(li->workflow->name(), li->nodes);
+
+   return NULL;
+}
+
+static void
+workers_report(int type, struct art* nodes, struct workers* workers)
+{
+   unsigned long tasks;
+   unsigned long available;
+   double wait = 0.0;
+   double execute = 0.0;
+   double busy = 0.0;
+   char* backup_base = NULL;
+   char* info = NULL;
+   char* per_worker = NULL;
+   struct info_batch* batch = NULL;
+   struct workers_statistics statistics;
+
+   pgmoneta_workers_statistics(workers, &statistics);
+   pgmoneta_prometheus_workers(type, &statistics);
+
+   tasks = atomic_load(&statistics.tasks);
+   available = atomic_load(&statistics.available);
+
+   if (tasks > 0)
+   {
+      wait = (double)atomic_load(&statistics.wait) / (double)tasks / 1000000.0;
+      execute = (double)atomic_load(&statistics.execute) / (double)tasks / 1000000.0;
+   }
+
+   if (available > 0)
+   {
+      busy = (double)atomic_load(&statistics.busy) / (double)available;
+   }
+
+   pgmoneta_log_debug("Workers: %lu tasks, %lu bytes, %.6f/%.6f seconds average wait/execute, %.2f busy",
+                      tasks, atomic_load(&statistics.bytes), wait, execute, busy);
+
+   if ((type != WORKFLOW_TYPE_BACKUP && type != WORKFLOW_TYPE_INCREMENTAL_BACKUP) ||
+       !pgmoneta_art_contains_key(nodes, NODE_BACKUP_BASE))
+   {
+      return;
+   }
+
+   backup_base = (char*)pgmoneta_art_search(nodes, NODE_BACKUP_BASE);
+
+   info = pgmoneta_append(info, backup_base);
+   info = pgmoneta_append(info, "/backup.info");
+
+   if (pgmoneta_exists(info))
+   {
+      for (int i = 0; i < workers->number_of_workers; i++)
+      {
+         if (i > 0)
+         {
+            per_worker = pgmoneta_append_char(per_worker, ',');
+         }
+         per_worker = pgmoneta_append_double_precision(per_worker, pgmoneta_workers_busy(workers, i), 2);
+      }
+
+      if (!pgmoneta_info_begin(backup_base, &batch))
+      {
+         pgmoneta_info_set_unsigned_long(batch, INFO_WORKERS_TASKS, tasks);
+         pgmoneta_info_set_unsigned_long(batch, INFO_WORKERS_BYTES, atomic_load(&statistics.bytes));
+         pgmoneta_info_set_double(batch, INFO_WORKERS_WAIT, wait);
+         pgmoneta_info_set_double(batch, INFO_WORKERS_EXECUTE, execute);
+         pgmoneta_info_set_string(batch, INFO_WORKERS_BUSY, per_worker);
+         pgmoneta_info_commit(batch);
+      }
+   }
+
+   free(per_worker);
+   free(info);
+}
+
+static int
+workflow_sync(struct art* nodes)
+{
+   char* keys[] = {NODE_BACKUP_BASE, NODE_TARGET_BASE};
+   char* directory = NULL;
+
+   if (nodes == NULL)
+   {
+      return 0;
+   }
+
+   for (int i = 0; i < 2; i++)
+   {
+      directory = (char*)pgmoneta_art_search(nodes, keys[i]);
+
+      if (directory != NULL && pgmoneta_exists(directory))
+      {
+         if (pgmoneta_sync_directory(directory))
+         {
+            return 1;
+         }
+      }
+   }
+
+   return 0;
+}
+
 static int
 get_error_code(int type, int flow)
 {
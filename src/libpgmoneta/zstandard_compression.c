@@ -28,201 +28,197 @@
 
 /* pgmoneta */
 #include <pgmoneta.h>
+#include <aes.h>
+#include <compression.h>
 #include <logging.h>
 #include <management.h>
+#include <memory.h>
+#include <profile.h>
+#include <prometheus.h>
+#include <trace.h>
 #include <utils.h>
+#include <walfile/wal_reader.h>
 #include <zstandard_compression.h>
 
 /* system */
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <zdict.h>
 #include <zstd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #define NAME "zstd"
 #define ZSTD_DEFAULT_NUMBER_OF_WORKERS 4
-
-static int zstd_compress(char* from, char* to, ZSTD_CCtx* cctx, size_t zin_size, void* zin, size_t zout_size, void* zout);
+#define ZSTD_MULTITHREAD_THRESHOLD (16 * 1024 * 1024)
+
+#define ZSTD_FRAME_MAGIC              0xFD2FB528
+#define ZSTD_SEEKABLE_SKIPPABLE_MAGIC 0x184D2A5E
+#define ZSTD_SEEKABLE_MAGIC           0x8F92EAB1
+#define ZSTD_SEEKABLE_ENTRY_SIZE      8
+#define ZSTD_SEEKABLE_FOOTER_SIZE     9
+
+#define ZSTD_DICTIONARY_SIZE         (112 * 1024)
+#define ZSTD_DICTIONARY_SAMPLES_SIZE (100 * ZSTD_DICTIONARY_SIZE)
+#define ZSTD_DICTIONARY_MIN_SAMPLES  16
+#define ZSTD_DICTIONARY_MAX_AGE      86400
+#define ZSTD_DICTIONARY_SEGMENTS     16
+#define ZSTD_DICTIONARY_PAGE_SIZE    8192
+
+#define ZSTD_PROBE_THRESHOLD (8 * 1024 * 1024)
+#define ZSTD_PROBES          4
+#define ZSTD_PROBE_RATIO     0.97
+#define ZSTD_RAW_BLOCK_SIZE  (128 * 1024)
+
+#define ZSTD_PASS_ALL   0
+#define ZSTD_PASS_SMALL 1
+#define ZSTD_PASS_LARGE 2
+
+/** @struct zstd_reader
+ * Defines the state of a Zstandard decompression layer
+ */
+struct zstd_reader
+{
+   ZSTD_DCtx* dctx;        /**< The decompression context */
+   void* zin;              /**< The input buffer */
+   size_t zin_size;        /**< The size of the input buffer */
+   ZSTD_inBuffer input;    /**< The pending input */
+   bool first;             /**< Is the next input the start of the file */
+   bool eof;               /**< Has the source ended */
+   size_t last;            /**< The last hint from the decoder, 0 at a frame boundary */
+   void* dictionary;       /**< The dictionary, if any */
+};
+
+/** @struct zstd_parallel
+ * Defines a Zstandard file decompressed by ranges of frames on the workers
+ */
+struct zstd_parallel
+{
+   char* from;                      /**< The compressed file */
+   char* to;                        /**< The decompressed file */
+   struct zstd_seekable* seekable;  /**< The seek table */
+   atomic_int references;           /**< The number of ranges that aren't done */
+};
+
+/** @struct zstd_range
+ * Defines a range of frames of a Zstandard file
+ */
+struct zstd_range
+{
+   struct worker_common common;  /**< The common base */
+   struct zstd_parallel* file;   /**< The file */
+   uint32_t first;               /**< The first frame */
+   uint32_t last;                /**< The frame after the range */
+};
+
+/** @struct zstd_context
+ * Defines a cached Zstandard compression context
+ */
+struct zstd_context
+{
+   ZSTD_CCtx* cctx;  /**< The compression context */
+   size_t zin_size;  /**< The size of the input buffer */
+   void* zin;        /**< The input buffer */
+   size_t zout_size; /**< The size of the output buffer */
+   void* zout;       /**< The output buffer */
+};
+
+static int zstd_reader_read(struct reader* reader, void* buffer, size_t size, size_t* read);
+static void zstd_reader_close(struct reader* reader);
+static struct zstd_context* zstd_context_get(int level, int workers);
+static void zstd_context_destroy(void* context);
+static void zstd_data(char* directory, bool encrypt, int pass, struct compression_controller* controller, struct workers* workers);
+static int zstd_level(void);
+static int zstd_compress_file(char* from, char* to, bool encrypt, int level, int workers);
+static int zstd_compress_controlled(char* from, char* to, bool encrypt, int level, int workers,
+                                    struct compression_controller* controller);
+static void do_zstd_compress(struct worker_common* wc);
+static int zstd_wal_dictionary(char* directory, void** dictionary, size_t* dictionary_size);
+static int zstd_train_wal_dictionary(char* directory, char* dictionary_directory, void** dictionary, size_t* dictionary_size);
+static int zstd_find_dictionary(unsigned int id, void** dictionary, size_t* dictionary_size);
+static int zstd_read_file(char* path, void** buffer, size_t* size);
+static int zstd_compare_names(const void* a, const void* b);
+static int zstd_write(FILE* fout, EVP_CIPHER_CTX* ectx, unsigned char* eout, void* data, size_t size);
+static void zstd_put_le32(unsigned char* p, uint32_t v);
+static uint32_t zstd_get_le32(unsigned char* p);
+static int zstd_write_seek_table(FILE* fout, EVP_CIPHER_CTX* ectx, unsigned char* eout, void* buffer, size_t buffer_size,
+                                 uint32_t* frames, uint32_t number_of_frames);
+static bool zstd_incompressible(char* from, ZSTD_CCtx* cctx, size_t zin_size, void* zin, size_t zout_size, void* zout);
+static int zstd_write_raw(FILE* fout, EVP_CIPHER_CTX* ectx, unsigned char* eout, bool header, void* data, size_t size, bool last, size_t* written);
+static int zstd_compress(char* from, char* to, bool encrypt, bool raw, ZSTD_CCtx* cctx, size_t zin_size, void* zin, size_t zout_size, void* zout);
 static int zstd_decompress(char* from, char* to, ZSTD_DCtx* dctx, size_t zin_size, void* zin, size_t zout_size, void* zout);
+static void do_zstd_range(struct worker_common* wc);
+static void zstd_parallel_release(struct zstd_parallel* file);
 
 void
-pgmoneta_zstandardc_data(char* directory, struct workers* workers)
+pgmoneta_zstandardc_data(char* directory, bool encrypt, struct compression_controller* controller, struct workers* workers)
 {
-   size_t zin_size = -1;
-   void* zin = NULL;
-   size_t zout_size = -1;
-   void* zout = NULL;
-   ZSTD_CCtx* cctx = NULL;
-   char* from = NULL;
-   char* to = NULL;
-   DIR* dir;
-   struct dirent* entry;
-   int level;
-   int ws;
-   struct main_configuration* config;
-
-   config = (struct main_configuration*)shmem;
-
-   if (!(dir = opendir(directory)))
-   {
-      return;
-   }
-
-   level = config->compression_level;
-   if (level < 1)
+   if (workers != NULL)
    {
-      level = 1;
+      /* Spread the small files over the workers, and let the large files use */
+      /* the Zstandard threads once the workers are idle */
+      zstd_data(directory, encrypt, ZSTD_PASS_SMALL, controller, workers);
+      pgmoneta_workers_wait(workers);
+      zstd_data(directory, encrypt, ZSTD_PASS_LARGE, controller, workers);
    }
-   else if (level > 19)
+   else
    {
-      level = 19;
+      zstd_data(directory, encrypt, ZSTD_PASS_ALL, controller, NULL);
    }
+}
 
-   ws = config->workers != 0 ? config->workers : ZSTD_DEFAULT_NUMBER_OF_WORKERS;
-
-   zin_size = ZSTD_CStreamInSize();
-   zin = malloc(zin_size);
-   zout_size = ZSTD_CStreamOutSize();
-   zout = malloc(zout_size);
+void
+pgmoneta_zstandardc_tablespaces(char* root, bool encrypt, struct compression_controller* controller, struct workers* workers)
+{
+   DIR* dir;
+   struct dirent* entry;
+   int passes[] = {ZSTD_PASS_SMALL, ZSTD_PASS_LARGE};
 
-   cctx = ZSTD_createCCtx();
-   if (cctx == NULL)
+   if (workers == NULL)
    {
-      goto error;
+      passes[0] = ZSTD_PASS_ALL;
    }
 
-   ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
-   ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
-   ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, ws);
-
-   while ((entry = readdir(dir)) != NULL)
+   /* Each pass covers all tablespaces, so they are compressed at the same time */
+   for (int i = 0; i < (workers != NULL ? 2 : 1); i++)
    {
-      if (entry->d_type == DT_DIR)
+      if (i > 0)
       {
-         char path[1024];
-
-         if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
-         {
-            continue;
-         }
-
-         snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
-
-         pgmoneta_zstandardc_data(path, workers);
+         pgmoneta_workers_wait(workers);
       }
-      else if (entry->d_type == DT_REG)
+
+      if (!(dir = opendir(root)))
       {
-         if (pgmoneta_ends_with(entry->d_name, "backup_manifest") ||
-             pgmoneta_ends_with(entry->d_name, "backup_label"))
-         {
-            continue;
-         }
+         return;
+      }
 
-         if (!pgmoneta_is_compressed(entry->d_name) &&
-             !pgmoneta_is_encrypted(entry->d_name))
+      while ((entry = readdir(dir)) != NULL)
+      {
+         if (entry->d_type == DT_DIR)
          {
-            from = NULL;
-
-            from = pgmoneta_append(from, directory);
-            from = pgmoneta_append(from, "/");
-            from = pgmoneta_append(from, entry->d_name);
-
-            to = NULL;
+            char path[1024];
 
-            to = pgmoneta_append(to, directory);
-            to = pgmoneta_append(to, "/");
-            to = pgmoneta_append(to, entry->d_name);
-            to = pgmoneta_append(to, ".zstd");
-
-            if (pgmoneta_exists(from))
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 || strcmp(entry->d_name, "data") == 0)
             {
-               if (zstd_compress(from, to, cctx, zin_size, zin, zout_size, zout))
-               {
-                  pgmoneta_log_error("ZSTD: Could not compress %s/%s", directory, entry->d_name);
-                  break;
-               }
-
-               if (pgmoneta_exists(from))
-               {
-                  pgmoneta_delete_file(from, NULL);
-               }
-               else
-               {
-                  pgmoneta_log_debug("%s doesn't exists", from);
-               }
-
-               memset(zin, 0, zin_size);
-               memset(zout, 0, zout_size);
+               continue;
             }
 
-            free(from);
-            free(to);
+            snprintf(path, sizeof(path), "%s/%s", root, entry->d_name);
 
-            from = NULL;
-            to = NULL;
+            zstd_data(path, encrypt, passes[i], controller, workers);
          }
       }
-   }
-
-   closedir(dir);
-
-   ZSTD_freeCCtx(cctx);
-
-   free(zin);
-   free(zout);
-
-   free(from);
-   free(to);
-
-   return;
-
-error:
-
-   if (cctx != NULL)
-   {
-      ZSTD_freeCCtx(cctx);
-   }
-
-   free(zin);
-   free(zout);
-
-   free(from);
-   free(to);
-}
-
-void
-pgmoneta_zstandardc_tablespaces(char* root, struct workers* workers)
-{
-   DIR* dir;
-   struct dirent* entry;
-
-   if (!(dir = opendir(root)))
-   {
-      return;
-   }
-
-   while ((entry = readdir(dir)) != NULL)
-   {
-      if (entry->d_type == DT_DIR)
-      {
-         char path[1024];
-
-         if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 || strcmp(entry->d_name, "data") == 0)
-         {
-            continue;
-         }
-
-         snprintf(path, sizeof(path), "%s/%s", root, entry->d_name);
 
-         pgmoneta_zstandardc_data(path, workers);
-      }
+      closedir(dir);
    }
-
-   closedir(dir);
 }
 
 void
@@ -233,12 +229,16 @@ pgmoneta_zstandardc_wal(char* directory)
    size_t zout_size = -1;
    void* zout = NULL;
    ZSTD_CCtx* cctx = NULL;
+   struct zstd_context* zctx = NULL;
    char* from = NULL;
    char* to = NULL;
    DIR* dir;
    struct dirent* entry;
    int level;
    int workers;
+   bool encrypt;
+   void* dictionary = NULL;
+   size_t dictionary_size = 0;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
@@ -248,32 +248,37 @@ pgmoneta_zstandardc_wal(char* directory)
       return;
    }
 
-   level = config->compression_level;
-   if (level < 1)
-   {
-      level = 1;
-   }
-   else if (level > 19)
-   {
-      level = 19;
-   }
+   encrypt = pgmoneta_encrypt_stream_supported(config->encryption);
 
-   workers = config->workers != 0 ? config->workers : ZSTD_DEFAULT_NUMBER_OF_WORKERS;
+   level = zstd_level();
 
-   zin_size = ZSTD_CStreamInSize();
-   zin = malloc(zin_size);
-   zout_size = ZSTD_CStreamOutSize();
-   zout = malloc(zout_size);
+   workers = config->workers != 0 ? config->workers : ZSTD_DEFAULT_NUMBER_OF_WORKERS;
 
-   cctx = ZSTD_createCCtx();
-   if (cctx == NULL)
+   zctx = zstd_context_get(level, workers);
+   if (zctx == NULL)
    {
       goto error;
    }
 
-   ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
-   ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
-   ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, workers);
+   cctx = zctx->cctx;
+   zin_size = zctx->zin_size;
+   zin = zctx->zin;
+   zout_size = zctx->zout_size;
+   zout = zctx->zout;
+
+   if (config->wal_dictionary)
+   {
+      if (zstd_wal_dictionary(directory, &dictionary, &dictionary_size))
+      {
+         pgmoneta_log_warn("ZSTD: No WAL dictionary available for %s", directory);
+      }
+      else if (ZSTD_isError(ZSTD_CCtx_loadDictionary(cctx, dictionary, dictionary_size)))
+      {
+         pgmoneta_log_warn("ZSTD: Could not load the WAL dictionary for %s", directory);
+         free(dictionary);
+         dictionary = NULL;
+      }
+   }
 
    while ((entry = readdir(dir)) != NULL)
    {
@@ -299,10 +304,17 @@ pgmoneta_zstandardc_wal(char* directory)
          to = pgmoneta_append(to, "/");
          to = pgmoneta_append(to, entry->d_name);
          to = pgmoneta_append(to, ".zstd");
+         if (encrypt)
+         {
+            to = pgmoneta_append(to, ".aes");
+         }
 
          if (pgmoneta_exists(from))
          {
-            if (zstd_compress(from, to, cctx, zin_size, zin, zout_size, zout))
+            ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers,
+                                   pgmoneta_get_file_size(from) >= ZSTD_MULTITHREAD_THRESHOLD ? workers : 0);
+
+            if (zstd_compress(from, to, encrypt, false, cctx, zin_size, zin, zout_size, zout))
             {
                pgmoneta_log_error("ZSTD: Could not compress %s/%s", directory, entry->d_name);
                break;
@@ -317,9 +329,6 @@ pgmoneta_zstandardc_wal(char* directory)
                pgmoneta_log_debug("%s doesn't exists", from);
             }
             pgmoneta_permission(to, 6, 0, 0);
-
-            memset(zin, 0, zin_size);
-            memset(zout, 0, zout_size);
          }
 
          free(from);
@@ -332,10 +341,11 @@ pgmoneta_zstandardc_wal(char* directory)
 
    closedir(dir);
 
-   ZSTD_freeCCtx(cctx);
-
-   free(zin);
-   free(zout);
+   if (dictionary != NULL)
+   {
+      ZSTD_CCtx_loadDictionary(cctx, NULL, 0);
+      free(dictionary);
+   }
 
    free(from);
    free(to);
@@ -344,14 +354,6 @@ pgmoneta_zstandardc_wal(char* directory)
 
 error:
 
-   if (cctx != NULL)
-   {
-      ZSTD_freeCCtx(cctx);
-   }
-
-   free(zin);
-   free(zout);
-
    free(from);
    free(to);
 }
@@ -463,9 +465,9 @@ pgmoneta_zstandardd_file(char* from, char* to)
    if (pgmoneta_ends_with(from, ".zstd"))
    {
       zin_size = ZSTD_DStreamInSize();
-      zin = malloc(zin_size);
+      zin = pgmoneta_memory_buffer_get(zin_size);
       zout_size = ZSTD_DStreamOutSize();
-      zout = malloc(zout_size);
+      zout = pgmoneta_memory_buffer_get(zout_size);
 
       dctx = ZSTD_createDCtx();
       if (dctx == NULL)
@@ -495,8 +497,8 @@ pgmoneta_zstandardd_file(char* from, char* to)
 
    ZSTD_freeDCtx(dctx);
 
-   free(zin);
-   free(zout);
+   pgmoneta_memory_buffer_put(zin);
+   pgmoneta_memory_buffer_put(zout);
 
    return 0;
 
@@ -507,8 +509,60 @@ error:
       ZSTD_freeDCtx(dctx);
    }
 
-   free(zin);
-   free(zout);
+   pgmoneta_memory_buffer_put(zin);
+   pgmoneta_memory_buffer_put(zout);
+
+   return 1;
+}
+
+int
+pgmoneta_zstandardd_reader(struct reader* source, struct reader** reader)
+{
+   struct zstd_reader* zr = NULL;
+
+   *reader = NULL;
+
+   zr = (struct zstd_reader*)malloc(sizeof(struct zstd_reader));
+   if (zr == NULL)
+   {
+      goto error;
+   }
+
+   memset(zr, 0, sizeof(struct zstd_reader));
+
+   zr->dctx = ZSTD_createDCtx();
+   if (zr->dctx == NULL)
+   {
+      goto error;
+   }
+
+   zr->zin_size = ZSTD_DStreamInSize();
+   zr->zin = pgmoneta_memory_buffer_get(zr->zin_size);
+   if (zr->zin == NULL)
+   {
+      goto error;
+   }
+
+   zr->input.src = zr->zin;
+   zr->first = true;
+
+   if (pgmoneta_reader_create(source, zstd_reader_read, zstd_reader_close, zr, reader))
+   {
+      goto error;
+   }
+
+   return 0;
+
+error:
+
+   if (zr != NULL)
+   {
+      struct reader r;
+
+      memset(&r, 0, sizeof(struct reader));
+      r.state = zr;
+      zstd_reader_close(&r);
+   }
 
    return 1;
 }
@@ -533,7 +587,7 @@ pgmoneta_zstandardd_directory(char* directory, struct workers* workers)
    }
 
    zin_size = ZSTD_DStreamInSize();
-   zin = malloc(zin_size);
+   zin = pgmoneta_memory_buffer_get(zin_size);
 
    if (zin == NULL)
    {
@@ -541,7 +595,7 @@ pgmoneta_zstandardd_directory(char* directory, struct workers* workers)
    }
 
    zout_size = ZSTD_DStreamOutSize();
-   zout = malloc(zout_size);
+   zout = pgmoneta_memory_buffer_get(zout_size);
 
    if (zout == NULL)
    {
@@ -634,8 +688,8 @@ pgmoneta_zstandardd_directory(char* directory, struct workers* workers)
 
    ZSTD_freeDCtx(dctx);
 
-   free(zin);
-   free(zout);
+   pgmoneta_memory_buffer_put(zin);
+   pgmoneta_memory_buffer_put(zout);
 
    free(from);
    free(to);
@@ -650,8 +704,8 @@ error:
       ZSTD_freeDCtx(dctx);
    }
 
-   free(zin);
-   free(zout);
+   pgmoneta_memory_buffer_put(zin);
+   pgmoneta_memory_buffer_put(zout);
 
    free(name);
    free(from);
@@ -758,40 +812,35 @@ pgmoneta_zstandardc_file(char* from, char* to)
    size_t zout_size = -1;
    void* zout = NULL;
    ZSTD_CCtx* cctx = NULL;
+   struct zstd_context* zctx = NULL;
    int level;
    int workers;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
 
-   level = config->compression_level;
-   if (level < 1)
-   {
-      level = 1;
-   }
-   else if (level > 19)
-   {
-      level = 19;
-   }
+   level = zstd_level();
 
    workers = config->workers != 0 ? config->workers : ZSTD_DEFAULT_NUMBER_OF_WORKERS;
 
-   zin_size = ZSTD_CStreamInSize();
-   zin = malloc(zin_size);
-   zout_size = ZSTD_CStreamOutSize();
-   zout = malloc(zout_size);
+   if (pgmoneta_get_file_size(from) < ZSTD_MULTITHREAD_THRESHOLD)
+   {
+      workers = 0;
+   }
 
-   cctx = ZSTD_createCCtx();
-   if (cctx == NULL)
+   zctx = zstd_context_get(level, workers);
+   if (zctx == NULL)
    {
       goto error;
    }
 
-   ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
-   ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
-   ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, workers);
+   cctx = zctx->cctx;
+   zin_size = zctx->zin_size;
+   zin = zctx->zin;
+   zout_size = zctx->zout_size;
+   zout = zctx->zout;
 
-   if (zstd_compress(from, to, cctx, zin_size, zin, zout_size, zout))
+   if (zstd_compress(from, to, false, false, cctx, zin_size, zin, zout_size, zout))
    {
       goto error;
    }
@@ -807,162 +856,1465 @@ pgmoneta_zstandardc_file(char* from, char* to)
       }
    }
 
-   ZSTD_freeCCtx(cctx);
-
-   free(zin);
-   free(zout);
-
    return 0;
 
 error:
 
-   if (cctx != NULL)
-   {
-      ZSTD_freeCCtx(cctx);
-   }
-
-   free(zin);
-   free(zout);
-
    return 1;
 }
 
 int
-pgmoneta_zstdc_string(char* s, unsigned char** buffer, size_t* buffer_size)
+pgmoneta_zstandardd_seekable_open(char* path, struct zstd_seekable** seekable)
 {
-   size_t input_size;
-   size_t max_compressed_size;
-   size_t compressed_size;
+   unsigned char footer[ZSTD_SEEKABLE_FOOTER_SIZE];
+   unsigned char header[8];
+   unsigned char entry[12];
+   unsigned char descriptor;
+   size_t entry_size;
+   long file_size;
+   long table_size;
+   uint32_t number_of_frames;
+   struct zstd_seekable* s = NULL;
+
+   *seekable = NULL;
+
+   s = (struct zstd_seekable*)malloc(sizeof(struct zstd_seekable));
+   if (s == NULL)
+   {
+      goto error;
+   }
 
-   input_size = strlen(s);
-   max_compressed_size = ZSTD_compressBound(input_size);
+   memset(s, 0, sizeof(struct zstd_seekable));
+   s->current = -1;
 
-   *buffer = (unsigned char*)malloc(max_compressed_size);
-   if (*buffer == NULL)
+   s->fp = fopen(path, "rb");
+   if (s->fp == NULL)
    {
-      pgmoneta_log_error("ZSTD: Allocation failed");
-      return 1;
+      goto error;
    }
 
-   compressed_size = ZSTD_compress(*buffer, max_compressed_size, s, input_size, 1);
-   if (ZSTD_isError(compressed_size))
+   if (fseek(s->fp, 0, SEEK_END) != 0 || (file_size = ftell(s->fp)) < (long)(8 + ZSTD_SEEKABLE_FOOTER_SIZE))
    {
-      pgmoneta_log_error("ZSTD: Compression error: %s", ZSTD_getErrorName(compressed_size));
-      free(*buffer);
-      return 1;
+      goto error;
    }
 
-   *buffer_size = compressed_size;
-
-   return 0;
-}
+   if (fseek(s->fp, file_size - ZSTD_SEEKABLE_FOOTER_SIZE, SEEK_SET) != 0 ||
+       fread(footer, 1, sizeof(footer), s->fp) != sizeof(footer))
+   {
+      goto error;
+   }
 
-int
-pgmoneta_zstdd_string(unsigned char* compressed_buffer, size_t compressed_size, char** output_string)
-{
-   size_t decompressed_size;
-   size_t result;
+   if (zstd_get_le32(footer + 5) != ZSTD_SEEKABLE_MAGIC)
+   {
+      goto error;
+   }
 
-   decompressed_size = ZSTD_getFrameContentSize(compressed_buffer, compressed_size);
+   number_of_frames = zstd_get_le32(footer);
+   descriptor = footer[4];
+   entry_size = (descriptor & 0x80) ? 12 : ZSTD_SEEKABLE_ENTRY_SIZE;
 
-   if (decompressed_size == ZSTD_CONTENTSIZE_ERROR)
+   table_size = 8 + (long)(number_of_frames * entry_size) + ZSTD_SEEKABLE_FOOTER_SIZE;
+   if (number_of_frames == 0 || table_size > file_size)
    {
-      pgmoneta_log_error("ZSTD: Not a valid compressed buffer");
-      return 1;
+      goto error;
+   }
+
+   if (fseek(s->fp, file_size - table_size, SEEK_SET) != 0 ||
+       fread(header, 1, sizeof(header), s->fp) != sizeof(header))
+   {
+      goto error;
+   }
+
+   if (zstd_get_le32(header) != ZSTD_SEEKABLE_SKIPPABLE_MAGIC ||
+       zstd_get_le32(header + 4) != (uint32_t)(table_size - 8))
+   {
+      goto error;
+   }
+
+   s->number_of_frames = number_of_frames;
+   s->compressed_offsets = (uint64_t*)malloc((number_of_frames + 1) * sizeof(uint64_t));
+   s->decompressed_offsets = (uint64_t*)malloc((number_of_frames + 1) * sizeof(uint64_t));
+   if (s->compressed_offsets == NULL || s->decompressed_offsets == NULL)
+   {
+      goto error;
+   }
+
+   s->compressed_offsets[0] = 0;
+   s->decompressed_offsets[0] = 0;
+
+   for (uint32_t i = 0; i < number_of_frames; i++)
+   {
+      uint32_t csize;
+      uint32_t dsize;
+
+      if (fread(entry, 1, entry_size, s->fp) != entry_size)
+      {
+         goto error;
+      }
+
+      csize = zstd_get_le32(entry);
+      dsize = zstd_get_le32(entry + 4);
+
+      s->compressed_offsets[i + 1] = s->compressed_offsets[i] + csize;
+      s->decompressed_offsets[i + 1] = s->decompressed_offsets[i] + dsize;
+
+      if (csize > s->input_capacity)
+      {
+         s->input_capacity = csize;
+      }
+
+      if (dsize > s->frame_capacity)
+      {
+         s->frame_capacity = dsize;
+      }
+   }
+
+   if (s->compressed_offsets[number_of_frames] != (uint64_t)(file_size - table_size))
+   {
+      goto error;
+   }
+
+   s->input = malloc(s->input_capacity > 0 ? s->input_capacity : 1);
+   s->frame = malloc(s->frame_capacity > 0 ? s->frame_capacity : 1);
+   s->dctx = ZSTD_createDCtx();
+
+   if (s->input == NULL || s->frame == NULL || s->dctx == NULL)
+   {
+      goto error;
+   }
+
+   *seekable = s;
+
+   return 0;
+
+error:
+
+   pgmoneta_zstandardd_seekable_close(s);
+
+   return 1;
+}
+
+size_t
+pgmoneta_zstandardd_seekable_read(struct zstd_seekable* seekable, uint64_t offset, void* buffer, size_t size)
+{
+   size_t total = 0;
+
+   while (total < size && offset < seekable->decompressed_offsets[seekable->number_of_frames])
+   {
+      uint32_t low = 0;
+      uint32_t high = seekable->number_of_frames - 1;
+      uint64_t start;
+      uint64_t length;
+      size_t n;
+
+      while (low < high)
+      {
+         uint32_t mid = low + (high - low + 1) / 2;
+
+         if (seekable->decompressed_offsets[mid] <= offset)
+         {
+            low = mid;
+         }
+         else
+         {
+            high = mid - 1;
+         }
+      }
+
+      start = seekable->decompressed_offsets[low];
+      length = seekable->decompressed_offsets[low + 1] - start;
+
+      if (seekable->current != (int64_t)low)
+      {
+         size_t csize = seekable->compressed_offsets[low + 1] - seekable->compressed_offsets[low];
+         size_t ret;
+
+         seekable->current = -1;
+
+         if (fseeko(seekable->fp, (off_t)seekable->compressed_offsets[low], SEEK_SET) != 0 ||
+             fread(seekable->input, 1, csize, seekable->fp) != csize)
+         {
+            pgmoneta_log_error("ZSTD: Could not read frame %u", low);
+            break;
+         }
+
+         ret = ZSTD_decompressDCtx((ZSTD_DCtx*)seekable->dctx, seekable->frame, length, seekable->input, csize);
+         if (ZSTD_isError(ret) || ret != length)
+         {
+            pgmoneta_log_error("ZSTD: Could not decompress frame %u", low);
+            break;
+         }
+
+         seekable->current = low;
+      }
+
+      n = MIN(size - total, (size_t)(length - (offset - start)));
+      memcpy((char*)buffer + total, (char*)seekable->frame + (offset - start), n);
+
+      total += n;
+      offset += n;
+   }
+
+   return total;
+}
+
+void
+pgmoneta_zstandardd_seekable_close(struct zstd_seekable* seekable)
+{
+   if (seekable != NULL)
+   {
+      if (seekable->fp != NULL)
+      {
+         fclose(seekable->fp);
+      }
+
+      if (seekable->dctx != NULL)
+      {
+         ZSTD_freeDCtx((ZSTD_DCtx*)seekable->dctx);
+      }
+
+      free(seekable->compressed_offsets);
+      free(seekable->decompressed_offsets);
+      free(seekable->input);
+      free(seekable->frame);
+      free(seekable);
+   }
+}
+
+int
+pgmoneta_zstandardd_parallel(char* from, char* to, struct workers* workers)
+{
+   struct zstd_parallel* file = NULL;
+   struct zstd_seekable* seekable = NULL;
+   char* copy = NULL;
+   uint32_t per_range;
+   int fd = -1;
+
+   if (workers == NULL || workers->number_of_alive < 2 || pgmoneta_is_encrypted(from) ||
+       pgmoneta_zstandardd_seekable_open(from, &seekable))
+   {
+      return 1;
+   }
+
+   /* Small files keep a worker each */
+   if (seekable->number_of_frames < 2 ||
+       seekable->decompressed_offsets[seekable->number_of_frames] < ZSTD_MULTITHREAD_THRESHOLD)
+   {
+      pgmoneta_zstandardd_seekable_close(seekable);
+      return 1;
+   }
+
+   copy = strdup(to);
+   if (copy == NULL || pgmoneta_mkdir(dirname(copy)))
+   {
+      goto error;
+   }
+
+   /* The ranges are written in place, in any order */
+   fd = open(to, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+   if (fd == -1 || ftruncate(fd, (off_t)seekable->decompressed_offsets[seekable->number_of_frames]) != 0)
+   {
+      pgmoneta_log_error("ZSTD: Could not create %s: %s", to, strerror(errno));
+      goto error;
+   }
+   close(fd);
+   fd = -1;
+
+   file = (struct zstd_parallel*)malloc(sizeof(struct zstd_parallel));
+   if (file == NULL)
+   {
+      goto error;
+   }
+
+   memset(file, 0, sizeof(struct zstd_parallel));
+   file->from = strdup(from);
+   file->to = strdup(to);
+   file->seekable = seekable;
+   seekable = NULL;
+
+   if (file->from == NULL || file->to == NULL)
+   {
+      goto error;
+   }
+
+   /* A few ranges per worker, so the workers finish together */
+   per_range = file->seekable->number_of_frames / (uint32_t)(workers->number_of_alive * 4);
+   if (per_range == 0)
+   {
+      per_range = 1;
+   }
+
+   /* The reference of this function is released once every range is queued */
+   atomic_init(&file->references, 1);
+
+   for (uint32_t first = 0; first < file->seekable->number_of_frames; first += per_range)
+   {
+      struct zstd_range* range = NULL;
+
+      range = (struct zstd_range*)malloc(sizeof(struct zstd_range));
+      if (range == NULL)
+      {
+         workers->outcome = false;
+         break;
+      }
+
+      memset(range, 0, sizeof(struct zstd_range));
+      range->common.workers = workers;
+      range->file = file;
+      range->first = first;
+      range->last = MIN(first + per_range, file->seekable->number_of_frames);
+      range->common.size = file->seekable->compressed_offsets[range->last] - file->seekable->compressed_offsets[range->first];
+
+      atomic_fetch_add(&file->references, 1);
+
+      if (pgmoneta_workers_add(workers, do_zstd_range, (struct worker_common*)range))
+      {
+         atomic_fetch_sub(&file->references, 1);
+         workers->outcome = false;
+         free(range);
+         break;
+      }
+   }
+
+   zstd_parallel_release(file);
+
+   free(copy);
+
+   return 0;
+
+error:
+
+   if (fd != -1)
+   {
+      close(fd);
+   }
+
+   if (file != NULL)
+   {
+      pgmoneta_zstandardd_seekable_close(file->seekable);
+      free(file->from);
+      free(file->to);
+      free(file);
+   }
+
+   pgmoneta_zstandardd_seekable_close(seekable);
+   pgmoneta_delete_file(to, NULL);
+
+   free(copy);
+
+   return 1;
+}
+
+int
+pgmoneta_zstdc_string(char* s, unsigned char** buffer, size_t* buffer_size)
+{
+   size_t input_size;
+   size_t max_compressed_size;
+   size_t compressed_size;
+
+   input_size = strlen(s);
+   max_compressed_size = ZSTD_compressBound(input_size);
+
+   *buffer = (unsigned char*)malloc(max_compressed_size);
+   if (*buffer == NULL)
+   {
+      pgmoneta_log_error("ZSTD: Allocation failed");
+      return 1;
+   }
+
+   compressed_size = ZSTD_compress(*buffer, max_compressed_size, s, input_size, 1);
+   if (ZSTD_isError(compressed_size))
+   {
+      pgmoneta_log_error("ZSTD: Compression error: %s", ZSTD_getErrorName(compressed_size));
+      free(*buffer);
+      return 1;
+   }
+
+   *buffer_size = compressed_size;
+
+   return 0;
+}
+
+int
+pgmoneta_zstdd_string(unsigned char* compressed_buffer, size_t compressed_size, char** output_string)
+{
+   size_t decompressed_size;
+   size_t result;
+
+   decompressed_size = ZSTD_getFrameContentSize(compressed_buffer, compressed_size);
+
+   if (decompressed_size == ZSTD_CONTENTSIZE_ERROR)
+   {
+      pgmoneta_log_error("ZSTD: Not a valid compressed buffer");
+      return 1;
    }
    if (decompressed_size == ZSTD_CONTENTSIZE_UNKNOWN)
    {
-      pgmoneta_log_error("ZSTD: Unknown decompressed size");
-      return 1;
+      pgmoneta_log_error("ZSTD: Unknown decompressed size");
+      return 1;
+   }
+
+   *output_string = (char*)malloc(decompressed_size + 1);
+   if (*output_string == NULL)
+   {
+      pgmoneta_log_error("ZSTD: Allocation failed");
+      return 1;
+   }
+
+   result = ZSTD_decompress(*output_string, decompressed_size, compressed_buffer, compressed_size);
+   if (ZSTD_isError(result))
+   {
+      pgmoneta_log_error("ZSTD: Compression error: %s", ZSTD_getErrorName(result));
+      free(*output_string);
+      return 1;
+   }
+
+   (*output_string)[decompressed_size] = '\0';
+
+   return 0;
+}
+
+static void
+zstd_data(char* directory, bool encrypt, int pass, struct compression_controller* controller, struct workers* workers)
+{
+   char* from = NULL;
+   char* to = NULL;
+   DIR* dir;
+   struct dirent* entry;
+   struct worker_input* wi = NULL;
+   bool large;
+   int level;
+   int ws;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (!(dir = opendir(directory)))
+   {
+      return;
+   }
+
+   level = zstd_level();
+
+   if (workers != NULL)
+   {
+      ws = workers->number_of_alive;
+   }
+   else
+   {
+      ws = config->workers != 0 ? config->workers : ZSTD_DEFAULT_NUMBER_OF_WORKERS;
+   }
+
+   while ((entry = readdir(dir)) != NULL)
+   {
+      if (entry->d_type == DT_DIR)
+      {
+         char path[1024];
+
+         if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+         {
+            continue;
+         }
+
+         snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+
+         zstd_data(path, encrypt, pass, controller, workers);
+      }
+      else if (entry->d_type == DT_REG)
+      {
+         if (pgmoneta_ends_with(entry->d_name, "backup_manifest") ||
+             pgmoneta_ends_with(entry->d_name, "backup_label"))
+         {
+            continue;
+         }
+
+         if (!pgmoneta_is_compressed(entry->d_name) &&
+             !pgmoneta_is_encrypted(entry->d_name))
+         {
+            from = NULL;
+
+            from = pgmoneta_append(from, directory);
+            from = pgmoneta_append(from, "/");
+            from = pgmoneta_append(from, entry->d_name);
+
+            to = NULL;
+
+            to = pgmoneta_append(to, directory);
+            to = pgmoneta_append(to, "/");
+            to = pgmoneta_append(to, entry->d_name);
+            to = pgmoneta_append(to, ".zstd");
+            if (encrypt)
+            {
+               to = pgmoneta_append(to, ".aes");
+            }
+
+            large = pgmoneta_get_file_size(from) >= ZSTD_MULTITHREAD_THRESHOLD;
+
+            if (pass == ZSTD_PASS_SMALL && !large)
+            {
+               if (workers->outcome)
+               {
+                  if (pgmoneta_create_worker_input(directory, from, to, level, workers, &wi))
+                  {
+                     workers->outcome = false;
+                  }
+                  else
+                  {
+                     wi->controller = controller;
+                     pgmoneta_workers_add(workers, do_zstd_compress, (struct worker_common*)wi);
+                  }
+               }
+            }
+            else if (pass == ZSTD_PASS_ALL || (pass == ZSTD_PASS_LARGE && large))
+            {
+               if (zstd_compress_controlled(from, to, encrypt, level, large ? ws : 0, controller))
+               {
+                  pgmoneta_log_error("ZSTD: Could not compress %s/%s", directory, entry->d_name);
+                  if (workers != NULL)
+                  {
+                     workers->outcome = false;
+                  }
+                  break;
+               }
+            }
+
+            free(from);
+            free(to);
+
+            from = NULL;
+            to = NULL;
+         }
+      }
+   }
+
+   closedir(dir);
+
+   free(from);
+   free(to);
+}
+
+static int
+zstd_level(void)
+{
+   int level;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   level = config->compression_level;
+   if (level < 1)
+   {
+      level = 1;
+   }
+   else if (level > 19)
+   {
+      level = 19;
+   }
+
+   return level;
+}
+
+static int
+zstd_compress_file(char* from, char* to, bool encrypt, int level, int workers)
+{
+   struct zstd_context* zctx = NULL;
+   bool raw = false;
+
+   if (!pgmoneta_exists(from))
+   {
+      pgmoneta_log_debug("%s doesn't exists", from);
+      return 0;
+   }
+
+   zctx = zstd_context_get(level, workers);
+   if (zctx == NULL)
+   {
+      return 1;
+   }
+
+   /* Data that is compressed already, like TOAST or bytea blobs, is stored */
+   if (pgmoneta_get_file_size(from) >= ZSTD_PROBE_THRESHOLD)
+   {
+      raw = zstd_incompressible(from, zctx->cctx, zctx->zin_size, zctx->zin, zctx->zout_size, zctx->zout);
+      if (raw)
+      {
+         pgmoneta_log_debug("ZSTD: Storing %s", from);
+      }
+   }
+
+   if (zstd_compress(from, to, encrypt, raw, zctx->cctx, zctx->zin_size, zctx->zin, zctx->zout_size, zctx->zout))
+   {
+      return 1;
+   }
+
+   pgmoneta_delete_file(from, NULL);
+
+   return 0;
+}
+
+static int
+zstd_compress_controlled(char* from, char* to, bool encrypt, int level, int workers,
+                         struct compression_controller* controller)
+{
+   size_t size;
+   struct timespec start_t;
+   struct timespec end_t;
+
+   if (controller == NULL)
+   {
+      return zstd_compress_file(from, to, encrypt, level, workers);
+   }
+
+   size = pgmoneta_get_file_size(from);
+   level = pgmoneta_compression_controller_level(controller);
+
+#ifdef HAVE_FREEBSD
+   clock_gettime(CLOCK_MONOTONIC_FAST, &start_t);
+#else
+   clock_gettime(CLOCK_MONOTONIC_RAW, &start_t);
+#endif
+
+   if (zstd_compress_file(from, to, encrypt, level, workers))
+   {
+      return 1;
+   }
+
+#ifdef HAVE_FREEBSD
+   clock_gettime(CLOCK_MONOTONIC_FAST, &end_t);
+#else
+   clock_gettime(CLOCK_MONOTONIC_RAW, &end_t);
+#endif
+
+   /* A large file keeps all the threads busy, so account for each of them */
+   pgmoneta_compression_controller_update(controller, size,
+                                          pgmoneta_compute_duration(start_t, end_t) * (workers > 1 ? workers : 1));
+
+   return 0;
+}
+
+static void
+do_zstd_compress(struct worker_common* wc)
+{
+   struct worker_input* wi = (struct worker_input*)wc;
+
+   if (zstd_compress_controlled(wi->from, wi->to, pgmoneta_is_encrypted(wi->to), wi->level, 0, wi->controller))
+   {
+      pgmoneta_log_error("ZSTD: Could not compress %s", wi->from);
+      wi->common.workers->outcome = false;
+   }
+   else
+   {
+      pgmoneta_drop_cache(wi->to);
+   }
+
+   free(wi);
+}
+
+static struct zstd_context*
+zstd_context_get(int level, int workers)
+{
+   struct zstd_context* zctx = NULL;
+
+   zctx = (struct zstd_context*)pgmoneta_workers_context_get(WORKER_CONTEXT_ZSTD, level);
+   if (zctx != NULL)
+   {
+      ZSTD_CCtx_reset(zctx->cctx, ZSTD_reset_session_only);
+      ZSTD_CCtx_setParameter(zctx->cctx, ZSTD_c_nbWorkers, workers);
+      return zctx;
+   }
+
+   zctx = (struct zstd_context*)malloc(sizeof(struct zstd_context));
+   if (zctx == NULL)
+   {
+      goto error;
+   }
+
+   memset(zctx, 0, sizeof(struct zstd_context));
+
+   zctx->zin_size = ZSTD_CStreamInSize();
+   zctx->zin = pgmoneta_memory_buffer_get(zctx->zin_size);
+   zctx->zout_size = ZSTD_CStreamOutSize();
+   zctx->zout = pgmoneta_memory_buffer_get(zctx->zout_size);
+   zctx->cctx = ZSTD_createCCtx();
+
+   if (zctx->zin == NULL || zctx->zout == NULL || zctx->cctx == NULL)
+   {
+      goto error;
+   }
+
+   ZSTD_CCtx_setParameter(zctx->cctx, ZSTD_c_compressionLevel, level);
+   ZSTD_CCtx_setParameter(zctx->cctx, ZSTD_c_checksumFlag, 1);
+   ZSTD_CCtx_setParameter(zctx->cctx, ZSTD_c_nbWorkers, workers);
+
+   pgmoneta_workers_context_put(WORKER_CONTEXT_ZSTD, level, zctx, zstd_context_destroy);
+
+   return zctx;
+
+error:
+
+   zstd_context_destroy(zctx);
+
+   return NULL;
+}
+
+static void
+zstd_context_destroy(void* context)
+{
+   struct zstd_context* zctx = (struct zstd_context*)context;
+
+   if (zctx != NULL)
+   {
+      if (zctx->cctx != NULL)
+      {
+         ZSTD_freeCCtx(zctx->cctx);
+      }
+
+      pgmoneta_memory_buffer_put(zctx->zin);
+      pgmoneta_memory_buffer_put(zctx->zout);
+      free(zctx);
+   }
+}
+
+/**
+ * Compress probe blocks spread over a file
+ * @param from The file
+ * @param cctx The compression context
+ * @param zin_size The size of the input buffer
+ * @param zin The input buffer
+ * @param zout_size The size of the output buffer
+ * @param zout The output buffer
+ * @return True if the probes compress less than ZSTD_PROBE_RATIO
+ */
+static bool
+zstd_incompressible(char* from, ZSTD_CCtx* cctx, size_t zin_size, void* zin, size_t zout_size, void* zout)
+{
+   FILE* fin = NULL;
+   uint64_t size = 0;
+   uint64_t in = 0;
+   uint64_t out = 0;
+
+   fin = fopen(from, "rb");
+   if (fin == NULL)
+   {
+      return false;
+   }
+
+   size = pgmoneta_get_file_size(from);
+
+   for (int i = 0; i < ZSTD_PROBES; i++)
+   {
+      size_t read = 0;
+      size_t compressed = 0;
+
+      if (fseeko(fin, (off_t)(size / ZSTD_PROBES * i), SEEK_SET))
+      {
+         break;
+      }
+
+      read = fread(zin, sizeof(char), zin_size, fin);
+      if (read == 0)
+      {
+         break;
+      }
+
+      compressed = ZSTD_compress2(cctx, zout, zout_size, zin, read);
+      if (ZSTD_isError(compressed))
+      {
+         break;
+      }
+
+      in += read;
+      out += compressed;
+   }
+
+   ZSTD_CCtx_reset(cctx, ZSTD_reset_session_only);
+
+   fclose(fin);
+
+   return in > 0 && (double)out >= (double)in * ZSTD_PROBE_RATIO;
+}
+
+/**
+ * Write data as raw blocks of a Zstandard frame, so any decoder reads it
+ * @param fout The file
+ * @param ectx The encryption context, or NULL
+ * @param eout The encryption buffer
+ * @param header Does the data start a frame
+ * @param data The data
+ * @param size The size of the data
+ * @param last Does the data end the frame
+ * @param written [out] The number of bytes written
+ * @return 0 on success, otherwise 1
+ */
+static int
+zstd_write_raw(FILE* fout, EVP_CIPHER_CTX* ectx, unsigned char* eout, bool header, void* data, size_t size, bool last, size_t* written)
+{
+   unsigned char h[6];
+   size_t offset = 0;
+
+   *written = 0;
+
+   if (header)
+   {
+      /* No content size and a window of ZSTD_RAW_BLOCK_SIZE */
+      zstd_put_le32(&h[0], ZSTD_FRAME_MAGIC);
+      h[4] = 0x00;
+      h[5] = 7 << 3;
+
+      if (zstd_write(fout, ectx, eout, &h[0], 6))
+      {
+         return 1;
+      }
+      *written += 6;
+   }
+
+   do
+   {
+      size_t block = MIN(size - offset, (size_t)ZSTD_RAW_BLOCK_SIZE);
+      bool final = last && offset + block == size;
+      uint32_t block_header = (uint32_t)(block << 3) | (final ? 1 : 0);
+
+      h[0] = block_header & 0xFF;
+      h[1] = (block_header >> 8) & 0xFF;
+      h[2] = (block_header >> 16) & 0xFF;
+
+      /* An empty block is only written to end the frame */
+      if (block > 0 || final)
+      {
+         if (zstd_write(fout, ectx, eout, &h[0], 3) ||
+             zstd_write(fout, ectx, eout, (unsigned char*)data + offset, block))
+         {
+            return 1;
+         }
+         *written += 3 + block;
+      }
+
+      offset += block;
+   }
+   while (offset < size);
+
+   return 0;
+}
+
+static int
+zstd_compress(char* from, char* to, bool encrypt, bool raw, ZSTD_CCtx* cctx, size_t zin_size, void* zin, size_t zout_size, void* zout)
+{
+   FILE* fin = NULL;
+   FILE* fout = NULL;
+   EVP_CIPHER_CTX* ectx = NULL;
+   unsigned char* eout = NULL;
+   size_t eout_size = 0;
+   size_t toRead;
+   size_t frame_size;
+   size_t frame_in = 0;
+   size_t frame_out = 0;
+   uint32_t* frames = NULL;
+   uint32_t number_of_frames = 0;
+   uint32_t frames_capacity = 0;
+   struct main_configuration* config;
+   uint64_t start;
+
+   PGMONETA_PROFILE(PROFILE_ZSTD_COMPRESS);
+
+   PGMONETA_TRACE2(compress_start, from, COMPRESSION_CLIENT_ZSTD);
+
+   start = pgmoneta_prometheus_now();
+
+   config = (struct main_configuration*)shmem;
+
+   frame_size = config->compression_frame_size > 0 ? (size_t)config->compression_frame_size : 0;
+
+   if (encrypt)
+   {
+      if (pgmoneta_encrypt_stream_create(to, &ectx))
+      {
+         goto error;
+      }
+
+      eout = (unsigned char*)malloc(zout_size + EVP_MAX_BLOCK_LENGTH);
+      if (eout == NULL)
+      {
+         goto error;
+      }
+   }
+
+   fin = fopen(from, "rb");
+
+   if (fin == NULL)
+   {
+      goto error;
+   }
+
+   fout = fopen(to, "wb");
+
+   if (fout == NULL)
+   {
+      goto error;
+   }
+
+   for (;;)
+   {
+      toRead = zin_size;
+      if (frame_size > 0 && frame_size - frame_in < toRead)
+      {
+         toRead = frame_size - frame_in;
+      }
+
+      size_t read = fread(zin, sizeof(char), toRead, fin);
+      int lastChunk = (read < toRead);
+      int lastInFrame = lastChunk || (frame_size > 0 && frame_in + read == frame_size);
+      ZSTD_EndDirective mode = lastInFrame ? ZSTD_e_end : ZSTD_e_continue;
+      ZSTD_inBuffer input = {zin, read, 0};
+      int finished;
+
+      if (raw)
+      {
+         size_t written = 0;
+
+         if (zstd_write_raw(fout, ectx, eout, frame_in == 0, zin, read, lastInFrame, &written))
+         {
+            goto error;
+         }
+         frame_out += written;
+      }
+      else
+      {
+         do
+         {
+            ZSTD_outBuffer output = {zout, zout_size, 0};
+            size_t remaining = ZSTD_compressStream2(cctx, &output, &input, mode);
+            if (ZSTD_isError(remaining))
+            {
+               pgmoneta_log_error("ZSTD: Compression error: %s", ZSTD_getErrorName(remaining));
+               goto error;
+            }
+            if (zstd_write(fout, ectx, eout, zout, output.pos))
+            {
+               goto error;
+            }
+            frame_out += output.pos;
+            finished = lastInFrame ? (remaining == 0) : (input.pos == input.size);
+         }
+         while (!finished);
+      }
+
+      frame_in += read;
+
+      if (frame_size > 0 && lastInFrame)
+      {
+         if (number_of_frames == frames_capacity)
+         {
+            uint32_t* f = NULL;
+
+            frames_capacity = frames_capacity == 0 ? 64 : frames_capacity * 2;
+            f = (uint32_t*)realloc(frames, 2 * frames_capacity * sizeof(uint32_t));
+            if (f == NULL)
+            {
+               goto error;
+            }
+            frames = f;
+         }
+
+         frames[2 * number_of_frames] = (uint32_t)frame_out;
+         frames[2 * number_of_frames + 1] = (uint32_t)frame_in;
+         number_of_frames++;
+
+         frame_in = 0;
+         frame_out = 0;
+      }
+
+      if (lastChunk)
+      {
+         break;
+      }
+   }
+
+   if (frame_size > 0)
+   {
+      if (zstd_write_seek_table(fout, ectx, eout, zout, zout_size, frames, number_of_frames))
+      {
+         goto error;
+      }
+   }
+
+   if (ectx != NULL)
+   {
+      if (pgmoneta_encrypt_stream_final(ectx, eout, &eout_size))
+      {
+         goto error;
+      }
+      fwrite(eout, sizeof(char), eout_size, fout);
+   }
+
+   pgmoneta_encrypt_stream_destroy(ectx);
+   free(eout);
+   free(frames);
+
+   fclose(fout);
+   fclose(fin);
+
+   pgmoneta_prometheus_file(FILE_OPERATION_COMPRESS, start);
+
+   PGMONETA_TRACE3(compress_done, from, COMPRESSION_CLIENT_ZSTD, 0);
+
+   return 0;
+
+error:
+
+   pgmoneta_encrypt_stream_destroy(ectx);
+   free(eout);
+   free(frames);
+
+   if (fout != NULL)
+   {
+      fclose(fout);
+   }
+
+   if (fin != NULL)
+   {
+      fclose(fin);
+   }
+
+   PGMONETA_TRACE3(compress_done, from, COMPRESSION_CLIENT_ZSTD, 1);
+
+   return 1;
+}
+
+static int
+zstd_wal_dictionary(char* directory, void** dictionary, size_t* dictionary_size)
+{
+   char* dictionary_directory = NULL;
+   char* newest = NULL;
+   time_t newest_time = 0;
+   DIR* dir = NULL;
+   struct dirent* entry;
+   struct stat st;
+   char path[MAX_PATH];
+
+   *dictionary = NULL;
+   *dictionary_size = 0;
+
+   /* The dictionaries live next to the wal directory of the server */
+   dictionary_directory = pgmoneta_append(dictionary_directory, directory);
+   if (!pgmoneta_ends_with(dictionary_directory, "/"))
+   {
+      dictionary_directory = pgmoneta_append(dictionary_directory, "/");
+   }
+   dictionary_directory = pgmoneta_append(dictionary_directory, "../wal_dictionary/");
+
+   pgmoneta_mkdir(dictionary_directory);
+
+   if ((dir = opendir(dictionary_directory)) != NULL)
+   {
+      while ((entry = readdir(dir)) != NULL)
+      {
+         if (entry->d_type != DT_REG || !pgmoneta_ends_with(entry->d_name, ".dict"))
+         {
+            continue;
+         }
+
+         snprintf(path, sizeof(path), "%s%s", dictionary_directory, entry->d_name);
+
+         if (stat(path, &st) == 0 && (newest == NULL || st.st_mtime > newest_time))
+         {
+            free(newest);
+            newest = pgmoneta_append(NULL, path);
+            newest_time = st.st_mtime;
+         }
+      }
+
+      closedir(dir);
+   }
+
+   if (newest == NULL || difftime(time(NULL), newest_time) >= ZSTD_DICTIONARY_MAX_AGE)
+   {
+      if (!zstd_train_wal_dictionary(directory, dictionary_directory, dictionary, dictionary_size))
+      {
+         goto done;
+      }
+   }
+
+   if (newest == NULL || zstd_read_file(newest, dictionary, dictionary_size))
+   {
+      goto error;
+   }
+
+done:
+
+   free(newest);
+   free(dictionary_directory);
+
+   return 0;
+
+error:
+
+   free(newest);
+   free(dictionary_directory);
+
+   return 1;
+}
+
+static int
+zstd_train_wal_dictionary(char* directory, char* dictionary_directory, void** dictionary, size_t* dictionary_size)
+{
+   char** segments = NULL;
+   int number_of_segments = 0;
+   int segments_capacity = 0;
+   unsigned char* samples = NULL;
+   size_t* sample_sizes = NULL;
+   unsigned int number_of_samples = 0;
+   size_t max_samples = ZSTD_DICTIONARY_SAMPLES_SIZE / ZSTD_DICTIONARY_PAGE_SIZE;
+   size_t total_pages = 0;
+   size_t stride;
+   void* dict = NULL;
+   size_t dict_size;
+   DIR* dir = NULL;
+   struct dirent* entry;
+   char path[MAX_PATH];
+   char tmp[MAX_PATH];
+   FILE* f = NULL;
+
+   *dictionary = NULL;
+   *dictionary_size = 0;
+
+   if (!(dir = opendir(directory)))
+   {
+      goto error;
+   }
+
+   while ((entry = readdir(dir)) != NULL)
+   {
+      if (entry->d_type != DT_REG || strlen(entry->d_name) != 24 ||
+          pgmoneta_is_compressed(entry->d_name) || pgmoneta_is_encrypted(entry->d_name))
+      {
+         continue;
+      }
+
+      if (number_of_segments == segments_capacity)
+      {
+         char** s = NULL;
+         segments_capacity = segments_capacity == 0 ? 64 : segments_capacity * 2;
+         s = (char**)realloc(segments, segments_capacity * sizeof(char*));
+         if (s == NULL)
+         {
+            goto error;
+         }
+         segments = s;
+      }
+
+      segments[number_of_segments++] = pgmoneta_append(NULL, entry->d_name);
+   }
+
+   closedir(dir);
+   dir = NULL;
+
+   if (number_of_segments == 0)
+   {
+      goto error;
+   }
+
+   /* Newest segments first */
+   qsort(segments, number_of_segments, sizeof(char*), zstd_compare_names);
+   number_of_segments = MIN(number_of_segments, ZSTD_DICTIONARY_SEGMENTS);
+
+   for (int i = 0; i < number_of_segments; i++)
+   {
+      snprintf(path, sizeof(path), "%s%s%s", directory, pgmoneta_ends_with(directory, "/") ? "" : "/", segments[i]);
+      total_pages += pgmoneta_get_file_size(path) / ZSTD_DICTIONARY_PAGE_SIZE;
+   }
+
+   stride = MAX((size_t)1, total_pages / max_samples);
+
+   samples = (unsigned char*)malloc(max_samples * ZSTD_DICTIONARY_PAGE_SIZE);
+   sample_sizes = (size_t*)malloc(max_samples * sizeof(size_t));
+   if (samples == NULL || sample_sizes == NULL)
+   {
+      goto error;
+   }
+
+   for (int i = 0; i < number_of_segments && number_of_samples < max_samples; i++)
+   {
+      size_t page = 0;
+
+      snprintf(path, sizeof(path), "%s%s%s", directory, pgmoneta_ends_with(directory, "/") ? "" : "/", segments[i]);
+
+      f = fopen(path, "rb");
+      if (f == NULL)
+      {
+         continue;
+      }
+
+      while (number_of_samples < max_samples)
+      {
+         unsigned char* p = samples + (size_t)number_of_samples * ZSTD_DICTIONARY_PAGE_SIZE;
+         struct xlog_page_header_data* header = (struct xlog_page_header_data*)p;
+
+         if (fread(p, 1, ZSTD_DICTIONARY_PAGE_SIZE, f) != ZSTD_DICTIONARY_PAGE_SIZE)
+         {
+            break;
+         }
+
+         /* Skip the unused tail of a segment, and thin out the pages to fit the sample budget */
+         if (header->xlp_magic == 0 || (page++ % stride) != 0)
+         {
+            continue;
+         }
+
+         sample_sizes[number_of_samples++] = ZSTD_DICTIONARY_PAGE_SIZE;
+      }
+
+      fclose(f);
+      f = NULL;
+   }
+
+   if (number_of_samples < ZSTD_DICTIONARY_MIN_SAMPLES)
+   {
+      goto error;
+   }
+
+   dict = malloc(ZSTD_DICTIONARY_SIZE);
+   if (dict == NULL)
+   {
+      goto error;
+   }
+
+   dict_size = ZDICT_trainFromBuffer(dict, ZSTD_DICTIONARY_SIZE, samples, sample_sizes, number_of_samples);
+   if (ZDICT_isError(dict_size))
+   {
+      pgmoneta_log_warn("ZSTD: Could not train a WAL dictionary: %s", ZDICT_getErrorName(dict_size));
+      goto error;
    }
 
-   *output_string = (char*)malloc(decompressed_size + 1);
-   if (*output_string == NULL)
+   snprintf(path, sizeof(path), "%s%08x.dict", dictionary_directory, ZDICT_getDictID(dict, dict_size));
+   snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+   f = fopen(tmp, "wb");
+   if (f == NULL)
    {
-      pgmoneta_log_error("ZSTD: Allocation failed");
-      return 1;
+      goto error;
    }
 
-   result = ZSTD_decompress(*output_string, decompressed_size, compressed_buffer, compressed_size);
-   if (ZSTD_isError(result))
+   if (fwrite(dict, 1, dict_size, f) != dict_size || fflush(f) != 0 || fsync(fileno(f)) != 0)
    {
-      pgmoneta_log_error("ZSTD: Compression error: %s", ZSTD_getErrorName(result));
-      free(*output_string);
-      return 1;
+      goto error;
    }
 
-   (*output_string)[decompressed_size] = '\0';
+   fclose(f);
+   f = NULL;
+
+   if (rename(tmp, path) != 0)
+   {
+      goto error;
+   }
+
+   pgmoneta_permission(path, 6, 0, 0);
+
+   pgmoneta_log_info("ZSTD: Trained WAL dictionary %s (%zu bytes from %u pages)", path, dict_size, number_of_samples);
+
+   for (int i = 0; i < number_of_segments; i++)
+   {
+      free(segments[i]);
+   }
+   free(segments);
+   free(samples);
+   free(sample_sizes);
+
+   *dictionary = dict;
+   *dictionary_size = dict_size;
 
    return 0;
+
+error:
+
+   if (dir != NULL)
+   {
+      closedir(dir);
+   }
+
+   if (f != NULL)
+   {
+      fclose(f);
+      remove(tmp);
+   }
+
+   for (int i = 0; segments != NULL && i < number_of_segments; i++)
+   {
+      free(segments[i]);
+   }
+   free(segments);
+   free(samples);
+   free(sample_sizes);
+   free(dict);
+
+   return 1;
 }
 
 static int
-zstd_compress(char* from, char* to, ZSTD_CCtx* cctx, size_t zin_size, void* zin, size_t zout_size, void* zout)
+zstd_find_dictionary(unsigned int id, void** dictionary, size_t* dictionary_size)
 {
-   FILE* fin = NULL;
-   FILE* fout = NULL;
-   size_t toRead;
+   char* d = NULL;
+   char name[32];
+   struct main_configuration* config;
 
-   fin = fopen(from, "rb");
+   config = (struct main_configuration*)shmem;
 
-   if (fin == NULL)
+   *dictionary = NULL;
+   *dictionary_size = 0;
+
+   snprintf(name, sizeof(name), "%08x.dict", id);
+
+   for (int i = 0; i < config->common.number_of_servers; i++)
+   {
+      d = pgmoneta_get_server_wal_dictionary(i);
+      d = pgmoneta_append(d, name);
+
+      if (pgmoneta_exists(d) && !zstd_read_file(d, dictionary, dictionary_size))
+      {
+         free(d);
+         return 0;
+      }
+
+      free(d);
+      d = NULL;
+   }
+
+   return 1;
+}
+
+static int
+zstd_read_file(char* path, void** buffer, size_t* size)
+{
+   FILE* f = NULL;
+   void* b = NULL;
+   size_t s;
+
+   *buffer = NULL;
+   *size = 0;
+
+   s = pgmoneta_get_file_size(path);
+   if (s == 0)
    {
       goto error;
    }
 
-   fout = fopen(to, "wb");
+   b = malloc(s);
+   if (b == NULL)
+   {
+      goto error;
+   }
 
-   if (fout == NULL)
+   f = fopen(path, "rb");
+   if (f == NULL || fread(b, 1, s, f) != s)
    {
       goto error;
    }
 
-   toRead = zin_size;
-   for (;;)
+   fclose(f);
+
+   *buffer = b;
+   *size = s;
+
+   return 0;
+
+error:
+
+   if (f != NULL)
    {
-      size_t read = fread(zin, sizeof(char), toRead, fin);
-      int lastChunk = (read < toRead);
-      ZSTD_EndDirective mode = lastChunk ? ZSTD_e_end : ZSTD_e_continue;
-      ZSTD_inBuffer input = {zin, read, 0};
-      int finished;
-      do
-      {
-         ZSTD_outBuffer output = {zout, zout_size, 0};
-         size_t remaining = ZSTD_compressStream2(cctx, &output, &input, mode);
-         if (ZSTD_isError(remaining))
-         {
-            pgmoneta_log_error("ZSTD: Compression error: %s", ZSTD_getErrorName(remaining));
-            goto error;
-         }
-         fwrite(zout, sizeof(char), output.pos, fout);
-         finished = lastChunk ? (remaining == 0) : (input.pos == input.size);
-      }
-      while (!finished);
+      fclose(f);
+   }
 
-      if (lastChunk)
+   free(b);
+
+   return 1;
+}
+
+static int
+zstd_compare_names(const void* a, const void* b)
+{
+   return strcmp(*(char* const*)b, *(char* const*)a);
+}
+
+static int
+zstd_write(FILE* fout, EVP_CIPHER_CTX* ectx, unsigned char* eout, void* data, size_t size)
+{
+   size_t eout_size = 0;
+
+   if (size == 0)
+   {
+      return 0;
+   }
+
+   if (ectx != NULL)
+   {
+      if (pgmoneta_encrypt_stream_update(ectx, (unsigned char*)data, size, eout, &eout_size))
       {
-         break;
+         return 1;
       }
+      return fwrite(eout, sizeof(char), eout_size, fout) != eout_size;
    }
 
-   fclose(fout);
-   fclose(fin);
+   return fwrite(data, sizeof(char), size, fout) != size;
+}
 
-   return 0;
+static void
+zstd_put_le32(unsigned char* p, uint32_t v)
+{
+   p[0] = (unsigned char)(v & 0xFF);
+   p[1] = (unsigned char)((v >> 8) & 0xFF);
+   p[2] = (unsigned char)((v >> 16) & 0xFF);
+   p[3] = (unsigned char)((v >> 24) & 0xFF);
+}
 
-error:
+static uint32_t
+zstd_get_le32(unsigned char* p)
+{
+   return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
 
-   if (fout != NULL)
+static int
+zstd_write_seek_table(FILE* fout, EVP_CIPHER_CTX* ectx, unsigned char* eout, void* buffer, size_t buffer_size,
+                      uint32_t* frames, uint32_t number_of_frames)
+{
+   unsigned char* b = (unsigned char*)buffer;
+   size_t pos = 0;
+
+   /* Skippable frame header, ignored by regular decoders */
+   zstd_put_le32(b, ZSTD_SEEKABLE_SKIPPABLE_MAGIC);
+   zstd_put_le32(b + 4, number_of_frames * ZSTD_SEEKABLE_ENTRY_SIZE + ZSTD_SEEKABLE_FOOTER_SIZE);
+   pos = 8;
+
+   for (uint32_t i = 0; i < number_of_frames; i++)
    {
-      fclose(fout);
+      if (pos + ZSTD_SEEKABLE_ENTRY_SIZE > buffer_size)
+      {
+         if (zstd_write(fout, ectx, eout, buffer, pos))
+         {
+            return 1;
+         }
+         pos = 0;
+      }
+
+      zstd_put_le32(b + pos, frames[2 * i]);
+      zstd_put_le32(b + pos + 4, frames[2 * i + 1]);
+      pos += ZSTD_SEEKABLE_ENTRY_SIZE;
    }
 
-   if (fin != NULL)
+   if (pos + ZSTD_SEEKABLE_FOOTER_SIZE > buffer_size)
    {
-      fclose(fin);
+      if (zstd_write(fout, ectx, eout, buffer, pos))
+      {
+         return 1;
+      }
+      pos = 0;
    }
 
-   return 1;
+   /* Footer: number of frames, descriptor without checksums, magic */
+   zstd_put_le32(b + pos, number_of_frames);
+   b[pos + 4] = 0;
+   zstd_put_le32(b + pos + 5, ZSTD_SEEKABLE_MAGIC);
+   pos += ZSTD_SEEKABLE_FOOTER_SIZE;
+
+   return zstd_write(fout, ectx, eout, buffer, pos);
 }
 
 static int
@@ -973,6 +2325,13 @@ zstd_decompress(char* from, char* to, ZSTD_DCtx* dctx, size_t zin_size, void* zi
    size_t toRead;
    size_t read;
    size_t lastRet = 0;
+   bool first = true;
+   unsigned int dictionary_id;
+   void* dictionary = NULL;
+   size_t dictionary_size = 0;
+   uint64_t start;
+
+   start = pgmoneta_prometheus_now();
 
    fin = fopen(from, "rb");
 
@@ -991,6 +2350,23 @@ zstd_decompress(char* from, char* to, ZSTD_DCtx* dctx, size_t zin_size, void* zi
    toRead = zin_size;
    while ((read = fread(zin, sizeof(char), toRead, fin)))
    {
+      if (first)
+      {
+         first = false;
+
+         /* WAL compressed with a trained dictionary names it in the frame header */
+         dictionary_id = ZSTD_getDictID_fromFrame(zin, read);
+         if (dictionary_id != 0)
+         {
+            if (zstd_find_dictionary(dictionary_id, &dictionary, &dictionary_size) ||
+                ZSTD_isError(ZSTD_DCtx_loadDictionary(dctx, dictionary, dictionary_size)))
+            {
+               pgmoneta_log_error("ZSTD: Dictionary %08x needed by %s is not available", dictionary_id, from);
+               goto error;
+            }
+         }
+      }
+
       ZSTD_inBuffer input = {zin, read, 0};
       while (input.pos < input.size)
       {
@@ -1015,10 +2391,24 @@ zstd_decompress(char* from, char* to, ZSTD_DCtx* dctx, size_t zin_size, void* zi
    fclose(fin);
    fclose(fout);
 
+   if (dictionary != NULL)
+   {
+      ZSTD_DCtx_loadDictionary(dctx, NULL, 0);
+      free(dictionary);
+   }
+
+   pgmoneta_prometheus_file(FILE_OPERATION_DECOMPRESS, start);
+
    return 0;
 
 error:
 
+   if (dictionary != NULL)
+   {
+      ZSTD_DCtx_loadDictionary(dctx, NULL, 0);
+      free(dictionary);
+   }
+
    if (fin != NULL)
    {
       fclose(fin);
@@ -1031,3 +2421,202 @@ error:
 
    return 1;
 }
+
+static int
+zstd_reader_read(struct reader* reader, void* buffer, size_t size, size_t* read)
+{
+   struct zstd_reader* zr = (struct zstd_reader*)reader->state;
+   ZSTD_outBuffer output = {buffer, size, 0};
+   unsigned int dictionary_id;
+   size_t dictionary_size = 0;
+   size_t n = 0;
+   size_t pos;
+   size_t ret;
+
+   *read = 0;
+
+   while (output.pos == 0)
+   {
+      if (zr->input.pos == zr->input.size && !zr->eof)
+      {
+         if (pgmoneta_reader_read(reader->source, zr->zin, zr->zin_size, &n))
+         {
+            goto error;
+         }
+
+         zr->eof = n == 0;
+         zr->input.size = n;
+         zr->input.pos = 0;
+
+         if (zr->first && n > 0)
+         {
+            zr->first = false;
+
+            /* WAL compressed with a trained dictionary names it in the frame header */
+            dictionary_id = ZSTD_getDictID_fromFrame(zr->zin, n);
+            if (dictionary_id != 0)
+            {
+               if (zstd_find_dictionary(dictionary_id, &zr->dictionary, &dictionary_size) ||
+                   ZSTD_isError(ZSTD_DCtx_loadDictionary(zr->dctx, zr->dictionary, dictionary_size)))
+               {
+                  pgmoneta_log_error("ZSTD: Dictionary %08x is not available", dictionary_id);
+                  goto error;
+               }
+            }
+         }
+      }
+
+      pos = zr->input.pos;
+
+      ret = ZSTD_decompressStream(zr->dctx, &output, &zr->input);
+      if (ZSTD_isError(ret))
+      {
+         pgmoneta_log_error("ZSTD: Decompression error: %s", ZSTD_getErrorName(ret));
+         goto error;
+      }
+
+      if (zr->input.pos > pos || output.pos > 0)
+      {
+         zr->last = ret;
+      }
+      else if (zr->eof)
+      {
+         /* Nothing more is buffered in the decoder */
+         if (zr->last != 0)
+         {
+            pgmoneta_log_error("ZSTD: Incomplete or corrupted frame");
+            goto error;
+         }
+         break;
+      }
+   }
+
+   *read = output.pos;
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+static void
+zstd_reader_close(struct reader* reader)
+{
+   struct zstd_reader* zr = (struct zstd_reader*)reader->state;
+
+   if (zr == NULL)
+   {
+      return;
+   }
+
+   if (zr->dctx != NULL)
+   {
+      ZSTD_freeDCtx(zr->dctx);
+   }
+
+   pgmoneta_memory_buffer_put(zr->zin);
+   free(zr->dictionary);
+   free(zr);
+
+   reader->state = NULL;
+}
+
+static void
+do_zstd_range(struct worker_common* wc)
+{
+   struct zstd_range* range = (struct zstd_range*)wc;
+   struct zstd_seekable* seekable = range->file->seekable;
+   ZSTD_DCtx* dctx = NULL;
+   void* input = NULL;
+   void* output = NULL;
+   int in = -1;
+   int out = -1;
+
+   dctx = ZSTD_createDCtx();
+   input = malloc(seekable->input_capacity > 0 ? seekable->input_capacity : 1);
+   output = malloc(seekable->frame_capacity > 0 ? seekable->frame_capacity : 1);
+   in = open(range->file->from, O_RDONLY);
+   out = open(range->file->to, O_WRONLY);
+
+   if (dctx == NULL || input == NULL || output == NULL || in == -1 || out == -1)
+   {
+      goto error;
+   }
+
+   for (uint32_t i = range->first; i < range->last; i++)
+   {
+      size_t csize = seekable->compressed_offsets[i + 1] - seekable->compressed_offsets[i];
+      size_t dsize = seekable->decompressed_offsets[i + 1] - seekable->decompressed_offsets[i];
+      size_t ret;
+
+      if (pread(in, input, csize, (off_t)seekable->compressed_offsets[i]) != (ssize_t)csize)
+      {
+         goto error;
+      }
+
+      ret = ZSTD_decompressDCtx(dctx, output, dsize, input, csize);
+      if (ZSTD_isError(ret) || ret != dsize)
+      {
+         pgmoneta_log_error("ZSTD: Could not decompress frame %u of %s", i, range->file->from);
+         goto error;
+      }
+
+      pgmoneta_reader_throttle(dsize);
+
+      if (pwrite(out, output, dsize, (off_t)seekable->decompressed_offsets[i]) != (ssize_t)dsize)
+      {
+         goto error;
+      }
+   }
+
+   close(in);
+   close(out);
+   free(input);
+   free(output);
+   ZSTD_freeDCtx(dctx);
+
+   zstd_parallel_release(range->file);
+   free(range);
+
+   return;
+
+error:
+
+   pgmoneta_log_error("ZSTD: Could not decompress %s", range->file->from);
+
+   if (range->common.workers != NULL)
+   {
+      range->common.workers->outcome = false;
+   }
+
+   if (in != -1)
+   {
+      close(in);
+   }
+   if (out != -1)
+   {
+      close(out);
+   }
+   free(input);
+   free(output);
+   if (dctx != NULL)
+   {
+      ZSTD_freeDCtx(dctx);
+   }
+
+   zstd_parallel_release(range->file);
+   free(range);
+}
+
+static void
+zstd_parallel_release(struct zstd_parallel* file)
+{
+   if (atomic_fetch_sub(&file->references, 1) == 1)
+   {
+      pgmoneta_zstandardd_seekable_close(file->seekable);
+      free(file->from);
+      free(file->to);
+      free(file);
+   }
+}
@@ -31,30 +31,39 @@
 #include <achv.h>
 #include <aes.h>
 #include <backup.h>
+#include <batch.h>
 #include <bzip2_compression.h>
 #include <cmd.h>
+#include <compaction.h>
 #include <configuration.h>
 #include <delete.h>
 #include <gzip_compression.h>
 #include <info.h>
 #include <keep.h>
+#include <lock.h>
 #include <logging.h>
 #include <lz4_compression.h>
 #include <management.h>
 #include <memory.h>
 #include <message.h>
 #include <network.h>
+#include <profile.h>
 #include <prometheus.h>
 #include <remote.h>
 #include <restore.h>
 #include <retention.h>
+#include <scrub.h>
 #include <security.h>
 #include <server.h>
 #include <shmem.h>
 #include <status.h>
+#include <trace.h>
 #include <utils.h>
 #include <verify.h>
 #include <wal.h>
+#include <walfetch.h>
+#include <walpush.h>
+#include <workers.h>
 #include <zstandard_compression.h>
 
 /* system */
@@ -66,6 +75,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
@@ -74,6 +84,7 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 
 #include <openssl/crypto.h>
 #ifdef HAVE_SYSTEMD
@@ -83,6 +94,17 @@
 #define NAME "main"
 #define MAX_FDS 64
 #define OFFLINE 1000
+#define MANAGEMENT_WORKERS 4
+#define NUMBER_OF_HELPERS 2
+#define HELPER_MAX_JOBS 100
+
+#define SERVER_CHECK_OK          0
+#define SERVER_CHECK_FATAL       1
+#define SERVER_CHECK_UNAVAILABLE 2
+
+#define HELPER_JOB_WAL       0
+#define HELPER_JOB_VALID     1
+#define HELPER_JOB_RETENTION 2
 
 static void accept_mgt_cb(struct ev_loop* loop, struct ev_io* watcher, int revents);
 static void accept_metrics_cb(struct ev_loop* loop, struct ev_io* watcher, int revents);
@@ -92,16 +114,34 @@ static void reload_cb(struct ev_loop* loop, ev_signal* w, int revents);
 static void coredump_cb(struct ev_loop* loop, ev_signal* w, int revents);
 static void wal_cb(struct ev_loop* loop, ev_periodic* w, int revents);
 static void retention_cb(struct ev_loop* loop, ev_periodic* w, int revents);
+static void compaction_cb(struct ev_loop* loop, ev_periodic* w, int revents);
+static void scrub_cb(struct ev_loop* loop, ev_periodic* w, int revents);
 static void valid_cb(struct ev_loop* loop, ev_periodic* w, int revents);
 static void wal_streaming_cb(struct ev_loop* loop, ev_periodic* w, int revents);
+static void log_ring_cb(struct ev_loop* loop, ev_periodic* w, int revents);
 static bool accept_fatal(int error);
 static bool reload_configuration(void);
 static void init_receivewals(void);
 static int init_replication_slots(void);
+static int check_server(int srv);
 static int verify_replication_slot(char* slot_name, int srv, SSL* ssl, int socket);
 static int  create_pidfile(void);
 static void remove_pidfile(void);
 static void shutdown_ports(void);
+static int management_submit(int client_fd, int32_t id, int server, uint8_t compression, uint8_t encryption, struct json* payload);
+static void management_execute(struct worker_common* wc);
+static void wal_compress(int server);
+static void valid_servers(void);
+static int start_helpers(void);
+static void shutdown_helpers(void);
+static int helper_spawn(int index);
+static void helper_run(void);
+static void helper_cb(struct ev_loop* loop, struct ev_child* w, int revents);
+static bool helper_submit(int type, int server);
+static int start_backup_multiplex(void);
+static void shutdown_backup_multiplex(void);
+static int backup_multiplex_spawn(void);
+static void backup_multiplex_cb(struct ev_loop* loop, struct ev_child* w, int revents);
 
 struct accept_io
 {
@@ -110,6 +150,39 @@ struct accept_io
    char** argv;
 };
 
+/** @struct management_input
+ * A read-only management request served by the management workers
+ */
+struct management_input
+{
+   struct worker_common common; /**< The common base */
+   int client_fd;               /**< The client */
+   int32_t id;                  /**< The command */
+   int server;                  /**< The server, or -1 */
+   bool offline;                /**< Is the server running in offline mode */
+   uint8_t compression;         /**< The compress method for wire protocol */
+   uint8_t encryption;          /**< The encrypt method for wire protocol */
+   struct json* payload;        /**< The payload */
+};
+
+/** @struct helper_job
+ * A job for the helper processes
+ */
+struct helper_job
+{
+   int type;   /**< The job type */
+   int server; /**< The server, or -1 */
+};
+
+/** @struct helper
+ * A pre-forked helper process
+ */
+struct helper
+{
+   struct ev_child child; /**< The child watcher */
+   pid_t pid;             /**< The process identifier, or 0 */
+};
+
 static volatile int keep_running = 1;
 static volatile int stop = 0;
 static char** argv_ptr;
@@ -123,6 +196,12 @@ static struct accept_io io_management[MAX_FDS];
 static int* management_fds = NULL;
 static int management_fds_length = -1;
 static bool offline = false;
+static bool wal_multiplex = false;
+static struct workers* management_workers = NULL;
+static struct helper helpers[NUMBER_OF_HELPERS];
+static int helper_fds[2] = {-1, -1};
+static struct helper backup_multiplex;
+static int backup_fds[2] = {-1, -1};
 
 static void
 start_mgt(void)
@@ -245,10 +324,14 @@ main(int argc, char** argv)
    struct signal_info signal_watcher[5];
    struct ev_periodic wal;
    struct ev_periodic retention;
+   struct ev_periodic compaction;
+   struct ev_periodic scrub;
    struct ev_periodic valid;
    struct ev_periodic wal_streaming;
+   struct ev_periodic log_ring;
    size_t shmem_size;
    size_t prometheus_cache_shmem_size = 0;
+   size_t log_ring_shmem_size = 0;
    struct main_configuration* config = NULL;
    int ret;
    char* os = NULL;
@@ -544,6 +627,18 @@ main(int argc, char** argv)
       errx(1, "Error in creating and initializing prometheus cache shared memory");
    }
 
+   /* Forked processes queue their log lines, which the main process writes */
+   if (config->common.log_type == PGMONETA_LOGGING_TYPE_CONSOLE || config->common.log_type == PGMONETA_LOGGING_TYPE_FILE)
+   {
+      if (pgmoneta_init_log_ring(&log_ring_shmem_size, &log_ring_shmem))
+      {
+         pgmoneta_log_warn("Logging: Writing log lines directly");
+      }
+   }
+
+   /* The I/O buffers of pgmoneta and its forked processes */
+   pgmoneta_memory_pool_init(config->hugepage);
+
    /* Bind Unix Domain Socket */
    if (pgmoneta_bind_unix_socket(config->unix_socket_dir, MAIN_UDS, &unix_management_socket))
    {
@@ -613,6 +708,12 @@ main(int argc, char** argv)
 
       start_metrics();
       metrics_started = true;
+
+      /* The scrapes are served by a thread, so they don't fork */
+      if (pgmoneta_prometheus_start())
+      {
+         pgmoneta_log_warn("Prometheus: Using a process per scrape");
+      }
    }
 
    if (config->management > 0)
@@ -671,11 +772,52 @@ main(int argc, char** argv)
       }
    }
 
+   if (!offline)
+   {
+      /* Periodic maintenance is run by pre-forked helpers */
+      if (start_helpers())
+      {
+         pgmoneta_log_warn("Helpers: Using a process per job");
+      }
+
+      if (config->backup_multiplex && start_backup_multiplex())
+      {
+         pgmoneta_log_warn("Backup: Using a process per backup");
+      }
+   }
+
    if (!offline)
    {
       /* Start backup retention policy */
       ev_periodic_init(&retention, retention_cb, 0., config->retention_interval, 0);
       ev_periodic_start(main_loop, &retention);
+
+      /* Start incremental chain compaction */
+      if (config->compaction_interval > 0)
+      {
+         ev_periodic_init(&compaction, compaction_cb, 0., config->compaction_interval, 0);
+         ev_periodic_start(main_loop, &compaction);
+      }
+   }
+
+   /* Start background scrubbing, which only reads the local backups and WAL */
+   if (config->scrub_interval > 0)
+   {
+      ev_periodic_init(&scrub, scrub_cb, 0., config->scrub_interval, 0);
+      ev_periodic_start(main_loop, &scrub);
+   }
+
+   if (log_ring_shmem != NULL)
+   {
+      ev_periodic_init(&log_ring, log_ring_cb, 0., PGMONETA_LOGGING_RING_INTERVAL, 0);
+      ev_periodic_start(main_loop, &log_ring);
+   }
+
+   /* Read-only management commands are served by threads in the main process */
+   if (pgmoneta_workers_initialize(MANAGEMENT_WORKERS, &management_workers))
+   {
+      pgmoneta_log_warn("Management: Using a process per request");
+      management_workers = NULL;
    }
 
    if (!offline)
@@ -725,8 +867,19 @@ main(int argc, char** argv)
 
    shutdown_management();
    shutdown_metrics();
+   pgmoneta_prometheus_stop();
    shutdown_mgt();
 
+   shutdown_helpers();
+   shutdown_backup_multiplex();
+
+   if (management_workers != NULL)
+   {
+      pgmoneta_workers_wait(management_workers);
+      pgmoneta_workers_destroy(management_workers);
+      management_workers = NULL;
+   }
+
    for (int i = 0; i < 5; i++)
    {
       ev_signal_stop(main_loop, (struct ev_signal*)&signal_watcher[i]);
@@ -739,9 +892,11 @@ main(int argc, char** argv)
 
    remove_pidfile();
 
+   pgmoneta_log_ring_flush();
    pgmoneta_stop_logging();
    pgmoneta_destroy_shared_memory(shmem, shmem_size);
    pgmoneta_destroy_shared_memory(prometheus_cache_shmem, prometheus_cache_shmem_size);
+   pgmoneta_destroy_shared_memory(log_ring_shmem, log_ring_shmem_size);
 
    if (daemon || stop)
    {
@@ -766,6 +921,7 @@ error:
    if (metrics_started)
    {
       shutdown_metrics();
+      pgmoneta_prometheus_stop();
    }
 
    if (management_started)
@@ -778,9 +934,11 @@ error:
 
    config->running = false;
 
+   pgmoneta_log_ring_flush();
    pgmoneta_stop_logging();
    pgmoneta_destroy_shared_memory(shmem, shmem_size);
    pgmoneta_destroy_shared_memory(prometheus_cache_shmem, prometheus_cache_shmem_size);
+   pgmoneta_destroy_shared_memory(log_ring_shmem, log_ring_shmem_size);
 
    if (daemon || stop)
    {
@@ -866,7 +1024,39 @@ accept_mgt_cb(struct ev_loop* loop, struct ev_io* watcher, int revents)
 
    request = (struct json*)pgmoneta_json_get(payload, MANAGEMENT_CATEGORY_REQUEST);
 
-   if (id == MANAGEMENT_BACKUP)
+   PGMONETA_TRACE1(management_request, id);
+
+   if ((id == MANAGEMENT_BACKUP || id == MANAGEMENT_VERIFY) && (bool)pgmoneta_json_get(request, MANAGEMENT_ARGUMENT_ALL))
+   {
+      if (id == MANAGEMENT_BACKUP && offline)
+      {
+         pgmoneta_log_warn("Can not create backups in offline mode");
+
+         pgmoneta_management_response_error(NULL, client_fd, NULL, MANAGEMENT_ERROR_BACKUP_OFFLINE, NAME, compression, encryption, payload);
+      }
+      else
+      {
+         pid = fork();
+         if (pid == -1)
+         {
+            pgmoneta_management_response_error(NULL, client_fd, NULL, id == MANAGEMENT_BACKUP ? MANAGEMENT_ERROR_BACKUP_NOFORK : MANAGEMENT_ERROR_VERIFY_NOFORK,
+                                               NAME, compression, encryption, payload);
+            pgmoneta_log_error("Batch: No fork");
+            goto error;
+         }
+         else if (pid == 0)
+         {
+            struct json* pyl = NULL;
+
+            shutdown_ports();
+
+            pgmoneta_json_clone(payload, &pyl);
+
+            pgmoneta_batch(client_fd, id, compression, encryption, pyl, ai->argv);
+         }
+      }
+   }
+   else if (id == MANAGEMENT_BACKUP)
    {
       server = (char*)pgmoneta_json_get(request, MANAGEMENT_ARGUMENT_SERVER);
 
@@ -881,7 +1071,12 @@ accept_mgt_cb(struct ev_loop* loop, struct ev_io* watcher, int revents)
             }
          }
 
-         if (srv != -1)
+         if (srv != -1 && backup_fds[0] != -1 &&
+             !pgmoneta_backup_multiplex_submit(backup_fds[0], client_fd, srv, compression, encryption, payload))
+         {
+            pgmoneta_log_debug("Backup: %s handed to the backup process", server);
+         }
+         else if (srv != -1)
          {
             pid = fork();
             if (pid == -1)
@@ -932,23 +1127,34 @@ accept_mgt_cb(struct ev_loop* loop, struct ev_io* watcher, int revents)
 
       if (srv != -1)
       {
-         pid = fork();
-         if (pid == -1)
+         if (!management_submit(client_fd, id, srv, compression, encryption, payload))
          {
-            pgmoneta_management_response_error(NULL, client_fd, server, MANAGEMENT_ERROR_LIST_BACKUP_NOFORK, NAME, compression, encryption, payload);
-            pgmoneta_log_error("List backup: No fork %s (%d)", server, MANAGEMENT_ERROR_LIST_BACKUP_NOFORK);
-            goto error;
+            client_fd = -1;
          }
-         else if (pid == 0)
+         else
          {
-            struct json* pyl = NULL;
+            pid = fork();
+            if (pid == -1)
+            {
+               pgmoneta_management_response_error(NULL, client_fd, server, MANAGEMENT_ERROR_LIST_BACKUP_NOFORK, NAME, compression, encryption, payload);
+               pgmoneta_log_error("List backup: No fork %s (%d)", server, MANAGEMENT_ERROR_LIST_BACKUP_NOFORK);
+               goto error;
+            }
+            else if (pid == 0)
+            {
+               struct json* pyl = NULL;
+               int ret;
 
-            shutdown_ports();
+               shutdown_ports();
 
-            pgmoneta_json_clone(payload, &pyl);
+               pgmoneta_json_clone(payload, &pyl);
 
-            pgmoneta_set_proc_title(1, ai->argv, "list-backup", config->common.servers[srv].name);
-            pgmoneta_list_backup(client_fd, srv, compression, encryption, pyl);
+               pgmoneta_set_proc_title(1, ai->argv, "list-backup", config->common.servers[srv].name);
+               ret = pgmoneta_list_backup(client_fd, srv, compression, encryption, pyl);
+
+               pgmoneta_stop_logging();
+               exit(ret);
+            }
          }
       }
       else
@@ -1174,6 +1380,47 @@ accept_mgt_cb(struct ev_loop* loop, struct ev_io* watcher, int revents)
 
       pgmoneta_prometheus_reset();
 
+#ifdef HAVE_FREEBSD
+      clock_gettime(CLOCK_MONOTONIC_FAST, &end_t);
+#else
+      clock_gettime(CLOCK_MONOTONIC_RAW, &end_t);
+#endif
+
+      pgmoneta_management_response_ok(NULL, client_fd, start_t, end_t, compression, encryption, payload);
+   }
+   else if (id == MANAGEMENT_PROFILE)
+   {
+      struct json* response = NULL;
+      struct json* probes = NULL;
+
+#ifdef HAVE_FREEBSD
+      clock_gettime(CLOCK_MONOTONIC_FAST, &start_t);
+#else
+      clock_gettime(CLOCK_MONOTONIC_RAW, &start_t);
+#endif
+
+      pgmoneta_profile_flush();
+
+      if (pgmoneta_profile_json(&probes))
+      {
+         pgmoneta_management_response_error(NULL, client_fd, NULL, MANAGEMENT_ERROR_ALLOCATION, NAME, compression, encryption, payload);
+         goto error;
+      }
+
+      if (request != NULL && (bool)pgmoneta_json_get(request, MANAGEMENT_ARGUMENT_RESET))
+      {
+         pgmoneta_profile_reset();
+      }
+
+      pgmoneta_management_create_response(payload, -1, &response);
+
+#ifdef HAVE_PROFILE
+      pgmoneta_json_put(response, MANAGEMENT_ARGUMENT_ENABLED, (uintptr_t)true, ValueBool);
+#else
+      pgmoneta_json_put(response, MANAGEMENT_ARGUMENT_ENABLED, (uintptr_t)false, ValueBool);
+#endif
+      pgmoneta_json_put(response, MANAGEMENT_ARGUMENT_PROBES, (uintptr_t)probes, ValueJSON);
+
 #ifdef HAVE_FREEBSD
       clock_gettime(CLOCK_MONOTONIC_FAST, &end_t);
 #else
@@ -1233,23 +1480,34 @@ accept_mgt_cb(struct ev_loop* loop, struct ev_io* watcher, int revents)
    }
    else if (id == MANAGEMENT_CONF_GET)
    {
-      pid = fork();
-      if (pid == -1)
+      if (!management_submit(client_fd, id, -1, compression, encryption, payload))
       {
-         pgmoneta_management_response_error(NULL, client_fd, server, MANAGEMENT_ERROR_CONF_GET_NOFORK, NAME, compression, encryption, payload);
-         pgmoneta_log_error("Conf Get: No fork %s (%d)", server, MANAGEMENT_ERROR_CONF_GET_NOFORK);
-         goto error;
+         client_fd = -1;
       }
-      else if (pid == 0)
+      else
       {
-         struct json* pyl = NULL;
+         pid = fork();
+         if (pid == -1)
+         {
+            pgmoneta_management_response_error(NULL, client_fd, server, MANAGEMENT_ERROR_CONF_GET_NOFORK, NAME, compression, encryption, payload);
+            pgmoneta_log_error("Conf Get: No fork %s (%d)", server, MANAGEMENT_ERROR_CONF_GET_NOFORK);
+            goto error;
+         }
+         else if (pid == 0)
+         {
+            struct json* pyl = NULL;
+            int ret;
 
-         shutdown_ports();
+            shutdown_ports();
 
-         pgmoneta_json_clone(payload, &pyl);
+            pgmoneta_json_clone(payload, &pyl);
 
-         pgmoneta_set_proc_title(1, ai->argv, "conf get", NULL);
-         pgmoneta_conf_get(NULL, client_fd, compression, encryption, pyl);
+            pgmoneta_set_proc_title(1, ai->argv, "conf get", NULL);
+            ret = pgmoneta_conf_get(NULL, client_fd, compression, encryption, pyl);
+
+            pgmoneta_stop_logging();
+            exit(ret);
+         }
       }
    }
    else if (id == MANAGEMENT_CONF_SET)
@@ -1275,44 +1533,66 @@ accept_mgt_cb(struct ev_loop* loop, struct ev_io* watcher, int revents)
    }
    else if (id == MANAGEMENT_STATUS)
    {
-      pid = fork();
-      if (pid == -1)
+      if (!management_submit(client_fd, id, -1, compression, encryption, payload))
       {
-         pgmoneta_management_response_error(NULL, client_fd, server, MANAGEMENT_ERROR_STATUS_NOFORK, NAME, compression, encryption, payload);
-         pgmoneta_log_error("Status: No fork %s (%d)", server, MANAGEMENT_ERROR_STATUS_NOFORK);
-         goto error;
+         client_fd = -1;
       }
-      else if (pid == 0)
+      else
       {
-         struct json* pyl = NULL;
+         pid = fork();
+         if (pid == -1)
+         {
+            pgmoneta_management_response_error(NULL, client_fd, server, MANAGEMENT_ERROR_STATUS_NOFORK, NAME, compression, encryption, payload);
+            pgmoneta_log_error("Status: No fork %s (%d)", server, MANAGEMENT_ERROR_STATUS_NOFORK);
+            goto error;
+         }
+         else if (pid == 0)
+         {
+            struct json* pyl = NULL;
+            int ret;
 
-         shutdown_ports();
+            shutdown_ports();
 
-         pgmoneta_json_clone(payload, &pyl);
+            pgmoneta_json_clone(payload, &pyl);
 
-         pgmoneta_set_proc_title(1, ai->argv, "status", NULL);
-         pgmoneta_status(NULL, client_fd, offline, compression, encryption, pyl);
+            pgmoneta_set_proc_title(1, ai->argv, "status", NULL);
+            ret = pgmoneta_status(NULL, client_fd, offline, compression, encryption, pyl);
+
+            pgmoneta_stop_logging();
+            exit(ret);
+         }
       }
    }
    else if (id == MANAGEMENT_STATUS_DETAILS)
    {
-      pid = fork();
-      if (pid == -1)
+      if (!management_submit(client_fd, id, -1, compression, encryption, payload))
       {
-         pgmoneta_management_response_error(NULL, client_fd, server, MANAGEMENT_ERROR_STATUS_DETAILS_NOFORK, NAME, compression, encryption, payload);
-         pgmoneta_log_error("Details: No fork %s (%d)", server, MANAGEMENT_ERROR_STATUS_DETAILS_NOFORK);
-         goto error;
+         client_fd = -1;
       }
-      else if (pid == 0)
+      else
       {
-         struct json* pyl = NULL;
+         pid = fork();
+         if (pid == -1)
+         {
+            pgmoneta_management_response_error(NULL, client_fd, server, MANAGEMENT_ERROR_STATUS_DETAILS_NOFORK, NAME, compression, encryption, payload);
+            pgmoneta_log_error("Details: No fork %s (%d)", server, MANAGEMENT_ERROR_STATUS_DETAILS_NOFORK);
+            goto error;
+         }
+         else if (pid == 0)
+         {
+            struct json* pyl = NULL;
+            int ret;
 
-         shutdown_ports();
+            shutdown_ports();
 
-         pgmoneta_json_clone(payload, &pyl);
+            pgmoneta_json_clone(payload, &pyl);
 
-         pgmoneta_set_proc_title(1, ai->argv, "details", NULL);
-         pgmoneta_status_details(NULL, client_fd, offline, compression, encryption, pyl);
+            pgmoneta_set_proc_title(1, ai->argv, "details", NULL);
+            ret = pgmoneta_status_details(NULL, client_fd, offline, compression, encryption, pyl);
+
+            pgmoneta_stop_logging();
+            exit(ret);
+         }
       }
    }
    else if (id == MANAGEMENT_RETAIN)
@@ -1397,6 +1677,88 @@ accept_mgt_cb(struct ev_loop* loop, struct ev_io* watcher, int revents)
          goto error;
       }
    }
+   else if (id == MANAGEMENT_WAL_FETCH)
+   {
+      server = (char*)pgmoneta_json_get(request, MANAGEMENT_ARGUMENT_SERVER);
+
+      srv = -1;
+      for (int i = 0; srv == -1 && i < config->common.number_of_servers; i++)
+      {
+         if (!strcmp(config->common.servers[i].name, server))
+         {
+            srv = i;
+         }
+      }
+
+      if (srv != -1)
+      {
+         pid = fork();
+         if (pid == -1)
+         {
+            pgmoneta_management_response_error(NULL, client_fd, server, MANAGEMENT_ERROR_WAL_FETCH_NOFORK, NAME, compression, encryption, payload);
+            pgmoneta_log_error("WAL fetch: No fork %s (%d)", server, MANAGEMENT_ERROR_WAL_FETCH_NOFORK);
+            goto error;
+         }
+         else if (pid == 0)
+         {
+            struct json* pyl = NULL;
+
+            shutdown_ports();
+
+            pgmoneta_json_clone(payload, &pyl);
+
+            pgmoneta_set_proc_title(1, ai->argv, "wal-fetch", config->common.servers[srv].name);
+            pgmoneta_wal_fetch(NULL, client_fd, srv, compression, encryption, pyl);
+         }
+      }
+      else
+      {
+         pgmoneta_management_response_error(NULL, client_fd, server, MANAGEMENT_ERROR_WAL_FETCH_NOSERVER, NAME, compression, encryption, payload);
+         pgmoneta_log_error("WAL fetch: No server %s (%d)", server, MANAGEMENT_ERROR_WAL_FETCH_NOSERVER);
+         goto error;
+      }
+   }
+   else if (id == MANAGEMENT_WAL_PUSH)
+   {
+      server = (char*)pgmoneta_json_get(request, MANAGEMENT_ARGUMENT_SERVER);
+
+      srv = -1;
+      for (int i = 0; srv == -1 && i < config->common.number_of_servers; i++)
+      {
+         if (!strcmp(config->common.servers[i].name, server))
+         {
+            srv = i;
+         }
+      }
+
+      if (srv != -1)
+      {
+         pid = fork();
+         if (pid == -1)
+         {
+            pgmoneta_management_response_error(NULL, client_fd, server, MANAGEMENT_ERROR_WAL_PUSH_NOFORK, NAME, compression, encryption, payload);
+            pgmoneta_log_error("WAL push: No fork %s (%d)", server, MANAGEMENT_ERROR_WAL_PUSH_NOFORK);
+            goto error;
+         }
+         else if (pid == 0)
+         {
+            struct json* pyl = NULL;
+
+            shutdown_ports();
+
+            pgmoneta_json_clone(payload, &pyl);
+
+            pgmoneta_set_proc_title(1, ai->argv, "wal-push", config->common.servers[srv].name);
+            pgmoneta_wal_push(NULL, client_fd, srv, compression, encryption, pyl);
+         }
+      }
+      else
+      {
+         pgmoneta_management_response_error(NULL, client_fd, server, MANAGEMENT_ERROR_WAL_PUSH_NOSERVER, NAME, compression, encryption, payload);
+         pgmoneta_log_error("WAL push: No server %s (%d)", server, MANAGEMENT_ERROR_WAL_PUSH_NOSERVER);
+         goto error;
+      }
+   }
    else if (id == MANAGEMENT_DECRYPT)
    {
       pid = fork();
@@ -1542,23 +1904,34 @@ accept_mgt_cb(struct ev_loop* loop, struct ev_io* watcher, int revents)
 
       if (srv != -1)
       {
-         pid = fork();
-         if (pid == -1)
+         if (!management_submit(client_fd, id, srv, compression, encryption, payload))
          {
-            pgmoneta_management_response_error(NULL, client_fd, server, MANAGEMENT_ERROR_INFO_NOFORK, NAME, compression, encryption, payload);
-            pgmoneta_log_error("Info: No fork %s (%d)", server, MANAGEMENT_ERROR_INFO_NOFORK);
-            goto error;
+            client_fd = -1;
          }
-         else if (pid == 0)
+         else
          {
-            struct json* pyl = NULL;
+            pid = fork();
+            if (pid == -1)
+            {
+               pgmoneta_management_response_error(NULL, client_fd, server, MANAGEMENT_ERROR_INFO_NOFORK, NAME, compression, encryption, payload);
+               pgmoneta_log_error("Info: No fork %s (%d)", server, MANAGEMENT_ERROR_INFO_NOFORK);
+               goto error;
+            }
+            else if (pid == 0)
+            {
+               struct json* pyl = NULL;
+               int ret;
 
-            shutdown_ports();
+               shutdown_ports();
 
-            pgmoneta_json_clone(payload, &pyl);
+               pgmoneta_json_clone(payload, &pyl);
 
-            pgmoneta_set_proc_title(1, ai->argv, "info", config->common.servers[srv].name);
-            pgmoneta_info_request(NULL, client_fd, srv, compression, encryption, pyl);
+               pgmoneta_set_proc_title(1, ai->argv, "info", config->common.servers[srv].name);
+               ret = pgmoneta_info_request(NULL, client_fd, srv, compression, encryption, pyl);
+
+               pgmoneta_stop_logging();
+               exit(ret);
+            }
          }
       }
       else
@@ -1691,6 +2064,12 @@ accept_metrics_cb(struct ev_loop* loop, struct ev_io* watcher, int revents)
       return;
    }
 
+   /* The metrics thread keeps the connection open for the next scrapes */
+   if (!pgmoneta_prometheus_submit(client_fd))
+   {
+      return;
+   }
+
    if (!fork())
    {
       ev_loop_fork(loop);
@@ -1838,46 +2217,19 @@ wal_cb(struct ev_loop* loop __attribute__((unused)), ev_periodic* w __attribute_
 
    for (int i = 0; i < config->common.number_of_servers; i++)
    {
-      /* Compression is always in a fork() */
-      if (!fork())
+      if (helper_submit(HELPER_JOB_WAL, i))
       {
-         bool active = false;
-         char* d = NULL;
+         continue;
+      }
 
+      /* Without helpers compression is always in a fork() */
+      if (!fork())
+      {
          pgmoneta_set_proc_title(1, argv_ptr, "wal", config->common.servers[i].name);
 
          shutdown_ports();
 
-         if (atomic_compare_exchange_strong(&config->common.servers[i].repository, &active, true))
-         {
-            d = pgmoneta_get_server_wal(i);
-
-            if (config->compression_type == COMPRESSION_CLIENT_GZIP || config->compression_type == COMPRESSION_SERVER_GZIP)
-            {
-               pgmoneta_gzip_wal(d);
-            }
-            else if (config->compression_type == COMPRESSION_CLIENT_ZSTD || config->compression_type == COMPRESSION_SERVER_ZSTD)
-            {
-               pgmoneta_zstandardc_wal(d);
-            }
-            else if (config->compression_type == COMPRESSION_CLIENT_LZ4 || config->compression_type == COMPRESSION_SERVER_LZ4)
-            {
-               pgmoneta_lz4c_wal(d);
-            }
-            else if (config->compression_type == COMPRESSION_CLIENT_BZIP2)
-            {
-               pgmoneta_bzip2_wal(d);
-            }
-
-            if (config->encryption != ENCRYPTION_NONE)
-            {
-               pgmoneta_encrypt_wal(d);
-            }
-
-            free(d);
-
-            atomic_store(&config->common.servers[i].repository, false);
-         }
+         wal_compress(i);
 
          exit(0);
       }
@@ -1894,20 +2246,85 @@ retention_cb(struct ev_loop* loop __attribute__((unused)), ev_periodic* w __attr
       return;
    }
 
+   if (helper_submit(HELPER_JOB_RETENTION, -1))
+   {
+      return;
+   }
+
    if (!fork())
    {
+      int ret;
+
       shutdown_ports();
-      pgmoneta_retention(argv_ptr);
+      ret = pgmoneta_retention(argv_ptr);
+
+      pgmoneta_stop_logging();
+      exit(ret);
    }
 }
 
 static void
-valid_cb(struct ev_loop* loop __attribute__((unused)), ev_periodic* w __attribute__((unused)), int revents)
+compaction_cb(struct ev_loop* loop __attribute__((unused)), ev_periodic* w __attribute__((unused)), int revents)
 {
-   struct main_configuration* config;
+   if (EV_ERROR & revents)
+   {
+      pgmoneta_log_trace("compaction_cb: got invalid event: %s", strerror(errno));
+      errno = 0;
+      return;
+   }
 
-   config = (struct main_configuration*)shmem;
+   /* A rollup can run for a long time, so it doesn't occupy a helper */
+   if (!fork())
+   {
+      int ret;
+
+      shutdown_ports();
+      ret = pgmoneta_compaction(argv_ptr);
+
+      pgmoneta_stop_logging();
+      exit(ret);
+   }
+}
+
+static void
+scrub_cb(struct ev_loop* loop __attribute__((unused)), ev_periodic* w __attribute__((unused)), int revents)
+{
+   if (EV_ERROR & revents)
+   {
+      pgmoneta_log_trace("scrub_cb: got invalid event: %s", strerror(errno));
+      errno = 0;
+      return;
+   }
+
+   /* A scrub can run for a long time, so it doesn't occupy a helper */
+   if (!fork())
+   {
+      int ret;
+
+      shutdown_ports();
+      ret = pgmoneta_scrub(argv_ptr);
+
+      pgmoneta_stop_logging();
+      exit(ret);
+   }
+}
 
+static void
+log_ring_cb(struct ev_loop* loop __attribute__((unused)), ev_periodic* w __attribute__((unused)), int revents)
+{
+   if (EV_ERROR & revents)
+   {
+      pgmoneta_log_trace("log_ring_cb: got invalid event: %s", strerror(errno));
+      errno = 0;
+      return;
+   }
+
+   pgmoneta_log_ring_flush();
+}
+
+static void
+valid_cb(struct ev_loop* loop __attribute__((unused)), ev_periodic* w __attribute__((unused)), int revents)
+{
    if (EV_ERROR & revents)
    {
       pgmoneta_log_trace("valid_cb: got invalid event: %s", strerror(errno));
@@ -1915,22 +2332,17 @@ valid_cb(struct ev_loop* loop __attribute__((unused)), ev_periodic* w __attribut
       return;
    }
 
+   if (helper_submit(HELPER_JOB_VALID, -1))
+   {
+      return;
+   }
+
    if (!fork())
    {
       pgmoneta_start_logging();
-      pgmoneta_memory_init();
-
-      for (int i = 0; i < config->common.number_of_servers; i++)
-      {
-         pgmoneta_log_trace("Valid - Server %d Valid %d WAL %d", i, config->common.servers[i].valid, config->common.servers[i].wal_streaming);
 
-         if (keep_running && !config->common.servers[i].valid)
-         {
-            pgmoneta_server_info(i);
-         }
-      }
+      valid_servers();
 
-      pgmoneta_memory_destroy();
       pgmoneta_stop_logging();
 
       exit(0);
@@ -1940,8 +2352,6 @@ valid_cb(struct ev_loop* loop __attribute__((unused)), ev_periodic* w __attribut
 static void
 wal_streaming_cb(struct ev_loop* loop __attribute__((unused)), ev_periodic* w __attribute__((unused)), int revents)
 {
-   bool start = false;
-   int follow;
    struct main_configuration* config;
 
    config = (struct main_configuration*)shmem;
@@ -1952,63 +2362,32 @@ wal_streaming_cb(struct ev_loop* loop __attribute__((unused)), ev_periodic* w __
       return;
    }
 
+   if (wal_multiplex)
+   {
+      // the multiplexed WAL process restarts its own receivers
+      return;
+   }
+
    for (int i = 0; i < config->common.number_of_servers; i++)
    {
       pgmoneta_log_trace("WAL streaming - Server %d Valid %d WAL %d CHECKSUMS %d SUMMARIZE_WAL %d",
                          i, config->common.servers[i].valid, config->common.servers[i].wal_streaming,
                          config->common.servers[i].checksums, config->common.servers[i].summarize_wal);
 
-      if (keep_running && !config->common.servers[i].wal_streaming)
+      if (keep_running && pgmoneta_wal_should_stream(i))
       {
-         start = false;
-
-         if (strlen(config->common.servers[i].follow) == 0)
-         {
-            follow = -1;
-
-            for (int j = 0; follow == -1 && j < config->common.number_of_servers; j++)
-            {
-               if (!strcmp(config->common.servers[j].follow, config->common.servers[i].name))
-               {
-                  follow = j;
-               }
-            }
+         pid_t pid;
 
-            if (follow == -1)
-            {
-               start = true;
-            }
-            else if (!config->common.servers[follow].wal_streaming)
-            {
-               start = true;
-            }
-         }
-         else
+         pid = fork();
+         if (pid == -1)
          {
-            for (int j = 0; !start && j < config->common.number_of_servers; j++)
-            {
-               if (!strcmp(config->common.servers[i].follow, config->common.servers[j].name) && !config->common.servers[j].wal_streaming)
-               {
-                  start = true;
-               }
-            }
+            /* No process */
+            pgmoneta_log_error("pgmoenta: WAL - Cannot create process");
          }
-
-         if (start)
+         else if (pid == 0)
          {
-            pid_t pid;
-
-            pid = fork();
-            if (pid == -1)
-            {
-               /* No process */
-               pgmoneta_log_error("pgmoenta: WAL - Cannot create process");
-            }
-            else if (pid == 0)
-            {
-               shutdown_ports();
-               pgmoneta_wal(i, argv_ptr);
-            }
+            shutdown_ports();
+            pgmoneta_wal(i, argv_ptr);
          }
       }
    }
@@ -2127,6 +2506,37 @@ init_receivewals(void)
 
    config = (struct main_configuration*)shmem;
 
+   if (config->wal_multiplex)
+   {
+      if (config->storage_engine & STORAGE_ENGINE_SSH)
+      {
+         pgmoneta_log_warn("WAL multiplexing isn't supported with the ssh storage engine");
+      }
+      else
+      {
+         pid_t pid;
+
+         wal_multiplex = true;
+
+         pid = fork();
+         if (pid == -1)
+         {
+            /* No process */
+            pgmoneta_log_error("WAL - Cannot create process");
+            wal_multiplex = false;
+         }
+         else if (pid == 0)
+         {
+            shutdown_ports();
+            pgmoneta_wal_multiplex(argv_ptr);
+         }
+         else
+         {
+            return;
+         }
+      }
+   }
+
    for (int i = 0; i < config->common.number_of_servers; i++)
    {
       if (strlen(config->common.servers[i].follow) == 0)
@@ -2160,170 +2570,252 @@ init_receivewals(void)
 static int
 init_replication_slots(void)
 {
-   int usr;
-   int auth = AUTH_ERROR;
-   int slot_status = INCORRECT_SLOT_TYPE;
-   SSL* ssl = NULL;
-   int socket;
    int ret = 0;
-   struct message* slot_request_msg = NULL;
-   struct message* slot_response_msg = NULL;
+   int remaining = 0;
+   int status;
+   int timeout;
+   time_t deadline;
+   pid_t pids[NUMBER_OF_SERVERS];
    struct main_configuration* config = NULL;
-   bool create_slot = false;
 
    config = (struct main_configuration*)shmem;
 
-   pgmoneta_memory_init();
-
+   /* The servers are checked in parallel, each in its own process */
    for (int srv = 0; srv < config->common.number_of_servers; srv++)
    {
-      usr = -1;
-
-      for (int i = 0; usr == -1 && i < config->common.number_of_users; i++)
+      pids[srv] = fork();
+      if (pids[srv] == -1)
       {
-         if (!strcmp(config->common.servers[srv].username, config->common.users[i].username))
+         status = check_server(srv);
+         if (status == SERVER_CHECK_FATAL)
          {
-            usr = i;
+            ret = 1;
          }
       }
-
-      if (usr != -1)
+      else if (pids[srv] == 0)
       {
-         create_slot = config->common.servers[srv].create_slot == CREATE_SLOT_YES ||
-                       (config->create_slot == CREATE_SLOT_YES && config->common.servers[srv].create_slot != CREATE_SLOT_NO);
-         socket = 0;
-         auth = pgmoneta_server_authenticate(srv, "postgres", config->common.users[usr].username, config->common.users[usr].password, false, &ssl, &socket);
-
-         if (auth == AUTH_SUCCESS)
-         {
-            pgmoneta_server_info(srv);
-
-            if (!pgmoneta_server_valid(srv))
-            {
-               pgmoneta_log_fatal("Could not get version for server %s", config->common.servers[srv].name);
-               ret = 1;
-               goto server_done;
-            }
+         shutdown_ports();
+         status = check_server(srv);
+         pgmoneta_server_close_connections();
+         _exit(status);
+      }
+      else
+      {
+         remaining++;
+      }
+   }
 
-            if (config->common.servers[srv].version < POSTGRESQL_MIN_VERSION)
-            {
-               pgmoneta_log_fatal("PostgreSQL %d or higher is required for server %s", POSTGRESQL_MIN_VERSION, config->common.servers[srv].name);
-               ret = 1;
-               goto server_done;
-            }
+   timeout = config->blocking_timeout > 0 ? config->blocking_timeout : DEFAULT_BLOCKING_TIMEOUT;
+   deadline = time(NULL) + timeout;
 
-            if (config->common.servers[srv].version < 15 && (config->compression_type == COMPRESSION_SERVER_GZIP ||
-                                                             config->compression_type == COMPRESSION_SERVER_ZSTD ||
-                                                             config->compression_type == COMPRESSION_SERVER_LZ4))
-            {
-               pgmoneta_log_fatal("PostgreSQL 15 or higher is required for server %s for server side compression", config->common.servers[srv].name);
-               ret = 1;
-               goto server_done;
-            }
+   while (remaining > 0 && time(NULL) < deadline)
+   {
+      for (int srv = 0; srv < config->common.number_of_servers; srv++)
+      {
+         if (pids[srv] <= 0 || waitpid(pids[srv], &status, WNOHANG) != pids[srv])
+         {
+            continue;
+         }
 
-            if (config->common.servers[srv].version >= 17 && !config->common.servers[srv].summarize_wal)
-            {
-               pgmoneta_log_fatal("PostgreSQL %d or higher requires summarize_wal for server %s",
-                                  config->common.servers[srv].version, config->common.servers[srv].name);
-               ret = 1;
-               goto server_done;
-            }
+         pids[srv] = 0;
+         remaining--;
 
-            /* Verify replication slot */
-            slot_status = verify_replication_slot(config->common.servers[srv].wal_slot, srv, ssl, socket);
-            if (slot_status == VALID_SLOT)
-            {
-               /* Ok */
-            }
-            else if (!create_slot)
-            {
-               if (slot_status == SLOT_NOT_FOUND)
-               {
-                  pgmoneta_log_fatal("Replication slot '%s' is not found for server %s", config->common.servers[srv].wal_slot, config->common.servers[srv].name);
-                  ret = 1;
-               }
-               else if (slot_status == INCORRECT_SLOT_TYPE)
-               {
-                  pgmoneta_log_fatal("Replication slot '%s' should be physical", config->common.servers[srv].wal_slot);
-                  ret = 1;
-               }
-            }
-         }
-         else
+         if (WIFEXITED(status) && WEXITSTATUS(status) == SERVER_CHECK_FATAL)
          {
-            pgmoneta_log_error("Authentication failed for user %s on %s", config->common.users[usr].username, config->common.servers[srv].name);
             ret = 1;
          }
-
-         pgmoneta_close_ssl(ssl);
-         pgmoneta_disconnect(socket);
-         socket = 0;
-
-         if (create_slot && slot_status == SLOT_NOT_FOUND)
+         else if (!WIFEXITED(status) || WEXITSTATUS(status) != SERVER_CHECK_OK)
          {
-            auth = pgmoneta_server_authenticate(srv, "postgres", config->common.users[usr].username, config->common.users[usr].password, true, &ssl, &socket);
-
-            if (auth == AUTH_SUCCESS)
-            {
-               pgmoneta_log_trace("CREATE_SLOT: %s/%s", config->common.servers[srv].name, config->common.servers[srv].wal_slot);
-
-               pgmoneta_create_replication_slot_message(config->common.servers[srv].wal_slot, &slot_request_msg, config->common.servers[srv].version);
-               if (pgmoneta_write_message(ssl, socket, slot_request_msg) == MESSAGE_STATUS_OK)
-               {
-                  if (pgmoneta_read_block_message(ssl, socket, &slot_response_msg) == MESSAGE_STATUS_OK)
-                  {
-                     pgmoneta_log_info("Created replication slot %s on %s", config->common.servers[srv].wal_slot, config->common.servers[srv].name);
-                  }
-                  else
-                  {
-                     pgmoneta_log_error("Could not read CREATE_REPLICATION_SLOT response for %s", config->common.servers[srv].name);
-                  }
-               }
-               else
-               {
-                  pgmoneta_log_error("Could not write CREATE_REPLICATION_SLOT request for %s", config->common.servers[srv].name);
-               }
-
-               pgmoneta_free_message(slot_request_msg);
-               slot_request_msg = NULL;
-
-               pgmoneta_clear_message();
-               slot_response_msg = NULL;
-            }
-            else
-            {
-               pgmoneta_log_error("Authentication failed for user on %s", config->common.servers[srv].name);
-            }
-
-server_done:
-            pgmoneta_close_ssl(ssl);
-            pgmoneta_disconnect(socket);
+            pgmoneta_log_warn("Server %s is not available, it is validated in the background", config->common.servers[srv].name);
          }
       }
-      else
+
+      if (remaining > 0)
       {
-         pgmoneta_log_error("Invalid user for %s", config->common.servers[srv].name);
+         SLEEP(10000000L);
       }
    }
 
-   pgmoneta_memory_destroy();
+   /* A server that doesn't answer doesn't hold back the others */
+   for (int srv = 0; srv < config->common.number_of_servers; srv++)
+   {
+      if (pids[srv] > 0)
+      {
+         pgmoneta_log_warn("Server %s didn't answer within %d seconds, it is validated in the background",
+                           config->common.servers[srv].name, timeout);
+      }
+   }
 
    return ret;
 }
 
 static int
-verify_replication_slot(char* slot_name, int srv, SSL* ssl, int socket)
+check_server(int srv)
 {
-   int ret = VALID_SLOT;
-   struct message* query;
-   struct query_response* response;
+   int usr;
+   int auth = AUTH_ERROR;
+   int slot_status = INCORRECT_SLOT_TYPE;
+   SSL* ssl = NULL;
+   int socket;
+   int ret = SERVER_CHECK_OK;
+   struct message* slot_request_msg = NULL;
+   struct message* slot_response_msg = NULL;
    struct main_configuration* config = NULL;
-   struct tuple* current = NULL;
+   bool create_slot = false;
 
    config = (struct main_configuration*)shmem;
 
-   pgmoneta_create_search_replication_slot_message(slot_name, &query);
-   if (pgmoneta_query_execute(ssl, socket, query, &response) || response == NULL)
+   pgmoneta_memory_init();
+
+   usr = -1;
+
+   for (int i = 0; usr == -1 && i < config->common.number_of_users; i++)
+   {
+      if (!strcmp(config->common.servers[srv].username, config->common.users[i].username))
+      {
+         usr = i;
+      }
+   }
+
+   if (usr != -1)
+   {
+      create_slot = config->common.servers[srv].create_slot == CREATE_SLOT_YES ||
+                    (config->create_slot == CREATE_SLOT_YES && config->common.servers[srv].create_slot != CREATE_SLOT_NO);
+      socket = 0;
+
+      /* The connection of the server information is reused for the checks */
+      pgmoneta_server_info(srv);
+
+      auth = pgmoneta_server_connect(srv, &ssl, &socket);
+
+      if (auth == AUTH_SUCCESS)
+      {
+         if (!pgmoneta_server_valid(srv))
+         {
+            pgmoneta_log_fatal("Could not get version for server %s", config->common.servers[srv].name);
+            ret = SERVER_CHECK_FATAL;
+            goto server_done;
+         }
+
+         if (config->common.servers[srv].version < POSTGRESQL_MIN_VERSION)
+         {
+            pgmoneta_log_fatal("PostgreSQL %d or higher is required for server %s", POSTGRESQL_MIN_VERSION, config->common.servers[srv].name);
+            ret = SERVER_CHECK_FATAL;
+            goto server_done;
+         }
+
+         if (config->common.servers[srv].version < 15 && (config->compression_type == COMPRESSION_SERVER_GZIP ||
+                                                          config->compression_type == COMPRESSION_SERVER_ZSTD ||
+                                                          config->compression_type == COMPRESSION_SERVER_LZ4))
+         {
+            pgmoneta_log_fatal("PostgreSQL 15 or higher is required for server %s for server side compression", config->common.servers[srv].name);
+            ret = SERVER_CHECK_FATAL;
+            goto server_done;
+         }
+
+         if (config->common.servers[srv].version >= 17 && !config->common.servers[srv].summarize_wal)
+         {
+            pgmoneta_log_fatal("PostgreSQL %d or higher requires summarize_wal for server %s",
+                               config->common.servers[srv].version, config->common.servers[srv].name);
+            ret = SERVER_CHECK_FATAL;
+            goto server_done;
+         }
+
+         /* Verify replication slot */
+         slot_status = verify_replication_slot(config->common.servers[srv].wal_slot, srv, ssl, socket);
+         if (slot_status == VALID_SLOT)
+         {
+            /* Ok */
+         }
+         else if (!create_slot)
+         {
+            if (slot_status == SLOT_NOT_FOUND)
+            {
+               pgmoneta_log_fatal("Replication slot '%s' is not found for server %s", config->common.servers[srv].wal_slot, config->common.servers[srv].name);
+               ret = SERVER_CHECK_FATAL;
+            }
+            else if (slot_status == INCORRECT_SLOT_TYPE)
+            {
+               pgmoneta_log_fatal("Replication slot '%s' should be physical", config->common.servers[srv].wal_slot);
+               ret = SERVER_CHECK_FATAL;
+            }
+         }
+      }
+      else
+      {
+         pgmoneta_log_error("Authentication failed for user %s on %s", config->common.users[usr].username, config->common.servers[srv].name);
+         ret = SERVER_CHECK_UNAVAILABLE;
+      }
+
+      pgmoneta_close_ssl(ssl);
+      pgmoneta_disconnect(socket);
+      socket = 0;
+
+      if (create_slot && slot_status == SLOT_NOT_FOUND)
+      {
+         auth = pgmoneta_server_authenticate(srv, "postgres", config->common.users[usr].username, config->common.users[usr].password, true, &ssl, &socket);
+
+         if (auth == AUTH_SUCCESS)
+         {
+            pgmoneta_log_trace("CREATE_SLOT: %s/%s", config->common.servers[srv].name, config->common.servers[srv].wal_slot);
+
+            pgmoneta_create_replication_slot_message(config->common.servers[srv].wal_slot, &slot_request_msg, config->common.servers[srv].version);
+            if (pgmoneta_write_message(ssl, socket, slot_request_msg) == MESSAGE_STATUS_OK)
+            {
+               if (pgmoneta_read_block_message(ssl, socket, &slot_response_msg) == MESSAGE_STATUS_OK)
+               {
+                  pgmoneta_log_info("Created replication slot %s on %s", config->common.servers[srv].wal_slot, config->common.servers[srv].name);
+               }
+               else
+               {
+                  pgmoneta_log_error("Could not read CREATE_REPLICATION_SLOT response for %s", config->common.servers[srv].name);
+               }
+            }
+            else
+            {
+               pgmoneta_log_error("Could not write CREATE_REPLICATION_SLOT request for %s", config->common.servers[srv].name);
+            }
+
+            pgmoneta_free_message(slot_request_msg);
+            slot_request_msg = NULL;
+
+            pgmoneta_clear_message();
+            slot_response_msg = NULL;
+         }
+         else
+         {
+            pgmoneta_log_error("Authentication failed for user on %s", config->common.servers[srv].name);
+         }
+
+server_done:
+         pgmoneta_close_ssl(ssl);
+         pgmoneta_disconnect(socket);
+      }
+   }
+   else
+   {
+      pgmoneta_log_error("Invalid user for %s", config->common.servers[srv].name);
+      ret = SERVER_CHECK_UNAVAILABLE;
+   }
+
+   pgmoneta_memory_destroy();
+
+   return ret;
+}
+
+static int
+verify_replication_slot(char* slot_name, int srv, SSL* ssl, int socket)
+{
+   int ret = VALID_SLOT;
+   struct message* query;
+   struct query_response* response;
+   struct main_configuration* config = NULL;
+   struct tuple* current = NULL;
+
+   config = (struct main_configuration*)shmem;
+
+   pgmoneta_create_search_replication_slot_message(slot_name, &query);
+   if (pgmoneta_query_execute(ssl, socket, query, &response) || response == NULL)
    {
       pgmoneta_log_error("Could not execute verify replication slot query for %s", config->common.servers[srv].name);
    }
@@ -2444,4 +2936,497 @@ shutdown_ports(void)
    {
       shutdown_management();
    }
+
+   /* Only the main process submits helper jobs and backups */
+   if (helper_fds[0] != -1)
+   {
+      close(helper_fds[0]);
+      helper_fds[0] = -1;
+   }
+
+   if (backup_fds[0] != -1)
+   {
+      close(backup_fds[0]);
+      backup_fds[0] = -1;
+   }
+}
+
+static int
+management_submit(int client_fd, int32_t id, int server, uint8_t compression, uint8_t encryption, struct json* payload)
+{
+   struct management_input* mi = NULL;
+
+   if (management_workers == NULL)
+   {
+      goto error;
+   }
+
+   mi = (struct management_input*)calloc(1, sizeof(struct management_input));
+   if (mi == NULL)
+   {
+      goto error;
+   }
+
+   mi->common.workers = management_workers;
+   mi->client_fd = client_fd;
+   mi->id = id;
+   mi->server = server;
+   mi->offline = offline;
+   mi->compression = compression;
+   mi->encryption = encryption;
+
+   if (pgmoneta_json_clone(payload, &mi->payload))
+   {
+      goto error;
+   }
+
+   if (pgmoneta_workers_add(management_workers, management_execute, (struct worker_common*)mi))
+   {
+      goto error;
+   }
+
+   return 0;
+
+error:
+
+   if (mi != NULL)
+   {
+      pgmoneta_json_destroy(mi->payload);
+      free(mi);
+   }
+
+   return 1;
+}
+
+static void
+management_execute(struct worker_common* wc)
+{
+   struct management_input* mi = (struct management_input*)wc;
+
+   /* The handlers take ownership of the payload and close the client */
+   switch (mi->id)
+   {
+      case MANAGEMENT_LIST_BACKUP:
+         pgmoneta_list_backup(mi->client_fd, mi->server, mi->compression, mi->encryption, mi->payload);
+         break;
+      case MANAGEMENT_INFO:
+         pgmoneta_info_request(NULL, mi->client_fd, mi->server, mi->compression, mi->encryption, mi->payload);
+         break;
+      case MANAGEMENT_CONF_GET:
+         pgmoneta_conf_get(NULL, mi->client_fd, mi->compression, mi->encryption, mi->payload);
+         break;
+      case MANAGEMENT_STATUS:
+         pgmoneta_status(NULL, mi->client_fd, mi->offline, mi->compression, mi->encryption, mi->payload);
+         break;
+      case MANAGEMENT_STATUS_DETAILS:
+         pgmoneta_status_details(NULL, mi->client_fd, mi->offline, mi->compression, mi->encryption, mi->payload);
+         break;
+      default:
+         pgmoneta_json_destroy(mi->payload);
+         pgmoneta_disconnect(mi->client_fd);
+         break;
+   }
+
+   free(mi);
+}
+
+static void
+wal_compress(int server)
+{
+   char* d = NULL;
+   struct lock* lock = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (!pgmoneta_lock_repository(server, LOCK_EXCLUSIVE, &lock))
+   {
+      d = pgmoneta_get_server_wal(server);
+
+      if (config->compression_type == COMPRESSION_CLIENT_GZIP || config->compression_type == COMPRESSION_SERVER_GZIP)
+      {
+         pgmoneta_gzip_wal(d);
+      }
+      else if (config->compression_type == COMPRESSION_CLIENT_ZSTD || config->compression_type == COMPRESSION_SERVER_ZSTD)
+      {
+         pgmoneta_zstandardc_wal(d);
+      }
+      else if (config->compression_type == COMPRESSION_CLIENT_LZ4 || config->compression_type == COMPRESSION_SERVER_LZ4)
+      {
+         pgmoneta_lz4c_wal(d);
+      }
+      else if (config->compression_type == COMPRESSION_CLIENT_BZIP2)
+      {
+         pgmoneta_bzip2_wal(d);
+      }
+
+      if (config->encryption != ENCRYPTION_NONE)
+      {
+         pgmoneta_encrypt_wal(d);
+      }
+
+      free(d);
+
+      pgmoneta_unlock(lock);
+   }
+}
+
+static void
+valid_servers(void)
+{
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   pgmoneta_memory_init();
+
+   for (int i = 0; i < config->common.number_of_servers; i++)
+   {
+      pgmoneta_log_trace("Valid - Server %d Valid %d WAL %d", i, config->common.servers[i].valid, config->common.servers[i].wal_streaming);
+
+      if (keep_running && !config->common.servers[i].valid)
+      {
+         pgmoneta_server_info(i);
+      }
+   }
+
+   pgmoneta_memory_destroy();
+}
+
+static int
+start_helpers(void)
+{
+   int flags;
+
+   /* Each job is a single message, so every job goes to exactly one helper */
+   if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, helper_fds))
+   {
+      pgmoneta_log_error("Helpers: Could not create socket pair due to %s", strerror(errno));
+      errno = 0;
+      goto error;
+   }
+
+   flags = fcntl(helper_fds[0], F_GETFL, 0);
+   if (flags == -1 || fcntl(helper_fds[0], F_SETFL, flags | O_NONBLOCK) == -1)
+   {
+      pgmoneta_log_error("Helpers: Could not set non-blocking mode due to %s", strerror(errno));
+      errno = 0;
+      goto error;
+   }
+
+   memset(&helpers, 0, sizeof(helpers));
+
+   for (int i = 0; i < NUMBER_OF_HELPERS; i++)
+   {
+      if (helper_spawn(i))
+      {
+         goto error;
+      }
+   }
+
+   return 0;
+
+error:
+
+   shutdown_helpers();
+
+   return 1;
+}
+
+static void
+shutdown_helpers(void)
+{
+   for (int i = 0; i < NUMBER_OF_HELPERS; i++)
+   {
+      if (helpers[i].pid > 0)
+      {
+         ev_child_stop(main_loop, &helpers[i].child);
+         helpers[i].pid = 0;
+      }
+   }
+
+   /* The helpers exit once they see the end of the job stream */
+   for (int i = 0; i < 2; i++)
+   {
+      if (helper_fds[i] != -1)
+      {
+         close(helper_fds[i]);
+         helper_fds[i] = -1;
+      }
+   }
+}
+
+static int
+helper_spawn(int index)
+{
+   pid_t pid;
+
+   pid = fork();
+   if (pid == -1)
+   {
+      pgmoneta_log_error("Helpers: Could not fork due to %s", strerror(errno));
+      errno = 0;
+      goto error;
+   }
+   else if (pid == 0)
+   {
+      helper_run();
+   }
+
+   helpers[index].pid = pid;
+   ev_child_init(&helpers[index].child, helper_cb, pid, 0);
+   ev_child_start(main_loop, &helpers[index].child);
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+static void
+helper_run(void)
+{
+   struct helper_job job;
+   sigset_t mask;
+   ssize_t n;
+   int jobs = 0;
+
+   pgmoneta_set_proc_title(1, argv_ptr, "helper", NULL);
+
+   /* The helper has no event loop, so the signals must act directly */
+   signal(SIGTERM, SIG_DFL);
+   signal(SIGINT, SIG_DFL);
+   signal(SIGHUP, SIG_IGN);
+   signal(SIGALRM, SIG_DFL);
+   sigemptyset(&mask);
+   sigaddset(&mask, SIGTERM);
+   sigaddset(&mask, SIGINT);
+   sigaddset(&mask, SIGALRM);
+   sigprocmask(SIG_UNBLOCK, &mask, NULL);
+
+   shutdown_ports();
+
+   /* Exit after a number of jobs, so nothing the jobs leak piles up */
+   while (jobs < HELPER_MAX_JOBS)
+   {
+      n = recv(helper_fds[1], &job, sizeof(job), 0);
+
+      if (n == -1 && errno == EINTR)
+      {
+         errno = 0;
+         continue;
+      }
+
+      if (n != (ssize_t)sizeof(job))
+      {
+         break;
+      }
+
+      if (job.type == HELPER_JOB_WAL)
+      {
+         wal_compress(job.server);
+      }
+      else if (job.type == HELPER_JOB_VALID)
+      {
+         valid_servers();
+      }
+      else if (job.type == HELPER_JOB_RETENTION)
+      {
+         pgmoneta_retention(argv_ptr);
+      }
+
+      pgmoneta_set_proc_title(1, argv_ptr, "helper", NULL);
+
+      jobs++;
+   }
+
+   pgmoneta_stop_logging();
+
+   exit(0);
+}
+
+static void
+helper_cb(struct ev_loop* loop __attribute__((unused)), struct ev_child* w, int revents)
+{
+   if (EV_ERROR & revents)
+   {
+      pgmoneta_log_trace("helper_cb: got invalid event: %s", strerror(errno));
+      errno = 0;
+      return;
+   }
+
+   for (int i = 0; i < NUMBER_OF_HELPERS; i++)
+   {
+      if (&helpers[i].child == w)
+      {
+         ev_child_stop(main_loop, w);
+         helpers[i].pid = 0;
+
+         pgmoneta_log_debug("Helpers: Helper %d exited with status %d", w->rpid, WEXITSTATUS(w->rstatus));
+
+         if (keep_running && helper_fds[0] != -1)
+         {
+            helper_spawn(i);
+         }
+      }
+   }
+}
+
+static bool
+helper_submit(int type, int server)
+{
+   struct helper_job job;
+
+   if (helper_fds[0] == -1)
+   {
+      return false;
+   }
+
+   memset(&job, 0, sizeof(job));
+   job.type = type;
+   job.server = server;
+
+   if (send(helper_fds[0], &job, sizeof(job), MSG_NOSIGNAL) != (ssize_t)sizeof(job))
+   {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+      {
+         /* All helpers are busy and the backlog is full, the next tick will retry */
+         pgmoneta_log_debug("Helpers: Job %d for server %d skipped", type, server);
+         errno = 0;
+         return true;
+      }
+
+      pgmoneta_log_warn("Helpers: Could not submit job %d due to %s", type, strerror(errno));
+      errno = 0;
+      return false;
+   }
+
+   return true;
+}
+
+static int
+start_backup_multiplex(void)
+{
+   int flags;
+
+   /* Each backup is a single message, which carries the client along */
+   if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, backup_fds))
+   {
+      pgmoneta_log_error("Backup: Could not create socket pair due to %s", strerror(errno));
+      errno = 0;
+      goto error;
+   }
+
+   flags = fcntl(backup_fds[0], F_GETFL, 0);
+   if (flags == -1 || fcntl(backup_fds[0], F_SETFL, flags | O_NONBLOCK) == -1)
+   {
+      pgmoneta_log_error("Backup: Could not set non-blocking mode due to %s", strerror(errno));
+      errno = 0;
+      goto error;
+   }
+
+   memset(&backup_multiplex, 0, sizeof(backup_multiplex));
+
+   if (backup_multiplex_spawn())
+   {
+      goto error;
+   }
+
+   return 0;
+
+error:
+
+   shutdown_backup_multiplex();
+
+   return 1;
+}
+
+static void
+shutdown_backup_multiplex(void)
+{
+   if (backup_multiplex.pid > 0)
+   {
+      ev_child_stop(main_loop, &backup_multiplex.child);
+      backup_multiplex.pid = 0;
+   }
+
+   /* The backup process exits once its backups are done and it sees the end of the stream */
+   for (int i = 0; i < 2; i++)
+   {
+      if (backup_fds[i] != -1)
+      {
+         close(backup_fds[i]);
+         backup_fds[i] = -1;
+      }
+   }
+}
+
+static int
+backup_multiplex_spawn(void)
+{
+   pid_t pid;
+   sigset_t mask;
+
+   pid = fork();
+   if (pid == -1)
+   {
+      pgmoneta_log_error("Backup: Could not fork due to %s", strerror(errno));
+      errno = 0;
+      goto error;
+   }
+   else if (pid == 0)
+   {
+      /* The loop of the backup process doesn't watch the signals */
+      signal(SIGTERM, SIG_DFL);
+      signal(SIGINT, SIG_DFL);
+      signal(SIGHUP, SIG_IGN);
+      signal(SIGALRM, SIG_DFL);
+      sigemptyset(&mask);
+      sigaddset(&mask, SIGTERM);
+      sigaddset(&mask, SIGINT);
+      sigaddset(&mask, SIGALRM);
+      sigprocmask(SIG_UNBLOCK, &mask, NULL);
+
+      shutdown_ports();
+
+      if (helper_fds[1] != -1)
+      {
+         close(helper_fds[1]);
+         helper_fds[1] = -1;
+      }
+
+      pgmoneta_backup_multiplex(backup_fds[1], argv_ptr);
+   }
+
+   backup_multiplex.pid = pid;
+   ev_child_init(&backup_multiplex.child, backup_multiplex_cb, pid, 0);
+   ev_child_start(main_loop, &backup_multiplex.child);
+
+   return 0;
+
+error:
+
+   return 1;
+}
+
+static void
+backup_multiplex_cb(struct ev_loop* loop __attribute__((unused)), struct ev_child* w, int revents)
+{
+   if (EV_ERROR & revents)
+   {
+      pgmoneta_log_trace("backup_multiplex_cb: got invalid event: %s", strerror(errno));
+      errno = 0;
+      return;
+   }
+
+   ev_child_stop(main_loop, w);
+   backup_multiplex.pid = 0;
+
+   pgmoneta_log_debug("Backup: Backup process %d exited with status %d", w->rpid, WEXITSTATUS(w->rstatus));
+
+   if (keep_running && backup_fds[0] != -1)
+   {
+      backup_multiplex_spawn();
+   }
 }
@@ -63,7 +63,7 @@ usage(void)
    printf("\n");
 
    printf("Usage:\n");
-   printf("  pgmoneta-walinfo <file>\n");
+   printf("  pgmoneta-walinfo <file|directory>\n");
    printf("\n");
    printf("Options:\n");
    printf("  -c,   --config      Set the path to the pgmoneta_walinfo.conf file\n");
@@ -82,6 +82,8 @@ usage(void)
    printf("  -e,   --end         Filter on an end LSN\n");
    printf("  -x,   --xid         Filter on an XID\n");
    printf("  -l,   --limit       Limit number of outputs\n");
+   printf("  -w,   --workers     Number of workers for a WAL directory\n");
+   printf("  -S,   --stats       Summarize the records instead of showing them\n");
    printf("  -v,   --verbose     Output result\n");
    printf("  -V,   --version     Display version information\n");
    printf("  -m,   --mapping     Provide mappings file for OID translation\n");
@@ -137,6 +139,8 @@ main(int argc, char** argv)
    char* filepath;
    int num_results = 0;
    int num_options = 0;
+   int workers = 0;
+   bool stats = false;
 
    cli_option options[] = {
       {"c", "config", true},
@@ -157,6 +161,8 @@ main(int argc, char** argv)
       {"e", "end", true},
       {"x", "xid", true},
       {"l", "limit", true},
+      {"w", "workers", true},
+      {"S", "stats", false},
       {"v", "verbose", false},
       {"V", "version", false},
       {"?", "help", false},
@@ -296,6 +302,14 @@ main(int argc, char** argv)
       {
          limit = pgmoneta_atoi(optarg);
       }
+      else if (!strcmp(optname, "w") || !strcmp(optname, "workers"))
+      {
+         workers = pgmoneta_atoi(optarg);
+      }
+      else if (!strcmp(optname, "S") || !strcmp(optname, "stats"))
+      {
+         stats = true;
+      }
       else if (!strcmp(optname, "m") || !strcmp(optname, "mapping"))
       {
          enable_mapping = true;
@@ -345,7 +359,8 @@ main(int argc, char** argv)
       }
    }
 
-   size = sizeof(struct walinfo_configuration);
+   /* The workers read the CPU pinning from the main configuration */
+   size = MAX(sizeof(struct walinfo_configuration), sizeof(struct main_configuration));
    if (pgmoneta_create_shared_memory(size, HUGEPAGE_OFF, &shmem))
    {
       warnx("Error creating shared memory");
@@ -582,7 +597,34 @@ main(int argc, char** argv)
       }
    }
 
-   if (filepath != NULL)
+   if (filepath != NULL && stats)
+   {
+      if (workers <= 0)
+      {
+         workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+      }
+
+      if (pgmoneta_stats_walfiles(filepath, type, output, rms, start_lsn, end_lsn, xids, limit, workers))
+      {
+         fprintf(stderr, "Error while summarizing WAL files\n");
+         goto error;
+      }
+   }
+   else if (filepath != NULL && pgmoneta_is_directory(filepath))
+   {
+      if (workers <= 0)
+      {
+         workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+      }
+
+      if (pgmoneta_describe_walfiles(filepath, type, output, quiet, color,
+                                     rms, start_lsn, end_lsn, xids, limit, included_objects, workers))
+      {
+         fprintf(stderr, "Error while reading/describing WAL files\n");
+         goto error;
+      }
+   }
+   else if (filepath != NULL)
    {
       if (pgmoneta_describe_walfile(filepath, type, output, quiet, color,
                                     rms, start_lsn, end_lsn, xids, limit, included_objects))
@@ -0,0 +1,3157 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <art.h>
+#include <bzip2_compression.h>
+#include <cmd.h>
+#include <configuration.h>
+#include <deque.h>
+#include <gzip_compression.h>
+#include <http.h>
+#include <info.h>
+#include <json.h>
+#include <logging.h>
+#include <lz4_compression.h>
+#include <manifest.h>
+#include <security.h>
+#include <shmem.h>
+#include <storage.h>
+#include <utils.h>
+#include <value.h>
+#include <walfile.h>
+#include <walfile/wal_reader.h>
+#include <workflow.h>
+#include <zstandard_compression.h>
+
+/* system */
+#include <err.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+
+#define BENCH_PAGE_SIZE    8192
+#define BENCH_SEGMENT_SIZE (16 * 1024 * 1024)
+#define BENCH_DEFAULT_SIZE 64
+#define BENCH_MAX_CORPORA  16
+#define BENCH_MAX_VALUES   32
+
+#define BENCH_DEFAULT_REPETITIONS 10
+#define BENCH_MAX_REPETITIONS     100
+
+#define BENCH_FORMAT_TEXT 0
+#define BENCH_FORMAT_CSV  1
+#define BENCH_FORMAT_JSON 2
+
+#define BENCH_DEFAULT_DISTRIBUTION "8:1000,1024:64,65536:4"
+#define BENCH_FILES_PER_DIRECTORY  1000
+
+#define BENCH_REPOSITORY_CHAIN    7
+#define BENCH_REPOSITORY_FILES    16
+#define BENCH_REPOSITORY_SEGMENTS 4
+#define BENCH_REPOSITORY_KEEP     97
+
+/** @struct bench_algorithm
+ * Defines a compression algorithm under test
+ */
+struct bench_algorithm
+{
+   char* name;                                                    /**< The name */
+   char* suffix;                                                  /**< The file suffix */
+   int max_level;                                                 /**< The highest level, 0 if the level is ignored */
+   bool workers;                                                  /**< Does the algorithm use the workers setting */
+   int (*compress_file)(char*, char*);                            /**< Compress a file */
+   int (*decompress_file)(char*, char*);                          /**< Decompress a file */
+   int (*compress_string)(char*, unsigned char**, size_t*);       /**< Compress a string */
+   int (*decompress_string)(unsigned char*, size_t, char**);      /**< Decompress a string */
+};
+
+/** @struct bench_corpus
+ * Defines a data set
+ */
+struct bench_corpus
+{
+   char name[MISC_LENGTH]; /**< The name */
+   char path[MAX_PATH];    /**< The path of the data */
+   size_t size;            /**< The size of the data */
+   bool text;              /**< Is the data text, and usable by the string functions */
+   bool generated;         /**< Was the data generated, and should be removed */
+};
+
+/** @struct bench_result
+ * Defines the result of a run
+ */
+struct bench_result
+{
+   bool success;              /**< Did the run succeed */
+   size_t compressed_size;    /**< The compressed size */
+   double compress_seconds;   /**< The compression time */
+   double decompress_seconds; /**< The decompression time */
+};
+
+/** @struct bench_storage_run
+ * Defines the result of a storage engine run
+ */
+struct bench_storage_run
+{
+   bool success;           /**< Did the run succeed */
+   int files;              /**< The number of files */
+   uint64_t bytes;         /**< The number of bytes */
+   double seconds;         /**< The time of the execute phase */
+   double cpu_seconds;     /**< The user and system time of the execute phase */
+   int requests;           /**< The number of HTTP requests */
+   double latencies[3];    /**< The p50, p95 and p99 request latencies in milliseconds */
+};
+
+/** @struct bench_wal_result
+ * Defines the result of a WAL decoding run
+ */
+struct bench_wal_result
+{
+   bool success;                  /**< Did the run succeed */
+   int version;                   /**< The PostgreSQL version of the segments */
+   uint64_t records;              /**< The number of records */
+   uint64_t bytes;                /**< The number of record bytes */
+   double decode_seconds;         /**< The time to decode the records */
+   double describe_seconds;       /**< The time to describe the records */
+   double encode_seconds;         /**< The time to encode the records */
+   uint64_t rmgrs[UINT8_MAX + 1]; /**< The number of records per resource manager */
+};
+
+/** @struct bench_timing
+ * Defines the timings of an operation over the repetitions
+ */
+struct bench_timing
+{
+   char* name;                                 /**< The name of the operation */
+   int count;                                  /**< The number of repetitions */
+   double seconds[BENCH_MAX_REPETITIONS];      /**< The time of each repetition */
+};
+
+static struct bench_algorithm algorithms[] = {
+   {"gzip", ".gz", 9, false, pgmoneta_gzip_file, pgmoneta_gunzip_file, pgmoneta_gzip_string, pgmoneta_gunzip_string},
+   {"zstd", ".zstd", 19, true, pgmoneta_zstandardc_file, pgmoneta_zstandardd_file, pgmoneta_zstdc_string, pgmoneta_zstdd_string},
+   {"lz4", ".lz4", 0, false, pgmoneta_lz4c_file, pgmoneta_lz4d_file, pgmoneta_lz4c_string, pgmoneta_lz4d_string},
+   {"bzip2", ".bz2", 9, false, pgmoneta_bzip2_file, pgmoneta_bunzip2_file, pgmoneta_bzip2_string, pgmoneta_bunzip2_string},
+};
+
+static uint64_t seed = 0x9E3779B97F4A7C15ULL;
+
+static char* words[] = {
+   "alpha", "bravo", "charlie", "delta", "echo", "foxtrot", "golf", "hotel",
+   "india", "juliett", "kilo", "lima", "mike", "november", "oscar", "papa",
+   "quebec", "romeo", "sierra", "tango", "uniform", "victor", "whiskey", "xray",
+   "yankee", "zulu", "postgresql", "pgmoneta", "backup", "restore", "wal", "page",
+};
+
+static uint64_t bench_random(void);
+static size_t bench_text(char* buffer, size_t size);
+static void bench_put16(unsigned char* p, uint16_t v);
+static void bench_put32(unsigned char* p, uint32_t v);
+static void bench_put64(unsigned char* p, uint64_t v);
+static void bench_heap_page(unsigned char* page, uint32_t block, uint32_t* id);
+static void bench_btree_page(unsigned char* page, uint32_t block, uint64_t* key);
+static void bench_wal_segment(unsigned char* segment, uint64_t segno);
+static int bench_generate(char* directory, char* name, size_t size, struct bench_corpus* corpus);
+static int bench_capture(char* path, struct bench_corpus* corpus);
+static int bench_file(struct bench_corpus* corpus, struct bench_algorithm* algorithm, char* directory, struct bench_result* result);
+static int bench_string(struct bench_corpus* corpus, struct bench_algorithm* algorithm, struct bench_result* result);
+static int bench_run(struct bench_corpus* corpus, struct bench_algorithm* algorithm, int level, int workers, bool string,
+                     char* directory, struct bench_result* result, long* memory);
+static void bench_report(int format, struct bench_corpus* corpus, struct bench_algorithm* algorithm, char* api, int level,
+                         int workers, struct bench_result* result, long memory);
+static int bench_manifest(char* directory, int files, int format);
+static int bench_storage(char* configuration, char* engines, int* concurrency, int number_of_concurrency,
+                         char* distribution, int format);
+static int bench_storage_tree(char* label, int* sizes, int* counts, int number_of_sizes, int* files, uint64_t* bytes);
+static int bench_storage_run(char* engine, char* label, struct bench_storage_run* run);
+static int bench_compare_latencies(const void* a, const void* b);
+static int bench_wal(char** paths, int number_of_paths, int format);
+static int bench_wal_segments(char* path, int* number_of_segments, char*** segments);
+static int bench_wal_run(char** segments, int number_of_segments, int rmid, struct bench_wal_result* result, long* memory);
+static int bench_wal_parse(char** segments, int number_of_segments, struct bench_wal_result* result);
+static int bench_wal_iterate(char** segments, int number_of_segments, int rmid, struct bench_wal_result* result);
+static void bench_wal_record(struct decoded_xlog_record* record, uint16_t magic, struct bench_wal_result* result);
+static void bench_wal_report(int format, char* path, char* rmgr, struct bench_wal_result* result, long memory);
+static int bench_containers(int* sizes, int number_of_sizes, int repetitions, int format);
+static int bench_containers_run(char** keys, int size, struct bench_timing* timings, bool record);
+static void bench_containers_record(struct bench_timing* timing, bool record, double seconds);
+static void bench_containers_report(int format, int size, struct bench_timing* timing);
+static int bench_compare_doubles(const void* a, const void* b);
+static int bench_repository(char* directory, int* sizes, int number_of_sizes, int repetitions, bool keep, int format);
+static int bench_repository_generate(int backups);
+static int bench_repository_backup(char* directory, int index, char* label, char* parent);
+static int bench_repository_run(struct bench_timing* timings, bool record);
+static void bench_repository_report(int format, int backups, struct bench_timing* timing);
+static void bench_json(char* suite, char* name, char* metric, char* unit, bool higher, double value, int samples,
+                       double stddev, int* ranks, double* percentiles, int number_of_percentiles);
+static struct json* bench_json_environment(void);
+static double bench_mean(double* values, int count, double* stddev);
+static int bench_parse_list(char* s, int* values, int max);
+static double bench_now(void);
+
+static void
+version(void)
+{
+   printf("pgmoneta-bench %s\n", VERSION);
+   exit(1);
+}
+
+static void
+usage(void)
+{
+   printf("pgmoneta-bench %s\n", VERSION);
+   printf("  Benchmark the compression throughput and ratio, the manifest comparison, the storage engines,\n");
+   printf("  the WAL decoding, the containers or the backup catalog of pgmoneta\n");
+   printf("\n");
+
+   printf("Usage:\n");
+   printf("  pgmoneta-bench [ -a ALGORITHMS ] [ -l LEVELS ] [ -w WORKERS ] [ -s SIZE ] [ -f FILE ]*\n");
+   printf("  pgmoneta-bench -m FILES\n");
+   printf("  pgmoneta-bench -S ENGINES -c CONFIG [ -C CONCURRENCY ] [ -D DISTRIBUTION ]\n");
+   printf("  pgmoneta-bench -W PATH [ -W PATH ]*\n");
+   printf("  pgmoneta-bench -K SIZES [ -r REPETITIONS ]\n");
+   printf("  pgmoneta-bench -R BACKUPS [ -r REPETITIONS ] [ -k ]\n");
+   printf("\n");
+   printf("Options:\n");
+   printf("  -a, --algorithms  Comma separated algorithms (gzip, zstd, lz4, bzip2). Default is all\n");
+   printf("  -l, --levels      Comma separated compression levels. Default is 1,3,6,9\n");
+   printf("  -w, --workers     Comma separated worker counts. Default is 0\n");
+   printf("  -s, --size        The size of each generated data set in MB. Default is 64\n");
+   printf("  -f, --file        Add a captured file, like a relation segment or a WAL segment\n");
+   printf("  -d, --directory   The work directory. Default is /tmp\n");
+   printf("  -F, --format      Output format (text, csv, json)\n");
+   printf("  -m, --manifest    Benchmark the manifest comparison with this many files instead\n");
+   printf("  -S, --storage     Benchmark the comma separated storage engines (local, ssh, s3, azure) instead\n");
+   printf("  -c, --config      The pgmoneta.conf with the storage settings, the first server is used\n");
+   printf("  -C, --concurrency Comma separated upload concurrencies, or SSH workers. Default is 4\n");
+   printf("  -D, --distribution Comma separated SIZE:COUNT file sizes in kB. Default is %s\n", BENCH_DEFAULT_DISTRIBUTION);
+   printf("  -W, --wal         Benchmark the WAL decoding of a captured WAL segment, or a directory of them, instead\n");
+   printf("  -K, --containers  Benchmark the ART, deque, JSON and value containers with comma separated key counts instead\n");
+   printf("  -R, --repository  Benchmark the catalog of generated repositories with comma separated backup counts instead\n");
+   printf("  -k, --keep        Keep the generated repositories in the work directory\n");
+   printf("  -r, --repetitions The number of measured repetitions after one warmup. Default is %d\n", BENCH_DEFAULT_REPETITIONS);
+   printf("  -V, --version     Display version information\n");
+   printf("  -?, --help        Display help\n");
+   printf("\n");
+   printf("pgmoneta: %s\n", PGMONETA_HOMEPAGE);
+   printf("Report bugs: %s\n", PGMONETA_ISSUES);
+}
+
+int
+main(int argc, char** argv)
+{
+   char* selected = NULL;
+   char* directory = "/tmp";
+   char* filename = NULL;
+   int levels[BENCH_MAX_VALUES] = {1, 3, 6, 9};
+   int number_of_levels = 4;
+   int workers[BENCH_MAX_VALUES] = {0};
+   int number_of_workers = 1;
+   int size = BENCH_DEFAULT_SIZE;
+   int format = BENCH_FORMAT_TEXT;
+   int manifest = 0;
+   char* storage = NULL;
+   char* configuration = NULL;
+   char* distribution = BENCH_DEFAULT_DISTRIBUTION;
+   int concurrency[BENCH_MAX_VALUES] = {4};
+   int number_of_concurrency = 1;
+   char* wal[BENCH_MAX_CORPORA];
+   int number_of_wal = 0;
+   int containers[BENCH_MAX_VALUES] = {0};
+   int number_of_containers = 0;
+   int repositories[BENCH_MAX_VALUES] = {0};
+   int number_of_repositories = 0;
+   bool keep = false;
+   int repetitions = BENCH_DEFAULT_REPETITIONS;
+   int number_of_corpora = 0;
+   int optind = 0;
+   int num_results = 0;
+   int num_options = 0;
+   int previous;
+   int level;
+   long memory;
+   size_t shmem_size;
+   bool failed = false;
+   struct bench_corpus corpora[BENCH_MAX_CORPORA];
+   struct bench_result result;
+   struct main_configuration* config = NULL;
+
+   cli_option options[] = {
+      {"a", "algorithms", true},
+      {"l", "levels", true},
+      {"w", "workers", true},
+      {"s", "size", true},
+      {"f", "file", true},
+      {"d", "directory", true},
+      {"F", "format", true},
+      {"m", "manifest", true},
+      {"S", "storage", true},
+      {"c", "config", true},
+      {"C", "concurrency", true},
+      {"D", "distribution", true},
+      {"W", "wal", true},
+      {"K", "containers", true},
+      {"R", "repository", true},
+      {"k", "keep", false},
+      {"r", "repetitions", true},
+      {"V", "version", false},
+      {"?", "help", false},
+   };
+
+   num_options = sizeof(options) / sizeof(options[0]);
+   cli_result results[BENCH_MAX_VALUES];
+
+   num_results = cmd_parse(argc, argv, options, num_options, results, BENCH_MAX_VALUES, false, &filename, &optind);
+
+   if (num_results < 0)
+   {
+      errx(1, "Error parsing command line\n");
+      return 1;
+   }
+
+   shmem_size = sizeof(struct main_configuration);
+   if (pgmoneta_create_shared_memory(shmem_size, HUGEPAGE_OFF, &shmem))
+   {
+      errx(1, "Error creating shared memory");
+   }
+
+   pgmoneta_init_main_configuration(shmem);
+   config = (struct main_configuration*)shmem;
+   config->common.log_type = PGMONETA_LOGGING_TYPE_CONSOLE;
+   config->common.log_level = PGMONETA_LOGGING_LEVEL_FATAL;
+
+   memset(&corpora, 0, sizeof(corpora));
+
+   for (int i = 0; i < num_results; i++)
+   {
+      char* optname = results[i].option_name;
+      char* optarg = results[i].argument;
+
+      if (optname == NULL)
+      {
+         break;
+      }
+      else if (!strcmp(optname, "a") || !strcmp(optname, "algorithms"))
+      {
+         selected = optarg;
+      }
+      else if (!strcmp(optname, "l") || !strcmp(optname, "levels"))
+      {
+         number_of_levels = bench_parse_list(optarg, levels, BENCH_MAX_VALUES);
+      }
+      else if (!strcmp(optname, "w") || !strcmp(optname, "workers"))
+      {
+         number_of_workers = bench_parse_list(optarg, workers, BENCH_MAX_VALUES);
+      }
+      else if (!strcmp(optname, "s") || !strcmp(optname, "size"))
+      {
+         size = atoi(optarg);
+      }
+      else if (!strcmp(optname, "f") || !strcmp(optname, "file"))
+      {
+         if (number_of_corpora >= BENCH_MAX_CORPORA - 4)
+         {
+            errx(1, "Too many files");
+         }
+
+         if (bench_capture(optarg, &corpora[number_of_corpora]))
+         {
+            errx(1, "Could not use %s", optarg);
+         }
+
+         number_of_corpora++;
+      }
+      else if (!strcmp(optname, "d") || !strcmp(optname, "directory"))
+      {
+         directory = optarg;
+      }
+      else if (!strcmp(optname, "F") || !strcmp(optname, "format"))
+      {
+         if (!strcmp(optarg, "csv"))
+         {
+            format = BENCH_FORMAT_CSV;
+         }
+         else if (!strcmp(optarg, "json"))
+         {
+            format = BENCH_FORMAT_JSON;
+         }
+         else
+         {
+            format = BENCH_FORMAT_TEXT;
+         }
+      }
+      else if (!strcmp(optname, "m") || !strcmp(optname, "manifest"))
+      {
+         manifest = atoi(optarg);
+      }
+      else if (!strcmp(optname, "S") || !strcmp(optname, "storage"))
+      {
+         storage = optarg;
+      }
+      else if (!strcmp(optname, "c") || !strcmp(optname, "config"))
+      {
+         configuration = optarg;
+      }
+      else if (!strcmp(optname, "C") || !strcmp(optname, "concurrency"))
+      {
+         number_of_concurrency = bench_parse_list(optarg, concurrency, BENCH_MAX_VALUES);
+      }
+      else if (!strcmp(optname, "D") || !strcmp(optname, "distribution"))
+      {
+         distribution = optarg;
+      }
+      else if (!strcmp(optname, "W") || !strcmp(optname, "wal"))
+      {
+         if (number_of_wal >= BENCH_MAX_CORPORA)
+         {
+            errx(1, "Too many WAL paths");
+         }
+
+         wal[number_of_wal++] = optarg;
+      }
+      else if (!strcmp(optname, "K") || !strcmp(optname, "containers"))
+      {
+         number_of_containers = bench_parse_list(optarg, containers, BENCH_MAX_VALUES);
+         if (number_of_containers <= 0)
+         {
+            usage();
+            goto error;
+         }
+      }
+      else if (!strcmp(optname, "R") || !strcmp(optname, "repository"))
+      {
+         number_of_repositories = bench_parse_list(optarg, repositories, BENCH_MAX_VALUES);
+         if (number_of_repositories <= 0)
+         {
+            usage();
+            goto error;
+         }
+      }
+      else if (!strcmp(optname, "k") || !strcmp(optname, "keep"))
+      {
+         keep = true;
+      }
+      else if (!strcmp(optname, "r") || !strcmp(optname, "repetitions"))
+      {
+         repetitions = MIN(MAX(atoi(optarg), 1), BENCH_MAX_REPETITIONS);
+      }
+      else if (!strcmp(optname, "V") || !strcmp(optname, "version"))
+      {
+         version();
+      }
+      else if (!strcmp(optname, "?") || !strcmp(optname, "help"))
+      {
+         usage();
+         exit(0);
+      }
+   }
+
+   if (number_of_levels <= 0 || number_of_workers <= 0 || number_of_concurrency <= 0 || size <= 0)
+   {
+      usage();
+      goto error;
+   }
+
+   if (manifest > 0)
+   {
+      failed = bench_manifest(directory, manifest, format) != 0;
+
+      pgmoneta_destroy_shared_memory(shmem, shmem_size);
+
+      return failed ? 1 : 0;
+   }
+
+   if (storage != NULL)
+   {
+      failed = bench_storage(configuration, storage, concurrency, number_of_concurrency, distribution, format) != 0;
+
+      pgmoneta_destroy_shared_memory(shmem, shmem_size);
+
+      return failed ? 1 : 0;
+   }
+
+   if (number_of_wal > 0)
+   {
+      failed = bench_wal(&wal[0], number_of_wal, format) != 0;
+
+      pgmoneta_destroy_shared_memory(shmem, shmem_size);
+
+      return failed ? 1 : 0;
+   }
+
+   if (number_of_containers > 0)
+   {
+      failed = bench_containers(&containers[0], number_of_containers, repetitions, format) != 0;
+
+      pgmoneta_destroy_shared_memory(shmem, shmem_size);
+
+      return failed ? 1 : 0;
+   }
+
+   if (number_of_repositories > 0)
+   {
+      failed = bench_repository(directory, &repositories[0], number_of_repositories, repetitions, keep, format) != 0;
+
+      pgmoneta_destroy_shared_memory(shmem, shmem_size);
+
+      return failed ? 1 : 0;
+   }
+
+   if (bench_generate(directory, "heap", (size_t)size * 1024 * 1024, &corpora[number_of_corpora++]) ||
+       bench_generate(directory, "btree", (size_t)size * 1024 * 1024, &corpora[number_of_corpora++]) ||
+       bench_generate(directory, "wal", (size_t)size * 1024 * 1024, &corpora[number_of_corpora++]) ||
+       bench_generate(directory, "manifest", (size_t)size * 1024 * 1024, &corpora[number_of_corpora++]))
+   {
+      warnx("Could not generate the data sets in %s", directory);
+      goto error;
+   }
+
+   if (format == BENCH_FORMAT_CSV)
+   {
+      printf("data,algorithm,api,level,workers,size,compress_mbs,decompress_mbs,ratio,memory_kb\n");
+   }
+   else if (format == BENCH_FORMAT_TEXT)
+   {
+      printf("%-12s %-6s %-6s %5s %7s %10s %14s %16s %8s %12s\n", "Data", "Algo", "API", "Level", "Workers",
+             "Size (MB)", "Compress MB/s", "Decompress MB/s", "Ratio", "Memory (KB)");
+   }
+
+   for (int c = 0; c < number_of_corpora; c++)
+   {
+      for (size_t a = 0; a < sizeof(algorithms) / sizeof(algorithms[0]); a++)
+      {
+         struct bench_algorithm* algorithm = &algorithms[a];
+
+         if (selected != NULL && strstr(selected, algorithm->name) == NULL)
+         {
+            continue;
+         }
+
+         previous = -1;
+
+         for (int l = 0; l < number_of_levels; l++)
+         {
+            level = algorithm->max_level == 0 ? 0 : MIN(MAX(levels[l], 1), algorithm->max_level);
+
+            /* Levels above the maximum of the algorithm would repeat the same run */
+            if (level == previous)
+            {
+               continue;
+            }
+            previous = level;
+
+            for (int w = 0; w < (algorithm->workers ? number_of_workers : 1); w++)
+            {
+               int ws = algorithm->workers ? workers[w] : -1;
+
+               if (bench_run(&corpora[c], algorithm, level, ws, false, directory, &result, &memory))
+               {
+                  failed = true;
+               }
+               bench_report(format, &corpora[c], algorithm, "file", level, ws, &result, memory);
+
+               if (corpora[c].text && w == 0)
+               {
+                  if (bench_run(&corpora[c], algorithm, level, ws, true, directory, &result, &memory))
+                  {
+                     failed = true;
+                  }
+                  bench_report(format, &corpora[c], algorithm, "string", level, ws, &result, memory);
+               }
+            }
+         }
+      }
+   }
+
+   for (int c = 0; c < number_of_corpora; c++)
+   {
+      if (corpora[c].generated)
+      {
+         pgmoneta_delete_file(corpora[c].path, NULL);
+      }
+   }
+
+   pgmoneta_destroy_shared_memory(shmem, shmem_size);
+
+   return failed ? 1 : 0;
+
+error:
+
+   for (int c = 0; c < number_of_corpora; c++)
+   {
+      if (corpora[c].generated && pgmoneta_exists(corpora[c].path))
+      {
+         pgmoneta_delete_file(corpora[c].path, NULL);
+      }
+   }
+
+   pgmoneta_destroy_shared_memory(shmem, shmem_size);
+
+   return 1;
+}
+
+static uint64_t
+bench_random(void)
+{
+   seed ^= seed << 13;
+   seed ^= seed >> 7;
+   seed ^= seed << 17;
+
+   return seed;
+}
+
+static size_t
+bench_text(char* buffer, size_t size)
+{
+   size_t length = 0;
+   int count = 1 + bench_random() % 5;
+
+   for (int i = 0; i < count; i++)
+   {
+      char* word = words[bench_random() % (sizeof(words) / sizeof(words[0]))];
+      size_t l = strlen(word);
+
+      if (length + l + 1 > size)
+      {
+         break;
+      }
+
+      if (length > 0)
+      {
+         buffer[length++] = ' ';
+      }
+      memcpy(buffer + length, word, l);
+      length += l;
+   }
+
+   return length;
+}
+
+static void
+bench_put16(unsigned char* p, uint16_t v)
+{
+   memcpy(p, &v, sizeof(v));
+}
+
+static void
+bench_put32(unsigned char* p, uint32_t v)
+{
+   memcpy(p, &v, sizeof(v));
+}
+
+static void
+bench_put64(unsigned char* p, uint64_t v)
+{
+   memcpy(p, &v, sizeof(v));
+}
+
+static void
+bench_heap_page(unsigned char* page, uint32_t block, uint32_t* id)
+{
+   uint16_t lower = 24;
+   uint16_t upper = BENCH_PAGE_SIZE;
+   uint16_t offset = 1;
+
+   memset(page, 0, BENCH_PAGE_SIZE);
+
+   for (;;)
+   {
+      char text[64];
+      size_t text_length;
+      uint16_t length;
+      uint16_t aligned;
+      unsigned char* tuple;
+
+      text_length = bench_text(&text[0], sizeof(text));
+      length = 24 + 4 + 4 + 1 + text_length;
+      aligned = (length + 7) & ~7;
+
+      if (lower + 4 > upper - aligned)
+      {
+         break;
+      }
+
+      upper -= aligned;
+      tuple = page + upper;
+
+      /* HeapTupleHeaderData followed by (int4, int4, text) */
+      bench_put32(tuple, 1000 + *id / 128);
+      bench_put32(tuple + 4, 0);
+      bench_put32(tuple + 8, 0);
+      bench_put16(tuple + 12, block >> 16);
+      bench_put16(tuple + 14, block & 0xFFFF);
+      bench_put16(tuple + 16, offset);
+      bench_put16(tuple + 18, 3);
+      bench_put16(tuple + 20, 0x0902);
+      tuple[22] = 24;
+      bench_put32(tuple + 24, (*id)++);
+      bench_put32(tuple + 28, bench_random() % 1000);
+      tuple[32] = ((text_length + 1) << 1) | 1;
+      memcpy(tuple + 33, &text[0], text_length);
+
+      /* ItemIdData: lp_off, lp_flags = LP_NORMAL, lp_len */
+      bench_put32(page + lower, upper | (1 << 15) | ((uint32_t)length << 17));
+      lower += 4;
+      offset++;
+   }
+
+   /* PageHeaderData */
+   bench_put64(page, ((uint64_t)block << 13) | (bench_random() & 0x1FFF));
+   bench_put16(page + 8, bench_random() & 0xFFFF);
+   bench_put16(page + 12, lower);
+   bench_put16(page + 14, upper);
+   bench_put16(page + 16, BENCH_PAGE_SIZE);
+   bench_put16(page + 18, BENCH_PAGE_SIZE | 4);
+}
+
+static void
+bench_btree_page(unsigned char* page, uint32_t block, uint64_t* key)
+{
+   uint16_t lower = 24;
+   uint16_t upper = BENCH_PAGE_SIZE - 16;
+   unsigned char* special = page + upper;
+
+   memset(page, 0, BENCH_PAGE_SIZE);
+
+   while (lower + 4 <= upper - 16)
+   {
+      unsigned char* tuple;
+      uint32_t heap_block = *key / 60;
+
+      upper -= 16;
+      tuple = page + upper;
+
+      /* IndexTupleData followed by an int8 key */
+      bench_put16(tuple, heap_block >> 16);
+      bench_put16(tuple + 2, heap_block & 0xFFFF);
+      bench_put16(tuple + 4, 1 + *key % 60);
+      bench_put16(tuple + 6, 16);
+      bench_put64(tuple + 8, *key);
+
+      bench_put32(page + lower, upper | (1 << 15) | ((uint32_t)16 << 17));
+      lower += 4;
+
+      *key += 1 + bench_random() % 3;
+   }
+
+   /* BTPageOpaqueData of a leaf page */
+   bench_put32(special, block > 1 ? block - 1 : 0);
+   bench_put32(special + 4, block + 1);
+   bench_put32(special + 8, 0);
+   bench_put16(special + 12, 1);
+
+   bench_put64(page, ((uint64_t)block << 13) | (bench_random() & 0x1FFF));
+   bench_put16(page + 8, bench_random() & 0xFFFF);
+   bench_put16(page + 12, lower);
+   bench_put16(page + 14, upper);
+   bench_put16(page + 16, BENCH_PAGE_SIZE - 16);
+   bench_put16(page + 18, BENCH_PAGE_SIZE | 4);
+}
+
+static void
+bench_wal_segment(unsigned char* segment, uint64_t segno)
+{
+   size_t position = 0;
+   uint64_t previous = 0;
+   uint32_t xid = 1000 + segno * 4096;
+
+   memset(segment, 0, BENCH_SEGMENT_SIZE);
+
+   while (position < BENCH_SEGMENT_SIZE)
+   {
+      unsigned char record[256];
+      char text[64];
+      size_t text_length;
+      uint32_t length;
+
+      if (position % BENCH_PAGE_SIZE == 0)
+      {
+         /* XLogPageHeaderData, and XLogLongPageHeaderData on the first page */
+         bench_put16(segment + position, 0xD116);
+         bench_put16(segment + position + 2, position == 0 ? 0x0002 : 0x0001);
+         bench_put32(segment + position + 4, 1);
+         bench_put64(segment + position + 8, segno * BENCH_SEGMENT_SIZE + position);
+         if (position == 0)
+         {
+            bench_put64(segment + 24, 0x7000000000000000ULL | segno);
+            bench_put32(segment + 32, BENCH_SEGMENT_SIZE);
+            bench_put32(segment + 36, BENCH_PAGE_SIZE);
+            position += 40;
+         }
+         else
+         {
+            position += 24;
+         }
+      }
+
+      /* XLogRecord, a block reference and a heap tuple as main data */
+      memset(&record[0], 0, sizeof(record));
+      text_length = bench_text(&text[0], sizeof(text));
+      length = 24 + 20 + 24 + 8 + text_length;
+
+      bench_put32(&record[0], length);
+      bench_put32(&record[4], xid);
+      bench_put64(&record[8], previous);
+      record[16] = 0x00;
+      record[17] = 10;
+      bench_put32(&record[20], bench_random() & 0xFFFFFFFF);
+      record[24] = 0;
+      record[25] = 0x20;
+      bench_put16(&record[26], 24 + 8 + text_length);
+      bench_put32(&record[28], 1663);
+      bench_put32(&record[32], 5);
+      bench_put32(&record[36], 16384 + xid % 8);
+      bench_put32(&record[40], xid / 32);
+      bench_put32(&record[44], xid);
+      bench_put32(&record[68], xid);
+      bench_put32(&record[72], bench_random() % 1000);
+      memcpy(&record[76], &text[0], text_length);
+
+      previous = segno * BENCH_SEGMENT_SIZE + position;
+
+      for (uint32_t i = 0; i < length && position < BENCH_SEGMENT_SIZE; i++)
+      {
+         if (position % BENCH_PAGE_SIZE == 0)
+         {
+            /* Continuation page header */
+            bench_put16(segment + position, 0xD116);
+            bench_put16(segment + position + 2, 0x0003);
+            bench_put32(segment + position + 4, 1);
+            bench_put64(segment + position + 8, segno * BENCH_SEGMENT_SIZE + position);
+            bench_put32(segment + position + 16, length - i);
+            position += 24;
+         }
+
+         segment[position++] = record[i];
+      }
+
+      /* Records are MAXALIGN'ed */
+      position = (position + 7) & ~(size_t)7;
+      xid++;
+   }
+}
+
+static int
+bench_generate(char* directory, char* name, size_t size, struct bench_corpus* corpus)
+{
+   FILE* file = NULL;
+   unsigned char* buffer = NULL;
+   size_t buffer_size;
+   size_t written = 0;
+   uint32_t block = 0;
+   uint32_t id = 1;
+   uint64_t key = 1;
+
+   memset(corpus, 0, sizeof(struct bench_corpus));
+   snprintf(&corpus->name[0], sizeof(corpus->name), "%s", name);
+   snprintf(&corpus->path[0], sizeof(corpus->path), "%s/pgmoneta-bench-%d-%s", directory, (int)getpid(), name);
+   corpus->text = !strcmp(name, "manifest");
+   corpus->generated = true;
+
+   buffer_size = !strcmp(name, "wal") ? BENCH_SEGMENT_SIZE : BENCH_PAGE_SIZE;
+   buffer = (unsigned char*)malloc(buffer_size);
+   if (buffer == NULL)
+   {
+      goto error;
+   }
+
+   file = fopen(&corpus->path[0], "w");
+   if (file == NULL)
+   {
+      goto error;
+   }
+
+   while (written < size)
+   {
+      size_t length = buffer_size;
+
+      if (!strcmp(name, "heap"))
+      {
+         bench_heap_page(buffer, block, &id);
+      }
+      else if (!strcmp(name, "btree"))
+      {
+         bench_btree_page(buffer, block, &key);
+      }
+      else if (!strcmp(name, "wal"))
+      {
+         bench_wal_segment(buffer, block);
+      }
+      else
+      {
+         char text[64];
+
+         memset(&text[0], 0, sizeof(text));
+         bench_text(&text[0], sizeof(text) - 1);
+         length = snprintf((char*)buffer, buffer_size,
+                           "    { \"Path\": \"base/5/%u\", \"Size\": %u, \"Last-Modified\": \"2025-01-01 00:00:%02u GMT\", \"Checksum-Algorithm\": \"CRC32C\", \"Checksum\": \"%08x\", \"Comment\": \"%s\" },\n",
+                           16384 + block, (uint32_t)(bench_random() % 1073741824), block % 60, (uint32_t)bench_random(), &text[0]);
+      }
+
+      if (fwrite(buffer, 1, length, file) != length)
+      {
+         goto error;
+      }
+
+      written += length;
+      block++;
+   }
+
+   fclose(file);
+   free(buffer);
+
+   corpus->size = written;
+
+   return 0;
+
+error:
+
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+
+   free(buffer);
+
+   return 1;
+}
+
+static int
+bench_capture(char* path, struct bench_corpus* corpus)
+{
+   char* name = NULL;
+
+   memset(corpus, 0, sizeof(struct bench_corpus));
+
+   if (!pgmoneta_exists(path))
+   {
+      return 1;
+   }
+
+   name = strrchr(path, '/');
+   name = name != NULL ? name + 1 : path;
+
+   snprintf(&corpus->name[0], sizeof(corpus->name), "%s", name);
+   snprintf(&corpus->path[0], sizeof(corpus->path), "%s", path);
+   corpus->size = pgmoneta_get_file_size(path);
+   corpus->text = false;
+   corpus->generated = false;
+
+   return corpus->size > 0 ? 0 : 1;
+}
+
+static int
+bench_file(struct bench_corpus* corpus, struct bench_algorithm* algorithm, char* directory, struct bench_result* result)
+{
+   char from[MAX_PATH];
+   char to[MAX_PATH];
+   double start;
+
+   snprintf(&from[0], sizeof(from), "%s/pgmoneta-bench-%d", directory, (int)getpid());
+   snprintf(&to[0], sizeof(to), "%s%s", &from[0], algorithm->suffix);
+
+   /* The file functions remove their input */
+   if (pgmoneta_copy_file(&corpus->path[0], &from[0], NULL))
+   {
+      goto error;
+   }
+
+   start = bench_now();
+   if (algorithm->compress_file(&from[0], &to[0]))
+   {
+      goto error;
+   }
+   result->compress_seconds = bench_now() - start;
+   result->compressed_size = pgmoneta_get_file_size(&to[0]);
+
+   start = bench_now();
+   if (algorithm->decompress_file(&to[0], &from[0]))
+   {
+      goto error;
+   }
+   result->decompress_seconds = bench_now() - start;
+
+   if (pgmoneta_get_file_size(&from[0]) != corpus->size)
+   {
+      goto error;
+   }
+
+   pgmoneta_delete_file(&from[0], NULL);
+
+   return 0;
+
+error:
+
+   if (pgmoneta_exists(&from[0]))
+   {
+      pgmoneta_delete_file(&from[0], NULL);
+   }
+   if (pgmoneta_exists(&to[0]))
+   {
+      pgmoneta_delete_file(&to[0], NULL);
+   }
+
+   return 1;
+}
+
+static int
+bench_string(struct bench_corpus* corpus, struct bench_algorithm* algorithm, struct bench_result* result)
+{
+   FILE* file = NULL;
+   char* s = NULL;
+   char* output = NULL;
+   unsigned char* compressed = NULL;
+   size_t compressed_size = 0;
+   double start;
+
+   s = (char*)malloc(corpus->size + 1);
+   if (s == NULL)
+   {
+      goto error;
+   }
+
+   file = fopen(&corpus->path[0], "r");
+   if (file == NULL || fread(s, 1, corpus->size, file) != corpus->size)
+   {
+      goto error;
+   }
+   s[corpus->size] = '\0';
+
+   start = bench_now();
+   if (algorithm->compress_string(s, &compressed, &compressed_size))
+   {
+      goto error;
+   }
+   result->compress_seconds = bench_now() - start;
+   result->compressed_size = compressed_size;
+
+   start = bench_now();
+   if (algorithm->decompress_string(compressed, compressed_size, &output))
+   {
+      goto error;
+   }
+   result->decompress_seconds = bench_now() - start;
+
+   if (output == NULL || strcmp(s, output))
+   {
+      goto error;
+   }
+
+   fclose(file);
+   free(s);
+   free(compressed);
+   free(output);
+
+   return 0;
+
+error:
+
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+
+   free(s);
+   free(compressed);
+   free(output);
+
+   return 1;
+}
+
+static int
+bench_run(struct bench_corpus* corpus, struct bench_algorithm* algorithm, int level, int workers, bool string,
+          char* directory, struct bench_result* result, long* memory)
+{
+   int fds[2];
+   int status;
+   pid_t pid;
+   struct rusage usage;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   memset(result, 0, sizeof(struct bench_result));
+   *memory = 0;
+
+   if (pipe(fds))
+   {
+      return 1;
+   }
+
+   /* Run in a child, so the peak memory belongs to this run only */
+   pid = fork();
+   if (pid == -1)
+   {
+      close(fds[0]);
+      close(fds[1]);
+      return 1;
+   }
+   else if (pid == 0)
+   {
+      close(fds[0]);
+
+      config->compression_level = level > 0 ? level : 1;
+      config->workers = workers > 0 ? workers : 0;
+
+      if (string)
+      {
+         result->success = bench_string(corpus, algorithm, result) == 0;
+      }
+      else
+      {
+         result->success = bench_file(corpus, algorithm, directory, result) == 0;
+      }
+
+      if (write(fds[1], result, sizeof(struct bench_result)) != sizeof(struct bench_result))
+      {
+         _exit(1);
+      }
+
+      close(fds[1]);
+      _exit(0);
+   }
+
+   close(fds[1]);
+
+   if (read(fds[0], result, sizeof(struct bench_result)) != sizeof(struct bench_result))
+   {
+      result->success = false;
+   }
+
+   close(fds[0]);
+
+   if (wait4(pid, &status, 0, &usage) == pid)
+   {
+      *memory = usage.ru_maxrss;
+   }
+
+   return result->success ? 0 : 1;
+}
+
+static void
+bench_report(int format, struct bench_corpus* corpus, struct bench_algorithm* algorithm, char* api, int level,
+             int workers, struct bench_result* result, long memory)
+{
+   double mb = corpus->size / (1024.0 * 1024.0);
+   double compress = result->compress_seconds > 0 ? mb / result->compress_seconds : 0;
+   double decompress = result->decompress_seconds > 0 ? mb / result->decompress_seconds : 0;
+   double ratio = result->compressed_size > 0 ? (double)corpus->size / result->compressed_size : 0;
+   char l[16];
+   char w[16];
+   char name[MAX_PATH];
+
+   snprintf(&l[0], sizeof(l), level > 0 ? "%d" : "-", level);
+   snprintf(&w[0], sizeof(w), workers >= 0 ? "%d" : "-", workers);
+
+   if (!result->success)
+   {
+      if (format == BENCH_FORMAT_CSV)
+      {
+         printf("%s,%s,%s,%s,%s,%.2f,failed,failed,failed,%ld\n", &corpus->name[0], algorithm->name, api, &l[0], &w[0], mb, memory);
+      }
+      else if (format == BENCH_FORMAT_TEXT)
+      {
+         printf("%-12s %-6s %-6s %5s %7s %10.2f %14s %16s %8s %12ld\n", &corpus->name[0], algorithm->name, api, &l[0], &w[0],
+                mb, "failed", "failed", "failed", memory);
+      }
+      return;
+   }
+
+   if (format == BENCH_FORMAT_CSV)
+   {
+      printf("%s,%s,%s,%s,%s,%.2f,%.2f,%.2f,%.3f,%ld\n", &corpus->name[0], algorithm->name, api, &l[0], &w[0],
+             mb, compress, decompress, ratio, memory);
+   }
+   else if (format == BENCH_FORMAT_JSON)
+   {
+      snprintf(&name[0], sizeof(name), "%s/%s/%s/level=%s/workers=%s/size=%.0f", &corpus->name[0], algorithm->name, api,
+               &l[0], &w[0], mb);
+
+      bench_json("compression", &name[0], "compress", "MB/s", true, compress, 1, 0, NULL, NULL, 0);
+      bench_json("compression", &name[0], "decompress", "MB/s", true, decompress, 1, 0, NULL, NULL, 0);
+      bench_json("compression", &name[0], "ratio", "x", true, ratio, 1, 0, NULL, NULL, 0);
+      bench_json("compression", &name[0], "memory", "kB", false, memory, 1, 0, NULL, NULL, 0);
+   }
+   else
+   {
+      printf("%-12s %-6s %-6s %5s %7s %10.2f %14.2f %16.2f %8.3f %12ld\n", &corpus->name[0], algorithm->name, api, &l[0], &w[0],
+             mb, compress, decompress, ratio, memory);
+   }
+
+   fflush(stdout);
+}
+
+static int
+bench_manifest(char* directory, int files, int format)
+{
+   char old_manifest[MAX_PATH];
+   char new_manifest[MAX_PATH];
+   char name[MISC_LENGTH];
+   FILE* o = NULL;
+   FILE* n = NULL;
+   int* order = NULL;
+   double start;
+   double sorted;
+   double diffed;
+   double compared;
+   long diff_memory;
+   struct manifest_diff* diff = NULL;
+   struct art* deleted = NULL;
+   struct art* changed = NULL;
+   struct art* added = NULL;
+   struct rusage usage;
+
+   memset(&old_manifest[0], 0, sizeof(old_manifest));
+   memset(&new_manifest[0], 0, sizeof(new_manifest));
+   snprintf(&old_manifest[0], sizeof(old_manifest), "%s/pgmoneta-bench-old.manifest", directory);
+   snprintf(&new_manifest[0], sizeof(new_manifest), "%s/pgmoneta-bench-new.manifest", directory);
+
+   order = (int*)malloc(files * sizeof(int));
+   if (order == NULL)
+   {
+      goto error;
+   }
+
+   /* The server lists the files in directory order, so shuffle them */
+   for (int i = 0; i < files; i++)
+   {
+      order[i] = i;
+   }
+   for (int i = files - 1; i > 0; i--)
+   {
+      int j = bench_random() % (i + 1);
+      int t = order[i];
+
+      order[i] = order[j];
+      order[j] = t;
+   }
+
+   o = fopen(&old_manifest[0], "w");
+   n = fopen(&new_manifest[0], "w");
+   if (o == NULL || n == NULL)
+   {
+      goto error;
+   }
+
+   /* 1% of the files are added, deleted and changed each */
+   for (int i = 0; i < files; i++)
+   {
+      int f = order[i];
+      int m = f % 100;
+
+      if (m != 0)
+      {
+         fprintf(o, "base/%d/%d,%016x%016x\n", 16384 + f % 8, f, f, f);
+      }
+
+      if (m == 1)
+      {
+         continue;
+      }
+
+      fprintf(n, "base/%d/%d,%016x%016x\n", 16384 + f % 8, f, f, m == 2 ? f + 1 : f);
+   }
+
+   fclose(o);
+   o = NULL;
+   fclose(n);
+   n = NULL;
+
+   start = bench_now();
+
+   if (pgmoneta_manifest_sort(&old_manifest[0]) || pgmoneta_manifest_sort(&new_manifest[0]))
+   {
+      goto error;
+   }
+
+   sorted = bench_now();
+
+   /* The difference spilled to disk runs first, so the peak memory is its own */
+   if (pgmoneta_manifest_diff(directory, &old_manifest[0], &new_manifest[0], &diff))
+   {
+      goto error;
+   }
+
+   diffed = bench_now();
+
+   getrusage(RUSAGE_SELF, &usage);
+   diff_memory = usage.ru_maxrss;
+
+   if (pgmoneta_compare_manifests(&old_manifest[0], &new_manifest[0], &deleted, &changed, &added))
+   {
+      goto error;
+   }
+
+   compared = bench_now();
+
+   getrusage(RUSAGE_SELF, &usage);
+
+   if (format == BENCH_FORMAT_CSV)
+   {
+      printf("files,sort_seconds,diff_seconds,diff_memory_kb,compare_seconds,deleted,changed,added,memory_kb\n");
+      printf("%d,%.3f,%.3f,%ld,%.3f,%lu,%lu,%lu,%ld\n", files, sorted - start, diffed - sorted, diff_memory, compared - diffed,
+             (unsigned long)deleted->size, (unsigned long)changed->size, (unsigned long)added->size, usage.ru_maxrss);
+   }
+   else if (format == BENCH_FORMAT_JSON)
+   {
+      snprintf(&name[0], sizeof(name), "files=%d", files);
+
+      bench_json("manifest", &name[0], "sort", "s", false, sorted - start, 1, 0, NULL, NULL, 0);
+      bench_json("manifest", &name[0], "diff", "s", false, diffed - sorted, 1, 0, NULL, NULL, 0);
+      bench_json("manifest", &name[0], "diff_memory", "kB", false, diff_memory, 1, 0, NULL, NULL, 0);
+      bench_json("manifest", &name[0], "compare", "s", false, compared - diffed, 1, 0, NULL, NULL, 0);
+      bench_json("manifest", &name[0], "memory", "kB", false, usage.ru_maxrss, 1, 0, NULL, NULL, 0);
+   }
+   else
+   {
+      printf("%10s %12s %12s %12s %12s %8s %8s %8s %12s\n", "Files", "Sort (s)", "Diff (s)", "Diff (KB)", "Compare (s)",
+             "Deleted", "Changed", "Added", "Memory (KB)");
+      printf("%10d %12.3f %12.3f %12ld %12.3f %8lu %8lu %8lu %12ld\n", files, sorted - start, diffed - sorted, diff_memory,
+             compared - diffed, (unsigned long)deleted->size, (unsigned long)changed->size, (unsigned long)added->size,
+             usage.ru_maxrss);
+   }
+
+   pgmoneta_manifest_diff_destroy(diff);
+   pgmoneta_art_destroy(deleted);
+   pgmoneta_art_destroy(changed);
+   pgmoneta_art_destroy(added);
+   free(order);
+
+   unlink(&old_manifest[0]);
+   unlink(&new_manifest[0]);
+
+   return 0;
+
+error:
+
+   warnx("Could not benchmark the manifest comparison in %s", directory);
+
+   if (o != NULL)
+   {
+      fclose(o);
+   }
+   if (n != NULL)
+   {
+      fclose(n);
+   }
+
+   pgmoneta_manifest_diff_destroy(diff);
+   pgmoneta_art_destroy(deleted);
+   pgmoneta_art_destroy(changed);
+   pgmoneta_art_destroy(added);
+   free(order);
+
+   unlink(&old_manifest[0]);
+   unlink(&new_manifest[0]);
+
+   return 1;
+}
+
+static int
+bench_storage(char* configuration, char* engines, int* concurrency, int number_of_concurrency,
+              char* distribution, int format)
+{
+   char* copy = NULL;
+   char* engine = NULL;
+   char* saveptr = NULL;
+   char* sep = NULL;
+   char label[MISC_LENGTH];
+   char name[MISC_LENGTH];
+   int sizes[BENCH_MAX_VALUES];
+   int counts[BENCH_MAX_VALUES];
+   int latency_ranks[3] = {50, 95, 99};
+   int number_of_sizes = 0;
+   int number_of_runs = 0;
+   bool failed = false;
+   struct bench_storage_run run;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   if (configuration == NULL || pgmoneta_read_main_configuration(shmem, configuration))
+   {
+      warnx("The storage benchmark needs a configuration with -c");
+      return 1;
+   }
+
+   if (config->common.number_of_servers < 1)
+   {
+      warnx("No server in %s", configuration);
+      return 1;
+   }
+
+   config->common.log_type = PGMONETA_LOGGING_TYPE_CONSOLE;
+   config->common.log_level = PGMONETA_LOGGING_LEVEL_FATAL;
+
+   copy = strdup(distribution);
+   for (char* t = strtok_r(copy, ",", &saveptr); t != NULL && number_of_sizes < BENCH_MAX_VALUES; t = strtok_r(NULL, ",", &saveptr))
+   {
+      sep = strchr(t, ':');
+      sizes[number_of_sizes] = atoi(t);
+      counts[number_of_sizes] = sep != NULL ? atoi(sep + 1) : 1;
+      if (sizes[number_of_sizes] < 0 || counts[number_of_sizes] <= 0)
+      {
+         warnx("Invalid distribution %s", distribution);
+         free(copy);
+         return 1;
+      }
+      number_of_sizes++;
+   }
+   free(copy);
+   copy = NULL;
+
+   if (format == BENCH_FORMAT_CSV)
+   {
+      printf("engine,concurrency,files,size_mb,seconds,files_per_second,mbs,cpu_seconds_per_mb,requests,p50_ms,p95_ms,p99_ms\n");
+   }
+   else if (format == BENCH_FORMAT_TEXT)
+   {
+      printf("%-6s %11s %8s %10s %10s %10s %10s %12s %9s %9s %9s %9s\n", "Engine", "Concurrency", "Files", "Size (MB)",
+             "Time (s)", "Files/s", "MB/s", "CPU s/MB", "Requests", "p50 (ms)", "p95 (ms)", "p99 (ms)");
+   }
+
+   copy = strdup(engines);
+   saveptr = NULL;
+   for (engine = strtok_r(copy, ",", &saveptr); engine != NULL; engine = strtok_r(NULL, ",", &saveptr))
+   {
+      for (int c = 0; c < number_of_concurrency; c++)
+      {
+         double mb;
+
+         config->upload_concurrency = MAX(concurrency[c], 1);
+         config->workers = MAX(concurrency[c], 1);
+         config->common.servers[0].workers = -1;
+
+         /* A label of its own per run, so no run is the previous backup of another */
+         memset(&label[0], 0, sizeof(label));
+         snprintf(&label[0], sizeof(label), "%ld%04d", (long)time(NULL), number_of_runs++);
+
+         memset(&run, 0, sizeof(run));
+
+         if (bench_storage_tree(&label[0], &sizes[0], &counts[0], number_of_sizes, &run.files, &run.bytes))
+         {
+            warnx("Could not generate the backup %s", &label[0]);
+            failed = true;
+            continue;
+         }
+
+         if (bench_storage_run(engine, &label[0], &run))
+         {
+            warnx("Could not run the %s storage engine", engine);
+            failed = true;
+         }
+
+         mb = run.bytes / (1024.0 * 1024.0);
+
+         if (format == BENCH_FORMAT_CSV)
+         {
+            printf("%s,%d,%d,%.1f,%.3f,%.1f,%.1f,%.4f,%d,%.1f,%.1f,%.1f\n", engine, concurrency[c], run.files, mb,
+                   run.seconds, run.seconds > 0 ? run.files / run.seconds : 0, run.seconds > 0 ? mb / run.seconds : 0,
+                   mb > 0 ? run.cpu_seconds / mb : 0, run.requests, run.latencies[0], run.latencies[1], run.latencies[2]);
+         }
+         else if (format == BENCH_FORMAT_JSON)
+         {
+            if (run.success)
+            {
+               snprintf(&name[0], sizeof(name), "%s/concurrency=%d", engine, concurrency[c]);
+
+               bench_json("storage", &name[0], "time", "s", false, run.seconds, 1, 0, NULL, NULL, 0);
+               bench_json("storage", &name[0], "throughput", "MB/s", true, run.seconds > 0 ? mb / run.seconds : 0, 1, 0,
+                          NULL, NULL, 0);
+               bench_json("storage", &name[0], "files", "files/s", true, run.seconds > 0 ? run.files / run.seconds : 0,
+                          1, 0, NULL, NULL, 0);
+               bench_json("storage", &name[0], "cpu", "s/MB", false, mb > 0 ? run.cpu_seconds / mb : 0, 1, 0,
+                          NULL, NULL, 0);
+               if (run.requests > 0)
+               {
+                  bench_json("storage", &name[0], "request", "ms", false, run.latencies[0], run.requests, 0,
+                             &latency_ranks[0], &run.latencies[0], 3);
+               }
+            }
+         }
+         else
+         {
+            printf("%-6s %11d %8d %10.1f %10.3f %10.1f %10.1f %12.4f %9d %9.1f %9.1f %9.1f%s\n", engine, concurrency[c],
+                   run.files, mb, run.seconds, run.seconds > 0 ? run.files / run.seconds : 0,
+                   run.seconds > 0 ? mb / run.seconds : 0, mb > 0 ? run.cpu_seconds / mb : 0, run.requests,
+                   run.latencies[0], run.latencies[1], run.latencies[2], run.success ? "" : " (failed)");
+         }
+      }
+   }
+
+   free(copy);
+
+   return failed ? 1 : 0;
+}
+
+static int
+bench_storage_tree(char* label, int* sizes, int* counts, int number_of_sizes, int* files, uint64_t* bytes)
+{
+   char* root = NULL;
+   char* data = NULL;
+   char path[MAX_PATH];
+   unsigned char* buffer = NULL;
+   size_t length = 1024 * 1024;
+   int file = 0;
+   FILE* f = NULL;
+
+   *files = 0;
+   *bytes = 0;
+
+   root = pgmoneta_get_server_backup_identifier(0, label);
+   data = pgmoneta_get_server_backup_identifier_data(0, label);
+
+   buffer = (unsigned char*)malloc(length);
+   if (buffer == NULL || pgmoneta_mkdir(data))
+   {
+      goto error;
+   }
+
+   /* A backup that is never valid, so it isn't used by pgmoneta */
+   pgmoneta_create_info(root, label, VALID_FALSE);
+
+   /* Random data, as the storage engines don't compress */
+   for (size_t i = 0; i < length / sizeof(uint64_t); i++)
+   {
+      ((uint64_t*)buffer)[i] = bench_random();
+   }
+
+   for (int s = 0; s < number_of_sizes; s++)
+   {
+      for (int c = 0; c < counts[s]; c++)
+      {
+         size_t remaining = (size_t)sizes[s] * 1024;
+
+         if (file % BENCH_FILES_PER_DIRECTORY == 0)
+         {
+            memset(&path[0], 0, sizeof(path));
+            snprintf(&path[0], sizeof(path), "%sbase/%d", data, 16384 + file / BENCH_FILES_PER_DIRECTORY);
+            if (pgmoneta_mkdir(&path[0]))
+            {
+               goto error;
+            }
+         }
+
+         memset(&path[0], 0, sizeof(path));
+         snprintf(&path[0], sizeof(path), "%sbase/%d/%d", data, 16384 + file / BENCH_FILES_PER_DIRECTORY, 16384 + file);
+
+         f = fopen(&path[0], "w");
+         if (f == NULL)
+         {
+            goto error;
+         }
+
+         while (remaining > 0)
+         {
+            size_t n = MIN(remaining, length);
+
+            if (fwrite(buffer, 1, n, f) != n)
+            {
+               goto error;
+            }
+            remaining -= n;
+         }
+
+         fclose(f);
+         f = NULL;
+
+         file++;
+         *bytes += (uint64_t)sizes[s] * 1024;
+      }
+   }
+
+   *files = file;
+
+   free(buffer);
+   free(root);
+   free(data);
+
+   return 0;
+
+error:
+
+   if (f != NULL)
+   {
+      fclose(f);
+   }
+
+   if (root != NULL)
+   {
+      pgmoneta_delete_directory(root);
+   }
+
+   free(buffer);
+   free(root);
+   free(data);
+
+   return 1;
+}
+
+static int
+bench_storage_run(char* engine, char* label, struct bench_storage_run* run)
+{
+   char* root = NULL;
+   uint64_t* latencies = NULL;
+   double start;
+   double cpu;
+   struct rusage usage;
+   struct workflow* wf = NULL;
+   struct art* nodes = NULL;
+
+   if (!strcmp(engine, "local"))
+   {
+      wf = pgmoneta_storage_create_local();
+   }
+   else if (!strcmp(engine, "ssh"))
+   {
+      wf = pgmoneta_storage_create_ssh(WORKFLOW_TYPE_BACKUP);
+   }
+   else if (!strcmp(engine, "s3"))
+   {
+      wf = pgmoneta_storage_create_s3();
+   }
+   else if (!strcmp(engine, "azure"))
+   {
+      wf = pgmoneta_storage_create_azure();
+   }
+
+   root = pgmoneta_get_server_backup_identifier(0, label);
+
+   if (wf == NULL || pgmoneta_art_create(&nodes))
+   {
+      goto error;
+   }
+
+   pgmoneta_art_insert(nodes, NODE_SERVER_ID, (uintptr_t)0, ValueInt32);
+   pgmoneta_art_insert(nodes, NODE_LABEL, (uintptr_t)label, ValueString);
+
+   if (wf->setup(wf->name(), nodes))
+   {
+      goto error;
+   }
+
+   pgmoneta_http_latency_record(true);
+
+   getrusage(RUSAGE_SELF, &usage);
+   cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+   start = bench_now();
+
+   run->success = wf->execute(wf->name(), nodes) == 0;
+
+   run->seconds = bench_now() - start;
+   getrusage(RUSAGE_SELF, &usage);
+   run->cpu_seconds = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6 - cpu;
+
+   pgmoneta_http_latency_record(false);
+
+   run->requests = pgmoneta_http_latencies(&latencies);
+   if (run->requests > 0)
+   {
+      qsort(latencies, run->requests, sizeof(uint64_t), bench_compare_latencies);
+      run->latencies[0] = latencies[(run->requests - 1) * 50 / 100] / 1000.0;
+      run->latencies[1] = latencies[(run->requests - 1) * 95 / 100] / 1000.0;
+      run->latencies[2] = latencies[(run->requests - 1) * 99 / 100] / 1000.0;
+   }
+
+   wf->teardown(wf->name(), nodes);
+
+   /* The uploaded files are left on the remote storage */
+   pgmoneta_delete_directory(root);
+
+   pgmoneta_art_destroy(nodes);
+   pgmoneta_workflow_destroy(wf);
+   free(root);
+
+   return run->success ? 0 : 1;
+
+error:
+
+   pgmoneta_http_latency_record(false);
+
+   if (root != NULL)
+   {
+      pgmoneta_delete_directory(root);
+   }
+
+   pgmoneta_art_destroy(nodes);
+   pgmoneta_workflow_destroy(wf);
+   free(root);
+
+   return 1;
+}
+
+static int
+bench_compare_latencies(const void* a, const void* b)
+{
+   uint64_t la = *(const uint64_t*)a;
+   uint64_t lb = *(const uint64_t*)b;
+
+   return la < lb ? -1 : la > lb ? 1 : 0;
+}
+
+static int
+bench_wal(char** paths, int number_of_paths, int format)
+{
+   char** segments = NULL;
+   int number_of_segments = 0;
+   long memory;
+   bool failed = false;
+   struct bench_wal_result all;
+   struct bench_wal_result result;
+
+   if (format == BENCH_FORMAT_CSV)
+   {
+      printf("path,version,rmgr,records,size,decode_records_s,decode_mbs,describe_records_s,encode_mbs,memory_kb\n");
+   }
+   else if (format == BENCH_FORMAT_TEXT)
+   {
+      printf("%-24s %7s %-12s %10s %10s %14s %10s %16s %10s %12s\n", "Path", "Version", "Rmgr", "Records", "Size (MB)",
+             "Decode rec/s", "Decode MB/s", "Describe rec/s", "Encode MB/s", "Memory (KB)");
+   }
+
+   for (int p = 0; p < number_of_paths; p++)
+   {
+      if (bench_wal_segments(paths[p], &number_of_segments, &segments))
+      {
+         warnx("Could not find WAL segments in %s", paths[p]);
+         failed = true;
+         continue;
+      }
+
+      /* The whole file parse keeps every record, and finds the resource managers in use */
+      if (bench_wal_run(segments, number_of_segments, -1, &all, &memory))
+      {
+         failed = true;
+      }
+      bench_wal_report(format, paths[p], "all", &all, memory);
+
+      /* Each resource manager runs in its own child, so the peak memory belongs to it */
+      for (int rmid = 0; all.success && rmid <= UINT8_MAX; rmid++)
+      {
+         if (all.rmgrs[rmid] == 0)
+         {
+            continue;
+         }
+
+         if (bench_wal_run(segments, number_of_segments, rmid, &result, &memory))
+         {
+            failed = true;
+         }
+         bench_wal_report(format, paths[p], pgmoneta_wal_rmgr_name((rmgr_id)rmid), &result, memory);
+      }
+
+      for (int i = 0; i < number_of_segments; i++)
+      {
+         free(segments[i]);
+      }
+      free(segments);
+      segments = NULL;
+      number_of_segments = 0;
+   }
+
+   return failed ? 1 : 0;
+}
+
+static int
+bench_wal_segments(char* path, int* number_of_segments, char*** segments)
+{
+   char** files = NULL;
+   int number_of_files = 0;
+   char** result = NULL;
+
+   *number_of_segments = 0;
+   *segments = NULL;
+
+   if (pgmoneta_is_file(path))
+   {
+      result = (char**)malloc(sizeof(char*));
+      if (result == NULL)
+      {
+         goto error;
+      }
+
+      result[0] = strdup(path);
+      if (result[0] == NULL)
+      {
+         goto error;
+      }
+
+      *number_of_segments = 1;
+      *segments = result;
+
+      return 0;
+   }
+
+   if (pgmoneta_get_wal_files(path, &number_of_files, &files) || number_of_files == 0)
+   {
+      goto error;
+   }
+
+   result = (char**)calloc(number_of_files, sizeof(char*));
+   if (result == NULL)
+   {
+      goto error;
+   }
+
+   for (int i = 0; i < number_of_files; i++)
+   {
+      result[i] = pgmoneta_append(NULL, path);
+      if (!pgmoneta_ends_with(path, "/"))
+      {
+         result[i] = pgmoneta_append(result[i], "/");
+      }
+      result[i] = pgmoneta_append(result[i], files[i]);
+   }
+
+   for (int i = 0; i < number_of_files; i++)
+   {
+      free(files[i]);
+   }
+   free(files);
+
+   *number_of_segments = number_of_files;
+   *segments = result;
+
+   return 0;
+
+error:
+
+   for (int i = 0; i < number_of_files; i++)
+   {
+      free(files[i]);
+   }
+   free(files);
+   free(result);
+
+   return 1;
+}
+
+static int
+bench_wal_run(char** segments, int number_of_segments, int rmid, struct bench_wal_result* result, long* memory)
+{
+   int fds[2];
+   int status;
+   pid_t pid;
+   struct rusage usage;
+
+   memset(result, 0, sizeof(struct bench_wal_result));
+   *memory = 0;
+
+   if (pipe(fds))
+   {
+      return 1;
+   }
+
+   /* Run in a child, so the peak memory belongs to this run only */
+   pid = fork();
+   if (pid == -1)
+   {
+      close(fds[0]);
+      close(fds[1]);
+      return 1;
+   }
+   else if (pid == 0)
+   {
+      close(fds[0]);
+
+      if (rmid < 0)
+      {
+         result->success = bench_wal_parse(segments, number_of_segments, result) == 0;
+      }
+      else
+      {
+         result->success = bench_wal_iterate(segments, number_of_segments, rmid, result) == 0;
+      }
+
+      if (write(fds[1], result, sizeof(struct bench_wal_result)) != sizeof(struct bench_wal_result))
+      {
+         _exit(1);
+      }
+
+      close(fds[1]);
+      _exit(0);
+   }
+
+   close(fds[1]);
+
+   if (read(fds[0], result, sizeof(struct bench_wal_result)) != sizeof(struct bench_wal_result))
+   {
+      result->success = false;
+   }
+
+   close(fds[0]);
+
+   if (wait4(pid, &status, 0, &usage) == pid)
+   {
+      *memory = usage.ru_maxrss;
+   }
+
+   return result->success ? 0 : 1;
+}
+
+static int
+bench_wal_parse(char** segments, int number_of_segments, struct bench_wal_result* result)
+{
+   struct main_configuration* config;
+   struct walfile* wf = NULL;
+   struct deque_iterator* iter = NULL;
+   double start;
+
+   config = (struct main_configuration*)shmem;
+
+   for (int i = 0; i < number_of_segments; i++)
+   {
+      start = bench_now();
+
+      if (pgmoneta_read_walfile(-1, segments[i], &wf))
+      {
+         goto error;
+      }
+
+      result->decode_seconds += bench_now() - start;
+      result->version = config->common.servers[0].version;
+
+      if (pgmoneta_deque_iterator_create(wf->records, &iter))
+      {
+         goto error;
+      }
+
+      while (pgmoneta_deque_iterator_next(iter))
+      {
+         bench_wal_record((struct decoded_xlog_record*)pgmoneta_value_data(iter->value), wf->long_phd->std.xlp_magic, result);
+      }
+
+      pgmoneta_deque_iterator_destroy(iter);
+      iter = NULL;
+
+      pgmoneta_destroy_walfile(wf);
+      wf = NULL;
+   }
+
+   return 0;
+
+error:
+
+   pgmoneta_deque_iterator_destroy(iter);
+   pgmoneta_destroy_walfile(wf);
+
+   return 1;
+}
+
+static int
+bench_wal_iterate(char** segments, int number_of_segments, int rmid, struct bench_wal_result* result)
+{
+   struct main_configuration* config;
+   struct wal_record_filter* filter = NULL;
+   struct wal_record_iterator* iterator = NULL;
+   double start;
+   bool more;
+
+   config = (struct main_configuration*)shmem;
+
+   if (pgmoneta_wal_record_filter_create(NULL, 0, 0, NULL, &filter))
+   {
+      goto error;
+   }
+
+   /* Records of other resource managers are rejected from their header */
+   filter->by_rmgr = true;
+   filter->rmgrs[rmid] = true;
+
+   for (int i = 0; i < number_of_segments; i++)
+   {
+      start = bench_now();
+
+      if (pgmoneta_wal_record_iterator_create(segments[i], -1, NULL, &iterator))
+      {
+         goto error;
+      }
+
+      iterator->filter = filter;
+      result->version = config->common.servers[0].version;
+
+      more = pgmoneta_wal_record_iterator_next(iterator);
+      result->decode_seconds += bench_now() - start;
+
+      /* Only the current record is kept, so it is described and encoded before the next one */
+      while (more)
+      {
+         bench_wal_record(iterator->record, iterator->long_phd->std.xlp_magic, result);
+
+         start = bench_now();
+         more = pgmoneta_wal_record_iterator_next(iterator);
+         result->decode_seconds += bench_now() - start;
+      }
+
+      if (iterator->failed)
+      {
+         goto error;
+      }
+
+      pgmoneta_wal_record_iterator_destroy(iterator);
+      iterator = NULL;
+   }
+
+   pgmoneta_wal_record_filter_destroy(filter);
+
+   return 0;
+
+error:
+
+   pgmoneta_wal_record_iterator_destroy(iterator);
+   pgmoneta_wal_record_filter_destroy(filter);
+
+   return 1;
+}
+
+static void
+bench_wal_record(struct decoded_xlog_record* record, uint16_t magic, struct bench_wal_result* result)
+{
+   char* desc = NULL;
+   char* encoded = NULL;
+   double start;
+
+   if (record->partial)
+   {
+      return;
+   }
+
+   result->records++;
+   result->bytes += record->header.xl_tot_len;
+   result->rmgrs[record->header.xl_rmid]++;
+
+   start = bench_now();
+   desc = pgmoneta_wal_rmgr_desc(desc, record);
+   result->describe_seconds += bench_now() - start;
+
+   start = bench_now();
+   encoded = pgmoneta_wal_encode_xlog_record(record, magic, encoded);
+   result->encode_seconds += bench_now() - start;
+
+   free(desc);
+   free(encoded);
+}
+
+static void
+bench_wal_report(int format, char* path, char* rmgr, struct bench_wal_result* result, long memory)
+{
+   double mb = result->bytes / (1024.0 * 1024.0);
+   double decode_records = result->decode_seconds > 0 ? result->records / result->decode_seconds : 0;
+   double decode = result->decode_seconds > 0 ? mb / result->decode_seconds : 0;
+   double describe = result->describe_seconds > 0 ? result->records / result->describe_seconds : 0;
+   double encode = result->encode_seconds > 0 ? mb / result->encode_seconds : 0;
+   char name[MAX_PATH];
+
+   if (rmgr == NULL)
+   {
+      rmgr = "unknown";
+   }
+
+   if (!result->success)
+   {
+      if (format == BENCH_FORMAT_CSV)
+      {
+         printf("%s,%d,%s,failed,failed,failed,failed,failed,failed,%ld\n", path, result->version, rmgr, memory);
+      }
+      else if (format == BENCH_FORMAT_TEXT)
+      {
+         printf("%-24s %7d %-12s %10s %10s %14s %10s %16s %10s %12ld\n", path, result->version, rmgr,
+                "failed", "failed", "failed", "failed", "failed", "failed", memory);
+      }
+      fflush(stdout);
+      return;
+   }
+
+   if (format == BENCH_FORMAT_CSV)
+   {
+      printf("%s,%d,%s,%lu,%.2f,%.0f,%.2f,%.0f,%.2f,%ld\n", path, result->version, rmgr, (unsigned long)result->records, mb,
+             decode_records, decode, describe, encode, memory);
+   }
+   else if (format == BENCH_FORMAT_JSON)
+   {
+      snprintf(&name[0], sizeof(name), "%s/%s", path, rmgr);
+
+      bench_json("wal", &name[0], "decode", "records/s", true, decode_records, 1, 0, NULL, NULL, 0);
+      bench_json("wal", &name[0], "decode_throughput", "MB/s", true, decode, 1, 0, NULL, NULL, 0);
+      bench_json("wal", &name[0], "describe", "records/s", true, describe, 1, 0, NULL, NULL, 0);
+      bench_json("wal", &name[0], "encode_throughput", "MB/s", true, encode, 1, 0, NULL, NULL, 0);
+      bench_json("wal", &name[0], "memory", "kB", false, memory, 1, 0, NULL, NULL, 0);
+   }
+   else
+   {
+      printf("%-24s %7d %-12s %10lu %10.2f %14.0f %10.2f %16.0f %10.2f %12ld\n", path, result->version, rmgr,
+             (unsigned long)result->records, mb, decode_records, decode, describe, encode, memory);
+   }
+
+   fflush(stdout);
+}
+
+static int
+bench_containers(int* sizes, int number_of_sizes, int repetitions, int format)
+{
+   char** keys = NULL;
+   int size = 0;
+   struct bench_timing timings[] = {
+      {"art_insert", 0, {0}},
+      {"art_search", 0, {0}},
+      {"art_iterate", 0, {0}},
+      {"art_delete", 0, {0}},
+      {"art_arena_insert", 0, {0}},
+      {"art_arena_destroy", 0, {0}},
+      {"deque_add", 0, {0}},
+      {"deque_sort", 0, {0}},
+      {"deque_poll", 0, {0}},
+      {"json_build", 0, {0}},
+      {"json_serialize", 0, {0}},
+      {"json_parse", 0, {0}},
+      {"json_to_binary", 0, {0}},
+      {"json_from_binary", 0, {0}},
+      {"value_create", 0, {0}},
+   };
+   int number_of_timings = sizeof(timings) / sizeof(timings[0]);
+
+   if (format == BENCH_FORMAT_CSV)
+   {
+      printf("operation,keys,repetitions,p50_ns,p90_ns,p99_ns,max_ns,ops_per_second\n");
+   }
+   else if (format == BENCH_FORMAT_TEXT)
+   {
+      printf("%-18s %10s %5s %10s %10s %10s %10s %14s\n", "Operation", "Keys", "Reps", "p50 ns/op", "p90 ns/op",
+             "p99 ns/op", "Max ns/op", "Ops/s (p50)");
+   }
+
+   for (int s = 0; s < number_of_sizes; s++)
+   {
+      size = sizes[s];
+
+      if (size <= 0)
+      {
+         continue;
+      }
+
+      keys = (char**)calloc(size, sizeof(char*));
+      if (keys == NULL)
+      {
+         goto error;
+      }
+
+      /* Relation paths of a manifest, in random order like the server lists them */
+      for (int i = 0; i < size; i++)
+      {
+         char key[MISC_LENGTH];
+
+         snprintf(&key[0], sizeof(key), "base/%d/%lu", 16384 + i % 8, (unsigned long)(bench_random() % 100000000) * 100 + i % 100);
+         keys[i] = strdup(&key[0]);
+         if (keys[i] == NULL)
+         {
+            goto error;
+         }
+      }
+
+      for (int t = 0; t < number_of_timings; t++)
+      {
+         timings[t].count = 0;
+      }
+
+      /* The first run warms the caches and the allocator, and is not measured */
+      for (int r = 0; r <= repetitions; r++)
+      {
+         if (bench_containers_run(keys, size, &timings[0], r > 0))
+         {
+            goto error;
+         }
+      }
+
+      for (int t = 0; t < number_of_timings; t++)
+      {
+         bench_containers_report(format, size, &timings[t]);
+      }
+
+      for (int i = 0; i < size; i++)
+      {
+         free(keys[i]);
+      }
+      free(keys);
+      keys = NULL;
+   }
+
+   return 0;
+
+error:
+
+   warnx("Could not benchmark the containers");
+
+   if (keys != NULL)
+   {
+      for (int i = 0; i < size; i++)
+      {
+         free(keys[i]);
+      }
+      free(keys);
+   }
+
+   return 1;
+}
+
+static int
+bench_containers_run(char** keys, int size, struct bench_timing* timings, bool record)
+{
+   int t = 0;
+   int found = 0;
+   double start;
+   char* string = NULL;
+   char* tag = NULL;
+   unsigned char* binary = NULL;
+   size_t binary_size = 0;
+   struct art* tree = NULL;
+   struct art_iterator* iter = NULL;
+   struct deque* deque = NULL;
+   struct json* root = NULL;
+   struct json* files = NULL;
+   struct json* parsed = NULL;
+   struct value* value = NULL;
+
+   /* ART */
+   if (pgmoneta_art_create(&tree))
+   {
+      goto error;
+   }
+
+   start = bench_now();
+   for (int i = 0; i < size; i++)
+   {
+      pgmoneta_art_insert(tree, keys[i], (uintptr_t)i, ValueInt32);
+   }
+   bench_containers_record(&timings[t++], record, (bench_now() - start) / size);
+
+   start = bench_now();
+   for (int i = size - 1; i >= 0; i--)
+   {
+      found += pgmoneta_art_contains_key(tree, keys[i]) ? 1 : 0;
+   }
+   bench_containers_record(&timings[t++], record, (bench_now() - start) / size);
+
+   start = bench_now();
+   if (pgmoneta_art_iterator_create(tree, &iter))
+   {
+      goto error;
+   }
+   while (pgmoneta_art_iterator_next(iter))
+   {
+      found++;
+   }
+   pgmoneta_art_iterator_destroy(iter);
+   iter = NULL;
+   bench_containers_record(&timings[t++], record, (bench_now() - start) / size);
+
+   start = bench_now();
+   for (int i = 0; i < size; i++)
+   {
+      pgmoneta_art_delete(tree, keys[i]);
+   }
+   bench_containers_record(&timings[t++], record, (bench_now() - start) / size);
+
+   pgmoneta_art_destroy(tree);
+   tree = NULL;
+
+   if (pgmoneta_art_create_with_arena(&tree))
+   {
+      goto error;
+   }
+
+   start = bench_now();
+   for (int i = 0; i < size; i++)
+   {
+      pgmoneta_art_insert(tree, keys[i], (uintptr_t)i, ValueInt32);
+   }
+   bench_containers_record(&timings[t++], record, (bench_now() - start) / size);
+
+   start = bench_now();
+   pgmoneta_art_destroy(tree);
+   tree = NULL;
+   bench_containers_record(&timings[t++], record, (bench_now() - start) / size);
+
+   /* Deque */
+   if (pgmoneta_deque_create(false, &deque))
+   {
+      goto error;
+   }
+
+   start = bench_now();
+   for (int i = 0; i < size; i++)
+   {
+      pgmoneta_deque_add(deque, keys[i], (uintptr_t)i, ValueInt32);
+   }
+   bench_containers_record(&timings[t++], record, (bench_now() - start) / size);
+
+   start = bench_now();
+   pgmoneta_deque_sort(deque);
+   bench_containers_record(&timings[t++], record, (bench_now() - start) / size);
+
+   start = bench_now();
+   while (!pgmoneta_deque_empty(deque))
+   {
+      pgmoneta_deque_poll(deque, &tag);
+      free(tag);
+      tag = NULL;
+   }
+   bench_containers_record(&timings[t++], record, (bench_now() - start) / size);
+
+   pgmoneta_deque_destroy(deque);
+   deque = NULL;
+
+   /* JSON, shaped like the files of a backup manifest */
+   start = bench_now();
+   if (pgmoneta_json_create(&root) || pgmoneta_json_create(&files))
+   {
+      goto error;
+   }
+   for (int i = 0; i < size; i++)
+   {
+      struct json* file = NULL;
+
+      if (pgmoneta_json_create(&file))
+      {
+         goto error;
+      }
+      pgmoneta_json_put(file, "Path", (uintptr_t)keys[i], ValueString);
+      pgmoneta_json_put(file, "Size", (uintptr_t)8192 * (i % 131072), ValueInt64);
+      pgmoneta_json_put(file, "Checksum-Algorithm", (uintptr_t)"SHA256", ValueString);
+      pgmoneta_json_put(file, "Checksum", (uintptr_t)keys[(i + 1) % size], ValueString);
+      pgmoneta_json_append(files, (uintptr_t)file, ValueJSON);
+   }
+   pgmoneta_json_put(root, "PostgreSQL-Backup-Manifest-Version", (uintptr_t)2, ValueInt64);
+   pgmoneta_json_put(root, "Files", (uintptr_t)files, ValueJSON);
+   files = NULL;
+   bench_containers_record(&timings[t++], record, (bench_now() - start) / size);
+
+   start = bench_now();
+   string = pgmoneta_json_to_string(root, FORMAT_JSON_COMPACT, NULL, 0);
+   if (string == NULL)
+   {
+      goto error;
+   }
+   bench_containers_record(&timings[t++], record, (bench_now() - start) / size);
+
+   start = bench_now();
+   if (pgmoneta_json_parse_string(string, &parsed))
+   {
+      goto error;
+   }
+   bench_containers_record(&timings[t++], record, (bench_now() - start) / size);
+
+   pgmoneta_json_destroy(parsed);
+   parsed = NULL;
+
+   start = bench_now();
+   if (pgmoneta_json_to_binary(root, &binary, &binary_size))
+   {
+      goto error;
+   }
+   bench_containers_record(&timings[t++], record, (bench_now() - start) / size);
+
+   start = bench_now();
+   if (pgmoneta_json_from_binary(binary, binary_size, &parsed))
+   {
+      goto error;
+   }
+   bench_containers_record(&timings[t++], record, (bench_now() - start) / size);
+
+   pgmoneta_json_destroy(parsed);
+   parsed = NULL;
+   pgmoneta_json_destroy(root);
+   root = NULL;
+   free(string);
+   string = NULL;
+   free(binary);
+   binary = NULL;
+
+   /* Value */
+   start = bench_now();
+   for (int i = 0; i < size; i++)
+   {
+      if (pgmoneta_value_create(ValueString, (uintptr_t)keys[i], &value))
+      {
+         goto error;
+      }
+      pgmoneta_value_destroy(value);
+      value = NULL;
+   }
+   bench_containers_record(&timings[t++], record, (bench_now() - start) / size);
+
+   if (found < 0)
+   {
+      goto error;
+   }
+
+   return 0;
+
+error:
+
+   pgmoneta_art_iterator_destroy(iter);
+   pgmoneta_art_destroy(tree);
+   pgmoneta_deque_destroy(deque);
+   pgmoneta_json_destroy(files);
+   pgmoneta_json_destroy(root);
+   pgmoneta_json_destroy(parsed);
+   free(string);
+   free(binary);
+
+   return 1;
+}
+
+static void
+bench_containers_record(struct bench_timing* timing, bool record, double seconds)
+{
+   if (record && timing->count < BENCH_MAX_REPETITIONS)
+   {
+      timing->seconds[timing->count++] = seconds;
+   }
+}
+
+static void
+bench_containers_report(int format, int size, struct bench_timing* timing)
+{
+   double p50;
+   double p90;
+   double p99;
+   double max;
+   double mean;
+   double stddev;
+   double percentiles[3];
+   int ranks[3] = {50, 90, 99};
+   char name[MISC_LENGTH];
+
+   if (timing->count == 0)
+   {
+      return;
+   }
+
+   qsort(&timing->seconds[0], timing->count, sizeof(double), bench_compare_doubles);
+
+   /* Nearest rank percentiles of the repetitions */
+   p50 = timing->seconds[(timing->count * 50 + 99) / 100 - 1] * 1e9;
+   p90 = timing->seconds[(timing->count * 90 + 99) / 100 - 1] * 1e9;
+   p99 = timing->seconds[(timing->count * 99 + 99) / 100 - 1] * 1e9;
+   max = timing->seconds[timing->count - 1] * 1e9;
+
+   if (format == BENCH_FORMAT_CSV)
+   {
+      printf("%s,%d,%d,%.1f,%.1f,%.1f,%.1f,%.0f\n", timing->name, size, timing->count, p50, p90, p99, max,
+             p50 > 0 ? 1e9 / p50 : 0);
+   }
+   else if (format == BENCH_FORMAT_JSON)
+   {
+      mean = bench_mean(&timing->seconds[0], timing->count, &stddev);
+      percentiles[0] = p50;
+      percentiles[1] = p90;
+      percentiles[2] = p99;
+      snprintf(&name[0], sizeof(name), "%s/keys=%d", timing->name, size);
+
+      bench_json("containers", &name[0], "time", "ns/op", false, mean * 1e9, timing->count, stddev * 1e9,
+                 &ranks[0], &percentiles[0], 3);
+   }
+   else
+   {
+      printf("%-18s %10d %5d %10.1f %10.1f %10.1f %10.1f %14.0f\n", timing->name, size, timing->count, p50, p90, p99, max,
+             p50 > 0 ? 1e9 / p50 : 0);
+   }
+}
+
+static int
+bench_compare_doubles(const void* a, const void* b)
+{
+   double x = *(const double*)a;
+   double y = *(const double*)b;
+
+   return (x > y) - (x < y);
+}
+
+static int
+bench_repository(char* directory, int* sizes, int number_of_sizes, int repetitions, bool keep, int format)
+{
+   int backups = 0;
+   struct bench_timing timings[] = {
+      {"get_backups_cold", 0, {0}},
+      {"get_backups_warm", 0, {0}},
+      {"get_backup_newest", 0, {0}},
+      {"valid_backups", 0, {0}},
+      {"backup_root", 0, {0}},
+      {"wal_files", 0, {0}},
+      {"repository_size", 0, {0}},
+   };
+   int number_of_timings = sizeof(timings) / sizeof(timings[0]);
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   config->common.number_of_servers = 1;
+   snprintf(&config->common.servers[0].name[0], MISC_LENGTH, "%s", "primary");
+
+   if (format == BENCH_FORMAT_CSV)
+   {
+      printf("operation,backups,repetitions,p50_ms,p90_ms,p99_ms,max_ms\n");
+   }
+   else if (format == BENCH_FORMAT_TEXT)
+   {
+      printf("%-18s %10s %5s %10s %10s %10s %10s\n", "Operation", "Backups", "Reps", "p50 ms", "p90 ms",
+             "p99 ms", "Max ms");
+   }
+
+   for (int s = 0; s < number_of_sizes; s++)
+   {
+      backups = sizes[s];
+
+      if (backups <= 0)
+      {
+         continue;
+      }
+
+      snprintf(&config->base_dir[0], MAX_PATH, "%s/pgmoneta-bench-repository-%d", directory, backups);
+
+      if (pgmoneta_exists(config->base_dir))
+      {
+         pgmoneta_delete_directory(config->base_dir);
+      }
+
+      if (bench_repository_generate(backups))
+      {
+         goto error;
+      }
+
+      for (int t = 0; t < number_of_timings; t++)
+      {
+         timings[t].count = 0;
+      }
+
+      /* The first run warms the page cache with the directories and the backup.info files, and is not measured */
+      for (int r = 0; r <= repetitions; r++)
+      {
+         if (bench_repository_run(&timings[0], r > 0))
+         {
+            goto error;
+         }
+      }
+
+      for (int t = 0; t < number_of_timings; t++)
+      {
+         bench_repository_report(format, backups, &timings[t]);
+      }
+
+      if (keep)
+      {
+         fprintf(stderr, "Kept %s\n", config->base_dir);
+      }
+      else
+      {
+         pgmoneta_delete_directory(config->base_dir);
+      }
+   }
+
+   return 0;
+
+error:
+
+   warnx("Could not benchmark the repository in %s", config->base_dir);
+
+   if (!keep && pgmoneta_exists(config->base_dir))
+   {
+      pgmoneta_delete_directory(config->base_dir);
+   }
+
+   return 1;
+}
+
+static int
+bench_repository_generate(int backups)
+{
+   char* backup_directory = NULL;
+   char* wal_directory = NULL;
+   char label[MISC_LENGTH];
+   char parent[MISC_LENGTH];
+   char path[MAX_PATH];
+   time_t start = 1704067200;
+   struct tm tm;
+   FILE* file = NULL;
+
+   backup_directory = pgmoneta_get_server_backup(0);
+   wal_directory = pgmoneta_get_server_wal(0);
+
+   if (backup_directory == NULL || wal_directory == NULL ||
+       pgmoneta_mkdir(backup_directory) || pgmoneta_mkdir(wal_directory))
+   {
+      goto error;
+   }
+
+   memset(&parent[0], 0, sizeof(parent));
+
+   for (int i = 0; i < backups; i++)
+   {
+      time_t t = start + (time_t)i * 3600;
+
+      gmtime_r(&t, &tm);
+      strftime(&label[0], sizeof(label), "%Y%m%d%H%M%S", &tm);
+
+      /* A full backup a week with daily incremental backups on top of the previous one */
+      if (bench_repository_backup(backup_directory, i, &label[0], i % BENCH_REPOSITORY_CHAIN == 0 ? NULL : &parent[0]))
+      {
+         goto error;
+      }
+
+      memcpy(&parent[0], &label[0], sizeof(parent));
+
+      /* The WAL of the backup as sparse segments */
+      for (int w = 0; w < BENCH_REPOSITORY_SEGMENTS; w++)
+      {
+         uint64_t segno = 2 + (uint64_t)i * BENCH_REPOSITORY_SEGMENTS + w;
+
+         snprintf(&path[0], sizeof(path), "%s00000001%08X%08X", wal_directory,
+                  (uint32_t)(segno / 0x100), (uint32_t)(segno % 0x100));
+
+         file = fopen(&path[0], "w");
+         if (file == NULL || ftruncate(fileno(file), BENCH_SEGMENT_SIZE))
+         {
+            goto error;
+         }
+         fclose(file);
+         file = NULL;
+      }
+   }
+
+   free(backup_directory);
+   free(wal_directory);
+
+   return 0;
+
+error:
+
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+
+   free(backup_directory);
+   free(wal_directory);
+
+   return 1;
+}
+
+static int
+bench_repository_backup(char* directory, int index, char* label, char* parent)
+{
+   char base[MAX_PATH];
+   char path[MAX_PATH];
+   uint64_t start_lsn;
+   uint64_t end_lsn;
+   uint64_t segno;
+   uint64_t size;
+   uint64_t backup_size = 0;
+   FILE* info = NULL;
+   FILE* manifest = NULL;
+   FILE* file = NULL;
+   struct main_configuration* config;
+
+   config = (struct main_configuration*)shmem;
+
+   snprintf(&base[0], sizeof(base), "%s%s", directory, label);
+   snprintf(&path[0], sizeof(path), "%s/data/base/16384", &base[0]);
+
+   if (pgmoneta_mkdir(&path[0]))
+   {
+      goto error;
+   }
+
+   snprintf(&path[0], sizeof(path), "%s/backup.manifest", &base[0]);
+   manifest = fopen(&path[0], "w");
+   if (manifest == NULL)
+   {
+      goto error;
+   }
+
+   /* Sparse relation segments, whole for a full backup and changed blocks for an incremental */
+   for (int f = 0; f < BENCH_REPOSITORY_FILES; f++)
+   {
+      size = parent == NULL ? (uint64_t)(bench_random() % 1024 + 1) * 1024 * 1024 : (uint64_t)(bench_random() % 64 + 1) * BENCH_PAGE_SIZE;
+
+      snprintf(&path[0], sizeof(path), "%s/data/base/16384/%s%d", &base[0], parent == NULL ? "" : "INCREMENTAL.", 16385 + f);
+
+      file = fopen(&path[0], "w");
+      if (file == NULL || ftruncate(fileno(file), size))
+      {
+         goto error;
+      }
+      fclose(file);
+      file = NULL;
+
+      fprintf(manifest, "base/16384/%s%d,%016lx%016lx%016lx%016lx\n", parent == NULL ? "" : "INCREMENTAL.", 16385 + f,
+              (unsigned long)bench_random(), (unsigned long)bench_random(), (unsigned long)bench_random(),
+              (unsigned long)bench_random());
+
+      backup_size += size;
+   }
+
+   fclose(manifest);
+   manifest = NULL;
+
+   snprintf(&path[0], sizeof(path), "%s/data/backup_manifest", &base[0]);
+   file = fopen(&path[0], "w");
+   if (file == NULL)
+   {
+      goto error;
+   }
+   fprintf(file, "{ \"PostgreSQL-Backup-Manifest-Version\": 2,\n\"System-Identifier\": 7000000000000000000,\n\"Files\": [\n]\n}\n");
+   fclose(file);
+   file = NULL;
+
+   segno = 2 + (uint64_t)index * BENCH_REPOSITORY_SEGMENTS;
+   start_lsn = segno * BENCH_SEGMENT_SIZE + 0x28;
+   end_lsn = (segno + BENCH_REPOSITORY_SEGMENTS - 1) * BENCH_SEGMENT_SIZE + 0x100;
+
+   snprintf(&path[0], sizeof(path), "%s/backup.info", &base[0]);
+   info = fopen(&path[0], "w");
+   if (info == NULL)
+   {
+      goto error;
+   }
+
+   fprintf(info, "%s=1\n", INFO_STATUS);
+   fprintf(info, "%s=%s\n", INFO_LABEL, label);
+   fprintf(info, "%s=0\n", INFO_TABLESPACES);
+   fprintf(info, "%s=%s\n", INFO_PGMONETA_VERSION, VERSION);
+   fprintf(info, "%s=\n", INFO_COMMENTS);
+   fprintf(info, "%s=%d\n", INFO_COMPRESSION, config->compression_type);
+   fprintf(info, "%s=%d\n", INFO_ENCRYPTION, config->encryption);
+   fprintf(info, "%s=00000001%08X%08X\n", INFO_WAL, (uint32_t)(segno / 0x100), (uint32_t)(segno % 0x100));
+   fprintf(info, "%s=%lu\n", INFO_BACKUP, (unsigned long)backup_size);
+   fprintf(info, "%s=%lu\n", INFO_RESTORE, (unsigned long)backup_size);
+   fprintf(info, "%s=%lu\n", INFO_BIGGEST_FILE, (unsigned long)(1024 * 1024 * 1024));
+   fprintf(info, "%s=%.4f\n", INFO_ELAPSED, (double)(bench_random() % 600000) / 1000);
+   fprintf(info, "%s=%.4f\n", INFO_BASEBACKUP_ELAPSED, (double)(bench_random() % 300000) / 1000);
+   fprintf(info, "%s=%.4f\n", INFO_MANIFEST_ELAPSED, (double)(bench_random() % 10000) / 1000);
+   fprintf(info, "%s=17\n", INFO_MAJOR_VERSION);
+   fprintf(info, "%s=0\n", INFO_MINOR_VERSION);
+   fprintf(info, "%s=%d\n", INFO_KEEP, index % BENCH_REPOSITORY_KEEP == BENCH_REPOSITORY_KEEP - 1 ? 1 : 0);
+   fprintf(info, "%s=%X/%X\n", INFO_START_WALPOS, (uint32_t)(start_lsn >> 32), (uint32_t)start_lsn);
+   fprintf(info, "%s=%X/%X\n", INFO_CHKPT_WALPOS, (uint32_t)(start_lsn >> 32), (uint32_t)(start_lsn + 0x60));
+   fprintf(info, "%s=%X/%X\n", INFO_END_WALPOS, (uint32_t)(end_lsn >> 32), (uint32_t)end_lsn);
+   fprintf(info, "%s=1\n", INFO_START_TIMELINE);
+   fprintf(info, "%s=1\n", INFO_END_TIMELINE);
+   fprintf(info, "%s=%d\n", INFO_HASH_ALGORITHM, HASH_ALGORITHM_SHA256);
+   fprintf(info, "%s=%d\n", INFO_TYPE, parent == NULL ? TYPE_FULL : TYPE_INCREMENTAL);
+   if (parent != NULL)
+   {
+      fprintf(info, "%s=%s\n", INFO_PARENT, parent);
+   }
+
+   fclose(info);
+
+   return 0;
+
+error:
+
+   if (file != NULL)
+   {
+      fclose(file);
+   }
+   if (manifest != NULL)
+   {
+      fclose(manifest);
+   }
+
+   return 1;
+}
+
+static int
+bench_repository_run(struct bench_timing* timings, bool record)
+{
+   char* backup_directory = NULL;
+   char* wal_directory = NULL;
+   char* server_directory = NULL;
+   char* catalog = NULL;
+   int number_of_backups = 0;
+   int number_of_files = 0;
+   char** files = NULL;
+   struct backup** backups = NULL;
+   struct backup* newest = NULL;
+   struct backup* root = NULL;
+   double start;
+
+   backup_directory = pgmoneta_get_server_backup(0);
+   wal_directory = pgmoneta_get_server_wal(0);
+   server_directory = pgmoneta_get_server(0);
+
+   /* The catalog is stored next to the backup directory */
+   catalog = pgmoneta_append(catalog, server_directory);
+   catalog = pgmoneta_append(catalog, "backup.catalog");
+
+   if (backup_directory == NULL || wal_directory == NULL || server_directory == NULL || catalog == NULL)
+   {
+      goto error;
+   }
+
+   unlink(catalog);
+
+   start = bench_now();
+   if (pgmoneta_get_backups(backup_directory, &number_of_backups, &backups))
+   {
+      goto error;
+   }
+   bench_containers_record(&timings[0], record, bench_now() - start);
+
+   for (int i = 0; i < number_of_backups; i++)
+   {
+      free(backups[i]);
+   }
+   free(backups);
+   backups = NULL;
+
+   start = bench_now();
+   if (pgmoneta_get_backups(backup_directory, &number_of_backups, &backups))
+   {
+      goto error;
+   }
+   bench_containers_record(&timings[1], record, bench_now() - start);
+
+   for (int i = 0; i < number_of_backups; i++)
+   {
+      free(backups[i]);
+   }
+   free(backups);
+   backups = NULL;
+
+   start = bench_now();
+   if (pgmoneta_get_backup_server(0, "newest", &newest) || newest == NULL)
+   {
+      goto error;
+   }
+   bench_containers_record(&timings[2], record, bench_now() - start);
+
+   start = bench_now();
+   pgmoneta_get_number_of_valid_backups(0);
+   bench_containers_record(&timings[3], record, bench_now() - start);
+
+   /* Walking the chain to the full backup, when the newest backup is an incremental */
+   if (newest->type == TYPE_INCREMENTAL)
+   {
+      start = bench_now();
+      if (pgmoneta_get_backup_root(0, newest, &root))
+      {
+         goto error;
+      }
+      bench_containers_record(&timings[4], record, bench_now() - start);
+   }
+
+   start = bench_now();
+   if (pgmoneta_get_wal_files(wal_directory, &number_of_files, &files))
+   {
+      goto error;
+   }
+   bench_containers_record(&timings[5], record, bench_now() - start);
+
+   start = bench_now();
+   pgmoneta_directory_size(server_directory);
+   bench_containers_record(&timings[6], record, bench_now() - start);
+
+   for (int i = 0; i < number_of_files; i++)
+   {
+      free(files[i]);
+   }
+   free(files);
+
+   free(root);
+   free(newest);
+   free(catalog);
+   free(server_directory);
+   free(wal_directory);
+   free(backup_directory);
+
+   return 0;
+
+error:
+
+   if (backups != NULL)
+   {
+      for (int i = 0; i < number_of_backups; i++)
+      {
+         free(backups[i]);
+      }
+      free(backups);
+   }
+
+   if (files != NULL)
+   {
+      for (int i = 0; i < number_of_files; i++)
+      {
+         free(files[i]);
+      }
+      free(files);
+   }
+
+   free(root);
+   free(newest);
+   free(catalog);
+   free(server_directory);
+   free(wal_directory);
+   free(backup_directory);
+
+   return 1;
+}
+
+static void
+bench_repository_report(int format, int backups, struct bench_timing* timing)
+{
+   double p50;
+   double p90;
+   double p99;
+   double max;
+   double mean;
+   double stddev;
+   double percentiles[3];
+   int ranks[3] = {50, 90, 99};
+   char name[MISC_LENGTH];
+
+   if (timing->count == 0)
+   {
+      return;
+   }
+
+   qsort(&timing->seconds[0], timing->count, sizeof(double), bench_compare_doubles);
+
+   p50 = timing->seconds[(timing->count * 50 + 99) / 100 - 1] * 1000;
+   p90 = timing->seconds[(timing->count * 90 + 99) / 100 - 1] * 1000;
+   p99 = timing->seconds[(timing->count * 99 + 99) / 100 - 1] * 1000;
+   max = timing->seconds[timing->count - 1] * 1000;
+
+   if (format == BENCH_FORMAT_CSV)
+   {
+      printf("%s,%d,%d,%.3f,%.3f,%.3f,%.3f\n", timing->name, backups, timing->count, p50, p90, p99, max);
+   }
+   else if (format == BENCH_FORMAT_JSON)
+   {
+      mean = bench_mean(&timing->seconds[0], timing->count, &stddev);
+      percentiles[0] = p50;
+      percentiles[1] = p90;
+      percentiles[2] = p99;
+      snprintf(&name[0], sizeof(name), "%s/backups=%d", timing->name, backups);
+
+      bench_json("repository", &name[0], "time", "ms", false, mean * 1000, timing->count, stddev * 1000,
+                 &ranks[0], &percentiles[0], 3);
+   }
+   else
+   {
+      printf("%-18s %10d %5d %10.3f %10.3f %10.3f %10.3f\n", timing->name, backups, timing->count, p50, p90, p99, max);
+   }
+}
+
+/**
+ * Print a result as one JSON object per line, so the results of the runs can be
+ * concatenated and compared with test/benchcompare.sh
+ */
+static void
+bench_json(char* suite, char* name, char* metric, char* unit, bool higher, double value, int samples,
+           double stddev, int* ranks, double* percentiles, int number_of_percentiles)
+{
+   char key[MISC_LENGTH];
+   char timestamp[128];
+   char* commit = NULL;
+   char* str = NULL;
+   time_t now;
+   struct tm tm;
+   struct json* record = NULL;
+   struct json* p = NULL;
+
+   commit = getenv("PGMONETA_COMMIT");
+
+   now = time(NULL);
+   gmtime_r(&now, &tm);
+   strftime(&timestamp[0], sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", &tm);
+
+   if (pgmoneta_json_create(&record))
+   {
+      goto error;
+   }
+
+   pgmoneta_json_put(record, "suite", (uintptr_t)suite, ValueString);
+   pgmoneta_json_put(record, "name", (uintptr_t)name, ValueString);
+   pgmoneta_json_put(record, "metric", (uintptr_t)metric, ValueString);
+   pgmoneta_json_put(record, "unit", (uintptr_t)unit, ValueString);
+   pgmoneta_json_put(record, "better", (uintptr_t)(higher ? "higher" : "lower"), ValueString);
+   pgmoneta_json_put(record, "value", pgmoneta_value_from_double(value), ValueDouble);
+   pgmoneta_json_put(record, "samples", (uintptr_t)samples, ValueInt32);
+   pgmoneta_json_put(record, "stddev", pgmoneta_value_from_double(stddev), ValueDouble);
+
+   if (number_of_percentiles > 0)
+   {
+      if (pgmoneta_json_create(&p))
+      {
+         goto error;
+      }
+
+      for (int i = 0; i < number_of_percentiles; i++)
+      {
+         snprintf(&key[0], sizeof(key), "p%d", ranks[i]);
+         pgmoneta_json_put(p, &key[0], pgmoneta_value_from_double(percentiles[i]), ValueDouble);
+      }
+
+      pgmoneta_json_put(record, "percentiles", (uintptr_t)p, ValueJSON);
+      p = NULL;
+   }
+
+   pgmoneta_json_put(record, "commit", (uintptr_t)(commit != NULL && strlen(commit) > 0 ? commit : "unknown"), ValueString);
+   pgmoneta_json_put(record, "timestamp", (uintptr_t)&timestamp[0], ValueString);
+   pgmoneta_json_put(record, "environment", (uintptr_t)bench_json_environment(), ValueJSON);
+
+   str = pgmoneta_json_to_string(record, FORMAT_JSON_COMPACT, NULL, 0);
+   if (str == NULL)
+   {
+      goto error;
+   }
+
+   printf("%s\n", str);
+   fflush(stdout);
+
+   free(str);
+   pgmoneta_json_destroy(record);
+
+   return;
+
+error:
+
+   warnx("Could not report %s %s %s", suite, name, metric);
+
+   pgmoneta_json_destroy(p);
+   pgmoneta_json_destroy(record);
+}
+
+/**
+ * The machine of a result, so results from different hosts are not compared by mistake
+ */
+static struct json*
+bench_json_environment(void)
+{
+   struct utsname u;
+   struct json* environment = NULL;
+
+   if (pgmoneta_json_create(&environment))
+   {
+      return NULL;
+   }
+
+   memset(&u, 0, sizeof(u));
+   uname(&u);
+
+   pgmoneta_json_put(environment, "host", (uintptr_t)&u.nodename[0], ValueString);
+   pgmoneta_json_put(environment, "os", (uintptr_t)&u.sysname[0], ValueString);
+   pgmoneta_json_put(environment, "release", (uintptr_t)&u.release[0], ValueString);
+   pgmoneta_json_put(environment, "machine", (uintptr_t)&u.machine[0], ValueString);
+   pgmoneta_json_put(environment, "cpus", (uintptr_t)sysconf(_SC_NPROCESSORS_ONLN), ValueInt32);
+   pgmoneta_json_put(environment, "version", (uintptr_t)VERSION, ValueString);
+
+   return environment;
+}
+
+static double
+bench_mean(double* values, int count, double* stddev)
+{
+   double mean = 0;
+   double sum = 0;
+
+   *stddev = 0;
+
+   if (count == 0)
+   {
+      return 0;
+   }
+
+   for (int i = 0; i < count; i++)
+   {
+      mean += values[i];
+   }
+   mean /= count;
+
+   for (int i = 0; i < count; i++)
+   {
+      sum += (values[i] - mean) * (values[i] - mean);
+   }
+
+   /* The sample standard deviation */
+   *stddev = count > 1 ? sqrt(sum / (count - 1)) : 0;
+
+   return mean;
+}
+
+static int
+bench_parse_list(char* s, int* values, int max)
+{
+   char* copy = NULL;
+   char* token = NULL;
+   char* saveptr = NULL;
+   int count = 0;
+
+   copy = strdup(s);
+   if (copy == NULL)
+   {
+      return -1;
+   }
+
+   token = strtok_r(copy, ",", &saveptr);
+   while (token != NULL && count < max)
+   {
+      values[count++] = atoi(token);
+      token = strtok_r(NULL, ",", &saveptr);
+   }
+
+   free(copy);
+
+   return count;
+}
+
+static double
+bench_now(void)
+{
+   struct timespec now;
+
+#ifdef HAVE_FREEBSD
+   clock_gettime(CLOCK_MONOTONIC_FAST, &now);
+#else
+   clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+#endif
+
+   return now.tv_sec + now.tv_nsec / 1e9;
+}
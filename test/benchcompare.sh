@@ -0,0 +1,176 @@
+#!/bin/bash
+#
+# Copyright (C) 2025 The pgmoneta community
+#
+# Redistribution and use in source and binary forms, with or without modification,
+# are permitted provided that the following conditions are met:
+#
+# 1. Redistributions of source code must retain the above copyright notice, this list
+# of conditions and the following disclaimer.
+#
+# 2. Redistributions in binary form must reproduce the above copyright notice, this
+# list of conditions and the following disclaimer in the documentation and/or other
+# materials provided with the distribution.
+#
+# 3. Neither the name of the copyright holder nor the names of its contributors may
+# be used to endorse or promote products derived from this software without specific
+# prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+# EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+# OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+# THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+# OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+# HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+# TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+# SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+# Compare two files of pgmoneta-bench -F json or benchsuite.sh -j results, and fail on
+# the results which got significantly worse. A result is keyed by its suite, name and
+# metric. Several records of a key are the samples of repeated runs, a single record
+# uses the repetitions it was measured over
+
+THRESHOLD=5
+
+usage() {
+   echo "Usage: $0 [-t PERCENT] BASELINE CURRENT"
+   echo "Options:"
+   echo " -t PERCENT       the smallest change reported as a regression, default $THRESHOLD"
+   echo "Exit status is 1 when a result regressed or is missing from CURRENT"
+   exit 2
+}
+
+while getopts "t:h" option; do
+   case $option in
+      t) THRESHOLD=$OPTARG ;;
+      *) usage ;;
+   esac
+done
+shift $((OPTIND - 1))
+
+if [ $# -ne 2 ] || [ ! -f "$1" ] || [ ! -f "$2" ]; then
+   usage
+fi
+
+awk -v threshold="$THRESHOLD" '
+function field(line, key,    s) {
+   if (match(line, "\"" key "\":\"[^\"]*\"")) {
+      s = substr(line, RSTART + length(key) + 4, RLENGTH - length(key) - 5)
+      return s
+   }
+   if (match(line, "\"" key "\":[-+0-9.eE]+")) {
+      return substr(line, RSTART + length(key) + 3, RLENGTH - length(key) - 3) + 0
+   }
+   return ""
+}
+
+# The two sided 95% critical value of the t distribution
+function critical(df) {
+   if (df < 2) return 12.71
+   if (df < 3) return 4.30
+   if (df < 4) return 3.18
+   if (df < 5) return 2.78
+   if (df < 6) return 2.57
+   if (df < 8) return 2.45
+   if (df < 10) return 2.31
+   if (df < 15) return 2.23
+   if (df < 20) return 2.13
+   if (df < 30) return 2.09
+   if (df < 60) return 2.04
+   return 1.96
+}
+
+# The mean, standard deviation and number of samples of a key in a file
+function stats(f, k) {
+   if (records[f, k] > 1) {
+      n = records[f, k]
+      mean = sum[f, k] / n
+      var = (squares[f, k] - n * mean * mean) / (n - 1)
+      sd = var > 0 ? sqrt(var) : 0
+   } else {
+      n = samples[f, k]
+      mean = sum[f, k]
+      sd = deviation[f, k]
+   }
+}
+
+/^\{/ {
+   k = field($0, "suite") "|" field($0, "name") "|" field($0, "metric")
+   if (!((1, k) in records) && !((2, k) in records)) {
+      keys[++number_of_keys] = k
+   }
+   records[file, k]++
+   sum[file, k] += field($0, "value")
+   squares[file, k] += field($0, "value") * field($0, "value")
+   samples[file, k] = field($0, "samples") > 0 ? field($0, "samples") : 1
+   deviation[file, k] = field($0, "stddev") + 0
+   better[k] = field($0, "better")
+   unit[k] = field($0, "unit")
+   if (host[file] == "") {
+      host[file] = field($0, "host") "/" field($0, "machine") "/" field($0, "cpus")
+   }
+}
+
+END {
+   if (host[1] != host[2]) {
+      printf "warning: the baseline is from %s and the results are from %s\n", host[1], host[2]
+   }
+
+   printf "%-10s %-11s %-48s %-18s %14s %14s %9s %7s\n", "Status", "Suite", "Name", "Metric", "Baseline", "Current", "Change", "t"
+
+   for (i = 1; i <= number_of_keys; i++) {
+      k = keys[i]
+      split(k, parts, "|")
+
+      if (!((1, k) in records)) {
+         stats(2, k)
+         printf "%-10s %-11s %-48s %-18s %14s %14.3f %9s %7s\n", "new", parts[1], parts[2], parts[3] " (" unit[k] ")", "-", mean, "-", "-"
+         continue
+      }
+      if (!((2, k) in records)) {
+         stats(1, k)
+         printf "%-10s %-11s %-48s %-18s %14.3f %14s %9s %7s\n", "missing", parts[1], parts[2], parts[3] " (" unit[k] ")", mean, "-", "-", "-"
+         failures++
+         continue
+      }
+
+      stats(1, k)
+      bn = n; bm = mean; bs = sd
+      stats(2, k)
+      cn = n; cm = mean; cs = sd
+
+      change = bm != 0 ? (cm - bm) / (bm < 0 ? -bm : bm) * 100 : 0
+      worse = better[k] == "higher" ? -change : change
+
+      # Welch t test when both sides have samples to estimate the noise from
+      t = "-"
+      significant = 1
+      if (bn > 1 && cn > 1) {
+         se = bs * bs / bn + cs * cs / cn
+         if (se > 0) {
+            t = (cm - bm) / sqrt(se)
+            t = t < 0 ? -t : t
+            df = se * se / ((bs * bs / bn) ^ 2 / (bn - 1) + (cs * cs / cn) ^ 2 / (cn - 1))
+            significant = t >= critical(df)
+            t = sprintf("%.2f", t)
+         }
+      }
+
+      if (worse > threshold && significant) {
+         status = "regression"
+         failures++
+      } else if (-worse > threshold && significant) {
+         status = "improved"
+      } else {
+         status = "ok"
+      }
+
+      printf "%-10s %-11s %-48s %-18s %14.3f %14.3f %8.1f%% %7s\n", status, parts[1], parts[2], parts[3] " (" unit[k] ")", bm, cm, change, t
+   }
+
+   if (failures > 0) {
+      printf "%d results regressed or are missing\n", failures
+      exit 1
+   }
+}' file=1 "$1" file=2 "$2"
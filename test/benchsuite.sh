@@ -0,0 +1,424 @@
+#!/bin/bash
+#
+# Copyright (C) 2025 The pgmoneta community
+#
+# Redistribution and use in source and binary forms, with or without modification,
+# are permitted provided that the following conditions are met:
+#
+# 1. Redistributions of source code must retain the above copyright notice, this list
+# of conditions and the following disclaimer.
+#
+# 2. Redistributions in binary form must reproduce the above copyright notice, this
+# list of conditions and the following disclaimer in the documentation and/or other
+# materials provided with the distribution.
+#
+# 3. Neither the name of the copyright holder nor the names of its contributors may
+# be used to endorse or promote products derived from this software without specific
+# prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+# EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+# OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+# THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+# SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+# OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+# HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+# TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+# SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+set -e
+
+OS=$(uname)
+
+THIS_FILE=$(realpath "$0")
+FILE_OWNER=$(ls -l "$THIS_FILE" | awk '{print $3}')
+USER=$(whoami)
+WAIT_TIMEOUT=5
+
+PORT=5432
+PGPASSWORD="password"
+
+SCALES="10,100"
+COMPRESSIONS="none,zstd,lz4"
+ENCRYPTIONS="none,aes-256-gcm"
+REPORT=$(pwd)/benchsuite.csv
+RESULTS=
+
+EXECUTABLE_DIRECTORY=$(pwd)/src
+
+LOG_DIRECTORY=$(pwd)/log
+PGCTL_LOG_FILE=$LOG_DIRECTORY/logfile-bench
+PGMONETA_LOG_FILE=$LOG_DIRECTORY/pgmoneta-bench.log
+
+POSTGRES_OPERATION_DIR=$(pwd)/pgmoneta-postgresql-bench
+DATA_DIRECTORY=$POSTGRES_OPERATION_DIR/data
+
+PGMONETA_OPERATION_DIR=$(pwd)/pgmoneta-benchsuite
+RESTORE_DIRECTORY=$PGMONETA_OPERATION_DIR/restore
+BACKUP_DIRECTORY=$PGMONETA_OPERATION_DIR/backup
+CONFIGURATION_DIRECTORY=$PGMONETA_OPERATION_DIR/conf
+PIDFILE=$PGMONETA_OPERATION_DIR/pgmoneta.pid
+RSS_FILE=$PGMONETA_OPERATION_DIR/rss
+
+PSQL_USER=$USER
+
+########################### UTILS ############################
+is_port_in_use() {
+   local port=$1
+   if [[ "$OS" == "Linux" ]]; then
+      ss -tuln | grep $port >/dev/null 2>&1
+   elif [[ "$OS" == "Darwin" ]]; then
+      lsof -i:$port >/dev/null 2>&1
+   elif [[ "$OS" == "FreeBSD" ]]; then
+      sockstat -4 -l | grep $port >/dev/null 2>&1
+   fi
+   return $?
+}
+
+next_available_port() {
+   local port=$1
+   while true; do
+      is_port_in_use $port
+      if [ $? -ne 0 ]; then
+         echo "$port"
+         return 0
+      else
+         port=$((port + 1))
+      fi
+   done
+}
+
+wait_for_server_ready() {
+   local start_time=$SECONDS
+   while true; do
+      pg_isready -h localhost -p $PORT >/dev/null 2>&1
+      if [ $? -eq 0 ]; then
+         return 0
+      fi
+      if [ $(($SECONDS - $start_time)) -gt $WAIT_TIMEOUT ]; then
+         echo "waiting for server timed out"
+         return 1
+      fi
+
+      # Avoid busy-waiting
+      sleep 1
+   done
+}
+
+# Nanoseconds of the wall clock
+now() {
+   if [[ "$OS" == "Linux" ]]; then
+      date +%s%N
+   else
+      echo $(($(date +%s) * 1000000000))
+   fi
+}
+
+# CPU ticks of pgmoneta and of the processes it has reaped
+cpu_ticks() {
+   local pid
+   pid=$(cat $PIDFILE 2>/dev/null || echo 0)
+   if [[ "$OS" == "Linux" && -r /proc/$pid/stat ]]; then
+      awk '{print $14 + $15 + $16 + $17}' /proc/$pid/stat
+   else
+      echo 0
+   fi
+}
+
+# Sample the resident memory of the pgmoneta processes, and keep the peak in kB
+start_rss_sampler() {
+   echo 0 >$RSS_FILE
+   (
+      local sid peak rss
+      sid=$(ps -o sid= -p $(cat $PIDFILE) | tr -d ' ')
+      peak=0
+      while true; do
+         rss=$(ps -o rss= -s $sid 2>/dev/null | awk '{s += $1} END {print s + 0}')
+         if [ "$rss" -gt "$peak" ]; then
+            peak=$rss
+            echo $peak >$RSS_FILE
+         fi
+         sleep 0.2
+      done
+   ) &
+   RSS_SAMPLER=$!
+}
+
+stop_rss_sampler() {
+   kill $RSS_SAMPLER >/dev/null 2>&1 || true
+   wait $RSS_SAMPLER 2>/dev/null || true
+}
+
+##############################################################
+
+############### CHECK POSTGRES DEPENDENCIES ##################
+check_system_requirements() {
+   echo -e "\e[34mCheck System Requirements \e[0m"
+   for binary in initdb pg_ctl psql pgbench; do
+      if which $binary >/dev/null 2>&1; then
+         echo "check $binary in path ... ok"
+      else
+         echo "check $binary in path ... not present"
+         exit 1
+      fi
+   done
+   version=$(psql --version | awk '{print $3}' | cut -d'.' -f1)
+   if [ "$version" -lt 17 ]; then
+      echo "check postgresql version: $version ... not ok"
+      exit 1
+   fi
+   echo "check postgresql version: $version ... ok"
+   echo ""
+}
+##############################################################
+
+##################### POSTGRES OPERATIONS ####################
+create_cluster() {
+   echo -e "\e[34mInitializing Cluster \e[0m"
+   mkdir -p $LOG_DIRECTORY
+   initdb -k -D $DATA_DIRECTORY >/dev/null
+   cat <<EOF >>$DATA_DIRECTORY/postgresql.conf
+port = $PORT
+unix_socket_directories = '/tmp'
+password_encryption = scram-sha-256
+shared_buffers = 1GB
+wal_level = replica
+max_wal_size = 16GB
+summarize_wal = on
+EOF
+   cat <<EOF >$DATA_DIRECTORY/pg_hba.conf
+local   all              all                                     trust
+local   replication      all                                     trust
+host    postgres         repl            127.0.0.1/32            scram-sha-256
+host    postgres         repl            ::1/128                 scram-sha-256
+host    replication      repl            127.0.0.1/32            scram-sha-256
+host    replication      repl            ::1/128                 scram-sha-256
+EOF
+   pg_ctl -D $DATA_DIRECTORY -l $PGCTL_LOG_FILE start >/dev/null
+   wait_for_server_ready
+   psql -q -h /tmp -p $PORT -U $PSQL_USER -d postgres -c "CREATE ROLE repl WITH LOGIN REPLICATION PASSWORD '$PGPASSWORD';"
+   psql -q -h /tmp -p $PORT -U $PSQL_USER -d postgres -c "SELECT pg_create_physical_replication_slot('repl', true, false);" >/dev/null
+   echo "initialize cluster at $DATA_DIRECTORY on port $PORT ... ok"
+   echo ""
+}
+
+stop_cluster() {
+   if [ -d $DATA_DIRECTORY ]; then
+      pg_ctl -D $DATA_DIRECTORY -l $PGCTL_LOG_FILE stop >/dev/null 2>&1 || true
+   fi
+}
+
+clean() {
+   echo -e "\e[34mClean Benchmark Resources \e[0m"
+   if [ -d $POSTGRES_OPERATION_DIR ]; then
+      rm -r "${POSTGRES_OPERATION_DIR:?}"
+      echo "remove postgres operations directory $POSTGRES_OPERATION_DIR ... ok"
+   fi
+   if [ -d $PGMONETA_OPERATION_DIR ]; then
+      rm -r "${PGMONETA_OPERATION_DIR:?}"
+      echo "remove pgmoneta operations directory $PGMONETA_OPERATION_DIR ... ok"
+   fi
+}
+##############################################################
+
+#################### PGMONETA OPERATIONS #####################
+pgmoneta_start() {
+   local compression=$1
+   local encryption=$2
+
+   rm -rf "${BACKUP_DIRECTORY:?}" "${RESTORE_DIRECTORY:?}"
+   mkdir -p $BACKUP_DIRECTORY $RESTORE_DIRECTORY $CONFIGURATION_DIRECTORY
+   cat <<EOF >$CONFIGURATION_DIRECTORY/pgmoneta.conf
+[pgmoneta]
+host = localhost
+metrics = 0
+
+base_dir = $BACKUP_DIRECTORY
+
+compression = $compression
+encryption = $encryption
+workers = $(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 4)
+
+retention = 7
+
+log_type = file
+log_level = info
+log_path = $PGMONETA_LOG_FILE
+
+unix_socket_dir = /tmp/
+pidfile = $PIDFILE
+
+[primary]
+host = localhost
+port = $PORT
+user = repl
+wal_slot = repl
+EOF
+   if [ ! -f $CONFIGURATION_DIRECTORY/pgmoneta_users.conf ]; then
+      $EXECUTABLE_DIRECTORY/pgmoneta-admin master-key -P $PGPASSWORD >/dev/null 2>&1 || true
+      $EXECUTABLE_DIRECTORY/pgmoneta-admin -f $CONFIGURATION_DIRECTORY/pgmoneta_users.conf -U repl -P $PGPASSWORD user add >/dev/null
+   fi
+   $EXECUTABLE_DIRECTORY/pgmoneta -c $CONFIGURATION_DIRECTORY/pgmoneta.conf -u $CONFIGURATION_DIRECTORY/pgmoneta_users.conf -d
+   sleep 1
+   $EXECUTABLE_DIRECTORY/pgmoneta-cli -c $CONFIGURATION_DIRECTORY/pgmoneta.conf ping >/dev/null
+}
+
+pgmoneta_stop() {
+   if [ -f $PIDFILE ]; then
+      $EXECUTABLE_DIRECTORY/pgmoneta-cli -c $CONFIGURATION_DIRECTORY/pgmoneta.conf shutdown >/dev/null 2>&1 || true
+      sleep 1
+   fi
+}
+
+# Run a pgmoneta-cli command, and add its wall time, throughput, CPU and peak memory to the report
+measure() {
+   local scale=$1
+   local compression=$2
+   local encryption=$3
+   local operation=$4
+   local bytes=$5
+   shift 5
+
+   local start end ticks_start ticks_end status seconds mbs cpu rss
+
+   ticks_start=$(cpu_ticks)
+   start_rss_sampler
+   start=$(now)
+   set +e
+   $EXECUTABLE_DIRECTORY/pgmoneta-cli -c $CONFIGURATION_DIRECTORY/pgmoneta.conf "$@" >/dev/null 2>&1
+   status=$?
+   set -e
+   end=$(now)
+   stop_rss_sampler
+   ticks_end=$(cpu_ticks)
+
+   seconds=$(awk -v s=$start -v e=$end 'BEGIN {printf "%.3f", (e - s) / 1000000000}')
+   mbs=$(awk -v b=$bytes -v s=$seconds 'BEGIN {printf "%.1f", s > 0 ? b / 1048576 / s : 0}')
+   cpu=$(awk -v t=$((ticks_end - ticks_start)) -v h=$(getconf CLK_TCK) 'BEGIN {printf "%.2f", t / h}')
+   rss=$(cat $RSS_FILE)
+
+   if [ $status -eq 0 ]; then
+      status=ok
+   else
+      status=failed
+   fi
+
+   echo "$scale,$compression,$encryption,$operation,$seconds,$bytes,$mbs,$cpu,$rss,$status" >>$REPORT
+   if [ -n "$RESULTS" ] && [ "$status" == "ok" ]; then
+      local name="scale=$scale/compression=$compression/encryption=$encryption/$operation"
+      result "$name" time s lower $seconds
+      result "$name" throughput MB/s higher $mbs
+      result "$name" cpu s lower $cpu
+      result "$name" memory kB lower $rss
+   fi
+   printf "%-6s %-5s %-12s %-12s %8ss %8s MB/s %8s CPU s %10s kB %s\n" $scale $compression $encryption $operation $seconds $mbs $cpu $rss $status
+}
+
+# Add a result in the JSON format of pgmoneta-bench -F json, for benchcompare.sh
+result() {
+   printf '{"better":"%s","commit":"%s","environment":{"cpus":%s,"host":"%s","machine":"%s","os":"%s","release":"%s"},"metric":"%s","name":"%s","samples":1,"stddev":0,"suite":"benchsuite","timestamp":"%s","unit":"%s","value":%s}\n' \
+      $4 "${PGMONETA_COMMIT:-unknown}" $(getconf _NPROCESSORS_ONLN) "$(uname -n)" "$(uname -m)" "$OS" "$(uname -r)" \
+      $2 "$1" "$(date -u +%Y-%m-%dT%H:%M:%SZ)" $3 $5 >>$RESULTS
+}
+
+run_combination() {
+   local scale=$1
+   local compression=$2
+   local encryption=$3
+   local bytes=$4
+   local latest
+
+   pgmoneta_start $compression $encryption
+
+   measure $scale $compression $encryption backup $bytes backup primary
+
+   # change about a tenth of the accounts before the incremental backup
+   pgbench -h /tmp -p $PORT -U $PSQL_USER -n -N -t $((scale * 10000)) postgres >/dev/null 2>&1
+   latest=$(ls $BACKUP_DIRECTORY/primary/backup | grep -E '^[0-9]{14}$' | sort | tail -1)
+   measure $scale $compression $encryption incremental $bytes backup primary $latest
+
+   measure $scale $compression $encryption restore $bytes restore primary newest current $RESTORE_DIRECTORY
+   rm -rf "${RESTORE_DIRECTORY:?}"/*
+   measure $scale $compression $encryption verify $bytes verify primary oldest $RESTORE_DIRECTORY
+   measure $scale $compression $encryption archive $bytes archive primary oldest current $RESTORE_DIRECTORY
+   rm -rf "${RESTORE_DIRECTORY:?}"/*
+
+   pgmoneta_stop
+}
+
+run_benchmarks() {
+   local bytes
+
+   if [ "$FILE_OWNER" != "$USER" ]; then
+      echo "user should be $FILE_OWNER"
+      exit 1
+   fi
+
+   check_system_requirements
+
+   PORT=$(next_available_port $PORT)
+   create_cluster
+
+   echo "scale,compression,encryption,operation,seconds,bytes,mb_per_second,cpu_seconds,peak_rss_kb,status" >$REPORT
+
+   echo -e "\e[34mRun Benchmarks \e[0m"
+   for scale in ${SCALES//,/ }; do
+      pgbench -q -i -s $scale -h /tmp -p $PORT -U $PSQL_USER postgres >/dev/null 2>&1
+      psql -q -h /tmp -p $PORT -U $PSQL_USER -d postgres -c "CHECKPOINT;"
+      bytes=$(psql -At -h /tmp -p $PORT -U $PSQL_USER -d postgres -c "SELECT sum(pg_database_size(oid)) FROM pg_database;")
+
+      for compression in ${COMPRESSIONS//,/ }; do
+         for encryption in ${ENCRYPTIONS//,/ }; do
+            run_combination $scale $compression $encryption $bytes
+         done
+      done
+   done
+   echo ""
+
+   stop_cluster
+   clean
+   echo "report ... $REPORT"
+   if [ -n "$RESULTS" ]; then
+      echo "results ... $RESULTS"
+   fi
+}
+
+usage() {
+   echo "Usage: $0 [-s SCALES] [-c COMPRESSIONS] [-e ENCRYPTIONS] [-o REPORT] [-j RESULTS] [clean]"
+   echo "Options:"
+   echo " -s SCALES        pgbench scale factors, default $SCALES"
+   echo " -c COMPRESSIONS  compression methods, default $COMPRESSIONS"
+   echo " -e ENCRYPTIONS   encryption modes, default $ENCRYPTIONS"
+   echo " -o REPORT        CSV report, default $REPORT"
+   echo " -j RESULTS       also append the results as JSON lines, see benchcompare.sh"
+   echo "Subcommand:"
+   echo " clean            clean up benchmark environment"
+   exit 1
+}
+
+while getopts "s:c:e:o:j:h" option; do
+   case $option in
+      s) SCALES=$OPTARG ;;
+      c) COMPRESSIONS=$OPTARG ;;
+      e) ENCRYPTIONS=$OPTARG ;;
+      o) REPORT=$(realpath -m "$OPTARG") ;;
+      j) RESULTS=$(realpath -m "$OPTARG") ;;
+      *) usage ;;
+   esac
+done
+shift $((OPTIND - 1))
+
+if [ $# -gt 1 ]; then
+   usage
+elif [ $# -eq 1 ]; then
+   if [ "$1" == "clean" ]; then
+      stop_cluster
+      clean
+   else
+      echo "Invalid parameter: $1"
+      usage
+   fi
+else
+   trap 'pgmoneta_stop; stop_cluster' EXIT
+   run_benchmarks
+fi
@@ -36,6 +36,7 @@ extern "C" {
 
 #include <json.h>
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -95,6 +96,25 @@ pgmoneta_tsclient_execute_restore(char* server, char* backup_id, char* position)
 int
 pgmoneta_tsclient_execute_delete(char* server, char* backup_id);
 
+/**
+ * Execute delete command on the server, and report whether the backup was deleted
+ * @param server the server to perform delete on
+ * @param backup_id the backup_id to delete
+ * @param deleted the status of the outcome, true if the backup was deleted
+ * @return 0 if the outcome was received, otherwise 1
+ */
+int
+pgmoneta_tsclient_execute_delete_status(char* server, char* backup_id, bool* deleted);
+
+/**
+ * Get the number of backups of a server, including a backup in progress
+ * @param server the server
+ * @param number_of_backups the number of backups
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgmoneta_tsclient_number_of_backups(char* server, int* number_of_backups);
+
 #ifdef __cplusplus
 }
 #endif
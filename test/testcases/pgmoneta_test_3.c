@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <tsclient.h>
+
+#include "pgmoneta_test_3.h"
+
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+// test delete of the newest backup while a backup links to it
+START_TEST(test_pgmoneta_delete_during_backup)
+{
+   int found = 0;
+   int status = 0;
+   int before = 0;
+   int current = 0;
+   bool deleted = false;
+   bool done = false;
+   pid_t pid;
+
+   found = !pgmoneta_tsclient_execute_backup("primary", NULL);
+   ck_assert_msg(found, "success status not found");
+
+   ck_assert_msg(!pgmoneta_tsclient_number_of_backups("primary", &before), "backups not found");
+
+   pid = fork();
+   ck_assert_msg(pid != -1, "fork failed");
+
+   if (pid == 0)
+   {
+      _exit(pgmoneta_tsclient_execute_backup("primary", NULL));
+   }
+
+   // wait until the backup is in progress, or already done
+   for (int i = 0; i < 600 && current <= before && !done; i++)
+   {
+      usleep(100000);
+      done = waitpid(pid, &status, WNOHANG) == pid;
+      ck_assert_msg(!pgmoneta_tsclient_number_of_backups("primary", &current), "backups not found");
+   }
+   ck_assert_msg(current > before, "backup not started");
+
+   // the delete either fails on the lock of the backup or happens before the link
+   ck_assert_msg(!pgmoneta_tsclient_execute_delete_status("primary", "newest", &deleted), "delete outcome not found");
+
+   if (!done)
+   {
+      ck_assert_msg(waitpid(pid, &status, 0) == pid, "waitpid failed");
+   }
+   ck_assert_msg(WIFEXITED(status) && WEXITSTATUS(status) == 0, "backup failed");
+
+   ck_assert_msg(!pgmoneta_tsclient_number_of_backups("primary", &current), "backups not found");
+   ck_assert_msg(current == (deleted ? before : before + 1), "delete outcome does not match the backups");
+
+   found = !pgmoneta_tsclient_execute_restore("primary", "newest", "current");
+   ck_assert_msg(found, "success status not found");
+}
+END_TEST
+
+Suite*
+pgmoneta_test3_suite()
+{
+   Suite* s;
+   TCase* tc_core;
+   s = suite_create("pgmoneta_test3");
+
+   tc_core = tcase_create("Core");
+
+   tcase_set_timeout(tc_core, 120);
+   tcase_add_test(tc_core, test_pgmoneta_delete_during_backup);
+   suite_add_tcase(s, tc_core);
+
+   return s;
+}
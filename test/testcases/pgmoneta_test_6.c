@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <pgmoneta.h>
+#include <deque.h>
+#include <value.h>
+
+#include "pgmoneta_test_6.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TEST_PRODUCERS 8
+#define TEST_NODES 20000
+
+struct producer_input
+{
+   struct deque* deque;
+   int producer;
+   atomic_int* failures;
+};
+
+static void*
+test_produce(void* arg)
+{
+   struct producer_input* input = (struct producer_input*)arg;
+   char tag[32];
+
+   snprintf(tag, sizeof(tag), "producer-%d", input->producer);
+
+   // the value holds the producer and its sequence, starting at 1 so it is never 0
+   for (uint64_t i = 1; i <= TEST_NODES; i++)
+   {
+      if (pgmoneta_deque_add(input->deque, tag, ((uint64_t)input->producer << 32) | i, ValueUInt64))
+      {
+         atomic_fetch_add(input->failures, 1);
+      }
+   }
+
+   return NULL;
+}
+
+// test that the nodes of each producer of a thread safe deque keep their order
+START_TEST(test_pgmoneta_deque_producers)
+{
+   struct deque* deque = NULL;
+   struct producer_input inputs[TEST_PRODUCERS];
+   pthread_t threads[TEST_PRODUCERS];
+   uint64_t last[TEST_PRODUCERS];
+   atomic_int failures;
+   uint64_t value;
+   uint64_t producer;
+   uint64_t sequence;
+   uint64_t count = 0;
+   char expected[32];
+   char* tag = NULL;
+
+   atomic_init(&failures, 0);
+   memset(last, 0, sizeof(last));
+
+   ck_assert_msg(!pgmoneta_deque_create(true, &deque), "create failed");
+
+   for (int i = 0; i < TEST_PRODUCERS; i++)
+   {
+      inputs[i].deque = deque;
+      inputs[i].producer = i;
+      inputs[i].failures = &failures;
+      ck_assert_msg(!pthread_create(&threads[i], NULL, test_produce, &inputs[i]), "pthread_create failed");
+   }
+
+   // consume while the producers add, so the inbox is moved into the deque many times
+   while (count < (uint64_t)TEST_PRODUCERS * TEST_NODES)
+   {
+      tag = NULL;
+      value = (uint64_t)pgmoneta_deque_poll(deque, &tag);
+      if (value == 0)
+      {
+         continue;
+      }
+
+      producer = value >> 32;
+      sequence = value & 0xFFFFFFFF;
+
+      ck_assert_uint_lt(producer, TEST_PRODUCERS);
+      ck_assert_uint_eq(sequence, last[producer] + 1);
+
+      snprintf(expected, sizeof(expected), "producer-%d", (int)producer);
+      ck_assert_ptr_nonnull(tag);
+      ck_assert_str_eq(tag, expected);
+      free(tag);
+
+      last[producer] = sequence;
+      count++;
+   }
+
+   for (int i = 0; i < TEST_PRODUCERS; i++)
+   {
+      pthread_join(threads[i], NULL);
+      ck_assert_uint_eq(last[i], TEST_NODES);
+   }
+
+   ck_assert_int_eq(atomic_load(&failures), 0);
+   ck_assert_uint_eq(pgmoneta_deque_size(deque), 0);
+
+   pgmoneta_deque_destroy(deque);
+}
+END_TEST
+// test that nodes added concurrently are all seen by size and iteration
+START_TEST(test_pgmoneta_deque_producers_iterate)
+{
+   struct deque* deque = NULL;
+   struct deque_iterator* iter = NULL;
+   struct producer_input inputs[TEST_PRODUCERS];
+   pthread_t threads[TEST_PRODUCERS];
+   uint64_t last[TEST_PRODUCERS];
+   atomic_int failures;
+   uint64_t value;
+   uint64_t producer;
+
+   atomic_init(&failures, 0);
+   memset(last, 0, sizeof(last));
+
+   ck_assert_msg(!pgmoneta_deque_create(true, &deque), "create failed");
+
+   for (int i = 0; i < TEST_PRODUCERS; i++)
+   {
+      inputs[i].deque = deque;
+      inputs[i].producer = i;
+      inputs[i].failures = &failures;
+      ck_assert_msg(!pthread_create(&threads[i], NULL, test_produce, &inputs[i]), "pthread_create failed");
+   }
+
+   for (int i = 0; i < TEST_PRODUCERS; i++)
+   {
+      pthread_join(threads[i], NULL);
+   }
+
+   ck_assert_int_eq(atomic_load(&failures), 0);
+   ck_assert_uint_eq(pgmoneta_deque_size(deque), TEST_PRODUCERS * TEST_NODES);
+
+   ck_assert_msg(!pgmoneta_deque_iterator_create(deque, &iter), "iterator_create failed");
+   while (pgmoneta_deque_iterator_next(iter))
+   {
+      value = (uint64_t)pgmoneta_value_data(iter->value);
+      producer = value >> 32;
+
+      ck_assert_uint_lt(producer, TEST_PRODUCERS);
+      ck_assert_uint_eq(value & 0xFFFFFFFF, last[producer] + 1);
+
+      last[producer]++;
+   }
+   pgmoneta_deque_iterator_destroy(iter);
+
+   for (int i = 0; i < TEST_PRODUCERS; i++)
+   {
+      ck_assert_uint_eq(last[i], TEST_NODES);
+   }
+
+   pgmoneta_deque_destroy(deque);
+}
+END_TEST
+
+Suite*
+pgmoneta_test6_suite()
+{
+   Suite* s;
+   TCase* tc_core;
+   s = suite_create("pgmoneta_test6");
+
+   tc_core = tcase_create("Core");
+
+   tcase_set_timeout(tc_core, 60);
+   tcase_add_test(tc_core, test_pgmoneta_deque_producers);
+   tcase_add_test(tc_core, test_pgmoneta_deque_producers_iterate);
+   suite_add_tcase(s, tc_core);
+
+   return s;
+}
@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <pgmoneta.h>
+#include <utils.h>
+#include <wal.h>
+#include <workers.h>
+
+#include "pgmoneta_test_7.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#define TEST_SEGMENT "000000010000000000000001"
+
+struct block_input
+{
+   struct worker_common common;
+   atomic_bool* release;
+};
+
+static void
+test_block(struct worker_common* wc)
+{
+   struct block_input* bi = (struct block_input*)wc;
+
+   while (!atomic_load(bi->release))
+   {
+      usleep(1000);
+   }
+}
+
+static void
+test_server_directories(char* base, int srv, char* directory, char* queue)
+{
+   FILE* file = NULL;
+   char path[MAX_PATH];
+
+   snprintf(directory, MAX_PATH, "%s/%d/wal/", base, srv);
+   snprintf(queue, MAX_PATH, "%s/%d/wal_upload/", base, srv);
+
+   ck_assert_msg(!pgmoneta_mkdir(directory), "mkdir failed");
+   ck_assert_msg(!pgmoneta_mkdir(queue), "mkdir failed");
+
+   snprintf(path, sizeof(path), "%s%s", directory, TEST_SEGMENT);
+   file = fopen(path, "w");
+   ck_assert_ptr_nonnull(file);
+   fclose(file);
+}
+
+static bool
+test_queued(char* queue)
+{
+   char path[MAX_PATH];
+
+   snprintf(path, sizeof(path), "%s%s", queue, TEST_SEGMENT);
+
+   return pgmoneta_exists(path);
+}
+
+// test that a waiting upload of one server doesn't hold back the upload of another
+START_TEST(test_pgmoneta_wal_upload_multiplex)
+{
+   char base[] = "/tmp/pgmoneta_test_7_XXXXXX";
+   char directory[2][MAX_PATH];
+   char queue[2][MAX_PATH];
+   struct workers* workers[2] = {NULL, NULL};
+   struct block_input block;
+   atomic_bool release;
+
+   ck_assert_ptr_nonnull(mkdtemp(base));
+
+   // the receivers of a multiplexed process each have their own upload worker
+   for (int i = 0; i < 2; i++)
+   {
+      test_server_directories(base, i, directory[i], queue[i]);
+      ck_assert_msg(!pgmoneta_workers_initialize(1, &workers[i]), "workers failed");
+   }
+
+   // the upload of the first server is queued behind a busy worker
+   atomic_init(&release, false);
+   memset(&block, 0, sizeof(block));
+   block.common.workers = workers[0];
+   block.release = &release;
+   ck_assert_msg(!pgmoneta_workers_add(workers[0], test_block, (struct worker_common*)&block), "add failed");
+
+   pgmoneta_wal_upload(workers[0], 0, directory[0], queue[0], TEST_SEGMENT);
+   ck_assert_msg(test_queued(queue[0]), "segment of the first server not queued");
+
+   // the second server still uploads its segment
+   pgmoneta_wal_upload(workers[1], 1, directory[1], queue[1], TEST_SEGMENT);
+   pgmoneta_workers_wait(workers[1]);
+   ck_assert_msg(!test_queued(queue[1]), "segment of the second server not uploaded");
+   ck_assert_msg(test_queued(queue[0]), "segment of the first server uploaded too early");
+
+   atomic_store(&release, true);
+   pgmoneta_workers_wait(workers[0]);
+   ck_assert_msg(!test_queued(queue[0]), "segment of the first server not uploaded");
+
+   for (int i = 0; i < 2; i++)
+   {
+      pgmoneta_workers_destroy(workers[i]);
+   }
+
+   pgmoneta_delete_directory(base);
+}
+END_TEST
+
+Suite*
+pgmoneta_test7_suite()
+{
+   Suite* s;
+   TCase* tc_core;
+   s = suite_create("pgmoneta_test7");
+
+   tc_core = tcase_create("Core");
+
+   tcase_set_timeout(tc_core, 60);
+   tcase_add_test(tc_core, test_pgmoneta_wal_upload_multiplex);
+   suite_add_tcase(s, tc_core);
+
+   return s;
+}
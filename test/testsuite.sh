@@ -54,6 +54,11 @@ RESTORE_DIRECTORY=$PGMONETA_OPERATION_DIR/restore
 BACKUP_DIRECTORY=$PGMONETA_OPERATION_DIR/backup
 CONFIGURATION_DIRECTORY=$PGMONETA_OPERATION_DIR/conf
 
+BENCH_DIRECTORY=$(pwd)/pgmoneta-bench
+BENCH_RESULTS=$(pwd)/bench-results.jsonl
+BENCH_BASELINE=$(pwd)/bench-baseline.jsonl
+BENCH_RUNS=${BENCH_RUNS:-3}
+
 PSQL_USER=$USER
 if [ "$OS" = "FreeBSD" ]; then
   PSQL_USER=postgres
@@ -608,14 +613,57 @@ run_tests() {
    fi
 }
 
+# Run the benchmarks BENCH_RUNS times, and compare them with the baseline, or keep them as the baseline
+run_bench() {
+   local baseline=${1:-$BENCH_BASELINE}
+   local bench=$TEST_DIRECTORY/pgmoneta-bench
+
+   if [ ! -x $bench ]; then
+      echo "$bench not found, build it with 'make pgmoneta-bench'"
+      exit 1
+   fi
+
+   export PGMONETA_COMMIT=${PGMONETA_COMMIT:-$(git -C $PROJECT_DIRECTORY rev-parse --short HEAD 2>/dev/null || echo unknown)}
+
+   rm -rf $BENCH_DIRECTORY $BENCH_RESULTS
+   mkdir -p $BENCH_DIRECTORY
+
+   for run in $(seq 1 $BENCH_RUNS); do
+      echo "benchmark run $run of $BENCH_RUNS ..."
+      $bench -F json -d $BENCH_DIRECTORY -a zstd,lz4 -l 1,3 -s 16 >>$BENCH_RESULTS
+      $bench -F json -d $BENCH_DIRECTORY -m 100000 >>$BENCH_RESULTS
+      $bench -F json -d $BENCH_DIRECTORY -K 1000,100000 >>$BENCH_RESULTS
+      $bench -F json -d $BENCH_DIRECTORY -R 10,100 >>$BENCH_RESULTS
+   done
+
+   if [ -n "$BENCHSUITE_SCALES" ]; then
+      mkdir -p $LOG_DIRECTORY
+      $PROJECT_DIRECTORY/benchsuite.sh -s $BENCHSUITE_SCALES -o $LOG_DIRECTORY/benchsuite.csv -j $BENCH_RESULTS
+   fi
+
+   rm -rf $BENCH_DIRECTORY
+   echo "results ... $BENCH_RESULTS"
+
+   if [ -f "$baseline" ]; then
+      $PROJECT_DIRECTORY/benchcompare.sh "$baseline" $BENCH_RESULTS
+   else
+      cp $BENCH_RESULTS "$baseline"
+      echo "baseline ... $baseline"
+   fi
+}
+
 usage() {
    echo "Usage: $0 [sub-command]"
    echo "Subcommand:"
    echo " clean           clean up test suite environment"
+   echo " bench [BASELINE] run the benchmarks, and compare them with BASELINE, default $BENCH_BASELINE,"
+   echo "                  or store them as BASELINE when it doesn't exist"
    exit 1
 }
 
-if [ $# -gt 1 ]; then
+if [ "$1" == "bench" ] && [ $# -le 2 ]; then
+   run_bench "$2"
+elif [ $# -gt 1 ]; then
    usage # More than one argument, show usage and exit
 elif [ $# -eq 1 ]; then
    if [ "$1" == "clean" ]; then
@@ -53,6 +53,7 @@
 char project_directory[BUFFER_SIZE];
 
 static int check_output_outcome(int socket);
+static int check_output_status(int socket, bool* status);
 static int get_connection();
 static char* get_configuration_path();
 static char* get_restore_path();
@@ -217,6 +218,87 @@ error:
     return 1;
 }
 
+int
+pgmoneta_tsclient_execute_delete_status(char* server, char* backup_id, bool* deleted)
+{
+    int socket = -1;
+
+    *deleted = false;
+
+    socket = get_connection();
+    // Security Checks
+    if (!pgmoneta_socket_isvalid(socket) || server == NULL || backup_id == NULL)
+    {
+        return 1;
+    }
+
+    // Create a delete request to the main server
+    if (pgmoneta_management_request_delete(NULL, socket, server, backup_id, MANAGEMENT_COMPRESSION_NONE, MANAGEMENT_ENCRYPTION_NONE, MANAGEMENT_OUTPUT_FORMAT_JSON))
+    {
+        goto error;
+    }
+
+    // The status of the outcome tells whether the backup was deleted
+    if (check_output_status(socket, deleted))
+    {
+        goto error;
+    }
+
+    pgmoneta_disconnect(socket);
+    return 0;
+error:
+    pgmoneta_disconnect(socket);
+    return 1;
+}
+
+int
+pgmoneta_tsclient_number_of_backups(char* server, int* number_of_backups)
+{
+    int srv = -1;
+    int number_of_directories = 0;
+    char** dirs = NULL;
+    char* d = NULL;
+    struct main_configuration* config;
+
+    config = (struct main_configuration*)shmem;
+
+    *number_of_backups = 0;
+
+    for (int i = 0; srv == -1 && i < config->common.number_of_servers; i++)
+    {
+        if (!strcmp(config->common.servers[i].name, server))
+        {
+            srv = i;
+        }
+    }
+
+    if (srv == -1)
+    {
+        goto error;
+    }
+
+    // Every backup, including one in progress, has a directory
+    d = pgmoneta_get_server_backup(srv);
+    if (pgmoneta_get_directories(d, &number_of_directories, &dirs))
+    {
+        goto error;
+    }
+
+    for (int i = 0; i < number_of_directories; i++)
+    {
+        free(dirs[i]);
+    }
+    free(dirs);
+    free(d);
+
+    *number_of_backups = number_of_directories;
+
+    return 0;
+error:
+    free(d);
+    return 1;
+}
+
 static int 
 check_output_outcome(int socket)
 {
@@ -246,6 +328,39 @@ error:
     return 1;
 }
 
+static int
+check_output_status(int socket, bool* status)
+{
+    struct json* read = NULL;
+    struct json* outcome = NULL;
+
+    *status = false;
+
+    if (pgmoneta_management_read_json(NULL, socket, NULL, NULL, &read))
+    {
+        goto error;
+    }
+
+    if (!pgmoneta_json_contains_key(read, MANAGEMENT_CATEGORY_OUTCOME))
+    {
+        goto error;
+    }
+
+    outcome = (struct json*)pgmoneta_json_get(read, MANAGEMENT_CATEGORY_OUTCOME);
+    if (!pgmoneta_json_contains_key(outcome, MANAGEMENT_ARGUMENT_STATUS))
+    {
+        goto error;
+    }
+
+    *status = (bool)pgmoneta_json_get(outcome, MANAGEMENT_ARGUMENT_STATUS);
+
+    pgmoneta_json_destroy(read);
+    return 0;
+error:
+    pgmoneta_json_destroy(read);
+    return 1;
+}
+
 static int
 get_connection()
 {
@@ -0,0 +1,1084 @@
+/*
+ * Copyright (C) 2025 The pgmoneta community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgmoneta */
+#include <pgmoneta.h>
+#include <cmd.h>
+#include <configuration.h>
+#include <logging.h>
+#include <network.h>
+#include <shmem.h>
+#include <utils.h>
+
+/* system */
+#include <dirent.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define WALLOAD_DEFAULT_PORT         5433
+#define WALLOAD_DEFAULT_MESSAGE_SIZE (128 * 1024)
+#define WALLOAD_DEFAULT_VERSION      17
+#define WALLOAD_SEGMENT_SIZE         (16 * 1024 * 1024)
+#define WALLOAD_PAGE_SIZE            8192
+#define WALLOAD_MAX_MESSAGE          (1024 * 1024)
+#define WALLOAD_MAX_PENDING          65536
+#define WALLOAD_MAX_SAMPLES          65536
+#define WALLOAD_START_LSN            0x1000000ULL
+#define WALLOAD_MAX_FDS              8
+
+/* Microseconds between the Unix and the PostgreSQL epoch */
+#define WALLOAD_EPOCH_OFFSET 946684800000000LL
+
+/** @struct walload_options
+ * Defines the options of the load
+ */
+struct walload_options
+{
+   int version;          /**< The PostgreSQL major version to announce */
+   double rate;          /**< The rate in MB/s, 0 is unlimited */
+   size_t message_size;  /**< The WAL bytes per XLogData message */
+   int duration;         /**< The seconds to stream, 0 is until the client disconnects */
+   char* data;           /**< The WAL to replay */
+   size_t data_size;     /**< The size of the WAL, a multiple of the segment size */
+};
+
+/** @struct walload_pending
+ * Defines a message that is not reported as flushed yet
+ */
+struct walload_pending
+{
+   uint64_t lsn;   /**< The end LSN of the message */
+   double sent;    /**< The time the message was sent */
+};
+
+/** @struct walload_stream
+ * Defines the state of a replication stream
+ */
+struct walload_stream
+{
+   uint64_t start_lsn;                                /**< The LSN the stream started at */
+   uint64_t sent_lsn;                                 /**< The LSN sent */
+   uint64_t written_lsn;                              /**< The LSN last reported as written */
+   uint64_t flushed_lsn;                              /**< The LSN last reported as flushed */
+   double last_report;                                /**< The time of the last status report */
+   struct walload_pending pending[WALLOAD_MAX_PENDING]; /**< The messages that are not flushed */
+   int pending_head;                                  /**< The oldest pending message */
+   int pending_count;                                 /**< The number of pending messages */
+   double samples[WALLOAD_MAX_SAMPLES];               /**< The flush latencies of the interval */
+   int number_of_samples;                             /**< The number of flush latencies */
+   uint64_t reports;                                  /**< The status reports of the interval */
+};
+
+static volatile sig_atomic_t running = 1;
+
+static void walload_signal(int signum);
+static int walload_generate(struct walload_options* options);
+static int walload_capture(char* path, struct walload_options* options);
+static void walload_session(int fd, struct walload_options* options);
+static int walload_read(int fd, void* buffer, size_t size);
+static int walload_write(int fd, void* buffer, size_t size);
+static int walload_read_message(int fd, char* kind, char* buffer, size_t* size);
+static int walload_send(int fd, char kind, void* payload, size_t size);
+static int walload_ready(int fd);
+static int walload_result(int fd, char** names, char** values, int columns);
+static int walload_error(int fd, char* message);
+static int walload_query(int fd, char* query, struct walload_options* options);
+static int walload_stream(int fd, uint64_t lsn, struct walload_options* options);
+static int walload_status(struct walload_stream* stream, char* buffer, size_t size);
+static void walload_interval(struct walload_stream* stream, double elapsed, uint64_t sent);
+static int walload_compare(const void* a, const void* b);
+static int64_t walload_timestamp(void);
+static double walload_now(void);
+
+static void
+version(void)
+{
+   printf("pgmoneta-walload %s\n", VERSION);
+   exit(1);
+}
+
+static void
+usage(void)
+{
+   printf("pgmoneta-walload %s\n", VERSION);
+   printf("  Act as a PostgreSQL primary and stream WAL into pgmoneta at a controlled rate\n");
+   printf("\n");
+
+   printf("Usage:\n");
+   printf("  pgmoneta-walload [ -p PORT ] [ -r RATE ] [ -m SIZE ] [ -t SECONDS ] [ -w PATH ] [ -v VERSION ]\n");
+   printf("\n");
+   printf("Options:\n");
+   printf("  -p, --port            The port to listen on. Default is %d\n", WALLOAD_DEFAULT_PORT);
+   printf("  -r, --rate            The WAL rate in MB/s per stream, 0 is unlimited. Default is 0\n");
+   printf("  -m, --message         The WAL bytes per XLogData message. Default is %d\n", WALLOAD_DEFAULT_MESSAGE_SIZE);
+   printf("  -t, --time            The seconds to stream, 0 is until pgmoneta disconnects. Default is 0\n");
+   printf("  -w, --wal             Replay a captured WAL segment, or a directory of them, instead of generated WAL\n");
+   printf("  -v, --server-version  The PostgreSQL major version to announce. Default is %d\n", WALLOAD_DEFAULT_VERSION);
+   printf("  -V, --version         Display version information\n");
+   printf("  -?, --help            Display help\n");
+   printf("\n");
+   printf("pgmoneta: %s\n", PGMONETA_HOMEPAGE);
+   printf("Report bugs: %s\n", PGMONETA_ISSUES);
+}
+
+int
+main(int argc, char** argv)
+{
+   int port = WALLOAD_DEFAULT_PORT;
+   char* wal = NULL;
+   char* filename = NULL;
+   int optind = 0;
+   int num_results = 0;
+   int num_options = 0;
+   int* fds = NULL;
+   int length = 0;
+   size_t shmem_size;
+   struct walload_options options;
+   struct main_configuration* config = NULL;
+   struct pollfd pfds[WALLOAD_MAX_FDS];
+
+   cli_option cli_options[] = {
+      {"p", "port", true},
+      {"r", "rate", true},
+      {"m", "message", true},
+      {"t", "time", true},
+      {"w", "wal", true},
+      {"v", "server-version", true},
+      {"V", "version", false},
+      {"?", "help", false},
+   };
+
+   memset(&options, 0, sizeof(options));
+   options.version = WALLOAD_DEFAULT_VERSION;
+   options.message_size = WALLOAD_DEFAULT_MESSAGE_SIZE;
+
+   num_options = sizeof(cli_options) / sizeof(cli_options[0]);
+   cli_result results[num_options];
+
+   num_results = cmd_parse(argc, argv, cli_options, num_options, results, num_options, false, &filename, &optind);
+
+   if (num_results < 0)
+   {
+      errx(1, "Error parsing command line\n");
+      return 1;
+   }
+
+   shmem_size = sizeof(struct main_configuration);
+   if (pgmoneta_create_shared_memory(shmem_size, HUGEPAGE_OFF, &shmem))
+   {
+      errx(1, "Error creating shared memory");
+   }
+
+   pgmoneta_init_main_configuration(shmem);
+   config = (struct main_configuration*)shmem;
+   config->common.log_type = PGMONETA_LOGGING_TYPE_CONSOLE;
+   config->common.log_level = PGMONETA_LOGGING_LEVEL_FATAL;
+
+   for (int i = 0; i < num_results; i++)
+   {
+      char* optname = results[i].option_name;
+      char* optarg = results[i].argument;
+
+      if (optname == NULL)
+      {
+         break;
+      }
+      else if (!strcmp(optname, "p") || !strcmp(optname, "port"))
+      {
+         port = atoi(optarg);
+      }
+      else if (!strcmp(optname, "r") || !strcmp(optname, "rate"))
+      {
+         options.rate = atof(optarg);
+      }
+      else if (!strcmp(optname, "m") || !strcmp(optname, "message"))
+      {
+         options.message_size = (size_t)MIN(MAX(atol(optarg), 1), WALLOAD_MAX_MESSAGE);
+      }
+      else if (!strcmp(optname, "t") || !strcmp(optname, "time"))
+      {
+         options.duration = atoi(optarg);
+      }
+      else if (!strcmp(optname, "w") || !strcmp(optname, "wal"))
+      {
+         wal = optarg;
+      }
+      else if (!strcmp(optname, "v") || !strcmp(optname, "server-version"))
+      {
+         options.version = atoi(optarg);
+      }
+      else if (!strcmp(optname, "V") || !strcmp(optname, "version"))
+      {
+         version();
+      }
+      else if (!strcmp(optname, "?") || !strcmp(optname, "help"))
+      {
+         usage();
+         exit(0);
+      }
+   }
+
+   if (port <= 0 || options.version < 13)
+   {
+      usage();
+      goto error;
+   }
+
+   if (wal != NULL ? walload_capture(wal, &options) : walload_generate(&options))
+   {
+      warnx("Could not prepare the WAL");
+      goto error;
+   }
+
+   if (pgmoneta_bind("localhost", port, &fds, &length) || length == 0)
+   {
+      warnx("Could not bind to localhost:%d", port);
+      goto error;
+   }
+
+   signal(SIGINT, walload_signal);
+   signal(SIGTERM, walload_signal);
+   signal(SIGPIPE, SIG_IGN);
+
+   printf("Listening on localhost:%d with %zu MB of WAL, %s MB/s, %zu byte messages\n", port,
+          options.data_size / (1024 * 1024), options.rate > 0 ? "limited to the given" : "unlimited", options.message_size);
+   fflush(stdout);
+
+   for (int i = 0; i < length && i < WALLOAD_MAX_FDS; i++)
+   {
+      pfds[i].fd = fds[i];
+      pfds[i].events = POLLIN;
+   }
+
+   /* Each connection of pgmoneta gets a process, like the backends of PostgreSQL */
+   while (running)
+   {
+      if (poll(pfds, MIN(length, WALLOAD_MAX_FDS), 1000) <= 0)
+      {
+         while (waitpid(-1, NULL, WNOHANG) > 0)
+         {
+         }
+         continue;
+      }
+
+      for (int i = 0; i < length && i < WALLOAD_MAX_FDS; i++)
+      {
+         int client;
+         pid_t pid;
+
+         if (!(pfds[i].revents & POLLIN))
+         {
+            continue;
+         }
+
+         client = accept(fds[i], NULL, NULL);
+         if (client == -1)
+         {
+            continue;
+         }
+
+         fcntl(client, F_SETFL, fcntl(client, F_GETFL) & ~O_NONBLOCK);
+
+         pid = fork();
+         if (pid == 0)
+         {
+            for (int j = 0; j < length; j++)
+            {
+               close(fds[j]);
+            }
+
+            walload_session(client, &options);
+
+            close(client);
+            exit(0);
+         }
+
+         close(client);
+      }
+   }
+
+   for (int i = 0; i < length; i++)
+   {
+      close(fds[i]);
+   }
+   free(fds);
+   free(options.data);
+
+   pgmoneta_destroy_shared_memory(shmem, shmem_size);
+
+   return 0;
+
+error:
+
+   free(fds);
+   free(options.data);
+
+   pgmoneta_destroy_shared_memory(shmem, shmem_size);
+
+   return 1;
+}
+
+static void
+walload_signal(int signum __attribute__((unused)))
+{
+   running = 0;
+}
+
+static int
+walload_generate(struct walload_options* options)
+{
+   uint64_t seed = 0x9E3779B97F4A7C15ULL;
+
+   /* Four segments of pages that are half random and half zero, about as compressible as a busy primary */
+   options->data_size = 4 * WALLOAD_SEGMENT_SIZE;
+   options->data = (char*)malloc(options->data_size);
+   if (options->data == NULL)
+   {
+      return 1;
+   }
+
+   memset(options->data, 0, options->data_size);
+
+   for (size_t page = 0; page < options->data_size; page += WALLOAD_PAGE_SIZE)
+   {
+      for (size_t i = 0; i < WALLOAD_PAGE_SIZE / 2; i += sizeof(uint64_t))
+      {
+         seed ^= seed << 13;
+         seed ^= seed >> 7;
+         seed ^= seed << 17;
+         memcpy(options->data + page + i, &seed, sizeof(uint64_t));
+      }
+   }
+
+   return 0;
+}
+
+static int
+walload_capture(char* path, struct walload_options* options)
+{
+   int fd = -1;
+   DIR* dir = NULL;
+   struct dirent* entry;
+   struct stat st;
+   char file[MAX_PATH];
+   size_t offset = 0;
+
+   if (stat(path, &st))
+   {
+      return 1;
+   }
+
+   if (S_ISDIR(st.st_mode))
+   {
+      dir = opendir(path);
+      if (dir == NULL)
+      {
+         return 1;
+      }
+   }
+
+   while (true)
+   {
+      if (dir != NULL)
+      {
+         entry = readdir(dir);
+         if (entry == NULL)
+         {
+            break;
+         }
+
+         snprintf(&file[0], sizeof(file), "%s/%s", path, entry->d_name);
+         if (stat(&file[0], &st) || !S_ISREG(st.st_mode) || st.st_size != WALLOAD_SEGMENT_SIZE)
+         {
+            continue;
+         }
+      }
+      else
+      {
+         snprintf(&file[0], sizeof(file), "%s", path);
+         if (st.st_size != WALLOAD_SEGMENT_SIZE)
+         {
+            warnx("%s is not an uncompressed 16MB WAL segment", path);
+            return 1;
+         }
+      }
+
+      options->data = (char*)realloc(options->data, offset + WALLOAD_SEGMENT_SIZE);
+      if (options->data == NULL)
+      {
+         goto error;
+      }
+
+      fd = open(&file[0], O_RDONLY);
+      if (fd == -1 || walload_read(fd, options->data + offset, WALLOAD_SEGMENT_SIZE))
+      {
+         goto error;
+      }
+      close(fd);
+      fd = -1;
+
+      offset += WALLOAD_SEGMENT_SIZE;
+
+      if (dir == NULL)
+      {
+         break;
+      }
+   }
+
+   if (dir != NULL)
+   {
+      closedir(dir);
+   }
+
+   options->data_size = offset;
+
+   return offset > 0 ? 0 : 1;
+
+error:
+
+   if (fd != -1)
+   {
+      close(fd);
+   }
+   if (dir != NULL)
+   {
+      closedir(dir);
+   }
+
+   return 1;
+}
+
+static void
+walload_session(int fd, struct walload_options* options)
+{
+   char kind;
+   char buffer[WALLOAD_MAX_MESSAGE];
+   char version[MISC_LENGTH];
+   size_t size;
+   int32_t length;
+   int32_t code;
+   char n = 'N';
+   char ok[4];
+   char key[8];
+
+   /* The startup message, after an optional SSL request that is declined */
+   while (true)
+   {
+      if (walload_read(fd, &length, sizeof(length)))
+      {
+         return;
+      }
+
+      length = pgmoneta_read_int32(&length);
+      if (length < 8 || length > (int32_t)sizeof(buffer))
+      {
+         return;
+      }
+
+      if (walload_read(fd, &buffer[0], length - 4))
+      {
+         return;
+      }
+
+      code = pgmoneta_read_int32(&buffer[0]);
+      if (code == 80877103)
+      {
+         if (walload_write(fd, &n, 1))
+         {
+            return;
+         }
+         continue;
+      }
+
+      break;
+   }
+
+   /* Trust, as the load is about the stream and not the authentication */
+   pgmoneta_write_int32(&ok[0], 0);
+   if (walload_send(fd, 'R', &ok[0], sizeof(ok)))
+   {
+      return;
+   }
+
+   memset(&version[0], 0, sizeof(version));
+   size = snprintf(&version[0], sizeof(version), "server_version%c%d.0", '\0', options->version) + 1;
+   if (walload_send(fd, 'S', &version[0], size))
+   {
+      return;
+   }
+
+   memset(&key[0], 0, sizeof(key));
+   pgmoneta_write_int32(&key[0], getpid());
+   if (walload_send(fd, 'K', &key[0], sizeof(key)) || walload_ready(fd))
+   {
+      return;
+   }
+
+   while (running)
+   {
+      if (walload_read_message(fd, &kind, &buffer[0], &size))
+      {
+         return;
+      }
+
+      if (kind == 'X')
+      {
+         return;
+      }
+      else if (kind == 'Q')
+      {
+         buffer[MIN(size, sizeof(buffer) - 1)] = '\0';
+         if (walload_query(fd, &buffer[0], options))
+         {
+            return;
+         }
+      }
+   }
+}
+
+static int
+walload_read(int fd, void* buffer, size_t size)
+{
+   size_t offset = 0;
+
+   while (offset < size)
+   {
+      ssize_t r = read(fd, (char*)buffer + offset, size - offset);
+
+      if (r < 0 && errno == EINTR)
+      {
+         continue;
+      }
+      if (r <= 0)
+      {
+         return 1;
+      }
+
+      offset += r;
+   }
+
+   return 0;
+}
+
+static int
+walload_write(int fd, void* buffer, size_t size)
+{
+   size_t offset = 0;
+
+   while (offset < size)
+   {
+      ssize_t w = write(fd, (char*)buffer + offset, size - offset);
+
+      if (w < 0 && errno == EINTR)
+      {
+         continue;
+      }
+      if (w <= 0)
+      {
+         return 1;
+      }
+
+      offset += w;
+   }
+
+   return 0;
+}
+
+static int
+walload_read_message(int fd, char* kind, char* buffer, size_t* size)
+{
+   char header[5];
+   int32_t length;
+
+   if (walload_read(fd, &header[0], sizeof(header)))
+   {
+      return 1;
+   }
+
+   *kind = header[0];
+   length = pgmoneta_read_int32(&header[1]);
+   if (length < 4 || (size_t)length - 4 > WALLOAD_MAX_MESSAGE)
+   {
+      return 1;
+   }
+
+   *size = length - 4;
+
+   return walload_read(fd, buffer, *size);
+}
+
+static int
+walload_send(int fd, char kind, void* payload, size_t size)
+{
+   char header[5];
+
+   header[0] = kind;
+   pgmoneta_write_int32(&header[1], (int32_t)(size + 4));
+
+   if (walload_write(fd, &header[0], sizeof(header)))
+   {
+      return 1;
+   }
+
+   return size > 0 ? walload_write(fd, payload, size) : 0;
+}
+
+static int
+walload_ready(int fd)
+{
+   char idle = 'I';
+
+   return walload_send(fd, 'Z', &idle, 1);
+}
+
+static int
+walload_result(int fd, char** names, char** values, int columns)
+{
+   char buffer[4096];
+   size_t offset = 2;
+
+   /* RowDescription with text columns */
+   pgmoneta_write_int16(&buffer[0], columns);
+   for (int i = 0; i < columns; i++)
+   {
+      size_t l = strlen(names[i]) + 1;
+
+      memcpy(&buffer[offset], names[i], l);
+      offset += l;
+      pgmoneta_write_int32(&buffer[offset], 0);
+      pgmoneta_write_int16(&buffer[offset + 4], 0);
+      pgmoneta_write_int32(&buffer[offset + 6], 25);
+      pgmoneta_write_int16(&buffer[offset + 10], -1);
+      pgmoneta_write_int32(&buffer[offset + 12], -1);
+      pgmoneta_write_int16(&buffer[offset + 16], 0);
+      offset += 18;
+   }
+
+   if (walload_send(fd, 'T', &buffer[0], offset))
+   {
+      return 1;
+   }
+
+   if (values != NULL)
+   {
+      offset = 2;
+      pgmoneta_write_int16(&buffer[0], columns);
+      for (int i = 0; i < columns; i++)
+      {
+         if (values[i] == NULL)
+         {
+            pgmoneta_write_int32(&buffer[offset], -1);
+            offset += 4;
+         }
+         else
+         {
+            size_t l = strlen(values[i]);
+
+            pgmoneta_write_int32(&buffer[offset], (int32_t)l);
+            memcpy(&buffer[offset + 4], values[i], l);
+            offset += 4 + l;
+         }
+      }
+
+      if (walload_send(fd, 'D', &buffer[0], offset))
+      {
+         return 1;
+      }
+   }
+
+   memset(&buffer[0], 0, sizeof(buffer));
+   snprintf(&buffer[0], sizeof(buffer), "SELECT %d", values != NULL ? 1 : 0);
+   if (walload_send(fd, 'C', &buffer[0], strlen(&buffer[0]) + 1))
+   {
+      return 1;
+   }
+
+   return walload_ready(fd);
+}
+
+static int
+walload_error(int fd, char* message)
+{
+   char buffer[1024];
+   size_t offset = 0;
+
+   offset += snprintf(&buffer[offset], sizeof(buffer) - 1, "SERROR%cC0A000%cM%s", '\0', '\0', message) + 1;
+   buffer[offset++] = '\0';
+
+   if (walload_send(fd, 'E', &buffer[0], offset))
+   {
+      return 1;
+   }
+
+   return walload_ready(fd);
+}
+
+static int
+walload_query(int fd, char* query, struct walload_options* options)
+{
+   char lsn[MISC_LENGTH];
+   uint32_t hi;
+   uint32_t lo;
+   char* p;
+
+   snprintf(&lsn[0], sizeof(lsn), "%X/%X", (uint32_t)(WALLOAD_START_LSN >> 32), (uint32_t)WALLOAD_START_LSN);
+
+   if (pgmoneta_starts_with(query, "SHOW "))
+   {
+      char* name = query + 5;
+      char* value = "";
+
+      if (pgmoneta_starts_with(name, "wal_level"))
+      {
+         value = "replica";
+      }
+      else if (pgmoneta_starts_with(name, "data_checksums"))
+      {
+         value = "on";
+      }
+      else if (pgmoneta_starts_with(name, "wal_segment_size"))
+      {
+         value = "16MB";
+      }
+      else if (pgmoneta_starts_with(name, "segment_size"))
+      {
+         value = "1GB";
+      }
+      else if (pgmoneta_starts_with(name, "block_size"))
+      {
+         value = "8192";
+      }
+      else if (pgmoneta_starts_with(name, "summarize_wal"))
+      {
+         value = "off";
+      }
+
+      return walload_result(fd, (char*[]){name}, (char*[]){value}, 1);
+   }
+   else if (pgmoneta_starts_with(query, "IDENTIFY_SYSTEM"))
+   {
+      return walload_result(fd, (char*[]){"systemid", "timeline", "xlogpos", "dbname"},
+                            (char*[]){"7000000000000000000", "1", &lsn[0], NULL}, 4);
+   }
+   else if (pgmoneta_starts_with(query, "READ_REPLICATION_SLOT"))
+   {
+      return walload_result(fd, (char*[]){"slot_type", "restart_lsn", "restart_tli"},
+                            (char*[]){"physical", &lsn[0], "1"}, 3);
+   }
+   else if (pgmoneta_starts_with(query, "START_REPLICATION"))
+   {
+      p = strstr(query, "PHYSICAL ");
+      if (p == NULL || sscanf(p + 9, "%X/%X", &hi, &lo) != 2)
+      {
+         return walload_error(fd, "invalid START_REPLICATION");
+      }
+
+      return walload_stream(fd, ((uint64_t)hi << 32) | lo, options);
+   }
+   else if (strstr(query, "pg_replication_slots") != NULL)
+   {
+      return walload_result(fd, (char*[]){"slot_name", "slot_type"}, (char*[]){"repl", "physical"}, 2);
+   }
+
+   /* The catalogs and the extension are empty */
+   return walload_result(fd, (char*[]){"?column?"}, NULL, 1);
+}
+
+static int
+walload_stream(int fd, uint64_t lsn, struct walload_options* options)
+{
+   char* message = NULL;
+   char buffer[WALLOAD_MAX_MESSAGE];
+   char copy_both[3];
+   char kind;
+   size_t size;
+   size_t chunk;
+   size_t offset;
+   uint64_t interval_sent = 0;
+   double start;
+   double interval;
+   double next_keepalive;
+   double now;
+   struct pollfd pfd;
+   struct walload_stream* stream = NULL;
+
+   stream = (struct walload_stream*)calloc(1, sizeof(struct walload_stream));
+   message = (char*)malloc(options->message_size + 25);
+   if (stream == NULL || message == NULL)
+   {
+      goto error;
+   }
+
+   /* CopyBothResponse, text format without columns */
+   memset(&copy_both[0], 0, sizeof(copy_both));
+   if (walload_send(fd, 'W', &copy_both[0], sizeof(copy_both)))
+   {
+      goto error;
+   }
+
+   stream->start_lsn = lsn;
+   stream->sent_lsn = lsn;
+   stream->written_lsn = lsn;
+   stream->flushed_lsn = lsn;
+
+   start = walload_now();
+   interval = start;
+   next_keepalive = start + 1;
+   stream->last_report = start;
+
+   printf("%8s %10s %10s %12s %12s %10s %10s %10s\n", "Seconds", "Sent MB/s", "Flush MB/s", "Lag (kB)",
+          "Report (ms)", "p50 (ms)", "p99 (ms)", "Reports");
+   fflush(stdout);
+
+   pfd.fd = fd;
+   pfd.events = POLLIN;
+
+   while (running)
+   {
+      now = walload_now();
+
+      if (options->duration > 0 && now - start >= options->duration)
+      {
+         break;
+      }
+
+      /* The status reports of pgmoneta */
+      while (poll(&pfd, 1, 0) > 0)
+      {
+         if (!(pfd.revents & POLLIN) || walload_read_message(fd, &kind, &buffer[0], &size))
+         {
+            goto done;
+         }
+
+         if (kind == 'd' && size > 0 && buffer[0] == 'r')
+         {
+            walload_status(stream, &buffer[0], size);
+         }
+         else if (kind == 'c' || kind == 'X')
+         {
+            goto done;
+         }
+      }
+
+      if (now - interval >= 1)
+      {
+         walload_interval(stream, now - interval, interval_sent);
+         interval = now;
+         interval_sent = 0;
+      }
+
+      if (now >= next_keepalive)
+      {
+         /* Keepalive asking for a reply */
+         message[0] = 'k';
+         pgmoneta_write_int64(&message[1], (int64_t)stream->sent_lsn);
+         pgmoneta_write_int64(&message[9], walload_timestamp());
+         message[17] = 1;
+
+         if (walload_send(fd, 'd', message, 18))
+         {
+            goto done;
+         }
+
+         next_keepalive = now + 1;
+      }
+
+      /* The rate limit, or a short sleep when too much is in flight */
+      if ((options->rate > 0 && (double)(stream->sent_lsn - stream->start_lsn) / (1024 * 1024) > options->rate * (now - start)) ||
+          stream->pending_count == WALLOAD_MAX_PENDING)
+      {
+         usleep(1000);
+         continue;
+      }
+
+      /* XLogData, never crossing a segment */
+      offset = (size_t)(stream->sent_lsn % options->data_size);
+      chunk = MIN(options->message_size, WALLOAD_SEGMENT_SIZE - (stream->sent_lsn % WALLOAD_SEGMENT_SIZE));
+
+      message[0] = 'w';
+      pgmoneta_write_int64(&message[1], (int64_t)stream->sent_lsn);
+      pgmoneta_write_int64(&message[9], (int64_t)(stream->sent_lsn + chunk));
+      pgmoneta_write_int64(&message[17], walload_timestamp());
+      memcpy(&message[25], options->data + offset, chunk);
+
+      if (walload_send(fd, 'd', message, chunk + 25))
+      {
+         goto done;
+      }
+
+      stream->sent_lsn += chunk;
+      interval_sent += chunk;
+
+      stream->pending[(stream->pending_head + stream->pending_count) % WALLOAD_MAX_PENDING].lsn = stream->sent_lsn;
+      stream->pending[(stream->pending_head + stream->pending_count) % WALLOAD_MAX_PENDING].sent = walload_now();
+      stream->pending_count++;
+   }
+
+done:
+
+   now = walload_now();
+   printf("Streamed %.1f MB in %.1f s, %.1f MB/s, %.1f MB flushed\n",
+          (double)(stream->sent_lsn - stream->start_lsn) / (1024 * 1024), now - start,
+          now > start ? (double)(stream->sent_lsn - stream->start_lsn) / (1024 * 1024) / (now - start) : 0,
+          (double)(stream->flushed_lsn - stream->start_lsn) / (1024 * 1024));
+   fflush(stdout);
+
+   free(message);
+   free(stream);
+
+   /* The session ends with the stream */
+   return 1;
+
+error:
+
+   free(message);
+   free(stream);
+
+   return 1;
+}
+
+static int
+walload_status(struct walload_stream* stream, char* buffer, size_t size)
+{
+   uint64_t flushed;
+   double now;
+
+   if (size < 34)
+   {
+      return 1;
+   }
+
+   now = walload_now();
+
+   stream->written_lsn = (uint64_t)pgmoneta_read_int64(&buffer[1]);
+   flushed = (uint64_t)pgmoneta_read_int64(&buffer[9]);
+
+   if (flushed > stream->flushed_lsn)
+   {
+      stream->flushed_lsn = flushed;
+   }
+
+   /* The flush latency of every message the report covers */
+   while (stream->pending_count > 0 && stream->pending[stream->pending_head].lsn <= stream->flushed_lsn)
+   {
+      if (stream->number_of_samples < WALLOAD_MAX_SAMPLES)
+      {
+         stream->samples[stream->number_of_samples++] = now - stream->pending[stream->pending_head].sent;
+      }
+
+      stream->pending_head = (stream->pending_head + 1) % WALLOAD_MAX_PENDING;
+      stream->pending_count--;
+   }
+
+   stream->last_report = now;
+   stream->reports++;
+
+   return 0;
+}
+
+static void
+walload_interval(struct walload_stream* stream, double elapsed, uint64_t sent)
+{
+   static uint64_t previous_flushed = 0;
+   static double seconds = 0;
+   double p50 = 0;
+   double p99 = 0;
+   uint64_t flushed;
+
+   if (previous_flushed == 0)
+   {
+      previous_flushed = stream->start_lsn;
+   }
+
+   flushed = stream->flushed_lsn - previous_flushed;
+   previous_flushed = stream->flushed_lsn;
+   seconds += elapsed;
+
+   if (stream->number_of_samples > 0)
+   {
+      qsort(&stream->samples[0], stream->number_of_samples, sizeof(double), walload_compare);
+      p50 = stream->samples[(stream->number_of_samples * 50 + 99) / 100 - 1];
+      p99 = stream->samples[(stream->number_of_samples * 99 + 99) / 100 - 1];
+   }
+
+   printf("%8.0f %10.1f %10.1f %12lu %12.1f %10.2f %10.2f %10lu\n", seconds,
+          (double)sent / (1024 * 1024) / elapsed, (double)flushed / (1024 * 1024) / elapsed,
+          (unsigned long)((stream->sent_lsn - stream->flushed_lsn) / 1024), (walload_now() - stream->last_report) * 1000,
+          p50 * 1000, p99 * 1000, (unsigned long)stream->reports);
+   fflush(stdout);
+
+   stream->number_of_samples = 0;
+   stream->reports = 0;
+}
+
+static int
+walload_compare(const void* a, const void* b)
+{
+   double x = *(const double*)a;
+   double y = *(const double*)b;
+
+   return (x > y) - (x < y);
+}
+
+static int64_t
+walload_timestamp(void)
+{
+   struct timespec now;
+
+   clock_gettime(CLOCK_REALTIME, &now);
+
+   return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000 - WALLOAD_EPOCH_OFFSET;
+}
+
+static double
+walload_now(void)
+{
+   struct timespec now;
+
+#ifdef HAVE_FREEBSD
+   clock_gettime(CLOCK_MONOTONIC_FAST, &now);
+#else
+   clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+#endif
+
+   return now.tv_sec + now.tv_nsec / 1e9;
+}